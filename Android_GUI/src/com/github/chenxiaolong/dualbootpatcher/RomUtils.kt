@@ -269,26 +269,15 @@ object RomUtils {
                 return CacheWallpaperResult.FAILED
             }
 
-            // Read file into memory
-            val data = ByteArray(sb.st_size.toInt())
-            var nWritten = 0
-            while (nWritten < data.size) {
-                val newData = iface.fileRead(id, 10240)
-
-                val nRead = newData.limit() - newData.position()
-                newData.get(data, nWritten, nRead)
-                nWritten += nRead
-            }
-
-            iface.fileClose(id)
-            id = -1
-
             FileOutputStream(wallpaperCacheFile).use { fos ->
                 // Compression can be very slow (more than 10 seconds) for a large wallpaper, so
                 // we'll just cache the actual file instead
-                fos.write(data)
+                iface.fileStreamRead(id, sb.st_size, fos)
             }
 
+            iface.fileClose(id)
+            id = -1
+
             // Load into bitmap
             //Bitmap bitmap = BitmapFactory.decodeByteArray(data, 0, data.length)
             //if (bitmap == null) {
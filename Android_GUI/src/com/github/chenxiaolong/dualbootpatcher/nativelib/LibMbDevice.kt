@@ -21,13 +21,17 @@ import android.os.Parcel
 import android.os.Parcelable
 
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CDevice
+import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CDeviceSummary
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CJsonError
 import com.sun.jna.IntegerType
+import com.sun.jna.Memory
 import com.sun.jna.Native
 import com.sun.jna.Pointer
 import com.sun.jna.PointerType
 import com.sun.jna.StringArray
+import com.sun.jna.Structure
 
+import java.util.Arrays
 import java.util.HashMap
 
 // NOTE: Almost no checking of parameters is performed on both the Java and C side of this native
@@ -48,6 +52,24 @@ object LibMbDevice {
 
         class CJsonError : PointerType()
 
+        class CDeviceSummary : Structure {
+            @JvmField var id: Pointer? /* const char * */ = null
+            @JvmField var name: Pointer? /* const char * */ = null
+            @JvmField var architecture: Pointer? /* const char * */ = null
+            @JvmField var flags: Int /* uint32_t */ = 0
+            @JvmField var tw_supported: Byte /* bool */ = 0
+
+            constructor()
+
+            constructor(p: Pointer) : super(p) {
+                read()
+            }
+
+            override fun getFieldOrder(): List<String> {
+                return Arrays.asList("id", "name", "architecture", "flags", "tw_supported")
+            }
+        }
+
         class SizeT @JvmOverloads constructor(value: Long = 0)
                 : IntegerType(Native.SIZE_T_SIZE, value, true) {
             override fun toByte(): Byte {
@@ -74,6 +96,8 @@ object LibMbDevice {
         external fun mb_device_id(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_id(device: CDevice, id: String?)
+        @JvmStatic
+        external fun mb_device_id_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_codenames(device: CDevice): Pointer? /* char ** */
@@ -84,11 +108,15 @@ object LibMbDevice {
         external fun mb_device_name(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_name(device: CDevice, name: String?)
+        @JvmStatic
+        external fun mb_device_name_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_architecture(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_architecture(device: CDevice, architecture: String?)
+        @JvmStatic
+        external fun mb_device_architecture_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_flags(device: CDevice): Int /* uint32_t */
@@ -172,11 +200,15 @@ object LibMbDevice {
         external fun mb_device_tw_brightness_path(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_brightness_path(device: CDevice, path: String?)
+        @JvmStatic
+        external fun mb_device_tw_brightness_path_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_secondary_brightness_path(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_secondary_brightness_path(device: CDevice, path: String?)
+        @JvmStatic
+        external fun mb_device_tw_secondary_brightness_path_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_max_brightness(device: CDevice): Int
@@ -192,21 +224,29 @@ object LibMbDevice {
         external fun mb_device_tw_battery_path(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_battery_path(device: CDevice, path: String?)
+        @JvmStatic
+        external fun mb_device_tw_battery_path_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_cpu_temp_path(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_cpu_temp_path(device: CDevice, path: String?)
+        @JvmStatic
+        external fun mb_device_tw_cpu_temp_path_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_input_blacklist(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_input_blacklist(device: CDevice, blacklist: String?)
+        @JvmStatic
+        external fun mb_device_tw_input_blacklist_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_input_whitelist(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_input_whitelist(device: CDevice, whitelist: String?)
+        @JvmStatic
+        external fun mb_device_tw_input_whitelist_ref(device: CDevice): String? /* const char * */
 
         @JvmStatic
         external fun mb_device_tw_graphics_backends(device: CDevice): Pointer? /* char ** */
@@ -217,6 +257,8 @@ object LibMbDevice {
         external fun mb_device_tw_theme(device: CDevice): Pointer? /* char * */
         @JvmStatic
         external fun mb_device_set_tw_theme(device: CDevice, theme: String?)
+        @JvmStatic
+        external fun mb_device_tw_theme_ref(device: CDevice): String? /* const char * */
 
         /* Other */
 
@@ -225,6 +267,10 @@ object LibMbDevice {
 
         @JvmStatic
         external fun mb_device_equals(a: CDevice, b: CDevice): Boolean
+
+        @JvmStatic
+        external fun mb_device_summaries(devices: Pointer /* const CDevice * const * */,
+                                         count: SizeT, summaries: Pointer /* CDeviceSummary * */)
         // END: device.h
 
         // BEGIN: json.h
@@ -338,16 +384,24 @@ object LibMbDevice {
         }
     }
 
+    /**
+     * Fields of a [Device] that are needed for displaying it in a list.
+     */
+    data class DeviceSummary(
+            val id: String,
+            val name: String,
+            val architecture: String,
+            val flags: Int,
+            val isTwSupported: Boolean
+    )
+
     @Suppress("unused", "MemberVisibilityCanBePrivate")
     class Device : Parcelable {
         internal var pointer: CDevice? = null
         private var destroyable: Boolean = false
 
         var id: String?
-            get() {
-                val p = CWrapper.mb_device_id(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_id_ref(pointer!!)
             set(id) = CWrapper.mb_device_set_id(pointer!!, id)
 
         var codenames: Array<String>?
@@ -358,17 +412,11 @@ object LibMbDevice {
             set(names) = CWrapper.mb_device_set_codenames(pointer!!, StringArray(names))
 
         var name: String?
-            get() {
-                val p = CWrapper.mb_device_name(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_name_ref(pointer!!)
             set(name) = CWrapper.mb_device_set_name(pointer!!, name)
 
         var architecture: String?
-            get() {
-                val p = CWrapper.mb_device_architecture(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_architecture_ref(pointer!!)
             set(arch) = CWrapper.mb_device_set_architecture(pointer!!, arch)
 
         var flags: Int
@@ -453,17 +501,11 @@ object LibMbDevice {
             set(offset) = CWrapper.mb_device_set_tw_default_y_offset(pointer!!, offset)
 
         var twBrightnessPath: String?
-            get() {
-                val p = CWrapper.mb_device_tw_brightness_path(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_brightness_path_ref(pointer!!)
             set(path) = CWrapper.mb_device_set_tw_brightness_path(pointer!!, path)
 
         var twSecondaryBrightnessPath: String?
-            get() {
-                val p = CWrapper.mb_device_tw_secondary_brightness_path(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_secondary_brightness_path_ref(pointer!!)
             set(path) = CWrapper.mb_device_set_tw_secondary_brightness_path(pointer!!, path)
 
         var twMaxBrightness: Int
@@ -475,31 +517,19 @@ object LibMbDevice {
             set(brightness) = CWrapper.mb_device_set_tw_default_brightness(pointer!!, brightness)
 
         var twBatteryPath: String?
-            get() {
-                val p = CWrapper.mb_device_tw_battery_path(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_battery_path_ref(pointer!!)
             set(path) = CWrapper.mb_device_set_tw_battery_path(pointer!!, path)
 
         var twCpuTempPath: String?
-            get() {
-                val p = CWrapper.mb_device_tw_cpu_temp_path(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_cpu_temp_path_ref(pointer!!)
             set(path) = CWrapper.mb_device_set_tw_cpu_temp_path(pointer!!, path)
 
         var twInputBlacklist: String?
-            get() {
-                val p = CWrapper.mb_device_tw_input_blacklist(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_input_blacklist_ref(pointer!!)
             set(blacklist) = CWrapper.mb_device_set_tw_input_blacklist(pointer!!, blacklist)
 
         var twInputWhitelist: String?
-            get() {
-                val p = CWrapper.mb_device_tw_input_whitelist(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_input_whitelist_ref(pointer!!)
             set(whitelist) = CWrapper.mb_device_set_tw_input_whitelist(pointer!!, whitelist)
 
         var twGraphicsBackends: Array<String>?
@@ -510,10 +540,7 @@ object LibMbDevice {
             set(backends) = CWrapper.mb_device_set_tw_graphics_backends(pointer!!, StringArray(backends))
 
         var twTheme: String?
-            get() {
-                val p = CWrapper.mb_device_tw_theme(pointer!!) ?: return null
-                return LibC.getStringAndFree(p)
-            }
+            get() = CWrapper.mb_device_tw_theme_ref(pointer!!)
             set(theme) = CWrapper.mb_device_set_tw_theme(pointer!!, theme)
 
         constructor() {
@@ -638,6 +665,33 @@ object LibMbDevice {
                 LibC.free(p)
                 return devices.toTypedArray()
             }
+
+            /**
+             * Get the summaries of many devices with a single native call.
+             */
+            fun summaries(devices: List<Device>): List<DeviceSummary> {
+                if (devices.isEmpty()) {
+                    return emptyList()
+                }
+
+                val pointerSize = Native.POINTER_SIZE.toLong()
+                val cDevices = Memory(pointerSize * devices.size)
+                devices.forEachIndexed { i, device ->
+                    cDevices.setPointer(pointerSize * i, device.pointer!!.pointer)
+                }
+
+                val summarySize = CDeviceSummary().size().toLong()
+                val cSummaries = Memory(summarySize * devices.size)
+
+                CWrapper.mb_device_summaries(cDevices, CWrapper.SizeT(devices.size.toLong()),
+                        cSummaries)
+
+                return devices.indices.map { i ->
+                    val s = CDeviceSummary(cSummaries.share(summarySize * i))
+                    DeviceSummary(s.id!!.getString(0), s.name!!.getString(0),
+                            s.architecture!!.getString(0), s.flags, s.tw_supported.toInt() != 0)
+                }
+            }
         }
     }
 }
@@ -69,10 +69,14 @@ object LibMbPatcher {
         @JvmStatic
         external fun mbpatcher_fileinfo_set_input_path(info: CFileInfo, path: String?)
         @JvmStatic
+        external fun mbpatcher_fileinfo_input_path_ref(info: CFileInfo): String? /* const char * */
+        @JvmStatic
         external fun mbpatcher_fileinfo_output_path(info: CFileInfo): Pointer?
         @JvmStatic
         external fun mbpatcher_fileinfo_set_output_path(info: CFileInfo, path: String?)
         @JvmStatic
+        external fun mbpatcher_fileinfo_output_path_ref(info: CFileInfo): String? /* const char * */
+        @JvmStatic
         external fun mbpatcher_fileinfo_device(info: CFileInfo): CDevice?
         @JvmStatic
         external fun mbpatcher_fileinfo_set_device(info: CFileInfo, device: CDevice?)
@@ -80,6 +84,8 @@ object LibMbPatcher {
         external fun mbpatcher_fileinfo_rom_id(info: CFileInfo): Pointer?
         @JvmStatic
         external fun mbpatcher_fileinfo_set_rom_id(info: CFileInfo, id: String?)
+        @JvmStatic
+        external fun mbpatcher_fileinfo_rom_id_ref(info: CFileInfo): String? /* const char * */
         // END: cfileinfo.h
 
         // BEGIN: cpatcherconfig.h
@@ -92,6 +98,8 @@ object LibMbPatcher {
         @JvmStatic
         external fun mbpatcher_config_data_directory(pc: CPatcherConfig): Pointer
         @JvmStatic
+        external fun mbpatcher_config_data_directory_ref(pc: CPatcherConfig): String /* const char * */
+        @JvmStatic
         external fun mbpatcher_config_temp_directory(pc: CPatcherConfig): Pointer
         @JvmStatic
         external fun mbpatcher_config_set_data_directory(pc: CPatcherConfig, path: String)
@@ -241,8 +249,7 @@ object LibMbPatcher {
         var inputPath: String?
             get() {
                 validate(cFileInfo, FileInfo::class.java, "getInputPath")
-                val p = CWrapper.mbpatcher_fileinfo_input_path(cFileInfo!!) ?: return null
-                return LibC.getStringAndFree(p)
+                return CWrapper.mbpatcher_fileinfo_input_path_ref(cFileInfo!!)
             }
             set(path) {
                 validate(cFileInfo, FileInfo::class.java, "setInputPath", path)
@@ -252,8 +259,7 @@ object LibMbPatcher {
         var outputPath: String?
             get() {
                 validate(cFileInfo, FileInfo::class.java, "getOutputPath")
-                val p = CWrapper.mbpatcher_fileinfo_output_path(cFileInfo!!) ?: return null
-                return LibC.getStringAndFree(p)
+                return CWrapper.mbpatcher_fileinfo_output_path_ref(cFileInfo!!)
             }
             set(path) {
                 validate(cFileInfo, FileInfo::class.java, "setOutputPath", path)
@@ -274,8 +280,7 @@ object LibMbPatcher {
         var romId: String?
             get() {
                 validate(cFileInfo, FileInfo::class.java, "getRomId")
-                val p = CWrapper.mbpatcher_fileinfo_rom_id(cFileInfo!!) ?: return null
-                return LibC.getStringAndFree(p)
+                return CWrapper.mbpatcher_fileinfo_rom_id_ref(cFileInfo!!)
             }
             set(id) {
                 validate(cFileInfo, FileInfo::class.java, "setRomId", id)
@@ -375,8 +380,7 @@ object LibMbPatcher {
         var dataDirectory: String
             get() {
                 validate(cPatcherConfig, PatcherConfig::class.java, "getDataDirectory")
-                val p = CWrapper.mbpatcher_config_data_directory(cPatcherConfig!!)
-                return LibC.getStringAndFree(p)
+                return CWrapper.mbpatcher_config_data_directory_ref(cPatcherConfig!!)
             }
             set(path) {
                 validate(cPatcherConfig, PatcherConfig::class.java, "setDataDirectory", path)
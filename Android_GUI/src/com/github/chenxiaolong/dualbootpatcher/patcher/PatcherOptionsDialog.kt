@@ -257,7 +257,7 @@ class PatcherOptionsDialog : DialogFragment() {
     private fun refreshDevices(devices: List<Device>, currentDevice: Device?) {
         deviceAdapter.setNotifyOnChange(false)
         deviceAdapter.clear()
-        deviceAdapter.addAll(devices.map { "${it.id} - ${it.name}" })
+        deviceAdapter.addAll(Device.summaries(devices).map { "${it.id} - ${it.name}" })
         deviceAdapter.notifyDataSetChanged()
 
         // Select initial device
@@ -70,7 +70,7 @@ constructor(context: Context) : Closeable {
         initRequestInterface(socketIS!!, socketOS!!, PROTOCOL_VERSION)
 
         // Set up interface
-        `interface` = createInterface(socketIS!!, socketOS!!, PROTOCOL_VERSION)
+        `interface` = createInterface(socket!!, socketIS!!, socketOS!!, PROTOCOL_VERSION)
 
         // Check version
         initVerifyVersion(`interface`!!, MbtoolUtils.getMinimumRequiredVersion(Feature.DAEMON))
@@ -227,10 +227,10 @@ constructor(context: Context) : Closeable {
             }
         }
 
-        private fun createInterface(`is`: InputStream, os: OutputStream, version: Int):
-                MbtoolInterface? {
+        private fun createInterface(socket: LocalSocket, `is`: InputStream, os: OutputStream,
+                                    version: Int): MbtoolInterface? {
             return when (version) {
-                3 -> MbtoolInterfaceV3(`is`, os)
+                3 -> MbtoolInterfaceV3(socket, `is`, os)
                 else -> null
             }
         }
@@ -345,7 +345,7 @@ constructor(context: Context) : Closeable {
                         initRequestInterface(socketIS, socketOS, i)
 
                         // Create interface
-                        val iface = createInterface(socketIS, socketOS, i)
+                        val iface = createInterface(socket, socketIS, socketOS, i)
                                 ?: throw IllegalStateException("Failed to create interface for version: $i")
 
                         // Use signed exec to replace mbtool. This purposely sets argv[0] to "mbtool" and
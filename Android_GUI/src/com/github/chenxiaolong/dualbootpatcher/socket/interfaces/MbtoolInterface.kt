@@ -18,6 +18,7 @@
 package com.github.chenxiaolong.dualbootpatcher.socket.interfaces
 
 import android.content.Context
+import android.os.ParcelFileDescriptor
 
 import com.github.chenxiaolong.dualbootpatcher.RomUtils.RomInformation
 import com.github.chenxiaolong.dualbootpatcher.Version
@@ -25,6 +26,8 @@ import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolCommandEx
 import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolException
 
 import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
 import java.nio.ByteBuffer
 
 import mbtool.daemon.v3.FileOpenFlag
@@ -32,6 +35,14 @@ import mbtool.daemon.v3.FileSeekWhence
 import mbtool.daemon.v3.PathDeleteFlag
 
 interface MbtoolInterface {
+    /**
+     * Scheduling class that the daemon runs subsequent requests under.
+     *
+     * One of the [mbtool.daemon.v3.SchedPolicy] constants. Child processes spawned by a request
+     * (eg. [signedExec]) inherit the policy.
+     */
+    var schedPolicy: Short
+
     /**
      * Change the mode of an opened file.
      *
@@ -71,6 +82,23 @@ interface MbtoolInterface {
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     fun fileOpen(path: String, flags: ShortArray, perms: Int): Int
 
+    /**
+     * Open a file and receive its file descriptor
+     *
+     * The file is opened by the daemon, but unlike [fileOpen], the descriptor is passed to the
+     * app so that it can be read, written, or mapped directly without going through the daemon.
+     *
+     * @param path Path to file
+     * @param flags Flags (see [FileOpenFlag])
+     * @param perms File mode (ignored unless [FileOpenFlag.CREAT] is provided)
+     * @return File descriptor owned by the caller
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun fileOpenFd(path: String, flags: ShortArray, perms: Int): ParcelFileDescriptor
+
     /**
      * Read data from an opened file
      *
@@ -114,6 +142,36 @@ interface MbtoolInterface {
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     fun fileStat(id: Int): StatBuf
 
+    /**
+     * Read an opened file in a single streaming transfer.
+     *
+     * Unlike [fileRead], the daemon sends the whole range in chunks without waiting for a request
+     * for each one.
+     *
+     * @param id File ID
+     * @param count Maximum number of bytes to read (0 to read until EOF)
+     * @param output Stream to write the data to
+     * @return Number of bytes read
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun fileStreamRead(id: Int, count: Long, output: OutputStream): Long
+
+    /**
+     * Write to an opened file in a single streaming transfer.
+     *
+     * @param id File ID
+     * @param input Stream to read the data from until EOF
+     * @return Number of bytes written
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun fileStreamWrite(id: Int, input: InputStream): Long
+
     /**
      * Write to an opened file.
      *
@@ -196,15 +254,18 @@ interface MbtoolInterface {
      *
      * @param context Application context
      * @param id ID of ROM to switch to
+     * @param listener Callback for receiving progress (or null to only get the result). The
+     *                 switch can be cancelled until the images start being flashed.
      * @return [SwitchRomResult.UNKNOWN_BOOT_PARTITION] if the boot partition could not be determined
      * [SwitchRomResult.SUCCEEDED] if the ROM was successfully switched
-     * [SwitchRomResult.FAILED] if the ROM failed to switch
+     * [SwitchRomResult.FAILED] if the ROM failed to switch or switching was cancelled
      * @throws IOException When any socket communication error occurs
      * @throws MbtoolException
      * @throws MbtoolCommandException
      */
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    fun switchRom(context: Context, id: String, forceChecksumsUpdate: Boolean): SwitchRomResult
+    fun switchRom(context: Context, id: String, forceChecksumsUpdate: Boolean,
+                  listener: OperationProgressListener?): SwitchRomResult
 
     /**
      * Set the kernel for a ROM.
@@ -215,15 +276,18 @@ interface MbtoolInterface {
      *
      * @param context Application context
      * @param id ID of ROM to set the kernel for
+     * @param listener Callback for receiving progress (or null to only get the result). The
+     *                 request can be cancelled until the image starts being written.
      * @return [SetKernelResult.UNKNOWN_BOOT_PARTITION] if the boot partition could not be determined
      * [SetKernelResult.SUCCEEDED] if setting the kernel was successful
-     * [SetKernelResult.FAILED] if setting the kernel failed
+     * [SetKernelResult.FAILED] if setting the kernel failed or was cancelled
      * @throws IOException When any socket communication error occurs
      * @throws MbtoolException
      * @throws MbtoolCommandException
      */
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    fun setKernel(context: Context, id: String): SetKernelResult
+    fun setKernel(context: Context, id: String,
+                  listener: OperationProgressListener?): SetKernelResult
 
     /**
      * Reboots the device via the framework.
@@ -360,13 +424,15 @@ interface MbtoolInterface {
      *
      * @param romId ROM ID to wipe
      * @param targets List of [mbtool.daemon.v3.MbWipeTarget]s indicating the wipe targets
+     * @param listener Callback for receiving progress (or null to only get the result)
      * @return [WipeResult] containing the list of succeeded and failed wipe targets
      * @throws IOException When any socket communication error occurs
      * @throws MbtoolException
      * @throws MbtoolCommandException
      */
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    fun wipeRom(romId: String, targets: ShortArray): WipeResult
+    fun wipeRom(romId: String, targets: ShortArray,
+                listener: OperationProgressListener?): WipeResult
 
     /**
      * Get package counts for a ROM.
@@ -412,13 +478,32 @@ interface MbtoolInterface {
      *
      * @param path Path to directory
      * @param exclusions Top level directories to exclude
+     * @param listener Callback for receiving the running total while the size is being
+     *                 calculated (or null to only get the final size)
      * @return Size of directory in bytes
      * @throws IOException
      * @throws MbtoolException
      * @throws MbtoolCommandException
      */
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    fun pathGetDirectorySize(path: String, exclusions: Array<String>?): Long
+    fun pathGetDirectorySize(path: String, exclusions: Array<String>?,
+                             listener: DirectorySizeProgressListener?): Long
+
+    /**
+     * Subscribe to daemon events.
+     *
+     * This blocks until the connection is closed (eg. by closing the [MbtoolConnection] from
+     * another thread, which causes an [IOException] to be thrown). No other requests can be made
+     * on this interface afterwards.
+     *
+     * @param events [mbtool.daemon.v3.EventType] values to subscribe to (or null for all events)
+     * @param listener Callback for receiving events
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun eventSubscribe(events: ShortArray?, listener: DaemonEventListener)
 
     /**
      * Run signed executable.
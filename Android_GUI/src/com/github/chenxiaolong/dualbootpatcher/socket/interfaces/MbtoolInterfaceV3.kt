@@ -18,6 +18,10 @@
 package com.github.chenxiaolong.dualbootpatcher.socket.interfaces
 
 import android.content.Context
+import android.net.LocalSocket
+import android.os.Build
+import android.os.ParcelFileDescriptor
+import android.system.Os
 import android.util.Log
 import com.github.chenxiaolong.dualbootpatcher.RomUtils.RomInformation
 import com.github.chenxiaolong.dualbootpatcher.ThreadUtils
@@ -31,24 +35,33 @@ import com.github.chenxiaolong.dualbootpatcher.switcher.SwitcherUtils
 import com.google.flatbuffers.FlatBufferBuilder
 import com.google.flatbuffers.Table
 import mbtool.daemon.v3.*
+import java.io.EOFException
+import java.io.FileInputStream
 import java.io.IOException
 import java.io.InputStream
 import java.io.OutputStream
 import java.nio.ByteBuffer
+import java.nio.channels.FileChannel
 
 class MbtoolInterfaceV3(
+        private val socket: LocalSocket,
         private val sis: InputStream,
         private val sos: OutputStream
 ) : MbtoolInterface {
+    override var schedPolicy: Short = SchedPolicy.DEFAULT
+
     @Throws(MbtoolException::class)
     private fun getTableFromResponse(response: Response): Table {
         var table: Table? = when (response.responseType()) {
             ResponseType.FileChmodResponse -> FileChmodResponse()
             ResponseType.FileCloseResponse -> FileCloseResponse()
             ResponseType.FileOpenResponse -> FileOpenResponse()
+            ResponseType.FileOpenFdResponse -> FileOpenFdResponse()
             ResponseType.FileReadResponse -> FileReadResponse()
             ResponseType.FileSeekResponse -> FileSeekResponse()
             ResponseType.FileStatResponse -> FileStatResponse()
+            ResponseType.FileStreamReadResponse -> FileStreamReadResponse()
+            ResponseType.FileStreamWriteResponse -> FileStreamWriteResponse()
             ResponseType.FileWriteResponse -> FileWriteResponse()
             ResponseType.FileSELinuxGetLabelResponse -> FileSELinuxGetLabelResponse()
             ResponseType.FileSELinuxSetLabelResponse -> FileSELinuxSetLabelResponse()
@@ -71,6 +84,10 @@ class MbtoolInterfaceV3(
             ResponseType.MbGetPackagesCountResponse -> MbGetPackagesCountResponse()
             ResponseType.RebootResponse -> RebootResponse()
             ResponseType.ShutdownResponse -> ShutdownResponse()
+            ResponseType.EventSubscribeResponse -> EventSubscribeResponse()
+            ResponseType.EventNotificationResponse -> EventNotificationResponse()
+            ResponseType.OperationProgressResponse -> OperationProgressResponse()
+            ResponseType.OperationCancelResponse -> OperationCancelResponse()
             else -> throw MbtoolException(Reason.PROTOCOL_ERROR,
                     "Unknown response type: ${response.responseType()}")
         }
@@ -94,16 +111,120 @@ class MbtoolInterfaceV3(
         Request.startRequest(builder)
         Request.addRequestType(builder, fbRequestType)
         Request.addRequest(builder, fbRequest)
+        Request.addSchedPolicy(builder, schedPolicy)
+        // Large responses can be mapped from a memfd instead of being read from the socket
+        Request.addAllowMemfd(builder, true)
         builder.finish(Request.endRequest(builder))
 
         // Send request to daemon
         SocketUtils.writeBytes(sos, builder.sizedByteArray())
 
+        return receiveResponse(fbRequestType, expected)
+    }
+
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    private fun receiveResponse(fbRequestType: Byte, expected: Byte): Table {
         // Read response back as table
         val responseBytes = SocketUtils.readBytes(sis)
-        val bb = ByteBuffer.wrap(responseBytes)
-        val response = Response.getRootAsResponse(bb)
+        var response = Response.getRootAsResponse(ByteBuffer.wrap(responseBytes))
+
+        if (response.memfd()) {
+            response = Response.getRootAsResponse(receiveMemfd())
+        }
+
+        return checkResponse(response, fbRequestType, expected)
+    }
+
+    /**
+     * Map the sealed memfd that follows a response with the memfd field set.
+     *
+     * The mapping stays valid after the descriptor is closed and is released when the returned
+     * buffer is garbage collected.
+     */
+    @Throws(IOException::class, MbtoolException::class)
+    private fun receiveMemfd(): ByteBuffer {
+        // The descriptor is attached to a single dummy byte following the response
+        if (sis.read() < 0) {
+            throw EOFException()
+        }
+
+        val fds = socket.ancillaryFileDescriptors
+        if (fds == null || fds.size != 1) {
+            throw MbtoolException(Reason.PROTOCOL_ERROR,
+                    "Expected 1 file descriptor, but received ${fds?.size ?: 0}")
+        }
+
+        FileInputStream(fds[0]).use {
+            val channel = it.channel
+            return channel.map(FileChannel.MapMode.READ_ONLY, 0, channel.size())
+        }
+    }
+
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    private fun sendRequestWithProgress(builder: FlatBufferBuilder, fbRequest: Int,
+                                        fbRequestType: Byte, expected: Byte,
+                                        listener: OperationProgressListener?): Table {
+        ThreadUtils.enforceExecutionOnNonMainThread()
+
+        // Build request table
+        Request.startRequest(builder)
+        Request.addRequestType(builder, fbRequestType)
+        Request.addRequest(builder, fbRequest)
+        Request.addSchedPolicy(builder, schedPolicy)
+        builder.finish(Request.endRequest(builder))
+
+        // Send request to daemon
+        SocketUtils.writeBytes(sos, builder.sizedByteArray())
+
+        // Daemons that don't support progress reporting just send the final response
+        var cancelSent = false
+        var root: Response
+        while (true) {
+            val responseBytes = SocketUtils.readBytes(sis)
+            root = Response.getRootAsResponse(ByteBuffer.wrap(responseBytes))
+
+            if (root.responseType() != ResponseType.OperationProgressResponse) {
+                break
+            }
+
+            val progress = root.response(OperationProgressResponse())
+                    as OperationProgressResponse?
+                    ?: throw MbtoolException(Reason.PROTOCOL_ERROR, "Invalid union data")
+
+            if (listener != null
+                    && !listener.onOperationProgress(
+                            progress.files(), progress.bytes(), progress.path())
+                    && !cancelSent) {
+                // The daemon reads this while the operation is running and replies to it
+                // after the operation's final response
+                val cancelBuilder = FlatBufferBuilder(FBB_SIZE)
+                OperationCancelRequest.startOperationCancelRequest(cancelBuilder)
+                val fbCancelRequest = OperationCancelRequest.endOperationCancelRequest(
+                        cancelBuilder)
+                Request.startRequest(cancelBuilder)
+                Request.addRequestType(cancelBuilder, RequestType.OperationCancelRequest)
+                Request.addRequest(cancelBuilder, fbCancelRequest)
+                cancelBuilder.finish(Request.endRequest(cancelBuilder))
+
+                SocketUtils.writeBytes(sos, cancelBuilder.sizedByteArray())
+                cancelSent = true
+            }
+        }
+
+        val table = checkResponse(root, fbRequestType, expected)
 
+        if (cancelSent) {
+            receiveResponse(RequestType.OperationCancelRequest,
+                    ResponseType.OperationCancelResponse)
+        }
+
+        return table
+    }
+
+    @Throws(MbtoolException::class, MbtoolCommandException::class)
+    private fun checkResponse(response: Response, fbRequestType: Byte, expected: Byte): Table {
         when {
             response.responseType() == ResponseType.Unsupported -> throw MbtoolCommandException(
                     "Daemon does not support request type: $fbRequestType")
@@ -187,6 +308,50 @@ class MbtoolInterfaceV3(
         return response.id()
     }
 
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun fileOpenFd(path: String, flags: ShortArray, perms: Int): ParcelFileDescriptor {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+
+        val fbPath = builder.createString(path)
+        val fbFlags = FileOpenFdRequest.createFlagsVector(builder, flags)
+
+        FileOpenFdRequest.startFileOpenFdRequest(builder)
+        FileOpenFdRequest.addPath(builder, fbPath)
+        FileOpenFdRequest.addFlags(builder, fbFlags)
+        FileOpenFdRequest.addPerms(builder, perms.toLong())
+        val fbRequest = FileOpenFdRequest.endFileOpenFdRequest(builder)
+
+        // Send request
+        val response = sendRequest(builder, fbRequest, RequestType.FileOpenFdRequest,
+                ResponseType.FileOpenFdResponse) as FileOpenFdResponse
+
+        val error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$path]: open failed: ${error.msg()}")
+        }
+
+        // The descriptor is attached to a single dummy byte following the response
+        if (sis.read() < 0) {
+            throw EOFException()
+        }
+
+        val fds = socket.ancillaryFileDescriptors
+        if (fds == null || fds.size != 1) {
+            throw MbtoolException(Reason.PROTOCOL_ERROR,
+                    "Expected 1 file descriptor, but received ${fds?.size ?: 0}")
+        }
+
+        val pfd = ParcelFileDescriptor.dup(fds[0])
+        // There is no public API for closing a FileDescriptor before Lollipop
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.LOLLIPOP) {
+            Os.close(fds[0])
+        }
+        return pfd
+    }
+
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     override fun fileRead(id: Int, size: Long): ByteBuffer {
@@ -271,6 +436,115 @@ class MbtoolInterfaceV3(
         return sb
     }
 
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun fileStreamRead(id: Int, count: Long, output: OutputStream): Long {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+        FileStreamReadRequest.startFileStreamReadRequest(builder)
+        FileStreamReadRequest.addId(builder, id)
+        FileStreamReadRequest.addCount(builder, count)
+        val fbRequest = FileStreamReadRequest.endFileStreamReadRequest(builder)
+
+        // Send request and wait for the daemon to accept the stream
+        sendRequest(builder, fbRequest, RequestType.FileStreamReadRequest,
+                ResponseType.FileStreamReadResponse)
+
+        // Receive chunks until the empty one. If writing to the output fails, the rest of the
+        // stream still has to be consumed to keep the connection usable.
+        var buf = ByteArray(0)
+        var outputError: IOException? = null
+
+        while (true) {
+            val size = SocketUtils.readInt32(sis)
+            if (size < 0) {
+                throw MbtoolException(Reason.PROTOCOL_ERROR, "Invalid chunk size: $size")
+            } else if (size == 0) {
+                break
+            }
+
+            if (buf.size < size) {
+                buf = ByteArray(size)
+            }
+            SocketUtils.readFully(sis, buf, 0, size)
+
+            if (outputError == null) {
+                try {
+                    output.write(buf, 0, size)
+                } catch (e: IOException) {
+                    outputError = e
+                }
+            }
+        }
+
+        val response = receiveResponse(RequestType.FileStreamReadRequest,
+                ResponseType.FileStreamReadResponse) as FileStreamReadResponse
+
+        val error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: stream read failed: ${error.msg()}")
+        }
+
+        if (outputError != null) {
+            throw outputError
+        }
+
+        return response.bytesRead()
+    }
+
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun fileStreamWrite(id: Int, input: InputStream): Long {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+        FileStreamWriteRequest.startFileStreamWriteRequest(builder)
+        FileStreamWriteRequest.addId(builder, id)
+        val fbRequest = FileStreamWriteRequest.endFileStreamWriteRequest(builder)
+
+        // Send request and wait for the daemon to accept the stream
+        sendRequest(builder, fbRequest, RequestType.FileStreamWriteRequest,
+                ResponseType.FileStreamWriteResponse)
+
+        // Send chunks followed by an empty one. The stream is terminated even if reading from the
+        // input fails so that the daemon stops waiting for data.
+        val buf = ByteArray(STREAM_CHUNK_SIZE)
+        var inputError: IOException? = null
+
+        while (true) {
+            val n = try {
+                input.read(buf)
+            } catch (e: IOException) {
+                inputError = e
+                -1
+            }
+
+            if (n < 0) {
+                break
+            } else if (n > 0) {
+                SocketUtils.writeInt32(sos, n)
+                sos.write(buf, 0, n)
+            }
+        }
+
+        SocketUtils.writeInt32(sos, 0)
+
+        val response = receiveResponse(RequestType.FileStreamWriteRequest,
+                ResponseType.FileStreamWriteResponse) as FileStreamWriteResponse
+
+        val error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: stream write failed: ${error.msg()}")
+        }
+
+        if (inputError != null) {
+            throw inputError
+        }
+
+        return response.bytesWritten()
+    }
+
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     override fun fileWrite(id: Int, data: ByteArray): Long {
@@ -407,8 +681,8 @@ class MbtoolInterfaceV3(
 
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    override fun switchRom(context: Context, id: String,
-                           forceChecksumsUpdate: Boolean): SwitchRomResult {
+    override fun switchRom(context: Context, id: String, forceChecksumsUpdate: Boolean,
+                           listener: OperationProgressListener?): SwitchRomResult {
         val bootBlockDev = SwitcherUtils.getBootPartition(context, this)
         if (bootBlockDev == null) {
             Log.e(TAG, "Failed to determine boot partition")
@@ -438,24 +712,28 @@ class MbtoolInterfaceV3(
         MbSwitchRomRequest.addBootBlockdev(builder, fbBootBlockDev)
         MbSwitchRomRequest.addBlockdevBaseDirs(builder, fbSearchDirs)
         MbSwitchRomRequest.addForceUpdateChecksums(builder, forceChecksumsUpdate)
+        MbSwitchRomRequest.addReportProgress(builder, listener != null)
         val fbRequest = MbSwitchRomRequest.endMbSwitchRomRequest(builder)
 
         // Send request
-        val response = sendRequest(builder, fbRequest, RequestType.MbSwitchRomRequest,
-                ResponseType.MbSwitchRomResponse) as MbSwitchRomResponse
+        val response = sendRequestWithProgress(builder, fbRequest,
+                RequestType.MbSwitchRomRequest, ResponseType.MbSwitchRomResponse,
+                listener) as MbSwitchRomResponse
 
         return when (response.result()) {
             MbSwitchRomResult.SUCCEEDED -> SwitchRomResult.SUCCEEDED
             MbSwitchRomResult.FAILED -> SwitchRomResult.FAILED
             MbSwitchRomResult.CHECKSUM_INVALID -> SwitchRomResult.CHECKSUM_INVALID
             MbSwitchRomResult.CHECKSUM_NOT_FOUND -> SwitchRomResult.CHECKSUM_NOT_FOUND
+            MbSwitchRomResult.CANCELLED -> SwitchRomResult.FAILED
             else -> throw MbtoolCommandException("Invalid SwitchRomResult: ${response.result()}")
         }
     }
 
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    override fun setKernel(context: Context, id: String): SetKernelResult {
+    override fun setKernel(context: Context, id: String,
+                           listener: OperationProgressListener?): SetKernelResult {
         val bootBlockDev = SwitcherUtils.getBootPartition(context, this)
         if (bootBlockDev == null) {
             Log.e(TAG, "Failed to determine boot partition")
@@ -469,12 +747,15 @@ class MbtoolInterfaceV3(
         MbSetKernelRequest.startMbSetKernelRequest(builder)
         MbSetKernelRequest.addRomId(builder, fbRomId)
         MbSetKernelRequest.addBootBlockdev(builder, fbBootBlockDev)
+        MbSetKernelRequest.addReportProgress(builder, listener != null)
         val fbRequest = MbSetKernelRequest.endMbSetKernelRequest(builder)
 
         // Send request
-        val response = sendRequest(builder, fbRequest, RequestType.MbSetKernelRequest,
-                ResponseType.MbSetKernelResponse) as MbSetKernelResponse
+        val response = sendRequestWithProgress(builder, fbRequest,
+                RequestType.MbSetKernelRequest, ResponseType.MbSetKernelResponse,
+                listener) as MbSetKernelResponse
 
+        // A cancelled request also has an error
         val error = response.error()
         return if (error != null) SetKernelResult.FAILED else SetKernelResult.SUCCEEDED
     }
@@ -693,7 +974,8 @@ class MbtoolInterfaceV3(
 
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    override fun wipeRom(romId: String, targets: ShortArray): WipeResult {
+    override fun wipeRom(romId: String, targets: ShortArray,
+                         listener: OperationProgressListener?): WipeResult {
         // Create request
         val builder = FlatBufferBuilder(FBB_SIZE)
         val fbRomId = builder.createString(romId)
@@ -701,14 +983,16 @@ class MbtoolInterfaceV3(
         MbWipeRomRequest.startMbWipeRomRequest(builder)
         MbWipeRomRequest.addRomId(builder, fbRomId)
         MbWipeRomRequest.addTargets(builder, fbTargets)
+        MbWipeRomRequest.addReportProgress(builder, listener != null)
         val fbRequest = MbWipeRomRequest.endMbWipeRomRequest(builder)
 
         // Send request
-        val response = sendRequest(builder, fbRequest, RequestType.MbWipeRomRequest,
-                ResponseType.MbWipeRomResponse) as MbWipeRomResponse
+        val response = sendRequestWithProgress(builder, fbRequest,
+                RequestType.MbWipeRomRequest, ResponseType.MbWipeRomResponse,
+                listener) as MbWipeRomResponse
 
         val result = WipeResult(ShortArray(response.succeededLength()),
-                ShortArray(response.failedLength()))
+                ShortArray(response.failedLength()), response.cancelled())
 
         for (i in 0 until response.succeededLength()) {
             result.succeeded[i] = response.succeeded(i)
@@ -793,7 +1077,8 @@ class MbtoolInterfaceV3(
 
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
-    override fun pathGetDirectorySize(path: String, exclusions: Array<String>?): Long {
+    override fun pathGetDirectorySize(path: String, exclusions: Array<String>?,
+                                      listener: DirectorySizeProgressListener?): Long {
         // Create request
         val builder = FlatBufferBuilder(FBB_SIZE)
         val fbPath = builder.createString(path)
@@ -810,10 +1095,37 @@ class MbtoolInterfaceV3(
         PathGetDirectorySizeRequest.startPathGetDirectorySizeRequest(builder)
         PathGetDirectorySizeRequest.addPath(builder, fbPath)
         PathGetDirectorySizeRequest.addExclusions(builder, fbExclusions)
+        PathGetDirectorySizeRequest.addReportProgress(builder, listener != null)
         val fbRequest = PathGetDirectorySizeRequest.endPathGetDirectorySizeRequest(builder)
 
         // Send request
-        val response = sendRequest(builder, fbRequest, RequestType.PathGetDirectorySizeRequest,
+        ThreadUtils.enforceExecutionOnNonMainThread()
+
+        Request.startRequest(builder)
+        Request.addRequestType(builder, RequestType.PathGetDirectorySizeRequest)
+        Request.addRequest(builder, fbRequest)
+        Request.addSchedPolicy(builder, schedPolicy)
+        builder.finish(Request.endRequest(builder))
+
+        SocketUtils.writeBytes(sos, builder.sizedByteArray())
+
+        // Daemons that don't support progress reporting just send the final response
+        var root: Response
+        while (true) {
+            val responseBytes = SocketUtils.readBytes(sis)
+            root = Response.getRootAsResponse(ByteBuffer.wrap(responseBytes))
+
+            if (root.responseType() != ResponseType.PathGetDirectorySizeProgressResponse) {
+                break
+            }
+
+            val progress = root.response(PathGetDirectorySizeProgressResponse())
+                    as PathGetDirectorySizeProgressResponse?
+                    ?: throw MbtoolException(Reason.PROTOCOL_ERROR, "Invalid union data")
+            listener?.onDirectorySizeProgress(progress.size())
+        }
+
+        val response = checkResponse(root, RequestType.PathGetDirectorySizeRequest,
                 ResponseType.PathGetDirectorySizeResponse) as PathGetDirectorySizeResponse
 
         val error = response.error()
@@ -825,6 +1137,40 @@ class MbtoolInterfaceV3(
         return response.size()
     }
 
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun eventSubscribe(events: ShortArray?, listener: DaemonEventListener) {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+        var fbEvents = 0
+        if (events != null) {
+            fbEvents = EventSubscribeRequest.createEventsVector(builder, events)
+        }
+        EventSubscribeRequest.startEventSubscribeRequest(builder)
+        EventSubscribeRequest.addEvents(builder, fbEvents)
+        val fbRequest = EventSubscribeRequest.endEventSubscribeRequest(builder)
+
+        // Send request
+        val response = sendRequest(builder, fbRequest, RequestType.EventSubscribeRequest,
+                ResponseType.EventSubscribeResponse) as EventSubscribeResponse
+
+        val error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "Failed to subscribe to events: ${error.msg()}")
+        }
+
+        // The connection now only carries event notifications
+        while (true) {
+            val notification = receiveResponse(RequestType.EventSubscribeRequest,
+                    ResponseType.EventNotificationResponse) as EventNotificationResponse
+
+            listener.onDaemonEvents(ShortArray(notification.eventsLength()) {
+                notification.events(it)
+            })
+        }
+    }
+
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     override fun signedExec(path: String, sigPath: String, arg0: String?, args: Array<String>?,
@@ -859,6 +1205,7 @@ class MbtoolInterfaceV3(
         Request.startRequest(builder)
         Request.addRequestType(builder, RequestType.SignedExecRequest)
         Request.addRequest(builder, fbRequest)
+        Request.addSchedPolicy(builder, schedPolicy)
         builder.finish(Request.endRequest(builder))
 
         SocketUtils.writeBytes(sos, builder.sizedByteArray())
@@ -920,5 +1267,8 @@ class MbtoolInterfaceV3(
 
         /** Flatbuffers buffer size (same as the C++ default)  */
         private const val FBB_SIZE = 1024
+
+        /** Size of chunks sent by [fileStreamWrite] */
+        private const val STREAM_CHUNK_SIZE = 1024 * 1024
     }
 }
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package com.github.chenxiaolong.dualbootpatcher.socket.interfaces
+
+interface OperationProgressListener {
+    /**
+     * Called when the daemon reports the progress of a long-running operation.
+     *
+     * @param files Number of files processed so far
+     * @param bytes Number of bytes processed so far
+     * @param path Path currently being processed
+     * @return False to cancel the operation. The daemon stops at the next point where it is
+     *         safe to do so, so more progress may be reported afterwards.
+     */
+    fun onOperationProgress(files: Long, bytes: Long, path: String?): Boolean
+}
@@ -20,5 +20,7 @@ package com.github.chenxiaolong.dualbootpatcher.socket.interfaces
 class WipeResult(
         // Targets as listed in WipeTarget
         val succeeded: ShortArray,
-        val failed: ShortArray
+        val failed: ShortArray,
+        // Whether the wipe was cancelled before all targets were attempted
+        val cancelled: Boolean = false
 )
\ No newline at end of file
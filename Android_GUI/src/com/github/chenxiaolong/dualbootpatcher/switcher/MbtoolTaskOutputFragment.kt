@@ -110,7 +110,9 @@ class MbtoolTaskOutputFragment : Fragment(), ServiceConnection {
                 MbtoolAction.Type.ROM_INSTALLER -> countFlash++
                 MbtoolAction.Type.BACKUP_RESTORE -> when (a.backupRestoreParams!!.action) {
                     BackupRestoreParams.Action.BACKUP -> countBackup++
-                    BackupRestoreParams.Action.RESTORE -> countRestore++
+                    // Cloning writes a ROM into a slot, like a restore
+                    BackupRestoreParams.Action.RESTORE,
+                    BackupRestoreParams.Action.CLONE -> countRestore++
                 }
             }
         }
@@ -28,14 +28,24 @@ class BackupRestoreParams : Parcelable {
     var backupName: String? = null
     var backupDirUri: Uri? = null
     var force: Boolean = false
+    // Only used for CLONE
+    var targetRomId: String? = null
 
     enum class Action {
         BACKUP,
-        RESTORE
+        RESTORE,
+        CLONE
     }
 
     constructor()
 
+    constructor(romId: String, targetRomId: String, targets: Array<String>) {
+        this.action = Action.CLONE
+        this.romId = romId
+        this.targetRomId = targetRomId
+        this.targets = targets
+    }
+
     constructor(action: Action, romId: String, targets: Array<String>, backupName: String,
                 backupDirUri: Uri, force: Boolean) {
         this.action = action
@@ -53,6 +63,7 @@ class BackupRestoreParams : Parcelable {
         backupName = p.readString()
         backupDirUri = p.readParcelable(Uri::class.java.classLoader)
         force = p.readInt() != 0
+        targetRomId = p.readString()
     }
 
     override fun describeContents(): Int {
@@ -66,6 +77,7 @@ class BackupRestoreParams : Parcelable {
         dest.writeString(backupName)
         dest.writeParcelable(backupDirUri, 0)
         dest.writeInt(if (force) 1 else 0)
+        dest.writeString(targetRomId)
     }
 
     companion object {
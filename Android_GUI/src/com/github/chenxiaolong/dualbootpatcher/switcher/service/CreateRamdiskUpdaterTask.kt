@@ -110,7 +110,7 @@ class CreateRamdiskUpdaterTask(
     private fun setKernelIfNeeded(iface: MbtoolInterface): Boolean {
         val currentRom = RomUtils.getCurrentRom(context, iface)
         if (currentRom != null && currentRom.id == romInfo.id) {
-            val result = iface.setKernel(context, romInfo.id!!)
+            val result = iface.setKernel(context, romInfo.id!!, null)
             if (result !== SetKernelResult.SUCCEEDED) {
                 Log.e(TAG, "Failed to reflash boot image")
                 return false
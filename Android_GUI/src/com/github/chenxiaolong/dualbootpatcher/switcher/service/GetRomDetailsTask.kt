@@ -24,6 +24,7 @@ import com.github.chenxiaolong.dualbootpatcher.socket.MbtoolConnection
 import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolCommandException
 import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolException
 import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolException.Reason
+import com.github.chenxiaolong.dualbootpatcher.socket.interfaces.DirectorySizeProgressListener
 import com.github.chenxiaolong.dualbootpatcher.socket.interfaces.MbtoolInterface
 import java.io.IOException
 
@@ -136,8 +137,19 @@ class GetRomDetailsTask(
 
     @Throws(MbtoolException::class, IOException::class, MbtoolCommandException::class)
     private fun getSystemSize(iface: MbtoolInterface) {
+        val listener = object : DirectorySizeProgressListener {
+            override fun onDirectorySizeProgress(size: Long) {
+                // Report the running total, but don't mark it as final
+                synchronized(stateLock) {
+                    this@GetRomDetailsTask.systemSizeSuccess = true
+                    this@GetRomDetailsTask.systemSize = size
+                    sendOnRomDetailsGotSystemSize()
+                }
+            }
+        }
+
         val systemSize = iface.pathGetDirectorySize(
-                romInfo.systemPath!!, arrayOf("multiboot"))
+                romInfo.systemPath!!, arrayOf("multiboot"), listener)
         val systemSizeSuccess = systemSize >= 0
 
         synchronized(stateLock) {
@@ -150,8 +162,19 @@ class GetRomDetailsTask(
 
     @Throws(MbtoolException::class, IOException::class, MbtoolCommandException::class)
     private fun getCacheSize(iface: MbtoolInterface) {
+        val listener = object : DirectorySizeProgressListener {
+            override fun onDirectorySizeProgress(size: Long) {
+                // Report the running total, but don't mark it as final
+                synchronized(stateLock) {
+                    this@GetRomDetailsTask.cacheSizeSuccess = true
+                    this@GetRomDetailsTask.cacheSize = size
+                    sendOnRomDetailsGotCacheSize()
+                }
+            }
+        }
+
         val cacheSize = iface.pathGetDirectorySize(
-                romInfo.cachePath!!, arrayOf("multiboot"))
+                romInfo.cachePath!!, arrayOf("multiboot"), listener)
         val cacheSizeSuccess = cacheSize >= 0
 
         synchronized(stateLock) {
@@ -164,8 +187,19 @@ class GetRomDetailsTask(
 
     @Throws(MbtoolException::class, IOException::class, MbtoolCommandException::class)
     private fun getDataSize(iface: MbtoolInterface) {
+        val listener = object : DirectorySizeProgressListener {
+            override fun onDirectorySizeProgress(size: Long) {
+                // Report the running total, but don't mark it as final
+                synchronized(stateLock) {
+                    this@GetRomDetailsTask.dataSizeSuccess = true
+                    this@GetRomDetailsTask.dataSize = size
+                    sendOnRomDetailsGotDataSize()
+                }
+            }
+        }
+
         val dataSize = iface.pathGetDirectorySize(
-                romInfo.dataPath!!, arrayOf("multiboot", "media"))
+                romInfo.dataPath!!, arrayOf("multiboot", "media"), listener)
         val dataSizeSuccess = dataSize >= 0
 
         synchronized(stateLock) {
@@ -40,6 +40,7 @@ import com.github.chenxiaolong.dualbootpatcher.switcher.actions.BackupRestorePar
 import com.github.chenxiaolong.dualbootpatcher.switcher.actions.MbtoolAction
 import com.github.chenxiaolong.dualbootpatcher.switcher.actions.RomInstallerParams
 import mbtool.daemon.v3.PathDeleteFlag
+import mbtool.daemon.v3.SchedPolicy
 import mbtool.daemon.v3.SignedExecResult
 import java.io.File
 import java.io.IOException
@@ -242,9 +243,13 @@ class MbtoolTask(
         when (params.action) {
             BackupRestoreParams.Action.BACKUP -> printBoldText(Color.MAGENTA, "Backup:\n")
             BackupRestoreParams.Action.RESTORE -> printBoldText(Color.MAGENTA, "Restore:\n")
+            BackupRestoreParams.Action.CLONE -> printBoldText(Color.MAGENTA, "Clone:\n")
         }
 
         printBoldText(Color.MAGENTA, "- ROM ID: ${params.romId}\n")
+        if (params.action == BackupRestoreParams.Action.CLONE) {
+            printBoldText(Color.MAGENTA, "- Target ROM ID: ${params.targetRomId}\n")
+        }
         printBoldText(Color.MAGENTA, "- Targets: ${Arrays.toString(params.targets)}\n")
         printBoldText(Color.MAGENTA, "- Backup name: ${params.backupName}\n")
         printBoldText(Color.MAGENTA, "- Backup dir URI: ${params.backupDirUri}\n")
@@ -286,12 +291,20 @@ class MbtoolTask(
         val argv0 = when (params.action) {
             BackupRestoreParams.Action.BACKUP -> "backup"
             BackupRestoreParams.Action.RESTORE -> "restore"
+            BackupRestoreParams.Action.CLONE -> "clone-rom"
             else -> throw IllegalStateException("Invalid action: ${params.action}")
         }
 
         val args = ArrayList<String>()
-        args.add("-r")
-        args.add(params.romId!!)
+        if (params.action == BackupRestoreParams.Action.CLONE) {
+            args.add("-s")
+            args.add(params.romId!!)
+            args.add("-r")
+            args.add(params.targetRomId!!)
+        } else {
+            args.add("-r")
+            args.add(params.romId!!)
+        }
         args.add("-t")
         args.add(params.targets!!.joinToString(","))
         if (params.backupName != null) {
@@ -311,9 +324,15 @@ class MbtoolTask(
         printBoldText(Color.YELLOW, "Running $argv0 with arguments: [" +
                 "${TextUtils.join(", ", args)}]\n")
 
-        val completion = iface.signedExec(
-                mbtoolRecovery.absolutePath, mbtoolRecoverySig.absolutePath,
-                argv0, argsArray, this)
+        // Keep the device responsive while large amounts of data are copied
+        iface.schedPolicy = SchedPolicy.BACKGROUND
+        val completion = try {
+            iface.signedExec(
+                    mbtoolRecovery.absolutePath, mbtoolRecoverySig.absolutePath,
+                    argv0, argsArray, this)
+        } finally {
+            iface.schedPolicy = SchedPolicy.DEFAULT
+        }
 
         when (completion.result) {
             SignedExecResult.PROCESS_EXITED -> {
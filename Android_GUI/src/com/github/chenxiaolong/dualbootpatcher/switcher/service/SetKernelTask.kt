@@ -48,7 +48,7 @@ class SetKernelTask(
         try {
             MbtoolConnection(context).use { conn ->
                 val iface = conn.`interface`!!
-                result = iface.setKernel(context, romId)
+                result = iface.setKernel(context, romId, null)
             }
         } catch (e: IOException) {
             Log.e(TAG, "mbtool communication error", e)
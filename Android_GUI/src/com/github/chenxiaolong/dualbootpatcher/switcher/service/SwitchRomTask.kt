@@ -49,7 +49,7 @@ class SwitchRomTask(
         try {
             MbtoolConnection(context).use { conn ->
                 val iface = conn.`interface`!!
-                result = iface.switchRom(context, romId, forceChecksumsUpdate)
+                result = iface.switchRom(context, romId, forceChecksumsUpdate, null)
             }
         } catch (e: IOException) {
             Log.e(TAG, "mbtool communication error", e)
@@ -46,7 +46,7 @@ class WipeRomTask(
             MbtoolConnection(context).use { conn ->
                 val iface = conn.`interface`!!
 
-                val result = iface.wipeRom(romId, targets)
+                val result = iface.wipeRom(romId, targets, null)
                 synchronized(stateLock) {
                     targetsSucceeded = result.succeeded
                     targetsFailed = result.failed
@@ -0,0 +1,37 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class EventSubscribeRequest extends Table {
+  public static EventSubscribeRequest getRootAsEventSubscribeRequest(ByteBuffer _bb) { return getRootAsEventSubscribeRequest(_bb, new EventSubscribeRequest()); }
+  public static EventSubscribeRequest getRootAsEventSubscribeRequest(ByteBuffer _bb, EventSubscribeRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public EventSubscribeRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public short events(int j) { int o = __offset(4); return o != 0 ? bb.getShort(__vector(o) + j * 2) : 0; }
+  public int eventsLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer eventsAsByteBuffer() { return __vector_as_bytebuffer(4, 2); }
+
+  public static int createEventSubscribeRequest(FlatBufferBuilder builder,
+      int eventsOffset) {
+    builder.startObject(1);
+    EventSubscribeRequest.addEvents(builder, eventsOffset);
+    return EventSubscribeRequest.endEventSubscribeRequest(builder);
+  }
+
+  public static void startEventSubscribeRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addEvents(FlatBufferBuilder builder, int eventsOffset) { builder.addOffset(0, eventsOffset, 0); }
+  public static int createEventsVector(FlatBufferBuilder builder, short[] data) { builder.startVector(2, data.length, 2); for (int i = data.length - 1; i >= 0; i--) builder.addShort(data[i]); return builder.endVector(); }
+  public static void startEventsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(2, numElems, 2); }
+  public static int endEventSubscribeRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,34 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class EventSubscribeResponse extends Table {
+  public static EventSubscribeResponse getRootAsEventSubscribeResponse(ByteBuffer _bb) { return getRootAsEventSubscribeResponse(_bb, new EventSubscribeResponse()); }
+  public static EventSubscribeResponse getRootAsEventSubscribeResponse(ByteBuffer _bb, EventSubscribeResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public EventSubscribeResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public EventSubscribeError error() { return error(new EventSubscribeError()); }
+  public EventSubscribeError error(EventSubscribeError obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createEventSubscribeResponse(FlatBufferBuilder builder,
+      int errorOffset) {
+    builder.startObject(1);
+    EventSubscribeResponse.addError(builder, errorOffset);
+    return EventSubscribeResponse.endEventSubscribeResponse(builder);
+  }
+
+  public static void startEventSubscribeResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(0, errorOffset, 0); }
+  public static int endEventSubscribeResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,15 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+public final class EventType {
+  private EventType() { }
+  public static final short ROMS_CHANGED = 0;
+  public static final short ROM_SWITCHED = 1;
+  public static final short PACKAGES_CHANGED = 2;
+
+  public static final String[] names = { "ROMS_CHANGED", "ROM_SWITCHED", "PACKAGES_CHANGED", };
+
+  public static String name(int e) { return names[e]; }
+}
+
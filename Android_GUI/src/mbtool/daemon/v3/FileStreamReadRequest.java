@@ -0,0 +1,41 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileStreamReadRequest extends Table {
+  public static FileStreamReadRequest getRootAsFileStreamReadRequest(ByteBuffer _bb) { return getRootAsFileStreamReadRequest(_bb, new FileStreamReadRequest()); }
+  public static FileStreamReadRequest getRootAsFileStreamReadRequest(ByteBuffer _bb, FileStreamReadRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileStreamReadRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int id() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public long count() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long chunkSize() { int o = __offset(8); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createFileStreamReadRequest(FlatBufferBuilder builder,
+      int id,
+      long count,
+      long chunk_size) {
+    builder.startObject(3);
+    FileStreamReadRequest.addCount(builder, count);
+    FileStreamReadRequest.addChunkSize(builder, chunk_size);
+    FileStreamReadRequest.addId(builder, id);
+    return FileStreamReadRequest.endFileStreamReadRequest(builder);
+  }
+
+  public static void startFileStreamReadRequest(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(0, id, 0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(1, count, 0L); }
+  public static void addChunkSize(FlatBufferBuilder builder, long chunkSize) { builder.addInt(2, (int)chunkSize, (int)0L); }
+  public static int endFileStreamReadRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
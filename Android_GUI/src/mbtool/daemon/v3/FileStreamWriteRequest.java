@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileStreamWriteRequest extends Table {
+  public static FileStreamWriteRequest getRootAsFileStreamWriteRequest(ByteBuffer _bb) { return getRootAsFileStreamWriteRequest(_bb, new FileStreamWriteRequest()); }
+  public static FileStreamWriteRequest getRootAsFileStreamWriteRequest(ByteBuffer _bb, FileStreamWriteRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileStreamWriteRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int id() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+
+  public static int createFileStreamWriteRequest(FlatBufferBuilder builder,
+      int id) {
+    builder.startObject(1);
+    FileStreamWriteRequest.addId(builder, id);
+    return FileStreamWriteRequest.endFileStreamWriteRequest(builder);
+  }
+
+  public static void startFileStreamWriteRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(0, id, 0); }
+  public static int endFileStreamWriteRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,49 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbGetStatsResponse extends Table {
+  public static MbGetStatsResponse getRootAsMbGetStatsResponse(ByteBuffer _bb) { return getRootAsMbGetStatsResponse(_bb, new MbGetStatsResponse()); }
+  public static MbGetStatsResponse getRootAsMbGetStatsResponse(ByteBuffer _bb, MbGetStatsResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbGetStatsResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long histogramBounds(int j) { int o = __offset(4); return o != 0 ? bb.getLong(__vector(o) + j * 8) : 0; }
+  public int histogramBoundsLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer histogramBoundsAsByteBuffer() { return __vector_as_bytebuffer(4, 8); }
+  public MbRequestStats requests(int j) { return requests(new MbRequestStats(), j); }
+  public MbRequestStats requests(MbRequestStats obj, int j) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(__vector(o) + j * 4), bb) : null; }
+  public int requestsLength() { int o = __offset(6); return o != 0 ? __vector_len(o) : 0; }
+  public long slowRequestThresholdMs() { int o = __offset(8); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createMbGetStatsResponse(FlatBufferBuilder builder,
+      int histogram_boundsOffset,
+      int requestsOffset,
+      long slow_request_threshold_ms) {
+    builder.startObject(3);
+    MbGetStatsResponse.addSlowRequestThresholdMs(builder, slow_request_threshold_ms);
+    MbGetStatsResponse.addRequests(builder, requestsOffset);
+    MbGetStatsResponse.addHistogramBounds(builder, histogram_boundsOffset);
+    return MbGetStatsResponse.endMbGetStatsResponse(builder);
+  }
+
+  public static void startMbGetStatsResponse(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addHistogramBounds(FlatBufferBuilder builder, int histogramBoundsOffset) { builder.addOffset(0, histogramBoundsOffset, 0); }
+  public static int createHistogramBoundsVector(FlatBufferBuilder builder, long[] data) { builder.startVector(8, data.length, 8); for (int i = data.length - 1; i >= 0; i--) builder.addLong(data[i]); return builder.endVector(); }
+  public static void startHistogramBoundsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(8, numElems, 8); }
+  public static void addRequests(FlatBufferBuilder builder, int requestsOffset) { builder.addOffset(1, requestsOffset, 0); }
+  public static int createRequestsVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
+  public static void startRequestsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static void addSlowRequestThresholdMs(FlatBufferBuilder builder, long slowRequestThresholdMs) { builder.addInt(2, (int)slowRequestThresholdMs, (int)0L); }
+  public static int endMbGetStatsResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
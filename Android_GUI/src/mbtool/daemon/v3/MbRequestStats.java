@@ -0,0 +1,54 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbRequestStats extends Table {
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb) { return getRootAsMbRequestStats(_bb, new MbRequestStats()); }
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb, MbRequestStats obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbRequestStats __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String requestType() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer requestTypeAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public long count() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long totalUsec() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long maxUsec() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long histogram(int j) { int o = __offset(12); return o != 0 ? bb.getLong(__vector(o) + j * 8) : 0; }
+  public int histogramLength() { int o = __offset(12); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer histogramAsByteBuffer() { return __vector_as_bytebuffer(12, 8); }
+
+  public static int createMbRequestStats(FlatBufferBuilder builder,
+      int request_typeOffset,
+      long count,
+      long total_usec,
+      long max_usec,
+      int histogramOffset) {
+    builder.startObject(5);
+    MbRequestStats.addMaxUsec(builder, max_usec);
+    MbRequestStats.addTotalUsec(builder, total_usec);
+    MbRequestStats.addCount(builder, count);
+    MbRequestStats.addHistogram(builder, histogramOffset);
+    MbRequestStats.addRequestType(builder, request_typeOffset);
+    return MbRequestStats.endMbRequestStats(builder);
+  }
+
+  public static void startMbRequestStats(FlatBufferBuilder builder) { builder.startObject(5); }
+  public static void addRequestType(FlatBufferBuilder builder, int requestTypeOffset) { builder.addOffset(0, requestTypeOffset, 0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(1, count, 0L); }
+  public static void addTotalUsec(FlatBufferBuilder builder, long totalUsec) { builder.addLong(2, totalUsec, 0L); }
+  public static void addMaxUsec(FlatBufferBuilder builder, long maxUsec) { builder.addLong(3, maxUsec, 0L); }
+  public static void addHistogram(FlatBufferBuilder builder, int histogramOffset) { builder.addOffset(4, histogramOffset, 0); }
+  public static int createHistogramVector(FlatBufferBuilder builder, long[] data) { builder.startVector(8, data.length, 8); for (int i = data.length - 1; i >= 0; i--) builder.addLong(data[i]); return builder.endVector(); }
+  public static void startHistogramVector(FlatBufferBuilder builder, int numElems) { builder.startVector(8, numElems, 8); }
+  public static int endMbRequestStats(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
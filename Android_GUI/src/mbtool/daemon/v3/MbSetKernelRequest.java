@@ -18,19 +18,23 @@ public final class MbSetKernelRequest extends Table {
   public ByteBuffer romIdAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
   public String bootBlockdev() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
   public ByteBuffer bootBlockdevAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public boolean reportProgress() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createMbSetKernelRequest(FlatBufferBuilder builder,
       int rom_idOffset,
-      int boot_blockdevOffset) {
-    builder.startObject(2);
+      int boot_blockdevOffset,
+      boolean report_progress) {
+    builder.startObject(3);
     MbSetKernelRequest.addBootBlockdev(builder, boot_blockdevOffset);
     MbSetKernelRequest.addRomId(builder, rom_idOffset);
+    MbSetKernelRequest.addReportProgress(builder, report_progress);
     return MbSetKernelRequest.endMbSetKernelRequest(builder);
   }
 
-  public static void startMbSetKernelRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startMbSetKernelRequest(FlatBufferBuilder builder) { builder.startObject(3); }
   public static void addRomId(FlatBufferBuilder builder, int romIdOffset) { builder.addOffset(0, romIdOffset, 0); }
   public static void addBootBlockdev(FlatBufferBuilder builder, int bootBlockdevOffset) { builder.addOffset(1, bootBlockdevOffset, 0); }
+  public static void addReportProgress(FlatBufferBuilder builder, boolean reportProgress) { builder.addBoolean(2, reportProgress, false); }
   public static int endMbSetKernelRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
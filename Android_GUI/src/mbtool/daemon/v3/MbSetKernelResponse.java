@@ -17,19 +17,23 @@ public final class MbSetKernelResponse extends Table {
   public boolean success() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
   public MbSetKernelError error() { return error(new MbSetKernelError()); }
   public MbSetKernelError error(MbSetKernelError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+  public boolean cancelled() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createMbSetKernelResponse(FlatBufferBuilder builder,
       boolean success,
-      int errorOffset) {
-    builder.startObject(2);
+      int errorOffset,
+      boolean cancelled) {
+    builder.startObject(3);
     MbSetKernelResponse.addError(builder, errorOffset);
+    MbSetKernelResponse.addCancelled(builder, cancelled);
     MbSetKernelResponse.addSuccess(builder, success);
     return MbSetKernelResponse.endMbSetKernelResponse(builder);
   }
 
-  public static void startMbSetKernelResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startMbSetKernelResponse(FlatBufferBuilder builder) { builder.startObject(3); }
   public static void addSuccess(FlatBufferBuilder builder, boolean success) { builder.addBoolean(0, success, false); }
   public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(2, cancelled, false); }
   public static int endMbSetKernelResponse(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
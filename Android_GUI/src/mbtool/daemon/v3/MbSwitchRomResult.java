@@ -8,8 +8,9 @@ public final class MbSwitchRomResult {
   public static final short FAILED = 1;
   public static final short CHECKSUM_NOT_FOUND = 2;
   public static final short CHECKSUM_INVALID = 3;
+  public static final short CANCELLED = 4;
 
-  public static final String[] names = { "SUCCEEDED", "FAILED", "CHECKSUM_NOT_FOUND", "CHECKSUM_INVALID", };
+  public static final String[] names = { "SUCCEEDED", "FAILED", "CHECKSUM_NOT_FOUND", "CHECKSUM_INVALID", "CANCELLED", };
 
   public static String name(int e) { return names[e]; }
 }
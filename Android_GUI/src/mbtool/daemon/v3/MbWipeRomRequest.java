@@ -19,21 +19,29 @@ public final class MbWipeRomRequest extends Table {
   public short targets(int j) { int o = __offset(6); return o != 0 ? bb.getShort(__vector(o) + j * 2) : 0; }
   public int targetsLength() { int o = __offset(6); return o != 0 ? __vector_len(o) : 0; }
   public ByteBuffer targetsAsByteBuffer() { return __vector_as_bytebuffer(6, 2); }
+  public boolean reportProgress() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public boolean background() { int o = __offset(10); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createMbWipeRomRequest(FlatBufferBuilder builder,
       int rom_idOffset,
-      int targetsOffset) {
-    builder.startObject(2);
+      int targetsOffset,
+      boolean report_progress,
+      boolean background) {
+    builder.startObject(4);
     MbWipeRomRequest.addTargets(builder, targetsOffset);
     MbWipeRomRequest.addRomId(builder, rom_idOffset);
+    MbWipeRomRequest.addBackground(builder, background);
+    MbWipeRomRequest.addReportProgress(builder, report_progress);
     return MbWipeRomRequest.endMbWipeRomRequest(builder);
   }
 
-  public static void startMbWipeRomRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startMbWipeRomRequest(FlatBufferBuilder builder) { builder.startObject(4); }
   public static void addRomId(FlatBufferBuilder builder, int romIdOffset) { builder.addOffset(0, romIdOffset, 0); }
   public static void addTargets(FlatBufferBuilder builder, int targetsOffset) { builder.addOffset(1, targetsOffset, 0); }
   public static int createTargetsVector(FlatBufferBuilder builder, short[] data) { builder.startVector(2, data.length, 2); for (int i = data.length - 1; i >= 0; i--) builder.addShort(data[i]); return builder.endVector(); }
   public static void startTargetsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(2, numElems, 2); }
+  public static void addReportProgress(FlatBufferBuilder builder, boolean reportProgress) { builder.addBoolean(2, reportProgress, false); }
+  public static void addBackground(FlatBufferBuilder builder, boolean background) { builder.addBoolean(3, background, false); }
   public static int endMbWipeRomRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
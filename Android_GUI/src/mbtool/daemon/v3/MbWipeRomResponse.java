@@ -20,23 +20,27 @@ public final class MbWipeRomResponse extends Table {
   public short failed(int j) { int o = __offset(6); return o != 0 ? bb.getShort(__vector(o) + j * 2) : 0; }
   public int failedLength() { int o = __offset(6); return o != 0 ? __vector_len(o) : 0; }
   public ByteBuffer failedAsByteBuffer() { return __vector_as_bytebuffer(6, 2); }
+  public boolean cancelled() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createMbWipeRomResponse(FlatBufferBuilder builder,
       int succeededOffset,
-      int failedOffset) {
-    builder.startObject(2);
+      int failedOffset,
+      boolean cancelled) {
+    builder.startObject(3);
     MbWipeRomResponse.addFailed(builder, failedOffset);
     MbWipeRomResponse.addSucceeded(builder, succeededOffset);
+    MbWipeRomResponse.addCancelled(builder, cancelled);
     return MbWipeRomResponse.endMbWipeRomResponse(builder);
   }
 
-  public static void startMbWipeRomResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startMbWipeRomResponse(FlatBufferBuilder builder) { builder.startObject(3); }
   public static void addSucceeded(FlatBufferBuilder builder, int succeededOffset) { builder.addOffset(0, succeededOffset, 0); }
   public static int createSucceededVector(FlatBufferBuilder builder, short[] data) { builder.startVector(2, data.length, 2); for (int i = data.length - 1; i >= 0; i--) builder.addShort(data[i]); return builder.endVector(); }
   public static void startSucceededVector(FlatBufferBuilder builder, int numElems) { builder.startVector(2, numElems, 2); }
   public static void addFailed(FlatBufferBuilder builder, int failedOffset) { builder.addOffset(1, failedOffset, 0); }
   public static int createFailedVector(FlatBufferBuilder builder, short[] data) { builder.startVector(2, data.length, 2); for (int i = data.length - 1; i >= 0; i--) builder.addShort(data[i]); return builder.endVector(); }
   public static void startFailedVector(FlatBufferBuilder builder, int numElems) { builder.startVector(2, numElems, 2); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(2, cancelled, false); }
   public static int endMbWipeRomResponse(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class OperationCancelResponse extends Table {
+  public static OperationCancelResponse getRootAsOperationCancelResponse(ByteBuffer _bb) { return getRootAsOperationCancelResponse(_bb, new OperationCancelResponse()); }
+  public static OperationCancelResponse getRootAsOperationCancelResponse(ByteBuffer _bb, OperationCancelResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public OperationCancelResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public boolean cancelled() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createOperationCancelResponse(FlatBufferBuilder builder,
+      boolean cancelled) {
+    builder.startObject(1);
+    OperationCancelResponse.addCancelled(builder, cancelled);
+    return OperationCancelResponse.endOperationCancelResponse(builder);
+  }
+
+  public static void startOperationCancelResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(0, cancelled, false); }
+  public static int endOperationCancelResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
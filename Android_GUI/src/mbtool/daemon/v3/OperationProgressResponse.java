@@ -0,0 +1,42 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class OperationProgressResponse extends Table {
+  public static OperationProgressResponse getRootAsOperationProgressResponse(ByteBuffer _bb) { return getRootAsOperationProgressResponse(_bb, new OperationProgressResponse()); }
+  public static OperationProgressResponse getRootAsOperationProgressResponse(ByteBuffer _bb, OperationProgressResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public OperationProgressResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long files() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytes() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public String path() { int o = __offset(8); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer pathAsByteBuffer() { return __vector_as_bytebuffer(8, 1); }
+
+  public static int createOperationProgressResponse(FlatBufferBuilder builder,
+      long files,
+      long bytes,
+      int pathOffset) {
+    builder.startObject(3);
+    OperationProgressResponse.addBytes(builder, bytes);
+    OperationProgressResponse.addFiles(builder, files);
+    OperationProgressResponse.addPath(builder, pathOffset);
+    return OperationProgressResponse.endOperationProgressResponse(builder);
+  }
+
+  public static void startOperationProgressResponse(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addFiles(FlatBufferBuilder builder, long files) { builder.addLong(0, files, 0L); }
+  public static void addBytes(FlatBufferBuilder builder, long bytes) { builder.addLong(1, bytes, 0L); }
+  public static void addPath(FlatBufferBuilder builder, int pathOffset) { builder.addOffset(2, pathOffset, 0); }
+  public static int endOperationProgressResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
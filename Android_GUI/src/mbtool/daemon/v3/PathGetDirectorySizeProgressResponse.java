@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathGetDirectorySizeProgressResponse extends Table {
+  public static PathGetDirectorySizeProgressResponse getRootAsPathGetDirectorySizeProgressResponse(ByteBuffer _bb) { return getRootAsPathGetDirectorySizeProgressResponse(_bb, new PathGetDirectorySizeProgressResponse()); }
+  public static PathGetDirectorySizeProgressResponse getRootAsPathGetDirectorySizeProgressResponse(ByteBuffer _bb, PathGetDirectorySizeProgressResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathGetDirectorySizeProgressResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long size() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createPathGetDirectorySizeProgressResponse(FlatBufferBuilder builder,
+      long size) {
+    builder.startObject(1);
+    PathGetDirectorySizeProgressResponse.addSize(builder, size);
+    return PathGetDirectorySizeProgressResponse.endPathGetDirectorySizeProgressResponse(builder);
+  }
+
+  public static void startPathGetDirectorySizeProgressResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addSize(FlatBufferBuilder builder, long size) { builder.addLong(0, size, 0L); }
+  public static int endPathGetDirectorySizeProgressResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -18,21 +18,25 @@ public final class PathGetDirectorySizeRequest extends Table {
   public ByteBuffer pathAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
   public String exclusions(int j) { int o = __offset(6); return o != 0 ? __string(__vector(o) + j * 4) : null; }
   public int exclusionsLength() { int o = __offset(6); return o != 0 ? __vector_len(o) : 0; }
+  public boolean reportProgress() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createPathGetDirectorySizeRequest(FlatBufferBuilder builder,
       int pathOffset,
-      int exclusionsOffset) {
-    builder.startObject(2);
+      int exclusionsOffset,
+      boolean report_progress) {
+    builder.startObject(3);
     PathGetDirectorySizeRequest.addExclusions(builder, exclusionsOffset);
     PathGetDirectorySizeRequest.addPath(builder, pathOffset);
+    PathGetDirectorySizeRequest.addReportProgress(builder, report_progress);
     return PathGetDirectorySizeRequest.endPathGetDirectorySizeRequest(builder);
   }
 
-  public static void startPathGetDirectorySizeRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startPathGetDirectorySizeRequest(FlatBufferBuilder builder) { builder.startObject(3); }
   public static void addPath(FlatBufferBuilder builder, int pathOffset) { builder.addOffset(0, pathOffset, 0); }
   public static void addExclusions(FlatBufferBuilder builder, int exclusionsOffset) { builder.addOffset(1, exclusionsOffset, 0); }
   public static int createExclusionsVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
   public static void startExclusionsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static void addReportProgress(FlatBufferBuilder builder, boolean reportProgress) { builder.addBoolean(2, reportProgress, false); }
   public static int endPathGetDirectorySizeRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
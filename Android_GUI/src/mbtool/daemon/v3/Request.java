@@ -16,19 +16,27 @@ public final class Request extends Table {
 
   public byte requestType() { int o = __offset(4); return o != 0 ? bb.get(o + bb_pos) : 0; }
   public Table request(Table obj) { int o = __offset(6); return o != 0 ? __union(obj, o) : null; }
+  public boolean allowMemfd() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public short schedPolicy() { int o = __offset(10); return o != 0 ? bb.getShort(o + bb_pos) : 0; }
 
   public static int createRequest(FlatBufferBuilder builder,
       byte request_type,
-      int requestOffset) {
-    builder.startObject(2);
+      int requestOffset,
+      boolean allow_memfd,
+      short sched_policy) {
+    builder.startObject(4);
     Request.addRequest(builder, requestOffset);
+    Request.addSchedPolicy(builder, sched_policy);
     Request.addRequestType(builder, request_type);
+    Request.addAllowMemfd(builder, allow_memfd);
     return Request.endRequest(builder);
   }
 
-  public static void startRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startRequest(FlatBufferBuilder builder) { builder.startObject(4); }
   public static void addRequestType(FlatBufferBuilder builder, byte requestType) { builder.addByte(0, requestType, 0); }
   public static void addRequest(FlatBufferBuilder builder, int requestOffset) { builder.addOffset(1, requestOffset, 0); }
+  public static void addAllowMemfd(FlatBufferBuilder builder, boolean allowMemfd) { builder.addBoolean(2, allowMemfd, false); }
+  public static void addSchedPolicy(FlatBufferBuilder builder, short schedPolicy) { builder.addShort(3, schedPolicy, 0); }
   public static int endRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
@@ -34,8 +34,15 @@ public final class RequestType {
   public static final byte CryptoDecryptRequest = 27;
   public static final byte CryptoGetPwTypeRequest = 28;
   public static final byte PathReadlinkRequest = 29;
+  public static final byte FileStreamReadRequest = 30;
+  public static final byte FileStreamWriteRequest = 31;
+  public static final byte FileOpenFdRequest = 32;
+  public static final byte BatchRequest = 33;
+  public static final byte EventSubscribeRequest = 34;
+  public static final byte OperationCancelRequest = 35;
+  public static final byte MbGetStatsRequest = 36;
 
-  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", };
+  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", "FileStreamReadRequest", "FileStreamWriteRequest", "FileOpenFdRequest", "BatchRequest", "EventSubscribeRequest", "OperationCancelRequest", "MbGetStatsRequest", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -16,19 +16,23 @@ public final class Response extends Table {
 
   public byte responseType() { int o = __offset(4); return o != 0 ? bb.get(o + bb_pos) : 0; }
   public Table response(Table obj) { int o = __offset(6); return o != 0 ? __union(obj, o) : null; }
+  public boolean memfd() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createResponse(FlatBufferBuilder builder,
       byte response_type,
-      int responseOffset) {
-    builder.startObject(2);
+      int responseOffset,
+      boolean memfd) {
+    builder.startObject(3);
     Response.addResponse(builder, responseOffset);
     Response.addResponseType(builder, response_type);
+    Response.addMemfd(builder, memfd);
     return Response.endResponse(builder);
   }
 
-  public static void startResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void startResponse(FlatBufferBuilder builder) { builder.startObject(3); }
   public static void addResponseType(FlatBufferBuilder builder, byte responseType) { builder.addByte(0, responseType, 0); }
   public static void addResponse(FlatBufferBuilder builder, int responseOffset) { builder.addOffset(1, responseOffset, 0); }
+  public static void addMemfd(FlatBufferBuilder builder, boolean memfd) { builder.addBoolean(2, memfd, false); }
   public static int endResponse(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
@@ -37,8 +37,18 @@ public final class ResponseType {
   public static final byte CryptoDecryptResponse = 30;
   public static final byte CryptoGetPwTypeResponse = 31;
   public static final byte PathReadlinkResponse = 32;
+  public static final byte FileStreamReadResponse = 33;
+  public static final byte FileStreamWriteResponse = 34;
+  public static final byte FileOpenFdResponse = 35;
+  public static final byte BatchResponse = 36;
+  public static final byte PathGetDirectorySizeProgressResponse = 37;
+  public static final byte EventSubscribeResponse = 38;
+  public static final byte EventNotificationResponse = 39;
+  public static final byte OperationProgressResponse = 40;
+  public static final byte OperationCancelResponse = 41;
+  public static final byte MbGetStatsResponse = 42;
 
-  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", };
+  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", "FileStreamReadResponse", "FileStreamWriteResponse", "FileOpenFdResponse", "BatchResponse", "PathGetDirectorySizeProgressResponse", "EventSubscribeResponse", "EventNotificationResponse", "OperationProgressResponse", "OperationCancelResponse", "MbGetStatsResponse", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -0,0 +1,15 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+public final class SchedPolicy {
+  private SchedPolicy() { }
+  public static final short DEFAULT = 0;
+  public static final short BACKGROUND = 1;
+  public static final short IDLE = 2;
+  public static final short INTERACTIVE = 3;
+
+  public static final String[] names = { "DEFAULT", "BACKGROUND", "IDLE", "INTERACTIVE", };
+
+  public static String name(int e) { return names[e]; }
+}
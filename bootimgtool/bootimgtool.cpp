@@ -17,32 +17,46 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
+#include <chrono>
 #include <limits>
 #include <memory>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <functional>
 #include <unordered_map>
+#include <vector>
 
 #include <cassert>
+#include <cinttypes>
 #include <climits>
 #include <cstdarg>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <getopt.h>
 
+#ifdef _WIN32
+#  include <fcntl.h>
+#  include <io.h>
+#endif
+
 // rapidjson
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
 #include <rapidjson/filereadstream.h>
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 
 // libmbcommon
 #include <mbcommon/common.h>
 #include <mbcommon/integer.h>
 #include <mbcommon/string.h>
+#include <mbcommon/thread_pool.h>
 
 // libmbbootimg
 #include <mbbootimg/entry.h>
@@ -80,6 +94,20 @@
 #define IMAGE_RPM                       "rpm"
 #define IMAGE_APPSBL                    "appsbl"
 
+#define MANIFEST_COMMAND                "command"
+#define MANIFEST_IMAGE                  "image"
+#define MANIFEST_DIRECTORY              "directory"
+#define MANIFEST_PREFIX                 "prefix"
+#define MANIFEST_TYPE                   "type"
+
+#define REPORT_DURATION_MS              "duration_ms"
+#define REPORT_SUCCESS                  "success"
+
+#define STREAM_PATH                     "-"
+#define STREAM_HEADER                   "header.json"
+
+#define TAR_BLOCK_SIZE                  512
+
 
 namespace rj = rapidjson;
 
@@ -126,12 +154,22 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "   | `- Supported by bump'd Android boot images\n" \
     "   `- Supported by plain Android boot images\n"
 
+#define HELP_STREAM \
+    "Streams:\n" \
+    "\n" \
+    "A stream is a POSIX ustar archive containing header.json and one member for\n" \
+    "each image, named <prefix><item> as above. The prefix is empty unless\n" \
+    "-p/--prefix is specified. The --output-<item> and --input-<item> options are\n" \
+    "ignored for streams. When packing, members may appear in any order and\n" \
+    "unknown members are ignored.\n"
+
 #define HELP_MAIN_USAGE \
     "Usage: bootimgtool <command> [<args>...]\n" \
     "\n" \
     "Available commands:\n" \
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
+    "  batch          Unpack or pack many boot images listed in a manifest\n" \
     "\n" \
     "Pass -h/--help as a argument to a command to see its available options.\n"
 
@@ -141,6 +179,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Options:\n" \
     "  -o, --output <output directory>\n" \
     "                  Output directory (current directory if unspecified)\n" \
+    "                  If \"-\", a tar stream is written to stdout instead\n" \
     "  -p, --prefix <prefix>\n" \
     "                  Prefix to prepend to output filenames\n" \
     "                  (defaults to \"<input file>-\")\n" \
@@ -148,6 +187,9 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "  -t, --type <type>\n" \
     "                  Input type of the boot image (autodetect if unspecified)\n" \
     "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "  -c, --format-cache <cache file>\n" \
+    "                  Remember the detected type of each boot image in the\n" \
+    "                  specified file to skip autodetection next time\n" \
     "  --output-<item> <item path>\n" \
     "                  Custom path for a particular item\n" \
     "\n" \
@@ -185,7 +227,12 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "2. Unpack a boot image to a different directory, but put the kernel in /tmp/\n" \
     "\n" \
     "        bootimgtool unpack boot.img -o extracted --output-kernel /tmp/kernel.img\n" \
-    "\n"
+    "\n" \
+    "3. Unpack a boot image and repack it without any intermediate files\n" \
+    "\n" \
+    "        bootimgtool unpack boot.img -o - | bootimgtool pack new.img -i -\n" \
+    "\n" \
+    HELP_STREAM
 
 #define HELP_PACK_USAGE \
     "Usage: bootimgtool pack <output file> [<option>...]\n" \
@@ -193,6 +240,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Options:\n" \
     "  -i, --input <input directory>\n" \
     "                  Input directory (current directory if unspecified)\n" \
+    "                  If \"-\", a tar stream is read from stdin instead\n" \
     "  -p, --prefix <prefix>\n" \
     "                  Prefix to prepend to item filenames\n" \
     "                  (defaults to \"<output file>-\")\n" \
@@ -239,6 +287,49 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "   kernel located at /tmp/newkernel.\n" \
     "\n" \
     "        bootimgtool pack boot.img -i /tmp/android --input-kernel /tmp/newkernel\n" \
+    "\n" \
+    "3. Build a boot image with a new kernel from a tar stream\n" \
+    "\n" \
+    "        tar -cf - header.json ramdisk kernel | bootimgtool pack boot.img -i -\n" \
+    "\n" \
+    HELP_STREAM
+
+#define HELP_BATCH_USAGE \
+    "Usage: bootimgtool batch <manifest file> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -j, --jobs <count>\n" \
+    "                  Number of images to process in parallel\n" \
+    "                  (number of CPUs if unspecified)\n" \
+    "  -r, --report <report file>\n" \
+    "                  Write per-image results and timings as JSON\n" \
+    "  -c, --format-cache <cache file>\n" \
+    "                  Same as -c/--format-cache for the unpack command\n" \
+    "\n" \
+    "The manifest is a JSON array of objects with the following keys:\n" \
+    "\n" \
+    "  command         \"unpack\" or \"pack\"\n" \
+    "  image           Boot image to unpack or to create\n" \
+    "  directory       Directory to unpack to or to pack from\n" \
+    "                  (current directory if unspecified)\n" \
+    "  prefix          Prefix for the item filenames\n" \
+    "                  (defaults to \"<image>-\")\n" \
+    "  type            Boot image type, with the same meaning as -t/--type for\n" \
+    "                  the unpack and pack commands\n" \
+    "\n" \
+    "Each image is processed independently. A failure is reported for that image\n" \
+    "only and the remaining images are still processed.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Unpack two boot images on four threads and save the timings\n" \
+    "\n" \
+    "        [\n" \
+    "            {\"command\": \"unpack\", \"image\": \"a.img\", \"directory\": \"a\"},\n" \
+    "            {\"command\": \"unpack\", \"image\": \"b.img\", \"directory\": \"b\"}\n" \
+    "        ]\n" \
+    "\n" \
+    "        bootimgtool batch manifest.json -j 4 -r report.json\n" \
     "\n"
 
 struct Paths
@@ -395,26 +486,15 @@ static inline std::string get_string(const rj::Value &node)
     return {node.GetString(), node.GetStringLength()};
 }
 
-static bool read_header(const std::string &path, Header &header)
+static bool parse_header(const std::string &path, const rj::Document &document,
+                         Header &header)
 {
     static const char *fmt_unknown_key =
             "Unknown key '%s' or invalid value type\n";
     static const char *fmt_unsupported =
             "Ignoring unsupported key for boot image type: '%s'\n";
 
-    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
-    if (!fp) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                path.c_str(), strerror(errno));
-        return false;
-    }
-
-    char read_buf[65536];
-    rj::Document document;
-    rj::Reader reader;
-    rj::FileReadStream is(fp.get(), read_buf, sizeof(read_buf));
-
-    if (document.ParseStream(is).HasParseError()) {
+    if (document.HasParseError()) {
         fprintf(stderr, "%s: JSON parse error at offset %" MB_PRIzu ": %s\n",
                 path.c_str(), document.GetErrorOffset(),
                 rj::GetParseError_En(document.GetParseError()));
@@ -494,7 +574,25 @@ static bool read_header(const std::string &path, Header &header)
     return true;
 }
 
-static bool write_header(const std::string &path, const Header &header)
+static bool read_header(const std::string &path, Header &header)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char read_buf[65536];
+    rj::Document document;
+    rj::FileReadStream is(fp.get(), read_buf, sizeof(read_buf));
+
+    document.ParseStream(is);
+
+    return parse_header(path, document, header);
+}
+
+static bool format_header(const Header &header, rj::StringBuffer &sb)
 {
     // Try to use base relative to the default kernel offset
     std::optional<uint32_t> base;
@@ -506,17 +604,7 @@ static bool write_header(const std::string &path, const Header &header)
     absolute_to_offset(base, kernel_offset, ramdisk_offset, second_offset,
                        tags_offset);
 
-    ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
-    if (!fp) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // NOTE: RapidJSON has no way of reporting write errors at the moment
-    char write_buf[65536];
-    rj::FileWriteStream os(fp.get(), write_buf, sizeof(write_buf));
-    rj::PrettyWriter<rj::FileWriteStream> writer(os);
+    rj::PrettyWriter<rj::StringBuffer> writer(sb);
 
     auto cmdline = header.kernel_cmdline();
     auto board_name = header.board_name();
@@ -554,9 +642,30 @@ static bool write_header(const std::string &path, const Header &header)
                     && !(writer.Key(FIELD_PAGE_SIZE) && writer.Uint(*page_size)))
             || !writer.EndObject();
 
-    writer.Flush();
-
     if (failed) {
+        fprintf(stderr, "Failed to serialize header\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_header(const std::string &path, const Header &header)
+{
+    rj::StringBuffer sb;
+
+    if (!format_header(header, sb)) {
+        return false;
+    }
+
+    ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (fwrite(sb.GetString(), 1, sb.GetSize(), fp.get()) != sb.GetSize()) {
         fprintf(stderr, "%s: Failed to write file: %s\n",
                 path.c_str(), strerror(errno));
         return false;
@@ -757,171 +866,675 @@ static bool write_entry_to_file(const Paths &paths, Reader &reader,
     return write_data_entry_to_file(path, reader);
 }
 
-static bool unpack_main(int argc, char *argv[])
+static const char * entry_item_name(int type)
 {
-    int opt;
-    bool no_prefix = false;
-    std::string input_file;
-    std::string output_dir;
-    std::string prefix;
-    const char *type = nullptr;
-    Paths paths;
-
-    // Arguments with no short options
-    enum unpack_options : int
-    {
-        OPT_OUTPUT_HEADER         = 10000 + 1,
-        OPT_OUTPUT_KERNEL         = 10000 + 2,
-        OPT_OUTPUT_RAMDISK        = 10000 + 3,
-        OPT_OUTPUT_SECOND         = 10000 + 4,
-        OPT_OUTPUT_DT             = 10000 + 5,
-        OPT_OUTPUT_KERNEL_MTKHDR  = 10000 + 6,
-        OPT_OUTPUT_RAMDISK_MTKHDR = 10000 + 7,
-        OPT_OUTPUT_IPL            = 10000 + 8,
-        OPT_OUTPUT_RPM            = 10000 + 9,
-        OPT_OUTPUT_APPSBL         = 10000 + 10,
-    };
+    switch (type) {
+    case ENTRY_TYPE_KERNEL:             return IMAGE_KERNEL;
+    case ENTRY_TYPE_RAMDISK:            return IMAGE_RAMDISK;
+    case ENTRY_TYPE_SECONDBOOT:         return IMAGE_SECOND;
+    case ENTRY_TYPE_DEVICE_TREE:        return IMAGE_DT;
+    case ENTRY_TYPE_ABOOT:              return IMAGE_ABOOT;
+    case ENTRY_TYPE_MTK_KERNEL_HEADER:  return IMAGE_KERNEL_MTKHDR;
+    case ENTRY_TYPE_MTK_RAMDISK_HEADER: return IMAGE_RAMDISK_MTKHDR;
+    case ENTRY_TYPE_SONY_IPL:           return IMAGE_IPL;
+    case ENTRY_TYPE_SONY_RPM:           return IMAGE_RPM;
+    case ENTRY_TYPE_SONY_APPSBL:        return IMAGE_APPSBL;
+    default:                            return nullptr;
+    }
+}
 
-    static const char short_options[] = "o:p:n" "h";
+// POSIX ustar header
+struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
 
-    static struct option long_options[] = {
-        // Arguments with short versions
-        {"output",                required_argument, nullptr, 'o'},
-        {"prefix",                required_argument, nullptr, 'p'},
-        {"noprefix",              required_argument, nullptr, 'n'},
-        {"type",                  required_argument, nullptr, 't'},
-        // Arguments without short versions
-        {"output-header",         required_argument, nullptr, OPT_OUTPUT_HEADER},
-        {"output-kernel",         required_argument, nullptr, OPT_OUTPUT_KERNEL},
-        {"output-ramdisk",        required_argument, nullptr, OPT_OUTPUT_RAMDISK},
-        {"output-second",         required_argument, nullptr, OPT_OUTPUT_SECOND},
-        {"output-dt",             required_argument, nullptr, OPT_OUTPUT_DT},
-        {"output-kernel_mtkhdr",  required_argument, nullptr, OPT_OUTPUT_KERNEL_MTKHDR},
-        {"output-ramdisk_mtkhdr", required_argument, nullptr, OPT_OUTPUT_RAMDISK_MTKHDR},
-        {"output-ipl",            required_argument, nullptr, OPT_OUTPUT_IPL},
-        {"output-rpm",            required_argument, nullptr, OPT_OUTPUT_RPM},
-        {"output-appsbl",         required_argument, nullptr, OPT_OUTPUT_APPSBL},
-        // Misc
-        {"help",                  no_argument,       nullptr, 'h'},
-        {nullptr,                 0,                 nullptr, 0},
-    };
+static_assert(sizeof(TarHeader) == TAR_BLOCK_SIZE, "Invalid tar header size");
 
-    int long_index = 0;
+static unsigned int tar_checksum(const TarHeader &th)
+{
+    auto data = reinterpret_cast<const unsigned char *>(&th);
+    unsigned int sum = 0;
+
+    // The checksum field itself is counted as spaces
+    for (size_t i = 0; i < sizeof(th); ++i) {
+        if (i >= offsetof(TarHeader, chksum)
+                && i < offsetof(TarHeader, chksum) + sizeof(th.chksum)) {
+            sum += ' ';
+        } else {
+            sum += data[i];
+        }
+    }
 
-    while ((opt = getopt_long(argc, argv, short_options,
-                              long_options, &long_index)) != -1) {
-        switch (opt) {
-        case 'o':                       output_dir = optarg;           break;
-        case 'p':                       prefix = optarg;               break;
-        case 'n':                       no_prefix = true;              break;
-        case 't':                       type = optarg;                 break;
-        case OPT_OUTPUT_HEADER:         paths.header = optarg;         break;
-        case OPT_OUTPUT_KERNEL:         paths.kernel = optarg;         break;
-        case OPT_OUTPUT_RAMDISK:        paths.ramdisk = optarg;        break;
-        case OPT_OUTPUT_SECOND:         paths.second = optarg;         break;
-        case OPT_OUTPUT_DT:             paths.dt = optarg;             break;
-        case OPT_OUTPUT_KERNEL_MTKHDR:  paths.kernel_mtkhdr = optarg;  break;
-        case OPT_OUTPUT_RAMDISK_MTKHDR: paths.ramdisk_mtkhdr = optarg; break;
-        case OPT_OUTPUT_IPL:            paths.ipl = optarg;            break;
-        case OPT_OUTPUT_RPM:            paths.rpm = optarg;            break;
-        case OPT_OUTPUT_APPSBL:         paths.appsbl = optarg;         break;
+    return sum;
+}
 
-        case 'h':
-            fputs(HELP_UNPACK_USAGE, stdout);
-            return true;
+static bool parse_tar_number(const char *field, size_t size, uint64_t &result)
+{
+    size_t i = 0;
 
-        default:
-            fputs(HELP_UNPACK_USAGE, stderr);
-            return false;
-        }
+    // Leading spaces are allowed and the number ends at a space or NUL
+    while (i < size && field[i] == ' ') {
+        ++i;
     }
 
-    // There should be one other arguments
-    if (argc - optind != 1) {
-        fputs(HELP_UNPACK_USAGE, stderr);
+    if (i == size || field[i] < '0' || field[i] > '7') {
         return false;
     }
 
-    input_file = argv[optind];
+    result = 0;
 
-    if (no_prefix) {
-        prefix.clear();
-    } else if (prefix.empty()) {
-        prefix = mb::io::base_name(input_file);
-        prefix += "-";
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) {
+        result = (result << 3) | static_cast<uint64_t>(field[i] - '0');
     }
 
-    if (output_dir.empty()) {
-        output_dir = ".";
+    return i == size || field[i] == ' ' || field[i] == '\0';
+}
+
+static bool write_stream(FILE *fp, const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, fp) != size) {
+        fprintf(stderr, "Failed to write stream: %s\n", strerror(errno));
+        return false;
     }
 
-    prepend_if_empty(paths, output_dir, prefix);
+    return true;
+}
 
-    if (!mb::io::create_directories(output_dir)) {
-        fprintf(stderr, "%s: Failed to create directory: %s\n",
-                output_dir.c_str(), mb::io::last_error_string().c_str());
+static bool write_tar_header(FILE *fp, const std::string &name, uint64_t size)
+{
+    TarHeader th{};
+
+    if (name.size() >= sizeof(th.name)) {
+        fprintf(stderr, "%s: Name too long for tar stream\n", name.c_str());
+        return false;
+    } else if (size >= UINT64_C(1) << 33) {
+        fprintf(stderr, "%s: Too large for tar stream\n", name.c_str());
         return false;
     }
 
-    // Load the boot image
-    Reader reader;
-    Header header;
-    Entry entry;
+    memcpy(th.name, name.data(), name.size());
+    memcpy(th.mode, "0000644", sizeof(th.mode));
+    memcpy(th.uid, "0000000", sizeof(th.uid));
+    memcpy(th.gid, "0000000", sizeof(th.gid));
+    snprintf(th.size, sizeof(th.size), "%011" PRIo64, size);
+    memcpy(th.mtime, "00000000000", sizeof(th.mtime));
+    th.typeflag = '0';
+    memcpy(th.magic, "ustar", sizeof(th.magic));
+    memcpy(th.version, "00", sizeof(th.version));
 
-    if (type) {
-        auto ret = reader.enable_format_by_name(type);
-        if (!ret) {
-            fprintf(stderr, "Failed to enable format '%s': %s\n",
-                    type, ret.error().message().c_str());
-            return false;
-        }
-    } else {
-        auto ret = reader.enable_format_all();
-        if (!ret) {
-            fprintf(stderr, "Failed to enable all formats: %s\n",
-                    ret.error().message().c_str());
-            return false;
+    snprintf(th.chksum, sizeof(th.chksum), "%06o", tar_checksum(th));
+    th.chksum[7] = ' ';
+
+    return write_stream(fp, &th, sizeof(th));
+}
+
+static bool write_tar_padding(FILE *fp, uint64_t size)
+{
+    static const char zeros[TAR_BLOCK_SIZE] = {};
+
+    return write_stream(fp, zeros, static_cast<size_t>(
+            (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE));
+}
+
+static bool write_tar_member(FILE *fp, const std::string &name,
+                             const void *data, size_t size)
+{
+    return write_tar_header(fp, name, size)
+            && write_stream(fp, data, size)
+            && write_tar_padding(fp, size);
+}
+
+static bool write_entry_to_stream(FILE *fp, const std::string &name,
+                                  Reader &reader, const Entry &entry)
+{
+    char buf[10240];
+
+    // The tar header needs the size up front. Entries of unknown size are
+    // buffered in memory.
+    if (!entry.size()) {
+        std::vector<unsigned char> data;
+
+        while (true) {
+            auto n = reader.read_data(buf, sizeof(buf));
+            if (!n) {
+                fprintf(stderr, "Failed to read entry data: %s\n",
+                        n.error().message().c_str());
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            data.insert(data.end(), buf, buf + n.value());
         }
-    }
 
-    auto ret = reader.open_filename(input_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
+        return write_tar_member(fp, name, data.data(), data.size());
     }
 
-    ret = reader.read_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
+    uint64_t remaining = *entry.size();
 
-    if (!write_header(paths.header, header)) {
+    if (!write_tar_header(fp, name, remaining)) {
         return false;
     }
 
     while (true) {
-        ret = reader.read_entry(entry);
-        if (!ret) {
-            if (ret.error() == ReaderError::EndOfEntries) {
-                break;
-            }
-            fprintf(stderr, "Failed to read entry: %s\n",
-                    ret.error().message().c_str());
+        auto n = reader.read_data(buf, sizeof(buf));
+        if (!n) {
+            fprintf(stderr, "Failed to read entry data: %s\n",
+                    n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        } else if (n.value() > remaining) {
+            fprintf(stderr, "%s: Entry data is larger than its size\n",
+                    name.c_str());
             return false;
         }
 
-        if (!write_entry_to_file(paths, reader, entry)) {
+        if (!write_stream(fp, buf, n.value())) {
             return false;
         }
+
+        remaining -= n.value();
     }
 
-    return true;
+    if (remaining != 0) {
+        fprintf(stderr, "%s: Entry data is smaller than its size\n",
+                name.c_str());
+        return false;
+    }
+
+    return write_tar_padding(fp, *entry.size());
 }
 
-static bool pack_main(int argc, char *argv[])
+typedef std::unordered_map<std::string, std::vector<unsigned char>> StreamMembers;
+
+static bool read_stream(FILE *fp, void *buf, size_t size)
+{
+    if (fread(buf, 1, size, fp) != size) {
+        if (ferror(fp)) {
+            fprintf(stderr, "Failed to read stream: %s\n", strerror(errno));
+        } else {
+            fprintf(stderr, "Unexpected end of stream\n");
+        }
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_tar_stream(FILE *fp, StreamMembers &members)
+{
+    static const TarHeader zero_header{};
+    TarHeader th;
+
+    while (true) {
+        size_t n = fread(&th, 1, sizeof(th), fp);
+        if (n == 0 && feof(fp)) {
+            // Tolerate streams that are missing the end-of-archive blocks
+            break;
+        } else if (n != sizeof(th)) {
+            if (ferror(fp)) {
+                fprintf(stderr, "Failed to read stream: %s\n",
+                        strerror(errno));
+            } else {
+                fprintf(stderr, "Unexpected end of stream\n");
+            }
+            return false;
+        }
+
+        if (memcmp(&th, &zero_header, sizeof(th)) == 0) {
+            break;
+        }
+
+        uint64_t checksum;
+        uint64_t size;
+
+        if (!parse_tar_number(th.chksum, sizeof(th.chksum), checksum)
+                || checksum != tar_checksum(th)) {
+            fprintf(stderr, "Invalid tar header checksum\n");
+            return false;
+        } else if (!parse_tar_number(th.size, sizeof(th.size), size)
+                || size > SIZE_MAX) {
+            fprintf(stderr, "Invalid tar member size\n");
+            return false;
+        }
+
+        std::string name(th.name, strnlen(th.name, sizeof(th.name)));
+
+        if (memcmp(th.magic, "ustar", 5) == 0 && th.prefix[0]) {
+            name.insert(0, "/");
+            name.insert(0, th.prefix, strnlen(th.prefix, sizeof(th.prefix)));
+        }
+
+        if (mb::starts_with(name, "./")) {
+            name.erase(0, 2);
+        }
+
+        std::vector<unsigned char> data(static_cast<size_t>(size));
+        char padding[TAR_BLOCK_SIZE];
+
+        if (!read_stream(fp, data.data(), data.size())
+                || !read_stream(fp, padding, static_cast<size_t>(
+                        (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE)
+                        % TAR_BLOCK_SIZE))) {
+            return false;
+        }
+
+        // Only regular files are used. Directories, links and extended
+        // headers are skipped.
+        if (th.typeflag == '0' || th.typeflag == '\0') {
+            members[name] = std::move(data);
+        }
+    }
+
+    return true;
+}
+
+static bool open_image(Reader &reader, const std::string &input_file,
+                       const char *type, const char *format_cache,
+                       Header &header)
+{
+    if (type) {
+        auto ret = reader.enable_format_by_name(type);
+        if (!ret) {
+            fprintf(stderr, "Failed to enable format '%s': %s\n",
+                    type, ret.error().message().c_str());
+            return false;
+        }
+    } else {
+        auto ret = reader.enable_format_all();
+        if (!ret) {
+            fprintf(stderr, "Failed to enable all formats: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+    }
+
+    if (format_cache) {
+        auto ret = reader.set_format_cache(format_cache);
+        if (!ret) {
+            fprintf(stderr, "%s: Failed to enable format cache: %s\n",
+                    format_cache, ret.error().message().c_str());
+            return false;
+        }
+    }
+
+    auto ret = reader.open_filename(input_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = reader.read_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool unpack_image_to_stream(const std::string &input_file,
+                                   const char *type, const char *format_cache,
+                                   const std::string &prefix)
+{
+    Reader reader;
+    Header header;
+    Entry entry;
+    rj::StringBuffer sb;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    if (!open_image(reader, input_file, type, format_cache, header)
+            || !format_header(header, sb)
+            || !write_tar_member(stdout, prefix + STREAM_HEADER,
+                                 sb.GetString(), sb.GetSize())) {
+        return false;
+    }
+
+    while (true) {
+        auto ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to read entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        auto name = entry_item_name(*entry.type());
+        if (!name) {
+            fprintf(stderr, "Unknown entry type: %d\n", *entry.type());
+            return false;
+        }
+
+        if (!write_entry_to_stream(stdout, prefix + name, reader, entry)) {
+            return false;
+        }
+    }
+
+    // End-of-archive marker
+    static const char zeros[TAR_BLOCK_SIZE * 2] = {};
+
+    if (!write_stream(stdout, zeros, sizeof(zeros))) {
+        return false;
+    }
+
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Failed to write stream: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool unpack_image(const std::string &input_file,
+                         const std::string &output_dir, const char *type,
+                         const char *format_cache, const Paths &paths)
+{
+    if (!mb::io::create_directories(output_dir)) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n",
+                output_dir.c_str(), mb::io::last_error_string().c_str());
+        return false;
+    }
+
+    // Load the boot image
+    Reader reader;
+    Header header;
+    Entry entry;
+
+    if (!open_image(reader, input_file, type, format_cache, header)) {
+        return false;
+    }
+
+    if (!write_header(paths.header, header)) {
+        return false;
+    }
+
+    while (true) {
+        auto ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to read entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        if (!write_entry_to_file(paths, reader, entry)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool unpack_main(int argc, char *argv[])
+{
+    int opt;
+    bool no_prefix = false;
+    std::string input_file;
+    std::string output_dir;
+    std::string prefix;
+    const char *type = nullptr;
+    const char *format_cache = nullptr;
+    Paths paths;
+
+    // Arguments with no short options
+    enum unpack_options : int
+    {
+        OPT_OUTPUT_HEADER         = 10000 + 1,
+        OPT_OUTPUT_KERNEL         = 10000 + 2,
+        OPT_OUTPUT_RAMDISK        = 10000 + 3,
+        OPT_OUTPUT_SECOND         = 10000 + 4,
+        OPT_OUTPUT_DT             = 10000 + 5,
+        OPT_OUTPUT_KERNEL_MTKHDR  = 10000 + 6,
+        OPT_OUTPUT_RAMDISK_MTKHDR = 10000 + 7,
+        OPT_OUTPUT_IPL            = 10000 + 8,
+        OPT_OUTPUT_RPM            = 10000 + 9,
+        OPT_OUTPUT_APPSBL         = 10000 + 10,
+    };
+
+    static const char short_options[] = "o:p:nt:c:" "h";
+
+    static struct option long_options[] = {
+        // Arguments with short versions
+        {"output",                required_argument, nullptr, 'o'},
+        {"prefix",                required_argument, nullptr, 'p'},
+        {"noprefix",              required_argument, nullptr, 'n'},
+        {"type",                  required_argument, nullptr, 't'},
+        {"format-cache",          required_argument, nullptr, 'c'},
+        // Arguments without short versions
+        {"output-header",         required_argument, nullptr, OPT_OUTPUT_HEADER},
+        {"output-kernel",         required_argument, nullptr, OPT_OUTPUT_KERNEL},
+        {"output-ramdisk",        required_argument, nullptr, OPT_OUTPUT_RAMDISK},
+        {"output-second",         required_argument, nullptr, OPT_OUTPUT_SECOND},
+        {"output-dt",             required_argument, nullptr, OPT_OUTPUT_DT},
+        {"output-kernel_mtkhdr",  required_argument, nullptr, OPT_OUTPUT_KERNEL_MTKHDR},
+        {"output-ramdisk_mtkhdr", required_argument, nullptr, OPT_OUTPUT_RAMDISK_MTKHDR},
+        {"output-ipl",            required_argument, nullptr, OPT_OUTPUT_IPL},
+        {"output-rpm",            required_argument, nullptr, OPT_OUTPUT_RPM},
+        {"output-appsbl",         required_argument, nullptr, OPT_OUTPUT_APPSBL},
+        // Misc
+        {"help",                  no_argument,       nullptr, 'h'},
+        {nullptr,                 0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'o':                       output_dir = optarg;           break;
+        case 'p':                       prefix = optarg;               break;
+        case 'n':                       no_prefix = true;              break;
+        case 't':                       type = optarg;                 break;
+        case 'c':                       format_cache = optarg;         break;
+        case OPT_OUTPUT_HEADER:         paths.header = optarg;         break;
+        case OPT_OUTPUT_KERNEL:         paths.kernel = optarg;         break;
+        case OPT_OUTPUT_RAMDISK:        paths.ramdisk = optarg;        break;
+        case OPT_OUTPUT_SECOND:         paths.second = optarg;         break;
+        case OPT_OUTPUT_DT:             paths.dt = optarg;             break;
+        case OPT_OUTPUT_KERNEL_MTKHDR:  paths.kernel_mtkhdr = optarg;  break;
+        case OPT_OUTPUT_RAMDISK_MTKHDR: paths.ramdisk_mtkhdr = optarg; break;
+        case OPT_OUTPUT_IPL:            paths.ipl = optarg;            break;
+        case OPT_OUTPUT_RPM:            paths.rpm = optarg;            break;
+        case OPT_OUTPUT_APPSBL:         paths.appsbl = optarg;         break;
+
+        case 'h':
+            fputs(HELP_UNPACK_USAGE, stdout);
+            return true;
+
+        default:
+            fputs(HELP_UNPACK_USAGE, stderr);
+            return false;
+        }
+    }
+
+    // There should be one other arguments
+    if (argc - optind != 1) {
+        fputs(HELP_UNPACK_USAGE, stderr);
+        return false;
+    }
+
+    input_file = argv[optind];
+
+    // Stream members are not prefixed unless a prefix is explicitly given
+    if (no_prefix) {
+        prefix.clear();
+    } else if (prefix.empty() && output_dir != STREAM_PATH) {
+        prefix = mb::io::base_name(input_file);
+        prefix += "-";
+    }
+
+    if (output_dir == STREAM_PATH) {
+        return unpack_image_to_stream(input_file, type, format_cache, prefix);
+    } else if (output_dir.empty()) {
+        output_dir = ".";
+    }
+
+    prepend_if_empty(paths, output_dir, prefix);
+
+    return unpack_image(input_file, output_dir, type, format_cache, paths);
+}
+
+static bool pack_image(const std::string &output_file, const char *type,
+                       const std::function<bool(Header &)> &load_header,
+                       const std::function<bool(Writer &, const Entry &)> &load_entry)
+{
+    // Load the boot image
+    Writer writer;
+    Header header;
+    Entry entry;
+
+    if (!writer.set_format_by_name(type)) {
+        fprintf(stderr, "Invalid boot image type: %s\n", type);
+        return false;
+    }
+
+    auto ret = writer.open_filename(output_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = writer.get_header(header);
+    if (!ret) {
+        fprintf(stderr, "Failed to get header instance: %s\n",
+                ret.error().message().c_str());
+        return false;
+    }
+
+    if (!load_header(header)) {
+        return false;
+    }
+
+    ret = writer.write_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    while (true) {
+        ret = writer.get_entry(entry);
+        if (!ret) {
+            if (ret.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to get next entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        if (!load_entry(writer, entry)) {
+            return false;
+        }
+    }
+
+    ret = writer.close();
+    if (!ret) {
+        fprintf(stderr, "Failed to close boot image: %s\n",
+                ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool pack_image(const std::string &output_file, const char *type,
+                       const Paths &paths)
+{
+    return pack_image(output_file, type, [&](Header &header) {
+        return read_header(paths.header, header);
+    }, [&](Writer &writer, const Entry &entry) {
+        return write_file_to_entry(paths, writer, entry);
+    });
+}
+
+static bool pack_image_from_stream(const std::string &output_file,
+                                   const char *type, const std::string &prefix)
+{
+    StreamMembers members;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    // Members may be in any order, so the whole stream is read before the
+    // writer asks for the entries in the order of the output format
+    if (!read_tar_stream(stdin, members)) {
+        return false;
+    }
+
+    return pack_image(output_file, type, [&](Header &header) {
+        auto name = prefix + STREAM_HEADER;
+
+        auto it = members.find(name);
+        if (it == members.end()) {
+            fprintf(stderr, "%s: Not found in stream\n", name.c_str());
+            return false;
+        }
+
+        rj::Document document;
+        document.Parse(reinterpret_cast<const char *>(it->second.data()),
+                       it->second.size());
+
+        return parse_header(name, document, header);
+    }, [&](Writer &writer, const Entry &entry) {
+        auto name = entry_item_name(*entry.type());
+        if (!name) {
+            fprintf(stderr, "Unknown entry type: %d\n", *entry.type());
+            return false;
+        }
+
+        auto ret = writer.write_entry(entry);
+        if (!ret) {
+            fprintf(stderr, "Failed to write entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        // Entries are optional
+        auto it = members.find(prefix + name);
+        if (it != members.end() && !it->second.empty()) {
+            auto n = writer.write_data(it->second.data(), it->second.size());
+            if (!n) {
+                fprintf(stderr, "Failed to write entry data: %s\n",
+                        n.error().message().c_str());
+                return false;
+            }
+        }
+
+        return true;
+    });
+}
+
+static bool pack_main(int argc, char *argv[])
 {
     int opt;
     bool no_prefix = false;
@@ -1012,78 +1625,295 @@ static bool pack_main(int argc, char *argv[])
 
     output_file = argv[optind];
 
+    // Stream members are not prefixed unless a prefix is explicitly given
     if (no_prefix) {
         prefix.clear();
-    } else if (prefix.empty()) {
+    } else if (prefix.empty() && input_dir != STREAM_PATH) {
         prefix = mb::io::base_name(output_file);
         prefix += "-";
     }
 
-    if (input_dir.empty()) {
+    if (input_dir == STREAM_PATH) {
+        return pack_image_from_stream(output_file, type, prefix);
+    } else if (input_dir.empty()) {
         input_dir = ".";
     }
 
     prepend_if_empty(paths, input_dir, prefix);
 
-    // Load the boot image
-    Writer writer;
-    Header header;
-    Entry entry;
+    return pack_image(output_file, type, paths);
+}
 
-    if (!writer.set_format_by_name(type)) {
-        fprintf(stderr, "Invalid boot image type: %s\n", type);
+struct BatchJob
+{
+    std::string command;
+    std::string image;
+    std::string directory;
+    std::string type;
+    Paths paths;
+
+    bool success;
+    std::chrono::steady_clock::duration duration;
+};
+
+static bool read_manifest(const std::string &path, std::vector<BatchJob> &jobs)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    auto ret = writer.open_filename(output_file);
-    if (!ret) {
+    char read_buf[65536];
+    rj::Document document;
+    rj::FileReadStream is(fp.get(), read_buf, sizeof(read_buf));
+
+    if (document.ParseStream(is).HasParseError()) {
+        fprintf(stderr, "%s: JSON parse error at offset %" MB_PRIzu ": %s\n",
+                path.c_str(), document.GetErrorOffset(),
+                rj::GetParseError_En(document.GetParseError()));
+        return false;
+    }
+
+    if (!document.IsArray()) {
+        fprintf(stderr, "%s: Root is not an array\n", path.c_str());
+        return false;
+    }
+
+    for (auto const &node : document.GetArray()) {
+        if (!node.IsObject()) {
+            fprintf(stderr, "%s: Job %" MB_PRIzu " is not an object\n",
+                    path.c_str(), jobs.size());
+            return false;
+        }
+
+        BatchJob job{};
+        std::optional<std::string> prefix;
+
+        for (auto const &item : node.GetObject()) {
+            auto const &key = get_string(item.name);
+
+            if (!item.value.IsString()) {
+                fprintf(stderr, "%s: Job %" MB_PRIzu ": Unknown key '%s' or"
+                        " invalid value type\n", path.c_str(), jobs.size(),
+                        key.c_str());
+                return false;
+            } else if (key == MANIFEST_COMMAND) {
+                job.command = get_string(item.value);
+            } else if (key == MANIFEST_IMAGE) {
+                job.image = get_string(item.value);
+            } else if (key == MANIFEST_DIRECTORY) {
+                job.directory = get_string(item.value);
+            } else if (key == MANIFEST_PREFIX) {
+                prefix = get_string(item.value);
+            } else if (key == MANIFEST_TYPE) {
+                job.type = get_string(item.value);
+            } else {
+                fprintf(stderr, "%s: Job %" MB_PRIzu ": Unknown key '%s' or"
+                        " invalid value type\n", path.c_str(), jobs.size(),
+                        key.c_str());
+                return false;
+            }
+        }
+
+        if (job.command != "unpack" && job.command != "pack") {
+            fprintf(stderr, "%s: Job %" MB_PRIzu ": Invalid command: '%s'\n",
+                    path.c_str(), jobs.size(), job.command.c_str());
+            return false;
+        } else if (job.image.empty()) {
+            fprintf(stderr, "%s: Job %" MB_PRIzu ": No image specified\n",
+                    path.c_str(), jobs.size());
+            return false;
+        }
+
+        if (!prefix) {
+            prefix = mb::io::base_name(job.image);
+            *prefix += "-";
+        }
+
+        if (job.directory.empty()) {
+            job.directory = ".";
+        }
+
+        prepend_if_empty(job.paths, job.directory, *prefix);
+
+        jobs.push_back(std::move(job));
+    }
+
+    return true;
+}
+
+static bool write_report(const std::string &path,
+                         const std::vector<BatchJob> &jobs)
+{
+    ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
+    if (!fp) {
         fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    ret = writer.get_header(header);
-    if (!ret) {
-        fprintf(stderr, "Failed to get header instance: %s\n",
-                ret.error().message().c_str());
+    // NOTE: RapidJSON has no way of reporting write errors at the moment
+    char write_buf[65536];
+    rj::FileWriteStream os(fp.get(), write_buf, sizeof(write_buf));
+    rj::PrettyWriter<rj::FileWriteStream> writer(os);
+
+    bool failed = !writer.StartArray();
+
+    for (auto it = jobs.begin(); !failed && it != jobs.end(); ++it) {
+        auto ms = std::chrono::duration_cast<std::chrono::duration<
+                double, std::milli>>(it->duration).count();
+
+        failed = !writer.StartObject()
+                || !writer.Key(MANIFEST_COMMAND) || !writer.String(it->command)
+                || !writer.Key(MANIFEST_IMAGE) || !writer.String(it->image)
+                || !writer.Key(REPORT_SUCCESS) || !writer.Bool(it->success)
+                || !writer.Key(REPORT_DURATION_MS) || !writer.Double(ms)
+                || !writer.EndObject();
+    }
+
+    failed = failed || !writer.EndArray();
+
+    writer.Flush();
+
+    if (failed) {
+        fprintf(stderr, "%s: Failed to write file: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    if (!read_header(paths.header, header)) {
+    if (fclose(fp.release()) < 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    ret = writer.write_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
+    return true;
+}
+
+static void run_batch_job(BatchJob &job, const char *format_cache)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (job.command == "unpack") {
+        job.success = unpack_image(job.image, job.directory,
+                                   job.type.empty() ? nullptr : job.type.c_str(),
+                                   format_cache, job.paths);
+    } else {
+        job.success = pack_image(job.image,
+                                 job.type.empty() ? FORMAT_NAME_ANDROID
+                                                  : job.type.c_str(),
+                                 job.paths);
+    }
+
+    job.duration = std::chrono::steady_clock::now() - start;
+}
+
+static bool batch_main(int argc, char *argv[])
+{
+    int opt;
+    unsigned int num_jobs = std::thread::hardware_concurrency();
+    std::string report_file;
+    const char *format_cache = nullptr;
+
+    static const char short_options[] = "j:r:c:" "h";
+
+    static struct option long_options[] = {
+        {"jobs",         required_argument, nullptr, 'j'},
+        {"report",       required_argument, nullptr, 'r'},
+        {"format-cache", required_argument, nullptr, 'c'},
+        {"help",         no_argument,       nullptr, 'h'},
+        {nullptr,        0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, num_jobs) || num_jobs == 0) {
+                fprintf(stderr, "Invalid job count: %s\n", optarg);
+                return false;
+            }
+            break;
+
+        case 'r':
+            report_file = optarg;
+            break;
+
+        case 'c':
+            format_cache = optarg;
+            break;
+
+        case 'h':
+            fputs(HELP_BATCH_USAGE, stdout);
+            return true;
+
+        default:
+            fputs(HELP_BATCH_USAGE, stderr);
+            return false;
+        }
+    }
+
+    // There should be one other argument
+    if (argc - optind != 1) {
+        fputs(HELP_BATCH_USAGE, stderr);
         return false;
     }
 
-    while (true) {
-        ret = writer.get_entry(entry);
-        if (!ret) {
-            if (ret.error() == WriterError::EndOfEntries) {
+    std::vector<BatchJob> jobs;
+
+    if (!read_manifest(argv[optind], jobs)) {
+        return false;
+    }
+
+    if (num_jobs == 0) {
+        num_jobs = 1;
+    }
+
+    // Each worker claims the next unprocessed job until none are left. Jobs do
+    // not share any Reader or Writer state.
+    std::atomic_size_t next_job{0};
+
+    mb::run_on_threads(mb::ThreadPool::global(),
+                       static_cast<unsigned int>(std::min<size_t>(
+                               num_jobs, jobs.size())), [&] {
+        while (true) {
+            size_t i = next_job++;
+            if (i >= jobs.size()) {
                 break;
             }
-            fprintf(stderr, "Failed to get next entry: %s\n",
-                    ret.error().message().c_str());
-            return false;
+
+            run_batch_job(jobs[i], format_cache);
         }
+    });
 
-        if (!write_file_to_entry(paths, writer, entry)) {
-            return false;
+    size_t failed = 0;
+
+    for (auto const &job : jobs) {
+        auto ms = std::chrono::duration_cast<std::chrono::duration<
+                double, std::milli>>(job.duration).count();
+
+        printf("%-6s %-8s %10.3f ms  %s\n", job.command.c_str(),
+               job.success ? "ok" : "FAILED", ms, job.image.c_str());
+
+        if (!job.success) {
+            ++failed;
         }
     }
 
-    ret = writer.close();
-    if (!ret) {
-        fprintf(stderr, "Failed to close boot image: %s\n",
-                ret.error().message().c_str());
+    if (failed > 0) {
+        fprintf(stderr, "%" MB_PRIzu " of %" MB_PRIzu " images failed\n",
+                failed, jobs.size());
+    }
+
+    if (!report_file.empty() && !write_report(report_file, jobs)) {
         return false;
     }
 
-    return true;
+    return failed == 0;
 }
 
 int main(int argc, char *argv[])
@@ -1100,6 +1930,8 @@ int main(int argc, char *argv[])
         ret = unpack_main(--argc, ++argv);
     } else if (command == "pack") {
         ret = pack_main(--argc, ++argv);
+    } else if (command == "batch") {
+        ret = batch_main(--argc, ++argv);
     } else {
         fputs(HELP_MAIN_USAGE, stderr);
         return EXIT_FAILURE;
@@ -19,6 +19,8 @@ if(${MBP_BUILD_TARGET} STREQUAL android)
 endif()
 
 if(${MBP_BUILD_TARGET} STREQUAL desktop)
+    # Must come before libarchive and minizip
+    include(cmake/dependencies/zstd.cmake)
     include(cmake/dependencies/googletest.cmake)
     include(cmake/dependencies/libarchive.cmake)
     include(cmake/dependencies/liblzma.cmake)
@@ -27,6 +29,8 @@ if(${MBP_BUILD_TARGET} STREQUAL desktop)
     include(cmake/dependencies/qt5.cmake)
     include(cmake/dependencies/zlib.cmake)
 elseif(${MBP_BUILD_TARGET} STREQUAL android-app)
+    # Must come before libarchive and minizip
+    include(cmake/dependencies/zstd.cmake)
     include(cmake/dependencies/iconv.cmake)
     include(cmake/dependencies/libarchive.cmake)
     include(cmake/dependencies/liblzma.cmake)
@@ -38,6 +42,8 @@ elseif(${MBP_BUILD_TARGET} STREQUAL android-system)
     set(CMAKE_FIND_LIBRARY_SUFFIXES_OLD ${CMAKE_FIND_LIBRARY_SUFFIXES})
     set(CMAKE_FIND_LIBRARY_SUFFIXES .a)
 
+    # Must come before libarchive and minizip
+    include(cmake/dependencies/zstd.cmake)
     include(cmake/dependencies/android-system-core.cmake)
     include(cmake/dependencies/freetype2.cmake)
     include(cmake/dependencies/fuse.cmake)
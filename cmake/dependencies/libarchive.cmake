@@ -9,3 +9,11 @@ set_target_properties(
     INTERFACE_INCLUDE_DIRECTORIES "${LibArchive_INCLUDE_DIRS}"
     INTERFACE_LINK_LIBRARIES "LibLZMA::LibLZMA;LZ4::LZ4;ZLIB::ZLIB"
 )
+
+# Entries in zstd-compressed zips are decoded by libarchive
+if(TARGET ZSTD::ZSTD)
+    set_property(
+        TARGET LibArchive::LibArchive
+        APPEND PROPERTY INTERFACE_LINK_LIBRARIES ZSTD::ZSTD
+    )
+endif()
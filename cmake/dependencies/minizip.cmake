@@ -3,6 +3,11 @@ set(USE_BZIP2 OFF CACHE BOOL "Enables building with BZIP2 library" FORCE)
 set(USE_LZMA OFF CACHE BOOL "Enables building with LZMA library" FORCE)
 set(USE_CRYPT OFF CACHE BOOL "Enables building with PKWARE traditional encryption" FORCE)
 set(USE_AES OFF CACHE BOOL "Enables building with AES library" FORCE)
+if(TARGET ZSTD::ZSTD)
+    set(USE_ZSTD ON CACHE BOOL "Enables building with ZSTD library" FORCE)
+else()
+    set(USE_ZSTD OFF CACHE BOOL "Enables building with ZSTD library" FORCE)
+endif()
 
 backup_variable(BUILD_SHARED_LIBS)
 
@@ -0,0 +1,4 @@
+# zstd is optional. If it is found, minizip and libarchive are built or linked
+# with zstd support so that zstd-compressed (method 93) zip entries can be
+# written by libmbpatcher and extracted by mbtool.
+find_package(ZSTD)
@@ -0,0 +1,31 @@
+# Find the ZSTD include directory and library
+#
+# ZSTD_INCLUDE_DIR - Where to find <zstd.h>
+# ZSTD_LIBRARIES   - List of zstd libraries
+# ZSTD_FOUND       - True if zstd found
+
+# Find include directory
+find_path(ZSTD_INCLUDE_DIR NAMES zstd.h)
+
+# Find library
+find_library(ZSTD_LIBRARY NAMES zstd libzstd)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(
+    ZSTD DEFAULT_MSG ZSTD_INCLUDE_DIR ZSTD_LIBRARY
+)
+
+if(ZSTD_FOUND)
+    set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+
+    add_library(ZSTD::ZSTD UNKNOWN IMPORTED)
+    set_target_properties(
+        ZSTD::ZSTD
+        PROPERTIES
+        IMPORTED_LINK_INTERFACE_LANGUAGES "C"
+        IMPORTED_LOCATION "${ZSTD_LIBRARY}"
+        INTERFACE_INCLUDE_DIRECTORIES "${ZSTD_INCLUDE_DIR}"
+    )
+endif()
+
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
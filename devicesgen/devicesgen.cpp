@@ -17,17 +17,25 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <initializer_list>
+#include <string>
+#include <vector>
+
 #include <cerrno>
 #include <cinttypes>
+#include <cstdio>
 #include <cstring>
 
 #include <getopt.h>
+#include <sys/stat.h>
 
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 #include <yaml-cpp/yaml.h>
 
+#include "mbdevice/database.h"
 #include "mbdevice/json.h"
 #include "mbdevice/schema.h"
 
@@ -94,32 +102,73 @@ static Value yaml_node_to_json(const YAML::Node &yaml_node, Allocator &alloc)
     }
 }
 
-template<typename Allocator>
-static bool convert_files(int argc, char *argv[], Value &value,
-                          Allocator &alloc)
+// Bump this when the YAML to JSON conversion changes so that old cache entries
+// are ignored
+static constexpr char CACHE_VERSION[] = "devicesgen-cache-1";
+
+// 64-bit FNV-1a. Cache entries are only keyed by this hash, which is fine for
+// the small number of device definition files that exist.
+static uint64_t fnv1a_64(uint64_t hash, const char *data, size_t size)
 {
-    value.SetArray();
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
 
-    for (int i = 0; i < argc; ++i) {
-        try {
-            YAML::Node root = YAML::LoadFile(argv[i]);
+static bool read_file(const char *path, std::string &out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
 
-            if (root.Type() != YAML::NodeType::Sequence) {
-                fprintf(stderr, "%s: Root is not an array\n", argv[i]);
-                return false;
-            }
+    out.clear();
 
-            for (auto const &item : root) {
-                value.PushBack(yaml_node_to_json(item, alloc), alloc);
-            }
-        } catch (const std::exception &e) {
-            fprintf(stderr, "%s: Failed to convert file: %s\n",
-                    argv[i], e.what());
+    char buf[65536];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+
+    bool ret = !ferror(fp);
+    fclose(fp);
+
+    return ret;
+}
+
+static bool write_file(const char *path, const std::string &data, bool binary)
+{
+    FILE *fp = stdout;
+
+    if (path) {
+        fp = fopen(path, binary ? "wb" : "w");
+        if (!fp) {
+            fprintf(stderr, "%s: Failed to open file: %s\n",
+                    path, strerror(errno));
             return false;
         }
     }
 
-    return true;
+    bool ret = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to write file: %s\n",
+                path ? path : "<stdout>", strerror(errno));
+    }
+
+    if (path) {
+        if (fclose(fp) != 0) {
+            fprintf(stderr, "%s: Failed to close file: %s\n",
+                    path, strerror(errno));
+            ret = false;
+        }
+    } else if (fflush(fp) != 0) {
+        ret = false;
+    }
+
+    return ret;
 }
 
 template<typename Writer>
@@ -161,6 +210,179 @@ static bool validate_and_write(Document &d, const SchemaDocument &sd,
     return true;
 }
 
+// Convert one YAML file to a validated, compact JSON array of devices
+static bool convert_file(const char *path, const std::string &contents,
+                         const SchemaDocument &sd, std::string &out)
+{
+    Document d;
+    d.SetArray();
+
+    try {
+        YAML::Node root = YAML::Load(contents);
+
+        if (root.Type() != YAML::NodeType::Sequence) {
+            fprintf(stderr, "%s: Root is not an array\n", path);
+            return false;
+        }
+
+        for (auto const &item : root) {
+            d.PushBack(yaml_node_to_json(item, d.GetAllocator()),
+                       d.GetAllocator());
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s: Failed to convert file: %s\n", path, e.what());
+        return false;
+    }
+
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+
+    if (!validate_and_write(d, sd, writer)) {
+        fprintf(stderr, "%s: Device list is invalid\n", path);
+        return false;
+    }
+
+    out.assign(sb.GetString(), sb.GetSize());
+    return true;
+}
+
+static bool is_json_array(const std::string &json)
+{
+    return json.size() >= 2 && json.front() == '[' && json.back() == ']';
+}
+
+// Convert every YAML file and merge the devices into one JSON array. The
+// schema only describes individual devices, so validating each file on its own
+// is equivalent to validating the merged list. If a cache directory is given,
+// the validated JSON for each file is stored there, keyed by the hash of the
+// file contents and the schemas, and only files that changed are converted.
+static bool convert_files(int argc, char *argv[], const char *cache_dir,
+                          std::string &out)
+{
+    DeviceSchemaProvider<> sp;
+    const SchemaDocument *sd = sp.GetSchema("device_list.json");
+    if (!sd) {
+        assert(false);
+        return false;
+    }
+
+    uint64_t base_hash = 0xcbf29ce484222325ULL;
+    base_hash = fnv1a_64(base_hash, CACHE_VERSION, sizeof(CACHE_VERSION));
+    for (auto const &name : {"device_list.json", "device.json"}) {
+        const char *schema = find_schema(name);
+        if (schema) {
+            base_hash = fnv1a_64(base_hash, schema, strlen(schema) + 1);
+        }
+    }
+
+    if (cache_dir && mkdir(cache_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n",
+                cache_dir, strerror(errno));
+        return false;
+    }
+
+    std::string contents;
+    std::string json;
+
+    out = "[";
+
+    for (int i = 0; i < argc; ++i) {
+        if (!read_file(argv[i], contents)) {
+            fprintf(stderr, "%s: Failed to read file: %s\n",
+                    argv[i], strerror(errno));
+            return false;
+        }
+
+        std::string cache_file;
+        bool cached = false;
+
+        if (cache_dir) {
+            char name[32];
+            snprintf(name, sizeof(name), "%016" PRIx64 ".json",
+                     fnv1a_64(base_hash, contents.data(), contents.size()));
+            cache_file = std::string(cache_dir) + "/" + name;
+
+            cached = read_file(cache_file.c_str(), json) && is_json_array(json);
+        }
+
+        if (!cached) {
+            if (!convert_file(argv[i], contents, *sd, json)) {
+                return false;
+            }
+
+            if (cache_dir) {
+                // Write to a temporary file first so that an interrupted run
+                // cannot leave a truncated cache entry behind
+                std::string temp_file = cache_file + ".tmp";
+
+                if (!write_file(temp_file.c_str(), json, false)
+                        || rename(temp_file.c_str(), cache_file.c_str()) < 0) {
+                    fprintf(stderr, "%s: Failed to write cache entry\n",
+                            cache_file.c_str());
+                    remove(temp_file.c_str());
+                    return false;
+                }
+            }
+        }
+
+        // Strip the brackets and join the elements of each array
+        if (json.size() > 2) {
+            if (out.size() > 1) {
+                out += ',';
+            }
+            out.append(json, 1, json.size() - 2);
+        }
+    }
+
+    out += ']';
+
+    return true;
+}
+
+static bool make_database(const std::string &json, std::string &out)
+{
+    std::vector<Device> devices;
+    JsonError error;
+
+    if (!device_list_from_json(json, devices, error)) {
+        fprintf(stderr, "Failed to load validated device list\n");
+        return false;
+    }
+
+    if (!device_list_to_database(devices, out)) {
+        fprintf(stderr, "Failed to create device database\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool make_json(const std::string &json, bool styled, std::string &out)
+{
+    if (styled) {
+        Document d;
+        d.Parse(json.data(), json.size());
+        if (d.HasParseError()) {
+            fprintf(stderr, "Failed to parse merged device list\n");
+            return false;
+        }
+
+        StringBuffer sb;
+        PrettyWriter<StringBuffer> writer(sb);
+        d.Accept(writer);
+
+        out.assign(sb.GetString(), sb.GetSize());
+    } else {
+        out = json;
+    }
+
+    // Only output that passed schema validation gets here. Mark it so that
+    // libmbdevice can skip the validation when loading it at runtime.
+    device_list_mark_validated(out);
+
+    return true;
+}
+
 static void usage(FILE *stream)
 {
     fprintf(stream,
@@ -170,7 +392,12 @@ static void usage(FILE *stream)
             "  -o, --output <file>\n"
             "                   Output file (outputs to stdout if omitted)\n"
             "  -h, --help       Display this help message\n"
-            "  --styled         Output in human-readable format\n");
+            "  --styled         Output in human-readable format\n"
+            "  --binary         Output a binary device database instead of JSON\n"
+            "  --binary-output <file>\n"
+            "                   Also write a binary device database to <file>\n"
+            "  --cache-dir <dir>\n"
+            "                   Cache the converted device list of each file in <dir>\n");
 }
 
 int main(int argc, char *argv[])
@@ -179,12 +406,18 @@ int main(int argc, char *argv[])
 
     enum Options {
         OPT_STYLED             = 1000,
+        OPT_BINARY             = 1001,
+        OPT_BINARY_OUTPUT      = 1002,
+        OPT_CACHE_DIR          = 1003,
     };
 
     static const char short_options[] = "o:h";
 
     static struct option long_options[] = {
         {"styled", no_argument, 0, OPT_STYLED},
+        {"binary", no_argument, 0, OPT_BINARY},
+        {"binary-output", required_argument, 0, OPT_BINARY_OUTPUT},
+        {"cache-dir", required_argument, 0, OPT_CACHE_DIR},
         {"output", required_argument, 0, 'o'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
@@ -193,7 +426,10 @@ int main(int argc, char *argv[])
     int long_index = 0;
 
     const char *output_file = nullptr;
+    const char *binary_output_file = nullptr;
+    const char *cache_dir = nullptr;
     bool styled = false;
+    bool binary = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
@@ -202,6 +438,18 @@ int main(int argc, char *argv[])
             styled = true;
             break;
 
+        case OPT_BINARY:
+            binary = true;
+            break;
+
+        case OPT_BINARY_OUTPUT:
+            binary_output_file = optarg;
+            break;
+
+        case OPT_CACHE_DIR:
+            cache_dir = optarg;
+            break;
+
         case 'o':
             output_file = optarg;
             break;
@@ -216,50 +464,37 @@ int main(int argc, char *argv[])
         }
     }
 
-    FILE *fp = stdout;
-
-    if (output_file) {
-        fp = fopen(output_file, "w");
-        if (!fp) {
-            fprintf(stderr, "%s: Failed to open file: %s\n",
-                    output_file, strerror(errno));
-            return EXIT_FAILURE;
-        }
+    if (styled && binary) {
+        fprintf(stderr, "--styled and --binary cannot be used together\n");
+        return EXIT_FAILURE;
     }
 
-    char write_buf[65536];
-    FileWriteStream os(fp, write_buf, sizeof(write_buf));
-    bool ret;
-
-    DeviceSchemaProvider<> sp;
-    const SchemaDocument *sd = sp.GetSchema("device_list.json");
-    if (!sd) {
-        assert(false);
+    if (binary && binary_output_file) {
+        fprintf(stderr, "--binary and --binary-output cannot be used together\n");
         return EXIT_FAILURE;
     }
 
-    Document d;
-    auto &alloc = d.GetAllocator();
-
-    if (!convert_files(argc - optind, argv + optind, d, alloc)) {
+    std::string json;
+    if (!convert_files(argc - optind, argv + optind, cache_dir, json)) {
         return EXIT_FAILURE;
     }
 
-    if (styled) {
-        PrettyWriter<FileWriteStream> writer(os);
-        ret = validate_and_write(d, *sd, writer);
-    } else {
-        Writer<FileWriteStream> writer(os);
-        ret = validate_and_write(d, *sd, writer);
+    std::string data;
+
+    if (binary_output_file) {
+        if (!make_database(json, data)
+                || !write_file(binary_output_file, data, true)) {
+            return EXIT_FAILURE;
+        }
     }
 
-    if (output_file) {
-        if (fclose(fp) != 0) {
-            fprintf(stderr, "%s: Failed to close file: %s\n",
-                    output_file, strerror(errno));
+    if (binary) {
+        if (!make_database(json, data)) {
             return EXIT_FAILURE;
         }
+    } else if (!make_json(json, styled, data)) {
+        return EXIT_FAILURE;
     }
 
-    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    return write_file(output_file, data, binary) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
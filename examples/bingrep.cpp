@@ -19,8 +19,13 @@
 
 #include "mbcommon/file_util.h"
 
+#include <algorithm>
 #include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -29,15 +34,21 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <ftw.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/file/posix.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 
 static void usage(FILE *stream, const char *prog_name)
 {
-    fprintf(stream, "Usage: %s {-p <hex> | -t <text>} [option...] [<file>...]\n"
+    fprintf(stream, "Usage: %s {-p <hex> | -t <text>}... [option...]"
+                    " [<file>...]\n"
                     "\n"
                     "Options:\n"
                     "  -p, --hex <hex pattern>\n"
@@ -48,10 +59,32 @@ static void usage(FILE *stream, const char *prog_name)
                     "                  Maximum number of matches\n"
                     "  --start-offset  Starting boundary offset for search\n"
                     "  --end-offset    Ending boundary offset for search\n"
-                    "  --buffer-size   Buffer size\n",
+                    "  --buffer-size   Buffer size\n"
+                    "  --searcher <multi|boyer-moore>\n"
+                    "                  Search algorithm (default: multi)\n"
+                    "  -r, --recursive Search files in directories recursively\n"
+                    "  -j, --jobs <count>\n"
+                    "                  Number of files to search in parallel\n"
+                    "                  (default: 1, 0: one per CPU core)\n"
+                    "  --mmap          Memory map files instead of reading them\n"
+                    "\n"
+                    "Multiple patterns may be specified. The 'multi' searcher\n"
+                    "finds all of them in a single pass. The 'boyer-moore'\n"
+                    "searcher runs a separate pass for each pattern and\n"
+                    "requires a seekable file.\n"
+                    "\n"
+                    "Results are printed in the order in which the files are\n"
+                    "listed, even when they are searched in parallel. Files\n"
+                    "found by --recursive are sorted by path.\n",
                     prog_name);
 }
 
+enum class Searcher
+{
+    Multi,
+    BoyerMoore,
+};
+
 static int ascii_to_hex(char c)
 {
     if (c >= '0' && c <= '9') {
@@ -65,73 +98,143 @@ static int ascii_to_hex(char c)
     }
 }
 
-static bool hex_to_binary(const char *hex, void **data, size_t *data_size)
+static bool hex_to_binary(const char *hex, std::string &data)
 {
     size_t size = strlen(hex);
-    unsigned char *buf;
 
     if (size & 1) {
         errno = EINVAL;
         return false;
     }
 
-    buf = static_cast<unsigned char *>(malloc(size / 2));
-    if (!buf) {
-        return false;
-    }
+    data.clear();
+    data.reserve(size / 2);
 
     for (size_t i = 0; i < size; i += 2) {
         int hi = ascii_to_hex(hex[i]);
         int lo = ascii_to_hex(hex[i + 1]);
 
         if (hi < 0 || lo < 0) {
-            free(buf);
             errno = EINVAL;
             return false;
         }
 
-        buf[i / 2] = static_cast<unsigned char>((hi << 4) | lo);
+        data.push_back(static_cast<char>((hi << 4) | lo));
     }
 
-    *data = buf;
-    *data_size = size / 2;
-
     return true;
 }
 
+struct SearchOptions
+{
+    std::optional<uint64_t> start;
+    std::optional<uint64_t> end;
+    size_t bsize = 0;
+    std::vector<std::string> patterns;
+    std::optional<uint64_t> max_matches;
+    Searcher searcher = Searcher::Multi;
+    bool use_mmap = false;
+};
+
+// Output of a search. Everything is buffered so that files searched in
+// parallel can be printed in order.
+struct SearchOutput
+{
+    std::string out;
+    std::string err;
+};
+
+struct SearchContext
+{
+    const char *name;
+    bool show_id;
+    size_t pattern_id;
+    SearchOutput &output;
+};
+
+static void print_result(SearchContext &ctx, size_t pattern_id,
+                         uint64_t offset)
+{
+    if (ctx.show_id) {
+        ctx.output.out += mb::format("%s: 0x%016" PRIx64 " (pattern %zu)\n",
+                                     ctx.name, offset, pattern_id);
+    } else {
+        ctx.output.out += mb::format("%s: 0x%016" PRIx64 "\n",
+                                     ctx.name, offset);
+    }
+}
+
 static mb::oc::result<mb::FileSearchAction>
 search_result_cb(mb::File &file, void *userdata, uint64_t offset)
 {
     (void) file;
-    const char *name = static_cast<char *>(userdata);
-    printf("%s: 0x%016" PRIx64 "\n", name, offset);
+    auto *ctx = static_cast<SearchContext *>(userdata);
+    print_result(*ctx, ctx->pattern_id, offset);
+    return mb::FileSearchAction::Continue;
+}
+
+static mb::oc::result<mb::FileSearchAction>
+search_multi_result_cb(mb::File &file, void *userdata, size_t pattern_id,
+                       uint64_t offset)
+{
+    (void) file;
+    print_result(*static_cast<SearchContext *>(userdata), pattern_id, offset);
     return mb::FileSearchAction::Continue;
 }
 
 static bool search(const char *name, mb::File &file,
-                   std::optional<uint64_t> start,
-                   std::optional<uint64_t> end,
-                   size_t bsize, const void *pattern,
-                   size_t pattern_size, std::optional<uint64_t> max_matches)
+                   const SearchOptions &opts, SearchOutput &output)
 {
-    auto ret = mb::file_search(file, start, end, bsize, pattern, pattern_size,
-                               max_matches, &search_result_cb,
-                               const_cast<char *>(name));
+    SearchContext ctx{name, opts.patterns.size() > 1, 0, output};
+    mb::oc::result<void> ret = mb::oc::success();
+
+    switch (opts.searcher) {
+    case Searcher::Multi: {
+        std::vector<mb::FileSearchPattern> fsp;
+        for (auto const &p : opts.patterns) {
+            fsp.push_back({p.data(), p.size()});
+        }
+
+        ret = mb::file_search_multi(file, opts.start, opts.end, opts.bsize,
+                                    fsp.data(), fsp.size(), opts.max_matches,
+                                    &search_multi_result_cb, &ctx);
+        break;
+    }
+
+    case Searcher::BoyerMoore:
+        for (ctx.pattern_id = 0; ctx.pattern_id < opts.patterns.size();
+                ++ctx.pattern_id) {
+            auto const &p = opts.patterns[ctx.pattern_id];
+
+            ret = mb::file_search(file, opts.start, opts.end, opts.bsize,
+                                  p.data(), p.size(), opts.max_matches,
+                                  &search_result_cb, &ctx);
+            if (!ret) {
+                break;
+            }
+        }
+        break;
+    }
+
     if (!ret) {
-        fprintf(stderr, "%s: Search failed: %s\n",
-                name, ret.error().message().c_str());
+        output.err += mb::format("%s: Search failed: %s\n",
+                                 name, ret.error().message().c_str());
         return false;
     }
     return true;
 }
 
-static bool search_stdin(std::optional<uint64_t> start,
-                         std::optional<uint64_t> end,
-                         size_t bsize, const void *pattern,
-                         size_t pattern_size,
-                         std::optional<uint64_t> max_matches)
+static void write_output(const SearchOutput &output)
+{
+    fwrite(output.out.data(), 1, output.out.size(), stdout);
+    fflush(stdout);
+    fwrite(output.err.data(), 1, output.err.size(), stderr);
+}
+
+static bool search_stdin(const SearchOptions &opts)
 {
     mb::PosixFile file;
+    SearchOutput output;
 
     auto ret = file.open(stdin, false);
     if (!ret) {
@@ -140,42 +243,144 @@ static bool search_stdin(std::optional<uint64_t> start,
         return false;
     }
 
-    return search("stdin", file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    bool result = search("stdin", file, opts, output);
+    write_output(output);
+    return result;
 }
 
-static bool search_file(const char *path,
-                        std::optional<uint64_t> start,
-                        std::optional<uint64_t> end,
-                        size_t bsize, const void *pattern,
-                        size_t pattern_size,
-                        std::optional<uint64_t> max_matches)
+static bool search_file(const std::string &path, const SearchOptions &opts,
+                        SearchOutput &output)
 {
+    if (opts.use_mmap) {
+        mb::MmapFile file;
+
+        // Fall back to regular reads for files that cannot be mapped, like
+        // empty files and character devices
+        if (file.open(path, false)) {
+            (void) file.advise(mb::MmapAdvice::Sequential);
+            return search(path.c_str(), file, opts, output);
+        }
+    }
+
     mb::StandardFile file;
 
     auto ret = file.open(path, mb::FileOpenMode::ReadOnly);
     if (!ret) {
-        fprintf(stderr, "%s: Failed to open file: %s\n",
-                path, ret.error().message().c_str());
+        output.err += mb::format("%s: Failed to open file: %s\n",
+                                 path.c_str(), ret.error().message().c_str());
         return false;
     }
 
-    return search(path, file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    return search(path.c_str(), file, opts, output);
 }
 
-int main(int argc, char *argv[])
+static std::vector<std::string> *g_walk_paths;
+
+static int walk_cb(const char *fpath, const struct stat *sb, int typeflag,
+                   struct FTW *ftwbuf)
 {
-    std::optional<uint64_t> start;
-    std::optional<uint64_t> end;
-    size_t bsize = 0;
-    std::optional<uint64_t> max_matches;
+    (void) sb;
+    (void) ftwbuf;
+
+    if (typeflag == FTW_F) {
+        g_walk_paths->emplace_back(fpath);
+    } else if (typeflag == FTW_DNR || typeflag == FTW_NS) {
+        fprintf(stderr, "%s: Failed to read: %s\n", fpath, strerror(errno));
+    }
+
+    return 0;
+}
 
-    const char *text_pattern = nullptr;
-    const char *hex_pattern = nullptr;
-    void *pattern = nullptr;
-    size_t pattern_size = 0;
-    bool pattern_needs_free = false;
+// Expand directories into the regular files beneath them. Symlinks are not
+// followed.
+static bool collect_paths(const char *path, std::vector<std::string> &paths)
+{
+    struct stat sb;
+
+    if (stat(path, &sb) < 0) {
+        fprintf(stderr, "%s: Failed to stat: %s\n", path, strerror(errno));
+        return false;
+    } else if (!S_ISDIR(sb.st_mode)) {
+        paths.emplace_back(path);
+        return true;
+    }
+
+    std::vector<std::string> found;
+    g_walk_paths = &found;
+
+    if (nftw(path, &walk_cb, 64, FTW_PHYS) < 0) {
+        fprintf(stderr, "%s: Failed to walk directory: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), std::make_move_iterator(found.begin()),
+                 std::make_move_iterator(found.end()));
+
+    return true;
+}
+
+// Search the files on a thread pool and print the results in the original
+// order as soon as all of the preceding files are done.
+static bool search_files(const std::vector<std::string> &paths,
+                         const SearchOptions &opts, unsigned int jobs)
+{
+    struct Result
+    {
+        SearchOutput output;
+        bool done = false;
+        bool ok = false;
+    };
+
+    std::vector<Result> results(paths.size());
+    std::mutex lock;
+    size_t next = 0;
+    bool ok = true;
+
+    auto finish = [&](size_t i, bool ret, SearchOutput output) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        results[i].output = std::move(output);
+        results[i].ok = ret;
+        results[i].done = true;
+
+        for (; next < results.size() && results[next].done; ++next) {
+            write_output(results[next].output);
+            results[next].output = {};
+            ok = ok && results[next].ok;
+        }
+    };
+
+    auto task = [&](size_t i) {
+        SearchOutput output;
+        bool ret = search_file(paths[i], opts, output);
+        finish(i, ret, std::move(output));
+    };
+
+    if (jobs == 1) {
+        for (size_t i = 0; i < paths.size(); ++i) {
+            task(i);
+        }
+    } else {
+        mb::ThreadPool pool(jobs, mb::ThreadPool::DEFAULT_QUEUE_LIMIT);
+        mb::TaskGroup group(pool);
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            group.run([&, i] { task(i); });
+        }
+
+        group.wait();
+    }
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    SearchOptions opts;
+    bool recursive = false;
+    unsigned int jobs = 1;
 
     int opt;
 
@@ -185,20 +390,26 @@ int main(int argc, char *argv[])
         OPT_START_OFFSET         = CHAR_MAX + 1,
         OPT_END_OFFSET           = CHAR_MAX + 2,
         OPT_BUFFER_SIZE          = CHAR_MAX + 3,
+        OPT_SEARCHER             = CHAR_MAX + 4,
+        OPT_MMAP                 = CHAR_MAX + 5,
     };
 
-    static const char short_options[] = "hn:p:t:";
+    static const char short_options[] = "hj:n:p:rt:";
 
     static struct option long_options[] = {
         // Arguments with short versions
         {"help",         no_argument,       nullptr, 'h'},
+        {"jobs",         required_argument, nullptr, 'j'},
         {"num-matches",  required_argument, nullptr, 'n'},
         {"hex",          required_argument, nullptr, 'p'},
+        {"recursive",    no_argument,       nullptr, 'r'},
         {"text",         required_argument, nullptr, 't'},
         // Arguments without short versions
         {"start-offset", required_argument, nullptr, OPT_START_OFFSET},
         {"end-offset",   required_argument, nullptr, OPT_END_OFFSET},
         {"buffer-size",  required_argument, nullptr, OPT_BUFFER_SIZE},
+        {"searcher",     required_argument, nullptr, OPT_SEARCHER},
+        {"mmap",         no_argument,       nullptr, OPT_MMAP},
         {nullptr,        0,                 nullptr, 0},
     };
 
@@ -214,16 +425,36 @@ int main(int argc, char *argv[])
                         optarg);
                 return EXIT_FAILURE;
             }
-            max_matches = value;
+            opts.max_matches = value;
+            break;
+        }
+
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs)) {
+                fprintf(stderr, "Invalid value for -j/--jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            if (jobs == 0) {
+                jobs = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+            break;
+
+        case 'p': {
+            std::string pattern;
+            if (!hex_to_binary(optarg, pattern)) {
+                fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+            opts.patterns.push_back(std::move(pattern));
             break;
         }
 
-        case 'p':
-            hex_pattern = optarg;
+        case 'r':
+            recursive = true;
             break;
 
         case 't':
-            text_pattern = optarg;
+            opts.patterns.emplace_back(optarg);
             break;
 
         case OPT_START_OFFSET: {
@@ -233,7 +464,7 @@ int main(int argc, char *argv[])
                         optarg);
                 return EXIT_FAILURE;
             }
-            start = value;
+            opts.start = value;
             break;
         }
 
@@ -244,18 +475,33 @@ int main(int argc, char *argv[])
                         optarg);
                 return EXIT_FAILURE;
             }
-            end = value;
+            opts.end = value;
             break;
         }
 
         case OPT_BUFFER_SIZE:
-            if (!mb::str_to_num(optarg, 10, bsize)) {
+            if (!mb::str_to_num(optarg, 10, opts.bsize)) {
                 fprintf(stderr, "Invalid value for --buffer-size: %s\n",
                         optarg);
                 return EXIT_FAILURE;
             }
             break;
 
+        case OPT_SEARCHER:
+            if (strcmp(optarg, "multi") == 0) {
+                opts.searcher = Searcher::Multi;
+            } else if (strcmp(optarg, "boyer-moore") == 0) {
+                opts.searcher = Searcher::BoyerMoore;
+            } else {
+                fprintf(stderr, "Invalid value for --searcher: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case OPT_MMAP:
+            opts.use_mmap = true;
+            break;
+
         case 'h':
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
@@ -266,37 +512,30 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!hex_pattern && !text_pattern) {
+    if (opts.patterns.empty()) {
         fprintf(stderr, "No pattern provided\n");
         return EXIT_FAILURE;
-    } else if (hex_pattern) {
-        if (!hex_to_binary(hex_pattern, &pattern, &pattern_size)) {
-            fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
-            return EXIT_FAILURE;
-        }
-        pattern_needs_free = true;
-    } else if (text_pattern) {
-        pattern = const_cast<char *>(text_pattern);
-        pattern_size = strlen(text_pattern);
+    }
+
+    if (optind == argc) {
+        return search_stdin(opts) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
     bool ret = true;
+    std::vector<std::string> paths;
 
-    if (optind == argc) {
-        ret = search_stdin(start, end, bsize, pattern, pattern_size,
-                           max_matches);
-    } else {
-        for (int i = optind; i < argc; ++i) {
-            bool ret2 = search_file(argv[i], start, end, bsize, pattern,
-                                    pattern_size, max_matches);
-            if (!ret2) {
+    for (int i = optind; i < argc; ++i) {
+        if (recursive) {
+            if (!collect_paths(argv[i], paths)) {
                 ret = false;
             }
+        } else {
+            paths.emplace_back(argv[i]);
         }
     }
 
-    if (pattern_needs_free) {
-        free(pattern);
+    if (!search_files(paths, opts, jobs)) {
+        ret = false;
     }
 
     return ret ? EXIT_SUCCESS : EXIT_FAILURE;
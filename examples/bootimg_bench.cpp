@@ -0,0 +1,543 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput benchmark for the libmbbootimg readers and writers. Images of each
+// format are generated in memory, packed with Writer, and read back with
+// Reader (including format bidding) through the MemoryFile, FdFile, and
+// PosixFile backends. The number of heap allocations made per operation is
+// reported too.
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/posix.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static uint64_t g_allocations = 0;
+
+void * operator new(size_t size)
+{
+    ++g_allocations;
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    std::abort();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+
+// Loki target that the generated aboot image matches (Samsung Galaxy S4, AT&T)
+constexpr uint32_t LOKI_CHECK_SIGS      = 0x88e0ff98;
+constexpr uint32_t LOKI_ABOOT_BASE      = 0x88e00000;
+constexpr char LOKI_THUMB_PATTERN[]     = "\xf0\xb5\x8f\xb0\x06\x46\xf0\xf7";
+constexpr size_t LOKI_PATTERN_SIZE      = 8;
+
+constexpr char MTK_MAGIC[]              = "\x88\x16\x88\x58";
+constexpr size_t MTK_HEADER_SIZE        = 512;
+
+constexpr size_t READ_BUFFER_SIZE       = 1024 * 1024;
+
+struct Options
+{
+    bool json = false;
+    unsigned int iterations = 20;
+    size_t kernel_size = 8 * 1024 * 1024;
+    size_t ramdisk_size = 4 * 1024 * 1024;
+};
+
+struct Payloads
+{
+    std::vector<unsigned char> kernel;
+    std::vector<unsigned char> ramdisk;
+    std::vector<unsigned char> secondboot;
+    std::vector<unsigned char> device_tree;
+    std::vector<unsigned char> aboot;
+    std::vector<unsigned char> mtk_kernel_header;
+    std::vector<unsigned char> mtk_ramdisk_header;
+    std::vector<unsigned char> sony_ipl;
+    std::vector<unsigned char> sony_rpm;
+    std::vector<unsigned char> sony_appsbl;
+
+    const std::vector<unsigned char> * get(int type) const
+    {
+        switch (type) {
+        case ENTRY_TYPE_KERNEL:             return &kernel;
+        case ENTRY_TYPE_RAMDISK:            return &ramdisk;
+        case ENTRY_TYPE_SECONDBOOT:         return &secondboot;
+        case ENTRY_TYPE_DEVICE_TREE:        return &device_tree;
+        case ENTRY_TYPE_ABOOT:              return &aboot;
+        case ENTRY_TYPE_MTK_KERNEL_HEADER:  return &mtk_kernel_header;
+        case ENTRY_TYPE_MTK_RAMDISK_HEADER: return &mtk_ramdisk_header;
+        case ENTRY_TYPE_SONY_IPL:           return &sony_ipl;
+        case ENTRY_TYPE_SONY_RPM:           return &sony_rpm;
+        case ENTRY_TYPE_SONY_APPSBL:        return &sony_appsbl;
+        default:                            return nullptr;
+        }
+    }
+};
+
+struct Result
+{
+    std::string name;
+    std::string format;
+    std::string backend;
+    unsigned int iterations;
+    uint64_t bytes;
+    double seconds;
+    uint64_t allocations;
+};
+
+// Deterministic, poorly compressible data
+std::vector<unsigned char> make_data(size_t size, uint32_t seed)
+{
+    std::vector<unsigned char> data(size);
+    uint32_t state = seed;
+
+    for (auto &c : data) {
+        state = state * 1103515245u + 12345u;
+        c = static_cast<unsigned char>(state >> 16);
+    }
+
+    return data;
+}
+
+std::vector<unsigned char> make_mtk_header(const char *type)
+{
+    std::vector<unsigned char> header(MTK_HEADER_SIZE, 0xff);
+    memcpy(header.data(), MTK_MAGIC, 4);
+    // The size at offset 4 is filled in by the writer
+    memset(header.data() + 4, 0, 4);
+    memset(header.data() + 8, 0, 32);
+    memcpy(header.data() + 8, type, strlen(type));
+    return header;
+}
+
+// Zeroed aboot image with the check_sigs() prologue of a known Loki target
+std::vector<unsigned char> make_aboot()
+{
+    std::vector<unsigned char> aboot(1024 * 1024);
+
+    uint32_t entry = LOKI_ABOOT_BASE + 0x28;
+    for (size_t i = 0; i < 4; ++i) {
+        aboot[12 + i] = static_cast<unsigned char>(entry >> (8 * i));
+    }
+
+    memcpy(aboot.data() + (LOKI_CHECK_SIGS - LOKI_ABOOT_BASE),
+           LOKI_THUMB_PATTERN, LOKI_PATTERN_SIZE);
+
+    return aboot;
+}
+
+Payloads make_payloads(const Options &opts)
+{
+    Payloads p;
+    p.kernel = make_data(opts.kernel_size, 1);
+    p.ramdisk = make_data(opts.ramdisk_size, 2);
+    p.secondboot = make_data(64 * 1024, 3);
+    p.device_tree = make_data(512 * 1024, 4);
+    p.aboot = make_aboot();
+    p.mtk_kernel_header = make_mtk_header("KERNEL");
+    p.mtk_ramdisk_header = make_mtk_header("ROOTFS");
+    p.sony_ipl = make_data(128 * 1024, 5);
+    p.sony_rpm = make_data(128 * 1024, 6);
+    p.sony_appsbl = make_data(512 * 1024, 7);
+    return p;
+}
+
+oc::result<void> write_image(Writer &writer, File &file,
+                             const Payloads &payloads)
+{
+    Header header;
+    Entry entry;
+
+    OUTCOME_TRYV(writer.open(&file));
+
+    OUTCOME_TRYV(writer.get_header(header));
+    header.set_page_size(2048);
+    header.set_kernel_address(0x80208000);
+    header.set_ramdisk_address(0x82200000);
+    header.set_secondboot_address(0x81100000);
+    header.set_kernel_tags_address(0x80200100);
+    header.set_sony_ipl_address(0x00020000);
+    header.set_sony_rpm_address(0x00200000);
+    header.set_sony_appsbl_address(0x88f00000);
+    header.set_entrypoint_address(0x80208000);
+    header.set_kernel_cmdline({"console=ttyHSL0,115200,n8"});
+    OUTCOME_TRYV(writer.write_header(header));
+
+    while (true) {
+        auto ret = writer.get_entry(entry);
+        if (!ret) {
+            if (ret.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            return ret.as_failure();
+        }
+
+        OUTCOME_TRYV(writer.write_entry(entry));
+
+        if (auto data = payloads.get(*entry.type())) {
+            OUTCOME_TRY(n, writer.write_data(data->data(), data->size()));
+            if (n != data->size()) {
+                return std::errc::io_error;
+            }
+        }
+    }
+
+    return writer.close();
+}
+
+oc::result<uint64_t> read_image(File &file, std::vector<unsigned char> &buf)
+{
+    Reader reader;
+    Header header;
+    Entry entry;
+    uint64_t total = 0;
+
+    OUTCOME_TRYV(reader.enable_format_all());
+    OUTCOME_TRYV(reader.open(&file));
+    OUTCOME_TRYV(reader.read_header(header));
+
+    while (true) {
+        auto ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            return ret.as_failure();
+        }
+
+        while (true) {
+            OUTCOME_TRY(n, reader.read_data(buf.data(), buf.size()));
+            if (n == 0) {
+                break;
+            }
+            total += n;
+        }
+    }
+
+    OUTCOME_TRYV(reader.close());
+
+    return total;
+}
+
+oc::result<void> open_image(File &file)
+{
+    Reader reader;
+    Header header;
+
+    OUTCOME_TRYV(reader.enable_format_all());
+    OUTCOME_TRYV(reader.open(&file));
+    OUTCOME_TRYV(reader.read_header(header));
+
+    return reader.close();
+}
+
+// Runs \p fn, which returns the number of bytes processed, \p iterations times
+oc::result<Result> measure(const char *name, const std::string &format,
+                           const char *backend, unsigned int iterations,
+                           const std::function<oc::result<uint64_t>()> &fn)
+{
+    // Warm up the page cache and any lazily initialized state
+    OUTCOME_TRYV(fn());
+
+    uint64_t bytes = 0;
+    uint64_t allocations = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < iterations; ++i) {
+        OUTCOME_TRY(n, fn());
+        bytes += n;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    return Result{
+        name, format, backend, iterations, bytes,
+        std::chrono::duration<double>(elapsed).count(),
+        g_allocations - allocations,
+    };
+}
+
+void print_result(const Result &r, bool json, bool &first)
+{
+    double us_per_op = r.seconds * 1e6 / r.iterations;
+    double mb_per_s = r.bytes > 0
+            ? static_cast<double>(r.bytes) / 1e6 / r.seconds : 0.0;
+    double allocs_per_op = static_cast<double>(r.allocations) / r.iterations;
+
+    if (json) {
+        printf("%s\n    {\"name\": \"%s\", \"format\": \"%s\", "
+               "\"backend\": \"%s\", \"iterations\": %u, "
+               "\"bytes_per_op\": %" PRIu64 ", \"us_per_op\": %.3f, "
+               "\"mb_per_s\": %.2f, \"allocations_per_op\": %.2f}",
+               first ? "" : ",", r.name.c_str(), r.format.c_str(),
+               r.backend.c_str(), r.iterations, r.bytes / r.iterations,
+               us_per_op, mb_per_s, allocs_per_op);
+    } else {
+        printf("%-6s %-9s %-7s %12.1f us/op %10.2f MB/s %10.1f allocs/op\n",
+               r.name.c_str(), r.format.c_str(), r.backend.c_str(),
+               us_per_op, mb_per_s, allocs_per_op);
+    }
+
+    first = false;
+}
+
+void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...]\n"
+                    "\n"
+                    "Options:\n"
+                    "  -n, --iterations <count>\n"
+                    "                   Iterations per benchmark (default: 20)\n"
+                    "  -k, --kernel-size <MiB>\n"
+                    "                   Size of the kernel (default: 8)\n"
+                    "  -r, --ramdisk-size <MiB>\n"
+                    "                   Size of the ramdisk (default: 4)\n"
+                    "  -j, --json       Print results as JSON\n"
+                    "  -h, --help       Display this help message\n",
+                    prog_name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "n:k:r:jh";
+
+    static struct option long_options[] = {
+        {"iterations",   required_argument, nullptr, 'n'},
+        {"kernel-size",  required_argument, nullptr, 'k'},
+        {"ramdisk-size", required_argument, nullptr, 'r'},
+        {"json",         no_argument,       nullptr, 'j'},
+        {"help",         no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.iterations = static_cast<unsigned int>(
+                    strtoul(optarg, nullptr, 10));
+            break;
+        case 'k':
+            opts.kernel_size = strtoul(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'r':
+            opts.ramdisk_size = strtoul(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'j':
+            opts.json = true;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc != optind || opts.iterations == 0 || opts.kernel_size == 0) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char temp_template[] = "/tmp/bootimg_bench.XXXXXX";
+    int temp_fd = mkstemp(temp_template);
+    if (temp_fd < 0) {
+        fprintf(stderr, "Failed to create temporary file: %s\n",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    unlink(temp_template);
+
+    auto payloads = make_payloads(opts);
+    std::vector<unsigned char> read_buf(READ_BUFFER_SIZE);
+    bool first = true;
+    bool failed = false;
+
+    auto report = [&](const oc::result<Result> &r, const char *what,
+                      const std::string &format, const char *backend) {
+        if (r) {
+            print_result(r.value(), opts.json, first);
+        } else {
+            fprintf(stderr, "%s %s (%s): %s\n", what, format.c_str(), backend,
+                    r.error().message().c_str());
+            failed = true;
+        }
+    };
+
+    if (opts.json) {
+        printf("[");
+    }
+
+    static const char *formats[] = {
+        "android", "bump", "loki", "mtk", "sony_elf",
+    };
+
+    for (auto const *format : formats) {
+        void *image = nullptr;
+        size_t image_size = 0;
+
+        // Pack the image into memory
+        auto w = measure("write", format, "memory", opts.iterations,
+                         [&]() -> oc::result<uint64_t> {
+            free(image);
+            image = nullptr;
+            image_size = 0;
+
+            MemoryFile file(&image, &image_size);
+            Writer writer;
+            OUTCOME_TRYV(writer.set_format_by_name(format));
+            OUTCOME_TRYV(write_image(writer, file, payloads));
+            return image_size;
+        });
+        report(w, "write", format, "memory");
+
+        if (!w) {
+            free(image);
+            continue;
+        }
+
+        // Pack the image into a file
+        auto wf = measure("write", format, "fd", opts.iterations,
+                          [&]() -> oc::result<uint64_t> {
+            if (ftruncate(temp_fd, 0) < 0) {
+                return ec_from_errno();
+            }
+
+            FdFile file;
+            OUTCOME_TRYV(file.open(temp_fd, false));
+            OUTCOME_TRYV(file.seek(0, SEEK_SET));
+            Writer writer;
+            OUTCOME_TRYV(writer.set_format_by_name(format));
+            OUTCOME_TRYV(write_image(writer, file, payloads));
+            return image_size;
+        });
+        report(wf, "write", format, "fd");
+
+        if (!wf) {
+            free(image);
+            continue;
+        }
+
+        auto read_memory = [&]() -> oc::result<uint64_t> {
+            MemoryFile file(image, image_size);
+            return read_image(file, read_buf);
+        };
+        auto read_fd = [&]() -> oc::result<uint64_t> {
+            FdFile file;
+            OUTCOME_TRYV(file.open(temp_fd, false));
+            OUTCOME_TRYV(file.seek(0, SEEK_SET));
+            return read_image(file, read_buf);
+        };
+        auto read_posix = [&]() -> oc::result<uint64_t> {
+            int fd = dup(temp_fd);
+            if (fd < 0) {
+                return ec_from_errno();
+            }
+            FILE *fp = fdopen(fd, "rb");
+            if (!fp) {
+                close(fd);
+                return ec_from_errno();
+            }
+            PosixFile file;
+            OUTCOME_TRYV(file.open(fp, true));
+            OUTCOME_TRYV(file.seek(0, SEEK_SET));
+            return read_image(file, read_buf);
+        };
+
+        report(measure("read", format, "memory", opts.iterations, read_memory),
+               "read", format, "memory");
+        report(measure("read", format, "fd", opts.iterations, read_fd),
+               "read", format, "fd");
+        report(measure("read", format, "posix", opts.iterations, read_posix),
+               "read", format, "posix");
+
+        // Format bidding and header parsing only
+        auto open_memory = [&]() -> oc::result<uint64_t> {
+            MemoryFile file(image, image_size);
+            OUTCOME_TRYV(open_image(file));
+            return 0;
+        };
+        auto open_fd = [&]() -> oc::result<uint64_t> {
+            FdFile file;
+            OUTCOME_TRYV(file.open(temp_fd, false));
+            OUTCOME_TRYV(file.seek(0, SEEK_SET));
+            OUTCOME_TRYV(open_image(file));
+            return 0;
+        };
+
+        report(measure("open", format, "memory", opts.iterations * 10,
+                       open_memory), "open", format, "memory");
+        report(measure("open", format, "fd", opts.iterations * 10, open_fd),
+               "open", format, "fd");
+
+        free(image);
+    }
+
+    if (opts.json) {
+        printf("\n]\n");
+    }
+
+    close(temp_fd);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
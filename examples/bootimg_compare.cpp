@@ -17,195 +17,470 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <getopt.h>
 
+#include <openssl/sha.h>
+
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/thread_pool.h"
+
+#include "mbbootimg/compare.h"
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
 
+using namespace mb::bootimg;
+
 static void usage(FILE *stream, const char *prog_name)
 {
-    fprintf(stream, "Usage: %s <file1> <file2>\n"
+    fprintf(stream, "Usage: %s [option...] <file1> <file2>\n"
+                    "       %s [option...] --batch <reference> <file>...\n"
+                    "\n"
+                    "Options:\n"
+                    "  -f, --fast      Compare entry sizes and SHA1 digests\n"
+                    "                  instead of the data itself\n"
+                    "  --full          With --fast or --batch, also compare the\n"
+                    "                  data of images whose digests match\n"
+                    "  -b, --batch     Compare every file against the reference\n"
+                    "                  image (implies --fast)\n"
+                    "  -j, --jobs <count>\n"
+                    "                  Number of images to process in parallel\n"
+                    "                  (default: one per CPU core)\n"
+                    "  --mmap          Memory map the boot images\n"
+                    "\n"
+                    "In batch mode, one line is printed for each file.\n"
                     "\n"
                     "Exits with:\n"
                     "  0 if boot images are equal\n"
                     "  1 if an error occurs\n"
                     "  2 if boot images are not equal\n",
-                    prog_name);
+                    prog_name, prog_name);
 }
 
-int main(int argc, char *argv[])
+enum class CompareResult
 {
-    int opt;
-
-    static const char short_options[] = "h";
+    Equal,
+    NotEqual,
+    Error,
+};
 
-    static struct option long_options[] = {
-        {"help", no_argument, nullptr, 'h'},
-        {nullptr, 0, nullptr, 0},
-    };
+struct EntrySummary
+{
+    int type;
+    uint64_t size;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+};
 
-    int long_index = 0;
+struct ImageSummary
+{
+    Header header;
+    std::vector<EntrySummary> entries;
+};
 
-    while ((opt = getopt_long(argc, argv, short_options,
-                              long_options, &long_index)) != -1) {
-        switch (opt) {
-        case 'h':
-            usage(stdout, argv[0]);
-            return EXIT_SUCCESS;
+static std::unique_ptr<mb::File> open_file(const char *path, bool use_mmap)
+{
+    if (use_mmap) {
+        auto file = std::make_unique<mb::MmapFile>();
 
-        default:
-            usage(stderr, argv[0]);
-            return EXIT_FAILURE;
+        // Fall back to regular reads if the file cannot be mapped
+        if (file->open(path, false)) {
+            (void) file->advise(mb::MmapAdvice::Sequential);
+            return file;
         }
     }
 
-    if (argc - optind != 2) {
-        usage(stderr, argv[0]);
-        return EXIT_FAILURE;
-    }
-
-    using namespace mb::bootimg;
+    auto file = std::make_unique<mb::StandardFile>();
 
-    const char *filename1 = argv[optind];
-    const char *filename2 = argv[optind + 1];
+    auto ret = file->open(path, mb::FileOpenMode::ReadOnly);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path, ret.error().message().c_str());
+        return nullptr;
+    }
 
-    Reader reader1;
-    Reader reader2;
-    Header header1;
-    Header header2;
-    Entry entry1;
-    Entry entry2;
-    size_t entries = 0;
+    return file;
+}
 
-    // Set up reader formats
-    auto ret = reader1.enable_format_all();
+static bool open_reader(Reader &reader, const char *path, bool use_mmap)
+{
+    auto ret = reader.enable_format_all();
     if (!ret) {
         fprintf(stderr, "Failed to enable all boot image formats: %s\n",
                 ret.error().message().c_str());
-        return EXIT_FAILURE;
+        return false;
     }
-    ret = reader2.enable_format_all();
-    if (!ret) {
-        fprintf(stderr, "Failed to enable all boot image formats: %s\n",
-                ret.error().message().c_str());
-        return EXIT_FAILURE;
+
+    auto file = open_file(path, use_mmap);
+    if (!file) {
+        return false;
     }
 
-    // Open boot images
-    ret = reader1.open_filename(filename1);
+    ret = reader.open(std::move(file));
     if (!ret) {
         fprintf(stderr, "%s: Failed to open boot image for reading: %s\n",
-                filename1, ret.error().message().c_str());
-        return EXIT_FAILURE;
+                path, ret.error().message().c_str());
+        return false;
     }
-    ret = reader2.open_filename(filename2);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open boot image for reading: %s\n",
-                filename2, ret.error().message().c_str());
-        return EXIT_FAILURE;
+
+    return true;
+}
+
+static const EntrySummary * find_entry(const ImageSummary &summary, int type)
+{
+    for (auto const &e : summary.entries) {
+        if (e.type == type) {
+            return &e;
+        }
     }
+    return nullptr;
+}
 
-    // Read headers
-    ret = reader1.read_header(header1);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                filename1, ret.error().message().c_str());
-        return EXIT_FAILURE;
+/*!
+ * \brief Read the header and hash each entry of a boot image
+ *
+ * If \p reference is given, this stops as soon as the image is known to differ
+ * from it, either by its header or by the type or size of an entry.
+ */
+static CompareResult summarize(const char *path, bool use_mmap,
+                               const ImageSummary *reference,
+                               ImageSummary &summary)
+{
+    Reader reader;
+    Entry entry;
+
+    if (!open_reader(reader, path, use_mmap)) {
+        return CompareResult::Error;
     }
-    ret = reader2.read_header(header2);
+
+    auto ret = reader.read_header(summary.header);
     if (!ret) {
         fprintf(stderr, "%s: Failed to read header: %s\n",
-                filename2, ret.error().message().c_str());
-        return EXIT_FAILURE;
+                path, ret.error().message().c_str());
+        return CompareResult::Error;
     }
 
-    // Compare headers
-    if (header1 != header2) {
-        return 2;
+    if (reference && summary.header != reference->header) {
+        return CompareResult::NotEqual;
     }
 
-    // Count entries in first boot image
-    {
-        while (true) {
-            ret = reader1.read_entry(entry1);
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    break;
+    // Formats that can list their entries allow rejecting a different layout
+    // before any data is hashed
+    if (reference) {
+        auto entries = reader.entries();
+        if (entries) {
+            if (entries.value().size() != reference->entries.size()) {
+                return CompareResult::NotEqual;
+            }
+            for (auto const &e : entries.value()) {
+                auto *ref = find_entry(*reference, e.type);
+                if (!ref || ref->size != e.size) {
+                    return CompareResult::NotEqual;
                 }
-                fprintf(stderr, "%s: Failed to read entry: %s\n",
-                        filename1, ret.error().message().c_str());
-                return EXIT_FAILURE;
             }
-            ++entries;
         }
     }
 
-    // Compare each entry in second image to first
-    {
-        while (true) {
-            ret = reader2.read_entry(entry2);
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                fprintf(stderr, "%s: Failed to read entry: %s",
-                        filename2, ret.error().message().c_str());
-                return EXIT_FAILURE;
-            }
+    std::vector<unsigned char> buf;
 
-            if (entries == 0) {
-                // Too few entries in second image
-                return 2;
+    while (true) {
+        ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
             }
-            --entries;
-
-            // Find the same entry in first image
-            ret = reader1.go_to_entry(entry1, *entry2.type());
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    // Cannot be equal if entry is missing
-                    return 2;
-                } else {
-                    fprintf(stderr, "%s: Failed to seek to entry: %s\n",
-                            filename1, ret.error().message().c_str());
-                    return EXIT_FAILURE;
-                }
+            fprintf(stderr, "%s: Failed to read entry: %s\n",
+                    path, ret.error().message().c_str());
+            return CompareResult::Error;
+        }
+
+        EntrySummary es{*entry.type(), 0, {}};
+
+        if (reference) {
+            auto *ref = find_entry(*reference, es.type);
+            if (!ref || (entry.size() && *entry.size() != ref->size)) {
+                return CompareResult::NotEqual;
             }
+        }
+
+        SHA_CTX ctx;
+        SHA1_Init(&ctx);
 
-            // Compare data
-            char buf1[10240];
-            char buf2[10240];
+        auto view = reader.read_data_view();
+        if (view) {
+            SHA1_Update(&ctx, view.value().data, view.value().size);
+            es.size = view.value().size;
+        } else if (view.error() == mb::FileError::UnsupportedView) {
+            buf.resize(1024 * 1024);
 
             while (true) {
-                auto n1 = reader1.read_data(buf1, sizeof(buf1));
-                if (!n1) {
-                    fprintf(stderr, "%s: Failed to read data: %s\n", filename1,
-                            n1.error().message().c_str());
-                    return EXIT_FAILURE;
-                } else if (n1.value() == 0) {
+                auto n = reader.read_data(buf.data(), buf.size());
+                if (!n) {
+                    fprintf(stderr, "%s: Failed to read data: %s\n",
+                            path, n.error().message().c_str());
+                    return CompareResult::Error;
+                } else if (n.value() == 0) {
                     break;
                 }
 
-                auto n2 = reader2.read_data(buf2, n1.value());
-                if (!n2) {
-                    fprintf(stderr, "%s: Failed to read data: %s\n", filename2,
-                            n2.error().message().c_str());
-                    return EXIT_FAILURE;
-                }
+                SHA1_Update(&ctx, buf.data(), n.value());
+                es.size += n.value();
+            }
+        } else {
+            fprintf(stderr, "%s: Failed to read data: %s\n",
+                    path, view.error().message().c_str());
+            return CompareResult::Error;
+        }
 
-                if (n1.value() != n2.value()
-                        || memcmp(buf1, buf2, n1.value()) != 0) {
-                    // Data is not equivalent
-                    return 2;
-                }
+        SHA1_Final(es.digest, &ctx);
+        summary.entries.push_back(es);
+    }
+
+    return CompareResult::Equal;
+}
+
+static bool summaries_equal(const ImageSummary &a, const ImageSummary &b)
+{
+    if (a.header != b.header || a.entries.size() != b.entries.size()) {
+        return false;
+    }
+
+    // Entries are matched by type, like in the full comparison
+    return std::all_of(b.entries.begin(), b.entries.end(),
+                       [&](const EntrySummary &e) {
+        auto *other = find_entry(a, e.type);
+        return other && other->size == e.size
+                && memcmp(other->digest, e.digest, sizeof(e.digest)) == 0;
+    });
+}
+
+static CompareResult compare_exact(const char *filename1,
+                                   const char *filename2, bool use_mmap)
+{
+    auto file1 = open_file(filename1, use_mmap);
+    if (!file1) {
+        return CompareResult::Error;
+    }
+    auto file2 = open_file(filename2, use_mmap);
+    if (!file2) {
+        return CompareResult::Error;
+    }
+
+    // With --mmap, the entries are compared in place with memcmp()
+    auto equal = images_equal(*file1, *file2);
+    if (!equal) {
+        fprintf(stderr, "Failed to compare %s and %s: %s\n",
+                filename1, filename2, equal.error().message().c_str());
+        return CompareResult::Error;
+    }
+
+    return equal.value() ? CompareResult::Equal : CompareResult::NotEqual;
+}
+
+static CompareResult compare_fast(const char *filename1,
+                                  const char *filename2, bool use_mmap,
+                                  bool full)
+{
+    ImageSummary summary1;
+    ImageSummary summary2;
+    CompareResult result2;
+
+    // Hash both images at the same time
+    std::thread thread([&] {
+        result2 = summarize(filename2, use_mmap, nullptr, summary2);
+    });
+    auto result1 = summarize(filename1, use_mmap, nullptr, summary1);
+    thread.join();
+
+    if (result1 == CompareResult::Error || result2 == CompareResult::Error) {
+        return CompareResult::Error;
+    } else if (!summaries_equal(summary1, summary2)) {
+        return CompareResult::NotEqual;
+    } else if (full) {
+        return compare_exact(filename1, filename2, use_mmap);
+    }
+
+    return CompareResult::Equal;
+}
+
+static CompareResult compare_batch(const char *reference,
+                                   const std::vector<const char *> &paths,
+                                   bool use_mmap, bool full,
+                                   unsigned int jobs)
+{
+    ImageSummary ref_summary;
+
+    if (summarize(reference, use_mmap, nullptr, ref_summary)
+            != CompareResult::Equal) {
+        return CompareResult::Error;
+    }
+
+    std::vector<CompareResult> results(paths.size(), CompareResult::Error);
+    std::vector<bool> done(paths.size());
+    std::mutex lock;
+    size_t next = 0;
+
+    auto task = [&](size_t i) {
+        ImageSummary summary;
+
+        auto result = summarize(paths[i], use_mmap, &ref_summary, summary);
+        if (result == CompareResult::Equal) {
+            if (!summaries_equal(ref_summary, summary)) {
+                result = CompareResult::NotEqual;
+            } else if (full) {
+                result = compare_exact(reference, paths[i], use_mmap);
+            }
+        }
+
+        // Print the results in the order the files were given
+        std::lock_guard<std::mutex> guard(lock);
+
+        results[i] = result;
+        done[i] = true;
+
+        for (; next < paths.size() && done[next]; ++next) {
+            printf("%s: %s\n", paths[next],
+                   results[next] == CompareResult::Equal ? "equal"
+                   : results[next] == CompareResult::NotEqual ? "not equal"
+                   : "error");
+        }
+        fflush(stdout);
+    };
+
+    {
+        mb::ThreadPool pool(jobs, mb::ThreadPool::DEFAULT_QUEUE_LIMIT);
+        mb::TaskGroup group(pool);
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            group.run([&, i] { task(i); });
+        }
+
+        group.wait();
+    }
+
+    if (std::find(results.begin(), results.end(), CompareResult::Error)
+            != results.end()) {
+        return CompareResult::Error;
+    } else if (std::find(results.begin(), results.end(),
+                         CompareResult::NotEqual) != results.end()) {
+        return CompareResult::NotEqual;
+    }
+
+    return CompareResult::Equal;
+}
+
+int main(int argc, char *argv[])
+{
+    bool fast = false;
+    bool full = false;
+    bool batch = false;
+    bool use_mmap = false;
+    unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    int opt;
+
+    // Arguments with no short options
+    enum : int
+    {
+        OPT_FULL                 = CHAR_MAX + 1,
+        OPT_MMAP                 = CHAR_MAX + 2,
+    };
+
+    static const char short_options[] = "bfhj:";
+
+    static struct option long_options[] = {
+        // Arguments with short versions
+        {"batch", no_argument,       nullptr, 'b'},
+        {"fast",  no_argument,       nullptr, 'f'},
+        {"help",  no_argument,       nullptr, 'h'},
+        {"jobs",  required_argument, nullptr, 'j'},
+        // Arguments without short versions
+        {"full",  no_argument,       nullptr, OPT_FULL},
+        {"mmap",  no_argument,       nullptr, OPT_MMAP},
+        {nullptr, 0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = true;
+            break;
+
+        case 'f':
+            fast = true;
+            break;
+
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid value for -j/--jobs: %s\n", optarg);
+                return EXIT_FAILURE;
             }
+            break;
+
+        case OPT_FULL:
+            full = true;
+            break;
+
+        case OPT_MMAP:
+            use_mmap = true;
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
         }
     }
 
-    return EXIT_SUCCESS;
+    CompareResult result;
+
+    if (batch) {
+        if (argc - optind < 2) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        std::vector<const char *> paths(argv + optind + 1, argv + argc);
+        result = compare_batch(argv[optind], paths, use_mmap, full, jobs);
+    } else {
+        if (argc - optind != 2) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (fast) {
+            result = compare_fast(argv[optind], argv[optind + 1], use_mmap,
+                                  full);
+        } else {
+            result = compare_exact(argv[optind], argv[optind + 1], use_mmap);
+        }
+    }
+
+    switch (result) {
+    case CompareResult::Equal:
+        return EXIT_SUCCESS;
+    case CompareResult::NotEqual:
+        return 2;
+    default:
+        return EXIT_FAILURE;
+    }
 }
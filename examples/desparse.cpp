@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016-2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ * Copyright (C) 2016-2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
  *
  * This file is part of DualBootPatcher
  *
@@ -17,70 +17,132 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <memory>
+// Sparse image tool
+//
+//   desparse <input file> <output file>
+//   desparse extract <input file> <output file>
+//   desparse info [--json] <input file>
+//   desparse bench [--json] [--seeks <count>] [<input file>]
+//
+// "info" prints chunk statistics and the sequential decode throughput.
+// "bench" measures sequential, random seek, and hole skipping workloads on the
+// given image or, if no image is given, on a synthetic image generated in
+// memory.
+
+#include <chrono>
+#include <random>
 #include <string>
+#include <vector>
 
-#include <cstdlib>
+#include <cinttypes>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
+#include "mbcommon/file/memory.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/string.h"
 #include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
 
-int main(int argc, char *argv[])
+using namespace mb;
+using namespace mb::sparse;
+
+namespace
 {
-    if (argc != 3) {
-        std::fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
-        return EXIT_FAILURE;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t READ_BUF_SIZE = 1024 * 1024;
+constexpr size_t SEEK_READ_SIZE = 4096;
+
+std::string json_escape(const char *str)
+{
+    std::string result;
+
+    for (; *str; ++str) {
+        auto c = static_cast<unsigned char>(*str);
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += static_cast<char>(c);
+        }
     }
 
-    const char *input_path = argv[1];
-    const char *output_path = argv[2];
+    return result;
+}
 
-    mb::StandardFile input_file;
-    mb::StandardFile output_file;
-    mb::sparse::SparseFile sparse_file;
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
+double mib_per_sec(uint64_t bytes, double seconds)
+{
+    return seconds > 0
+            ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0;
+}
+
+struct WorkloadResult
+{
+    const char *name;
+    uint64_t bytes;
+    uint64_t operations;
+    double seconds;
+};
+
+bool extract(const char *input_path, const char *output_path)
+{
+    StandardFile input_file;
+    StandardFile output_file;
+    SparseFile sparse_file;
+
+    auto open_ret = input_file.open(input_path, FileOpenMode::ReadOnly);
     if (!open_ret) {
         fprintf(stderr, "%s: Failed to open for reading: %s\n",
                 input_path, open_ret.error().message().c_str());
-        return EXIT_FAILURE;
+        return false;
     }
 
     open_ret = sparse_file.open(&input_file);
     if (!open_ret) {
         fprintf(stderr, "%s: %s\n",
                 input_path, open_ret.error().message().c_str());
-        return EXIT_FAILURE;
+        return false;
     }
 
-    open_ret = output_file.open(output_path, mb::FileOpenMode::WriteOnly);
+    open_ret = output_file.open(output_path, FileOpenMode::WriteOnly);
     if (!open_ret) {
         fprintf(stderr, "%s: Failed to open for writing: %s\n",
                 output_path, open_ret.error().message().c_str());
-        return EXIT_FAILURE;
+        return false;
     }
 
-    char buf[10240];
+    std::vector<char> buf(READ_BUF_SIZE);
 
     while (true) {
-        auto n_read = sparse_file.read(buf, sizeof(buf));
+        auto n_read = sparse_file.read(buf.data(), buf.size());
         if (!n_read) {
             fprintf(stderr, "%s: Failed to read file: %s\n",
                     input_path, n_read.error().message().c_str());
-            return EXIT_FAILURE;
+            return false;
         } else if (n_read.value() == 0) {
             break;
         }
 
-        char *ptr = buf;
+        char *ptr = buf.data();
 
         while (n_read.value() > 0) {
-            auto n_written = output_file.write(buf, n_read.value());
+            auto n_written = output_file.write(ptr, n_read.value());
             if (!n_written) {
                 fprintf(stderr, "%s: Failed to write file: %s\n",
                         output_path, n_written.error().message().c_str());
-                return EXIT_FAILURE;
+                return false;
             }
             n_read.value() -= n_written.value();
             ptr += n_written.value();
@@ -91,8 +153,358 @@ int main(int argc, char *argv[])
     if (!close_ret) {
         fprintf(stderr, "%s: Failed to close file: %s\n",
                 output_path, close_ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Read the whole image sequentially. If skip_holes is true, "don't care"
+// regions are skipped instead of being expanded to zeros.
+bool run_sequential(SparseFile &sparse_file, bool skip_holes,
+                    WorkloadResult &result)
+{
+    std::vector<char> buf(READ_BUF_SIZE);
+
+    auto seek_ret = sparse_file.seek(0, SEEK_SET);
+    if (!seek_ret) {
+        fprintf(stderr, "Failed to seek: %s\n",
+                seek_ret.error().message().c_str());
+        return false;
+    }
+
+    auto start = Clock::now();
+
+    while (true) {
+        if (skip_holes) {
+            auto skipped = sparse_file.skip_hole();
+            if (!skipped) {
+                fprintf(stderr, "Failed to skip hole: %s\n",
+                        skipped.error().message().c_str());
+                return false;
+            } else if (skipped.value() > 0) {
+                result.bytes += skipped.value();
+                ++result.operations;
+                continue;
+            }
+        }
+
+        auto n = sparse_file.read(buf.data(), buf.size());
+        if (!n) {
+            fprintf(stderr, "Failed to read: %s\n",
+                    n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        result.bytes += n.value();
+        ++result.operations;
+    }
+
+    result.seconds = seconds_since(start);
+    return true;
+}
+
+// Read small blocks at random offsets
+bool run_random_seek(SparseFile &sparse_file, uint64_t seeks,
+                     WorkloadResult &result)
+{
+    char buf[SEEK_READ_SIZE];
+    uint64_t size = sparse_file.size();
+
+    if (size == 0) {
+        result.seconds = 0;
+        return true;
+    }
+
+    // Fixed seed so that runs are comparable
+    std::mt19937_64 rng(0x5ba45e);
+    std::uniform_int_distribution<uint64_t> dist(0, size - 1);
+
+    auto start = Clock::now();
+
+    for (uint64_t i = 0; i < seeks; ++i) {
+        auto seek_ret = sparse_file.seek(static_cast<int64_t>(dist(rng)),
+                                         SEEK_SET);
+        if (!seek_ret) {
+            fprintf(stderr, "Failed to seek: %s\n",
+                    seek_ret.error().message().c_str());
+            return false;
+        }
+
+        auto n = sparse_file.read(buf, sizeof(buf));
+        if (!n) {
+            fprintf(stderr, "Failed to read: %s\n",
+                    n.error().message().c_str());
+            return false;
+        }
+
+        result.bytes += n.value();
+        ++result.operations;
+    }
+
+    result.seconds = seconds_since(start);
+    return true;
+}
+
+// Build a synthetic image with a mix of raw, fill, and "don't care" regions
+bool build_synthetic_image(void **data, size_t *size)
+{
+    MemoryFile memory_file;
+    SparseWriter writer;
+
+    if (!memory_file.open(data, size) || !writer.open(&memory_file)) {
+        fprintf(stderr, "Failed to create synthetic image\n");
+        return false;
+    }
+
+    std::mt19937 rng(0x5ba45e);
+    std::vector<unsigned char> raw(DEFAULT_BLOCK_SIZE * 64);
+    std::vector<unsigned char> fill(DEFAULT_BLOCK_SIZE * 64, 0);
+
+    // 64 MiB: 1/4 raw, 1/4 zero fill, 1/2 holes
+    for (int i = 0; i < 256; ++i) {
+        bool ok;
+
+        switch (i % 4) {
+        case 0:
+            for (auto &c : raw) {
+                c = static_cast<unsigned char>(rng());
+            }
+            ok = !!writer.write(raw.data(), raw.size());
+            break;
+        case 1:
+            ok = !!writer.write(fill.data(), fill.size());
+            break;
+        default:
+            ok = !!writer.seek(static_cast<int64_t>(fill.size()), SEEK_CUR);
+            break;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Failed to write synthetic image\n");
+            return false;
+        }
+    }
+
+    if (!writer.close()) {
+        fprintf(stderr, "Failed to finish synthetic image\n");
+        return false;
+    }
+
+    return true;
+}
+
+void print_chunk_stats(const std::vector<sparse::detail::ChunkInfo> &chunks,
+                       bool json)
+{
+    struct Stats
+    {
+        const char *name;
+        uint16_t type;
+        uint64_t count;
+        uint64_t bytes;
+    } stats[] = {
+        { "raw",       sparse::detail::CHUNK_TYPE_RAW,       0, 0 },
+        { "fill",      sparse::detail::CHUNK_TYPE_FILL,      0, 0 },
+        { "dont_care", sparse::detail::CHUNK_TYPE_DONT_CARE, 0, 0 },
+        { "crc32",     sparse::detail::CHUNK_TYPE_CRC32,     0, 0 },
+    };
+
+    for (auto const &chunk : chunks) {
+        for (auto &s : stats) {
+            if (s.type == chunk.type) {
+                ++s.count;
+                s.bytes += chunk.end - chunk.begin;
+            }
+        }
+    }
+
+    if (json) {
+        printf("  \"chunks\": {\n");
+        for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
+            printf("    \"%s\": {\"count\": %" PRIu64 ", \"bytes\": %" PRIu64
+                   "}%s\n", stats[i].name, stats[i].count, stats[i].bytes,
+                   i + 1 < sizeof(stats) / sizeof(stats[0]) ? "," : "");
+        }
+        printf("  },\n");
+    } else {
+        printf("Chunks:       %" MB_PRIzu "\n", chunks.size());
+        for (auto const &s : stats) {
+            printf("  %-10s  %10" PRIu64 " chunks  %14" PRIu64 " bytes\n",
+                   s.name, s.count, s.bytes);
+        }
+    }
+}
+
+void print_workloads(const std::vector<WorkloadResult> &results, bool json)
+{
+    if (json) {
+        printf("  \"workloads\": {\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto const &r = results[i];
+            printf("    \"%s\": {\"bytes\": %" PRIu64 ", \"operations\": %"
+                   PRIu64 ", \"seconds\": %.6f, \"mib_per_sec\": %.2f}%s\n",
+                   r.name, r.bytes, r.operations, r.seconds,
+                   mib_per_sec(r.bytes, r.seconds),
+                   i + 1 < results.size() ? "," : "");
+        }
+        printf("  }\n");
+    } else {
+        for (auto const &r : results) {
+            printf("%-14s %14" PRIu64 " bytes  %10" PRIu64 " ops  %9.3f s"
+                   "  %10.2f MiB/s\n", r.name, r.bytes, r.operations,
+                   r.seconds, mib_per_sec(r.bytes, r.seconds));
+        }
+    }
+}
+
+bool inspect(File &input_file, const char *name, bool json, bool bench,
+             uint64_t seeks)
+{
+    SparseFile sparse_file;
+
+    auto open_ret = sparse_file.open(&input_file);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n", name, open_ret.error().message().c_str());
+        return false;
+    }
+
+    auto index_start = Clock::now();
+    auto chunks = sparse_file.chunks();
+    if (!chunks) {
+        fprintf(stderr, "%s: Failed to read chunks: %s\n",
+                name, chunks.error().message().c_str());
+        return false;
+    }
+    double index_seconds = seconds_since(index_start);
+
+    std::vector<WorkloadResult> results;
+
+    results.push_back({"sequential", 0, 0, 0});
+    if (!run_sequential(sparse_file, false, results.back())) {
+        return false;
+    }
+
+    if (bench) {
+        results.push_back({"skip_holes", 0, 0, 0});
+        if (!run_sequential(sparse_file, true, results.back())) {
+            return false;
+        }
+
+        results.push_back({"random_seek", 0, 0, 0});
+        if (!run_random_seek(sparse_file, seeks, results.back())) {
+            return false;
+        }
+    }
+
+    if (json) {
+        printf("{\n");
+        printf("  \"file\": \"%s\",\n", json_escape(name).c_str());
+        printf("  \"size\": %" PRIu64 ",\n", sparse_file.size());
+        printf("  \"index_seconds\": %.6f,\n", index_seconds);
+        print_chunk_stats(chunks.value(), true);
+        print_workloads(results, true);
+        printf("}\n");
+    } else {
+        printf("File:         %s\n", name);
+        printf("Size:         %" PRIu64 " bytes\n", sparse_file.size());
+        printf("Index time:   %.6f s\n", index_seconds);
+        print_chunk_stats(chunks.value(), false);
+        printf("\n");
+        print_workloads(results, false);
+    }
+
+    return true;
+}
+
+void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream,
+            "Usage: %s <input file> <output file>\n"
+            "       %s extract <input file> <output file>\n"
+            "       %s info [--json] <input file>\n"
+            "       %s bench [--json] [--seeks <count>] [<input file>]\n"
+            "\n"
+            "If no input file is given to bench, a synthetic image is used.\n",
+            prog_name, prog_name, prog_name, prog_name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage(stderr, argv[0]);
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    std::string command = argv[1];
+
+    if (command != "extract" && command != "info" && command != "bench") {
+        // Compatibility with the old "desparse <input> <output>" syntax
+        if (argc != 3) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+        return extract(argv[1], argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (command == "extract") {
+        if (argc != 4) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+        return extract(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    bool json = false;
+    uint64_t seeks = 10000;
+    const char *input_path = nullptr;
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--seeks") == 0 && i + 1 < argc) {
+            seeks = strtoull(argv[++i], nullptr, 10);
+        } else if (!input_path && argv[i][0] != '-') {
+            input_path = argv[i];
+        } else {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool bench = command == "bench";
+
+    if (input_path) {
+        StandardFile input_file;
+
+        auto open_ret = input_file.open(input_path, FileOpenMode::ReadOnly);
+        if (!open_ret) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    input_path, open_ret.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        return inspect(input_file, input_path, json, bench, seeks)
+                ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (bench) {
+        void *data = nullptr;
+        size_t size = 0;
+
+        if (!build_synthetic_image(&data, &size)) {
+            free(data);
+            return EXIT_FAILURE;
+        }
+
+        MemoryFile input_file(data, size);
+        bool ret = inspect(input_file, "(synthetic)", json, bench, seeks);
+        (void) input_file.close();
+        free(data);
+
+        return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
 }
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark for the per-call overhead of oc::result-based File I/O on the
+// success and error paths, including the number of heap allocations made.
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+static uint64_t g_allocations = 0;
+
+void * operator new(size_t size)
+{
+    ++g_allocations;
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    std::abort();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+
+// File whose reads always fail with a custom category error
+class FailingFile : public mb::File
+{
+public:
+    FailingFile()
+    {
+        (void) open();
+    }
+
+    ~FailingFile() override
+    {
+        (void) close();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FailingFile)
+
+protected:
+    mb::oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return mb::FileError::UnexpectedEof;
+    }
+};
+
+// Equivalent errno-style interface as a baseline
+__attribute__((noinline))
+ssize_t raw_read(const unsigned char *src, size_t src_size, size_t &pos,
+                 void *buf, size_t size)
+{
+    if (pos >= src_size) {
+        errno = EIO;
+        return -1;
+    }
+
+    size_t n = std::min(size, src_size - pos);
+    memcpy(buf, src + pos, n);
+    pos += n;
+    return static_cast<ssize_t>(n);
+}
+
+template<typename Fn>
+void run(const char *name, uint64_t iterations, Fn &&fn)
+{
+    uint64_t allocations = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            elapsed).count();
+
+    printf("%-28s %8.2f ns/call  %" PRIu64 " allocations\n", name,
+           static_cast<double>(ns) / static_cast<double>(iterations),
+           g_allocations - allocations);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t iterations = 10000000;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    } else if (argc == 2) {
+        iterations = strtoull(argv[1], nullptr, 10);
+        if (iterations == 0) {
+            fprintf(stderr, "Invalid iteration count: %s\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static unsigned char data[4096];
+    unsigned char buf[16];
+    volatile size_t sink = 0;
+
+    size_t raw_pos = 0;
+    run("errno read (success)", iterations, [&] {
+        if (raw_pos >= sizeof(data)) {
+            raw_pos = 0;
+        }
+        sink = sink + static_cast<size_t>(
+                raw_read(data, sizeof(data), raw_pos, buf, sizeof(buf)));
+    });
+
+    run("errno read (error)", iterations, [&] {
+        size_t pos = sizeof(data);
+        if (raw_read(data, sizeof(data), pos, buf, sizeof(buf)) < 0) {
+            sink = sink + static_cast<size_t>(errno);
+        }
+    });
+
+    mb::MemoryFile memory_file(data, sizeof(data));
+    run("File::read (success)", iterations, [&] {
+        auto n = memory_file.read(buf, sizeof(buf));
+        if (n && n.value() == 0) {
+            (void) memory_file.seek(0, SEEK_SET);
+        }
+        sink = sink + (n ? n.value() : 0);
+    });
+
+    FailingFile failing_file;
+    run("File::read (error)", iterations, [&] {
+        auto n = failing_file.read(buf, sizeof(buf));
+        if (!n) {
+            sink = sink + static_cast<size_t>(n.error().value());
+        }
+    });
+
+    run("file_read_retry (error)", iterations, [&] {
+        auto n = mb::file_read_retry(failing_file, buf, sizeof(buf));
+        if (!n) {
+            sink = sink + static_cast<size_t>(n.error().value());
+        }
+    });
+
+    run("error().message()", iterations / 100, [&] {
+        auto n = failing_file.read(buf, sizeof(buf));
+        if (!n) {
+            sink = sink + n.error().message().size();
+        }
+    });
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark for the per-call cost of the logging macros when the level is
+// disabled at runtime and when records are formatted and discarded.
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/string.h"
+#include "mblog/base_logger.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "log_level_bench"
+
+namespace
+{
+
+class NullLogger : public mb::log::BaseLogger
+{
+public:
+    void log(const mb::log::LogRecord &rec) override
+    {
+        (void) rec;
+    }
+
+    bool formatted() override
+    {
+        return true;
+    }
+
+    bool concurrent() override
+    {
+        return true;
+    }
+};
+
+// Stands in for an argument that is costly to compute, like a path join
+__attribute__((noinline))
+std::string expensive_arg(uint64_t i)
+{
+    return mb::format("/data/media/0/file-%" PRIu64, i);
+}
+
+template<typename Fn>
+void run(const char *name, uint64_t iterations, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            elapsed).count();
+
+    printf("%-36s %8.2f ns/call\n", name,
+           static_cast<double>(ns) / static_cast<double>(iterations));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    using mb::log::LogLevel;
+
+    uint64_t iterations = 1000000;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    } else if (argc == 2) {
+        iterations = strtoull(argv[1], nullptr, 10);
+        if (iterations == 0) {
+            fprintf(stderr, "Invalid iteration count: %s\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    mb::log::set_logger(std::make_shared<NullLogger>());
+
+    printf("MBLOG_MIN_LEVEL allows verbose: %s\n",
+           mb::log::compiled_in(LogLevel::Verbose) ? "yes" : "no");
+
+    mb::log::set_level(LogLevel::Info);
+
+    run("LOGV, disabled at runtime", iterations, [](uint64_t i) {
+        LOGV("Copying %s", expensive_arg(i).c_str());
+    });
+
+    run("mb::log::log(), disabled at runtime", iterations, [](uint64_t i) {
+        mb::log::log(LogLevel::Verbose, LOG_TAG, "Copying %s",
+                     expensive_arg(i).c_str());
+    });
+
+    mb::log::set_level(LogLevel::Verbose);
+
+    run("LOGV, enabled (null logger)", iterations, [](uint64_t i) {
+        LOGV("Copying %s", expensive_arg(i).c_str());
+    });
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Binary log decoder
+//
+//   mblogdecode <file>...
+//
+// Prints the records in files written by mb::log::BinaryLogger as text, from
+// oldest to newest.
+
+#include <chrono>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "mblog/binary_log_reader.h"
+
+using namespace mb::log;
+
+namespace
+{
+
+char level_char(LogLevel prio)
+{
+    switch (prio) {
+    case LogLevel::Error:
+        return 'E';
+    case LogLevel::Warning:
+        return 'W';
+    case LogLevel::Info:
+        return 'I';
+    case LogLevel::Debug:
+        return 'D';
+    case LogLevel::Verbose:
+        return 'V';
+    }
+
+    return '?';
+}
+
+void print_record(const LogRecord &rec)
+{
+    auto since_epoch = rec.time.time_since_epoch();
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    auto msecs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            since_epoch - secs);
+    std::time_t t = static_cast<std::time_t>(secs.count());
+
+    char buf[32];
+    std::tm tm{};
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", &tm);
+
+    printf("[%s.%03" PRId64 "][%" PRIu64 ":%" PRIu64 "][%c] %s: %s\n",
+           buf, static_cast<int64_t>(msecs.count()), rec.pid, rec.tid,
+           level_char(rec.prio), rec.tag.c_str(), rec.msg.c_str());
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+
+    for (int i = 1; i < argc; ++i) {
+        auto result = read_binary_log(argv[i], &print_record);
+        if (!result) {
+            fprintf(stderr, "%s: Failed to decode: %s\n",
+                    argv[i], result.error().message().c_str());
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    return ret;
+}
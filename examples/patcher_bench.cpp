@@ -0,0 +1,1016 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// End-to-end benchmark for the patchers. Synthetic ROM zips and Odin tarballs
+// of configurable size and entry count are generated in a temporary directory
+// and each patcher is run in a child process so that its wall time, CPU time,
+// peak RSS, and I/O can be measured independently of the other runs.
+//
+// Bytes read and written are taken from /proc/self/io, which counts every
+// read/write syscall regardless of whether it goes through libmbcommon's File
+// API, minizip, or libarchive. With --trace-dir, MB_FILE_TRACE is also set for
+// the children so that the File-based I/O paths append their TracingFile
+// statistics to one JSON lines file per run.
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <mbdevice/json.h>
+#include <mblog/base_logger.h>
+#include <mblog/logging.h>
+#include <mbpatcher/patcherconfig.h>
+#include <mbpatcher/patcherinterface.h>
+
+
+namespace
+{
+
+constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+constexpr char SYSTEM_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/system";
+constexpr char CACHE_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/cache";
+constexpr char DATA_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/userdata";
+constexpr char BOOT_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/boot";
+
+struct Options
+{
+    std::vector<std::string> patchers;
+    const char *device_file = nullptr;
+    const char *data_dir = nullptr;
+    const char *temp_dir = "/tmp";
+    const char *trace_dir = nullptr;
+    uint64_t size = 256 * 1024 * 1024;
+    unsigned int entries = 64;
+    unsigned int iterations = 3;
+    long threads = -1;
+    bool json = false;
+    bool verbose = false;
+};
+
+struct ChildReport
+{
+    bool success;
+    int error;
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+};
+
+struct RunResult
+{
+    std::string patcher;
+    unsigned int iteration;
+    bool success;
+    int error;
+    double wall_seconds;
+    double cpu_seconds;
+    long peak_rss_kib;
+    uint64_t input_size;
+    uint64_t output_size;
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    std::string trace_path;
+};
+
+class BenchLogger : public mb::log::BaseLogger
+{
+public:
+    BenchLogger(bool verbose) : m_verbose(verbose)
+    {
+    }
+
+    virtual void log(const mb::log::LogRecord &rec) override
+    {
+        if (m_verbose || rec.prio <= mb::log::LogLevel::Warning) {
+            fprintf(stderr, "%s\n", rec.fmt_msg.c_str());
+        }
+    }
+
+    virtual bool formatted() override
+    {
+        return true;
+    }
+
+private:
+    bool m_verbose;
+};
+
+// Fills \p buf with deterministic data. Compressible chunks contain text that
+// deflates well and the others are poorly compressible.
+void fill_chunk(unsigned char *buf, size_t size, uint32_t seed,
+                bool compressible)
+{
+    if (compressible) {
+        static const char text[] =
+                "DualBootPatcher benchmark payload: lorem ipsum dolor sit "
+                "amet, consectetur adipiscing elit. ";
+        size_t text_size = sizeof(text) - 1;
+
+        for (size_t i = 0; i < size; ++i) {
+            buf[i] = static_cast<unsigned char>(text[(i + seed) % text_size]);
+        }
+    } else {
+        uint32_t state = seed * 2654435761u + 1;
+
+        for (size_t i = 0; i < size; ++i) {
+            state = state * 1103515245u + 12345u;
+            buf[i] = static_cast<unsigned char>(state >> 16);
+        }
+    }
+}
+
+bool write_all(FILE *fp, const void *data, size_t size)
+{
+    return fwrite(data, 1, size, fp) == size;
+}
+
+template<typename T>
+void put_le(std::vector<unsigned char> &buf, T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        buf.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+}
+
+bool write_file(const std::string &path, const void *data, size_t size)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ret = write_all(fp, data, size);
+    return fclose(fp) == 0 && ret;
+}
+
+bool write_file(const std::string &path, const std::string &data)
+{
+    return write_file(path, data.data(), data.size());
+}
+
+bool make_dirs(const std::string &path)
+{
+    for (size_t pos = 1; pos <= path.size(); ++pos) {
+        if (pos == path.size() || path[pos] == '/') {
+            if (mkdir(path.substr(0, pos).c_str(), 0755) < 0
+                    && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int remove_cb(const char *path, const struct stat *sb, int type,
+              struct FTW *ftw)
+{
+    (void) sb;
+    (void) type;
+    (void) ftw;
+    return remove(path);
+}
+
+bool remove_recursive(const std::string &path)
+{
+    return nftw(path.c_str(), &remove_cb, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+uint64_t file_size(const std::string &path)
+{
+    struct stat sb;
+    return stat(path.c_str(), &sb) == 0 ? static_cast<uint64_t>(sb.st_size) : 0;
+}
+
+// Minimal writer for zips with stored (uncompressed) entries. Zip64 is not
+// supported, so the total size must stay below 4 GiB.
+class StoredZipWriter
+{
+public:
+    StoredZipWriter() : m_fp(nullptr)
+    {
+    }
+
+    ~StoredZipWriter()
+    {
+        if (m_fp) {
+            fclose(m_fp);
+        }
+    }
+
+    bool open(const std::string &path)
+    {
+        m_fp = fopen(path.c_str(), "wb");
+        return m_fp != nullptr;
+    }
+
+    bool add(const std::string &name, const std::string &data)
+    {
+        return add(name, data.size(), [&](unsigned char *buf, size_t offset,
+                                          size_t size) {
+            memcpy(buf, data.data() + offset, size);
+        });
+    }
+
+    template<typename Fill>
+    bool add(const std::string &name, uint64_t size, const Fill &fill)
+    {
+        auto offset = ftello(m_fp);
+        if (offset < 0) {
+            return false;
+        }
+
+        // The CRC is filled in after the data is written
+        auto header = local_header(name, 0, static_cast<uint32_t>(size));
+        if (!write_all(m_fp, header.data(), header.size())) {
+            return false;
+        }
+
+        std::vector<unsigned char> buf(CHUNK_SIZE);
+        uLong crc = crc32(0, nullptr, 0);
+
+        for (uint64_t done = 0; done < size;) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(buf.size(), size - done));
+            fill(buf.data(), static_cast<size_t>(done), n);
+            crc = crc32(crc, buf.data(), static_cast<uInt>(n));
+            if (!write_all(m_fp, buf.data(), n)) {
+                return false;
+            }
+            done += n;
+        }
+
+        auto end = ftello(m_fp);
+        header = local_header(name, static_cast<uint32_t>(crc),
+                              static_cast<uint32_t>(size));
+        if (end < 0 || fseeko(m_fp, offset, SEEK_SET) < 0
+                || !write_all(m_fp, header.data(), header.size())
+                || fseeko(m_fp, end, SEEK_SET) < 0) {
+            return false;
+        }
+
+        m_entries.push_back({name, static_cast<uint32_t>(crc),
+                             static_cast<uint32_t>(size),
+                             static_cast<uint32_t>(offset)});
+        return true;
+    }
+
+    bool close()
+    {
+        auto cd_offset = ftello(m_fp);
+        if (cd_offset < 0) {
+            return false;
+        }
+
+        std::vector<unsigned char> cd;
+
+        for (auto const &e : m_entries) {
+            put_le<uint32_t>(cd, 0x02014b50);
+            put_le<uint16_t>(cd, 20);
+            put_le<uint16_t>(cd, 20);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0x21);
+            put_le<uint32_t>(cd, e.crc);
+            put_le<uint32_t>(cd, e.size);
+            put_le<uint32_t>(cd, e.size);
+            put_le<uint16_t>(cd, static_cast<uint16_t>(e.name.size()));
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint16_t>(cd, 0);
+            put_le<uint32_t>(cd, 0);
+            put_le<uint32_t>(cd, e.offset);
+            cd.insert(cd.end(), e.name.begin(), e.name.end());
+        }
+
+        auto count = static_cast<uint16_t>(m_entries.size());
+
+        std::vector<unsigned char> eocd;
+        put_le<uint32_t>(eocd, 0x06054b50);
+        put_le<uint16_t>(eocd, 0);
+        put_le<uint16_t>(eocd, 0);
+        put_le<uint16_t>(eocd, count);
+        put_le<uint16_t>(eocd, count);
+        put_le<uint32_t>(eocd, static_cast<uint32_t>(cd.size()));
+        put_le<uint32_t>(eocd, static_cast<uint32_t>(cd_offset));
+        put_le<uint16_t>(eocd, 0);
+
+        bool ret = write_all(m_fp, cd.data(), cd.size())
+                && write_all(m_fp, eocd.data(), eocd.size());
+
+        ret = fclose(m_fp) == 0 && ret;
+        m_fp = nullptr;
+
+        return ret;
+    }
+
+private:
+    struct CentralEntry
+    {
+        std::string name;
+        uint32_t crc;
+        uint32_t size;
+        uint32_t offset;
+    };
+
+    static std::vector<unsigned char> local_header(const std::string &name,
+                                                   uint32_t crc, uint32_t size)
+    {
+        std::vector<unsigned char> buf;
+        put_le<uint32_t>(buf, 0x04034b50);
+        put_le<uint16_t>(buf, 20);
+        put_le<uint16_t>(buf, 0);
+        put_le<uint16_t>(buf, 0);
+        put_le<uint16_t>(buf, 0);
+        put_le<uint16_t>(buf, 0x21);
+        put_le<uint32_t>(buf, crc);
+        put_le<uint32_t>(buf, size);
+        put_le<uint32_t>(buf, size);
+        put_le<uint16_t>(buf, static_cast<uint16_t>(name.size()));
+        put_le<uint16_t>(buf, 0);
+        buf.insert(buf.end(), name.begin(), name.end());
+        return buf;
+    }
+
+    FILE *m_fp;
+    std::vector<CentralEntry> m_entries;
+};
+
+// Appends a ustar entry to \p fp
+template<typename Fill>
+bool tar_add(FILE *fp, const std::string &name, uint64_t size,
+             const Fill &fill)
+{
+    unsigned char header[512] = {};
+
+    snprintf(reinterpret_cast<char *>(header), 100, "%s", name.c_str());
+    snprintf(reinterpret_cast<char *>(header + 100), 8, "%07o", 0644);
+    snprintf(reinterpret_cast<char *>(header + 108), 8, "%07o", 0);
+    snprintf(reinterpret_cast<char *>(header + 116), 8, "%07o", 0);
+    snprintf(reinterpret_cast<char *>(header + 124), 12, "%011" PRIo64, size);
+    snprintf(reinterpret_cast<char *>(header + 136), 12, "%011o", 0);
+    memset(header + 148, ' ', 8);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    unsigned int checksum = 0;
+    for (unsigned char c : header) {
+        checksum += c;
+    }
+    snprintf(reinterpret_cast<char *>(header + 148), 8, "%06o", checksum);
+
+    if (!write_all(fp, header, sizeof(header))) {
+        return false;
+    }
+
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+
+    for (uint64_t done = 0; done < size;) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(buf.size(), size - done));
+        fill(buf.data(), static_cast<size_t>(done), n);
+        if (!write_all(fp, buf.data(), n)) {
+            return false;
+        }
+        done += n;
+    }
+
+    static const unsigned char padding[512] = {};
+    size_t remainder = static_cast<size_t>(size % 512);
+
+    return remainder == 0 || write_all(fp, padding, 512 - remainder);
+}
+
+// Returns a fill function for an entry. Even entries are compressible and odd
+// entries are not, which exercises both the deflate and store paths.
+auto entry_filler(unsigned int index)
+{
+    return [index](unsigned char *buf, size_t offset, size_t size) {
+        fill_chunk(buf, size, static_cast<uint32_t>(index * 7919 + offset),
+                   index % 2 == 0);
+    };
+}
+
+std::string make_updater_script()
+{
+    std::string script;
+    script += "ui_print(\"Installing benchmark ROM\");\n";
+    script += "mount(\"ext4\", \"EMMC\", \"";
+    script += SYSTEM_BLOCK_DEV;
+    script += "\", \"/system\");\n";
+    script += "format(\"ext4\", \"EMMC\", \"";
+    script += SYSTEM_BLOCK_DEV;
+    script += "\", \"0\", \"/system\");\n";
+    script += "package_extract_dir(\"system\", \"/system\");\n";
+    script += "package_extract_file(\"boot.img\", \"";
+    script += BOOT_BLOCK_DEV;
+    script += "\");\n";
+    script += "unmount(\"/system\");\n";
+    return script;
+}
+
+bool make_rom_zip(const std::string &path, const Options &opts)
+{
+    StoredZipWriter zip;
+
+    if (!zip.open(path)
+            || !zip.add("META-INF/com/google/android/update-binary",
+                        "#!/sbin/sh\n")
+            || !zip.add("META-INF/com/google/android/updater-script",
+                        make_updater_script())) {
+        return false;
+    }
+
+    uint64_t entry_size = opts.size / opts.entries;
+
+    for (unsigned int i = 0; i < opts.entries; ++i) {
+        char name[64];
+        if (i == 0) {
+            snprintf(name, sizeof(name), "boot.img");
+        } else {
+            snprintf(name, sizeof(name), "system/app/Bench%04u.apk", i);
+        }
+
+        if (!zip.add(name, entry_size, entry_filler(i))) {
+            return false;
+        }
+    }
+
+    return zip.close();
+}
+
+bool make_odin_tar(const std::string &path, const Options &opts)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    // OdinPatcher repacks boot.img, system.img, and cache.img and skips over
+    // everything else. Like a real firmware, most of the data is in the system
+    // image.
+    uint64_t system_size = opts.size / 2;
+    uint64_t entry_size = (opts.size - system_size) / (opts.entries - 1);
+    bool ret = true;
+
+    for (unsigned int i = 0; ret && i < opts.entries; ++i) {
+        char name[64];
+        if (i == 0) {
+            snprintf(name, sizeof(name), "boot.img");
+        } else if (i == 1) {
+            snprintf(name, sizeof(name), "system.img");
+        } else if (i == 2) {
+            snprintf(name, sizeof(name), "cache.img");
+        } else {
+            snprintf(name, sizeof(name), "modem%04u.bin", i);
+        }
+
+        ret = tar_add(fp, name, i == 1 ? system_size : entry_size,
+                      entry_filler(i));
+    }
+
+    static const unsigned char end[1024] = {};
+    ret = ret && write_all(fp, end, sizeof(end));
+
+    return fclose(fp) == 0 && ret;
+}
+
+// Creates a data directory containing placeholders for the files that the
+// patchers copy into their output
+bool make_data_dir(const std::string &dir, const std::string &arch)
+{
+    std::string arch_dir = dir + "/binaries/android/" + arch;
+
+    if (!make_dirs(arch_dir) || !make_dirs(dir + "/scripts")) {
+        return false;
+    }
+
+    std::vector<unsigned char> binary(2 * CHUNK_SIZE);
+    fill_chunk(binary.data(), binary.size(), 42, false);
+
+    for (auto const *name : {
+        "file-contexts-tool", "fsck-wrapper", "fuse-sparse", "mbtool",
+        "mbtool_recovery", "mount.exfat", "odinupdater",
+    }) {
+        std::string path = arch_dir + "/" + name;
+
+        if (!write_file(path, binary.data(), binary.size())
+                || !write_file(path + ".sig", std::string(512, 's'))) {
+            return false;
+        }
+    }
+
+    std::string script = dir + "/scripts/bb-wrapper.sh";
+
+    return write_file(script, "#!/sbin/sh\nexec busybox \"$@\"\n")
+            && write_file(script + ".sig", std::string(512, 's'));
+}
+
+bool make_device(const Options &opts, mb::device::Device &device)
+{
+    if (!opts.device_file) {
+        device.set_id("benchmark");
+        device.set_codenames({"benchmark"});
+        device.set_name("Benchmark Device");
+        device.set_architecture(mb::device::ARCH_ARMEABI_V7A);
+        device.set_system_block_devs({SYSTEM_BLOCK_DEV});
+        device.set_cache_block_devs({CACHE_BLOCK_DEV});
+        device.set_data_block_devs({DATA_BLOCK_DEV});
+        device.set_boot_block_devs({BOOT_BLOCK_DEV});
+        return true;
+    }
+
+    FILE *fp = fopen(opts.device_file, "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                opts.device_file, strerror(errno));
+        return false;
+    }
+
+    std::string contents;
+    char buf[8192];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        contents.append(buf, n);
+    }
+
+    fclose(fp);
+
+    mb::device::JsonError error;
+
+    if (!mb::device::device_from_json(contents, device, error)) {
+        fprintf(stderr, "%s: Failed to load device\n", opts.device_file);
+        return false;
+    }
+
+    if (device.validate() != 0) {
+        fprintf(stderr, "%s: Validation failed\n", opts.device_file);
+        return false;
+    }
+
+    return true;
+}
+
+void read_proc_io(ChildReport &report)
+{
+    FILE *fp = fopen("/proc/self/io", "re");
+    if (!fp) {
+        return;
+    }
+
+    char key[32];
+    uint64_t value;
+
+    while (fscanf(fp, "%31[^:]: %" SCNu64 "\n", key, &value) == 2) {
+        if (strcmp(key, "rchar") == 0) {
+            report.rchar = value;
+        } else if (strcmp(key, "wchar") == 0) {
+            report.wchar = value;
+        } else if (strcmp(key, "read_bytes") == 0) {
+            report.read_bytes = value;
+        } else if (strcmp(key, "write_bytes") == 0) {
+            report.write_bytes = value;
+        }
+    }
+
+    fclose(fp);
+}
+
+[[noreturn]]
+void run_child(int report_fd, const Options &opts,
+               const std::string &patcher_id, const std::string &data_dir,
+               const std::string &work_dir, const mb::device::Device &device,
+               const std::string &input_path, const std::string &output_path,
+               const std::string &trace_path)
+{
+    ChildReport report = {};
+
+    if (!trace_path.empty()) {
+        setenv("MB_FILE_TRACE", trace_path.c_str(), 1);
+    }
+
+    mb::log::set_logger(std::make_shared<BenchLogger>(opts.verbose));
+
+    {
+        mb::patcher::PatcherConfig pc;
+        pc.set_data_directory(data_dir);
+        pc.set_temp_directory(work_dir);
+        if (opts.threads >= 0) {
+            pc.set_compression_threads(static_cast<unsigned int>(opts.threads));
+        }
+
+        mb::patcher::FileInfo fi;
+        fi.set_device(device);
+        fi.set_input_path(input_path);
+        fi.set_output_path(output_path);
+        fi.set_rom_id("dual");
+
+        if (auto *patcher = pc.create_patcher(patcher_id)) {
+            patcher->set_file_info(&fi);
+            report.success = patcher->patch_file(
+                    nullptr, nullptr, nullptr, nullptr);
+            report.error = static_cast<int>(patcher->error());
+        } else {
+            report.error = -1;
+        }
+    }
+
+    read_proc_io(report);
+
+    (void) !write(report_fd, &report, sizeof(report));
+    _exit(report.success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+bool run_once(const Options &opts, const std::string &patcher_id,
+              unsigned int iteration, const std::string &data_dir,
+              const std::string &work_dir, const mb::device::Device &device,
+              const std::string &input_path, RunResult &result)
+{
+    std::string output_path = work_dir + "/output." + patcher_id + ".zip";
+    std::string trace_path;
+
+    if (opts.trace_dir) {
+        trace_path = opts.trace_dir;
+        trace_path += "/trace.";
+        trace_path += patcher_id;
+        trace_path += '.';
+        trace_path += std::to_string(iteration);
+        trace_path += ".jsonl";
+        (void) unlink(trace_path.c_str());
+    }
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0) {
+        fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    } else if (pid == 0) {
+        close(pipe_fds[0]);
+        run_child(pipe_fds[1], opts, patcher_id, data_dir, work_dir, device,
+                  input_path, output_path, trace_path);
+    }
+
+    close(pipe_fds[1]);
+
+    ChildReport report = {};
+    bool have_report = read(pipe_fds[0], &report, sizeof(report))
+            == static_cast<ssize_t>(sizeof(report));
+    close(pipe_fds[0]);
+
+    int status;
+    struct rusage ru;
+
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        fprintf(stderr, "Failed to wait for child: %s\n", strerror(errno));
+        return false;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    auto tv_seconds = [](const timeval &tv) {
+        return static_cast<double>(tv.tv_sec)
+                + static_cast<double>(tv.tv_usec) / 1e6;
+    };
+
+    result.patcher = patcher_id;
+    result.iteration = iteration;
+    result.success = have_report && report.success && WIFEXITED(status)
+            && WEXITSTATUS(status) == EXIT_SUCCESS;
+    result.error = report.error;
+    result.wall_seconds = std::chrono::duration<double>(elapsed).count();
+    result.cpu_seconds = tv_seconds(ru.ru_utime) + tv_seconds(ru.ru_stime);
+    result.peak_rss_kib = ru.ru_maxrss;
+    result.input_size = input_path.empty() ? 0 : file_size(input_path);
+    result.output_size = file_size(output_path);
+    result.rchar = report.rchar;
+    result.wchar = report.wchar;
+    result.read_bytes = report.read_bytes;
+    result.write_bytes = report.write_bytes;
+    result.trace_path = trace_path;
+
+    (void) unlink(output_path.c_str());
+
+    return true;
+}
+
+void print_result(const RunResult &r, bool json, bool &first)
+{
+    double mb_per_s = r.wall_seconds > 0
+            ? static_cast<double>(r.input_size) / 1e6 / r.wall_seconds : 0.0;
+
+    if (json) {
+        printf("%s\n    {\"patcher\": \"%s\", \"iteration\": %u, "
+               "\"success\": %s, \"error\": %d, \"wall_s\": %.3f, "
+               "\"cpu_s\": %.3f, \"peak_rss_kib\": %ld, "
+               "\"input_bytes\": %" PRIu64 ", \"output_bytes\": %" PRIu64 ", "
+               "\"rchar\": %" PRIu64 ", \"wchar\": %" PRIu64 ", "
+               "\"read_bytes\": %" PRIu64 ", \"write_bytes\": %" PRIu64,
+               first ? "" : ",", r.patcher.c_str(), r.iteration,
+               r.success ? "true" : "false", r.error, r.wall_seconds,
+               r.cpu_seconds, r.peak_rss_kib, r.input_size, r.output_size,
+               r.rchar, r.wchar, r.read_bytes, r.write_bytes);
+        if (!r.trace_path.empty()) {
+            printf(", \"trace\": \"%s\"", r.trace_path.c_str());
+        }
+        printf("}");
+    } else {
+        printf("%-15s #%-2u %-4s %8.3f s wall %8.3f s cpu %8ld KiB rss "
+               "%9.2f MB/s %10.1f MiB read %10.1f MiB written\n",
+               r.patcher.c_str(), r.iteration, r.success ? "ok" : "FAIL",
+               r.wall_seconds, r.cpu_seconds, r.peak_rss_kib, mb_per_s,
+               static_cast<double>(r.rchar) / 1048576.0,
+               static_cast<double>(r.wchar) / 1048576.0);
+    }
+
+    first = false;
+}
+
+void print_summary(const std::vector<RunResult> &results)
+{
+    std::vector<double> wall;
+    std::vector<double> cpu;
+
+    for (auto const &r : results) {
+        wall.push_back(r.wall_seconds);
+        cpu.push_back(r.cpu_seconds);
+    }
+
+    if (wall.empty()) {
+        return;
+    }
+
+    std::sort(wall.begin(), wall.end());
+    std::sort(cpu.begin(), cpu.end());
+
+    printf("%-15s median %8.3f s wall %8.3f s cpu (min %.3f s, max %.3f s)\n",
+           results.front().patcher.c_str(), wall[wall.size() / 2],
+           cpu[cpu.size() / 2], wall.front(), wall.back());
+}
+
+void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...]\n"
+                    "\n"
+                    "Options:\n"
+                    "  -p, --patcher <id>\n"
+                    "                   Patcher to run: ZipPatcher, OdinPatcher,\n"
+                    "                   or RamdiskUpdater (default: all)\n"
+                    "  -s, --size <MiB>\n"
+                    "                   Size of the synthetic inputs (default: 256)\n"
+                    "  -e, --entries <count>\n"
+                    "                   Entries in the synthetic inputs (default: 64)\n"
+                    "  -n, --iterations <count>\n"
+                    "                   Runs per patcher (default: 3)\n"
+                    "  -t, --threads <count>\n"
+                    "                   Compression threads (0: one per CPU core)\n"
+                    "  -d, --device <file>\n"
+                    "                   Device definition (default: synthetic)\n"
+                    "  --data-dir <dir>\n"
+                    "                   Data directory (default: placeholders)\n"
+                    "  --temp-dir <dir>\n"
+                    "                   Parent of the work directory (default: /tmp)\n"
+                    "  --trace-dir <dir>\n"
+                    "                   Write MB_FILE_TRACE statistics to this\n"
+                    "                   directory\n"
+                    "  -j, --json       Print results as JSON\n"
+                    "  -v, --verbose    Print all log messages\n"
+                    "  -h, --help       Display this help message\n",
+                    prog_name);
+}
+
+}
+
+enum : int
+{
+    OPT_DATA_DIR  = 1000,
+    OPT_TEMP_DIR  = 1001,
+    OPT_TRACE_DIR = 1002,
+};
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "p:s:e:n:t:d:jvh";
+
+    static struct option long_options[] = {
+        {"patcher",    required_argument, nullptr, 'p'},
+        {"size",       required_argument, nullptr, 's'},
+        {"entries",    required_argument, nullptr, 'e'},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"threads",    required_argument, nullptr, 't'},
+        {"device",     required_argument, nullptr, 'd'},
+        {"data-dir",   required_argument, nullptr, OPT_DATA_DIR},
+        {"temp-dir",   required_argument, nullptr, OPT_TEMP_DIR},
+        {"trace-dir",  required_argument, nullptr, OPT_TRACE_DIR},
+        {"json",       no_argument,       nullptr, 'j'},
+        {"verbose",    no_argument,       nullptr, 'v'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'p':
+            opts.patchers.emplace_back(optarg);
+            break;
+        case 's':
+            opts.size = strtoull(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'e':
+            opts.entries = static_cast<unsigned int>(
+                    strtoul(optarg, nullptr, 10));
+            break;
+        case 'n':
+            opts.iterations = static_cast<unsigned int>(
+                    strtoul(optarg, nullptr, 10));
+            break;
+        case 't':
+            opts.threads = strtol(optarg, nullptr, 10);
+            break;
+        case 'd':
+            opts.device_file = optarg;
+            break;
+        case OPT_DATA_DIR:
+            opts.data_dir = optarg;
+            break;
+        case OPT_TEMP_DIR:
+            opts.temp_dir = optarg;
+            break;
+        case OPT_TRACE_DIR:
+            opts.trace_dir = optarg;
+            break;
+        case 'j':
+            opts.json = true;
+            break;
+        case 'v':
+            opts.verbose = true;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc != optind || opts.iterations == 0 || opts.entries < 3
+            || opts.entries > 65000 || opts.size < opts.entries
+            || opts.size >= UINT32_MAX) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.patchers.empty()) {
+        opts.patchers = {"ZipPatcher", "OdinPatcher", "RamdiskUpdater"};
+    }
+
+    mb::device::Device device;
+    if (!make_device(opts, device)) {
+        return EXIT_FAILURE;
+    }
+
+    std::string work_dir = opts.temp_dir;
+    work_dir += "/patcher_bench.XXXXXX";
+    if (!mkdtemp(&work_dir[0])) {
+        fprintf(stderr, "Failed to create temporary directory: %s\n",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+    std::string data_dir = opts.data_dir ? opts.data_dir : work_dir + "/data";
+    std::string rom_zip = work_dir + "/rom.zip";
+    std::string odin_tar = work_dir + "/firmware.tar";
+
+    if (!opts.data_dir && !make_data_dir(data_dir, device.architecture())) {
+        fprintf(stderr, "%s: Failed to create data directory: %s\n",
+                data_dir.c_str(), strerror(errno));
+        ret = EXIT_FAILURE;
+    } else if (!make_rom_zip(rom_zip, opts)) {
+        fprintf(stderr, "%s: Failed to create zip: %s\n",
+                rom_zip.c_str(), strerror(errno));
+        ret = EXIT_FAILURE;
+    } else if (!make_odin_tar(odin_tar, opts)) {
+        fprintf(stderr, "%s: Failed to create tarball: %s\n",
+                odin_tar.c_str(), strerror(errno));
+        ret = EXIT_FAILURE;
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        bool first = true;
+
+        if (opts.json) {
+            printf("[");
+        }
+
+        for (auto const &id : opts.patchers) {
+            std::string input_path;
+            if (id == "ZipPatcher") {
+                input_path = rom_zip;
+            } else if (id == "OdinPatcher") {
+                input_path = odin_tar;
+            }
+
+            std::vector<RunResult> results;
+
+            for (unsigned int i = 0; i < opts.iterations; ++i) {
+                RunResult result;
+
+                if (!run_once(opts, id, i, data_dir, work_dir, device,
+                              input_path, result)) {
+                    ret = EXIT_FAILURE;
+                    break;
+                }
+
+                print_result(result, opts.json, first);
+
+                if (!result.success) {
+                    fprintf(stderr, "%s: Patching failed with error %d\n",
+                            id.c_str(), result.error);
+                    ret = EXIT_FAILURE;
+                    break;
+                }
+
+                results.push_back(std::move(result));
+            }
+
+            if (!opts.json) {
+                print_summary(results);
+            }
+        }
+
+        if (opts.json) {
+            printf("\n]\n");
+        }
+    }
+
+    if (!remove_recursive(work_dir)) {
+        fprintf(stderr, "%s: Failed to remove directory: %s\n",
+                work_dir.c_str(), strerror(errno));
+    }
+
+    return ret;
+}
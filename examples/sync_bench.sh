@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Measures adb push/pull throughput against miniadbd for each sync compression
+# type, using both incompressible and compressible data.
+#
+# Usage: sync_bench.sh [remote directory] [size in MiB]
+#
+# Requires an adb client that supports `-z` (platform-tools 30 or newer).
+
+set -eu
+
+remote_dir=${1:-/tmp}
+size_mib=${2:-64}
+compressions=(none lz4 zstd)
+
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "${tmp_dir}"' EXIT
+
+head -c "$((size_mib * 1024 * 1024))" /dev/urandom > "${tmp_dir}/random"
+yes 'mbtool sync benchmark compressible data' \
+    | head -c "$((size_mib * 1024 * 1024))" > "${tmp_dir}/text"
+
+now_ns() {
+    date +%s%N
+}
+
+report() {
+    local name=${1} start=${2} end=${3}
+    local bytes=$((size_mib * 1024 * 1024))
+
+    awk -v name="${name}" -v bytes="${bytes}" -v ns="$((end - start))" \
+        'BEGIN { printf "%-24s %8.2f MB/s\n", name, bytes / (ns / 1e3) }'
+}
+
+for data in random text; do
+    for z in "${compressions[@]}"; do
+        remote="${remote_dir}/sync_bench.${data}"
+
+        start=$(now_ns)
+        adb push -q -z "${z}" "${tmp_dir}/${data}" "${remote}" >/dev/null
+        end=$(now_ns)
+        report "push ${data} (${z})" "${start}" "${end}"
+
+        start=$(now_ns)
+        adb pull -q -z "${z}" "${remote}" "${tmp_dir}/pulled" >/dev/null
+        end=$(now_ns)
+        report "pull ${data} (${z})" "${start}" "${end}"
+
+        if ! cmp -s "${tmp_dir}/${data}" "${tmp_dir}/pulled"; then
+            echo >&2 "Pulled ${data} (${z}) does not match the original"
+            exit 1
+        fi
+
+        adb shell rm -f "${remote}"
+    done
+done
@@ -26,6 +26,7 @@
 #include <mbpatcher/errors.h>
 
 #include <QtCore/QStringBuilder>
+#include <QtGui/QScreen>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QFrame>
 #include <QtWidgets/QFileDialog>
@@ -33,9 +34,56 @@
 #include <QtWidgets/QGroupBox>
 
 
-const int patcherPtrTypeId = qRegisterMetaType<PatcherPtr>("PatcherPtr");
-const int fileInfoPtrTypeId = qRegisterMetaType<FileInfoPtr>("FileInfoPtr");
-const int uint64TypeId = qRegisterMetaType<uint64_t>("uint64_t");
+const int patchQueuePtrTypeId = qRegisterMetaType<PatchQueuePtr>("PatchQueuePtr");
+
+static QString errorToString(const mb::patcher::ErrorCode &error) {
+    switch (error) {
+    case mb::patcher::ErrorCode::NoError:
+        return QObject::tr("No error has occurred");
+    case mb::patcher::ErrorCode::MemoryAllocationError:
+        return QObject::tr("Failed to allocate memory");
+    case mb::patcher::ErrorCode::PatcherCreateError:
+        return QObject::tr("Failed to create patcher");
+    case mb::patcher::ErrorCode::AutoPatcherCreateError:
+        return QObject::tr("Failed to create autopatcher");
+    case mb::patcher::ErrorCode::FileOpenError:
+        return QObject::tr("Failed to open file");
+    case mb::patcher::ErrorCode::FileCloseError:
+        return QObject::tr("Failed to close file");
+    case mb::patcher::ErrorCode::FileReadError:
+        return QObject::tr("Failed to read from file");
+    case mb::patcher::ErrorCode::FileWriteError:
+        return QObject::tr("Failed to write to file");
+    case mb::patcher::ErrorCode::FileSeekError:
+        return QObject::tr("Failed to seek file");
+    case mb::patcher::ErrorCode::FileTellError:
+        return QObject::tr("Failed to get file position");
+    case mb::patcher::ErrorCode::ArchiveReadOpenError:
+        return QObject::tr("Failed to open archive for reading");
+    case mb::patcher::ErrorCode::ArchiveReadDataError:
+        return QObject::tr("Failed to read archive data for file");
+    case mb::patcher::ErrorCode::ArchiveReadHeaderError:
+        return QObject::tr("Failed to read archive entry header");
+    case mb::patcher::ErrorCode::ArchiveWriteOpenError:
+        return QObject::tr("Failed to open archive for writing");
+    case mb::patcher::ErrorCode::ArchiveWriteDataError:
+        return QObject::tr("Failed to write archive data for file");
+    case mb::patcher::ErrorCode::ArchiveWriteHeaderError:
+        return QObject::tr("Failed to write archive header for file");
+    case mb::patcher::ErrorCode::ArchiveCloseError:
+        return QObject::tr("Failed to close archive");
+    case mb::patcher::ErrorCode::ArchiveFreeError:
+        return QObject::tr("Failed to free archive header memory");
+    case mb::patcher::ErrorCode::PatchingCancelled:
+        return QObject::tr("Patching was cancelled");
+    case mb::patcher::ErrorCode::ChecksumMismatch:
+        return QObject::tr("Checksum of the input file does not match");
+    default:
+        assert(false);
+    }
+
+    return QString();
+}
 
 MainWindowPrivate::MainWindowPrivate()
     : settings(qApp->applicationDirPath() % QStringLiteral("/settings.ini"),
@@ -54,10 +102,10 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
     // If we're passed an argument, switch to automatic mode
     if (qApp->arguments().size() > 2) {
         d->autoMode = true;
-        d->fileName = qApp->arguments().at(1);
+        d->fileNames << qApp->arguments().at(1);
     } else {
         d->autoMode = false;
-        d->fileName.clear();
+        d->fileNames.clear();
     }
 
     d->pc = pc;
@@ -88,30 +136,39 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
             d->task, &PatcherTask::patch);
     connect(d->task, &PatcherTask::finished,
             this, &MainWindow::onPatchingFinished);
-    connect(d->task, &PatcherTask::progressUpdated,
-            this, &MainWindow::onProgressUpdated);
-    connect(d->task, &PatcherTask::filesUpdated,
-            this, &MainWindow::onFilesUpdated);
-    connect(d->task, &PatcherTask::detailsUpdated,
-            this, &MainWindow::onDetailsUpdated);
 
     d->thread->start();
+
+    // Poll for progress once per frame
+    qreal refreshRate = 60.0;
+    if (QScreen *screen = QGuiApplication::primaryScreen()) {
+        if (screen->refreshRate() > 0.0) {
+            refreshRate = screen->refreshRate();
+        }
+    }
+
+    d->progressTimer = new QTimer(this);
+    d->progressTimer->setTimerType(Qt::PreciseTimer);
+    d->progressTimer->setInterval(qMax(1, qRound(1000.0 / refreshRate)));
+
+    connect(d->progressTimer, &QTimer::timeout,
+            this, &MainWindow::onProgressTimerTimeout);
 }
 
 MainWindow::~MainWindow()
 {
     Q_D(MainWindow);
 
-    if (d->patcher) {
-        d->patcher->cancel_patching();
-        d->pc->destroy_patcher(d->patcher);
-        d->patcher = nullptr;
+    if (d->queue) {
+        d->queue->cancel_all();
     }
 
     if (d->thread != nullptr) {
         d->thread->quit();
         d->thread->wait();
     }
+
+    d->queue.reset();
 }
 
 void MainWindow::onDeviceSelected(int index)
@@ -163,6 +220,8 @@ void MainWindow::closeEvent(QCloseEvent *event)
                              QString::fromStdString(id));
     }
 
+    d->settings.setValue(QStringLiteral("parallel_jobs"), d->jobsSel->value());
+
     QWidget::closeEvent(event);
 }
 
@@ -204,84 +263,108 @@ void MainWindow::onChooseFileItemClicked(QAction *action)
 
     if (action == d->chooseFlashableZip) {
         d->patcherId = QStringLiteral("ZipPatcher");
-        chooseFile(tr("Flashable zips (*.zip)"));
+        chooseFiles(tr("Flashable zips (*.zip)"));
     } else if (action == d->chooseOdinImage) {
         d->patcherId = QStringLiteral("OdinPatcher");
-        chooseFile(tr("Odin images (*.zip *.tar.md5 *.tar.md5.gz *.tar.md5.xz)"));
+        chooseFiles(tr("Odin images (*.zip *.tar.md5 *.tar.md5.gz *.tar.md5.xz)"));
     }
 }
 
-void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
+void MainWindow::onProgressTimerTimeout()
 {
     Q_D(MainWindow);
 
-    // Normalize values to 1000000
-    static const int normalize = 1000000;
-
-    int value;
-    int max;
-    if (maxBytes == 0) {
-        value = 0;
-        max = 0;
-    } else {
-        value = static_cast<int>(static_cast<double>(bytes)
-                / static_cast<double>(maxBytes * normalize));
-        max = normalize;
+    if (d->task->takeProgress(d->progress)) {
+        updateProgress();
     }
-
-    d->progressBar->setMaximum(max);
-    d->progressBar->setValue(value);
-    d->bytes = bytes;
-    d->maxBytes = maxBytes;
-
-    updateProgressText();
 }
 
-void MainWindow::onFilesUpdated(uint64_t files, uint64_t maxFiles)
+void MainWindow::onPatchingFinished(bool failed)
 {
     Q_D(MainWindow);
 
-    d->files = files;
-    d->maxFiles = maxFiles;
-
-    updateProgressText();
-}
+    d->progressTimer->stop();
 
-void MainWindow::onDetailsUpdated(const QString &text)
-{
-    Q_D(MainWindow);
+    QString results;
 
-    d->detailsLbl->setText(text);
-}
+    for (size_t i = 0; i < d->queue->job_count(); ++i) {
+        auto const &info = d->queue->job_file_info(i);
+        QString inputPath = QString::fromStdString(info.input_path());
 
-void MainWindow::onPatchingFinished(const QString &newFile, bool failed,
-                                    const QString &errorMessage)
-{
-    Q_D(MainWindow);
+        switch (d->queue->job_state(i)) {
+        case mb::patcher::PatchJobState::Succeeded:
+            results.append(tr("New file: %1\n").arg(
+                    QString::fromStdString(info.output_path())));
+            break;
+        case mb::patcher::PatchJobState::Failed:
+            results.append(tr("Failed to patch file: %1\n%2\n").arg(
+                    inputPath, errorToString(d->queue->job_error(i))));
+            break;
+        default:
+            results.append(tr("Cancelled: %1\n").arg(inputPath));
+            break;
+        }
+    }
 
-    d->pc->destroy_patcher(d->patcher);
-    d->patcher = nullptr;
+    d->queue.reset();
 
-    d->patcherNewFile = newFile;
     d->patcherFailed = failed;
-    d->patcherError = errorMessage;
+    d->patcherResults = results;
 
     d->state = MainWindowPrivate::FinishedPatching;
     updateWidgetsVisibility();
 }
 
-void MainWindow::updateProgressText()
+void MainWindow::updateProgress()
 {
     Q_D(MainWindow);
 
+    // Normalize values to 1000000
+    static const int normalize = 1000000;
+
+    uint64_t bytes = 0;
+    uint64_t maxBytes = 0;
+    size_t finished = 0;
+    QString details;
+
+    for (size_t i = 0; i < d->progress.size(); ++i) {
+        auto const &job = d->progress[i];
+
+        bytes += job.bytes;
+        maxBytes += job.maxBytes;
+
+        switch (job.state) {
+        case mb::patcher::PatchJobState::Pending:
+            break;
+        case mb::patcher::PatchJobState::Running:
+            details.append(QStringLiteral("[%1/%2] %3\n")
+                    .arg(i + 1).arg(d->progress.size()).arg(job.details));
+            break;
+        default:
+            ++finished;
+            break;
+        }
+    }
+
+    int value;
+    int max;
     double percentage = 0.0;
-    if (d->maxBytes != 0) {
-        percentage = 100.0 * static_cast<double>(d->bytes)
-                / static_cast<double>(d->maxBytes);
+    if (maxBytes == 0) {
+        value = 0;
+        max = 0;
+    } else {
+        percentage = static_cast<double>(bytes)
+                / static_cast<double>(maxBytes);
+        value = static_cast<int>(percentage * normalize);
+        max = normalize;
     }
 
-    d->progressBar->setFormat(tr("%1% - %2 / %3 files")
-            .arg(percentage, 0, 'f', 2).arg(d->files).arg(d->maxFiles));
+    d->progressBar->setMaximum(max);
+    d->progressBar->setValue(value);
+    d->progressBar->setFormat(tr("%1% - %2 / %3 files patched")
+            .arg(100.0 * percentage, 0, 'f', 2)
+            .arg(finished).arg(d->progress.size()));
+    d->detailsLbl->setText(details.trimmed());
 }
 
 void MainWindow::addWidgets()
@@ -300,6 +383,14 @@ void MainWindow::addWidgets()
     // Labels
     d->deviceLbl = new QLabel(tr("Device:"), d->mainContainer);
     d->instLocLbl = new QLabel(tr("Install to:"), d->mainContainer);
+    d->jobsLbl = new QLabel(tr("Parallel jobs:"), d->mainContainer);
+
+    // Number of files to patch at the same time
+    int maxJobs = qMax(1, QThread::idealThreadCount());
+    d->jobsSel = new QSpinBox(d->mainContainer);
+    d->jobsSel->setRange(1, maxJobs);
+    d->jobsSel->setValue(d->settings.value(
+            QStringLiteral("parallel_jobs"), maxJobs).toInt());
 
     // Text boxes
     d->instLocLe = new QLineEdit(d->mainContainer);
@@ -316,6 +407,8 @@ void MainWindow::addWidgets()
     layout->addWidget(d->instLocSel, i, 1, 1, -1);
     layout->addWidget(d->instLocLe, ++i, 1, 1, -1);
     layout->addWidget(d->instLocDesc, ++i, 1, 1, -1);
+    layout->addWidget(d->jobsLbl, ++i, 0);
+    layout->addWidget(d->jobsSel, i, 1);
 
     d->messageLbl = new QLabel(d->mainContainer);
     // Don't allow the window to grow too big
@@ -496,23 +589,23 @@ void MainWindow::populateInstallationLocations()
     d->instLocSel->addItem(tr("Extsd-slot"));
 }
 
-void MainWindow::chooseFile(const QString &patterns)
+void MainWindow::chooseFiles(const QString &patterns)
 {
     Q_D(MainWindow);
 
-    QString fileName = QFileDialog::getOpenFileName(this, QString(),
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, QString(),
             d->settings.value(QStringLiteral("last_dir")).toString(),
             patterns);
-    if (fileName.isNull()) {
+    if (fileNames.isEmpty()) {
         return;
     }
 
     d->settings.setValue(QStringLiteral("last_dir"),
-                         QFileInfo(fileName).dir().absolutePath());
+                         QFileInfo(fileNames.first()).dir().absolutePath());
 
     d->state = MainWindowPrivate::ChoseFile;
 
-    d->fileName = fileName;
+    d->fileNames = fileNames;
 
     updateWidgetsVisibility();
 }
@@ -539,16 +632,20 @@ void MainWindow::updateWidgetsVisibility()
     }
 
     if (d->state == MainWindowPrivate::ChoseFile) {
-        d->messageLbl->setText(tr("File: %1").arg(d->fileName));
+        if (d->fileNames.size() == 1) {
+            d->messageLbl->setText(tr("File: %1").arg(d->fileNames.first()));
+        } else {
+            d->messageLbl->setText(tr("Files:\n%1").arg(
+                    d->fileNames.join(QStringLiteral("\n"))));
+        }
     } else if (d->state == MainWindowPrivate::FinishedPatching) {
-        QString message;
+        QString message(d->patcherResults);
+        message.append(QStringLiteral("\n"));
 
         if (d->patcherFailed) {
-            message.append(tr("Failed to patch file: %1\n\n").arg(d->fileName));
-            message.append(d->patcherError);
+            message.append(tr("Failed to patch some files"));
         } else {
-            message.append(tr("New file: %1\n\n").arg(d->patcherNewFile));
-            message.append(tr("Successfully patched file"));
+            message.append(tr("Successfully patched all files"));
         }
 
         d->messageLbl->setText(message);
@@ -559,10 +656,7 @@ void MainWindow::startPatching()
 {
     Q_D(MainWindow);
 
-    d->bytes = 0;
-    d->maxBytes = 0;
-    d->files = 0;
-    d->maxFiles = 0;
+    d->progress.clear();
 
     d->progressBar->setMaximum(0);
     d->progressBar->setValue(0);
@@ -587,42 +681,48 @@ void MainWindow::startPatching()
     suffixes << QStringLiteral(".tar.md5.xz");
     suffixes << QStringLiteral(".zip");
 
-    QFileInfo qFileInfo(d->fileName);
-    QString suffix;
-    QString outputName;
-
-    for (const QString &suffix : suffixes) {
-        if (d->fileName.endsWith(suffix)) {
-            // Input name: <parent path>/<base name>.<suffix>
-            // Output name: <parent path>/<base name>_<rom id>.zip
-            outputName = d->fileName.left(d->fileName.size() - suffix.size())
+    d->queue.reset(new mb::patcher::PatchQueue(*d->pc));
+    d->queue->set_max_workers(static_cast<unsigned int>(d->jobsSel->value()));
+
+    for (const QString &fileName : d->fileNames) {
+        QFileInfo qFileInfo(fileName);
+        QString outputName;
+
+        for (const QString &suffix : suffixes) {
+            if (fileName.endsWith(suffix)) {
+                // Input name: <parent path>/<base name>.<suffix>
+                // Output name: <parent path>/<base name>_<rom id>.zip
+                outputName = fileName.left(fileName.size() - suffix.size())
+                        % QStringLiteral("_")
+                        % romId
+                        % QStringLiteral(".zip");
+                break;
+            }
+        }
+        if (outputName.isEmpty()) {
+            outputName = qFileInfo.completeBaseName()
                     % QStringLiteral("_")
                     % romId
-                    % QStringLiteral(".zip");
-            break;
+                    % QStringLiteral(".")
+                    % qFileInfo.suffix();
         }
-    }
-    if (outputName.isEmpty()) {
-        outputName = qFileInfo.completeBaseName()
-                % QStringLiteral("_")
-                % romId
-                % QStringLiteral(".")
-                % qFileInfo.suffix();
-    }
 
-    QString inputPath(QDir::toNativeSeparators(qFileInfo.filePath()));
-    QString outputPath(QDir::toNativeSeparators(
-            qFileInfo.dir().filePath(outputName)));
+        QString inputPath(QDir::toNativeSeparators(qFileInfo.filePath()));
+        QString outputPath(QDir::toNativeSeparators(
+                qFileInfo.dir().filePath(outputName)));
+
+        mb::patcher::FileInfo fileInfo;
+        fileInfo.set_input_path(inputPath.toUtf8().constData());
+        fileInfo.set_output_path(outputPath.toUtf8().constData());
+        fileInfo.set_device(*d->device);
+        fileInfo.set_rom_id(romId.toUtf8().constData());
 
-    FileInfoPtr fileInfo = new mb::patcher::FileInfo();
-    fileInfo->set_input_path(inputPath.toUtf8().constData());
-    fileInfo->set_output_path(outputPath.toUtf8().constData());
-    fileInfo->set_device(*d->device);
-    fileInfo->set_rom_id(romId.toUtf8().constData());
+        d->queue->add_job(d->patcherId.toStdString(), std::move(fileInfo));
+    }
 
-    d->patcher = d->pc->create_patcher(d->patcherId.toStdString());
+    d->progressTimer->start();
 
-    emit runThread(d->patcher, fileInfo);
+    emit runThread(d->queue.get());
 }
 
 QWidget * MainWindow::newHorizLine(QWidget *parent)
@@ -635,111 +735,104 @@ QWidget * MainWindow::newHorizLine(QWidget *parent)
 }
 
 
-static QString errorToString(const mb::patcher::ErrorCode &error) {
-    switch (error) {
-    case mb::patcher::ErrorCode::NoError:
-        return QObject::tr("No error has occurred");
-    case mb::patcher::ErrorCode::MemoryAllocationError:
-        return QObject::tr("Failed to allocate memory");
-    case mb::patcher::ErrorCode::PatcherCreateError:
-        return QObject::tr("Failed to create patcher");
-    case mb::patcher::ErrorCode::AutoPatcherCreateError:
-        return QObject::tr("Failed to create autopatcher");
-    case mb::patcher::ErrorCode::FileOpenError:
-        return QObject::tr("Failed to open file");
-    case mb::patcher::ErrorCode::FileCloseError:
-        return QObject::tr("Failed to close file");
-    case mb::patcher::ErrorCode::FileReadError:
-        return QObject::tr("Failed to read from file");
-    case mb::patcher::ErrorCode::FileWriteError:
-        return QObject::tr("Failed to write to file");
-    case mb::patcher::ErrorCode::FileSeekError:
-        return QObject::tr("Failed to seek file");
-    case mb::patcher::ErrorCode::FileTellError:
-        return QObject::tr("Failed to get file position");
-    case mb::patcher::ErrorCode::ArchiveReadOpenError:
-        return QObject::tr("Failed to open archive for reading");
-    case mb::patcher::ErrorCode::ArchiveReadDataError:
-        return QObject::tr("Failed to read archive data for file");
-    case mb::patcher::ErrorCode::ArchiveReadHeaderError:
-        return QObject::tr("Failed to read archive entry header");
-    case mb::patcher::ErrorCode::ArchiveWriteOpenError:
-        return QObject::tr("Failed to open archive for writing");
-    case mb::patcher::ErrorCode::ArchiveWriteDataError:
-        return QObject::tr("Failed to write archive data for file");
-    case mb::patcher::ErrorCode::ArchiveWriteHeaderError:
-        return QObject::tr("Failed to write archive header for file");
-    case mb::patcher::ErrorCode::ArchiveCloseError:
-        return QObject::tr("Failed to close archive");
-    case mb::patcher::ErrorCode::ArchiveFreeError:
-        return QObject::tr("Failed to free archive header memory");
-    case mb::patcher::ErrorCode::PatchingCancelled:
-        return QObject::tr("Patching was cancelled");
-    default:
-        assert(false);
-    }
-
-    return QString();
-}
-
 
 PatcherTask::PatcherTask(QWidget *parent)
     : QObject(parent)
 {
 }
 
-static void progressUpdatedCbWrapper(uint64_t bytes, uint64_t maxBytes,
-                                     void *userData)
+static void progressUpdatedCbWrapper(size_t job, uint64_t bytes,
+                                     uint64_t maxBytes, void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->progressUpdatedCb(bytes, maxBytes);
+    task->progressUpdatedCb(job, bytes, maxBytes);
 }
 
-static void filesUpdatedCbWrapper(uint64_t files, uint64_t maxFiles,
-                                  void *userData)
+static void filesUpdatedCbWrapper(size_t job, uint64_t files,
+                                  uint64_t maxFiles, void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->filesUpdatedCb(files, maxFiles);
+    task->filesUpdatedCb(job, files, maxFiles);
 }
 
-static void detailsUpdatedCbWrapper(const std::string &text, void *userData)
+static void detailsUpdatedCbWrapper(size_t job, const std::string &text,
+                                    void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->detailsUpdatedCb(text);
+    task->detailsUpdatedCb(job, text);
 }
 
-void PatcherTask::patch(PatcherPtr patcher, FileInfoPtr info)
+static void stateChangedCbWrapper(size_t job, mb::patcher::PatchJobState state,
+                                  void *userData)
 {
-    patcher->set_file_info(info);
+    PatcherTask *task = static_cast<PatcherTask *>(userData);
+    task->stateChangedCb(job, state);
+}
 
-    bool ret = patcher->patch_file(&progressUpdatedCbWrapper,
-                                   &filesUpdatedCbWrapper,
-                                   &detailsUpdatedCbWrapper,
-                                   this);
+void PatcherTask::patch(PatchQueuePtr queue)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_progressLock);
+        m_progress.assign(queue->job_count(), JobProgress());
+        m_progressChanged = true;
+    }
 
-    QString newFile(QString::fromStdString(info->output_path()));
+    queue->set_callbacks(&progressUpdatedCbWrapper,
+                         &filesUpdatedCbWrapper,
+                         &detailsUpdatedCbWrapper,
+                         &stateChangedCbWrapper,
+                         this);
 
-    patcher->set_file_info(nullptr);
-    delete info;
+    bool ret = queue->start() && queue->wait();
 
-    if (!ret) {
-        emit finished(QString(), true, errorToString(patcher->error()));
-    } else {
-        emit finished(newFile, false, QString());
+    queue->set_callbacks(nullptr, nullptr, nullptr, nullptr, nullptr);
+
+    emit finished(!ret);
+}
+
+bool PatcherTask::takeProgress(std::vector<JobProgress> &progress)
+{
+    std::lock_guard<std::mutex> lock(m_progressLock);
+
+    if (!m_progressChanged) {
+        return false;
     }
+
+    progress = m_progress;
+    m_progressChanged = false;
+
+    return true;
 }
 
-void PatcherTask::progressUpdatedCb(uint64_t bytes, uint64_t maxBytes)
+void PatcherTask::progressUpdatedCb(size_t job, uint64_t bytes,
+                                    uint64_t maxBytes)
 {
-    emit progressUpdated(bytes, maxBytes);
+    std::lock_guard<std::mutex> lock(m_progressLock);
+    m_progress[job].bytes = bytes;
+    m_progress[job].maxBytes = maxBytes;
+    m_progressChanged = true;
 }
 
-void PatcherTask::filesUpdatedCb(uint64_t files, uint64_t maxFiles)
+void PatcherTask::filesUpdatedCb(size_t job, uint64_t files, uint64_t maxFiles)
 {
-    emit filesUpdated(files, maxFiles);
+    std::lock_guard<std::mutex> lock(m_progressLock);
+    m_progress[job].files = files;
+    m_progress[job].maxFiles = maxFiles;
+    m_progressChanged = true;
+}
+
+void PatcherTask::detailsUpdatedCb(size_t job, const std::string &text)
+{
+    QString details(QString::fromStdString(text));
+
+    std::lock_guard<std::mutex> lock(m_progressLock);
+    m_progress[job].details = std::move(details);
+    m_progressChanged = true;
 }
 
-void PatcherTask::detailsUpdatedCb(const std::string &text)
+void PatcherTask::stateChangedCb(size_t job, mb::patcher::PatchJobState state)
 {
-    emit detailsUpdated(QString::fromStdString(text));
+    std::lock_guard<std::mutex> lock(m_progressLock);
+    m_progress[job].state = state;
+    m_progressChanged = true;
 }
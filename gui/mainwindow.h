@@ -20,19 +20,19 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#include <mbpatcher/fileinfo.h>
+#include <mbpatcher/patchqueue.h>
 #include <mbpatcher/patcherconfig.h>
-#include <mbpatcher/patcherinterface.h>
+
+#include <mutex>
+#include <vector>
 
 #include <QtCore/QMetaType>
 #include <QtWidgets/QAbstractButton>
 #include <QtWidgets/QWidget>
 
 
-typedef mb::patcher::Patcher * PatcherPtr;
-Q_DECLARE_METATYPE(PatcherPtr)
-typedef mb::patcher::FileInfo * FileInfoPtr;
-Q_DECLARE_METATYPE(FileInfoPtr)
+typedef mb::patcher::PatchQueue * PatchQueuePtr;
+Q_DECLARE_METATYPE(PatchQueuePtr)
 
 class MainWindowPrivate;
 
@@ -45,7 +45,7 @@ public:
     ~MainWindow();
 
 signals:
-    void runThread(PatcherPtr patcher, FileInfoPtr info);
+    void runThread(PatchQueuePtr queue);
 
 private slots:
     void onDeviceSelected(int index);
@@ -55,25 +55,22 @@ private slots:
     void onChooseFileItemClicked(QAction *action);
 
     // Progress
-    void onProgressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void onFilesUpdated(uint64_t files, uint64_t maxFiles);
-    void onDetailsUpdated(const QString &text);
+    void onProgressTimerTimeout();
 
-    void onPatchingFinished(const QString &newFile, bool failed,
-                            const QString &errorMessage);
+    void onPatchingFinished(bool failed);
 
 private:
     virtual void closeEvent(QCloseEvent *event) override;
 
     void updateRomIdDescText(const QString &text);
-    void updateProgressText();
+    void updateProgress();
 
     void addWidgets();
     void setWidgetActions();
     void populateDevices();
     void populateInstallationLocations();
 
-    void chooseFile(const QString &patterns);
+    void chooseFiles(const QString &patterns);
     void startPatching();
 
     void updateWidgetsVisibility();
@@ -84,27 +81,42 @@ private:
     Q_DECLARE_PRIVATE(MainWindow)
 };
 
-class PatcherTaskPrivate;
-
 class PatcherTask : public QObject
 {
     Q_OBJECT
 
 public:
+    struct JobProgress
+    {
+        uint64_t bytes = 0;
+        uint64_t maxBytes = 0;
+        uint64_t files = 0;
+        uint64_t maxFiles = 0;
+        QString details;
+        mb::patcher::PatchJobState state = mb::patcher::PatchJobState::Pending;
+    };
+
     PatcherTask(QWidget *parent = 0);
 
-    void patch(PatcherPtr patcher, FileInfoPtr info);
+    void patch(PatchQueuePtr queue);
 
-    void progressUpdatedCb(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdatedCb(uint64_t files, uint64_t maxFiles);
-    void detailsUpdatedCb(const std::string &text);
+    bool takeProgress(std::vector<JobProgress> &progress);
+
+    void progressUpdatedCb(size_t job, uint64_t bytes, uint64_t maxBytes);
+    void filesUpdatedCb(size_t job, uint64_t files, uint64_t maxFiles);
+    void detailsUpdatedCb(size_t job, const std::string &text);
+    void stateChangedCb(size_t job, mb::patcher::PatchJobState state);
 
 signals:
-    void finished(const QString &newFile, bool failed,
-                  const QString &errorMessage);
-    void progressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdated(uint64_t files, uint64_t maxFiles);
-    void detailsUpdated(const QString &text);
+    void finished(bool failed);
+
+private:
+    // The queue's workers only record their progress here. The GUI thread
+    // picks it up at the display refresh rate instead of receiving a signal
+    // for every callback.
+    std::mutex m_progressLock;
+    std::vector<JobProgress> m_progress;
+    bool m_progressChanged = false;
 };
 
 #endif // MAINWINDOW_H
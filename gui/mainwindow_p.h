@@ -23,14 +23,15 @@
 #include "mainwindow.h"
 
 #include <mbdevice/device.h>
+#include <mbpatcher/patchqueue.h>
 #include <mbpatcher/patcherconfig.h>
-#include <mbpatcher/patcherinterface.h>
 
 #include <memory>
 #include <vector>
 
 #include <QtCore/QSettings>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtWidgets/QCheckBox>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QDialogButtonBox>
@@ -40,6 +41,7 @@
 #include <QtWidgets/QProgressBar>
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QRadioButton>
+#include <QtWidgets/QSpinBox>
 
 
 class InstallLocation
@@ -62,35 +64,33 @@ public:
 
     MainWindowPrivate();
 
-    uint64_t bytes;
-    uint64_t maxBytes;
-    uint64_t files;
-    uint64_t maxFiles;
+    // Latest progress of each job in the queue
+    std::vector<PatcherTask::JobProgress> progress;
 
     QSettings settings;
 
     // Current state of the patcher
     State state = FirstRun;
 
-    // Selected file
+    // Selected files
     QString patcherId;
-    QString fileName;
+    QStringList fileNames;
     bool autoMode;
 
     mb::patcher::PatcherConfig *pc = nullptr;
     std::vector<mb::device::Device> devices;
 
-    // Selected patcher
-    mb::patcher::Patcher *patcher = nullptr;
+    // Queue of files being patched
+    std::unique_ptr<mb::patcher::PatchQueue> queue;
 
-    // Patcher finish status and error message
-    QString patcherNewFile;
+    // Patcher finish status and per-file results
     bool patcherFailed;
-    QString patcherError;
+    QString patcherResults;
 
     // Threads
     QThread *thread;
     PatcherTask *task;
+    QTimer *progressTimer;
 
     // Selected device
     mb::device::Device *device = nullptr;
@@ -110,6 +110,8 @@ public:
     QComboBox *instLocSel;
     QLabel *instLocDesc;
     QLineEdit *instLocLe;
+    QLabel *jobsLbl;
+    QSpinBox *jobsSel;
 
     QLabel *messageLbl;
 
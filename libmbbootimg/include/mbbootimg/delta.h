@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+class File;
+
+namespace bootimg
+{
+
+constexpr size_t DELTA_BLOCK_SIZE = 4096;
+
+struct DeltaRange
+{
+    //! Offset of the changed region
+    uint64_t offset;
+    //! Size of the changed region
+    uint64_t size;
+};
+
+struct ImageDelta
+{
+    //! Size of the new image
+    uint64_t size;
+    //! Regions of the new image that differ from the old image
+    std::vector<DeltaRange> ranges;
+    //! Whether the headers differ or either image could not be parsed
+    bool header_changed;
+    //! Types of the entries in the new image whose data or layout changed
+    std::vector<int> changed_entries;
+};
+
+MB_EXPORT oc::result<ImageDelta>
+delta_compute(File &old_file, File &new_file,
+              size_t block_size = DELTA_BLOCK_SIZE);
+
+MB_EXPORT oc::result<uint64_t>
+delta_apply(const ImageDelta &delta, File &new_file, File &old_file);
+
+}
+}
@@ -58,7 +58,7 @@ public:
     std::optional<int> type() const;
     void set_type(std::optional<int> type);
 
-    std::optional<std::string> name() const;
+    const std::optional<std::string> & name() const;
     void set_name(std::optional<std::string> name);
 
     std::optional<uint64_t> size() const;
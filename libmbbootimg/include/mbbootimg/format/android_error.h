@@ -38,6 +38,7 @@ enum class AndroidError
     MissingPageSize         = 14,
     BoardNameTooLong        = 15,
     KernelCmdlineTooLong    = 16,
+    PageSizeMismatch        = 17,
 
     // Bump errors
     BumpMagicNotFound       = 20,
@@ -23,8 +23,6 @@
 
 #include <optional>
 
-#include <openssl/sha.h>
-
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
 #include "mbbootimg/writer.h"
@@ -61,8 +59,6 @@ private:
     // Header values
     AndroidHeader m_hdr;
 
-    SHA_CTX m_sha_ctx;
-
     std::optional<SegmentWriter> m_seg;
 };
 
@@ -21,6 +21,7 @@
 
 #include "mbbootimg/guard_p.h"
 
+#include <cstddef>
 #include <cstdint>
 
 #include "mbcommon/common.h"
@@ -51,6 +52,9 @@ static inline void loki_fix_header_byte_order(LokiHeader &header)
     header.ramdisk_addr = mb_le32toh(header.ramdisk_addr);
 }
 
+bool _loki_find_aboot_function(const unsigned char *aboot, size_t aboot_size,
+                               size_t &offset_out);
+
 oc::result<void> _loki_patch_file(Writer &writer, File &file,
                                   const void *aboot, size_t aboot_size);
 
@@ -24,8 +24,6 @@
 #include <optional>
 #include <vector>
 
-#include <openssl/sha.h>
-
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
 #include "mbbootimg/writer.h"
@@ -62,8 +60,6 @@ private:
 
     std::vector<unsigned char> m_aboot;
 
-    SHA_CTX m_sha_ctx;
-
     std::optional<SegmentWriter> m_seg;
 };
 
@@ -22,6 +22,7 @@
 #include "mbbootimg/guard_p.h"
 
 #include <optional>
+#include <vector>
 
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/mtk_p.h"
@@ -55,9 +56,15 @@ public:
     oc::result<void> finish_entry(File &file) override;
 
 private:
+    oc::result<void> hash_mtk_header(std::optional<uint32_t> size);
+
     // Header values
     android::AndroidHeader m_hdr;
 
+    // MTK header of the current entry pair. Its size field is only known once
+    // the following kernel or ramdisk entry is written, so it is hashed then.
+    std::vector<unsigned char> m_mtk_hdr;
+
     std::optional<SegmentWriter> m_seg;
 };
 
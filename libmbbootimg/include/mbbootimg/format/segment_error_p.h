@@ -33,6 +33,9 @@ enum class SegmentError
     ReadWouldOverflowInteger    = 12,
     WriteWouldOverflowInteger   = 13,
     InvalidEntrySize            = 14,
+
+    Sha1InitError               = 20,
+    Sha1UpdateError             = 21,
 };
 
 MB_EXPORT std::error_code make_error_code(SegmentError e);
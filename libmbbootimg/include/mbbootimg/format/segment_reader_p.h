@@ -43,6 +43,8 @@ struct SegmentReaderEntry
     uint64_t offset;
     uint32_t size;
     bool can_truncate;
+    // Alignment of the segment within the image (0 if unaligned)
+    uint64_t align;
 };
 
 class SegmentReader
@@ -52,6 +54,7 @@ public:
 
     const std::vector<SegmentReaderEntry> & entries() const;
     oc::result<void> set_entries(std::vector<SegmentReaderEntry> entries);
+    std::vector<EntryInfo> entry_infos() const;
 
     oc::result<void> move_to_entry(File &file, Entry &entry,
                                    std::vector<SegmentReaderEntry>::iterator srentry,
@@ -62,6 +65,7 @@ public:
                                  Reader &reader);
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size,
                                  Reader &reader);
+    oc::result<FileConstIoVec> read_data_view(File &file, Reader &reader);
 
 private:
     SegmentReaderState m_state;
@@ -24,8 +24,11 @@
 #include <optional>
 #include <vector>
 
+#include <cstddef>
 #include <cstdint>
 
+#include <openssl/sha.h>
+
 #include "mbbootimg/writer.h"
 
 namespace mb::bootimg
@@ -65,6 +68,26 @@ public:
                                   Writer &writer);
     oc::result<void> finish_entry(File &file, Writer &writer);
 
+    // Once enabled, all data passed to write_data() is included in the SHA1
+    // hash, except for entries excluded by exclude_entry_from_sha1(). Format
+    // writers add format-specific values (eg. sizes) with update_sha1().
+    oc::result<void> enable_sha1();
+    void disable_sha1();
+    bool is_sha1_enabled() const;
+    void exclude_entry_from_sha1();
+    oc::result<void> update_sha1(const void *data, size_t size,
+                                 Writer &writer);
+    oc::result<void> finish_sha1(unsigned char digest[SHA_DIGEST_LENGTH],
+                                 Writer &writer);
+
+    // Stops hashing written data, but keeps the hash state. A format writer
+    // that learns a hashed value too late (eg. a size stored in a header that
+    // precedes the data) can call resume_sha1() once the image is complete and
+    // read back only the entries starting at sha1_deferred_entry().
+    void defer_sha1(size_t entry_index);
+    std::optional<size_t> sha1_deferred_entry() const;
+    void resume_sha1();
+
 private:
     SegmentWriterState m_state;
 
@@ -74,6 +97,11 @@ private:
     uint32_t m_entry_size;
 
     std::optional<uint64_t> m_pos;
+
+    std::optional<SHA_CTX> m_sha_ctx;
+    bool m_sha_exclude_entry;
+    std::optional<SHA_CTX> m_sha_deferred_ctx;
+    std::optional<size_t> m_sha_deferred_entry;
 };
 
 }
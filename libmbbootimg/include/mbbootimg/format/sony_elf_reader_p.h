@@ -47,7 +47,9 @@ public:
     oc::result<void> read_header(File &file, Header &header) override;
     oc::result<void> read_entry(File &file, Entry &entry) override;
     oc::result<void> go_to_entry(File &file, Entry &entry, int entry_type) override;
+    oc::result<std::vector<EntryInfo>> entries() override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<FileConstIoVec> read_data_view(File &file) override;
 
     static oc::result<void>
     find_sony_elf_header(Reader &reader, File &file,
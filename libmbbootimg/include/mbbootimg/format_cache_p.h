@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::bootimg::detail
+{
+
+class ProbeFile;
+
+// Persistent map from a fingerprint of a boot image to the name of the format
+// that won the bid for it. The fingerprint consists of the file size and a
+// SHA1 hash of the head and tail regions read by ProbeFile, so any change to
+// the size or to the regions that the bidders inspect invalidates the entry.
+// The cache is only a hint: the cached format must still accept the file.
+class FormatCache
+{
+public:
+    static constexpr size_t MAX_ENTRIES = 256;
+
+    FormatCache(std::string path);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FormatCache)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(FormatCache)
+
+    static std::optional<std::string> fingerprint(const ProbeFile &file);
+
+    std::optional<std::string> lookup(const std::string &fingerprint);
+    oc::result<void> store(const std::string &fingerprint,
+                           const std::string &format_name);
+
+private:
+    void load();
+    oc::result<void> save();
+
+    std::string m_path;
+    bool m_loaded;
+    // Pairs of (fingerprint, format name), most recently stored last
+    std::vector<std::pair<std::string, std::string>> m_entries;
+};
+
+}
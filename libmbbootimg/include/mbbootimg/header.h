@@ -92,10 +92,10 @@ public:
     HeaderFields supported_fields() const;
     void set_supported_fields(HeaderFields fields);
 
-    std::optional<std::string> board_name() const;
+    const std::optional<std::string> & board_name() const;
     bool set_board_name(std::optional<std::string> name);
 
-    std::optional<std::string> kernel_cmdline() const;
+    const std::optional<std::string> & kernel_cmdline() const;
     bool set_kernel_cmdline(std::optional<std::string> cmdline);
 
     std::optional<uint32_t> page_size() const;
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+// Read-only view of a file that caches the head and tail regions. Format
+// bidders mostly look at the beginning of the image (headers) and the end
+// (footers and signatures), so reading both once and sharing them between all
+// bidders avoids reading the same regions over and over. Reads outside of the
+// cached regions go to the underlying file.
+class ProbeFile : public File
+{
+public:
+    static constexpr size_t HEAD_SIZE = 64 * 1024;
+    static constexpr size_t TAIL_SIZE = 64 * 1024;
+
+    ProbeFile();
+    virtual ~ProbeFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProbeFile)
+
+    oc::result<void> open(File *file);
+
+    // Cached regions (only valid while open)
+    const std::vector<unsigned char> & head() const;
+    const std::vector<unsigned char> & tail() const;
+    std::optional<uint64_t> size() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    void clear();
+
+    oc::result<void> fill(std::vector<unsigned char> &buf, uint64_t offset,
+                          size_t size);
+
+    File *m_file;
+    // Cached data for [0, m_head.size())
+    std::vector<unsigned char> m_head;
+    // Cached data for [m_tail_offset, m_tail_offset + m_tail.size())
+    std::vector<unsigned char> m_tail;
+    uint64_t m_tail_offset;
+    std::optional<uint64_t> m_size;
+    uint64_t m_pos;
+    // Position of the underlying file if known
+    std::optional<uint64_t> m_file_pos;
+};
+
+}
@@ -24,8 +24,10 @@
 #include <vector>
 
 #include <cstddef>
+#include <cstdint>
 
 #include "mbcommon/common.h"
+#include "mbcommon/file.h"
 #include "mbcommon/outcome.h"
 
 #include "mbbootimg/defs.h"
@@ -34,7 +36,7 @@
 
 namespace mb
 {
-class File;
+class TracingFile;
 
 namespace bootimg
 {
@@ -42,6 +44,18 @@ namespace bootimg
 class Entry;
 class Header;
 
+struct EntryInfo
+{
+    //! Entry type (one of the `ENTRY_TYPE_*` constants)
+    int type;
+    //! Offset of the entry data within the boot image
+    uint64_t offset;
+    //! Size of the entry data
+    uint64_t size;
+    //! Alignment of the entry within the boot image (0 if unaligned)
+    uint64_t alignment;
+};
+
 class MB_EXPORT Reader
 {
 public:
@@ -64,7 +78,9 @@ public:
     oc::result<void> read_header(Header &header);
     oc::result<void> read_entry(Entry &entry);
     oc::result<void> go_to_entry(Entry &entry, int entry_type);
+    oc::result<std::vector<EntryInfo>> entries();
     oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<FileConstIoVec> read_data_view();
 
     // Format operations
     int format_code();
@@ -74,6 +90,7 @@ public:
     oc::result<void> enable_format_all();
     oc::result<void> enable_format_by_code(int code);
     oc::result<void> enable_format_by_name(const std::string &name);
+    oc::result<void> set_format_cache(const std::string &path);
 
     // Specific formats
     oc::result<void> enable_format_android();
@@ -96,10 +113,14 @@ private:
     // File
     std::unique_ptr<File> m_owned_file;
     File *m_file;
+    // Wraps m_file if tracing is enabled via MB_FILE_TRACE
+    std::unique_ptr<TracingFile> m_trace_file;
 
     std::vector<std::unique_ptr<detail::FormatReader>> m_formats;
     detail::FormatReader *m_format;
     bool m_format_user_set;
+    // Remembers bid winners across runs if enabled via set_format_cache()
+    std::unique_ptr<detail::FormatCache> m_format_cache;
 };
 
 }
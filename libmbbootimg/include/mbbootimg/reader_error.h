@@ -39,10 +39,13 @@ enum class ReaderError
     FormatAlreadyEnabled    = 33,
     NoFormatsRegistered     = 34,
     UnknownFileFormat       = 35,
+    FormatDisabled          = 36,
 
     EndOfEntries            = 40,
 
     UnsupportedGoTo         = 50,
+    UnsupportedEntryIndex   = 51,
+    UnsupportedHeaderPatch  = 52,
 };
 
 MB_EXPORT std::error_code make_error_code(ReaderError e);
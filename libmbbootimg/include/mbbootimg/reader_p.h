@@ -20,10 +20,12 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
 #include "mbcommon/common.h"
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
@@ -35,10 +37,13 @@ class File;
 namespace bootimg
 {
 class Reader;
+struct EntryInfo;
 
 namespace detail
 {
 
+class FormatCache;
+
 class FormatReader
 {
 public:
@@ -63,8 +68,12 @@ public:
     read_entry(File &file, Entry &entry) = 0;
     virtual oc::result<void>
     go_to_entry(File &file, Entry &entry, int entry_type);
+    virtual oc::result<std::vector<EntryInfo>>
+    entries();
     virtual oc::result<size_t>
     read_data(File &file, void *buf, size_t buf_size) = 0;
+    virtual oc::result<FileConstIoVec>
+    read_data_view(File &file);
 
 protected:
     Reader &m_reader;
@@ -34,6 +34,7 @@
 namespace mb
 {
 class File;
+class TracingFile;
 
 namespace bootimg
 {
@@ -93,6 +94,8 @@ private:
     // File
     std::unique_ptr<File> m_owned_file;
     File *m_file;
+    // Wraps m_file if tracing is enabled via MB_FILE_TRACE
+    std::unique_ptr<TracingFile> m_trace_file;
 
     std::unique_ptr<detail::FormatWriter> m_format;
 };
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbbootimg/compare.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+
+namespace mb::bootimg
+{
+
+// Amount of data compared at a time when the files cannot provide views
+static constexpr size_t COMPARE_IO_SIZE = 1024 * 1024;
+
+static oc::result<void> open_image(Reader &reader, File &file, Header &header)
+{
+    OUTCOME_TRYV(reader.enable_format_all());
+    OUTCOME_TRYV(reader.open(&file));
+    OUTCOME_TRYV(reader.read_header(header));
+
+    return oc::success();
+}
+
+static oc::result<bool> ranges_equal(File &file1, uint64_t offset1,
+                                     File &file2, uint64_t offset2,
+                                     uint64_t size)
+{
+    // Memory-backed files (eg. MmapFile) can be compared in place
+    if (size <= SIZE_MAX) {
+        auto view1 = file1.view(offset1, static_cast<size_t>(size));
+        auto view2 = file2.view(offset2, static_cast<size_t>(size));
+
+        if (view1 && view2) {
+            return view1.value().size == size
+                    && view2.value().size == size
+                    && memcmp(view1.value().data, view2.value().data,
+                              static_cast<size_t>(size)) == 0;
+        } else if ((!view1 && view1.error() != FileError::UnsupportedView)
+                || (!view2 && view2.error() != FileError::UnsupportedView)) {
+            return view1 ? view2.as_failure() : view1.as_failure();
+        }
+    }
+
+    std::vector<unsigned char> buf1(
+            static_cast<size_t>(std::min<uint64_t>(size, COMPARE_IO_SIZE)));
+    std::vector<unsigned char> buf2(buf1.size());
+
+    OUTCOME_TRYV(file1.seek(static_cast<int64_t>(offset1), SEEK_SET));
+    OUTCOME_TRYV(file2.seek(static_cast<int64_t>(offset2), SEEK_SET));
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf1.size()));
+
+        OUTCOME_TRY(n1, file_read_retry(file1, buf1.data(), n));
+        OUTCOME_TRY(n2, file_read_retry(file2, buf2.data(), n));
+
+        if (n1 != n || n2 != n || memcmp(buf1.data(), buf2.data(), n) != 0) {
+            return false;
+        }
+
+        size -= n;
+    }
+
+    return true;
+}
+
+// Used for formats that cannot list their entries. Each entry of the second
+// image is streamed and compared with the same entry in the first image.
+static oc::result<bool> entries_equal_streaming(Reader &reader1,
+                                                Reader &reader2)
+{
+    Entry entry1;
+    Entry entry2;
+    size_t entries = 0;
+
+    while (true) {
+        auto ret = reader1.read_entry(entry1);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            return ret.as_failure();
+        }
+        ++entries;
+    }
+
+    std::vector<unsigned char> buf1(COMPARE_IO_SIZE);
+    std::vector<unsigned char> buf2(COMPARE_IO_SIZE);
+
+    while (true) {
+        auto ret = reader2.read_entry(entry2);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            return ret.as_failure();
+        }
+
+        if (entries == 0) {
+            // Too many entries in second image
+            return false;
+        }
+        --entries;
+
+        ret = reader1.go_to_entry(entry1, *entry2.type());
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                // Cannot be equal if entry is missing
+                return false;
+            }
+            return ret.as_failure();
+        }
+
+        if (entry1.size() != entry2.size()) {
+            return false;
+        }
+
+        while (true) {
+            OUTCOME_TRY(n1, reader1.read_data(buf1.data(), buf1.size()));
+            if (n1 == 0) {
+                break;
+            }
+
+            OUTCOME_TRY(n2, reader2.read_data(buf2.data(), n1));
+            if (n1 != n2 || memcmp(buf1.data(), buf2.data(), n1) != 0) {
+                return false;
+            }
+        }
+    }
+
+    return entries == 0;
+}
+
+/*!
+ * \brief Check whether two boot images have the same contents
+ *
+ * The images are equal if their headers are equal and every entry has the
+ * same data. The headers include the SHA1 ID and the entry sizes, so most
+ * differing images are rejected without reading any entry data. If the format
+ * can list its entries, the entry data is compared in place when both files
+ * are memory-backed (eg. MmapFile) and in 1 MiB chunks otherwise.
+ *
+ * \note The file positions of both files after this function returns are
+ *       unspecified.
+ *
+ * \param file1 First boot image
+ * \param file2 Second boot image
+ *
+ * \return Whether the images are equal if both files are successfully read.
+ *         Otherwise, the error code.
+ */
+oc::result<bool> images_equal(File &file1, File &file2)
+{
+    Reader reader1;
+    Reader reader2;
+    Header header1;
+    Header header2;
+
+    OUTCOME_TRYV(open_image(reader1, file1, header1));
+    OUTCOME_TRYV(open_image(reader2, file2, header2));
+
+    if (header1 != header2) {
+        return false;
+    }
+
+    auto entries1 = reader1.entries();
+    auto entries2 = reader2.entries();
+
+    if (!entries1 || !entries2) {
+        if ((!entries1 && entries1.error() != ReaderError::UnsupportedEntryIndex)
+                || (!entries2 && entries2.error() != ReaderError::UnsupportedEntryIndex)) {
+            return entries1 ? entries2.as_failure() : entries1.as_failure();
+        }
+
+        return entries_equal_streaming(reader1, reader2);
+    }
+
+    if (entries1.value().size() != entries2.value().size()) {
+        return false;
+    }
+
+    // Check the entry layout before reading any data
+    for (auto const &e2 : entries2.value()) {
+        auto e1 = std::find_if(
+                entries1.value().begin(), entries1.value().end(),
+                [&](const EntryInfo &e) { return e.type == e2.type; });
+        if (e1 == entries1.value().end() || e1->size != e2.size) {
+            return false;
+        }
+    }
+
+    for (auto const &e2 : entries2.value()) {
+        auto e1 = std::find_if(
+                entries1.value().begin(), entries1.value().end(),
+                [&](const EntryInfo &e) { return e.type == e2.type; });
+
+        OUTCOME_TRY(equal, ranges_equal(file1, e1->offset,
+                                        file2, e2.offset, e2.size));
+        if (!equal) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
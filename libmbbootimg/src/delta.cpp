@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbbootimg/delta.h"
+
+#include <algorithm>
+#include <system_error>
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+
+namespace mb::bootimg
+{
+
+// Amount of data read or written at a time. Comparisons are still done at
+// block_size granularity, but block devices are much faster with large I/O.
+static constexpr size_t DELTA_IO_SIZE = 1024 * 1024;
+
+static void add_range(std::vector<DeltaRange> &ranges, uint64_t offset,
+                      uint64_t size)
+{
+    // Merge with the previous range if they are contiguous
+    if (!ranges.empty()
+            && ranges.back().offset + ranges.back().size == offset) {
+        ranges.back().size += size;
+    } else {
+        ranges.push_back({offset, size});
+    }
+}
+
+static bool overlaps(const std::vector<DeltaRange> &ranges, uint64_t offset,
+                     uint64_t size)
+{
+    return std::any_of(ranges.begin(), ranges.end(),
+                       [&](const DeltaRange &r) {
+        return r.offset < offset + size && offset < r.offset + r.size;
+    });
+}
+
+static oc::result<std::vector<EntryInfo>>
+read_layout(File &file, Header &header)
+{
+    Reader reader;
+
+    OUTCOME_TRYV(reader.enable_format_all());
+    OUTCOME_TRYV(reader.open(&file));
+    OUTCOME_TRYV(reader.read_header(header));
+    OUTCOME_TRY(entries, reader.entries());
+    OUTCOME_TRYV(reader.close());
+
+    return entries;
+}
+
+static void find_changed_entries(File &old_file, File &new_file,
+                                 const std::vector<DeltaRange> &diffs,
+                                 ImageDelta &delta)
+{
+    Header old_header;
+    Header new_header;
+
+    auto old_entries = read_layout(old_file, old_header);
+    auto new_entries = read_layout(new_file, new_header);
+
+    if (!new_entries) {
+        // Nothing is known about the new image's structure
+        delta.header_changed = true;
+        return;
+    }
+
+    delta.header_changed = !old_entries || old_header != new_header;
+
+    for (auto const &entry : new_entries.value()) {
+        bool changed = true;
+
+        if (old_entries) {
+            auto old_entry = std::find_if(
+                    old_entries.value().begin(), old_entries.value().end(),
+                    [&](const EntryInfo &e) { return e.type == entry.type; });
+
+            changed = old_entry == old_entries.value().end()
+                    || old_entry->offset != entry.offset
+                    || old_entry->size != entry.size
+                    || overlaps(diffs, entry.offset, entry.size);
+        }
+
+        if (changed) {
+            delta.changed_entries.push_back(entry.type);
+        }
+    }
+}
+
+/*!
+ * \brief Compare two boot images block by block
+ *
+ * The new image is compared against the old image in blocks of \p block_size
+ * bytes and every block that differs (including blocks past the end of the old
+ * image) is recorded. If both files are boot images that libmbbootimg can
+ * parse, the entries whose data or layout changed are also listed.
+ *
+ * \note The file positions of both files after this function returns are
+ *       unspecified.
+ *
+ * \param old_file Currently installed image (eg. the boot partition)
+ * \param new_file Image to be installed
+ * \param block_size Comparison granularity
+ *
+ * \return ImageDelta describing the changed regions if both files are
+ *         successfully read. Otherwise, the error code.
+ */
+oc::result<ImageDelta>
+delta_compute(File &old_file, File &new_file, size_t block_size)
+{
+    if (block_size == 0) {
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    ImageDelta delta{};
+    // Exact byte ranges that differ. The blocks in delta.ranges may also cover
+    // unchanged bytes of neighboring entries.
+    std::vector<DeltaRange> diffs;
+
+    size_t blocks_per_read = std::max<size_t>(1, DELTA_IO_SIZE / block_size);
+    std::vector<unsigned char> old_buf(block_size * blocks_per_read);
+    std::vector<unsigned char> new_buf(block_size * blocks_per_read);
+
+    OUTCOME_TRYV(old_file.seek(0, SEEK_SET));
+    OUTCOME_TRYV(new_file.seek(0, SEEK_SET));
+
+    while (true) {
+        OUTCOME_TRY(n_new, file_read_retry(new_file, new_buf.data(),
+                                           new_buf.size()));
+        if (n_new == 0) {
+            break;
+        }
+
+        OUTCOME_TRY(n_old, file_read_retry(old_file, old_buf.data(), n_new));
+
+        for (size_t pos = 0; pos < n_new; pos += block_size) {
+            size_t n = std::min(block_size, n_new - pos);
+            uint64_t offset = delta.size + pos;
+            const unsigned char *old_block = old_buf.data() + pos;
+            const unsigned char *new_block = new_buf.data() + pos;
+
+            if (pos + n > n_old) {
+                add_range(delta.ranges, offset, n);
+                add_range(diffs, offset, n);
+            } else if (memcmp(old_block, new_block, n) != 0) {
+                size_t first = 0;
+                size_t last = n;
+
+                while (old_block[first] == new_block[first]) {
+                    ++first;
+                }
+                while (old_block[last - 1] == new_block[last - 1]) {
+                    --last;
+                }
+
+                add_range(delta.ranges, offset, n);
+                add_range(diffs, offset + first, last - first);
+            }
+        }
+
+        delta.size += n_new;
+
+        if (n_new < new_buf.size()) {
+            break;
+        }
+    }
+
+    find_changed_entries(old_file, new_file, diffs, delta);
+
+    return delta;
+}
+
+/*!
+ * \brief Write the changed regions of a new boot image over the old image
+ *
+ * After this function succeeds, the first ImageDelta::size bytes of \p old_file
+ * are identical to \p new_file. Data in \p old_file past that point is left
+ * untouched.
+ *
+ * \param delta Delta computed by delta_compute()
+ * \param new_file Image to be installed
+ * \param old_file Currently installed image. Must be writable.
+ *
+ * \return Number of bytes written if all changed regions are successfully
+ *         written. Otherwise, the error code.
+ */
+oc::result<uint64_t>
+delta_apply(const ImageDelta &delta, File &new_file, File &old_file)
+{
+    std::vector<unsigned char> buf(DELTA_IO_SIZE);
+    uint64_t total = 0;
+
+    for (auto const &range : delta.ranges) {
+        if (range.offset > INT64_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        OUTCOME_TRYV(new_file.seek(static_cast<int64_t>(range.offset),
+                                   SEEK_SET));
+        OUTCOME_TRYV(old_file.seek(static_cast<int64_t>(range.offset),
+                                   SEEK_SET));
+
+        for (uint64_t remain = range.size; remain > 0;) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(remain, buf.size()));
+
+            OUTCOME_TRYV(file_read_exact(new_file, buf.data(), n));
+            OUTCOME_TRYV(file_write_exact(old_file, buf.data(), n));
+
+            remain -= n;
+            total += n;
+        }
+    }
+
+    return total;
+}
+
+}
@@ -62,7 +62,7 @@ void Entry::set_type(std::optional<int> type)
     m_type = std::move(type);
 }
 
-std::optional<std::string> Entry::name() const
+const std::optional<std::string> & Entry::name() const
 {
     return m_name;
 }
@@ -66,6 +66,8 @@ std::string AndroidErrorCategory::message(int ev) const
         return "board name too long";
     case AndroidError::KernelCmdlineTooLong:
         return "kernel cmdline too long";
+    case AndroidError::PageSizeMismatch:
+        return "page size does not match existing image";
     case AndroidError::BumpMagicNotFound:
         return "bump magic not found";
     case AndroidError::SamsungMagicNotFound:
@@ -170,20 +170,23 @@ oc::result<void> AndroidFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_KERNEL, kernel_offset, m_hdr.kernel_size, false
+        ENTRY_TYPE_KERNEL, kernel_offset, m_hdr.kernel_size,
+        false, m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, ramdisk_offset, m_hdr.ramdisk_size, false
+        ENTRY_TYPE_RAMDISK, ramdisk_offset, m_hdr.ramdisk_size,
+        false, m_hdr.page_size
     });
     if (m_hdr.second_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false
+            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size,
+            false, m_hdr.page_size
         });
     }
     if (m_hdr.dt_size > 0) {
         entries.push_back({
             ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size,
-            m_allow_truncated_dt
+            m_allow_truncated_dt, m_hdr.page_size
         });
     }
 
@@ -201,12 +204,22 @@ oc::result<void> AndroidFormatReader::go_to_entry(File &file, Entry &entry,
     return m_seg->go_to_entry(file, entry, entry_type, m_reader);
 }
 
+oc::result<std::vector<EntryInfo>> AndroidFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
 oc::result<size_t> AndroidFormatReader::read_data(File &file, void *buf,
                                                   size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileConstIoVec> AndroidFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file, m_reader);
+}
+
 /*!
  * \brief Find and read Android boot image header
  *
@@ -555,13 +568,18 @@ oc::result<int> AndroidFormatReader::open_bump(File &file, int best_bid)
 /*!
  * \brief Enable support for Android boot image format
  *
- * \return Nothing if the format is successfully enabled. Otherwise, the error
- *         code.
+ * \return Nothing if the format is successfully enabled.
+ *         ReaderError::FormatDisabled if support for the format was left out
+ *         of the build. Otherwise, the error code.
  */
 oc::result<void> Reader::enable_format_android()
 {
+#ifdef MBBOOTIMG_DISABLE_ANDROID_READER
+    return ReaderError::FormatDisabled;
+#else
     return register_format(
             std::make_unique<android::AndroidFormatReader>(*this, false));
+#endif
 }
 
 }
@@ -51,7 +51,6 @@ AndroidFormatWriter::AndroidFormatWriter(Writer &writer, bool is_bump)
     : FormatWriter(writer)
     , m_is_bump(is_bump)
     , m_hdr()
-    , m_sha_ctx()
 {
 }
 
@@ -79,12 +78,11 @@ oc::result<void> AndroidFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
-        return AndroidError::Sha1InitError;
-    }
-
     m_seg = SegmentWriter();
 
+    // The ID is computed while the entries are written
+    OUTCOME_TRYV(m_seg->enable_sha1());
+
     return oc::success();
 }
 
@@ -92,7 +90,6 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 {
     auto reset_state = finally([&] {
         m_hdr = {};
-        m_sha_ctx = {};
         m_seg = {};
     });
 
@@ -116,10 +113,7 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 
             // Set ID
             unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
-                m_writer.set_fatal();
-                return AndroidError::Sha1UpdateError;
-            }
+            OUTCOME_TRYV(m_seg->finish_sha1(digest, m_writer));
             memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
 
             // Convert fields back to little-endian
@@ -191,7 +185,7 @@ oc::result<void> AndroidFormatWriter::write_header(File &file,
         return AndroidError::MissingPageSize;
     }
 
-    if (auto board_name = header.board_name()) {
+    if (auto &board_name = header.board_name()) {
         if (board_name->size() >= sizeof(m_hdr.name)) {
             return AndroidError::BoardNameTooLong;
         }
@@ -200,7 +194,7 @@ oc::result<void> AndroidFormatWriter::write_header(File &file,
                 sizeof(m_hdr.name) - 1);
         m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
     }
-    if (auto cmdline = header.kernel_cmdline()) {
+    if (auto &cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return AndroidError::KernelCmdlineTooLong;
         }
@@ -246,18 +240,9 @@ oc::result<void> AndroidFormatWriter::write_entry(File &file,
 oc::result<size_t> AndroidFormatWriter::write_data(File &file, const void *buf,
                                                    size_t buf_size)
 {
-    OUTCOME_TRY(n, m_seg->write_data(file, buf, buf_size, m_writer));
-
-    // We always include the image in the hash. The size is sometimes included
-    // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
-        // This must be fatal as the write already happened and cannot be
-        // reattempted
-        m_writer.set_fatal();
-        return AndroidError::Sha1UpdateError;
-    }
-
-    return n;
+    // We always include the image in the hash (done by SegmentWriter). The
+    // size is sometimes included and is handled in finish_entry().
+    return m_seg->write_data(file, buf, buf_size, m_writer);
 }
 
 oc::result<void> AndroidFormatWriter::finish_entry(File &file)
@@ -270,10 +255,9 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     uint32_t le32_size = mb_htole32(*swentry->size);
 
     // Include size for everything except empty DT images
-    if ((swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
-        m_writer.set_fatal();
-        return AndroidError::Sha1UpdateError;
+    if (swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0) {
+        OUTCOME_TRYV(m_seg->update_sha1(&le32_size, sizeof(le32_size),
+                                        m_writer));
     }
 
     switch (swentry->type) {
@@ -27,13 +27,18 @@ namespace mb::bootimg
 /*!
  * \brief Enable support for Bump boot image format
  *
- * \return Nothing if the format is successfully enabled. Otherwise, the error
- *         code.
+ * \return Nothing if the format is successfully enabled.
+ *         ReaderError::FormatDisabled if support for the format was left out
+ *         of the build. Otherwise, the error code.
  */
 oc::result<void> Reader::enable_format_bump()
 {
+#ifdef MBBOOTIMG_DISABLE_BUMP_READER
+    return ReaderError::FormatDisabled;
+#else
     return register_format(
             std::make_unique<android::AndroidFormatReader>(*this, true));
+#endif
 }
 
 
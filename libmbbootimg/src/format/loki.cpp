@@ -271,6 +271,77 @@ _loki_write_shellcode(Writer &writer, File &file,
     return oc::success();
 }
 
+/*!
+ * \brief Find the signature checking function in an aboot image
+ *
+ * All patterns are matched in a single pass. Every pattern starts with one of
+ * two bytes, so candidate offsets are located with memchr(), which libc
+ * implements with vector instructions, and only those offsets are compared
+ * against the full patterns.
+ *
+ * The first five patterns take precedence over the second LG pattern. This is
+ * necessary because apparently some LG models have both LG patterns, which
+ * throws off the fingerprinting.
+ *
+ * \param[in] aboot aboot image
+ * \param[in] aboot_size Size of aboot image
+ * \param[out] offset_out Offset of the function in the aboot image
+ *
+ * \return Whether the function was found
+ */
+bool _loki_find_aboot_function(const unsigned char *aboot, size_t aboot_size,
+                               size_t &offset_out)
+{
+    if (aboot_size < MIN_ABOOT_SIZE) {
+        return false;
+    }
+
+    const unsigned char *end = aboot + aboot_size - ABOOT_SEARCH_LIMIT;
+    const unsigned char *lg_match = nullptr;
+
+    auto find_next = [&](const unsigned char *ptr, char c) {
+        auto found = memchr(ptr, static_cast<unsigned char>(c),
+                            static_cast<size_t>(end - ptr));
+        return found ? static_cast<const unsigned char *>(found) : end;
+    };
+
+    // PATTERN1 and PATTERN2 are Thumb and start with a different byte than the
+    // ARM patterns, PATTERN3 through PATTERN6
+    auto next_thumb = find_next(aboot, PATTERN1[0]);
+    auto next_arm = find_next(aboot, PATTERN3[0]);
+
+    while (next_thumb != end || next_arm != end) {
+        if (next_thumb < next_arm) {
+            if (memcmp(next_thumb, PATTERN1, ABOOT_PATTERN_SIZE) == 0
+                    || memcmp(next_thumb, PATTERN2, ABOOT_PATTERN_SIZE) == 0) {
+                offset_out = static_cast<size_t>(next_thumb - aboot);
+                return true;
+            }
+
+            next_thumb = find_next(next_thumb + 1, PATTERN1[0]);
+        } else {
+            if (memcmp(next_arm, PATTERN3, ABOOT_PATTERN_SIZE) == 0
+                    || memcmp(next_arm, PATTERN4, ABOOT_PATTERN_SIZE) == 0
+                    || memcmp(next_arm, PATTERN5, ABOOT_PATTERN_SIZE) == 0) {
+                offset_out = static_cast<size_t>(next_arm - aboot);
+                return true;
+            } else if (!lg_match
+                    && memcmp(next_arm, PATTERN6, ABOOT_PATTERN_SIZE) == 0) {
+                lg_match = next_arm;
+            }
+
+            next_arm = find_next(next_arm + 1, PATTERN3[0]);
+        }
+    }
+
+    if (lg_match) {
+        offset_out = static_cast<size_t>(lg_match - aboot);
+        return true;
+    }
+
+    return false;
+}
+
 /*!
  * \brief Patch Android boot image with Loki exploit in-place
  *
@@ -308,32 +379,9 @@ oc::result<void> _loki_patch_file(Writer &writer, File &file,
             aboot_ptr + 12)) - 0x28;
 
     // Find the signature checking function via pattern matching
-    for (const unsigned char *ptr = aboot_ptr;
-            ptr < aboot_ptr + aboot_size - ABOOT_SEARCH_LIMIT; ++ptr) {
-        if (memcmp(ptr, PATTERN1, ABOOT_PATTERN_SIZE) == 0
-                || memcmp(ptr, PATTERN2, ABOOT_PATTERN_SIZE) == 0
-                || memcmp(ptr, PATTERN3, ABOOT_PATTERN_SIZE) == 0
-                || memcmp(ptr, PATTERN4, ABOOT_PATTERN_SIZE) == 0
-                || memcmp(ptr, PATTERN5, ABOOT_PATTERN_SIZE) == 0) {
-            target = static_cast<uint32_t>(
-                    static_cast<size_t>(ptr - aboot_ptr) + aboot_base);
-            break;
-        }
-    }
-
-    // Do a second pass for the second LG pattern. This is necessary because
-    // apparently some LG models have both LG patterns, which throws off the
-    // fingerprinting.
-
-    if (target == 0) {
-        for (const unsigned char *ptr = aboot_ptr;
-                ptr < aboot_ptr + aboot_size - ABOOT_SEARCH_LIMIT; ++ptr) {
-            if (memcmp(ptr, PATTERN6, ABOOT_PATTERN_SIZE) == 0) {
-                target = static_cast<uint32_t>(
-                        static_cast<size_t>(ptr - aboot_ptr) + aboot_base);
-                break;
-            }
-        }
+    size_t func_offset;
+    if (_loki_find_aboot_function(aboot_ptr, aboot_size, func_offset)) {
+        target = static_cast<uint32_t>(func_offset + aboot_base);
     }
 
     if (target == 0) {
@@ -158,14 +158,15 @@ oc::result<void> LokiFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_KERNEL, kernel_offset, kernel_size, false
+        ENTRY_TYPE_KERNEL, kernel_offset, kernel_size, false, m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, ramdisk_offset, ramdisk_size, false
+        ENTRY_TYPE_RAMDISK, ramdisk_offset, ramdisk_size, false, m_hdr.page_size
     });
     if (m_hdr.dt_size > 0 && dt_offset != 0) {
         entries.push_back({
-            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false
+            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size,
+            false, m_hdr.page_size
         });
     }
 
@@ -183,12 +184,22 @@ oc::result<void> LokiFormatReader::go_to_entry(File &file, Entry &entry,
     return m_seg->go_to_entry(file, entry, entry_type, m_reader);
 }
 
+oc::result<std::vector<EntryInfo>> LokiFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
 oc::result<size_t> LokiFormatReader::read_data(File &file, void *buf,
                                                size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileConstIoVec> LokiFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file, m_reader);
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
@@ -773,12 +784,17 @@ LokiFormatReader::read_header_new(Reader &reader, File &file,
 /*!
  * \brief Enable support for Loki boot image format
  *
- * \return Nothing if the format is successfully enabled. Otherwise, the error
- *         code.
+ * \return Nothing if the format is successfully enabled.
+ *         ReaderError::FormatDisabled if support for the format was left out
+ *         of the build. Otherwise, the error code.
  */
 oc::result<void> Reader::enable_format_loki()
 {
+#ifdef MBBOOTIMG_DISABLE_LOKI_READER
+    return ReaderError::FormatDisabled;
+#else
     return register_format(std::make_unique<loki::LokiFormatReader>(*this));
+#endif
 }
 
 }
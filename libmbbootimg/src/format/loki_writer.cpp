@@ -53,7 +53,6 @@ constexpr size_t MAX_ABOOT_SIZE = 2 * 1024 * 1024;
 LokiFormatWriter::LokiFormatWriter(Writer &writer)
     : FormatWriter(writer)
     , m_hdr()
-    , m_sha_ctx()
 {
 }
 
@@ -73,12 +72,11 @@ oc::result<void> LokiFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
-        return android::AndroidError::Sha1InitError;
-    }
-
     m_seg = SegmentWriter();
 
+    // The ID is computed while the entries are written
+    OUTCOME_TRYV(m_seg->enable_sha1());
+
     return oc::success();
 }
 
@@ -87,7 +85,6 @@ oc::result<void> LokiFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_aboot.clear();
-        m_sha_ctx = {};
         m_seg = {};
     });
 
@@ -111,10 +108,7 @@ oc::result<void> LokiFormatWriter::close(File &file)
 
             // Set ID
             unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
-                m_writer.set_fatal();
-                return android::AndroidError::Sha1UpdateError;
-            }
+            OUTCOME_TRYV(m_seg->finish_sha1(digest, m_writer));
             memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
 
             // Convert fields back to little-endian
@@ -190,7 +184,7 @@ oc::result<void> LokiFormatWriter::write_header(File &file,
         return android::AndroidError::MissingPageSize;
     }
 
-    if (auto board_name = header.board_name()) {
+    if (auto &board_name = header.board_name()) {
         if (board_name->size() >= sizeof(m_hdr.name)) {
             return android::AndroidError::BoardNameTooLong;
         }
@@ -199,7 +193,7 @@ oc::result<void> LokiFormatWriter::write_header(File &file,
                 sizeof(m_hdr.name) - 1);
         m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
     }
-    if (auto cmdline = header.kernel_cmdline()) {
+    if (auto &cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return android::AndroidError::KernelCmdlineTooLong;
         }
@@ -259,18 +253,9 @@ oc::result<size_t> LokiFormatWriter::write_data(File &file, const void *buf,
 
         return buf_size;
     } else {
-        OUTCOME_TRY(n, m_seg->write_data(file, buf, buf_size, m_writer));
-
-        // We always include the image in the hash. The size is sometimes
-        // included and is handled in finish_entry().
-        if (!SHA1_Update(&m_sha_ctx, buf, n)) {
-            // This must be fatal as the write already happened and cannot be
-            // reattempted
-            m_writer.set_fatal();
-            return android::AndroidError::Sha1UpdateError;
-        }
-
-        return n;
+        // We always include the image in the hash (done by SegmentWriter).
+        // The size is sometimes included and is handled in finish_entry().
+        return m_seg->write_data(file, buf, buf_size, m_writer);
     }
 }
 
@@ -284,18 +269,15 @@ oc::result<void> LokiFormatWriter::finish_entry(File &file)
     uint32_t le32_size = mb_htole32(*swentry->size);
 
     // Include fake 0 size for unsupported secondboot image
-    if (swentry->type == ENTRY_TYPE_DEVICE_TREE
-            && !SHA1_Update(&m_sha_ctx, "\x00\x00\x00\x00", 4)) {
-        m_writer.set_fatal();
-        return android::AndroidError::Sha1UpdateError;
+    if (swentry->type == ENTRY_TYPE_DEVICE_TREE) {
+        OUTCOME_TRYV(m_seg->update_sha1("\x00\x00\x00\x00", 4, m_writer));
     }
 
     // Include size for everything except empty DT images
     if (swentry->type != ENTRY_TYPE_ABOOT
-            && (swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
-        m_writer.set_fatal();
-        return android::AndroidError::Sha1UpdateError;
+            && (swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)) {
+        OUTCOME_TRYV(m_seg->update_sha1(&le32_size, sizeof(le32_size),
+                                        m_writer));
     }
 
     switch (swentry->type) {
@@ -309,25 +309,31 @@ oc::result<void> MtkFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_MTK_KERNEL_HEADER, kernel_offset, sizeof(MtkHeader), false
+        ENTRY_TYPE_MTK_KERNEL_HEADER, kernel_offset, sizeof(MtkHeader),
+        false, m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_KERNEL, *m_mtk_kernel_offset, m_mtk_kernel_hdr.size, false
+        ENTRY_TYPE_KERNEL, *m_mtk_kernel_offset, m_mtk_kernel_hdr.size,
+        false, 0
     });
     entries.push_back({
-        ENTRY_TYPE_MTK_RAMDISK_HEADER, ramdisk_offset, sizeof(MtkHeader), false
+        ENTRY_TYPE_MTK_RAMDISK_HEADER, ramdisk_offset, sizeof(MtkHeader),
+        false, m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, *m_mtk_ramdisk_offset, m_mtk_ramdisk_hdr.size, false
+        ENTRY_TYPE_RAMDISK, *m_mtk_ramdisk_offset, m_mtk_ramdisk_hdr.size,
+        false, 0
     });
     if (m_hdr.second_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false
+            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size,
+            false, m_hdr.page_size
         });
     }
     if (m_hdr.dt_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false
+            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size,
+            false, m_hdr.page_size
         });
     }
 
@@ -345,23 +351,38 @@ oc::result<void> MtkFormatReader::go_to_entry(File &file, Entry &entry,
     return m_seg->go_to_entry(file, entry, entry_type, m_reader);
 }
 
+oc::result<std::vector<EntryInfo>> MtkFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
 oc::result<size_t> MtkFormatReader::read_data(File &file, void *buf,
                                               size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileConstIoVec> MtkFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file, m_reader);
+}
+
 }
 
 /*!
  * \brief Enable support for MTK boot image format
  *
- * \return Nothing if the format is successfully enabled. Otherwise, the error
- *         code.
+ * \return Nothing if the format is successfully enabled.
+ *         ReaderError::FormatDisabled if support for the format was left out
+ *         of the build. Otherwise, the error code.
  */
 oc::result<void> Reader::enable_format_mtk()
 {
+#ifdef MBBOOTIMG_DISABLE_MTK_READER
+    return ReaderError::FormatDisabled;
+#else
     return register_format(std::make_unique<mtk::MtkFormatReader>(*this));
+#endif
 }
 
 }
@@ -22,6 +22,7 @@
 #include <algorithm>
 
 #include <cerrno>
+#include <cstddef>
 #include <cinttypes>
 #include <cstdio>
 #include <cstring>
@@ -73,21 +74,29 @@ _mtk_header_update_size(Writer &writer, File &file,
     return oc::success();
 }
 
+/*!
+ * \brief Add entries to the SHA1 hash by reading them back from the file
+ *
+ * \param writer Writer instance
+ * \param seg Segment writer with SHA1 hashing enabled
+ * \param file File handle
+ * \param first Index of first entry to hash. It must not be a kernel or
+ *              ramdisk entry because those depend on their MTK header's size.
+ */
 static oc::result<void>
-_mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
-                  File &file, unsigned char digest[SHA_DIGEST_LENGTH])
+_mtk_rehash_entries(Writer &writer, SegmentWriter &seg, File &file,
+                    size_t first)
 {
-    SHA_CTX sha_ctx;
     char buf[10240];
 
     uint32_t kernel_mtkhdr_size = 0;
     uint32_t ramdisk_mtkhdr_size = 0;
 
-    if (!SHA1_Init(&sha_ctx)) {
-        return android::AndroidError::Sha1InitError;
-    }
+    auto const &entries = seg.entries();
 
-    for (auto const &entry : seg.entries()) {
+    for (auto it = entries.begin() + static_cast<std::ptrdiff_t>(first);
+            it != entries.end(); ++it) {
+        auto const &entry = *it;
         uint64_t remain = *entry.size;
 
         auto seek_ret = file.seek(static_cast<int64_t>(entry.offset),
@@ -107,9 +116,8 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
                 return ret.as_failure();
             }
 
-            if (!SHA1_Update(&sha_ctx, buf, static_cast<size_t>(to_read))) {
-                return android::AndroidError::Sha1UpdateError;
-            }
+            OUTCOME_TRYV(seg.update_sha1(buf, static_cast<size_t>(to_read),
+                                         writer));
 
             remain -= to_read;
         }
@@ -143,13 +151,7 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
             continue;
         }
 
-        if (!SHA1_Update(&sha_ctx, &le32_size, sizeof(le32_size))) {
-            return android::AndroidError::Sha1UpdateError;
-        }
-    }
-
-    if (!SHA1_Final(digest, &sha_ctx)) {
-        return android::AndroidError::Sha1UpdateError;
+        OUTCOME_TRYV(seg.update_sha1(&le32_size, sizeof(le32_size), writer));
     }
 
     return oc::success();
@@ -158,6 +160,7 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
 MtkFormatWriter::MtkFormatWriter(Writer &writer)
     : FormatWriter(writer)
     , m_hdr()
+    , m_mtk_hdr()
 {
 }
 
@@ -179,6 +182,10 @@ oc::result<void> MtkFormatWriter::open(File &file)
 
     m_seg = SegmentWriter();
 
+    // The ID is computed while the entries are written if possible. See
+    // hash_mtk_header().
+    OUTCOME_TRYV(m_seg->enable_sha1());
+
     return oc::success();
 }
 
@@ -186,6 +193,7 @@ oc::result<void> MtkFormatWriter::close(File &file)
 {
     auto reset_state = finally([&] {
         m_hdr = {};
+        m_mtk_hdr.clear();
         m_seg = {};
     });
 
@@ -222,13 +230,18 @@ oc::result<void> MtkFormatWriter::close(File &file)
                 }
             }
 
-            // We need to take the performance hit and compute the SHA1 here.
-            // We can't fill in the sizes in the MTK headers when we're writing
-            // them. Thus, if we calculated the SHA1sum during write, it would
-            // be incorrect.
-            OUTCOME_TRYV(_mtk_compute_sha1(
-                    m_writer, *m_seg, file,
-                    reinterpret_cast<unsigned char *>(m_hdr.id)));
+            // If the kernel or ramdisk size was not known when its MTK header
+            // was written, hashing stopped there. Now that the MTK headers
+            // contain the correct sizes, read back and hash the remainder.
+            if (auto first = m_seg->sha1_deferred_entry()) {
+                m_seg->resume_sha1();
+                OUTCOME_TRYV(_mtk_rehash_entries(
+                        m_writer, *m_seg, file, *first));
+            }
+
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            OUTCOME_TRYV(m_seg->finish_sha1(digest, m_writer));
+            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -298,7 +311,7 @@ oc::result<void> MtkFormatWriter::write_header(File &file, const Header &header)
         return android::AndroidError::MissingPageSize;
     }
 
-    if (auto board_name = header.board_name()) {
+    if (auto &board_name = header.board_name()) {
         if (board_name->size() >= sizeof(m_hdr.name)) {
             return android::AndroidError::BoardNameTooLong;
         }
@@ -307,7 +320,7 @@ oc::result<void> MtkFormatWriter::write_header(File &file, const Header &header)
                 sizeof(m_hdr.name) - 1);
         m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
     }
-    if (auto cmdline = header.kernel_cmdline()) {
+    if (auto &cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return android::AndroidError::KernelCmdlineTooLong;
         }
@@ -348,15 +361,63 @@ oc::result<void> MtkFormatWriter::get_entry(File &file, Entry &entry)
 
 oc::result<void> MtkFormatWriter::write_entry(File &file, const Entry &entry)
 {
-    return m_seg->write_entry(file, entry, m_writer);
+    OUTCOME_TRYV(m_seg->write_entry(file, entry, m_writer));
+
+    auto swentry = m_seg->entry();
+
+    switch (swentry->type) {
+    case ENTRY_TYPE_MTK_KERNEL_HEADER:
+    case ENTRY_TYPE_MTK_RAMDISK_HEADER:
+        m_seg->exclude_entry_from_sha1();
+        m_mtk_hdr.clear();
+        break;
+    case ENTRY_TYPE_KERNEL:
+    case ENTRY_TYPE_RAMDISK:
+        OUTCOME_TRYV(hash_mtk_header(swentry->size));
+        break;
+    }
+
+    return oc::success();
 }
 
 oc::result<size_t> MtkFormatWriter::write_data(File &file, const void *buf,
                                                size_t buf_size)
 {
+    auto swentry = m_seg->entry();
+
+    if (swentry->type == ENTRY_TYPE_MTK_KERNEL_HEADER
+            || swentry->type == ENTRY_TYPE_MTK_RAMDISK_HEADER) {
+        // Anything beyond sizeof(MtkHeader) is rejected in finish_entry()
+        auto to_copy = std::min(buf_size, sizeof(MtkHeader) - m_mtk_hdr.size());
+        auto ptr = static_cast<const unsigned char *>(buf);
+        m_mtk_hdr.insert(m_mtk_hdr.end(), ptr, ptr + to_copy);
+    }
+
     return m_seg->write_data(file, buf, buf_size, m_writer);
 }
 
+oc::result<void> MtkFormatWriter::hash_mtk_header(std::optional<uint32_t> size)
+{
+    if (!m_seg->is_sha1_enabled()) {
+        return oc::success();
+    } else if (!size || m_mtk_hdr.size() != sizeof(MtkHeader)) {
+        // The size will only be known after the data is written, so the MTK
+        // header (the previous entry) and everything after it must be hashed
+        // after the fact by reading back the file
+        auto index = static_cast<size_t>(
+                m_seg->entry() - m_seg->entries().begin());
+        m_seg->defer_sha1(index - 1);
+        return oc::success();
+    }
+
+    // Hash the header as it will look after close() updates the size
+    uint32_t le32_size = mb_htole32(*size);
+    memcpy(m_mtk_hdr.data() + offsetof(MtkHeader, size), &le32_size,
+           sizeof(le32_size));
+
+    return m_seg->update_sha1(m_mtk_hdr.data(), m_mtk_hdr.size(), m_writer);
+}
+
 oc::result<void> MtkFormatWriter::finish_entry(File &file)
 {
     OUTCOME_TRYV(m_seg->finish_entry(file, m_writer));
@@ -392,7 +453,31 @@ oc::result<void> MtkFormatWriter::finish_entry(File &file)
         break;
     }
 
-    return oc::success();
+    // Update SHA1 hash. The MTK headers are included in the kernel and ramdisk
+    // sizes.
+    uint32_t le32_size;
+
+    switch (swentry->type) {
+    case ENTRY_TYPE_KERNEL:
+        le32_size = mb_htole32(m_hdr.kernel_size);
+        break;
+    case ENTRY_TYPE_RAMDISK:
+        le32_size = mb_htole32(m_hdr.ramdisk_size);
+        break;
+    case ENTRY_TYPE_SECONDBOOT:
+        le32_size = mb_htole32(m_hdr.second_size);
+        break;
+    case ENTRY_TYPE_DEVICE_TREE:
+        if (m_hdr.dt_size == 0) {
+            return oc::success();
+        }
+        le32_size = mb_htole32(m_hdr.dt_size);
+        break;
+    default:
+        return oc::success();
+    }
+
+    return m_seg->update_sha1(&le32_size, sizeof(le32_size), m_writer);
 }
 
 }
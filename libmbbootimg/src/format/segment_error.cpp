@@ -60,6 +60,10 @@ std::string SegmentErrorCategory::message(int ev) const
         return "write would overflow integer";
     case SegmentError::InvalidEntrySize:
         return "invalid entry size";
+    case SegmentError::Sha1InitError:
+        return "SHA1 hash initialization error";
+    case SegmentError::Sha1UpdateError:
+        return "failed to update SHA1 hash";
     default:
         return "(unknown segment reader/writer error)";
     }
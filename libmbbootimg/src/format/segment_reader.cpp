@@ -50,6 +50,18 @@ const std::vector<SegmentReaderEntry> & SegmentReader::entries() const
     return m_entries;
 }
 
+std::vector<EntryInfo> SegmentReader::entry_infos() const
+{
+    std::vector<EntryInfo> infos;
+    infos.reserve(m_entries.size());
+
+    for (auto const &sre : m_entries) {
+        infos.push_back({sre.type, sre.offset, sre.size, sre.align});
+    }
+
+    return infos;
+}
+
 oc::result<void> SegmentReader::set_entries(std::vector<SegmentReaderEntry> entries)
 {
     if (m_state != SegmentReaderState::Begin) {
@@ -174,4 +186,38 @@ oc::result<size_t> SegmentReader::read_data(File &file, void *buf,
     return n.value();
 }
 
+oc::result<FileConstIoVec> SegmentReader::read_data_view(File &file,
+                                                         Reader &reader)
+{
+    uint64_t remaining = m_read_end_offset - m_read_cur_offset;
+
+    if (remaining > SIZE_MAX) {
+        return SegmentError::ReadWouldOverflowInteger;
+    }
+
+    auto view = file.view(m_read_cur_offset, static_cast<size_t>(remaining));
+    if (!view) {
+        if (file.is_fatal()) { reader.set_fatal(); }
+        return view.as_failure();
+    }
+
+    m_read_cur_offset += view.value().size;
+
+    // Fail if we reach EOF early
+    if (m_read_cur_offset != m_read_end_offset && !m_entry->can_truncate) {
+        reader.set_fatal();
+        return FileError::UnexpectedEof;
+    }
+
+    // Keep the file position in sync for move_to_entry() and read_data()
+    auto seek_ret = file.seek(static_cast<int64_t>(m_read_cur_offset),
+                              SEEK_SET);
+    if (!seek_ret) {
+        if (file.is_fatal()) { reader.set_fatal(); }
+        return seek_ret.as_failure();
+    }
+
+    return view;
+}
+
 }
@@ -42,6 +42,10 @@ SegmentWriter::SegmentWriter()
     , m_entry()
     , m_entry_size()
     , m_pos()
+    , m_sha_ctx()
+    , m_sha_exclude_entry(false)
+    , m_sha_deferred_ctx()
+    , m_sha_deferred_entry()
 {
 }
 
@@ -112,6 +116,7 @@ oc::result<void> SegmentWriter::get_entry(File &file, Entry &entry,
     m_entry_size = 0;
     m_state = SegmentWriterState::Entries;
     m_entry = swentry;
+    m_sha_exclude_entry = false;
 
     return oc::success();
 }
@@ -156,6 +161,10 @@ oc::result<size_t> SegmentWriter::write_data(File &file, const void *buf,
     m_entry_size += static_cast<uint32_t>(buf_size);
     *m_pos += buf_size;
 
+    if (!m_sha_exclude_entry) {
+        OUTCOME_TRYV(update_sha1(buf, buf_size, writer));
+    }
+
     return buf_size;
 }
 
@@ -180,4 +189,87 @@ oc::result<void> SegmentWriter::finish_entry(File &file, Writer &writer)
     return oc::success();
 }
 
+oc::result<void> SegmentWriter::enable_sha1()
+{
+    m_sha_ctx.emplace();
+
+    if (!SHA1_Init(&*m_sha_ctx)) {
+        m_sha_ctx.reset();
+        return SegmentError::Sha1InitError;
+    }
+
+    return oc::success();
+}
+
+void SegmentWriter::disable_sha1()
+{
+    m_sha_ctx.reset();
+}
+
+bool SegmentWriter::is_sha1_enabled() const
+{
+    return m_sha_ctx.has_value();
+}
+
+void SegmentWriter::exclude_entry_from_sha1()
+{
+    m_sha_exclude_entry = true;
+}
+
+oc::result<void> SegmentWriter::update_sha1(const void *data, size_t size,
+                                            Writer &writer)
+{
+    if (m_sha_ctx && !SHA1_Update(&*m_sha_ctx, data, size)) {
+        writer.set_fatal();
+        return SegmentError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+oc::result<void>
+SegmentWriter::finish_sha1(unsigned char digest[SHA_DIGEST_LENGTH],
+                           Writer &writer)
+{
+    if (!m_sha_ctx) {
+        return SegmentError::Sha1UpdateError;
+    }
+
+    auto ret = SHA1_Final(digest, &*m_sha_ctx);
+    m_sha_ctx.reset();
+
+    if (!ret) {
+        writer.set_fatal();
+        return SegmentError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+
+void SegmentWriter::defer_sha1(size_t entry_index)
+{
+    if (!m_sha_ctx) {
+        return;
+    }
+
+    m_sha_deferred_ctx = std::move(m_sha_ctx);
+    m_sha_deferred_entry = entry_index;
+    m_sha_ctx.reset();
+}
+
+std::optional<size_t> SegmentWriter::sha1_deferred_entry() const
+{
+    return m_sha_deferred_entry;
+}
+
+void SegmentWriter::resume_sha1()
+{
+    if (m_sha_deferred_ctx) {
+        m_sha_ctx = std::move(m_sha_deferred_ctx);
+        m_sha_deferred_ctx.reset();
+        m_sha_deferred_entry.reset();
+    }
+}
+
 }
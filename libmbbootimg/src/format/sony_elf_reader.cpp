@@ -177,35 +177,40 @@ oc::result<void> SonyElfFormatReader::read_header(File &file, Header &header)
         } else if (phdr.p_type == SONY_E_TYPE_KERNEL
                 && phdr.p_flags == SONY_E_FLAGS_KERNEL) {
             entries.push_back({
-                ENTRY_TYPE_KERNEL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_KERNEL, phdr.p_offset, phdr.p_memsz,
+                false, phdr.p_align
             });
 
             header.set_kernel_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_RAMDISK
                 && phdr.p_flags == SONY_E_FLAGS_RAMDISK) {
             entries.push_back({
-                ENTRY_TYPE_RAMDISK, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_RAMDISK, phdr.p_offset, phdr.p_memsz,
+                false, phdr.p_align
             });
 
             header.set_ramdisk_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_IPL
                 && phdr.p_flags == SONY_E_FLAGS_IPL) {
             entries.push_back({
-                ENTRY_TYPE_SONY_IPL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_IPL, phdr.p_offset, phdr.p_memsz,
+                false, phdr.p_align
             });
 
             header.set_sony_ipl_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_RPM
                 && phdr.p_flags == SONY_E_FLAGS_RPM) {
             entries.push_back({
-                ENTRY_TYPE_SONY_RPM, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_RPM, phdr.p_offset, phdr.p_memsz,
+                false, phdr.p_align
             });
 
             header.set_sony_rpm_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_APPSBL
                 && phdr.p_flags == SONY_E_FLAGS_APPSBL) {
             entries.push_back({
-                ENTRY_TYPE_SONY_APPSBL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_APPSBL, phdr.p_offset, phdr.p_memsz,
+                false, phdr.p_align
             });
 
             header.set_sony_appsbl_address(phdr.p_vaddr);
@@ -236,12 +241,22 @@ oc::result<void> SonyElfFormatReader::go_to_entry(File &file, Entry &entry,
     return m_seg->go_to_entry(file, entry, entry_type, m_reader);
 }
 
+oc::result<std::vector<EntryInfo>> SonyElfFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
 oc::result<size_t> SonyElfFormatReader::read_data(File &file, void *buf,
                                                   size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileConstIoVec> SonyElfFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file, m_reader);
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
@@ -299,13 +314,18 @@ SonyElfFormatReader::find_sony_elf_header(Reader &reader, File &file,
 /*!
  * \brief Enable support for Sony ELF boot image format
  *
- * \return Nothing if the format is successfully enabled. Otherwise, the error
- *         code.
+ * \return Nothing if the format is successfully enabled.
+ *         ReaderError::FormatDisabled if support for the format was left out
+ *         of the build. Otherwise, the error code.
  */
 oc::result<void> Reader::enable_format_sony_elf()
 {
+#ifdef MBBOOTIMG_DISABLE_SONY_ELF_READER
+    return ReaderError::FormatDisabled;
+#else
     return register_format(
             std::make_unique<sonyelf::SonyElfFormatReader>(*this));
+#endif
 }
 
 }
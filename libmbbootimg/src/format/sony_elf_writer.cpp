@@ -213,7 +213,7 @@ oc::result<void> SonyElfFormatWriter::write_header(File &file,
     m_hdr_cmdline.p_flags = SONY_E_FLAGS_CMDLINE;
     m_hdr_cmdline.p_align = 0;
 
-    if (auto cmdline = header.kernel_cmdline()) {
+    if (auto &cmdline = header.kernel_cmdline()) {
         m_cmdline = *cmdline;
     }
 
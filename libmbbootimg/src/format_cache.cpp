@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbbootimg/format_cache_p.h"
+
+#include <algorithm>
+#include <random>
+#include <system_error>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+#include "mbbootimg/probe_file_p.h"
+
+namespace mb::bootimg::detail
+{
+
+FormatCache::FormatCache(std::string path)
+    : m_path(std::move(path))
+    , m_loaded(false)
+    , m_entries()
+{
+}
+
+/*!
+ * \brief Compute fingerprint of a probed file
+ *
+ * \return Fingerprint string or nothing if the file size is unknown
+ */
+std::optional<std::string> FormatCache::fingerprint(const ProbeFile &file)
+{
+    auto size = file.size();
+    if (!size) {
+        return std::nullopt;
+    }
+
+    SHA_CTX sha_ctx;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+
+    if (!SHA1_Init(&sha_ctx)
+            || !SHA1_Update(&sha_ctx, file.head().data(), file.head().size())
+            || !SHA1_Update(&sha_ctx, file.tail().data(), file.tail().size())
+            || !SHA1_Final(digest, &sha_ctx)) {
+        return std::nullopt;
+    }
+
+    std::string result = format("%" PRIu64 "-", *size);
+
+    for (auto c : digest) {
+        result += format("%02x", c);
+    }
+
+    return result;
+}
+
+std::optional<std::string> FormatCache::lookup(const std::string &fingerprint)
+{
+    load();
+
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&](auto const &e) { return e.first == fingerprint; });
+    if (it == m_entries.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+oc::result<void> FormatCache::store(const std::string &fingerprint,
+                                    const std::string &format_name)
+{
+    load();
+
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                                   [&](auto const &e) {
+        return e.first == fingerprint;
+    }), m_entries.end());
+
+    m_entries.emplace_back(fingerprint, format_name);
+
+    if (m_entries.size() > MAX_ENTRIES) {
+        m_entries.erase(m_entries.begin(),
+                        m_entries.end() - MAX_ENTRIES);
+    }
+
+    return save();
+}
+
+// A missing or unreadable cache is treated as empty
+void FormatCache::load()
+{
+    if (m_loaded) {
+        return;
+    }
+
+    m_loaded = true;
+    m_entries.clear();
+
+    StandardFile file;
+    if (!file.open(m_path, FileOpenMode::ReadOnly)) {
+        return;
+    }
+
+    std::string data;
+    char buf[4096];
+
+    while (true) {
+        auto n = file_read_retry(file, buf, sizeof(buf));
+        if (!n) {
+            return;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        data.append(buf, n.value());
+    }
+
+    for (auto const &line : split(data, '\n')) {
+        auto pos = line.find(' ');
+
+        // Skip malformed lines (eg. from a partially written cache)
+        if (pos == std::string::npos || pos == 0 || pos + 1 == line.size()) {
+            continue;
+        }
+
+        m_entries.emplace_back(line.substr(0, pos), line.substr(pos + 1));
+    }
+
+    if (m_entries.size() > MAX_ENTRIES) {
+        m_entries.erase(m_entries.begin(),
+                        m_entries.end() - MAX_ENTRIES);
+    }
+}
+
+oc::result<void> FormatCache::save()
+{
+    std::string data;
+
+    for (auto const &[fingerprint, format_name] : m_entries) {
+        data += fingerprint;
+        data += ' ';
+        data += format_name;
+        data += '\n';
+    }
+
+    // Write to a temporary file first so that readers never see a partially
+    // written cache. The name is unique so that concurrent writers (eg. batch
+    // jobs) cannot interleave their writes to the same temporary file.
+    std::random_device rd;
+    std::string temp_path = format("%s.%08x%08x.tmp", m_path.c_str(),
+                                   rd(), rd());
+
+    {
+        StandardFile file;
+        OUTCOME_TRYV(file.open(temp_path, FileOpenMode::WriteOnly));
+        OUTCOME_TRYV(file_write_exact(file, data.data(), data.size()));
+        OUTCOME_TRYV(file.close());
+    }
+
+    if (std::rename(temp_path.c_str(), m_path.c_str()) != 0) {
+        auto ec = std::error_code(errno, std::generic_category());
+        (void) std::remove(temp_path.c_str());
+        return ec;
+    }
+
+    return oc::success();
+}
+
+}
@@ -119,7 +119,7 @@ void Header::set_supported_fields(HeaderFields fields)
 
 // Fields
 
-std::optional<std::string> Header::board_name() const
+const std::optional<std::string> & Header::board_name() const
 {
     return m_board_name;
 }
@@ -131,7 +131,7 @@ bool Header::set_board_name(std::optional<std::string> name)
     return true;
 }
 
-std::optional<std::string> Header::kernel_cmdline() const
+const std::optional<std::string> & Header::kernel_cmdline() const
 {
     return m_cmdline;
 }
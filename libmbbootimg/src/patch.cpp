@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbbootimg/patch.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/format/android_error.h"
+#include "mbbootimg/format/android_p.h"
+#include "mbbootimg/format/android_reader_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+
+namespace mb::bootimg
+{
+
+using namespace android;
+
+/*!
+ * \brief Rewrite the header of a boot image in place
+ *
+ * This updates the board name, kernel cmdline, and load addresses of an
+ * existing boot image without rewriting any of the payloads. Only the header
+ * bytes are written, so this can be used directly on a block device.
+ *
+ * Only Android, bump'd, and MTK boot images are supported. Their SHA1 ID only
+ * covers the payloads and their sizes, so it remains valid and is preserved.
+ * Loki'd and Sony ELF images embed header values elsewhere in the image and
+ * must be rewritten with Writer instead.
+ *
+ * Fields that are unset in \p header are left unchanged.
+ *
+ * \param file File opened for reading and writing
+ * \param header New header values
+ *
+ * \return
+ *   * Nothing if the header is successfully rewritten
+ *   * ReaderError::UnsupportedHeaderPatch if the boot image format is not
+ *     supported
+ *   * AndroidError::PageSizeMismatch if \p header specifies a different page
+ *     size than the existing image
+ *   * AndroidError::BoardNameTooLong or AndroidError::KernelCmdlineTooLong if
+ *     the new values do not fit in the header
+ *   * A specific error code if any file operation fails
+ */
+oc::result<void> patch_header(File &file, const Header &header)
+{
+    Reader reader;
+
+    // Bid with every format so that eg. Loki'd images are not mistaken for
+    // plain Android images
+    OUTCOME_TRYV(reader.enable_format_all());
+    OUTCOME_TRYV(reader.open(&file));
+
+    switch (reader.format_code()) {
+    case FORMAT_ANDROID:
+    case FORMAT_BUMP:
+    case FORMAT_MTK:
+        break;
+    default:
+        return ReaderError::UnsupportedHeaderPatch;
+    }
+
+    OUTCOME_TRYV(reader.close());
+
+    AndroidHeader hdr;
+    uint64_t offset;
+
+    OUTCOME_TRYV(AndroidFormatReader::find_header(
+            reader, file, MAX_HEADER_OFFSET, hdr, offset));
+
+    // Validate everything before modifying the file
+    if (auto page_size = header.page_size();
+            page_size && *page_size != hdr.page_size) {
+        return AndroidError::PageSizeMismatch;
+    }
+
+    auto &board_name = header.board_name();
+    if (board_name && board_name->size() >= sizeof(hdr.name)) {
+        return AndroidError::BoardNameTooLong;
+    }
+
+    auto &cmdline = header.kernel_cmdline();
+    if (cmdline && cmdline->size() >= sizeof(hdr.cmdline)) {
+        return AndroidError::KernelCmdlineTooLong;
+    }
+
+    if (auto address = header.kernel_address()) {
+        hdr.kernel_addr = *address;
+    }
+    if (auto address = header.ramdisk_address()) {
+        hdr.ramdisk_addr = *address;
+    }
+    if (auto address = header.secondboot_address()) {
+        hdr.second_addr = *address;
+    }
+    if (auto address = header.kernel_tags_address()) {
+        hdr.tags_addr = *address;
+    }
+    if (board_name) {
+        memset(hdr.name, 0, sizeof(hdr.name));
+        memcpy(hdr.name, board_name->data(), board_name->size());
+    }
+    if (cmdline) {
+        memset(hdr.cmdline, 0, sizeof(hdr.cmdline));
+        memcpy(hdr.cmdline, cmdline->data(), cmdline->size());
+    }
+
+    android_fix_header_byte_order(hdr);
+
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+    OUTCOME_TRYV(file_write_exact(file, &hdr, sizeof(hdr)));
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_file_p.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+namespace mb::bootimg::detail
+{
+
+ProbeFile::ProbeFile()
+    : File()
+{
+    clear();
+}
+
+ProbeFile::~ProbeFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open probe view of a file
+ *
+ * The head and tail regions of \p file are read during this call. The file
+ * position of \p file is undefined afterwards.
+ *
+ * \param file File to open. Must already be opened.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ProbeFile::open(File *file)
+{
+    if (state() == mb::detail::FileState::New) {
+        m_file = file;
+    }
+
+    return File::open();
+}
+
+const std::vector<unsigned char> & ProbeFile::head() const
+{
+    return m_head;
+}
+
+const std::vector<unsigned char> & ProbeFile::tail() const
+{
+    return m_tail;
+}
+
+std::optional<uint64_t> ProbeFile::size() const
+{
+    return m_size;
+}
+
+oc::result<void> ProbeFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(fill(m_head, 0, HEAD_SIZE));
+
+    if (m_head.size() < HEAD_SIZE) {
+        // Whole file is cached
+        m_size = m_head.size();
+        return oc::success();
+    }
+
+    // The file size is only needed for the tail. If the file is not
+    // seekable from the end, end-relative seeks are forwarded instead.
+    auto size = m_file->seek(0, SEEK_END);
+    if (!size) {
+        if (m_file->is_fatal()) {
+            return size.as_failure();
+        }
+        m_file_pos = {};
+        return oc::success();
+    }
+
+    m_size = size.value();
+    m_file_pos = size.value();
+
+    if (*m_size > HEAD_SIZE) {
+        m_tail_offset = std::max<uint64_t>(HEAD_SIZE, *m_size - TAIL_SIZE);
+        OUTCOME_TRYV(fill(m_tail, m_tail_offset,
+                          static_cast<size_t>(*m_size - m_tail_offset)));
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ProbeFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> ProbeFile::on_read(void *buf, size_t size)
+{
+    if (m_size && m_pos >= *m_size) {
+        return 0;
+    }
+
+    const std::vector<unsigned char> *cache = nullptr;
+    uint64_t cache_offset = 0;
+
+    if (m_pos < m_head.size()) {
+        cache = &m_head;
+    } else if (!m_tail.empty() && m_pos >= m_tail_offset
+            && m_pos - m_tail_offset < m_tail.size()) {
+        cache = &m_tail;
+        cache_offset = m_tail_offset;
+    }
+
+    if (cache) {
+        auto start = static_cast<size_t>(m_pos - cache_offset);
+        size_t n = std::min(size, cache->size() - start);
+
+        memcpy(buf, cache->data() + start, n);
+        m_pos += n;
+
+        return n;
+    }
+
+    // Don't read past the start of the tail
+    if (!m_tail.empty() && m_pos < m_tail_offset) {
+        size = static_cast<size_t>(
+                std::min<uint64_t>(size, m_tail_offset - m_pos));
+    }
+
+    if (m_file_pos != m_pos) {
+        auto seek_ret = m_file->seek(static_cast<int64_t>(m_pos), SEEK_SET);
+        if (!seek_ret) {
+            if (m_file->is_fatal()) { set_fatal(); }
+            m_file_pos = {};
+            return seek_ret.as_failure();
+        }
+        m_file_pos = m_pos;
+    }
+
+    auto n = m_file->read(buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        m_file_pos = {};
+        return n.as_failure();
+    }
+
+    m_pos += n.value();
+    m_file_pos = m_pos;
+
+    return n.value();
+}
+
+oc::result<uint64_t> ProbeFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        if (!m_size) {
+            auto new_pos = m_file->seek(offset, SEEK_END);
+            if (!new_pos) {
+                if (m_file->is_fatal()) { set_fatal(); }
+                m_file_pos = {};
+                return new_pos.as_failure();
+            }
+            m_pos = new_pos.value();
+            m_file_pos = m_pos;
+            return m_pos;
+        }
+        base = *m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::IntegerOverflow;
+        }
+        m_pos = base + static_cast<uint64_t>(offset);
+    }
+
+    return m_pos;
+}
+
+void ProbeFile::clear()
+{
+    m_file = nullptr;
+    m_head.clear();
+    m_head.shrink_to_fit();
+    m_tail.clear();
+    m_tail.shrink_to_fit();
+    m_tail_offset = 0;
+    m_size = {};
+    m_pos = 0;
+    m_file_pos = {};
+}
+
+/*!
+ * \brief Read up to \p size bytes at \p offset of the underlying file into
+ *        \p buf
+ */
+oc::result<void> ProbeFile::fill(std::vector<unsigned char> &buf,
+                                 uint64_t offset, size_t size)
+{
+    buf.resize(size);
+
+    auto seek_ret = m_file->seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        buf.clear();
+        return seek_ret.as_failure();
+    }
+
+    auto n = file_read_retry(*m_file, buf.data(), buf.size());
+    if (!n) {
+        buf.clear();
+        m_file_pos = {};
+        return n.as_failure();
+    }
+
+    buf.resize(n.value());
+    m_file_pos = offset + n.value();
+
+    return oc::success();
+}
+
+}
@@ -26,12 +26,17 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <optional>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file/tracing.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/format_cache_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_file_p.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -159,6 +164,19 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::entries
+ *
+ * \brief Format reader callback to list the entries in the boot image
+ *
+ * \return
+ *   * Return the list of entries in the order they would be returned by
+ *     FormatReader::read_entry()
+ *   * Return ReaderError::UnsupportedEntryIndex if the format cannot list its
+ *     entries without reading them sequentially
+ *   * Return a specific error code if an error occurs
+ */
+
 /*!
  * \fn FormatReader::read_data
  *
@@ -175,6 +193,21 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::read_data_view
+ *
+ * \brief Format reader callback to get a view of the remaining entry data
+ *
+ * \param[in] file Reference to file handle
+ *
+ * \return
+ *   * Return a pointer to and size of the unread entry data in \p file's
+ *     backing storage and mark that data as read
+ *   * Return FileError::UnsupportedView if \p file or the format cannot
+ *     provide a view, in which case no data has been consumed
+ *   * Return a specific error code if an error occurs
+ */
+
 ///
 
 namespace mb::bootimg
@@ -240,6 +273,17 @@ oc::result<void> FormatReader::go_to_entry(File &file, Entry &entry,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<std::vector<EntryInfo>> FormatReader::entries()
+{
+    return ReaderError::UnsupportedEntryIndex;
+}
+
+oc::result<FileConstIoVec> FormatReader::read_data_view(File &file)
+{
+    (void) file;
+    return FileError::UnsupportedView;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -247,8 +291,10 @@ Reader::Reader()
     : m_state(ReaderState::New)
     , m_owned_file()
     , m_file()
+    , m_trace_file()
     , m_format()
     , m_format_user_set(false)
+    , m_format_cache()
 {
 }
 
@@ -268,9 +314,11 @@ Reader::Reader(Reader &&other) noexcept
     : m_state(other.m_state)
     , m_owned_file(std::move(other.m_owned_file))
     , m_file(other.m_file)
+    , m_trace_file(std::move(other.m_trace_file))
     , m_formats(std::move(other.m_formats))
     , m_format(other.m_format)
     , m_format_user_set(other.m_format_user_set)
+    , m_format_cache(std::move(other.m_format_cache))
 {
     other.m_state = ReaderState::Moved;
 }
@@ -282,9 +330,11 @@ Reader & Reader::operator=(Reader &&rhs) noexcept
     m_state = rhs.m_state;
     m_owned_file.swap(rhs.m_owned_file);
     m_file = rhs.m_file;
+    m_trace_file.swap(rhs.m_trace_file);
     m_formats.swap(rhs.m_formats);
     m_format = rhs.m_format;
     m_format_user_set = rhs.m_format_user_set;
+    m_format_cache.swap(rhs.m_format_cache);
 
     rhs.m_state = ReaderState::Moved;
 
@@ -368,43 +418,85 @@ oc::result<void> Reader::open(File *file)
         return ReaderError::NoFormatsRegistered;
     }
 
+    // Collect I/O statistics if requested
+    std::unique_ptr<TracingFile> trace_file;
+    if (file_trace_path()) {
+        trace_file = std::make_unique<TracingFile>(file);
+        if (trace_file->is_open()) {
+            file = trace_file.get();
+        } else {
+            trace_file.reset();
+        }
+    }
+
     int best_bid = 0;
     FormatReader *format = nullptr;
 
+    // Bidders share one read of the head and tail of the file
+    ProbeFile probe_file;
+
     auto close_format = finally([&] {
         if (format) {
-            (void) format->close(*file);
+            (void) format->close(probe_file);
         }
     });
 
     // Perform bid if a format wasn't explicitly chosen
     if (!m_format) {
-        for (auto &f : m_formats) {
-            // Seek to beginning
-            auto seek_ret = file->seek(0, SEEK_SET);
-            if (!seek_ret) {
-                if (file->is_fatal()) { set_fatal(); }
-                return seek_ret.as_failure();
-            }
+        auto probe_ret = probe_file.open(file);
+        if (!probe_ret) {
+            if (file->is_fatal()) { set_fatal(); }
+            return probe_ret.as_failure();
+        }
+
+        std::optional<std::string> fingerprint;
+        std::optional<std::string> cached_name;
 
-            auto close_f = finally([&] {
-                (void) f->close(*file);
-            });
+        if (m_format_cache) {
+            fingerprint = FormatCache::fingerprint(probe_file);
+            if (fingerprint) {
+                cached_name = m_format_cache->lookup(*fingerprint);
+            }
+        }
 
-            // Call bidder
-            OUTCOME_TRY(bid, f->open(*file, best_bid));
+        // If the cache knows the format, only that format needs to bid. If it
+        // no longer accepts the file, fall back to asking every format.
+        for (bool cached_only = !!cached_name; !format; cached_only = false) {
+            for (auto &f : m_formats) {
+                if (cached_only && f->name() != *cached_name) {
+                    continue;
+                }
 
-            if (bid > best_bid) {
-                // Close previous best format
-                if (format) {
-                    (void) format->close(*file);
+                // Seek to beginning
+                auto seek_ret = probe_file.seek(0, SEEK_SET);
+                if (!seek_ret) {
+                    if (file->is_fatal()) { set_fatal(); }
+                    return seek_ret.as_failure();
                 }
 
-                // Don't close this format
-                close_f.dismiss();
+                auto close_f = finally([&] {
+                    (void) f->close(probe_file);
+                });
+
+                // Call bidder
+                OUTCOME_TRY(bid, f->open(probe_file, best_bid));
+
+                if (bid > best_bid) {
+                    // Close previous best format
+                    if (format) {
+                        (void) format->close(probe_file);
+                    }
 
-                best_bid = bid;
-                format = f.get();
+                    // Don't close this format
+                    close_f.dismiss();
+
+                    best_bid = bid;
+                    format = f.get();
+                }
+            }
+
+            if (!cached_only) {
+                break;
             }
         }
 
@@ -412,6 +504,11 @@ oc::result<void> Reader::open(File *file)
             return ReaderError::UnknownFileFormat;
         }
 
+        if (fingerprint && (!cached_name || format->name() != *cached_name)) {
+            // Failing to persist the cache is not an error
+            (void) m_format_cache->store(*fingerprint, format->name());
+        }
+
         // We've found a matching format, so don't close it
         close_format.dismiss();
 
@@ -420,6 +517,7 @@ oc::result<void> Reader::open(File *file)
 
     m_state = ReaderState::Header;
     m_file = file;
+    m_trace_file = std::move(trace_file);
 
     return oc::success();
 }
@@ -440,6 +538,7 @@ oc::result<void> Reader::close()
     auto reset_state = finally([&] {
         m_state = ReaderState::New;
 
+        m_trace_file.reset();
         m_owned_file.reset();
         m_file = nullptr;
 
@@ -454,6 +553,15 @@ oc::result<void> Reader::close()
     if (m_state != ReaderState::New) {
         ret = m_format->close(*m_file);
 
+        if (m_trace_file) {
+            (void) m_trace_file->close();
+
+            if (auto path = file_trace_path()) {
+                (void) file_trace_write(path, "reader:" + m_format->name(),
+                                        *m_trace_file);
+            }
+        }
+
         if (m_owned_file) {
             auto close_ret = m_owned_file->close();
             if (ret && !close_ret) {
@@ -546,6 +654,29 @@ oc::result<void> Reader::go_to_entry(Entry &entry, int entry_type)
     return oc::success();
 }
 
+/*!
+ * \brief Get index of boot image entries.
+ *
+ * List the type, offset, size, and alignment of every entry in the boot image
+ * without reading any entry data. Combined with Reader::go_to_entry(), this
+ * allows a single entry to be extracted without streaming through the entries
+ * that precede it.
+ *
+ * \note This function can only be called after Reader::read_header() has
+ *       succeeded. It does not change the reader state.
+ *
+ * \return List of entries in the order they appear in the boot image. If the
+ *         format does not support listing entries, this function returns
+ *         ReaderError::UnsupportedEntryIndex. If any other error occurs, a
+ *         specific error code will be returned.
+ */
+oc::result<std::vector<EntryInfo>> Reader::entries()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    return m_format->entries();
+}
+
 /*!
  * \brief Read current boot image entry data.
  *
@@ -564,6 +695,30 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Read current boot image entry data without copying.
+ *
+ * If the boot image was opened from a memory-backed File (eg. MemoryFile or
+ * MmapFile), this returns a pointer directly into the file's backing storage
+ * for the rest of the current entry's data. The data is marked as read, so a
+ * subsequent call to Reader::read_data() will return 0.
+ *
+ * If the file does not support views, FileError::UnsupportedView is returned,
+ * no data is consumed, and the caller should fall back to Reader::read_data().
+ *
+ * \note The returned pointer is only valid until the reader is closed.
+ *
+ * \return Pointer to and size of the remaining entry data. If an error occurs,
+ *         a specific error code will be returned.
+ */
+oc::result<FileConstIoVec> Reader::read_data_view()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Data);
+
+    // Do not alter state. Stay in ReaderState::DATA
+    return m_format->read_data_view(*m_file);
+}
+
 /*!
  * \brief Get detected or forced boot image format code.
  *
@@ -688,6 +843,8 @@ oc::result<void> Reader::set_format_by_name(const std::string &name)
 /*!
  * \brief Enable support for all boot image formats.
  *
+ * Formats that were left out of the build are skipped.
+ *
  * \return Nothing if all formats are successfully enabled. Otherwise, the error
  *         code.
  */
@@ -697,7 +854,8 @@ oc::result<void> Reader::enable_format_all()
 
     for (auto const &format : g_reader_formats) {
         auto ret = (this->*format.func)();
-        if (!ret && ret.error() != ReaderError::FormatAlreadyEnabled) {
+        if (!ret && ret.error() != ReaderError::FormatAlreadyEnabled
+                && ret.error() != ReaderError::FormatDisabled) {
             return ret.as_failure();
         }
     }
@@ -747,6 +905,28 @@ oc::result<void> Reader::enable_format_by_name(const std::string &name)
     return ReaderError::InvalidFormatName;
 }
 
+/*!
+ * \brief Remember format detection results in a file
+ *
+ * When enabled, open() computes a fingerprint of the file from its size and
+ * the bytes the bidders inspect. If the fingerprint has been seen before, only
+ * the format that previously won the bid is asked to bid again. The full bid
+ * is performed if that format no longer accepts the file or if the cache file
+ * is missing or corrupt.
+ *
+ * \param path Path to cache file. It will be created if it does not exist.
+ *
+ * \return Nothing if the cache is successfully enabled. Otherwise, the error
+ *         code.
+ */
+oc::result<void> Reader::set_format_cache(const std::string &path)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
+
+    m_format_cache = std::make_unique<FormatCache>(path);
+    return oc::success();
+}
+
 /*!
  * \brief Check whether reader is opened
  *
@@ -66,10 +66,16 @@ std::string ReaderErrorCategory::message(int ev) const
         return "no formats registered";
     case ReaderError::UnknownFileFormat:
         return "unknown file format";
+    case ReaderError::FormatDisabled:
+        return "format support disabled at build time";
     case ReaderError::EndOfEntries:
         return "end of entries";
     case ReaderError::UnsupportedGoTo:
         return "go to entry not supported";
+    case ReaderError::UnsupportedEntryIndex:
+        return "entry index not supported";
+    case ReaderError::UnsupportedHeaderPatch:
+        return "in-place header patching not supported";
     default:
         return "(unknown reader error)";
     }
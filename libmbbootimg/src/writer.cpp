@@ -27,6 +27,7 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file/tracing.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
@@ -258,6 +259,7 @@ Writer::Writer()
     : m_state(WriterState::New)
     , m_owned_file()
     , m_file()
+    , m_trace_file()
     , m_format()
 {
 }
@@ -278,6 +280,7 @@ Writer::Writer(Writer &&other) noexcept
     : m_state(other.m_state)
     , m_owned_file(std::move(other.m_owned_file))
     , m_file(other.m_file)
+    , m_trace_file(std::move(other.m_trace_file))
     , m_format(std::move(other.m_format))
 {
     other.m_state = WriterState::Moved;
@@ -290,6 +293,7 @@ Writer & Writer::operator=(Writer &&rhs) noexcept
     m_state = rhs.m_state;
     m_owned_file.swap(rhs.m_owned_file);
     m_file = rhs.m_file;
+    m_trace_file.swap(rhs.m_trace_file);
     m_format.swap(rhs.m_format);
 
     rhs.m_state = WriterState::Moved;
@@ -376,6 +380,17 @@ oc::result<void> Writer::open(File *file)
         return WriterError::NoFormatRegistered;
     }
 
+    // Collect I/O statistics if requested
+    std::unique_ptr<TracingFile> trace_file;
+    if (file_trace_path()) {
+        trace_file = std::make_unique<TracingFile>(file);
+        if (trace_file->is_open()) {
+            file = trace_file.get();
+        } else {
+            trace_file.reset();
+        }
+    }
+
     auto ret = m_format->open(*file);
     if (!ret) {
         (void) m_format->close(*file);
@@ -384,6 +399,7 @@ oc::result<void> Writer::open(File *file)
 
     m_state = WriterState::Header;
     m_file = file;
+    m_trace_file = std::move(trace_file);
 
     return oc::success();
 }
@@ -408,6 +424,7 @@ oc::result<void> Writer::close()
     auto reset_state = finally([&] {
         m_state = WriterState::New;
 
+        m_trace_file.reset();
         m_owned_file.reset();
         m_file = nullptr;
     });
@@ -417,6 +434,15 @@ oc::result<void> Writer::close()
     if (m_state != WriterState::New) {
         ret = m_format->close(*m_file);
 
+        if (m_trace_file) {
+            (void) m_trace_file->close();
+
+            if (auto path = file_trace_path()) {
+                (void) file_trace_write(path, "writer:" + m_format->name(),
+                                        *m_trace_file);
+            }
+        }
+
         if (m_owned_file) {
             auto close_ret = m_owned_file->close();
             if (ret && !close_ret) {
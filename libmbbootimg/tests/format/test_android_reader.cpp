@@ -397,3 +397,68 @@ TEST_F(AndroidReaderGoToEntryTest, GoToMissingEntryShouldFail)
     ASSERT_FALSE(ret);
     ASSERT_EQ(ret.error(), ReaderError::EndOfEntries);
 }
+
+TEST_F(AndroidReaderGoToEntryTest, EntriesShouldListAllSegments)
+{
+    auto entries = _reader.entries();
+    ASSERT_TRUE(entries);
+    ASSERT_EQ(entries.value().size(), 3u);
+
+    auto const &kernel = entries.value()[0];
+    ASSERT_EQ(kernel.type, ENTRY_TYPE_KERNEL);
+    ASSERT_EQ(kernel.offset, 2048u);
+    ASSERT_EQ(kernel.size, 6u);
+    ASSERT_EQ(kernel.alignment, 2048u);
+
+    auto const &ramdisk = entries.value()[1];
+    ASSERT_EQ(ramdisk.type, ENTRY_TYPE_RAMDISK);
+    ASSERT_EQ(ramdisk.offset, 4096u);
+    ASSERT_EQ(ramdisk.size, 7u);
+    ASSERT_EQ(ramdisk.alignment, 2048u);
+
+    auto const &secondboot = entries.value()[2];
+    ASSERT_EQ(secondboot.type, ENTRY_TYPE_SECONDBOOT);
+    ASSERT_EQ(secondboot.offset, 6144u);
+    ASSERT_EQ(secondboot.size, 10u);
+    ASSERT_EQ(secondboot.alignment, 2048u);
+
+    // Listing entries should not affect sequential reads
+    Entry entry;
+    ASSERT_TRUE(_reader.read_entry(entry));
+    ASSERT_EQ(*entry.type(), ENTRY_TYPE_KERNEL);
+}
+
+TEST_F(AndroidReaderGoToEntryTest, ReadDataViewShouldPointIntoFile)
+{
+    Entry entry;
+    char buf[50];
+
+    ASSERT_TRUE(_reader.go_to_entry(entry, ENTRY_TYPE_RAMDISK));
+    auto view = _reader.read_data_view();
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().data, _data.data() + 4096);
+    ASSERT_EQ(view.value().size, 7u);
+
+    // Data should have been consumed
+    auto n = _reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    // Sequential reads should still continue at the next entry
+    ASSERT_TRUE(_reader.read_entry(entry));
+    ASSERT_EQ(*entry.type(), ENTRY_TYPE_SECONDBOOT);
+    n = _reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+    ASSERT_EQ(memcmp(buf, "secondboot", n.value()), 0);
+}
+
+TEST(AndroidReaderEntriesTest, EntriesBeforeHeaderShouldFail)
+{
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_android());
+
+    auto entries = reader.entries();
+    ASSERT_FALSE(entries);
+    ASSERT_EQ(entries.error(), ReaderError::InvalidState);
+}
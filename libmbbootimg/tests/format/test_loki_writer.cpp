@@ -18,3 +18,114 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "mbbootimg/format/loki_p.h"
+
+using namespace mb::bootimg::loki;
+
+namespace
+{
+
+constexpr char THUMB_PATTERN[] = "\xf0\xb5\x8f\xb0\x06\x46\xf0\xf7";
+constexpr char ARM_PATTERN[]   = "\x2d\xe9\xf0\x41\x86\xb0\xf1\xf7";
+constexpr char LG_PATTERN[]    = "\x2d\xe9\xf0\x4f\xf3\xb0\x05\x46";
+constexpr size_t PATTERN_SIZE  = 8;
+constexpr size_t SEARCH_LIMIT  = 0x1000;
+
+std::vector<unsigned char> make_aboot(size_t size)
+{
+    std::vector<unsigned char> aboot(size);
+    uint32_t state = 0x12345678;
+
+    // Deterministic noise with plenty of partial matches of the patterns'
+    // first bytes
+    for (auto &c : aboot) {
+        state = state * 1103515245u + 12345u;
+        c = static_cast<unsigned char>(state >> 16);
+        if ((state & 0x700) == 0) {
+            c = (state & 0x800) ? 0xf0 : 0x2d;
+        }
+    }
+
+    return aboot;
+}
+
+void put(std::vector<unsigned char> &aboot, size_t offset, const char *pattern)
+{
+    memcpy(aboot.data() + offset, pattern, PATTERN_SIZE);
+}
+
+}
+
+TEST(LokiFindAbootFunctionTest, EarliestMatchShouldBeFound)
+{
+    auto aboot = make_aboot(0x10000);
+    put(aboot, 0x3000, THUMB_PATTERN);
+    put(aboot, 0x5000, ARM_PATTERN);
+
+    size_t offset;
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, 0x3000u);
+
+    put(aboot, 0x2000, ARM_PATTERN);
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, 0x2000u);
+}
+
+TEST(LokiFindAbootFunctionTest, LgPatternShouldHaveLowestPrecedence)
+{
+    auto aboot = make_aboot(0x10000);
+    put(aboot, 0x1000, LG_PATTERN);
+    put(aboot, 0x8000, ARM_PATTERN);
+
+    size_t offset;
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, 0x8000u);
+
+    aboot = make_aboot(0x10000);
+    put(aboot, 0x1000, LG_PATTERN);
+    put(aboot, 0x4000, LG_PATTERN);
+
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, 0x1000u);
+}
+
+TEST(LokiFindAbootFunctionTest, MatchInSearchLimitShouldBeIgnored)
+{
+    auto aboot = make_aboot(0x10000);
+    put(aboot, aboot.size() - SEARCH_LIMIT, THUMB_PATTERN);
+
+    size_t offset;
+    ASSERT_FALSE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+
+    put(aboot, aboot.size() - SEARCH_LIMIT - 1, THUMB_PATTERN);
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, aboot.size() - SEARCH_LIMIT - 1);
+}
+
+TEST(LokiFindAbootFunctionTest, UndersizedImageShouldFail)
+{
+    std::vector<unsigned char> aboot(SEARCH_LIMIT + PATTERN_SIZE - 1);
+    put(aboot, 0, THUMB_PATTERN);
+
+    size_t offset;
+    ASSERT_FALSE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+}
+
+TEST(LokiFindAbootFunctionTest, FullSizeImageShouldBeScanned)
+{
+    // Typical aboot partitions are a few MiB
+    auto aboot = make_aboot(4 * 1024 * 1024);
+    size_t expected = aboot.size() - SEARCH_LIMIT - PATTERN_SIZE;
+    put(aboot, expected, ARM_PATTERN);
+
+    size_t offset;
+    ASSERT_TRUE(_loki_find_aboot_function(aboot.data(), aboot.size(), offset));
+    ASSERT_EQ(offset, expected);
+}
@@ -18,3 +18,137 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/tracing.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::mtk;
+
+struct MtkWriterSHA1Test : public ::testing::Test
+{
+protected:
+    // Write an MTK image, declaring the entry sizes up front except for the
+    // kernel and/or ramdisk
+    void WriteImage(bool declare_kernel_size, bool declare_ramdisk_size,
+                    std::string &data, uint64_t &read_bytes)
+    {
+        void *buf = nullptr;
+        size_t buf_size = 0;
+
+        MemoryFile memory_file(&buf, &buf_size);
+        ASSERT_TRUE(memory_file.is_open());
+        TracingFile file(&memory_file);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_mtk());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+
+        while (true) {
+            auto ret = writer.get_entry(entry);
+            if (!ret) {
+                ASSERT_EQ(ret.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            std::string entry_data;
+
+            switch (*entry.type()) {
+            case ENTRY_TYPE_MTK_KERNEL_HEADER:
+            case ENTRY_TYPE_MTK_RAMDISK_HEADER: {
+                MtkHeader mtk_hdr = {};
+                memcpy(mtk_hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+                memset(mtk_hdr.unused, 0xff, sizeof(mtk_hdr.unused));
+                entry_data.assign(reinterpret_cast<char *>(&mtk_hdr),
+                                  sizeof(mtk_hdr));
+                break;
+            }
+            case ENTRY_TYPE_KERNEL:
+                entry_data = "kernel";
+                break;
+            case ENTRY_TYPE_RAMDISK:
+                entry_data = "ramdisk";
+                break;
+            }
+
+            if ((*entry.type() != ENTRY_TYPE_KERNEL || declare_kernel_size)
+                    && (*entry.type() != ENTRY_TYPE_RAMDISK
+                            || declare_ramdisk_size)) {
+                entry.set_size(entry_data.size());
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry));
+
+            if (!entry_data.empty()) {
+                auto n = writer.write_data(entry_data.data(),
+                                           entry_data.size());
+                ASSERT_TRUE(n);
+                ASSERT_EQ(n.value(), entry_data.size());
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+
+        data.assign(static_cast<char *>(buf), buf_size);
+        read_bytes = file.stats(FileOp::Read).bytes;
+
+        free(buf);
+    }
+};
+
+TEST_F(MtkWriterSHA1Test, StreamingHashMatchesSecondPass)
+{
+    std::string streamed;
+    uint64_t streamed_reads;
+    std::string reread;
+    uint64_t reread_reads;
+
+    ASSERT_NO_FATAL_FAILURE(WriteImage(true, true, streamed, streamed_reads));
+    ASSERT_NO_FATAL_FAILURE(WriteImage(false, false, reread, reread_reads));
+
+    // Sizes known up front should not require reading back the output
+    ASSERT_EQ(streamed_reads, 0u);
+    ASSERT_GT(reread_reads, 0u);
+
+    ASSERT_EQ(streamed, reread);
+}
+
+TEST_F(MtkWriterSHA1Test, UnknownSizeOnlyRereadsFromThatEntry)
+{
+    std::string streamed;
+    uint64_t streamed_reads;
+    std::string partial;
+    uint64_t partial_reads;
+    std::string reread;
+    uint64_t reread_reads;
+
+    ASSERT_NO_FATAL_FAILURE(WriteImage(true, true, streamed, streamed_reads));
+    ASSERT_NO_FATAL_FAILURE(WriteImage(true, false, partial, partial_reads));
+    ASSERT_NO_FATAL_FAILURE(WriteImage(false, false, reread, reread_reads));
+
+    // Only the ramdisk's MTK header and everything after it is read back
+    ASSERT_EQ(partial_reads, sizeof(MtkHeader) + strlen("ramdisk"));
+    ASSERT_EQ(reread_reads, 2 * sizeof(MtkHeader) + strlen("kernel")
+              + strlen("ramdisk"));
+
+    ASSERT_EQ(partial, streamed);
+    ASSERT_EQ(reread, streamed);
+}
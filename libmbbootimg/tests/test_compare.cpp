@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/compare.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+namespace
+{
+
+std::string make_image(const std::string &kernel, const std::string &ramdisk)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    MemoryFile file(&buf, &buf_size);
+    EXPECT_TRUE(file.is_open());
+
+    Writer writer;
+    EXPECT_TRUE(writer.set_format_android());
+    EXPECT_TRUE(writer.open(&file));
+
+    Header header;
+    EXPECT_TRUE(writer.get_header(header));
+    EXPECT_TRUE(header.set_page_size(2048));
+    EXPECT_TRUE(writer.write_header(header));
+
+    Entry entry;
+
+    while (writer.get_entry(entry)) {
+        EXPECT_TRUE(writer.write_entry(entry));
+
+        const std::string *data = nullptr;
+        if (*entry.type() == ENTRY_TYPE_KERNEL) {
+            data = &kernel;
+        } else if (*entry.type() == ENTRY_TYPE_RAMDISK) {
+            data = &ramdisk;
+        }
+
+        if (data) {
+            EXPECT_TRUE(writer.write_data(data->data(), data->size()));
+        }
+    }
+
+    EXPECT_TRUE(writer.close());
+
+    std::string result(static_cast<char *>(buf), buf_size);
+    free(buf);
+
+    return result;
+}
+
+}
+
+TEST(CompareTest, IdenticalImagesAreEqual)
+{
+    auto image1 = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+    auto image2 = image1;
+
+    MemoryFile file1(image1.data(), image1.size());
+    MemoryFile file2(image2.data(), image2.size());
+
+    auto equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_TRUE(equal.value());
+}
+
+TEST(CompareTest, DifferentRamdiskIsNotEqual)
+{
+    auto image1 = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+    auto image2 = make_image(std::string(10000, 'k'), std::string(5000, 's'));
+
+    MemoryFile file1(image1.data(), image1.size());
+    MemoryFile file2(image2.data(), image2.size());
+
+    auto equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_FALSE(equal.value());
+}
+
+TEST(CompareTest, DifferentSizesAreNotEqual)
+{
+    auto image1 = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+    auto image2 = make_image(std::string(10000, 'k'), std::string(5001, 'r'));
+
+    MemoryFile file1(image1.data(), image1.size());
+    MemoryFile file2(image2.data(), image2.size());
+
+    auto equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_FALSE(equal.value());
+}
+
+TEST(CompareTest, ModifiedDataWithSameHeaderIsNotEqual)
+{
+    auto image1 = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+    auto image2 = image1;
+
+    // Change the ramdisk without updating the ID in the header
+    auto pos = image2.find(std::string(5000, 'r'));
+    ASSERT_NE(pos, std::string::npos);
+    image2[pos + 4096] = 'x';
+
+    MemoryFile file1(image1.data(), image1.size());
+    MemoryFile file2(image2.data(), image2.size());
+
+    auto equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_FALSE(equal.value());
+}
+
+TEST(CompareTest, ModifiedDataIsDetectedWithoutViews)
+{
+    auto image1 = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+    auto image2 = image1;
+
+    MemoryFile mem_file1(image1.data(), image1.size());
+    MemoryFile mem_file2(image2.data(), image2.size());
+
+    // BufferedFile does not support views, so chunked reads are used
+    BufferedFile file1(&mem_file1);
+    BufferedFile file2(&mem_file2);
+
+    auto equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_TRUE(equal.value());
+
+    auto pos = image2.find(std::string(5000, 'r'));
+    ASSERT_NE(pos, std::string::npos);
+    image2[pos + 4096] = 'x';
+
+    equal = images_equal(file1, file2);
+    ASSERT_TRUE(equal);
+    ASSERT_FALSE(equal.value());
+}
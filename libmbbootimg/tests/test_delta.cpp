@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/delta.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+namespace
+{
+
+std::string make_image(const std::string &kernel, const std::string &ramdisk)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    MemoryFile file(&buf, &buf_size);
+    EXPECT_TRUE(file.is_open());
+
+    Writer writer;
+    EXPECT_TRUE(writer.set_format_android());
+    EXPECT_TRUE(writer.open(&file));
+
+    Header header;
+    EXPECT_TRUE(writer.get_header(header));
+    EXPECT_TRUE(header.set_page_size(2048));
+    EXPECT_TRUE(writer.write_header(header));
+
+    Entry entry;
+
+    while (writer.get_entry(entry)) {
+        EXPECT_TRUE(writer.write_entry(entry));
+
+        const std::string *data = nullptr;
+        if (*entry.type() == ENTRY_TYPE_KERNEL) {
+            data = &kernel;
+        } else if (*entry.type() == ENTRY_TYPE_RAMDISK) {
+            data = &ramdisk;
+        }
+
+        if (data) {
+            EXPECT_TRUE(writer.write_data(data->data(), data->size()));
+        }
+    }
+
+    EXPECT_TRUE(writer.close());
+
+    std::string result(static_cast<char *>(buf), buf_size);
+    free(buf);
+
+    return result;
+}
+
+}
+
+TEST(DeltaTest, IdenticalImagesHaveNoChanges)
+{
+    auto image = make_image(std::string(10000, 'k'), std::string(5000, 'r'));
+
+    MemoryFile old_file(image.data(), image.size());
+    MemoryFile new_file(image.data(), image.size());
+
+    auto delta = delta_compute(old_file, new_file);
+    ASSERT_TRUE(delta);
+    ASSERT_EQ(delta.value().size, image.size());
+    ASSERT_TRUE(delta.value().ranges.empty());
+    ASSERT_FALSE(delta.value().header_changed);
+    ASSERT_TRUE(delta.value().changed_entries.empty());
+}
+
+TEST(DeltaTest, ChangedRamdiskOnlyTouchesRamdiskBlocks)
+{
+    auto old_image = make_image(std::string(100000, 'k'),
+                                std::string(5000, 'r'));
+    auto new_image = make_image(std::string(100000, 'k'),
+                                std::string(5000, 'R'));
+    ASSERT_EQ(old_image.size(), new_image.size());
+
+    MemoryFile old_file(old_image.data(), old_image.size());
+    MemoryFile new_file(new_image.data(), new_image.size());
+
+    auto delta = delta_compute(old_file, new_file);
+    ASSERT_TRUE(delta);
+
+    // The ID changes along with the ramdisk, but no Header fields do
+    ASSERT_FALSE(delta.value().header_changed);
+    ASSERT_EQ(delta.value().changed_entries,
+              std::vector<int>{ENTRY_TYPE_RAMDISK});
+
+    uint64_t changed = 0;
+    for (auto const &range : delta.value().ranges) {
+        changed += range.size;
+    }
+    ASSERT_LT(changed, new_image.size() / 4);
+
+    // Applying the delta should produce the new image
+    std::string patched = old_image;
+    MemoryFile patched_file(patched.data(), patched.size());
+
+    auto n = delta_apply(delta.value(), new_file, patched_file);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), changed);
+    ASSERT_EQ(patched, new_image);
+}
+
+TEST(DeltaTest, UnparseableOldImageMarksEverythingChanged)
+{
+    auto new_image = make_image(std::string(100, 'k'), std::string(100, 'r'));
+    std::string old_image(new_image.size(), '\0');
+
+    MemoryFile old_file(old_image.data(), old_image.size());
+    MemoryFile new_file(new_image.data(), new_image.size());
+
+    auto delta = delta_compute(old_file, new_file);
+    ASSERT_TRUE(delta);
+    ASSERT_TRUE(delta.value().header_changed);
+    ASSERT_EQ(delta.value().changed_entries,
+              (std::vector<int>{ENTRY_TYPE_KERNEL, ENTRY_TYPE_RAMDISK}));
+}
+
+TEST(DeltaTest, RawImageOnlyTouchesChangedBlocks)
+{
+    // Not a boot image (eg. modem) and larger than a single read
+    std::string old_image(3 * 1024 * 1024 + 100, 'a');
+    std::string new_image(old_image);
+
+    // Change straddling the first 1 MiB boundary and a partial last block.
+    // The old image is also shorter than the new one.
+    new_image[1024 * 1024 - 1] = 'b';
+    new_image[1024 * 1024] = 'b';
+    new_image[new_image.size() - 1] = 'b';
+    old_image.resize(old_image.size() - 50);
+
+    MemoryFile old_file(old_image.data(), old_image.size());
+    MemoryFile new_file(new_image.data(), new_image.size());
+
+    auto delta = delta_compute(old_file, new_file);
+    ASSERT_TRUE(delta);
+    ASSERT_EQ(delta.value().size, new_image.size());
+    ASSERT_TRUE(delta.value().header_changed);
+
+    std::vector<DeltaRange> expected{
+        { 1024 * 1024 - DELTA_BLOCK_SIZE, 2 * DELTA_BLOCK_SIZE },
+        { 3 * 1024 * 1024, 100 },
+    };
+    ASSERT_EQ(delta.value().ranges.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(delta.value().ranges[i].offset, expected[i].offset);
+        ASSERT_EQ(delta.value().ranges[i].size, expected[i].size);
+    }
+
+    std::string patched = old_image;
+    patched.resize(new_image.size());
+    MemoryFile patched_file(patched.data(), patched.size());
+
+    auto n = delta_apply(delta.value(), new_file, patched_file);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2 * DELTA_BLOCK_SIZE + 100);
+    ASSERT_EQ(patched, new_image);
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/file/standard.h"
+
+#include "mbbootimg/defs.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct FormatCacheTest : testing::Test
+{
+    std::string _path;
+    std::string _image;
+
+    void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        _path = tmpdir ? tmpdir : "/tmp";
+        _path += "/mbbootimg-test-format-cache.XXXXXX";
+
+        int fd = mkstemp(_path.data());
+        ASSERT_GE(fd, 0);
+        close(fd);
+
+        void *buf = nullptr;
+        size_t buf_size = 0;
+
+        MemoryFile file(&buf, &buf_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_android());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+            ASSERT_TRUE(writer.write_data("data", 4));
+        }
+
+        ASSERT_TRUE(writer.close());
+
+        _image.assign(static_cast<char *>(buf), buf_size);
+        free(buf);
+    }
+
+    void TearDown() override
+    {
+        unlink(_path.c_str());
+    }
+
+    int open_image()
+    {
+        MemoryFile file(_image.data(), _image.size());
+        EXPECT_TRUE(file.is_open());
+
+        Reader reader;
+        EXPECT_TRUE(reader.enable_format_all());
+        EXPECT_TRUE(reader.set_format_cache(_path));
+        auto ret = reader.open(&file);
+        EXPECT_TRUE(ret) << ret.error().message();
+        if (!ret) {
+            return 0;
+        }
+
+        return reader.format_code();
+    }
+
+    std::string read_cache()
+    {
+        StandardFile file;
+        EXPECT_TRUE(file.open(_path, FileOpenMode::ReadOnly));
+
+        std::string contents(4096, '\0');
+        auto n = file_read_retry(file, contents.data(), contents.size());
+        EXPECT_TRUE(n);
+        contents.resize(n ? n.value() : 0);
+
+        return contents;
+    }
+
+    void write_cache(const std::string &contents)
+    {
+        StandardFile file;
+        ASSERT_TRUE(file.open(_path, FileOpenMode::WriteOnly));
+        ASSERT_TRUE(file_write_exact(file, contents.data(), contents.size()));
+    }
+};
+
+TEST_F(FormatCacheTest, StoresBidWinner)
+{
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+
+    auto contents = read_cache();
+    ASSERT_EQ(contents.find(std::to_string(_image.size()) + "-"), 0u);
+    ASSERT_NE(contents.find(std::string(" ") + FORMAT_NAME_ANDROID + "\n"),
+              std::string::npos);
+}
+
+TEST_F(FormatCacheTest, HitSelectsSameFormat)
+{
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+    auto contents = read_cache();
+
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+    ASSERT_EQ(read_cache(), contents);
+}
+
+TEST_F(FormatCacheTest, StaleEntryFallsBackToFullBid)
+{
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+    auto contents = read_cache();
+
+    // Point the fingerprint at a format that will refuse the file
+    auto pos = contents.find(' ');
+    ASSERT_NE(pos, std::string::npos);
+    write_cache(contents.substr(0, pos + 1) + FORMAT_NAME_LOKI + "\n");
+
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+    ASSERT_EQ(read_cache(), contents);
+}
+
+TEST_F(FormatCacheTest, CorruptCacheIsIgnored)
+{
+    write_cache("garbage\n\n  \nno-newline");
+
+    ASSERT_EQ(open_image(), FORMAT_ANDROID);
+    ASSERT_NE(read_cache().find(std::string(" ") + FORMAT_NAME_ANDROID + "\n"),
+              std::string::npos);
+}
@@ -20,6 +20,7 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
 
 #include "mbbootimg/header.h"
 
@@ -45,6 +46,22 @@ TEST(BootImgHeaderTest, CheckDefaultValues)
     ASSERT_FALSE(header.entrypoint_address());
 }
 
+TEST(BootImgHeaderTest, CheckStringFieldsAreNotCopied)
+{
+    Header header;
+
+    // Long enough to not fit in the small string buffer
+    std::string cmdline(512, 'x');
+    const char *data = cmdline.data();
+
+    header.set_kernel_cmdline(std::move(cmdline));
+
+    auto &value = header.kernel_cmdline();
+    ASSERT_TRUE(value);
+    ASSERT_EQ(value->data(), data);
+    ASSERT_EQ(&header.kernel_cmdline(), &value);
+}
+
 TEST(BootImgHeaderTest, CheckGettersSetters)
 {
     Header header;
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstddef>
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/android_error.h"
+#include "mbbootimg/format/android_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/patch.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::android;
+
+struct PatchHeaderTest : testing::Test
+{
+    std::string _image;
+
+    void SetUp() override
+    {
+        void *buf = nullptr;
+        size_t buf_size = 0;
+
+        MemoryFile file(&buf, &buf_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_android());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(header.set_board_name({"old_board"}));
+        ASSERT_TRUE(header.set_kernel_cmdline({"console=ttyHSL0"}));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+            if (*entry.type() == ENTRY_TYPE_KERNEL) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            } else if (*entry.type() == ENTRY_TYPE_RAMDISK) {
+                ASSERT_TRUE(writer.write_data("ramdisk", 7));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+
+        _image.assign(static_cast<char *>(buf), buf_size);
+        free(buf);
+    }
+
+    Header read_header(const std::string &image)
+    {
+        MemoryFile file(const_cast<char *>(image.data()), image.size());
+        EXPECT_TRUE(file.is_open());
+
+        Reader reader;
+        Header header;
+        EXPECT_TRUE(reader.enable_format_all());
+        EXPECT_TRUE(reader.open(&file));
+        EXPECT_TRUE(reader.read_header(header));
+
+        return header;
+    }
+};
+
+TEST_F(PatchHeaderTest, RewritesOnlyHeaderFields)
+{
+    std::string image(_image);
+    MemoryFile file(image.data(), image.size());
+    ASSERT_TRUE(file.is_open());
+
+    Header header;
+    ASSERT_TRUE(header.set_board_name({"new_board"}));
+    ASSERT_TRUE(header.set_kernel_cmdline({"console=ttyMSM0 quiet"}));
+    ASSERT_TRUE(header.set_kernel_tags_address(0x10000100));
+
+    auto ret = patch_header(file, header);
+    ASSERT_TRUE(ret) << ret.error().message();
+
+    ASSERT_EQ(image.size(), _image.size());
+
+    // SHA1 ID and everything after the header is untouched
+    constexpr size_t id_offset = offsetof(AndroidHeader, id);
+    ASSERT_EQ(image.compare(id_offset, std::string::npos, _image, id_offset,
+                            std::string::npos), 0);
+
+    auto old_header = read_header(_image);
+    auto new_header = read_header(image);
+
+    ASSERT_EQ(new_header.board_name(), std::string("new_board"));
+    ASSERT_EQ(new_header.kernel_cmdline(),
+              std::string("console=ttyMSM0 quiet"));
+    ASSERT_EQ(new_header.kernel_tags_address(), 0x10000100u);
+    ASSERT_EQ(new_header.page_size(), old_header.page_size());
+    ASSERT_EQ(new_header.kernel_address(), old_header.kernel_address());
+    ASSERT_EQ(new_header.ramdisk_address(), old_header.ramdisk_address());
+}
+
+TEST_F(PatchHeaderTest, RejectsPageSizeChange)
+{
+    std::string image(_image);
+    MemoryFile file(image.data(), image.size());
+    ASSERT_TRUE(file.is_open());
+
+    Header header;
+    ASSERT_TRUE(header.set_page_size(4096));
+    ASSERT_TRUE(header.set_kernel_cmdline({"quiet"}));
+
+    auto ret = patch_header(file, header);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), AndroidError::PageSizeMismatch);
+    ASSERT_EQ(image, _image);
+}
+
+TEST_F(PatchHeaderTest, RejectsTooLongCmdline)
+{
+    std::string image(_image);
+    MemoryFile file(image.data(), image.size());
+    ASSERT_TRUE(file.is_open());
+
+    Header header;
+    ASSERT_TRUE(header.set_board_name({"new_board"}));
+    ASSERT_TRUE(header.set_kernel_cmdline(std::string(BOOT_ARGS_SIZE, 'x')));
+
+    auto ret = patch_header(file, header);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), AndroidError::KernelCmdlineTooLong);
+    ASSERT_EQ(image, _image);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/tracing.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/probe_file_p.h"
+
+using namespace mb;
+using namespace mb::bootimg::detail;
+
+namespace
+{
+
+std::string make_data(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    for (size_t i = 0; i < size; ++i) {
+        data.push_back(static_cast<char>(i * 7 + i / 251));
+    }
+
+    return data;
+}
+
+std::string read_at(File &file, uint64_t offset, size_t size)
+{
+    std::string buf(size, '\0');
+
+    EXPECT_TRUE(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+    auto n = file_read_retry(file, buf.data(), buf.size());
+    EXPECT_TRUE(n);
+    buf.resize(n ? n.value() : 0);
+
+    return buf;
+}
+
+}
+
+TEST(ProbeFileTest, OpenUnopenedFile)
+{
+    MemoryFile memory_file;
+
+    ProbeFile probe_file;
+    auto ret = probe_file.open(&memory_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST(ProbeFileTest, SmallFileIsFullyCached)
+{
+    auto data = make_data(1000);
+
+    MemoryFile memory_file(data.data(), data.size());
+    TracingFile tracing_file(&memory_file);
+    ASSERT_TRUE(tracing_file.is_open());
+
+    ProbeFile probe_file;
+    ASSERT_TRUE(probe_file.open(&tracing_file));
+
+    auto reads = tracing_file.stats(FileOp::Read).calls;
+
+    ASSERT_EQ(read_at(probe_file, 0, 100), data.substr(0, 100));
+    ASSERT_EQ(read_at(probe_file, 900, 200), data.substr(900));
+
+    auto size = probe_file.seek(0, SEEK_END);
+    ASSERT_TRUE(size);
+    ASSERT_EQ(size.value(), data.size());
+
+    ASSERT_EQ(tracing_file.stats(FileOp::Read).calls, reads);
+}
+
+TEST(ProbeFileTest, HeadAndTailAreCached)
+{
+    auto data = make_data(1024 * 1024);
+
+    MemoryFile memory_file(data.data(), data.size());
+    TracingFile tracing_file(&memory_file);
+    ASSERT_TRUE(tracing_file.is_open());
+
+    ProbeFile probe_file;
+    ASSERT_TRUE(probe_file.open(&tracing_file));
+
+    auto reads = tracing_file.stats(FileOp::Read).calls;
+
+    ASSERT_EQ(read_at(probe_file, 512, 1024), data.substr(512, 1024));
+    ASSERT_EQ(read_at(probe_file, data.size() - 256, 256),
+              data.substr(data.size() - 256));
+
+    ASSERT_TRUE(probe_file.seek(-16, SEEK_END));
+    std::string buf(16, '\0');
+    ASSERT_TRUE(file_read_exact(probe_file, buf.data(), buf.size()));
+    ASSERT_EQ(buf, data.substr(data.size() - 16));
+
+    ASSERT_EQ(tracing_file.stats(FileOp::Read).calls, reads);
+}
+
+TEST(ProbeFileTest, UncachedReadsGoToFile)
+{
+    auto data = make_data(1024 * 1024);
+
+    MemoryFile memory_file(data.data(), data.size());
+    ProbeFile probe_file;
+    ASSERT_TRUE(probe_file.open(&memory_file));
+
+    // Spans the end of the head
+    auto offset = ProbeFile::HEAD_SIZE - 100;
+    ASSERT_EQ(read_at(probe_file, offset, 200), data.substr(offset, 200));
+
+    // Spans the start of the tail
+    offset = data.size() - ProbeFile::TAIL_SIZE - 100;
+    ASSERT_EQ(read_at(probe_file, offset, 200), data.substr(offset, 200));
+
+    // Past the end
+    ASSERT_EQ(read_at(probe_file, data.size() + 10, 10), "");
+}
+
+TEST(ProbeFileTest, WriteNotSupported)
+{
+    auto data = make_data(100);
+
+    MemoryFile memory_file(data.data(), data.size());
+    ProbeFile probe_file;
+    ASSERT_TRUE(probe_file.open(&memory_file));
+
+    auto n = probe_file.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+}
@@ -34,6 +34,18 @@
 namespace mb
 {
 
+struct FileIoVec
+{
+    void *data;
+    size_t size;
+};
+
+struct FileConstIoVec
+{
+    const void *data;
+    size_t size;
+};
+
 class MB_EXPORT File
 {
 public:
@@ -48,6 +60,13 @@ public:
     // File operations
     oc::result<size_t> read(void *buf, size_t size);
     oc::result<size_t> write(const void *buf, size_t size);
+    oc::result<size_t> readv(const FileIoVec *iov, size_t count);
+    oc::result<size_t> writev(const FileConstIoVec *iov, size_t count);
+    oc::result<size_t> read_at(uint64_t offset, void *buf, size_t size);
+    oc::result<size_t> write_at(uint64_t offset, const void *buf, size_t size);
+    oc::result<uint64_t> copy_range(uint64_t src, uint64_t dest,
+                                    uint64_t size);
+    oc::result<FileConstIoVec> view(uint64_t offset, size_t size);
     oc::result<uint64_t> seek(int64_t offset, int whence);
     oc::result<void> truncate(uint64_t size);
 
@@ -70,6 +89,16 @@ protected:
     virtual oc::result<void> on_close();
     virtual oc::result<size_t> on_read(void *buf, size_t size);
     virtual oc::result<size_t> on_write(const void *buf, size_t size);
+    virtual oc::result<size_t> on_readv(const FileIoVec *iov, size_t count);
+    virtual oc::result<size_t> on_writev(const FileConstIoVec *iov,
+                                         size_t count);
+    virtual oc::result<size_t> on_read_at(uint64_t offset,
+                                          void *buf, size_t size);
+    virtual oc::result<size_t> on_write_at(uint64_t offset,
+                                           const void *buf, size_t size);
+    virtual oc::result<uint64_t> on_copy_range(uint64_t src, uint64_t dest,
+                                               uint64_t size);
+    virtual oc::result<FileConstIoVec> on_view(uint64_t offset, size_t size);
     virtual oc::result<uint64_t> on_seek(int64_t offset, int whence);
     virtual oc::result<void> on_truncate(uint64_t size);
 
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "mbcommon/file/async_p.h"
+#include "mbcommon/file/open_mode.h"
+
+namespace mb
+{
+
+enum class AsyncBackend
+{
+    Auto,
+    IoUring,
+    ThreadPool,
+};
+
+struct AsyncCompletion
+{
+    //! ID returned when the request was submitted
+    uint64_t id;
+    //! Error if the request failed
+    std::error_code error;
+    //! Number of bytes transferred if the request succeeded
+    size_t size;
+};
+
+class MB_EXPORT AsyncFile : public File
+{
+public:
+    static constexpr unsigned int DEFAULT_QUEUE_DEPTH = 32;
+
+    AsyncFile();
+    AsyncFile(int fd, bool owned);
+    AsyncFile(const std::string &filename, FileOpenMode mode);
+    AsyncFile(const std::wstring &filename, FileOpenMode mode);
+    virtual ~AsyncFile();
+
+    AsyncFile(AsyncFile &&other) noexcept;
+    AsyncFile & operator=(AsyncFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AsyncFile)
+
+    // File open
+    oc::result<void> open(int fd, bool owned);
+    oc::result<void> open(const std::string &filename, FileOpenMode mode);
+    oc::result<void> open(const std::wstring &filename, FileOpenMode mode);
+
+    // Configuration (before opening)
+    oc::result<void> set_queue_depth(unsigned int depth);
+    oc::result<void> set_backend(AsyncBackend backend);
+
+    AsyncBackend backend();
+
+    // Completion-based I/O
+    oc::result<uint64_t> submit_read(uint64_t offset, void *buf, size_t size);
+    oc::result<uint64_t> submit_write(uint64_t offset, const void *buf,
+                                      size_t size);
+    oc::result<AsyncCompletion> wait();
+    size_t in_flight();
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<uint64_t> submit(bool write, uint64_t offset, void *buf,
+                                size_t size);
+    oc::result<void> reap_one();
+    oc::result<size_t> wait_for(uint64_t id);
+
+    int m_fd;
+    bool m_owned;
+    std::string m_filename;
+    int m_flags;
+
+    unsigned int m_queue_depth;
+    AsyncBackend m_backend;
+
+    std::unique_ptr<detail::AsyncEngine> m_engine;
+    uint64_t m_next_id;
+    size_t m_in_flight;
+    // Completions that were reaped but not yet returned by wait()
+    std::deque<AsyncCompletion> m_completed;
+
+    uint64_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+/*! \cond INTERNAL */
+namespace mb
+{
+
+struct AsyncCompletion;
+
+namespace detail
+{
+
+// Backend that performs the positional reads and writes for AsyncFile. The
+// caller guarantees that no more than the queue depth's worth of requests are
+// in flight at any time.
+class AsyncEngine
+{
+public:
+    virtual ~AsyncEngine();
+
+    virtual oc::result<void> submit(uint64_t id, bool write, uint64_t offset,
+                                    void *buf, size_t size) = 0;
+    // Block until a request completes
+    virtual oc::result<AsyncCompletion> reap() = 0;
+};
+
+}
+}
+/*! \endcond */
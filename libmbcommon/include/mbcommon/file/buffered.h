@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <string_view>
+#include <vector>
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 32 * 1024;
+
+    BufferedFile();
+    BufferedFile(File *file);
+    BufferedFile(File *file, size_t buf_size);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    // File open
+    oc::result<void> open(File *file);
+    oc::result<void> open(File *file, size_t buf_size);
+
+    // Zero-copy access
+    oc::result<std::string_view> peek(size_t size);
+    void consume(size_t size);
+
+    oc::result<void> flush();
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> flush_write();
+    oc::result<void> discard_read();
+
+    File *m_file;
+    size_t m_buf_size;
+
+    std::vector<unsigned char> m_buf;
+    // Unconsumed read-ahead data is in [m_read_pos, m_read_end)
+    size_t m_read_pos;
+    size_t m_read_end;
+    // Pending write-behind data is in [0, m_write_end)
+    size_t m_write_end;
+    /*! \endcond */
+};
+
+}
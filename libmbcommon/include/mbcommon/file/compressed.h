@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <memory>
+#include <system_error>
+#include <vector>
+
+namespace mb
+{
+
+namespace detail
+{
+class CompressionCodec;
+}
+
+enum class CompressionFormat
+{
+    Auto,
+    None,
+    Gzip,
+    Lz4Legacy,
+    Lz4Frame,
+    Xz,
+};
+
+enum class CompressionMode
+{
+    Decompress,
+    Compress,
+};
+
+enum class CompressedFileError
+{
+    UnsupportedFormat   = 10,
+    CorruptData         = 20,
+    CodecError          = 30,
+};
+
+MB_EXPORT std::error_code make_error_code(CompressedFileError e);
+
+MB_EXPORT const std::error_category & compressed_file_error_category();
+
+class MB_EXPORT CompressedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    CompressedFile();
+    CompressedFile(File *file, CompressionMode mode, CompressionFormat format);
+    virtual ~CompressedFile();
+
+    CompressedFile(CompressedFile &&other) noexcept;
+    CompressedFile & operator=(CompressedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompressedFile)
+
+    // File open
+    oc::result<void> open(File *file, CompressionMode mode,
+                          CompressionFormat format);
+
+    CompressionFormat format() const;
+    uint64_t compressed_offset() const;
+    uint64_t uncompressed_offset() const;
+
+    static bool is_supported(CompressionFormat format);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> fill_input();
+    oc::result<CompressionFormat> detect_format();
+    oc::result<void> write_output();
+
+    File *m_file;
+    CompressionMode m_mode;
+    CompressionFormat m_format;
+    std::unique_ptr<detail::CompressionCodec> m_codec;
+
+    // Compressed input not yet consumed by the codec is in
+    // [m_in_pos, m_in_end)
+    std::vector<unsigned char> m_in_buf;
+    size_t m_in_pos;
+    size_t m_in_end;
+    bool m_in_eof;
+    // Compressed output not yet written to the underlying file
+    std::vector<unsigned char> m_out_buf;
+    bool m_done;
+
+    uint64_t m_compressed_offset;
+    uint64_t m_uncompressed_offset;
+    /*! \endcond */
+};
+
+}
+
+namespace std
+{
+    template<>
+    struct MB_EXPORT is_error_code_enum<mb::CompressedFileError> : true_type
+    {
+    };
+}
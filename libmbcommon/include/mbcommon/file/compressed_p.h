@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/outcome.h"
+
+/*! \cond INTERNAL */
+namespace mb::detail
+{
+
+struct CodecStep
+{
+    // Number of input bytes consumed
+    size_t in_used;
+    // Number of output bytes produced
+    size_t out_used;
+    // Whether the end of the compressed stream was reached
+    bool done;
+};
+
+// Streaming compressor or decompressor used by CompressedFile
+class CompressionCodec
+{
+public:
+    virtual ~CompressionCodec();
+
+    // Decompress as much of the input into the output buffer as possible.
+    // in_eof is set when no more input will be provided after this chunk.
+    // Returning a step that neither consumes nor produces data when in_eof is
+    // set means that the stream is truncated.
+    virtual oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                             void *out, size_t out_size,
+                                             bool in_eof) = 0;
+
+    // Compress all of the input, appending any produced data to out
+    virtual oc::result<void> compress(const void *in, size_t in_size,
+                                      std::vector<unsigned char> &out) = 0;
+
+    // Flush all pending data and write the stream trailer to out
+    virtual oc::result<void> finish(std::vector<unsigned char> &out) = 0;
+};
+
+using CodecResult = oc::result<std::unique_ptr<CompressionCodec>>;
+
+#ifdef MBCOMMON_HAVE_ZLIB
+CodecResult create_gzip_codec(CompressionMode mode);
+#endif
+#ifdef MBCOMMON_HAVE_LZ4
+CodecResult create_lz4_codec(CompressionMode mode, bool legacy);
+#endif
+#ifdef MBCOMMON_HAVE_LZMA
+CodecResult create_xz_codec(CompressionMode mode);
+#endif
+
+}
+/*! \endcond */
@@ -60,6 +60,17 @@ protected:
     oc::result<void> on_close() override;
     oc::result<size_t> on_read(void *buf, size_t size) override;
     oc::result<size_t> on_write(const void *buf, size_t size) override;
+#ifndef _WIN32
+    oc::result<size_t> on_readv(const FileIoVec *iov, size_t count) override;
+    oc::result<size_t> on_writev(const FileConstIoVec *iov,
+                                 size_t count) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<uint64_t> on_copy_range(uint64_t src, uint64_t dest,
+                                       uint64_t size) override;
+#endif
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
 
@@ -44,6 +44,7 @@ protected:
     oc::result<void> on_close() override;
     oc::result<size_t> on_read(void *buf, size_t size) override;
     oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<FileConstIoVec> on_view(uint64_t offset, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include "mbcommon/file/mmap_p.h"
+
+namespace mb
+{
+
+enum class MmapAdvice
+{
+    Normal,
+    Sequential,
+    Random,
+    WillNeed,
+    DontNeed,
+};
+
+class MB_EXPORT MmapFile : public File
+{
+public:
+    MmapFile();
+    MmapFile(int fd, bool writable);
+    MmapFile(const std::string &filename, bool writable);
+    MmapFile(const std::wstring &filename, bool writable);
+    virtual ~MmapFile();
+
+    MmapFile(MmapFile &&other) noexcept;
+    MmapFile & operator=(MmapFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MmapFile)
+
+    oc::result<void> open(int fd, bool writable);
+    oc::result<void> open(const std::string &filename, bool writable);
+    oc::result<void> open(const std::wstring &filename, bool writable);
+
+    void * data();
+    size_t size();
+
+    oc::result<void> advise(MmapAdvice advice);
+
+protected:
+    /*! \cond INTERNAL */
+    MmapFile(detail::MmapFileFuncs *funcs);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             int fd, bool writable);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::string &filename, bool writable);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::wstring &filename, bool writable);
+    /*! \endcond */
+
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<FileConstIoVec> on_view(uint64_t offset, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    detail::MmapFileFuncs *m_funcs;
+
+    int m_fd;
+    std::string m_filename;
+    bool m_writable;
+
+    void *m_data;
+    size_t m_size;
+    size_t m_pos;
+    /*! \endcond */
+};
+
+}
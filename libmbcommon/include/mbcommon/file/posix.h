@@ -24,6 +24,8 @@
 #include "mbcommon/file/open_mode.h"
 #include "mbcommon/file/posix_p.h"
 
+#include <optional>
+
 #include <cstdio>
 
 namespace mb
@@ -47,6 +49,9 @@ public:
     oc::result<void> open(const std::string &filename, FileOpenMode mode);
     oc::result<void> open(const std::wstring &filename, FileOpenMode mode);
 
+    // Configuration (before opening)
+    oc::result<void> set_buffer_size(size_t size);
+
 protected:
     /*! \cond INTERNAL */
     PosixFile(detail::PosixFileFuncs *funcs);
@@ -62,12 +67,20 @@ protected:
     oc::result<void> on_close() override;
     oc::result<size_t> on_read(void *buf, size_t size) override;
     oc::result<size_t> on_write(const void *buf, size_t size) override;
+#ifndef _WIN32
+    oc::result<uint64_t> on_copy_range(uint64_t src, uint64_t dest,
+                                       uint64_t size) override;
+#endif
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
 
 private:
     /*! \cond INTERNAL */
     void clear();
+    oc::result<void> sync_stream();
+#ifndef _WIN32
+    oc::result<size_t> read_direct(void *buf, size_t size);
+#endif
 
     detail::PosixFileFuncs *m_funcs;
 
@@ -82,6 +95,16 @@ private:
 #endif
 
     bool m_can_seek;
+    bool m_append;
+
+    std::optional<size_t> m_buf_size;
+
+    // Cached stream position. If m_stale is set, the stdio position lags
+    // behind m_pos and must be restored before the next stdio call.
+    uint64_t m_pos;
+    bool m_pos_known;
+    bool m_stale;
+    bool m_unflushed;
     /*! \endcond */
 };
 
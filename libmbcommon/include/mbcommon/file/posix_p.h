@@ -39,6 +39,7 @@ struct PosixFileFuncs
     // stdio.h
     virtual int fn_fclose(FILE *stream) = 0;
     virtual int fn_ferror(FILE *stream) = 0;
+    virtual int fn_fflush(FILE *stream) = 0;
     virtual int fn_fileno(FILE *stream) = 0;
 #ifdef _WIN32
     virtual FILE * fn_wfopen(const wchar_t *filename, const wchar_t *mode) = 0;
@@ -51,9 +52,21 @@ struct PosixFileFuncs
     virtual off_t fn_ftello(FILE *stream) = 0;
     virtual size_t fn_fwrite(const void *ptr, size_t size, size_t nmemb,
                              FILE *stream) = 0;
+    virtual int fn_setvbuf(FILE *stream, char *buf, int mode, size_t size) = 0;
 
     // unistd.h
     virtual int fn_ftruncate64(int fd, off64_t length) = 0;
+#ifndef _WIN32
+    virtual ssize_t fn_pread64(int fd, void *buf, size_t count,
+                               off64_t offset) = 0;
+#endif
+
+#ifndef _WIN32
+    // sys/syscall.h
+    virtual ssize_t fn_copy_file_range(int fd_in, off64_t *off_in, int fd_out,
+                                       off64_t *off_out, size_t len,
+                                       unsigned int flags) = 0;
+#endif
 };
 
 }
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mb
+{
+
+enum class FileOp
+{
+    Read,
+    Write,
+    Readv,
+    Writev,
+    ReadAt,
+    WriteAt,
+    CopyRange,
+    Seek,
+    Truncate,
+};
+
+constexpr size_t FILE_OP_COUNT = static_cast<size_t>(FileOp::Truncate) + 1;
+
+struct FileOpStats
+{
+    static constexpr size_t HISTOGRAM_BUCKETS = 16;
+
+    //! Number of calls
+    uint64_t calls;
+    //! Number of calls that returned an error
+    uint64_t errors;
+    //! Number of bytes transferred
+    uint64_t bytes;
+    //! Number of reads or writes that transferred fewer bytes than requested
+    uint64_t short_transfers;
+    //! Total time spent in the underlying file
+    std::chrono::nanoseconds total_time;
+    //! Latency histogram (see TracingFile for the bucket boundaries)
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram;
+};
+
+class MB_EXPORT TracingFile : public File
+{
+public:
+    TracingFile();
+    TracingFile(File *file);
+    virtual ~TracingFile();
+
+    TracingFile(TracingFile &&other) noexcept;
+    TracingFile & operator=(TracingFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TracingFile)
+
+    // File open
+    oc::result<void> open(File *file);
+
+    // Statistics
+    const FileOpStats & stats(FileOp op) const;
+    void reset_stats();
+
+    std::string to_json(std::string_view label) const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<size_t> on_readv(const FileIoVec *iov, size_t count) override;
+    oc::result<size_t> on_writev(const FileConstIoVec *iov,
+                                 size_t count) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<uint64_t> on_copy_range(uint64_t src, uint64_t dest,
+                                       uint64_t size) override;
+    oc::result<FileConstIoVec> on_view(uint64_t offset, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    void record(FileOp op, std::chrono::steady_clock::time_point start,
+                bool success, uint64_t bytes,
+                std::optional<uint64_t> requested);
+
+    File *m_file;
+
+    std::array<FileOpStats, FILE_OP_COUNT> m_stats;
+    /*! \endcond */
+};
+
+MB_EXPORT const char * file_trace_path();
+MB_EXPORT oc::result<void> file_trace_write(const char *path,
+                                            std::string_view label,
+                                            const TracingFile &file);
+
+}
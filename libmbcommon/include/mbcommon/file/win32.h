@@ -47,6 +47,9 @@ public:
     oc::result<void> open(const std::string &filename, FileOpenMode mode);
     oc::result<void> open(const std::wstring &filename, FileOpenMode mode);
 
+    // Configuration (before opening)
+    oc::result<void> set_sequential_scan(bool enabled);
+
 protected:
     /*! \cond INTERNAL */
     Win32File(detail::Win32FileFuncs *funcs);
@@ -62,6 +65,10 @@ protected:
     oc::result<void> on_close() override;
     oc::result<size_t> on_read(void *buf, size_t size) override;
     oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
 
@@ -81,6 +88,7 @@ private:
     DWORD m_attrib;
 
     bool m_append;
+    bool m_sequential_scan;
 };
 
 }
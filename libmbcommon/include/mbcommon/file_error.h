@@ -37,6 +37,8 @@ enum class FileError
     UnsupportedWrite        = 31,
     UnsupportedSeek         = 32,
     UnsupportedTruncate     = 33,
+    UnsupportedCopyRange    = 34,
+    UnsupportedView         = 35,
 
     UnexpectedEof           = 40,
 
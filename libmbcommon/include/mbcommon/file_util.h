@@ -36,6 +36,24 @@ using FileSearchResultCallback =
         oc::result<FileSearchAction> (*)(File &file, void *userdata,
                                          uint64_t offset);
 
+struct FileSearchPattern
+{
+    const void *data;
+    size_t size;
+};
+
+struct FileMoveStats
+{
+    //! Number of bytes moved with File::copy_range()
+    uint64_t copy_range_bytes;
+    //! Number of bytes moved by reading into and writing from a buffer
+    uint64_t buffered_bytes;
+};
+
+using FileMultiSearchResultCallback =
+        oc::result<FileSearchAction> (*)(File &file, void *userdata,
+                                         size_t pattern_id, uint64_t offset);
+
 MB_EXPORT oc::result<size_t> file_read_retry(File &file,
                                              void *buf, size_t size);
 MB_EXPORT oc::result<size_t> file_write_retry(File &file,
@@ -57,7 +75,17 @@ MB_EXPORT oc::result<void> file_search(File &file,
                                        FileSearchResultCallback result_cb,
                                        void *userdata);
 
+MB_EXPORT oc::result<void>
+file_search_multi(File &file, std::optional<uint64_t> start,
+                  std::optional<uint64_t> end, size_t bsize,
+                  const FileSearchPattern *patterns, size_t pattern_count,
+                  std::optional<uint64_t> max_matches,
+                  FileMultiSearchResultCallback result_cb, void *userdata);
+
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
                                          uint64_t dest, uint64_t size);
+MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
+                                         uint64_t dest, uint64_t size,
+                                         FileMoveStats &stats);
 
 }
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <cstddef>
+
+namespace mb
+{
+
+namespace detail
+{
+struct ThreadPoolState;
+struct TaskGroupState;
+}
+
+/*!
+ * \brief Flag that lets a task know that its result is no longer wanted
+ *
+ * Copies share the same flag.
+ */
+class MB_EXPORT CancellationToken
+{
+public:
+    CancellationToken();
+
+    void cancel();
+    bool is_cancelled() const;
+
+private:
+    std::shared_ptr<std::atomic_bool> m_flag;
+};
+
+/*!
+ * \brief Work-stealing thread pool
+ *
+ * Each worker has its own deque of tasks. Tasks submitted from a worker go to
+ * the front of that worker's deque, which keeps related work on the same core,
+ * and idle workers steal from the back of the other deques. Tasks submitted
+ * from any other thread go to a shared queue, which is bounded so that a fast
+ * producer cannot queue up an unlimited amount of work.
+ *
+ * Use global() instead of creating a new pool so that every subsystem shares
+ * the same workers.
+ */
+class MB_EXPORT ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    //! Default limit on the number of tasks waiting in the shared queue
+    static constexpr size_t DEFAULT_QUEUE_LIMIT = 1024;
+
+    ThreadPool(unsigned int threads, size_t queue_limit);
+    ~ThreadPool();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ThreadPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ThreadPool)
+
+    void submit(Task task);
+    bool try_submit(Task task);
+    bool run_pending_task();
+
+    unsigned int thread_count() const;
+    unsigned int max_active_threads() const;
+    void set_max_active_threads(unsigned int threads);
+
+    static ThreadPool & global();
+    static void set_global_thread_limit(unsigned int threads);
+
+private:
+    /*! \cond INTERNAL */
+    std::unique_ptr<detail::ThreadPoolState> m_state;
+    /*! \endcond */
+};
+
+/*!
+ * \brief Set of tasks that can be waited for or cancelled together
+ *
+ * The destructor waits for all of the tasks to finish.
+ */
+class MB_EXPORT TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool &pool);
+    ~TaskGroup();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TaskGroup)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TaskGroup)
+
+    void run(ThreadPool::Task task);
+    void wait();
+
+    void cancel();
+    bool is_cancelled() const;
+    CancellationToken token() const;
+
+private:
+    /*! \cond INTERNAL */
+    ThreadPool &m_pool;
+    CancellationToken m_token;
+    std::shared_ptr<detail::TaskGroupState> m_state;
+    /*! \endcond */
+};
+
+MB_EXPORT void run_on_threads(ThreadPool &pool, unsigned int threads,
+                              const ThreadPool::Task &task);
+
+}
@@ -49,6 +49,30 @@ namespace mb
 
 using namespace detail;
 
+/*!
+ * \struct FileIoVec
+ *
+ * \brief Buffer descriptor for File::readv()
+ *
+ * \var FileIoVec::data
+ * \brief Buffer to read into
+ *
+ * \var FileIoVec::size
+ * \brief Buffer size
+ */
+
+/*!
+ * \struct FileConstIoVec
+ *
+ * \brief Buffer descriptor for File::writev()
+ *
+ * \var FileConstIoVec::data
+ * \brief Buffer to write from
+ *
+ * \var FileConstIoVec::size
+ * \brief Buffer size
+ */
+
 /*!
  * \class File
  *
@@ -251,6 +275,192 @@ oc::result<size_t> File::write(const void *buf, size_t size)
     return on_write(buf, size);
 }
 
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * The buffers are filled in order, as if File::read() were called for each of
+ * them, but subclasses may perform the whole operation with a single call (eg.
+ * `readv()`). Like File::read(), fewer bytes than the total size of the
+ * buffers may be read.
+ *
+ * Example usage:
+ *
+ * \code{.cpp}
+ * Header header;
+ * char payload[1024];
+ *
+ * FileIoVec iov[] = {
+ *     { &header, sizeof(header) },
+ *     { payload, sizeof(payload) },
+ * };
+ *
+ * auto n = file.readv(iov, 2);
+ * if (!n) {
+ *     printf("Failed to read file: %s\n", n.error().message().c_str());
+ * }
+ * \endcode
+ *
+ * \param iov Array of buffers to read into
+ * \param count Number of buffers in \p iov
+ *
+ * \return Total number of bytes read if some bytes were read or EOF was
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::readv(const FileIoVec *iov, size_t count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_readv(iov, count);
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * The buffers are written in order, as if File::write() were called for each of
+ * them, but subclasses may perform the whole operation with a single call (eg.
+ * `writev()`). Like File::write(), fewer bytes than the total size of the
+ * buffers may be written.
+ *
+ * \param iov Array of buffers to write from
+ * \param count Number of buffers in \p iov
+ *
+ * \return Total number of bytes written if some bytes were successfully
+ *         written or EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::writev(const FileConstIoVec *iov, size_t count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_writev(iov, count);
+}
+
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This is equivalent to calling File::seek() with \p offset and `SEEK_SET`
+ * followed by File::read(), but subclasses may perform the operation with a
+ * single call (eg. `pread()`). Backends that implement this natively allow
+ * multiple threads to read from the same handle concurrently.
+ *
+ * \note The file position after this function returns is unspecified. Be sure
+ *       to seek to a known location before calling File::read() or
+ *       File::write().
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return Number of bytes read if some bytes were read or EOF was reached.
+ *         Otherwise, the error code.
+ */
+oc::result<size_t> File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return on_read_at(offset, buf, size);
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This is equivalent to calling File::seek() with \p offset and `SEEK_SET`
+ * followed by File::write(), but subclasses may perform the operation with a
+ * single call (eg. `pwrite()`).
+ *
+ * \note The file position after this function returns is unspecified. Be sure
+ *       to seek to a known location before calling File::read() or
+ *       File::write().
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes that were written if some bytes were successfully
+ *         written or EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::write_at(uint64_t offset, const void *buf, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return on_write_at(offset, buf, size);
+}
+
+/*!
+ * \brief Copy data between two regions of a File handle.
+ *
+ * This copies up to \p size bytes from offset \p src to offset \p dest within
+ * the same file without passing through a userspace buffer. The source and
+ * destination regions must not overlap. Only some backends support this (eg.
+ * via `copy_file_range()`). All others return FileError::UnsupportedCopyRange.
+ * Most callers should use file_move() instead, which falls back to a buffered
+ * copy as needed.
+ *
+ * \note The file position after this function returns is unspecified. Be sure
+ *       to seek to a known location before calling File::read() or
+ *       File::write().
+ *
+ * \param src Source offset
+ * \param dest Destination offset
+ * \param size Number of bytes to copy
+ *
+ * \return Number of bytes copied if some bytes were copied or EOF was reached.
+ *         Otherwise, the error code.
+ */
+oc::result<uint64_t> File::copy_range(uint64_t src, uint64_t dest,
+                                      uint64_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    if (src > INT64_MAX || dest > INT64_MAX
+            || size > static_cast<uint64_t>(INT64_MAX) - src
+            || size > static_cast<uint64_t>(INT64_MAX) - dest) {
+        return FileError::ArgumentOutOfRange;
+    } else if (src < dest ? dest - src < size : src - dest < size) {
+        // Overlapping regions
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return on_copy_range(src, dest, size);
+}
+
+/*!
+ * \brief Get a pointer to a region of a File handle's backing storage.
+ *
+ * For backends that keep the entire file in memory (eg. MemoryFile and
+ * MmapFile), this returns a pointer directly into that memory so that the data
+ * can be consumed without being copied into a separate buffer. All other
+ * backends return FileError::UnsupportedView and the caller should fall back
+ * to File::read_at() or File::read().
+ *
+ * The returned region is only valid until the next write, truncate, or close
+ * operation on the file. The file position is not changed.
+ *
+ * \param offset File offset of the start of the region
+ * \param size Maximum size of the region
+ *
+ * \return Pointer to and size of the region if the view was successfully
+ *         obtained. The size may be less than \p size (and is 0 if \p offset
+ *         is at or beyond EOF). Otherwise, the error code.
+ */
+oc::result<FileConstIoVec> File::view(uint64_t offset, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return on_view(offset, size);
+}
+
 /*!
  * \brief Set file position of a File handle.
  *
@@ -461,6 +671,220 @@ oc::result<size_t> File::on_write(const void *buf, size_t size)
     return FileError::UnsupportedWrite;
 }
 
+/*!
+ * \brief File vectored read callback
+ *
+ * Subclasses can override this method to read into multiple buffers with a
+ * single operation.
+ *
+ * This method should return:
+ *
+ *   * The total number of bytes read if some bytes were successfully read or
+ *     EOF was reached
+ *   * std::errc::interrupted if no bytes were read and the same operation
+ *     should be reattempted
+ *   * A specific error for all other cases
+ *
+ * If this method is not overridden, it will call on_read() for each buffer
+ * until a short read occurs. If on_read() fails after some bytes have already
+ * been read, the number of bytes read so far is returned instead of the error.
+ *
+ * \param iov Array of buffers to read into
+ * \param count Number of buffers in \p iov
+ *
+ * \return Total number of bytes read or the error code from on_read()
+ */
+oc::result<size_t> File::on_readv(const FileIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = on_read(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File vectored write callback
+ *
+ * Subclasses can override this method to write from multiple buffers with a
+ * single operation.
+ *
+ * This method should return:
+ *
+ *   * The total number of bytes written if some bytes were successfully
+ *     written or EOF was reached
+ *   * std::errc::interrupted if no bytes were written and the same operation
+ *     should be reattempted
+ *   * A specific error for all other cases
+ *
+ * If this method is not overridden, it will call on_write() for each buffer
+ * until a short write occurs. If on_write() fails after some bytes have already
+ * been written, the number of bytes written so far is returned instead of the
+ * error.
+ *
+ * \param iov Array of buffers to write from
+ * \param count Number of buffers in \p iov
+ *
+ * \return Total number of bytes written or the error code from on_write()
+ */
+oc::result<size_t> File::on_writev(const FileConstIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = on_write(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File positional read callback
+ *
+ * Subclasses can override this method to read from a specific offset without
+ * a separate seek operation.
+ *
+ * This method should return the same values as on_read(). \p offset is
+ * guaranteed to be no larger than `INT64_MAX`.
+ *
+ * If this method is not overridden, it will call on_seek() and then on_read().
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return Number of bytes read or the error code from on_seek() or on_read()
+ */
+oc::result<size_t> File::on_read_at(uint64_t offset, void *buf, size_t size)
+{
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    return on_read(buf, size);
+}
+
+/*!
+ * \brief File positional write callback
+ *
+ * Subclasses can override this method to write to a specific offset without
+ * a separate seek operation.
+ *
+ * This method should return the same values as on_write(). \p offset is
+ * guaranteed to be no larger than `INT64_MAX`.
+ *
+ * If this method is not overridden, it will call on_seek() and then
+ * on_write().
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes written or the error code from on_seek() or
+ *         on_write()
+ */
+oc::result<size_t> File::on_write_at(uint64_t offset, const void *buf,
+                                     size_t size)
+{
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    return on_write(buf, size);
+}
+
+/*!
+ * \brief File copy range callback
+ *
+ * Subclasses can override this method to copy data between two regions of the
+ * file without a userspace buffer.
+ *
+ * This method should return:
+ *
+ *   * The number of bytes copied, which may be less than \p size
+ *   * 0 if \p src is at or beyond EOF
+ *   * FileError::UnsupportedCopyRange if the file cannot perform the copy
+ *     natively, in which case the caller should fall back to reading and
+ *     writing
+ *   * A specific error for all other cases
+ *
+ * \p src + \p size and \p dest + \p size are guaranteed to be no larger than
+ * `INT64_MAX` and the two regions are guaranteed not to overlap.
+ *
+ * If this method is not overridden, it will simply return
+ * FileError::UnsupportedCopyRange.
+ *
+ * \param src Source offset
+ * \param dest Destination offset
+ * \param size Number of bytes to copy
+ *
+ * \return Always returns #FileError::UnsupportedCopyRange
+ */
+oc::result<uint64_t> File::on_copy_range(uint64_t src, uint64_t dest,
+                                         uint64_t size)
+{
+    (void) src;
+    (void) dest;
+    (void) size;
+
+    return FileError::UnsupportedCopyRange;
+}
+
+/*!
+ * \brief File view callback
+ *
+ * Subclasses that keep the file contents in memory can override this method to
+ * expose a region of that memory directly.
+ *
+ * This method should return:
+ *
+ *   * A pointer to the data at \p offset and the number of bytes available
+ *     there, up to \p size
+ *   * A zero-sized region if \p offset is at or beyond EOF
+ *   * FileError::UnsupportedView if the file has no directly addressable
+ *     backing storage
+ *   * A specific error for all other cases
+ *
+ * \p offset is guaranteed to be no larger than `INT64_MAX`.
+ *
+ * If this method is not overridden, it will simply return
+ * FileError::UnsupportedView.
+ *
+ * \param offset File offset of the start of the region
+ * \param size Maximum size of the region
+ *
+ * \return Always returns #FileError::UnsupportedView
+ */
+oc::result<FileConstIoVec> File::on_view(uint64_t offset, size_t size)
+{
+    (void) offset;
+    (void) size;
+
+    return FileError::UnsupportedView;
+}
+
 /*!
  * \brief File seek callback
  *
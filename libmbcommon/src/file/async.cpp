@@ -0,0 +1,996 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/async.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) \
+        && __has_include(<linux/io_uring.h>)
+#  include <sys/mman.h>
+#  include <linux/io_uring.h>
+#  define HAVE_IO_URING 1
+#endif
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/async.h
+ * \brief Open file with completion-based asynchronous I/O
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+//! Largest transfer done by a single request (Linux's MAX_RW_COUNT)
+static constexpr size_t MAX_REQUEST_SIZE = 0x7ffff000;
+
+//! Maximum number of worker threads used by the thread pool backend
+static constexpr unsigned int MAX_THREADS = 4;
+
+/*! \cond INTERNAL */
+
+AsyncEngine::~AsyncEngine() = default;
+
+#ifdef HAVE_IO_URING
+class IoUringEngine : public AsyncEngine
+{
+public:
+    IoUringEngine(int fd)
+        : m_fd(fd)
+    {
+    }
+
+    ~IoUringEngine() override
+    {
+        if (m_sqes) {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ring && m_cq_ring != m_sq_ring) {
+            munmap(m_cq_ring, m_cq_ring_size);
+        }
+        if (m_sq_ring) {
+            munmap(m_sq_ring, m_sq_ring_size);
+        }
+        if (m_ring_fd >= 0) {
+            close(m_ring_fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(IoUringEngine)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(IoUringEngine)
+
+    oc::result<void> init(unsigned int depth)
+    {
+        io_uring_params params{};
+
+        m_ring_fd = static_cast<int>(
+                syscall(__NR_io_uring_setup, depth, &params));
+        if (m_ring_fd < 0) {
+            return ec_from_errno();
+        }
+
+        m_sq_ring_size = params.sq_off.array
+                + params.sq_entries * sizeof(uint32_t);
+        m_cq_ring_size = params.cq_off.cqes
+                + params.cq_entries * sizeof(io_uring_cqe);
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_sq_ring_size = m_cq_ring_size =
+                    std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                         IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED) {
+            m_sq_ring = nullptr;
+            return ec_from_errno();
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_cq_ring = m_sq_ring;
+        } else {
+            m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                             IORING_OFF_CQ_RING);
+            if (m_cq_ring == MAP_FAILED) {
+                m_cq_ring = nullptr;
+                return ec_from_errno();
+            }
+        }
+
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                          IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return ec_from_errno();
+        }
+        m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+        auto sq = static_cast<char *>(m_sq_ring);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char *>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // The iovecs must remain valid until the requests complete
+        m_slots.resize(depth);
+        for (unsigned int i = depth; i > 0; --i) {
+            m_free_slots.push_back(i - 1);
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> submit(uint64_t id, bool write, uint64_t offset,
+                            void *buf, size_t size) override
+    {
+        unsigned int slot = m_free_slots.back();
+        m_slots[slot].id = id;
+        m_slots[slot].iov.iov_base = buf;
+        m_slots[slot].iov.iov_len = size;
+
+        unsigned int tail = *m_sq_tail;
+        unsigned int index = tail & m_sq_mask;
+
+        io_uring_sqe *sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        // IORING_OP_READV/WRITEV are supported by every kernel with io_uring
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = m_fd;
+        sqe->off = offset;
+        sqe->addr = reinterpret_cast<uintptr_t>(&m_slots[slot].iov);
+        sqe->len = 1;
+        sqe->user_data = slot;
+
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        while (true) {
+            auto ret = syscall(__NR_io_uring_enter, m_ring_fd, 1, 0, 0,
+                               nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                // The kernel did not consume the entry, so take it back
+                int errno_to_report = errno;
+                __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+                return ec_from_errno(errno_to_report);
+            }
+            break;
+        }
+
+        m_free_slots.pop_back();
+
+        return oc::success();
+    }
+
+    oc::result<AsyncCompletion> reap() override
+    {
+        while (true) {
+            unsigned int head = *m_cq_head;
+
+            if (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+                auto slot = static_cast<unsigned int>(cqe->user_data);
+                int res = cqe->res;
+
+                __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+                m_free_slots.push_back(slot);
+
+                AsyncCompletion c{m_slots[slot].id, {}, 0};
+                if (res < 0) {
+                    c.error = ec_from_errno(-res);
+                } else {
+                    c.size = static_cast<size_t>(res);
+                }
+                return c;
+            }
+
+            auto ret = syscall(__NR_io_uring_enter, m_ring_fd, 0, 1,
+                               IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0 && errno != EINTR) {
+                return ec_from_errno();
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t id;
+        iovec iov;
+    };
+
+    int m_fd;
+    int m_ring_fd = -1;
+
+    void *m_sq_ring = nullptr;
+    size_t m_sq_ring_size = 0;
+    void *m_cq_ring = nullptr;
+    size_t m_cq_ring_size = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqes_size = 0;
+
+    unsigned int *m_sq_tail = nullptr;
+    unsigned int m_sq_mask = 0;
+    unsigned int *m_sq_array = nullptr;
+    unsigned int *m_cq_head = nullptr;
+    unsigned int *m_cq_tail = nullptr;
+    unsigned int m_cq_mask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    std::vector<Slot> m_slots;
+    std::vector<unsigned int> m_free_slots;
+};
+#endif
+
+class ThreadPoolEngine : public AsyncEngine
+{
+public:
+    ThreadPoolEngine(int fd, unsigned int depth)
+        : m_fd(fd)
+    {
+        unsigned int n_threads = std::min(depth, MAX_THREADS);
+
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            m_threads.emplace_back(&ThreadPoolEngine::worker, this);
+        }
+    }
+
+    ~ThreadPoolEngine() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_queue_cv.notify_all();
+
+        for (auto &t : m_threads) {
+            t.join();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ThreadPoolEngine)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ThreadPoolEngine)
+
+    oc::result<void> submit(uint64_t id, bool write, uint64_t offset,
+                            void *buf, size_t size) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back({id, write, offset, buf, size});
+        }
+        m_queue_cv.notify_one();
+
+        return oc::success();
+    }
+
+    oc::result<AsyncCompletion> reap() override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [&] { return !m_done.empty(); });
+
+        auto c = std::move(m_done.front());
+        m_done.pop_front();
+
+        return c;
+    }
+
+private:
+    struct Request
+    {
+        uint64_t id;
+        bool write;
+        uint64_t offset;
+        void *buf;
+        size_t size;
+    };
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_queue_cv.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+            if (m_stop) {
+                return;
+            }
+
+            Request req = m_queue.front();
+            m_queue.pop_front();
+
+            lock.unlock();
+
+            ssize_t n;
+            do {
+                if (req.write) {
+                    n = pwrite64(m_fd, req.buf, req.size,
+                                 static_cast<off64_t>(req.offset));
+                } else {
+                    n = pread64(m_fd, req.buf, req.size,
+                                static_cast<off64_t>(req.offset));
+                }
+            } while (n < 0 && errno == EINTR);
+
+            AsyncCompletion c{req.id, {}, 0};
+            if (n < 0) {
+                c.error = ec_from_errno();
+            } else {
+                c.size = static_cast<size_t>(n);
+            }
+
+            lock.lock();
+            m_done.push_back(std::move(c));
+            m_done_cv.notify_one();
+        }
+    }
+
+    int m_fd;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_cv;
+    std::condition_variable m_done_cv;
+    std::deque<Request> m_queue;
+    std::deque<AsyncCompletion> m_done;
+    bool m_stop = false;
+};
+
+static int convert_mode(FileOpenMode mode)
+{
+    int ret = O_CLOEXEC;
+
+    switch (mode) {
+    case FileOpenMode::ReadOnly:
+        ret |= O_RDONLY;
+        break;
+    case FileOpenMode::ReadWrite:
+        ret |= O_RDWR;
+        break;
+    case FileOpenMode::WriteOnly:
+        ret |= O_WRONLY | O_CREAT | O_TRUNC;
+        break;
+    case FileOpenMode::ReadWriteTrunc:
+        ret |= O_RDWR | O_CREAT | O_TRUNC;
+        break;
+    case FileOpenMode::Append:
+        ret |= O_WRONLY | O_CREAT | O_APPEND;
+        break;
+    case FileOpenMode::ReadAppend:
+        ret |= O_RDWR | O_CREAT | O_APPEND;
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+/*! \endcond */
+
+/*!
+ * \enum AsyncBackend
+ *
+ * \brief Backend used by AsyncFile to perform I/O
+ *
+ * \var AsyncBackend::Auto
+ * \brief Use io_uring if the kernel supports it. Otherwise, use a thread pool.
+ *
+ * \var AsyncBackend::IoUring
+ * \brief Use io_uring (Linux 5.1 or newer)
+ *
+ * \var AsyncBackend::ThreadPool
+ * \brief Use a small pool of threads performing `pread()` and `pwrite()`
+ */
+
+/*!
+ * \struct AsyncCompletion
+ *
+ * \brief Result of a request submitted to an AsyncFile
+ */
+
+/*!
+ * \class AsyncFile
+ *
+ * \brief Open file with completion-based asynchronous I/O.
+ *
+ * Reads and writes can be submitted with submit_read() and submit_write()
+ * without waiting for them to complete. Up to the queue depth's worth of
+ * requests may be in flight at once. Completions are collected with wait().
+ * The buffers passed to the submit functions must remain valid until the
+ * corresponding completion is returned or the handle is closed.
+ *
+ * The normal File functions are also supported. They submit a single request
+ * and wait for it to complete, so AsyncFile can be passed to existing code that
+ * expects a synchronous File handle. Completions of other requests that are
+ * reaped while waiting are kept and returned by later calls to wait().
+ *
+ * On Linux, io_uring is used if the kernel supports it. Otherwise, requests
+ * are performed by a small thread pool.
+ */
+
+/*!
+ * \var AsyncFile::DEFAULT_QUEUE_DEPTH
+ *
+ * \brief Default maximum number of requests in flight
+ */
+
+/*!
+ * \brief Construct unbound AsyncFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+AsyncFile::AsyncFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int, bool)
+ *
+ * \param fd File descriptor
+ * \param owned If true, the file descriptor will be closed when the File
+ *              handle is closed
+ */
+AsyncFile::AsyncFile(int fd, bool owned)
+    : AsyncFile()
+{
+    (void) open(fd, owned);
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &, FileOpenMode)
+ *
+ * \param filename MBS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+AsyncFile::AsyncFile(const std::string &filename, FileOpenMode mode)
+    : AsyncFile()
+{
+    (void) open(filename, mode);
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &, FileOpenMode)
+ *
+ * \param filename WCS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+AsyncFile::AsyncFile(const std::wstring &filename, FileOpenMode mode)
+    : AsyncFile()
+{
+    (void) open(filename, mode);
+}
+
+AsyncFile::~AsyncFile()
+{
+    (void) close();
+}
+
+AsyncFile::AsyncFile(AsyncFile &&other) noexcept
+    : File(std::move(other))
+    , m_fd(other.m_fd)
+    , m_owned(other.m_owned)
+    , m_filename(std::move(other.m_filename))
+    , m_flags(other.m_flags)
+    , m_queue_depth(other.m_queue_depth)
+    , m_backend(other.m_backend)
+    , m_engine(std::move(other.m_engine))
+    , m_next_id(other.m_next_id)
+    , m_in_flight(other.m_in_flight)
+    , m_completed(std::move(other.m_completed))
+    , m_pos(other.m_pos)
+{
+    other.clear();
+}
+
+AsyncFile & AsyncFile::operator=(AsyncFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_fd = rhs.m_fd;
+    m_owned = rhs.m_owned;
+    m_filename.swap(rhs.m_filename);
+    m_flags = rhs.m_flags;
+    m_queue_depth = rhs.m_queue_depth;
+    m_backend = rhs.m_backend;
+    m_engine = std::move(rhs.m_engine);
+    m_next_id = rhs.m_next_id;
+    m_in_flight = rhs.m_in_flight;
+    m_completed = std::move(rhs.m_completed);
+    m_pos = rhs.m_pos;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open from file descriptor.
+ *
+ * \param fd File descriptor
+ * \param owned If true, the file descriptor will be closed when the File
+ *              handle is closed
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> AsyncFile::open(int fd, bool owned)
+{
+    if (state() == FileState::New) {
+        m_fd = fd;
+        m_owned = owned;
+        m_filename.clear();
+        m_flags = 0;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a multi-byte filename.
+ *
+ * \param filename MBS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> AsyncFile::open(const std::string &filename,
+                                 FileOpenMode mode)
+{
+    if (state() == FileState::New) {
+        int flags = convert_mode(mode);
+        if (flags < 0) {
+            MB_UNREACHABLE("Invalid mode: %d", static_cast<int>(mode));
+        }
+
+        m_fd = -1;
+        m_owned = true;
+        m_filename = filename;
+        m_flags = flags;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> AsyncFile::open(const std::wstring &filename,
+                                 FileOpenMode mode)
+{
+    if (state() == FileState::New) {
+        auto converted = wcs_to_mbs(filename);
+        if (!converted) {
+            return FileError::CannotConvertEncoding;
+        }
+
+        return open(converted.value(), mode);
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Set maximum number of requests in flight
+ *
+ * This can only be called before the file is opened. The default is
+ * #DEFAULT_QUEUE_DEPTH.
+ *
+ * \param depth Queue depth. Must not be 0.
+ *
+ * \return Nothing if the queue depth is set. Otherwise, the error code.
+ */
+oc::result<void> AsyncFile::set_queue_depth(unsigned int depth)
+{
+    if (state() != FileState::New) {
+        return FileError::InvalidState;
+    } else if (depth == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    m_queue_depth = depth;
+    return oc::success();
+}
+
+/*!
+ * \brief Set backend to use for I/O
+ *
+ * This can only be called before the file is opened. The default is
+ * AsyncBackend::Auto. If AsyncBackend::IoUring is chosen and the kernel does
+ * not support io_uring, then opening the file will fail.
+ *
+ * \param backend I/O backend
+ *
+ * \return Nothing if the backend is set. Otherwise, the error code.
+ */
+oc::result<void> AsyncFile::set_backend(AsyncBackend backend)
+{
+    if (state() != FileState::New) {
+        return FileError::InvalidState;
+    }
+
+    m_backend = backend;
+    return oc::success();
+}
+
+/*!
+ * \brief Get backend used for I/O
+ *
+ * \return The backend in use if the file is opened. Otherwise, the backend that
+ *         was requested with set_backend().
+ */
+AsyncBackend AsyncFile::backend()
+{
+    return m_backend;
+}
+
+/*!
+ * \brief Submit an asynchronous read
+ *
+ * If the maximum number of requests are already in flight, this function
+ * blocks until one of them completes. The completion is kept and returned by
+ * a later call to wait().
+ *
+ * \note Requests larger than 0x7ffff000 bytes are truncated to that size.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into. It must remain valid until the request
+ *                 completes.
+ * \param[in] size Buffer size
+ *
+ * \return ID of the request if it was submitted. Otherwise, the error code.
+ */
+oc::result<uint64_t> AsyncFile::submit_read(uint64_t offset, void *buf,
+                                            size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return submit(false, offset, buf, size);
+}
+
+/*!
+ * \brief Submit an asynchronous write
+ *
+ * \sa submit_read()
+ *
+ * \param offset File offset to write to. This is ignored if the file was opened
+ *               in append mode.
+ * \param buf Buffer to write from. It must remain valid until the request
+ *            completes.
+ * \param size Buffer size
+ *
+ * \return ID of the request if it was submitted. Otherwise, the error code.
+ */
+oc::result<uint64_t> AsyncFile::submit_write(uint64_t offset, const void *buf,
+                                             size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return submit(true, offset, const_cast<void *>(buf), size);
+}
+
+/*!
+ * \brief Wait for a request to complete
+ *
+ * Completions are not necessarily returned in the order that the requests were
+ * submitted.
+ *
+ * \return Completion of a request if one completes. FileError::InvalidState if
+ *         there are no requests in flight. Otherwise, the error code.
+ */
+oc::result<AsyncCompletion> AsyncFile::wait()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_completed.empty()) {
+        if (m_in_flight == 0) {
+            return FileError::InvalidState;
+        }
+
+        OUTCOME_TRYV(reap_one());
+    }
+
+    auto c = std::move(m_completed.front());
+    m_completed.pop_front();
+
+    return c;
+}
+
+/*!
+ * \brief Get number of requests whose completions have not been returned by
+ *        wait()
+ *
+ * \return Number of pending requests
+ */
+size_t AsyncFile::in_flight()
+{
+    return m_in_flight + m_completed.size();
+}
+
+oc::result<void> AsyncFile::on_open()
+{
+    if (!m_filename.empty()) {
+        m_fd = ::open(m_filename.c_str(), m_flags, 0666);
+        if (m_fd < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    struct stat sb;
+
+    if (fstat(m_fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    }
+
+#ifdef HAVE_IO_URING
+    if (m_backend == AsyncBackend::Auto
+            || m_backend == AsyncBackend::IoUring) {
+        auto engine = std::make_unique<IoUringEngine>(m_fd);
+
+        auto ret = engine->init(m_queue_depth);
+        if (ret) {
+            m_engine = std::move(engine);
+            m_backend = AsyncBackend::IoUring;
+        } else if (m_backend == AsyncBackend::IoUring) {
+            return ret.as_failure();
+        }
+    }
+#else
+    if (m_backend == AsyncBackend::IoUring) {
+        return std::make_error_code(std::errc::function_not_supported);
+    }
+#endif
+
+    if (!m_engine) {
+        m_engine = std::make_unique<ThreadPoolEngine>(m_fd, m_queue_depth);
+        m_backend = AsyncBackend::ThreadPool;
+    }
+
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<void> AsyncFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    // Buffers may still be referenced by requests in flight
+    while (m_in_flight > 0 && reap_one()) {
+    }
+    m_engine.reset();
+
+    if (m_owned && m_fd >= 0 && ::close(m_fd) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> AsyncFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> AsyncFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_write_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> AsyncFile::on_read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    OUTCOME_TRY(id, submit(false, offset, buf, size));
+
+    return wait_for(id);
+}
+
+oc::result<size_t> AsyncFile::on_write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+    OUTCOME_TRY(id, submit(true, offset, const_cast<void *>(buf), size));
+
+    return wait_for(id);
+}
+
+oc::result<uint64_t> AsyncFile::on_seek(int64_t offset, int whence)
+{
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<uint64_t>(offset);
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > m_pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > INT64_MAX - m_pos)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos += static_cast<uint64_t>(offset);
+    case SEEK_END: {
+        off64_t pos = lseek64(m_fd, offset, SEEK_END);
+        if (pos < 0) {
+            return ec_from_errno();
+        }
+        return m_pos = static_cast<uint64_t>(pos);
+    }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<void> AsyncFile::on_truncate(uint64_t size)
+{
+    if (ftruncate64(m_fd, static_cast<off64_t>(size)) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+void AsyncFile::clear()
+{
+    m_fd = -1;
+    m_owned = false;
+    m_filename.clear();
+    m_flags = 0;
+    m_queue_depth = DEFAULT_QUEUE_DEPTH;
+    m_backend = AsyncBackend::Auto;
+    m_engine.reset();
+    m_next_id = 0;
+    m_in_flight = 0;
+    m_completed.clear();
+    m_pos = 0;
+}
+
+oc::result<uint64_t> AsyncFile::submit(bool write, uint64_t offset, void *buf,
+                                       size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Make room for the new request
+    if (m_in_flight >= m_queue_depth) {
+        OUTCOME_TRYV(reap_one());
+    }
+
+    uint64_t id = m_next_id++;
+
+    OUTCOME_TRYV(m_engine->submit(id, write, offset, buf,
+                                  std::min(size, MAX_REQUEST_SIZE)));
+    ++m_in_flight;
+
+    return id;
+}
+
+oc::result<void> AsyncFile::reap_one()
+{
+    auto c = m_engine->reap();
+    if (!c) {
+        // Requests can no longer be tracked
+        set_fatal();
+        return c.as_failure();
+    }
+
+    --m_in_flight;
+    m_completed.push_back(std::move(c.value()));
+
+    return oc::success();
+}
+
+oc::result<size_t> AsyncFile::wait_for(uint64_t id)
+{
+    while (true) {
+        for (auto it = m_completed.begin(); it != m_completed.end(); ++it) {
+            if (it->id == id) {
+                auto c = std::move(*it);
+                m_completed.erase(it);
+
+                if (c.error) {
+                    return c.error;
+                }
+                return c.size;
+            }
+        }
+
+        OUTCOME_TRYV(reap_one());
+    }
+}
+
+}
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Buffered reading and writing on top of another File handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Add read-ahead and write-behind buffering to another File handle.
+ *
+ * Reads smaller than the buffer size are served from a buffer that is filled
+ * with as much data as possible from the underlying file. Writes smaller than
+ * the buffer size are collected and written to the underlying file in one
+ * operation when the buffer fills up, when switching from writing to reading
+ * or seeking, or when flush() or close() is called. Operations larger than the
+ * buffer bypass it entirely.
+ *
+ * peek() and consume() allow parsers to access buffered data directly without
+ * copying it.
+ *
+ * The underlying File handle is not closed when the BufferedFile is closed.
+ * It must not be used directly while the BufferedFile is open because the
+ * underlying file position does not match the buffered file position.
+ */
+
+/*!
+ * \var BufferedFile::DEFAULT_BUFFER_SIZE
+ *
+ * \brief Default buffer size used by the constructors and open functions that
+ *        do not take a buffer size
+ */
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+BufferedFile::BufferedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open buffered file from File handle with the default buffer size.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *)
+ *
+ * \param file File to open
+ */
+BufferedFile::BufferedFile(File *file)
+    : BufferedFile(file, DEFAULT_BUFFER_SIZE)
+{
+}
+
+/*!
+ * \brief Open buffered file from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t)
+ *
+ * \param file File to open
+ * \param buf_size Buffer size
+ */
+BufferedFile::BufferedFile(File *file, size_t buf_size)
+    : BufferedFile()
+{
+    (void) open(file, buf_size);
+}
+
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_buf_size(other.m_buf_size)
+    , m_buf(std::move(other.m_buf))
+    , m_read_pos(other.m_read_pos)
+    , m_read_end(other.m_read_end)
+    , m_write_end(other.m_write_end)
+{
+    other.clear();
+}
+
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_buf_size = rhs.m_buf_size;
+    m_buf.swap(rhs.m_buf);
+    m_read_pos = rhs.m_read_pos;
+    m_read_end = rhs.m_read_end;
+    m_write_end = rhs.m_write_end;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open buffered file from File handle with the default buffer size.
+ *
+ * \param file File to open
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file)
+{
+    return open(file, DEFAULT_BUFFER_SIZE);
+}
+
+/*!
+ * \brief Open buffered file from File handle.
+ *
+ * \p file must already be opened. The file position of \p file is used as the
+ * initial file position.
+ *
+ * \param file File to open
+ * \param buf_size Buffer size. This is also the maximum size that can be
+ *                 passed to peek(). Must not be 0.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file, size_t buf_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_buf_size = buf_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get pointer to buffered data without copying it.
+ *
+ * If fewer than \p size bytes are currently buffered, more data is read from
+ * the underlying file. The buffered data is not consumed. Call consume() to
+ * advance the file position past the data once it has been processed.
+ *
+ * \note The returned view is only valid until the next operation on the File
+ *       handle, other than consume().
+ *
+ * \param size Number of bytes to peek. Must not exceed the buffer size.
+ *
+ * \return View of up to \p size bytes of buffered data. Fewer bytes are only
+ *         returned if EOF is reached. If \p size is larger than the buffer
+ *         size, FileError::ArgumentOutOfRange is returned. Otherwise, the error
+ *         code.
+ */
+oc::result<std::string_view> BufferedFile::peek(size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (size > m_buf.size()) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRYV(flush_write());
+
+    if (m_read_end - m_read_pos < size) {
+        // Move unconsumed data to the beginning to get enough space
+        size_t remain = m_read_end - m_read_pos;
+        memmove(m_buf.data(), m_buf.data() + m_read_pos, remain);
+        m_read_pos = 0;
+        m_read_end = remain;
+
+        // Read ahead as much as possible
+        while (m_read_end < size) {
+            auto n = m_file->read(m_buf.data() + m_read_end,
+                                  m_buf.size() - m_read_end);
+            if (!n) {
+                if (n.error() == std::errc::interrupted) {
+                    continue;
+                }
+                if (m_file->is_fatal()) { set_fatal(); }
+                return n.as_failure();
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            m_read_end += n.value();
+        }
+    }
+
+    return std::string_view(
+            reinterpret_cast<const char *>(m_buf.data()) + m_read_pos,
+            std::min(m_read_end - m_read_pos, size));
+}
+
+/*!
+ * \brief Consume buffered data.
+ *
+ * Advance the file position by \p size bytes. \p size must not exceed the size
+ * of the data returned by the previous call to peek().
+ *
+ * \param size Number of bytes to consume
+ */
+void BufferedFile::consume(size_t size)
+{
+    assert(size <= m_read_end - m_read_pos);
+
+    m_read_pos += std::min(size, m_read_end - m_read_pos);
+}
+
+/*!
+ * \brief Write pending data to the underlying file.
+ *
+ * \return Nothing if all pending data was written. Otherwise, the error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return flush_write();
+}
+
+oc::result<void> BufferedFile::on_open()
+{
+    if (!m_file || !m_file->is_open() || m_buf_size == 0) {
+        return FileError::InvalidState;
+    }
+
+    m_buf.resize(m_buf_size);
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_file) {
+        return flush_write();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> BufferedFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRYV(flush_write());
+
+    if (m_read_pos == m_read_end) {
+        // Bypass the buffer for large reads
+        if (size >= m_buf.size()) {
+            return m_file->read(buf, size);
+        }
+
+        OUTCOME_TRY(n, m_file->read(m_buf.data(), m_buf.size()));
+
+        m_read_pos = 0;
+        m_read_end = n;
+    }
+
+    size_t to_copy = std::min(m_read_end - m_read_pos, size);
+    memcpy(buf, m_buf.data() + m_read_pos, to_copy);
+    m_read_pos += to_copy;
+
+    return to_copy;
+}
+
+oc::result<size_t> BufferedFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRYV(discard_read());
+
+    if (size > m_buf.size() - m_write_end) {
+        OUTCOME_TRYV(flush_write());
+
+        // Bypass the buffer for large writes
+        if (size >= m_buf.size()) {
+            return m_file->write(buf, size);
+        }
+    }
+
+    memcpy(m_buf.data() + m_write_end, buf, size);
+    m_write_end += size;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::on_seek(int64_t offset, int whence)
+{
+    OUTCOME_TRYV(flush_write());
+
+    size_t unread = m_read_end - m_read_pos;
+
+    if (whence == SEEK_CUR && unread > 0) {
+        // The underlying file position is ahead by the unread amount
+        OUTCOME_TRY(file_pos, m_file->seek(0, SEEK_CUR));
+        uint64_t pos = file_pos - unread;
+
+        // Seek within the buffer if possible
+        if ((offset < 0 && static_cast<uint64_t>(-offset) <= m_read_pos)
+                || (offset >= 0 && static_cast<uint64_t>(offset) <= unread)) {
+            m_read_pos = static_cast<size_t>(
+                    static_cast<int64_t>(m_read_pos) + offset);
+            return static_cast<uint64_t>(static_cast<int64_t>(pos) + offset);
+        }
+
+        offset -= static_cast<int64_t>(unread);
+    }
+
+    OUTCOME_TRY(new_pos, m_file->seek(offset, whence));
+
+    m_read_pos = 0;
+    m_read_end = 0;
+
+    return new_pos;
+}
+
+oc::result<void> BufferedFile::on_truncate(uint64_t size)
+{
+    OUTCOME_TRYV(flush_write());
+
+    return m_file->truncate(size);
+}
+
+void BufferedFile::clear()
+{
+    m_file = nullptr;
+    m_buf_size = 0;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_read_pos = 0;
+    m_read_end = 0;
+    m_write_end = 0;
+}
+
+/*!
+ * \brief Write all pending data to the underlying file
+ */
+oc::result<void> BufferedFile::flush_write()
+{
+    if (m_write_end > 0) {
+        auto ret = file_write_exact(*m_file, m_buf.data(), m_write_end);
+        if (!ret) {
+            if (m_file->is_fatal()) { set_fatal(); }
+            return ret.as_failure();
+        }
+
+        m_write_end = 0;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Drop read-ahead data and move the underlying file position back
+ */
+oc::result<void> BufferedFile::discard_read()
+{
+    size_t unread = m_read_end - m_read_pos;
+
+    if (unread > 0) {
+        OUTCOME_TRYV(m_file->seek(-static_cast<int64_t>(unread), SEEK_CUR));
+    }
+
+    m_read_pos = 0;
+    m_read_end = 0;
+
+    return oc::success();
+}
+
+}
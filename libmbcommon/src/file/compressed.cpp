@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed.h"
+
+#include <algorithm>
+#include <string>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file/compressed_p.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/compressed.h
+ * \brief Transparent compression and decompression on top of another File
+ *        handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+namespace detail
+{
+
+CompressionCodec::~CompressionCodec() = default;
+
+}
+/*! \endcond */
+
+namespace
+{
+
+constexpr unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+constexpr unsigned char LZ4_LEGACY_MAGIC[] = { 0x02, 0x21, 0x4c, 0x18 };
+constexpr unsigned char LZ4_FRAME_MAGIC[] = { 0x04, 0x22, 0x4d, 0x18 };
+constexpr unsigned char XZ_MAGIC[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+
+constexpr size_t MAX_MAGIC_SIZE = sizeof(XZ_MAGIC);
+
+constexpr size_t SEEK_BUF_SIZE = 16384;
+
+struct CompressedFileErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+
+    std::error_condition
+    default_error_condition(int code) const noexcept override;
+};
+
+const char * CompressedFileErrorCategory::name() const noexcept
+{
+    return "compressed_file";
+}
+
+std::string CompressedFileErrorCategory::message(int ev) const
+{
+    switch (static_cast<CompressedFileError>(ev)) {
+    case CompressedFileError::UnsupportedFormat:
+        return "compression format not supported";
+    case CompressedFileError::CorruptData:
+        return "compressed data is corrupt";
+    case CompressedFileError::CodecError:
+        return "compression library error";
+    default:
+        return "(unknown compressed file error)";
+    }
+}
+
+std::error_condition
+CompressedFileErrorCategory::default_error_condition(int code) const noexcept
+{
+    switch (static_cast<CompressedFileError>(code)) {
+    case CompressedFileError::UnsupportedFormat:
+        return FileErrorC::Unsupported;
+    default:
+        return FileErrorC::InternalError;
+    }
+}
+
+//! Pass-through codec for uncompressed data
+class NoneCodec : public CompressionCodec
+{
+public:
+    oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                     void *out, size_t out_size,
+                                     bool in_eof) override
+    {
+        size_t n = std::min(in_size, out_size);
+        if (n > 0) {
+            memcpy(out, in, n);
+        }
+
+        return CodecStep{n, n, in_eof && n == in_size};
+    }
+
+    oc::result<void> compress(const void *in, size_t in_size,
+                              std::vector<unsigned char> &out) override
+    {
+        auto begin = static_cast<const unsigned char *>(in);
+        out.insert(out.end(), begin, begin + in_size);
+        return oc::success();
+    }
+
+    oc::result<void> finish(std::vector<unsigned char> &out) override
+    {
+        (void) out;
+        return oc::success();
+    }
+};
+
+CodecResult create_codec(CompressionFormat format, CompressionMode mode)
+{
+    switch (format) {
+    case CompressionFormat::None:
+        return std::make_unique<NoneCodec>();
+#ifdef MBCOMMON_HAVE_ZLIB
+    case CompressionFormat::Gzip:
+        return create_gzip_codec(mode);
+#endif
+#ifdef MBCOMMON_HAVE_LZ4
+    case CompressionFormat::Lz4Legacy:
+        return create_lz4_codec(mode, true);
+    case CompressionFormat::Lz4Frame:
+        return create_lz4_codec(mode, false);
+#endif
+#ifdef MBCOMMON_HAVE_LZMA
+    case CompressionFormat::Xz:
+        return create_xz_codec(mode);
+#endif
+    default:
+        (void) mode;
+        return CompressedFileError::UnsupportedFormat;
+    }
+}
+
+template<size_t N>
+bool has_magic(const unsigned char *data, size_t size,
+               const unsigned char (&magic)[N])
+{
+    return size >= N && memcmp(data, magic, N) == 0;
+}
+
+}
+
+const std::error_category & compressed_file_error_category()
+{
+    static CompressedFileErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(CompressedFileError e)
+{
+    return {static_cast<int>(e), compressed_file_error_category()};
+}
+
+/*!
+ * \class CompressedFile
+ *
+ * \brief Compress or decompress data on the fly on top of another File handle.
+ *
+ * In CompressionMode::Decompress mode, reads return the decompressed contents
+ * of the underlying file, starting from its current file position. Forward
+ * seeks are emulated by decompressing and discarding data. Backward seeks and
+ * seeks relative to the end of the file are not supported.
+ *
+ * In CompressionMode::Compress mode, written data is compressed and written to
+ * the underlying file. The stream trailer is written when the file is closed,
+ * so the result of close() must be checked. Only `seek(0, SEEK_CUR)` is
+ * supported for querying the uncompressed offset.
+ *
+ * The supported formats are gzip, LZ4 (legacy and frame formats), and XZ.
+ * Support for each format depends on the compression libraries available at
+ * build time. Use is_supported() to check if a format is available.
+ *
+ * The underlying File handle is not closed when the CompressedFile is closed.
+ * It must not be used directly while the CompressedFile is open because data
+ * may be buffered.
+ */
+
+/*!
+ * \var CompressedFile::DEFAULT_BUFFER_SIZE
+ *
+ * \brief Size of the buffer used for reading compressed data from the
+ *        underlying file
+ */
+
+/*!
+ * \brief Construct unbound CompressedFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+CompressedFile::CompressedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open compressed file from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, CompressionMode, CompressionFormat)
+ *
+ * \param file File to open
+ * \param mode Whether to decompress on read or compress on write
+ * \param format Compression format
+ */
+CompressedFile::CompressedFile(File *file, CompressionMode mode,
+                               CompressionFormat format)
+    : CompressedFile()
+{
+    (void) open(file, mode, format);
+}
+
+CompressedFile::~CompressedFile()
+{
+    (void) close();
+}
+
+CompressedFile::CompressedFile(CompressedFile &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_mode(other.m_mode)
+    , m_format(other.m_format)
+    , m_codec(std::move(other.m_codec))
+    , m_in_buf(std::move(other.m_in_buf))
+    , m_in_pos(other.m_in_pos)
+    , m_in_end(other.m_in_end)
+    , m_in_eof(other.m_in_eof)
+    , m_out_buf(std::move(other.m_out_buf))
+    , m_done(other.m_done)
+    , m_compressed_offset(other.m_compressed_offset)
+    , m_uncompressed_offset(other.m_uncompressed_offset)
+{
+    other.clear();
+}
+
+CompressedFile & CompressedFile::operator=(CompressedFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_mode = rhs.m_mode;
+    m_format = rhs.m_format;
+    m_codec.swap(rhs.m_codec);
+    m_in_buf.swap(rhs.m_in_buf);
+    m_in_pos = rhs.m_in_pos;
+    m_in_end = rhs.m_in_end;
+    m_in_eof = rhs.m_in_eof;
+    m_out_buf.swap(rhs.m_out_buf);
+    m_done = rhs.m_done;
+    m_compressed_offset = rhs.m_compressed_offset;
+    m_uncompressed_offset = rhs.m_uncompressed_offset;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open compressed file from File handle.
+ *
+ * \p file must already be opened. Data is read from or written to \p file
+ * starting at its current file position.
+ *
+ * If \p format is CompressionFormat::Auto, the format is detected from the
+ * magic bytes at the beginning of the compressed stream. Data that does not
+ * match any known format is passed through as is (CompressionFormat::None).
+ * Auto detection is only supported in CompressionMode::Decompress mode.
+ *
+ * \param file File to open
+ * \param mode Whether to decompress on read or compress on write
+ * \param format Compression format
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code. If the compression format was not enabled at build time,
+ *         CompressedFileError::UnsupportedFormat is returned.
+ */
+oc::result<void> CompressedFile::open(File *file, CompressionMode mode,
+                                      CompressionFormat format)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_mode = mode;
+        m_format = format;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get compression format.
+ *
+ * \return The compression format. If the file was opened with
+ *         CompressionFormat::Auto, this is the detected format.
+ */
+CompressionFormat CompressedFile::format() const
+{
+    return m_format;
+}
+
+/*!
+ * \brief Get number of compressed bytes processed.
+ *
+ * \return Number of bytes consumed from the underlying file by the
+ *         decompressor or written to the underlying file by the compressor.
+ *         When decompressing, this does not include data that was read ahead
+ *         but not yet used.
+ */
+uint64_t CompressedFile::compressed_offset() const
+{
+    return m_compressed_offset;
+}
+
+/*!
+ * \brief Get number of uncompressed bytes processed.
+ *
+ * \return Current file position in the uncompressed stream
+ */
+uint64_t CompressedFile::uncompressed_offset() const
+{
+    return m_uncompressed_offset;
+}
+
+/*!
+ * \brief Check if a compression format is available.
+ *
+ * \param format Compression format
+ *
+ * \return Whether support for \p format was enabled at build time
+ */
+bool CompressedFile::is_supported(CompressionFormat format)
+{
+    switch (format) {
+    case CompressionFormat::Auto:
+    case CompressionFormat::None:
+        return true;
+    case CompressionFormat::Gzip:
+#ifdef MBCOMMON_HAVE_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    case CompressionFormat::Lz4Legacy:
+    case CompressionFormat::Lz4Frame:
+#ifdef MBCOMMON_HAVE_LZ4
+        return true;
+#else
+        return false;
+#endif
+    case CompressionFormat::Xz:
+#ifdef MBCOMMON_HAVE_LZMA
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+oc::result<void> CompressedFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_mode == CompressionMode::Decompress) {
+        m_in_buf.resize(DEFAULT_BUFFER_SIZE);
+
+        if (m_format == CompressionFormat::Auto) {
+            OUTCOME_TRY(format, detect_format());
+            m_format = format;
+        }
+    } else if (m_format == CompressionFormat::Auto) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(codec, create_codec(m_format, m_mode));
+    m_codec = std::move(codec);
+
+    return oc::success();
+}
+
+oc::result<void> CompressedFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_codec && m_mode == CompressionMode::Compress && !is_fatal()) {
+        OUTCOME_TRYV(m_codec->finish(m_out_buf));
+        return write_output();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> CompressedFile::on_read(void *buf, size_t size)
+{
+    if (m_mode != CompressionMode::Decompress) {
+        return FileError::UnsupportedRead;
+    }
+
+    bool need_input = m_in_pos == m_in_end;
+
+    while (size > 0 && !m_done) {
+        if (need_input && !m_in_eof) {
+            OUTCOME_TRYV(fill_input());
+        }
+
+        size_t in_avail = m_in_end - m_in_pos;
+
+        auto step = m_codec->decompress(m_in_buf.data() + m_in_pos, in_avail,
+                                        buf, size, m_in_eof);
+        if (!step) {
+            set_fatal();
+            return step.as_failure();
+        }
+
+        m_in_pos += step.value().in_used;
+        m_compressed_offset += step.value().in_used;
+        m_uncompressed_offset += step.value().out_used;
+        m_done = step.value().done;
+
+        if (step.value().out_used > 0 || m_done) {
+            return step.value().out_used;
+        } else if (step.value().in_used == 0) {
+            if (m_in_eof) {
+                // Stream is truncated
+                return FileError::UnexpectedEof;
+            } else if (in_avail == m_in_buf.size()) {
+                // Codec cannot make progress even with a full buffer
+                set_fatal();
+                return CompressedFileError::CorruptData;
+            }
+
+            need_input = true;
+        } else {
+            need_input = m_in_pos == m_in_end;
+        }
+    }
+
+    return 0;
+}
+
+oc::result<size_t> CompressedFile::on_write(const void *buf, size_t size)
+{
+    if (m_mode != CompressionMode::Compress) {
+        return FileError::UnsupportedWrite;
+    }
+
+    auto ret = m_codec->compress(buf, size, m_out_buf);
+    if (!ret) {
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    OUTCOME_TRYV(write_output());
+
+    m_uncompressed_offset += size;
+
+    return size;
+}
+
+oc::result<uint64_t> CompressedFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t target;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        target = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_uncompressed_offset) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = m_uncompressed_offset - static_cast<uint64_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset)
+                    > UINT64_MAX - m_uncompressed_offset) {
+                return FileError::IntegerOverflow;
+            }
+            target = m_uncompressed_offset + static_cast<uint64_t>(offset);
+        }
+        break;
+    case SEEK_END:
+        return FileError::UnsupportedSeek;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (target == m_uncompressed_offset) {
+        return target;
+    } else if (m_mode != CompressionMode::Decompress
+            || target < m_uncompressed_offset) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // Emulate forward seeks by discarding decompressed data
+    std::vector<unsigned char> discard(static_cast<size_t>(
+            std::min<uint64_t>(target - m_uncompressed_offset, SEEK_BUF_SIZE)));
+
+    while (m_uncompressed_offset < target) {
+        auto to_read = static_cast<size_t>(std::min<uint64_t>(
+                target - m_uncompressed_offset, discard.size()));
+
+        OUTCOME_TRY(n, on_read(discard.data(), to_read));
+        if (n == 0) {
+            return FileError::UnexpectedEof;
+        }
+    }
+
+    return m_uncompressed_offset;
+}
+
+void CompressedFile::clear()
+{
+    m_file = nullptr;
+    m_mode = CompressionMode::Decompress;
+    m_format = CompressionFormat::Auto;
+    m_codec.reset();
+    m_in_buf.clear();
+    m_in_buf.shrink_to_fit();
+    m_in_pos = 0;
+    m_in_end = 0;
+    m_in_eof = false;
+    m_out_buf.clear();
+    m_out_buf.shrink_to_fit();
+    m_done = false;
+    m_compressed_offset = 0;
+    m_uncompressed_offset = 0;
+}
+
+/*!
+ * \brief Read more compressed data into the input buffer
+ */
+oc::result<void> CompressedFile::fill_input()
+{
+    // Move unconsumed data to the beginning
+    size_t remain = m_in_end - m_in_pos;
+    memmove(m_in_buf.data(), m_in_buf.data() + m_in_pos, remain);
+    m_in_pos = 0;
+    m_in_end = remain;
+
+    while (true) {
+        auto n = m_file->read(m_in_buf.data() + m_in_end,
+                              m_in_buf.size() - m_in_end);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            if (m_file->is_fatal()) { set_fatal(); }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            m_in_eof = true;
+        }
+
+        m_in_end += n.value();
+        return oc::success();
+    }
+}
+
+/*!
+ * \brief Detect compression format from the buffered magic bytes
+ */
+oc::result<CompressionFormat> CompressedFile::detect_format()
+{
+    while (m_in_end - m_in_pos < MAX_MAGIC_SIZE && !m_in_eof) {
+        OUTCOME_TRYV(fill_input());
+    }
+
+    auto data = m_in_buf.data() + m_in_pos;
+    size_t size = m_in_end - m_in_pos;
+
+    if (has_magic(data, size, GZIP_MAGIC)) {
+        return CompressionFormat::Gzip;
+    } else if (has_magic(data, size, LZ4_LEGACY_MAGIC)) {
+        return CompressionFormat::Lz4Legacy;
+    } else if (has_magic(data, size, LZ4_FRAME_MAGIC)) {
+        return CompressionFormat::Lz4Frame;
+    } else if (has_magic(data, size, XZ_MAGIC)) {
+        return CompressionFormat::Xz;
+    } else {
+        return CompressionFormat::None;
+    }
+}
+
+/*!
+ * \brief Write all pending compressed data to the underlying file
+ */
+oc::result<void> CompressedFile::write_output()
+{
+    if (!m_out_buf.empty()) {
+        auto ret = file_write_exact(*m_file, m_out_buf.data(),
+                                    m_out_buf.size());
+        if (!ret) {
+            set_fatal();
+            return ret.as_failure();
+        }
+
+        m_compressed_offset += m_out_buf.size();
+        m_out_buf.clear();
+    }
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <zlib.h>
+
+#include "mbcommon/file_error.h"
+
+namespace mb::detail
+{
+
+namespace
+{
+
+// Decode gzip streams only. Add 32 to enable automatic zlib/gzip detection.
+constexpr int GZIP_WINDOW_BITS = 15 + 16;
+
+constexpr size_t DEFLATE_CHUNK_SIZE = 16384;
+
+// zlib's counters are a uInt, so feed it at most this much at a time
+constexpr size_t MAX_ZLIB_CHUNK = std::numeric_limits<uInt>::max();
+
+class GzipCodec : public CompressionCodec
+{
+public:
+    GzipCodec(CompressionMode mode) : m_mode(mode), m_stream(), m_init(false)
+    {
+    }
+
+    ~GzipCodec() override
+    {
+        if (m_init) {
+            if (m_mode == CompressionMode::Decompress) {
+                inflateEnd(&m_stream);
+            } else {
+                deflateEnd(&m_stream);
+            }
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(GzipCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(GzipCodec)
+
+    oc::result<void> init()
+    {
+        int ret;
+
+        if (m_mode == CompressionMode::Decompress) {
+            ret = inflateInit2(&m_stream, GZIP_WINDOW_BITS);
+        } else {
+            ret = deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                               GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY);
+        }
+
+        if (ret != Z_OK) {
+            return CompressedFileError::CodecError;
+        }
+
+        m_init = true;
+        return oc::success();
+    }
+
+    oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                     void *out, size_t out_size,
+                                     bool in_eof) override
+    {
+        (void) in_eof;
+
+        auto in_chunk = static_cast<uInt>(std::min(in_size, MAX_ZLIB_CHUNK));
+        auto out_chunk = static_cast<uInt>(std::min(out_size, MAX_ZLIB_CHUNK));
+
+        // zlib does not modify the input buffer
+        m_stream.next_in = static_cast<Bytef *>(const_cast<void *>(in));
+        m_stream.avail_in = in_chunk;
+        m_stream.next_out = static_cast<Bytef *>(out);
+        m_stream.avail_out = out_chunk;
+
+        int ret = inflate(&m_stream, Z_NO_FLUSH);
+
+        CodecStep step{in_chunk - m_stream.avail_in,
+                       out_chunk - m_stream.avail_out,
+                       ret == Z_STREAM_END};
+
+        switch (ret) {
+        case Z_OK:
+        case Z_STREAM_END:
+            return step;
+        case Z_BUF_ERROR:
+            // No progress possible with the given input
+            return step;
+        case Z_DATA_ERROR:
+        case Z_NEED_DICT:
+            return CompressedFileError::CorruptData;
+        default:
+            return CompressedFileError::CodecError;
+        }
+    }
+
+    oc::result<void> compress(const void *in, size_t in_size,
+                              std::vector<unsigned char> &out) override
+    {
+        auto ptr = static_cast<const unsigned char *>(in);
+
+        while (in_size > 0) {
+            auto chunk = static_cast<uInt>(std::min(in_size, MAX_ZLIB_CHUNK));
+
+            m_stream.next_in = const_cast<Bytef *>(ptr);
+            m_stream.avail_in = chunk;
+
+            OUTCOME_TRYV(deflate_all(Z_NO_FLUSH, out));
+
+            ptr += chunk;
+            in_size -= chunk;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> finish(std::vector<unsigned char> &out) override
+    {
+        m_stream.next_in = nullptr;
+        m_stream.avail_in = 0;
+
+        return deflate_all(Z_FINISH, out);
+    }
+
+private:
+    oc::result<void> deflate_all(int flush, std::vector<unsigned char> &out)
+    {
+        while (true) {
+            size_t old_size = out.size();
+            out.resize(old_size + DEFLATE_CHUNK_SIZE);
+
+            m_stream.next_out = out.data() + old_size;
+            m_stream.avail_out = static_cast<uInt>(DEFLATE_CHUNK_SIZE);
+
+            int ret = deflate(&m_stream, flush);
+
+            out.resize(old_size + DEFLATE_CHUNK_SIZE - m_stream.avail_out);
+
+            if (ret == Z_STREAM_END) {
+                return oc::success();
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return CompressedFileError::CodecError;
+            } else if (flush != Z_FINISH && m_stream.avail_in == 0
+                    && m_stream.avail_out > 0) {
+                return oc::success();
+            }
+        }
+    }
+
+    CompressionMode m_mode;
+    z_stream m_stream;
+    bool m_init;
+};
+
+}
+
+CodecResult create_gzip_codec(CompressionMode mode)
+{
+    auto codec = std::make_unique<GzipCodec>(mode);
+    OUTCOME_TRYV(codec->init());
+    return codec;
+}
+
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4frame.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_error.h"
+
+namespace mb::detail
+{
+
+namespace
+{
+
+constexpr uint32_t LZ4_LEGACY_MAGIC = 0x184c2102;
+// Uncompressed size of each block in the legacy format
+constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+
+class Lz4FrameCodec : public CompressionCodec
+{
+public:
+    Lz4FrameCodec(CompressionMode mode)
+        : m_mode(mode), m_dctx(), m_cctx(), m_prefs(), m_started(false)
+    {
+    }
+
+    ~Lz4FrameCodec() override
+    {
+        if (m_dctx) {
+            LZ4F_freeDecompressionContext(m_dctx);
+        }
+        if (m_cctx) {
+            LZ4F_freeCompressionContext(m_cctx);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Lz4FrameCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Lz4FrameCodec)
+
+    oc::result<void> init()
+    {
+        LZ4F_errorCode_t ret;
+
+        if (m_mode == CompressionMode::Decompress) {
+            ret = LZ4F_createDecompressionContext(&m_dctx, LZ4F_VERSION);
+        } else {
+            ret = LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION);
+        }
+
+        if (LZ4F_isError(ret)) {
+            return CompressedFileError::CodecError;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                     void *out, size_t out_size,
+                                     bool in_eof) override
+    {
+        (void) in_eof;
+
+        size_t in_used = in_size;
+        size_t out_used = out_size;
+
+        size_t ret = LZ4F_decompress(m_dctx, out, &out_used, in, &in_used,
+                                     nullptr);
+        if (LZ4F_isError(ret)) {
+            return CompressedFileError::CorruptData;
+        }
+
+        // A return value of 0 indicates that the frame is fully decoded
+        return CodecStep{in_used, out_used, ret == 0};
+    }
+
+    oc::result<void> compress(const void *in, size_t in_size,
+                              std::vector<unsigned char> &out) override
+    {
+        OUTCOME_TRYV(begin(out));
+
+        size_t old_size = out.size();
+        out.resize(old_size + LZ4F_compressBound(in_size, &m_prefs));
+
+        size_t n = LZ4F_compressUpdate(m_cctx, out.data() + old_size,
+                                       out.size() - old_size, in, in_size,
+                                       nullptr);
+        if (LZ4F_isError(n)) {
+            out.resize(old_size);
+            return CompressedFileError::CodecError;
+        }
+
+        out.resize(old_size + n);
+        return oc::success();
+    }
+
+    oc::result<void> finish(std::vector<unsigned char> &out) override
+    {
+        OUTCOME_TRYV(begin(out));
+
+        size_t old_size = out.size();
+        out.resize(old_size + LZ4F_compressBound(0, &m_prefs));
+
+        size_t n = LZ4F_compressEnd(m_cctx, out.data() + old_size,
+                                    out.size() - old_size, nullptr);
+        if (LZ4F_isError(n)) {
+            out.resize(old_size);
+            return CompressedFileError::CodecError;
+        }
+
+        out.resize(old_size + n);
+        return oc::success();
+    }
+
+private:
+    oc::result<void> begin(std::vector<unsigned char> &out)
+    {
+        if (!m_started) {
+            size_t old_size = out.size();
+            out.resize(old_size + LZ4F_HEADER_SIZE_MAX);
+
+            size_t n = LZ4F_compressBegin(m_cctx, out.data() + old_size,
+                                          LZ4F_HEADER_SIZE_MAX, &m_prefs);
+            if (LZ4F_isError(n)) {
+                out.resize(old_size);
+                return CompressedFileError::CodecError;
+            }
+
+            out.resize(old_size + n);
+            m_started = true;
+        }
+
+        return oc::success();
+    }
+
+    CompressionMode m_mode;
+    LZ4F_dctx *m_dctx;
+    LZ4F_cctx *m_cctx;
+    LZ4F_preferences_t m_prefs;
+    bool m_started;
+};
+
+// The legacy format consists of the magic number followed by blocks that each
+// have a 32-bit little endian compressed size header and decompress to at most
+// LZ4_LEGACY_BLOCK_SIZE bytes. There is no end marker.
+class Lz4LegacyCodec : public CompressionCodec
+{
+public:
+    Lz4LegacyCodec()
+        : m_state(State::Magic)
+        , m_need(sizeof(uint32_t))
+        , m_block_pos(0)
+        , m_started(false)
+    {
+    }
+
+    oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                     void *out, size_t out_size,
+                                     bool in_eof) override
+    {
+        auto in_ptr = static_cast<const unsigned char *>(in);
+        size_t in_used = 0;
+
+        // Decode the next block once the previous one has been fully returned
+        while (m_block_pos == m_block.size()) {
+            size_t take = std::min(m_need - m_pending.size(),
+                                   in_size - in_used);
+            m_pending.insert(m_pending.end(), in_ptr + in_used,
+                             in_ptr + in_used + take);
+            in_used += take;
+
+            if (m_pending.size() < m_need) {
+                // The stream may only end on a block boundary
+                bool done = in_eof && in_used == in_size
+                        && m_state == State::Size && m_pending.empty();
+                return CodecStep{in_used, 0, done};
+            }
+
+            OUTCOME_TRYV(process_pending());
+        }
+
+        size_t n = std::min(out_size, m_block.size() - m_block_pos);
+        memcpy(out, m_block.data() + m_block_pos, n);
+        m_block_pos += n;
+
+        return CodecStep{in_used, n, false};
+    }
+
+    oc::result<void> compress(const void *in, size_t in_size,
+                              std::vector<unsigned char> &out) override
+    {
+        auto ptr = static_cast<const unsigned char *>(in);
+
+        begin(out);
+
+        while (in_size > 0) {
+            size_t n = std::min(in_size,
+                                LZ4_LEGACY_BLOCK_SIZE - m_pending.size());
+            m_pending.insert(m_pending.end(), ptr, ptr + n);
+            ptr += n;
+            in_size -= n;
+
+            if (m_pending.size() == LZ4_LEGACY_BLOCK_SIZE) {
+                OUTCOME_TRYV(compress_block(out));
+            }
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> finish(std::vector<unsigned char> &out) override
+    {
+        begin(out);
+
+        if (!m_pending.empty()) {
+            OUTCOME_TRYV(compress_block(out));
+        }
+
+        return oc::success();
+    }
+
+private:
+    enum class State
+    {
+        Magic,
+        Size,
+        Block,
+    };
+
+    oc::result<void> process_pending()
+    {
+        switch (m_state) {
+        case State::Magic:
+            if (read_le32() != LZ4_LEGACY_MAGIC) {
+                return CompressedFileError::CorruptData;
+            }
+            m_state = State::Size;
+            m_need = sizeof(uint32_t);
+            break;
+
+        case State::Size: {
+            uint32_t size = read_le32();
+
+            if (size == LZ4_LEGACY_MAGIC) {
+                // Concatenated legacy stream
+                m_need = sizeof(uint32_t);
+            } else if (size == 0 || size > static_cast<uint32_t>(
+                    LZ4_compressBound(LZ4_LEGACY_BLOCK_SIZE))) {
+                return CompressedFileError::CorruptData;
+            } else {
+                m_state = State::Block;
+                m_need = size;
+            }
+            break;
+        }
+
+        case State::Block: {
+            m_block.resize(LZ4_LEGACY_BLOCK_SIZE);
+
+            int n = LZ4_decompress_safe(
+                    reinterpret_cast<const char *>(m_pending.data()),
+                    reinterpret_cast<char *>(m_block.data()),
+                    static_cast<int>(m_pending.size()),
+                    static_cast<int>(m_block.size()));
+            if (n < 0) {
+                m_block.clear();
+                return CompressedFileError::CorruptData;
+            }
+
+            m_block.resize(static_cast<size_t>(n));
+            m_block_pos = 0;
+            m_state = State::Size;
+            m_need = sizeof(uint32_t);
+            break;
+        }
+        }
+
+        m_pending.clear();
+        return oc::success();
+    }
+
+    uint32_t read_le32()
+    {
+        uint32_t value;
+        memcpy(&value, m_pending.data(), sizeof(value));
+        return mb_le32toh(value);
+    }
+
+    void begin(std::vector<unsigned char> &out)
+    {
+        if (!m_started) {
+            append_le32(out, LZ4_LEGACY_MAGIC);
+            m_started = true;
+        }
+    }
+
+    oc::result<void> compress_block(std::vector<unsigned char> &out)
+    {
+        int bound = LZ4_compressBound(static_cast<int>(m_pending.size()));
+
+        size_t old_size = out.size();
+        out.resize(old_size + sizeof(uint32_t) + static_cast<size_t>(bound));
+
+        int n = LZ4_compress_default(
+                reinterpret_cast<const char *>(m_pending.data()),
+                reinterpret_cast<char *>(out.data() + old_size
+                        + sizeof(uint32_t)),
+                static_cast<int>(m_pending.size()), bound);
+        if (n <= 0) {
+            out.resize(old_size);
+            return CompressedFileError::CodecError;
+        }
+
+        uint32_t size = mb_htole32(static_cast<uint32_t>(n));
+        memcpy(out.data() + old_size, &size, sizeof(size));
+        out.resize(old_size + sizeof(uint32_t) + static_cast<size_t>(n));
+
+        m_pending.clear();
+        return oc::success();
+    }
+
+    static void append_le32(std::vector<unsigned char> &out, uint32_t value)
+    {
+        value = mb_htole32(value);
+        auto ptr = reinterpret_cast<const unsigned char *>(&value);
+        out.insert(out.end(), ptr, ptr + sizeof(value));
+    }
+
+    State m_state;
+    // Number of bytes needed in m_pending before it can be processed
+    size_t m_need;
+    // Partially received header or block when decompressing and partially
+    // filled block when compressing
+    std::vector<unsigned char> m_pending;
+    // Decompressed block data not yet returned is in [m_block_pos, end)
+    std::vector<unsigned char> m_block;
+    size_t m_block_pos;
+    bool m_started;
+};
+
+}
+
+CodecResult create_lz4_codec(CompressionMode mode, bool legacy)
+{
+    if (legacy) {
+        return std::make_unique<Lz4LegacyCodec>();
+    }
+
+    auto codec = std::make_unique<Lz4FrameCodec>(mode);
+    OUTCOME_TRYV(codec->init());
+    return codec;
+}
+
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <lzma.h>
+
+#include "mbcommon/file_error.h"
+
+namespace mb::detail
+{
+
+namespace
+{
+
+constexpr uint32_t XZ_PRESET = 6;
+
+constexpr size_t ENCODE_CHUNK_SIZE = 16384;
+
+class XzCodec : public CompressionCodec
+{
+public:
+    XzCodec(CompressionMode mode) : m_mode(mode), m_stream(LZMA_STREAM_INIT)
+    {
+    }
+
+    ~XzCodec() override
+    {
+        lzma_end(&m_stream);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(XzCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(XzCodec)
+
+    oc::result<void> init()
+    {
+        lzma_ret ret;
+
+        if (m_mode == CompressionMode::Decompress) {
+            ret = lzma_stream_decoder(&m_stream, UINT64_MAX, 0);
+        } else {
+            // The kernel's XZ decompressor only supports CRC32 checks
+            ret = lzma_easy_encoder(&m_stream, XZ_PRESET, LZMA_CHECK_CRC32);
+        }
+
+        if (ret != LZMA_OK) {
+            return CompressedFileError::CodecError;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<CodecStep> decompress(const void *in, size_t in_size,
+                                     void *out, size_t out_size,
+                                     bool in_eof) override
+    {
+        m_stream.next_in = static_cast<const uint8_t *>(in);
+        m_stream.avail_in = in_size;
+        m_stream.next_out = static_cast<uint8_t *>(out);
+        m_stream.avail_out = out_size;
+
+        lzma_ret ret = lzma_code(&m_stream, in_eof ? LZMA_FINISH : LZMA_RUN);
+
+        CodecStep step{in_size - m_stream.avail_in,
+                       out_size - m_stream.avail_out,
+                       ret == LZMA_STREAM_END};
+
+        switch (ret) {
+        case LZMA_OK:
+        case LZMA_STREAM_END:
+        case LZMA_BUF_ERROR:
+            return step;
+        case LZMA_FORMAT_ERROR:
+        case LZMA_OPTIONS_ERROR:
+        case LZMA_DATA_ERROR:
+            return CompressedFileError::CorruptData;
+        default:
+            return CompressedFileError::CodecError;
+        }
+    }
+
+    oc::result<void> compress(const void *in, size_t in_size,
+                              std::vector<unsigned char> &out) override
+    {
+        m_stream.next_in = static_cast<const uint8_t *>(in);
+        m_stream.avail_in = in_size;
+
+        return encode_all(LZMA_RUN, out);
+    }
+
+    oc::result<void> finish(std::vector<unsigned char> &out) override
+    {
+        m_stream.next_in = nullptr;
+        m_stream.avail_in = 0;
+
+        return encode_all(LZMA_FINISH, out);
+    }
+
+private:
+    oc::result<void> encode_all(lzma_action action,
+                                std::vector<unsigned char> &out)
+    {
+        while (true) {
+            size_t old_size = out.size();
+            out.resize(old_size + ENCODE_CHUNK_SIZE);
+
+            m_stream.next_out = out.data() + old_size;
+            m_stream.avail_out = ENCODE_CHUNK_SIZE;
+
+            lzma_ret ret = lzma_code(&m_stream, action);
+
+            out.resize(old_size + ENCODE_CHUNK_SIZE - m_stream.avail_out);
+
+            if (ret == LZMA_STREAM_END) {
+                return oc::success();
+            } else if (ret != LZMA_OK) {
+                return CompressedFileError::CodecError;
+            } else if (action == LZMA_RUN && m_stream.avail_in == 0) {
+                return oc::success();
+            }
+        }
+    }
+
+    CompressionMode m_mode;
+    lzma_stream m_stream;
+};
+
+}
+
+CodecResult create_xz_codec(CompressionMode mode)
+{
+    auto codec = std::make_unique<XzCodec>(mode);
+    OUTCOME_TRYV(codec->init());
+    return codec;
+}
+
+}
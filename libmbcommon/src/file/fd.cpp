@@ -19,6 +19,8 @@
 
 #include "mbcommon/file/fd.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -27,6 +29,10 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifndef _WIN32
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#endif
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
@@ -45,6 +51,11 @@ using namespace detail;
 static constexpr mode_t DEFAULT_MODE =
         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
+#ifndef _WIN32
+//! Maximum number of buffers passed to a single readv()/writev() call
+static constexpr size_t IOV_BATCH_SIZE = 64;
+#endif
+
 /*! \cond INTERNAL */
 struct RealFdFileFuncs : public FdFileFuncs
 {
@@ -89,6 +100,49 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return writev(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_copy_file_range(int fd_in, off64_t *off_in, int fd_out,
+                               off64_t *off_out, size_t len,
+                               unsigned int flags) override
+    {
+#ifdef SYS_copy_file_range
+        return static_cast<ssize_t>(syscall(SYS_copy_file_range, fd_in, off_in,
+                                            fd_out, off_out, len, flags));
+#else
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+#endif
 };
 /*! \endcond */
 
@@ -135,6 +189,58 @@ static int convert_mode(FileOpenMode mode)
     return ret;
 }
 
+#ifndef _WIN32
+/*!
+ * \brief Perform vectored I/O in batches of up to IOV_BATCH_SIZE buffers
+ *
+ * \p fn is called with `struct iovec` arrays built from \p iov. The operation
+ * stops early when \p fn transfers fewer bytes than requested. The total size
+ * of each batch is limited to `SSIZE_MAX`.
+ */
+template<typename IoVec, typename Fn>
+static oc::result<size_t> batch_iov(const IoVec *iov, size_t count, Fn &&fn)
+{
+    struct iovec batch[IOV_BATCH_SIZE];
+    size_t total = 0;
+
+    while (count > 0) {
+        size_t n_iov = 0;
+        size_t batch_size = 0;
+        bool truncated = false;
+
+        while (n_iov < IOV_BATCH_SIZE && n_iov < count && !truncated) {
+            size_t size = std::min<size_t>(
+                    iov[n_iov].size, SSIZE_MAX - batch_size);
+            truncated = size < iov[n_iov].size;
+
+            batch[n_iov].iov_base = const_cast<void *>(iov[n_iov].data);
+            batch[n_iov].iov_len = size;
+            batch_size += size;
+            ++n_iov;
+        }
+
+        ssize_t n = fn(batch, static_cast<int>(n_iov));
+        if (n < 0) {
+            if (total > 0) {
+                break;
+            }
+            return ec_from_errno();
+        }
+
+        total += static_cast<size_t>(n);
+
+        if (truncated || static_cast<size_t>(n) < batch_size) {
+            break;
+        }
+
+        iov += n_iov;
+        count -= n_iov;
+    }
+
+    return total;
+}
+#endif
+
 /*! \endcond */
 
 /*!
@@ -443,6 +549,78 @@ oc::result<size_t> FdFile::on_write(const void *buf, size_t size)
     return static_cast<size_t>(n);
 }
 
+#ifndef _WIN32
+oc::result<size_t> FdFile::on_read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::on_write_at(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::on_readv(const FileIoVec *iov, size_t count)
+{
+    return batch_iov(iov, count, [&](const struct iovec *batch, int n) {
+        return m_funcs->fn_readv(m_fd, batch, n);
+    });
+}
+
+oc::result<size_t> FdFile::on_writev(const FileConstIoVec *iov, size_t count)
+{
+    return batch_iov(iov, count, [&](const struct iovec *batch, int n) {
+        return m_funcs->fn_writev(m_fd, batch, n);
+    });
+}
+#endif
+
+oc::result<uint64_t> FdFile::on_copy_range(uint64_t src, uint64_t dest,
+                                           uint64_t size)
+{
+    auto src_off = static_cast<off64_t>(src);
+    auto dest_off = static_cast<off64_t>(dest);
+    auto len = static_cast<size_t>(std::min<uint64_t>(size, SSIZE_MAX));
+
+    ssize_t n = m_funcs->fn_copy_file_range(m_fd, &src_off, m_fd, &dest_off,
+                                            len, 0);
+    if (n < 0) {
+        switch (errno) {
+        case ENOSYS:     // Kernel or C library too old
+        case EXDEV:      // Not supported across filesystems on older kernels
+        case EINVAL:     // Filesystem does not support it
+        case EOPNOTSUPP:
+        case EBADF:      // Opened in append mode
+            return FileError::UnsupportedCopyRange;
+        default:
+            return ec_from_errno();
+        }
+    }
+
+    return static_cast<uint64_t>(n);
+}
+
 oc::result<uint64_t> FdFile::on_seek(int64_t offset, int whence)
 {
     off64_t ret = m_funcs->fn_lseek64(m_fd, offset, whence);
@@ -192,6 +192,18 @@ oc::result<size_t> MemoryFile::on_read(void *buf, size_t size)
     return to_read;
 }
 
+oc::result<FileConstIoVec> MemoryFile::on_view(uint64_t offset, size_t size)
+{
+    if (offset >= m_size) {
+        return FileConstIoVec{nullptr, 0};
+    }
+
+    return FileConstIoVec{
+        static_cast<char *>(m_data) + offset,
+        std::min(m_size - static_cast<size_t>(offset), size)
+    };
+}
+
 oc::result<size_t> MemoryFile::on_write(const void *buf, size_t size)
 {
     if (m_pos > SIZE_MAX - size) {
@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open file with memory-mapped I/O
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+struct RealMmapFileFuncs : public MmapFileFuncs
+{
+    int fn_open(const char *path, int flags, mode_t mode) override
+    {
+        return open(path, flags, mode);
+    }
+
+    void * fn_mmap(void *addr, size_t length, int prot, int flags, int fd,
+                   off64_t offset) override
+    {
+        return mmap64(addr, length, prot, flags, fd, offset);
+    }
+
+    int fn_munmap(void *addr, size_t length) override
+    {
+        return munmap(addr, length);
+    }
+
+    int fn_madvise(void *addr, size_t length, int advice) override
+    {
+        return madvise(addr, length, advice);
+    }
+
+    int fn_fstat(int fildes, struct stat *buf) override
+    {
+        return fstat(fildes, buf);
+    }
+
+    int fn_close(int fd) override
+    {
+        return close(fd);
+    }
+
+    off64_t fn_lseek64(int fd, off64_t offset, int whence) override
+    {
+        return lseek64(fd, offset, whence);
+    }
+};
+/*! \endcond */
+
+static RealMmapFileFuncs g_default_funcs;
+
+/*! \cond INTERNAL */
+
+MmapFileFuncs::~MmapFileFuncs() = default;
+
+static int convert_advice(MmapAdvice advice)
+{
+    switch (advice) {
+    case MmapAdvice::Normal:
+        return MADV_NORMAL;
+    case MmapAdvice::Sequential:
+        return MADV_SEQUENTIAL;
+    case MmapAdvice::Random:
+        return MADV_RANDOM;
+    case MmapAdvice::WillNeed:
+        return MADV_WILLNEED;
+    case MmapAdvice::DontNeed:
+        return MADV_DONTNEED;
+    default:
+        MB_UNREACHABLE("Invalid advice: %d", static_cast<int>(advice));
+    }
+}
+
+/*! \endcond */
+
+/*!
+ * \enum MmapAdvice
+ *
+ * \brief Access pattern hints for MmapFile::advise()
+ *
+ * \var MmapAdvice::Normal
+ * \brief No special treatment (`MADV_NORMAL`)
+ *
+ * \var MmapAdvice::Sequential
+ * \brief Expect sequential access (`MADV_SEQUENTIAL`)
+ *
+ * \var MmapAdvice::Random
+ * \brief Expect random access (`MADV_RANDOM`)
+ *
+ * \var MmapAdvice::WillNeed
+ * \brief Expect access in the near future (`MADV_WILLNEED`)
+ *
+ * \var MmapAdvice::DontNeed
+ * \brief Do not expect access in the near future (`MADV_DONTNEED`)
+ */
+
+/*!
+ * \class MmapFile
+ *
+ * \brief Open file by mapping it into memory.
+ *
+ * The whole file is mapped when the handle is opened. Read-only handles use a
+ * private mapping, while writable handles use a shared mapping so that writes
+ * are visible to other processes and are written back to the file. The size of
+ * the file is fixed for the lifetime of the handle: writes past the end of the
+ * mapping are truncated and File::truncate() is not supported.
+ *
+ * The mapped memory can be accessed directly with data() and size() to avoid
+ * copying data into intermediate buffers.
+ */
+
+/*!
+ * \brief Construct unbound MmapFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+MmapFile::MmapFile()
+    : MmapFile(&g_default_funcs)
+{
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int, bool)
+ *
+ * \param fd File descriptor
+ * \param writable Whether the mapping should be writable
+ */
+MmapFile::MmapFile(int fd, bool writable)
+    : MmapFile(&g_default_funcs, fd, writable)
+{
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &, bool)
+ *
+ * \param filename MBS filename
+ * \param writable Whether the mapping should be writable
+ */
+MmapFile::MmapFile(const std::string &filename, bool writable)
+    : MmapFile(&g_default_funcs, filename, writable)
+{
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &, bool)
+ *
+ * \param filename WCS filename
+ * \param writable Whether the mapping should be writable
+ */
+MmapFile::MmapFile(const std::wstring &filename, bool writable)
+    : MmapFile(&g_default_funcs, filename, writable)
+{
+}
+
+/*! \cond INTERNAL */
+
+MmapFile::MmapFile(MmapFileFuncs *funcs)
+    : File(), m_funcs(funcs)
+{
+    clear();
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs, int fd, bool writable)
+    : MmapFile(funcs)
+{
+    (void) open(fd, writable);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::string &filename, bool writable)
+    : MmapFile(funcs)
+{
+    (void) open(filename, writable);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::wstring &filename, bool writable)
+    : MmapFile(funcs)
+{
+    (void) open(filename, writable);
+}
+
+/*! \endcond */
+
+MmapFile::~MmapFile()
+{
+    (void) close();
+}
+
+MmapFile::MmapFile(MmapFile &&other) noexcept
+    : File(std::move(other))
+    , m_funcs(other.m_funcs)
+    , m_fd(other.m_fd)
+    , m_filename(std::move(other.m_filename))
+    , m_writable(other.m_writable)
+    , m_data(other.m_data)
+    , m_size(other.m_size)
+    , m_pos(other.m_pos)
+{
+    other.clear();
+}
+
+MmapFile & MmapFile::operator=(MmapFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_funcs = rhs.m_funcs;
+    m_fd = rhs.m_fd;
+    m_filename.swap(rhs.m_filename);
+    m_writable = rhs.m_writable;
+    m_data = rhs.m_data;
+    m_size = rhs.m_size;
+    m_pos = rhs.m_pos;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open from file descriptor.
+ *
+ * The file descriptor is only used while opening the file. It is never closed
+ * by the File handle and can be closed by the caller once this function
+ * returns.
+ *
+ * \param fd File descriptor
+ * \param writable Whether the mapping should be writable. The file descriptor
+ *                 must have been opened for reading and writing if this is
+ *                 true.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(int fd, bool writable)
+{
+    if (state() == FileState::New) {
+        m_fd = fd;
+        m_writable = writable;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a multi-byte filename.
+ *
+ * \p filename is opened with `open()` and the file descriptor is closed once
+ * the file has been mapped.
+ *
+ * \param filename MBS filename
+ * \param writable Whether the mapping should be writable
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::string &filename, bool writable)
+{
+    if (state() == FileState::New) {
+        m_fd = -1;
+        m_filename = filename;
+        m_writable = writable;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ * \param writable Whether the mapping should be writable
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::wstring &filename, bool writable)
+{
+    if (state() == FileState::New) {
+        auto converted = wcs_to_mbs(filename);
+        if (!converted) {
+            return FileError::CannotConvertEncoding;
+        }
+
+        m_fd = -1;
+        m_filename = std::move(converted.value());
+        m_writable = writable;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get pointer to mapped memory
+ *
+ * The pointer remains valid until the File handle is closed. Writing to the
+ * memory is only allowed if the handle was opened as writable.
+ *
+ * \return Pointer to the beginning of the mapping or nullptr if the file is
+ *         not opened or is empty
+ */
+void * MmapFile::data()
+{
+    return m_data;
+}
+
+/*!
+ * \brief Get size of mapped memory
+ *
+ * \return Size of the mapping, which is the size of the file at the time it was
+ *         opened
+ */
+size_t MmapFile::size()
+{
+    return m_size;
+}
+
+/*!
+ * \brief Give the kernel a hint about the expected access pattern
+ *
+ * \param advice Expected access pattern
+ *
+ * \return Nothing if the hint was successfully applied. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::advise(MmapAdvice advice)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_size > 0 && m_funcs->fn_madvise(
+            m_data, m_size, convert_advice(advice)) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::on_open()
+{
+    int fd = m_fd;
+
+    if (!m_filename.empty()) {
+        fd = m_funcs->fn_open(m_filename.c_str(),
+                              (m_writable ? O_RDWR : O_RDONLY) | O_CLOEXEC, 0);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    // The mapping does not need the file descriptor to stay open
+    auto close_fd = finally([&] {
+        if (!m_filename.empty()) {
+            m_funcs->fn_close(fd);
+        }
+    });
+
+    struct stat sb;
+
+    if (m_funcs->fn_fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    }
+
+    uint64_t size;
+
+    if (S_ISREG(sb.st_mode)) {
+        size = static_cast<uint64_t>(sb.st_size);
+    } else {
+        // Block devices report a size of 0
+        off64_t end = m_funcs->fn_lseek64(fd, 0, SEEK_END);
+        if (end < 0) {
+            return ec_from_errno();
+        }
+        size = static_cast<uint64_t>(end);
+    }
+
+    if (size > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // mmap() fails for zero-length mappings
+    if (size > 0) {
+        int prot = PROT_READ | (m_writable ? PROT_WRITE : 0);
+        int flags = m_writable ? MAP_SHARED : MAP_PRIVATE;
+
+        void *data = m_funcs->fn_mmap(nullptr, static_cast<size_t>(size),
+                                      prot, flags, fd, 0);
+        if (data == MAP_FAILED) {
+            return ec_from_errno();
+        }
+
+        m_data = data;
+    }
+
+    m_size = static_cast<size_t>(size);
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_data && m_funcs->fn_munmap(m_data, m_size) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> MmapFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> MmapFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_write_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> MmapFile::on_read_at(uint64_t offset, void *buf,
+                                        size_t size)
+{
+    size_t to_read = 0;
+    if (offset < m_size) {
+        to_read = std::min(m_size - static_cast<size_t>(offset), size);
+    }
+
+    if (to_read > 0) {
+        memcpy(buf, static_cast<char *>(m_data) + offset, to_read);
+    }
+
+    return to_read;
+}
+
+oc::result<FileConstIoVec> MmapFile::on_view(uint64_t offset, size_t size)
+{
+    if (offset >= m_size) {
+        return FileConstIoVec{nullptr, 0};
+    }
+
+    return FileConstIoVec{
+        static_cast<char *>(m_data) + offset,
+        std::min(m_size - static_cast<size_t>(offset), size)
+    };
+}
+
+oc::result<size_t> MmapFile::on_write_at(uint64_t offset, const void *buf,
+                                         size_t size)
+{
+    if (!m_writable) {
+        return FileError::UnsupportedWrite;
+    }
+
+    size_t to_write = 0;
+    if (offset < m_size) {
+        to_write = std::min(m_size - static_cast<size_t>(offset), size);
+    }
+
+    if (to_write > 0) {
+        memcpy(static_cast<char *>(m_data) + offset, buf, to_write);
+    }
+
+    return to_write;
+}
+
+oc::result<uint64_t> MmapFile::on_seek(int64_t offset, int whence)
+{
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<size_t>(offset);
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > m_pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - m_pos)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos += static_cast<size_t>(offset);
+    case SEEK_END:
+        if ((offset < 0 && static_cast<size_t>(-offset) > m_size)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - m_size)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = m_size + static_cast<size_t>(offset);
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+void MmapFile::clear()
+{
+    m_fd = -1;
+    m_filename.clear();
+    m_writable = false;
+    m_data = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
@@ -19,12 +19,19 @@
 
 #include "mbcommon/file/posix.h"
 
+#include <algorithm>
+
 #include <cerrno>
+#include <climits>
 #include <cstdio>
+#include <limits>
 #include <cstdlib>
 #include <cstring>
 
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/syscall.h>
+#endif
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -63,6 +70,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -101,10 +113,44 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return fwrite(ptr, size, nmemb, stream);
     }
 
+    int fn_setvbuf(FILE *stream, char *buf, int mode, size_t size) override
+    {
+        return setvbuf(stream, buf, mode, size);
+    }
+
     int fn_ftruncate64(int fd, off64_t length) override
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+#endif
+
+#ifndef _WIN32
+    ssize_t fn_copy_file_range(int fd_in, off64_t *off_in, int fd_out,
+                               off64_t *off_out, size_t len,
+                               unsigned int flags) override
+    {
+#ifdef SYS_copy_file_range
+        return static_cast<ssize_t>(syscall(SYS_copy_file_range, fd_in, off_in,
+                                            fd_out, off_out, len, flags));
+#else
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+#endif
 };
 /*! \endcond */
 
@@ -165,6 +211,12 @@ static const char * convert_mode(FileOpenMode mode)
  *
  * This class supports opening large files (64-bit offsets) on non-Android
  * Unix-like platforms.
+ *
+ * The stream position is cached, so `seek(0, SEEK_CUR)` and relative seeks on
+ * seekable files do not call into stdio. Seeks are applied to the `FILE *`
+ * lazily, right before the next stdio call. On Unix-like systems, reads that
+ * are at least as large as the stdio buffer bypass the buffer and are served
+ * with `pread64()` directly into the caller's buffer.
  */
 
 /*!
@@ -271,6 +323,12 @@ PosixFile::PosixFile(PosixFile &&other) noexcept
     , m_filename(std::move(other.m_filename))
     , m_mode(other.m_mode)
     , m_can_seek(other.m_can_seek)
+    , m_append(other.m_append)
+    , m_buf_size(other.m_buf_size)
+    , m_pos(other.m_pos)
+    , m_pos_known(other.m_pos_known)
+    , m_stale(other.m_stale)
+    , m_unflushed(other.m_unflushed)
 {
     other.clear();
 }
@@ -285,6 +343,12 @@ PosixFile & PosixFile::operator=(PosixFile &&rhs) noexcept
     m_filename.swap(rhs.m_filename);
     m_mode = rhs.m_mode;
     m_can_seek = rhs.m_can_seek;
+    m_append = rhs.m_append;
+    m_buf_size = rhs.m_buf_size;
+    m_pos = rhs.m_pos;
+    m_pos_known = rhs.m_pos_known;
+    m_stale = rhs.m_stale;
+    m_unflushed = rhs.m_unflushed;
 
     rhs.clear();
 
@@ -310,6 +374,8 @@ oc::result<void> PosixFile::open(FILE *fp, bool owned)
     if (state() == FileState::New) {
         m_fp = fp;
         m_owned = owned;
+        // The stream may have been opened in append mode
+        m_append = true;
     }
 
     return File::open();
@@ -352,6 +418,8 @@ oc::result<void> PosixFile::open(const std::string &filename, FileOpenMode mode)
         m_owned = true;
         m_filename = std::move(native_filename);
         m_mode = mode_str;
+        m_append = mode == FileOpenMode::Append
+                || mode == FileOpenMode::ReadAppend;
     }
 
     return File::open();
@@ -394,11 +462,40 @@ oc::result<void> PosixFile::open(const std::wstring &filename, FileOpenMode mode
         m_owned = true;
         m_filename = std::move(native_filename);
         m_mode = mode_str;
+        m_append = mode == FileOpenMode::Append
+                || mode == FileOpenMode::ReadAppend;
     }
 
     return File::open();
 }
 
+/*!
+ * \brief Set the size of the stdio buffer
+ *
+ * This calls `setvbuf()` on the stream as soon as it is opened. If \p size is
+ * 0, the stream is unbuffered. Otherwise, it is fully buffered with a buffer
+ * allocated by the C library. Reads of at least \p size bytes bypass the
+ * buffer entirely.
+ *
+ * This can only be called before the file is opened. If the file is opened
+ * from a `FILE *`, no I/O must have been performed on the stream yet. The size
+ * is reset when the file is closed.
+ *
+ * \param size Buffer size in bytes
+ *
+ * \return Nothing if the buffer size is successfully set. Otherwise, the error
+ *         code.
+ */
+oc::result<void> PosixFile::set_buffer_size(size_t size)
+{
+    if (state() != FileState::New) {
+        return FileError::InvalidState;
+    }
+
+    m_buf_size = size;
+    return oc::success();
+}
+
 oc::result<void> PosixFile::on_open()
 {
     if (!m_filename.empty()) {
@@ -411,6 +508,25 @@ oc::result<void> PosixFile::on_open()
         if (!m_fp) {
             return ec_from_errno();
         }
+
+        // Freshly opened streams start at the beginning of the file. In append
+        // mode, where the position after opening is implementation-defined,
+        // it is queried from the stream when it is first needed.
+        m_pos = 0;
+        m_pos_known = !m_append;
+        m_unflushed = false;
+    } else {
+        // The caller may have used the stream already
+        m_pos_known = false;
+        m_unflushed = true;
+    }
+
+    if (m_buf_size) {
+        if (m_funcs->fn_setvbuf(m_fp, nullptr, *m_buf_size == 0 ? _IONBF
+                                                                : _IOFBF,
+                                *m_buf_size) != 0) {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
     }
 
     // Assume file is unseekable by default
@@ -449,6 +565,11 @@ oc::result<void> PosixFile::on_close()
         clear();
     });
 
+    // Leave an unowned stream at the position the caller expects
+    if (!m_owned && m_fp) {
+        OUTCOME_TRYV(sync_stream());
+    }
+
     if (m_owned && m_fp && m_funcs->fn_fclose(m_fp) == EOF) {
         return ec_from_errno();
     }
@@ -458,36 +579,147 @@ oc::result<void> PosixFile::on_close()
 
 oc::result<size_t> PosixFile::on_read(void *buf, size_t size)
 {
+#ifndef _WIN32
+    if (m_can_seek && size >= m_buf_size.value_or(BUFSIZ)) {
+        return read_direct(buf, size);
+    }
+#endif
+
+    OUTCOME_TRYV(sync_stream());
+
     size_t n = m_funcs->fn_fread(buf, 1, size, m_fp);
 
     if (n < size && m_funcs->fn_ferror(m_fp)) {
+        m_pos_known = false;
         return ec_from_errno();
     }
 
+    m_pos += n;
+
     return n;
 }
 
 oc::result<size_t> PosixFile::on_write(const void *buf, size_t size)
 {
+    OUTCOME_TRYV(sync_stream());
+
     size_t n = m_funcs->fn_fwrite(buf, 1, size, m_fp);
+    m_unflushed = true;
 
     if (n < size && m_funcs->fn_ferror(m_fp)) {
+        m_pos_known = false;
         return ec_from_errno();
     }
 
+    // Writes in append mode always go to the end of the file
+    if (m_append) {
+        m_pos_known = false;
+    } else {
+        m_pos += n;
+    }
+
     return n;
 }
 
+#ifndef _WIN32
+oc::result<uint64_t> PosixFile::on_copy_range(uint64_t src, uint64_t dest,
+                                              uint64_t size)
+{
+    if (!m_can_seek) {
+        return FileError::UnsupportedCopyRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        // fileno() not supported for fp
+        return FileError::UnsupportedCopyRange;
+    }
+
+    // Seeking flushes pending writes and discards any buffered data so that
+    // the stream does not return stale data after the copy
+    if (!m_pos_known) {
+        off_t pos = m_funcs->fn_ftello(m_fp);
+        if (pos < 0) {
+            return ec_from_errno();
+        }
+        m_pos = static_cast<uint64_t>(pos);
+        m_pos_known = true;
+    }
+    m_stale = true;
+    OUTCOME_TRYV(sync_stream());
+
+    auto src_off = static_cast<off64_t>(src);
+    auto dest_off = static_cast<off64_t>(dest);
+    auto len = static_cast<size_t>(std::min<uint64_t>(size, SSIZE_MAX));
+
+    ssize_t n = m_funcs->fn_copy_file_range(fd, &src_off, fd, &dest_off,
+                                            len, 0);
+    if (n < 0) {
+        switch (errno) {
+        case ENOSYS:
+        case EXDEV:
+        case EINVAL:
+        case EOPNOTSUPP:
+        case EBADF:
+            return FileError::UnsupportedCopyRange;
+        default:
+            return ec_from_errno();
+        }
+    }
+
+    return static_cast<uint64_t>(n);
+}
+#endif
+
 oc::result<uint64_t> PosixFile::on_seek(int64_t offset, int whence)
 {
     if (!m_can_seek) {
         return FileError::UnsupportedSeek;
     }
 
+    if (whence == SEEK_CUR && offset == 0) {
+        if (!m_pos_known) {
+            off_t pos = m_funcs->fn_ftello(m_fp);
+            if (pos < 0) {
+                return ec_from_errno();
+            }
+            m_pos = static_cast<uint64_t>(pos);
+            m_pos_known = true;
+        }
+
+        return m_pos;
+    }
+
+    // Seeks relative to a known position only update the cached position. The
+    // stream itself is repositioned before the next stdio call.
+    if (m_pos_known && (whence == SEEK_SET || whence == SEEK_CUR)) {
+        uint64_t base = whence == SEEK_SET ? 0 : m_pos;
+        constexpr auto max_pos = static_cast<uint64_t>(
+                std::numeric_limits<off_t>::max());
+
+        if ((offset < 0 && static_cast<uint64_t>(-(offset + 1)) >= base)
+                || (offset > 0 && static_cast<uint64_t>(offset) > max_pos - base)) {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        uint64_t new_pos = base + static_cast<uint64_t>(offset);
+        if (new_pos != m_pos) {
+            m_pos = new_pos;
+            m_stale = true;
+        }
+
+        return m_pos;
+    }
+
     // Get current file position
-    off_t old_pos = m_funcs->fn_ftello(m_fp);
-    if (old_pos < 0) {
-        return ec_from_errno();
+    off_t old_pos;
+    if (m_pos_known) {
+        old_pos = static_cast<off_t>(m_pos);
+    } else {
+        old_pos = m_funcs->fn_ftello(m_fp);
+        if (old_pos < 0) {
+            return ec_from_errno();
+        }
     }
 
     // Try to seek
@@ -495,6 +727,10 @@ oc::result<uint64_t> PosixFile::on_seek(int64_t offset, int whence)
         return ec_from_errno();
     }
 
+    m_pos_known = false;
+    m_stale = false;
+    m_unflushed = false;
+
     // Get new position
     off_t new_pos = m_funcs->fn_ftello(m_fp);
     if (new_pos < 0) {
@@ -507,7 +743,10 @@ oc::result<uint64_t> PosixFile::on_seek(int64_t offset, int whence)
         return ec_from_errno(errno_to_report);
     }
 
-    return static_cast<uint64_t>(new_pos);
+    m_pos = static_cast<uint64_t>(new_pos);
+    m_pos_known = true;
+
+    return m_pos;
 }
 
 oc::result<void> PosixFile::on_truncate(uint64_t size)
@@ -525,6 +764,81 @@ oc::result<void> PosixFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Apply a deferred seek to the stdio stream
+ *
+ * This must be called before any stdio call that depends on the stream
+ * position.
+ */
+oc::result<void> PosixFile::sync_stream()
+{
+    if (m_stale) {
+        if (m_funcs->fn_fseeko(m_fp, static_cast<off_t>(m_pos), SEEK_SET) < 0) {
+            m_pos_known = false;
+            m_stale = false;
+            return ec_from_errno();
+        }
+
+        m_stale = false;
+        m_unflushed = false;
+    }
+
+    return oc::success();
+}
+
+#ifndef _WIN32
+/*!
+ * \brief Read directly from the file descriptor, bypassing the stdio buffer
+ *
+ * Falls back to `fread()` if the stream has no file descriptor or its position
+ * cannot be determined.
+ */
+oc::result<size_t> PosixFile::read_direct(void *buf, size_t size)
+{
+    int fd = m_funcs->fn_fileno(m_fp);
+
+    if (fd >= 0 && !m_pos_known) {
+        off_t pos = m_funcs->fn_ftello(m_fp);
+        if (pos >= 0) {
+            m_pos = static_cast<uint64_t>(pos);
+            m_pos_known = true;
+        }
+    }
+
+    if (fd < 0 || !m_pos_known) {
+        size_t n = m_funcs->fn_fread(buf, 1, size, m_fp);
+
+        if (n < size && m_funcs->fn_ferror(m_fp)) {
+            return ec_from_errno();
+        }
+
+        return n;
+    }
+
+    // Pending writes must hit the file before it is read behind stdio's back
+    if (m_unflushed) {
+        if (m_funcs->fn_fflush(m_fp) != 0) {
+            return ec_from_errno();
+        }
+        m_unflushed = false;
+    }
+
+    auto to_read = std::min<size_t>(size, SSIZE_MAX);
+    ssize_t n = m_funcs->fn_pread64(fd, buf, to_read,
+                                    static_cast<off64_t>(m_pos));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    if (n > 0) {
+        m_pos += static_cast<uint64_t>(n);
+        m_stale = true;
+    }
+
+    return static_cast<size_t>(n);
+}
+#endif
+
 void PosixFile::clear()
 {
     m_fp = nullptr;
@@ -532,6 +846,12 @@ void PosixFile::clear()
     m_filename.clear();
     m_mode = nullptr;
     m_can_seek = false;
+    m_append = false;
+    m_buf_size = {};
+    m_pos = 0;
+    m_pos_known = false;
+    m_stale = false;
+    m_unflushed = false;
 }
 
 }
@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/tracing.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/tracing.h
+ * \brief File handle wrapper for collecting I/O statistics
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+using Clock = std::chrono::steady_clock;
+
+//! Environment variable pointing to where traces should be written
+static constexpr char TRACE_ENV_VAR[] = "MB_FILE_TRACE";
+
+/*! \cond INTERNAL */
+
+static const char * op_name(FileOp op)
+{
+    switch (op) {
+    case FileOp::Read:
+        return "read";
+    case FileOp::Write:
+        return "write";
+    case FileOp::Readv:
+        return "readv";
+    case FileOp::Writev:
+        return "writev";
+    case FileOp::ReadAt:
+        return "read_at";
+    case FileOp::WriteAt:
+        return "write_at";
+    case FileOp::CopyRange:
+        return "copy_range";
+    case FileOp::Seek:
+        return "seek";
+    case FileOp::Truncate:
+        return "truncate";
+    default:
+        MB_UNREACHABLE("Invalid op: %d", static_cast<int>(op));
+    }
+}
+
+static size_t histogram_bucket(std::chrono::nanoseconds latency)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            latency).count();
+    size_t bucket = 0;
+
+    while (us > 0 && bucket < FileOpStats::HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+template<typename IoVec>
+static uint64_t total_iov_size(const IoVec *iov, size_t count)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += iov[i].size;
+    }
+    return total;
+}
+
+static void append_json_string(std::string &out, std::string_view str)
+{
+    out += '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += format("\\u%04x", c);
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+/*! \endcond */
+
+/*!
+ * \enum FileOp
+ *
+ * \brief File operations tracked by TracingFile
+ */
+
+/*!
+ * \struct FileOpStats
+ *
+ * \brief Statistics for one file operation
+ */
+
+/*!
+ * \class TracingFile
+ *
+ * \brief Collect I/O statistics for another File handle.
+ *
+ * Every operation is forwarded to the underlying file. The number of calls,
+ * errors, bytes transferred, short reads/writes, and time spent are recorded
+ * for each kind of operation.
+ *
+ * The latency histogram is logarithmic. Bucket 0 counts calls that took less
+ * than 1 microsecond, bucket \e n counts calls that took [2^(n-1), 2^n)
+ * microseconds, and the last bucket counts everything slower than that.
+ *
+ * The underlying File handle is not closed when the TracingFile is closed.
+ *
+ * If the `MB_FILE_TRACE` environment variable is set, libmbbootimg's Reader and
+ * Writer wrap their files with a TracingFile and append a JSON summary to the
+ * path given by the variable (or stderr if it is `-`) when they are closed.
+ */
+
+/*!
+ * \brief Construct unbound TracingFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+TracingFile::TracingFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle wrapping another file.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *)
+ *
+ * \param file File handle to wrap
+ */
+TracingFile::TracingFile(File *file)
+    : TracingFile()
+{
+    (void) open(file);
+}
+
+TracingFile::~TracingFile()
+{
+    (void) close();
+}
+
+TracingFile::TracingFile(TracingFile &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_stats(other.m_stats)
+{
+    other.clear();
+}
+
+TracingFile & TracingFile::operator=(TracingFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_stats = rhs.m_stats;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open File handle wrapping another file.
+ *
+ * \param file File handle to wrap. It must already be open and must remain
+ *             valid until the TracingFile is closed.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> TracingFile::open(File *file)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get statistics for an operation
+ *
+ * \param op File operation
+ *
+ * \return Statistics collected since the file was opened or since the last
+ *         call to reset_stats()
+ */
+const FileOpStats & TracingFile::stats(FileOp op) const
+{
+    return m_stats[static_cast<size_t>(op)];
+}
+
+/*!
+ * \brief Reset all statistics to zero
+ */
+void TracingFile::reset_stats()
+{
+    m_stats = {};
+}
+
+/*!
+ * \brief Format statistics as a JSON object
+ *
+ * Operations that were never called are omitted.
+ *
+ * \param label Label to include in the `label` field
+ *
+ * \return Single-line JSON object
+ */
+std::string TracingFile::to_json(std::string_view label) const
+{
+    std::string out;
+
+    out += "{\"label\":";
+    append_json_string(out, label);
+    out += ",\"ops\":{";
+
+    bool first = true;
+
+    for (size_t i = 0; i < FILE_OP_COUNT; ++i) {
+        auto const &s = m_stats[i];
+        if (s.calls == 0) {
+            continue;
+        }
+
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+
+        out += format("\"%s\":{\"calls\":%" PRIu64 ",\"errors\":%" PRIu64
+                      ",\"bytes\":%" PRIu64 ",\"short\":%" PRIu64
+                      ",\"total_ns\":%" PRId64 ",\"histogram_us\":[",
+                      op_name(static_cast<FileOp>(i)), s.calls, s.errors,
+                      s.bytes, s.short_transfers,
+                      static_cast<int64_t>(s.total_time.count()));
+
+        for (size_t j = 0; j < s.histogram.size(); ++j) {
+            if (j > 0) {
+                out += ',';
+            }
+            out += format("%" PRIu64, s.histogram[j]);
+        }
+
+        out += "]}";
+    }
+
+    out += "}}";
+
+    return out;
+}
+
+oc::result<void> TracingFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    reset_stats();
+
+    return oc::success();
+}
+
+oc::result<void> TracingFile::on_close()
+{
+    // Statistics are kept so that they can be inspected after closing
+    m_file = nullptr;
+
+    return oc::success();
+}
+
+oc::result<size_t> TracingFile::on_read(void *buf, size_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->read(buf, size);
+    record(FileOp::Read, start, !!ret, ret ? ret.value() : 0, size);
+    return ret;
+}
+
+oc::result<size_t> TracingFile::on_write(const void *buf, size_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->write(buf, size);
+    record(FileOp::Write, start, !!ret, ret ? ret.value() : 0, size);
+    return ret;
+}
+
+oc::result<size_t> TracingFile::on_readv(const FileIoVec *iov, size_t count)
+{
+    auto start = Clock::now();
+    auto ret = m_file->readv(iov, count);
+    record(FileOp::Readv, start, !!ret, ret ? ret.value() : 0,
+           total_iov_size(iov, count));
+    return ret;
+}
+
+oc::result<size_t> TracingFile::on_writev(const FileConstIoVec *iov,
+                                          size_t count)
+{
+    auto start = Clock::now();
+    auto ret = m_file->writev(iov, count);
+    record(FileOp::Writev, start, !!ret, ret ? ret.value() : 0,
+           total_iov_size(iov, count));
+    return ret;
+}
+
+oc::result<size_t> TracingFile::on_read_at(uint64_t offset, void *buf,
+                                           size_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->read_at(offset, buf, size);
+    record(FileOp::ReadAt, start, !!ret, ret ? ret.value() : 0, size);
+    return ret;
+}
+
+oc::result<size_t> TracingFile::on_write_at(uint64_t offset, const void *buf,
+                                            size_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->write_at(offset, buf, size);
+    record(FileOp::WriteAt, start, !!ret, ret ? ret.value() : 0, size);
+    return ret;
+}
+
+oc::result<uint64_t> TracingFile::on_copy_range(uint64_t src, uint64_t dest,
+                                                uint64_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->copy_range(src, dest, size);
+    record(FileOp::CopyRange, start, !!ret, ret ? ret.value() : 0, size);
+    return ret;
+}
+
+oc::result<FileConstIoVec> TracingFile::on_view(uint64_t offset, size_t size)
+{
+    // Views do not perform any I/O, so there is nothing to record
+    return m_file->view(offset, size);
+}
+
+oc::result<uint64_t> TracingFile::on_seek(int64_t offset, int whence)
+{
+    auto start = Clock::now();
+    auto ret = m_file->seek(offset, whence);
+    record(FileOp::Seek, start, !!ret, 0, {});
+    return ret;
+}
+
+oc::result<void> TracingFile::on_truncate(uint64_t size)
+{
+    auto start = Clock::now();
+    auto ret = m_file->truncate(size);
+    record(FileOp::Truncate, start, !!ret, 0, {});
+    return ret;
+}
+
+void TracingFile::clear()
+{
+    m_file = nullptr;
+    m_stats = {};
+}
+
+void TracingFile::record(FileOp op, Clock::time_point start, bool success,
+                         uint64_t bytes, std::optional<uint64_t> requested)
+{
+    auto latency = Clock::now() - start;
+    auto &s = m_stats[static_cast<size_t>(op)];
+
+    ++s.calls;
+    s.total_time += latency;
+    ++s.histogram[histogram_bucket(latency)];
+
+    if (!success) {
+        ++s.errors;
+
+        // Keep the fatal state in sync with the underlying file
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+    } else {
+        s.bytes += bytes;
+
+        if (requested && bytes < *requested) {
+            ++s.short_transfers;
+        }
+    }
+}
+
+/*!
+ * \brief Get path where traces should be written
+ *
+ * \return Value of the `MB_FILE_TRACE` environment variable or nullptr if it is
+ *         unset or empty
+ */
+const char * file_trace_path()
+{
+    const char *path = getenv(TRACE_ENV_VAR);
+    if (path && !*path) {
+        path = nullptr;
+    }
+    return path;
+}
+
+/*!
+ * \brief Append statistics of a TracingFile as a line of JSON
+ *
+ * \param path Path of the file to append to or `-` for stderr
+ * \param label Label to include in the JSON object
+ * \param file TracingFile handle
+ *
+ * \return Nothing if the statistics are successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> file_trace_write(const char *path, std::string_view label,
+                                  const TracingFile &file)
+{
+    auto json = file.to_json(label);
+    json += '\n';
+
+    bool is_stderr = strcmp(path, "-") == 0;
+
+    FILE *fp = is_stderr ? stderr : fopen(path, "a");
+    if (!fp) {
+        return ec_from_errno();
+    }
+
+    auto close_fp = finally([&] {
+        if (!is_stderr) {
+            fclose(fp);
+        }
+    });
+
+    if (fwrite(json.data(), 1, json.size(), fp) != json.size()
+            || fflush(fp) != 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+}
@@ -284,6 +284,7 @@ Win32File::Win32File(Win32File &&other) noexcept
     , m_creation(other.m_creation)
     , m_attrib(other.m_attrib)
     , m_append(other.m_append)
+    , m_sequential_scan(other.m_sequential_scan)
 {
     other.clear();
 }
@@ -302,6 +303,7 @@ Win32File & Win32File::operator=(Win32File &&rhs) noexcept
     m_creation = rhs.m_creation;
     m_attrib = rhs.m_attrib;
     m_append = rhs.m_append;
+    m_sequential_scan = rhs.m_sequential_scan;
 
     rhs.clear();
 
@@ -420,12 +422,41 @@ oc::result<void> Win32File::open(const std::wstring &filename, FileOpenMode mode
     return File::open();
 }
 
+/*!
+ * \brief Hint that the file will be accessed sequentially
+ *
+ * This passes `FILE_FLAG_SEQUENTIAL_SCAN` to `CreateFileW()`, which makes the
+ * cache manager read ahead more aggressively and drop pages that have already
+ * been read. Seeking still works, but random access may be slower.
+ *
+ * This can only be called before the file is opened and has no effect if the
+ * file is opened from a `HANDLE`. The hint is reset when the file is closed.
+ *
+ * \param enabled Whether to enable the hint
+ *
+ * \return Nothing if the hint is successfully set. Otherwise, the error code.
+ */
+oc::result<void> Win32File::set_sequential_scan(bool enabled)
+{
+    if (state() != FileState::New) {
+        return FileError::InvalidState;
+    }
+
+    m_sequential_scan = enabled;
+    return oc::success();
+}
+
 oc::result<void> Win32File::on_open()
 {
     if (!m_filename.empty()) {
+        DWORD attrib = m_attrib;
+        if (m_sequential_scan) {
+            attrib |= FILE_FLAG_SEQUENTIAL_SCAN;
+        }
+
         m_handle = m_funcs->fn_CreateFileW(
                 m_filename.c_str(), m_access, m_sharing, &m_sa, m_creation,
-                m_attrib, nullptr);
+                attrib, nullptr);
         if (m_handle == INVALID_HANDLE_VALUE) {
             return ec_from_win32();
         }
@@ -501,6 +532,75 @@ oc::result<size_t> Win32File::on_write(const void *buf, size_t size)
     return n;
 }
 
+oc::result<size_t> Win32File::on_read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    DWORD n = 0;
+    OVERLAPPED overlapped = {};
+
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    // The file pointer is updated for synchronous handles, which is allowed
+    // since the file position is unspecified after read_at()
+    bool ret = m_funcs->fn_ReadFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToRead
+        &n,         // lpNumberOfBytesRead
+        &overlapped // lpOverlapped
+    );
+
+    if (!ret) {
+        // Reading past EOF with an offset is not an error for read_at()
+        DWORD error = GetLastError();
+        if (error == ERROR_HANDLE_EOF) {
+            return 0;
+        }
+        return ec_from_win32(error);
+    }
+
+    return n;
+}
+
+oc::result<size_t> Win32File::on_write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+    // Like pwrite() on files opened with O_APPEND, always write to the end of
+    // the file in append mode
+    if (m_append) {
+        return on_write(buf, size);
+    }
+
+    DWORD n = 0;
+    OVERLAPPED overlapped = {};
+
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    bool ret = m_funcs->fn_WriteFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToWrite
+        &n,         // lpNumberOfBytesWritten
+        &overlapped // lpOverlapped
+    );
+
+    if (!ret) {
+        return ec_from_win32();
+    }
+
+    return n;
+}
+
 oc::result<uint64_t> Win32File::on_seek(int64_t offset, int whence)
 {
     DWORD move_method;
@@ -581,6 +681,7 @@ void Win32File::clear()
     m_creation = 0;
     m_attrib = 0;
     m_append = false;
+    m_sequential_scan = false;
 }
 
 }
@@ -64,6 +64,10 @@ std::string FileErrorCategory::message(int ev) const
         return "seek not supported";
     case FileError::UnsupportedTruncate:
         return "truncate not supported";
+    case FileError::UnsupportedCopyRange:
+        return "copy range not supported";
+    case FileError::UnsupportedView:
+        return "view not supported";
     case FileError::UnexpectedEof:
         return "unexpected end of file";
     case FileError::IntegerOverflow:
@@ -86,6 +90,8 @@ FileErrorCategory::default_error_condition(int code) const noexcept
     case FileError::UnsupportedWrite:
     case FileError::UnsupportedSeek:
     case FileError::UnsupportedTruncate:
+    case FileError::UnsupportedCopyRange:
+    case FileError::UnsupportedView:
         return FileErrorC::Unsupported;
     default:
         return FileErrorC::InternalError;
@@ -35,6 +35,11 @@
 
 #define DEFAULT_BUFFER_SIZE             (8 * 1024 * 1024)
 
+// Minimum distance between the regions for file_move() to use
+// File::copy_range(). Each chunk can be at most this large, so smaller
+// distances would need more syscalls than the buffered copy.
+#define MIN_COPY_RANGE_DISTANCE         10240
+
 /*!
  * \file mbcommon/file_util.h
  * \brief Useful utility functions for File API
@@ -437,6 +442,316 @@ oc::result<void> file_search(File &file,
     }
 }
 
+/*!
+ * \typedef FileMultiSearchResultCallback
+ *
+ * \brief Search result callback for file_search_multi()
+ *
+ * The same restrictions on the file position as FileSearchResultCallback
+ * apply.
+ *
+ * \sa file_search_multi()
+ *
+ * \param file File handle
+ * \param userdata User callback data
+ * \param pattern_id Index of the matching pattern in the pattern array
+ * \param offset File offset of search result
+ *
+ * \return
+ *   * #FileSearchAction::Continue to continue search
+ *   * #FileSearchAction::Stop to stop search, but have file_search_multi()
+ *     report a successful result
+ *   * An error code if file_search_multi() should report a failure
+ */
+
+/*!
+ * \brief Search file for several binary sequences in a single pass
+ *
+ * This function behaves like file_search(), except that all of the patterns
+ * in \p patterns are searched for at the same time and the file is only read
+ * once. Candidate offsets are found by filtering on the first byte of each
+ * pattern (using `memchr()` if all patterns share the same first byte) and are
+ * then confirmed with `memcmp()`.
+ *
+ * Matches are reported in order of increasing offset. If multiple patterns
+ * match at the same offset, they are reported in the order in which they
+ * appear in \p patterns. Overlapping matches are not reported for the same
+ * pattern, but matches for different patterns may overlap. Empty patterns are
+ * ignored.
+ *
+ * The buffer size rules are the same as those for file_search(), except that
+ * the size of the largest pattern is used.
+ *
+ * \note The file position after this function returns is undefined. Be sure to
+ *       seek to a known location before attempting further read or write
+ *       operations.
+ *
+ * \param file File handle
+ * \param start Start offset or nothing for beginning of file
+ * \param end End offset or nothing for end of file
+ * \param bsize Buffer size or 0 to automatically choose a size
+ * \param patterns Array of patterns to search
+ * \param pattern_count Number of patterns in \p patterns
+ * \param max_matches Maximum number of matches (across all patterns) or nothing
+ *                    to find all matches
+ * \param result_cb Callback to invoke upon finding a match
+ * \param userdata User callback data
+ *
+ * \return Nothing if the search completes successfully. Otherwise, the error
+ *         code.
+ */
+oc::result<void>
+file_search_multi(File &file, std::optional<uint64_t> start,
+                  std::optional<uint64_t> end, size_t bsize,
+                  const FileSearchPattern *patterns, size_t pattern_count,
+                  std::optional<uint64_t> max_matches,
+                  FileMultiSearchResultCallback result_cb, void *userdata)
+{
+    size_t buf_size;
+    uint64_t offset;
+
+    // Check boundaries
+    if (start && end && *end < *start) {
+        // End offset < start offset
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Index non-empty patterns by their first byte
+    std::vector<std::vector<size_t>> by_first_byte(256);
+    size_t max_size = 0;
+    size_t first_byte_count = 0;
+    unsigned char first_byte = 0;
+
+    for (size_t i = 0; i < pattern_count; ++i) {
+        if (patterns[i].size == 0) {
+            continue;
+        }
+
+        auto c = *static_cast<const unsigned char *>(patterns[i].data);
+        if (by_first_byte[c].empty()) {
+            ++first_byte_count;
+            first_byte = c;
+        }
+        by_first_byte[c].push_back(i);
+
+        max_size = std::max(max_size, patterns[i].size);
+    }
+
+    // Trivial case
+    if ((max_matches && *max_matches == 0) || max_size == 0) {
+        return oc::success();
+    }
+
+    // Compute buffer size
+    if (bsize != 0) {
+        buf_size = bsize;
+    } else {
+        buf_size = DEFAULT_BUFFER_SIZE;
+
+        if (max_size > SIZE_MAX / 2) {
+            buf_size = SIZE_MAX;
+        } else {
+            buf_size = std::max(buf_size, max_size * 2);
+        }
+    }
+
+    // Ensure buffer is large enough
+    if (buf_size < max_size) {
+        // Buffer size cannot be less than pattern size
+        return FileError::ArgumentOutOfRange;
+    }
+
+    std::vector<unsigned char> buf(buf_size);
+
+    // Offset at which each pattern may next match (no overlapping matches)
+    std::vector<uint64_t> next_offset(pattern_count, 0);
+
+    if (start) {
+        offset = *start;
+    } else {
+        offset = 0;
+    }
+
+    // Seek to starting point
+    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        if (seek_ret.error() == FileErrorC::Unsupported) {
+            OUTCOME_TRY(discarded, file_read_discard(file, offset));
+
+            if (discarded != offset) {
+                // Reached EOF before starting offset
+                file.set_fatal();
+                return FileError::ArgumentOutOfRange;
+            }
+        } else {
+            return seek_ret.as_failure();
+        }
+    }
+
+    // Initially read to beginning of buffer
+    unsigned char *ptr = buf.data();
+    size_t ptr_remain = buf.size();
+
+    while (true) {
+        OUTCOME_TRY(n_read, file_read_retry(file, ptr, ptr_remain));
+        bool eof = n_read < ptr_remain;
+
+        // Number of available bytes in buf
+        size_t n = n_read + static_cast<size_t>(ptr - buf.data());
+
+        // Ensure that offset + n cannot overflow
+        if (n > UINT64_MAX - offset) {
+            // Read overflows offset value
+            return FileError::IntegerOverflow;
+        }
+
+        // Every pattern can be fully compared at positions below scan_end. The
+        // remaining max_size - 1 bytes are carried over to the next read,
+        // unless we're at EOF.
+        size_t scan_end = eof ? n : n - (max_size - 1);
+        size_t pos = 0;
+
+        while (pos < scan_end) {
+            if (first_byte_count == 1) {
+                auto it = static_cast<unsigned char *>(
+                        memchr(buf.data() + pos, first_byte, scan_end - pos));
+                if (!it) {
+                    break;
+                }
+                pos = static_cast<size_t>(it - buf.data());
+            } else {
+                while (pos < scan_end && by_first_byte[buf[pos]].empty()) {
+                    ++pos;
+                }
+                if (pos == scan_end) {
+                    break;
+                }
+            }
+
+            uint64_t match_offset = offset + pos;
+
+            if (end && match_offset >= *end) {
+                // Artificial EOF
+                return oc::success();
+            }
+
+            for (size_t id : by_first_byte[buf[pos]]) {
+                auto const &p = patterns[id];
+
+                if (match_offset < next_offset[id]
+                        || p.size > n - pos
+                        || (end && p.size > *end - match_offset)
+                        || memcmp(buf.data() + pos, p.data, p.size) != 0) {
+                    continue;
+                }
+
+                // Invoke callback
+                auto ret = result_cb(file, userdata, id, match_offset);
+                if (!ret) {
+                    return ret.as_failure();
+                } else if (ret.value() == FileSearchAction::Stop) {
+                    // Stop searching early
+                    return oc::success();
+                }
+
+                if (max_matches && *max_matches > 0) {
+                    --*max_matches;
+                    if (*max_matches == 0) {
+                        return oc::success();
+                    }
+                }
+
+                // We don't do overlapping searches
+                next_offset[id] = match_offset + p.size;
+            }
+
+            ++pos;
+        }
+
+        if (eof || (end && offset + scan_end >= *end)) {
+            // Reached EOF or artificial EOF
+            return oc::success();
+        }
+
+        // Move the unscanned tail to the beginning of the buffer
+        size_t to_move = n - scan_end;
+        memmove(buf.data(), buf.data() + scan_end, to_move);
+        ptr = buf.data() + to_move;
+        ptr_remain = buf.size() - to_move;
+        offset += scan_end;
+    }
+}
+
+/*!
+ * \brief Move data with File::copy_range() if possible
+ *
+ * The regions are copied in chunks no larger than the distance between them so
+ * that the source and destination of each chunk never overlap. The chunks are
+ * copied from the end of the region when moving data towards the end of the
+ * file.
+ *
+ * \return Number of bytes moved, which is either 0 (if the fast path is not
+ *         usable) or \p size. Otherwise, the error code.
+ */
+static oc::result<uint64_t> file_move_copy_range(File &file, uint64_t src,
+                                                 uint64_t dest, uint64_t size)
+{
+    uint64_t distance = dest < src ? src - dest : dest - src;
+    if (distance < MIN_COPY_RANGE_DISTANCE) {
+        return 0;
+    }
+
+    // Let the buffered copy handle partial copies past EOF
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size) {
+        if (file_size.error() == FileErrorC::Unsupported) {
+            return 0;
+        }
+        return file_size.as_failure();
+    } else if (src + size > file_size.value()) {
+        return 0;
+    }
+
+    uint64_t size_moved = 0;
+
+    while (size_moved < size) {
+        auto to_copy = std::min(distance, size - size_moved);
+        uint64_t chunk_src, chunk_dest;
+
+        if (dest < src) {
+            chunk_src = src + size_moved;
+            chunk_dest = dest + size_moved;
+        } else {
+            chunk_src = src + size - size_moved - to_copy;
+            chunk_dest = dest + size - size_moved - to_copy;
+        }
+
+        for (uint64_t n_copied = 0; n_copied < to_copy;) {
+            auto n = file.copy_range(chunk_src + n_copied,
+                                     chunk_dest + n_copied,
+                                     to_copy - n_copied);
+            if (!n) {
+                if (n.error() == std::errc::interrupted) {
+                    continue;
+                } else if (n.error() == FileErrorC::Unsupported
+                        && size_moved == 0 && n_copied == 0) {
+                    return 0;
+                }
+                return n.as_failure();
+            } else if (n.value() == 0) {
+                // File was truncated while copying
+                return FileError::UnexpectedEof;
+            }
+
+            n_copied += n.value();
+        }
+
+        size_moved += to_copy;
+    }
+
+    return size_moved;
+}
+
 /*!
  * \brief Move data in file
  *
@@ -463,9 +778,38 @@ oc::result<void> file_search(File &file,
  */
 oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
                                uint64_t size)
+{
+    FileMoveStats stats;
+    return file_move(file, src, dest, size, stats);
+}
+
+/*!
+ * \brief Move data in file and report how it was moved
+ *
+ * This function behaves like file_move(File &, uint64_t, uint64_t, uint64_t),
+ * except that it first tries to move the data with File::copy_range(), which
+ * avoids copying through a userspace buffer on backends that support it (eg.
+ * `copy_file_range()` on Linux). The fast path is only used if the source
+ * region lies completely within the file and the regions are at least 10240
+ * bytes apart. Otherwise, or if the backend does not support it, the buffered
+ * copy is used.
+ *
+ * \param[in] file File handle
+ * \param[in] src Source offset
+ * \param[in] dest Destination offset
+ * \param[in] size Size of data to move
+ * \param[out] stats Number of bytes moved by each method
+ *
+ * \return Size of data that is moved if data is successfully moved. Otherwise,
+ *         the error code.
+ */
+oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
+                               uint64_t size, FileMoveStats &stats)
 {
     char buf[10240];
 
+    stats = {};
+
     // Check if we need to do anything
     if (src == dest || size == 0) {
         return size;
@@ -476,7 +820,10 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         return FileError::ArgumentOutOfRange;
     }
 
-    uint64_t size_moved = 0;
+    OUTCOME_TRY(copied, file_move_copy_range(file, src, dest, size));
+    stats.copy_range_bytes = copied;
+
+    uint64_t size_moved = copied;
 
     if (dest < src) {
         // Copy forwards
@@ -540,6 +887,8 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         }
     }
 
+    stats.buffered_bytes = size_moved - stats.copy_range_bytes;
+
     return size_moved;
 }
 
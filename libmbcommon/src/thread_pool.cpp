@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+namespace mb
+{
+
+namespace detail
+{
+
+struct WorkerQueue
+{
+    std::mutex mutex;
+    std::deque<ThreadPool::Task> tasks;
+};
+
+struct ThreadPoolState
+{
+    // Protects everything below except for the worker queues' contents
+    std::mutex mutex;
+    // Signalled when a task is queued, the limit changes, or the pool stops
+    std::condition_variable work_cv;
+    // Signalled when there is space in the shared queue
+    std::condition_variable space_cv;
+
+    std::deque<ThreadPool::Task> shared;
+    size_t queue_limit;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+
+    // Number of tasks in the shared queue and all worker queues
+    std::atomic<size_t> queued{0};
+    std::atomic<unsigned int> max_active{0};
+    bool stop = false;
+};
+
+struct TaskGroupState
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t pending = 0;
+};
+
+}
+
+using namespace detail;
+
+// How often a thread waiting for a task group checks for tasks to help with
+constexpr auto TASK_GROUP_HELP_INTERVAL = std::chrono::milliseconds(10);
+
+// Pool and index of the worker running on the current thread
+static thread_local ThreadPoolState *t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+static bool pop_task(ThreadPoolState &state, size_t index, bool is_worker,
+                     ThreadPool::Task &task)
+{
+    // Newest task of our own first, since its data is most likely still cached
+    if (is_worker) {
+        auto &queue = *state.queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            --state.queued;
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (!state.shared.empty()) {
+            task = std::move(state.shared.front());
+            state.shared.pop_front();
+            --state.queued;
+            state.space_cv.notify_one();
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another worker
+    size_t n = state.queues.size();
+
+    for (size_t i = 1; i <= n; ++i) {
+        size_t victim = (index + i) % n;
+        if (is_worker && victim == index) {
+            continue;
+        }
+
+        auto &queue = *state.queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            --state.queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void worker_main(ThreadPoolState *state, size_t index)
+{
+    t_pool = state;
+    t_index = index;
+
+    while (true) {
+        ThreadPool::Task task;
+
+        if ((index < state->max_active || state->stop)
+                && pop_task(*state, index, true, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+
+        if (state->stop && state->queued == 0) {
+            break;
+        }
+
+        state->work_cv.wait(lock, [&] {
+            return state->stop
+                    || (state->queued > 0 && index < state->max_active);
+        });
+    }
+}
+
+static unsigned int hardware_threads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+CancellationToken::CancellationToken()
+    : m_flag(std::make_shared<std::atomic_bool>(false))
+{
+}
+
+void CancellationToken::cancel()
+{
+    *m_flag = true;
+}
+
+bool CancellationToken::is_cancelled() const
+{
+    return *m_flag;
+}
+
+/*!
+ * \brief Create a thread pool
+ *
+ * \param threads Number of worker threads (at least 1)
+ * \param queue_limit Maximum number of tasks waiting in the shared queue. Tasks
+ *                    submitted from workers are never limited since blocking a
+ *                    worker could deadlock the pool.
+ */
+ThreadPool::ThreadPool(unsigned int threads, size_t queue_limit)
+    : m_state(std::make_unique<ThreadPoolState>())
+{
+    threads = std::max(threads, 1u);
+
+    m_state->queue_limit = std::max<size_t>(queue_limit, 1);
+    m_state->max_active = threads;
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_state->queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_state->threads.emplace_back(&worker_main, m_state.get(), i);
+    }
+}
+
+/*!
+ * \brief Run the remaining tasks and stop the workers
+ *
+ * Tasks must not be submitted from other threads once this has been called.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->stop = true;
+    }
+
+    m_state->work_cv.notify_all();
+    m_state->space_cv.notify_all();
+
+    for (auto &thread : m_state->threads) {
+        thread.join();
+    }
+}
+
+/*!
+ * \brief Queue a task
+ *
+ * If the shared queue is full, this blocks until a worker takes a task from it.
+ */
+void ThreadPool::submit(Task task)
+{
+    if (t_pool == m_state.get()) {
+        {
+            auto &queue = *m_state->queues[t_index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_front(std::move(task));
+        }
+
+        {
+            // Counted under the lock so that a worker that is about to sleep
+            // cannot miss the notification
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            ++m_state->queued;
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+
+        m_state->space_cv.wait(lock, [&] {
+            return m_state->stop
+                    || m_state->shared.size() < m_state->queue_limit;
+        });
+
+        m_state->shared.push_back(std::move(task));
+        ++m_state->queued;
+    }
+
+    m_state->work_cv.notify_one();
+}
+
+/*!
+ * \brief Queue a task if there is space for it
+ *
+ * \return Whether the task was queued. This is always true when called from one
+ *         of the pool's workers.
+ */
+bool ThreadPool::try_submit(Task task)
+{
+    if (t_pool != m_state.get()) {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+
+        if (m_state->shared.size() >= m_state->queue_limit) {
+            return false;
+        }
+
+        m_state->shared.push_back(std::move(task));
+        ++m_state->queued;
+    } else {
+        submit(std::move(task));
+        return true;
+    }
+
+    m_state->work_cv.notify_one();
+    return true;
+}
+
+/*!
+ * \brief Run one queued task on the calling thread
+ *
+ * This lets a thread that is waiting for tasks help finish them instead of
+ * blocking a worker.
+ *
+ * \return Whether a task was run
+ */
+bool ThreadPool::run_pending_task()
+{
+    bool is_worker = t_pool == m_state.get();
+    Task task;
+
+    if (!pop_task(*m_state, is_worker ? t_index : 0, is_worker, task)) {
+        return false;
+    }
+
+    task();
+    return true;
+}
+
+unsigned int ThreadPool::thread_count() const
+{
+    return static_cast<unsigned int>(m_state->threads.size());
+}
+
+unsigned int ThreadPool::max_active_threads() const
+{
+    return m_state->max_active;
+}
+
+/*!
+ * \brief Limit how many workers run tasks at the same time
+ *
+ * The other workers finish their current tasks and then sleep. Their queued
+ * tasks are stolen by the active workers.
+ *
+ * \param threads Number of active workers, which is clamped to
+ *                [1, thread_count()]
+ */
+void ThreadPool::set_max_active_threads(unsigned int threads)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->max_active = std::clamp(threads, 1u, thread_count());
+    }
+
+    m_state->work_cv.notify_all();
+}
+
+static std::mutex g_global_mutex;
+static ThreadPool *g_global_pool = nullptr;
+static unsigned int g_global_limit = 0;
+#ifndef _WIN32
+static pid_t g_global_pid = 0;
+#endif
+
+/*!
+ * \brief Get the process-wide thread pool
+ *
+ * The pool has one worker per CPU and is never destroyed, so tasks may still be
+ * running when the process exits. A forked child gets a new pool since it does
+ * not inherit the parent's workers.
+ */
+ThreadPool & ThreadPool::global()
+{
+    std::lock_guard<std::mutex> lock(g_global_mutex);
+
+#ifndef _WIN32
+    // The old pool's state is not usable in the child, so it is leaked
+    if (g_global_pool && g_global_pid != getpid()) {
+        g_global_pool = nullptr;
+    }
+#endif
+
+    if (!g_global_pool) {
+        g_global_pool = new ThreadPool(hardware_threads(), DEFAULT_QUEUE_LIMIT);
+        if (g_global_limit != 0) {
+            g_global_pool->set_max_active_threads(g_global_limit);
+        }
+#ifndef _WIN32
+        g_global_pid = getpid();
+#endif
+    }
+
+    return *g_global_pool;
+}
+
+/*!
+ * \brief Cap the number of threads that the process-wide pool uses
+ *
+ * This can be called at any time, for example when the device is thermally
+ * throttled, and applies to a pool that was already created.
+ *
+ * \param threads Maximum number of active workers or 0 for one per CPU
+ */
+void ThreadPool::set_global_thread_limit(unsigned int threads)
+{
+    std::lock_guard<std::mutex> lock(g_global_mutex);
+
+    g_global_limit = threads;
+
+    if (g_global_pool) {
+        g_global_pool->set_max_active_threads(
+                threads == 0 ? hardware_threads() : threads);
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : m_pool(pool)
+    , m_state(std::make_shared<TaskGroupState>())
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+/*!
+ * \brief Queue a task in the group
+ *
+ * If the group is cancelled before the task starts, the task is skipped.
+ */
+void TaskGroup::run(ThreadPool::Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        ++m_state->pending;
+    }
+
+    m_pool.submit([state = m_state, token = m_token, task = std::move(task)] {
+        if (!token.is_cancelled()) {
+            task();
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (--state->pending == 0) {
+            state->cv.notify_all();
+        }
+    });
+}
+
+/*!
+ * \brief Wait for every task in the group to finish
+ *
+ * While waiting, the calling thread runs queued tasks of the pool. This keeps
+ * nested groups from deadlocking when every worker is waiting.
+ */
+void TaskGroup::wait()
+{
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (m_state->pending == 0) {
+                return;
+            }
+        }
+
+        if (m_pool.run_pending_task()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->cv.wait_for(lock, TASK_GROUP_HELP_INTERVAL, [&] {
+            return m_state->pending == 0;
+        });
+    }
+}
+
+/*!
+ * \brief Skip the tasks that haven't started yet
+ *
+ * Running tasks can check is_cancelled() on the group's token() to stop early.
+ */
+void TaskGroup::cancel()
+{
+    m_token.cancel();
+}
+
+bool TaskGroup::is_cancelled() const
+{
+    return m_token.is_cancelled();
+}
+
+CancellationToken TaskGroup::token() const
+{
+    return m_token;
+}
+
+/*!
+ * \brief Run copies of a task on up to \p threads threads at once
+ *
+ * One copy runs on the calling thread and the others are queued in \p pool.
+ * This suits workers that take items from shared state until there are none
+ * left: the calling thread guarantees progress even if the pool is busy, and
+ * copies that start late simply find nothing to do. Returns once every copy
+ * has finished.
+ *
+ * \param pool Pool to run the other copies in
+ * \param threads Number of copies, including the one on the calling thread.
+ *                0 is treated as 1.
+ * \param task Task to run
+ */
+void run_on_threads(ThreadPool &pool, unsigned int threads,
+                    const ThreadPool::Task &task)
+{
+    TaskGroup group(pool);
+
+    for (unsigned int i = 1; i < threads; ++i) {
+        group.run(task);
+    }
+
+    task();
+
+    group.wait();
+}
+
+}
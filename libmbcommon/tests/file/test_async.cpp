@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "mbcommon/file/async.h"
+
+using namespace mb;
+
+struct FileAsyncTest : testing::TestWithParam<AsyncBackend>
+{
+    std::string _path;
+
+    void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        _path = tmpdir ? tmpdir : "/tmp";
+        _path += "/mbcommon-test-async.XXXXXX";
+
+        int fd = mkstemp(_path.data());
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() override
+    {
+        unlink(_path.c_str());
+    }
+
+    // Returns false if the backend is unavailable on this system
+    bool open_file(AsyncFile &file, FileOpenMode mode)
+    {
+        EXPECT_TRUE(file.set_queue_depth(4));
+        EXPECT_TRUE(file.set_backend(GetParam()));
+
+        auto ret = file.open(_path, mode);
+        if (!ret && GetParam() == AsyncBackend::IoUring) {
+            return false;
+        }
+        EXPECT_TRUE(ret) << ret.error().message();
+
+        return true;
+    }
+};
+
+TEST_P(FileAsyncTest, CheckConfigAfterOpenFails)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::ReadWrite)) {
+        return;
+    }
+
+    // Auto resolves to the backend that is actually used
+    ASSERT_NE(file.backend(), AsyncBackend::Auto);
+    if (GetParam() != AsyncBackend::Auto) {
+        ASSERT_EQ(file.backend(), GetParam());
+    }
+
+    auto ret = file.set_queue_depth(8);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+
+    ret = file.set_backend(AsyncBackend::Auto);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST_P(FileAsyncTest, CheckZeroQueueDepthFails)
+{
+    AsyncFile file;
+
+    auto ret = file.set_queue_depth(0);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_P(FileAsyncTest, WaitWithoutRequestsFails)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::ReadWrite)) {
+        return;
+    }
+
+    auto ret = file.wait();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST_P(FileAsyncTest, SubmitBeyondQueueDepth)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::ReadWrite)) {
+        return;
+    }
+
+    // Submit more requests than the queue depth
+    constexpr size_t count = 16;
+    std::vector<std::string> bufs;
+    for (size_t i = 0; i < count; ++i) {
+        bufs.push_back(std::string(100, static_cast<char>('a' + i)));
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        auto id = file.submit_write(i * 100, bufs[i].data(), bufs[i].size());
+        ASSERT_TRUE(id);
+        ASSERT_EQ(id.value(), i);
+    }
+
+    ASSERT_EQ(file.in_flight(), count);
+
+    std::vector<bool> seen(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto c = file.wait();
+        ASSERT_TRUE(c);
+        ASSERT_LT(c.value().id, count);
+        ASSERT_FALSE(c.value().error);
+        ASSERT_EQ(c.value().size, 100u);
+        ASSERT_FALSE(seen[c.value().id]);
+        seen[c.value().id] = true;
+    }
+
+    ASSERT_EQ(file.in_flight(), 0u);
+
+    // Read everything back
+    std::vector<std::string> read_bufs(count, std::string(100, '\0'));
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_TRUE(file.submit_read(i * 100, read_bufs[i].data(), 100));
+    }
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_TRUE(file.wait());
+    }
+
+    ASSERT_EQ(read_bufs, bufs);
+}
+
+TEST_P(FileAsyncTest, SynchronousFacade)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::ReadWrite)) {
+        return;
+    }
+
+    ASSERT_TRUE(file.write("Hello, world!", 13));
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 13u);
+
+    pos = file.seek(-6, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 7u);
+
+    char buf[16] = {};
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+    ASSERT_STREQ(buf, "world!");
+
+    // EOF
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    ASSERT_TRUE(file.truncate(5));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    memset(buf, 0, sizeof(buf));
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_STREQ(buf, "Hello");
+}
+
+TEST_P(FileAsyncTest, SynchronousReadKeepsOtherCompletions)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::ReadWrite)) {
+        return;
+    }
+
+    ASSERT_TRUE(file.write("abcdef", 6));
+
+    char async_buf[3] = {};
+    auto id = file.submit_read(0, async_buf, sizeof(async_buf));
+    ASSERT_TRUE(id);
+
+    char sync_buf[3] = {};
+    auto n = file.read_at(3, sync_buf, sizeof(sync_buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_EQ(memcmp(sync_buf, "def", 3), 0);
+
+    auto c = file.wait();
+    ASSERT_TRUE(c);
+    ASSERT_EQ(c.value().id, id.value());
+    ASSERT_EQ(c.value().size, 3u);
+    ASSERT_EQ(memcmp(async_buf, "abc", 3), 0);
+}
+
+TEST_P(FileAsyncTest, ReadFromWriteOnlyFileFails)
+{
+    AsyncFile file;
+    if (!open_file(file, FileOpenMode::WriteOnly)) {
+        return;
+    }
+
+    char c;
+    auto id = file.submit_read(0, &c, 1);
+    ASSERT_TRUE(id);
+
+    auto completion = file.wait();
+    ASSERT_TRUE(completion);
+    ASSERT_EQ(completion.value().error, std::errc::bad_file_descriptor);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    FileAsyncTestBackends,
+    FileAsyncTest,
+    testing::Values(AsyncBackend::Auto, AsyncBackend::IoUring,
+                    AsyncBackend::ThreadPool)
+);
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+
+TEST(FileBufferedTest, OpenUnopenedFile)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    BufferedFile buffered;
+    auto result = buffered.open(&file);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
+
+TEST(FileBufferedTest, SmallReadsAreBuffered)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    // Only one read of the underlying file is needed
+    EXPECT_CALL(file, on_read(testing::_, 64))
+            .Times(1);
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    for (size_t i = 0; i < 16; ++i) {
+        char buf[4];
+        auto n = buffered.read(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), sizeof(buf));
+        ASSERT_EQ(memcmp(buf, file._buf.data() + i * 4, sizeof(buf)), 0);
+    }
+}
+
+TEST(FileBufferedTest, LargeReadsBypassBuffer)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    EXPECT_CALL(file, on_read(testing::_, 128))
+            .Times(1);
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    char buf[128];
+    auto n = buffered.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_EQ(memcmp(buf, file._buf.data(), sizeof(buf)), 0);
+}
+
+TEST(FileBufferedTest, PeekAndConsume)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    auto data = buffered.peek(10);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value().size(), 10u);
+    ASSERT_EQ(memcmp(data.value().data(), file._buf.data(), 10), 0);
+
+    // Peeking does not consume data
+    data = buffered.peek(4);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(memcmp(data.value().data(), file._buf.data(), 4), 0);
+
+    buffered.consume(4);
+
+    char buf[4];
+    ASSERT_TRUE(buffered.read(buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, file._buf.data() + 4, sizeof(buf)), 0);
+
+    auto pos = buffered.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 8u);
+}
+
+TEST(FileBufferedTest, PeekAcrossBufferEnd)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    // Leave 4 bytes in the buffer, then peek more than that
+    char buf[60];
+    ASSERT_TRUE(buffered.read(buf, sizeof(buf)));
+
+    auto data = buffered.peek(32);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value().size(), 32u);
+    ASSERT_EQ(memcmp(data.value().data(), file._buf.data() + 60, 32), 0);
+}
+
+TEST(FileBufferedTest, PeekAtEof)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    ASSERT_TRUE(buffered.seek(-3, SEEK_END));
+
+    auto data = buffered.peek(10);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value().size(), 3u);
+}
+
+TEST(FileBufferedTest, PeekTooLarge)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    auto data = buffered.peek(65);
+    ASSERT_FALSE(data);
+    ASSERT_EQ(data.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST(FileBufferedTest, SeekWithinBuffer)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(1);
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    char c;
+    ASSERT_TRUE(buffered.read(&c, 1));
+
+    auto pos = buffered.seek(10, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 11u);
+
+    ASSERT_TRUE(buffered.read(&c, 1));
+    ASSERT_EQ(c, static_cast<char>(file._buf[11]));
+
+    pos = buffered.seek(-12, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    ASSERT_TRUE(buffered.read(&c, 1));
+    ASSERT_EQ(c, static_cast<char>(file._buf[0]));
+}
+
+TEST(FileBufferedTest, SmallWritesAreBuffered)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    // All writes should be combined into one
+    EXPECT_CALL(file, on_write(testing::_, 12))
+            .Times(1);
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    ASSERT_TRUE(buffered.write("abcd", 4));
+    ASSERT_TRUE(buffered.write("efgh", 4));
+    ASSERT_TRUE(buffered.write("ijkl", 4));
+
+    ASSERT_TRUE(buffered.close());
+    ASSERT_EQ(memcmp(file._buf.data(), "abcdefghijkl", 12), 0);
+}
+
+TEST(FileBufferedTest, WriteAfterReadKeepsPosition)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    char buf[4];
+    ASSERT_TRUE(buffered.read(buf, sizeof(buf)));
+    ASSERT_TRUE(buffered.write("XY", 2));
+    ASSERT_TRUE(buffered.read(buf, 2));
+    ASSERT_TRUE(buffered.flush());
+
+    ASSERT_EQ(file._buf[4], 'X');
+    ASSERT_EQ(file._buf[5], 'Y');
+    ASSERT_EQ(memcmp(buf, file._buf.data() + 6, 2), 0);
+}
+
+TEST(FileBufferedTest, FlushFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    // Pending data is kept after a failed flush and written on close
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::Return(std::error_code{}))
+            .WillOnce(testing::DoDefault());
+
+    BufferedFile buffered(&file, 64);
+    ASSERT_TRUE(buffered.is_open());
+
+    ASSERT_TRUE(buffered.write("x", 1));
+    ASSERT_FALSE(buffered.flush());
+    ASSERT_TRUE(buffered.close());
+    ASSERT_EQ(file._buf[0], 'x');
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+namespace
+{
+
+std::string make_test_data(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    // Mix of compressible runs and less compressible bytes
+    unsigned int state = 1;
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        if (state & 0x10000) {
+            data.append(std::min<size_t>(size - data.size(), 37), 'x');
+        } else {
+            data.push_back(static_cast<char>(state >> 24));
+        }
+    }
+
+    return data;
+}
+
+std::vector<unsigned char> compress_data(CompressionFormat format,
+                                         const std::string &data)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+
+    MemoryFile raw(&buf, &size);
+    EXPECT_TRUE(raw.is_open());
+
+    CompressedFile file(&raw, CompressionMode::Compress, format);
+    EXPECT_TRUE(file.is_open());
+
+    // Write in uneven chunks
+    for (size_t pos = 0; pos < data.size();) {
+        size_t n = std::min<size_t>(data.size() - pos, 4093);
+        EXPECT_TRUE(file_write_exact(file, data.data() + pos, n));
+        pos += n;
+    }
+
+    EXPECT_EQ(file.uncompressed_offset(), data.size());
+    EXPECT_TRUE(file.close());
+
+    std::vector<unsigned char> result(static_cast<unsigned char *>(buf),
+                                      static_cast<unsigned char *>(buf) + size);
+    free(buf);
+
+    return result;
+}
+
+oc::result<std::string> decompress_data(CompressionFormat format,
+                                        const std::vector<unsigned char> &data,
+                                        CompressionFormat *detected)
+{
+    MemoryFile raw(data.data(), data.size());
+    OUTCOME_TRYV(raw.seek(0, SEEK_CUR));
+
+    CompressedFile file;
+    OUTCOME_TRYV(file.open(&raw, CompressionMode::Decompress, format));
+
+    if (detected) {
+        *detected = file.format();
+    }
+
+    std::string result;
+    char buf[1000];
+
+    while (true) {
+        OUTCOME_TRY(n, file.read(buf, sizeof(buf)));
+        if (n == 0) {
+            break;
+        }
+        result.append(buf, n);
+    }
+
+    EXPECT_EQ(file.uncompressed_offset(), result.size());
+    EXPECT_LE(file.compressed_offset(), data.size());
+
+    return result;
+}
+
+}
+
+struct FileCompressedTest : testing::TestWithParam<CompressionFormat>
+{
+};
+
+// Formats that were not enabled at build time are skipped
+#define SKIP_IF_UNSUPPORTED() \
+    do { \
+        if (!CompressedFile::is_supported(GetParam())) { \
+            return; \
+        } \
+    } while (0)
+
+TEST_P(FileCompressedTest, RoundTrip)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    // Large enough to span multiple legacy LZ4 blocks
+    auto data = make_test_data(9 * 1024 * 1024);
+
+    auto compressed = compress_data(GetParam(), data);
+    if (GetParam() != CompressionFormat::None) {
+        ASSERT_LT(compressed.size(), data.size());
+    }
+
+    auto result = decompress_data(GetParam(), compressed, nullptr);
+    ASSERT_TRUE(result) << result.error().message();
+    ASSERT_EQ(result.value(), data);
+}
+
+TEST_P(FileCompressedTest, RoundTripEmpty)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    auto compressed = compress_data(GetParam(), {});
+
+    auto result = decompress_data(GetParam(), compressed, nullptr);
+    ASSERT_TRUE(result) << result.error().message();
+    ASSERT_EQ(result.value(), "");
+}
+
+TEST_P(FileCompressedTest, DetectFormat)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    auto data = make_test_data(100000);
+    auto compressed = compress_data(GetParam(), data);
+
+    CompressionFormat detected = CompressionFormat::Auto;
+    auto result = decompress_data(CompressionFormat::Auto, compressed,
+                                  &detected);
+    ASSERT_TRUE(result) << result.error().message();
+    ASSERT_EQ(result.value(), data);
+    ASSERT_EQ(detected, GetParam());
+}
+
+TEST_P(FileCompressedTest, ForwardSeek)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    auto data = make_test_data(200000);
+    auto compressed = compress_data(GetParam(), data);
+
+    MemoryFile raw(compressed.data(), compressed.size());
+    CompressedFile file(&raw, CompressionMode::Decompress, GetParam());
+    ASSERT_TRUE(file.is_open());
+
+    auto offset = file.seek(150000, SEEK_SET);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 150000u);
+
+    offset = file.seek(10000, SEEK_CUR);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 160000u);
+
+    char buf[100];
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(std::string(buf, sizeof(buf)), data.substr(160000, 100));
+
+    // Backward and end-relative seeks cannot be emulated
+    auto ret = file.seek(0, SEEK_SET);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+    ret = file.seek(0, SEEK_END);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    // Seeking past the end stops at the end
+    ret = file.seek(1000000, SEEK_SET);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+    ASSERT_EQ(file.uncompressed_offset(), data.size());
+}
+
+TEST_P(FileCompressedTest, TruncatedStream)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    if (GetParam() == CompressionFormat::None) {
+        return;
+    }
+
+    auto data = make_test_data(100000);
+    auto compressed = compress_data(GetParam(), data);
+    compressed.resize(compressed.size() / 2);
+
+    auto result = decompress_data(GetParam(), compressed, nullptr);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::UnexpectedEof);
+}
+
+TEST_P(FileCompressedTest, CorruptStream)
+{
+    SKIP_IF_UNSUPPORTED();
+
+    if (GetParam() == CompressionFormat::None) {
+        return;
+    }
+
+    std::vector<unsigned char> garbage(1000, 0xa5);
+
+    auto result = decompress_data(GetParam(), garbage, nullptr);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), CompressedFileError::CorruptData);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    FileCompressedTestInstance,
+    FileCompressedTest,
+    testing::Values(CompressionFormat::None,
+                    CompressionFormat::Gzip,
+                    CompressionFormat::Lz4Legacy,
+                    CompressionFormat::Lz4Frame,
+                    CompressionFormat::Xz)
+);
+
+TEST(FileCompressedMiscTest, AutoNotAllowedForCompression)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+
+    MemoryFile raw(&buf, &size);
+    ASSERT_TRUE(raw.is_open());
+
+    CompressedFile file;
+    auto ret = file.open(&raw, CompressionMode::Compress,
+                         CompressionFormat::Auto);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+
+    ASSERT_TRUE(raw.close());
+    free(buf);
+}
+
+TEST(FileCompressedMiscTest, WrongDirectionFails)
+{
+    MemoryFile raw("abc", 3);
+    CompressedFile file(&raw, CompressionMode::Decompress,
+                        CompressionFormat::None);
+    ASSERT_TRUE(file.is_open());
+
+    auto ret = file.write("x", 1);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedWrite);
+}
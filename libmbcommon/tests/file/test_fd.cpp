@@ -47,6 +47,23 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+
+    // sys/uio.h
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+
+    // sys/syscall.h
+    MOCK_METHOD6(fn_copy_file_range, ssize_t(int fd_in, off64_t *off_in,
+                                             int fd_out, off64_t *off_out,
+                                             size_t len, unsigned int flags));
+#endif
 
     struct stat _sb_regfile{};
 
@@ -74,6 +91,21 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(testing::_, testing::_, testing::_))
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(testing::_, testing::_, testing::_,
+                                   testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_readv(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                          testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void report_as_regular_file()
@@ -477,6 +509,290 @@ TEST_F(FileFdTest, WriteFailureEINTR)
     ASSERT_EQ(n.error(), std::errc::interrupted);
 }
 
+#ifndef _WIN32
+TEST_F(FileFdTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that pread() is used instead of seeking
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, 1, 1000))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(1000, &c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, ReadAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that the pread callback is called
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(0, &c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, WriteAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that pwrite() is used instead of seeking
+    EXPECT_CALL(_funcs, fn_pwrite64(testing::_, testing::_, 1, 1000))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(1000, "x", 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, WriteAtOffsetOutOfRange)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(testing::_, testing::_, testing::_,
+                                    testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(UINT64_MAX, "x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::ArgumentOutOfRange);
+}
+
+static ssize_t total_iov_size(const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    return static_cast<ssize_t>(total);
+}
+
+TEST_F(FileFdTest, ReadvSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that all buffers are passed to a single readv() call
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, 3))
+            .Times(1)
+            .WillOnce(testing::Invoke([](int, const struct iovec *iov,
+                                         int iovcnt) {
+                return total_iov_size(iov, iovcnt);
+            }));
+    EXPECT_CALL(_funcs, fn_read(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[1], b[2], c[3];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+    auto n = file.readv(iov, 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+}
+
+TEST_F(FileFdTest, ReadvManyBuffers)
+{
+    _funcs.report_as_regular_file();
+
+    // 100 buffers should be split into two batches
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, testing::_))
+            .Times(2)
+            .WillRepeatedly(testing::Invoke([](int, const struct iovec *iov,
+                                               int iovcnt) {
+                return total_iov_size(iov, iovcnt);
+            }));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[100];
+    FileIoVec iov[100];
+    for (size_t i = 0; i < 100; ++i) {
+        iov[i] = { &buf[i], 1 };
+    }
+
+    auto n = file.readv(iov, 100);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 100u);
+}
+
+TEST_F(FileFdTest, ReadvShortRead)
+{
+    _funcs.report_as_regular_file();
+
+    // A short read should stop before the next batch
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(10));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[100];
+    FileIoVec iov[100];
+    for (size_t i = 0; i < 100; ++i) {
+        iov[i] = { &buf[i], 1 };
+    }
+
+    auto n = file.readv(iov, 100);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+}
+
+TEST_F(FileFdTest, ReadvFailure)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that the readv callback is called
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    FileIoVec iov[] = { { &c, 1 } };
+    auto n = file.readv(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, WritevSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that all buffers are passed to a single writev() call
+    EXPECT_CALL(_funcs, fn_writev(testing::_, testing::_, 2))
+            .Times(1)
+            .WillOnce(testing::Invoke([](int, const struct iovec *iov,
+                                         int iovcnt) {
+                return total_iov_size(iov, iovcnt);
+            }));
+    EXPECT_CALL(_funcs, fn_write(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    FileConstIoVec iov[] = { { "abc", 3 }, { "de", 2 } };
+    auto n = file.writev(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+}
+
+TEST_F(FileFdTest, WritevFailureEINTR)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that the writev callback is called
+    EXPECT_CALL(_funcs, fn_writev(testing::_, testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::SetErrnoAndReturn(EINTR, -1));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    FileConstIoVec iov[] = { { "x", 1 } };
+    auto n = file.writev(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::interrupted);
+}
+#endif
+
+TEST_F(FileFdTest, CopyRangeSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_copy_file_range(
+            testing::_, testing::Pointee(100), testing::_,
+            testing::Pointee(0), 50, 0))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<4>());
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(100, 0, 50);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 50u);
+}
+
+TEST_F(FileFdTest, CopyRangeOverlapping)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                           testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(10, 0, 50);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileFdTest, CopyRangeUnsupported)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                           testing::_, testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::SetErrnoAndReturn(ENOSYS, -1));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(100, 0, 50);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedCopyRange);
+    ASSERT_EQ(n.error(), FileErrorC::Unsupported);
+}
+
+TEST_F(FileFdTest, CopyRangeFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                           testing::_, testing::_, testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(100, 0, 50);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
 TEST_F(FileFdTest, SeekSuccess)
 {
     _funcs.report_as_regular_file();
@@ -239,6 +239,38 @@ TEST(FileStaticMemoryTest, CheckTruncateUnsupported)
     ASSERT_EQ(result.error(), FileError::UnsupportedTruncate);
 }
 
+TEST(FileStaticMemoryTest, ViewInBounds)
+{
+    constexpr char in[] = "abc";
+    constexpr size_t in_size = 3;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto view = file.view(1, 10);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().data, in + 1);
+    ASSERT_EQ(view.value().size, 2u);
+
+    // File position should not change
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
+
+TEST(FileStaticMemoryTest, ViewOutOfBounds)
+{
+    constexpr char in[] = "x";
+    constexpr size_t in_size = 1;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto view = file.view(10, 1);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().size, 0u);
+}
+
 TEST(FileDynamicMemoryTest, OpenFile)
 {
     void *in = nullptr;
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+
+using namespace mb;
+using namespace mb::detail;
+
+struct MockMmapFileFuncs : public MmapFileFuncs
+{
+    // fcntl.h
+    MOCK_METHOD3(fn_open, int(const char *path, int flags, mode_t mode));
+
+    // sys/mman.h
+    MOCK_METHOD6(fn_mmap, void *(void *addr, size_t length, int prot,
+                                 int flags, int fd, off64_t offset));
+    MOCK_METHOD2(fn_munmap, int(void *addr, size_t length));
+    MOCK_METHOD3(fn_madvise, int(void *addr, size_t length, int advice));
+
+    // sys/stat.h
+    MOCK_METHOD2(fn_fstat, int(int fildes, struct stat *buf));
+
+    // unistd.h
+    MOCK_METHOD1(fn_close, int(int fd));
+    MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+
+    struct stat _sb_regfile{};
+    char _data[16] = "Hello, world!";
+
+    MockMmapFileFuncs()
+    {
+        _sb_regfile.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        _sb_regfile.st_size = sizeof(_data);
+
+        // Fail everything by default
+        ON_CALL(*this, fn_open(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, MAP_FAILED));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_madvise(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_close(testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_lseek64(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+    }
+
+    void report_as_regular_file()
+    {
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::DoAll(
+                        testing::SetArgPointee<1>(_sb_regfile),
+                        testing::Return(0)));
+    }
+
+    void map_with_success()
+    {
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::Return(_data));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::Return(0));
+    }
+};
+
+class TestableMmapFile : public MmapFile
+{
+public:
+    TestableMmapFile(MmapFileFuncs *funcs)
+        : MmapFile(funcs)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, int fd, bool writable)
+        : MmapFile(funcs, fd, writable)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs,
+                     const std::string &filename, bool writable)
+        : MmapFile(funcs, filename, writable)
+    {
+    }
+
+    ~TestableMmapFile()
+    {
+    }
+};
+
+struct FileMmapTest : testing::Test
+{
+    testing::NiceMock<MockMmapFileFuncs> _funcs;
+};
+
+TEST_F(FileMmapTest, OpenFilenameClosesFd)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_open(testing::_, O_RDONLY | O_CLOEXEC, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(3));
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, sizeof(_funcs._data), PROT_READ,
+                                MAP_PRIVATE, 3, 0))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(3))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open("x", false));
+    ASSERT_EQ(file.data(), _funcs._data);
+    ASSERT_EQ(file.size(), sizeof(_funcs._data));
+}
+
+TEST_F(FileMmapTest, OpenFilenameFailure)
+{
+    EXPECT_CALL(_funcs, fn_open(testing::_, testing::_, testing::_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open("x", false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, OpenFdWritable)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    // Writable mappings must be shared and the fd must not be closed
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_,
+                                PROT_READ | PROT_WRITE, MAP_SHARED, 5, 0))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 5, true);
+    ASSERT_TRUE(file.is_open());
+}
+
+TEST_F(FileMmapTest, OpenDirectory)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFDIR;
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::is_a_directory);
+}
+
+TEST_F(FileMmapTest, OpenBlockDeviceUsesSeekSize)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFBLK;
+
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, 0, SEEK_END))
+            .Times(1)
+            .WillOnce(testing::Return(8));
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, 8u, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.size(), 8u);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFileSkipsMapping)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFREG;
+    sb.st_size = 0;
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.data(), nullptr);
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, OpenMmapFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, CloseUnmaps)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(_funcs._data, sizeof(_funcs._data)))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(file.data(), nullptr);
+}
+
+TEST_F(FileMmapTest, ReadAndSeek)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[5];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_EQ(memcmp(buf, "Hello", 5), 0);
+
+    auto pos = file.seek(7, SEEK_SET);
+    ASSERT_TRUE(pos);
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_EQ(memcmp(buf, "world", 5), 0);
+
+    // Read past EOF
+    ASSERT_TRUE(file.seek(0, SEEK_END));
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, ReadAtDoesNotMovePosition)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[5];
+    auto n = file.read_at(7, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_EQ(memcmp(buf, "world", 5), 0);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
+
+TEST_F(FileMmapTest, WriteReadOnlyMapping)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+}
+
+TEST_F(FileMmapTest, WriteTruncatedAtEnd)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(-2, SEEK_END));
+    auto n = file.write("abcd", 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(_funcs._data + sizeof(_funcs._data) - 2, "ab", 2), 0);
+}
+
+TEST_F(FileMmapTest, ViewMapping)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto view = file.view(7, 100);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().data, _funcs._data + 7);
+    ASSERT_EQ(view.value().size, sizeof(_funcs._data) - 7);
+}
+
+TEST_F(FileMmapTest, TruncateUnsupported)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto result = file.truncate(0);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::UnsupportedTruncate);
+}
+
+TEST_F(FileMmapTest, Advise)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_madvise(_funcs._data, sizeof(_funcs._data),
+                                   MADV_SEQUENTIAL))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.advise(MmapAdvice::Sequential));
+}
+
+TEST_F(FileMmapTest, AdviseInWrongState)
+{
+    TestableMmapFile file(&_funcs);
+
+    auto result = file.advise(MmapAdvice::Random);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
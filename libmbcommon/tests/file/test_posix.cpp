@@ -36,6 +36,7 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     // stdio.h
     MOCK_METHOD1(fn_fclose, int(FILE *stream));
     MOCK_METHOD1(fn_ferror, int(FILE *stream));
+    MOCK_METHOD1(fn_fflush, int(FILE *stream));
     MOCK_METHOD1(fn_fileno, int(FILE *stream));
 #ifdef _WIN32
     MOCK_METHOD2(fn_wfopen, FILE *(const wchar_t *filename,
@@ -49,9 +50,22 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     MOCK_METHOD1(fn_ftello, off_t(FILE *stream));
     MOCK_METHOD4(fn_fwrite, size_t(const void *ptr, size_t size, size_t nmemb,
                                    FILE *stream));
+    MOCK_METHOD4(fn_setvbuf, int(FILE *stream, char *buf, int mode,
+                                 size_t size));
 
     // unistd.h
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+#endif
+
+#ifndef _WIN32
+    // sys/syscall.h
+    MOCK_METHOD6(fn_copy_file_range, ssize_t(int fd_in, off64_t *off_in,
+                                             int fd_out, off64_t *off_out,
+                                             size_t len, unsigned int flags));
+#endif
 
     bool stream_error = false;
 
@@ -73,6 +87,8 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                 .WillByDefault(testing::ReturnPointee(&stream_error));
         ON_CALL(*this, fn_fileno(testing::_))
                 .WillByDefault(testing::Return(-1));
+        ON_CALL(*this, fn_fflush(testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, EOF));
         ON_CALL(*this, fn_fread(testing::_, testing::_, testing::_, testing::_))
                 .WillByDefault(testing::DoAll(
                         testing::InvokeWithoutArgs(
@@ -87,8 +103,21 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                         testing::InvokeWithoutArgs(
                                 this, &MockPosixFileFuncs::set_ferror_fail),
                         testing::SetErrnoAndReturn(EIO, 0)));
+        ON_CALL(*this, fn_setvbuf(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::Return(EOF));
         ON_CALL(*this, fn_ftruncate64(testing::_, testing::_))
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
+#ifndef _WIN32
+        ON_CALL(*this, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                          testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void set_ferror_fail()
@@ -277,6 +306,52 @@ TEST_F(FilePosixTest, OpenFile)
     ASSERT_TRUE(file.open(g_fp, false));
 }
 
+TEST_F(FilePosixTest, OpenWithBufferSize)
+{
+    _funcs.open_with_success();
+
+    EXPECT_CALL(_funcs, fn_setvbuf(g_fp, nullptr, _IOFBF, 1024 * 1024))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestablePosixFile file(&_funcs);
+    ASSERT_TRUE(file.set_buffer_size(1024 * 1024));
+    ASSERT_TRUE(file.open("x", FileOpenMode::ReadOnly));
+
+    // Buffer size cannot be changed once the file is open
+    auto result = file.set_buffer_size(0);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
+
+TEST_F(FilePosixTest, OpenUnbuffered)
+{
+    _funcs.open_with_success();
+
+    EXPECT_CALL(_funcs, fn_setvbuf(g_fp, nullptr, _IONBF, 0))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestablePosixFile file(&_funcs);
+    ASSERT_TRUE(file.set_buffer_size(0));
+    ASSERT_TRUE(file.open("x", FileOpenMode::ReadOnly));
+}
+
+TEST_F(FilePosixTest, OpenWithBufferSizeFailure)
+{
+    _funcs.open_with_success();
+
+    EXPECT_CALL(_funcs, fn_setvbuf(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(1);
+
+    TestablePosixFile file(&_funcs);
+    ASSERT_TRUE(file.set_buffer_size(4096));
+    auto result = file.open("x", FileOpenMode::ReadOnly);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::invalid_argument);
+}
+
 TEST_F(FilePosixTest, CloseUnownedFile)
 {
     // Ensure that the close callback is not called
@@ -623,6 +698,108 @@ TEST_F(FilePosixTest, SeekSecondFtellFatal)
     ASSERT_TRUE(file.is_fatal());
 }
 
+TEST_F(FilePosixTest, SeekCurrentUsesCachedPosition)
+{
+    _funcs.open_with_success();
+
+    // The position of a freshly opened file is known, so neither querying it
+    // nor seeking should touch the stream until the next stdio call
+    EXPECT_CALL(_funcs, fn_ftello(testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_fseeko(g_fp, 15, SEEK_SET))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_fread(testing::_, testing::_, testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+
+    ON_CALL(_funcs, fn_fileno(testing::_))
+            .WillByDefault(testing::Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    TestablePosixFile file(&_funcs, "x", FileOpenMode::ReadOnly);
+    ASSERT_TRUE(file.is_open());
+
+    auto offset = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 0u);
+
+    offset = file.seek(10, SEEK_SET);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 10u);
+
+    offset = file.seek(5, SEEK_CUR);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 15u);
+
+    offset = file.seek(-16, SEEK_CUR);
+    ASSERT_FALSE(offset);
+    ASSERT_EQ(offset.error(), std::errc::invalid_argument);
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+
+    offset = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 16u);
+}
+
+#ifndef _WIN32
+TEST_F(FilePosixTest, ReadLargeBypassesBuffer)
+{
+    _funcs.open_with_success();
+
+    EXPECT_CALL(_funcs, fn_setvbuf(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_fread(testing::_, testing::_, testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_fseeko(testing::_, testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_pread64(3, testing::_, 4096, 0))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_pread64(3, testing::_, 4096, 4096))
+            .Times(1)
+            .WillOnce(testing::Return(100));
+
+    ON_CALL(_funcs, fn_fileno(testing::_))
+            .WillByDefault(testing::Return(3));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    TestablePosixFile file(&_funcs);
+    ASSERT_TRUE(file.set_buffer_size(4096));
+    ASSERT_TRUE(file.open("x", FileOpenMode::ReadOnly));
+
+    char buf[4096];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4096u);
+
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 100u);
+
+    auto offset = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(offset);
+    ASSERT_EQ(offset.value(), 4196u);
+}
+#endif
+
 TEST_F(FilePosixTest, SeekUnsupported)
 {
     TestablePosixFile file(&_funcs, g_fp, true);
@@ -633,6 +810,55 @@ TEST_F(FilePosixTest, SeekUnsupported)
     ASSERT_EQ(offset.error(), FileError::UnsupportedSeek);
 }
 
+#ifndef _WIN32
+TEST_F(FilePosixTest, CopyRangeSuccess)
+{
+    // Stream must be synced before the copy
+    EXPECT_CALL(_funcs, fn_ftello(testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(10));
+    EXPECT_CALL(_funcs, fn_fseeko(testing::_, 10, SEEK_SET))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_copy_file_range(
+            3, testing::Pointee(100), 3, testing::Pointee(0), 50, 0))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<4>());
+
+    ON_CALL(_funcs, fn_fileno(testing::_))
+            .WillByDefault(testing::Return(3));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(100, 0, 50);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 50u);
+}
+
+TEST_F(FilePosixTest, CopyRangeUnsupported)
+{
+    // Unseekable streams cannot use copy_file_range()
+    EXPECT_CALL(_funcs, fn_copy_file_range(testing::_, testing::_, testing::_,
+                                           testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.copy_range(100, 0, 50);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedCopyRange);
+}
+#endif
+
 TEST_F(FilePosixTest, TruncateSuccess)
 {
     // Fail when opening to avoid fstat check
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/tracing.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+
+TEST(FileTracingTest, OpenUnopenedFile)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    TracingFile tracing;
+    auto result = tracing.open(&file);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
+
+TEST(FileTracingTest, CountReadsAndShortReads)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    TracingFile tracing(&file);
+    ASSERT_TRUE(tracing.is_open());
+
+    char buf[100];
+    ASSERT_TRUE(tracing.read(buf, sizeof(buf)));
+    ASSERT_TRUE(tracing.seek(-10, SEEK_END));
+
+    // Short read at end of file
+    auto n = tracing.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+
+    auto const &read_stats = tracing.stats(FileOp::Read);
+    ASSERT_EQ(read_stats.calls, 2u);
+    ASSERT_EQ(read_stats.errors, 0u);
+    ASSERT_EQ(read_stats.bytes, 110u);
+    ASSERT_EQ(read_stats.short_transfers, 1u);
+
+    uint64_t histogram_total = 0;
+    for (auto count : read_stats.histogram) {
+        histogram_total += count;
+    }
+    ASSERT_EQ(histogram_total, 2u);
+
+    auto const &seek_stats = tracing.stats(FileOp::Seek);
+    ASSERT_EQ(seek_stats.calls, 1u);
+    ASSERT_EQ(seek_stats.bytes, 0u);
+
+    ASSERT_EQ(tracing.stats(FileOp::Write).calls, 0u);
+}
+
+TEST(FileTracingTest, CountErrorsAndPropagateFatal)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::Invoke([&](const void *, size_t)
+                    -> oc::result<size_t> {
+                file.set_fatal();
+                return std::make_error_code(std::errc::io_error);
+            }));
+
+    TracingFile tracing(&file);
+    ASSERT_TRUE(tracing.is_open());
+
+    auto n = tracing.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+    ASSERT_TRUE(tracing.is_fatal());
+
+    ASSERT_EQ(tracing.stats(FileOp::Write).calls, 1u);
+    ASSERT_EQ(tracing.stats(FileOp::Write).errors, 1u);
+    ASSERT_EQ(tracing.stats(FileOp::Write).bytes, 0u);
+}
+
+TEST(FileTracingTest, ForwardPositionalAndVectoredIo)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    TracingFile tracing(&file);
+    ASSERT_TRUE(tracing.is_open());
+
+    char a[4];
+    char b[8];
+    FileIoVec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}};
+
+    ASSERT_TRUE(tracing.readv(iov, 2));
+    ASSERT_TRUE(tracing.read_at(20, a, sizeof(a)));
+
+    ASSERT_EQ(tracing.stats(FileOp::Readv).bytes, 12u);
+    ASSERT_EQ(tracing.stats(FileOp::ReadAt).bytes, 4u);
+    ASSERT_EQ(memcmp(a, file._buf.data() + 20, sizeof(a)), 0);
+}
+
+TEST(FileTracingTest, JsonSummary)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    TracingFile tracing(&file);
+    ASSERT_TRUE(tracing.is_open());
+
+    ASSERT_TRUE(tracing.truncate(10));
+    ASSERT_TRUE(tracing.close());
+
+    // Statistics are available after closing
+    auto json = tracing.to_json("test \"file\"");
+    ASSERT_EQ(json.find("{\"label\":\"test \\\"file\\\"\",\"ops\":{"
+                        "\"truncate\":{\"calls\":1,\"errors\":0,\"bytes\":0,"
+                        "\"short\":0,\"total_ns\":"), 0u);
+    ASSERT_EQ(json.find("\"read\""), std::string::npos);
+    ASSERT_EQ(json.back(), '}');
+
+    // The underlying file is not closed
+    ASSERT_TRUE(file.is_open());
+}
@@ -222,6 +222,23 @@ TEST_F(FileWin32Test, OpenFilenameWcsInvalidMode)
 }
 #endif
 
+TEST_F(FileWin32Test, OpenSequentialScan)
+{
+    EXPECT_CALL(_funcs, fn_CreateFileW(testing::_, testing::_, testing::_,
+                                       testing::_, testing::_,
+                                       FILE_FLAG_SEQUENTIAL_SCAN, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(reinterpret_cast<HANDLE>(1)));
+
+    TestableWin32File file(&_funcs);
+    ASSERT_TRUE(file.set_sequential_scan(true));
+    ASSERT_TRUE(file.open(L"x", FileOpenMode::ReadOnly));
+
+    auto result = file.set_sequential_scan(false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
+
 TEST_F(FileWin32Test, CloseUnownedFile)
 {
     // Ensure that the close callback is not called
@@ -443,6 +460,47 @@ TEST_F(FileWin32Test, WriteAppendSeekFailure)
     ASSERT_EQ(n.error().value(), ERROR_INVALID_HANDLE);
 }
 
+TEST_F(FileWin32Test, ReadAtSuccess)
+{
+    // Ensure that an overlapped read is used instead of seeking
+    EXPECT_CALL(_funcs, fn_ReadFile(testing::_, testing::_, testing::_,
+                                    testing::_, testing::NotNull()))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<3>(1),
+                                     testing::Return(TRUE)));
+    EXPECT_CALL(_funcs, fn_SetFilePointerEx(testing::_, testing::_, testing::_,
+                                            testing::_))
+            .Times(0);
+
+    TestableWin32File file(&_funcs, nullptr, true, false);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(1000, &c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileWin32Test, WriteAtSuccess)
+{
+    // Ensure that an overlapped write is used instead of seeking
+    EXPECT_CALL(_funcs, fn_WriteFile(testing::_, testing::_, testing::_,
+                                     testing::_, testing::NotNull()))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<3>(1),
+                                     testing::Return(TRUE)));
+    EXPECT_CALL(_funcs, fn_SetFilePointerEx(testing::_, testing::_, testing::_,
+                                            testing::_))
+            .Times(0);
+
+    TestableWin32File file(&_funcs, nullptr, true, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(1000, "x", 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
 TEST_F(FileWin32Test, SeekSuccess)
 {
     LARGE_INTEGER offset;
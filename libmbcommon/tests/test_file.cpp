@@ -384,6 +384,150 @@ TEST(FileTest, WriteReturnFailure)
     ASSERT_EQ(file.state(), FileState::Opened);
 }
 
+TEST(FileTest, ReadvFallbackCallsRead)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Read from file
+    char a[4];
+    char b[6];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(a) + sizeof(b));
+    ASSERT_EQ(memcmp(a, file._buf.data(), sizeof(a)), 0);
+    ASSERT_EQ(memcmp(b, file._buf.data() + sizeof(a), sizeof(b)), 0);
+}
+
+TEST(FileTest, ReadvInWrongState)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(0);
+
+    // Read from file
+    char c;
+    FileIoVec iov[] = { { &c, 1 } };
+    auto n = file.readv(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::InvalidState);
+    ASSERT_EQ(file.state(), FileState::New);
+}
+
+TEST(FileTest, ReadvStopsAtShortRead)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::Return(1u))
+            .WillOnce(testing::Return(std::error_code{}));
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // The second buffer should never be read
+    char a[2];
+    char b[2];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+
+    // Errors are only reported if nothing was read
+    n = file.readv(iov, 2);
+    ASSERT_FALSE(n);
+}
+
+TEST(FileTest, WritevFallbackCallsWrite)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Write to file
+    FileConstIoVec iov[] = { { "Hello, ", 7 }, { "world!", 6 } };
+    auto n = file.writev(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 13u);
+    ASSERT_EQ(memcmp("Hello, world!", file._buf.data(), 13), 0);
+}
+
+TEST(FileTest, ReadAtFallbackSeeksAndReads)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    {
+        testing::InSequence seq;
+
+        EXPECT_CALL(file, on_seek(10, SEEK_SET))
+                .Times(1);
+        EXPECT_CALL(file, on_read(testing::_, testing::_))
+                .Times(1);
+    }
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Read from file
+    char buf[10];
+    auto n = file.read_at(10, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_EQ(memcmp(buf, file._buf.data() + 10, sizeof(buf)), 0);
+}
+
+TEST(FileTest, ReadAtSeekFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_seek(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(std::error_code{}));
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(0);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char c;
+    ASSERT_FALSE(file.read_at(10, &c, 1));
+}
+
+TEST(FileTest, WriteAtFallbackSeeksAndWrites)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    {
+        testing::InSequence seq;
+
+        EXPECT_CALL(file, on_seek(5, SEEK_SET))
+                .Times(1);
+        EXPECT_CALL(file, on_write(testing::_, testing::_))
+                .Times(1);
+    }
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Write to file
+    auto n = file.write_at(5, "xyz", 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_EQ(memcmp(file._buf.data() + 5, "xyz", 3), 0);
+}
+
 TEST(FileTest, SeekCallbackCalled)
 {
     testing::NiceMock<MockTestFile> file;
@@ -387,6 +387,120 @@ TEST_F(FileSearchTest, FindNormal)
     ASSERT_TRUE(file_search(file, {}, {}, 0, "a", 1, {}, &_result_cb, this));
 }
 
+struct FileSearchMultiTest : testing::Test
+{
+    std::vector<std::pair<size_t, uint64_t>> _results;
+
+    static oc::result<FileSearchAction> _result_cb(File &file, void *userdata,
+                                                   size_t pattern_id,
+                                                   uint64_t offset)
+    {
+        (void) file;
+
+        auto *test = static_cast<FileSearchMultiTest *>(userdata);
+        test->_results.emplace_back(pattern_id, offset);
+
+        return FileSearchAction::Continue;
+    }
+};
+
+TEST_F(FileSearchMultiTest, CheckInvalidBoundariesFail)
+{
+    MemoryFile file("", 0);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {{"x", 1}};
+
+    auto result = file_search_multi(file, 20, 10, 0, patterns, 1, {},
+                                    &_result_cb, this);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileSearchMultiTest, CheckBufferSize)
+{
+    MemoryFile file("", 0);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {{"x", 1}, {"xxx", 3}};
+
+    auto result = file_search_multi(file, {}, {}, 2, patterns, 2, {},
+                                    &_result_cb, this);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 3, patterns, 2, {},
+                                  &_result_cb, this));
+}
+
+TEST_F(FileSearchMultiTest, FindAllPatternsInOnePass)
+{
+    const char data[] = "ANDROID!xxLOKIxxANDROID!MTKxx";
+    MemoryFile file(data, sizeof(data) - 1);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {
+        {"ANDROID!", 8},
+        {"LOKI", 4},
+        {"", 0},
+        {"MTK", 3},
+    };
+
+    // Use a tiny buffer to exercise carrying data between reads
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 8, patterns, 4, {},
+                                  &_result_cb, this));
+
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        {0, 0}, {1, 10}, {0, 16}, {3, 24},
+    };
+    ASSERT_EQ(_results, expected);
+}
+
+TEST_F(FileSearchMultiTest, FindSharedFirstByte)
+{
+    MemoryFile file("abababab", 8);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {{"abab", 4}, {"ab", 2}};
+
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 0, patterns, 2, {},
+                                  &_result_cb, this));
+
+    // Matches are non-overlapping per pattern, but may overlap across patterns
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        {0, 0}, {1, 0}, {1, 2}, {0, 4}, {1, 4}, {1, 6},
+    };
+    ASSERT_EQ(_results, expected);
+}
+
+TEST_F(FileSearchMultiTest, FindWithinBoundaries)
+{
+    MemoryFile file("xaybxaybxayb", 12);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {{"a", 1}, {"yb", 2}};
+
+    ASSERT_TRUE(file_search_multi(file, 2, 7, 0, patterns, 2, {},
+                                  &_result_cb, this));
+
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        {1, 2}, {0, 5},
+    };
+    ASSERT_EQ(_results, expected);
+}
+
+TEST_F(FileSearchMultiTest, FindMaxMatches)
+{
+    MemoryFile file("aaaa", 4);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {{"a", 1}};
+
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 0, patterns, 1, 3,
+                                  &_result_cb, this));
+    ASSERT_EQ(_results.size(), 3u);
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     constexpr char buf[] = "abcdef";
@@ -493,4 +607,105 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     }
 }
 
+class CopyRangeMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    unsigned int n_copy_range = 0;
+
+protected:
+    oc::result<uint64_t> on_copy_range(uint64_t src, uint64_t dest,
+                                       uint64_t size) override
+    {
+        std::vector<unsigned char> tmp(static_cast<size_t>(size));
+
+        ++n_copy_range;
+
+        OUTCOME_TRY(n_read, on_read_at(src, tmp.data(), tmp.size()));
+        OUTCOME_TRY(n_written, on_write_at(dest, tmp.data(), n_read));
+
+        return n_written;
+    }
+};
+
+TEST(FileMoveTest, CopyRangeForwardsShouldSucceed)
+{
+    std::vector<unsigned char> buf(100000);
+
+    auto split = buf.begin() + 10240;
+    std::fill(buf.begin(), split, 'a');
+    std::fill(split, buf.end(), 'b');
+
+    CopyRangeMemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileMoveStats stats;
+    auto n = file_move(file, 10240, 0, buf.size() - 10240, stats);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), buf.size() - 10240);
+    ASSERT_EQ(stats.copy_range_bytes, buf.size() - 10240);
+    ASSERT_EQ(stats.buffered_bytes, 0u);
+    ASSERT_EQ(file.n_copy_range, 9u);
+
+    for (size_t i = 0; i < buf.size(); ++i) {
+        ASSERT_EQ(buf[i], 'b');
+    }
+}
+
+TEST(FileMoveTest, CopyRangeBackwardsShouldSucceed)
+{
+    std::vector<unsigned char> buf(100000);
+
+    auto split = buf.end() - 20000;
+    std::fill(buf.begin(), split, 'a');
+    std::fill(split, buf.end(), 'b');
+
+    CopyRangeMemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileMoveStats stats;
+    auto n = file_move(file, 0, 20000, buf.size() - 20000, stats);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), buf.size() - 20000);
+    ASSERT_EQ(stats.copy_range_bytes, buf.size() - 20000);
+    ASSERT_EQ(stats.buffered_bytes, 0u);
+
+    for (size_t i = 0; i < buf.size(); ++i) {
+        ASSERT_EQ(buf[i], 'a');
+    }
+}
+
+TEST(FileMoveTest, CopyRangeSmallDistanceShouldUseBuffer)
+{
+    constexpr char buf[] = "abcdef";
+
+    CopyRangeMemoryFile file(buf, sizeof(buf) - 1);
+    ASSERT_TRUE(file.is_open());
+
+    FileMoveStats stats;
+    auto n = file_move(file, 2, 0, 4, stats);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_STREQ(buf, "cdefef");
+    ASSERT_EQ(stats.copy_range_bytes, 0u);
+    ASSERT_EQ(stats.buffered_bytes, 4u);
+    ASSERT_EQ(file.n_copy_range, 0u);
+}
+
+TEST(FileMoveTest, CopyRangeUnsupportedShouldUseBuffer)
+{
+    std::vector<unsigned char> buf(100000, 'a');
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileMoveStats stats;
+    auto n = file_move(file, 50000, 0, 50000, stats);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 50000u);
+    ASSERT_EQ(stats.copy_range_bytes, 0u);
+    ASSERT_EQ(stats.buffered_bytes, 50000u);
+}
+
 // TODO: Add more tests after integrating gmock
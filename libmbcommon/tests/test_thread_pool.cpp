@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "mbcommon/thread_pool.h"
+
+using namespace mb;
+
+TEST(ThreadPoolTest, RunAllTasks)
+{
+    ThreadPool pool(4, ThreadPool::DEFAULT_QUEUE_LIMIT);
+    std::atomic<int> count{0};
+
+    {
+        TaskGroup group(pool);
+
+        for (int i = 0; i < 1000; ++i) {
+            group.run([&] { ++count; });
+        }
+    }
+
+    ASSERT_EQ(count, 1000);
+}
+
+TEST(ThreadPoolTest, NestedGroupsDoNotDeadlock)
+{
+    ThreadPool pool(2, ThreadPool::DEFAULT_QUEUE_LIMIT);
+    std::atomic<int> count{0};
+
+    TaskGroup outer(pool);
+
+    for (int i = 0; i < 8; ++i) {
+        outer.run([&] {
+            TaskGroup inner(pool);
+
+            for (int j = 0; j < 8; ++j) {
+                inner.run([&] { ++count; });
+            }
+
+            inner.wait();
+        });
+    }
+
+    outer.wait();
+
+    ASSERT_EQ(count, 64);
+}
+
+TEST(ThreadPoolTest, CancelSkipsPendingTasks)
+{
+    ThreadPool pool(1, ThreadPool::DEFAULT_QUEUE_LIMIT);
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+    std::atomic<int> count{0};
+
+    TaskGroup group(pool);
+
+    // Keep the only worker busy until the group is cancelled
+    group.run([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return release; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return started; });
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        group.run([&] { ++count; });
+    }
+
+    group.cancel();
+    ASSERT_TRUE(group.is_cancelled());
+    ASSERT_TRUE(group.token().is_cancelled());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    cv.notify_all();
+
+    group.wait();
+
+    ASSERT_EQ(count, 0);
+}
+
+TEST(ThreadPoolTest, TrySubmitFailsWhenQueueIsFull)
+{
+    ThreadPool pool(1, 2);
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+
+    pool.submit([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return release; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return started; });
+    }
+
+    ASSERT_TRUE(pool.try_submit([] {}));
+    ASSERT_TRUE(pool.try_submit([] {}));
+    ASSERT_FALSE(pool.try_submit([] {}));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    cv.notify_all();
+}
+
+TEST(ThreadPoolTest, LimitActiveThreads)
+{
+    ThreadPool pool(4, ThreadPool::DEFAULT_QUEUE_LIMIT);
+    pool.set_max_active_threads(1);
+    ASSERT_EQ(pool.thread_count(), 4u);
+    ASSERT_EQ(pool.max_active_threads(), 1u);
+
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+
+    {
+        TaskGroup group(pool);
+
+        for (int i = 0; i < 100; ++i) {
+            group.run([&] {
+                int n = ++running;
+
+                int expected = max_running;
+                while (n > expected
+                        && !max_running.compare_exchange_weak(expected, n)) {
+                }
+
+                std::this_thread::yield();
+                --running;
+            });
+        }
+    }
+
+    // The thread waiting for the group may also run tasks
+    ASSERT_LE(max_running, 2);
+
+    pool.set_max_active_threads(0);
+    ASSERT_EQ(pool.max_active_threads(), 1u);
+    pool.set_max_active_threads(100);
+    ASSERT_EQ(pool.max_active_threads(), 4u);
+}
+
+TEST(ThreadPoolTest, RunOnThreadsFinishesSharedWork)
+{
+    ThreadPool pool(2, ThreadPool::DEFAULT_QUEUE_LIMIT);
+    pool.set_max_active_threads(1);
+
+    std::atomic<int> next{0};
+    std::atomic<int> copies{0};
+    std::atomic<int> done{0};
+
+    // More copies than workers must not keep the call from returning
+    run_on_threads(pool, 8, [&] {
+        ++copies;
+        while (next++ < 1000) {
+            ++done;
+        }
+    });
+
+    ASSERT_EQ(copies, 8);
+    ASSERT_EQ(done, 1000);
+
+    run_on_threads(pool, 0, [&] { ++copies; });
+    ASSERT_EQ(copies, 9);
+}
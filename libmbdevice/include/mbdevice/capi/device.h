@@ -21,9 +21,11 @@
 
 #ifdef __cplusplus
 #  include <cstdbool>
+#  include <cstddef>
 #  include <cstdint>
 #else
 #  include <stdbool.h>
+#  include <stddef.h>
 #  include <stdint.h>
 #endif
 
@@ -36,6 +38,15 @@ MB_BEGIN_C_DECLS
 struct CDevice;
 typedef struct CDevice CDevice;
 
+typedef struct CDeviceSummary
+{
+    const char *id;
+    const char *name;
+    const char *architecture;
+    uint32_t flags;
+    bool tw_supported;
+} CDeviceSummary;
+
 MB_EXPORT CDevice * mb_device_new();
 
 MB_EXPORT void mb_device_free(CDevice *device);
@@ -45,41 +56,64 @@ MB_EXPORT void mb_device_free(CDevice *device);
 #define SETTER(TYPE, NAME) \
     MB_EXPORT void mb_device_set_ ## NAME (CDevice *device, TYPE value)
 
+/*
+ * The *_ref() and *_ref_at() getters return pointers into the CDevice instead
+ * of copies. They must not be free()'d and are only valid until the CDevice is
+ * modified or freed.
+ */
+#define REF_GETTER(NAME) \
+    MB_EXPORT const char * mb_device_ ## NAME ## _ref (const CDevice *device)
+#define ARRAY_REF_GETTERS(NAME) \
+    MB_EXPORT size_t mb_device_ ## NAME ## _count (const CDevice *device); \
+    MB_EXPORT const char * mb_device_ ## NAME ## _ref_at (const CDevice *device, \
+                                                        size_t index)
+
 GETTER(char *, id);
 SETTER(const char *, id);
+REF_GETTER(id);
 
 GETTER(char * const *, codenames);
 SETTER(char const * const *, codenames);
+ARRAY_REF_GETTERS(codenames);
 
 GETTER(char *, name);
 SETTER(const char *, name);
+REF_GETTER(name);
 
 GETTER(char *, architecture);
 SETTER(const char *, architecture);
+REF_GETTER(architecture);
 
 GETTER(uint32_t, flags);
 SETTER(uint32_t, flags);
 
 GETTER(char * const *, block_dev_base_dirs);
 SETTER(char const * const *, block_dev_base_dirs);
+ARRAY_REF_GETTERS(block_dev_base_dirs);
 
 GETTER(char * const *, system_block_devs);
 SETTER(char const * const *, system_block_devs);
+ARRAY_REF_GETTERS(system_block_devs);
 
 GETTER(char * const *, cache_block_devs);
 SETTER(char const * const *, cache_block_devs);
+ARRAY_REF_GETTERS(cache_block_devs);
 
 GETTER(char * const *, data_block_devs);
 SETTER(char const * const *, data_block_devs);
+ARRAY_REF_GETTERS(data_block_devs);
 
 GETTER(char * const *, boot_block_devs);
 SETTER(char const * const *, boot_block_devs);
+ARRAY_REF_GETTERS(boot_block_devs);
 
 GETTER(char * const *, recovery_block_devs);
 SETTER(char const * const *, recovery_block_devs);
+ARRAY_REF_GETTERS(recovery_block_devs);
 
 GETTER(char * const *, extra_block_devs);
 SETTER(char const * const *, extra_block_devs);
+ARRAY_REF_GETTERS(extra_block_devs);
 
 /* Boot UI */
 
@@ -106,9 +140,11 @@ SETTER(int, tw_default_y_offset);
 
 GETTER(char *, tw_brightness_path);
 SETTER(const char *, tw_brightness_path);
+REF_GETTER(tw_brightness_path);
 
 GETTER(char *, tw_secondary_brightness_path);
 SETTER(const char *, tw_secondary_brightness_path);
+REF_GETTER(tw_secondary_brightness_path);
 
 GETTER(int, tw_max_brightness);
 SETTER(int, tw_max_brightness);
@@ -118,27 +154,42 @@ SETTER(int, tw_default_brightness);
 
 GETTER(char *, tw_battery_path);
 SETTER(const char *, tw_battery_path);
+REF_GETTER(tw_battery_path);
 
 GETTER(char *, tw_cpu_temp_path);
 SETTER(const char *, tw_cpu_temp_path);
+REF_GETTER(tw_cpu_temp_path);
 
 GETTER(char *, tw_input_blacklist);
 SETTER(const char *, tw_input_blacklist);
+REF_GETTER(tw_input_blacklist);
 
 GETTER(char *, tw_input_whitelist);
 SETTER(const char *, tw_input_whitelist);
+REF_GETTER(tw_input_whitelist);
 
 GETTER(char * const *, tw_graphics_backends);
 SETTER(char const * const *, tw_graphics_backends);
+ARRAY_REF_GETTERS(tw_graphics_backends);
 
 GETTER(char *, tw_theme);
 SETTER(const char *, tw_theme);
+REF_GETTER(tw_theme);
 
 MB_EXPORT uint32_t mb_device_validate(const CDevice *device);
 
 MB_EXPORT bool mb_device_equals(const CDevice *a, const CDevice *b);
 
+/*
+ * Fills summaries[i] for each of the count devices. The strings are borrowed
+ * with the same lifetime rules as the *_ref() getters.
+ */
+MB_EXPORT void mb_device_summaries(const CDevice * const *devices, size_t count,
+                                   CDeviceSummary *summaries);
+
 #undef GETTER
 #undef SETTER
+#undef REF_GETTER
+#undef ARRAY_REF_GETTERS
 
 MB_END_C_DECLS
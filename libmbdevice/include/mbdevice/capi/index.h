@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbdevice/capi/device.h"
+
+#include <cstddef>
+
+MB_BEGIN_C_DECLS
+
+struct CDeviceIndex;
+typedef CDeviceIndex CDeviceIndex;
+
+MB_EXPORT CDeviceIndex * mb_device_index_new(const CDevice * const *devices);
+
+MB_EXPORT void mb_device_index_free(CDeviceIndex *index);
+
+MB_EXPORT bool mb_device_index_find(const CDeviceIndex *index,
+                                    const char *codename, size_t *device_out);
+
+MB_EXPORT bool mb_device_index_find_first(const CDeviceIndex *index,
+                                          const char *codename1,
+                                          const char *codename2,
+                                          size_t *device_out);
+
+MB_END_C_DECLS
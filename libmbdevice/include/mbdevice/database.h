@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+class MB_EXPORT DeviceDatabase
+{
+public:
+    DeviceDatabase();
+    ~DeviceDatabase();
+
+    MB_DEFAULT_COPY_CONSTRUCT_AND_ASSIGN(DeviceDatabase)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(DeviceDatabase)
+
+    bool load(const void *data, size_t size);
+
+    size_t size() const;
+
+    std::optional<size_t> find_by_id(std::string_view id) const;
+    std::optional<size_t> find_by_codename(std::string_view codename) const;
+
+    std::string_view id(size_t index) const;
+    std::string_view name(size_t index) const;
+    std::vector<std::string_view> codenames(size_t index) const;
+
+    Device device(size_t index) const;
+
+private:
+    const unsigned char *m_data;
+    size_t m_size;
+};
+
+MB_EXPORT bool is_device_database(const void *data, size_t size);
+
+MB_EXPORT bool device_list_to_database(const std::vector<Device> &devices,
+                                       std::string &data);
+
+}
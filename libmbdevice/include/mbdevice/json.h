@@ -53,4 +53,6 @@ MB_EXPORT bool device_list_from_json(const std::string &json,
 
 MB_EXPORT bool device_to_json(const Device &device, std::string &json);
 
+MB_EXPORT void device_list_mark_validated(std::string &json);
+
 }
@@ -30,6 +30,25 @@
     TYPE mb_device_ ## NAME (const CDevice *device)
 #define SETTER(TYPE, NAME) \
     void mb_device_set_ ## NAME (CDevice *device, TYPE value)
+#define REF_GETTER(NAME) \
+    const char * mb_device_ ## NAME ## _ref (const CDevice *device) \
+    { \
+        CCAST(device); \
+        return d->NAME().c_str(); \
+    }
+#define ARRAY_REF_GETTERS(NAME) \
+    size_t mb_device_ ## NAME ## _count (const CDevice *device) \
+    { \
+        CCAST(device); \
+        return d->NAME().size(); \
+    } \
+    const char * mb_device_ ## NAME ## _ref_at (const CDevice *device, \
+                                              size_t index) \
+    { \
+        CCAST(device); \
+        auto const &array = d->NAME(); \
+        return index < array.size() ? array[index].c_str() : nullptr; \
+    }
 
 #define CAST(x) \
     assert(x != nullptr); \
@@ -65,6 +84,8 @@ SETTER(const char *, id)
     d->set_id(capi_cstr_to_str(value));
 }
 
+REF_GETTER(id)
+
 GETTER(char * const *, codenames)
 {
     CCAST(device);
@@ -77,6 +98,8 @@ SETTER(char const * const *, codenames)
     d->set_codenames(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(codenames)
+
 GETTER(char *, name)
 {
     CCAST(device);
@@ -89,6 +112,8 @@ SETTER(const char *, name)
     d->set_name(capi_cstr_to_str(value));
 }
 
+REF_GETTER(name)
+
 GETTER(char *, architecture)
 {
     CCAST(device);
@@ -101,6 +126,8 @@ SETTER(const char *, architecture)
     d->set_architecture(capi_cstr_to_str(value));
 }
 
+REF_GETTER(architecture)
+
 GETTER(uint32_t, flags)
 {
     CCAST(device);
@@ -125,6 +152,8 @@ SETTER(char const * const *, block_dev_base_dirs)
     d->set_block_dev_base_dirs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(block_dev_base_dirs)
+
 GETTER(char * const *, system_block_devs)
 {
     CCAST(device);
@@ -137,6 +166,8 @@ SETTER(char const * const *, system_block_devs)
     d->set_system_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(system_block_devs)
+
 GETTER(char * const *, cache_block_devs)
 {
     CCAST(device);
@@ -149,6 +180,8 @@ SETTER(char const * const *, cache_block_devs)
     d->set_cache_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(cache_block_devs)
+
 GETTER(char * const *, data_block_devs)
 {
     CCAST(device);
@@ -161,6 +194,8 @@ SETTER(char const * const *, data_block_devs)
     d->set_data_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(data_block_devs)
+
 GETTER(char * const *, boot_block_devs)
 {
     CCAST(device);
@@ -173,6 +208,8 @@ SETTER(char const * const *, boot_block_devs)
     d->set_boot_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(boot_block_devs)
+
 GETTER(char * const *, recovery_block_devs)
 {
     CCAST(device);
@@ -185,6 +222,8 @@ SETTER(char const * const *, recovery_block_devs)
     d->set_recovery_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(recovery_block_devs)
+
 GETTER(char * const *, extra_block_devs)
 {
     CCAST(device);
@@ -197,6 +236,8 @@ SETTER(char const * const *, extra_block_devs)
     d->set_extra_block_devs(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(extra_block_devs)
+
 /* Boot UI */
 
 GETTER(bool, tw_supported)
@@ -297,6 +338,8 @@ SETTER(const char *, tw_brightness_path)
     d->set_tw_brightness_path(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_brightness_path)
+
 GETTER(char *, tw_secondary_brightness_path)
 {
     CCAST(device);
@@ -309,6 +352,8 @@ SETTER(const char *, tw_secondary_brightness_path)
     d->set_tw_secondary_brightness_path(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_secondary_brightness_path)
+
 GETTER(int, tw_max_brightness)
 {
     CCAST(device);
@@ -345,6 +390,8 @@ SETTER(const char *, tw_battery_path)
     d->set_tw_battery_path(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_battery_path)
+
 GETTER(char *, tw_cpu_temp_path)
 {
     CCAST(device);
@@ -357,6 +404,8 @@ SETTER(const char *, tw_cpu_temp_path)
     d->set_tw_cpu_temp_path(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_cpu_temp_path)
+
 GETTER(char *, tw_input_blacklist)
 {
     CCAST(device);
@@ -369,6 +418,8 @@ SETTER(const char *, tw_input_blacklist)
     d->set_tw_input_blacklist(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_input_blacklist)
+
 GETTER(char *, tw_input_whitelist)
 {
     CCAST(device);
@@ -381,6 +432,8 @@ SETTER(const char *, tw_input_whitelist)
     d->set_tw_input_whitelist(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_input_whitelist)
+
 GETTER(char * const *, tw_graphics_backends)
 {
     CCAST(device);
@@ -393,6 +446,8 @@ SETTER(char const * const *, tw_graphics_backends)
     d->set_tw_graphics_backends(capi_cstr_array_to_vector(value));
 }
 
+ARRAY_REF_GETTERS(tw_graphics_backends)
+
 GETTER(char *, tw_theme)
 {
     CCAST(device);
@@ -405,6 +460,8 @@ SETTER(const char *, tw_theme)
     d->set_tw_theme(capi_cstr_to_str(value));
 }
 
+REF_GETTER(tw_theme)
+
 uint32_t mb_device_validate(const CDevice *device)
 {
     CCAST(device);
@@ -419,4 +476,19 @@ bool mb_device_equals(const CDevice *a, const CDevice *b)
     return *device_a == *device_b;
 }
 
+void mb_device_summaries(const CDevice * const *devices, size_t count,
+                         CDeviceSummary *summaries)
+{
+    for (size_t i = 0; i < count; ++i) {
+        CCAST(devices[i]);
+        CDeviceSummary &summary = summaries[i];
+
+        summary.id = d->id().c_str();
+        summary.name = d->name().c_str();
+        summary.architecture = d->architecture().c_str();
+        summary.flags = d->flags();
+        summary.tw_supported = d->tw_supported();
+    }
+}
+
 MB_END_C_DECLS
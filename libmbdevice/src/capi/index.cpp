@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/capi/index.h"
+
+#include <cassert>
+
+#include "mbdevice/index.h"
+
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *di = reinterpret_cast<const DeviceIndex *>(x);
+
+using namespace mb;
+using namespace mb::device;
+
+static bool set_result(const std::optional<size_t> &result, size_t *device_out)
+{
+    if (!result) {
+        return false;
+    }
+
+    if (device_out) {
+        *device_out = *result;
+    }
+    return true;
+}
+
+MB_BEGIN_C_DECLS
+
+/*!
+ * \brief Build a codename index for a NULL-terminated device list
+ *
+ * The positions returned by mb_device_index_find() refer to \p devices, such
+ * as the array returned by mb_device_new_list_from_json().
+ */
+CDeviceIndex * mb_device_index_new(const CDevice * const *devices)
+{
+    assert(devices != nullptr);
+
+    auto *di = new DeviceIndex();
+
+    for (size_t i = 0; devices[i]; ++i) {
+        di->add(*reinterpret_cast<const Device *>(devices[i]), i);
+    }
+
+    return reinterpret_cast<CDeviceIndex *>(di);
+}
+
+void mb_device_index_free(CDeviceIndex *index)
+{
+    delete reinterpret_cast<DeviceIndex *>(index);
+}
+
+bool mb_device_index_find(const CDeviceIndex *index,
+                          const char *codename, size_t *device_out)
+{
+    CCAST(index);
+    assert(codename != nullptr);
+
+    return set_result(di->find(codename), device_out);
+}
+
+bool mb_device_index_find_first(const CDeviceIndex *index,
+                                const char *codename1, const char *codename2,
+                                size_t *device_out)
+{
+    CCAST(index);
+    assert(codename1 != nullptr);
+    assert(codename2 != nullptr);
+
+    return set_result(di->find_first(codename1, codename2), device_out);
+}
+
+MB_END_C_DECLS
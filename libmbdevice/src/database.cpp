@@ -0,0 +1,778 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/database.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+/*
+ * Binary device database format
+ *
+ * All integers are little endian and every table starts on a 4-byte boundary.
+ *
+ * - Header
+ * - Device records (DbRecord[device_count])
+ * - Device indexes sorted by ID (uint32_t[device_count])
+ * - Codename index sorted by codename, then device index
+ *   (DbCodename[codename_count])
+ * - String references (DbString[string_count])
+ * - String data. Every string is followed by a NUL byte.
+ *
+ * String fields in a record are indexes into the string reference table. List
+ * fields refer to a contiguous range of entries in the same table.
+ */
+
+namespace mb::device
+{
+
+constexpr char DB_MAGIC[8] = { 'M', 'B', 'D', 'E', 'V', 'D', 'B', '\0' };
+constexpr uint32_t DB_VERSION = 1;
+
+namespace
+{
+
+struct DbHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t device_count;
+    uint32_t records_offset;
+    uint32_t id_index_offset;
+    uint32_t codename_index_offset;
+    uint32_t codename_count;
+    uint32_t strings_offset;
+    uint32_t string_count;
+    uint32_t data_offset;
+    uint32_t data_size;
+};
+
+struct DbString
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct DbList
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+struct DbCodename
+{
+    uint32_t string;
+    uint32_t device;
+};
+
+struct DbRecord
+{
+    uint32_t id;
+    uint32_t name;
+    uint32_t architecture;
+    uint32_t flags;
+    DbList codenames;
+    DbList base_dirs;
+    DbList system_devs;
+    DbList cache_devs;
+    DbList data_devs;
+    DbList boot_devs;
+    DbList recovery_devs;
+    DbList extra_devs;
+
+    uint32_t tw_supported;
+    uint32_t tw_flags;
+    uint32_t tw_pixel_format;
+    uint32_t tw_force_pixel_format;
+    uint32_t tw_overscan_percent;
+    uint32_t tw_default_x_offset;
+    uint32_t tw_default_y_offset;
+    uint32_t tw_brightness_path;
+    uint32_t tw_secondary_brightness_path;
+    uint32_t tw_max_brightness;
+    uint32_t tw_default_brightness;
+    uint32_t tw_battery_path;
+    uint32_t tw_cpu_temp_path;
+    uint32_t tw_input_blacklist;
+    uint32_t tw_input_whitelist;
+    DbList tw_graphics_backends;
+    uint32_t tw_theme;
+};
+
+static_assert(sizeof(DbHeader) % 4 == 0);
+static_assert(sizeof(DbRecord) % 4 == 0);
+
+// The database may come from a read-only mapping with any alignment, so
+// fields are always copied out instead of being accessed in place
+
+template<typename T>
+T read_struct(const unsigned char *data, size_t offset)
+{
+    T value;
+    memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+
+uint32_t read_u32(const unsigned char *data, size_t offset)
+{
+    return mb_le32toh(read_struct<uint32_t>(data, offset));
+}
+
+DbHeader read_header(const unsigned char *data)
+{
+    auto h = read_struct<DbHeader>(data, 0);
+    h.version = mb_le32toh(h.version);
+    h.device_count = mb_le32toh(h.device_count);
+    h.records_offset = mb_le32toh(h.records_offset);
+    h.id_index_offset = mb_le32toh(h.id_index_offset);
+    h.codename_index_offset = mb_le32toh(h.codename_index_offset);
+    h.codename_count = mb_le32toh(h.codename_count);
+    h.strings_offset = mb_le32toh(h.strings_offset);
+    h.string_count = mb_le32toh(h.string_count);
+    h.data_offset = mb_le32toh(h.data_offset);
+    h.data_size = mb_le32toh(h.data_size);
+    return h;
+}
+
+// Every field of the table entries is a uint32_t, so byte swapping can be
+// done generically. The conversion is its own inverse.
+template<typename T>
+void swap_le32(T &value)
+{
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0);
+
+    uint32_t words[sizeof(T) / sizeof(uint32_t)];
+    memcpy(words, &value, sizeof(T));
+    for (auto &w : words) {
+        w = mb_le32toh(w);
+    }
+    memcpy(&value, words, sizeof(T));
+}
+
+bool table_in_bounds(size_t size, uint32_t offset, uint64_t count,
+                     size_t elem_size)
+{
+    return offset % 4 == 0 && offset <= size
+            && count * elem_size <= size - offset;
+}
+
+}
+
+/*!
+ * \class DeviceDatabase
+ *
+ * \brief Read-only view of a binary device database
+ *
+ * The database is generated by `devicesgen --binary` (or
+ * device_list_to_database()). Lookups and field accesses read directly from
+ * the buffer passed to load() without parsing or allocating, so the buffer
+ * can be a memory-mapped file. The buffer must outlive the DeviceDatabase.
+ */
+
+DeviceDatabase::DeviceDatabase()
+    : m_data(nullptr)
+    , m_size(0)
+{
+}
+
+DeviceDatabase::~DeviceDatabase() = default;
+
+/*!
+ * \brief Load a binary device database
+ *
+ * The header and all offsets are checked so that later accesses cannot read
+ * outside of the buffer. The buffer is not copied.
+ *
+ * \param data Pointer to database
+ * \param size Size of database
+ *
+ * \return Whether the buffer contains a valid database
+ */
+bool DeviceDatabase::load(const void *data, size_t size)
+{
+    m_data = nullptr;
+    m_size = 0;
+
+    if (!is_device_database(data, size)) {
+        return false;
+    }
+
+    auto const *buf = static_cast<const unsigned char *>(data);
+    auto const h = read_header(buf);
+
+    if (h.version != DB_VERSION
+            || !table_in_bounds(size, h.records_offset, h.device_count,
+                                sizeof(DbRecord))
+            || !table_in_bounds(size, h.id_index_offset, h.device_count,
+                                sizeof(uint32_t))
+            || !table_in_bounds(size, h.codename_index_offset,
+                                h.codename_count, sizeof(DbCodename))
+            || !table_in_bounds(size, h.strings_offset, h.string_count,
+                                sizeof(DbString))
+            || !table_in_bounds(size, h.data_offset, h.data_size, 1)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h.string_count; ++i) {
+        auto s = read_struct<DbString>(
+                buf, h.strings_offset + i * sizeof(DbString));
+        swap_le32(s);
+        if (s.offset > h.data_size || s.size > h.data_size - s.offset) {
+            return false;
+        }
+    }
+
+    auto valid_string = [&](uint32_t index) {
+        return index < h.string_count;
+    };
+    auto valid_list = [&](const DbList &list) {
+        return list.first <= h.string_count
+                && list.count <= h.string_count - list.first;
+    };
+
+    for (uint32_t i = 0; i < h.device_count; ++i) {
+        auto r = read_struct<DbRecord>(
+                buf, h.records_offset + i * sizeof(DbRecord));
+        swap_le32(r);
+
+        if (!valid_string(r.id) || !valid_string(r.name)
+                || !valid_string(r.architecture)
+                || !valid_list(r.codenames) || !valid_list(r.base_dirs)
+                || !valid_list(r.system_devs) || !valid_list(r.cache_devs)
+                || !valid_list(r.data_devs) || !valid_list(r.boot_devs)
+                || !valid_list(r.recovery_devs) || !valid_list(r.extra_devs)
+                || !valid_string(r.tw_brightness_path)
+                || !valid_string(r.tw_secondary_brightness_path)
+                || !valid_string(r.tw_battery_path)
+                || !valid_string(r.tw_cpu_temp_path)
+                || !valid_string(r.tw_input_blacklist)
+                || !valid_string(r.tw_input_whitelist)
+                || !valid_list(r.tw_graphics_backends)
+                || !valid_string(r.tw_theme)) {
+            return false;
+        }
+
+        if (read_u32(buf, h.id_index_offset + i * sizeof(uint32_t))
+                >= h.device_count) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < h.codename_count; ++i) {
+        auto c = read_struct<DbCodename>(
+                buf, h.codename_index_offset + i * sizeof(DbCodename));
+        swap_le32(c);
+        if (!valid_string(c.string) || c.device >= h.device_count) {
+            return false;
+        }
+    }
+
+    m_data = buf;
+    m_size = size;
+    return true;
+}
+
+/*!
+ * \brief Number of devices in the database
+ */
+size_t DeviceDatabase::size() const
+{
+    return m_data ? read_header(m_data).device_count : 0;
+}
+
+static std::string_view db_string(const unsigned char *data,
+                                  const DbHeader &h, uint32_t index)
+{
+    auto s = read_struct<DbString>(
+            data, h.strings_offset + index * sizeof(DbString));
+    swap_le32(s);
+    return { reinterpret_cast<const char *>(data) + h.data_offset + s.offset,
+             s.size };
+}
+
+static std::vector<std::string> db_list(const unsigned char *data,
+                                        const DbHeader &h, const DbList &list)
+{
+    std::vector<std::string> result;
+    result.reserve(list.count);
+    for (uint32_t i = 0; i < list.count; ++i) {
+        result.emplace_back(db_string(data, h, list.first + i));
+    }
+    return result;
+}
+
+static DbRecord db_record(const unsigned char *data, const DbHeader &h,
+                          size_t index)
+{
+    auto r = read_struct<DbRecord>(
+            data, h.records_offset + index * sizeof(DbRecord));
+    swap_le32(r);
+    return r;
+}
+
+/*!
+ * \brief Find a device by its ID
+ *
+ * \param id Device ID
+ *
+ * \return Index of the device or std::nullopt if no device has the ID
+ */
+std::optional<size_t> DeviceDatabase::find_by_id(std::string_view id) const
+{
+    if (!m_data) {
+        return std::nullopt;
+    }
+
+    auto const h = read_header(m_data);
+    size_t lo = 0;
+    size_t hi = h.device_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t device = read_u32(
+                m_data, h.id_index_offset + mid * sizeof(uint32_t));
+        auto cmp = db_string(m_data, h, db_record(m_data, h, device).id)
+                .compare(id);
+
+        if (cmp == 0) {
+            return device;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Find a device by one of its codenames
+ *
+ * If multiple devices share a codename, the one that appears first in the
+ * device list is returned, matching a linear search over the JSON list.
+ *
+ * \param codename Device codename
+ *
+ * \return Index of the device or std::nullopt if no device has the codename
+ */
+std::optional<size_t>
+DeviceDatabase::find_by_codename(std::string_view codename) const
+{
+    if (!m_data) {
+        return std::nullopt;
+    }
+
+    auto const h = read_header(m_data);
+    size_t lo = 0;
+    size_t hi = h.codename_count;
+
+    // Lower bound so that the lowest device index wins
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        auto c = read_struct<DbCodename>(
+                m_data, h.codename_index_offset + mid * sizeof(DbCodename));
+        swap_le32(c);
+
+        if (db_string(m_data, h, c.string) < codename) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < h.codename_count) {
+        auto c = read_struct<DbCodename>(
+                m_data, h.codename_index_offset + lo * sizeof(DbCodename));
+        swap_le32(c);
+
+        if (db_string(m_data, h, c.string) == codename) {
+            return c.device;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Get the ID of a device
+ *
+ * \param index Device index (must be less than size())
+ *
+ * \return View of the device ID in the database buffer
+ */
+std::string_view DeviceDatabase::id(size_t index) const
+{
+    auto const h = read_header(m_data);
+    return db_string(m_data, h, db_record(m_data, h, index).id);
+}
+
+/*!
+ * \brief Get the name of a device
+ *
+ * \param index Device index (must be less than size())
+ *
+ * \return View of the device name in the database buffer
+ */
+std::string_view DeviceDatabase::name(size_t index) const
+{
+    auto const h = read_header(m_data);
+    return db_string(m_data, h, db_record(m_data, h, index).name);
+}
+
+/*!
+ * \brief Get the codenames of a device
+ *
+ * \param index Device index (must be less than size())
+ *
+ * \return Views of the codenames in the database buffer
+ */
+std::vector<std::string_view> DeviceDatabase::codenames(size_t index) const
+{
+    auto const h = read_header(m_data);
+    auto const r = db_record(m_data, h, index);
+
+    std::vector<std::string_view> result;
+    result.reserve(r.codenames.count);
+    for (uint32_t i = 0; i < r.codenames.count; ++i) {
+        result.push_back(db_string(m_data, h, r.codenames.first + i));
+    }
+    return result;
+}
+
+/*!
+ * \brief Construct a Device from a database record
+ *
+ * \param index Device index (must be less than size())
+ *
+ * \return Device with all fields copied from the database
+ */
+Device DeviceDatabase::device(size_t index) const
+{
+    auto const h = read_header(m_data);
+    auto const r = db_record(m_data, h, index);
+    auto str = [&](uint32_t i) {
+        return std::string(db_string(m_data, h, i));
+    };
+    auto list = [&](const DbList &l) {
+        return db_list(m_data, h, l);
+    };
+
+    Device device;
+
+    device.set_id(str(r.id));
+    device.set_codenames(list(r.codenames));
+    device.set_name(str(r.name));
+    device.set_architecture(str(r.architecture));
+    device.set_flags(static_cast<DeviceFlag>(r.flags));
+
+    device.set_block_dev_base_dirs(list(r.base_dirs));
+    device.set_system_block_devs(list(r.system_devs));
+    device.set_cache_block_devs(list(r.cache_devs));
+    device.set_data_block_devs(list(r.data_devs));
+    device.set_boot_block_devs(list(r.boot_devs));
+    device.set_recovery_block_devs(list(r.recovery_devs));
+    device.set_extra_block_devs(list(r.extra_devs));
+
+    device.set_tw_supported(r.tw_supported != 0);
+    device.set_tw_flags(static_cast<TwFlag>(r.tw_flags));
+    device.set_tw_pixel_format(static_cast<TwPixelFormat>(r.tw_pixel_format));
+    device.set_tw_force_pixel_format(
+            static_cast<TwForcePixelFormat>(r.tw_force_pixel_format));
+    device.set_tw_overscan_percent(
+            static_cast<int32_t>(r.tw_overscan_percent));
+    device.set_tw_default_x_offset(
+            static_cast<int32_t>(r.tw_default_x_offset));
+    device.set_tw_default_y_offset(
+            static_cast<int32_t>(r.tw_default_y_offset));
+    device.set_tw_brightness_path(str(r.tw_brightness_path));
+    device.set_tw_secondary_brightness_path(
+            str(r.tw_secondary_brightness_path));
+    device.set_tw_max_brightness(static_cast<int32_t>(r.tw_max_brightness));
+    device.set_tw_default_brightness(
+            static_cast<int32_t>(r.tw_default_brightness));
+    device.set_tw_battery_path(str(r.tw_battery_path));
+    device.set_tw_cpu_temp_path(str(r.tw_cpu_temp_path));
+    device.set_tw_input_blacklist(str(r.tw_input_blacklist));
+    device.set_tw_input_whitelist(str(r.tw_input_whitelist));
+    device.set_tw_graphics_backends(list(r.tw_graphics_backends));
+    device.set_tw_theme(str(r.tw_theme));
+
+    return device;
+}
+
+/*!
+ * \brief Check if a buffer starts with a binary device database header
+ *
+ * This only checks the magic bytes. Use DeviceDatabase::load() to validate
+ * the database.
+ *
+ * \param data Pointer to data
+ * \param size Size of data
+ *
+ * \return Whether the data looks like a binary device database
+ */
+bool is_device_database(const void *data, size_t size)
+{
+    return size >= sizeof(DbHeader)
+            && memcmp(data, DB_MAGIC, sizeof(DB_MAGIC)) == 0;
+}
+
+namespace
+{
+
+class DatabaseWriter
+{
+public:
+    uint32_t add_string(const std::string &str)
+    {
+        auto it = m_string_indexes.find(str);
+        if (it != m_string_indexes.end()) {
+            return it->second;
+        }
+
+        uint32_t index = add_string_ref(str);
+        m_string_indexes.emplace(str, index);
+        return index;
+    }
+
+    DbList add_list(const std::vector<std::string> &list)
+    {
+        DbList result;
+        result.first = static_cast<uint32_t>(m_strings.size());
+        result.count = static_cast<uint32_t>(list.size());
+
+        for (auto const &item : list) {
+            add_string_ref(item);
+        }
+
+        return result;
+    }
+
+    std::string_view string(uint32_t index) const
+    {
+        auto const &s = m_strings[index];
+        return { m_data.data() + s.offset, s.size };
+    }
+
+    uint32_t string_count() const
+    {
+        return static_cast<uint32_t>(m_strings.size());
+    }
+
+    void write_strings(std::string &out) const
+    {
+        for (auto s : m_strings) {
+            swap_le32(s);
+            out.append(reinterpret_cast<const char *>(&s), sizeof(s));
+        }
+    }
+
+    const std::string & data() const
+    {
+        return m_data;
+    }
+
+private:
+    // Add a reference to the string's bytes, which are shared with any
+    // identical string added earlier
+    uint32_t add_string_ref(const std::string &str)
+    {
+        auto it = m_data_offsets.find(str);
+        if (it == m_data_offsets.end()) {
+            it = m_data_offsets.emplace(
+                    str, static_cast<uint32_t>(m_data.size())).first;
+            m_data += str;
+            m_data += '\0';
+        }
+
+        DbString s;
+        s.offset = it->second;
+        s.size = static_cast<uint32_t>(str.size());
+        m_strings.push_back(s);
+
+        return static_cast<uint32_t>(m_strings.size() - 1);
+    }
+
+    std::vector<DbString> m_strings;
+    std::string m_data;
+    std::unordered_map<std::string, uint32_t> m_data_offsets;
+    std::unordered_map<std::string, uint32_t> m_string_indexes;
+};
+
+template<typename T>
+void append_le32(std::string &out, T value)
+{
+    swap_le32(value);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void align4(std::string &out)
+{
+    out.resize((out.size() + 3) & ~static_cast<size_t>(3), '\0');
+}
+
+}
+
+/*!
+ * \brief Serialize a list of devices to the binary database format
+ *
+ * \param[in] devices List of devices
+ * \param[out] data Output buffer for the database
+ *
+ * \return Whether the database was successfully created. This fails only if
+ *         the database would exceed 4 GiB.
+ */
+bool device_list_to_database(const std::vector<Device> &devices,
+                             std::string &data)
+{
+    DatabaseWriter w;
+    std::vector<DbRecord> records;
+    std::vector<DbCodename> codenames;
+
+    records.reserve(devices.size());
+
+    for (auto const &d : devices) {
+        DbRecord r{};
+
+        r.id = w.add_string(d.id());
+        r.name = w.add_string(d.name());
+        r.architecture = w.add_string(d.architecture());
+        r.flags = static_cast<uint32_t>(d.flags());
+        r.codenames = w.add_list(d.codenames());
+        r.base_dirs = w.add_list(d.block_dev_base_dirs());
+        r.system_devs = w.add_list(d.system_block_devs());
+        r.cache_devs = w.add_list(d.cache_block_devs());
+        r.data_devs = w.add_list(d.data_block_devs());
+        r.boot_devs = w.add_list(d.boot_block_devs());
+        r.recovery_devs = w.add_list(d.recovery_block_devs());
+        r.extra_devs = w.add_list(d.extra_block_devs());
+
+        r.tw_supported = d.tw_supported();
+        r.tw_flags = static_cast<uint32_t>(d.tw_flags());
+        r.tw_pixel_format = static_cast<uint32_t>(d.tw_pixel_format());
+        r.tw_force_pixel_format =
+                static_cast<uint32_t>(d.tw_force_pixel_format());
+        r.tw_overscan_percent = static_cast<uint32_t>(d.tw_overscan_percent());
+        r.tw_default_x_offset = static_cast<uint32_t>(d.tw_default_x_offset());
+        r.tw_default_y_offset = static_cast<uint32_t>(d.tw_default_y_offset());
+        r.tw_brightness_path = w.add_string(d.tw_brightness_path());
+        r.tw_secondary_brightness_path =
+                w.add_string(d.tw_secondary_brightness_path());
+        r.tw_max_brightness = static_cast<uint32_t>(d.tw_max_brightness());
+        r.tw_default_brightness =
+                static_cast<uint32_t>(d.tw_default_brightness());
+        r.tw_battery_path = w.add_string(d.tw_battery_path());
+        r.tw_cpu_temp_path = w.add_string(d.tw_cpu_temp_path());
+        r.tw_input_blacklist = w.add_string(d.tw_input_blacklist());
+        r.tw_input_whitelist = w.add_string(d.tw_input_whitelist());
+        r.tw_graphics_backends = w.add_list(d.tw_graphics_backends());
+        r.tw_theme = w.add_string(d.tw_theme());
+
+        for (uint32_t i = 0; i < r.codenames.count; ++i) {
+            codenames.push_back({ r.codenames.first + i,
+                                  static_cast<uint32_t>(records.size()) });
+        }
+
+        records.push_back(r);
+    }
+
+    std::vector<uint32_t> id_index(records.size());
+    for (size_t i = 0; i < id_index.size(); ++i) {
+        id_index[i] = static_cast<uint32_t>(i);
+    }
+    std::stable_sort(id_index.begin(), id_index.end(),
+                     [&](uint32_t a, uint32_t b) {
+        return w.string(records[a].id) < w.string(records[b].id);
+    });
+
+    // Ties are broken by device index so lookups find the first device
+    std::sort(codenames.begin(), codenames.end(),
+              [&](const DbCodename &a, const DbCodename &b) {
+        auto sa = w.string(a.string);
+        auto sb = w.string(b.string);
+        return sa < sb || (sa == sb && a.device < b.device);
+    });
+
+    uint64_t records_offset = sizeof(DbHeader);
+    uint64_t id_index_offset =
+            records_offset + records.size() * sizeof(DbRecord);
+    uint64_t codename_index_offset =
+            id_index_offset + id_index.size() * sizeof(uint32_t);
+    uint64_t strings_offset =
+            codename_index_offset + codenames.size() * sizeof(DbCodename);
+    uint64_t data_offset =
+            strings_offset + static_cast<uint64_t>(w.string_count()) * sizeof(DbString);
+
+    if (data_offset + w.data().size() + 3 > UINT32_MAX) {
+        return false;
+    }
+
+    DbHeader h;
+    memcpy(h.magic, DB_MAGIC, sizeof(DB_MAGIC));
+    h.version = DB_VERSION;
+    h.device_count = static_cast<uint32_t>(records.size());
+    h.records_offset = static_cast<uint32_t>(records_offset);
+    h.id_index_offset = static_cast<uint32_t>(id_index_offset);
+    h.codename_index_offset = static_cast<uint32_t>(codename_index_offset);
+    h.codename_count = static_cast<uint32_t>(codenames.size());
+    h.strings_offset = static_cast<uint32_t>(strings_offset);
+    h.string_count = w.string_count();
+    h.data_offset = static_cast<uint32_t>(data_offset);
+    h.data_size = static_cast<uint32_t>(w.data().size());
+
+    std::string out;
+    out.reserve(static_cast<size_t>(data_offset) + w.data().size() + 3);
+
+    out.append(h.magic, sizeof(h.magic));
+    append_le32(out, h.version);
+    append_le32(out, h.device_count);
+    append_le32(out, h.records_offset);
+    append_le32(out, h.id_index_offset);
+    append_le32(out, h.codename_index_offset);
+    append_le32(out, h.codename_count);
+    append_le32(out, h.strings_offset);
+    append_le32(out, h.string_count);
+    append_le32(out, h.data_offset);
+    append_le32(out, h.data_size);
+
+    for (auto const &r : records) {
+        append_le32(out, r);
+    }
+    for (auto i : id_index) {
+        append_le32(out, i);
+    }
+    for (auto const &c : codenames) {
+        append_le32(out, c);
+    }
+    w.write_strings(out);
+    out += w.data();
+    align4(out);
+
+    data.swap(out);
+    return true;
+}
+
+}
@@ -40,7 +40,7 @@ Device::~Device() = default;
  *
  * \return Device ID
  */
-std::string Device::id() const
+const std::string & Device::id() const
 {
     return m_base.id;
 }
@@ -60,7 +60,7 @@ void Device::set_id(std::string id)
  *
  * \return List of device names
  */
-std::vector<std::string> Device::codenames() const
+const std::vector<std::string> & Device::codenames() const
 {
     return m_base.codenames;
 }
@@ -80,7 +80,7 @@ void Device::set_codenames(std::vector<std::string> codenames)
  *
  * \return Device name
  */
-std::string Device::name() const
+const std::string & Device::name() const
 {
     return m_base.name;
 }
@@ -100,7 +100,7 @@ void Device::set_name(std::string name)
  *
  * \return Device architecture
  */
-std::string Device::architecture() const
+const std::string & Device::architecture() const
 {
     return m_base.architecture;
 }
@@ -130,7 +130,7 @@ void Device::set_flags(DeviceFlags flags)
  *
  * \return List of block device base directories
  */
-std::vector<std::string> Device::block_dev_base_dirs() const
+const std::vector<std::string> & Device::block_dev_base_dirs() const
 {
     return m_base.base_dirs;
 }
@@ -150,7 +150,7 @@ void Device::set_block_dev_base_dirs(std::vector<std::string> base_dirs)
  *
  * \return List of system block device paths
  */
-std::vector<std::string> Device::system_block_devs() const
+const std::vector<std::string> & Device::system_block_devs() const
 {
     return m_base.system_devs;
 }
@@ -170,7 +170,7 @@ void Device::set_system_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of cache block device paths
  */
-std::vector<std::string> Device::cache_block_devs() const
+const std::vector<std::string> & Device::cache_block_devs() const
 {
     return m_base.cache_devs;
 }
@@ -190,7 +190,7 @@ void Device::set_cache_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of data block device paths
  */
-std::vector<std::string> Device::data_block_devs() const
+const std::vector<std::string> & Device::data_block_devs() const
 {
     return m_base.data_devs;
 }
@@ -210,7 +210,7 @@ void Device::set_data_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of boot block device paths
  */
-std::vector<std::string> Device::boot_block_devs() const
+const std::vector<std::string> & Device::boot_block_devs() const
 {
     return m_base.boot_devs;
 }
@@ -230,7 +230,7 @@ void Device::set_boot_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of recovery block devices
  */
-std::vector<std::string> Device::recovery_block_devs() const
+const std::vector<std::string> & Device::recovery_block_devs() const
 {
     return m_base.recovery_devs;
 }
@@ -250,7 +250,7 @@ void Device::set_recovery_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of extra block device paths
  */
-std::vector<std::string> Device::extra_block_devs() const
+const std::vector<std::string> & Device::extra_block_devs() const
 {
     return m_base.extra_devs;
 }
@@ -335,7 +335,7 @@ void Device::set_tw_default_y_offset(int offset)
     m_tw.default_y_offset = offset;
 }
 
-std::string Device::tw_brightness_path() const
+const std::string & Device::tw_brightness_path() const
 {
     return m_tw.brightness_path;
 }
@@ -345,7 +345,7 @@ void Device::set_tw_brightness_path(std::string path)
     m_tw.brightness_path = std::move(path);
 }
 
-std::string Device::tw_secondary_brightness_path() const
+const std::string & Device::tw_secondary_brightness_path() const
 {
     return m_tw.secondary_brightness_path;
 }
@@ -375,7 +375,7 @@ void Device::set_tw_default_brightness(int value)
     m_tw.default_brightness = value;
 }
 
-std::string Device::tw_battery_path() const
+const std::string & Device::tw_battery_path() const
 {
     return m_tw.battery_path;
 }
@@ -385,7 +385,7 @@ void Device::set_tw_battery_path(std::string path)
     m_tw.battery_path = std::move(path);
 }
 
-std::string Device::tw_cpu_temp_path() const
+const std::string & Device::tw_cpu_temp_path() const
 {
     return m_tw.cpu_temp_path;
 }
@@ -395,7 +395,7 @@ void Device::set_tw_cpu_temp_path(std::string path)
     m_tw.cpu_temp_path = std::move(path);
 }
 
-std::string Device::tw_input_blacklist() const
+const std::string & Device::tw_input_blacklist() const
 {
     return m_tw.input_blacklist;
 }
@@ -405,7 +405,7 @@ void Device::set_tw_input_blacklist(std::string blacklist)
     m_tw.input_blacklist = std::move(blacklist);
 }
 
-std::string Device::tw_input_whitelist() const
+const std::string & Device::tw_input_whitelist() const
 {
     return m_tw.input_whitelist;
 }
@@ -415,7 +415,7 @@ void Device::set_tw_input_whitelist(std::string whitelist)
     m_tw.input_whitelist = std::move(whitelist);
 }
 
-std::vector<std::string> Device::tw_graphics_backends() const
+const std::vector<std::string> & Device::tw_graphics_backends() const
 {
     return m_tw.graphics_backends;
 }
@@ -425,7 +425,7 @@ void Device::set_tw_graphics_backends(std::vector<std::string> backends)
     m_tw.graphics_backends = std::move(backends);
 }
 
-std::string Device::tw_theme() const
+const std::string & Device::tw_theme() const
 {
     return m_tw.theme;
 }
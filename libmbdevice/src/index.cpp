@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/index.h"
+
+namespace mb::device
+{
+
+/*!
+ * \class DeviceIndex
+ *
+ * \brief Hashed lookup table from codenames to devices in a device list
+ *
+ * The index stores positions in the list that it was built from. It must be
+ * rebuilt if that list is modified.
+ */
+
+DeviceIndex::DeviceIndex() = default;
+
+/*!
+ * \brief Construct an index for a device list
+ *
+ * \param devices Device list
+ */
+DeviceIndex::DeviceIndex(const std::vector<Device> &devices)
+{
+    build(devices);
+}
+
+DeviceIndex::~DeviceIndex() = default;
+
+/*!
+ * \brief Rebuild the index for a device list
+ *
+ * If multiple devices share a codename, the one that appears first in the
+ * device list wins, matching a linear search over the list.
+ *
+ * \param devices Device list
+ */
+void DeviceIndex::build(const std::vector<Device> &devices)
+{
+    clear();
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        add(devices[i], i);
+    }
+}
+
+/*!
+ * \brief Add the codenames of a device to the index
+ *
+ * Codenames that are already in the index keep their existing position.
+ *
+ * \param device Device
+ * \param position Position of the device in the list
+ */
+void DeviceIndex::add(const Device &device, size_t position)
+{
+    for (auto const &codename : device.codenames()) {
+        m_codenames.emplace(codename, position);
+    }
+}
+
+/*!
+ * \brief Remove all codenames from the index
+ */
+void DeviceIndex::clear()
+{
+    m_codenames.clear();
+}
+
+/*!
+ * \brief Get number of distinct codenames in the index
+ */
+size_t DeviceIndex::size() const
+{
+    return m_codenames.size();
+}
+
+/*!
+ * \brief Find a device by one of its codenames
+ *
+ * \param codename Device codename
+ *
+ * \return Index of the device in the list or std::nullopt if no device has the
+ *         codename
+ */
+std::optional<size_t> DeviceIndex::find(std::string_view codename) const
+{
+    auto it = m_codenames.find(std::string(codename));
+    if (it == m_codenames.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+/*!
+ * \brief Find the first device that has either of two codenames
+ *
+ * This is meant for matching both `ro.product.device` and `ro.build.product`
+ * in a single call.
+ *
+ * \param codename1 First device codename
+ * \param codename2 Second device codename
+ *
+ * \return Lowest index of a device in the list that has either codename or
+ *         std::nullopt if neither codename is known
+ */
+std::optional<size_t> DeviceIndex::find_first(std::string_view codename1,
+                                              std::string_view codename2) const
+{
+    auto index1 = find(codename1);
+    auto index2 = find(codename2);
+
+    if (index2 && (!index1 || *index2 < *index1)) {
+        return index2;
+    }
+    return index1;
+}
+
+}
@@ -20,8 +20,11 @@
 #include "mbdevice/json.h"
 
 #include <array>
+#include <optional>
 
 #include <cassert>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 
 #include <rapidjson/document.h>
@@ -44,6 +47,12 @@ using TwFlagMapping = std::pair<const char *, TwFlag>;
 using TwPixelFormatMapping = std::pair<const char *, TwPixelFormat>;
 using TwForcePixelFormatMapping = std::pair<const char *, TwForcePixelFormat>;
 
+// devicesgen appends this line after a device list that it has validated
+// against the schema. The marker is followed by the FNV-1a hash of all bytes
+// before it, so that a file that was edited afterwards is validated again.
+static constexpr char VALIDATED_MARKER[] = "\n#mbdevice-validated ";
+static constexpr size_t VALIDATED_HASH_DIGITS = 16;
+
 static constexpr std::array<DeviceFlagMapping, 2> g_device_flag_mappings{{
     { "HAS_COMBINED_BOOT_AND_RECOVERY", DeviceFlag::HasCombinedBootAndRecovery },
     { "FSTAB_SKIP_SDCARD0",             DeviceFlag::FstabSkipSdcard0 },
@@ -323,10 +332,113 @@ bool device_from_json(const std::string &json, Device &device, JsonError &error)
     return true;
 }
 
+static uint64_t fnv1a_64(const char *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static std::string validated_marker(const char *data, size_t size)
+{
+    char hash[VALIDATED_HASH_DIGITS + 1];
+    snprintf(hash, sizeof(hash), "%016" PRIx64, fnv1a_64(data, size));
+
+    std::string marker(VALIDATED_MARKER);
+    marker += hash;
+    marker += '\n';
+    return marker;
+}
+
+// Find the validated marker at the end of the JSON. Returns the size of the
+// document before the marker. |trusted| is set if the hash matches.
+static std::optional<size_t> find_validated_marker(const std::string &json,
+                                                   bool &trusted)
+{
+    trusted = false;
+
+    auto pos = json.rfind(VALIDATED_MARKER);
+    if (pos == std::string::npos) {
+        return std::nullopt;
+    }
+
+    // Allow the NUL terminator that callers often add
+    size_t end = json.size();
+    if (end > pos && json[end - 1] == '\0') {
+        --end;
+    }
+
+    auto expected = validated_marker(json.data(), pos);
+    trusted = json.compare(pos, end - pos, expected) == 0;
+    return pos;
+}
+
+static bool process_device_list(const Document &d,
+                                std::vector<Device> &devices)
+{
+    std::vector<Device> array;
+
+    for (auto const &item : d.GetArray()) {
+        Device device;
+        process_device(device, item);
+        array.push_back(std::move(device));
+    }
+
+    devices.swap(array);
+    return true;
+}
+
+/*!
+ * \brief Append the marker for a device list that was validated by devicesgen
+ *
+ * A list carrying a matching marker is parsed without schema validation by
+ * device_list_from_json() in release builds.
+ *
+ * \param json JSON device list that passed schema validation
+ */
+void device_list_mark_validated(std::string &json)
+{
+    json += validated_marker(json.data(), json.size());
+}
+
 bool device_list_from_json(const std::string &json,
                            std::vector<Device> &devices,
                            JsonError &error)
 {
+    bool trusted;
+    auto marker_pos = find_validated_marker(json, trusted);
+
+#ifdef NDEBUG
+    // The document was validated when it was generated. Skip the schema and
+    // parse in place to avoid copying every string.
+    if (trusted) {
+        std::vector<char> buf(json.begin(), json.begin()
+                + static_cast<std::string::difference_type>(*marker_pos));
+        buf.push_back('\0');
+
+        Document d;
+        d.ParseInsitu<kParseStopWhenDoneFlag>(buf.data());
+        if (d.HasParseError()) {
+            json_error_set_parse_error(error, d.GetErrorOffset(),
+                                       GetParseError_En(d.GetParseError()));
+            return false;
+        }
+
+        return process_device_list(d, devices);
+    }
+#endif
+
+    // Full validation for untrusted input and debug builds. A marker with a
+    // wrong hash is ignored rather than parsed as trailing garbage.
+    std::string stripped;
+    if (marker_pos) {
+        stripped = json.substr(0, *marker_pos);
+    }
+    const std::string &doc = marker_pos ? stripped : json;
+
     DeviceSchemaProvider<> sp;
     const SchemaDocument *sd = sp.GetSchema("device_list.json");
     if (!sd) {
@@ -335,7 +447,7 @@ bool device_list_from_json(const std::string &json,
     }
 
     Document d;
-    StringStream is(json.c_str());
+    StringStream is(doc.c_str());
     SchemaValidatingReader<kParseDefaultFlags, StringStream, UTF8<>> reader(is, *sd);
     d.Populate(reader);
 
@@ -359,16 +471,7 @@ bool device_list_from_json(const std::string &json,
         return false;
     }
 
-    std::vector<Device> array;
-
-    for (auto const &item : d.GetArray()) {
-        Device device;
-        process_device(device, item);
-        array.push_back(std::move(device));
-    }
-
-    devices.swap(array);
-    return true;
+    return process_device_list(d, devices);
 }
 
 bool device_to_json(const Device &device, std::string &json)
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "mbdevice/database.h"
+
+using namespace mb::device;
+
+static Device make_complete_device()
+{
+    Device device;
+    device.set_id("test");
+    device.set_codenames({"test1", "test2", "test3", "test4"});
+    device.set_name("Test Device");
+    device.set_architecture(ARCH_ARM64_V8A);
+    device.set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    device.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    device.set_system_block_devs({"/dev/block/bootdevice/by-name/system",
+                                  "/dev/block/sda1"});
+    device.set_cache_block_devs({"/dev/block/bootdevice/by-name/cache",
+                                 "/dev/block/sda2"});
+    device.set_data_block_devs({"/dev/block/bootdevice/by-name/userdata",
+                                "/dev/block/sda3"});
+    device.set_boot_block_devs({"/dev/block/bootdevice/by-name/boot",
+                                "/dev/block/sda4"});
+    device.set_recovery_block_devs({"/dev/block/bootdevice/by-name/recovery",
+                                    "/dev/block/sda5"});
+    device.set_extra_block_devs({"/dev/block/bootdevice/by-name/modem",
+                                 "/dev/block/sda6"});
+    device.set_tw_supported(true);
+    device.set_tw_flags(TwFlag::TouchscreenSwapXY | TwFlag::RoundScreen
+            | TwFlag::PreferLcdBacklight);
+    device.set_tw_pixel_format(TwPixelFormat::Rgba8888);
+    device.set_tw_force_pixel_format(TwForcePixelFormat::Rgb565);
+    device.set_tw_overscan_percent(10);
+    device.set_tw_default_x_offset(-20);
+    device.set_tw_default_y_offset(30);
+    device.set_tw_brightness_path("/sys/class/backlight");
+    device.set_tw_secondary_brightness_path("/sys/class/lcd-backlight");
+    device.set_tw_max_brightness(255);
+    device.set_tw_default_brightness(100);
+    device.set_tw_battery_path("/sys/class/battery");
+    device.set_tw_cpu_temp_path("/sys/class/cputemp");
+    device.set_tw_input_blacklist("foo");
+    device.set_tw_input_whitelist("bar");
+    device.set_tw_graphics_backends({"overlay_msm_old", "fbdev"});
+    device.set_tw_theme("portrait_hdpi");
+    return device;
+}
+
+static std::vector<Device> make_device_list()
+{
+    Device a = make_complete_device();
+
+    Device b;
+    b.set_id("beta");
+    b.set_codenames({"shared", "b1"});
+    b.set_name("Beta");
+
+    Device c;
+    c.set_id("alpha");
+    c.set_codenames({"c1", "shared"});
+    c.set_name("Alpha");
+
+    return { a, b, c };
+}
+
+TEST(DatabaseTest, RoundTripDevices)
+{
+    auto devices = make_device_list();
+    std::string data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+    ASSERT_EQ(data.size() % 4, 0u);
+    ASSERT_TRUE(is_device_database(data.data(), data.size()));
+
+    DeviceDatabase db;
+    ASSERT_TRUE(db.load(data.data(), data.size()));
+    ASSERT_EQ(db.size(), devices.size());
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        ASSERT_EQ(db.device(i), devices[i]);
+        ASSERT_EQ(db.id(i), devices[i].id());
+        ASSERT_EQ(db.name(i), devices[i].name());
+
+        auto codenames = db.codenames(i);
+        ASSERT_EQ(std::vector<std::string>(codenames.begin(), codenames.end()),
+                  devices[i].codenames());
+    }
+}
+
+TEST(DatabaseTest, FindDevices)
+{
+    std::string data;
+    ASSERT_TRUE(device_list_to_database(make_device_list(), data));
+
+    DeviceDatabase db;
+    ASSERT_TRUE(db.load(data.data(), data.size()));
+
+    ASSERT_EQ(db.find_by_id("test"), 0u);
+    ASSERT_EQ(db.find_by_id("beta"), 1u);
+    ASSERT_EQ(db.find_by_id("alpha"), 2u);
+    ASSERT_EQ(db.find_by_id("gamma"), std::nullopt);
+    ASSERT_EQ(db.find_by_id(""), std::nullopt);
+
+    ASSERT_EQ(db.find_by_codename("test3"), 0u);
+    ASSERT_EQ(db.find_by_codename("b1"), 1u);
+    ASSERT_EQ(db.find_by_codename("c1"), 2u);
+    ASSERT_EQ(db.find_by_codename("test"), std::nullopt);
+    ASSERT_EQ(db.find_by_codename("zzz"), std::nullopt);
+
+    // First device in the list wins
+    ASSERT_EQ(db.find_by_codename("shared"), 1u);
+}
+
+TEST(DatabaseTest, EmptyDatabase)
+{
+    std::string data;
+    ASSERT_TRUE(device_list_to_database({}, data));
+
+    DeviceDatabase db;
+    ASSERT_TRUE(db.load(data.data(), data.size()));
+    ASSERT_EQ(db.size(), 0u);
+    ASSERT_EQ(db.find_by_id("test"), std::nullopt);
+    ASSERT_EQ(db.find_by_codename("test"), std::nullopt);
+}
+
+TEST(DatabaseTest, RejectInvalidData)
+{
+    std::string data;
+    ASSERT_TRUE(device_list_to_database(make_device_list(), data));
+
+    DeviceDatabase db;
+
+    // Bad magic
+    std::string bad_magic = data;
+    bad_magic[0] = 'X';
+    ASSERT_FALSE(is_device_database(bad_magic.data(), bad_magic.size()));
+    ASSERT_FALSE(db.load(bad_magic.data(), bad_magic.size()));
+    ASSERT_EQ(db.size(), 0u);
+
+    // Every truncation must be rejected instead of reading out of bounds
+    for (size_t size = 0; size < data.size() - 3; ++size) {
+        std::string truncated = data.substr(0, size);
+        ASSERT_FALSE(db.load(truncated.data(), truncated.size()))
+                << "Truncated to " << size << " bytes";
+    }
+
+    // Corrupted string index in the first record
+    std::string bad_record = data;
+    uint32_t records_offset;
+    memcpy(&records_offset, bad_record.data() + 16, sizeof(records_offset));
+    memset(&bad_record[records_offset], 0xff, sizeof(uint32_t));
+    ASSERT_FALSE(db.load(bad_record.data(), bad_record.size()));
+}
@@ -19,6 +19,7 @@
 
 #include <gtest/gtest.h>
 
+#include "mbdevice/capi/device.h"
 #include "mbdevice/device.h"
 
 using namespace mb::device;
@@ -167,3 +168,51 @@ TEST(DeviceTest, CheckGettersSetters)
     device.set_tw_theme("portrait_hdpi");
     ASSERT_EQ(device.tw_theme(), "portrait_hdpi");
 }
+
+TEST(DeviceTest, CheckCapiBorrowedGetters)
+{
+    Device device;
+    device.set_id("test_id");
+    device.set_name("test_name");
+    device.set_codenames({"a", "b"});
+
+    auto const *cdevice = reinterpret_cast<const CDevice *>(&device);
+
+    ASSERT_EQ(mb_device_id_ref(cdevice), device.id().c_str());
+    ASSERT_STREQ(mb_device_name_ref(cdevice), "test_name");
+    ASSERT_STREQ(mb_device_tw_theme_ref(cdevice), "");
+
+    ASSERT_EQ(mb_device_codenames_count(cdevice), 2u);
+    ASSERT_STREQ(mb_device_codenames_ref_at(cdevice, 0), "a");
+    ASSERT_STREQ(mb_device_codenames_ref_at(cdevice, 1), "b");
+    ASSERT_EQ(mb_device_codenames_ref_at(cdevice, 2), nullptr);
+}
+
+TEST(DeviceTest, CheckCapiSummaries)
+{
+    Device devices[2];
+    devices[0].set_id("a");
+    devices[0].set_name("Device A");
+    devices[0].set_architecture(ARCH_ARMEABI_V7A);
+    devices[0].set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    devices[1].set_id("b");
+    devices[1].set_tw_supported(true);
+
+    const CDevice *cdevices[] = {
+        reinterpret_cast<const CDevice *>(&devices[0]),
+        reinterpret_cast<const CDevice *>(&devices[1]),
+    };
+    CDeviceSummary summaries[2];
+
+    mb_device_summaries(cdevices, 2, summaries);
+
+    ASSERT_STREQ(summaries[0].id, "a");
+    ASSERT_STREQ(summaries[0].name, "Device A");
+    ASSERT_STREQ(summaries[0].architecture, ARCH_ARMEABI_V7A);
+    ASSERT_EQ(summaries[0].flags,
+              static_cast<uint32_t>(DeviceFlag::HasCombinedBootAndRecovery));
+    ASSERT_FALSE(summaries[0].tw_supported);
+    ASSERT_STREQ(summaries[1].id, "b");
+    ASSERT_STREQ(summaries[1].name, "");
+    ASSERT_TRUE(summaries[1].tw_supported);
+}
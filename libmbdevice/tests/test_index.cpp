@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/capi/index.h"
+#include "mbdevice/index.h"
+
+using namespace mb::device;
+
+static std::vector<Device> make_device_list()
+{
+    Device a;
+    a.set_id("a");
+    a.set_codenames({"a1", "a2", "shared"});
+
+    Device b;
+    b.set_id("b");
+    b.set_codenames({"shared", "b1"});
+
+    Device c;
+    c.set_id("c");
+    c.set_codenames({"c1", "a2"});
+
+    return {a, b, c};
+}
+
+TEST(IndexTest, FindByCodename)
+{
+    DeviceIndex index(make_device_list());
+    ASSERT_EQ(index.size(), 5u);
+
+    ASSERT_EQ(index.find("a1"), 0u);
+    ASSERT_EQ(index.find("b1"), 1u);
+    ASSERT_EQ(index.find("c1"), 2u);
+    ASSERT_EQ(index.find("unknown"), std::nullopt);
+    ASSERT_EQ(index.find(""), std::nullopt);
+
+    // First device in the list wins
+    ASSERT_EQ(index.find("shared"), 0u);
+    ASSERT_EQ(index.find("a2"), 0u);
+}
+
+TEST(IndexTest, FindFirst)
+{
+    DeviceIndex index(make_device_list());
+
+    ASSERT_EQ(index.find_first("c1", "b1"), 1u);
+    ASSERT_EQ(index.find_first("b1", "c1"), 1u);
+    ASSERT_EQ(index.find_first("unknown", "c1"), 2u);
+    ASSERT_EQ(index.find_first("c1", "unknown"), 2u);
+    ASSERT_EQ(index.find_first("unknown", ""), std::nullopt);
+}
+
+TEST(IndexTest, Rebuild)
+{
+    DeviceIndex index(make_device_list());
+
+    Device d;
+    d.set_codenames({"d1"});
+    index.build({d});
+
+    ASSERT_EQ(index.size(), 1u);
+    ASSERT_EQ(index.find("d1"), 0u);
+    ASSERT_EQ(index.find("a1"), std::nullopt);
+}
+
+TEST(IndexTest, CapiFind)
+{
+    auto devices = make_device_list();
+    std::vector<const CDevice *> list;
+    for (auto const &d : devices) {
+        list.push_back(reinterpret_cast<const CDevice *>(&d));
+    }
+    list.push_back(nullptr);
+
+    CDeviceIndex *index = mb_device_index_new(list.data());
+    ASSERT_NE(index, nullptr);
+
+    size_t device = SIZE_MAX;
+    ASSERT_TRUE(mb_device_index_find(index, "shared", &device));
+    ASSERT_EQ(device, 0u);
+    ASSERT_TRUE(mb_device_index_find_first(index, "c1", "b1", &device));
+    ASSERT_EQ(device, 1u);
+    ASSERT_FALSE(mb_device_index_find(index, "unknown", &device));
+    ASSERT_EQ(device, 1u);
+
+    mb_device_index_free(index);
+}
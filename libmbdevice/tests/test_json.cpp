@@ -390,6 +390,32 @@ TEST(JsonTest, LoadMultiple)
     ASSERT_EQ(e2.document_uri, "#");
 }
 
+TEST(JsonTest, LoadMarkedValidated)
+{
+    std::vector<Device> d1;
+    JsonError e1;
+    ASSERT_TRUE(device_list_from_json(sample_multiple, d1, e1));
+
+    std::string marked(sample_multiple);
+    device_list_mark_validated(marked);
+
+    std::vector<Device> d2;
+    JsonError e2;
+    ASSERT_TRUE(device_list_from_json(marked, d2, e2));
+    ASSERT_EQ(d1, d2);
+
+    // Edited after being marked, so it must go through the schema again
+    std::string tampered(sample_complete);
+    device_list_mark_validated(tampered);
+    tampered[0] = '[';
+    tampered.insert(tampered.find("\n#mbdevice-validated "), "]");
+
+    std::vector<Device> d3;
+    JsonError e3;
+    ASSERT_TRUE(device_list_from_json(tampered, d3, e3));
+    ASSERT_EQ(d3.size(), 1u);
+}
+
 TEST(JsonTest, CreateJson)
 {
     Device d1;
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mblog/base_logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb::log
+{
+
+/*!
+ * \brief Logger that writes records to another logger on a background thread
+ *
+ * Records are queued in a fixed-size lock-free ring buffer, so callers only pay
+ * for formatting the record and copying it into the buffer. Records at or
+ * above the flush level are written before log() returns so that they are not
+ * lost if the process dies right afterwards.
+ *
+ * In a child process created with fork(), the background thread no longer
+ * exists, so records are written synchronously instead.
+ */
+class MB_EXPORT AsyncLogger : public BaseLogger
+{
+public:
+    //! What to do when the ring buffer is full
+    enum class Overflow
+    {
+        //! Wait for the background thread to make room
+        Block,
+        //! Discard the record. The number of discarded records is logged.
+        Drop,
+    };
+
+    AsyncLogger(std::shared_ptr<BaseLogger> logger, size_t capacity = 1024,
+                Overflow overflow = Overflow::Block,
+                LogLevel flush_level = LogLevel::Error);
+    virtual ~AsyncLogger();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AsyncLogger)
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual bool formatted() override;
+
+    virtual bool concurrent() override;
+
+    void flush();
+
+    uint64_t dropped() const;
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;
+        LogRecord rec;
+    };
+
+    bool in_owner_process() const;
+    bool try_push(const LogRecord &rec);
+    bool full() const;
+    bool ready() const;
+    size_t drain();
+    void notify_waiters();
+    void run();
+
+    std::shared_ptr<BaseLogger> _logger;
+    bool _formatted;
+    Overflow _overflow;
+    LogLevel _flush_level;
+    unsigned int _fork_generation;
+
+    std::unique_ptr<Slot[]> _slots;
+    uint64_t _capacity;
+    uint64_t _mask;
+
+    // Next position to claim for writing (producers)
+    std::atomic<uint64_t> _write_pos;
+    // Next position to read (consumer only)
+    uint64_t _read_pos;
+    // Number of records passed to the underlying logger
+    std::atomic<uint64_t> _written;
+    std::atomic<uint64_t> _dropped;
+    uint64_t _reported_dropped;
+
+    // Only used for sleeping when the buffer is empty or full
+    std::mutex _mutex;
+    std::condition_variable _consumer_cv;
+    std::condition_variable _waiter_cv;
+    std::atomic<bool> _consumer_waiting;
+    std::atomic<int> _waiters;
+    bool _stop;
+
+    std::thread _thread;
+};
+
+}
@@ -36,6 +36,14 @@ public:
     virtual void log(const LogRecord &rec) = 0;
 
     virtual bool formatted() = 0;
+
+    // Whether log() can be called from multiple threads at the same time.
+    // Otherwise, calls are serialized.
+    virtual bool concurrent();
+
+    // Whether the message should be formatted before calling log(). If not,
+    // the format string and arguments are passed in the record instead.
+    virtual bool needs_message();
 };
 
 }
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+#include "mblog/log_record.h"
+
+namespace mb::log
+{
+
+using BinaryLogCallback = std::function<void(const LogRecord &rec)>;
+
+MB_EXPORT oc::result<void>
+decode_binary_log(const void *data, size_t size, const BinaryLogCallback &cb);
+
+MB_EXPORT oc::result<void>
+read_binary_log(const std::string &path, const BinaryLogCallback &cb);
+
+}
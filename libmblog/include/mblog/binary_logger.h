@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mblog/base_logger.h"
+
+namespace mb::log
+{
+
+/*!
+ * \brief Logger that stores unformatted records in a memory-mapped ring file
+ *
+ * Instead of formatting messages, the format string and the raw arguments are
+ * written to the file. Tags and format strings are stored once and referenced
+ * by ID afterwards. Since the file is mapped with MAP_SHARED, records survive
+ * the process crashing. The file can be decoded with read_binary_log() (or the
+ * mblogdecode tool) on any host.
+ *
+ * When the ring is full, the oldest records are discarded.
+ */
+class MB_EXPORT BinaryLogger : public BaseLogger
+{
+public:
+    BinaryLogger(const std::string &path, size_t size);
+    virtual ~BinaryLogger();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BinaryLogger)
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual bool formatted() override;
+
+    virtual bool needs_message() override;
+
+private:
+    bool map_file(const std::string &path, size_t size);
+    void define_string(uint8_t kind, uint32_t id, const char *str, size_t len);
+    void make_room(size_t size);
+    void write_record(const unsigned char *data, size_t size);
+
+    int _fd;
+    unsigned char *_map;
+    size_t _map_size;
+    unsigned char *_ring;
+    uint64_t _capacity;
+
+    // IDs of the string records present in the ring
+    std::unordered_set<uint32_t> _defined;
+    std::unordered_map<const char *, uint32_t> _fmt_ids;
+};
+
+}
@@ -22,6 +22,8 @@
 #include <chrono>
 #include <string>
 
+#include <cstdarg>
+
 #include "mblog/log_level.h"
 
 namespace mb::log
@@ -36,6 +38,10 @@ struct LogRecord
     std::string tag;
     std::string msg;
     std::string fmt_msg;
+    // Only set for loggers that don't need msg. These are only valid for the
+    // duration of the BaseLogger::log() call.
+    const char *fmt = nullptr;
+    va_list *args = nullptr;
 };
 
 }
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <cstdarg>
@@ -27,16 +28,32 @@
 
 #include "mblog/log_level.h"
 
+// Least severe level that is compiled in. Calls for less severe levels are
+// discarded at compile time, including the evaluation of their arguments.
+#ifndef MBLOG_MIN_LEVEL
+#  define MBLOG_MIN_LEVEL Verbose
+#endif
+
+// Only evaluates the arguments and formats the message if the level is enabled
+#define MBLOG_LOG_IF(FUNC, PRIO, TAG, ...) \
+    do { \
+        if constexpr (::mb::log::compiled_in(PRIO)) { \
+            if (::mb::log::is_enabled(PRIO)) { \
+                ::mb::log::FUNC((PRIO), (TAG), __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
 #define TLOGE(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log, mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
 #define TLOGW(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log, mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
 #define TLOGI(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log, mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
 #define TLOGD(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log, mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
 #define TLOGV(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log, mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
 
 #define LOGE(...) TLOGE(LOG_TAG, __VA_ARGS__)
 #define LOGW(...) TLOGW(LOG_TAG, __VA_ARGS__)
@@ -45,15 +62,15 @@
 #define LOGV(...) TLOGV(LOG_TAG, __VA_ARGS__)
 
 #define TVLOGE(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log_v, mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
 #define TVLOGW(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log_v, mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
 #define TVLOGI(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log_v, mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
 #define TVLOGD(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log_v, mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
 #define TVLOGV(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+    MBLOG_LOG_IF(log_v, mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
 
 #define VLOGE(...) TVLOGE(LOG_TAG, __VA_ARGS__)
 #define VLOGW(...) TVLOGW(LOG_TAG, __VA_ARGS__)
@@ -64,6 +81,30 @@
 namespace mb::log
 {
 
+namespace detail
+{
+
+MB_EXPORT extern std::atomic<int> g_level;
+
+}
+
+//! Whether \p prio is at least as severe as MBLOG_MIN_LEVEL
+constexpr bool compiled_in(LogLevel prio)
+{
+    return static_cast<int>(prio)
+            <= static_cast<int>(LogLevel::MBLOG_MIN_LEVEL);
+}
+
+//! Whether records at \p prio are logged
+inline bool is_enabled(LogLevel prio)
+{
+    return compiled_in(prio) && static_cast<int>(prio)
+            <= detail::g_level.load(std::memory_order_relaxed);
+}
+
+MB_EXPORT LogLevel level();
+MB_EXPORT void set_level(LogLevel level);
+
 class BaseLogger;
 
 MB_EXPORT std::shared_ptr<BaseLogger> logger();
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/async_logger.h"
+
+#include <chrono>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+namespace mb::log
+{
+
+#ifndef _WIN32
+// Incremented in the child after every fork() so that loggers can tell that
+// their background thread is gone
+static std::atomic<unsigned int> g_fork_generation{0};
+static std::once_flag g_atfork_once;
+
+static void _on_fork_child()
+{
+    g_fork_generation.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+static uint64_t _round_up_pow2(size_t n)
+{
+    uint64_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/*!
+ * \brief Construct a logger that writes to \p logger on a background thread
+ *
+ * \param logger Logger to write the records to
+ * \param capacity Number of records that can be queued. This is rounded up to
+ *                 the next power of two.
+ * \param overflow What to do when the queue is full
+ * \param flush_level Records at or above this level are written before log()
+ *                    returns
+ */
+AsyncLogger::AsyncLogger(std::shared_ptr<BaseLogger> logger, size_t capacity,
+                         Overflow overflow, LogLevel flush_level)
+    : _logger(std::move(logger))
+    , _formatted(_logger->formatted())
+    , _overflow(overflow)
+    , _flush_level(flush_level)
+    , _fork_generation(0)
+    , _capacity(_round_up_pow2(capacity))
+    , _mask(_capacity - 1)
+    , _write_pos(0)
+    , _read_pos(0)
+    , _written(0)
+    , _dropped(0)
+    , _reported_dropped(0)
+    , _consumer_waiting(false)
+    , _waiters(0)
+    , _stop(false)
+{
+#ifndef _WIN32
+    std::call_once(g_atfork_once, [] {
+        pthread_atfork(nullptr, nullptr, &_on_fork_child);
+    });
+    _fork_generation = g_fork_generation.load(std::memory_order_relaxed);
+#endif
+
+    _slots = std::make_unique<Slot[]>(static_cast<size_t>(_capacity));
+    for (uint64_t i = 0; i < _capacity; ++i) {
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    _thread = std::thread(&AsyncLogger::run, this);
+}
+
+//! Writes all queued records and stops the background thread
+AsyncLogger::~AsyncLogger()
+{
+    if (!in_owner_process()) {
+        _thread.detach();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _consumer_cv.notify_one();
+
+    _thread.join();
+}
+
+void AsyncLogger::log(const LogRecord &rec)
+{
+    if (!in_owner_process()) {
+        _logger->log(rec);
+        return;
+    }
+
+    while (!try_push(rec)) {
+        if (_overflow == Overflow::Drop) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        _waiters.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _waiter_cv.wait(lock, [&] { return !full(); });
+        }
+        _waiters.fetch_sub(1);
+    }
+
+    // Pairs with the fence in run() so that either the consumer sees the new
+    // record or we see that it is waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_consumer_waiting.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+        }
+        _consumer_cv.notify_one();
+    }
+
+    if (static_cast<int>(rec.prio) <= static_cast<int>(_flush_level)) {
+        flush();
+    }
+}
+
+bool AsyncLogger::formatted()
+{
+    return _formatted;
+}
+
+bool AsyncLogger::concurrent()
+{
+    return true;
+}
+
+//! Wait until every record queued so far has been written
+void AsyncLogger::flush()
+{
+    if (!in_owner_process()
+            || std::this_thread::get_id() == _thread.get_id()) {
+        return;
+    }
+
+    uint64_t target = _write_pos.load();
+    if (_written.load() >= target) {
+        return;
+    }
+
+    _waiters.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waiter_cv.wait(lock, [&] { return _written.load() >= target; });
+    }
+    _waiters.fetch_sub(1);
+}
+
+//! Total number of records dropped because the queue was full
+uint64_t AsyncLogger::dropped() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+bool AsyncLogger::in_owner_process() const
+{
+#ifdef _WIN32
+    return true;
+#else
+    return g_fork_generation.load(std::memory_order_relaxed)
+            == _fork_generation;
+#endif
+}
+
+// Bounded MPMC queue algorithm by Dmitry Vyukov, with a single consumer. Each
+// slot's sequence number is equal to the position when it's free for writing
+// and to position + 1 when it holds a record.
+bool AsyncLogger::try_push(const LogRecord &rec)
+{
+    uint64_t pos = _write_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Slot &slot = _slots[pos & _mask];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        auto diff = static_cast<int64_t>(seq - pos);
+
+        if (diff == 0) {
+            if (_write_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                slot.rec = rec;
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _write_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool AsyncLogger::full() const
+{
+    uint64_t pos = _write_pos.load(std::memory_order_relaxed);
+    uint64_t seq = _slots[pos & _mask].seq.load(std::memory_order_acquire);
+    return static_cast<int64_t>(seq - pos) < 0;
+}
+
+bool AsyncLogger::ready() const
+{
+    return _slots[_read_pos & _mask].seq.load(std::memory_order_acquire)
+            == _read_pos + 1;
+}
+
+size_t AsyncLogger::drain()
+{
+    size_t n = 0;
+
+    while (ready()) {
+        Slot &slot = _slots[_read_pos & _mask];
+
+        _logger->log(slot.rec);
+
+        slot.seq.store(_read_pos + _capacity, std::memory_order_release);
+        ++_read_pos;
+        ++n;
+
+        _written.store(_read_pos);
+        notify_waiters();
+    }
+
+    uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped != _reported_dropped) {
+        LogRecord rec;
+        rec.time = std::chrono::system_clock::now();
+        rec.pid = 0;
+        rec.tid = 0;
+        rec.prio = LogLevel::Warning;
+        rec.tag = "mblog";
+        rec.msg = "Dropped " + std::to_string(dropped - _reported_dropped)
+                + " log records";
+        if (_formatted) {
+            rec.fmt_msg = rec.tag + ": " + rec.msg;
+        }
+        _logger->log(rec);
+
+        _reported_dropped = dropped;
+    }
+
+    return n;
+}
+
+void AsyncLogger::notify_waiters()
+{
+    // Pairs with the seq_cst increment of _waiters before they check for space
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_waiters.load(std::memory_order_relaxed) > 0) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+        }
+        _waiter_cv.notify_all();
+    }
+}
+
+void AsyncLogger::run()
+{
+    while (true) {
+        if (drain() > 0) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _consumer_waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _consumer_cv.wait(lock, [&] { return _stop || ready(); });
+        _consumer_waiting.store(false);
+
+        if (_stop && !ready()) {
+            break;
+        }
+    }
+}
+
+}
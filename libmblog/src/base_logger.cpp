@@ -30,4 +30,14 @@ BaseLogger::~BaseLogger()
 {
 }
 
+bool BaseLogger::concurrent()
+{
+    return false;
+}
+
+bool BaseLogger::needs_message()
+{
+    return true;
+}
+
 }
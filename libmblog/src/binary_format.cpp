@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary_format.h"
+
+#include <cstring>
+
+namespace mb::log::binary
+{
+
+enum class Length
+{
+    None,
+    Char,
+    Short,
+    Long,
+    LongLong,
+    IntMax,
+    Size,
+    PtrDiff,
+    LongDouble,
+};
+
+static ArgType signed_type(Length length)
+{
+    switch (length) {
+    case Length::Long:
+        return ArgType::Long;
+    case Length::LongLong:
+        return ArgType::LongLong;
+    case Length::IntMax:
+        return ArgType::IntMax;
+    case Length::Size:
+        return ArgType::SSize;
+    case Length::PtrDiff:
+        return ArgType::PtrDiff;
+    default:
+        return ArgType::Int;
+    }
+}
+
+static ArgType unsigned_type(Length length)
+{
+    switch (length) {
+    case Length::Long:
+        return ArgType::ULong;
+    case Length::LongLong:
+        return ArgType::ULongLong;
+    case Length::IntMax:
+        return ArgType::UIntMax;
+    case Length::Size:
+        return ArgType::Size;
+    case Length::PtrDiff:
+        return ArgType::UPtrDiff;
+    default:
+        return ArgType::UInt;
+    }
+}
+
+/*!
+ * \brief Find the next printf conversion specification
+ *
+ * \param[in] fmt Format string
+ * \param[in,out] pos Offset to start searching from. On success, this is set
+ *                    to the offset after the specification.
+ * \param[out] spec Parsed specification
+ *
+ * \return Whether a specification was found
+ */
+bool next_format_spec(std::string_view fmt, size_t &pos, FormatSpec &spec)
+{
+    size_t i = fmt.find('%', pos);
+    if (i == std::string_view::npos || i + 1 >= fmt.size()) {
+        pos = fmt.size();
+        return false;
+    }
+
+    spec.begin = i++;
+    spec.stars = 0;
+    spec.precision = -1;
+    spec.precision_star = false;
+
+    // Flags
+    while (i < fmt.size() && strchr("-+ #0'I", fmt[i])) {
+        ++i;
+    }
+
+    // Width
+    if (i < fmt.size() && fmt[i] == '*') {
+        ++spec.stars;
+        ++i;
+    }
+    while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9') {
+        ++i;
+    }
+
+    // Precision
+    if (i < fmt.size() && fmt[i] == '.') {
+        ++i;
+        if (i < fmt.size() && fmt[i] == '*') {
+            ++spec.stars;
+            spec.precision_star = true;
+            ++i;
+        } else {
+            spec.precision = 0;
+        }
+        while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9') {
+            if (spec.precision < 4096) {
+                spec.precision = spec.precision * 10 + (fmt[i] - '0');
+            }
+            ++i;
+        }
+    }
+
+    // Length modifier
+    spec.length = i;
+    Length length = Length::None;
+
+    if (i < fmt.size()) {
+        switch (fmt[i]) {
+        case 'h':
+            length = Length::Short;
+            if (i + 1 < fmt.size() && fmt[i + 1] == 'h') {
+                length = Length::Char;
+                ++i;
+            }
+            ++i;
+            break;
+        case 'l':
+            length = Length::Long;
+            if (i + 1 < fmt.size() && fmt[i + 1] == 'l') {
+                length = Length::LongLong;
+                ++i;
+            }
+            ++i;
+            break;
+        case 'q':
+            length = Length::LongLong;
+            ++i;
+            break;
+        case 'j':
+            length = Length::IntMax;
+            ++i;
+            break;
+        case 'z':
+            length = Length::Size;
+            ++i;
+            break;
+        case 't':
+            length = Length::PtrDiff;
+            ++i;
+            break;
+        case 'L':
+            length = Length::LongDouble;
+            ++i;
+            break;
+        }
+    }
+
+    if (i >= fmt.size()) {
+        pos = fmt.size();
+        return false;
+    }
+
+    spec.conversion = i;
+
+    switch (fmt[i]) {
+    case 'd':
+    case 'i':
+        spec.type = signed_type(length);
+        break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        spec.type = unsigned_type(length);
+        break;
+    case 'c':
+        spec.type = ArgType::Int;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec.type = length == Length::LongDouble
+                ? ArgType::LongDouble : ArgType::Double;
+        break;
+    case 's':
+        spec.type = ArgType::String;
+        break;
+    case 'p':
+        spec.type = ArgType::Pointer;
+        break;
+    case 'm':
+        spec.type = ArgType::ErrnoString;
+        break;
+    case 'n':
+        spec.type = ArgType::Count;
+        break;
+    default:
+        // Includes "%%"
+        spec.type = ArgType::None;
+        break;
+    }
+
+    pos = i + 1;
+    return true;
+}
+
+}
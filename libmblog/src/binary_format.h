@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+// On-disk format shared by BinaryLogger and the binary log reader.
+//
+// The file consists of a FileHeader followed by a ring buffer of records. All
+// integers are little endian. Records are 4-byte aligned and never straddle
+// the end of the ring; a padding record fills the gap instead. Positions in
+// the header are byte counts since the file was created, so the offset in the
+// ring is the position modulo the capacity. The valid records are the ones in
+// [tail, head).
+
+namespace mb::log::binary
+{
+
+constexpr char MAGIC[8] = { 'M', 'B', 'L', 'O', 'G', 'B', 'I', 'N' };
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t tail;
+};
+
+enum class RecordType : uint8_t
+{
+    Padding = 0,
+    Message = 1,
+    String  = 2,
+};
+
+enum class StringKind : uint8_t
+{
+    Tag    = 0,
+    Format = 1,
+};
+
+// Common header: u16 size (including header and padding), u8 type, u8 extra.
+// For messages, extra is the log level. For strings, it's the StringKind.
+constexpr size_t RECORD_HEADER_SIZE = 4;
+
+// Message: header, u32 pid, u32 tid, i64 time (ns since epoch), u32 tag id,
+// u32 format id, then the arguments
+constexpr size_t MESSAGE_HEADER_SIZE = RECORD_HEADER_SIZE + 24;
+
+// String: header, u32 id, then the string without a NUL terminator
+constexpr size_t STRING_HEADER_SIZE = RECORD_HEADER_SIZE + 4;
+
+constexpr size_t MAX_RECORD_SIZE = 4096;
+constexpr size_t MAX_STRING_ARG_SIZE = 1024;
+
+// Argument kinds. Each argument is a kind byte followed by its value. A zero
+// byte (from the record's padding) ends the list.
+enum class ArgKind : uint8_t
+{
+    End      = 0,
+    Signed   = 'i', // i64
+    Unsigned = 'u', // u64
+    Double   = 'f', // f64
+    String   = 's', // u16 length, then the bytes
+    Pointer  = 'p', // u64
+};
+
+enum class ArgType
+{
+    None,           // %%, or an unsupported conversion
+    Int,
+    Long,
+    LongLong,
+    IntMax,
+    SSize,
+    PtrDiff,
+    UInt,
+    ULong,
+    ULongLong,
+    UIntMax,
+    Size,
+    UPtrDiff,
+    Double,
+    LongDouble,
+    String,
+    Pointer,
+    ErrnoString,    // %m, which takes no argument
+    Count,          // %n, whose argument is skipped
+};
+
+struct FormatSpec
+{
+    // Offset of the '%'
+    size_t begin;
+    // Offset of the length modifier (or the conversion if there is none)
+    size_t length;
+    // Offset of the conversion character
+    size_t conversion;
+    // Number of '*' width and precision arguments before the value
+    int stars;
+    // Precision, or -1 if there is none. If the precision is '*', this is -1
+    // and precision_star is true.
+    int precision;
+    bool precision_star;
+    ArgType type;
+};
+
+bool next_format_spec(std::string_view fmt, size_t &pos, FormatSpec &spec);
+
+constexpr size_t align_record(size_t size)
+{
+    return (size + 3) & ~static_cast<size_t>(3);
+}
+
+// FNV-1a, used to give strings an ID that is stable across processes
+constexpr uint32_t string_id(std::string_view str)
+{
+    uint32_t hash = 2166136261u;
+    for (char c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Unaligned little endian accessors for record fields
+
+inline void put_u16(unsigned char *buf, uint16_t value)
+{
+    value = mb_htole16(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+inline void put_u32(unsigned char *buf, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+inline void put_u64(unsigned char *buf, uint64_t value)
+{
+    value = mb_htole64(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+inline uint16_t get_u16(const unsigned char *buf)
+{
+    uint16_t value;
+    memcpy(&value, buf, sizeof(value));
+    return mb_le16toh(value);
+}
+
+inline uint32_t get_u32(const unsigned char *buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+    return mb_le32toh(value);
+}
+
+inline uint64_t get_u64(const unsigned char *buf)
+{
+    uint64_t value;
+    memcpy(&value, buf, sizeof(value));
+    return mb_le64toh(value);
+}
+
+}
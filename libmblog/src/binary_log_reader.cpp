@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/binary_log_reader.h"
+
+#include <chrono>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+#include "binary_format.h"
+
+namespace mb::log
+{
+
+using namespace binary;
+
+namespace
+{
+
+class ArgReader
+{
+public:
+    ArgReader(const unsigned char *begin, const unsigned char *end)
+        : _ptr(begin), _end(end)
+    {
+    }
+
+    bool get_int(ArgKind kind, uint64_t &value)
+    {
+        if (_end - _ptr < 9 || _ptr[0] != static_cast<uint8_t>(kind)) {
+            return false;
+        }
+
+        value = get_u64(_ptr + 1);
+        _ptr += 9;
+        return true;
+    }
+
+    bool get_double(double &value)
+    {
+        uint64_t bits;
+        if (!get_int(ArgKind::Double, bits)) {
+            return false;
+        }
+
+        memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    bool get_string(std::string &value)
+    {
+        if (_end - _ptr < 3
+                || _ptr[0] != static_cast<uint8_t>(ArgKind::String)) {
+            return false;
+        }
+
+        uint16_t len = get_u16(_ptr + 1);
+        if (_end - _ptr - 3 < len) {
+            return false;
+        }
+
+        value.assign(reinterpret_cast<const char *>(_ptr + 3), len);
+        _ptr += 3 + len;
+        return true;
+    }
+
+private:
+    const unsigned char *_ptr;
+    const unsigned char *_end;
+};
+
+}
+
+template<typename T>
+static void append_arg(std::string &out, const std::string &spec,
+                       const int *stars, int n_stars, T value)
+{
+    switch (n_stars) {
+    case 0:
+        out += format(spec.c_str(), value);
+        break;
+    case 1:
+        out += format(spec.c_str(), stars[0], value);
+        break;
+    default:
+        out += format(spec.c_str(), stars[0], stars[1], value);
+        break;
+    }
+}
+
+static bool append_spec(std::string &out, std::string_view fmt,
+                        const FormatSpec &spec, ArgReader &reader)
+{
+    int stars[2];
+
+    for (int i = 0; i < spec.stars; ++i) {
+        uint64_t value;
+        if (!reader.get_int(ArgKind::Signed, value)) {
+            return false;
+        }
+        stars[i] = static_cast<int>(static_cast<int64_t>(value));
+    }
+
+    // Flags, width, and precision are kept as is, but the length modifier is
+    // replaced to match the stored type
+    std::string prefix(fmt.substr(spec.begin, spec.length - spec.begin));
+    std::string_view length =
+            fmt.substr(spec.length, spec.conversion - spec.length);
+    char conversion = fmt[spec.conversion];
+
+    switch (spec.type) {
+    case ArgType::Int:
+    case ArgType::UInt: {
+        // hh and h must be preserved since they truncate the value
+        uint64_t value;
+        bool is_signed = spec.type == ArgType::Int;
+        if (!reader.get_int(is_signed ? ArgKind::Signed : ArgKind::Unsigned,
+                            value)) {
+            return false;
+        }
+        std::string s = prefix;
+        s += length;
+        s += conversion;
+        if (is_signed) {
+            append_arg(out, s, stars, spec.stars,
+                       static_cast<int>(static_cast<int64_t>(value)));
+        } else {
+            append_arg(out, s, stars, spec.stars,
+                       static_cast<unsigned int>(value));
+        }
+        break;
+    }
+
+    case ArgType::Long:
+    case ArgType::LongLong:
+    case ArgType::IntMax:
+    case ArgType::SSize:
+    case ArgType::PtrDiff: {
+        uint64_t value;
+        if (!reader.get_int(ArgKind::Signed, value)) {
+            return false;
+        }
+        append_arg(out, prefix + "ll" + conversion, stars, spec.stars,
+                   static_cast<long long>(value));
+        break;
+    }
+
+    case ArgType::ULong:
+    case ArgType::ULongLong:
+    case ArgType::UIntMax:
+    case ArgType::Size:
+    case ArgType::UPtrDiff: {
+        uint64_t value;
+        if (!reader.get_int(ArgKind::Unsigned, value)) {
+            return false;
+        }
+        append_arg(out, prefix + "ll" + conversion, stars, spec.stars,
+                   static_cast<unsigned long long>(value));
+        break;
+    }
+
+    case ArgType::Double:
+    case ArgType::LongDouble: {
+        double value;
+        if (!reader.get_double(value)) {
+            return false;
+        }
+        append_arg(out, prefix + conversion, stars, spec.stars, value);
+        break;
+    }
+
+    case ArgType::String:
+    case ArgType::ErrnoString: {
+        std::string value;
+        if (!reader.get_string(value)) {
+            return false;
+        }
+        append_arg(out, prefix + 's', stars, spec.stars, value.c_str());
+        break;
+    }
+
+    case ArgType::Pointer: {
+        uint64_t value;
+        if (!reader.get_int(ArgKind::Pointer, value)) {
+            return false;
+        }
+        // The pointer may have been wider than the host's
+        append_arg(out, "0x%" PRIx64, stars, 0, value);
+        break;
+    }
+
+    case ArgType::Count:
+    case ArgType::None:
+        break;
+    }
+
+    return true;
+}
+
+static std::string format_message(std::string_view fmt,
+                                  const unsigned char *args,
+                                  const unsigned char *end)
+{
+    ArgReader reader(args, end);
+    std::string out;
+    size_t pos = 0;
+    size_t last = 0;
+    FormatSpec spec;
+
+    while (next_format_spec(fmt, pos, spec)) {
+        out += fmt.substr(last, spec.begin - last);
+        last = pos;
+
+        if (spec.type == ArgType::None) {
+            if (fmt[spec.conversion] == '%') {
+                out += '%';
+            } else {
+                out += fmt.substr(spec.begin, pos - spec.begin);
+            }
+        } else if (!append_spec(out, fmt, spec, reader)) {
+            // Arguments were truncated because the record was too large
+            out += "[trunc...]";
+            return out;
+        }
+    }
+
+    out += fmt.substr(last);
+    return out;
+}
+
+/*!
+ * \brief Walk the records in a binary log
+ *
+ * \return Whether the records are all intact
+ */
+template<typename Func>
+static bool for_each_record(const unsigned char *ring, uint64_t capacity,
+                            uint64_t head, uint64_t tail, Func func)
+{
+    for (uint64_t pos = tail; pos < head;) {
+        uint64_t offset = pos % capacity;
+        if (capacity - offset < RECORD_HEADER_SIZE) {
+            return false;
+        }
+
+        const unsigned char *rec = ring + offset;
+        uint16_t size = get_u16(rec);
+
+        if (size < RECORD_HEADER_SIZE || size % 4 != 0
+                || size > capacity - offset || size > head - pos) {
+            return false;
+        }
+
+        func(static_cast<RecordType>(rec[2]), rec, size);
+        pos += size;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Decode an in-memory copy of a file written by BinaryLogger
+ *
+ * \p cb is called for each record, from oldest to newest, with the message
+ * formatted in LogRecord::msg. If the file is partially corrupted, the intact
+ * records are still passed to \p cb before an error is returned.
+ *
+ * \return Nothing on success or `std::errc::bad_message` if the file is not
+ *         a valid binary log
+ */
+oc::result<void>
+decode_binary_log(const void *data, size_t size, const BinaryLogCallback &cb)
+{
+    auto base = static_cast<const unsigned char *>(data);
+
+    if (size < sizeof(FileHeader)
+            || memcmp(base + offsetof(FileHeader, magic), MAGIC,
+                      sizeof(MAGIC)) != 0
+            || get_u32(base + offsetof(FileHeader, version)) != VERSION) {
+        return std::make_error_code(std::errc::bad_message);
+    }
+
+    uint32_t header_size = get_u32(base + offsetof(FileHeader, header_size));
+    uint64_t capacity = get_u64(base + offsetof(FileHeader, capacity));
+    uint64_t head = get_u64(base + offsetof(FileHeader, head));
+    uint64_t tail = get_u64(base + offsetof(FileHeader, tail));
+
+    if (header_size < sizeof(FileHeader) || header_size > size
+            || capacity == 0 || capacity > size - header_size
+            || tail > head || head - tail > capacity) {
+        return std::make_error_code(std::errc::bad_message);
+    }
+
+    const unsigned char *ring = base + header_size;
+
+    // Strings can be defined anywhere before they are used, so the
+    // definitions are gathered first
+    std::unordered_map<uint32_t, std::string> tags;
+    std::unordered_map<uint32_t, std::string> formats;
+
+    for_each_record(ring, capacity, head, tail,
+                    [&](RecordType type, const unsigned char *rec,
+                        uint16_t rec_size) {
+        if (type != RecordType::String || rec_size < STRING_HEADER_SIZE) {
+            return;
+        }
+
+        auto &strings = rec[3] == static_cast<uint8_t>(StringKind::Tag)
+                ? tags : formats;
+        auto str = reinterpret_cast<const char *>(rec + STRING_HEADER_SIZE);
+
+        // Strip the padding
+        strings[get_u32(rec + 4)].assign(
+                str, strnlen(str, rec_size - STRING_HEADER_SIZE));
+    });
+
+    bool intact = for_each_record(ring, capacity, head, tail,
+                                  [&](RecordType type,
+                                      const unsigned char *rec,
+                                      uint16_t rec_size) {
+        if (type != RecordType::Message || rec_size < MESSAGE_HEADER_SIZE) {
+            return;
+        }
+
+        LogRecord lr;
+        lr.prio = rec[3] <= static_cast<uint8_t>(LogLevel::Verbose)
+                ? static_cast<LogLevel>(rec[3]) : LogLevel::Verbose;
+        lr.pid = get_u32(rec + 4);
+        lr.tid = get_u32(rec + 8);
+        lr.time = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<
+                        std::chrono::system_clock::duration>(
+                                std::chrono::nanoseconds(static_cast<int64_t>(
+                                        get_u64(rec + 12)))));
+
+        uint32_t tag_id = get_u32(rec + 20);
+        uint32_t fmt_id = get_u32(rec + 24);
+
+        if (auto it = tags.find(tag_id); it != tags.end()) {
+            lr.tag = it->second;
+        } else {
+            lr.tag = format("<tag %08" PRIx32 ">", tag_id);
+        }
+
+        if (auto it = formats.find(fmt_id); it != formats.end()) {
+            lr.msg = format_message(it->second, rec + MESSAGE_HEADER_SIZE,
+                                    rec + rec_size);
+        } else {
+            lr.msg = format("<format %08" PRIx32 ">", fmt_id);
+        }
+
+        cb(lr);
+    });
+
+    if (!intact) {
+        return std::make_error_code(std::errc::bad_message);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Decode a file written by BinaryLogger
+ *
+ * \sa decode_binary_log()
+ */
+oc::result<void>
+read_binary_log(const std::string &path, const BinaryLogCallback &cb)
+{
+    StandardFile file;
+    OUTCOME_TRYV(file.open(path, FileOpenMode::ReadOnly));
+
+    std::vector<unsigned char> data;
+    unsigned char buf[65536];
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(file, buf, sizeof(buf)));
+        if (n == 0) {
+            break;
+        }
+
+        data.insert(data.end(), buf, buf + n);
+    }
+
+    return decode_binary_log(data.data(), data.size(), cb);
+}
+
+}
@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/binary_logger.h"
+
+#include <algorithm>
+#include <array>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary_format.h"
+
+namespace mb::log
+{
+
+using namespace binary;
+
+// Leave enough room that a message and its string definitions can never
+// evict each other
+static constexpr size_t MIN_CAPACITY = 16 * MAX_RECORD_SIZE;
+
+static constexpr size_t OFF_MAGIC = offsetof(FileHeader, magic);
+static constexpr size_t OFF_VERSION = offsetof(FileHeader, version);
+static constexpr size_t OFF_HEADER_SIZE = offsetof(FileHeader, header_size);
+static constexpr size_t OFF_CAPACITY = offsetof(FileHeader, capacity);
+static constexpr size_t OFF_HEAD = offsetof(FileHeader, head);
+static constexpr size_t OFF_TAIL = offsetof(FileHeader, tail);
+
+namespace
+{
+
+class ArgWriter
+{
+public:
+    ArgWriter(unsigned char *buf, size_t size)
+        : _buf(buf), _size(size), _pos(0), _full(false)
+    {
+    }
+
+    bool full() const
+    {
+        return _full;
+    }
+
+    size_t pos() const
+    {
+        return _pos;
+    }
+
+    void put_int(ArgKind kind, uint64_t value)
+    {
+        if (reserve(1 + sizeof(value))) {
+            _buf[_pos] = static_cast<unsigned char>(kind);
+            put_u64(_buf + _pos + 1, value);
+            _pos += 1 + sizeof(value);
+        }
+    }
+
+    void put_double(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put_int(ArgKind::Double, bits);
+    }
+
+    void put_string(const char *str, int precision = -1)
+    {
+        if (!str) {
+            str = "(null)";
+        }
+
+        // The string might not be NUL-terminated if there's a precision
+        size_t max_len = MAX_STRING_ARG_SIZE;
+        if (precision >= 0) {
+            max_len = std::min(max_len, static_cast<size_t>(precision));
+        }
+
+        size_t len = strnlen(str, max_len);
+
+        if (reserve(1 + 2 + len)) {
+            _buf[_pos] = static_cast<unsigned char>(ArgKind::String);
+            put_u16(_buf + _pos + 1, static_cast<uint16_t>(len));
+            memcpy(_buf + _pos + 3, str, len);
+            _pos += 3 + len;
+        }
+    }
+
+private:
+    bool reserve(size_t n)
+    {
+        if (!_full && _size - _pos < n) {
+            _full = true;
+        }
+        return !_full;
+    }
+
+    unsigned char *_buf;
+    size_t _size;
+    size_t _pos;
+    bool _full;
+};
+
+}
+
+static void encode_args(ArgWriter &writer, const char *fmt, va_list ap)
+{
+    int saved_errno = errno;
+    std::string_view view(fmt);
+    size_t pos = 0;
+    FormatSpec spec;
+
+    while (!writer.full() && next_format_spec(view, pos, spec)) {
+        if (spec.type == ArgType::None) {
+            continue;
+        }
+
+        int precision = spec.precision;
+
+        for (int i = 0; i < spec.stars; ++i) {
+            int value = va_arg(ap, int);
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(value)));
+            if (spec.precision_star && i == spec.stars - 1) {
+                precision = value;
+            }
+        }
+
+        switch (spec.type) {
+        case ArgType::Int:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, int))));
+            break;
+        case ArgType::Long:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, long))));
+            break;
+        case ArgType::LongLong:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, long long))));
+            break;
+        case ArgType::IntMax:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, intmax_t))));
+            break;
+        case ArgType::SSize:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, ssize_t))));
+            break;
+        case ArgType::PtrDiff:
+            writer.put_int(ArgKind::Signed, static_cast<uint64_t>(
+                    static_cast<int64_t>(va_arg(ap, ptrdiff_t))));
+            break;
+        case ArgType::UInt:
+            writer.put_int(ArgKind::Unsigned, va_arg(ap, unsigned int));
+            break;
+        case ArgType::ULong:
+            writer.put_int(ArgKind::Unsigned, va_arg(ap, unsigned long));
+            break;
+        case ArgType::ULongLong:
+            writer.put_int(ArgKind::Unsigned, va_arg(ap, unsigned long long));
+            break;
+        case ArgType::UIntMax:
+            writer.put_int(ArgKind::Unsigned, va_arg(ap, uintmax_t));
+            break;
+        case ArgType::Size:
+            writer.put_int(ArgKind::Unsigned, va_arg(ap, size_t));
+            break;
+        case ArgType::UPtrDiff:
+            writer.put_int(ArgKind::Unsigned, static_cast<uint64_t>(
+                    va_arg(ap, ptrdiff_t)));
+            break;
+        case ArgType::Double:
+            writer.put_double(va_arg(ap, double));
+            break;
+        case ArgType::LongDouble:
+            writer.put_double(static_cast<double>(va_arg(ap, long double)));
+            break;
+        case ArgType::String:
+            writer.put_string(va_arg(ap, const char *), precision);
+            break;
+        case ArgType::Pointer:
+            writer.put_int(ArgKind::Pointer, reinterpret_cast<uintptr_t>(
+                    va_arg(ap, void *)));
+            break;
+        case ArgType::ErrnoString:
+            writer.put_string(strerror(saved_errno));
+            break;
+        case ArgType::Count:
+            // Nothing is printed, so there's nothing to store
+            va_arg(ap, void *);
+            break;
+        case ArgType::None:
+            break;
+        }
+    }
+
+    errno = saved_errno;
+}
+
+BinaryLogger::BinaryLogger(const std::string &path, size_t size)
+    : _fd(-1)
+    , _map(nullptr)
+    , _map_size(0)
+    , _ring(nullptr)
+    , _capacity(0)
+{
+    if (!map_file(path, size)) {
+        // Like KmsgLogger, logging silently becomes a no-op
+        if (_map) {
+            munmap(_map, _map_size);
+            _map = nullptr;
+        }
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+}
+
+BinaryLogger::~BinaryLogger()
+{
+    if (_map) {
+        munmap(_map, _map_size);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool BinaryLogger::map_file(const std::string &path, size_t size)
+{
+    uint64_t capacity = std::max(size, MIN_CAPACITY)
+            & ~static_cast<uint64_t>(3);
+    size_t total = sizeof(FileHeader) + static_cast<size_t>(capacity);
+
+    _fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(_fd, &sb) < 0) {
+        return false;
+    }
+
+    bool reuse = static_cast<uint64_t>(sb.st_size) == total;
+    if (!reuse && ftruncate(_fd, static_cast<off_t>(total)) < 0) {
+        return false;
+    }
+
+    void *map = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     _fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    _map = static_cast<unsigned char *>(map);
+    _map_size = total;
+    _ring = _map + sizeof(FileHeader);
+    _capacity = capacity;
+
+    // Keep the existing records if the file was created with the same
+    // parameters
+    if (reuse) {
+        uint64_t head = get_u64(_map + OFF_HEAD);
+        uint64_t tail = get_u64(_map + OFF_TAIL);
+
+        reuse = memcmp(_map + OFF_MAGIC, MAGIC, sizeof(MAGIC)) == 0
+                && get_u32(_map + OFF_VERSION) == VERSION
+                && get_u32(_map + OFF_HEADER_SIZE) == sizeof(FileHeader)
+                && get_u64(_map + OFF_CAPACITY) == capacity
+                && tail <= head && head - tail <= capacity
+                && head % 4 == 0 && tail % 4 == 0;
+    }
+
+    if (!reuse) {
+        memset(_map, 0, sizeof(FileHeader));
+        put_u32(_map + OFF_VERSION, VERSION);
+        put_u32(_map + OFF_HEADER_SIZE, sizeof(FileHeader));
+        put_u64(_map + OFF_CAPACITY, capacity);
+        put_u64(_map + OFF_HEAD, 0);
+        put_u64(_map + OFF_TAIL, 0);
+        // Write the magic last so that a partially initialized header is
+        // never considered valid
+        memcpy(_map + OFF_MAGIC, MAGIC, sizeof(MAGIC));
+    }
+
+    return true;
+}
+
+void BinaryLogger::log(const LogRecord &rec)
+{
+    if (!_map) {
+        return;
+    }
+
+    const char *fmt = rec.fmt;
+    if (!fmt) {
+        // Message was already formatted
+        fmt = "%s";
+    }
+
+    uint32_t tag_id = string_id(rec.tag);
+
+    uint32_t fmt_id;
+    if (auto it = _fmt_ids.find(fmt); it != _fmt_ids.end()) {
+        fmt_id = it->second;
+    } else {
+        fmt_id = string_id(fmt);
+        _fmt_ids.emplace(fmt, fmt_id);
+    }
+
+    std::array<unsigned char, MAX_RECORD_SIZE> buf;
+    ArgWriter writer(buf.data() + MESSAGE_HEADER_SIZE,
+                     buf.size() - MESSAGE_HEADER_SIZE);
+
+    if (rec.fmt) {
+        va_list ap;
+        va_copy(ap, *rec.args);
+        encode_args(writer, fmt, ap);
+        va_end(ap);
+    } else {
+        writer.put_string(rec.msg.c_str());
+    }
+
+    size_t size = align_record(MESSAGE_HEADER_SIZE + writer.pos());
+    memset(buf.data() + MESSAGE_HEADER_SIZE + writer.pos(), 0,
+           size - MESSAGE_HEADER_SIZE - writer.pos());
+
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            rec.time.time_since_epoch()).count();
+
+    put_u16(buf.data(), static_cast<uint16_t>(size));
+    buf[2] = static_cast<unsigned char>(RecordType::Message);
+    buf[3] = static_cast<unsigned char>(rec.prio);
+    put_u32(buf.data() + 4, static_cast<uint32_t>(rec.pid));
+    put_u32(buf.data() + 8, static_cast<uint32_t>(rec.tid));
+    put_u64(buf.data() + 12, static_cast<uint64_t>(time));
+    put_u32(buf.data() + 20, tag_id);
+    put_u32(buf.data() + 24, fmt_id);
+
+    // Evict enough for the message, its string definitions, and padding up
+    // front. Evicting a string definition forgets all of them, so this
+    // guarantees the definitions written below are still present afterwards.
+    make_room(4 * MAX_RECORD_SIZE);
+
+    define_string(static_cast<uint8_t>(StringKind::Tag), tag_id,
+                  rec.tag.data(), rec.tag.size());
+    define_string(static_cast<uint8_t>(StringKind::Format), fmt_id,
+                  fmt, strlen(fmt));
+
+    write_record(buf.data(), size);
+}
+
+bool BinaryLogger::formatted()
+{
+    return false;
+}
+
+bool BinaryLogger::needs_message()
+{
+    return false;
+}
+
+void BinaryLogger::define_string(uint8_t kind, uint32_t id, const char *str,
+                                 size_t len)
+{
+    if (_defined.find(id) != _defined.end()) {
+        return;
+    }
+
+    std::array<unsigned char, MAX_RECORD_SIZE> buf;
+
+    len = std::min(len, buf.size() - STRING_HEADER_SIZE);
+    size_t size = std::min(align_record(STRING_HEADER_SIZE + len), buf.size());
+
+    put_u16(buf.data(), static_cast<uint16_t>(size));
+    buf[2] = static_cast<unsigned char>(RecordType::String);
+    buf[3] = kind;
+    put_u32(buf.data() + 4, id);
+    memcpy(buf.data() + STRING_HEADER_SIZE, str, len);
+    memset(buf.data() + STRING_HEADER_SIZE + len, 0,
+           size - STRING_HEADER_SIZE - len);
+
+    write_record(buf.data(), size);
+
+    _defined.insert(id);
+}
+
+void BinaryLogger::make_room(size_t size)
+{
+    uint64_t head = get_u64(_map + OFF_HEAD);
+    uint64_t tail = get_u64(_map + OFF_TAIL);
+    uint64_t old_tail = tail;
+
+    while (head + size - tail > _capacity) {
+        uint64_t offset = tail % _capacity;
+        uint16_t rec_size = get_u16(_ring + offset);
+
+        if (rec_size < RECORD_HEADER_SIZE || rec_size % 4 != 0
+                || rec_size > _capacity - offset || tail + rec_size > head) {
+            // Corrupted, so start over
+            tail = head;
+            _defined.clear();
+            break;
+        }
+
+        if (_ring[offset + 2] == static_cast<uint8_t>(RecordType::String)) {
+            _defined.clear();
+        }
+
+        tail += rec_size;
+    }
+
+    if (tail != old_tail) {
+        put_u64(_map + OFF_TAIL, tail);
+    }
+}
+
+void BinaryLogger::write_record(const unsigned char *data, size_t size)
+{
+    uint64_t head = get_u64(_map + OFF_HEAD);
+    uint64_t offset = head % _capacity;
+
+    // Records never cross the end of the ring
+    if (offset + size > _capacity) {
+        size_t pad = static_cast<size_t>(_capacity - offset);
+
+        make_room(pad);
+        put_u16(_ring + offset, static_cast<uint16_t>(pad));
+        _ring[offset + 2] = static_cast<unsigned char>(RecordType::Padding);
+        _ring[offset + 3] = 0;
+
+        head += pad;
+        put_u64(_map + OFF_HEAD, head);
+        offset = 0;
+    }
+
+    // The tail is moved past the records being overwritten before the data
+    // is written and the head is only moved afterwards, so the file is
+    // always consistent if the process dies in between
+    make_room(size);
+    memcpy(_ring + offset, data, size);
+    put_u64(_map + OFF_HEAD, head + size);
+}
+
+}
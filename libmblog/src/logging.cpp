@@ -42,6 +42,7 @@
 #endif
 
 #include "mbcommon/error.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/type_traits.h"
 
@@ -65,9 +66,18 @@ using Tid = pid_t;
 
 static std::shared_ptr<BaseLogger> g_logger;
 static std::mutex g_mutex;
+// Serializes calls to loggers that aren't concurrent
+static std::mutex g_log_mutex;
 
 static std::string g_format{"[%t][%P:%T][%l] %n: %m"};
 
+namespace detail
+{
+
+std::atomic<int> g_level{static_cast<int>(LogLevel::Verbose)};
+
+}
+
 // %l - Level
 // %m - Message
 // %n - Tag
@@ -373,16 +383,40 @@ static std::string _format_rec(const LogRecord &rec)
 
 std::shared_ptr<BaseLogger> logger()
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     return g_logger;
 }
 
 void set_logger(std::shared_ptr<BaseLogger> logger)
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     g_logger = std::move(logger);
 }
 
+//! Get the least severe level that is logged
+LogLevel level()
+{
+    return static_cast<LogLevel>(
+            detail::g_level.load(std::memory_order_relaxed));
+}
+
+/*!
+ * \brief Set the least severe level that is logged
+ *
+ * Records below this level are discarded before they are formatted. Levels
+ * below MBLOG_MIN_LEVEL are never logged regardless of this setting.
+ */
+void set_level(LogLevel level)
+{
+    detail::g_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
 void log(LogLevel prio, const char *tag, const char *fmt, ...)
 {
+    if (!is_enabled(prio)) {
+        return;
+    }
+
     va_list ap;
     va_start(ap, fmt);
 
@@ -393,26 +427,56 @@ void log(LogLevel prio, const char *tag, const char *fmt, ...)
 
 void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap)
 {
+    if (!is_enabled(prio)) {
+        return;
+    }
+
     ErrorRestorer restorer;
     LogRecord rec;
-    std::lock_guard<std::mutex> guard(g_mutex);
+    std::shared_ptr<BaseLogger> logger;
 
     rec.time = std::chrono::system_clock::now();
     rec.pid = static_cast<uint64_t>(_get_pid());
     rec.tid = static_cast<uint64_t>(_get_tid());
     rec.prio = prio;
     rec.tag = tag;
-    rec.msg = format_v(fmt, ap);
 
-    if (!g_logger) {
-        g_logger = std::make_shared<StdioLogger>(stdout);
+    {
+        std::lock_guard<std::mutex> guard(g_mutex);
+
+        if (!g_logger) {
+            g_logger = std::make_shared<StdioLogger>(stdout);
+        }
+
+        logger = g_logger;
     }
 
-    if (g_logger->formatted()) {
+    // Loggers that store the raw arguments don't need any formatting
+    va_list copy;
+    va_copy(copy, ap);
+    auto end_copy = finally([&] {
+        va_end(copy);
+    });
+
+    if (logger->needs_message()) {
+        rec.msg = format_v(fmt, ap);
+    } else {
+        rec.fmt = fmt;
+        rec.args = &copy;
+    }
+
+    // Formatting happens outside of the lock so that threads only contend
+    // for the logger itself
+    if (logger->formatted()) {
         rec.fmt_msg = _format_rec(rec);
     }
 
-    g_logger->log(rec);
+    if (logger->concurrent()) {
+        logger->log(rec);
+    } else {
+        std::lock_guard<std::mutex> guard(g_log_mutex);
+        logger->log(rec);
+    }
 }
 
 std::string format()
@@ -45,6 +45,10 @@ public:
     std::vector<std::string> existing_files() const override;
 
     bool patch_files(const std::string &directory) override;
+    bool patch_files(FileMap &files) override;
+
+    bool can_stream(const std::string &file) const override;
+    LineResult patch_line(const std::string &file, std::string &line) override;
 };
 
 }
@@ -49,11 +49,18 @@ public:
     std::vector<std::string> existing_files() const override;
 
     bool patch_files(const std::string &directory) override;
+    bool patch_files(FileMap &files) override;
+
+    bool can_stream(const std::string &file) const override;
+    LineResult patch_line(const std::string &file, std::string &line) override;
 
     bool patch_updater(const std::string &directory);
     bool patch_transfer_list(const std::string &directory);
 
 private:
+    bool patch_updater_contents(std::string &contents);
+    static void patch_transfer_list_contents(std::string &contents);
+
     const FileInfo &m_info;
 };
 
@@ -40,4 +40,9 @@ MB_EXPORT void mbpatcher_fileinfo_set_device(CFileInfo *info, CDevice *device);
 MB_EXPORT char * mbpatcher_fileinfo_rom_id(const CFileInfo *info);
 MB_EXPORT void mbpatcher_fileinfo_set_rom_id(CFileInfo *info, const char *id);
 
+MB_EXPORT const char * mbpatcher_fileinfo_input_path_ref(const CFileInfo *info);
+MB_EXPORT const char * mbpatcher_fileinfo_output_path_ref(const CFileInfo *info);
+MB_EXPORT const CDevice * mbpatcher_fileinfo_device_ref(const CFileInfo *info);
+MB_EXPORT const char * mbpatcher_fileinfo_rom_id_ref(const CFileInfo *info);
+
 MB_END_C_DECLS
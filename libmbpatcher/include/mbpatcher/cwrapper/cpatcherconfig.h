@@ -20,6 +20,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "mbcommon/common.h"
 #include "mbpatcher/cwrapper/ctypes.h"
@@ -33,9 +34,34 @@ MB_EXPORT /* enum ErrorCode */ int mbpatcher_config_error(const CPatcherConfig *
 
 MB_EXPORT char * mbpatcher_config_data_directory(const CPatcherConfig *pc);
 MB_EXPORT char * mbpatcher_config_temp_directory(const CPatcherConfig *pc);
+MB_EXPORT char * mbpatcher_config_cache_directory(const CPatcherConfig *pc);
+
+MB_EXPORT const char * mbpatcher_config_data_directory_ref(const CPatcherConfig *pc);
+MB_EXPORT const char * mbpatcher_config_cache_directory_ref(const CPatcherConfig *pc);
 
 MB_EXPORT void mbpatcher_config_set_data_directory(CPatcherConfig *pc, char *path);
 MB_EXPORT void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path);
+MB_EXPORT void mbpatcher_config_set_cache_directory(CPatcherConfig *pc, char *path);
+
+MB_EXPORT /* enum CompressionPolicy */ int mbpatcher_config_compression_policy(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_compression_policy(CPatcherConfig *pc,
+                                                       /* enum CompressionPolicy */ int policy);
+MB_EXPORT /* enum CompressionMethod */ int mbpatcher_config_compression_method(const CPatcherConfig *pc);
+MB_EXPORT bool mbpatcher_config_set_compression_method(CPatcherConfig *pc,
+                                                       /* enum CompressionMethod */ int method);
+MB_EXPORT bool mbpatcher_config_is_compression_method_supported(/* enum CompressionMethod */ int method);
+
+MB_EXPORT unsigned int mbpatcher_config_compression_threads(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_compression_threads(CPatcherConfig *pc,
+                                                        unsigned int threads);
+
+MB_EXPORT uint64_t mbpatcher_config_memory_budget(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_memory_budget(CPatcherConfig *pc,
+                                                  uint64_t bytes);
+
+MB_EXPORT bool mbpatcher_config_defer_cleanup(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_defer_cleanup(CPatcherConfig *pc,
+                                                  bool defer);
 
 MB_EXPORT char ** mbpatcher_config_patchers(const CPatcherConfig *pc);
 MB_EXPORT char ** mbpatcher_config_autopatchers(const CPatcherConfig *pc);
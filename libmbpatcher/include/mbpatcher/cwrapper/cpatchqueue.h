@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+
+MB_BEGIN_C_DECLS
+
+typedef void (*JobProgressCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*JobFilesCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*JobDetailsCallback) (size_t, const char *, void *);
+typedef void (*JobStateCallback) (size_t, /* enum PatchJobState */ int, void *);
+
+MB_EXPORT CPatchQueue * mbpatcher_patchqueue_create(CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_patchqueue_destroy(CPatchQueue *queue);
+
+MB_EXPORT unsigned int mbpatcher_patchqueue_max_workers(const CPatchQueue *queue);
+MB_EXPORT void mbpatcher_patchqueue_set_max_workers(CPatchQueue *queue,
+                                                    unsigned int workers);
+
+MB_EXPORT bool mbpatcher_patchqueue_set_devices_from_json(CPatchQueue *queue,
+                                                          const char *json);
+
+MB_EXPORT size_t mbpatcher_patchqueue_add_job(CPatchQueue *queue,
+                                              const char *patcher_id,
+                                              const CFileInfo *info);
+MB_EXPORT bool mbpatcher_patchqueue_add_job_for_device(CPatchQueue *queue,
+                                                       const char *patcher_id,
+                                                       const char *input_path,
+                                                       const char *output_path,
+                                                       const char *device_id,
+                                                       const char *rom_id,
+                                                       size_t *job_out);
+
+MB_EXPORT size_t mbpatcher_patchqueue_job_count(const CPatchQueue *queue);
+MB_EXPORT /* enum PatchJobState */ int mbpatcher_patchqueue_job_state(const CPatchQueue *queue,
+                                                                      size_t job);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_patchqueue_job_error(const CPatchQueue *queue,
+                                                                  size_t job);
+
+MB_EXPORT void mbpatcher_patchqueue_set_callbacks(CPatchQueue *queue,
+                                                  JobProgressCallback progressCb,
+                                                  JobFilesCallback filesCb,
+                                                  JobDetailsCallback detailsCb,
+                                                  JobStateCallback stateCb,
+                                                  void *userData);
+
+MB_EXPORT bool mbpatcher_patchqueue_start(CPatchQueue *queue);
+MB_EXPORT bool mbpatcher_patchqueue_wait(CPatchQueue *queue);
+MB_EXPORT void mbpatcher_patchqueue_cancel_job(CPatchQueue *queue, size_t job);
+MB_EXPORT void mbpatcher_patchqueue_cancel_all(CPatchQueue *queue);
+
+MB_END_C_DECLS
@@ -25,6 +25,7 @@
 #include <variant>
 
 #include <cassert>
+#include <cstdint>
 
 #include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
@@ -236,6 +237,8 @@ public:
     static bool is_valid_unquoted(char c);
 
 protected:
+    friend struct EdifyTokenView;
+
     std::string m_str;
     bool m_quoted;
 
@@ -283,15 +286,110 @@ using EdifyToken = std::variant<
     EdifyTokenUnknown
 >;
 
+enum class EdifyTokenType : uint8_t
+{
+    If,
+    Then,
+    Else,
+    Endif,
+    And,
+    Or,
+    Equals,
+    NotEquals,
+    Not,
+    LeftParen,
+    RightParen,
+    Semicolon,
+    Comma,
+    Concat,
+    Newline,
+    Whitespace,
+    Comment,
+    String,
+    Unknown,
+};
+
+/*!
+ * \brief Non-owning edify token
+ *
+ * The token refers to the text in the buffer that was tokenized, so the buffer
+ * must outlive the token. Unlike EdifyToken, this never allocates.
+ */
+struct MB_EXPORT EdifyTokenView
+{
+    EdifyTokenType type;
+    // Full text of the token, including quotes and the leading '#' of comments
+    std::string_view text;
+    // Offset of the token in the tokenized buffer
+    std::size_t offset;
+
+    bool quoted() const;
+    std::string_view raw_string() const;
+    oc::result<std::string> unescaped_string() const;
+};
+
+/*!
+ * \brief Pull-based edify tokenizer
+ *
+ * Tokens are produced one at a time with next() without copying the input.
+ */
+class MB_EXPORT EdifyTokenStream
+{
+public:
+    explicit EdifyTokenStream(std::string_view str);
+
+    oc::result<bool> next(EdifyTokenView &token);
+
+    std::size_t offset() const;
+
+private:
+    std::string_view m_str;
+    std::size_t m_offset;
+};
+
+/*!
+ * \brief Rewrite an edify script by splicing replacements into the original
+ *
+ * Unmodified parts of the script are copied verbatim instead of being
+ * regenerated from tokens.
+ */
+class MB_EXPORT EdifyRewriter
+{
+public:
+    explicit EdifyRewriter(std::string_view source);
+
+    void replace(std::size_t offset, std::size_t size, std::string replacement);
+    void replace(const EdifyTokenView &first, const EdifyTokenView &last,
+                 std::string replacement);
+
+    bool modified() const;
+
+    std::string apply() const;
+
+private:
+    struct Edit
+    {
+        std::size_t offset;
+        std::size_t size;
+        std::string replacement;
+    };
+
+    std::string_view m_source;
+    std::vector<Edit> m_edits;
+};
+
 class EdifyTokenizer
 {
 public:
     static oc::result<std::vector<EdifyToken>> tokenize(std::string_view str);
+    static oc::result<void> tokenize(std::string_view str,
+                                     std::vector<EdifyTokenView> &tokens);
     static std::string untokenize(const std::vector<EdifyToken> &tokens);
     static std::string untokenize(std::vector<EdifyToken>::const_iterator begin,
                                   std::vector<EdifyToken>::const_iterator end);
 
     static void dump(const std::vector<EdifyToken> &tokens);
+    static void dump(const std::vector<EdifyTokenView> &tokens);
 
 private:
     static oc::result<EdifyToken> next_token(std::string_view str,
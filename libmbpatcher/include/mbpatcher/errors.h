@@ -59,6 +59,9 @@ enum ErrorCode
 
     // Cancelled
     PatchingCancelled = 300,
+
+    // Verification
+    ChecksumMismatch = 400,
 };
 
 #ifdef __cplusplus
@@ -20,8 +20,11 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
+#include <cstdint>
+
 #include "mbcommon/common.h"
 
 #include "mbpatcher/errors.h"
@@ -34,6 +37,24 @@ namespace mb::patcher
 class Patcher;
 class AutoPatcher;
 
+enum class CompressionPolicy
+{
+    // Always deflate
+    Deflate,
+    // Always store uncompressed
+    Store,
+    // Store data that does not compress well and deflate everything else
+    Auto,
+};
+
+enum class CompressionMethod
+{
+    // Deflate (zip method 8). Supported by every recovery.
+    Deflate,
+    // Zstandard (zip method 93). Requires zstd support at build time.
+    Zstd,
+};
+
 class MB_EXPORT PatcherConfig
 {
 public:
@@ -42,12 +63,32 @@ public:
 
     ErrorCode error() const;
 
-    std::string data_directory() const;
+    const std::string & data_directory() const;
     std::string temp_directory() const;
 
     void set_data_directory(std::string path);
     void set_temp_directory(std::string path);
 
+    const std::string & cache_directory() const;
+    void set_cache_directory(std::string path);
+
+    CompressionPolicy compression_policy() const;
+    void set_compression_policy(CompressionPolicy policy);
+
+    CompressionMethod compression_method() const;
+    bool set_compression_method(CompressionMethod method);
+
+    static bool is_compression_method_supported(CompressionMethod method);
+
+    unsigned int compression_threads() const;
+    void set_compression_threads(unsigned int threads);
+
+    uint64_t memory_budget() const;
+    void set_memory_budget(uint64_t bytes);
+
+    bool defer_cleanup() const;
+    void set_defer_cleanup(bool defer);
+
     std::vector<std::string> patchers() const;
     std::vector<std::string> auto_patchers() const;
 
@@ -65,11 +106,25 @@ private:
     // Directories
     std::string m_data_dir;
     std::string m_temp_dir;
+    std::string m_cache_dir;
+
+    // Compression
+    CompressionPolicy m_compression_policy = CompressionPolicy::Auto;
+    CompressionMethod m_compression_method = CompressionMethod::Deflate;
+    unsigned int m_compression_threads = 1;
+
+    // Memory
+    uint64_t m_memory_budget = 0;
+
+    // Cleanup
+    bool m_defer_cleanup = false;
 
     // Errors
     ErrorCode m_error;
 
-    // Created patchers
+    // Created patchers (guarded by m_patchers_lock so patchers can be created
+    // from multiple threads)
+    std::mutex m_patchers_lock;
     std::vector<std::unique_ptr<Patcher>> m_patchers;
     std::vector<std::unique_ptr<AutoPatcher>> m_auto_patchers;
 };
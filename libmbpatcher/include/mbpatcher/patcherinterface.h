@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "mbcommon/common.h"
 
 #include "mbpatcher/errors.h"
@@ -103,6 +107,24 @@ public:
 class AutoPatcher
 {
 public:
+    /*!
+     * \brief Map of paths within the zip file to the file contents
+     */
+    using FileMap = std::unordered_map<std::string, std::string>;
+
+    /*!
+     * \brief Result of patching a single line with patch_line()
+     */
+    enum class LineResult
+    {
+        // Keep the (possibly modified) line
+        Keep,
+        // Remove the line from the file
+        Remove,
+        // Patching failed
+        Error,
+    };
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -138,6 +160,48 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patch_files(const std::string &directory) = 0;
+
+    /*!
+     * \brief Patch files in memory
+     *
+     * Files from existing_files() that are not in \p files should be skipped.
+     * This allows the caller to patch each file as soon as it is read from the
+     * zip.
+     *
+     * \param files Files to be patched. The contents are modified in place.
+     */
+    virtual bool patch_files(FileMap &files) = 0;
+
+    /*!
+     * \brief Whether a file can be patched one line at a time
+     *
+     * Files that are too large to be kept in memory are streamed through
+     * patch_line() if every autopatcher that patches them supports it.
+     * Otherwise, they are extracted to a temporary directory and patched with
+     * patch_files(const std::string &).
+     *
+     * \param file Path of the file within the zip file
+     */
+    virtual bool can_stream(const std::string &file) const
+    {
+        (void) file;
+        return false;
+    }
+
+    /*!
+     * \brief Patch a single line of a streamed file
+     *
+     * Only called for files for which can_stream() returns true.
+     *
+     * \param file Path of the file within the zip file
+     * \param line Line without the trailing newline. Modified in place.
+     */
+    virtual LineResult patch_line(const std::string &file, std::string &line)
+    {
+        (void) file;
+        (void) line;
+        return LineResult::Error;
+    }
 };
 
 }
@@ -19,13 +19,22 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <unordered_set>
+#include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/file/tracing.h"
+
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/md5worker.h"
+#include "mbpatcher/private/progress.h"
 
 #ifdef __ANDROID__
 #  include "mbcommon/file/fd.h"
@@ -66,28 +75,40 @@ private:
     PatcherConfig &m_pc;
     const FileInfo *m_info;
 
-    uint64_t m_old_bytes;
     uint64_t m_bytes;
     uint64_t m_max_bytes;
 
-    volatile bool m_cancelled;
+    std::atomic_bool m_cancelled;
 
     ErrorCode m_error;
 
-    unsigned char m_la_buf[10240];
+    // Reads alternate between the buffers so that the previous one can still
+    // be hashed while the next one is filled
+    std::array<std::vector<unsigned char>, 2> m_la_bufs;
+    size_t m_la_buf_index;
 #ifdef __ANDROID__
     FdFile m_la_file;
     int m_fd;
 #else
     StandardFile m_la_file;
 #endif
+    // Collects I/O statistics for the input when MB_FILE_TRACE is set
+    TracingFile m_la_trace;
+    // Either m_la_file or m_la_trace
+    File *m_la_input;
+
+    // Verification of the MD5 trailer of .tar.md5 inputs
+    std::unique_ptr<Md5Worker> m_md5;
+    Md5Worker::Digest m_md5_expected;
+    // Size of the data covered by the checksum (everything before the trailer)
+    uint64_t m_md5_size;
+    // Number of bytes passed to m_md5 so far
+    uint64_t m_md5_pos;
 
     std::unordered_set<std::string> m_added_files;
 
     // Callbacks
-    OdinPatcher::ProgressUpdatedCallback m_progress_cb;
-    OdinPatcher::DetailsUpdatedCallback m_details_cb;
-    void *m_userdata;
+    ProgressReporter m_progress;
 
     // Patching
     archive *m_a_input;
@@ -96,7 +117,18 @@ private:
     bool patch_tar();
 
     bool process_file(archive *a, archive_entry *entry, bool sparse);
+    bool process_file_stored(archive *a, const char *name,
+                             const std::string &zip_name,
+                             const std::vector<unsigned char> &sample);
+    bool process_file_parallel(archive *a, const char *name,
+                               const std::string &zip_name,
+                               const std::vector<unsigned char> &sample);
+    bool copy_entry_data(archive *a, const char *name,
+                         const std::vector<unsigned char> &sample,
+                         const std::function<bool(const void *, size_t)> &write);
     bool process_contents(archive *a, unsigned int depth);
+    bool find_md5_trailer();
+    bool verify_md5();
     bool open_input_archive();
     bool close_input_archive();
     bool open_output_archive();
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
 
@@ -58,7 +60,7 @@ private:
     PatcherConfig &m_pc;
     const FileInfo *m_info;
 
-    volatile bool m_cancelled;
+    std::atomic_bool m_cancelled;
 
     ErrorCode m_error;
 
@@ -19,10 +19,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <unordered_set>
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/progress.h"
 
 
 namespace mb::patcher
@@ -68,30 +70,34 @@ private:
     uint64_t m_files;
     uint64_t m_max_files;
 
-    volatile bool m_cancelled;
+    std::atomic_bool m_cancelled;
 
     ErrorCode m_error;
 
     // Callbacks
-    ProgressUpdatedCallback m_progress_cb;
-    FilesUpdatedCallback m_files_cb;
-    DetailsUpdatedCallback m_details_cb;
-    void *m_userdata;
+    ProgressReporter m_progress;
 
     // Patching
     ZipCtx *m_z_input = nullptr;
     ZipCtx *m_z_output = nullptr;
     std::vector<AutoPatcher *> m_auto_patchers;
+    std::string m_device_json;
 
     bool patch_zip();
 
-    bool pass1(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &files);
+    bool process_entries(const std::unordered_set<std::string> &to_patch,
+                         bool copied);
+    bool patch_entry(const std::string &name, uint32_t crc32, uint64_t size);
+    bool patch_large_entry(const std::string &name,
+                           const std::string &output_name);
+
+    bool load_cached_entry(const std::string &key,
+                           std::vector<unsigned char> &data);
+    void store_cached_entry(const std::string &key,
+                            const std::vector<unsigned char> &data);
     bool open_input_archive();
     void close_input_archive();
-    bool open_output_archive();
+    bool open_output_archive(bool append);
     void close_output_archive();
 
     void update_progress(uint64_t bytes, uint64_t max_bytes);
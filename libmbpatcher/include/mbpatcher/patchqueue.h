@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+#include "mbdevice/device.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/fileinfo.h"
+
+
+namespace mb::patcher
+{
+
+class Patcher;
+class PatcherConfig;
+
+enum class PatchJobState
+{
+    // Waiting for a worker
+    Pending,
+    // Being patched
+    Running,
+    // Finished successfully
+    Succeeded,
+    // Patching failed. See PatchQueue::job_error()
+    Failed,
+    // Cancelled before or during patching
+    Cancelled,
+};
+
+class MB_EXPORT PatchQueue
+{
+public:
+    typedef void (*JobProgressCallback) (size_t, uint64_t, uint64_t, void *);
+    typedef void (*JobFilesCallback) (size_t, uint64_t, uint64_t, void *);
+    typedef void (*JobDetailsCallback) (size_t, const std::string &, void *);
+    typedef void (*JobStateCallback) (size_t, PatchJobState, void *);
+
+    explicit PatchQueue(PatcherConfig &pc);
+    ~PatchQueue();
+
+    unsigned int max_workers() const;
+    void set_max_workers(unsigned int workers);
+
+    void set_devices(std::vector<device::Device> devices);
+    const std::vector<device::Device> & devices() const;
+
+    size_t add_job(const std::string &patcher_id, FileInfo info);
+    bool add_job(const std::string &patcher_id, std::string input_path,
+                 std::string output_path, const std::string &device_id,
+                 std::string rom_id, size_t &job_out);
+
+    size_t job_count() const;
+    PatchJobState job_state(size_t job) const;
+    ErrorCode job_error(size_t job) const;
+    const FileInfo & job_file_info(size_t job) const;
+
+    void set_callbacks(JobProgressCallback progress_cb,
+                       JobFilesCallback files_cb,
+                       JobDetailsCallback details_cb,
+                       JobStateCallback state_cb,
+                       void *userdata);
+
+    bool start();
+    bool wait();
+    void cancel_job(size_t job);
+    void cancel_all();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatchQueue)
+
+private:
+    struct Job;
+
+    void worker();
+    void run_job(size_t index);
+    void set_job_state(size_t index, PatchJobState state, ErrorCode error);
+
+    static void progress_cb_wrapper(uint64_t bytes, uint64_t max_bytes,
+                                    void *userdata);
+    static void files_cb_wrapper(uint64_t files, uint64_t max_files,
+                                 void *userdata);
+    static void details_cb_wrapper(const std::string &text, void *userdata);
+
+    PatcherConfig &m_pc;
+
+    unsigned int m_max_workers;
+    std::vector<device::Device> m_devices;
+
+    // Jobs are never removed, so pointers to them remain valid while the
+    // workers are running
+    std::vector<std::unique_ptr<Job>> m_jobs;
+    // Guards the job states and running patchers
+    mutable std::mutex m_jobs_lock;
+    std::atomic_size_t m_next_job;
+    std::atomic_bool m_cancelled;
+
+    std::vector<std::thread> m_workers;
+
+    JobProgressCallback m_progress_cb;
+    JobFilesCallback m_files_cb;
+    JobDetailsCallback m_details_cb;
+    JobStateCallback m_state_cb;
+    void *m_userdata;
+};
+
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <openssl/md5.h>
+
+#include "mbcommon/common.h"
+
+
+namespace mb::patcher
+{
+
+class Md5Worker
+{
+public:
+    using Digest = std::array<unsigned char, MD5_DIGEST_LENGTH>;
+
+    Md5Worker();
+    ~Md5Worker();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Md5Worker)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Md5Worker)
+
+    void update(const void *data, size_t size);
+    void wait(size_t max_pending);
+    Digest finish();
+
+private:
+    struct Chunk
+    {
+        const void *data;
+        size_t size;
+    };
+
+    void worker();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    // Signalled when a chunk is queued or the worker should exit
+    std::condition_variable m_queue_cv;
+    // Signalled when a chunk has been hashed
+    std::condition_variable m_done_cv;
+    // Chunks that have not been hashed yet, including the one in progress
+    std::deque<Chunk> m_queue;
+    bool m_stop;
+
+    MD5_CTX m_ctx;
+};
+
+}
@@ -19,13 +19,18 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "mz.h"
 #include "mz_zip.h"
 
 #include "mbpatcher/errors.h"
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
 
 
 namespace mb::patcher
@@ -37,6 +42,7 @@ enum class ZipOpenMode
 {
     Read,
     Write,
+    Append,
 };
 
 class MinizipUtils
@@ -48,6 +54,16 @@ public:
         uint64_t total_size;
     };
 
+    struct RawCopyStats
+    {
+        // Whether the source zip could be copied with bulk_copy_raw()
+        bool supported;
+        uint64_t files;
+        uint64_t uncompressed_size;
+    };
+
+    static uint16_t zip_compression_method(CompressionMethod method);
+
     static void * ctx_get_zip_handle(ZipCtx *ctx);
 
     static ZipCtx * open_zip_file(std::string path, ZipOpenMode mode);
@@ -64,11 +80,28 @@ public:
                               void (*cb)(uint64_t bytes, void *),
                               void *userdata);
 
+    static ErrorCode bulk_copy_raw(const std::string &source_path,
+                                   const std::string &target_path,
+                                   const std::unordered_set<std::string> &exclude,
+                                   const std::unordered_map<std::string, std::string> &renames,
+                                   RawCopyStats &stats,
+                                   void (*cb)(uint64_t bytes, void *),
+                                   void *userdata);
+
     static bool read_to_memory(void *handle,
                                std::vector<unsigned char> &output,
                                void (*cb)(uint64_t bytes, void *),
                                void *userdata);
 
+    using LineFilter = std::function<AutoPatcher::LineResult(std::string &)>;
+
+    static bool filter_lines(void *source_handle,
+                             void *target_handle,
+                             const std::string &name,
+                             const LineFilter &filter,
+                             void (*cb)(uint64_t bytes, void *),
+                             void *userdata);
+
     static bool extract_file(void *handle,
                              const std::string &directory);
 
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+
+namespace mb::patcher
+{
+
+class ParallelDeflate
+{
+public:
+    using WriteCallback = std::function<bool(const void *data, size_t size)>;
+
+    ParallelDeflate(unsigned int threads, int level, WriteCallback cb);
+    ~ParallelDeflate();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDeflate)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDeflate)
+
+    bool write(const void *data, size_t size);
+    bool finish();
+
+    uint32_t crc32() const;
+    uint64_t uncompressed_size() const;
+
+private:
+    struct Job
+    {
+        std::vector<unsigned char> input;
+        std::vector<unsigned char> dict;
+        std::vector<unsigned char> output;
+        uint32_t crc32;
+        bool last;
+        bool done;
+        bool ok;
+    };
+
+    void worker();
+    static bool compress(Job &job, int level);
+
+    bool submit(bool last);
+    bool write_oldest();
+
+    int m_level;
+    WriteCallback m_cb;
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    // Signalled when a job is queued or the workers should exit
+    std::condition_variable m_queue_cv;
+    // Signalled when a job is completed
+    std::condition_variable m_done_cv;
+    // Jobs waiting for a worker
+    std::deque<Job *> m_queue;
+    // All submitted jobs that have not been written yet, in stream order
+    std::deque<std::unique_ptr<Job>> m_jobs;
+    size_t m_max_jobs;
+    bool m_stop;
+
+    // Data for the next block and the dictionary (tail of the previous block)
+    std::vector<unsigned char> m_block;
+    std::vector<unsigned char> m_dict;
+
+    uint32_t m_crc32;
+    uint64_t m_size;
+};
+
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/patcherinterface.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Throttled progress channel between a patcher and its host
+ *
+ * The patcher updates the current values from its worker thread, which only
+ * stores them in atomics. The host's callbacks are invoked at most once per
+ * dispatch interval (plus once when flush() is called), so slow callbacks,
+ * such as ones that cross JNI or post Qt events, cannot throttle the copy
+ * loops. The current values can also be polled from any thread.
+ */
+class ProgressReporter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr Clock::duration DEFAULT_INTERVAL =
+            std::chrono::milliseconds(50);
+
+    ProgressReporter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+
+    void reset(Patcher::ProgressUpdatedCallback progress_cb,
+               Patcher::FilesUpdatedCallback files_cb,
+               Patcher::DetailsUpdatedCallback details_cb,
+               void *userdata);
+
+    void set_interval(Clock::duration interval);
+
+    void set_bytes(uint64_t bytes, uint64_t max_bytes);
+    void set_files(uint64_t files, uint64_t max_files);
+    void set_details(const std::string &details);
+
+    void flush();
+
+    uint64_t bytes() const;
+    uint64_t max_bytes() const;
+    uint64_t files() const;
+    uint64_t max_files() const;
+
+private:
+    void maybe_dispatch();
+    void dispatch();
+
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_max_bytes;
+    std::atomic<uint64_t> m_files;
+    std::atomic<uint64_t> m_max_files;
+
+    // Details change rarely compared to the counters
+    std::mutex m_details_lock;
+    std::string m_details;
+    bool m_details_dirty;
+
+    // Only accessed by the updating thread
+    Patcher::ProgressUpdatedCallback m_progress_cb;
+    Patcher::FilesUpdatedCallback m_files_cb;
+    Patcher::DetailsUpdatedCallback m_details_cb;
+    void *m_userdata;
+
+    Clock::duration m_interval;
+    Clock::time_point m_next_dispatch;
+
+    uint64_t m_sent_bytes;
+    uint64_t m_sent_max_bytes;
+    uint64_t m_sent_files;
+    uint64_t m_sent_max_files;
+};
+
+}
@@ -78,19 +78,14 @@ static void replace_all(std::string &source, std::string_view from,
     }
 }
 
-static bool patch_file(const std::string &path, bool is_updater)
+static void patch_contents(std::string &contents, bool is_updater)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
     if (is_updater && !starts_with(contents, "#MAGISK")) {
-        return true;
+        return;
     }
 
+    // None of the patterns span multiple lines, so this also works for the
+    // individual lines passed to patch_line()
     replace_all(contents, "mount /data", "/update-binary-tool mount /data");
     replace_all(contents, "mount /cache", "/update-binary-tool mount /cache");
     replace_all(contents, "mount -o ro /system", "/update-binary-tool mount /system");
@@ -108,6 +103,18 @@ static bool patch_file(const std::string &path, bool is_updater)
     // continuing. This race condition leads to a corrupted boot image on
     // devices with slow internal storage like the Galaxy S4.
     replace_all(contents, "sleep 5", "sleep 10");
+}
+
+static bool patch_file(const std::string &path, bool is_updater)
+{
+    std::string contents;
+
+    ErrorCode ret = FileUtils::read_to_string(path, &contents);
+    if (ret != ErrorCode::NoError) {
+        return false;
+    }
+
+    patch_contents(contents, is_updater);
 
     FileUtils::write_from_string(path, contents);
 
@@ -124,4 +131,36 @@ bool MagiskPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool MagiskPatcher::patch_files(FileMap &files)
+{
+    for (auto const &[name, is_updater] : {
+        std::make_pair(StandardPatcher::UpdaterScript, true),
+        std::make_pair(AddonDScript, false),
+        std::make_pair(UtilFunctions, false),
+    }) {
+        if (auto it = files.find(name); it != files.end()) {
+            patch_contents(it->second, is_updater);
+        }
+    }
+
+    return true;
+}
+
+bool MagiskPatcher::can_stream(const std::string &file) const
+{
+    // The updater-script is only patched if its first line matches, so it
+    // needs to be seen as a whole
+    return file == AddonDScript || file == UtilFunctions;
+}
+
+AutoPatcher::LineResult MagiskPatcher::patch_line(const std::string &file,
+                                                  std::string &line)
+{
+    if (can_stream(file)) {
+        patch_contents(line, false);
+    }
+
+    return LineResult::Keep;
+}
+
 }
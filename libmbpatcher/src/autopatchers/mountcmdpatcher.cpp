@@ -67,35 +67,76 @@ std::vector<std::string> MountCmdPatcher::existing_files() const
     return { FlashScript, InstallerScript };
 }
 
-static bool space_or_end(const char *ptr)
+static bool space_or_end(std::string_view str, std::size_t pos)
 {
-    return !*ptr || isspace(*ptr);
+    return pos == str.size() || isspace(str[pos]);
 }
 
-static bool patch_file(const std::string &path)
+static bool is_mount_cmd(std::string_view str, std::size_t pos)
 {
-    std::string contents;
+    std::string_view rest = str.substr(pos);
 
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
+    return (starts_with(rest, "mount") && space_or_end(str, pos + 5))
+            || (starts_with(rest, "umount") && space_or_end(str, pos + 6));
+}
+
+static void patch_contents(std::string &contents)
+{
+    std::string_view input(contents);
+    std::string output;
+    std::size_t copied = 0;
+    bool modified = false;
+
+    // Find the first non-whitespace character of every line in a single pass
+    // and only copy the script when a command needs to be prefixed
+    for (std::size_t line = 0; line < input.size();) {
+        std::size_t pos = line;
+        for (; pos < input.size() && input[pos] != '\n'
+                && isspace(input[pos]); ++pos);
+
+        if (is_mount_cmd(input, pos)) {
+            if (!modified) {
+                output.reserve(contents.size() + 64);
+                modified = true;
+            }
+            output += input.substr(copied, pos - copied);
+            output += "/sbin/";
+            copied = pos;
+        }
+
+        auto newline = input.find('\n', pos);
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        line = newline + 1;
     }
 
-    auto lines = split(contents, '\n');
+    if (modified) {
+        output += input.substr(copied);
+        contents = std::move(output);
+    }
+}
 
-    for (auto &line : lines) {
-        const char *ptr = line.data();
+static void patch_line_contents(std::string &line)
+{
+    std::size_t pos = 0;
+    for (; pos < line.size() && isspace(line[pos]); ++pos);
 
-        // Skip whitespace
-        for (; *ptr && isspace(*ptr); ++ptr);
+    if (is_mount_cmd(line, pos)) {
+        line.insert(pos, "/sbin/");
+    }
+}
 
-        if ((strncmp(ptr, "mount", 5) == 0 && space_or_end(ptr + 5))
-                || (strncmp(ptr, "umount", 6) == 0 && space_or_end(ptr + 6))) {
-            line.insert(static_cast<size_t>(ptr - line.data()), "/sbin/");
-        }
+static bool patch_file(const std::string &path)
+{
+    std::string contents;
+
+    ErrorCode ret = FileUtils::read_to_string(path, &contents);
+    if (ret != ErrorCode::NoError) {
+        return false;
     }
 
-    contents = join(lines, "\n");
+    patch_contents(contents);
     FileUtils::write_from_string(path, contents);
 
     return true;
@@ -110,4 +151,30 @@ bool MountCmdPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool MountCmdPatcher::patch_files(FileMap &files)
+{
+    for (auto const &name : { FlashScript, InstallerScript }) {
+        if (auto it = files.find(name); it != files.end()) {
+            patch_contents(it->second);
+        }
+    }
+
+    return true;
+}
+
+bool MountCmdPatcher::can_stream(const std::string &file) const
+{
+    return file == FlashScript || file == InstallerScript;
+}
+
+AutoPatcher::LineResult MountCmdPatcher::patch_line(const std::string &file,
+                                                    std::string &line)
+{
+    if (can_stream(file)) {
+        patch_line_contents(line);
+    }
+
+    return LineResult::Keep;
+}
+
 }
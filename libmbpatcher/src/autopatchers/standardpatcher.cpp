@@ -19,8 +19,9 @@
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
-#include <optional>
+#include <chrono>
 
+#include <cinttypes>
 #include <cstring>
 
 #include "mbcommon/string.h"
@@ -94,7 +95,7 @@ static bool find_items_in_string(const std::string &haystack,
     return false;
 }
 
-using TokenIter = std::vector<EdifyToken>::iterator;
+using TokenIter = std::vector<EdifyTokenView>::const_iterator;
 
 struct FunctionBounds
 {
@@ -103,226 +104,219 @@ struct FunctionBounds
     TokenIter right_paren;
 };
 
-static std::optional<FunctionBounds>
-find_function(const TokenIter begin, const TokenIter end)
+/*!
+ * \brief Find the matching right parenthesis for every left parenthesis
+ *
+ * This is computed once per script so that finding the bounds of a function
+ * call does not require rescanning its arguments.
+ *
+ * \return Vector where the element for each left parenthesis token is the
+ *         index of the matching right parenthesis token (or SIZE_MAX if it is
+ *         unterminated). Other elements are unspecified.
+ */
+static std::vector<std::size_t>
+match_parens(const std::vector<EdifyTokenView> &tokens)
 {
-    FunctionBounds bounds;
+    std::vector<std::size_t> matching(tokens.size(), SIZE_MAX);
+    std::vector<std::size_t> stack;
 
-    for (auto it = begin; it != end; ++it) {
-        // Find string representing the function name
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
-            continue;
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == EdifyTokenType::LeftParen) {
+            stack.push_back(i);
+        } else if (tokens[i].type == EdifyTokenType::RightParen
+                && !stack.empty()) {
+            matching[stack.back()] = i;
+            stack.pop_back();
         }
+    }
 
-        bounds.func_name = it;
+    return matching;
+}
 
-        bool found_left_paren = false;
-        bool found_right_paren = false;
+enum class FindResult
+{
+    NotFunction,
+    Found,
+    Unterminated,
+};
 
-        // Barring any whitespace, newlines, or comments, the function name
-        // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenWhitespace>(*it2)
-                    || std::holds_alternative<EdifyTokenNewline>(*it2)
-                    || std::holds_alternative<EdifyTokenComment>(*it2)) {
-                continue;
-            } else if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                found_left_paren = true;
-                bounds.left_paren = it2;
-            }
+/*!
+ * \brief Check if the token at \p index is the name of a function call
+ */
+static FindResult
+function_at(const std::vector<EdifyTokenView> &tokens,
+            const std::vector<std::size_t> &matching, std::size_t index,
+            FunctionBounds &bounds)
+{
+    // Find string representing the function name
+    if (tokens[index].type != EdifyTokenType::String) {
+        return FindResult::NotFunction;
+    }
+
+    // Barring any whitespace, newlines, or comments, the function name
+    // should be followed by a left parenthesis
+    std::size_t left = index + 1;
+    for (; left < tokens.size(); ++left) {
+        auto type = tokens[left].type;
+        if (type != EdifyTokenType::Whitespace
+                && type != EdifyTokenType::Newline
+                && type != EdifyTokenType::Comment) {
             break;
         }
+    }
 
-        // If a left parenthesis was not found, then the string token was not
-        // a function name
-        if (!found_left_paren) {
-            continue;
-        }
+    // If a left parenthesis was not found, then the string token was not
+    // a function name
+    if (left == tokens.size()
+            || tokens[left].type != EdifyTokenType::LeftParen) {
+        return FindResult::NotFunction;
+    }
 
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
+    // If a right parenthesis was not found, but the function name and left
+    // parenthesis were found, then assume there's a syntax error
+    if (matching[left] == SIZE_MAX) {
+        return FindResult::Unterminated;
+    }
 
-        for (auto it2 = bounds.left_paren; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                ++depth;
-            } else if (std::holds_alternative<EdifyTokenRightParen>(*it2)) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                bounds.right_paren = it2;
-                break;
-            }
-        }
+    auto begin = tokens.begin();
+    bounds.func_name = begin + static_cast<ptrdiff_t>(index);
+    bounds.left_paren = begin + static_cast<ptrdiff_t>(left);
+    bounds.right_paren = begin + static_cast<ptrdiff_t>(matching[left]);
 
-        // If a right parenthesis was not found, but the function name and left
-        // parenthesis were found, then assume there's a syntax error and bail
-        // out
-        if (!found_right_paren) {
-            return {};
-        }
+    return FindResult::Found;
+}
 
-        return bounds;
-    }
+enum class RuleResult
+{
+    Unchanged,
+    Replaced,
+    Error,
+};
 
-    return {};
-}
+struct RuleContext
+{
+    EdifyRewriter &rewriter;
+    const std::vector<std::string> &system_devs;
+    const std::vector<std::string> &cache_devs;
+    const std::vector<std::string> &data_devs;
+};
 
 /*!
  * \brief Replace edify function
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
  * \param replacement Replacement edify function (in string form)
  *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens.end() if the replacement
- *         string could not be tokenized.
+ * \return RuleResult::Replaced
  */
-static TokenIter
-replace_function(std::vector<EdifyToken> &tokens,
-                 const FunctionBounds &bounds, const std::string &replacement)
+static RuleResult
+replace_function(const RuleContext &ctx, const FunctionBounds &bounds,
+                 std::string replacement)
 {
-    auto ret = EdifyTokenizer::tokenize(replacement);
-    if (!ret) {
-        LOGE("Failed to tokenize replacement function string: %s: %s",
-             replacement.c_str(), ret.error().message().c_str());
-        return tokens.end();
-    }
-    auto &rtokens = ret.value();
-
-    // Remove replaced tokens
-    auto it = tokens.erase(bounds.func_name, bounds.right_paren + 1);
-
-    // Add replacement tokens
-    it = tokens.insert(it, rtokens.begin(), rtokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += static_cast<ptrdiff_t>(rtokens.size());
+    ctx.rewriter.replace(*bounds.func_name, *bounds.right_paren,
+                         std::move(replacement));
 
-    return it;
+    return RuleResult::Replaced;
 }
 
 /*!
  * \brief Replace edify mount() command
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was replaced
  */
-static TokenIter
-replace_edify_mount(std::vector<EdifyToken> &tokens,
-                    const FunctionBounds &bounds,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
+static RuleResult
+rule_mount(const RuleContext &ctx, const FunctionBounds &bounds)
 {
     // For the mount() edify function, replace with the corresponding
     // update-binary-tool command
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (it->type != EdifyTokenType::String) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto const &token = *it;
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), ctx.system_devs);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), ctx.cache_devs);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), ctx.data_devs);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/data"));
         }
     }
-    return bounds.right_paren + 1;
+    return RuleResult::Unchanged;
 }
 
 /*!
  * \brief Replace edify unmount() command
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was replaced
  */
-static TokenIter
-replace_edify_unmount(std::vector<EdifyToken> &tokens,
-                      const FunctionBounds &bounds,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
+static RuleResult
+rule_unmount(const RuleContext &ctx, const FunctionBounds &bounds)
 {
     // For the unmount() edify function, replace with the corresponding
     // update-binary-tool command
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (it->type != EdifyTokenType::String) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto const &token = *it;
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), ctx.system_devs);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), ctx.cache_devs);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), ctx.data_devs);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/data"));
         }
     }
-    return bounds.right_paren + 1;
+    return RuleResult::Unchanged;
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was replaced or RuleResult::Error if an error
+ *         occurs
  */
-static TokenIter
-replace_edify_run_program(std::vector<EdifyToken> &tokens,
-                          const FunctionBounds &bounds,
-                          const std::vector<std::string> &system_devs,
-                          const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+static RuleResult
+rule_run_program(const RuleContext &ctx, const FunctionBounds &bounds)
 {
     bool found_reboot = false;
     bool found_mount = false;
@@ -334,16 +328,16 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
     bool is_data = false;
 
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (it->type != EdifyTokenType::String) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
+        auto const &token = *it;
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(), ret.error().message().c_str());
+            return RuleResult::Error;
         }
         auto const &unescaped = ret.value();
 
@@ -364,151 +358,196 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         }
 
         if (unescaped.find("/system") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), system_devs)) {
+                || find_items_in_string(unescaped.c_str(), ctx.system_devs)) {
             is_system = true;
         }
         if (unescaped.find("/cache") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), cache_devs)) {
+                || find_items_in_string(unescaped.c_str(), ctx.cache_devs)) {
             is_cache = true;
         }
         if (unescaped.find("/data") != std::string::npos
                 || unescaped.find("/userdata") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), data_devs)) {
+                || find_items_in_string(unescaped.c_str(), ctx.data_devs)) {
             is_data = true;
         }
     }
 
     if (found_reboot) {
-        return replace_function(tokens, bounds,
+        return replace_function(ctx, bounds,
                                 "(ui_print(\"Removed reboot command\") == 0)");
     } else if (found_umount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(UNMOUNT_FMT, "/data"));
         }
     } else if (found_mount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(MOUNT_FMT, "/data"));
         }
     } else if (found_format_sh) {
-        return replace_function(tokens, bounds,
+        return replace_function(ctx, bounds,
                                 format(FORMAT_FMT, "/system"));
     } else if (found_mke2fs) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/data"));
         }
     }
 
-    return bounds.right_paren + 1;
+    return RuleResult::Unchanged;
 }
 
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was replaced or RuleResult::Error if an error
+ *         occurs
  */
-static TokenIter
-replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
-                               const FunctionBounds &bounds)
+static RuleResult
+rule_delete_recursive(const RuleContext &ctx, const FunctionBounds &bounds)
 {
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (it->type != EdifyTokenType::String) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
+        auto const &token = *it;
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(), ret.error().message().c_str());
+            return RuleResult::Error;
         }
         auto const &unescaped = ret.value();
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/cache"));
         }
     }
-    return bounds.right_paren + 1;
+    return RuleResult::Unchanged;
 }
 
 /*!
  * \brief Replace edify format() command
  *
- * \param tokens List of edify tokens
+ * \param ctx Rule context
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was replaced
  */
-static TokenIter
-replace_edify_format(std::vector<EdifyToken> &tokens,
-                     const FunctionBounds &bounds,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
+static RuleResult
+rule_format(const RuleContext &ctx, const FunctionBounds &bounds)
 {
     // For the format() edify function, replace with the corresponding
     // update-binary-tool command
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (it->type != EdifyTokenType::String) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto const &token = *it;
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), ctx.system_devs);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), ctx.cache_devs);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), ctx.data_devs);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(ctx, bounds,
                                     format(FORMAT_FMT, "/data"));
         }
     }
-    return bounds.right_paren + 1;
+    return RuleResult::Unchanged;
+}
+
+using RuleFn = RuleResult (*)(const RuleContext &, const FunctionBounds &);
+
+struct Rule
+{
+    std::string_view name;
+    RuleFn fn;
+};
+
+// All rules are keyed by function name, so the script is patched in a single
+// pass by looking up the rule for every function call that is encountered
+static constexpr Rule RULES[] = {
+    { "mount",            &rule_mount },
+    { "unmount",          &rule_unmount },
+    { "run_program",      &rule_run_program },
+    { "delete_recursive", &rule_delete_recursive },
+    { "format",           &rule_format },
+};
+
+static constexpr std::size_t RULES_COUNT = sizeof(RULES) / sizeof(RULES[0]);
+
+struct RuleStats
+{
+    uint64_t matches;
+    uint64_t replacements;
+    std::chrono::steady_clock::duration time;
+};
+
+static const Rule * find_rule(std::string_view name)
+{
+    for (auto const &rule : RULES) {
+        if (rule.name == name) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+static void log_rule_stats(const RuleStats (&stats)[RULES_COUNT])
+{
+    for (std::size_t i = 0; i < RULES_COUNT; ++i) {
+        if (stats[i].matches == 0) {
+            continue;
+        }
+
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                stats[i].time).count();
+
+        LOGV("Rule %s: %" PRIu64 " matches, %" PRIu64 " replacements,"
+             " %" PRId64 " us", std::string(RULES[i].name).c_str(),
+             stats[i].matches, stats[i].replacements,
+             static_cast<int64_t>(us));
+    }
 }
 
 bool StandardPatcher::patch_files(const std::string &directory)
@@ -524,6 +563,20 @@ bool StandardPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool StandardPatcher::patch_files(FileMap &files)
+{
+    if (auto it = files.find(UpdaterScript); it != files.end()
+            && !patch_updater_contents(it->second)) {
+        return false;
+    }
+
+    if (auto it = files.find(SystemTransferList); it != files.end()) {
+        patch_transfer_list_contents(it->second);
+    }
+
+    return true;
+}
+
 bool StandardPatcher::patch_updater(const std::string &directory)
 {
     std::string contents;
@@ -535,18 +588,32 @@ bool StandardPatcher::patch_updater(const std::string &directory)
 
     FileUtils::read_to_string(path, &contents);
 
+    if (!patch_updater_contents(contents)) {
+        return false;
+    }
+
+    FileUtils::write_from_string(path, contents);
+
+    return true;
+}
+
+bool StandardPatcher::patch_updater_contents(std::string &contents)
+{
     if (starts_with(contents, "#!")) {
         // Ignore any script with a shebang line
         return true;
     }
 
-    auto ret = EdifyTokenizer::tokenize(contents);
+    std::vector<EdifyTokenView> tokens;
+
+    auto ret = EdifyTokenizer::tokenize(contents, tokens);
     if (!ret) {
         LOGE("Failed to tokenize updater-script: %s",
              ret.error().message().c_str());
         return false;
     }
-    auto &tokens = ret.value();
+
+    EdifyRewriter rewriter(contents);
 
 #if DUMP_DEBUG
     EdifyTokenizer::dump(tokens);
@@ -557,60 +624,74 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     auto cache_devs = device.cache_block_devs();
     auto data_devs = device.data_block_devs();
 
-    TokenIter begin = tokens.begin();
-    TokenIter end;
+    auto matching = match_parens(tokens);
 
-    while (true) {
-        end = tokens.end();
+    RuleContext ctx{rewriter, system_devs, cache_devs, data_devs};
+    RuleStats stats[RULES_COUNT] = {};
 
+    for (std::size_t i = 0; i < tokens.size();) {
         // Need to find:
         // 1. String containing function name
         // 2. Left parenthesis for the function
         // 3. Right parenthesis for the function
-        auto bounds = find_function(begin, end);
-        if (!bounds) {
+        FunctionBounds bounds;
+        auto found = function_at(tokens, matching, i, bounds);
+        if (found == FindResult::Unterminated) {
             break;
+        } else if (found == FindResult::NotFunction) {
+            ++i;
+            continue;
         }
 
-        // Tokens (types are checked by findFunction())
-        auto const &t_func_name = std::get<EdifyTokenString>(*bounds->func_name);
-        auto unescaped = t_func_name.unescaped_string();
-        if (!unescaped) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 t_func_name.raw_string().c_str(),
-                 unescaped.error().message().c_str());
-            return false;
-        }
+        const Rule *rule;
 
-        if (unescaped.value() == "mount") {
-            begin = replace_edify_mount(tokens, *bounds,
-                                        system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "unmount") {
-            begin = replace_edify_unmount(tokens, *bounds,
-                                          system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "run_program") {
-            begin = replace_edify_run_program(tokens, *bounds,
-                                              system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(tokens, *bounds);
-        } else if (unescaped.value() == "format") {
-            begin = replace_edify_format(tokens, *bounds,
-                                         system_devs, cache_devs, data_devs);
+        if (bounds.func_name->quoted()) {
+            auto unescaped = bounds.func_name->unescaped_string();
+            if (!unescaped) {
+                LOGE("Failed to unescape string token: %s: %s",
+                     std::string(bounds.func_name->raw_string()).c_str(),
+                     unescaped.error().message().c_str());
+                return false;
+            }
+            rule = find_rule(unescaped.value());
         } else {
-            // Only skip function name so that we catch nested function calls
-            begin = bounds->func_name + 1;
+            rule = find_rule(bounds.func_name->text);
         }
 
-        if (begin == tokens.end()) {
+        RuleResult result = RuleResult::Unchanged;
+
+        if (rule) {
+            auto &rule_stats = stats[static_cast<std::size_t>(rule - RULES)];
+            auto start = std::chrono::steady_clock::now();
+
+            result = rule->fn(ctx, bounds);
+
+            rule_stats.time += std::chrono::steady_clock::now() - start;
+            ++rule_stats.matches;
+            if (result == RuleResult::Replaced) {
+                ++rule_stats.replacements;
+            }
+        }
+
+        if (result == RuleResult::Error) {
             return false;
+        } else if (rule) {
+            // Skip past the function, whether or not it was replaced
+            i = static_cast<std::size_t>(
+                    bounds.right_paren - tokens.begin()) + 1;
+        } else {
+            // Only skip function name so that we catch nested function calls
+            ++i;
         }
     }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
+    log_rule_stats(stats);
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
+    // Only the replaced functions are regenerated. Everything else is copied
+    // from the original script as is.
+    if (rewriter.modified()) {
+        contents = rewriter.apply();
+    }
 
     return true;
 }
@@ -629,6 +710,30 @@ bool StandardPatcher::patch_transfer_list(const std::string &directory)
         return ret == ErrorCode::FileOpenError;
     }
 
+    patch_transfer_list_contents(contents);
+    FileUtils::write_from_string(path, contents);
+
+    return true;
+}
+
+bool StandardPatcher::can_stream(const std::string &file) const
+{
+    // The updater-script must be tokenized as a whole
+    return file == SystemTransferList;
+}
+
+AutoPatcher::LineResult StandardPatcher::patch_line(const std::string &file,
+                                                    std::string &line)
+{
+    if (file == SystemTransferList && starts_with(line, "erase ")) {
+        return LineResult::Remove;
+    }
+
+    return LineResult::Keep;
+}
+
+void StandardPatcher::patch_transfer_list_contents(std::string &contents)
+{
     auto lines = split_sv(contents, '\n');
 
     for (auto it = lines.begin(); it != lines.end();) {
@@ -640,9 +745,6 @@ bool StandardPatcher::patch_transfer_list(const std::string &directory)
     }
 
     contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
-
-    return true;
 }
 
 }
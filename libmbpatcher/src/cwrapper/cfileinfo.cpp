@@ -156,4 +156,54 @@ void mbpatcher_fileinfo_set_rom_id(CFileInfo *info, const char *id)
     fi->set_rom_id(id);
 }
 
+/*!
+ * \brief File to be patched, without copying it
+ *
+ * \param info CFileInfo object
+ *
+ * \note The returned string is owned by the CFileInfo. It must not be free()'d
+ *       and is only valid until the input path is changed or the CFileInfo is
+ *       destroyed. The same applies to the other *_ref() functions.
+ *
+ * \return File path
+ *
+ * \sa mbpatcher_fileinfo_input_path()
+ */
+const char * mbpatcher_fileinfo_input_path_ref(const CFileInfo *info)
+{
+    CCAST(info);
+    return fi->input_path().c_str();
+}
+
+const char * mbpatcher_fileinfo_output_path_ref(const CFileInfo *info)
+{
+    CCAST(info);
+    return fi->output_path().c_str();
+}
+
+/*!
+ * \brief Target device, without copying it
+ *
+ * \param info CFileInfo object
+ *
+ * \note The returned CDevice is owned by the CFileInfo. It must not be freed
+ *       or modified and is only valid until the device is changed or the
+ *       CFileInfo is destroyed.
+ *
+ * \return Device
+ *
+ * \sa mbpatcher_fileinfo_device()
+ */
+const CDevice * mbpatcher_fileinfo_device_ref(const CFileInfo *info)
+{
+    CCAST(info);
+    return reinterpret_cast<const CDevice *>(&fi->device());
+}
+
+const char * mbpatcher_fileinfo_rom_id_ref(const CFileInfo *info)
+{
+    CCAST(info);
+    return fi->rom_id().c_str();
+}
+
 }
@@ -127,6 +127,59 @@ char * mbpatcher_config_temp_directory(const CPatcherConfig *pc)
     return mb::capi_str_to_cstr(config->temp_directory());
 }
 
+/*!
+ * \brief Get the directory for caching patched files
+ *
+ * \note The returned string is dynamically allocated. It should be free()'d
+ *       when it is no longer needed.
+ *
+ * \param pc CPatcherConfig object
+ * \return Cache directory (empty if caching is disabled)
+ *
+ * \sa PatcherConfig::cache_directory()
+ */
+char * mbpatcher_config_cache_directory(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return mb::capi_str_to_cstr(config->cache_directory());
+}
+
+/*!
+ * \brief Get top-level data directory without copying it
+ *
+ * \note The returned string is owned by the CPatcherConfig. It must not be
+ *       free()'d and is only valid until the data directory is changed or the
+ *       CPatcherConfig is destroyed.
+ *
+ * \param pc CPatcherConfig object
+ * \return Data directory
+ *
+ * \sa mbpatcher_config_data_directory()
+ */
+const char * mbpatcher_config_data_directory_ref(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->data_directory().c_str();
+}
+
+/*!
+ * \brief Get the directory for caching patched files without copying it
+ *
+ * \note The returned string is owned by the CPatcherConfig. It must not be
+ *       free()'d and is only valid until the cache directory is changed or the
+ *       CPatcherConfig is destroyed.
+ *
+ * \param pc CPatcherConfig object
+ * \return Cache directory (empty if caching is disabled)
+ *
+ * \sa mbpatcher_config_cache_directory()
+ */
+const char * mbpatcher_config_cache_directory_ref(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->cache_directory().c_str();
+}
+
 /*!
  * \brief Set top-level data directory
  *
@@ -155,6 +208,180 @@ void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path)
     config->set_temp_directory(path);
 }
 
+/*!
+ * \brief Set the directory for caching patched files
+ *
+ * \param pc CPatcherConfig object
+ * \param path Path to cache directory (empty to disable caching)
+ *
+ * \sa PatcherConfig::set_cache_directory()
+ */
+void mbpatcher_config_set_cache_directory(CPatcherConfig *pc, char *path)
+{
+    CAST(pc);
+    config->set_cache_directory(path);
+}
+
+/*!
+ * \brief Get how patchers choose the compression method for output files
+ *
+ * \param pc CPatcherConfig object
+ * \return Compression policy
+ *
+ * \sa PatcherConfig::compression_policy()
+ */
+/* enum CompressionPolicy */ int mbpatcher_config_compression_policy(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return static_cast<int>(config->compression_policy());
+}
+
+/*!
+ * \brief Set how patchers choose the compression method for output files
+ *
+ * \param pc CPatcherConfig object
+ * \param policy Compression policy
+ *
+ * \sa PatcherConfig::set_compression_policy()
+ */
+void mbpatcher_config_set_compression_policy(CPatcherConfig *pc,
+                                             /* enum CompressionPolicy */ int policy)
+{
+    CAST(pc);
+    config->set_compression_policy(static_cast<mb::patcher::CompressionPolicy>(
+            policy));
+}
+
+/*!
+ * \brief Get the compression method for compressed files in output archives
+ *
+ * \param pc CPatcherConfig object
+ * \return Compression method
+ *
+ * \sa PatcherConfig::compression_method()
+ */
+/* enum CompressionMethod */ int mbpatcher_config_compression_method(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return static_cast<int>(config->compression_method());
+}
+
+/*!
+ * \brief Set the compression method for compressed files in output archives
+ *
+ * \param pc CPatcherConfig object
+ * \param method Compression method
+ * \return Whether the method is supported
+ *
+ * \sa PatcherConfig::set_compression_method()
+ */
+bool mbpatcher_config_set_compression_method(CPatcherConfig *pc,
+                                             /* enum CompressionMethod */ int method)
+{
+    CAST(pc);
+    return config->set_compression_method(
+            static_cast<mb::patcher::CompressionMethod>(method));
+}
+
+/*!
+ * \brief Check if a compression method is supported by this build
+ *
+ * \param method Compression method
+ * \return Whether the method is supported
+ *
+ * \sa PatcherConfig::is_compression_method_supported()
+ */
+bool mbpatcher_config_is_compression_method_supported(/* enum CompressionMethod */ int method)
+{
+    return mb::patcher::PatcherConfig::is_compression_method_supported(
+            static_cast<mb::patcher::CompressionMethod>(method));
+}
+
+/*!
+ * \brief Get the number of threads used for compressing output files
+ *
+ * \param pc CPatcherConfig object
+ * \return Number of threads (0 means one per CPU core)
+ *
+ * \sa PatcherConfig::compression_threads()
+ */
+unsigned int mbpatcher_config_compression_threads(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->compression_threads();
+}
+
+/*!
+ * \brief Set the number of threads used for compressing output files
+ *
+ * \param pc CPatcherConfig object
+ * \param threads Number of threads (0 for one per CPU core)
+ *
+ * \sa PatcherConfig::set_compression_threads()
+ */
+void mbpatcher_config_set_compression_threads(CPatcherConfig *pc,
+                                              unsigned int threads)
+{
+    CAST(pc);
+    config->set_compression_threads(threads);
+}
+
+/*!
+ * \brief Get the maximum size of a file that patchers keep in memory
+ *
+ * \param pc CPatcherConfig object
+ * \return Memory budget in bytes (0 means unlimited)
+ *
+ * \sa PatcherConfig::memory_budget()
+ */
+uint64_t mbpatcher_config_memory_budget(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->memory_budget();
+}
+
+/*!
+ * \brief Set the maximum size of a file that patchers keep in memory
+ *
+ * \param pc CPatcherConfig object
+ * \param bytes Memory budget in bytes (0 for unlimited)
+ *
+ * \sa PatcherConfig::set_memory_budget()
+ */
+void mbpatcher_config_set_memory_budget(CPatcherConfig *pc, uint64_t bytes)
+{
+    CAST(pc);
+    config->set_memory_budget(bytes);
+}
+
+/*!
+ * \brief Get whether patchers delete their temporary files in the background
+ *
+ * \param pc CPatcherConfig object
+ * \return Whether cleanup is deferred
+ *
+ * \sa PatcherConfig::defer_cleanup()
+ */
+bool mbpatcher_config_defer_cleanup(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->defer_cleanup();
+}
+
+/*!
+ * \brief Set whether patchers delete their temporary files in the background
+ *
+ * \param pc CPatcherConfig object
+ * \param defer Whether to defer cleanup
+ *
+ * \sa PatcherConfig::set_defer_cleanup()
+ */
+void mbpatcher_config_set_defer_cleanup(CPatcherConfig *pc, bool defer)
+{
+    CAST(pc);
+    config->set_defer_cleanup(defer);
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/cwrapper/cpatchqueue.h"
+
+#include <cassert>
+
+#include "mbdevice/json.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchqueue.h"
+
+
+/*! \cond INTERNAL */
+struct QueueWrapper
+{
+    QueueWrapper(mb::patcher::PatcherConfig &pc) : queue(pc)
+    {
+    }
+
+    mb::patcher::PatchQueue queue;
+
+    JobProgressCallback progress_cb = nullptr;
+    JobFilesCallback files_cb = nullptr;
+    JobDetailsCallback details_cb = nullptr;
+    JobStateCallback state_cb = nullptr;
+    void *userdata = nullptr;
+};
+/*! \endcond */
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *w = reinterpret_cast<QueueWrapper *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *w = reinterpret_cast<const QueueWrapper *>(x);
+
+
+/*!
+ * \file cpatchqueue.h
+ * \brief C Wrapper for PatchQueue
+ *
+ * Please see the documentation for PatchQueue from the C++ API for more
+ * details. The C functions directly correspond to the PatchQueue member
+ * functions.
+ *
+ * \sa PatchQueue
+ */
+
+extern "C"
+{
+
+static void progress_cb_wrapper(size_t job, uint64_t bytes, uint64_t max_bytes,
+                                void *userdata)
+{
+    auto *w = static_cast<QueueWrapper *>(userdata);
+    if (w->progress_cb) {
+        w->progress_cb(job, bytes, max_bytes, w->userdata);
+    }
+}
+
+static void files_cb_wrapper(size_t job, uint64_t files, uint64_t max_files,
+                             void *userdata)
+{
+    auto *w = static_cast<QueueWrapper *>(userdata);
+    if (w->files_cb) {
+        w->files_cb(job, files, max_files, w->userdata);
+    }
+}
+
+static void details_cb_wrapper(size_t job, const std::string &text,
+                               void *userdata)
+{
+    auto *w = static_cast<QueueWrapper *>(userdata);
+    if (w->details_cb) {
+        w->details_cb(job, text.c_str(), w->userdata);
+    }
+}
+
+static void state_cb_wrapper(size_t job, mb::patcher::PatchJobState state,
+                             void *userdata)
+{
+    auto *w = static_cast<QueueWrapper *>(userdata);
+    if (w->state_cb) {
+        w->state_cb(job, static_cast<int>(state), w->userdata);
+    }
+}
+
+/*!
+ * \brief Create a new PatchQueue object.
+ *
+ * \note The returned object must be freed with mbpatcher_patchqueue_destroy().
+ *
+ * \param pc CPatcherConfig to create patchers from. It must outlive the queue.
+ *
+ * \return New CPatchQueue
+ */
+CPatchQueue * mbpatcher_patchqueue_create(CPatcherConfig *pc)
+{
+    assert(pc != nullptr);
+    auto *config = reinterpret_cast<mb::patcher::PatcherConfig *>(pc);
+    return reinterpret_cast<CPatchQueue *>(new QueueWrapper(*config));
+}
+
+/*!
+ * \brief Destroys a CPatchQueue object.
+ *
+ * Pending and running jobs are cancelled before the queue is destroyed.
+ *
+ * \param queue CPatchQueue to destroy
+ */
+void mbpatcher_patchqueue_destroy(CPatchQueue *queue)
+{
+    CAST(queue);
+    delete w;
+}
+
+/*!
+ * \brief Get maximum number of jobs to run at the same time
+ *
+ * \param queue CPatchQueue object
+ * \return Maximum number of workers (0 if one per CPU core)
+ *
+ * \sa PatchQueue::max_workers()
+ */
+unsigned int mbpatcher_patchqueue_max_workers(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return w->queue.max_workers();
+}
+
+/*!
+ * \brief Set maximum number of jobs to run at the same time
+ *
+ * \param queue CPatchQueue object
+ * \param workers Maximum number of workers (0 for one per CPU core)
+ *
+ * \sa PatchQueue::set_max_workers()
+ */
+void mbpatcher_patchqueue_set_max_workers(CPatchQueue *queue,
+                                          unsigned int workers)
+{
+    CAST(queue);
+    w->queue.set_max_workers(workers);
+}
+
+/*!
+ * \brief Parse and set device definitions shared by all jobs
+ *
+ * \param queue CPatchQueue object
+ * \param json Contents of devices.json
+ * \return Whether the device definitions were successfully parsed
+ *
+ * \sa PatchQueue::set_devices()
+ */
+bool mbpatcher_patchqueue_set_devices_from_json(CPatchQueue *queue,
+                                                const char *json)
+{
+    CAST(queue);
+    std::vector<mb::device::Device> devices;
+    mb::device::JsonError error;
+
+    if (!mb::device::device_list_from_json(json, devices, error)) {
+        return false;
+    }
+
+    w->queue.set_devices(std::move(devices));
+    return true;
+}
+
+/*!
+ * \brief Add job to the queue
+ *
+ * \param queue CPatchQueue object
+ * \param patcher_id ID of patcher to use
+ * \param info CFileInfo describing the file to patch. It is copied.
+ * \return Index of the new job
+ *
+ * \sa PatchQueue::add_job(const std::string &, FileInfo)
+ */
+size_t mbpatcher_patchqueue_add_job(CPatchQueue *queue,
+                                    const char *patcher_id,
+                                    const CFileInfo *info)
+{
+    CAST(queue);
+    assert(info != nullptr);
+    auto const *fi = reinterpret_cast<const mb::patcher::FileInfo *>(info);
+    return w->queue.add_job(patcher_id, *fi);
+}
+
+/*!
+ * \brief Add job for a device from the shared device list
+ *
+ * \param[in] queue CPatchQueue object
+ * \param[in] patcher_id ID of patcher to use
+ * \param[in] input_path Path of the file to patch
+ * \param[in] output_path Path of the patched file
+ * \param[in] device_id ID of device
+ * \param[in] rom_id ID of the ROM to install to
+ * \param[out] job_out Index of the new job
+ * \return Whether the device was found and the job was added
+ *
+ * \sa PatchQueue::add_job(const std::string &, std::string, std::string,
+ *                         const std::string &, std::string, size_t &)
+ */
+bool mbpatcher_patchqueue_add_job_for_device(CPatchQueue *queue,
+                                             const char *patcher_id,
+                                             const char *input_path,
+                                             const char *output_path,
+                                             const char *device_id,
+                                             const char *rom_id,
+                                             size_t *job_out)
+{
+    CAST(queue);
+    assert(job_out != nullptr);
+    return w->queue.add_job(patcher_id, input_path, output_path, device_id,
+                            rom_id, *job_out);
+}
+
+/*!
+ * \brief Get number of jobs in the queue
+ *
+ * \param queue CPatchQueue object
+ * \return Number of jobs
+ *
+ * \sa PatchQueue::job_count()
+ */
+size_t mbpatcher_patchqueue_job_count(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return w->queue.job_count();
+}
+
+/*!
+ * \brief Get current state of a job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of job
+ * \return PatchJobState
+ *
+ * \sa PatchQueue::job_state()
+ */
+/* enum PatchJobState */ int mbpatcher_patchqueue_job_state(const CPatchQueue *queue,
+                                                            size_t job)
+{
+    CCAST(queue);
+    return static_cast<int>(w->queue.job_state(job));
+}
+
+/*!
+ * \brief Get error of a failed job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of job
+ * \return ErrorCode
+ *
+ * \sa PatchQueue::job_error()
+ */
+/* enum ErrorCode */ int mbpatcher_patchqueue_job_error(const CPatchQueue *queue,
+                                                        size_t job)
+{
+    CCAST(queue);
+    return static_cast<int>(w->queue.job_error(job));
+}
+
+/*!
+ * \brief Set callbacks for job progress
+ *
+ * \param queue CPatchQueue object
+ * \param progressCb Callback for receiving current progress values of a job
+ * \param filesCb Callback for receiving current files count of a job
+ * \param detailsCb Callback for receiving detailed progress text of a job
+ * \param stateCb Callback for receiving job state changes
+ * \param userData Pointer to pass to callback functions
+ *
+ * \sa PatchQueue::set_callbacks()
+ */
+void mbpatcher_patchqueue_set_callbacks(CPatchQueue *queue,
+                                        JobProgressCallback progressCb,
+                                        JobFilesCallback filesCb,
+                                        JobDetailsCallback detailsCb,
+                                        JobStateCallback stateCb,
+                                        void *userData)
+{
+    CAST(queue);
+    w->progress_cb = progressCb;
+    w->files_cb = filesCb;
+    w->details_cb = detailsCb;
+    w->state_cb = stateCb;
+    w->userdata = userData;
+    w->queue.set_callbacks(&progress_cb_wrapper, &files_cb_wrapper,
+                           &details_cb_wrapper, &state_cb_wrapper, w);
+}
+
+/*!
+ * \brief Start running the pending jobs
+ *
+ * \param queue CPatchQueue object
+ * \return Whether the workers were started
+ *
+ * \sa PatchQueue::start()
+ */
+bool mbpatcher_patchqueue_start(CPatchQueue *queue)
+{
+    CAST(queue);
+    return w->queue.start();
+}
+
+/*!
+ * \brief Wait for all jobs to complete
+ *
+ * \param queue CPatchQueue object
+ * \return Whether every job in the queue succeeded
+ *
+ * \sa PatchQueue::wait()
+ */
+bool mbpatcher_patchqueue_wait(CPatchQueue *queue)
+{
+    CAST(queue);
+    return w->queue.wait();
+}
+
+/*!
+ * \brief Cancel a job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of job
+ *
+ * \sa PatchQueue::cancel_job()
+ */
+void mbpatcher_patchqueue_cancel_job(CPatchQueue *queue, size_t job)
+{
+    CAST(queue);
+    w->queue.cancel_job(job);
+}
+
+/*!
+ * \brief Cancel all pending and running jobs
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::cancel_all()
+ */
+void mbpatcher_patchqueue_cancel_all(CPatchQueue *queue)
+{
+    CAST(queue);
+    w->queue.cancel_all();
+}
+
+}
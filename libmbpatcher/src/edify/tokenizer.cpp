@@ -270,120 +270,303 @@ oc::result<std::string> EdifyTokenString::unescape(std::string_view str)
     return std::move(output);
 }
 
-static std::string generate_token(const EdifyToken &token)
-{
-    return std::visit([](auto &&t) {
-        return t.generate();
-    }, token);
-}
-
-oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
-                                                  std::size_t &consumed)
+/*!
+ * \brief Find the type and length of the token at the beginning of \p str
+ *
+ * This is shared by the owning and non-owning tokenizers so that they always
+ * split the input the same way.
+ */
+static oc::result<EdifyTokenType> scan_token(std::string_view str,
+                                             std::size_t &consumed)
 {
     assert(!str.empty());
 
     if (mb::starts_with(str, {"if", 2})) {
         consumed = 2;
-        return EdifyTokenIf();
+        return EdifyTokenType::If;
     } else if (mb::starts_with(str, {"then", 4})) {
         consumed = 4;
-        return EdifyTokenThen();
+        return EdifyTokenType::Then;
     } else if (mb::starts_with(str, {"else", 4})) {
         consumed = 4;
-        return EdifyTokenElse();
-    } else if (mb::starts_with(str, {"endif", 4})) {
+        return EdifyTokenType::Else;
+    } else if (mb::starts_with(str, {"endif", 5})) {
         consumed = 5;
-        return EdifyTokenEndif();
+        return EdifyTokenType::Endif;
     } else if (mb::starts_with(str, {"&&", 2})) {
         consumed = 2;
-        return EdifyTokenAnd();
+        return EdifyTokenType::And;
     } else if (mb::starts_with(str, {"||", 2})) {
         consumed = 2;
-        return EdifyTokenOr();
+        return EdifyTokenType::Or;
     } else if (mb::starts_with(str, {"==", 2})) {
         consumed = 2;
-        return EdifyTokenEquals();
+        return EdifyTokenType::Equals;
     } else if (mb::starts_with(str, {"!=", 2})) {
         consumed = 2;
-        return EdifyTokenNotEquals();
+        return EdifyTokenType::NotEquals;
     } else if (str.front() == '!') {
         consumed = 1;
-        return EdifyTokenNot();
+        return EdifyTokenType::Not;
     } else if (str.front() == '(') {
         consumed = 1;
-        return EdifyTokenLeftParen();
+        return EdifyTokenType::LeftParen;
     } else if (str.front() == ')') {
         consumed = 1;
-        return EdifyTokenRightParen();
+        return EdifyTokenType::RightParen;
     } else if (str.front() == ';') {
         consumed = 1;
-        return EdifyTokenSemicolon();
+        return EdifyTokenType::Semicolon;
     } else if (str.front() == ',') {
         consumed = 1;
-        return EdifyTokenComma();
+        return EdifyTokenType::Comma;
     } else if (str.front() == '+') {
         consumed = 1;
-        return EdifyTokenConcat();
+        return EdifyTokenType::Concat;
     } else if (str.front() == '\n') {
         consumed = 1;
-        return EdifyTokenNewline();
+        return EdifyTokenType::Newline;
     } else if (char c = str.front(); c != '\n' && std::isspace(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
         for (auto it = str.begin() + 1;
                 it != str.end() && *it != '\n' && std::isspace(*it); ++it) {
-            buf += *it;
             consumed += 1;
         }
-        return EdifyTokenWhitespace(std::move(buf));
+        return EdifyTokenType::Whitespace;
     } else if (str.front() == '#') {
-        std::string buf;
-        // Omit '#' character
         consumed = 1;
         for (auto it = str.begin() + 1; it != str.end() && *it != '\n'; ++it) {
-            buf += *it;
             consumed += 1;
         }
-        return EdifyTokenComment(std::move(buf));
+        return EdifyTokenType::Comment;
     } else if (char c = str.front(); EdifyTokenString::is_valid_unquoted(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
         for (auto it = str.begin() + 1;
                 it != str.end() && EdifyTokenString::is_valid_unquoted(*it);
                 ++it) {
-            buf += *it;
             consumed += 1;
         }
-        OUTCOME_TRY(r, EdifyTokenString::from_raw(std::move(buf), false));
-        return std::move(r);
+        return EdifyTokenType::String;
     } else if (char c = str.front(); c == '"') {
-        std::string buf;
-        buf += c;
         consumed = 1;
         bool escaped = false;
         bool terminated = false;
         for (auto it = str.begin() + 1; it != str.end(); ++it) {
+            consumed += 1;
             if (*it == '\\' || escaped) {
                 escaped = !escaped;
-            } else if (!escaped && *it == '"') {
-                buf += *it;
-                consumed += 1;
+            } else if (*it == '"') {
                 terminated = true;
                 break;
             }
-            buf += *it;
-            consumed += 1;
         }
         if (!terminated) {
             return EdifyError::UnterminatedQuote;
         }
-        OUTCOME_TRY(r,  EdifyTokenString::from_raw(std::move(buf), true));
-        return std::move(r);
+        return EdifyTokenType::String;
     } else {
         consumed = 1;
-        return EdifyTokenUnknown(str.front());
+        return EdifyTokenType::Unknown;
+    }
+}
+
+bool EdifyTokenView::quoted() const
+{
+    return type == EdifyTokenType::String && !text.empty()
+            && text.front() == '"';
+}
+
+/*!
+ * \brief Get string value of a string token without the surrounding quotes
+ */
+std::string_view EdifyTokenView::raw_string() const
+{
+    if (quoted()) {
+        return text.substr(1, text.size() - 2);
+    } else {
+        return text;
+    }
+}
+
+oc::result<std::string> EdifyTokenView::unescaped_string() const
+{
+    if (quoted()) {
+        return EdifyTokenString::unescape(raw_string());
+    } else {
+        return std::string(text);
+    }
+}
+
+EdifyTokenStream::EdifyTokenStream(std::string_view str)
+    : m_str(str)
+    , m_offset(0)
+{
+}
+
+/*!
+ * \brief Get next token
+ *
+ * \param[out] token Next token (only valid if true is returned)
+ *
+ * \return
+ *   * True if a token was read
+ *   * False if the end of the input was reached
+ *   * An EdifyError if the input could not be tokenized
+ */
+oc::result<bool> EdifyTokenStream::next(EdifyTokenView &token)
+{
+    if (m_offset == m_str.size()) {
+        return false;
+    }
+
+    std::string_view remain = m_str.substr(m_offset);
+    std::size_t consumed;
+
+    OUTCOME_TRY(type, scan_token(remain, consumed));
+
+    token.type = type;
+    token.text = remain.substr(0, consumed);
+    token.offset = m_offset;
+
+    m_offset += consumed;
+
+    return true;
+}
+
+/*!
+ * \brief Offset of the next token in the input
+ */
+std::size_t EdifyTokenStream::offset() const
+{
+    return m_offset;
+}
+
+EdifyRewriter::EdifyRewriter(std::string_view source)
+    : m_source(source)
+{
+}
+
+/*!
+ * \brief Replace a range of the source
+ *
+ * \pre Ranges must be added in increasing order and must not overlap.
+ *
+ * \param offset Offset of the range
+ * \param size Size of the range
+ * \param replacement Text to replace the range with
+ */
+void EdifyRewriter::replace(std::size_t offset, std::size_t size,
+                            std::string replacement)
+{
+    assert(offset + size <= m_source.size());
+    assert(m_edits.empty()
+            || m_edits.back().offset + m_edits.back().size <= offset);
+
+    m_edits.push_back({offset, size, std::move(replacement)});
+}
+
+/*!
+ * \brief Replace the tokens from \p first to \p last (inclusive)
+ */
+void EdifyRewriter::replace(const EdifyTokenView &first,
+                            const EdifyTokenView &last,
+                            std::string replacement)
+{
+    assert(first.offset <= last.offset);
+
+    replace(first.offset, last.offset + last.text.size() - first.offset,
+            std::move(replacement));
+}
+
+/*!
+ * \brief Whether any replacements were made
+ */
+bool EdifyRewriter::modified() const
+{
+    return !m_edits.empty();
+}
+
+/*!
+ * \brief Build the rewritten script
+ */
+std::string EdifyRewriter::apply() const
+{
+    std::size_t size = m_source.size();
+    for (auto const &edit : m_edits) {
+        size = size - edit.size + edit.replacement.size();
+    }
+
+    std::string output;
+    output.reserve(size);
+
+    std::size_t pos = 0;
+    for (auto const &edit : m_edits) {
+        output += m_source.substr(pos, edit.offset - pos);
+        output += edit.replacement;
+        pos = edit.offset + edit.size;
+    }
+    output += m_source.substr(pos);
+
+    return output;
+}
+
+static std::string generate_token(const EdifyToken &token)
+{
+    return std::visit([](auto &&t) {
+        return t.generate();
+    }, token);
+}
+
+oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
+                                                  std::size_t &consumed)
+{
+    OUTCOME_TRY(type, scan_token(str, consumed));
+    std::string_view text = str.substr(0, consumed);
+
+    switch (type) {
+    case EdifyTokenType::If:
+        return EdifyTokenIf();
+    case EdifyTokenType::Then:
+        return EdifyTokenThen();
+    case EdifyTokenType::Else:
+        return EdifyTokenElse();
+    case EdifyTokenType::Endif:
+        return EdifyTokenEndif();
+    case EdifyTokenType::And:
+        return EdifyTokenAnd();
+    case EdifyTokenType::Or:
+        return EdifyTokenOr();
+    case EdifyTokenType::Equals:
+        return EdifyTokenEquals();
+    case EdifyTokenType::NotEquals:
+        return EdifyTokenNotEquals();
+    case EdifyTokenType::Not:
+        return EdifyTokenNot();
+    case EdifyTokenType::LeftParen:
+        return EdifyTokenLeftParen();
+    case EdifyTokenType::RightParen:
+        return EdifyTokenRightParen();
+    case EdifyTokenType::Semicolon:
+        return EdifyTokenSemicolon();
+    case EdifyTokenType::Comma:
+        return EdifyTokenComma();
+    case EdifyTokenType::Concat:
+        return EdifyTokenConcat();
+    case EdifyTokenType::Newline:
+        return EdifyTokenNewline();
+    case EdifyTokenType::Whitespace:
+        return EdifyTokenWhitespace(std::string(text));
+    case EdifyTokenType::Comment:
+        // Omit '#' character
+        return EdifyTokenComment(std::string(text.substr(1)));
+    case EdifyTokenType::String: {
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(
+                std::string(text), text.front() == '"'));
+        return std::move(r);
+    }
+    case EdifyTokenType::Unknown:
+    default:
+        return EdifyTokenUnknown(text.front());
     }
 }
 
@@ -407,6 +590,32 @@ EdifyTokenizer::tokenize(std::string_view str)
     return std::move(temp);
 }
 
+/*!
+ * \brief Tokenize \p str into non-owning tokens
+ *
+ * The tokens are appended to \p tokens, which can be reused across calls to
+ * avoid reallocating. They refer to \p str, which must outlive them.
+ */
+oc::result<void> EdifyTokenizer::tokenize(std::string_view str,
+                                          std::vector<EdifyTokenView> &tokens)
+{
+    EdifyTokenStream stream(str);
+    EdifyTokenView token;
+
+    // Most tokens in real scripts are a few characters long
+    tokens.reserve(tokens.size() + str.size() / 4);
+
+    while (true) {
+        OUTCOME_TRY(more, stream.next(token));
+        if (!more) {
+            break;
+        }
+        tokens.push_back(token);
+    }
+
+    return oc::success();
+}
+
 std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken> &tokens)
 {
     return untokenize(tokens.begin(), tokens.end());
@@ -478,4 +687,21 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
     }
 }
 
+void EdifyTokenizer::dump(const std::vector<EdifyTokenView> &tokens)
+{
+    static constexpr const char *names[] = {
+        "If", "Then", "Else", "Endif", "And", "Or", "Equals", "NotEquals",
+        "Not", "LeftParen", "RightParen", "Semicolon", "Comma", "Concat",
+        "Newline", "Whitespace", "Comment", "String", "Unknown",
+    };
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        auto const &t = tokens[i];
+
+        LOGD("%" MB_PRIzu ": %-20s: %.*s",
+             i, names[static_cast<std::size_t>(t.type)],
+             static_cast<int>(t.text.size()), t.text.data());
+    }
+}
+
 }
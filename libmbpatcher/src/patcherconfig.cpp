@@ -23,6 +23,8 @@
 
 #include <cassert>
 
+#include "mbpio/delete.h"
+
 #include "mbpatcher/patcherinterface.h"
 #include "mbpatcher/private/fileutils.h"
 
@@ -47,7 +49,12 @@ namespace mb::patcher
 
 PatcherConfig::PatcherConfig() = default;
 
-PatcherConfig::~PatcherConfig() = default;
+PatcherConfig::~PatcherConfig()
+{
+    if (m_defer_cleanup) {
+        io::wait_for_async_deletes();
+    }
+}
 
 /*!
  * \brief Get error information
@@ -67,7 +74,7 @@ ErrorCode PatcherConfig::error() const
  *
  * \return Data directory
  */
-std::string PatcherConfig::data_directory() const
+const std::string & PatcherConfig::data_directory() const
 {
     return m_data_dir;
 }
@@ -111,6 +118,182 @@ void PatcherConfig::set_temp_directory(std::string path)
     m_temp_dir = std::move(path);
 }
 
+/*!
+ * \brief Get the directory for caching patched files
+ *
+ * \return Cache directory (empty if caching is disabled)
+ */
+const std::string & PatcherConfig::cache_directory() const
+{
+    return m_cache_dir;
+}
+
+/*!
+ * \brief Set the directory for caching patched files
+ *
+ * If set, patchers store the result of patching files in this directory. When
+ * the same file is patched again for the same device with the same version of
+ * the patcher, the cached result is used instead. Caching is disabled by
+ * default.
+ *
+ * \param path Path to cache directory (empty to disable caching)
+ */
+void PatcherConfig::set_cache_directory(std::string path)
+{
+    m_cache_dir = std::move(path);
+}
+
+/*!
+ * \brief Get how patchers choose the compression method for output files
+ *
+ * \return Compression policy
+ */
+CompressionPolicy PatcherConfig::compression_policy() const
+{
+    return m_compression_policy;
+}
+
+/*!
+ * \brief Set how patchers choose the compression method for output files
+ *
+ * The default is CompressionPolicy::Auto. With that policy, the start of each
+ * file is sampled. If the sample does not get noticeably smaller when it is
+ * compressed, the file is stored.
+ *
+ * \param policy Compression policy
+ */
+void PatcherConfig::set_compression_policy(CompressionPolicy policy)
+{
+    m_compression_policy = policy;
+}
+
+/*!
+ * \brief Get the compression method for compressed files in output archives
+ *
+ * \return Compression method
+ */
+CompressionMethod PatcherConfig::compression_method() const
+{
+    return m_compression_method;
+}
+
+/*!
+ * \brief Set the compression method for compressed files in output archives
+ *
+ * The default is CompressionMethod::Deflate. Other methods only apply to the
+ * payload files in archives created by the OdinPatcher, which are extracted
+ * by the odinupdater on the device. Zips from the other patchers are read by
+ * the ROM's own updater and are always deflated.
+ *
+ * \param method Compression method
+ *
+ * \return Whether the method is supported. If not, the compression method is
+ *         unchanged.
+ */
+bool PatcherConfig::set_compression_method(CompressionMethod method)
+{
+    if (!is_compression_method_supported(method)) {
+        return false;
+    }
+
+    m_compression_method = method;
+    return true;
+}
+
+/*!
+ * \brief Check if a compression method is supported by this build
+ */
+bool PatcherConfig::is_compression_method_supported(CompressionMethod method)
+{
+    switch (method) {
+    case CompressionMethod::Deflate:
+        return true;
+    case CompressionMethod::Zstd:
+#ifdef MBPATCHER_HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Get the number of threads used for compressing output files
+ *
+ * \return Number of threads (0 means one per CPU core)
+ */
+unsigned int PatcherConfig::compression_threads() const
+{
+    return m_compression_threads;
+}
+
+/*!
+ * \brief Set the number of threads used for compressing output files
+ *
+ * The default is 1, which compresses each file as a single deflate stream on
+ * the patching thread. With more threads, patchers that support it split large
+ * files into blocks that are compressed in parallel. The output is still a
+ * normal deflate stream, but it is slightly larger.
+ *
+ * \param threads Number of threads (0 for one per CPU core)
+ */
+void PatcherConfig::set_compression_threads(unsigned int threads)
+{
+    m_compression_threads = threads;
+}
+
+/*!
+ * \brief Get the maximum size of a file that patchers keep in memory
+ *
+ * \return Memory budget in bytes (0 means unlimited)
+ */
+uint64_t PatcherConfig::memory_budget() const
+{
+    return m_memory_budget;
+}
+
+/*!
+ * \brief Set the maximum size of a file that patchers keep in memory
+ *
+ * The default is 0, which reads every file that needs to be patched into
+ * memory. Otherwise, larger files are streamed through the autopatchers one
+ * line at a time if all of them support it or are spilled to the temporary
+ * directory if they don't. Files that are only copied are always streamed.
+ *
+ * \param bytes Memory budget in bytes (0 for unlimited)
+ */
+void PatcherConfig::set_memory_budget(uint64_t bytes)
+{
+    m_memory_budget = bytes;
+}
+
+/*!
+ * \brief Get whether patchers delete their temporary files in the background
+ *
+ * \return Whether cleanup is deferred
+ */
+bool PatcherConfig::defer_cleanup() const
+{
+    return m_defer_cleanup;
+}
+
+/*!
+ * \brief Set whether patchers delete their temporary files in the background
+ *
+ * The default is false, which deletes the temporary directory before
+ * Patcher::patch_file() returns. Otherwise, the deletion continues on the
+ * global thread pool and the PatcherConfig destructor waits for it to
+ * complete.
+ *
+ * \param defer Whether to defer cleanup
+ */
+void PatcherConfig::set_defer_cleanup(bool defer)
+{
+    m_defer_cleanup = defer;
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -162,6 +345,8 @@ Patcher * PatcherConfig::create_patcher(const std::string &id)
         return nullptr;
     }
 
+    std::lock_guard<std::mutex> lock(m_patchers_lock);
+
     auto *ptr = p.get();
     m_patchers.push_back(std::move(p));
     return ptr;
@@ -192,6 +377,8 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
         return nullptr;
     }
 
+    std::lock_guard<std::mutex> lock(m_patchers_lock);
+
     auto *ptr = ap.get();
     m_auto_patchers.push_back(std::move(ap));
     return ptr;
@@ -204,6 +391,8 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
  */
 void PatcherConfig::destroy_patcher(Patcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_patchers_lock);
+
     auto it = std::find_if(
         m_patchers.begin(),
         m_patchers.end(),
@@ -222,6 +411,8 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
  */
 void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_patchers_lock);
+
     auto it = std::find_if(
         m_auto_patchers.begin(),
         m_auto_patchers.end(),
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <array>
+#include <string_view>
 #include <thread>
 #include <unordered_set>
 
@@ -32,6 +33,8 @@
 #  include <cerrno>
 #endif
 
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
@@ -44,12 +47,20 @@
 #include "mbpatcher/patchers/zippatcher.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/paralleldeflate.h"
 
 // minizip
 #include "mz_zip.h"
 
+// zlib
+#include <zlib.h>
+
 #define LOG_TAG "mbpatcher/patchers/odinpatcher"
 
+// Size of the reads from the Odin tarball. Odin images are usually several GiB,
+// so large reads keep the per-call overhead low, especially on Windows.
+static constexpr size_t LA_READ_BUF_SIZE = 1024 * 1024;
+
 
 namespace mb::patcher
 {
@@ -60,20 +71,24 @@ const std::string OdinPatcher::Id("OdinPatcher");
 OdinPatcher::OdinPatcher(PatcherConfig &pc)
     : m_pc(pc)
     , m_info(nullptr)
-    , m_old_bytes(0)
     , m_bytes(0)
     , m_max_bytes(0)
-    , m_cancelled(0)
+    , m_cancelled(false)
     , m_error()
-    , m_la_buf()
+    , m_la_bufs{std::vector<unsigned char>(LA_READ_BUF_SIZE),
+                std::vector<unsigned char>(LA_READ_BUF_SIZE)}
+    , m_la_buf_index(0)
     , m_la_file()
 #ifdef __ANDROID__
     , m_fd(-1)
 #endif
+    , m_la_trace()
+    , m_la_input(&m_la_file)
+    , m_md5()
+    , m_md5_expected()
+    , m_md5_size(0)
+    , m_md5_pos(0)
     , m_added_files()
-    , m_progress_cb()
-    , m_details_cb()
-    , m_userdata()
     , m_a_input(nullptr)
     , m_z_output(nullptr)
 {
@@ -112,19 +127,16 @@ bool OdinPatcher::patch_file(ProgressUpdatedCallback progress_cb,
 
     assert(m_info != nullptr);
 
-    m_progress_cb = progress_cb;
-    m_details_cb = details_cb;
-    m_userdata = userdata;
+    m_progress.reset(progress_cb, nullptr, details_cb, userdata);
 
-    m_old_bytes = 0;
     m_bytes = 0;
     m_max_bytes = 0;
 
     bool ret = patch_tar();
 
-    m_progress_cb = nullptr;
-    m_details_cb = nullptr;
-    m_userdata = nullptr;
+    // Make sure the host sees the final values before returning
+    m_progress.flush();
+    m_progress.reset(nullptr, nullptr, nullptr, nullptr);
 
     if (m_a_input != nullptr) {
         close_input_archive();
@@ -176,7 +188,7 @@ bool OdinPatcher::patch_tar()
     if (m_cancelled) return false;
 
     // Get file size and seek back to original location
-    auto current_pos = m_la_file.seek(0, SEEK_CUR);
+    auto current_pos = m_la_input->seek(0, SEEK_CUR);
     if (!current_pos) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
              current_pos.error().message().c_str());
@@ -184,7 +196,7 @@ bool OdinPatcher::patch_tar()
         return false;
     }
 
-    auto seek_ret = m_la_file.seek(0, SEEK_END);
+    auto seek_ret = m_la_input->seek(0, SEEK_END);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
              seek_ret.error().message().c_str());
@@ -193,7 +205,7 @@ bool OdinPatcher::patch_tar()
     }
     m_max_bytes = seek_ret.value();
 
-    seek_ret = m_la_file.seek(static_cast<int64_t>(current_pos.value()),
+    seek_ret = m_la_input->seek(static_cast<int64_t>(current_pos.value()),
                               SEEK_SET);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
@@ -208,6 +220,10 @@ bool OdinPatcher::patch_tar()
         return false;
     }
 
+    if (m_md5 && !verify_md5()) {
+        return false;
+    }
+
     std::string arch_dir(m_pc.data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += m_info->device().architecture();
@@ -309,6 +325,33 @@ bool OdinPatcher::patch_tar()
     return true;
 }
 
+/*! \cond INTERNAL */
+
+// Amount of data read from the start of each entry to decide whether it is
+// worth compressing
+static constexpr size_t SAMPLE_SIZE = 256 * 1024;
+
+// Check if deflating the sample at the fastest level saves at least 1/16 of its
+// size. Sparse images of already compressed data, for example, do not.
+static bool is_compressible(const std::vector<unsigned char> &sample)
+{
+    if (sample.empty()) {
+        return true;
+    }
+
+    auto size = compressBound(static_cast<uLong>(sample.size()));
+    std::vector<unsigned char> buf(size);
+
+    if (compress2(buf.data(), &size, sample.data(),
+                  static_cast<uLong>(sample.size()), Z_BEST_SPEED) != Z_OK) {
+        return true;
+    }
+
+    return size < sample.size() - sample.size() / 16;
+}
+
+/*! \endcond */
+
 bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
 {
     const char *name = archive_entry_pathname(entry);
@@ -321,8 +364,49 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
         zip_name += ".sparse";
     }
 
+    auto policy = m_pc.compression_policy();
+    std::vector<unsigned char> sample;
+
+    if (policy == CompressionPolicy::Auto) {
+        // Read the beginning of the entry to decide how to store it
+        sample.resize(SAMPLE_SIZE);
+        size_t sample_size = 0;
+
+        while (sample_size < sample.size()) {
+            la_ssize_t n_read = archive_read_data(
+                    a, sample.data() + sample_size,
+                    sample.size() - sample_size);
+            if (n_read < 0) {
+                LOGE("libarchive: Failed to read %s: %s",
+                     name, archive_error_string(a));
+                m_error = ErrorCode::ArchiveReadDataError;
+                return false;
+            } else if (n_read == 0) {
+                break;
+            }
+            sample_size += static_cast<size_t>(n_read);
+        }
+
+        sample.resize(sample_size);
+
+        if (!is_compressible(sample)) {
+            LOGD("%s: Data is not compressible; storing uncompressed",
+                 zip_name.c_str());
+            policy = CompressionPolicy::Store;
+        }
+    }
+
+    auto method = m_pc.compression_method();
+
+    if (policy == CompressionPolicy::Store) {
+        return process_file_stored(a, name, zip_name, sample);
+    } else if (method == CompressionMethod::Deflate
+            && m_pc.compression_threads() != 1) {
+        return process_file_parallel(a, name, zip_name, sample);
+    }
+
     mz_zip_file file_info = {};
-    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.compression_method = MinizipUtils::zip_compression_method(method);
     file_info.filename = const_cast<char *>(zip_name.c_str());
     file_info.filename_size = static_cast<uint16_t>(zip_name.size());
 
@@ -337,31 +421,150 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
         return false;
     }
 
-    la_ssize_t n_read;
-    char buf[10240];
-    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
-        if (m_cancelled) return false;
+    bool ret = copy_entry_data(a, name, sample,
+                               [&](const void *data, size_t size) {
+        int n_written = mz_zip_entry_write(
+                handle, data, static_cast<uint32_t>(size));
+        if (n_written < 0 || static_cast<size_t>(n_written) != size) {
+            LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
+            return false;
+        }
+        return true;
+    });
+    if (!ret) {
+        mz_zip_entry_close(handle);
+        return false;
+    }
+
+    // Close file in output zip
+    mz_ret = mz_zip_entry_close(handle);
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Store tar entry in the output zip without compression
+ *
+ * The entry is written as raw data and the CRC32 checksum is computed here,
+ * the same way MinizipUtils::copy_file_raw() copies entries.
+ */
+bool OdinPatcher::process_file_stored(archive *a, const char *name,
+                                      const std::string &zip_name,
+                                      const std::vector<unsigned char> &sample)
+{
+    mz_zip_file file_info = {};
+    file_info.compression_method = MZ_COMPRESS_METHOD_RAW;
+    file_info.filename = const_cast<char *>(zip_name.c_str());
+    file_info.filename_size = static_cast<uint16_t>(zip_name.size());
+
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    // Open raw file in output zip
+    int mz_ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteHeaderError;
+        return false;
+    }
+
+    auto crc = crc32(0, nullptr, 0);
+    uint64_t size = 0;
+
+    bool ret = copy_entry_data(a, name, sample,
+                               [&](const void *data, size_t n) {
+        crc = crc32(crc, static_cast<const Bytef *>(data),
+                    static_cast<uInt>(n));
+        size += n;
 
         int n_written = mz_zip_entry_write(
-                handle, buf, static_cast<uint32_t>(n_read));
-        if (static_cast<la_ssize_t>(n_written) != n_read) {
+                handle, data, static_cast<uint32_t>(n));
+        if (n_written < 0 || static_cast<size_t>(n_written) != n) {
             LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
-            m_error = ErrorCode::ArchiveWriteDataError;
-            mz_zip_entry_close(handle);
             return false;
         }
+        return true;
+    });
+    if (!ret) {
+        mz_zip_entry_close(handle);
+        return false;
     }
 
-    if (n_read != 0) {
-        LOGE("libarchive: Failed to read %s: %s",
-             name, archive_error_string(a));
-        m_error = ErrorCode::ArchiveReadDataError;
+    // Close raw file in output zip
+    mz_ret = mz_zip_entry_close_raw(handle, size, static_cast<uint32_t>(crc));
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress tar entry into the output zip using multiple threads
+ *
+ * The entry is compressed with ParallelDeflate and the resulting deflate stream
+ * is written to the zip as raw data, the same way MinizipUtils::copy_file_raw()
+ * copies already compressed entries.
+ */
+bool OdinPatcher::process_file_parallel(archive *a, const char *name,
+                                        const std::string &zip_name,
+                                        const std::vector<unsigned char> &sample)
+{
+    mz_zip_file file_info = {};
+    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.filename = const_cast<char *>(zip_name.c_str());
+    file_info.filename_size = static_cast<uint16_t>(zip_name.size());
+
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    // Open raw file in output zip
+    int mz_ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteHeaderError;
+        return false;
+    }
+
+    auto close_entry = finally([&] {
         mz_zip_entry_close(handle);
+    });
+
+    ParallelDeflate deflater(m_pc.compression_threads(),
+                             Z_DEFAULT_COMPRESSION,
+                             [&](const void *data, size_t size) {
+        int n_written = mz_zip_entry_write(
+                handle, data, static_cast<uint32_t>(size));
+        if (n_written < 0 || static_cast<size_t>(n_written) != size) {
+            LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
+            return false;
+        }
+        return true;
+    });
+
+    bool ret = copy_entry_data(a, name, sample,
+                               [&](const void *data, size_t size) {
+        return deflater.write(data, size);
+    });
+    if (!ret) {
         return false;
     }
 
-    // Close file in output zip
-    mz_ret = mz_zip_entry_close(handle);
+    if (!deflater.finish()) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    close_entry.dismiss();
+
+    // Close raw file in output zip
+    mz_ret = mz_zip_entry_close_raw(handle, deflater.uncompressed_size(),
+                                    deflater.crc32());
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteDataError;
@@ -371,6 +574,47 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
     return true;
 }
 
+/*!
+ * \brief Pass the data of the current tar entry to a function
+ *
+ * \param a Input archive
+ * \param name Name of the entry (for logging)
+ * \param sample Data that was already read from the start of the entry
+ * \param write Function to write the data to. It should log its own errors.
+ *
+ * \return Whether all data was read and written successfully
+ */
+bool OdinPatcher::copy_entry_data(archive *a, const char *name,
+                                  const std::vector<unsigned char> &sample,
+                                  const std::function<bool(const void *, size_t)>
+                                          &write)
+{
+    if (!sample.empty() && !write(sample.data(), sample.size())) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    la_ssize_t n_read;
+    char buf[10240];
+    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
+        if (m_cancelled) return false;
+
+        if (!write(buf, static_cast<size_t>(n_read))) {
+            m_error = ErrorCode::ArchiveWriteDataError;
+            return false;
+        }
+    }
+
+    if (n_read != 0) {
+        LOGE("libarchive: Failed to read %s: %s",
+             name, archive_error_string(a));
+        m_error = ErrorCode::ArchiveReadDataError;
+        return false;
+    }
+
+    return true;
+}
+
 static const char * indent(unsigned int depth)
 {
     static std::array<char, 16> buf;
@@ -492,6 +736,155 @@ bool OdinPatcher::process_contents(archive *a, unsigned int depth)
     return true;
 }
 
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+/*!
+ * \brief Find the MD5 trailer of a .tar.md5 input
+ *
+ * A .tar.md5 file is a tarball followed by the output of `md5sum` for the
+ * tarball. The trailer is detected from the contents because the input may be
+ * a file descriptor without a meaningful name. If a trailer is found, m_md5 is
+ * set up to hash the input as it is read.
+ *
+ * \return Whether the input file could be read. The file position is restored
+ *         to the beginning of the file.
+ */
+bool OdinPatcher::find_md5_trailer()
+{
+    m_md5.reset();
+
+    auto size = m_la_input->seek(0, SEEK_END);
+    if (!size) {
+        LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
+             size.error().message().c_str());
+        m_error = ErrorCode::FileSeekError;
+        return false;
+    }
+
+    // "<32 hex digits>  <name>\n" after at least one tar block
+    std::vector<char> tail(static_cast<size_t>(
+            std::min<uint64_t>(size.value(), 4096)));
+
+    auto ret = m_la_input->seek(static_cast<int64_t>(
+            size.value() - tail.size()), SEEK_SET);
+    if (!ret) {
+        LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
+             ret.error().message().c_str());
+        m_error = ErrorCode::FileSeekError;
+        return false;
+    }
+
+    auto n = file_read_retry(*m_la_input, tail.data(), tail.size());
+    if (!n) {
+        LOGE("%s: Failed to read: %s", m_info->input_path().c_str(),
+             n.error().message().c_str());
+        m_error = ErrorCode::FileReadError;
+        return false;
+    }
+    tail.resize(n.value());
+
+    ret = m_la_input->seek(0, SEEK_SET);
+    if (!ret) {
+        LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
+             ret.error().message().c_str());
+        m_error = ErrorCode::FileSeekError;
+        return false;
+    }
+
+    // The tarball ends with zero-filled blocks and the trailer is text
+    auto nul = std::find(tail.rbegin(), tail.rend(), '\0');
+    if (nul == tail.rend()) {
+        return true;
+    }
+
+    auto offset = static_cast<size_t>(nul.base() - tail.begin());
+    std::string_view trailer(tail.data() + offset, tail.size() - offset);
+    uint64_t tar_size = size.value() - trailer.size();
+
+    if (tar_size % 512 != 0 || trailer.size() < 2 * m_md5_expected.size() + 2
+            || trailer[2 * m_md5_expected.size()] != ' ') {
+        return true;
+    }
+
+    for (size_t i = 0; i < m_md5_expected.size(); ++i) {
+        int hi = hex_digit(trailer[i * 2]);
+        int lo = hex_digit(trailer[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return true;
+        }
+        m_md5_expected[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+
+    LOGD("%s: Verifying MD5 checksum of the first %" PRIu64 " bytes",
+         m_info->input_path().c_str(), tar_size);
+
+    m_md5 = std::make_unique<Md5Worker>();
+    m_md5_size = tar_size;
+    m_md5_pos = 0;
+
+    return true;
+}
+
+/*!
+ * \brief Hash the rest of the input and compare against the MD5 trailer
+ *
+ * libarchive stops reading at the end-of-archive marker, so the remaining
+ * padding before the trailer is read here.
+ */
+bool OdinPatcher::verify_md5()
+{
+    auto &buf = m_la_bufs[m_la_buf_index];
+
+    // The buffer may still be queued from the last read by libarchive
+    m_md5->wait(0);
+
+    while (m_md5_pos < m_md5_size) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(m_md5_size - m_md5_pos, buf.size()));
+
+        auto n = file_read_retry(*m_la_input, buf.data(), to_read);
+        if (!n) {
+            LOGE("%s: Failed to read: %s", m_info->input_path().c_str(),
+                 n.error().message().c_str());
+            m_error = ErrorCode::FileReadError;
+            return false;
+        } else if (n.value() != to_read) {
+            LOGE("%s: Unexpected end of file", m_info->input_path().c_str());
+            m_error = ErrorCode::FileReadError;
+            return false;
+        }
+
+        m_md5->update(buf.data(), n.value());
+        m_md5->wait(0);
+        m_md5_pos += n.value();
+    }
+
+    auto digest = m_md5->finish();
+    m_md5.reset();
+
+    if (digest != m_md5_expected) {
+        LOGE("%s: MD5 checksum does not match the trailer",
+             m_info->input_path().c_str());
+        m_error = ErrorCode::ChecksumMismatch;
+        return false;
+    }
+
+    LOGD("%s: MD5 checksum matches", m_info->input_path().c_str());
+
+    return true;
+}
+
 bool OdinPatcher::open_input_archive()
 {
     assert(m_a_input == nullptr);
@@ -573,30 +966,13 @@ bool OdinPatcher::close_output_archive()
 
 void OdinPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
-    if (m_progress_cb) {
-        bool should_call = true;
-        if (max_bytes > 0) {
-            // Rate limit... call back only if percentage exceeds 0.01%
-            double old_ratio = static_cast<double>(m_old_bytes)
-                    / static_cast<double>(max_bytes);
-            double new_ratio = static_cast<double>(bytes)
-                    / static_cast<double>(max_bytes);
-            if (new_ratio - old_ratio < 0.0001) {
-                should_call = false;
-            }
-        }
-        if (should_call) {
-            m_progress_cb(bytes, max_bytes, m_userdata);
-            m_old_bytes = bytes;
-        }
-    }
+    // ProgressReporter rate limits the callback
+    m_progress.set_bytes(bytes, max_bytes);
 }
 
 void OdinPatcher::update_details(const std::string &msg)
 {
-    if (m_details_cb) {
-        m_details_cb(msg, m_userdata);
-    }
+    m_progress.set_details(msg);
 }
 
 la_ssize_t OdinPatcher::la_nested_read_cb(archive *a, void *userdata,
@@ -616,9 +992,18 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
 {
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
-    *buffer = p->m_la_buf;
 
-    auto bytes_read = p->m_la_file.read(p->m_la_buf, sizeof(p->m_la_buf));
+    // libarchive is done with the previous buffer, but it may still be queued
+    // for hashing. The one before that can be reused once it is hashed.
+    p->m_la_buf_index ^= 1;
+    auto &buf = p->m_la_bufs[p->m_la_buf_index];
+    *buffer = buf.data();
+
+    if (p->m_md5) {
+        p->m_md5->wait(1);
+    }
+
+    auto bytes_read = p->m_la_input->read(buf.data(), buf.size());
     if (!bytes_read) {
         LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
              bytes_read.error().message().c_str());
@@ -626,6 +1011,13 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
         return -1;
     }
 
+    if (p->m_md5 && p->m_md5_pos < p->m_md5_size) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(
+                bytes_read.value(), p->m_md5_size - p->m_md5_pos));
+        p->m_md5->update(buf.data(), n);
+        p->m_md5_pos += n;
+    }
+
     p->m_bytes += bytes_read.value();
     p->update_progress(p->m_bytes, p->m_max_bytes);
     return static_cast<la_ssize_t>(bytes_read.value());
@@ -637,7 +1029,13 @@ la_int64_t OdinPatcher::la_skip_cb(archive *a, void *userdata,
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
-    auto seek_ret = p->m_la_file.seek(request, SEEK_CUR);
+    // Skipped data still needs to be hashed. libarchive reads it instead if
+    // nothing is skipped.
+    if (p->m_md5) {
+        return 0;
+    }
+
+    auto seek_ret = p->m_la_input->seek(request, SEEK_CUR);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", p->m_info->input_path().c_str(),
              seek_ret.error().message().c_str());
@@ -666,6 +1064,9 @@ int OdinPatcher::la_open_cb(archive *a, void *userdata)
         return -1;
     }
 
+    // The tarball is read from start to end
+    (void) p->m_la_file.set_sequential_scan(true);
+
     ret = p->m_la_file.open(w_filename.value(), FileOpenMode::ReadOnly);
 #else
 #  ifdef __ANDROID__
@@ -683,6 +1084,16 @@ int OdinPatcher::la_open_cb(archive *a, void *userdata)
         return -1;
     }
 
+    p->m_la_input = &p->m_la_file;
+
+    if (file_trace_path() && p->m_la_trace.open(&p->m_la_file)) {
+        p->m_la_input = &p->m_la_trace;
+    }
+
+    if (!p->find_md5_trailer()) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -691,6 +1102,18 @@ int OdinPatcher::la_close_cb(archive *a, void *userdata)
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
+    p->m_md5.reset();
+
+    if (p->m_la_input == &p->m_la_trace) {
+        (void) p->m_la_trace.close();
+
+        if (auto path = file_trace_path()) {
+            (void) file_trace_write(path, "odinpatcher:input", p->m_la_trace);
+        }
+
+        p->m_la_input = &p->m_la_file;
+    }
+
     auto ret = p->m_la_file.close();
     if (!ret) {
         LOGE("%s: Failed to close: %s", p->m_info->input_path().c_str(),
@@ -23,13 +23,20 @@
 #include <unordered_set>
 
 #include <cassert>
+#include <cinttypes>
 #include <cstring>
 
+#include "mbcommon/endian.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mbpio/delete.h"
+#include "mbpio/directory.h"
+#include "mbpio/error.h"
 
 #include "mbpatcher/autopatchers/magiskpatcher.h"
 #include "mbpatcher/autopatchers/mountcmdpatcher.h"
@@ -59,10 +66,6 @@ ZipPatcher::ZipPatcher(PatcherConfig &pc)
     , m_max_files(0)
     , m_cancelled(false)
     , m_error()
-    , m_progress_cb(nullptr)
-    , m_files_cb(nullptr)
-    , m_details_cb(nullptr)
-    , m_userdata(nullptr)
     , m_z_input(nullptr)
     , m_z_output(nullptr)
 {
@@ -99,10 +102,7 @@ bool ZipPatcher::patch_file(ProgressUpdatedCallback progress_cb,
 
     assert(m_info != nullptr);
 
-    m_progress_cb = progress_cb;
-    m_files_cb = files_cb;
-    m_details_cb = details_cb;
-    m_userdata = userdata;
+    m_progress.reset(progress_cb, files_cb, details_cb, userdata);
 
     m_bytes = 0;
     m_max_bytes = 0;
@@ -111,10 +111,9 @@ bool ZipPatcher::patch_file(ProgressUpdatedCallback progress_cb,
 
     bool ret = patch_zip();
 
-    m_progress_cb = nullptr;
-    m_files_cb = nullptr;
-    m_details_cb = nullptr;
-    m_userdata = nullptr;
+    // Make sure the host sees the final values before returning
+    m_progress.flush();
+    m_progress.reset(nullptr, nullptr, nullptr, nullptr);
 
     for (auto *p : m_auto_patchers) {
         m_pc.destroy_auto_patcher(p);
@@ -144,7 +143,7 @@ struct CopySpec
 
 bool ZipPatcher::patch_zip()
 {
-    std::unordered_set<std::string> exclude_from_pass1;
+    std::unordered_set<std::string> to_patch;
 
     for (auto const &id : {
         StandardPatcher::Id,
@@ -159,21 +158,17 @@ bool ZipPatcher::patch_zip()
 
         m_auto_patchers.push_back(ap);
 
-        // AutoPatcher files should be excluded from the first pass
+        // AutoPatcher files are patched in memory instead of being copied
         for (auto const &file : ap->existing_files()) {
-            exclude_from_pass1.insert(file);
+            to_patch.insert(file);
         }
     }
 
-    // Unlike the old patcher, we'll write directly to the new file
-    if (!open_output_archive()) {
+    if (!device::device_to_json(m_info->device(), m_device_json)) {
+        m_error = ErrorCode::MemoryAllocationError;
         return false;
     }
 
-    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
-
-    if (m_cancelled) return false;
-
     MinizipUtils::ArchiveStats stats;
     auto result = MinizipUtils::archive_stats(m_info->input_path(), stats, {});
     if (result != ErrorCode::NoError) {
@@ -185,6 +180,35 @@ bool ZipPatcher::patch_zip()
 
     if (m_cancelled) return false;
 
+    // Copy all the files that don't need to be patched in large chunks. If
+    // this isn't possible, the files are copied one by one below.
+    update_details("Copying files");
+
+    MinizipUtils::RawCopyStats copy_stats;
+    result = MinizipUtils::bulk_copy_raw(
+            m_info->input_path(), m_info->output_path(), to_patch, {
+                {
+                    "META-INF/com/google/android/update-binary",
+                    "META-INF/com/google/android/update-binary.orig"
+                },
+            }, copy_stats, &la_progress_cb, this);
+    if (result != ErrorCode::NoError) {
+        m_error = result;
+        return false;
+    }
+
+    m_bytes += copy_stats.uncompressed_size;
+    m_files += copy_stats.files;
+
+    if (m_cancelled) return false;
+
+    // Unlike the old patcher, we'll write directly to the new file
+    if (!open_output_archive(copy_stats.supported)) {
+        return false;
+    }
+
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
     std::string arch_dir(m_pc.data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += m_info->device().architecture();
@@ -230,26 +254,10 @@ bool ZipPatcher::patch_zip()
         return false;
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(m_pc.temp_directory());
-
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        io::delete_recursively(temp_dir);
+    if (!process_entries(to_patch, copy_stats.supported)) {
         return false;
     }
 
-    if (m_cancelled) return false;
-
-    // On the second pass, run the autopatchers on the rest of the files
-
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        io::delete_recursively(temp_dir);
-        return false;
-    }
-
-    io::delete_recursively(temp_dir);
-
     for (const CopySpec &spec : to_copy) {
         if (m_cancelled) return false;
 
@@ -283,15 +291,10 @@ bool ZipPatcher::patch_zip()
     update_files(++m_files, m_max_files);
     update_details("multiboot/device.json");
 
-    std::string json;
-    if (!device::device_to_json(m_info->device(), json)) {
-        m_error = ErrorCode::MemoryAllocationError;
-        return false;
-    }
-
     result = MinizipUtils::add_file(
             handle, "multiboot/device.json",
-            std::vector<unsigned char>(json.begin(), json.end()));
+            std::vector<unsigned char>(m_device_json.begin(),
+                                       m_device_json.end()));
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
@@ -303,15 +306,18 @@ bool ZipPatcher::patch_zip()
 }
 
 /*!
- * \brief First pass of patching operation
+ * \brief Copy and patch the entries of the input zip
  *
- * This performs the following operations:
+ * This performs the following operations in a single pass over the input zip:
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
- * - Otherwise, the file is copied directly to the output zip.
+ * - Files needed by an AutoPatcher are read into memory, patched, and added to
+ *   the output zip.
+ * - Otherwise, the file is copied directly to the output zip, unless
+ *   \p copied is true, which means that MinizipUtils::bulk_copy_raw() already
+ *   copied it.
  */
-bool ZipPatcher::pass1(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &exclude)
+bool ZipPatcher::process_entries(const std::unordered_set<std::string> &to_patch,
+                                 bool copied)
 {
     void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
     void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
@@ -335,29 +341,33 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
             }
 
             std::string cur_file{file_info->filename, file_info->filename_size};
+            bool is_patched = to_patch.find(cur_file) != to_patch.end();
+
+            if (copied && !is_patched) {
+                continue;
+            }
 
             update_files(++m_files, m_max_files);
             update_details(cur_file);
 
-            // Skip files that should be patched and added in pass 2
-            if (exclude.find(cur_file) != exclude.end()) {
-                if (!MinizipUtils::extract_file(h_in, temporary_dir)) {
-                    m_error = ErrorCode::ArchiveReadDataError;
+            if (is_patched) {
+                if (!patch_entry(cur_file, file_info->crc,
+                                 file_info->uncompressed_size)) {
                     return false;
                 }
-                continue;
-            }
-
-            // Rename the installer for mbtool
-            if (cur_file == "META-INF/com/google/android/update-binary") {
-                cur_file = "META-INF/com/google/android/update-binary.orig";
-            }
+            } else {
+                // Rename the installer for mbtool
+                if (cur_file == "META-INF/com/google/android/update-binary") {
+                    cur_file = "META-INF/com/google/android/update-binary.orig";
+                }
 
-            if (!MinizipUtils::copy_file_raw(
-                    h_in, h_out, cur_file, &la_progress_cb, this)) {
-                LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
-                m_error = ErrorCode::ArchiveWriteDataError;
-                return false;
+                if (!MinizipUtils::copy_file_raw(
+                        h_in, h_out, cur_file, &la_progress_cb, this)) {
+                    LOGW("minizip: Failed to copy raw data: %s",
+                         cur_file.c_str());
+                    m_error = ErrorCode::ArchiveWriteDataError;
+                    return false;
+                }
             }
 
             m_bytes += file_info->uncompressed_size;
@@ -375,58 +385,318 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
 }
 
 /*!
- * \brief Second pass of patching operation
+ * \brief Patch the current entry of the input zip and add it to the output zip
  *
- * This performs the following operations:
+ * The entry is read into memory and passed through each AutoPatcher, so
+ * patched files never touch the disk. If a cache directory is configured, the
+ * patched data is looked up there first. Entries larger than the memory budget
+ * are handled by patch_large_entry() instead.
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * \param name Name of the entry
+ * \param crc32 CRC32 checksum of the (unpatched) entry
+ * \param size Uncompressed size of the (unpatched) entry
  */
-bool ZipPatcher::pass2(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &files)
+bool ZipPatcher::patch_entry(const std::string &name, uint32_t crc32,
+                             uint64_t size)
 {
-    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+    std::string output_name = name;
+    if (name == "META-INF/com/google/android/update-binary") {
+        output_name = "META-INF/com/google/android/update-binary.orig";
+    }
 
-    for (auto *ap : m_auto_patchers) {
-        if (m_cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
-            m_error = ap->error();
+    uint64_t budget = m_pc.memory_budget();
+    if (budget != 0 && size > budget) {
+        return patch_large_entry(name, output_name);
+    }
+
+    void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
+    void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    std::vector<unsigned char> data;
+    std::string cache_key;
+    bool cached = false;
+
+    if (!m_pc.cache_directory().empty()) {
+        // The output only depends on the input data, the patcher code, the
+        // device, and the set of autopatchers
+        cache_key += name;
+        cache_key += '\0';
+        cache_key += format("%08" PRIx32, crc32);
+        cache_key += '\0';
+        cache_key += std::to_string(size);
+        cache_key += '\0';
+        cache_key += git_version();
+        cache_key += '\0';
+        cache_key += m_device_json;
+        for (auto *ap : m_auto_patchers) {
+            cache_key += '\0';
+            cache_key += ap->id();
+        }
+
+        cached = load_cached_entry(cache_key, data);
+    }
+
+    if (!cached) {
+        if (!MinizipUtils::read_to_memory(h_in, data, &la_progress_cb, this)) {
+            m_error = ErrorCode::ArchiveReadDataError;
             return false;
         }
+
+        AutoPatcher::FileMap files;
+        auto &contents = files[name];
+        contents.assign(data.begin(), data.end());
+
+        for (auto *ap : m_auto_patchers) {
+            if (m_cancelled) return false;
+            if (!ap->patch_files(files)) {
+                m_error = ap->error();
+                return false;
+            }
+        }
+
+        data.assign(contents.begin(), contents.end());
+
+        if (!cache_key.empty()) {
+            store_cached_entry(cache_key, data);
+        }
     }
 
     // TODO Headers are being discarded
 
-    for (auto const &file : files) {
-        if (m_cancelled) return false;
+    ErrorCode ret = MinizipUtils::add_file(h_out, output_name, data);
+    if (ret != ErrorCode::NoError) {
+        m_error = ret;
+        return false;
+    }
 
-        ErrorCode ret;
-
-        if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::add_file(
-                    handle,
-                    "META-INF/com/google/android/update-binary.orig",
-                    temporary_dir + "/" + file);
-        } else {
-            ret = MinizipUtils::add_file(
-                    handle,
-                    file,
-                    temporary_dir + "/" + file);
+    return true;
+}
+
+/*!
+ * \brief Patch the current entry of the input zip without reading it into
+ *        memory
+ *
+ * If every AutoPatcher that patches the entry can stream it, the entry is
+ * patched one line at a time while it is copied to the output zip. Otherwise,
+ * it is extracted to a temporary directory and patched there. Large entries
+ * are never cached.
+ *
+ * \param name Name of the entry
+ * \param output_name Name of the entry in the output zip
+ */
+bool ZipPatcher::patch_large_entry(const std::string &name,
+                                   const std::string &output_name)
+{
+    void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
+    void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    std::vector<AutoPatcher *> patchers;
+    for (auto *ap : m_auto_patchers) {
+        auto files = ap->existing_files();
+        if (std::find(files.begin(), files.end(), name) != files.end()) {
+            patchers.push_back(ap);
         }
+    }
+
+    bool streamable = std::all_of(patchers.begin(), patchers.end(),
+                                  [&](AutoPatcher *ap) {
+        return ap->can_stream(name);
+    });
+
+    if (streamable) {
+        LOGD("%s: Streaming through autopatchers", name.c_str());
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
-            m_error = ret;
+        AutoPatcher *failed = nullptr;
+
+        auto filter = [&](std::string &line) {
+            for (auto *ap : patchers) {
+                if (m_cancelled) {
+                    return AutoPatcher::LineResult::Error;
+                }
+
+                auto result = ap->patch_line(name, line);
+                if (result == AutoPatcher::LineResult::Error) {
+                    failed = ap;
+                }
+                if (result != AutoPatcher::LineResult::Keep) {
+                    return result;
+                }
+            }
+            return AutoPatcher::LineResult::Keep;
+        };
+
+        if (!MinizipUtils::filter_lines(h_in, h_out, output_name, filter,
+                                        &la_progress_cb, this)) {
+            m_error = failed ? failed->error()
+                    : ErrorCode::ArchiveWriteDataError;
             return false;
         }
+
+        return true;
     }
 
-    if (m_cancelled) return false;
+    LOGD("%s: Spilling to temporary directory", name.c_str());
+
+    std::string temp_dir =
+            FileUtils::create_temporary_dir(m_pc.temp_directory());
+    if (temp_dir.empty()) {
+        m_error = ErrorCode::FileOpenError;
+        return false;
+    }
+
+    auto delete_temp_dir = finally([&] {
+        if (m_pc.defer_cleanup()) {
+            io::delete_recursively_async(temp_dir);
+        } else if (!io::delete_recursively_parallel(temp_dir)) {
+            LOGW("%s: Failed to delete temporary directory: %s",
+                 temp_dir.c_str(), io::last_error_string().c_str());
+        }
+    });
+
+    if (!MinizipUtils::extract_file(h_in, temp_dir)) {
+        m_error = ErrorCode::ArchiveReadDataError;
+        return false;
+    }
+
+    for (auto *ap : patchers) {
+        if (m_cancelled) return false;
+        if (!ap->patch_files(temp_dir)) {
+            m_error = ap->error();
+            return false;
+        }
+    }
+
+    ErrorCode ret = MinizipUtils::add_file(h_out, output_name,
+                                           temp_dir + "/" + name);
+    if (ret != ErrorCode::NoError) {
+        m_error = ret;
+        return false;
+    }
 
     return true;
 }
 
+/*! \cond INTERNAL */
+
+static constexpr char CACHE_MAGIC[4] = { 'M', 'B', 'P', 'C' };
+
+// 64-bit FNV-1a. This only needs to be stable, not cryptographically secure,
+// because the full key is stored in and compared against the cache file.
+static uint64_t fnv1a_64(const std::string &data)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static std::string cache_path(const std::string &directory,
+                              const std::string &key)
+{
+    return format("%s/%016" PRIx64 ".patched", directory.c_str(),
+                  fnv1a_64(key));
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Load patched entry from the cache
+ *
+ * The cache file contains a 4-byte magic, the 32-bit little-endian key size,
+ * the key, the 64-bit little-endian data size, and the data.
+ *
+ * \return Whether a valid cache entry matching \p key was found
+ */
+bool ZipPatcher::load_cached_entry(const std::string &key,
+                                   std::vector<unsigned char> &data)
+{
+    StandardFile file;
+
+    if (!FileUtils::open_file(file, cache_path(m_pc.cache_directory(), key),
+                              FileOpenMode::ReadOnly)) {
+        return false;
+    }
+
+    char magic[sizeof(CACHE_MAGIC)];
+    uint32_t key_size;
+    uint64_t data_size;
+    std::string stored_key;
+
+    if (!file_read_exact(file, magic, sizeof(magic))
+            || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0
+            || !file_read_exact(file, &key_size, sizeof(key_size))
+            || (key_size = mb_le32toh(key_size)) != key.size()) {
+        return false;
+    }
+
+    stored_key.resize(key_size);
+
+    if (!file_read_exact(file, stored_key.data(), stored_key.size())
+            || stored_key != key
+            || !file_read_exact(file, &data_size, sizeof(data_size))) {
+        return false;
+    }
+
+    data_size = mb_le64toh(data_size);
+    if (data_size > SIZE_MAX) {
+        return false;
+    }
+
+    data.resize(static_cast<size_t>(data_size));
+
+    if (!file_read_exact(file, data.data(), data.size())) {
+        data.clear();
+        return false;
+    }
+
+    LOGD("Using cached patched data: %s",
+         cache_path(m_pc.cache_directory(), key).c_str());
+
+    return true;
+}
+
+/*!
+ * \brief Store patched entry in the cache
+ *
+ * Errors are logged, but are otherwise ignored because the cache is only an
+ * optimization.
+ */
+void ZipPatcher::store_cached_entry(const std::string &key,
+                                    const std::vector<unsigned char> &data)
+{
+    const std::string &directory = m_pc.cache_directory();
+
+    if (!io::create_directories(directory)) {
+        LOGW("%s: Failed to create cache directory: %s",
+             directory.c_str(), io::last_error_string().c_str());
+        return;
+    }
+
+    std::vector<unsigned char> contents(
+            CACHE_MAGIC, CACHE_MAGIC + sizeof(CACHE_MAGIC));
+
+    auto append = [&](const void *ptr, size_t size) {
+        auto begin = static_cast<const unsigned char *>(ptr);
+        contents.insert(contents.end(), begin, begin + size);
+    };
+
+    uint32_t key_size = mb_htole32(static_cast<uint32_t>(key.size()));
+    uint64_t data_size = mb_htole64(static_cast<uint64_t>(data.size()));
+
+    append(&key_size, sizeof(key_size));
+    append(key.data(), key.size());
+    append(&data_size, sizeof(data_size));
+    append(data.data(), data.size());
+
+    auto path = cache_path(directory, key);
+
+    if (FileUtils::write_from_memory(path, contents) != ErrorCode::NoError) {
+        LOGW("%s: Failed to write cache file", path.c_str());
+    }
+}
+
 bool ZipPatcher::open_input_archive()
 {
     assert(m_z_input == nullptr);
@@ -456,12 +726,13 @@ void ZipPatcher::close_input_archive()
     m_z_input = nullptr;
 }
 
-bool ZipPatcher::open_output_archive()
+bool ZipPatcher::open_output_archive(bool append)
 {
     assert(m_z_output == nullptr);
 
-    m_z_output = MinizipUtils::open_zip_file(m_info->output_path(),
-                                             ZipOpenMode::Write);
+    m_z_output = MinizipUtils::open_zip_file(
+            m_info->output_path(),
+            append ? ZipOpenMode::Append : ZipOpenMode::Write);
 
     if (!m_z_output) {
         LOGE("minizip: Failed to open for writing: %s",
@@ -487,23 +758,17 @@ void ZipPatcher::close_output_archive()
 
 void ZipPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
-    if (m_progress_cb) {
-        m_progress_cb(bytes, max_bytes, m_userdata);
-    }
+    m_progress.set_bytes(bytes, max_bytes);
 }
 
 void ZipPatcher::update_files(uint64_t files, uint64_t max_files)
 {
-    if (m_files_cb) {
-        m_files_cb(files, max_files, m_userdata);
-    }
+    m_progress.set_files(files, max_files);
 }
 
 void ZipPatcher::update_details(const std::string &msg)
 {
-    if (m_details_cb) {
-        m_details_cb(msg, m_userdata);
-    }
+    m_progress.set_details(msg);
 }
 
 void ZipPatcher::la_progress_cb(uint64_t bytes, void *userdata)
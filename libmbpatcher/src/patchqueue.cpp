@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/patchqueue.h"
+
+#include <algorithm>
+
+#include <cassert>
+
+#include "mblog/logging.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
+
+#define LOG_TAG "mbpatcher/patchqueue"
+
+
+namespace mb::patcher
+{
+
+/*! \cond INTERNAL */
+struct PatchQueue::Job
+{
+    PatchQueue *queue;
+    size_t index;
+
+    std::string patcher_id;
+    FileInfo info;
+
+    PatchJobState state;
+    ErrorCode error;
+    bool cancel_requested;
+
+    // Only non-null while the job is running
+    Patcher *patcher;
+};
+/*! \endcond */
+
+/*!
+ * \class PatchQueue
+ * \brief Patch multiple files on a bounded pool of worker threads
+ *
+ * All jobs share the same PatcherConfig (and thus the same data, temporary,
+ * and cache directories) and the same list of device definitions, so the
+ * caller only needs to load them once for the whole batch.
+ *
+ * Jobs are added with add_job() and run after start() is called. Each job
+ * reports its progress through the callbacks set with set_callbacks(). The job
+ * index is passed as the first argument to every callback. The callbacks are
+ * called from the worker threads, so they must be thread safe.
+ */
+
+/*!
+ * \brief Construct new patch queue
+ *
+ * \param pc PatcherConfig to create patchers from. It must outlive the queue.
+ */
+PatchQueue::PatchQueue(PatcherConfig &pc)
+    : m_pc(pc)
+    , m_max_workers(1)
+    , m_next_job(0)
+    , m_cancelled(false)
+    , m_progress_cb(nullptr)
+    , m_files_cb(nullptr)
+    , m_details_cb(nullptr)
+    , m_state_cb(nullptr)
+    , m_userdata(nullptr)
+{
+}
+
+/*!
+ * \brief Destroy patch queue
+ *
+ * Any pending or running jobs are cancelled and the worker threads are joined.
+ */
+PatchQueue::~PatchQueue()
+{
+    cancel_all();
+    wait();
+}
+
+/*!
+ * \brief Get maximum number of jobs to run at the same time
+ *
+ * \return Maximum number of workers (0 if one per CPU core)
+ */
+unsigned int PatchQueue::max_workers() const
+{
+    return m_max_workers;
+}
+
+/*!
+ * \brief Set maximum number of jobs to run at the same time
+ *
+ * The default is 1, which patches the files one by one on a background thread.
+ *
+ * \param workers Maximum number of workers (0 for one per CPU core)
+ */
+void PatchQueue::set_max_workers(unsigned int workers)
+{
+    m_max_workers = workers;
+}
+
+/*!
+ * \brief Set device definitions shared by all jobs
+ *
+ * Jobs added with the device ID overload of add_job() look up their device
+ * from this list.
+ *
+ * \param devices List of devices (eg. from device::device_list_from_json())
+ */
+void PatchQueue::set_devices(std::vector<device::Device> devices)
+{
+    m_devices = std::move(devices);
+}
+
+/*!
+ * \brief Get device definitions shared by all jobs
+ */
+const std::vector<device::Device> & PatchQueue::devices() const
+{
+    return m_devices;
+}
+
+/*!
+ * \brief Add job to the queue
+ *
+ * \pre The queue must not be running.
+ *
+ * \param patcher_id ID of patcher to use
+ * \param info FileInfo describing the file to patch
+ *
+ * \return Index of the new job
+ */
+size_t PatchQueue::add_job(const std::string &patcher_id, FileInfo info)
+{
+    assert(m_workers.empty());
+
+    auto job = std::make_unique<Job>();
+    job->queue = this;
+    job->index = m_jobs.size();
+    job->patcher_id = patcher_id;
+    job->info = std::move(info);
+    job->state = PatchJobState::Pending;
+    job->error = ErrorCode::NoError;
+    job->cancel_requested = false;
+    job->patcher = nullptr;
+
+    m_jobs.push_back(std::move(job));
+
+    return m_jobs.size() - 1;
+}
+
+/*!
+ * \brief Add job for a device from the shared device list
+ *
+ * \pre The queue must not be running.
+ *
+ * \param[in] patcher_id ID of patcher to use
+ * \param[in] input_path Path of the file to patch
+ * \param[in] output_path Path of the patched file
+ * \param[in] device_id ID of device in the list set with set_devices()
+ * \param[in] rom_id ID of the ROM to install to
+ * \param[out] job_out Index of the new job
+ *
+ * \return Whether the device was found and the job was added
+ */
+bool PatchQueue::add_job(const std::string &patcher_id, std::string input_path,
+                         std::string output_path, const std::string &device_id,
+                         std::string rom_id, size_t &job_out)
+{
+    auto it = std::find_if(m_devices.begin(), m_devices.end(),
+                           [&](const device::Device &d) {
+        return d.id() == device_id;
+    });
+    if (it == m_devices.end()) {
+        LOGE("%s: Device not found", device_id.c_str());
+        return false;
+    }
+
+    FileInfo info;
+    info.set_input_path(std::move(input_path));
+    info.set_output_path(std::move(output_path));
+    info.set_device(*it);
+    info.set_rom_id(std::move(rom_id));
+
+    job_out = add_job(patcher_id, std::move(info));
+    return true;
+}
+
+/*!
+ * \brief Get number of jobs in the queue
+ */
+size_t PatchQueue::job_count() const
+{
+    return m_jobs.size();
+}
+
+/*!
+ * \brief Get current state of a job
+ */
+PatchJobState PatchQueue::job_state(size_t job) const
+{
+    assert(job < m_jobs.size());
+    std::lock_guard<std::mutex> lock(m_jobs_lock);
+    return m_jobs[job]->state;
+}
+
+/*!
+ * \brief Get error of a failed job
+ *
+ * \return ErrorCode (only valid if the job state is PatchJobState::Failed)
+ */
+ErrorCode PatchQueue::job_error(size_t job) const
+{
+    assert(job < m_jobs.size());
+    std::lock_guard<std::mutex> lock(m_jobs_lock);
+    return m_jobs[job]->error;
+}
+
+/*!
+ * \brief Get FileInfo of a job
+ */
+const FileInfo & PatchQueue::job_file_info(size_t job) const
+{
+    assert(job < m_jobs.size());
+    return m_jobs[job]->info;
+}
+
+/*!
+ * \brief Set callbacks for job progress
+ *
+ * \pre The queue must not be running.
+ *
+ * Any of the callbacks can be nullptr if they are not needed.
+ *
+ * \param progress_cb Callback for receiving current progress values of a job
+ * \param files_cb Callback for receiving current files count of a job
+ * \param details_cb Callback for receiving detailed progress text of a job
+ * \param state_cb Callback for receiving job state changes
+ * \param userdata Pointer to pass to callback functions
+ */
+void PatchQueue::set_callbacks(JobProgressCallback progress_cb,
+                               JobFilesCallback files_cb,
+                               JobDetailsCallback details_cb,
+                               JobStateCallback state_cb,
+                               void *userdata)
+{
+    assert(m_workers.empty());
+
+    m_progress_cb = progress_cb;
+    m_files_cb = files_cb;
+    m_details_cb = details_cb;
+    m_state_cb = state_cb;
+    m_userdata = userdata;
+}
+
+/*!
+ * \brief Start running the pending jobs
+ *
+ * This returns immediately. Use wait() to wait for the jobs to complete.
+ *
+ * \return Whether the workers were started. Returns false if the queue is
+ *         already running.
+ */
+bool PatchQueue::start()
+{
+    if (!m_workers.empty()) {
+        return false;
+    }
+
+    unsigned int workers = m_max_workers;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t n = std::min<size_t>(workers, m_jobs.size());
+
+    m_next_job = 0;
+    m_cancelled = false;
+
+    for (size_t i = 0; i < n; ++i) {
+        m_workers.emplace_back(&PatchQueue::worker, this);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Wait for all jobs to complete
+ *
+ * \return Whether every job in the queue succeeded
+ */
+bool PatchQueue::wait()
+{
+    for (auto &t : m_workers) {
+        t.join();
+    }
+    m_workers.clear();
+
+    std::lock_guard<std::mutex> lock(m_jobs_lock);
+
+    return std::all_of(m_jobs.begin(), m_jobs.end(),
+                       [](const std::unique_ptr<Job> &job) {
+        return job->state == PatchJobState::Succeeded;
+    });
+}
+
+/*!
+ * \brief Cancel a job
+ *
+ * If the job is pending, it will not be run. If the job is running, the
+ * patcher is asked to stop as soon as possible.
+ *
+ * \param job Index of job
+ */
+void PatchQueue::cancel_job(size_t job)
+{
+    assert(job < m_jobs.size());
+
+    bool was_pending = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_lock);
+        auto &j = *m_jobs[job];
+
+        if (j.state == PatchJobState::Pending) {
+            j.state = PatchJobState::Cancelled;
+            was_pending = true;
+        } else if (j.state == PatchJobState::Running) {
+            j.cancel_requested = true;
+            j.patcher->cancel_patching();
+        }
+    }
+
+    if (was_pending && m_state_cb) {
+        m_state_cb(job, PatchJobState::Cancelled, m_userdata);
+    }
+}
+
+/*!
+ * \brief Cancel all pending and running jobs
+ */
+void PatchQueue::cancel_all()
+{
+    m_cancelled = true;
+
+    for (size_t i = 0; i < m_jobs.size(); ++i) {
+        cancel_job(i);
+    }
+}
+
+void PatchQueue::worker()
+{
+    size_t index;
+
+    while (!m_cancelled && (index = m_next_job++) < m_jobs.size()) {
+        run_job(index);
+    }
+}
+
+void PatchQueue::run_job(size_t index)
+{
+    auto &job = *m_jobs[index];
+
+    auto *patcher = m_pc.create_patcher(job.patcher_id);
+    if (!patcher) {
+        LOGE("%s: Failed to create patcher", job.patcher_id.c_str());
+        set_job_state(index, PatchJobState::Failed,
+                      ErrorCode::PatcherCreateError);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_lock);
+
+        // Cancelled while waiting for a worker
+        if (job.state != PatchJobState::Pending) {
+            m_pc.destroy_patcher(patcher);
+            return;
+        }
+
+        job.state = PatchJobState::Running;
+        job.patcher = patcher;
+    }
+
+    if (m_state_cb) {
+        m_state_cb(index, PatchJobState::Running, m_userdata);
+    }
+
+    patcher->set_file_info(&job.info);
+
+    bool ret = patcher->patch_file(&progress_cb_wrapper, &files_cb_wrapper,
+                                   &details_cb_wrapper, &job);
+
+    PatchJobState state;
+    ErrorCode error = ErrorCode::NoError;
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_lock);
+
+        job.patcher = nullptr;
+
+        if (ret) {
+            state = PatchJobState::Succeeded;
+        } else if (job.cancel_requested) {
+            state = PatchJobState::Cancelled;
+        } else {
+            state = PatchJobState::Failed;
+            error = patcher->error();
+        }
+    }
+
+    m_pc.destroy_patcher(patcher);
+
+    set_job_state(index, state, error);
+}
+
+void PatchQueue::set_job_state(size_t index, PatchJobState state,
+                               ErrorCode error)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_lock);
+        m_jobs[index]->state = state;
+        m_jobs[index]->error = error;
+    }
+
+    if (m_state_cb) {
+        m_state_cb(index, state, m_userdata);
+    }
+}
+
+void PatchQueue::progress_cb_wrapper(uint64_t bytes, uint64_t max_bytes,
+                                     void *userdata)
+{
+    auto *job = static_cast<Job *>(userdata);
+    auto *queue = job->queue;
+
+    if (queue->m_progress_cb) {
+        queue->m_progress_cb(job->index, bytes, max_bytes, queue->m_userdata);
+    }
+}
+
+void PatchQueue::files_cb_wrapper(uint64_t files, uint64_t max_files,
+                                  void *userdata)
+{
+    auto *job = static_cast<Job *>(userdata);
+    auto *queue = job->queue;
+
+    if (queue->m_files_cb) {
+        queue->m_files_cb(job->index, files, max_files, queue->m_userdata);
+    }
+}
+
+void PatchQueue::details_cb_wrapper(const std::string &text, void *userdata)
+{
+    auto *job = static_cast<Job *>(userdata);
+    auto *queue = job->queue;
+
+    if (queue->m_details_cb) {
+        queue->m_details_cb(job->index, text, queue->m_userdata);
+    }
+}
+
+}
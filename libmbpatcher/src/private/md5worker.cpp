@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/md5worker.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class Md5Worker
+ *
+ * \brief MD5 hasher that runs on a background thread
+ *
+ * The data passed to update() is not copied. The caller keeps it alive and
+ * unmodified until wait() reports that it has been hashed. This allows hashing
+ * to overlap with reading the next buffer without any extra copies.
+ */
+
+Md5Worker::Md5Worker()
+    : m_stop(false)
+{
+    MD5_Init(&m_ctx);
+
+    m_thread = std::thread(&Md5Worker::worker, this);
+}
+
+Md5Worker::~Md5Worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_queue_cv.notify_one();
+    m_thread.join();
+}
+
+/*!
+ * \brief Queue data to be hashed
+ *
+ * \param data Data to hash. It must remain valid until it has been hashed.
+ * \param size Size of \p data
+ */
+void Md5Worker::update(const void *data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back({data, size});
+    }
+
+    m_queue_cv.notify_one();
+}
+
+/*!
+ * \brief Wait until at most \p max_pending chunks have not been hashed yet
+ *
+ * Chunks are hashed in the order they were queued, so the buffers of all but
+ * the last \p max_pending calls to update() can be reused afterwards.
+ */
+void Md5Worker::wait(size_t max_pending)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [&] {
+        return m_queue.size() <= max_pending;
+    });
+}
+
+/*!
+ * \brief Wait for all queued data to be hashed and get the digest
+ */
+Md5Worker::Digest Md5Worker::finish()
+{
+    wait(0);
+
+    Digest digest;
+    MD5_Final(digest.data(), &m_ctx);
+
+    return digest;
+}
+
+void Md5Worker::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_queue_cv.wait(lock, [&] {
+            return m_stop || !m_queue.empty();
+        });
+
+        if (m_stop) {
+            break;
+        }
+
+        // The chunk stays in the queue while it is being hashed so that
+        // wait() does not return early
+        Chunk chunk = m_queue.front();
+
+        lock.unlock();
+        MD5_Update(&m_ctx, chunk.data, chunk.size);
+        lock.lock();
+
+        m_queue.pop_front();
+        m_done_cv.notify_all();
+    }
+}
+
+}
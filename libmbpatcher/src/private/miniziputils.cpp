@@ -20,6 +20,7 @@
 #include "mbpatcher/private/miniziputils.h"
 
 #include <algorithm>
+#include <string_view>
 
 #include <cassert>
 #include <cerrno>
@@ -32,6 +33,7 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/locale.h"
 
@@ -70,6 +72,22 @@ struct ZipCtx
     void *handle;
 };
 
+/*!
+ * \brief Get minizip compression method ID for a CompressionMethod
+ */
+uint16_t MinizipUtils::zip_compression_method(CompressionMethod method)
+{
+    switch (method) {
+#if defined(MBPATCHER_HAVE_ZSTD) && defined(MZ_COMPRESS_METHOD_ZSTD)
+    case CompressionMethod::Zstd:
+        return MZ_COMPRESS_METHOD_ZSTD;
+#endif
+    case CompressionMethod::Deflate:
+    default:
+        return MZ_COMPRESS_METHOD_DEFLATE;
+    }
+}
+
 void * MinizipUtils::ctx_get_zip_handle(ZipCtx *ctx)
 {
     return ctx->handle;
@@ -124,6 +142,9 @@ ZipCtx * MinizipUtils::open_zip_file(std::string path, ZipOpenMode mode)
         file_mode = zip_mode = MZ_OPEN_MODE_READWRITE;
         file_mode |= MZ_OPEN_MODE_CREATE;
         break;
+    case ZipOpenMode::Append:
+        file_mode = zip_mode = MZ_OPEN_MODE_READWRITE | MZ_OPEN_MODE_APPEND;
+        break;
     default:
         return nullptr;
     }
@@ -301,6 +322,401 @@ bool MinizipUtils::copy_file_raw(void *source_handle,
     return true;
 }
 
+/*! \cond INTERNAL */
+
+static constexpr uint32_t ZIP_LOCAL_HEADER_SIG = 0x04034b50;
+static constexpr uint32_t ZIP_CD_HEADER_SIG = 0x02014b50;
+static constexpr uint32_t ZIP_EOCD_SIG = 0x06054b50;
+static constexpr uint32_t ZIP64_EOCD_LOCATOR_SIG = 0x07064b50;
+
+static constexpr size_t ZIP_LOCAL_HEADER_SIZE = 30;
+static constexpr size_t ZIP_CD_HEADER_SIZE = 46;
+static constexpr size_t ZIP_EOCD_SIZE = 22;
+static constexpr size_t ZIP64_EOCD_LOCATOR_SIZE = 20;
+
+static constexpr size_t BULK_COPY_BUF_SIZE = 1024 * 1024;
+
+struct RawEntry
+{
+    std::string name;
+    // Central directory record from the source zip
+    std::vector<unsigned char> cd_record;
+    // Start and end of the local header and data in the source zip
+    uint64_t begin;
+    uint64_t end;
+    uint64_t uncompressed_size;
+};
+
+static uint16_t get_le16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | static_cast<uint32_t>(p[1]) << 8
+            | static_cast<uint32_t>(p[2]) << 16
+            | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static void put_le16(unsigned char *p, uint16_t value)
+{
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+static bool read_at(StandardFile &file, uint64_t offset, void *buf, size_t size)
+{
+    return file.seek(static_cast<int64_t>(offset), SEEK_SET)
+            && file_read_exact(file, buf, size);
+}
+
+// Copy a range of the source file to the current position of the target file
+static bool copy_range(StandardFile &source, StandardFile &target,
+                       uint64_t offset, uint64_t size,
+                       std::vector<unsigned char> &buf)
+{
+    if (!source.seek(static_cast<int64_t>(offset), SEEK_SET)) {
+        return false;
+    }
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+
+        if (!file_read_exact(source, buf.data(), n)
+                || !file_write_exact(target, buf.data(), n)) {
+            return false;
+        }
+
+        size -= n;
+    }
+
+    return true;
+}
+
+// Read the central directory of a non-zip64 archive. If the archive uses zip64
+// or spans multiple disks, supported is set to false.
+static ErrorCode read_raw_entries(StandardFile &file,
+                                  std::vector<RawEntry> &entries,
+                                  bool &supported)
+{
+    supported = false;
+
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size) {
+        return ErrorCode::FileSeekError;
+    } else if (file_size.value() < ZIP_EOCD_SIZE) {
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    // The EOCD record is followed by a comment of up to 64 KiB
+    size_t tail_size = static_cast<size_t>(std::min<uint64_t>(
+            file_size.value(), ZIP_EOCD_SIZE + UINT16_MAX
+                    + ZIP64_EOCD_LOCATOR_SIZE));
+    uint64_t tail_offset = file_size.value() - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+
+    if (!read_at(file, tail_offset, tail.data(), tail.size())) {
+        return ErrorCode::FileReadError;
+    }
+
+    size_t eocd_pos = tail_size - ZIP_EOCD_SIZE;
+    while (get_le32(tail.data() + eocd_pos) != ZIP_EOCD_SIG) {
+        if (eocd_pos == 0) {
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+        --eocd_pos;
+    }
+
+    const unsigned char *eocd = tail.data() + eocd_pos;
+    uint16_t disk = get_le16(eocd + 4);
+    uint16_t cd_disk = get_le16(eocd + 6);
+    uint16_t disk_entries = get_le16(eocd + 8);
+    uint16_t total_entries = get_le16(eocd + 10);
+    uint32_t cd_size = get_le32(eocd + 12);
+    uint32_t cd_offset = get_le32(eocd + 16);
+
+    if (eocd_pos >= ZIP64_EOCD_LOCATOR_SIZE
+            && get_le32(eocd - ZIP64_EOCD_LOCATOR_SIZE)
+                    == ZIP64_EOCD_LOCATOR_SIG) {
+        return ErrorCode::NoError;
+    } else if (disk != 0 || cd_disk != 0 || disk_entries != total_entries
+            || total_entries == UINT16_MAX || cd_size == UINT32_MAX
+            || cd_offset == UINT32_MAX) {
+        return ErrorCode::NoError;
+    } else if (static_cast<uint64_t>(cd_offset) + cd_size > tail_offset + eocd_pos) {
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<unsigned char> cd(cd_size);
+    if (!read_at(file, cd_offset, cd.data(), cd.size())) {
+        return ErrorCode::FileReadError;
+    }
+
+    entries.clear();
+    entries.reserve(total_entries);
+
+    size_t pos = 0;
+
+    for (uint16_t i = 0; i < total_entries; ++i) {
+        if (cd.size() - pos < ZIP_CD_HEADER_SIZE
+                || get_le32(cd.data() + pos) != ZIP_CD_HEADER_SIG) {
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        const unsigned char *hdr = cd.data() + pos;
+        size_t record_size = ZIP_CD_HEADER_SIZE + get_le16(hdr + 28)
+                + get_le16(hdr + 30) + get_le16(hdr + 32);
+
+        if (cd.size() - pos < record_size) {
+            return ErrorCode::ArchiveReadHeaderError;
+        } else if (get_le32(hdr + 20) == UINT32_MAX
+                || get_le32(hdr + 24) == UINT32_MAX
+                || get_le16(hdr + 34) != 0
+                || get_le32(hdr + 42) == UINT32_MAX) {
+            return ErrorCode::NoError;
+        }
+
+        RawEntry entry;
+        entry.name.assign(reinterpret_cast<const char *>(hdr)
+                + ZIP_CD_HEADER_SIZE, get_le16(hdr + 28));
+        entry.cd_record.assign(hdr, hdr + record_size);
+        entry.begin = get_le32(hdr + 42);
+        entry.end = 0;
+        entry.uncompressed_size = get_le32(hdr + 24);
+
+        if (entry.begin >= cd_offset) {
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        entries.push_back(std::move(entry));
+        pos += record_size;
+    }
+
+    // Each local entry extends to the start of the next one (or the central
+    // directory). This includes the data descriptor, if there is one.
+    std::sort(entries.begin(), entries.end(),
+              [](const RawEntry &a, const RawEntry &b) {
+        return a.begin < b.begin;
+    });
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i].end = i + 1 < entries.size()
+                ? entries[i + 1].begin : cd_offset;
+    }
+
+    supported = true;
+    return ErrorCode::NoError;
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Copy compressed entries from one zip file to a new zip file
+ *
+ * Unlike copy_file_raw(), this does not go through minizip. The central
+ * directory of the source zip is read once and runs of consecutive local
+ * entries are copied with large sequential reads and writes. A new central
+ * directory is written with the entries' new offsets, so the target is a valid
+ * zip file. It can be opened with ZipOpenMode::Append to add more files.
+ *
+ * Only archives that do not use zip64 extensions are supported. If the source
+ * zip cannot be copied this way, \p stats.supported is set to false and the
+ * target file is not created. The caller should fall back to copy_file_raw().
+ *
+ * \param source_path Source zip file
+ * \param target_path Target zip file (will be overwritten)
+ * \param exclude Entries that should not be copied
+ * \param renames Entries that should be stored under a different name
+ * \param stats Result of the copy
+ * \param cb Progress callback (receives number of uncompressed bytes copied)
+ * \param userdata Data pointer for \p cb
+ *
+ * \return ErrorCode::NoError on success or if the source zip is unsupported.
+ *         Otherwise, the error code.
+ */
+ErrorCode MinizipUtils::bulk_copy_raw(const std::string &source_path,
+                                      const std::string &target_path,
+                                      const std::unordered_set<std::string> &exclude,
+                                      const std::unordered_map<std::string, std::string> &renames,
+                                      RawCopyStats &stats,
+                                      void (*cb)(uint64_t bytes, void *),
+                                      void *userdata)
+{
+    stats = {};
+
+    StandardFile source;
+    StandardFile target;
+
+    auto ret = FileUtils::open_file(source, source_path,
+                                    FileOpenMode::ReadOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             source_path.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    std::vector<RawEntry> entries;
+
+    auto result = read_raw_entries(source, entries, stats.supported);
+    if (result != ErrorCode::NoError) {
+        LOGE("%s: Failed to read central directory", source_path.c_str());
+        return result;
+    } else if (!stats.supported) {
+        LOGV("%s: Cannot bulk copy zip64 archive", source_path.c_str());
+        return ErrorCode::NoError;
+    }
+
+    ret = FileUtils::open_file(target, target_path,
+                               FileOpenMode::WriteOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for writing: %s",
+             target_path.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    std::vector<unsigned char> buf(BULK_COPY_BUF_SIZE);
+    std::vector<unsigned char> cd;
+    uint64_t out_offset = 0;
+    // Pending run of entries to be copied verbatim
+    uint64_t run_begin = 0;
+    uint64_t run_end = 0;
+    uint64_t run_size = 0;
+
+    auto flush_run = [&] {
+        if (run_end > run_begin) {
+            if (!copy_range(source, target, run_begin, run_end - run_begin,
+                            buf)) {
+                return false;
+            }
+
+            out_offset += run_end - run_begin;
+            stats.uncompressed_size += run_size;
+
+            if (cb) {
+                cb(stats.uncompressed_size, userdata);
+            }
+        }
+
+        run_begin = run_end = run_size = 0;
+        return true;
+    };
+
+    for (auto &entry : entries) {
+        if (exclude.find(entry.name) != exclude.end()) {
+            continue;
+        }
+
+        // Offsets in the new central directory must fit in 32 bits
+        if (out_offset + (run_end - run_begin) > UINT32_MAX) {
+            LOGE("%s: Zip file too large", target_path.c_str());
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        auto local_offset = static_cast<uint32_t>(
+                out_offset + (run_end - run_begin));
+        auto it = renames.find(entry.name);
+
+        if (it == renames.end()) {
+            if (run_end != entry.begin && !flush_run()) {
+                return ErrorCode::FileWriteError;
+            }
+            if (run_end == run_begin) {
+                run_begin = entry.begin;
+            }
+            run_end = entry.end;
+            run_size += entry.uncompressed_size;
+        } else {
+            if (!flush_run()) {
+                return ErrorCode::FileWriteError;
+            }
+
+            // Rewrite the local header with the new name
+            const std::string &name = it->second;
+            unsigned char hdr[ZIP_LOCAL_HEADER_SIZE];
+
+            if (!read_at(source, entry.begin, hdr, sizeof(hdr))
+                    || get_le32(hdr) != ZIP_LOCAL_HEADER_SIG) {
+                return ErrorCode::ArchiveReadHeaderError;
+            }
+
+            uint64_t data_offset = entry.begin + ZIP_LOCAL_HEADER_SIZE
+                    + get_le16(hdr + 26);
+            if (data_offset > entry.end || name.size() > UINT16_MAX) {
+                return ErrorCode::ArchiveReadHeaderError;
+            }
+
+            put_le16(hdr + 26, static_cast<uint16_t>(name.size()));
+
+            if (!file_write_exact(target, hdr, sizeof(hdr))
+                    || !file_write_exact(target, name.data(), name.size())
+                    || !copy_range(source, target, data_offset,
+                                   entry.end - data_offset, buf)) {
+                return ErrorCode::FileWriteError;
+            }
+
+            out_offset += sizeof(hdr) + name.size()
+                    + (entry.end - data_offset);
+            stats.uncompressed_size += entry.uncompressed_size;
+
+            // Central directory record with the new name
+            size_t old_name_size = get_le16(entry.cd_record.data() + 28);
+            entry.cd_record.erase(
+                    entry.cd_record.begin() + ZIP_CD_HEADER_SIZE,
+                    entry.cd_record.begin() + static_cast<ptrdiff_t>(
+                            ZIP_CD_HEADER_SIZE + old_name_size));
+            entry.cd_record.insert(
+                    entry.cd_record.begin() + ZIP_CD_HEADER_SIZE,
+                    name.begin(), name.end());
+            put_le16(entry.cd_record.data() + 28,
+                     static_cast<uint16_t>(name.size()));
+        }
+
+        put_le32(entry.cd_record.data() + 42, local_offset);
+        cd.insert(cd.end(), entry.cd_record.begin(), entry.cd_record.end());
+        ++stats.files;
+    }
+
+    if (!flush_run()) {
+        return ErrorCode::FileWriteError;
+    }
+
+    if (out_offset > UINT32_MAX || cd.size() > UINT32_MAX) {
+        LOGE("%s: Zip file too large", target_path.c_str());
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    unsigned char eocd[ZIP_EOCD_SIZE] = {};
+    put_le32(eocd, ZIP_EOCD_SIG);
+    put_le16(eocd + 8, static_cast<uint16_t>(stats.files));
+    put_le16(eocd + 10, static_cast<uint16_t>(stats.files));
+    put_le32(eocd + 12, static_cast<uint32_t>(cd.size()));
+    put_le32(eocd + 16, static_cast<uint32_t>(out_offset));
+
+    if (!file_write_exact(target, cd.data(), cd.size())
+            || !file_write_exact(target, eocd, sizeof(eocd))) {
+        return ErrorCode::FileWriteError;
+    }
+
+    ret = target.close();
+    if (!ret) {
+        LOGE("%s: Failed to close file: %s",
+             target_path.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileCloseError;
+    }
+
+    return ErrorCode::NoError;
+}
+
 bool MinizipUtils::read_to_memory(void *handle,
                                   std::vector<unsigned char> &output,
                                   void (*cb)(uint64_t bytes, void *),
@@ -355,6 +771,153 @@ bool MinizipUtils::read_to_memory(void *handle,
     return true;
 }
 
+/*!
+ * \brief Copy the current entry to a new entry, passing each line through a
+ *        filter
+ *
+ * The entry is decompressed and recompressed in chunks, so only the line being
+ * filtered needs to be kept in memory.
+ *
+ * \param source_handle Input zip with the entry to copy opened
+ * \param target_handle Output zip
+ * \param name Name of the new entry
+ * \param filter Function that is called with each line (without the trailing
+ *               newline)
+ *
+ * \return Whether the entry was copied. This fails if \p filter returns
+ *         AutoPatcher::LineResult::Error.
+ */
+bool MinizipUtils::filter_lines(void *source_handle,
+                                void *target_handle,
+                                const std::string &name,
+                                const LineFilter &filter,
+                                void (*cb)(uint64_t bytes, void *),
+                                void *userdata)
+{
+    mz_zip_file file_info = {};
+    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.filename = const_cast<char *>(name.c_str());
+    file_info.filename_size = static_cast<uint16_t>(name.size());
+
+    int ret = mz_zip_entry_read_open(source_handle, 0, nullptr);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to open inner file: %d", ret);
+        return false;
+    }
+
+    auto close_inner_read = finally([&] {
+        mz_zip_entry_close(source_handle);
+    });
+
+    ret = mz_zip_entry_write_open(target_handle, &file_info,
+                                  MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to open inner file: %d", ret);
+        return false;
+    }
+
+    auto close_inner_write = finally([&] {
+        mz_zip_entry_close(target_handle);
+    });
+
+    std::string line;
+    std::string out;
+
+    // Filter the line and append it to the output buffer
+    auto emit = [&](bool newline) {
+        switch (filter(line)) {
+        case AutoPatcher::LineResult::Keep:
+            out += line;
+            if (newline) {
+                out += '\n';
+            }
+            break;
+        case AutoPatcher::LineResult::Remove:
+            break;
+        case AutoPatcher::LineResult::Error:
+            return false;
+        }
+
+        line.clear();
+        return true;
+    };
+
+    auto flush = [&] {
+        if (!out.empty()) {
+            int n = mz_zip_entry_write(target_handle, out.data(),
+                                       static_cast<uint32_t>(out.size()));
+            if (n < 0 || static_cast<size_t>(n) != out.size()) {
+                LOGE("minizip: Failed to write inner file data");
+                return false;
+            }
+            out.clear();
+        }
+        return true;
+    };
+
+    int n;
+    char buf[UINT16_MAX];
+    uint64_t total = 0;
+
+    while ((n = mz_zip_entry_read(source_handle, buf, sizeof(buf))) > 0) {
+        total += static_cast<uint64_t>(n);
+        if (cb) {
+            cb(total, userdata);
+        }
+
+        std::string_view chunk(buf, static_cast<size_t>(n));
+
+        while (!chunk.empty()) {
+            auto pos = chunk.find('\n');
+            line += chunk.substr(0, pos);
+
+            if (pos == std::string_view::npos) {
+                break;
+            }
+
+            chunk.remove_prefix(pos + 1);
+
+            if (!emit(true)) {
+                return false;
+            }
+        }
+
+        if (out.size() >= sizeof(buf) && !flush()) {
+            return false;
+        }
+    }
+    if (n != 0) {
+        LOGE("minizip: Failed to read inner file");
+        return false;
+    }
+
+    if (!line.empty() && !emit(false)) {
+        return false;
+    }
+
+    if (!flush()) {
+        return false;
+    }
+
+    close_inner_read.dismiss();
+
+    ret = mz_zip_entry_close(source_handle);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to close inner file: %d", ret);
+        return false;
+    }
+
+    close_inner_write.dismiss();
+
+    ret = mz_zip_entry_close(target_handle);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to close inner file: %d", ret);
+        return false;
+    }
+
+    return true;
+}
+
 bool MinizipUtils::extract_file(void *handle, const std::string &directory)
 {
     mz_zip_file *file_info;
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/paralleldeflate.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "mbcommon/finally.h"
+
+
+namespace mb::patcher
+{
+
+// Same values as pigz
+static constexpr size_t BLOCK_SIZE = 128 * 1024;
+static constexpr size_t DICT_SIZE = 32 * 1024;
+
+/*!
+ * \class ParallelDeflate
+ *
+ * \brief Multithreaded raw deflate compressor
+ *
+ * Input data is split into fixed-size blocks that are compressed independently
+ * on a pool of worker threads. Each block is primed with the last 32 KiB of the
+ * previous block as the dictionary and all but the last block are terminated
+ * with a sync flush, so the concatenated output is a single valid deflate
+ * stream (without a zlib or gzip wrapper). The compressed data is passed to the
+ * write callback in order on the thread that calls write() and finish().
+ *
+ * The number of blocks in flight is bounded, so memory usage does not depend on
+ * the size of the input.
+ */
+
+/*!
+ * \brief Construct compressor and start worker threads
+ *
+ * \param threads Number of worker threads (0 for one per CPU core)
+ * \param level zlib compression level
+ * \param cb Function to call with the compressed data
+ */
+ParallelDeflate::ParallelDeflate(unsigned int threads, int level,
+                                 WriteCallback cb)
+    : m_level(level)
+    , m_cb(std::move(cb))
+    , m_stop(false)
+    , m_crc32(static_cast<uint32_t>(::crc32(0, nullptr, 0)))
+    , m_size(0)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    m_max_jobs = threads * 2;
+    m_block.reserve(BLOCK_SIZE);
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&ParallelDeflate::worker, this);
+    }
+}
+
+ParallelDeflate::~ParallelDeflate()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_queue.clear();
+    }
+
+    m_queue_cv.notify_all();
+
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+/*!
+ * \brief Compress data
+ *
+ * \param data Uncompressed data
+ * \param size Size of \p data
+ *
+ * \return Whether the data was successfully queued and all completed blocks
+ *         were written
+ */
+bool ParallelDeflate::write(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        size_t n = std::min(size, BLOCK_SIZE - m_block.size());
+        m_block.insert(m_block.end(), ptr, ptr + n);
+        ptr += n;
+        size -= n;
+
+        if (m_block.size() == BLOCK_SIZE && !submit(false)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress remaining data and terminate the deflate stream
+ *
+ * This blocks until all compressed data has been passed to the write callback.
+ *
+ * \return Whether all blocks were successfully compressed and written
+ */
+bool ParallelDeflate::finish()
+{
+    if (!submit(true)) {
+        return false;
+    }
+
+    while (!m_jobs.empty()) {
+        if (!write_oldest()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief CRC32 checksum of the uncompressed data that has been written so far
+ */
+uint32_t ParallelDeflate::crc32() const
+{
+    return m_crc32;
+}
+
+/*!
+ * \brief Size of the uncompressed data that has been written so far
+ */
+uint64_t ParallelDeflate::uncompressed_size() const
+{
+    return m_size;
+}
+
+void ParallelDeflate::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_queue_cv.wait(lock, [&] {
+            return m_stop || !m_queue.empty();
+        });
+
+        if (m_stop) {
+            return;
+        }
+
+        Job *job = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        bool ok = compress(*job, m_level);
+        lock.lock();
+
+        job->ok = ok;
+        job->done = true;
+        m_done_cv.notify_all();
+    }
+}
+
+bool ParallelDeflate::compress(Job &job, int level)
+{
+    z_stream strm = {};
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    auto end_stream = finally([&] {
+        deflateEnd(&strm);
+    });
+
+    if (!job.dict.empty() && deflateSetDictionary(
+            &strm, job.dict.data(), static_cast<uInt>(job.dict.size()))
+            != Z_OK) {
+        return false;
+    }
+
+    int flush = job.last ? Z_FINISH : Z_SYNC_FLUSH;
+
+    job.output.resize(deflateBound(&strm, static_cast<uLong>(job.input.size()))
+            + 16);
+
+    strm.next_in = job.input.data();
+    strm.avail_in = static_cast<uInt>(job.input.size());
+
+    while (true) {
+        strm.next_out = job.output.data() + strm.total_out;
+        strm.avail_out = static_cast<uInt>(job.output.size() - strm.total_out);
+
+        int ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return false;
+        } else if (job.last ? ret == Z_STREAM_END : strm.avail_out != 0) {
+            break;
+        }
+
+        // Output buffer was too small
+        job.output.resize(job.output.size() * 2);
+    }
+
+    job.output.resize(strm.total_out);
+    job.crc32 = static_cast<uint32_t>(::crc32(
+            0, job.input.data(), static_cast<uInt>(job.input.size())));
+
+    return true;
+}
+
+bool ParallelDeflate::submit(bool last)
+{
+    auto job = std::make_unique<Job>();
+    job->input.swap(m_block);
+    job->dict = m_dict;
+    job->crc32 = 0;
+    job->last = last;
+    job->done = false;
+    job->ok = false;
+
+    m_block.reserve(BLOCK_SIZE);
+
+    if (!last) {
+        size_t n = std::min(job->input.size(), DICT_SIZE);
+        m_dict.assign(job->input.end() - static_cast<ptrdiff_t>(n),
+                      job->input.end());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(job.get());
+        m_jobs.push_back(std::move(job));
+    }
+
+    m_queue_cv.notify_one();
+
+    while (m_jobs.size() >= m_max_jobs) {
+        if (!write_oldest()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ParallelDeflate::write_oldest()
+{
+    std::unique_ptr<Job> job;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [&] {
+            return m_jobs.front()->done;
+        });
+
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+    }
+
+    if (!job->ok) {
+        return false;
+    }
+
+    m_crc32 = static_cast<uint32_t>(crc32_combine(
+            m_crc32, job->crc32, static_cast<z_off_t>(job->input.size())));
+    m_size += job->input.size();
+
+    return m_cb(job->output.data(), job->output.size());
+}
+
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/private/progress.h"
+
+
+namespace mb::patcher
+{
+
+constexpr ProgressReporter::Clock::duration ProgressReporter::DEFAULT_INTERVAL;
+
+ProgressReporter::ProgressReporter()
+    : m_bytes(0)
+    , m_max_bytes(0)
+    , m_files(0)
+    , m_max_files(0)
+    , m_details_dirty(false)
+    , m_progress_cb(nullptr)
+    , m_files_cb(nullptr)
+    , m_details_cb(nullptr)
+    , m_userdata(nullptr)
+    , m_interval(DEFAULT_INTERVAL)
+    , m_next_dispatch()
+    , m_sent_bytes(0)
+    , m_sent_max_bytes(0)
+    , m_sent_files(0)
+    , m_sent_max_files(0)
+{
+}
+
+/*!
+ * \brief Reset values and set new callbacks
+ *
+ * Any of the callbacks can be nullptr if they are not needed.
+ */
+void ProgressReporter::reset(Patcher::ProgressUpdatedCallback progress_cb,
+                             Patcher::FilesUpdatedCallback files_cb,
+                             Patcher::DetailsUpdatedCallback details_cb,
+                             void *userdata)
+{
+    m_progress_cb = progress_cb;
+    m_files_cb = files_cb;
+    m_details_cb = details_cb;
+    m_userdata = userdata;
+
+    m_bytes = 0;
+    m_max_bytes = 0;
+    m_files = 0;
+    m_max_files = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_details_lock);
+        m_details.clear();
+        m_details_dirty = false;
+    }
+
+    m_next_dispatch = Clock::time_point();
+
+    m_sent_bytes = 0;
+    m_sent_max_bytes = 0;
+    m_sent_files = 0;
+    m_sent_max_files = 0;
+}
+
+/*!
+ * \brief Set minimum time between callback invocations
+ */
+void ProgressReporter::set_interval(Clock::duration interval)
+{
+    m_interval = interval;
+}
+
+void ProgressReporter::set_bytes(uint64_t bytes, uint64_t max_bytes)
+{
+    m_bytes.store(bytes, std::memory_order_relaxed);
+    m_max_bytes.store(max_bytes, std::memory_order_relaxed);
+    maybe_dispatch();
+}
+
+void ProgressReporter::set_files(uint64_t files, uint64_t max_files)
+{
+    m_files.store(files, std::memory_order_relaxed);
+    m_max_files.store(max_files, std::memory_order_relaxed);
+    maybe_dispatch();
+}
+
+void ProgressReporter::set_details(const std::string &details)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_details_lock);
+        m_details = details;
+        m_details_dirty = true;
+    }
+    maybe_dispatch();
+}
+
+/*!
+ * \brief Invoke the callbacks with the latest values, ignoring the interval
+ */
+void ProgressReporter::flush()
+{
+    dispatch();
+}
+
+uint64_t ProgressReporter::bytes() const
+{
+    return m_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::max_bytes() const
+{
+    return m_max_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::files() const
+{
+    return m_files.load(std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::max_files() const
+{
+    return m_max_files.load(std::memory_order_relaxed);
+}
+
+void ProgressReporter::maybe_dispatch()
+{
+    if (!m_progress_cb && !m_files_cb && !m_details_cb) {
+        return;
+    }
+
+    auto now = Clock::now();
+    if (now < m_next_dispatch) {
+        return;
+    }
+
+    m_next_dispatch = now + m_interval;
+    dispatch();
+}
+
+void ProgressReporter::dispatch()
+{
+    if (m_details_cb) {
+        std::string details;
+        bool dirty;
+
+        {
+            std::lock_guard<std::mutex> lock(m_details_lock);
+            dirty = m_details_dirty;
+            if (dirty) {
+                details = m_details;
+                m_details_dirty = false;
+            }
+        }
+
+        if (dirty) {
+            m_details_cb(details, m_userdata);
+        }
+    }
+
+    uint64_t bytes = this->bytes();
+    uint64_t max_bytes = this->max_bytes();
+    uint64_t files = this->files();
+    uint64_t max_files = this->max_files();
+
+    // Skip callbacks if nothing changed since the last dispatch
+    if (m_progress_cb
+            && (bytes != m_sent_bytes || max_bytes != m_sent_max_bytes)) {
+        m_progress_cb(bytes, max_bytes, m_userdata);
+        m_sent_bytes = bytes;
+        m_sent_max_bytes = max_bytes;
+    }
+
+    if (m_files_cb
+            && (files != m_sent_files || max_files != m_sent_max_files)) {
+        m_files_cb(files, max_files, m_userdata);
+        m_sent_files = files;
+        m_sent_max_files = max_files;
+    }
+}
+
+}
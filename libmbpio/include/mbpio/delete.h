@@ -27,5 +27,8 @@ namespace mb::io
 {
 
 MB_EXPORT bool delete_recursively(const std::string &path);
+MB_EXPORT bool delete_recursively_parallel(const std::string &path);
+MB_EXPORT void delete_recursively_async(const std::string &path);
+MB_EXPORT bool wait_for_async_deletes();
 
 }
@@ -27,5 +27,6 @@ namespace mb::io::win32
 {
 
 MB_EXPORT bool delete_recursively(const std::string &path);
+MB_EXPORT bool delete_recursively_parallel(const std::string &path);
 
 }
@@ -19,6 +19,13 @@
 
 #include "mbpio/delete.h"
 
+#include <condition_variable>
+#include <mutex>
+
+#include "mbcommon/thread_pool.h"
+
+#include "mbpio/error.h"
+
 #ifdef _WIN32
 #  include "mbpio/win32/delete.h"
 #else
@@ -37,4 +44,88 @@ bool delete_recursively(const std::string &path)
 #endif
 }
 
+/*!
+ * \brief Recursively delete a path using the process-wide thread pool
+ *
+ * Each directory is listed on one thread and then its files (in batches) and
+ * subdirectories are deleted in parallel. Symlinks are deleted, not followed.
+ * This is mainly useful on Windows, where deleting a file can be slow due to
+ * antivirus hooks.
+ *
+ * \return Whether the path was deleted. If false, the first error encountered
+ *         is available from last_error_string().
+ */
+bool delete_recursively_parallel(const std::string &path)
+{
+#ifdef _WIN32
+    return win32::delete_recursively_parallel(path);
+#else
+    return posix::delete_recursively_parallel(path);
+#endif
+}
+
+static std::mutex g_async_mutex;
+static std::condition_variable g_async_cv;
+static size_t g_async_pending = 0;
+static bool g_async_failed = false;
+static std::string g_async_error;
+
+/*!
+ * \brief Delete a path with delete_recursively_parallel() in the background
+ *
+ * This returns immediately. Use wait_for_async_deletes() to wait for the
+ * deletion to complete and to check if it succeeded.
+ */
+void delete_recursively_async(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_async_mutex);
+        ++g_async_pending;
+    }
+
+    ThreadPool::global().submit([path] {
+        bool ret = delete_recursively_parallel(path);
+
+        {
+            std::lock_guard<std::mutex> lock(g_async_mutex);
+
+            if (!ret && !g_async_failed) {
+                g_async_failed = true;
+                g_async_error = last_error_string();
+            }
+
+            --g_async_pending;
+        }
+
+        g_async_cv.notify_all();
+    });
+}
+
+/*!
+ * \brief Wait for all deletions started by delete_recursively_async()
+ *
+ * \note This must not be called from a task running on the process-wide
+ *       thread pool.
+ *
+ * \return Whether every deletion since the last call succeeded. If false, the
+ *         first error is available from last_error_string().
+ */
+bool wait_for_async_deletes()
+{
+    std::unique_lock<std::mutex> lock(g_async_mutex);
+
+    g_async_cv.wait(lock, [] {
+        return g_async_pending == 0;
+    });
+
+    if (g_async_failed) {
+        set_last_error(Error::PlatformError, std::move(g_async_error));
+        g_async_failed = false;
+        g_async_error.clear();
+        return false;
+    }
+
+    return true;
+}
+
 }
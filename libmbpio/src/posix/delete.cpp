@@ -19,12 +19,21 @@
 
 #include "mbpio/posix/delete.h"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <cerrno>
 #include <cstring>
 
+#include <dirent.h>
 #include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 
 #include "mbpio/error.h"
 
@@ -51,4 +60,137 @@ bool delete_recursively(const std::string &path)
     return nftw(path.c_str(), _delete_cb, 64, FTW_DEPTH | FTW_PHYS) == 0;
 }
 
+// Number of files removed by each task
+static constexpr size_t FILES_PER_TASK = 64;
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+namespace
+{
+
+// The error is thread-local, so the first failure on any worker is saved here
+// and reported on the calling thread
+struct ParallelDeleteState
+{
+    std::mutex mutex;
+    bool failed = false;
+    std::string error;
+
+    void fail(std::string message)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+            failed = true;
+            error = std::move(message);
+        }
+    }
+};
+
+}
+
+static void _delete_files(const std::vector<std::string> &paths, size_t begin,
+                          size_t end, ParallelDeleteState &state)
+{
+    for (size_t i = begin; i < end; ++i) {
+        if (unlink(paths[i].c_str()) < 0 && errno != ENOENT) {
+            state.fail(mb::format("%s: Failed to remove: %s",
+                                  paths[i].c_str(), strerror(errno)));
+        }
+    }
+}
+
+static void _delete_tree(ThreadPool &pool, const std::string &path,
+                         ParallelDeleteState &state)
+{
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+
+    {
+        ScopedDIR dir(opendir(path.c_str()), &closedir);
+        if (!dir) {
+            state.fail(mb::format("%s: Failed to open directory: %s",
+                                  path.c_str(), strerror(errno)));
+            return;
+        }
+
+        dirent *ent;
+
+        while ((errno = 0, ent = readdir(dir.get()))) {
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            std::string child(path);
+            child += '/';
+            child += ent->d_name;
+
+            bool is_dir = ent->d_type == DT_DIR;
+
+            if (ent->d_type == DT_UNKNOWN) {
+                struct stat sb;
+                is_dir = lstat(child.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+            }
+
+            (is_dir ? dirs : files).push_back(std::move(child));
+        }
+
+        if (errno != 0) {
+            state.fail(mb::format("%s: Failed to read directory: %s",
+                                  path.c_str(), strerror(errno)));
+            return;
+        }
+    }
+
+    // The directory is closed before recursing so that deep trees do not use
+    // up all of the file descriptors
+    {
+        TaskGroup group(pool);
+
+        for (size_t i = 0; i < files.size(); i += FILES_PER_TASK) {
+            group.run([&, i] {
+                _delete_files(files, i, std::min(i + FILES_PER_TASK,
+                                                 files.size()), state);
+            });
+        }
+
+        for (auto const &d : dirs) {
+            group.run([&] {
+                _delete_tree(pool, d, state);
+            });
+        }
+
+        group.wait();
+    }
+
+    if (rmdir(path.c_str()) < 0) {
+        state.fail(mb::format("%s: Failed to remove: %s",
+                              path.c_str(), strerror(errno)));
+    }
+}
+
+bool delete_recursively_parallel(const std::string &path)
+{
+    struct stat sb;
+
+    if (lstat(path.c_str(), &sb) < 0) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to stat: %s", path.c_str(), strerror(errno)));
+        return false;
+    } else if (!S_ISDIR(sb.st_mode)) {
+        return _delete_cb(path.c_str(), &sb, FTW_F, nullptr) == 0;
+    }
+
+    ParallelDeleteState state;
+
+    _delete_tree(ThreadPool::global(), path, state);
+
+    if (state.failed) {
+        set_last_error(Error::PlatformError, std::move(state.error));
+        return false;
+    }
+
+    return true;
+}
+
 }
@@ -21,12 +21,16 @@
 
 #include <windows.h>
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 
 #include "mbpio/error.h"
 
@@ -44,12 +48,12 @@ static bool _win32_recursive_delete(const std::wstring &path)
 
     // First, delete the contents of the directory, recursively for subdirectories
     HANDLE _search_handle = FindFirstFileExW(
-        mask.c_str(),           // lpFileName
-        FindExInfoBasic,        // fInfoLevelId
-        &find_data,             // lpFindFileData
-        FindExSearchNameMatch,  // fSearchOp
-        nullptr,                // lpSearchFilter
-        0                       // dwAdditionalFlags
+        mask.c_str(),               // lpFileName
+        FindExInfoBasic,            // fInfoLevelId
+        &find_data,                 // lpFindFileData
+        FindExSearchNameMatch,      // fSearchOp
+        nullptr,                    // lpSearchFilter
+        FIND_FIRST_EX_LARGE_FETCH   // dwAdditionalFlags
     );
     if (_search_handle == INVALID_HANDLE_VALUE) {
         DWORD error = GetLastError();
@@ -122,4 +126,169 @@ bool delete_recursively(const std::string &path)
     return _win32_recursive_delete(w_path.value());
 }
 
+// Number of files removed by each task
+static constexpr size_t FILES_PER_TASK = 64;
+
+namespace
+{
+
+// The error is thread-local, so the first failure on any worker is saved here
+// and reported on the calling thread
+struct ParallelDeleteState
+{
+    std::mutex mutex;
+    bool failed = false;
+    std::string error;
+
+    void fail(const char *func, DWORD error_code)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+            failed = true;
+            error = mb::format("%s failed: %s", func,
+                               mb::ec_from_win32(error_code).message().c_str());
+        }
+    }
+};
+
+}
+
+static void _win32_delete_files(const std::vector<std::wstring> &paths,
+                                size_t begin, size_t end,
+                                ParallelDeleteState &state)
+{
+    for (size_t i = begin; i < end; ++i) {
+        if (!DeleteFileW(paths[i].c_str())) {
+            DWORD error = GetLastError();
+            if (error != ERROR_FILE_NOT_FOUND) {
+                state.fail("DeleteFileW()", error);
+            }
+        }
+    }
+}
+
+static void _win32_delete_tree(ThreadPool &pool, const std::wstring &path,
+                               ParallelDeleteState &state)
+{
+    std::vector<std::wstring> files;
+    std::vector<std::wstring> dirs;
+
+    {
+        std::wstring mask(path);
+        mask += L"\\*";
+
+        WIN32_FIND_DATAW find_data;
+
+        HANDLE _search_handle = FindFirstFileExW(
+            mask.c_str(),               // lpFileName
+            FindExInfoBasic,            // fInfoLevelId
+            &find_data,                 // lpFindFileData
+            FindExSearchNameMatch,      // fSearchOp
+            nullptr,                    // lpSearchFilter
+            FIND_FIRST_EX_LARGE_FETCH   // dwAdditionalFlags
+        );
+        if (_search_handle == INVALID_HANDLE_VALUE) {
+            DWORD error = GetLastError();
+            if (error != ERROR_FILE_NOT_FOUND) {
+                state.fail("FindFirstFileExW()", error);
+                return;
+            }
+        } else {
+            ScopedFindHandle search_handle(_search_handle, &FindClose);
+
+            while (true) {
+                if (wcscmp(find_data.cFileName, L".") != 0
+                        && wcscmp(find_data.cFileName, L"..") != 0) {
+                    std::wstring child_path(path);
+                    child_path += L'\\';
+                    child_path += find_data.cFileName;
+
+                    // Directory symlinks and junctions are removed without
+                    // deleting the contents of their targets
+                    if (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+                        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                            if (!RemoveDirectoryW(child_path.c_str())) {
+                                state.fail("RemoveDirectoryW()", GetLastError());
+                            }
+                        } else {
+                            files.push_back(std::move(child_path));
+                        }
+                    } else if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                        dirs.push_back(std::move(child_path));
+                    } else {
+                        files.push_back(std::move(child_path));
+                    }
+                }
+
+                if (!FindNextFileW(search_handle.get(), &find_data)) {
+                    DWORD error = GetLastError();
+                    if (error != ERROR_NO_MORE_FILES) {
+                        state.fail("FindNextFileW()", error);
+                        return;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // The search handle is closed before recursing so that the directory is
+    // not held open while its children are deleted
+    {
+        TaskGroup group(pool);
+
+        for (size_t i = 0; i < files.size(); i += FILES_PER_TASK) {
+            group.run([&, i] {
+                _win32_delete_files(files, i, std::min(i + FILES_PER_TASK,
+                                                       files.size()), state);
+            });
+        }
+
+        for (auto const &d : dirs) {
+            group.run([&] {
+                _win32_delete_tree(pool, d, state);
+            });
+        }
+
+        group.wait();
+    }
+
+    if (!RemoveDirectoryW(path.c_str())) {
+        state.fail("RemoveDirectoryW()", GetLastError());
+    }
+}
+
+bool delete_recursively_parallel(const std::string &path)
+{
+    auto w_path = mb::utf8_to_wcs(path);
+
+    if (!w_path) {
+        return false;
+    }
+
+    DWORD attrs = GetFileAttributesW(w_path.value().c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES) {
+        DWORD error = GetLastError();
+        set_last_error(Error::PlatformError, mb::format(
+                "GetFileAttributesW() failed: %s",
+                mb::ec_from_win32(error).message().c_str()));
+        return false;
+    } else if (!(attrs & FILE_ATTRIBUTE_DIRECTORY)
+            || (attrs & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        // Same as the sequential version for anything but a plain directory
+        return _win32_recursive_delete(w_path.value());
+    }
+
+    ParallelDeleteState state;
+
+    _win32_delete_tree(ThreadPool::global(), w_path.value(), state);
+
+    if (state.failed) {
+        set_last_error(Error::PlatformError, std::move(state.error));
+        return false;
+    }
+
+    return true;
+}
+
 }
@@ -22,6 +22,8 @@
 #include "mbcommon/common.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <openssl/evp.h>
 
@@ -38,6 +40,12 @@ enum class KeyFormat
     Pkcs12,
 };
 
+struct SignFile
+{
+    std::string path;
+    std::string sig_path;
+};
+
 MB_EXPORT Result<ScopedEVP_PKEY>
 load_private_key(BIO &bio_key, KeyFormat format, const char *pass);
 MB_EXPORT Result<ScopedEVP_PKEY>
@@ -53,4 +61,8 @@ sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey);
 MB_EXPORT Result<void>
 verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey);
 
+MB_EXPORT std::vector<Result<void>>
+sign_files(const std::vector<SignFile> &files, EVP_PKEY &pkey,
+           unsigned int threads = 0);
+
 }
@@ -19,11 +19,22 @@
 
 #include "mbsign/sign.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <cstring>
 
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #ifdef __clang__
 #  pragma GCC diagnostic push
 #  if __has_warning("-Wold-style-cast")
@@ -65,6 +76,8 @@ template <typename T>
 using ScopedMallocable = std::unique_ptr<T, decltype(free) *>;
 
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
+using ScopedEVP_PKEY_CTX =
+        std::unique_ptr<EVP_PKEY_CTX, decltype(EVP_PKEY_CTX_free) *>;
 using ScopedPKCS12 = std::unique_ptr<PKCS12, decltype(PKCS12_free) *>;
 
 /*!
@@ -296,6 +309,37 @@ load_public_key_from_file(const char *file, KeyFormat format, const char *pass)
     return load_public_key(*bio_key, format, pass);
 }
 
+/*!
+ * \brief Write signature header and signature to stream
+ *
+ * \param bio_sig_out Output stream for signature
+ * \param version Signature version
+ * \param sig Signature
+ * \param sig_len Size of \a sig
+ *
+ * \return Whether the signature was successfully written
+ */
+static Result<void>
+write_signature(BIO &bio_sig_out, uint32_t version, const unsigned char *sig,
+                size_t sig_len)
+{
+    SigHeader hdr = {};
+    memcpy(hdr.magic, MAGIC, MAGIC_SIZE);
+    hdr.version = version;
+
+    if (BIO_write(&bio_sig_out, &hdr, static_cast<int>(sizeof(hdr)))
+            != static_cast<int>(sizeof(hdr))) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    if (BIO_write(&bio_sig_out, sig, static_cast<int>(sig_len))
+            != static_cast<int>(sig_len)) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Sign data from stream
  *
@@ -375,22 +419,7 @@ Result<void> sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey)
         return ErrorInfo{Error::OpensslError, true};
     }
 
-    // Write header
-    SigHeader hdr = {};
-    memcpy(hdr.magic, MAGIC, MAGIC_SIZE);
-    hdr.version = version;
-
-    if (BIO_write(&bio_sig_out, &hdr, static_cast<int>(sizeof(hdr)))
-            != static_cast<int>(sizeof(hdr))) {
-        return ErrorInfo{Error::IoError, true};
-    }
-
-    if (BIO_write(&bio_sig_out, buf.get(), static_cast<int>(len))
-            != static_cast<int>(len)) {
-        return ErrorInfo{Error::IoError, true};
-    }
-
-    return oc::success();
+    return write_signature(bio_sig_out, version, buf.get(), len);
 }
 
 /*!
@@ -505,4 +534,219 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
     }
 }
 
+/*!
+ * \brief Compute the message digest of a file
+ *
+ * The file is mapped into memory where possible so that it can be hashed
+ * without copying it through a small read buffer.
+ *
+ * \param[in] path Input file
+ * \param[in] md_type Digest algorithm
+ * \param[out] digest Output digest (must be at least EVP_MAX_MD_SIZE bytes)
+ * \param[out] digest_len Size of output digest
+ *
+ * \return Whether the file was successfully hashed
+ */
+static Result<void>
+digest_file(const char *path, const EVP_MD *md_type, unsigned char *digest,
+            unsigned int &digest_len)
+{
+    EVP_MD_CTX *mctx = EVP_MD_CTX_create();
+    if (!mctx) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    auto free_ctx = finally([&mctx] {
+        EVP_MD_CTX_destroy(mctx);
+    });
+
+    if (!EVP_DigestInit_ex(mctx, md_type, nullptr)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    auto close_fd = finally([&fd] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    // mmap() does not accept an empty mapping
+    if (sb.st_size > 0) {
+        auto size = static_cast<size_t>(sb.st_size);
+
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return ErrorInfo{Error::IoError, false};
+        }
+
+        auto unmap = finally([&map, &size] {
+            munmap(map, size);
+        });
+
+        madvise(map, size, MADV_SEQUENTIAL);
+
+        if (!EVP_DigestUpdate(mctx, map, size)) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+    }
+#else
+    ScopedBIO bio_in(BIO_new_file(path, "rb"), BIO_free);
+    if (!bio_in) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    constexpr size_t buf_size = 1024 * 1024;
+    std::vector<unsigned char> buf(buf_size);
+
+    while (true) {
+        int n = BIO_read(bio_in.get(), buf.data(),
+                         static_cast<int>(buf.size()));
+        if (n < 0) {
+            return ErrorInfo{Error::IoError, true};
+        }
+        if (n == 0) {
+            break;
+        }
+        if (!EVP_DigestUpdate(mctx, buf.data(), static_cast<size_t>(n))) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+    }
+#endif
+
+    if (!EVP_DigestFinal_ex(mctx, digest, &digest_len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Sign a precomputed message digest and write the signature to a file
+ *
+ * This produces the same signature as sign_data() does for the file contents.
+ *
+ * \param digest Message digest of the data
+ * \param digest_len Size of \a digest
+ * \param sig_path Output signature file
+ * \param pkey Private key
+ *
+ * \return Whether the signing operation was successful
+ */
+static Result<void>
+sign_digest_to_file(const unsigned char *digest, size_t digest_len,
+                    const char *sig_path, EVP_PKEY &pkey)
+{
+    constexpr unsigned int version = VERSION_LATEST;
+
+    ScopedEVP_PKEY_CTX pctx(EVP_PKEY_CTX_new(&pkey, nullptr),
+                            EVP_PKEY_CTX_free);
+    if (!pctx) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (EVP_PKEY_sign_init(pctx.get()) <= 0
+            || EVP_PKEY_CTX_set_signature_md(pctx.get(), EVP_sha512()) <= 0) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    size_t len = 0;
+    if (EVP_PKEY_sign(pctx.get(), nullptr, &len, digest, digest_len) <= 0) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    std::vector<unsigned char> sig(len);
+    if (EVP_PKEY_sign(pctx.get(), sig.data(), &len, digest, digest_len) <= 0) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    ScopedBIO bio_sig_out(BIO_new_file(sig_path, "wb"), BIO_free);
+    if (!bio_sig_out) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    OUTCOME_TRYV(write_signature(*bio_sig_out, version, sig.data(), len));
+
+    if (!BIO_free(bio_sig_out.release())) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Sign several files with the same private key
+ *
+ * The files are hashed in parallel and the digests are then signed on the
+ * calling thread. The private key only needs to be loaded once for the whole
+ * batch.
+ *
+ * \param files List of input files and their output signature files
+ * \param pkey Private key
+ * \param threads Number of threads to use for hashing (0 = number of CPUs)
+ *
+ * \return Result of the signing operation for each entry in \a files
+ */
+std::vector<Result<void>>
+sign_files(const std::vector<SignFile> &files, EVP_PKEY &pkey,
+           unsigned int threads)
+{
+    // Only one signature version exists, so every file is hashed with SHA-512
+    static_assert(VERSION_LATEST == VERSION_1_SHA512_DGST,
+                  "Digest algorithm must match signature version");
+
+    struct Digest
+    {
+        unsigned char data[EVP_MAX_MD_SIZE];
+        unsigned int size;
+    };
+
+    std::vector<Digest> digests(files.size());
+    std::vector<Result<void>> results(files.size(), oc::success());
+    std::atomic_size_t next(0);
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            results[i] = digest_file(files[i].path.c_str(), EVP_sha512(),
+                                     digests[i].data, digests[i].size);
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, files.size()));
+
+    std::vector<std::thread> pool;
+
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &t : pool) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (results[i]) {
+            results[i] = sign_digest_to_file(
+                    digests[i].data, digests[i].size,
+                    files[i].sig_path.c_str(), pkey);
+        }
+    }
+
+    return results;
+}
+
 }
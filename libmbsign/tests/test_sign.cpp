@@ -21,6 +21,8 @@
 
 #include <memory>
 
+#include <cstdio>
+
 #include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -173,3 +175,57 @@ TEST(SignTest, TestLoadValidPemKeysWithInvalidPassphrase)
     auto private_key_read = load_private_key(*bio, KeyFormat::Pem, "gnitset");
     ASSERT_FALSE(private_key_read);
 }
+
+TEST(SignTest, TestSignFiles)
+{
+    ScopedEVP_PKEY private_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key(nullptr, EVP_PKEY_free);
+
+    // Generate keys
+    generate_keys(private_key, public_key);
+
+    char dir_template[] = "/tmp/mbsign_test_XXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    std::string dir(dir_template);
+
+    std::vector<SignFile> files;
+    for (size_t i = 0; i < 4; ++i) {
+        std::string path = dir + "/file" + std::to_string(i);
+
+        FILE *fp = fopen(path.c_str(), "wb");
+        ASSERT_NE(fp, nullptr);
+        // Include an empty file
+        for (size_t j = 0; j < i * 100000; ++j) {
+            fputc(static_cast<int>(j % 251), fp);
+        }
+        ASSERT_EQ(fclose(fp), 0);
+
+        files.push_back({path, path + ".sig"});
+    }
+    files.push_back({dir + "/missing", dir + "/missing.sig"});
+
+    auto results = sign_files(files, *private_key, 2);
+    ASSERT_EQ(results.size(), files.size());
+    ASSERT_FALSE(results.back());
+    ASSERT_EQ(results.back().error().ec, Error::IoError);
+
+    for (size_t i = 0; i + 1 < files.size(); ++i) {
+        ASSERT_TRUE(results[i]) << files[i].path;
+
+        ScopedBIO bio_data(BIO_new_file(files[i].path.c_str(), "rb"),
+                           BIO_free);
+        ASSERT_TRUE(!!bio_data);
+        ScopedBIO bio_sig(BIO_new_file(files[i].sig_path.c_str(), "rb"),
+                          BIO_free);
+        ASSERT_TRUE(!!bio_sig);
+
+        ASSERT_TRUE(verify_data(*bio_data, *bio_sig, *public_key))
+                << files[i].path;
+    }
+
+    for (auto const &f : files) {
+        remove(f.path.c_str());
+        remove(f.sig_path.c_str());
+    }
+    remove(dir.c_str());
+}
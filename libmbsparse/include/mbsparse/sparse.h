@@ -47,6 +47,18 @@ public:
     // File size
     uint64_t size();
 
+    // CRC32 validation
+    void set_crc32_validation(bool enabled);
+
+    // Holes
+    oc::result<uint64_t> skip_hole();
+
+    // Chunk index
+    oc::result<std::vector<detail::ChunkInfo>> chunks();
+    oc::result<void> build_chunk_index();
+    oc::result<std::vector<unsigned char>> chunk_index();
+    oc::result<void> load_chunk_index(const void *data, size_t size);
+
 protected:
     oc::result<void> on_open() override;
     oc::result<void> on_close() override;
@@ -76,12 +88,20 @@ private:
 
     oc::result<void> move_to_chunk(uint64_t offset);
 
+    void update_crc32(const void *buf, uint64_t size);
+
     File *m_file;
     detail::Seekability m_seekability;
 
-    // Expected CRC32 checksum. We currently do *not* validate this. It would
-    // only work if the entire file was read sequentially anyway.
+    // Whether CRC32 chunks should be validated
+    bool m_validate_crc32;
+    // Expected CRC32 checksum from the last CRC32 chunk
     uint32_t m_expected_crc32;
+    // CRC32 checksum of the output data before m_crc32_offset. This is only
+    // kept up to date while the file is read sequentially.
+    uint32_t m_crc32;
+    uint64_t m_crc32_offset;
+    bool m_crc32_sequential;
     // Relative offset in input file
     uint64_t m_cur_src_offset;
     // Absolute offset in output file
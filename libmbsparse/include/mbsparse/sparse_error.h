@@ -42,8 +42,20 @@ enum class SparseFileError
     InvalidFillChunk            = 34,
     InvalidSkipChunk            = 35,
     InvalidCrc32Chunk           = 36,
+    Crc32Mismatch               = 37,
 
     InternalError               = 40,
+
+    // Chunk index errors
+    InvalidChunkIndex           = 50,
+    ChunkIndexMismatch          = 51,
+
+    // Writer errors
+    InvalidBlockSize            = 60,
+    TooManyBlocks               = 61,
+
+    // Verification errors
+    VerifyMismatch              = 70,
 };
 
 MB_EXPORT std::error_code make_error_code(SparseFileError e);
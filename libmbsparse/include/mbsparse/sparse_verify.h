@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse.h"
+
+namespace mb::sparse
+{
+
+using DigestUpdateFn = std::function<oc::result<void>(const void *data,
+                                                      size_t size)>;
+
+MB_EXPORT oc::result<void> digest_expanded(SparseFile &sparse_file,
+                                           const DigestUpdateFn &update);
+
+MB_EXPORT oc::result<void> verify_expanded(SparseFile &sparse_file,
+                                           File &target_file);
+
+}
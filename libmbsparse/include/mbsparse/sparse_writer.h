@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse_p.h"
+
+namespace mb::sparse
+{
+
+constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    SparseWriter();
+    SparseWriter(File *file, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~SparseWriter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    void clear();
+
+    oc::result<void> wwrite(const void *buf, size_t size);
+    oc::result<void> wseek(uint64_t offset);
+
+    oc::result<void> write_sparse_header();
+    oc::result<void> write_chunk_header(uint16_t type, uint32_t blocks,
+                                        uint32_t data_size);
+
+    oc::result<void> add_block(const unsigned char *data);
+    oc::result<void> add_skip_blocks(uint64_t blocks);
+    oc::result<void> finish_chunk();
+    oc::result<void> finish();
+
+    File *m_file;
+    uint32_t m_block_size;
+
+    // Offset of the sparse header in the output file
+    uint64_t m_base_offset;
+    // Offset in output file
+    uint64_t m_cur_out_offset;
+    // Absolute offset in the (non-sparse) input data
+    uint64_t m_cur_offset;
+
+    // Buffer for the partially written block
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Chunk that can still be extended by the next block
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    uint32_t m_chunk_fill_val;
+    uint64_t m_chunk_out_offset;
+
+    uint32_t m_total_blocks;
+    uint32_t m_total_chunks;
+};
+
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/crc32.h"
+
+#include <array>
+
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#endif
+
+#include "mbcommon/endian.h"
+
+namespace mb::sparse
+{
+
+/*! \cond INTERNAL */
+
+#if !defined(__ARM_FEATURE_CRC32)
+// Reflected 802.3 polynomial
+constexpr uint32_t CRC32_POLYNOMIAL = 0xedb88320;
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr Crc32Tables make_crc32_tables()
+{
+    Crc32Tables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        tables[0][i] = crc;
+    }
+
+    for (size_t t = 1; t < tables.size(); ++t) {
+        for (size_t i = 0; i < 256; ++i) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+static constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+#endif
+
+/*! \endcond */
+
+/*!
+ * \brief Update CRC32 checksum
+ *
+ * This computes the standard 802.3 CRC32 checksum, which is the same as zlib's
+ * `crc32()`. The ARMv8 CRC32 instructions are used if the compiler targets
+ * them. Otherwise, a slicing-by-8 table implementation is used.
+ *
+ * \param crc Checksum of the previous data or 0 for the first call
+ * \param buf Data
+ * \param size Size of \p buf
+ *
+ * \return Updated checksum
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    crc = ~crc;
+
+#if defined(__ARM_FEATURE_CRC32)
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+        uint64_t value;
+        memcpy(&value, ptr, sizeof(value));
+        crc = __crc32d(crc, mb_htole64(value));
+        ptr += sizeof(value);
+    }
+
+    for (; size > 0; --size) {
+        crc = __crc32b(crc, *ptr++);
+    }
+#else
+    auto const &t = CRC32_TABLES;
+
+    for (; size >= 8; size -= 8) {
+        uint32_t lo = crc ^ (static_cast<uint32_t>(ptr[0])
+                | static_cast<uint32_t>(ptr[1]) << 8
+                | static_cast<uint32_t>(ptr[2]) << 16
+                | static_cast<uint32_t>(ptr[3]) << 24);
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+                ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                ^ t[3][ptr[4]] ^ t[2][ptr[5]] ^ t[1][ptr[6]] ^ t[0][ptr[7]];
+        ptr += 8;
+    }
+
+    for (; size > 0; --size) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *ptr++) & 0xff];
+    }
+#endif
+
+    return ~crc;
+}
+
+}
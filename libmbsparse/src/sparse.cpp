@@ -35,6 +35,7 @@
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
+#include "mbsparse/crc32.h"
 #include "mbsparse/sparse_error.h"
 
 // Enable debug logging of headers, offsets, etc.?
@@ -85,6 +86,28 @@ static void fix_chunk_header_byte_order(ChunkHeader &header)
     header.total_sz = mb_le32toh(header.total_sz);
 }
 
+template<typename T>
+static void index_put(std::vector<unsigned char> &buf, T value)
+{
+    // Little endian regardless of host byte order
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        buf.push_back(static_cast<unsigned char>(value >> (i * 8)));
+    }
+}
+
+template<typename T>
+static T index_get(const unsigned char *&ptr)
+{
+    T value = 0;
+
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value = static_cast<T>(value | static_cast<T>(
+                static_cast<T>(*ptr++) << (i * 8)));
+    }
+
+    return value;
+}
+
 #if SPARSE_DEBUG
 static void dump_sparse_header(const SparseHeader &header)
 {
@@ -129,6 +152,16 @@ static void dump_chunk_header(const ChunkHeader &header)
 
 /*! \cond INTERNAL */
 
+constexpr unsigned char CHUNK_INDEX_MAGIC[] = {
+    'M', 'B', 'S', 'P', 'I', 'D', 'X', 1
+};
+
+// Magic + sparse header fields
+constexpr size_t CHUNK_INDEX_HEADER_SIZE =
+        sizeof(CHUNK_INDEX_MAGIC) + 4 + 2 + 2 + 2 + 2 + 4 + 4 + 4 + 4;
+// Type + fill value + 6 offsets
+constexpr size_t CHUNK_INDEX_ENTRY_SIZE = 2 + 4 + 6 * 8;
+
 struct OffsetComp
 {
     bool operator()(uint64_t offset, const ChunkInfo &chunk) const
@@ -158,6 +191,7 @@ struct OffsetComp
  */
 SparseFile::SparseFile()
     : File()
+    , m_validate_crc32(false)
 {
     clear();
 }
@@ -187,7 +221,11 @@ SparseFile::SparseFile(SparseFile &&other) noexcept
     : File(std::move(other))
     , m_file(other.m_file)
     , m_seekability(other.m_seekability)
+    , m_validate_crc32(other.m_validate_crc32)
     , m_expected_crc32(other.m_expected_crc32)
+    , m_crc32(other.m_crc32)
+    , m_crc32_offset(other.m_crc32_offset)
+    , m_crc32_sequential(other.m_crc32_sequential)
     , m_cur_src_offset(other.m_cur_src_offset)
     , m_cur_tgt_offset(other.m_cur_tgt_offset)
     , m_file_size(other.m_file_size)
@@ -206,7 +244,11 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
 
     m_file = rhs.m_file;
     m_seekability = rhs.m_seekability;
+    m_validate_crc32 = rhs.m_validate_crc32;
     m_expected_crc32 = rhs.m_expected_crc32;
+    m_crc32 = rhs.m_crc32;
+    m_crc32_offset = rhs.m_crc32_offset;
+    m_crc32_sequential = rhs.m_crc32_sequential;
     m_cur_src_offset = rhs.m_cur_src_offset;
     m_cur_tgt_offset = rhs.m_cur_tgt_offset;
     m_file_size = rhs.m_file_size;
@@ -253,6 +295,261 @@ uint64_t SparseFile::size()
     return m_file_size;
 }
 
+/*!
+ * \brief Enable or disable CRC32 validation
+ *
+ * When enabled, the checksum of the output data is computed while the sparse
+ * file is read and compared against every CRC32 chunk that is encountered. The
+ * checksum can only be tracked while reading sequentially from the beginning
+ * of the file. Once the file is seeked to a different offset, the remaining
+ * CRC32 chunks are not validated.
+ *
+ * This setting is preserved when the file is closed.
+ *
+ * \param enabled Whether to validate CRC32 chunks
+ */
+void SparseFile::set_crc32_validation(bool enabled)
+{
+    m_validate_crc32 = enabled;
+}
+
+/*!
+ * \brief Skip over "don't care" region at the current offset
+ *
+ * If the current offset is inside a "don't care" chunk, the offset is moved to
+ * the end of the chunk without producing any data. This allows callers to
+ * seek their output instead of writing zeros for regions whose contents do not
+ * matter. Unlike seek(), this works regardless of whether the underlying file
+ * supports seeking because "don't care" chunks have no data in the source file.
+ *
+ * \return Number of bytes skipped, which is 0 if the current offset is not in a
+ *         "don't care" chunk. Otherwise, the error code.
+ */
+oc::result<uint64_t> SparseFile::skip_hole()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end() || m_chunk->type != CHUNK_TYPE_DONT_CARE) {
+        return 0;
+    }
+
+    uint64_t skipped = m_chunk->end - m_cur_tgt_offset;
+    if (m_validate_crc32) {
+        // "Don't care" regions are counted as zeros in the checksum
+        update_crc32(nullptr, skipped);
+    }
+    m_cur_tgt_offset = m_chunk->end;
+
+    return skipped;
+}
+
+/*!
+ * \brief Read all chunk headers
+ *
+ * Normally, chunk headers are read on demand as the sparse file is read or
+ * seeked. This function reads all remaining chunk headers up front so that
+ * every later seek is a binary search over the chunk table. Only the chunk
+ * headers are read. The raw data is skipped.
+ *
+ * \note This requires the underlying file to support random seeking.
+ *
+ * \return Nothing if all chunk headers are successfully read. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseFile::build_chunk_index()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // No chunk contains the end of the file, so this reads every chunk header
+    return move_to_chunk(m_file_size);
+}
+
+/*!
+ * \brief Get information about all chunks
+ *
+ * The chunk table is built with build_chunk_index() if needed.
+ *
+ * \return List of chunks in the order they appear in the sparse file if
+ *         successful. Otherwise, the error code.
+ */
+oc::result<std::vector<ChunkInfo>> SparseFile::chunks()
+{
+    OUTCOME_TRYV(build_chunk_index());
+
+    return m_chunks;
+}
+
+/*!
+ * \brief Get serialized chunk index
+ *
+ * The chunk table is built with build_chunk_index() if needed and then
+ * serialized to a byte array. It can be passed to load_chunk_index() when the
+ * same sparse file is opened again to avoid rereading the chunk headers.
+ *
+ * \return Serialized chunk index if successful. Otherwise, the error code.
+ */
+oc::result<std::vector<unsigned char>> SparseFile::chunk_index()
+{
+    OUTCOME_TRYV(build_chunk_index());
+
+    std::vector<unsigned char> buf;
+    buf.reserve(CHUNK_INDEX_HEADER_SIZE
+            + m_chunks.size() * CHUNK_INDEX_ENTRY_SIZE);
+
+    buf.insert(buf.end(), std::begin(CHUNK_INDEX_MAGIC),
+               std::end(CHUNK_INDEX_MAGIC));
+    index_put(buf, m_shdr.magic);
+    index_put(buf, m_shdr.major_version);
+    index_put(buf, m_shdr.minor_version);
+    index_put(buf, m_shdr.file_hdr_sz);
+    index_put(buf, m_shdr.chunk_hdr_sz);
+    index_put(buf, m_shdr.blk_sz);
+    index_put(buf, m_shdr.total_blks);
+    index_put(buf, m_shdr.total_chunks);
+    index_put(buf, m_shdr.image_checksum);
+
+    for (auto const &ci : m_chunks) {
+        index_put(buf, ci.type);
+        index_put(buf, ci.fill_val);
+        index_put(buf, ci.begin);
+        index_put(buf, ci.end);
+        index_put(buf, ci.src_begin);
+        index_put(buf, ci.src_end);
+        index_put(buf, ci.raw_begin);
+        index_put(buf, ci.raw_end);
+    }
+
+    return buf;
+}
+
+/*!
+ * \brief Load chunk index produced by chunk_index()
+ *
+ * The index must have been created from the same sparse file. The sparse
+ * header stored in the index must match the opened file's header and the
+ * chunk ranges must be consistent with each other. Nothing is changed if
+ * validation fails.
+ *
+ * \note This requires the underlying file to support random seeking.
+ *
+ * \param data Serialized chunk index
+ * \param size Size of \p data
+ *
+ * \return
+ *   * Nothing if the index is successfully loaded
+ *   * SparseFileError::ChunkIndexMismatch if the index belongs to a different
+ *     sparse file
+ *   * SparseFileError::InvalidChunkIndex if the index is malformed
+ *   * FileError::UnsupportedSeek if the underlying file cannot seek
+ */
+oc::result<void> SparseFile::load_chunk_index(const void *data, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    if (size < CHUNK_INDEX_HEADER_SIZE
+            || memcmp(ptr, CHUNK_INDEX_MAGIC, sizeof(CHUNK_INDEX_MAGIC)) != 0) {
+        return SparseFileError::InvalidChunkIndex;
+    }
+    ptr += sizeof(CHUNK_INDEX_MAGIC);
+
+    SparseHeader shdr;
+    shdr.magic = index_get<uint32_t>(ptr);
+    shdr.major_version = index_get<uint16_t>(ptr);
+    shdr.minor_version = index_get<uint16_t>(ptr);
+    shdr.file_hdr_sz = index_get<uint16_t>(ptr);
+    shdr.chunk_hdr_sz = index_get<uint16_t>(ptr);
+    shdr.blk_sz = index_get<uint32_t>(ptr);
+    shdr.total_blks = index_get<uint32_t>(ptr);
+    shdr.total_chunks = index_get<uint32_t>(ptr);
+    shdr.image_checksum = index_get<uint32_t>(ptr);
+
+    if (shdr.magic != m_shdr.magic
+            || shdr.major_version != m_shdr.major_version
+            || shdr.minor_version != m_shdr.minor_version
+            || shdr.file_hdr_sz != m_shdr.file_hdr_sz
+            || shdr.chunk_hdr_sz != m_shdr.chunk_hdr_sz
+            || shdr.blk_sz != m_shdr.blk_sz
+            || shdr.total_blks != m_shdr.total_blks
+            || shdr.total_chunks != m_shdr.total_chunks
+            || shdr.image_checksum != m_shdr.image_checksum) {
+        return SparseFileError::ChunkIndexMismatch;
+    }
+
+    if ((size - CHUNK_INDEX_HEADER_SIZE) / CHUNK_INDEX_ENTRY_SIZE
+                    != shdr.total_chunks
+            || (size - CHUNK_INDEX_HEADER_SIZE) % CHUNK_INDEX_ENTRY_SIZE != 0) {
+        return SparseFileError::InvalidChunkIndex;
+    }
+
+    std::vector<ChunkInfo> chunks;
+    chunks.reserve(shdr.total_chunks);
+
+    uint64_t tgt_offset = 0;
+    uint64_t src_offset = m_shdr.file_hdr_sz;
+
+    for (uint32_t i = 0; i < shdr.total_chunks; ++i) {
+        ChunkInfo ci;
+        ci.type = index_get<uint16_t>(ptr);
+        ci.fill_val = index_get<uint32_t>(ptr);
+        ci.begin = index_get<uint64_t>(ptr);
+        ci.end = index_get<uint64_t>(ptr);
+        ci.src_begin = index_get<uint64_t>(ptr);
+        ci.src_end = index_get<uint64_t>(ptr);
+        ci.raw_begin = index_get<uint64_t>(ptr);
+        ci.raw_end = index_get<uint64_t>(ptr);
+
+        // Chunks must be contiguous in both the source and output files
+        if (ci.begin != tgt_offset || ci.end < ci.begin
+                || ci.end > m_file_size || ci.src_begin != src_offset
+                || ci.src_end < ci.src_begin) {
+            return SparseFileError::InvalidChunkIndex;
+        }
+
+        switch (ci.type) {
+        case CHUNK_TYPE_RAW:
+            if (ci.raw_begin < ci.src_begin || ci.raw_end > ci.src_end
+                    || ci.raw_end - ci.raw_begin != ci.end - ci.begin) {
+                return SparseFileError::InvalidChunkIndex;
+            }
+            break;
+        case CHUNK_TYPE_FILL:
+        case CHUNK_TYPE_DONT_CARE:
+        case CHUNK_TYPE_CRC32:
+            break;
+        default:
+            return SparseFileError::InvalidChunkIndex;
+        }
+
+        tgt_offset = ci.end;
+        src_offset = ci.src_end;
+
+        chunks.push_back(ci);
+    }
+
+    if (tgt_offset != m_file_size) {
+        return SparseFileError::InvalidChunkIndex;
+    }
+
+    m_chunks = std::move(chunks);
+    m_chunk = m_chunks.end();
+
+    return oc::success();
+}
+
 /*!
  * \brief Open sparse file for reading
  *
@@ -427,15 +724,18 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
                 shifted[i] = reinterpret_cast<unsigned char *>(&fill_val)
                         [(i + shift) % sizeof(uint32_t)];
             }
-            unsigned char *temp_buf = reinterpret_cast<unsigned char *>(buf);
-            while (to_read > 0) {
-                size_t to_write = std::min<size_t>(
-                        sizeof(shifted), static_cast<size_t>(to_read));
-                memcpy(temp_buf, &shifted, to_write);
-                n_read += to_write;
-                to_read -= to_write;
-                temp_buf += to_write;
+            // Write the pattern once and then keep doubling the filled region
+            // so that most of the work is done by large memcpy() calls
+            auto temp_buf = reinterpret_cast<unsigned char *>(buf);
+            auto len = static_cast<size_t>(to_read);
+            size_t filled = std::min(sizeof(shifted), len);
+            memcpy(temp_buf, &shifted, filled);
+            while (filled < len) {
+                size_t to_copy = std::min(filled, len - filled);
+                memcpy(temp_buf + filled, temp_buf, to_copy);
+                filled += to_copy;
             }
+            n_read = to_read;
             break;
         }
         case CHUNK_TYPE_DONT_CARE:
@@ -447,6 +747,9 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
         }
 
         OPER("Read %" PRIu64 " bytes", n_read);
+        if (m_validate_crc32) {
+            update_crc32(buf, n_read);
+        }
         total_read += n_read;
         m_cur_tgt_offset += n_read;
         size -= static_cast<size_t>(n_read);
@@ -522,6 +825,9 @@ void SparseFile::clear()
 {
     m_file = nullptr;
     m_expected_crc32 = 0;
+    m_crc32 = 0;
+    m_crc32_offset = 0;
+    m_crc32_sequential = true;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
     m_file_size = 0;
@@ -685,7 +991,7 @@ SparseFile::process_raw_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidRawChunk;
     }
 
-    ChunkInfo ci;
+    ChunkInfo ci = {};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -728,7 +1034,7 @@ SparseFile::process_fill_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
 
     uint64_t src_end = m_cur_src_offset;
 
-    ChunkInfo ci;
+    ChunkInfo ci = {};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -762,7 +1068,7 @@ SparseFile::process_skip_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidSkipChunk;
     }
 
-    ChunkInfo ci;
+    ChunkInfo ci = {};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -778,6 +1084,8 @@ SparseFile::process_skip_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
  *
  * This function will check the following properties:
  *   * Chunk data size is 4 bytes (`sizeof(uint32_t)`)
+ *   * Checksum matches the data read so far (only if CRC32 validation is
+ *     enabled and the data was read sequentially)
  *
  * \param chdr Chunk header
  * \param tgt_offset Offset of the output file
@@ -806,13 +1114,22 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
 
     m_expected_crc32 = mb_le32toh(crc32);
 
-    ChunkInfo ci;
+    // The checksum covers all of the output data before this chunk. It can
+    // only be checked if all of that data was read in order.
+    if (m_validate_crc32 && m_crc32_sequential && m_crc32_offset == tgt_offset
+            && m_crc32 != m_expected_crc32) {
+        DEBUG("Expected CRC32 0x%08" PRIx32 ", but have 0x%08" PRIx32,
+              m_expected_crc32, m_crc32);
+        return SparseFileError::Crc32Mismatch;
+    }
+
+    ChunkInfo ci = {};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = m_cur_src_offset - data_size - m_shdr.chunk_hdr_sz;
+    ci.src_end = m_cur_src_offset;
 
     return std::move(ci);
 }
@@ -869,6 +1186,37 @@ SparseFile::process_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
  *
  * \return Nothing unless an error occurs
  */
+/*!
+ * \brief Add output data at the current offset to the CRC32 checksum
+ *
+ * \param buf Output data or nullptr for zeros
+ * \param size Size of output data
+ */
+void SparseFile::update_crc32(const void *buf, uint64_t size)
+{
+    if (!m_crc32_sequential) {
+        return;
+    } else if (m_crc32_offset != m_cur_tgt_offset) {
+        DEBUG("Non-sequential read; disabling CRC32 validation");
+        m_crc32_sequential = false;
+        return;
+    }
+
+    if (buf) {
+        m_crc32 = crc32_update(m_crc32, buf, static_cast<size_t>(size));
+    } else {
+        static constexpr unsigned char zeros[4096] = {};
+
+        for (uint64_t remain = size; remain > 0;) {
+            auto n = std::min<uint64_t>(remain, sizeof(zeros));
+            m_crc32 = crc32_update(m_crc32, zeros, static_cast<size_t>(n));
+            remain -= n;
+        }
+    }
+
+    m_crc32_offset += size;
+}
+
 oc::result<void> SparseFile::move_to_chunk(uint64_t offset)
 {
     // No action needed if the offset is in the current chunk
@@ -61,8 +61,20 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'skip' chunk";
     case SparseFileError::InvalidCrc32Chunk:
         return "invalid 'crc32' chunk";
+    case SparseFileError::Crc32Mismatch:
+        return "CRC32 checksum mismatch";
     case SparseFileError::InternalError:
         return "(internal error)";
+    case SparseFileError::InvalidChunkIndex:
+        return "invalid chunk index";
+    case SparseFileError::ChunkIndexMismatch:
+        return "chunk index does not match sparse file";
+    case SparseFileError::InvalidBlockSize:
+        return "invalid block size";
+    case SparseFileError::TooManyBlocks:
+        return "too many blocks";
+    case SparseFileError::VerifyMismatch:
+        return "data does not match sparse file";
     default:
         return "(unknown sparse file error)";
     }
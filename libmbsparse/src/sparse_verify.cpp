@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_verify.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse_error.h"
+
+namespace mb::sparse
+{
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+constexpr size_t PATTERN_BUF_SIZE = 256 * 1024;
+
+// Buffer holding a repeated fill value. The buffer is only rewritten when the
+// fill value changes, so runs of the same value (usually zeros) cost nothing
+// beyond feeding the already expanded buffer to the consumer.
+class PatternBuffer
+{
+public:
+    PatternBuffer() : m_buf(PATTERN_BUF_SIZE), m_valid(false), m_value(0)
+    {
+    }
+
+    const unsigned char * get(uint32_t value)
+    {
+        if (!m_valid || value != m_value) {
+            uint32_t le_value = mb_htole32(value);
+            size_t filled = sizeof(le_value);
+            memcpy(m_buf.data(), &le_value, filled);
+            while (filled < m_buf.size()) {
+                size_t to_copy = std::min(filled, m_buf.size() - filled);
+                memcpy(m_buf.data() + filled, m_buf.data(), to_copy);
+                filled += to_copy;
+            }
+            m_valid = true;
+            m_value = value;
+        }
+
+        return m_buf.data();
+    }
+
+    size_t size() const
+    {
+        return m_buf.size();
+    }
+
+private:
+    std::vector<unsigned char> m_buf;
+    bool m_valid;
+    uint32_t m_value;
+};
+
+static oc::result<void> seek_to(File &file, uint64_t offset)
+{
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+    return oc::success();
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Feed the expanded contents of a sparse file to a digest
+ *
+ * This produces the same data stream as reading \p sparse_file from start to
+ * finish, but the chunk list is used to avoid reading and expanding data that
+ * is not stored in the image. Only raw chunks are read from the underlying
+ * file. Fill and "don't care" chunks (which expand to zeros) are passed to
+ * \p update from a single pre-expanded pattern buffer.
+ *
+ * The digest itself is opaque to this function. For example, to compute a
+ * SHA-512 hash, \p update would call `SHA512_Update()`.
+ *
+ * \note The underlying file must be seekable.
+ *
+ * \param sparse_file Opened sparse file
+ * \param update Function to call with each run of expanded data, in order
+ *
+ * \return Nothing on success or the error code on failure. If \p update returns
+ *         an error, that error is returned.
+ */
+oc::result<void> digest_expanded(SparseFile &sparse_file,
+                                 const DigestUpdateFn &update)
+{
+    OUTCOME_TRY(chunks, sparse_file.chunks());
+
+    PatternBuffer pattern;
+    std::vector<unsigned char> buf(PATTERN_BUF_SIZE);
+
+    for (auto const &chunk : chunks) {
+        uint64_t remain = chunk.end - chunk.begin;
+
+        switch (chunk.type) {
+        case CHUNK_TYPE_RAW: {
+            OUTCOME_TRYV(seek_to(sparse_file, chunk.begin));
+
+            while (remain > 0) {
+                auto to_read = static_cast<size_t>(
+                        std::min<uint64_t>(remain, buf.size()));
+
+                OUTCOME_TRY(n, file_read_retry(sparse_file, buf.data(),
+                                               to_read));
+                if (n != to_read) {
+                    return FileError::UnexpectedEof;
+                }
+
+                OUTCOME_TRYV(update(buf.data(), n));
+                remain -= n;
+            }
+            break;
+        }
+
+        case CHUNK_TYPE_FILL:
+        case CHUNK_TYPE_DONT_CARE: {
+            auto data = pattern.get(
+                    chunk.type == CHUNK_TYPE_FILL ? chunk.fill_val : 0);
+
+            while (remain > 0) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(remain, pattern.size()));
+                OUTCOME_TRYV(update(data, n));
+                remain -= n;
+            }
+            break;
+        }
+
+        default:
+            // CRC32 chunks have no data
+            break;
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Verify that a file matches the expanded contents of a sparse file
+ *
+ * This is meant for checking a partition after a sparse image has been flashed
+ * to it. Only the regions that the image actually defines are read back from
+ * \p target_file:
+ *
+ * - Raw chunks are compared against the data in the sparse image
+ * - Fill chunks are compared against the fill pattern
+ * - "Don't care" chunks are skipped since their contents are undefined on the
+ *   target
+ *
+ * \note Both \p sparse_file and \p target_file must be seekable.
+ *
+ * \param sparse_file Opened sparse file
+ * \param target_file File (usually a block device) to check
+ *
+ * \return
+ *   * Nothing if the data matches
+ *   * SparseFileError::VerifyMismatch if the data does not match
+ *   * FileError::UnexpectedEof if \p target_file is too small
+ *   * Otherwise, the error code from reading either file
+ */
+oc::result<void> verify_expanded(SparseFile &sparse_file, File &target_file)
+{
+    OUTCOME_TRY(chunks, sparse_file.chunks());
+
+    PatternBuffer pattern;
+    std::vector<unsigned char> expected(PATTERN_BUF_SIZE);
+    std::vector<unsigned char> actual(PATTERN_BUF_SIZE);
+
+    for (auto const &chunk : chunks) {
+        if (chunk.type != CHUNK_TYPE_RAW && chunk.type != CHUNK_TYPE_FILL) {
+            continue;
+        }
+
+        uint64_t remain = chunk.end - chunk.begin;
+
+        OUTCOME_TRYV(seek_to(target_file, chunk.begin));
+        if (chunk.type == CHUNK_TYPE_RAW) {
+            OUTCOME_TRYV(seek_to(sparse_file, chunk.begin));
+        }
+
+        while (remain > 0) {
+            auto to_read = static_cast<size_t>(
+                    std::min<uint64_t>(remain, actual.size()));
+            const unsigned char *expected_data;
+
+            if (chunk.type == CHUNK_TYPE_RAW) {
+                OUTCOME_TRY(n, file_read_retry(sparse_file, expected.data(),
+                                               to_read));
+                if (n != to_read) {
+                    return FileError::UnexpectedEof;
+                }
+                expected_data = expected.data();
+            } else {
+                expected_data = pattern.get(chunk.fill_val);
+            }
+
+            OUTCOME_TRY(n, file_read_retry(target_file, actual.data(),
+                                           to_read));
+            if (n != to_read) {
+                return FileError::UnexpectedEof;
+            }
+
+            if (memcmp(expected_data, actual.data(), to_read) != 0) {
+                return SparseFileError::VerifyMismatch;
+            }
+
+            remain -= to_read;
+        }
+    }
+
+    return oc::success();
+}
+
+}
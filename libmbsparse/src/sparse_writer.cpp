@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse_error.h"
+
+namespace mb::sparse
+{
+using namespace mb::detail;
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+// Raw chunks are limited by the 32-bit total_sz field
+static uint32_t max_chunk_blocks(uint16_t type, uint32_t block_size)
+{
+    if (type == CHUNK_TYPE_RAW) {
+        return static_cast<uint32_t>(
+                (UINT32_MAX - sizeof(ChunkHeader)) / block_size);
+    } else {
+        return UINT32_MAX;
+    }
+}
+
+// Whether the non-sparse data fits in the 32-bit total_blks field
+static bool size_fits(uint64_t size, uint32_t block_size)
+{
+    return size / block_size + (size % block_size != 0) <= UINT32_MAX;
+}
+
+/*! \endcond */
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write Android sparse file image.
+ *
+ * Data written to this file is split into blocks. Each block is stored as a raw
+ * block unless it consists of a single repeating 32-bit value, in which case it
+ * is stored as a fill block. Adjacent blocks of the same kind are merged into a
+ * single chunk. Seeking forward creates a hole, which is stored as a "don't
+ * care" chunk. Seeking backwards is not supported.
+ *
+ * If the data size is not a multiple of the block size, the last block is
+ * padded with zeros.
+ *
+ * The underlying file must support random seeking because the sparse header
+ * and the raw chunk headers are written after the data they describe.
+ */
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file for writing from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, uint32_t)
+ *
+ * \param file File to write to
+ * \param block_size Block size
+ */
+SparseWriter::SparseWriter(File *file, uint32_t block_size)
+    : SparseWriter()
+{
+    (void) open(file, block_size);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open sparse file for writing from File handle.
+ *
+ * The sparse image is written starting at the current position of \p file.
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * \param file File to write to
+ * \param block_size Block size. Must be a non-zero multiple of 4.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::open(File *file, uint32_t block_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_block_size = block_size;
+    }
+
+    return File::open();
+}
+
+oc::result<void> SparseWriter::on_open()
+{
+    if (!m_file->is_open()) {
+        return FileError::InvalidState;
+    } else if (m_block_size == 0 || m_block_size % 4 != 0) {
+        return SparseFileError::InvalidBlockSize;
+    }
+
+    OUTCOME_TRY(offset, m_file->seek(0, SEEK_CUR));
+
+    m_base_offset = offset;
+    m_cur_out_offset = offset;
+    m_block.resize(m_block_size);
+
+    // Reserve space for the sparse header. It is rewritten when the file is
+    // closed and the totals are known.
+    return write_sparse_header();
+}
+
+/*!
+ * \brief Finish writing sparse file
+ *
+ * The partial last block and the current chunk are flushed and the sparse
+ * header is updated.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if the sparse file is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::on_close()
+{
+    oc::result<void> ret = oc::success();
+
+    // Nothing can be salvaged after a failed write
+    if (!is_fatal()) {
+        ret = finish();
+    }
+
+    // Reset to allow opening another file
+    clear();
+
+    return ret;
+}
+
+/*!
+ * \brief Write to sparse file
+ *
+ * \param buf Buffer to write from
+ * \param size Number of bytes to write
+ *
+ * \return \p size if the data is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<size_t> SparseWriter::on_write(const void *buf, size_t size)
+{
+    if (m_cur_offset > UINT64_MAX - size
+            || !size_fits(m_cur_offset + size, m_block_size)) {
+        return SparseFileError::TooManyBlocks;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(buf);
+    size_t remaining = size;
+
+    // Complete the partial block first
+    if (m_block_used > 0) {
+        size_t n = std::min(remaining, m_block_size - m_block_used);
+        memcpy(m_block.data() + m_block_used, ptr, n);
+        m_block_used += n;
+        ptr += n;
+        remaining -= n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(add_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    // Whole blocks don't need to be copied
+    for (; remaining >= m_block_size; remaining -= m_block_size) {
+        OUTCOME_TRYV(add_block(ptr));
+        ptr += m_block_size;
+    }
+
+    if (remaining > 0) {
+        memcpy(m_block.data(), ptr, remaining);
+        m_block_used = remaining;
+    }
+
+    m_cur_offset += size;
+
+    return size;
+}
+
+/*!
+ * \brief Seek sparse file
+ *
+ * Only seeking forward is supported. Whole blocks that are skipped are stored
+ * as "don't care" chunks. Skipped bytes in partial blocks are filled with
+ * zeros.
+ *
+ * \param offset Offset to seek
+ * \param whence SEEK_SET, SEEK_CUR, or SEEK_END
+ *
+ * \return New offset of sparse file if the seeking was successful. Otherwise,
+ *         the error code.
+ */
+oc::result<uint64_t> SparseWriter::on_seek(int64_t offset, int whence)
+{
+    uint64_t new_offset;
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_offset = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+    case SEEK_END:
+        // The file size is always the current offset
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > m_cur_offset)
+                || (offset > 0 && m_cur_offset
+                        >= UINT64_MAX - static_cast<uint64_t>(offset))) {
+            return FileError::IntegerOverflow;
+        }
+        new_offset = m_cur_offset + static_cast<uint64_t>(offset);
+        break;
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    if (new_offset < m_cur_offset) {
+        return FileError::UnsupportedSeek;
+    } else if (!size_fits(new_offset, m_block_size)) {
+        return SparseFileError::TooManyBlocks;
+    }
+
+    uint64_t gap = new_offset - m_cur_offset;
+
+    if (m_block_used > 0 && gap > 0) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(gap, m_block_size - m_block_used));
+        memset(m_block.data() + m_block_used, 0, n);
+        m_block_used += n;
+        gap -= n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(add_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    if (gap >= m_block_size) {
+        OUTCOME_TRYV(add_skip_blocks(gap / m_block_size));
+        gap %= m_block_size;
+    }
+
+    if (gap > 0) {
+        memset(m_block.data(), 0, static_cast<size_t>(gap));
+        m_block_used = static_cast<size_t>(gap);
+    }
+
+    m_cur_offset = new_offset;
+
+    return new_offset;
+}
+
+void SparseWriter::clear()
+{
+    m_file = nullptr;
+    m_block_size = DEFAULT_BLOCK_SIZE;
+    m_base_offset = 0;
+    m_cur_out_offset = 0;
+    m_cur_offset = 0;
+    m_block.clear();
+    m_block_used = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_out_offset = 0;
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+}
+
+oc::result<void> SparseWriter::wwrite(const void *buf, size_t size)
+{
+    auto ret = file_write_exact(*m_file, buf, size);
+    if (!ret) {
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    m_cur_out_offset += size;
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::wseek(uint64_t offset)
+{
+    auto ret = m_file->seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!ret) {
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    m_cur_out_offset = offset;
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::write_sparse_header()
+{
+    SparseHeader shdr = {};
+    shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+    shdr.minor_version = mb_htole16(0);
+    shdr.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+    shdr.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+    shdr.blk_sz = mb_htole32(m_block_size);
+    shdr.total_blks = mb_htole32(m_total_blocks);
+    shdr.total_chunks = mb_htole32(m_total_chunks);
+    shdr.image_checksum = mb_htole32(0);
+
+    return wwrite(&shdr, sizeof(shdr));
+}
+
+oc::result<void> SparseWriter::write_chunk_header(uint16_t type,
+                                                  uint32_t blocks,
+                                                  uint32_t data_size)
+{
+    ChunkHeader chdr = {};
+    chdr.chunk_type = mb_htole16(type);
+    chdr.chunk_sz = mb_htole32(blocks);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(ChunkHeader) + data_size));
+
+    return wwrite(&chdr, sizeof(chdr));
+}
+
+oc::result<void> SparseWriter::add_block(const unsigned char *data)
+{
+    // A block is a fill block if it is equal to itself shifted by one 32-bit
+    // word. memcmp() is vectorized by the libc, so this is much faster than
+    // comparing word by word.
+    uint32_t fill_val;
+    memcpy(&fill_val, data, sizeof(fill_val));
+    bool is_fill = memcmp(data, data + sizeof(fill_val),
+                          m_block_size - sizeof(fill_val)) == 0;
+    uint16_t type = is_fill ? CHUNK_TYPE_FILL : CHUNK_TYPE_RAW;
+
+    if (type != m_chunk_type
+            || (is_fill && fill_val != m_chunk_fill_val)
+            || m_chunk_blocks == max_chunk_blocks(type, m_block_size)) {
+        OUTCOME_TRYV(finish_chunk());
+
+        m_chunk_type = type;
+        m_chunk_fill_val = fill_val;
+        m_chunk_out_offset = m_cur_out_offset;
+
+        if (!is_fill) {
+            // Reserve space for the chunk header
+            ChunkHeader chdr = {};
+            OUTCOME_TRYV(wwrite(&chdr, sizeof(chdr)));
+        }
+    }
+
+    if (!is_fill) {
+        OUTCOME_TRYV(wwrite(data, m_block_size));
+    }
+
+    ++m_chunk_blocks;
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::add_skip_blocks(uint64_t blocks)
+{
+    if (m_chunk_type != CHUNK_TYPE_DONT_CARE) {
+        OUTCOME_TRYV(finish_chunk());
+
+        m_chunk_type = CHUNK_TYPE_DONT_CARE;
+        m_chunk_out_offset = m_cur_out_offset;
+    }
+
+    // Total size was already checked by the caller
+    m_chunk_blocks += static_cast<uint32_t>(blocks);
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::finish_chunk()
+{
+    switch (m_chunk_type) {
+    case 0:
+        return oc::success();
+    case CHUNK_TYPE_RAW: {
+        auto end_offset = m_cur_out_offset;
+
+        OUTCOME_TRYV(wseek(m_chunk_out_offset));
+        OUTCOME_TRYV(write_chunk_header(CHUNK_TYPE_RAW, m_chunk_blocks,
+                                        m_chunk_blocks * m_block_size));
+        OUTCOME_TRYV(wseek(end_offset));
+        break;
+    }
+    case CHUNK_TYPE_FILL: {
+        OUTCOME_TRYV(write_chunk_header(CHUNK_TYPE_FILL, m_chunk_blocks,
+                                        sizeof(m_chunk_fill_val)));
+        OUTCOME_TRYV(wwrite(&m_chunk_fill_val, sizeof(m_chunk_fill_val)));
+        break;
+    }
+    case CHUNK_TYPE_DONT_CARE: {
+        OUTCOME_TRYV(write_chunk_header(CHUNK_TYPE_DONT_CARE, m_chunk_blocks,
+                                        0));
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %u", m_chunk_type);
+    }
+
+    m_total_blocks += m_chunk_blocks;
+    ++m_total_chunks;
+
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::finish()
+{
+    if (m_block_used > 0) {
+        memset(m_block.data() + m_block_used, 0,
+               m_block_size - m_block_used);
+        OUTCOME_TRYV(add_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    OUTCOME_TRYV(finish_chunk());
+
+    auto end_offset = m_cur_out_offset;
+
+    OUTCOME_TRYV(wseek(m_base_offset));
+    OUTCOME_TRYV(write_sparse_header());
+    return wseek(end_offset);
+}
+
+}
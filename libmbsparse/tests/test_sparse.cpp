@@ -24,6 +24,7 @@
 #include "mbcommon/endian.h"
 #include "mbcommon/file/memory.h"
 
+#include "mbsparse/crc32.h"
 #include "mbsparse/sparse_error.h"
 
 using namespace mb;
@@ -87,7 +88,7 @@ struct SparseTest : testing::Test
         ASSERT_TRUE(_source_file.open(&_data, &_size));
     }
 
-    void build_valid_data(bool oversized)
+    void build_valid_data(bool oversized, uint32_t crc32 = 0)
     {
         SparseHeader shdr = {};
         shdr.magic = SPARSE_HEADER_MAGIC;
@@ -159,7 +160,8 @@ struct SparseTest : testing::Test
         if (oversized) {
             ASSERT_TRUE(_source_file.write("\xaa\xbb\xcc\xdd", 4));
         }
-        ASSERT_TRUE(_source_file.write("\x00\x00\x00\x00", 4));
+        crc32 = mb_htole32(crc32);
+        ASSERT_TRUE(_source_file.write(&crc32, sizeof(crc32)));
 
         // Move back to beginning of the file
         ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
@@ -744,3 +746,185 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, ChunkIndexRoundTrip)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto index = _file.chunk_index();
+    ASSERT_TRUE(index);
+    ASSERT_TRUE(_file.close());
+
+    // Reopen the sparse file and use the saved index
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.load_chunk_index(index.value().data(),
+                                       index.value().size()));
+
+    // Check that reading from the middle works without walking the chunks
+    ASSERT_TRUE(_file.seek(33, SEEK_SET));
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 15u);
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 33, 15), 0);
+
+    // Check that the entire file can be read
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, ChunkIndexFromDifferentFileFails)
+{
+    build_valid_data(true);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto index = _file.chunk_index();
+    ASSERT_TRUE(index);
+    ASSERT_TRUE(_file.close());
+
+    // Index of a file with a different header layout
+    ASSERT_TRUE(_source_file.truncate(0));
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    build_valid_data(false);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto ret = _file.load_chunk_index(index.value().data(),
+                                      index.value().size());
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::ChunkIndexMismatch);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, ChunkIndexCorruptFails)
+{
+    build_valid_data(true);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto index = _file.chunk_index();
+    ASSERT_TRUE(index);
+
+    auto data = index.value();
+
+    // Truncated index
+    auto ret = _file.load_chunk_index(data.data(), data.size() - 1);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidChunkIndex);
+
+    // Change the end offset of the last chunk (after the type, fill value,
+    // and begin offset of the last entry)
+    data[data.size() - 6 * 8 - 2 - 4 + 8] ^= 0x01;
+    ret = _file.load_chunk_index(data.data(), data.size());
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidChunkIndex);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, ChunkIndexWithSkippableFileFails)
+{
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto ret = _file.chunk_index();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, SkipHoleWithUnseekableFile)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Not in a hole
+    auto skipped = _file.skip_hole();
+    ASSERT_TRUE(skipped);
+    ASSERT_EQ(skipped.value(), 0u);
+
+    // Read the raw and fill chunks and part of the skip chunk
+    auto n = _file.read(buf, 40);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 40u);
+    ASSERT_EQ(memcmp(buf, expected_valid_data, 40), 0);
+
+    // Skip the rest of the skip chunk
+    skipped = _file.skip_hole();
+    ASSERT_TRUE(skipped);
+    ASSERT_EQ(skipped.value(), 8u);
+
+    auto pos = _file.seek(0, SEEK_CUR);
+    ASSERT_FALSE(pos);
+
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, Crc32OfKnownData)
+{
+    ASSERT_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+
+    // Incremental updates give the same result
+    uint32_t crc = crc32_update(0, "1234", 4);
+    crc = crc32_update(crc, "56789", 5);
+    ASSERT_EQ(crc, 0xcbf43926u);
+}
+
+TEST_F(SparseTest, ValidateCrc32WithMatchingChecksum)
+{
+    char buf[1024];
+    build_valid_data(true, crc32_update(0, expected_valid_data,
+                                        sizeof(expected_valid_data)));
+
+    _source_file.set_seekability(Seekability::CanRead);
+    _file.set_crc32_validation(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data));
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, ValidateCrc32WithMismatchedChecksumFatal)
+{
+    char buf[1024];
+    build_valid_data(true, 0xdeadbeef);
+
+    _file.set_crc32_validation(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), SparseFileError::Crc32Mismatch);
+    ASSERT_TRUE(_file.is_fatal());
+
+    // Not validated after a non-sequential read
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.seek(16, SEEK_SET));
+
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data) - 16);
+
+    ASSERT_TRUE(_file.close());
+}
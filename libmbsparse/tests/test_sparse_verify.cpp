@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbsparse/sparse_verify.h"
+
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/crc32.h"
+#include "mbsparse/sparse_error.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+struct SparseVerifyTest : testing::Test
+{
+    void *_data = nullptr;
+    size_t _size = 0;
+    MemoryFile _source_file;
+    SparseFile _sparse_file;
+    std::vector<unsigned char> _expanded;
+
+    virtual ~SparseVerifyTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        constexpr char raw[] = "0123456789abcdef" "ghijklmnopqrstuv";
+        constexpr unsigned char fill[] = {
+            0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+            0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+        };
+
+        {
+            MemoryFile target_file;
+            ASSERT_TRUE(target_file.open(&_data, &_size));
+
+            SparseWriter writer;
+            ASSERT_TRUE(writer.open(&target_file, 16));
+            ASSERT_TRUE(writer.write(raw, 32));
+            ASSERT_TRUE(writer.write(fill, sizeof(fill)));
+            ASSERT_TRUE(writer.seek(48, SEEK_CUR));
+            ASSERT_TRUE(writer.write(raw, 16));
+            ASSERT_TRUE(writer.close());
+        }
+
+        _expanded.insert(_expanded.end(), raw, raw + 32);
+        _expanded.insert(_expanded.end(), fill, fill + sizeof(fill));
+        _expanded.insert(_expanded.end(), 48, 0);
+        _expanded.insert(_expanded.end(), raw, raw + 16);
+
+        ASSERT_TRUE(_source_file.open(_data, _size));
+        ASSERT_TRUE(_sparse_file.open(&_source_file));
+    }
+};
+
+TEST_F(SparseVerifyTest, DigestMatchesExpandedData)
+{
+    std::vector<unsigned char> digested;
+    uint32_t crc = 0;
+
+    ASSERT_TRUE(digest_expanded(_sparse_file, [&](const void *data,
+                                                  size_t size)
+            -> oc::result<void> {
+        auto ptr = static_cast<const unsigned char *>(data);
+        digested.insert(digested.end(), ptr, ptr + size);
+        crc = crc32_update(crc, data, size);
+        return oc::success();
+    }));
+
+    ASSERT_EQ(digested, _expanded);
+    ASSERT_EQ(crc, crc32_update(0, _expanded.data(), _expanded.size()));
+}
+
+TEST_F(SparseVerifyTest, DigestErrorIsPropagated)
+{
+    auto ret = digest_expanded(_sparse_file, [](const void *, size_t)
+            -> oc::result<void> {
+        return std::errc::io_error;
+    });
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+}
+
+TEST_F(SparseVerifyTest, VerifyIgnoresDontCareRegions)
+{
+    auto target = _expanded;
+    // Garbage in the "don't care" region
+    std::fill_n(target.begin() + 48, 48, 0xff);
+
+    MemoryFile target_file(target.data(), target.size());
+    ASSERT_TRUE(verify_expanded(_sparse_file, target_file));
+}
+
+TEST_F(SparseVerifyTest, VerifyDetectsMismatch)
+{
+    for (size_t offset : {5u, 40u}) {
+        auto target = _expanded;
+        target[offset] ^= 1;
+
+        MemoryFile target_file(target.data(), target.size());
+        auto ret = verify_expanded(_sparse_file, target_file);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error(), SparseFileError::VerifyMismatch);
+    }
+}
+
+TEST_F(SparseVerifyTest, VerifyTruncatedTarget)
+{
+    MemoryFile target_file(_expanded.data(), 100);
+    auto ret = verify_expanded(_sparse_file, target_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbsparse/sparse_writer.h"
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_error.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+struct SparseWriterTest : testing::Test
+{
+    MemoryFile _target_file;
+    SparseWriter _writer;
+    void *_data = nullptr;
+    size_t _size = 0;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_target_file.open(&_data, &_size));
+    }
+
+    SparseHeader read_sparse_header()
+    {
+        SparseHeader shdr;
+        memcpy(&shdr, _data, sizeof(shdr));
+        shdr.blk_sz = mb_le32toh(shdr.blk_sz);
+        shdr.total_blks = mb_le32toh(shdr.total_blks);
+        shdr.total_chunks = mb_le32toh(shdr.total_chunks);
+        return shdr;
+    }
+
+    std::vector<unsigned char> read_back()
+    {
+        std::vector<unsigned char> result;
+
+        MemoryFile source(_data, _size);
+        SparseFile sparse_file(&source);
+        EXPECT_TRUE(sparse_file.is_open());
+
+        char buf[1024];
+        while (true) {
+            auto n = sparse_file.read(buf, sizeof(buf));
+            EXPECT_TRUE(n);
+            if (!n || n.value() == 0) {
+                break;
+            }
+            result.insert(result.end(), buf, buf + n.value());
+        }
+
+        return result;
+    }
+};
+
+TEST_F(SparseWriterTest, WriteMixedBlocks)
+{
+    constexpr unsigned char raw[] = "0123456789abcdef" "ghijklmnopqrstuv";
+    constexpr unsigned char fill[] = {
+        0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+        0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+    };
+    unsigned char zeros[16] = {};
+
+    ASSERT_TRUE(_writer.open(&_target_file, 16));
+    ASSERT_TRUE(_writer.write(raw, 32));
+    ASSERT_TRUE(_writer.write(zeros, sizeof(zeros)));
+    ASSERT_TRUE(_writer.write(fill, sizeof(fill)));
+    auto pos = _writer.seek(32, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 96u);
+    ASSERT_TRUE(_writer.write("xyz", 3));
+    ASSERT_TRUE(_writer.close());
+
+    // raw (2 blocks), fill (0), fill (0x12345678), don't care, raw (padded)
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.blk_sz, 16u);
+    ASSERT_EQ(shdr.total_blks, 7u);
+    ASSERT_EQ(shdr.total_chunks, 5u);
+
+    std::vector<unsigned char> expected;
+    expected.insert(expected.end(), raw, raw + 32);
+    expected.insert(expected.end(), zeros, zeros + 16);
+    expected.insert(expected.end(), fill, fill + 16);
+    expected.insert(expected.end(), 32, 0);
+    expected.insert(expected.end(), {'x', 'y', 'z'});
+    expected.insert(expected.end(), 13, 0);
+
+    ASSERT_EQ(read_back(), expected);
+}
+
+TEST_F(SparseWriterTest, UnalignedWritesMergeChunks)
+{
+    ASSERT_TRUE(_writer.open(&_target_file, 8));
+
+    // 4 blocks of the same fill value written one byte at a time
+    for (int i = 0; i < 32; ++i) {
+        ASSERT_TRUE(_writer.write("\xaa", 1));
+    }
+
+    // Trailing hole
+    ASSERT_TRUE(_writer.seek(20, SEEK_END));
+    ASSERT_TRUE(_writer.close());
+
+    // fill, don't care, fill (zero padded partial block)
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.total_blks, 7u);
+    ASSERT_EQ(shdr.total_chunks, 3u);
+
+    std::vector<unsigned char> expected(32, 0xaa);
+    expected.insert(expected.end(), 24, 0);
+
+    ASSERT_EQ(read_back(), expected);
+}
+
+TEST_F(SparseWriterTest, InvalidBlockSizeFails)
+{
+    auto ret = _writer.open(&_target_file, 6);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidBlockSize);
+}
+
+TEST_F(SparseWriterTest, SeekBackwardsFails)
+{
+    ASSERT_TRUE(_writer.open(&_target_file, 16));
+    ASSERT_TRUE(_writer.write("abcd", 4));
+
+    auto ret = _writer.seek(0, SEEK_SET);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_writer.close());
+}
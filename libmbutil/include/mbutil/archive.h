@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -46,6 +47,28 @@ enum class CompressionType : uint8_t
     Lz4,
     Gzip,
     Xz,
+    // Requires zstd support at build time
+    Zstd,
+};
+
+/*!
+ * Optional callbacks for libarchive_tar_create()
+ */
+struct TarCreateHooks
+{
+    // Called for every entry found in the paths being archived. Returns whether
+    // the entry should be written to the archive. Directories are always
+    // traversed, even if they are not written.
+    std::function<bool(archive_entry *entry)> filter;
+    // Called with the contents of each regular file that is written, including
+    // the zeros in sparse regions
+    std::function<void(archive_entry *entry,
+                       const void *data, size_t size)> data;
+    // Called after an entry and all of its data have been written
+    std::function<void(archive_entry *entry)> finished;
+    // Called with the bytes of the archive file as they are written, after
+    // compression
+    std::function<void(const void *data, size_t size)> output;
 };
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry);
@@ -60,7 +83,8 @@ bool libarchive_tar_extract(const std::string &filename,
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
-                           CompressionType compression);
+                           CompressionType compression,
+                           const TarCreateHooks *hooks = nullptr);
 
 bool extract_archive(const std::string &filename, const std::string &target);
 bool extract_files(const std::string &filename, const std::string &target,
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "mbcommon/outcome.h"
 
@@ -27,5 +28,8 @@ namespace mb::util
 {
 
 oc::result<std::string> blkid_get_fs_type(const std::string &path);
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths);
+void blkid_clear_cache();
 
 }
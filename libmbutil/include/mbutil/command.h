@@ -19,9 +19,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <cstddef>
@@ -63,6 +65,35 @@ typedef void (*CmdRawCb)(const char *data, size_t size, bool error,
  */
 typedef void (*CmdLineCb)(const char *line, bool error, void *userdata);
 
+/*!
+ * \brief Line command output callback that does not copy complete lines
+ *
+ * \note \a line does not include the newline character and is not
+ * NULL-terminated. It points into the output buffer and is only valid for the
+ * duration of the call. Lines that are too long to fit in the internal buffer
+ * are split.
+ *
+ * \param line Line that was read
+ * \param error stderr if true, else stdout
+ * \param userdata User-provided pointer
+ */
+typedef void (*CmdLineViewCb)(std::string_view line, bool error,
+                              void *userdata);
+
+/*!
+ * \brief Limit for the number of lines passed to a CmdLineViewCb
+ *
+ * Lines beyond \a max_lines in each \a interval are dropped and the number of
+ * dropped lines is logged.
+ */
+struct CmdLineRateLimit
+{
+    /*! Maximum number of lines per interval (0 for no limit) */
+    size_t max_lines = 0;
+    /*! Length of an interval */
+    std::chrono::milliseconds interval{1000};
+};
+
 struct CommandCtxPriv;
 
 struct CommandCtx
@@ -93,6 +124,8 @@ int command_wait(CommandCtx &ctx);
 
 bool command_raw_reader(CommandCtx &ctx, CmdRawCb cb, void *userdata);
 bool command_line_reader(CommandCtx &ctx, CmdLineCb cb, void *userdata);
+bool command_line_view_reader(CommandCtx &ctx, CmdLineViewCb cb,
+                              void *userdata, const CmdLineRateLimit &limit);
 
 int run_command(const std::string &path,
                 const std::vector<std::string> &argv,
@@ -100,5 +133,12 @@ int run_command(const std::string &path,
                 const std::string &chroot_dir,
                 CmdLineCb cb,
                 void *userdata);
+int run_command(const std::string &path,
+                const std::vector<std::string> &argv,
+                const std::optional<std::vector<std::string>> &envp,
+                const std::string &chroot_dir,
+                CmdLineViewCb cb,
+                void *userdata,
+                const CmdLineRateLimit &limit);
 
 }
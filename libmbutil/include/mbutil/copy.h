@@ -35,6 +35,8 @@ enum class CopyFlag : uint8_t
     CopyXattrs      = 1 << 1,
     ExcludeTopLevel = 1 << 2,
     FollowSymlinks  = 1 << 3,
+    // copy_dir() only: copy file data on multiple threads
+    Parallel        = 1 << 4,
 };
 MB_DECLARE_FLAGS(CopyFlags, CopyFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(CopyFlags)
@@ -19,7 +19,11 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include "mbcommon/outcome.h"
 
@@ -28,6 +32,31 @@
 namespace mb::util
 {
 
+struct DeleteOptions
+{
+    // Names of the entries directly inside the root to leave alone
+    std::vector<std::string> exclusions;
+    // Whether to leave the root directory itself alone
+    bool keep_root = false;
+    // Directory that delete_recursive_to_trash() creates its hidden directory
+    // in. It must be on the same mount as the path being deleted. If empty,
+    // the path itself (when the root is kept) or its parent is used.
+    std::string trash_dir;
+    // Number of threads deleting subtrees. With 1, everything is deleted on
+    // the calling thread.
+    unsigned int threads = 1;
+    // Called after each path is deleted. It may be called from any of the
+    // threads, but never concurrently. Return false to stop deleting.
+    std::function<bool(const std::string &path, const struct stat &sb)>
+            callback;
+};
+
 FileOpResult<void> delete_recursive(const std::string &path);
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    const DeleteOptions &options);
+FileOpResult<std::string> delete_recursive_to_trash(const std::string &path,
+                                                    const DeleteOptions &options);
+FileOpResult<void> delete_recursive_in_background(const std::string &path,
+                                                  const DeleteOptions &options);
 
 }
@@ -30,6 +30,7 @@
 #define _INCLUDE_SYS__SYSTEM_PROPERTIES_H
 
 #include <sys/cdefs.h>
+#include <sys/types.h>
 #include <stdint.h>
 
 #ifndef _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
@@ -131,6 +132,16 @@ uint32_t mb__system_property_serial(const prop_info* pi);
  */
 int mb__system_properties_init();
 
+/* Copy the name and value of every system property into |buf| as
+** consecutive pairs of NUL-terminated strings. Nothing is copied past
+** |size| bytes. If |serial| is not null, it is set to the value of
+** mb__system_property_area_serial() from before the properties were read.
+**
+** Returns the number of bytes needed to hold every property, which may
+** be larger than |size|, or -1 on error.
+*/
+ssize_t mb__system_property_snapshot(char *buf, size_t size, uint32_t *serial);
+
 /* Deprecated: use mb__system_property_wait instead. */
 uint32_t mb__system_property_wait_any(uint32_t old_serial);
 
@@ -20,8 +20,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -128,6 +131,63 @@ struct TwrpFstabRec
 
 using TwrpFstabRecs = std::vector<TwrpFstabRec>;
 
+/*!
+ * \brief Entry in a parsed fstab file
+ *
+ * The fields point into the buffer owned by the Fstab object and are only
+ * valid for as long as it exists.
+ */
+struct FstabEntry
+{
+    std::string_view blk_device;
+    std::string_view mount_point;
+    std::string_view fs_type;
+    unsigned long flags;
+    std::string_view fs_options;
+    unsigned long fs_mgr_flags;
+    std::string_view vold_args;
+    std::string_view mount_args;
+    std::string_view orig_line;
+
+    FstabRec to_rec() const;
+};
+
+/*!
+ * \brief Parsed fstab file with lookups by mount point and block device
+ *
+ * The file is read into a single buffer and the entries refer to it, so
+ * parsing does not allocate per field. Lookups compare normalized paths, like
+ * path_compare().
+ */
+class Fstab
+{
+public:
+    Fstab();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Fstab)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(Fstab)
+
+    static FstabResult<Fstab> load(const std::string &path);
+
+    const std::vector<FstabEntry> & entries() const;
+
+    const std::vector<const FstabEntry *> &
+    find_mount_point(std::string_view mount_point) const;
+    const std::vector<const FstabEntry *> &
+    find_blk_device(std::string_view blk_device) const;
+
+private:
+    using Index = std::unordered_map<std::string,
+                                     std::vector<const FstabEntry *>>;
+
+    // Never resized after parsing, so the views and pointers stay valid
+    std::vector<char> _data;
+    std::vector<char> _options;
+    std::vector<FstabEntry> _entries;
+    Index _by_mount_point;
+    Index _by_blk_device;
+};
+
 FstabResult<FstabRecs> read_fstab(const std::string &path);
 FstabResult<TwrpFstabRecs> read_twrp_fstab(const std::string &path);
 
@@ -21,16 +21,90 @@
 
 #include <array>
 #include <string>
+#include <vector>
 
+#include <cstddef>
+#include <cstdint>
+
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
+namespace mb
+{
+class File;
+}
+
 namespace mb::util
 {
 
 using Sha512Digest = std::array<unsigned char, SHA512_DIGEST_LENGTH>;
 
+enum class HashBackend
+{
+    // OpenSSL's EVP interface, which picks the fastest implementation for the
+    // CPU (eg. the ARMv8 SHA-512 instructions)
+    OpenSsl,
+    // The kernel's crypto API through an AF_ALG socket
+    KernelCrypto,
+};
+
+HashBackend sha512_backend();
+
+oc::result<Sha512Digest> sha512_hash(const void *data, size_t size);
 oc::result<Sha512Digest> sha512_hash(const std::string &path);
 
+enum class HashAlgorithm
+{
+    Sha256,
+    Sha512,
+};
+
+using HashDigest = std::vector<unsigned char>;
+
+size_t hash_digest_size(HashAlgorithm algorithm);
+
+/*!
+ * \brief Incremental hash using OpenSSL's EVP interface
+ *
+ * After finish() returns, the hasher is reset and can be reused.
+ */
+class Hasher
+{
+public:
+    explicit Hasher(HashAlgorithm algorithm);
+    ~Hasher();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Hasher)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Hasher)
+
+    HashAlgorithm algorithm() const;
+
+    oc::result<void> update(const void *data, size_t size);
+    oc::result<HashDigest> finish();
+
+private:
+    oc::result<void> reset();
+
+    HashAlgorithm _algorithm;
+    EVP_MD_CTX *_ctx;
+    bool _ready;
+};
+
+oc::result<HashDigest> hash_data(HashAlgorithm algorithm,
+                                 const void *data, size_t size);
+oc::result<HashDigest> hash_fd(HashAlgorithm algorithm, int fd);
+oc::result<HashDigest> hash_file(HashAlgorithm algorithm, File &file);
+oc::result<HashDigest> hash_path(HashAlgorithm algorithm,
+                                 const std::string &path);
+
+std::vector<oc::result<HashDigest>>
+hash_paths(HashAlgorithm algorithm, const std::vector<std::string> &paths,
+           unsigned int threads);
+
+oc::result<HashDigest> tree_hash_fd(HashAlgorithm algorithm, int fd,
+                                    uint64_t chunk_size, unsigned int threads);
+
 }
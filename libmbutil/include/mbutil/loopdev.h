@@ -21,15 +21,25 @@
 
 #include <string>
 
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
 {
 
+enum class LoopdevFlag : uint8_t
+{
+    // Read the backing file with direct I/O instead of through its page cache
+    DirectIo    = 1 << 0,
+};
+MB_DECLARE_FLAGS(LoopdevFlags, LoopdevFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(LoopdevFlags)
+
 oc::result<std::string> loopdev_find_unused();
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
-                                       uint64_t offset, bool ro);
+                                       uint64_t offset, bool ro,
+                                       LoopdevFlags flags);
 oc::result<void> loopdev_remove_device(const std::string &loopdev);
 
 }
@@ -20,10 +20,16 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <cstdio>
 
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
+#include "mbutil/loopdev.h"
 
 namespace mb::util
 {
@@ -39,6 +45,7 @@ std::error_code make_error_code(MountError e);
 const std::error_category & mount_error_category();
 
 constexpr char PROC_MOUNTS[] = "/proc/mounts";
+constexpr char PROC_MOUNTINFO[] = "/proc/self/mountinfo";
 
 struct MountEntry
 {
@@ -52,11 +59,56 @@ struct MountEntry
 
 oc::result<MountEntry> get_mount_entry(std::FILE *fp);
 
+/*!
+ * \brief Snapshot of the mount table
+ *
+ * refresh() parses /proc/self/mountinfo and indexes the entries by mount
+ * point. The file is kept open and is only parsed again once poll() reports
+ * that the mount table has changed or the process has switched to another
+ * mount namespace. Otherwise, refresh() does no work.
+ *
+ * The entries are in mount order, so a mount always appears after the mount
+ * that it is on top of.
+ *
+ * generation() is incremented every time the table is reparsed, so callers can
+ * cheaply tell whether anything derived from an earlier snapshot is stale.
+ */
+class MountTable
+{
+public:
+    MountTable();
+    ~MountTable();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MountTable)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MountTable)
+
+    oc::result<void> refresh();
+
+    uint64_t generation() const;
+
+    const std::vector<MountEntry> & entries() const;
+    const MountEntry * find(const std::string &mountpoint) const;
+    std::vector<const MountEntry *> find_under(const std::string &dir) const;
+
+private:
+    int _fd;
+    ino_t _ns_ino;
+    uint64_t _generation;
+    std::vector<MountEntry> _entries;
+    // Index of the topmost entry for each mount point
+    std::unordered_map<std::string, size_t> _index;
+
+    oc::result<void> load();
+};
+
 oc::result<void> is_mounted(const std::string &mountpoint);
 oc::result<void> unmount_all(const std::string &dir);
 oc::result<void> mount(const std::string &source, const std::string &target,
                        const std::string &fstype, unsigned long mount_flags,
                        const std::string &data);
+oc::result<void> mount(const std::string &source, const std::string &target,
+                       const std::string &fstype, unsigned long mount_flags,
+                       const std::string &data, LoopdevFlags loopdev_flags);
 oc::result<void> umount(const std::string &target);
 
 oc::result<uint64_t> mount_get_total_size(const std::string &path);
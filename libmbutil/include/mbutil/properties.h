@@ -19,9 +19,14 @@
 
 #pragma once
 
+#include <deque>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "mbcommon/common.h"
 #include "mbcommon/integer.h"
 
 #include "mbutil/external/system_properties.h"
@@ -51,6 +56,41 @@ bool libc_system_property_wait(const prop_info *pi,
                                uint32_t old_serial,
                                uint32_t *new_serial_ptr,
                                const struct timespec *relative_timeout);
+uint32_t libc_system_property_area_serial();
+ssize_t libc_system_property_snapshot(char *buf, size_t size,
+                                      uint32_t *serial);
+
+/*!
+ * \brief Snapshot of every system property
+ *
+ * refresh() copies the names and values of all properties into a single
+ * buffer and indexes them by name. If no property has changed since the last
+ * refresh (according to the property area serial), the existing snapshot is
+ * kept and no work is done.
+ */
+class PropertySnapshot
+{
+public:
+    using Property = std::pair<std::string_view, std::string_view>;
+
+    PropertySnapshot();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PropertySnapshot)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(PropertySnapshot)
+
+    bool refresh();
+    bool changed() const;
+
+    std::optional<std::string_view> get(std::string_view key) const;
+    const std::vector<Property> & properties() const;
+
+private:
+    std::vector<char> _buf;
+    // Sorted by name
+    std::vector<Property> _props;
+    uint32_t _serial;
+    bool _valid;
+};
 
 // Helper functions
 
@@ -81,6 +121,97 @@ bool property_get_all(std::unordered_map<std::string, std::string> &map);
 
 // Properties file functions
 
+/*!
+ * \brief Parsed properties file
+ *
+ * load() maps the file once and indexes its properties by key, so any number
+ * of lookups can be done without rereading or reparsing the file. Edits are
+ * made in place and save() writes the file back with its original line order,
+ * comments, and blank lines preserved.
+ *
+ * Like property_file_get(), lookups return the first occurrence of a key.
+ */
+class PropertyFile
+{
+public:
+    PropertyFile();
+    ~PropertyFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PropertyFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PropertyFile)
+
+    bool load(const std::string &path);
+    void load_data(std::string data);
+    void clear();
+
+    bool save(const std::string &path) const;
+    std::string data() const;
+
+    std::optional<std::string_view> get(std::string_view key) const;
+    std::string get_string(std::string_view key,
+                           const std::string &default_value) const;
+    bool get_bool(std::string_view key, bool default_value) const;
+
+    template<typename IntType>
+    IntType get_num(std::string_view key, IntType default_value) const
+    {
+        IntType result;
+
+        if (auto value = get(key); value
+                && str_to_num(std::string(*value).c_str(), 10, result)) {
+            return result;
+        }
+
+        return default_value;
+    }
+
+    void set(std::string_view key, std::string_view value);
+    bool remove(std::string_view key);
+    size_t remove_prefix(std::string_view prefix);
+
+    template<typename Fn>
+    void for_each(Fn &&fn) const
+    {
+        for (auto const &line : _lines) {
+            if (line.is_prop && !line.removed) {
+                fn(line.key(), line.value());
+            }
+        }
+    }
+
+private:
+    struct Line
+    {
+        std::string_view text;
+        size_t key_size;
+        bool is_prop;
+        bool removed;
+
+        std::string_view key() const
+        {
+            return text.substr(0, key_size);
+        }
+
+        std::string_view value() const
+        {
+            return text.substr(key_size + 1);
+        }
+    };
+
+    void parse(std::string_view data);
+    void unmap();
+    std::vector<size_t>::const_iterator lower_bound(std::string_view key) const;
+
+    void *_map;
+    size_t _map_size;
+    std::string _buf;
+    // Stable storage for edited lines
+    std::deque<std::string> _storage;
+    std::vector<Line> _lines;
+    // Indexes of property lines, sorted by key (stable)
+    std::vector<size_t> _index;
+};
+
 bool property_file_get(const std::string &path, const std::string &key,
                        std::string &value_out);
 std::string property_file_get_string(const std::string &path,
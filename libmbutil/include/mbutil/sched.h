@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+enum class SchedPolicy : uint8_t
+{
+    // Leave the CPU and I/O scheduling parameters unchanged
+    Default,
+    // Low CPU and best-effort I/O priority for work nobody is waiting on
+    Background,
+    // Only run when the CPU and disks are otherwise idle
+    Idle,
+    // Raised priority for work the user is actively waiting on
+    Interactive,
+};
+
+std::optional<SchedPolicy> sched_policy_from_string(std::string_view name);
+const char * sched_policy_to_string(SchedPolicy policy);
+
+oc::result<void> set_sched_policy(SchedPolicy policy);
+
+/*!
+ * \brief Apply a scheduling policy to the calling thread until destroyed
+ *
+ * The previous I/O priority, nice value, scheduler and cgroups are restored by
+ * the destructor. Threads and processes created in the meantime keep the
+ * policy.
+ */
+class ScopedSchedPolicy
+{
+public:
+    explicit ScopedSchedPolicy(SchedPolicy policy);
+    ~ScopedSchedPolicy();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ScopedSchedPolicy)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ScopedSchedPolicy)
+
+private:
+    bool _applied;
+    int _ioprio;
+    int _nice;
+    int _scheduler;
+    int _sched_priority;
+    std::optional<std::string> _cpu_cgroup;
+    std::optional<std::string> _cpuset_cgroup;
+};
+
+}
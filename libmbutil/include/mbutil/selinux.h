@@ -20,11 +20,14 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <sepol/policydb/policydb.h>
 
 #include "mbcommon/outcome.h"
 
+#include "mbutil/result/file_op_result.h"
+
 namespace mb::util
 {
 
@@ -46,8 +49,30 @@ enum class SELinuxAttr
     SockCreate,
 };
 
+struct SELinuxRelabelOptions
+{
+    // Set the context of symlink targets instead of the symlinks themselves
+    bool follow_symlinks = false;
+    // Number of threads relabeling subtrees. With 1, everything is relabeled
+    // on the calling thread.
+    unsigned int threads = 1;
+};
+
+struct SELinuxRelabelStats
+{
+    // Number of paths whose context was changed
+    uint64_t changed = 0;
+    // Number of paths that already had the context
+    uint64_t skipped = 0;
+};
+
 bool selinux_read_policy(const std::string &path, policydb_t *pdb);
+bool selinux_read_policy_image(const void *data, size_t len, policydb_t *pdb);
 bool selinux_write_policy(const std::string &path, policydb_t *pdb);
+bool selinux_policy_to_image(policydb_t *pdb,
+                             std::vector<unsigned char> &image);
+bool selinux_write_policy_image(const std::string &path,
+                                const void *data, size_t len);
 oc::result<std::string> selinux_get_context(const std::string &path);
 oc::result<std::string> selinux_lget_context(const std::string &path);
 oc::result<std::string> selinux_fget_context(int fd);
@@ -60,6 +85,9 @@ oc::result<void> selinux_set_context_recursive(const std::string &path,
                                                const std::string &context);
 oc::result<void> selinux_lset_context_recursive(const std::string &path,
                                                 const std::string &context);
+FileOpResult<SELinuxRelabelStats>
+selinux_relabel_recursive(const std::string &path, const std::string &context,
+                          const SELinuxRelabelOptions &options);
 oc::result<bool> selinux_get_enforcing();
 oc::result<void> selinux_set_enforcing(bool value);
 oc::result<std::string> selinux_get_process_attr(pid_t pid, SELinuxAttr attr);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+/*!
+ * \brief Matcher for file_contexts specs
+ *
+ * Each regex is compiled once when the spec is added. Identical regexes share
+ * a single compiled copy. Specs without regex metacharacters are looked up in
+ * a hash table. The rest are bucketed by their stem (the first path
+ * component), as libselinux does, and must match their literal prefix before
+ * the regex is evaluated. Lookups are const and can run from multiple threads
+ * at the same time.
+ */
+class FileContexts
+{
+public:
+    FileContexts();
+    ~FileContexts();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileContexts)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(FileContexts)
+
+    oc::result<void> load_file(const std::string &path);
+    oc::result<void> add_spec(const std::string &regex, mode_t mode,
+                              std::string context);
+
+    size_t size() const;
+
+    const std::string * lookup(std::string_view path, mode_t mode) const;
+
+private:
+    struct Spec
+    {
+        std::shared_ptr<const std::regex> regex;
+        std::string prefix;
+        mode_t mode;
+        std::string context;
+    };
+
+    const Spec * find_literal(const std::string &key, mode_t mode) const;
+    const Spec * find_regex(std::string_view path, mode_t mode,
+                            std::string_view stem) const;
+
+    std::vector<Spec> _specs;
+    // Compiled regexes by their source
+    std::unordered_map<std::string, std::shared_ptr<const std::regex>> _regexes;
+    // Specs without metacharacters by their path
+    std::unordered_map<std::string, std::vector<size_t>> _literal_specs;
+    // Specs with metacharacters by their stem
+    std::unordered_map<std::string, std::vector<size_t>> _stem_specs;
+    // Specs with metacharacters and no stem
+    std::vector<size_t> _stemless_specs;
+};
+
+oc::result<void> selinux_restore_context_recursive(const std::string &path,
+                                                   const FileContexts &contexts);
+
+}
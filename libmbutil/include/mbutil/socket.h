@@ -24,6 +24,7 @@
 
 #include <cinttypes>
 
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -32,6 +33,7 @@ namespace mb::util
 oc::result<size_t> socket_read(int fd, void *buf, size_t size);
 oc::result<size_t> socket_write(int fd, const void *buf, size_t size);
 oc::result<std::vector<unsigned char>> socket_read_bytes(int fd);
+oc::result<void> socket_read_bytes_into(int fd, std::vector<unsigned char> &buf);
 oc::result<void> socket_write_bytes(int fd, const void *data, size_t len);
 oc::result<uint16_t> socket_read_uint16(int fd);
 oc::result<void> socket_write_uint16(int fd, uint16_t n);
@@ -46,10 +48,93 @@ oc::result<void> socket_write_int32(int fd, int32_t n);
 oc::result<int64_t> socket_read_int64(int fd);
 oc::result<void> socket_write_int64(int fd, int64_t n);
 oc::result<std::string> socket_read_string(int fd);
+oc::result<void> socket_read_string_into(int fd, std::string &str);
 oc::result<void> socket_write_string(int fd, const std::string &str);
 oc::result<std::vector<std::string>> socket_read_string_array(int fd);
 oc::result<void> socket_write_string_array(int fd, const std::vector<std::string> &list);
 oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds);
 oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds);
 
+/*!
+ * \brief Buffered reader for the socket_write_*() message format
+ *
+ * Reads as much data as is available into an internal buffer, so a message's
+ * size and payload (and often the messages after it) are received with a
+ * single read(). The *_into() functions reuse the capacity of the output
+ * buffer, so no memory is allocated once the buffers are large enough.
+ *
+ * Because data may already be buffered, the fd must not be read from directly
+ * while the reader is in use and callers that poll() the fd must check
+ * buffered() first.
+ */
+class SocketReader
+{
+public:
+    explicit SocketReader(int fd);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SocketReader)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(SocketReader)
+
+    int fd() const;
+    size_t buffered() const;
+
+    oc::result<void> read(void *buf, size_t size);
+    oc::result<uint16_t> read_uint16();
+    oc::result<uint32_t> read_uint32();
+    oc::result<uint64_t> read_uint64();
+    oc::result<int16_t> read_int16();
+    oc::result<int32_t> read_int32();
+    oc::result<int64_t> read_int64();
+    oc::result<void> read_bytes_into(std::vector<unsigned char> &buf);
+    oc::result<void> read_string_into(std::string &str);
+    oc::result<void> read_string_array_into(std::vector<std::string> &list);
+
+private:
+    int _fd;
+    std::vector<unsigned char> _buf;
+    size_t _begin;
+    size_t _end;
+
+    oc::result<void> fill();
+    template<typename T>
+    oc::result<T> read_value();
+};
+
+/*!
+ * \brief Buffered writer for the socket_write_*() message format
+ *
+ * Small values are collected in an internal buffer until flush() is called.
+ * If a payload does not fit in the buffer, it is sent together with the
+ * buffered data using writev() instead of being copied. Nothing is flushed
+ * automatically on destruction.
+ */
+class SocketWriter
+{
+public:
+    explicit SocketWriter(int fd);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SocketWriter)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(SocketWriter)
+
+    int fd() const;
+    size_t buffered() const;
+
+    oc::result<void> write(const void *buf, size_t size);
+    oc::result<void> write_uint16(uint16_t n);
+    oc::result<void> write_uint32(uint32_t n);
+    oc::result<void> write_uint64(uint64_t n);
+    oc::result<void> write_int16(int16_t n);
+    oc::result<void> write_int32(int32_t n);
+    oc::result<void> write_int64(int64_t n);
+    oc::result<void> write_bytes(const void *data, size_t len);
+    oc::result<void> write_string(const std::string &str);
+    oc::result<void> write_string_array(const std::vector<std::string> &list);
+
+    oc::result<void> flush();
+
+private:
+    int _fd;
+    std::vector<unsigned char> _buf;
+};
+
 }
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbcommon/flags.h"
+#include "mbutil/fts.h"
+
+namespace mb::util
+{
+
+enum class WalkFlag : uint8_t
+{
+    // If tree contains a mountpoint, traverse its contents
+    CrossMountPointBoundaries   = 1 << 0,
+    // Call on_reached_special_file() instead of separate functions
+    GroupSpecialFiles           = 1 << 1,
+    // Don't stat non-directories when getdents64() reports their type
+    NoStat                      = 1 << 2,
+};
+MB_DECLARE_FLAGS(WalkFlags, WalkFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(WalkFlags)
+
+struct WalkEntry
+{
+    // Path of the entry (the input path joined with the relative path)
+    std::string path;
+    // Directory that `name` is relative to (AT_FDCWD for the root)
+    int dir_fd;
+    // Name of the entry inside `dir_fd` (the input path for the root)
+    const char *name;
+    // Open fd of the directory itself (-1 for everything else)
+    int fd;
+    // Depth of the entry (0 for the root)
+    size_t level;
+    // DT_* type of the entry
+    unsigned char type;
+    // Whether `sb` is valid. Always true for directories.
+    bool has_stat;
+    struct stat sb;
+};
+
+struct WalkNode;
+struct WalkQueue;
+
+/*!
+ * Multithreaded counterpart to FtsWrapper.
+ *
+ * Directories are read relative to their parent's fd with getdents64() and
+ * each worker thread keeps its own queue of subdirectories, stealing from the
+ * other threads when it runs out. The hooks match the ones in FtsWrapper,
+ * except that the current entry is passed in and that they are called from
+ * multiple threads at once, so subclasses must synchronize their own state.
+ *
+ * A directory's pre hook is called before any of its children are visited and
+ * its post hook is called after all of its descendants have been visited.
+ * There is no ordering between siblings. Symlinks are never followed.
+ */
+class ParallelWalker
+{
+public:
+    using Action = FtsWrapper::Action;
+    using Actions = FtsWrapper::Actions;
+
+    ParallelWalker(std::string path, WalkFlags flags, unsigned int threads);
+    virtual ~ParallelWalker();
+
+    bool run();
+    std::string error();
+
+    virtual bool on_pre_execute();
+    virtual bool on_post_execute(bool success);
+    virtual Actions on_changed_path(const WalkEntry &entry);
+    virtual Actions on_reached_directory_pre(const WalkEntry &entry);
+    virtual Actions on_reached_directory_post(const WalkEntry &entry);
+    virtual Actions on_reached_file(const WalkEntry &entry);
+    virtual Actions on_reached_symlink(const WalkEntry &entry);
+    virtual Actions on_reached_special_file(const WalkEntry &entry);
+
+    // Special files
+    virtual Actions on_reached_block_device(const WalkEntry &entry);
+    virtual Actions on_reached_character_device(const WalkEntry &entry);
+    virtual Actions on_reached_fifo(const WalkEntry &entry);
+    virtual Actions on_reached_socket(const WalkEntry &entry);
+
+protected:
+    // Input path
+    std::string _path;
+    // Input flags
+    WalkFlags _flags;
+
+    // Set the error message returned by error(). Only the first one is kept.
+    void set_error(std::string msg);
+
+private:
+    unsigned int _threads;
+    bool _ran;
+    dev_t _root_dev;
+
+    std::vector<std::unique_ptr<WalkQueue>> _queues;
+    // Directories that are queued or being read
+    std::atomic_size_t _pending;
+    // Directories that are queued
+    std::atomic_size_t _queued;
+    std::atomic_uint _sleeping;
+    std::atomic_bool _stop;
+    std::atomic_bool _failed;
+
+    std::mutex _idle_mutex;
+    std::condition_variable _idle_cv;
+
+    std::mutex _error_mutex;
+    std::string _error_msg;
+
+    void worker(size_t id);
+    std::shared_ptr<WalkNode> next_task(size_t id);
+    void push_task(size_t id, std::shared_ptr<WalkNode> node);
+
+    void read_directory(size_t id, const std::shared_ptr<WalkNode> &node);
+    bool visit_entry(size_t id, const std::shared_ptr<WalkNode> &node,
+                     const char *name, unsigned char type);
+    void finish_directory(std::shared_ptr<WalkNode> node);
+
+    Actions call_hooks(const WalkEntry &entry, bool post);
+    bool handle_actions(Actions actions);
+};
+
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2014-2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbutil/archive.h"
+
+namespace mb::util
+{
+
+struct ZipEntry
+{
+    std::string name;
+    uint16_t flags;
+    uint16_t method;
+    uint32_t crc32;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+    // Permission bits from the external attributes or 0 if not made on Unix
+    uint32_t mode;
+};
+
+/*!
+ * \brief Parsed central directory of a zip file
+ *
+ * The central directory is read once by load() and individual entries can
+ * then be looked up or extracted without rescanning the archive. Extraction
+ * seeks directly to each entry's local header, so several entries can be
+ * extracted in parallel from the same file.
+ */
+class ZipIndex
+{
+public:
+    ZipIndex();
+
+    bool load(const std::string &path);
+    void clear();
+
+    bool loaded() const;
+    const std::string & path() const;
+    const std::vector<ZipEntry> & entries() const;
+
+    const ZipEntry * find(const std::string &name) const;
+
+    bool exists(std::vector<ExistsInfo> &files) const;
+    bool extract(const std::vector<ExtractInfo> &files,
+                 unsigned int threads = 1) const;
+
+private:
+    bool extract_entry(int fd, const ZipEntry &entry,
+                       const std::string &target) const;
+
+    std::string _path;
+    bool _loaded;
+    uint64_t _size;
+    std::vector<ZipEntry> _entries;
+    std::unordered_map<std::string, size_t> _lookup;
+};
+
+}
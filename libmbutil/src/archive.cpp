@@ -20,14 +20,25 @@
 #include "mbutil/archive.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <cerrno>
 #include <cstring>
 
+#ifdef MBUTIL_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mblog/logging.h"
 #include "mbutil/directory.h"
 #include "mbutil/path.h"
+#include "mbutil/zip.h"
 
 #define LOG_TAG "mbutil/archive"
 
@@ -52,6 +63,245 @@ namespace mb::util
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedLinkResolver = std::unique_ptr<archive_entry_linkresolver,
         decltype(archive_entry_linkresolver_free) *>;
+using ScopedArchiveEntry = std::unique_ptr<archive_entry,
+        decltype(archive_entry_free) *>;
+
+// Compression uses a lot of memory per thread, so don't use every core
+static constexpr unsigned int MAX_COMPRESSION_THREADS = 4;
+
+// The tar stream is passed to a CompressionStage in chunks of this size
+static constexpr size_t COMPRESSION_STAGE_BUFFER_SIZE = 1024 * 1024;
+
+// Number of threads that write extracted entries to disk. Most of the time
+// goes to creating files and setting their metadata rather than to I/O.
+static constexpr unsigned int MAX_EXTRACT_THREADS = 4;
+
+// Limit on the file data that has been read, but not yet written to disk
+static constexpr size_t EXTRACT_QUEUE_MAX_BYTES = 32 * 1024 * 1024;
+
+// Files at least this large are written by the thread reading the archive
+static constexpr int64_t EXTRACT_INLINE_MIN_SIZE = 4 * 1024 * 1024;
+
+static unsigned int compression_threads()
+{
+    return std::clamp(std::thread::hardware_concurrency(),
+                      1u, MAX_COMPRESSION_THREADS);
+}
+
+/*!
+ * Stage that libarchive_tar_create() hands the output of the archive writer to.
+ * Subclasses may compress the tar stream themselves instead of using one of
+ * libarchive's write filters, which only run on the calling thread. Everything
+ * written to the output file is also passed to TarCreateHooks::output.
+ */
+class CompressionStage
+{
+public:
+    virtual ~CompressionStage() = default;
+
+    bool open(const std::string &filename, const TarCreateHooks *hooks)
+    {
+        _filename = filename;
+        _output_cb = hooks && hooks->output ? &hooks->output : nullptr;
+
+        if (!on_open()) {
+            return false;
+        }
+
+        if (auto r = _file.open(filename, FileOpenMode::WriteOnly); !r) {
+            LOGE("%s: Failed to open file: %s",
+                 filename.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    virtual bool write(const void *data, size_t size) = 0;
+
+    bool close()
+    {
+        bool ret = on_close();
+
+        if (auto r = _file.close(); !r) {
+            LOGE("%s: Failed to close file: %s",
+                 _filename.c_str(), r.error().message().c_str());
+            ret = false;
+        }
+
+        return ret;
+    }
+
+protected:
+    virtual bool on_open()
+    {
+        return true;
+    }
+
+    virtual bool on_close()
+    {
+        return true;
+    }
+
+    bool write_output(const void *data, size_t size)
+    {
+        if (auto r = file_write_exact(_file, data, size); !r) {
+            LOGE("%s: Failed to write data: %s",
+                 _filename.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (_output_cb) {
+            (*_output_cb)(data, size);
+        }
+
+        return true;
+    }
+
+    std::string _filename;
+
+private:
+    const std::function<void(const void *, size_t)> *_output_cb = nullptr;
+    StandardFile _file;
+};
+
+/*!
+ * Data that was already compressed by one of libarchive's write filters. This
+ * is only used when the output needs to be observed.
+ */
+class PassthroughStage : public CompressionStage
+{
+public:
+    bool write(const void *data, size_t size) override
+    {
+        return write_output(data, size);
+    }
+};
+
+#ifdef MBUTIL_HAVE_ZSTD
+/*!
+ * zstd compression with libzstd's worker threads. The input is split into jobs
+ * that are compressed in parallel while new data is still being read.
+ */
+class ZstdCompressionStage : public CompressionStage
+{
+public:
+    ZstdCompressionStage()
+        : _cctx(ZSTD_createCCtx(), ZSTD_freeCCtx)
+    {
+    }
+
+    bool write(const void *data, size_t size) override
+    {
+        auto ptr = static_cast<const unsigned char *>(data);
+
+        while (size > 0) {
+            size_t n = std::min(size, COMPRESSION_STAGE_BUFFER_SIZE - _in.size());
+            _in.insert(_in.end(), ptr, ptr + n);
+            ptr += n;
+            size -= n;
+
+            if (_in.size() == COMPRESSION_STAGE_BUFFER_SIZE
+                    && !compress(ZSTD_e_continue)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+protected:
+    bool on_open() override
+    {
+        if (!_cctx) {
+            LOGE("%s: Out of memory when creating zstd context", __FUNCTION__);
+            return false;
+        }
+
+        ZSTD_CCtx_setParameter(_cctx.get(), ZSTD_c_compressionLevel,
+                               ZSTD_CLEVEL_DEFAULT);
+        ZSTD_CCtx_setParameter(_cctx.get(), ZSTD_c_checksumFlag, 1);
+
+        // This fails if libzstd was built without multithreading support. The
+        // data is then compressed on the calling thread.
+        auto n_threads = static_cast<int>(compression_threads());
+        if (n_threads > 1 && ZSTD_isError(ZSTD_CCtx_setParameter(
+                _cctx.get(), ZSTD_c_nbWorkers, n_threads))) {
+            LOGW("%s: zstd was built without multithreading support",
+                 _filename.c_str());
+        }
+
+        _in.reserve(COMPRESSION_STAGE_BUFFER_SIZE);
+        _out.resize(ZSTD_CStreamOutSize());
+
+        return true;
+    }
+
+    bool on_close() override
+    {
+        return compress(ZSTD_e_end);
+    }
+
+private:
+    bool compress(ZSTD_EndDirective mode)
+    {
+        ZSTD_inBuffer input{ _in.data(), _in.size(), 0 };
+        bool finished;
+
+        do {
+            ZSTD_outBuffer output{ _out.data(), _out.size(), 0 };
+
+            size_t remaining = ZSTD_compressStream2(
+                    _cctx.get(), &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                LOGE("%s: Failed to compress data: %s",
+                     _filename.c_str(), ZSTD_getErrorName(remaining));
+                return false;
+            }
+
+            if (!write_output(_out.data(), output.pos)) {
+                return false;
+            }
+
+            finished = mode == ZSTD_e_end
+                    ? remaining == 0
+                    : input.pos == input.size;
+        } while (!finished);
+
+        _in.clear();
+        return true;
+    }
+
+    std::unique_ptr<ZSTD_CCtx, decltype(ZSTD_freeCCtx) *> _cctx;
+    std::vector<unsigned char> _in;
+    std::vector<unsigned char> _out;
+};
+#endif
+
+static la_ssize_t compression_stage_write_cb(archive *a, void *userdata,
+                                             const void *buf, size_t size)
+{
+    auto *stage = static_cast<CompressionStage *>(userdata);
+
+    if (!stage->write(buf, size)) {
+        archive_set_error(a, EIO, "Failed to compress data");
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(size);
+}
+
+static int compression_stage_close_cb(archive *a, void *userdata)
+{
+    auto *stage = static_cast<CompressionStage *>(userdata);
+
+    if (!stage->close()) {
+        archive_set_error(a, EIO, "Failed to finish compressing data");
+        return ARCHIVE_FATAL;
+    }
+
+    return ARCHIVE_OK;
+}
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
 {
@@ -83,9 +333,12 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
  *
  * \see tar/write.c from libarchive's source code
  */
-bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry)
+static bool copy_data_disk_to_archive(archive *in, archive *out,
+                                      archive_entry *entry,
+                                      const TarCreateHooks *hooks)
 {
+    auto data_cb = hooks && hooks->data ? &hooks->data : nullptr;
+
     size_t bytes_read;
     ssize_t bytes_written;
     int64_t offset;
@@ -119,6 +372,10 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
                     return false;
                 }
 
+                if (data_cb) {
+                    (*data_cb)(entry, null_buf, ns);
+                }
+
                 progress += bytes_written;
                 sparse -= bytes_written;
             }
@@ -136,6 +393,10 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
             return false;
         }
 
+        if (data_cb) {
+            (*data_cb)(entry, buf, bytes_read);
+        }
+
         progress += bytes_written;
     }
 
@@ -144,9 +405,25 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
         return false;
     }
 
+    // A trailing hole is not returned as a data block
+    if (data_cb) {
+        for (int64_t size = archive_entry_size(entry); progress < size;) {
+            auto n = static_cast<size_t>(std::min<int64_t>(
+                    size - progress, static_cast<int64_t>(sizeof(null_buf))));
+            (*data_cb)(entry, null_buf, n);
+            progress += static_cast<int64_t>(n);
+        }
+    }
+
     return true;
 }
 
+bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
+                                          archive_entry *entry)
+{
+    return copy_data_disk_to_archive(in, out, entry, nullptr);
+}
+
 int libarchive_copy_header_and_data(archive *in, archive *out,
                                     archive_entry *entry)
 {
@@ -164,6 +441,236 @@ int libarchive_copy_header_and_data(archive *in, archive *out,
     return ret;
 }
 
+/*!
+ * \brief Entry read from an archive and waiting to be written to disk
+ */
+struct ExtractItem
+{
+    struct Block
+    {
+        int64_t offset;
+        std::vector<unsigned char> data;
+    };
+
+    ScopedArchiveEntry entry{nullptr, archive_entry_free};
+    std::vector<Block> blocks;
+    size_t size = 0;
+};
+
+/*!
+ * \brief Pool of threads writing entries to disk for libarchive_tar_extract()
+ *
+ * Each thread has its own disk writer. The writers are only closed, which
+ * applies the deferred directory permissions and timestamps, after every
+ * thread has finished.
+ */
+class ExtractPool
+{
+public:
+    ExtractPool() = default;
+
+    ~ExtractPool()
+    {
+        // Discard the queue if extraction was aborted
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _failed = true;
+        }
+        finish();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ExtractPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ExtractPool)
+
+    bool start(unsigned int n_threads)
+    {
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            ScopedArchive out(archive_write_disk_new(), archive_write_free);
+            if (!out) {
+                LOGE("%s: Out of memory when creating disk writer",
+                     __FUNCTION__);
+                return false;
+            }
+
+            archive_write_disk_set_standard_lookup(out.get());
+            archive_write_disk_set_options(out.get(),
+                                           LIBARCHIVE_DISK_WRITER_FLAGS);
+
+            _writers.push_back(std::move(out));
+        }
+
+        for (auto &writer : _writers) {
+            _threads.emplace_back(&ExtractPool::run, this, writer.get());
+        }
+
+        return true;
+    }
+
+    // Returns false if a write already failed
+    bool push(ExtractItem item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Always accept one item so that a full queue can't block forever
+        _cv.wait(lock, [&] {
+            return _failed || _queue.empty()
+                    || _queued_bytes + item.size <= EXTRACT_QUEUE_MAX_BYTES;
+        });
+
+        if (_failed) {
+            return false;
+        }
+
+        _queued_bytes += item.size;
+        _queue.push_back(std::move(item));
+        _cv.notify_all();
+
+        return true;
+    }
+
+    // Wait for every queued item to be written
+    bool wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _cv.wait(lock, [&] {
+            return _failed || (_queue.empty() && _active == 0);
+        });
+
+        return !_failed;
+    }
+
+    bool finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _done = true;
+        }
+        _cv.notify_all();
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+        _threads.clear();
+
+        for (auto &writer : _writers) {
+            if (archive_write_close(writer.get()) != ARCHIVE_OK) {
+                LOGE("Failed to close disk writer: %s",
+                     archive_error_string(writer.get()));
+                _failed = true;
+            }
+        }
+        _writers.clear();
+
+        return !_failed;
+    }
+
+private:
+    void run(archive *out)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] {
+                return _failed || _done || !_queue.empty();
+            });
+
+            if (_failed || _queue.empty()) {
+                break;
+            }
+
+            ExtractItem item = std::move(_queue.front());
+            _queue.pop_front();
+            _queued_bytes -= item.size;
+            ++_active;
+            _cv.notify_all();
+
+            lock.unlock();
+            bool ret = write_item(out, item);
+            lock.lock();
+
+            --_active;
+            if (!ret) {
+                _failed = true;
+            }
+            _cv.notify_all();
+        }
+    }
+
+    static bool write_item(archive *out, const ExtractItem &item)
+    {
+        archive_entry *entry = item.entry.get();
+
+        if (archive_write_header(out, entry) != ARCHIVE_OK) {
+            LOGE("%s: %s", archive_entry_pathname(entry),
+                 archive_error_string(out));
+            return false;
+        }
+
+        for (auto const &block : item.blocks) {
+            if (archive_write_data_block(out, block.data.data(),
+                                         block.data.size(), block.offset)
+                    != ARCHIVE_OK) {
+                LOGE("%s: Failed to write data: %s",
+                     archive_entry_pathname(entry), archive_error_string(out));
+                return false;
+            }
+        }
+
+        if (archive_write_finish_entry(out) != ARCHIVE_OK) {
+            LOGE("%s: %s", archive_entry_pathname(entry),
+                 archive_error_string(out));
+            return false;
+        }
+
+        return true;
+    }
+
+    std::vector<ScopedArchive> _writers;
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<ExtractItem> _queue;
+    size_t _queued_bytes = 0;
+    unsigned int _active = 0;
+    bool _done = false;
+    bool _failed = false;
+};
+
+/*!
+ * \brief Read the data of the current entry into an ExtractItem
+ */
+static bool read_extract_item(archive *in, archive_entry *entry,
+                              ExtractItem &item)
+{
+    item.entry.reset(archive_entry_clone(entry));
+    if (!item.entry) {
+        LOGE("%s: Out of memory when copying entry", __FUNCTION__);
+        return false;
+    }
+
+    const void *buff;
+    size_t size;
+    int64_t offset;
+    int ret;
+
+    while ((ret = archive_read_data_block(
+            in, &buff, &size, &offset)) == ARCHIVE_OK) {
+        auto data = static_cast<const unsigned char *>(buff);
+        item.blocks.push_back({ offset, { data, data + size } });
+        item.size += size;
+    }
+
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: Data copy ended without reaching EOF: %s",
+             archive_entry_pathname(entry), archive_error_string(in));
+        return false;
+    }
+
+    return true;
+}
+
 /*
  * The following libarchive functions are based on code from bsdtar. The main
  * difference is that they will not try to extract/add as many files as possible
@@ -171,6 +678,22 @@ int libarchive_copy_header_and_data(archive *in, archive *out,
  * warning because an incomplete archive is useless for backup and restoring.
  */
 
+/*!
+ * \brief Extract a tar archive
+ *
+ * The archive is decompressed and parsed on the calling thread while a pool of
+ * threads creates the files and applies their metadata. Directories, hard
+ * links and large files are extracted by the calling thread. Hard links wait
+ * for the queued entries to be written first so that their targets exist.
+ *
+ * \param filename Path to archive
+ * \param target Directory to extract to
+ * \param patterns Only extract entries that match one of these patterns. All
+ *                 entries are extracted if the list is empty.
+ * \param compression Compression type
+ *
+ * \return Whether all matching entries were extracted
+ */
 bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
@@ -222,6 +745,15 @@ bool libarchive_tar_extract(const std::string &filename,
     case CompressionType::Xz:
         archive_read_support_filter_xz(in.get());
         break;
+    case CompressionType::Zstd:
+#ifdef MBUTIL_HAVE_ZSTD
+        archive_read_support_filter_zstd(in.get());
+        break;
+#else
+        LOGE("%s: zstd support was not enabled at build time",
+             filename.c_str());
+        return false;
+#endif
     default:
         LOGE("Invalid compression type");
         return false;
@@ -238,6 +770,12 @@ bool libarchive_tar_extract(const std::string &filename,
         return false;
     }
 
+    ExtractPool pool;
+    if (!pool.start(std::clamp(std::thread::hardware_concurrency(),
+                               1u, MAX_EXTRACT_THREADS))) {
+        return false;
+    }
+
     archive_entry *entry;
     int ret;
     std::string target_path;
@@ -277,6 +815,25 @@ bool libarchive_tar_extract(const std::string &filename,
             continue;
         }
 
+        // Small files are handed off to the pool. Directories are created
+        // here so that they exist before their children are queued.
+        bool is_hardlink = archive_entry_hardlink(entry);
+
+        if (archive_entry_filetype(entry) != AE_IFDIR && !is_hardlink
+                && archive_entry_size(entry) < EXTRACT_INLINE_MIN_SIZE) {
+            ExtractItem item;
+
+            if (!read_extract_item(in.get(), entry, item)
+                    || !pool.push(std::move(item))) {
+                return false;
+            }
+            continue;
+        }
+
+        if (is_hardlink && !pool.wait_idle()) {
+            return false;
+        }
+
         // Extract file
         ret = archive_read_extract2(in.get(), entry, out.get());
         if (ret != ARCHIVE_OK) {
@@ -286,6 +843,17 @@ bool libarchive_tar_extract(const std::string &filename,
         }
     }
 
+    // The pool's writers must be closed before the directory metadata that
+    // this thread's writer deferred is applied
+    if (!pool.finish()) {
+        return false;
+    }
+
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", target.c_str(), archive_error_string(out.get()));
+        return false;
+    }
+
     if (archive_read_close(in.get()) != ARCHIVE_OK) {
         LOGE("%s: %s", filename.c_str(), archive_error_string(in.get()));
         return false;
@@ -305,7 +873,8 @@ bool libarchive_tar_extract(const std::string &filename,
     return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
 }
 
-static bool write_file(archive *in, archive *out, archive_entry *entry)
+static bool write_file(archive *in, archive *out, archive_entry *entry,
+                       const TarCreateHooks *hooks)
 {
     int ret;
 
@@ -315,8 +884,13 @@ static bool write_file(archive *in, archive *out, archive_entry *entry)
         return false;
     }
 
-    if (archive_entry_size(entry) > 0) {
-        return libarchive_copy_data_disk_to_archive(in, out, entry);
+    if (archive_entry_size(entry) > 0
+            && !copy_data_disk_to_archive(in, out, entry, hooks)) {
+        return false;
+    }
+
+    if (hooks && hooks->finished) {
+        hooks->finished(entry);
     }
 
     return true;
@@ -339,13 +913,18 @@ static int metadata_filter(archive *a, void *data, archive_entry *entry)
  * \param filename Target archive path
  * \param base_dir Base directory for \a paths
  * \param paths List of paths to add to the archive
+ * \param compression Compression type. xz and zstd compression use multiple
+ *                    threads when the libraries support it.
+ * \param hooks Optional callbacks for filtering the entries and observing the
+ *              data that is written
  *
  * \return Whether the archive creation was successful
  */
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
-                           CompressionType compression)
+                           CompressionType compression,
+                           const TarCreateHooks *hooks)
 {
     if (base_dir.empty() && paths.empty()) {
         LOGE("%s: No base directory or paths specified", filename.c_str());
@@ -357,6 +936,8 @@ bool libarchive_tar_create(const std::string &filename,
         LOGE("%s: Out of memory when creating disk reader", __FUNCTION__);
         return false;
     }
+    // Must outlive the archive writer, which may still write to it when freed
+    std::unique_ptr<CompressionStage> stage;
     ScopedArchive out(archive_write_new(), archive_write_free);
     if (!out) {
         LOGE("%s: Out of memory when creating archive writer", __FUNCTION__);
@@ -401,7 +982,23 @@ bool libarchive_tar_create(const std::string &filename,
         break;
     case CompressionType::Xz:
         archive_write_add_filter_xz(out.get());
+        // Not available if liblzma was built without multithreading support
+        if (archive_write_set_filter_option(
+                out.get(), "xz", "threads",
+                std::to_string(compression_threads()).c_str()) != ARCHIVE_OK) {
+            LOGD("%s: Compressing with a single thread: %s",
+                 filename.c_str(), archive_error_string(out.get()));
+        }
         break;
+    case CompressionType::Zstd:
+#ifdef MBUTIL_HAVE_ZSTD
+        stage = std::make_unique<ZstdCompressionStage>();
+        break;
+#else
+        LOGE("%s: zstd support was not enabled at build time",
+             filename.c_str());
+        return false;
+#endif
     default:
         LOGE("Invalid compression type");
         return false;
@@ -411,8 +1008,27 @@ bool libarchive_tar_create(const std::string &filename,
     archive_entry_linkresolver_set_strategy(resolver.get(),
                                             archive_format(out.get()));
 
+    if (!stage && hooks && hooks->output) {
+        stage = std::make_unique<PassthroughStage>();
+        // Don't pad the output to a whole block, like when writing to a file
+        archive_write_set_bytes_in_last_block(out.get(), 1);
+    }
+
     // Open output file
-    if (archive_write_open_filename(out.get(), filename.c_str()) != ARCHIVE_OK) {
+    if (stage) {
+        if (!stage->open(filename, hooks)) {
+            return false;
+        }
+
+        if (archive_write_open(out.get(), stage.get(), nullptr,
+                               &compression_stage_write_cb,
+                               &compression_stage_close_cb) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open archive writer: %s",
+                 filename.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+    } else if (archive_write_open_filename(
+            out.get(), filename.c_str()) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(out.get()));
         return false;
@@ -491,14 +1107,19 @@ bool libarchive_tar_create(const std::string &filename,
                 LOGW("%s: Skipping socket", archive_entry_pathname(entry));
                 continue;
             default:
-                LOGV("%s", archive_entry_pathname(entry));
                 break;
             }
 
+            if (hooks && hooks->filter && !hooks->filter(entry)) {
+                continue;
+            }
+
+            LOGV("%s", archive_entry_pathname(entry));
+
             archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
 
             if (entry) {
-                if (!write_file(in.get(), out.get(), entry)) {
+                if (!write_file(in.get(), out.get(), entry, hooks)) {
                     archive_entry_free(entry);
                     return false;
                 }
@@ -506,7 +1127,7 @@ bool libarchive_tar_create(const std::string &filename,
                 entry = nullptr;
             }
             if (sparse_entry) {
-                if (!write_file(in.get(), out.get(), sparse_entry)) {
+                if (!write_file(in.get(), out.get(), sparse_entry, hooks)) {
                     archive_entry_free(sparse_entry);
                     return false;
                 }
@@ -550,7 +1171,7 @@ bool libarchive_tar_create(const std::string &filename,
             return false;
         }
 
-        if (!write_file(in.get(), out.get(), entry)) {
+        if (!write_file(in.get(), out.get(), entry, hooks)) {
             archive_entry_free(entry);
             return false;
         }
@@ -736,6 +1357,14 @@ bool extract_files2(const std::string &filename,
         return false;
     }
 
+    // Zip files can be extracted straight from the central directory instead
+    // of decompressing every entry in the archive to find the requested ones
+    if (ZipIndex index; index.load(filename)) {
+        return index.extract(files, std::thread::hardware_concurrency());
+    }
+
+    LOGW("%s: Falling back to sequential extraction", filename.c_str());
+
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
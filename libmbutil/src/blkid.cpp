@@ -19,14 +19,24 @@
 
 #include "mbutil/blkid.h"
 
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include <cerrno>
 #include <cstring>
 
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#  include <linux/fs.h>
+#endif
+
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 
@@ -36,6 +46,17 @@
 namespace mb::util
 {
 
+// Covers every superblock checked below (the furthest is btrfs' magic at
+// 64 KiB + 0x40), rounded up to a whole number of pages
+constexpr size_t PROBE_WINDOW_SIZE = 68 * 1024;
+
+// Identifies a device or file and changes if it is resized or modified:
+// { device, inode, size, mtime (s), mtime (ns) }
+using ProbeKey = std::tuple<uint64_t, uint64_t, uint64_t, int64_t, int64_t>;
+
+static std::mutex g_cache_lock;
+static std::map<ProbeKey, std::string> g_cache;
+
 static inline bool check_magic(const void *data, size_t data_size,
                                const void *magic, size_t magic_size,
                                size_t offset)
@@ -114,7 +135,8 @@ static oc::result<size_t> read_all(int fd, void *buf, size_t size)
     size_t total = 0;
 
     while (total < size) {
-        ssize_t n = read(fd, static_cast<char *>(buf) + total, size - total);
+        ssize_t n = pread64(fd, static_cast<char *>(buf) + total, size - total,
+                            static_cast<off64_t>(total));
         if (n == 0) {
             break;
         } else if (n < 0) {
@@ -131,10 +153,42 @@ static oc::result<size_t> read_all(int fd, void *buf, size_t size)
     return total;
 }
 
-oc::result<std::string> blkid_get_fs_type(const std::string &path)
+static oc::result<ProbeKey> get_probe_key(int fd)
 {
-    std::vector<unsigned char> buf(1024 * 1024);
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISBLK(sb.st_mode)) {
+        uint64_t size = 0;
+#ifdef __linux__
+        if (ioctl(fd, BLKGETSIZE64, &size) < 0) {
+            return ec_from_errno();
+        }
+#endif
+
+        // Writes through the block device do not update any timestamps
+        return ProbeKey{sb.st_rdev, 0, size, 0, 0};
+    }
 
+    return ProbeKey{sb.st_dev, sb.st_ino, static_cast<uint64_t>(sb.st_size),
+                    sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec};
+}
+
+/*!
+ * \brief Detect the filesystem type of a block device or image
+ *
+ * Only the first PROBE_WINDOW_SIZE bytes are read. Results are cached for the
+ * lifetime of the process, keyed by the device number (or inode for files)
+ * and the size (and modification time for files). A block device that is
+ * reformatted without being resized keeps its cached type, so code that
+ * formats devices must call blkid_clear_cache().
+ *
+ * \return Filesystem type or an empty string if it is unknown
+ */
+oc::result<std::string> blkid_get_fs_type(const std::string &path)
+{
     int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         return ec_from_errno();
@@ -144,15 +198,71 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
         close(fd);
     });
 
+    OUTCOME_TRY(key, get_probe_key(fd));
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+
+        if (auto it = g_cache.find(key); it != g_cache.end()) {
+            return it->second;
+        }
+    }
+
+    std::vector<unsigned char> buf(PROBE_WINDOW_SIZE);
+
     OUTCOME_TRY(n, read_all(fd, buf.data(), buf.size()));
 
+    std::string fs_type;
+
     for (auto const &pf : g_probe_funcs) {
         if (pf.func(buf.data(), n)) {
-            return pf.name;
+            fs_type = pf.name;
+            break;
         }
     }
 
-    return "";
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    g_cache.insert_or_assign(key, fs_type);
+
+    return std::move(fs_type);
+}
+
+/*!
+ * \brief Detect the filesystem types of several devices in parallel
+ *
+ * Every device is probed on its own thread because reading the superblocks of
+ * slow devices, like SD cards, is dominated by latency.
+ *
+ * \return Result of blkid_get_fs_type() for each path in \a paths
+ */
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths)
+{
+    std::vector<oc::result<std::string>> results(
+            paths.size(), std::errc::operation_canceled);
+    std::vector<std::thread> workers;
+    workers.reserve(paths.size());
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        workers.emplace_back([&, i] {
+            results[i] = blkid_get_fs_type(paths[i]);
+        });
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    return results;
+}
+
+/*!
+ * \brief Forget the cached results of blkid_get_fs_type()
+ */
+void blkid_clear_cache()
+{
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    g_cache.clear();
 }
 
 }
@@ -19,65 +19,89 @@
 
 #include "mbutil/chmod.h"
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
 #include <cstdlib>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/string.h"
-#include "mbutil/fts.h"
+#include "mbutil/walker.h"
 
 
 namespace mb::util
 {
 
-class RecursiveChmod : public FtsWrapper {
-public:
-    std::error_code ec;
+// Maximum number of threads changing permissions
+constexpr unsigned int CHMOD_MAX_THREADS = 4;
 
+class RecursiveChmod : public ParallelWalker {
+public:
     RecursiveChmod(std::string path, mode_t perms)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : ParallelWalker(std::move(path),
+                         WalkFlag::GroupSpecialFiles | WalkFlag::NoStat,
+                         std::clamp(std::thread::hardware_concurrency(),
+                                    1u, CHMOD_MAX_THREADS))
         , _perms(perms)
     {
     }
 
-    Actions on_reached_directory_pre() override
+    std::error_code ec()
     {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _ec;
+    }
+
+    Actions on_reached_directory_pre(const WalkEntry &entry) override
+    {
+        (void) entry;
         // Do nothing. Need depth-first search.
         return Action::Ok;
     }
 
-    Actions on_reached_directory_post() override
+    Actions on_reached_directory_post(const WalkEntry &entry) override
     {
-        return chmod_path() ? Action::Ok : Action::Fail;
+        return check(fchmod(entry.fd, _perms));
     }
 
-    Actions on_reached_file() override
+    Actions on_reached_file(const WalkEntry &entry) override
     {
-        return chmod_path() ? Action::Ok : Action::Fail;
+        return check(fchmodat(entry.dir_fd, entry.name, _perms, 0));
     }
 
-    Actions on_reached_symlink() override
+    Actions on_reached_symlink(const WalkEntry &entry) override
     {
+        (void) entry;
         return Action::Skip;
     }
 
-    Actions on_reached_special_file() override
+    Actions on_reached_special_file(const WalkEntry &entry) override
     {
-        return chmod_path() ? Action::Ok : Action::Fail;
+        return check(fchmodat(entry.dir_fd, entry.name, _perms, 0));
     }
 
 private:
     mode_t _perms;
+    std::mutex _mutex;
+    std::error_code _ec;
 
-    bool chmod_path()
+    Actions check(int ret)
     {
-        if (::chmod(_curr->fts_accpath, _perms) < 0) {
-            ec = ec_from_errno();
-            return false;
+        if (ret < 0) {
+            auto ec = ec_from_errno();
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_ec) {
+                _ec = ec;
+            }
+            return Action::Fail;
         }
-        return true;
+        return Action::Ok;
     }
 };
 
@@ -87,7 +111,7 @@ oc::result<void> chmod(const std::string &path, mode_t perms, ChmodFlags flags)
     if (flags & ChmodFlag::Recursive) {
         RecursiveChmod fts(path, perms);
         if (!fts.run()) {
-            return fts.ec;
+            return fts.ec();
         }
     } else {
         if (::chmod(path.c_str(), perms) < 0) {
@@ -19,15 +19,18 @@
 
 #include "mbutil/command.h"
 
+#include <algorithm>
 #include <array>
 
 #include <cerrno>
+#include <csignal>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -118,14 +121,16 @@ bool command_start(CommandCtx &ctx)
                 ctx.log_argv ? ctx.argv : std::vector<std::string>{},
                 ctx.log_envp ? ctx.envp : std::optional<std::vector<std::string>>{});
 
-    // Create stdout/stderr pipe if output callback is provided
+    // Create stdout/stderr pipe if output callback is provided. The pipes are
+    // close-on-exec, so the child only keeps the dup2()'d ends and concurrently
+    // running commands do not inherit each other's pipes.
     if (ctx.redirect_stdio) {
-        if (pipe(ctx._priv->stdout_pipe.data()) < 0) {
+        if (pipe2(ctx._priv->stdout_pipe.data(), O_CLOEXEC) < 0) {
             ctx._priv->stdout_pipe[0] = -1;
             ctx._priv->stdout_pipe[1] = -1;
             goto error;
         }
-        if (pipe(ctx._priv->stderr_pipe.data()) < 0) {
+        if (pipe2(ctx._priv->stderr_pipe.data(), O_CLOEXEC) < 0) {
             ctx._priv->stderr_pipe[0] = -1;
             ctx._priv->stderr_pipe[1] = -1;
             goto error;
@@ -138,11 +143,12 @@ bool command_start(CommandCtx &ctx)
         }
     }
 
-    ctx._priv->pid = fork();
-    if (ctx._priv->pid < 0) {
-        LOGE("Failed to fork: %s", strerror(errno));
-        goto error;
-    } else if (ctx._priv->pid == 0) {
+    {
+        // The child is created with vfork(), which does not copy the page
+        // tables of this (potentially very large) process. The child shares
+        // our memory until it execs, so everything it needs is prepared here
+        // and it may only make syscalls. Errors are reported back through
+        // child_errno and child_step and logged by the parent.
         std::vector<const char *> c_argv;
         for (auto const &arg : ctx.argv) {
             c_argv.push_back(arg.c_str());
@@ -157,69 +163,106 @@ bool command_start(CommandCtx &ctx)
             c_envp.push_back(nullptr);
         }
 
-        // Close read end of the pipes
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[0]);
-        }
+        const char *path = ctx.path.c_str();
+        const char *chroot_dir =
+                ctx.chroot_dir.empty() ? nullptr : ctx.chroot_dir.c_str();
+        int stdout_fd = ctx._priv->stdout_pipe[1];
+        int stderr_fd = ctx._priv->stderr_pipe[1];
+
+        volatile int child_errno = 0;
+        const char * volatile child_step = nullptr;
+        const char * volatile child_subject = path;
+
+        // Keep signal handlers from running in the child while it shares our
+        // memory
+        sigset_t all_signals;
+        sigset_t old_signals;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+        ctx._priv->pid = vfork();
+        if (ctx._priv->pid == 0) {
+            // Chroot if needed
+            if (chroot_dir) {
+                if (chdir(chroot_dir) < 0) {
+                    child_step = "Failed to chdir";
+                    child_subject = chroot_dir;
+                    goto child_error;
+                }
+                if (chroot(chroot_dir) < 0) {
+                    child_step = "Failed to chroot";
+                    child_subject = chroot_dir;
+                    goto child_error;
+                }
+            }
 
-        // Chroot if needed
-        if (!ctx.chroot_dir.empty()) {
-            if (chdir(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chdir: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
+            // Reassign stdout/stderr fds
+            if (stdout_fd >= 0 && dup2(stdout_fd, STDOUT_FILENO) < 0) {
+                child_step = "Failed to redirect stdout";
                 goto child_error;
             }
-            if (chroot(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chroot: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
+            if (stderr_fd >= 0 && dup2(stderr_fd, STDERR_FILENO) < 0) {
+                child_step = "Failed to redirect stderr";
                 goto child_error;
             }
-        }
 
-        // Reassign stdout/stderr fds
-        if (ctx.redirect_stdio) {
-            if (dup2(ctx._priv->stdout_pipe[1], STDOUT_FILENO) < 0) {
-                LOGE("Failed to redirect stdout: %s", strerror(errno));
-                goto child_error;
+            // Like posix_spawn(), reset caught signals to their default
+            // actions before unblocking them. Otherwise, a pending signal
+            // would run the parent's handler on the parent's stack. The
+            // child has its own copy of the dispositions, so this does not
+            // affect the parent.
+            for (int sig = 1; sig < NSIG; ++sig) {
+                struct sigaction sa;
+                if (sigaction(sig, nullptr, &sa) == 0
+                        && sa.sa_handler != SIG_DFL
+                        && sa.sa_handler != SIG_IGN) {
+                    sa.sa_handler = SIG_DFL;
+                    sa.sa_flags = 0;
+                    sigemptyset(&sa.sa_mask);
+                    sigaction(sig, &sa, nullptr);
+                }
             }
-            if (dup2(ctx._priv->stderr_pipe[1], STDERR_FILENO) < 0) {
-                LOGE("Failed to redirect stderr: %s", strerror(errno));
-                goto child_error;
+
+            sigprocmask(SIG_SETMASK, &old_signals, nullptr);
+
+            if (ctx.envp) {
+                execvpe(path,
+                        const_cast<char * const *>(c_argv.data()),
+                        const_cast<char * const *>(c_envp.data()));
+            } else {
+                execvp(path, const_cast<char * const *>(c_argv.data()));
             }
 
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[1]);
-        }
+            child_step = "Failed to exec";
 
-        if (ctx.envp) {
-            execvpe(ctx.path.c_str(),
-                    const_cast<char * const *>(c_argv.data()),
-                    const_cast<char * const *>(c_envp.data()));
-        } else {
-            execvp(ctx.path.c_str(),
-                   const_cast<char * const *>(c_argv.data()));
+        child_error:
+            child_errno = errno;
+            _exit(127);
         }
 
-        LOGE("%s: Failed to exec: %s", ctx.path.c_str(), strerror(errno));
+        int saved_errno = errno;
+        pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
 
-    child_error:
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[1]);
+        if (ctx._priv->pid < 0) {
+            LOGE("Failed to vfork: %s", strerror(saved_errno));
+            errno = saved_errno;
+            goto error;
         }
 
-        _exit(127);
-    } else {
-        // Close write ends of the pipes
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[1]);
+        // The child has exec'd or exited by now. A failed child exits with
+        // status 127, which is returned by command_wait().
+        if (child_step) {
+            LOGE("%s: %s: %s", child_subject, child_step,
+                 strerror(child_errno));
         }
     }
 
+    // Close write ends of the pipes
+    if (ctx.redirect_stdio) {
+        safely_close(ctx._priv->stdout_pipe[1]);
+        safely_close(ctx._priv->stderr_pipe[1]);
+    }
+
     return true;
 
 error:
@@ -295,14 +338,9 @@ bool command_raw_reader(CommandCtx &ctx, CmdRawCb cb, void *userdata)
         for (int i = 0; i < fds_size; ++i) {
             bool is_stderr = fds[i].fd == ctx._priv->stderr_pipe[0];
 
-            if (fds[i].revents & POLLHUP) {
-                // EOF/pipe closed. The fd will be closed later
-                fds[i].fd = -1;
-                fds[i].events = 0;
-
-                // Final call for EOF
-                cb(buf, 0, is_stderr, userdata);
-            } else if (fds[i].revents & POLLIN) {
+            // Data that is still in the pipe is read before handling POLLHUP,
+            // which is reported together with POLLIN once the child exits
+            if (fds[i].revents & POLLIN) {
                 ssize_t n = read(fds[i].fd, buf, sizeof(buf) - 1);
                 if (n < 0) {
                     if (errno != EAGAIN
@@ -313,15 +351,28 @@ bool command_raw_reader(CommandCtx &ctx, CmdRawCb cb, void *userdata)
                         fds[i].events = 0;
                         ret = false;
                     }
+                } else if (n == 0) {
+                    // EOF. The fd will be closed later
+                    fds[i].fd = -1;
+                    fds[i].events = 0;
+
+                    // Final call for EOF
+                    buf[0] = '\0';
+                    cb(buf, 0, is_stderr, userdata);
                 } else {
                     // NULL-terminate
                     buf[n] = '\0';
 
-                    // Potential EOF (n == 0) here on some non-Linux systems,
-                    // which is fine since it's not possible to reach both the
-                    // POLLHUP block and this block
                     cb(buf, static_cast<size_t>(n), is_stderr, userdata);
                 }
+            } else if (fds[i].revents & (POLLHUP | POLLERR)) {
+                // EOF/pipe closed. The fd will be closed later
+                fds[i].fd = -1;
+                fds[i].events = 0;
+
+                // Final call for EOF
+                buf[0] = '\0';
+                cb(buf, 0, is_stderr, userdata);
             }
         }
     }
@@ -417,6 +468,124 @@ bool command_line_reader(CommandCtx &ctx, CmdLineCb cb, void *userdata)
     return command_raw_reader(ctx, &command_line_reader_cb, &reader_ctx);
 }
 
+struct CommandLineViewReaderCtx
+{
+    // Only used for lines that span multiple chunks of output
+    std::array<char, 4096> stdout_buf;
+    std::array<char, 4096> stderr_buf;
+    size_t stdout_used = 0;
+    size_t stderr_used = 0;
+
+    CmdLineViewCb cb;
+    void *userdata;
+
+    CmdLineRateLimit limit;
+    std::chrono::steady_clock::time_point interval_start;
+    size_t interval_lines = 0;
+    size_t dropped = 0;
+};
+
+static void report_dropped_lines(CommandLineViewReaderCtx &ctx)
+{
+    if (ctx.dropped > 0) {
+        LOGW("Dropped %zu lines of command output", ctx.dropped);
+        ctx.dropped = 0;
+    }
+}
+
+static void emit_line(CommandLineViewReaderCtx &ctx, std::string_view line,
+                      bool error)
+{
+    if (ctx.limit.max_lines > 0) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - ctx.interval_start >= ctx.limit.interval) {
+            report_dropped_lines(ctx);
+            ctx.interval_start = now;
+            ctx.interval_lines = 0;
+        }
+
+        if (ctx.interval_lines >= ctx.limit.max_lines) {
+            ++ctx.dropped;
+            return;
+        }
+
+        ++ctx.interval_lines;
+    }
+
+    ctx.cb(line, error, ctx.userdata);
+}
+
+static void command_line_view_reader_cb(const char *data, size_t size,
+                                        bool error, void *userdata)
+{
+    auto *ctx = static_cast<CommandLineViewReaderCtx *>(userdata);
+
+    auto &buf = error ? ctx->stderr_buf : ctx->stdout_buf;
+    size_t &used = error ? ctx->stderr_used : ctx->stdout_used;
+
+    // Reached EOF
+    if (size == 0) {
+        if (used > 0) {
+            emit_line(*ctx, {buf.data(), used}, error);
+            used = 0;
+        }
+        return;
+    }
+
+    const char *end = data + size;
+
+    while (data < end) {
+        auto newline = static_cast<const char *>(
+                memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char *next = newline ? newline + 1 : end;
+        size_t n = static_cast<size_t>((newline ? newline : end) - data);
+
+        if (newline && used == 0) {
+            // The whole line is in this chunk, so it's passed as is
+            emit_line(*ctx, {data, n}, error);
+        } else {
+            // Buffer the partial line, splitting it if it's too long
+            while (n > 0) {
+                size_t to_copy = std::min(n, buf.size() - used);
+                memcpy(buf.data() + used, data, to_copy);
+                data += to_copy;
+                n -= to_copy;
+                used += to_copy;
+
+                if (used == buf.size()) {
+                    emit_line(*ctx, {buf.data(), used}, error);
+                    used = 0;
+                }
+            }
+
+            if (newline && used > 0) {
+                emit_line(*ctx, {buf.data(), used}, error);
+                used = 0;
+            }
+        }
+
+        data = next;
+    }
+}
+
+bool command_line_view_reader(CommandCtx &ctx, CmdLineViewCb cb,
+                              void *userdata, const CmdLineRateLimit &limit)
+{
+    CommandLineViewReaderCtx reader_ctx;
+    reader_ctx.cb = cb;
+    reader_ctx.userdata = userdata;
+    reader_ctx.limit = limit;
+    reader_ctx.interval_start = std::chrono::steady_clock::now();
+
+    bool ret = command_raw_reader(ctx, &command_line_view_reader_cb,
+                                  &reader_ctx);
+
+    report_dropped_lines(reader_ctx);
+
+    return ret;
+}
+
 int run_command(const std::string &path,
                 const std::vector<std::string> &argv,
                 const std::optional<std::vector<std::string>> &envp,
@@ -447,4 +616,35 @@ int run_command(const std::string &path,
     return command_wait(ctx);
 }
 
+int run_command(const std::string &path,
+                const std::vector<std::string> &argv,
+                const std::optional<std::vector<std::string>> &envp,
+                const std::string &chroot_dir,
+                CmdLineViewCb cb,
+                void *userdata,
+                const CmdLineRateLimit &limit)
+{
+    CommandCtx ctx;
+    ctx.path = path;
+    ctx.argv = argv;
+    ctx.envp = envp;
+    ctx.chroot_dir = chroot_dir;
+    ctx.redirect_stdio = !!cb;
+#if LOG_COMMANDS
+    ctx.log_argv = true;
+    ctx.log_envp = true;
+#else
+    ctx.log_argv = false;
+    ctx.log_envp = false;
+#endif
+
+    if (!command_start(ctx)) {
+        return -1;
+    }
+
+    command_line_view_reader(ctx, cb, userdata, limit);
+
+    return command_wait(ctx);
+}
+
 }
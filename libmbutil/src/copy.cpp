@@ -19,12 +19,27 @@
 
 #include "mbutil/copy.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include <cerrno>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
@@ -44,30 +59,345 @@
 namespace mb::util
 {
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target)
+// Maximum number of threads copying file data with CopyFlag::Parallel
+constexpr unsigned int MAX_COPY_THREADS = 4;
+// Maximum number of files waiting for a copy thread
+constexpr size_t COPY_QUEUE_MAX_ITEMS = 256;
+// Maximum number of bytes moved by each system call
+constexpr size_t COPY_CHUNK_SIZE = 8 * 1024 * 1024;
+// Size of the pipe used with splice()
+constexpr int COPY_PIPE_SIZE = 1024 * 1024;
+// Size of the buffer used when the data must go through userspace. The buffer
+// is smaller for files that are known to be smaller.
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+enum class CopyMethod
+{
+    CopyFileRange,
+    Sendfile,
+    Splice,
+    ReadWrite,
+};
+
+using ScopedBuffer = std::unique_ptr<void, decltype(free) *>;
+
+/*!
+ * State for copy_data_fd(). Each copy method is used until the kernel reports
+ * that it does not support the pair of files, at which point the next method is
+ * tried.
+ */
+struct CopyState
+{
+    CopyMethod method = CopyMethod::CopyFileRange;
+    int pipe_fds[2] = { -1, -1 };
+    size_t pipe_size = 0;
+    ScopedBuffer buf{nullptr, free};
+    size_t buf_size = 0;
+    // Size of the source file if it is a regular file
+    std::optional<uint64_t> source_size;
+
+    ~CopyState()
+    {
+        if (pipe_fds[0] >= 0) {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+    }
+};
+
+static bool is_unsupported_copy_error(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == ENOTSUP;
+}
+
+static ssize_t write_all(int fd, const char *data, size_t size)
+{
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n = write(fd, data + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += static_cast<size_t>(n);
+    }
+
+    return static_cast<ssize_t>(total);
+}
+
+static ssize_t copy_chunk_splice(CopyState &state, int fd_source,
+                                 int fd_target, size_t size)
+{
+    if (state.pipe_fds[0] < 0) {
+        if (pipe2(state.pipe_fds, O_CLOEXEC) < 0) {
+            return -1;
+        }
+
+        // A larger pipe means fewer splice() calls. The default size is fine
+        // if it cannot be changed.
+        int pipe_size = fcntl(state.pipe_fds[1], F_SETPIPE_SZ, COPY_PIPE_SIZE);
+        if (pipe_size < 0) {
+            pipe_size = fcntl(state.pipe_fds[1], F_GETPIPE_SZ);
+        }
+        state.pipe_size = pipe_size > 0 ? static_cast<size_t>(pipe_size)
+                                        : 65536;
+    }
+
+    ssize_t n = splice(fd_source, nullptr, state.pipe_fds[1], nullptr,
+                       std::min(size, state.pipe_size), SPLICE_F_MOVE);
+    if (n <= 0) {
+        return n;
+    }
+
+    for (size_t remain = static_cast<size_t>(n); remain > 0;) {
+        ssize_t n_out = splice(state.pipe_fds[0], nullptr, fd_target, nullptr,
+                               remain, SPLICE_F_MOVE);
+        if (n_out < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The data in the pipe belongs to the source's old offset, so
+            // there's no recovering from this
+            if (is_unsupported_copy_error(errno)) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        remain -= static_cast<size_t>(n_out);
+    }
+
+    return n;
+}
+
+static ssize_t copy_chunk_read_write(CopyState &state, int fd_source,
+                                     int fd_target, size_t size)
+{
+    if (!state.buf) {
+        auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t buf_size = COPY_BUFFER_SIZE;
+
+        if (state.source_size) {
+            buf_size = static_cast<size_t>(std::clamp<uint64_t>(
+                    *state.source_size, page_size, COPY_BUFFER_SIZE));
+            buf_size = (buf_size + page_size - 1) / page_size * page_size;
+        }
+
+        void *ptr;
+        if ((errno = posix_memalign(&ptr, page_size, buf_size)) != 0) {
+            return -1;
+        }
+
+        state.buf.reset(ptr);
+        state.buf_size = buf_size;
+    }
+
+    auto buf = static_cast<char *>(state.buf.get());
+    ssize_t n;
+
+    do {
+        n = read(fd_source, buf, std::min(size, state.buf_size));
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return n;
+    }
+
+    return write_all(fd_target, buf, static_cast<size_t>(n));
+}
+
+/*!
+ * \brief Copy up to \p size bytes starting at the current file offsets
+ *
+ * \return Number of bytes copied, which is less than \p size only if the end
+ *         of the source file was reached
+ */
+static oc::result<uint64_t> copy_data_range(CopyState &state, int fd_source,
+                                            int fd_target, uint64_t size)
 {
-    char buf[10240];
-    ssize_t nread;
+    uint64_t total = 0;
+    // Whether the current method has worked for this pair of files
+    bool method_works = false;
+
+    while (total < size) {
+        auto chunk = static_cast<size_t>(
+                std::min<uint64_t>(size - total, COPY_CHUNK_SIZE));
+        ssize_t n;
+
+        switch (state.method) {
+        case CopyMethod::CopyFileRange:
+#ifdef __NR_copy_file_range
+            n = syscall(__NR_copy_file_range, fd_source, nullptr, fd_target,
+                        nullptr, chunk, 0u);
+#else
+            n = -1;
+            errno = ENOSYS;
+#endif
+            break;
+        case CopyMethod::Sendfile:
+            n = sendfile(fd_target, fd_source, nullptr, chunk);
+            break;
+        case CopyMethod::Splice:
+            n = copy_chunk_splice(state, fd_source, fd_target, chunk);
+            break;
+        case CopyMethod::ReadWrite:
+        default:
+            n = copy_chunk_read_write(state, fd_source, fd_target, chunk);
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        } else if (n > 0) {
+            total += static_cast<uint64_t>(n);
+            method_works = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (!method_works && state.method != CopyMethod::ReadWrite
+                && is_unsupported_copy_error(errno)) {
+            state.method = static_cast<CopyMethod>(
+                    static_cast<int>(state.method) + 1);
+        } else {
+            return ec_from_errno();
+        }
+    }
+
+    return total;
+}
 
-    while ((nread = read(fd_source, buf, sizeof(buf))) > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+/*!
+ * \brief Try to share the source file's extents with the target
+ *
+ * This only works on filesystems with reflink support, like btrfs, xfs or f2fs
+ * (with the compression feature). The whole file is cloned, so this is only
+ * attempted when both files are at offset 0 and the target is empty.
+ */
+static bool try_clone_fd(int fd_source, int fd_target)
+{
+#ifdef FICLONE
+    return ioctl(fd_target, FICLONE, fd_source) == 0;
+#else
+    (void) fd_source;
+    (void) fd_target;
+    return false;
+#endif
+}
 
-        do {
-            if ((nwritten = write(fd_target, out_ptr,
-                                  static_cast<size_t>(nread))) < 0) {
-                return ec_from_errno();
+/*!
+ * \brief Copy the data regions of a sparse file, leaving holes in the target
+ *
+ * \return Whether the file was copied or an error code. If the filesystem does
+ *         not support SEEK_DATA/SEEK_HOLE, false is returned and nothing has
+ *         been written.
+ */
+static oc::result<bool> copy_sparse_fd(CopyState &state, int fd_source,
+                                       int fd_target, off_t size)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t offset = 0;
+
+    while (offset < size) {
+        off_t data = lseek(fd_source, offset, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // Only a hole remains
+                break;
+            } else if (offset == 0 && is_unsupported_copy_error(errno)) {
+                if (lseek(fd_source, 0, SEEK_SET) < 0) {
+                    return ec_from_errno();
+                }
+                return false;
             }
+            return ec_from_errno();
+        }
+
+        off_t hole = lseek(fd_source, data, SEEK_HOLE);
+        if (hole < 0) {
+            return ec_from_errno();
+        }
+
+        if (lseek(fd_source, data, SEEK_SET) < 0
+                || lseek(fd_target, data, SEEK_SET) < 0) {
+            return ec_from_errno();
+        }
+
+        OUTCOME_TRY(n, copy_data_range(state, fd_source, fd_target,
+                                       static_cast<uint64_t>(hole - data)));
+        if (n != static_cast<uint64_t>(hole - data)) {
+            // File shrunk while it was being copied
+            break;
+        }
 
-            nread -= nwritten;
-            out_ptr += nwritten;
-        } while (nread > 0);
+        offset = hole;
     }
 
-    if (nread < 0) {
+    if (ftruncate(fd_target, size) < 0) {
         return ec_from_errno();
     }
 
+    return true;
+#else
+    (void) state;
+    (void) fd_source;
+    (void) fd_target;
+    (void) size;
+    return false;
+#endif
+}
+
+/*!
+ * \brief Copy data from one file descriptor to another
+ *
+ * The data is copied from the current offset of \p fd_source to the current
+ * offset of \p fd_target until the end of \p fd_source is reached. The fastest
+ * method supported by the kernel and the filesystems is used:
+ *
+ * 1. If both files are at offset 0 and the target is empty: reflinking the
+ *    source's extents with FICLONE, then copying only the data regions of
+ *    sparse files so that they stay sparse
+ * 2. copy_file_range(), which can copy in-kernel or server-side
+ * 3. sendfile()
+ * 4. splice() through a pipe
+ * 5. read() and write() with a page-aligned buffer of up to 1 MiB
+ */
+oc::result<void> copy_data_fd(int fd_source, int fd_target)
+{
+    CopyState state;
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISREG(sb_source.st_mode)) {
+        state.source_size = static_cast<uint64_t>(sb_source.st_size);
+    }
+
+    if (S_ISREG(sb_source.st_mode) && S_ISREG(sb_target.st_mode)
+            && sb_target.st_size == 0
+            && lseek(fd_source, 0, SEEK_CUR) == 0
+            && lseek(fd_target, 0, SEEK_CUR) == 0) {
+        if (sb_source.st_size > 0 && try_clone_fd(fd_source, fd_target)) {
+            return oc::success();
+        }
+
+        // Fewer allocated blocks than the size requires means there are holes
+        if (static_cast<uint64_t>(sb_source.st_blocks) * 512
+                < static_cast<uint64_t>(sb_source.st_size)) {
+            OUTCOME_TRY(copied, copy_sparse_fd(state, fd_source, fd_target,
+                                               sb_source.st_size));
+            if (copied) {
+                return oc::success();
+            }
+        }
+    }
+
+    OUTCOME_TRYV(copy_data_range(state, fd_source, fd_target, UINT64_MAX));
+
     return oc::success();
 }
 
@@ -290,6 +620,127 @@ FileOpResult<void> copy_file(const std::string &source,
 }
 
 
+/*!
+ * Thread pool that copies the data, attributes and xattrs of regular files for
+ * RecursiveCopier.
+ *
+ * Every file is attempted, even after one fails, to match the "copy as much as
+ * possible" behavior of the single-threaded path. The first error is kept.
+ */
+class CopyPool
+{
+public:
+    explicit CopyPool(CopyFlags flags)
+        : _flags(flags)
+        , _stopping(false)
+        , _failed(false)
+    {
+    }
+
+    ~CopyPool()
+    {
+        finish();
+    }
+
+    CopyPool(const CopyPool &) = delete;
+    CopyPool & operator=(const CopyPool &) = delete;
+
+    void start(unsigned int n_threads)
+    {
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            _threads.emplace_back(&CopyPool::run, this);
+        }
+    }
+
+    void push(std::string source, std::string target)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _cv.wait(lock, [&] {
+            return _queue.size() < COPY_QUEUE_MAX_ITEMS;
+        });
+
+        _queue.emplace_back(std::move(source), std::move(target));
+        _cv.notify_all();
+    }
+
+    /*!
+     * \brief Wait for the queued files to be copied and stop the threads
+     *
+     * \return Whether every file was copied successfully
+     */
+    bool finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+        _threads.clear();
+
+        return !_failed;
+    }
+
+    FileOpErrorInfo error;
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] {
+                return _stopping || !_queue.empty();
+            });
+
+            if (_queue.empty()) {
+                break;
+            }
+
+            auto [source, target] = std::move(_queue.front());
+            _queue.pop_front();
+            _cv.notify_all();
+
+            lock.unlock();
+            auto ret = copy(source, target);
+            lock.lock();
+
+            if (!ret && !_failed) {
+                error = std::move(ret.error());
+                _failed = true;
+            }
+        }
+    }
+
+    FileOpResult<void> copy(const std::string &source,
+                            const std::string &target)
+    {
+        OUTCOME_TRYV(copy_data(source, target));
+
+        if (_flags & CopyFlag::CopyAttributes) {
+            OUTCOME_TRYV(copy_stat(source, target));
+        }
+        if (_flags & CopyFlag::CopyXattrs) {
+            OUTCOME_TRYV(copy_xattrs(source, target));
+        }
+
+        return oc::success();
+    }
+
+    CopyFlags _flags;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::pair<std::string, std::string>> _queue;
+    std::vector<std::thread> _threads;
+    bool _stopping;
+    bool _failed;
+};
+
 class RecursiveCopier : public FtsWrapper
 {
 public:
@@ -329,9 +780,47 @@ public:
             return false;
         }
 
+        if (_copyflags & CopyFlag::Parallel) {
+            _pool = std::make_unique<CopyPool>(_copyflags);
+            _pool->start(std::clamp(std::thread::hardware_concurrency(),
+                                    1u, MAX_COPY_THREADS));
+        }
+
         return true;
     }
 
+    bool on_post_execute(bool success) override
+    {
+        if (!_pool) {
+            return true;
+        }
+
+        if (!_pool->finish()) {
+            error = std::move(_pool->error);
+            success = false;
+        }
+
+        // Directory attributes are applied last so that nothing written to the
+        // directories afterwards changes them. The list is in post-order, so
+        // children are handled before their parents.
+        for (auto const &[source, target] : _deferred_dirs) {
+            if (_copyflags & CopyFlag::CopyAttributes) {
+                if (auto r = copy_stat(source, target); !r) {
+                    error = r.error();
+                    success = false;
+                }
+            }
+            if (_copyflags & CopyFlag::CopyXattrs) {
+                if (auto r = copy_xattrs(source, target); !r) {
+                    error = r.error();
+                    success = false;
+                }
+            }
+        }
+
+        return success;
+    }
+
     Actions on_changed_path() override
     {
         // Make sure we aren't copying the target on top of itself
@@ -408,6 +897,11 @@ public:
 
     Actions on_reached_directory_post() override
     {
+        if (_pool) {
+            _deferred_dirs.emplace_back(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
+        }
+
         if (!cp_attrs()) {
             return Action::Fail;
         }
@@ -425,6 +919,11 @@ public:
             return Action::Fail;
         }
 
+        if (_pool) {
+            _pool->push(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
+        }
+
         // Copy file contents
         if (auto r = copy_data(_curr->fts_accpath, _curtgtpath); !r) {
             error = r.error();
@@ -551,6 +1050,8 @@ private:
     std::string _target;
     struct stat sb_target;
     std::string _curtgtpath;
+    std::unique_ptr<CopyPool> _pool;
+    std::vector<std::pair<std::string, std::string>> _deferred_dirs;
 
     bool remove_existing_file()
     {
@@ -19,77 +19,580 @@
 
 #include "mbutil/delete.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/thread_pool.h"
+#include "mblog/logging.h"
+#include "mbutil/getdents_p.h"
+#include "mbutil/path.h"
+
+#define LOG_TAG "mbutil/delete"
 
 
 namespace mb::util
 {
 
-class RecursiveDeleter : public FtsWrapper {
+// Prefix of the directories that delete_recursive_in_background() moves paths
+// into before deleting them
+constexpr char DELETE_TRASH_PREFIX[] = ".mbutil-trash-";
+
+struct DeleteNode
+{
+    std::shared_ptr<DeleteNode> parent;
+    std::string path;
+    struct stat sb;
+    // Work left before the directory can be removed: listing the directory
+    // plus deleting each of its subdirectories
+    std::atomic_size_t pending{1};
+};
+
+/*!
+ * Deletes a tree with openat()/unlinkat(), reading directories in large
+ * batches with getdents64().
+ *
+ * Every directory that is found is queued, so subtrees are deleted by
+ * whichever thread is free. A directory is removed by the thread that finishes
+ * the last of its subdirectories. Errors (other than paths that are already
+ * gone) are logged and skipped, and the first one is returned, so as much as
+ * possible is deleted. Like the FtsWrapper-based code, other filesystems that
+ * are mounted inside the tree are not entered.
+ */
+class ParallelDeleter
+{
 public:
-    std::string error_path;
-    std::error_code error;
+    ParallelDeleter(const std::string &root, const struct stat &sb,
+                    const DeleteOptions &options)
+        : _options(options)
+        , _root_dev(sb.st_dev)
+        , _active(0)
+        , _stop(false)
+        , _cancelled(false)
+    {
+        _root = std::make_shared<DeleteNode>();
+        _root->path = root;
+        _root->sb = sb;
+        _queue.push_back(_root);
+    }
 
-    RecursiveDeleter(std::string path)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+    FileOpResult<void> run()
     {
+        run_on_threads(ThreadPool::global(), _options.threads,
+                       [this] { worker(); });
+
+        if (_cancelled) {
+            return FileOpErrorInfo{
+                    _root->path,
+                    std::make_error_code(std::errc::operation_canceled)};
+        } else if (_error.ec) {
+            return std::move(_error);
+        }
+
+        return oc::success();
     }
 
-    Actions on_reached_directory_pre() override
+private:
+    const DeleteOptions &_options;
+    dev_t _root_dev;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::shared_ptr<DeleteNode>> _queue;
+    unsigned int _active;
+    bool _stop;
+    bool _cancelled;
+    FileOpErrorInfo _error;
+
+    std::shared_ptr<DeleteNode> _root;
+
+    void worker()
     {
-        // Do nothing. Need depth-first search, so directories are deleted in
-        // on_reached_directory_post()
-        return Action::Ok;
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] {
+                return _stop || !_queue.empty() || _active == 0;
+            });
+
+            if (_stop || _queue.empty()) {
+                break;
+            }
+
+            // Depth-first keeps the number of queued directories small
+            auto node = std::move(_queue.back());
+            _queue.pop_back();
+            ++_active;
+
+            lock.unlock();
+            list_directory(node);
+            finish_directory(std::move(node));
+            lock.lock();
+
+            --_active;
+            _cv.notify_all();
+        }
     }
 
-    Actions on_reached_directory_post() override
+    void list_directory(const std::shared_ptr<DeleteNode> &node)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        int dfd = open(node->path.c_str(),
+                       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dfd < 0) {
+            if (errno != ENOENT) {
+                set_error(node->path, ec_from_errno());
+            }
+            return;
+        }
+
+        auto close_fd = finally([&] {
+            close(dfd);
+        });
+
+        bool is_root = node == _root;
+
+        auto ret = read_dir_entries(dfd, [&](const char *name,
+                                             unsigned char type) {
+            if (is_stopped()) {
+                return false;
+            }
+
+            if (is_root && std::find(_options.exclusions.begin(),
+                                     _options.exclusions.end(), name)
+                    != _options.exclusions.end()) {
+                return true;
+            }
+
+            return delete_entry(node, dfd, name, type);
+        });
+        if (!ret) {
+            set_error(node->path, ret.error());
+        }
     }
 
-    Actions on_reached_file() override
+    /*!
+     * \return Whether to continue listing the directory
+     */
+    bool delete_entry(const std::shared_ptr<DeleteNode> &node, int dfd,
+                      const char *name, unsigned char type)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        struct stat sb;
+        bool have_stat = false;
+
+        if (type == DT_UNKNOWN || type == DT_DIR || _options.callback) {
+            if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                if (errno != ENOENT) {
+                    set_error(child_path(node, name), ec_from_errno());
+                }
+                return true;
+            }
+            have_stat = true;
+        }
+
+        if (have_stat && S_ISDIR(sb.st_mode) && sb.st_dev == _root_dev) {
+            auto child = std::make_shared<DeleteNode>();
+            child->parent = node;
+            child->path = child_path(node, name);
+            child->sb = sb;
+
+            ++node->pending;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::move(child));
+            _cv.notify_one();
+
+            return true;
+        }
+
+        // Mount points are removed like empty directories, which fails
+        int flags = have_stat && S_ISDIR(sb.st_mode) ? AT_REMOVEDIR : 0;
+
+        if (unlinkat(dfd, name, flags) < 0) {
+            if (errno != ENOENT) {
+                set_error(child_path(node, name), ec_from_errno());
+            }
+            return true;
+        }
+
+        return report(child_path(node, name), sb, have_stat);
     }
 
-    Actions on_reached_symlink() override
+    void finish_directory(std::shared_ptr<DeleteNode> node)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        while (node && --node->pending == 0) {
+            if (is_stopped()) {
+                return;
+            }
+
+            bool keep = node == _root && (_options.keep_root
+                    || !_options.exclusions.empty());
+
+            if (!keep) {
+                if (rmdir(node->path.c_str()) < 0) {
+                    if (errno != ENOENT) {
+                        set_error(node->path, ec_from_errno());
+                    }
+                } else if (!report(node->path, node->sb, true)) {
+                    return;
+                }
+            }
+
+            node = std::move(node->parent);
+        }
     }
 
-    Actions on_reached_special_file() override
+    std::string child_path(const std::shared_ptr<DeleteNode> &node,
+                           const char *name)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        std::string path(node->path);
+        if (path.empty() || path.back() != '/') {
+            path += '/';
+        }
+        path += name;
+        return path;
     }
 
-private:
-    bool delete_path()
+    bool report(const std::string &path, const struct stat &sb,
+                bool have_stat)
     {
-        if (remove(_curr->fts_accpath) < 0) {
-            error_path = _curr->fts_path;
-            error = ec_from_errno();
+        if (!_options.callback || !have_stat) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_stop) {
+            return false;
+        } else if (!_options.callback(path, sb)) {
+            _stop = true;
+            _cancelled = true;
+            _cv.notify_all();
             return false;
         }
+
         return true;
     }
+
+    void set_error(std::string path, std::error_code ec)
+    {
+        LOGW("%s: Failed to remove: %s", path.c_str(), ec.message().c_str());
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_error.ec) {
+            _error = {std::move(path), ec};
+        }
+    }
+
+    bool is_stopped()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stop;
+    }
 };
 
 FileOpResult<void> delete_recursive(const std::string &path)
+{
+    return delete_recursive(path, {});
+}
+
+/*!
+ * \brief Recursively delete a path
+ *
+ * Symlinks are not followed. It is not an error if \p path does not exist.
+ *
+ * \param path Path to delete
+ * \param options Options controlling what is deleted and how
+ *
+ * \return Nothing if the path was deleted. Otherwise, the first error that
+ *         was encountered. If the callback stopped the deletion, the error is
+ *         std::errc::operation_canceled.
+ */
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    const DeleteOptions &options)
 {
     struct stat sb;
-    if (stat(path.c_str(), &sb) < 0 && errno == ENOENT) {
-        // Don't fail if directory does not exist
+    if (lstat(path.c_str(), &sb) < 0) {
+        if (errno == ENOENT) {
+            // Don't fail if directory does not exist
+            return oc::success();
+        }
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        if (options.keep_root) {
+            return oc::success();
+        }
+
+        if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+            return FileOpErrorInfo{path, ec_from_errno()};
+        }
+
+        if (options.callback && !options.callback(path, sb)) {
+            return FileOpErrorInfo{
+                    path, std::make_error_code(std::errc::operation_canceled)};
+        }
+
         return oc::success();
     }
 
-    RecursiveDeleter deleter(path);
-    if (!deleter.run()) {
-        return FileOpErrorInfo{std::move(deleter.error_path), deleter.error};
+    return ParallelDeleter(path, sb, options).run();
+}
+
+/*!
+ * \brief Check if a directory entry is a trash directory that is in use
+ *
+ * delete_recursive_in_background() holds an exclusive flock() on its trash
+ * directory until the deletion finishes. The lock goes away with the process,
+ * so the trash of a process that died is never considered busy.
+ */
+static bool is_busy_trash(int dfd, const char *name)
+{
+    if (strncmp(name, DELETE_TRASH_PREFIX,
+                sizeof(DELETE_TRASH_PREFIX) - 1) != 0) {
+        return false;
+    }
+
+    int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool busy = flock(fd, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return busy;
+}
+
+/*!
+ * \brief Move stale trash directories in \p dir into \p trash
+ */
+static void sweep_stale_trash(const std::string &dir, const std::string &trash)
+{
+    std::unique_ptr<DIR, decltype(closedir) *> dp(
+            opendir(dir.c_str()), closedir);
+    if (!dp) {
+        return;
+    }
+
+    std::string trash_name = base_name(trash);
+    std::vector<std::string> names;
+
+    while (auto *ent = readdir(dp.get())) {
+        if (strncmp(ent->d_name, DELETE_TRASH_PREFIX,
+                    sizeof(DELETE_TRASH_PREFIX) - 1) == 0
+                && ent->d_name != trash_name
+                && !is_busy_trash(dirfd(dp.get()), ent->d_name)) {
+            names.push_back(ent->d_name);
+        }
+    }
+
+    for (auto const &name : names) {
+        if (renameat(dirfd(dp.get()), name.c_str(), dirfd(dp.get()),
+                     (trash_name + '/' + name).c_str()) < 0) {
+            LOGV("%s/%s: Failed to move to %s: %s", dir.c_str(),
+                 name.c_str(), trash.c_str(), strerror(errno));
+        }
+    }
+}
+
+static FileOpResult<std::string> move_to_trash(const std::string &path,
+                                               const DeleteOptions &options,
+                                               int *lock_fd)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        if (errno == ENOENT) {
+            return std::string();
+        }
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    bool keep_root = options.keep_root || !options.exclusions.empty();
+
+    if (keep_root && !S_ISDIR(sb.st_mode)) {
+        return std::string();
+    }
+
+    // Moving the root itself requires the trash to be in the parent directory
+    std::string trash;
+    if (!options.trash_dir.empty()) {
+        trash = options.trash_dir;
+    } else if (keep_root) {
+        trash = path;
+    } else {
+        trash = dir_name(path);
+    }
+    trash += '/';
+    trash += DELETE_TRASH_PREFIX;
+    trash += "XXXXXX";
+
+    if (!mkdtemp(trash.data())) {
+        LOGW("%s: Failed to create directory: %s",
+             trash.c_str(), strerror(errno));
+        OUTCOME_TRYV(delete_recursive(path, options));
+        return std::string();
+    }
+
+    if (lock_fd) {
+        *lock_fd = open(trash.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (*lock_fd >= 0 && flock(*lock_fd, LOCK_EX | LOCK_NB) < 0) {
+            LOGW("%s: Failed to lock directory: %s",
+                 trash.c_str(), strerror(errno));
+        }
+    }
+
+    DeleteOptions remaining(options);
+    remaining.exclusions.push_back(base_name(trash));
+
+    if (keep_root) {
+        std::unique_ptr<DIR, decltype(closedir) *> dp(
+                opendir(path.c_str()), closedir);
+        if (!dp) {
+            return FileOpErrorInfo{path, ec_from_errno()};
+        }
+
+        std::vector<std::string> names;
+        dirent *ent;
+        errno = 0;
+
+        while ((ent = readdir(dp.get()))) {
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0
+                    || std::find(remaining.exclusions.begin(),
+                                 remaining.exclusions.end(), ent->d_name)
+                            != remaining.exclusions.end()) {
+                continue;
+            }
+
+            // Stale trash directories are moved along with everything else,
+            // but the trash of a deletion that is still running is left alone
+            if (is_busy_trash(dirfd(dp.get()), ent->d_name)) {
+                remaining.exclusions.push_back(ent->d_name);
+            } else {
+                names.push_back(ent->d_name);
+            }
+        }
+
+        if (errno) {
+            return FileOpErrorInfo{path, ec_from_errno()};
+        }
+
+        for (auto const &name : names) {
+            if (renameat(dirfd(dp.get()), name.c_str(), AT_FDCWD,
+                         (trash + '/' + name).c_str()) < 0) {
+                LOGV("%s/%s: Failed to move to %s: %s", path.c_str(),
+                     name.c_str(), trash.c_str(), strerror(errno));
+            }
+        }
+    } else {
+        if (rename(path.c_str(),
+                   (trash + '/' + base_name(path)).c_str()) < 0) {
+            LOGV("%s: Failed to move to %s: %s",
+                 path.c_str(), trash.c_str(), strerror(errno));
+        }
+
+    }
+
+    // Nothing else wipes a trash directory's location outside of the path, so
+    // clean up after background deletions that were interrupted there
+    if (!options.trash_dir.empty()) {
+        sweep_stale_trash(options.trash_dir, trash);
+    } else if (!keep_root) {
+        sweep_stale_trash(dir_name(path), trash);
+    }
+
+    // Delete whatever could not be moved
+    if (keep_root) {
+        OUTCOME_TRYV(delete_recursive(path, remaining));
+    } else {
+        struct stat sb2;
+        if (lstat(path.c_str(), &sb2) == 0) {
+            OUTCOME_TRYV(delete_recursive(path, options));
+        }
+    }
+
+    return trash;
+}
+
+/*!
+ * \brief Move a path out of the way so that it can be deleted later
+ *
+ * The contents of \p path (except for the exclusions) are renamed into a new
+ * hidden directory on the same filesystem. Anything that cannot be moved, such
+ * as mount points, is deleted before returning.
+ *
+ * The hidden directory lives in DeleteOptions::trash_dir if set. Otherwise, it
+ * lives inside \p path (when the root is kept) or next to it. Trash directories left behind in that location by interrupted background
+ * deletions are moved into the new one.
+ *
+ * \return Path of the hidden directory, which the caller is responsible for
+ *         deleting, or an empty string if everything was deleted in place
+ */
+FileOpResult<std::string> delete_recursive_to_trash(const std::string &path,
+                                                    const DeleteOptions &options)
+{
+    return move_to_trash(path, options, nullptr);
+}
+
+/*!
+ * \brief Move a path out of the way and delete it on a background thread
+ *
+ * The path is moved with delete_recursive_to_trash() and the hidden directory
+ * is then deleted by a detached thread. This returns as soon as the paths have
+ * been moved.
+ *
+ * If the process exits before the background deletion finishes, the hidden
+ * directory is left behind. It is cleaned up by the next background deletion
+ * that creates its trash in the same directory, ie. the next wipe of the same
+ * path or of one of its siblings.
+ *
+ * \note \p options.callback is not called for paths deleted in the background
+ */
+FileOpResult<void> delete_recursive_in_background(const std::string &path,
+                                                  const DeleteOptions &options)
+{
+    int lock_fd = -1;
+    auto trash = move_to_trash(path, options, &lock_fd);
+    if (!trash || trash.value().empty()) {
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        if (!trash) {
+            return trash.as_failure();
+        }
+    } else {
+        DeleteOptions trash_options;
+        trash_options.threads = options.threads;
+
+        // The lock is held until the trash is gone so that other wipes do not
+        // mistake it for a leftover
+        std::thread([trash = std::move(trash.value()), trash_options,
+                     lock_fd] {
+            if (auto r = delete_recursive(trash, trash_options); !r) {
+                LOGW("%s: Background deletion failed: %s",
+                     trash.c_str(), r.error().message().c_str());
+            }
+            if (lock_fd >= 0) {
+                close(lock_fd);
+            }
+        }).detach();
     }
 
     return oc::success();
@@ -1613,3 +1613,45 @@ int mb__system_property_foreach(void (*propfn)(const prop_info* pi, void* cookie
   });
   return 0;
 }
+
+struct snapshot_cookie {
+  char* buf;
+  size_t size;
+  size_t used;
+};
+
+static void snapshot_fn(void* cookie, const char* name, const char* value, uint32_t) {
+  snapshot_cookie* c = static_cast<snapshot_cookie*>(cookie);
+  const size_t name_size = strlen(name) + 1;
+  const size_t value_size = strlen(value) + 1;
+
+  // Once a record doesn't fit, |used| exceeds |size| and nothing else is copied
+  if (c->used + name_size + value_size <= c->size) {
+    memcpy(c->buf + c->used, name, name_size);
+    memcpy(c->buf + c->used + name_size, value, value_size);
+  }
+  c->used += name_size + value_size;
+}
+
+ssize_t mb__system_property_snapshot(char* buf, size_t size, uint32_t* serial) {
+  if (!mb__system_property_area__) {
+    return -1;
+  }
+
+  if (serial) {
+    *serial = mb__system_property_area_serial();
+  }
+
+  snapshot_cookie cookie = { buf, size, 0 };
+
+  const int err = mb__system_property_foreach(
+      [](const prop_info* pi, void* c) {
+        mb__system_property_read_callback(pi, snapshot_fn, c);
+      },
+      &cookie);
+  if (err < 0) {
+    return -1;
+  }
+
+  return static_cast<ssize_t>(cookie.used);
+}
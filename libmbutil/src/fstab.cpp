@@ -19,6 +19,7 @@
 
 #include "mbutil/fstab.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <cctype>
@@ -28,13 +29,17 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/path.h"
 #include "mbutil/string.h"
 
 #define LOG_TAG "mbutil/fstab"
@@ -172,118 +177,248 @@ static struct MountFlag g_fs_mgr_flags[] =
     { nullptr,              0 },
 };
 
-static std::pair<unsigned long, std::string>
-options_to_flags(const MountFlag *flags_map, std::string options)
+/*!
+ * \brief Convert comma-separated options to flags
+ *
+ * The options that are not flags are appended to \a out (if not null), which
+ * must have enough capacity so that it is not reallocated.
+ */
+static unsigned long
+options_to_flags(const MountFlag *flags_map, std::string_view options,
+                 std::vector<char> *out)
 {
     unsigned long flags = 0;
-    std::string new_options;
-    char *save_ptr;
+    bool first = true;
+
+    while (!options.empty()) {
+        auto pos = options.find(',');
+        auto option = options.substr(0, pos);
+        options.remove_prefix(pos == std::string_view::npos
+                ? options.size() : pos + 1);
+
+        if (option.empty()) {
+            continue;
+        }
 
-    char *temp = strtok_r(options.data(), ",", &save_ptr);
-    while (temp) {
         const MountFlag *it;
 
         for (it = flags_map; it->name; ++it) {
-            if (starts_with(temp, it->name)) {
+            if (starts_with(option, it->name)) {
                 flags |= it->flag;
                 break;
             }
         }
 
-        if (!it->name) {
-            new_options += temp;
-            new_options += ',';
+        if (!it->name && out) {
+            if (!first) {
+                out->push_back(',');
+            }
+            out->insert(out->end(), option.begin(), option.end());
+            first = false;
         }
+    }
+
+    return flags;
+}
+
+/*!
+ * \brief Split the next field off of \a line
+ */
+static std::string_view next_field(std::string_view &line)
+{
+    constexpr char delim[] = " \t";
 
-        temp = strtok_r(nullptr, ",", &save_ptr);
+    auto begin = line.find_first_not_of(delim);
+    if (begin == std::string_view::npos) {
+        line = {};
+        return {};
     }
 
-    if (!new_options.empty()) {
-        new_options.pop_back();
+    auto end = line.find_first_of(delim, begin);
+    if (end == std::string_view::npos) {
+        end = line.size();
     }
 
-    return {flags, std::move(new_options)};
+    auto field = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return field;
+}
+
+static std::string index_key(std::string_view path)
+{
+    auto pieces = path_split(std::string(path));
+    normalize_path(pieces);
+    return path_join(pieces);
+}
+
+FstabRec FstabEntry::to_rec() const
+{
+    FstabRec rec;
+    rec.blk_device = blk_device;
+    rec.mount_point = mount_point;
+    rec.fs_type = fs_type;
+    rec.flags = flags;
+    rec.fs_options = fs_options;
+    rec.fs_mgr_flags = fs_mgr_flags;
+    rec.vold_args = vold_args;
+    rec.mount_args = mount_args;
+    rec.orig_line = orig_line;
+    return rec;
 }
 
+Fstab::Fstab() = default;
+
 // Much simplified version of fs_mgr's fstab parsing code
-FstabResult<FstabRecs> read_fstab(const std::string &path)
+FstabResult<Fstab> Fstab::load(const std::string &path)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
-    if (!fp) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return FstabErrorInfo{{}, ec_from_errno()};
     }
 
-    char *line = nullptr;
-    size_t len = 0; // allocated memory size
-    ssize_t bytes_read; // number of bytes read
-    constexpr char delim[] = " \t";
-    std::vector<FstabRec> fstab;
-
-    auto free_line = finally([&] {
-        free(line);
+    auto close_fd = finally([&] {
+        close(fd);
     });
 
-    while ((bytes_read = getline(&line, &len, fp.get())) != -1) {
-        // Strip newlines
-        if (bytes_read > 0 && line[bytes_read - 1] == '\n') {
-            line[bytes_read - 1] = '\0';
-        }
+    Fstab fstab;
 
-        // Strip leading whitespace
-        char *temp = line;
-        while (isspace(*temp)) {
-            ++temp;
+    // fstab files are small, so they're read in one go
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        fstab._data.reserve(static_cast<size_t>(sb.st_size));
+    }
+
+    char buf[4096];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FstabErrorInfo{{}, ec_from_errno()};
+        } else if (n == 0) {
+            break;
         }
 
+        fstab._data.insert(fstab._data.end(), buf, buf + n);
+    }
+
+    // Filtered mount options are never longer than the original ones
+    fstab._options.reserve(fstab._data.size());
+
+    std::string_view data(fstab._data.data(), fstab._data.size());
+
+    while (!data.empty()) {
+        auto newline = data.find('\n');
+        auto line = data.substr(0, newline);
+        data.remove_prefix(newline == std::string_view::npos
+                ? data.size() : newline + 1);
+
         // Skip empty lines and comments
-        if (*temp == '\0' || *temp == '#') {
+        auto begin = std::find_if_not(line.begin(), line.end(), [](char c) {
+            return isspace(static_cast<unsigned char>(c));
+        });
+        if (begin == line.end() || *begin == '#') {
             continue;
         }
 
-        FstabRec rec;
-        char *save_ptr;
+        FstabEntry entry;
+        auto rest = line;
 
-        rec.orig_line = line;
+        entry.orig_line = line;
 
-        if (!(temp = strtok_r(line, delim, &save_ptr))) {
-            return FstabErrorInfo{line, FstabError::MissingSourcePath};
+        if ((entry.blk_device = next_field(rest)).empty()) {
+            return FstabErrorInfo{std::string(line),
+                                  FstabError::MissingSourcePath};
         }
-        rec.blk_device = temp;
-
-        if (!(temp = strtok_r(nullptr, delim, &save_ptr))) {
-            return FstabErrorInfo{line, FstabError::MissingTargetPath};
+        if ((entry.mount_point = next_field(rest)).empty()) {
+            return FstabErrorInfo{std::string(line),
+                                  FstabError::MissingTargetPath};
         }
-        rec.mount_point = temp;
-
-        if (!(temp = strtok_r(nullptr, delim, &save_ptr))) {
-            return FstabErrorInfo{line, FstabError::MissingFilesystemType};
+        if ((entry.fs_type = next_field(rest)).empty()) {
+            return FstabErrorInfo{std::string(line),
+                                  FstabError::MissingFilesystemType};
         }
-        rec.fs_type = temp;
-
-        if (!(temp = strtok_r(nullptr, delim, &save_ptr))) {
-            return FstabErrorInfo{line, FstabError::MissingMountOptions};
+        if ((entry.mount_args = next_field(rest)).empty()) {
+            return FstabErrorInfo{std::string(line),
+                                  FstabError::MissingMountOptions};
         }
-        rec.mount_args = temp;
-        std::tie(rec.flags, rec.fs_options) =
-                options_to_flags(g_mount_flags, temp);
-
-        if (!(temp = strtok_r(nullptr, delim, &save_ptr))) {
-            return FstabErrorInfo{line, FstabError::MissingVoldOptions};
+        if ((entry.vold_args = next_field(rest)).empty()) {
+            return FstabErrorInfo{std::string(line),
+                                  FstabError::MissingVoldOptions};
         }
-        rec.vold_args = temp;
-        std::tie(rec.fs_mgr_flags, std::ignore) =
-                options_to_flags(g_fs_mgr_flags, temp);
 
-        fstab.push_back(std::move(rec));
+        size_t options_begin = fstab._options.size();
+        entry.flags = options_to_flags(
+                g_mount_flags, entry.mount_args, &fstab._options);
+        entry.fs_options = {fstab._options.data() + options_begin,
+                            fstab._options.size() - options_begin};
+        entry.fs_mgr_flags = options_to_flags(
+                g_fs_mgr_flags, entry.vold_args, nullptr);
+
+        fstab._entries.push_back(entry);
     }
 
-    if (ferror(fp.get())) {
-        return FstabErrorInfo{{}, ec_from_errno()};
+    for (auto const &entry : fstab._entries) {
+        fstab._by_mount_point[index_key(entry.mount_point)].push_back(&entry);
+        fstab._by_blk_device[index_key(entry.blk_device)].push_back(&entry);
     }
 
     return std::move(fstab);
 }
 
+const std::vector<FstabEntry> & Fstab::entries() const
+{
+    return _entries;
+}
+
+static const std::vector<const FstabEntry *> g_no_entries;
+
+/*!
+ * \brief Find the entries for a mount point
+ *
+ * \return Entries in the order they appear in the file
+ */
+const std::vector<const FstabEntry *> &
+Fstab::find_mount_point(std::string_view mount_point) const
+{
+    if (auto it = _by_mount_point.find(index_key(mount_point));
+            it != _by_mount_point.end()) {
+        return it->second;
+    }
+    return g_no_entries;
+}
+
+/*!
+ * \brief Find the entries for a block device
+ *
+ * \return Entries in the order they appear in the file
+ */
+const std::vector<const FstabEntry *> &
+Fstab::find_blk_device(std::string_view blk_device) const
+{
+    if (auto it = _by_blk_device.find(index_key(blk_device));
+            it != _by_blk_device.end()) {
+        return it->second;
+    }
+    return g_no_entries;
+}
+
+FstabResult<FstabRecs> read_fstab(const std::string &path)
+{
+    OUTCOME_TRY(fstab, Fstab::load(path));
+
+    FstabRecs recs;
+    recs.reserve(fstab.entries().size());
+
+    for (auto const &entry : fstab.entries()) {
+        recs.push_back(entry.to_rec());
+    }
+
+    return std::move(recs);
+}
+
 FstabResult<TwrpFstabRecs> read_twrp_fstab(const std::string &path)
 {
     ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
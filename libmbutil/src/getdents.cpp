@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/getdents_p.h"
+
+#include <memory>
+
+#include <cstdint>
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+
+
+namespace mb::util
+{
+
+// Size of the buffer for reading directory entries with getdents64()
+constexpr size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+
+// Layout of the records returned by getdents64()
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+/*!
+ * \brief Read the entries of an open directory in large batches
+ *
+ * Unlike readdir(), this reads many entries per system call into a buffer that
+ * is not shared with other users of \p fd. "." and ".." are skipped. The entry
+ * type is DT_UNKNOWN if the filesystem does not report it.
+ *
+ * \param fd Directory file descriptor
+ * \param callback Function to call with each entry's name and type. Return
+ *                 false to stop reading.
+ *
+ * \return Nothing if all entries were read or \p callback returned false.
+ *         Otherwise, the error from getdents64().
+ */
+oc::result<void> read_dir_entries(int fd,
+                                  const std::function<DirentFn> &callback)
+{
+    std::unique_ptr<char[]> buf(new char[DIRENT_BUFFER_SIZE]);
+
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buf.get(), DIRENT_BUFFER_SIZE);
+        if (n < 0) {
+            return ec_from_errno();
+        } else if (n == 0) {
+            return oc::success();
+        }
+
+        for (long pos = 0; pos < n;) {
+            auto ent = reinterpret_cast<LinuxDirent64 *>(buf.get() + pos);
+            pos += ent->d_reclen;
+
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            if (!callback(ent->d_name, ent->d_type)) {
+                return oc::success();
+            }
+        }
+    }
+}
+
+}
@@ -19,18 +19,316 @@
 
 #include "mbutil/hash.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string_view>
+#include <vector>
 
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-#include "mbcommon/error_code.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <linux/if_alg.h>
+#endif
 
+#include <openssl/evp.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 
 namespace mb::util
 {
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
+// Large reads keep the hashing from being dominated by read() calls
+constexpr size_t HASH_BUFFER_SIZE = 1024 * 1024;
+
+namespace
+{
+
+/*!
+ * \brief Incremental SHA512 hash using one of the backends
+ */
+class Sha512Context
+{
+public:
+    explicit Sha512Context(HashBackend backend)
+        : _backend(backend)
+        , _md_ctx(nullptr)
+        , _alg_fd(-1)
+        , _op_fd(-1)
+    {
+    }
+
+    ~Sha512Context()
+    {
+        if (_md_ctx) {
+            EVP_MD_CTX_free(_md_ctx);
+        }
+        if (_op_fd >= 0) {
+            close(_op_fd);
+        }
+        if (_alg_fd >= 0) {
+            close(_alg_fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Sha512Context)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Sha512Context)
+
+    oc::result<void> init()
+    {
+        if (_backend == HashBackend::KernelCrypto) {
+            return init_kernel();
+        }
+
+        _md_ctx = EVP_MD_CTX_new();
+        if (!_md_ctx || !EVP_DigestInit_ex(_md_ctx, EVP_sha512(), nullptr)) {
+            return std::errc::io_error;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> update(const void *data, size_t size)
+    {
+        if (_backend == HashBackend::KernelCrypto) {
+            return send_kernel(data, size, MSG_MORE);
+        }
+
+        if (!EVP_DigestUpdate(_md_ctx, data, size)) {
+            return std::errc::io_error;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<Sha512Digest> finish()
+    {
+        Sha512Digest digest;
+
+        if (_backend == HashBackend::KernelCrypto) {
+            OUTCOME_TRYV(send_kernel(nullptr, 0, 0));
+
+            ssize_t n;
+            do {
+                n = read(_op_fd, digest.data(), digest.size());
+            } while (n < 0 && errno == EINTR);
+
+            if (n < 0) {
+                return ec_from_errno();
+            } else if (static_cast<size_t>(n) != digest.size()) {
+                return std::errc::io_error;
+            }
+        } else if (!EVP_DigestFinal_ex(_md_ctx, digest.data(), nullptr)) {
+            return std::errc::io_error;
+        }
+
+        return digest;
+    }
+
+private:
+    oc::result<void> init_kernel()
+    {
+#ifdef __linux__
+        _alg_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (_alg_fd < 0) {
+            return ec_from_errno();
+        }
+
+        sockaddr_alg sa = {};
+        sa.salg_family = AF_ALG;
+        strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
+        strcpy(reinterpret_cast<char *>(sa.salg_name), "sha512");
+
+        if (bind(_alg_fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) < 0) {
+            return ec_from_errno();
+        }
+
+        _op_fd = accept4(_alg_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (_op_fd < 0) {
+            return ec_from_errno();
+        }
+
+        return oc::success();
+#else
+        return std::errc::function_not_supported;
+#endif
+    }
+
+    oc::result<void> send_kernel(const void *data, size_t size, int flags)
+    {
+        auto ptr = static_cast<const unsigned char *>(data);
+
+        // An empty send without MSG_MORE is still needed to finalize the hash
+        do {
+            ssize_t n = send(_op_fd, ptr, size, flags);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            }
+
+            ptr += n;
+            size -= static_cast<size_t>(n);
+        } while (size > 0);
+
+        return oc::success();
+    }
+
+    HashBackend _backend;
+    EVP_MD_CTX *_md_ctx;
+    int _alg_fd;
+    int _op_fd;
+};
+
+}
+
+/*!
+ * \brief Find the SHA512 implementation to use
+ *
+ * The kernel's crypto API is only used if its preferred SHA512 driver is
+ * asynchronous, which means that the hashing is offloaded to a hardware
+ * engine. Software implementations in the kernel are no faster than
+ * OpenSSL's and hashing through a socket requires copying the data into the
+ * kernel.
+ *
+ * The result is computed once and cached.
+ *
+ * \return HashBackend::KernelCrypto or HashBackend::OpenSsl
+ */
+HashBackend sha512_backend()
+{
+    static const HashBackend backend = [] {
+        ScopedFILE fp(fopen("/proc/crypto", "re"), fclose);
+        if (!fp) {
+            return HashBackend::OpenSsl;
+        }
+
+        char *line = nullptr;
+        size_t len = 0;
+        ssize_t n;
+
+        auto free_line = finally([&] {
+            free(line);
+        });
+
+        // Entries are blocks of "key : value" lines separated by blank lines
+        std::string name;
+        std::string async;
+        long priority = -1;
+        long best_priority = -1;
+        bool best_async = false;
+
+        auto end_entry = [&] {
+            if (name == "sha512" && priority > best_priority) {
+                best_priority = priority;
+                best_async = async == "yes";
+            }
+            name.clear();
+            async.clear();
+            priority = -1;
+        };
+
+        while ((n = getline(&line, &len, fp.get())) >= 0) {
+            std::string_view sv(line, static_cast<size_t>(n));
+            auto pos = sv.find(':');
+
+            if (pos == std::string_view::npos) {
+                end_entry();
+                continue;
+            }
+
+            std::string key(sv.substr(0, pos));
+            std::string value(sv.substr(pos + 1));
+            trim(key);
+            trim(value);
+
+            if (key == "name") {
+                name = std::move(value);
+            } else if (key == "async") {
+                async = std::move(value);
+            } else if (key == "priority") {
+                priority = strtol(value.c_str(), nullptr, 10);
+            }
+        }
+
+        end_entry();
+
+        return best_async ? HashBackend::KernelCrypto : HashBackend::OpenSsl;
+    }();
+
+    return backend;
+}
+
+static oc::result<Sha512Digest>
+sha512_hash_data(HashBackend backend, const void *data, size_t size)
+{
+    Sha512Context ctx(backend);
+
+    OUTCOME_TRYV(ctx.init());
+    OUTCOME_TRYV(ctx.update(data, size));
+    return ctx.finish();
+}
+
+static oc::result<Sha512Digest>
+sha512_hash_fd(HashBackend backend, int fd)
+{
+    Sha512Context ctx(backend);
+    std::vector<unsigned char> buf(HASH_BUFFER_SIZE);
+
+    OUTCOME_TRYV(ctx.init());
+
+    while (true) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(ctx.update(buf.data(), static_cast<size_t>(n)));
+    }
+
+    return ctx.finish();
+}
+
+/*!
+ * \brief Compute SHA512 hash of a buffer
+ *
+ * \param data Pointer to data
+ * \param size Size of data
+ *
+ * \return The digest on success or the error code on failure
+ */
+oc::result<Sha512Digest> sha512_hash(const void *data, size_t size)
+{
+    if (sha512_backend() == HashBackend::KernelCrypto) {
+        if (auto r = sha512_hash_data(HashBackend::KernelCrypto, data, size)) {
+            return std::move(r.value());
+        }
+    }
+
+    return sha512_hash_data(HashBackend::OpenSsl, data, size);
+}
+
 /*!
  * \brief Compute SHA512 hash of a file
  *
@@ -40,39 +338,331 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
  */
 oc::result<Sha512Digest> sha512_hash(const std::string &path)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
-    if (!fp) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return ec_from_errno();
     }
 
-    std::array<unsigned char, 10240> buf;
-    size_t n;
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (sha512_backend() == HashBackend::KernelCrypto) {
+        if (auto r = sha512_hash_fd(HashBackend::KernelCrypto, fd)) {
+            return std::move(r.value());
+        }
+
+        // Start over with OpenSSL if the kernel failed partway through
+        if (lseek(fd, 0, SEEK_SET) < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    return sha512_hash_fd(HashBackend::OpenSsl, fd);
+}
+
+static const EVP_MD * evp_md(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Sha256:
+        return EVP_sha256();
+    case HashAlgorithm::Sha512:
+        return EVP_sha512();
+    }
+
+    return nullptr;
+}
+
+size_t hash_digest_size(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Sha256:
+        return SHA256_DIGEST_LENGTH;
+    case HashAlgorithm::Sha512:
+        return SHA512_DIGEST_LENGTH;
+    }
+
+    return 0;
+}
+
+Hasher::Hasher(HashAlgorithm algorithm)
+    : _algorithm(algorithm)
+    , _ctx(EVP_MD_CTX_new())
+    , _ready(false)
+{
+    (void) reset();
+}
+
+Hasher::~Hasher()
+{
+    if (_ctx) {
+        EVP_MD_CTX_free(_ctx);
+    }
+}
+
+HashAlgorithm Hasher::algorithm() const
+{
+    return _algorithm;
+}
 
-    SHA512_CTX ctx;
-    if (!SHA512_Init(&ctx)) {
+oc::result<void> Hasher::reset()
+{
+    _ready = _ctx && EVP_DigestInit_ex(_ctx, evp_md(_algorithm), nullptr);
+    if (!_ready) {
         return std::errc::io_error;
     }
 
-    while ((n = fread(buf.data(), 1, buf.size(), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf.data(), n)) {
-            return std::errc::io_error;
+    return oc::success();
+}
+
+oc::result<void> Hasher::update(const void *data, size_t size)
+{
+    if (!_ready || !EVP_DigestUpdate(_ctx, data, size)) {
+        return std::errc::io_error;
+    }
+
+    return oc::success();
+}
+
+oc::result<HashDigest> Hasher::finish()
+{
+    HashDigest digest(hash_digest_size(_algorithm));
+
+    if (!_ready || !EVP_DigestFinal_ex(_ctx, digest.data(), nullptr)) {
+        return std::errc::io_error;
+    }
+
+    OUTCOME_TRYV(reset());
+
+    return digest;
+}
+
+/*!
+ * \brief Compute the hash of a buffer
+ */
+oc::result<HashDigest> hash_data(HashAlgorithm algorithm,
+                                 const void *data, size_t size)
+{
+    if (algorithm == HashAlgorithm::Sha512) {
+        OUTCOME_TRY(digest, sha512_hash(data, size));
+        return HashDigest(digest.begin(), digest.end());
+    }
+
+    Hasher hasher(algorithm);
+    OUTCOME_TRYV(hasher.update(data, size));
+    return hasher.finish();
+}
+
+/*!
+ * \brief Compute the hash of an fd's contents from its current position
+ */
+oc::result<HashDigest> hash_fd(HashAlgorithm algorithm, int fd)
+{
+    Hasher hasher(algorithm);
+    std::vector<unsigned char> buf(HASH_BUFFER_SIZE);
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while (true) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
         }
-        if (n < buf.size()) {
+
+        OUTCOME_TRYV(hasher.update(buf.data(), static_cast<size_t>(n)));
+    }
+
+    return hasher.finish();
+}
+
+/*!
+ * \brief Compute the hash of a File's contents from its current position
+ *
+ * If the file's contents are in memory (File::view() is supported), they are
+ * hashed in place instead of being copied.
+ */
+oc::result<HashDigest> hash_file(HashAlgorithm algorithm, File &file)
+{
+    Hasher hasher(algorithm);
+
+    OUTCOME_TRY(offset, file.seek(0, SEEK_CUR));
+
+    auto view = file.view(offset, SIZE_MAX);
+    if (view) {
+        while (view.value().size > 0) {
+            OUTCOME_TRYV(hasher.update(view.value().data, view.value().size));
+            offset += view.value().size;
+
+            view = file.view(offset, SIZE_MAX);
+            if (!view) {
+                return view.as_failure();
+            }
+        }
+
+        OUTCOME_TRYV(file.seek(0, SEEK_END));
+
+        return hasher.finish();
+    } else if (view.error() != FileError::UnsupportedView) {
+        return view.as_failure();
+    }
+
+    std::vector<unsigned char> buf(HASH_BUFFER_SIZE);
+
+    while (true) {
+        OUTCOME_TRY(n, file.read(buf.data(), buf.size()));
+        if (n == 0) {
             break;
         }
+
+        OUTCOME_TRYV(hasher.update(buf.data(), n));
+    }
+
+    return hasher.finish();
+}
+
+/*!
+ * \brief Compute the hash of a file
+ *
+ * SHA512 hashes are computed with sha512_hash(), so they may be offloaded to
+ * a hardware engine.
+ */
+oc::result<HashDigest> hash_path(HashAlgorithm algorithm,
+                                 const std::string &path)
+{
+    if (algorithm == HashAlgorithm::Sha512) {
+        OUTCOME_TRY(digest, sha512_hash(path));
+        return HashDigest(digest.begin(), digest.end());
     }
 
-    if (ferror(fp.get())) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return ec_from_errno();
     }
 
-    Sha512Digest digest;
+    auto close_fd = finally([&] {
+        close(fd);
+    });
 
-    if (!SHA512_Final(digest.data(), &ctx)) {
-        return std::errc::io_error;
+    return hash_fd(algorithm, fd);
+}
+
+/*!
+ * \brief Compute the hashes of several files with up to \a threads at a time
+ *
+ * \return Digest or error for each path in \a paths
+ */
+std::vector<oc::result<HashDigest>>
+hash_paths(HashAlgorithm algorithm, const std::vector<std::string> &paths,
+           unsigned int threads)
+{
+    std::vector<oc::result<HashDigest>> results(
+            paths.size(), std::errc::operation_canceled);
+    std::atomic_size_t next(0);
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < paths.size();) {
+            results[i] = hash_path(algorithm, paths[i]);
+        }
+    };
+
+    run_on_threads(ThreadPool::global(),
+                   static_cast<unsigned int>(std::min<size_t>(
+                           threads, paths.size())), worker);
+
+    return results;
+}
+
+/*!
+ * \brief Compute a two-level hash of a file with up to \a threads at a time
+ *
+ * The file is split into \a chunk_size pieces, which are hashed in parallel
+ * with pread(). The result is the hash of the concatenated chunk digests, so
+ * it is \em not the same as the plain hash of the file. An empty file has a
+ * single empty chunk.
+ */
+oc::result<HashDigest> tree_hash_fd(HashAlgorithm algorithm, int fd,
+                                    uint64_t chunk_size, unsigned int threads)
+{
+    if (chunk_size == 0) {
+        return std::errc::invalid_argument;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    auto file_size = static_cast<uint64_t>(sb.st_size);
+    auto n_chunks = std::max<uint64_t>(
+            (file_size + chunk_size - 1) / chunk_size, 1);
+    auto digest_size = hash_digest_size(algorithm);
+
+    std::vector<unsigned char> leaves(n_chunks * digest_size);
+    std::atomic_uint64_t next(0);
+    std::atomic_bool failed(false);
+    std::error_code error;
+
+    auto worker = [&] {
+        Hasher hasher(algorithm);
+        std::vector<unsigned char> buf(static_cast<size_t>(
+                std::min<uint64_t>(chunk_size, HASH_BUFFER_SIZE)));
+
+        auto hash_chunk = [&](uint64_t chunk) -> oc::result<void> {
+            uint64_t offset = chunk * chunk_size;
+            uint64_t end = std::min(offset + chunk_size, file_size);
+
+            while (offset < end) {
+                auto to_read = static_cast<size_t>(
+                        std::min<uint64_t>(end - offset, buf.size()));
+
+                ssize_t n = pread64(fd, buf.data(), to_read,
+                                    static_cast<off64_t>(offset));
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return ec_from_errno();
+                } else if (n == 0) {
+                    // File was truncated
+                    return std::errc::io_error;
+                }
+
+                OUTCOME_TRYV(hasher.update(buf.data(),
+                                           static_cast<size_t>(n)));
+                offset += static_cast<uint64_t>(n);
+            }
+
+            OUTCOME_TRY(digest, hasher.finish());
+            std::copy(digest.begin(), digest.end(),
+                      leaves.begin() + static_cast<ptrdiff_t>(
+                              chunk * digest_size));
+
+            return oc::success();
+        };
+
+        for (uint64_t chunk; !failed && (chunk = next++) < n_chunks;) {
+            if (auto r = hash_chunk(chunk); !r && !failed.exchange(true)) {
+                error = r.error();
+            }
+        }
+    };
+
+    run_on_threads(ThreadPool::global(),
+                   static_cast<unsigned int>(std::min<uint64_t>(
+                           threads, n_chunks)), worker);
+
+    if (failed) {
+        return error;
     }
 
-    return std::move(digest);
+    Hasher hasher(algorithm);
+    OUTCOME_TRYV(hasher.update(leaves.data(), leaves.size()));
+    return hasher.finish();
 }
 
 }
@@ -19,12 +19,16 @@
 
 #include "mbutil/loopdev.h"
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
+
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
@@ -45,10 +49,93 @@
 
 #define MAX_LOOPDEVS    1024
 
+// Loop devices that were detached by this process and can be handed out again
+// without asking the kernel
+#define LOOPDEV_POOL_SIZE 8
+
+// Older kernel headers do not have these
+#ifndef LO_FLAGS_DIRECT_IO
+#  define LO_FLAGS_DIRECT_IO 16
+#endif
+#ifndef LOOP_SET_DIRECT_IO
+#  define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+#ifndef LOOP_SET_BLOCK_SIZE
+#  define LOOP_SET_BLOCK_SIZE 0x4C09
+#endif
+#ifndef LOOP_CONFIGURE
+#  define LOOP_CONFIGURE 0x4C0A
+#endif
+
+#define EXT4_SUPERBLOCK_OFFSET  1024
+#define EXT4_SUPER_MAGIC        0xEF53
+
 
 namespace mb::util
 {
 
+// Same layout as struct loop_config from <linux/loop.h> (Linux 5.8)
+struct LoopConfig
+{
+    uint32_t fd;
+    uint32_t block_size;
+    loop_info64 info;
+    uint64_t reserved[8];
+};
+
+static std::mutex g_pool_mutex;
+static std::vector<int> g_pool;
+
+/*!
+ * \brief Check if a loopdev is not attached to a file
+ *
+ * The device node is created if it does not exist.
+ */
+static bool is_loopdev_free(int n)
+{
+    char loopdev[64];
+    sprintf(loopdev, LOOP_FMT, n);
+
+    if (mknod(loopdev, S_IFBLK | 0644, static_cast<dev_t>(makedev(7, n))) < 0
+            && errno != EEXIST) {
+        return false;
+    }
+
+    int fd = open(loopdev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    loop_info64 loopinfo;
+    return ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0 && errno == ENXIO;
+}
+
+/*!
+ * \brief Take a loopdev that this process detached earlier
+ *
+ * \return Loopdev number or -1 if the pool has no free loopdevs
+ */
+static int find_loopdev_in_pool()
+{
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+
+    while (!g_pool.empty()) {
+        int n = g_pool.back();
+        g_pool.pop_back();
+
+        // Something else may have attached it in the meantime
+        if (is_loopdev_free(n)) {
+            return n;
+        }
+    }
+
+    return -1;
+}
+
 /*!
  * \brief Find empty loopdev by using the new ioctl for /dev/block/loop-control
  *
@@ -148,8 +235,20 @@ static oc::result<int> find_loopdev_by_scanning()
     return std::errc::no_such_file_or_directory;
 }
 
+/*!
+ * \brief Find a loopdev that is not attached to a file
+ *
+ * Loopdevs previously detached with loopdev_remove_device() are reused first.
+ * Otherwise, the kernel is asked for a free loopdev with LOOP_CTL_GET_FREE.
+ * The loopdevs are only scanned one by one if loop-control is not available or
+ * if the free loopdev is /dev/block/loop0.
+ */
 oc::result<std::string> loopdev_find_unused()
 {
+    if (int pooled = find_loopdev_in_pool(); pooled >= 0) {
+        return format(LOOP_FMT, pooled);
+    }
+
     auto n = find_loopdev_by_loop_control();
 
     // Also search by scanning if n == 0, since some installers hardcode
@@ -164,11 +263,71 @@ oc::result<std::string> loopdev_find_unused()
     return format(LOOP_FMT, n.value());
 }
 
+/*!
+ * \brief Pick the logical block size for a loopdev
+ *
+ * A larger block size lets direct I/O be used on storage with 4 KiB sectors,
+ * but filesystems cannot be mounted if their block size is smaller than the
+ * device's. 4 KiB is only used for ext2/3/4 images with blocks at least that
+ * large and the default (512 bytes) is used for everything else.
+ */
+static uint32_t pick_block_size(int ffd, uint64_t offset)
+{
+    constexpr uint32_t block_size = 4096;
+    unsigned char sb[64];
+    struct stat st;
+
+    if (offset % block_size != 0 || fstat(ffd, &st) < 0
+            || static_cast<uint64_t>(st.st_size) % block_size != 0
+            || pread64(ffd, sb, sizeof(sb),
+                       static_cast<off64_t>(offset + EXT4_SUPERBLOCK_OFFSET))
+                    != static_cast<ssize_t>(sizeof(sb))) {
+        return 0;
+    }
+
+    // s_log_block_size is at 24 and s_magic is at 56 (little endian)
+    uint32_t log_block_size = static_cast<uint32_t>(sb[24])
+            | static_cast<uint32_t>(sb[25]) << 8
+            | static_cast<uint32_t>(sb[26]) << 16
+            | static_cast<uint32_t>(sb[27]) << 24;
+    uint16_t magic = static_cast<uint16_t>(sb[56] | sb[57] << 8);
+
+    if (magic != EXT4_SUPER_MAGIC || log_block_size < 2
+            || log_block_size > 6) {
+        return 0;
+    }
+
+    return block_size;
+}
+
+/*!
+ * \brief Attach a file to a loopdev
+ *
+ * LOOP_CONFIGURE is used where it is supported (Linux 5.8+) so that the
+ * backing file, offset, and flags are all set with one ioctl. Older kernels
+ * fall back to LOOP_SET_FD and LOOP_SET_STATUS64.
+ *
+ * If \a flags contains LoopdevFlag::DirectIo, the loopdev reads and writes the
+ * backing file with direct I/O, so the data is not cached a second time in
+ * the backing file's page cache. The logical block size is raised to match
+ * the image where that is safe (see pick_block_size()) since direct I/O
+ * requires it to be at least the backing storage's sector size. If the kernel
+ * cannot do direct I/O for the file, the loopdev uses buffered I/O instead.
+ *
+ * \param loopdev Loopdev path
+ * \param file Backing file path
+ * \param offset Offset of the data in \a file
+ * \param ro Whether to attach the file read-only
+ * \param flags Loopdev flags
+ *
+ * \return Nothing on success or the error code on failure
+ */
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
-                                       uint64_t offset, bool ro)
+                                       uint64_t offset, bool ro,
+                                       LoopdevFlags flags)
 {
-    int ffd = open(file.c_str(), ro ? O_RDONLY : O_RDWR);
+    int ffd = open(file.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (ffd < 0) {
         return ec_from_errno();
     }
@@ -177,7 +336,7 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         close(ffd);
     });
 
-    int lfd = open(loopdev.c_str(), ro ? O_RDONLY : O_RDWR);
+    int lfd = open(loopdev.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (lfd < 0) {
         return ec_from_errno();
     }
@@ -186,12 +345,42 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         close(lfd);
     });
 
+    bool direct_io = flags & LoopdevFlag::DirectIo;
+    uint32_t block_size = direct_io ? pick_block_size(ffd, offset) : 0;
+
     loop_info64 loopinfo = {};
 
     strlcpy(reinterpret_cast<char *>(loopinfo.lo_file_name), file.c_str(),
             LO_NAME_SIZE);
     loopinfo.lo_offset = offset;
 
+    LoopConfig config = {};
+    config.fd = static_cast<uint32_t>(ffd);
+    config.block_size = block_size;
+    config.info = loopinfo;
+    if (ro) {
+        config.info.lo_flags |= LO_FLAGS_READ_ONLY;
+    }
+    if (direct_io) {
+        config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+    }
+
+    if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+        return oc::success();
+    } else if (errno == EINVAL && direct_io) {
+        config.info.lo_flags &= ~static_cast<uint32_t>(LO_FLAGS_DIRECT_IO);
+
+        if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+            return oc::success();
+        }
+    }
+
+    // EBUSY means the loopdev is in use and the old ioctls will fail too.
+    // Anything else most likely means that LOOP_CONFIGURE is not supported.
+    if (errno == EBUSY) {
+        return ec_from_errno();
+    }
+
     if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
         return ec_from_errno();
     }
@@ -202,6 +391,16 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         return ec_from_errno(saved_errno);
     }
 
+    // These are best effort. Kernels older than 4.4 (direct I/O) and 4.14
+    // (block size) don't support them, but the loopdev works without them.
+    if (direct_io) {
+        if (block_size != 0) {
+            (void) ioctl(lfd, LOOP_SET_BLOCK_SIZE,
+                         static_cast<unsigned long>(block_size));
+        }
+        (void) ioctl(lfd, LOOP_SET_DIRECT_IO, 1UL);
+    }
+
     return oc::success();
 }
 
@@ -216,10 +415,27 @@ oc::result<void> loopdev_remove_device(const std::string &loopdev)
         close(lfd);
     });
 
+    // Remember the loopdev's number so loopdev_find_unused() can hand it out
+    // again. /dev/block/loop0 is never reused (see find_loopdev_by_scanning()).
+    loop_info64 loopinfo;
+    bool have_info = ioctl(lfd, LOOP_GET_STATUS64, &loopinfo) == 0;
+
     if (ioctl(lfd, LOOP_CLR_FD, 0) < 0) {
         return ec_from_errno();
     }
 
+    if (have_info && loopinfo.lo_number != 0) {
+        int n = static_cast<int>(loopinfo.lo_number);
+
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+
+        if (g_pool.size() < LOOPDEV_POOL_SIZE
+                && std::find(g_pool.begin(), g_pool.end(), n)
+                        == g_pool.end()) {
+            g_pool.push_back(n);
+        }
+    }
+
     return oc::success();
 }
 
@@ -19,7 +19,9 @@
 
 #include "mbutil/mount.h"
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
@@ -27,6 +29,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
@@ -53,6 +57,10 @@ namespace mb::util
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
+// Shared snapshot used by is_mounted(), unmount_all(), and umount()
+static std::mutex g_mount_table_mutex;
+static MountTable g_mount_table;
+
 struct MountErrorCategory : std::error_category
 {
     const char * name() const noexcept override;
@@ -111,6 +119,16 @@ static std::string unescape_octals(std::string_view in)
     return result;
 }
 
+static void strip_deleted_suffix(std::string &dir)
+{
+    struct stat sb;
+
+    if (ends_with(dir, DELETED_SUFFIX) && lstat(dir.c_str(), &sb) < 0
+            && errno == ENOENT) {
+        dir.erase(dir.size() - strlen(DELETED_SUFFIX));
+    }
+}
+
 oc::result<MountEntry> get_mount_entry(std::FILE *fp)
 {
     MountEntry entry;
@@ -154,41 +172,251 @@ oc::result<MountEntry> get_mount_entry(std::FILE *fp)
     entry.type = unescape_octals(line + pos[4]);
     entry.opts = unescape_octals(line + pos[6]);
 
-    struct stat sb;
-    if (lstat(entry.dir.c_str(), &sb) < 0 && errno == ENOENT
-            && ends_with(entry.dir, DELETED_SUFFIX)) {
-        entry.dir.erase(entry.dir.size() - strlen(DELETED_SUFFIX));
+    strip_deleted_suffix(entry.dir);
+
+    return std::move(entry);
+}
+
+/*!
+ * \brief Parse a line from /proc/self/mountinfo
+ *
+ * The fields are returned in the same form as the ones from /proc/mounts. The
+ * per-mount options are followed by the superblock options.
+ */
+static oc::result<MountEntry> parse_mountinfo_line(std::string_view line)
+{
+    // <id> <parent id> <major:minor> <root> <mount point> <mount options>
+    // [optional fields...] - <fs type> <source> <superblock options>
+    auto fields = split_sv(line, ' ');
+
+    auto sep = std::find(fields.begin(), fields.end(), "-");
+    if (std::distance(fields.begin(), sep) < 6
+            || std::distance(sep, fields.end()) != 4) {
+        return std::errc::invalid_argument;
     }
 
+    MountEntry entry;
+    entry.fsname = unescape_octals(sep[2]);
+    entry.dir = unescape_octals(fields[4]);
+    entry.type = unescape_octals(sep[1]);
+    entry.opts = unescape_octals(fields[5]);
+    entry.freq = 0;
+    entry.passno = 0;
+
+    // The superblock options repeat "ro" or "rw"
+    auto super_opts = sep[3];
+    if (starts_with(super_opts, "ro") || starts_with(super_opts, "rw")) {
+        super_opts.remove_prefix(2);
+        if (!super_opts.empty() && super_opts.front() == ',') {
+            super_opts.remove_prefix(1);
+        }
+    }
+    if (!super_opts.empty()) {
+        entry.opts += ',';
+        entry.opts += unescape_octals(super_opts);
+    }
+
+    strip_deleted_suffix(entry.dir);
+
     return std::move(entry);
 }
 
-oc::result<void> is_mounted(const std::string &mountpoint)
+MountTable::MountTable()
+    : _fd(-1)
+    , _ns_ino(0)
+    , _generation(0)
+{
+}
+
+MountTable::~MountTable()
+{
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+/*!
+ * \brief Update the snapshot if the mount table changed
+ *
+ * \return Nothing if the snapshot is up to date. Otherwise, the error code. If
+ *         an error occurs, the next call will reread the mount table.
+ */
+oc::result<void> MountTable::refresh()
 {
-    ScopedFILE fp(std::fopen(PROC_MOUNTS, "r"), std::fclose);
-    if (!fp) {
+    // An fd for mountinfo keeps reporting the namespace it was opened in
+    struct stat sb;
+    ino_t ns_ino = stat("/proc/self/ns/mnt", &sb) == 0 ? sb.st_ino : 0;
+
+    if (_fd >= 0 && ns_ino == _ns_ino) {
+        struct pollfd pfd = {};
+        pfd.fd = _fd;
+        pfd.events = POLLPRI;
+
+        int n = poll(&pfd, 1, 0);
+        if (n < 0) {
+            return ec_from_errno();
+        } else if (n == 0 || !(pfd.revents & (POLLERR | POLLPRI))) {
+            return oc::success();
+        }
+    } else {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+
+        // Open before reading so that no change is missed
+        _fd = open(PROC_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+        if (_fd < 0) {
+            return ec_from_errno();
+        }
+
+        _ns_ino = ns_ino;
+    }
+
+    auto ret = load();
+    if (!ret) {
+        close(_fd);
+        _fd = -1;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Number of times the mount table has been reparsed
+ */
+uint64_t MountTable::generation() const
+{
+    return _generation;
+}
+
+const std::vector<MountEntry> & MountTable::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find the topmost mount at a mount point
+ *
+ * \return Pointer to the entry or nullptr if nothing is mounted there
+ */
+const MountEntry * MountTable::find(const std::string &mountpoint) const
+{
+    if (auto it = _index.find(mountpoint); it != _index.end()) {
+        return &_entries[it->second];
+    }
+
+    return nullptr;
+}
+
+/*!
+ * \brief Find the mounts whose mount point starts with a prefix
+ *
+ * \return Entries in reverse mount order, which is safe for unmounting since
+ *         every mount comes before the one it is on top of
+ */
+std::vector<const MountEntry *>
+MountTable::find_under(const std::string &dir) const
+{
+    std::vector<const MountEntry *> result;
+
+    for (auto it = _entries.rbegin(); it != _entries.rend(); ++it) {
+        // TODO: Use path_compare() instead of dumb string prefix matching
+        if (starts_with(it->dir, dir)) {
+            result.push_back(&*it);
+        }
+    }
+
+    return result;
+}
+
+oc::result<void> MountTable::load()
+{
+    if (lseek(_fd, 0, SEEK_SET) < 0) {
         return ec_from_errno();
     }
 
+    std::string data;
+    char buf[16384];
+
     while (true) {
-        auto entry = get_mount_entry(fp.get());
-        if (!entry) {
-            if (entry.error() == MountError::EndOfFile) {
-                break;
-            } else {
-                return entry.as_failure();
+        ssize_t n = read(_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        data.append(buf, static_cast<size_t>(n));
+    }
+
+    std::vector<MountEntry> entries;
+
+    for (auto line : split_sv(data, '\n')) {
+        if (line.empty()) {
+            continue;
+        }
+
+        OUTCOME_TRY(entry, parse_mountinfo_line(line));
+        entries.push_back(std::move(entry));
+    }
+
+    _entries.swap(entries);
+    _index.clear();
+
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        _index[_entries[i].dir] = i;
+    }
+
+    ++_generation;
+
+    return oc::success();
+}
+
+oc::result<void> is_mounted(const std::string &mountpoint)
+{
+    std::lock_guard<std::mutex> lock(g_mount_table_mutex);
+
+    OUTCOME_TRYV(g_mount_table.refresh());
+
+    if (!g_mount_table.find(mountpoint)) {
+        return MountError::PathNotMounted;
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> umount_source(const std::string &target,
+                                      const std::string &source)
+{
+    oc::result<void> ret = oc::success();
+    if (::umount(target.c_str()) < 0) {
+        ret = ec_from_errno();
+    }
+
+    if (!source.empty()) {
+        struct stat sb;
+
+        if (stat(source.c_str(), &sb) == 0
+                && S_ISBLK(sb.st_mode) && major(sb.st_rdev) == 7) {
+            // If the source path is a loop block device, then disassociate it
+            // from the image
+            LOGD("Clearing loop device %s", source.c_str());
+            if (auto r = loopdev_remove_device(source); !r) {
+                LOGW("Failed to clear loop device: %s",
+                     r.error().message().c_str());
             }
-        } else if (entry.value().dir == mountpoint) {
-            return oc::success();
         }
     }
 
-    return MountError::PathNotMounted;
+    return ret;
 }
 
 oc::result<void> unmount_all(const std::string &dir)
 {
-    std::vector<std::string> to_unmount;
+    std::vector<std::pair<std::string, std::string>> to_unmount;
     int failed = 0;
     std::error_code ec;
 
@@ -197,25 +425,23 @@ oc::result<void> unmount_all(const std::string &dir)
         to_unmount.clear();
         ec.clear();
 
-        ScopedFILE fp(std::fopen(PROC_MOUNTS, "r"), std::fclose);
-        if (!fp) {
-            return ec_from_errno();
-        }
+        {
+            std::lock_guard<std::mutex> lock(g_mount_table_mutex);
+
+            OUTCOME_TRYV(g_mount_table.refresh());
 
-        while (auto entry = get_mount_entry(fp.get())) {
-            // TODO: Use path_compare() instead of dumb string prefix matching
-            if (starts_with(entry.value().dir, dir)) {
-                to_unmount.push_back(std::move(entry.value().dir));
+            for (auto const *entry : g_mount_table.find_under(dir)) {
+                to_unmount.emplace_back(entry->dir, entry->fsname);
             }
         }
 
-        // Unmount in reverse order
-        for (auto it = to_unmount.rbegin(); it != to_unmount.rend(); ++it) {
-            LOGD("Attempting to unmount %s", it->c_str());
+        // Already ordered so that submounts are unmounted first
+        for (auto const &[target, source] : to_unmount) {
+            LOGD("Attempting to unmount %s", target.c_str());
 
-            if (auto ret = umount(*it); !ret) {
+            if (auto ret = umount_source(target, source); !ret) {
                 LOGW("%s: Failed to unmount: %s",
-                     it->c_str(), ret.error().message().c_str());
+                     target.c_str(), ret.error().message().c_str());
                 ++failed;
                 ec = ret.error();
             }
@@ -256,6 +482,22 @@ oc::result<void> unmount_all(const std::string &dir)
 oc::result<void> mount(const std::string &source, const std::string &target,
                        const std::string &fstype, unsigned long mount_flags,
                        const std::string &data)
+{
+    return mount(source, target, fstype, mount_flags, data, {});
+}
+
+/*!
+ * \brief Mount filesystem, passing flags for the loopdev if one is needed
+ *
+ * \sa mount(const std::string &, const std::string &, const std::string &,
+ *         unsigned long, const std::string &)
+ *
+ * \param loopdev_flags Flags for loopdev_set_up_device() if \a source is
+ *                      attached to a loopdev
+ */
+oc::result<void> mount(const std::string &source, const std::string &target,
+                       const std::string &fstype, unsigned long mount_flags,
+                       const std::string &data, LoopdevFlags loopdev_flags)
 {
     bool need_loopdev = false;
     struct stat sb;
@@ -284,7 +526,8 @@ oc::result<void> mount(const std::string &source, const std::string &target,
     if (need_loopdev) {
         OUTCOME_TRY(loopdev, loopdev_find_unused());
         OUTCOME_TRYV(loopdev_set_up_device(loopdev, source, 0,
-                                           mount_flags & MS_RDONLY));
+                                           mount_flags & MS_RDONLY,
+                                           loopdev_flags));
 
         if (::mount(loopdev.c_str(), target.c_str(), fstype_real.c_str(),
                     mount_flags, data.c_str()) < 0) {
@@ -308,7 +551,7 @@ oc::result<void> mount(const std::string &source, const std::string &target,
  * This function takes the same arguments as umount(2), but returns nothing on
  * success and the error on failure.
  *
- * This function will search /proc/mounts for the mountpoint (using an exact
+ * This function will search the mount table for the mountpoint (using an exact
  * string compare). If the source path of the mountpoint is a block device and
  * the block device is a loop device, then it will be disassociated from the
  * previously attached file. Note that the return value of
@@ -322,40 +565,19 @@ oc::result<void> mount(const std::string &source, const std::string &target,
 oc::result<void> umount(const std::string &target)
 {
     std::string source;
-    std::string mnt_dir;
-
-    ScopedFILE fp(std::fopen(PROC_MOUNTS, "r"), std::fclose);
-    if (fp) {
-        while (auto entry = get_mount_entry(fp.get())) {
-            if (entry.value().dir == target) {
-                source = entry.value().fsname;
-            }
-        }
-    } else {
-        LOGW("%s: Failed to read file: %s", PROC_MOUNTS, strerror(errno));
-    }
-
-    oc::result<void> ret = oc::success();
-    if (::umount(target.c_str()) < 0) {
-        ret = ec_from_errno();
-    }
 
-    if (!source.empty()) {
-        struct stat sb;
+    {
+        std::lock_guard<std::mutex> lock(g_mount_table_mutex);
 
-        if (stat(source.c_str(), &sb) == 0
-                && S_ISBLK(sb.st_mode) && major(sb.st_rdev) == 7) {
-            // If the source path is a loop block device, then disassociate it
-            // from the image
-            LOGD("Clearing loop device %s", source.c_str());
-            if (auto r = loopdev_remove_device(source); !r) {
-                LOGW("Failed to clear loop device: %s",
-                     ret.error().message().c_str());
-            }
+        if (auto r = g_mount_table.refresh(); !r) {
+            LOGW("%s: Failed to read file: %s", PROC_MOUNTINFO,
+                 r.error().message().c_str());
+        } else if (auto entry = g_mount_table.find(target)) {
+            source = entry->fsname;
         }
     }
 
-    return ret;
+    return umount_source(target, source);
 }
 
 oc::result<uint64_t> mount_get_total_size(const std::string &path)
@@ -19,6 +19,7 @@
 
 #include "mbutil/path.h"
 
+#include <algorithm>
 #include <chrono>
 #include <vector>
 
@@ -27,10 +28,13 @@
 #include <cstring>
 
 #include <libgen.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
 
 
 namespace mb::util
@@ -284,11 +288,31 @@ int path_compare(const std::string &path1, const std::string &path2)
     return path_join(path1_pieces).compare(path_join(path2_pieces));
 }
 
-bool wait_for_path(const std::string &path, std::chrono::milliseconds timeout)
+// Upper bound on the time between checks when waiting with inotify. Changes
+// that are not visible in the watched directory (eg. the target of a symlink
+// being created) are still noticed within this interval.
+static constexpr std::chrono::milliseconds WAIT_RECHECK_INTERVAL{250};
+
+/*!
+ * \brief Find the deepest existing directory on the way to a path
+ */
+static std::string deepest_existing_parent(const std::string &path)
+{
+    std::string dir = path;
+    struct stat sb;
+
+    do {
+        dir = dir_name(std::move(dir));
+    } while (stat(dir.c_str(), &sb) < 0 && dir != "/" && dir != ".");
+
+    return dir;
+}
+
+static bool wait_for_path_polling(const std::string &path,
+                                  std::chrono::steady_clock::time_point until)
 {
     using namespace std::chrono;
 
-    auto until = steady_clock::now() + timeout;
     struct stat sb;
     int ret;
 
@@ -299,6 +323,96 @@ bool wait_for_path(const std::string &path, std::chrono::milliseconds timeout)
     return ret == 0;
 }
 
+/*!
+ * \brief Wait for a path to exist
+ *
+ * The closest existing parent directory of \p path is watched with inotify, so
+ * this returns as soon as the path is created instead of on the next polling
+ * interval. When a missing parent directory is created, the watch moves down
+ * to it. If inotify is unavailable, the path is polled every 10ms instead.
+ *
+ * \param path Path to wait for (symlinks are followed)
+ * \param timeout Maximum amount of time to wait
+ *
+ * \return Whether the path exists
+ */
+bool wait_for_path(const std::string &path, std::chrono::milliseconds timeout)
+{
+    using namespace std::chrono;
+
+    auto until = steady_clock::now() + timeout;
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) == 0) {
+        return true;
+    }
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return wait_for_path_polling(path, until);
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    alignas(struct inotify_event) char buf[4096];
+    std::string watched;
+    int wd = -1;
+
+    while (true) {
+        auto dir = deepest_existing_parent(path);
+
+        if (dir != watched || wd < 0) {
+            if (wd >= 0) {
+                inotify_rm_watch(fd, wd);
+            }
+
+            wd = inotify_add_watch(fd, dir.c_str(),
+                                   IN_CREATE | IN_MOVED_TO | IN_ATTRIB
+                                   | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+            if (wd < 0 && errno != ENOENT) {
+                return wait_for_path_polling(path, until);
+            }
+            watched = std::move(dir);
+        }
+
+        // Check after adding the watch so that nothing created in between is
+        // missed
+        if (stat(path.c_str(), &sb) == 0) {
+            return true;
+        }
+
+        auto now = steady_clock::now();
+        if (now >= until) {
+            return false;
+        }
+
+        auto wait = std::min(duration_cast<milliseconds>(until - now),
+                             WAIT_RECHECK_INTERVAL);
+
+        pollfd pfd = { fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, static_cast<int>(wait.count()) + 1) < 0
+                && errno != EINTR) {
+            return wait_for_path_polling(path, until);
+        }
+
+        // The contents do not matter since everything is checked again
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            for (char *ptr = buf; ptr < buf + n;) {
+                auto *event = reinterpret_cast<struct inotify_event *>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if ((event->mask & IN_IGNORED) && event->wd == wd) {
+                    wd = -1;
+                }
+            }
+        }
+    }
+}
+
 bool path_exists(const std::string &path, bool follow_symlinks)
 {
     struct stat sb;
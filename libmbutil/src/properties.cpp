@@ -19,13 +19,20 @@
 
 #include "mbutil/properties.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <vector>
 
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
@@ -98,6 +105,107 @@ bool libc_system_property_wait(const prop_info *pi,
                                     relative_timeout);
 }
 
+uint32_t libc_system_property_area_serial()
+{
+    initialize_properties();
+
+    return mb__system_property_area_serial();
+}
+
+ssize_t libc_system_property_snapshot(char *buf, size_t size,
+                                      uint32_t *serial)
+{
+    initialize_properties();
+
+    return mb__system_property_snapshot(buf, size, serial);
+}
+
+PropertySnapshot::PropertySnapshot()
+    : _serial(0)
+    , _valid(false)
+{
+}
+
+/*!
+ * \brief Update the snapshot if any property has changed
+ *
+ * \return Whether the snapshot is valid
+ */
+bool PropertySnapshot::refresh()
+{
+    if (!changed()) {
+        return true;
+    }
+
+    _valid = false;
+    _props.clear();
+
+    if (_buf.empty()) {
+        _buf.resize(16384);
+    }
+
+    size_t used;
+
+    while (true) {
+        auto ret = libc_system_property_snapshot(_buf.data(), _buf.size(),
+                                                 &_serial);
+        if (ret < 0) {
+            return false;
+        }
+
+        used = static_cast<size_t>(ret);
+        if (used <= _buf.size()) {
+            break;
+        }
+
+        // Leave some room in case properties are added before the next try
+        _buf.resize(used + used / 4);
+    }
+
+    for (std::string_view data(_buf.data(), used); !data.empty();) {
+        auto name_size = data.find('\0');
+        auto value_size = data.find('\0', name_size + 1) - name_size - 1;
+
+        _props.emplace_back(data.substr(0, name_size),
+                            data.substr(name_size + 1, value_size));
+        data.remove_prefix(name_size + value_size + 2);
+    }
+
+    std::sort(_props.begin(), _props.end());
+
+    _valid = true;
+    return true;
+}
+
+/*!
+ * \brief Check if the snapshot is out of date
+ */
+bool PropertySnapshot::changed() const
+{
+    return !_valid || libc_system_property_area_serial() != _serial;
+}
+
+std::optional<std::string_view>
+PropertySnapshot::get(std::string_view key) const
+{
+    auto it = std::lower_bound(_props.begin(), _props.end(), key,
+                               [](const Property &p, std::string_view k) {
+        return p.first < k;
+    });
+
+    if (it != _props.end() && it->first == key) {
+        return it->second;
+    }
+
+    return std::nullopt;
+}
+
+const std::vector<PropertySnapshot::Property> &
+PropertySnapshot::properties() const
+{
+    return _props;
+}
+
 // Helper functions
 
 static bool string_to_bool(const std::string &str, bool &value_out)
@@ -204,121 +312,356 @@ bool property_set_direct(const std::string &key, const std::string &value)
 
 bool property_list(PropertyListCb prop_fn, void *cookie)
 {
-    struct PropListCtx
-    {
-        PropertyListCb prop_fn;
-        void *cookie;
-    };
-
-    PropListCtx ctx{ prop_fn, cookie };
+    PropertySnapshot snapshot;
+    if (!snapshot.refresh()) {
+        return false;
+    }
 
-    return libc_system_property_foreach(
-            [](const prop_info *pi, void *cookie_) {
-        auto *ctx_ = static_cast<PropListCtx *>(cookie_);
-        std::string name;
-        std::string value;
+    for (auto const &[name, value] : snapshot.properties()) {
+        prop_fn(std::string(name), std::string(value), cookie);
+    }
 
-        read_property(pi, name, value);
-        ctx_->prop_fn(name, value, ctx_->cookie);
-    }, &ctx);
+    return true;
 }
 
 bool property_get_all(std::unordered_map<std::string, std::string> &map)
 {
-    return libc_system_property_foreach(
-            [](const prop_info *pi, void *cookie) {
-        auto *map_ = static_cast<std::unordered_map<std::string, std::string> *>(cookie);
-        std::string name;
-        std::string value;
+    PropertySnapshot snapshot;
+    if (!snapshot.refresh()) {
+        return false;
+    }
+
+    map.reserve(map.size() + snapshot.properties().size());
 
-        read_property(pi, name, value);
-        (*map_)[name] = value;
-    }, &map);
+    for (auto const &[name, value] : snapshot.properties()) {
+        map.insert_or_assign(std::string(name), std::string(value));
+    }
+
+    return true;
 }
 
 // Properties file functions
 
-enum class PropIterAction
+PropertyFile::PropertyFile()
+    : _map(nullptr)
+    , _map_size(0)
 {
-    Continue,
-    Stop,
-};
+}
 
-typedef PropIterAction (*PropIterCb)(const std::string &key,
-                                     const std::string &value,
-                                     void *cookie);
+PropertyFile::~PropertyFile()
+{
+    unmap();
+}
 
-static bool iterate_property_file(const std::string &path, PropIterCb cb,
-                                  void *cookie)
+void PropertyFile::unmap()
 {
-    ScopedFILE fp(fopen(path.c_str(), "r"), &fclose);
-    if (!fp) {
+    if (_map) {
+        munmap(_map, _map_size);
+        _map = nullptr;
+        _map_size = 0;
+    }
+}
+
+/*!
+ * \brief Map and index a properties file
+ *
+ * \return Whether the file was successfully loaded. If false is returned,
+ *         errno is set accordingly.
+ */
+bool PropertyFile::load(const std::string &path)
+{
+    clear();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
         return false;
     }
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+    if (sb.st_size > 0) {
+        auto size = static_cast<size_t>(sb.st_size);
+
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+
+        _map = map;
+        _map_size = size;
+    }
+
+    parse({static_cast<const char *>(_map), _map_size});
+    return true;
+}
+
+/*!
+ * \brief Index properties from data that is already in memory
+ */
+void PropertyFile::load_data(std::string data)
+{
+    clear();
+
+    _buf = std::move(data);
+    parse(_buf);
+}
+
+void PropertyFile::clear()
+{
+    _lines.clear();
+    _index.clear();
+    _storage.clear();
+    _buf.clear();
+    unmap();
+}
 
-    auto free_line = finally([&] {
-        free(line);
+void PropertyFile::parse(std::string_view data)
+{
+    while (!data.empty()) {
+        auto pos = data.find('\n');
+        auto text = data.substr(0, pos);
+        data.remove_prefix(pos == std::string_view::npos
+                ? data.size() : pos + 1);
+
+        Line line{text, 0, false, false};
+
+        // Skip empty and comment lines
+        if (!text.empty() && text[0] != '#') {
+            if (auto equals = text.find('='); equals != text.npos) {
+                line.key_size = equals;
+                line.is_prop = true;
+                _index.push_back(_lines.size());
+            }
+        }
+
+        _lines.push_back(line);
+    }
+
+    std::stable_sort(_index.begin(), _index.end(), [&](size_t a, size_t b) {
+        return _lines[a].key() < _lines[b].key();
     });
+}
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        if (read == 0 || line[0] == '#') {
-            // Skip empty and comment lines
-            continue;
+std::vector<size_t>::const_iterator
+PropertyFile::lower_bound(std::string_view key) const
+{
+    return std::lower_bound(_index.begin(), _index.end(), key,
+                            [&](size_t i, std::string_view k) {
+        return _lines[i].key() < k;
+    });
+}
+
+/*!
+ * \brief Serialize the properties file, including any edits
+ */
+std::string PropertyFile::data() const
+{
+    size_t size = 0;
+    for (auto const &line : _lines) {
+        if (!line.removed) {
+            size += line.text.size() + 1;
         }
+    }
+
+    std::string result;
+    result.reserve(size);
 
-        char *equals = strchr(line, '=');
-        if (!equals) {
-            // No equals in line
-            continue;
+    for (auto const &line : _lines) {
+        if (!line.removed) {
+            result += line.text;
+            result += '\n';
         }
+    }
 
-        *equals = '\0';
+    return result;
+}
+
+/*!
+ * \brief Write the properties file, including any edits, to a path
+ *
+ * The file is written to a temporary file and then renamed into place, so it
+ * is safe to save to the same path that was loaded. If \p path already exists,
+ * its permissions are preserved.
+ */
+bool PropertyFile::save(const std::string &path) const
+{
+    std::string contents = data();
+
+    mode_t mode = 0644;
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == 0) {
+        mode = sb.st_mode & 07777;
+    }
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  mode);
+    if (fd < 0) {
+        return false;
+    }
 
-        if (line[read - 1] == '\n') {
-            line[read - 1] = '\0';
+    auto remove_temp = finally([&] {
+        if (fd >= 0) {
+            close(fd);
         }
+        unlink(temp_path.c_str());
+    });
 
-        if (cb(line, equals + 1, cookie) == PropIterAction::Stop) {
-            return true;
+    if (fchmod(fd, mode) < 0) {
+        return false;
+    }
+
+    for (std::string_view remain(contents); !remain.empty();) {
+        ssize_t n = write(fd, remain.data(), remain.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
         }
+        remain.remove_prefix(static_cast<size_t>(n));
+    }
+
+    int ret = close(fd);
+    fd = -1;
+
+    return ret == 0 && rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+/*!
+ * \brief Get the value of the first occurrence of a property
+ *
+ * \return The value, which is valid until the next edit or load, or
+ *         std::nullopt if the property does not exist
+ */
+std::optional<std::string_view> PropertyFile::get(std::string_view key) const
+{
+    if (auto it = lower_bound(key);
+            it != _index.end() && _lines[*it].key() == key) {
+        return _lines[*it].value();
     }
 
-    return !ferror(fp.get());
+    return std::nullopt;
+}
+
+std::string PropertyFile::get_string(std::string_view key,
+                                     const std::string &default_value) const
+{
+    if (auto value = get(key); value && !value->empty()) {
+        return std::string(*value);
+    }
+
+    return default_value;
+}
+
+bool PropertyFile::get_bool(std::string_view key, bool default_value) const
+{
+    bool result;
+
+    if (auto value = get(key);
+            value && string_to_bool(std::string(*value), result)) {
+        return result;
+    }
+
+    return default_value;
+}
+
+/*!
+ * \brief Set the value of a property
+ *
+ * If the property exists, its first occurrence is replaced in place.
+ * Otherwise, it is appended to the end of the file.
+ */
+void PropertyFile::set(std::string_view key, std::string_view value)
+{
+    std::string text;
+    text.reserve(key.size() + 1 + value.size());
+    text += key;
+    text += '=';
+    text += value;
+
+    auto it = lower_bound(key);
+    bool exists = it != _index.end() && _lines[*it].key() == key;
+
+    std::string_view stored = _storage.emplace_back(std::move(text));
+
+    if (exists) {
+        auto &line = _lines[*it];
+        line.text = stored;
+        line.key_size = key.size();
+    } else {
+        _index.insert(it, _lines.size());
+        _lines.push_back({stored, key.size(), true, false});
+    }
+}
+
+/*!
+ * \brief Remove every occurrence of a property
+ *
+ * \return Whether the property existed
+ */
+bool PropertyFile::remove(std::string_view key)
+{
+    auto begin = lower_bound(key);
+    auto end = begin;
+
+    while (end != _index.end() && _lines[*end].key() == key) {
+        _lines[*end].removed = true;
+        ++end;
+    }
+
+    _index.erase(begin, end);
+
+    return begin != end;
+}
+
+/*!
+ * \brief Remove every property whose key starts with a prefix
+ *
+ * \return Number of lines removed
+ */
+size_t PropertyFile::remove_prefix(std::string_view prefix)
+{
+    auto begin = lower_bound(prefix);
+    auto end = begin;
+
+    while (end != _index.end() && starts_with(_lines[*end].key(), prefix)) {
+        _lines[*end].removed = true;
+        ++end;
+    }
+
+    auto count = static_cast<size_t>(end - begin);
+    _index.erase(begin, end);
+
+    return count;
 }
 
 bool property_file_get(const std::string &path, const std::string &key,
                        std::string &value_out)
 {
-    struct Ctx
-    {
-        const std::string *key;
-        std::string *value_out;
-        bool found;
-    };
-
-    Ctx ctx{&key, &value_out, false};
-
-    bool ret = iterate_property_file(
-            path, [](const std::string &key_, const std::string &value,
-                     void *cookie) {
-        auto *ctx_ = static_cast<Ctx *>(cookie);
-        if (key_ == *ctx_->key) {
-            *ctx_->value_out = value;
-            ctx_->found = true;
-            return PropIterAction::Stop;
-        }
-        return PropIterAction::Continue;
-    }, &ctx);
+    PropertyFile props;
+    if (!props.load(path)) {
+        return false;
+    }
 
-    if (!ctx.found) {
+    if (auto value = props.get(key)) {
+        value_out = *value;
+    } else {
         value_out.clear();
     }
 
-    return ret;
+    return true;
 }
 
 std::string property_file_get_string(const std::string &path,
@@ -350,31 +693,31 @@ bool property_file_get_bool(const std::string &path, const std::string &key,
 bool property_file_list(const std::string &path, PropertyListCb prop_fn,
                         void *cookie)
 {
-    struct Ctx
-    {
-        PropertyListCb prop_fn;
-        void *cookie;
-    };
+    PropertyFile props;
+    if (!props.load(path)) {
+        return false;
+    }
 
-    Ctx ctx{prop_fn, cookie};
+    props.for_each([&](std::string_view key, std::string_view value) {
+        prop_fn(std::string(key), std::string(value), cookie);
+    });
 
-    return iterate_property_file(
-            path, [](const std::string &key, const std::string &value,
-                     void *cookie_) {
-        auto *ctx_ = static_cast<Ctx *>(cookie_);
-        ctx_->prop_fn(key, value, ctx_->cookie);
-        return PropIterAction::Continue;
-    }, &ctx);
+    return true;
 }
 
 bool property_file_get_all(const std::string &path,
                            std::unordered_map<std::string, std::string> &map)
 {
-    return property_file_list(path,
-            [](const std::string &key, const std::string &value, void *cookie) {
-        auto *map_ = static_cast<std::unordered_map<std::string, std::string> *>(cookie);
-        (*map_)[key] = value;
-    }, &map);
+    PropertyFile props;
+    if (!props.load(path)) {
+        return false;
+    }
+
+    props.for_each([&](std::string_view key, std::string_view value) {
+        map.insert_or_assign(std::string(key), std::string(value));
+    });
+
+    return true;
 }
 
 bool property_file_write_all(const std::string &path,
@@ -36,21 +36,13 @@
 namespace mb::util
 {
 
-static void log_output(const char *line, bool error, void *userdata)
+static void log_output(std::string_view line, bool error, void *userdata)
 {
     (void) error;
     (void) userdata;
 
-    size_t size = strlen(line);
-
-    std::string copy;
-    if (size > 0 && line[size - 1] == '\n') {
-        copy.assign(line, line + size - 1);
-    } else {
-        copy.assign(line, line + size);
-    }
-
-    LOGD("Reboot command output: %s", copy.c_str());
+    LOGD("Reboot command output: %.*s", static_cast<int>(line.size()),
+         line.data());
 }
 
 bool reboot_via_framework(bool show_confirm_dialog)
@@ -63,7 +55,8 @@ bool reboot_via_framework(bool show_confirm_dialog)
         "-a", "android.intent.action.REBOOT",
     };
 
-    int status = run_command(argv[0], argv, {}, {}, &log_output, nullptr);
+    int status = run_command(argv[0], argv, {}, {}, &log_output, nullptr,
+                             {});
 
     return WIFEXITED(status) && WEXITSTATUS(status) == 0;
 }
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/sched.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbutil/sched"
+
+// Not exposed by the libc headers
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_CLASS_IDLE       3
+#define IOPRIO_WHO_PROCESS      1
+
+#ifndef SCHED_IDLE
+#  define SCHED_IDLE            5
+#endif
+
+// Where Android mounts the cpu and cpuset cgroup hierarchies
+#define CPUCTL_MOUNT_POINT      "/dev/cpuctl"
+#define CPUSET_MOUNT_POINT      "/dev/cpuset"
+
+namespace mb::util
+{
+
+struct PolicyParams
+{
+    int ioprio;
+    int nice;
+    int scheduler;
+    // Candidate cgroups relative to the mount points, in order of preference.
+    // Older versions of Android have different names for the groups.
+    const char *cpu_cgroups[2];
+    const char *cpuset_cgroups[2];
+};
+
+// Interactive matches ANDROID_PRIORITY_DISPLAY, which is what the framework
+// gives to threads that the UI is waiting on
+static const PolicyParams * policy_params(SchedPolicy policy)
+{
+    static constexpr PolicyParams background = {
+        IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7), 10, SCHED_OTHER,
+        { "/background", "/bg_non_interactive" },
+        { "/background", nullptr },
+    };
+    static constexpr PolicyParams idle = {
+        IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0), 19, SCHED_IDLE,
+        { "/background", "/bg_non_interactive" },
+        { "/background", nullptr },
+    };
+    static constexpr PolicyParams interactive = {
+        IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 0), -4, SCHED_OTHER,
+        { "/top-app", "" },
+        { "/top-app", "/foreground" },
+    };
+
+    switch (policy) {
+    case SchedPolicy::Background:
+        return &background;
+    case SchedPolicy::Idle:
+        return &idle;
+    case SchedPolicy::Interactive:
+        return &interactive;
+    case SchedPolicy::Default:
+    default:
+        return nullptr;
+    }
+}
+
+static pid_t current_tid()
+{
+    return static_cast<pid_t>(syscall(__NR_gettid));
+}
+
+static int ioprio_get(pid_t tid)
+{
+    return static_cast<int>(syscall(__NR_ioprio_get, IOPRIO_WHO_PROCESS, tid));
+}
+
+static int ioprio_set(pid_t tid, int ioprio)
+{
+    return static_cast<int>(syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                                    ioprio));
+}
+
+/*!
+ * \brief Move a thread to a cgroup
+ *
+ * \param mount_point Mount point of the cgroup hierarchy
+ * \param cgroup Path of the cgroup relative to \p mount_point ("" for the root)
+ */
+static bool move_to_cgroup(const char *mount_point, const std::string &cgroup,
+                           pid_t tid)
+{
+    std::string path(mount_point);
+    path += cgroup;
+    path += "/tasks";
+
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    char buf[16];
+    int n = snprintf(buf, sizeof(buf), "%d", tid);
+
+    if (write(fd, buf, static_cast<size_t>(n)) != n) {
+        LOGV("%s: Failed to write %d: %s", path.c_str(), tid, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static void move_to_first_cgroup(const char *mount_point,
+                                 const char * const (&cgroups)[2], pid_t tid)
+{
+    for (auto cgroup : cgroups) {
+        if (cgroup && move_to_cgroup(mount_point, cgroup, tid)) {
+            return;
+        }
+    }
+}
+
+/*!
+ * \brief Find the cgroups of a thread in the cpu and cpuset hierarchies
+ */
+static void get_cgroups(pid_t tid, std::optional<std::string> &cpu,
+                        std::optional<std::string> &cpuset)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/cgroup", tid);
+
+    FILE *fp = fopen(path, "re");
+    if (!fp) {
+        return;
+    }
+
+    auto close_fp = finally([&] {
+        fclose(fp);
+    });
+
+    char *line = nullptr;
+    size_t size = 0;
+    ssize_t n;
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
+    // Each line is "<hierarchy ID>:<controllers>:<path>"
+    while ((n = getline(&line, &size, fp)) >= 0) {
+        if (n > 0 && line[n - 1] == '\n') {
+            line[n - 1] = '\0';
+        }
+
+        char *controllers = strchr(line, ':');
+        char *cgroup = controllers ? strchr(controllers + 1, ':') : nullptr;
+        if (!cgroup) {
+            continue;
+        }
+        *cgroup++ = '\0';
+        ++controllers;
+
+        // The root is written as "/", but is "" relative to the mount point
+        std::string relative(strcmp(cgroup, "/") == 0 ? "" : cgroup);
+
+        for (char *save, *c = strtok_r(controllers, ",", &save); c;
+                c = strtok_r(nullptr, ",", &save)) {
+            if (strcmp(c, "cpu") == 0) {
+                cpu = relative;
+            } else if (strcmp(c, "cpuset") == 0) {
+                cpuset = relative;
+            }
+        }
+    }
+}
+
+std::optional<SchedPolicy> sched_policy_from_string(std::string_view name)
+{
+    if (name == "default") {
+        return SchedPolicy::Default;
+    } else if (name == "background") {
+        return SchedPolicy::Background;
+    } else if (name == "idle") {
+        return SchedPolicy::Idle;
+    } else if (name == "interactive") {
+        return SchedPolicy::Interactive;
+    } else {
+        return std::nullopt;
+    }
+}
+
+const char * sched_policy_to_string(SchedPolicy policy)
+{
+    switch (policy) {
+    case SchedPolicy::Background:
+        return "background";
+    case SchedPolicy::Idle:
+        return "idle";
+    case SchedPolicy::Interactive:
+        return "interactive";
+    case SchedPolicy::Default:
+    default:
+        return "default";
+    }
+}
+
+/*!
+ * \brief Set the CPU and I/O scheduling parameters of the calling thread
+ *
+ * The I/O priority, nice value and scheduler are always set. The thread is
+ * also moved to the matching cpu and cpuset cgroups if the device has them.
+ * Threads and processes created afterwards inherit all of these.
+ *
+ * \return Nothing if the priorities were set. Otherwise, the error code of the
+ *         first failure. The remaining parameters are still set.
+ */
+oc::result<void> set_sched_policy(SchedPolicy policy)
+{
+    const PolicyParams *params = policy_params(policy);
+    if (!params) {
+        return oc::success();
+    }
+
+    pid_t tid = current_tid();
+    std::error_code ec;
+
+    if (ioprio_set(tid, params->ioprio) < 0 && !ec) {
+        ec = ec_from_errno();
+    }
+
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(tid), params->nice) < 0
+            && !ec) {
+        ec = ec_from_errno();
+    }
+
+    sched_param param = {};
+    if (sched_setscheduler(tid, params->scheduler, &param) < 0 && !ec) {
+        ec = ec_from_errno();
+    }
+
+    move_to_first_cgroup(CPUCTL_MOUNT_POINT, params->cpu_cgroups, tid);
+    move_to_first_cgroup(CPUSET_MOUNT_POINT, params->cpuset_cgroups, tid);
+
+    if (ec) {
+        return ec;
+    }
+
+    return oc::success();
+}
+
+ScopedSchedPolicy::ScopedSchedPolicy(SchedPolicy policy)
+    : _applied(policy != SchedPolicy::Default)
+    , _ioprio(0)
+    , _nice(0)
+    , _scheduler(SCHED_OTHER)
+    , _sched_priority(0)
+{
+    if (!_applied) {
+        return;
+    }
+
+    pid_t tid = current_tid();
+
+    _ioprio = ioprio_get(tid);
+
+    errno = 0;
+    _nice = getpriority(PRIO_PROCESS, static_cast<id_t>(tid));
+    if (_nice == -1 && errno != 0) {
+        _nice = 0;
+    }
+
+    sched_param param = {};
+    _scheduler = sched_getscheduler(tid);
+    if (_scheduler >= 0 && sched_getparam(tid, &param) == 0) {
+        _sched_priority = param.sched_priority;
+    }
+
+    get_cgroups(tid, _cpu_cgroup, _cpuset_cgroup);
+
+    if (auto r = set_sched_policy(policy); !r) {
+        LOGW("Failed to set %s scheduling policy: %s",
+             sched_policy_to_string(policy), r.error().message().c_str());
+    }
+}
+
+ScopedSchedPolicy::~ScopedSchedPolicy()
+{
+    if (!_applied) {
+        return;
+    }
+
+    pid_t tid = current_tid();
+
+    if (_ioprio >= 0) {
+        (void) ioprio_set(tid, _ioprio);
+    }
+
+    (void) setpriority(PRIO_PROCESS, static_cast<id_t>(tid), _nice);
+
+    if (_scheduler >= 0) {
+        sched_param param = {};
+        param.sched_priority = _sched_priority;
+        (void) sched_setscheduler(tid, _scheduler, &param);
+    }
+
+    if (_cpu_cgroup) {
+        (void) move_to_cgroup(CPUCTL_MOUNT_POINT, *_cpu_cgroup, tid);
+    }
+    if (_cpuset_cgroup) {
+        (void) move_to_cgroup(CPUSET_MOUNT_POINT, *_cpuset_cgroup, tid);
+    }
+}
+
+}
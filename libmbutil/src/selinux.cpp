@@ -19,8 +19,15 @@
 
 #include "mbutil/selinux.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 #include <cerrno>
 #include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -33,8 +40,10 @@
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mblog/logging.h"
 #include "mbutil/fts.h"
+#include "mbutil/getdents_p.h"
 
 #define LOG_TAG "mbutil/selinux"
 
@@ -98,9 +107,209 @@ private:
     }
 };
 
+/*!
+ * Relabels a tree on a pool of threads.
+ *
+ * Every directory that is found is queued, so subtrees are relabeled by
+ * whichever thread is free. Directories are opened anyway to be listed, so
+ * their labels are read and written through the open file descriptor. Other
+ * paths use lgetxattr()/lsetxattr() because opening device nodes or FIFOs can
+ * have side effects. Labels that already match are not written. Errors are
+ * logged and skipped, and the first one is returned, so as much as possible is
+ * relabeled. Like the FtsWrapper-based code, mount points are relabeled, but
+ * not entered.
+ */
+class ParallelRelabeler
+{
+public:
+    ParallelRelabeler(const std::string &root, const struct stat &sb,
+                      const std::string &context,
+                      const SELinuxRelabelOptions &options)
+        : _context(context)
+        , _options(options)
+        , _root_dev(sb.st_dev)
+        , _changed(0)
+        , _skipped(0)
+        , _active(0)
+    {
+        _queue.push_back(root);
+    }
+
+    FileOpResult<SELinuxRelabelStats> run()
+    {
+        run_on_threads(ThreadPool::global(), _options.threads,
+                       [this] { worker(); });
+
+        if (_error.ec) {
+            return std::move(_error);
+        }
+
+        return SELinuxRelabelStats{_changed, _skipped};
+    }
+
+private:
+    const std::string &_context;
+    const SELinuxRelabelOptions &_options;
+    dev_t _root_dev;
+
+    std::atomic<uint64_t> _changed;
+    std::atomic<uint64_t> _skipped;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::string> _queue;
+    unsigned int _active;
+    FileOpErrorInfo _error;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] {
+                return !_queue.empty() || _active == 0;
+            });
+
+            if (_queue.empty()) {
+                break;
+            }
+
+            // Depth-first keeps the number of queued directories small
+            auto path = std::move(_queue.back());
+            _queue.pop_back();
+            ++_active;
+
+            lock.unlock();
+            relabel_directory(path);
+            lock.lock();
+
+            --_active;
+            _cv.notify_all();
+        }
+    }
+
+    void relabel_directory(const std::string &path)
+    {
+        int dfd = open(path.c_str(),
+                       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dfd < 0) {
+            set_error(path, ec_from_errno());
+            return;
+        }
+
+        auto close_fd = finally([&] {
+            close(dfd);
+        });
+
+        relabel_fd(path, dfd);
+
+        auto ret = read_dir_entries(dfd, [&](const char *name,
+                                             unsigned char type) {
+            relabel_entry(path, dfd, name, type);
+            return true;
+        });
+        if (!ret) {
+            set_error(path, ret.error());
+        }
+    }
+
+    void relabel_entry(const std::string &parent, int dfd, const char *name,
+                       unsigned char type)
+    {
+        std::string path(parent);
+        if (path.empty() || path.back() != '/') {
+            path += '/';
+        }
+        path += name;
+
+        if (type == DT_UNKNOWN || type == DT_DIR) {
+            struct stat sb;
+
+            if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                set_error(std::move(path), ec_from_errno());
+                return;
+            }
+
+            if (S_ISDIR(sb.st_mode)) {
+                if (sb.st_dev == _root_dev) {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _queue.push_back(std::move(path));
+                    _cv.notify_one();
+                } else {
+                    // Label the mount point, but do not enter it
+                    relabel_path(path, false);
+                }
+                return;
+            }
+
+            type = S_ISLNK(sb.st_mode) ? DT_LNK : DT_REG;
+        }
+
+        relabel_path(path, type == DT_LNK && _options.follow_symlinks);
+    }
+
+    bool context_matches(const char *value, ssize_t size)
+    {
+        if (size < 0) {
+            return false;
+        }
+
+        auto n = static_cast<size_t>(size);
+        if (n > 0 && value[n - 1] == '\0') {
+            --n;
+        }
+
+        return n == _context.size() && memcmp(value, _context.data(), n) == 0;
+    }
+
+    void relabel_fd(const std::string &path, int fd)
+    {
+        char value[256];
+        ssize_t size = fgetxattr(fd, SELINUX_XATTR, value, sizeof(value));
+
+        if (context_matches(value, size)) {
+            ++_skipped;
+        } else if (fsetxattr(fd, SELINUX_XATTR, _context.c_str(),
+                             _context.size() + 1, 0) < 0) {
+            set_error(path, ec_from_errno());
+        } else {
+            ++_changed;
+        }
+    }
+
+    void relabel_path(const std::string &path, bool follow)
+    {
+        auto get = follow ? getxattr : lgetxattr;
+        auto set = follow ? setxattr : lsetxattr;
+
+        char value[256];
+        ssize_t size = get(path.c_str(), SELINUX_XATTR, value, sizeof(value));
+
+        if (context_matches(value, size)) {
+            ++_skipped;
+        } else if (set(path.c_str(), SELINUX_XATTR, _context.c_str(),
+                       _context.size() + 1, 0) < 0) {
+            set_error(path, ec_from_errno());
+        } else {
+            ++_changed;
+        }
+    }
+
+    void set_error(std::string path, std::error_code ec)
+    {
+        LOGW("%s: Failed to set context: %s", path.c_str(),
+             ec.message().c_str());
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_error.ec) {
+            _error = {std::move(path), ec};
+        }
+    }
+};
+
 bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 {
-    struct policy_file pf;
     struct stat sb;
     void *map;
     int fd;
@@ -129,8 +338,9 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
         return false;
     }
 
-    map = mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ, MAP_PRIVATE,
-               fd, 0);
+    // Prefault the whole policy since policydb_read() reads all of it
+    map = mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ,
+               MAP_PRIVATE | MAP_POPULATE, fd, 0);
     if (map == MAP_FAILED) {
         LOGE("%s: Failed to mmap sepolicy: %s", path.c_str(), strerror(errno));
         return false;
@@ -140,10 +350,20 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
         munmap(map, static_cast<size_t>(sb.st_size));
     });
 
+    return selinux_read_policy_image(map, static_cast<size_t>(sb.st_size), pdb);
+}
+
+/*!
+ * \brief Read a binary policy image that is already in memory
+ */
+bool selinux_read_policy_image(const void *data, size_t len, policydb_t *pdb)
+{
+    struct policy_file pf;
+
     policy_file_init(&pf);
     pf.type = PF_USE_MEMORY;
-    pf.data = static_cast<char *>(map);
-    pf.len = static_cast<size_t>(sb.st_size);
+    pf.data = static_cast<char *>(const_cast<void *>(data));
+    pf.len = len;
 
     auto destroy_pf = finally([&] {
         sepol_handle_destroy(pf.handle);
@@ -160,7 +380,6 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
     void *data;
     size_t len;
     sepol_handle_t *handle;
-    int fd;
 
     // Don't print warnings to stderr
     handle = sepol_handle_create();
@@ -179,6 +398,56 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
         free(data);
     });
 
+    return selinux_write_policy_image(path, data, len);
+}
+
+/*!
+ * \brief Serialize a policy to a binary image in memory
+ *
+ * This allows a patched policy to be kept around (eg. for caching or for
+ * loading into multiple targets) without going through a file.
+ */
+bool selinux_policy_to_image(policydb_t *pdb,
+                             std::vector<unsigned char> &image)
+{
+    void *data;
+    size_t len;
+    sepol_handle_t *handle;
+
+    // Don't print warnings to stderr
+    handle = sepol_handle_create();
+    sepol_msg_set_callback(handle, nullptr, nullptr);
+
+    auto destroy_handle = finally([&] {
+        sepol_handle_destroy(handle);
+    });
+
+    if (policydb_to_image(handle, pdb, &data, &len) < 0) {
+        LOGE("Failed to write policydb to memory");
+        return false;
+    }
+
+    auto free_data = finally([&] {
+        free(data);
+    });
+
+    auto begin = static_cast<unsigned char *>(data);
+    image.assign(begin, begin + len);
+
+    return true;
+}
+
+/*!
+ * \brief Write a binary policy image
+ *
+ * The image is written with a single write() call since that is required for
+ * loading a policy via selinuxfs.
+ */
+bool selinux_write_policy_image(const std::string &path,
+                                const void *data, size_t len)
+{
+    int fd;
+
     for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
         fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
         if (fd < 0) {
@@ -342,6 +611,52 @@ oc::result<void> selinux_lset_context_recursive(const std::string &path,
     return rsc.result();
 }
 
+/*!
+ * \brief Recursively set the SELinux context of a path on multiple threads
+ *
+ * Paths that already have the context are skipped instead of being written
+ * to. Symlinks are never traversed. Other filesystems mounted inside the tree
+ * have their mount point relabeled, but are not entered.
+ *
+ * \param path Path to relabel
+ * \param context SELinux context to set
+ * \param options Options controlling how the tree is relabeled
+ *
+ * \return Number of changed and skipped paths if everything was relabeled.
+ *         Otherwise, the first error that was encountered.
+ */
+FileOpResult<SELinuxRelabelStats>
+selinux_relabel_recursive(const std::string &path, const std::string &context,
+                          const SELinuxRelabelOptions &options)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        bool follow = S_ISLNK(sb.st_mode) && options.follow_symlinks;
+        auto current = follow
+                ? selinux_get_context(path)
+                : selinux_lget_context(path);
+
+        if (current && current.value() == context) {
+            return SELinuxRelabelStats{0, 1};
+        }
+
+        auto ret = follow
+                ? selinux_set_context(path, context)
+                : selinux_lset_context(path, context);
+        if (!ret) {
+            return FileOpErrorInfo{path, ret.error()};
+        }
+
+        return SELinuxRelabelStats{1, 0};
+    }
+
+    return ParallelRelabeler(path, sb, context, options).run();
+}
+
 oc::result<bool> selinux_get_enforcing()
 {
     int fd = open(SELINUX_ENFORCE_FILE, O_RDONLY);
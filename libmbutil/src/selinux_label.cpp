@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/selinux_label.h"
+
+#include <memory>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbutil/fts.h"
+#include "mbutil/selinux.h"
+
+#define LOG_TAG "mbutil/selinux_label"
+
+// Context that means that a path should not be relabeled
+static constexpr char NO_CONTEXT[] = "<<none>>";
+
+namespace mb::util
+{
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+static bool is_meta_char(char c)
+{
+    return strchr(".^$?*+|[({\\", c) != nullptr;
+}
+
+static bool has_meta_chars(const std::string &regex)
+{
+    for (char c : regex) {
+        if (is_meta_char(c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_top_level_alternation(const std::string &regex)
+{
+    int depth = 0;
+    bool in_class = false;
+
+    for (size_t i = 0; i < regex.size(); ++i) {
+        char c = regex[i];
+
+        if (c == '\\') {
+            ++i;
+        } else if (in_class) {
+            in_class = c != ']';
+        } else if (c == '[') {
+            in_class = true;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        } else if (c == '|' && depth == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Literal string that every path matching the regex must start with
+static std::string literal_prefix(const std::string &regex)
+{
+    if (has_top_level_alternation(regex)) {
+        return {};
+    }
+
+    size_t n = 0;
+    while (n < regex.size() && !is_meta_char(regex[n])) {
+        ++n;
+    }
+
+    // The last literal character is optional if it is quantified
+    if (n > 0 && n < regex.size()
+            && (regex[n] == '?' || regex[n] == '*' || regex[n] == '{')) {
+        --n;
+    }
+
+    return regex.substr(0, n);
+}
+
+// First path component (eg. "/system" for "/system/bin/sh") if the string
+// contains a second slash
+static std::string_view path_stem(std::string_view path)
+{
+    if (path.empty() || path[0] != '/') {
+        return {};
+    }
+
+    auto pos = path.find('/', 1);
+    if (pos == std::string_view::npos) {
+        return {};
+    }
+
+    return path.substr(0, pos);
+}
+
+static bool mode_matches(mode_t spec_mode, mode_t mode)
+{
+    return spec_mode == 0 || mode == 0 || spec_mode == mode;
+}
+
+static bool parse_file_type(const char *type, mode_t &mode)
+{
+    if (type[0] != '-' || type[1] == '\0' || type[2] != '\0') {
+        return false;
+    }
+
+    switch (type[1]) {
+    case '-': mode = S_IFREG;  return true;
+    case 'd': mode = S_IFDIR;  return true;
+    case 'c': mode = S_IFCHR;  return true;
+    case 'b': mode = S_IFBLK;  return true;
+    case 's': mode = S_IFSOCK; return true;
+    case 'l': mode = S_IFLNK;  return true;
+    case 'p': mode = S_IFIFO;  return true;
+    default:                   return false;
+    }
+}
+
+FileContexts::FileContexts() = default;
+
+FileContexts::~FileContexts() = default;
+
+/*!
+ * \brief Load specs from a text file_contexts file
+ *
+ * Each line contains a regex, an optional file type (eg. `-d`), and a
+ * context. Specs are appended to the ones already loaded, so multiple files
+ * (eg. `plat_file_contexts` and `vendor_file_contexts`) can be combined.
+ *
+ * \param path Path to file_contexts file
+ *
+ * \return Nothing if all specs are successfully loaded. Otherwise, the error
+ *         code.
+ */
+oc::result<void> FileContexts::load_file(const std::string &path)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
+    if (!fp) {
+        return ec_from_errno();
+    }
+
+    char *line = nullptr;
+    size_t len = 0; // allocated memory size
+    ssize_t bytes_read; // number of bytes read
+    constexpr char delim[] = " \t\r\n";
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
+    while ((bytes_read = getline(&line, &len, fp.get())) != -1) {
+        // Strip leading whitespace
+        char *temp = line;
+        while (isspace(*temp)) {
+            ++temp;
+        }
+
+        // Skip empty lines and comments
+        if (*temp == '\0' || *temp == '#') {
+            continue;
+        }
+
+        char *save_ptr;
+        char *regex = strtok_r(temp, delim, &save_ptr);
+        char *type = strtok_r(nullptr, delim, &save_ptr);
+        char *context = strtok_r(nullptr, delim, &save_ptr);
+        mode_t mode = 0;
+
+        if (!type) {
+            LOGW("%s: Spec has no context: %s", path.c_str(), regex);
+            return std::errc::invalid_argument;
+        } else if (!context) {
+            context = type;
+        } else if (!parse_file_type(type, mode)) {
+            LOGW("%s: Invalid file type: %s", path.c_str(), type);
+            return std::errc::invalid_argument;
+        }
+
+        OUTCOME_TRYV(add_spec(regex, mode, context));
+    }
+
+    if (ferror(fp.get())) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add a spec
+ *
+ * If multiple specs match a path, the one added last wins. Specs without regex
+ * metacharacters take precedence over specs with metacharacters.
+ *
+ * \param regex Regex that must match the whole path
+ * \param mode File type (`S_IFMT` bits) the spec applies to or 0 for all types
+ * \param context SELinux context
+ *
+ * \return Nothing if the spec is added. Otherwise, std::errc::invalid_argument
+ *         if the regex is invalid.
+ */
+oc::result<void> FileContexts::add_spec(const std::string &regex, mode_t mode,
+                                        std::string context)
+{
+    size_t index = _specs.size();
+    Spec spec;
+
+    spec.mode = mode & S_IFMT;
+    spec.context = std::move(context);
+
+    if (!has_meta_chars(regex)) {
+        _specs.push_back(std::move(spec));
+        _literal_specs[regex].push_back(index);
+        return oc::success();
+    }
+
+    if (auto it = _regexes.find(regex); it != _regexes.end()) {
+        spec.regex = it->second;
+    } else {
+        try {
+            spec.regex = std::make_shared<const std::regex>(
+                    regex, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error &e) {
+            LOGW("Failed to compile regex: %s: %s", regex.c_str(), e.what());
+            return std::errc::invalid_argument;
+        }
+        _regexes.emplace(regex, spec.regex);
+    }
+
+    spec.prefix = literal_prefix(regex);
+    std::string stem(path_stem(spec.prefix));
+
+    _specs.push_back(std::move(spec));
+
+    if (stem.empty()) {
+        _stemless_specs.push_back(index);
+    } else {
+        _stem_specs[std::move(stem)].push_back(index);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Number of specs that have been added
+ */
+size_t FileContexts::size() const
+{
+    return _specs.size();
+}
+
+/*!
+ * \brief Find the context for a path
+ *
+ * \param path Absolute path
+ * \param mode File type (`S_IFMT` bits) of the path or 0 to match all specs
+ *
+ * \return Pointer to the context, which remains valid until the FileContexts
+ *         instance is modified or destroyed. nullptr if no spec matches or if
+ *         the path should not be labeled (`<<none>>`).
+ */
+const std::string * FileContexts::lookup(std::string_view path,
+                                         mode_t mode) const
+{
+    mode &= S_IFMT;
+
+    const Spec *spec = find_literal(std::string(path), mode);
+    if (!spec) {
+        spec = find_regex(path, mode, path_stem(path));
+    }
+
+    if (!spec || spec->context == NO_CONTEXT) {
+        return nullptr;
+    }
+
+    return &spec->context;
+}
+
+const FileContexts::Spec * FileContexts::find_literal(const std::string &key,
+                                                      mode_t mode) const
+{
+    auto it = _literal_specs.find(key);
+    if (it == _literal_specs.end()) {
+        return nullptr;
+    }
+
+    for (auto i = it->second.rbegin(); i != it->second.rend(); ++i) {
+        if (mode_matches(_specs[*i].mode, mode)) {
+            return &_specs[*i];
+        }
+    }
+
+    return nullptr;
+}
+
+const FileContexts::Spec * FileContexts::find_regex(std::string_view path,
+                                                    mode_t mode,
+                                                    std::string_view stem) const
+{
+    static const std::vector<size_t> empty;
+    const std::vector<size_t> *stem_specs = &empty;
+
+    if (!stem.empty()) {
+        if (auto it = _stem_specs.find(std::string(stem));
+                it != _stem_specs.end()) {
+            stem_specs = &it->second;
+        }
+    }
+
+    // Walk both candidate lists from the most recently added spec
+    auto a = stem_specs->rbegin();
+    auto b = _stemless_specs.rbegin();
+
+    while (a != stem_specs->rend() || b != _stemless_specs.rend()) {
+        size_t index;
+        if (b == _stemless_specs.rend()
+                || (a != stem_specs->rend() && *a > *b)) {
+            index = *a++;
+        } else {
+            index = *b++;
+        }
+
+        auto const &spec = _specs[index];
+
+        if (!mode_matches(spec.mode, mode)
+                || path.size() < spec.prefix.size()
+                || path.compare(0, spec.prefix.size(), spec.prefix) != 0) {
+            continue;
+        }
+
+        if (std::regex_match(path.begin(), path.end(), *spec.regex)) {
+            return &spec;
+        }
+    }
+
+    return nullptr;
+}
+
+class RecursiveRestoreContext : public FtsWrapper
+{
+public:
+    RecursiveRestoreContext(std::string path, const FileContexts &contexts)
+        : FtsWrapper(path, FtsFlag::GroupSpecialFiles)
+        , _contexts(contexts)
+        , _result(oc::success())
+    {
+    }
+
+    Actions on_reached_directory_post() override
+    {
+        return restore_context() ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_file() override
+    {
+        return restore_context() ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return restore_context() ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_special_file() override
+    {
+        return restore_context() ? Action::Ok : Action::Fail;
+    }
+
+    oc::result<void> result()
+    {
+        return _result;
+    }
+
+private:
+    const FileContexts &_contexts;
+    oc::result<void> _result;
+
+    oc::result<void> restore_context()
+    {
+        auto context = _contexts.lookup(_curr->fts_path,
+                                        _curr->fts_statp->st_mode);
+        if (!context) {
+            return _result = oc::success();
+        }
+
+        if (auto current = selinux_lget_context(_curr->fts_accpath);
+                current && current.value() == *context) {
+            return _result = oc::success();
+        }
+
+        return _result = selinux_lset_context(_curr->fts_accpath, *context);
+    }
+};
+
+/*!
+ * \brief Recursively relabel a path according to file_contexts specs
+ *
+ * This is the equivalent of `restorecon -R`. Symlinks are not followed and
+ * paths without a matching spec are left alone. Only paths whose context
+ * differs from the spec are written to.
+ *
+ * \param path Absolute path to relabel
+ * \param contexts Loaded file_contexts specs
+ *
+ * \return Nothing if all paths are successfully relabeled. Otherwise, the
+ *         error code.
+ */
+oc::result<void> selinux_restore_context_recursive(const std::string &path,
+                                                   const FileContexts &contexts)
+{
+    RecursiveRestoreContext rrc(path, contexts);
+    if (!rrc.run()) {
+        auto ret = rrc.result();
+        if (ret) {
+            return ec_from_errno();
+        } else {
+            return ret.as_failure();
+        }
+    }
+
+    return rrc.result();
+}
+
+}
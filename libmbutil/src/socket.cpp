@@ -19,12 +19,15 @@
 
 #include "mbutil/socket.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -32,6 +35,67 @@
 namespace mb::util
 {
 
+// Size of the SocketReader and SocketWriter buffers
+constexpr size_t SOCKET_BUFFER_SIZE = 16 * 1024;
+
+/*!
+ * \brief Write all of the data described by \a iov, retrying partial writes
+ *
+ * \note \a iov is modified
+ */
+static oc::result<void> socket_writev_all(int fd, struct iovec *iov,
+                                          int iovcnt)
+{
+    while (iovcnt > 0) {
+        auto n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return ec_from_errno();
+            }
+        } else if (n == 0) {
+            return std::errc::io_error;
+        }
+
+        auto written = static_cast<size_t>(n);
+
+        while (iovcnt > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write a 32-bit length followed by the data with a single writev()
+ */
+static oc::result<void> socket_write_sized(int fd, const void *data,
+                                           size_t len)
+{
+    if (len > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    auto header = static_cast<int32_t>(len);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = len;
+
+    return socket_writev_all(fd, iov, 2);
+}
+
 oc::result<size_t> socket_read(int fd, void *buf, size_t size)
 {
     // read()'s behavior is undefined when size is greater than SSIZE_MAX
@@ -106,21 +170,29 @@ oc::result<std::vector<unsigned char>> socket_read_bytes(int fd)
     return std::move(buf);
 }
 
-oc::result<void> socket_write_bytes(int fd, const void *data, size_t len)
+// Like socket_read_bytes(), but reuses the capacity of an existing buffer
+oc::result<void> socket_read_bytes_into(int fd, std::vector<unsigned char> &buf)
 {
-    if (len > INT32_MAX) {
-        return std::errc::invalid_argument;
+    OUTCOME_TRY(len, socket_read_int32(fd));
+    if (len < 0) {
+        return std::errc::bad_message;
     }
 
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(len)));
-    OUTCOME_TRY(n, socket_write(fd, data, len));
-    if (n != len) {
+    buf.resize(static_cast<size_t>(len));
+
+    OUTCOME_TRY(n, socket_read(fd, buf.data(), static_cast<size_t>(len)));
+    if (n != static_cast<size_t>(len)) {
         return std::errc::io_error;
     }
 
     return oc::success();
 }
 
+oc::result<void> socket_write_bytes(int fd, const void *data, size_t len)
+{
+    return socket_write_sized(fd, data, len);
+}
+
 template<typename T>
 static inline oc::result<T> read_copyable_type(int fd)
 {
@@ -220,21 +292,29 @@ oc::result<std::string> socket_read_string(int fd)
     return std::move(buf);
 }
 
-oc::result<void> socket_write_string(int fd, const std::string &str)
+// Like socket_read_string(), but reuses the capacity of an existing string
+oc::result<void> socket_read_string_into(int fd, std::string &str)
 {
-    if (str.size() > INT32_MAX) {
-        return std::errc::invalid_argument;
+    OUTCOME_TRY(len, socket_read_int32(fd));
+    if (len < 0) {
+        return std::errc::bad_message;
     }
 
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(str.size())));
-    OUTCOME_TRY(n, socket_write(fd, str.data(), str.size()));
-    if (n != str.size()) {
+    str.resize(static_cast<size_t>(len));
+
+    OUTCOME_TRY(n, socket_read(fd, str.data(), static_cast<size_t>(len)));
+    if (n != static_cast<size_t>(len)) {
         return std::errc::io_error;
     }
 
     return oc::success();
 }
 
+oc::result<void> socket_write_string(int fd, const std::string &str)
+{
+    return socket_write_sized(fd, str.data(), str.size());
+}
+
 oc::result<std::vector<std::string>> socket_read_string_array(int fd)
 {
     OUTCOME_TRY(len, socket_read_int32(fd));
@@ -259,13 +339,11 @@ oc::result<void> socket_write_string_array(int fd, const std::vector<std::string
         return std::errc::invalid_argument;
     }
 
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(list.size())));
+    SocketWriter writer(fd);
 
-    for (const std::string &str : list) {
-        OUTCOME_TRYV(socket_write_string(fd, str));
-    }
+    OUTCOME_TRYV(writer.write_string_array(list));
 
-    return oc::success();
+    return writer.flush();
 }
 
 oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds)
@@ -352,4 +430,292 @@ oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds)
     return oc::success();
 }
 
+SocketReader::SocketReader(int fd)
+    : _fd(fd)
+    , _begin(0)
+    , _end(0)
+{
+}
+
+int SocketReader::fd() const
+{
+    return _fd;
+}
+
+/*!
+ * \brief Number of bytes that were received, but not consumed yet
+ */
+size_t SocketReader::buffered() const
+{
+    return _end - _begin;
+}
+
+/*!
+ * \brief Refill the (empty) buffer with whatever data is available
+ */
+oc::result<void> SocketReader::fill()
+{
+    if (_buf.empty()) {
+        _buf.resize(SOCKET_BUFFER_SIZE);
+    }
+
+    _begin = 0;
+    _end = 0;
+
+    while (true) {
+        auto n = ::read(_fd, _buf.data(), _buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return ec_from_errno();
+            }
+        } else if (n == 0) {
+            // Connection closed in the middle of a message
+            return std::errc::io_error;
+        }
+
+        _end = static_cast<size_t>(n);
+        return oc::success();
+    }
+}
+
+/*!
+ * \brief Read exactly \a size bytes
+ */
+oc::result<void> SocketReader::read(void *buf, size_t size)
+{
+    auto out = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        if (_begin == _end) {
+            // Large reads go straight into the output buffer
+            if (size >= SOCKET_BUFFER_SIZE) {
+                OUTCOME_TRY(n, socket_read(_fd, out, size));
+                if (n != size) {
+                    return std::errc::io_error;
+                }
+                return oc::success();
+            }
+
+            OUTCOME_TRYV(fill());
+        }
+
+        size_t n = std::min(size, _end - _begin);
+        memcpy(out, _buf.data() + _begin, n);
+
+        _begin += n;
+        out += n;
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+template<typename T>
+oc::result<T> SocketReader::read_value()
+{
+    T value;
+    OUTCOME_TRYV(read(&value, sizeof(T)));
+    return oc::success(value);
+}
+
+oc::result<uint16_t> SocketReader::read_uint16()
+{
+    return read_value<uint16_t>();
+}
+
+oc::result<uint32_t> SocketReader::read_uint32()
+{
+    return read_value<uint32_t>();
+}
+
+oc::result<uint64_t> SocketReader::read_uint64()
+{
+    return read_value<uint64_t>();
+}
+
+oc::result<int16_t> SocketReader::read_int16()
+{
+    return read_value<int16_t>();
+}
+
+oc::result<int32_t> SocketReader::read_int32()
+{
+    return read_value<int32_t>();
+}
+
+oc::result<int64_t> SocketReader::read_int64()
+{
+    return read_value<int64_t>();
+}
+
+oc::result<void> SocketReader::read_bytes_into(std::vector<unsigned char> &buf)
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    buf.resize(static_cast<size_t>(len));
+
+    return read(buf.data(), buf.size());
+}
+
+oc::result<void> SocketReader::read_string_into(std::string &str)
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    str.resize(static_cast<size_t>(len));
+
+    return read(str.data(), str.size());
+}
+
+oc::result<void>
+SocketReader::read_string_array_into(std::vector<std::string> &list)
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    // Existing strings are reused
+    list.resize(static_cast<size_t>(len));
+
+    for (auto &str : list) {
+        OUTCOME_TRYV(read_string_into(str));
+    }
+
+    return oc::success();
+}
+
+SocketWriter::SocketWriter(int fd)
+    : _fd(fd)
+{
+}
+
+int SocketWriter::fd() const
+{
+    return _fd;
+}
+
+/*!
+ * \brief Number of bytes that have not been sent yet
+ */
+size_t SocketWriter::buffered() const
+{
+    return _buf.size();
+}
+
+oc::result<void> SocketWriter::write(const void *buf, size_t size)
+{
+    auto data = static_cast<const unsigned char *>(buf);
+
+    // The buffer never holds more than SOCKET_BUFFER_SIZE bytes
+    if (size <= SOCKET_BUFFER_SIZE - _buf.size()) {
+        if (_buf.capacity() == 0) {
+            _buf.reserve(SOCKET_BUFFER_SIZE);
+        }
+        _buf.insert(_buf.end(), data, data + size);
+        return oc::success();
+    }
+
+    // Send the buffered data and the payload together without copying
+    struct iovec iov[2];
+    iov[0].iov_base = _buf.data();
+    iov[0].iov_len = _buf.size();
+    iov[1].iov_base = const_cast<unsigned char *>(data);
+    iov[1].iov_len = size;
+
+    OUTCOME_TRYV(socket_writev_all(_fd, iov, 2));
+
+    _buf.clear();
+
+    return oc::success();
+}
+
+oc::result<void> SocketWriter::write_uint16(uint16_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_uint32(uint32_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_uint64(uint64_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_int16(int16_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_int32(int32_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_int64(int64_t n)
+{
+    return write(&n, sizeof(n));
+}
+
+oc::result<void> SocketWriter::write_bytes(const void *data, size_t len)
+{
+    if (len > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRYV(write_int32(static_cast<int32_t>(len)));
+    return write(data, len);
+}
+
+oc::result<void> SocketWriter::write_string(const std::string &str)
+{
+    return write_bytes(str.data(), str.size());
+}
+
+oc::result<void>
+SocketWriter::write_string_array(const std::vector<std::string> &list)
+{
+    if (list.size() > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRYV(write_int32(static_cast<int32_t>(list.size())));
+
+    for (auto const &str : list) {
+        OUTCOME_TRYV(write_string(str));
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Send all buffered data
+ */
+oc::result<void> SocketWriter::flush()
+{
+    if (_buf.empty()) {
+        return oc::success();
+    }
+
+    struct iovec iov;
+    iov.iov_base = _buf.data();
+    iov.iov_len = _buf.size();
+
+    OUTCOME_TRYV(socket_writev_all(_fd, &iov, 1));
+
+    _buf.clear();
+
+    return oc::success();
+}
+
 }
@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/walker.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/string.h"
+
+#include "mbutil/getdents_p.h"
+
+
+namespace mb::util
+{
+
+struct WalkNode
+{
+    std::shared_ptr<WalkNode> parent;
+    std::string path;
+    std::string name;
+    size_t level = 0;
+    int fd = -1;
+    struct stat sb;
+    // Whether the directory was entered and needs its post hook called
+    bool visit_post = false;
+    // Work left before the post hook can be called: reading the directory
+    // plus finishing each of its subdirectories
+    std::atomic_size_t pending{1};
+
+    ~WalkNode()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+struct WalkQueue
+{
+    std::mutex mutex;
+    std::deque<std::shared_ptr<WalkNode>> tasks;
+};
+
+static WalkEntry directory_entry(const WalkNode &node)
+{
+    WalkEntry entry;
+    entry.path = node.path;
+    entry.dir_fd = node.parent ? node.parent->fd : AT_FDCWD;
+    entry.name = node.parent ? node.name.c_str() : node.path.c_str();
+    entry.fd = node.fd;
+    entry.level = node.level;
+    entry.type = DT_DIR;
+    entry.has_stat = true;
+    entry.sb = node.sb;
+    return entry;
+}
+
+ParallelWalker::ParallelWalker(std::string path, WalkFlags flags,
+                               unsigned int threads)
+    : _path(std::move(path))
+    , _flags(flags)
+    , _threads(std::max(threads, 1u))
+    , _ran(false)
+    , _root_dev(0)
+    , _pending(0)
+    , _queued(0)
+    , _sleeping(0)
+    , _stop(false)
+    , _failed(false)
+{
+}
+
+ParallelWalker::~ParallelWalker() = default;
+
+bool ParallelWalker::run()
+{
+    if (_ran) {
+        _error_msg = "Already ran";
+        return false;
+    }
+    _ran = true;
+
+    // Pre-execute hook
+    if (!on_pre_execute()) {
+        return false;
+    }
+
+    struct stat sb;
+
+    if (lstat(_path.c_str(), &sb) < 0) {
+        set_error(format("%s: Failed to stat: %s",
+                         _path.c_str(), strerror(errno)));
+        _failed = true;
+    } else if (S_ISDIR(sb.st_mode)) {
+        _root_dev = sb.st_dev;
+
+        for (unsigned int i = 0; i < _threads; ++i) {
+            _queues.push_back(std::make_unique<WalkQueue>());
+        }
+
+        auto root = std::make_shared<WalkNode>();
+        root->path = _path;
+        push_task(0, std::move(root));
+
+        std::vector<std::thread> threads;
+
+        for (unsigned int i = 1; i < _threads; ++i) {
+            threads.emplace_back(&ParallelWalker::worker, this, i);
+        }
+
+        worker(0);
+
+        for (auto &t : threads) {
+            t.join();
+        }
+    } else {
+        WalkEntry entry;
+        entry.path = _path;
+        entry.dir_fd = AT_FDCWD;
+        entry.name = _path.c_str();
+        entry.fd = -1;
+        entry.level = 0;
+        entry.type = static_cast<unsigned char>(IFTODT(sb.st_mode));
+        entry.has_stat = true;
+        entry.sb = sb;
+
+        handle_actions(call_hooks(entry, false));
+    }
+
+    bool ret = !_failed;
+
+    if (!on_post_execute(ret)) {
+        return false;
+    }
+
+    return ret;
+}
+
+std::string ParallelWalker::error()
+{
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    return _error_msg;
+}
+
+void ParallelWalker::set_error(std::string msg)
+{
+    std::lock_guard<std::mutex> lock(_error_mutex);
+
+    if (_error_msg.empty()) {
+        _error_msg = std::move(msg);
+    }
+}
+
+void ParallelWalker::worker(size_t id)
+{
+    while (auto node = next_task(id)) {
+        if (!_stop) {
+            read_directory(id, node);
+        }
+        finish_directory(std::move(node));
+
+        if (--_pending == 0) {
+            std::lock_guard<std::mutex> lock(_idle_mutex);
+            _idle_cv.notify_all();
+        }
+    }
+}
+
+std::shared_ptr<WalkNode> ParallelWalker::next_task(size_t id)
+{
+    while (true) {
+        // Take the newest directory from our own queue to stay depth-first
+        // and steal the oldest (and likely largest) subtree from others
+        for (size_t i = 0; i < _queues.size(); ++i) {
+            auto &queue = *_queues[(id + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (!queue.tasks.empty()) {
+                std::shared_ptr<WalkNode> node;
+
+                if (i == 0) {
+                    node = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    node = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+
+                --_queued;
+                return node;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(_idle_mutex);
+
+        ++_sleeping;
+        _idle_cv.wait(lock, [&] {
+            return _queued > 0 || _pending == 0;
+        });
+        --_sleeping;
+
+        if (_pending == 0) {
+            return nullptr;
+        }
+    }
+}
+
+void ParallelWalker::push_task(size_t id, std::shared_ptr<WalkNode> node)
+{
+    ++_pending;
+
+    {
+        auto &queue = *_queues[id];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(node));
+    }
+
+    ++_queued;
+
+    // A sleeping thread increments _sleeping before checking _queued, so it
+    // either sees the new task or is woken up here
+    if (_sleeping > 0) {
+        std::lock_guard<std::mutex> lock(_idle_mutex);
+        _idle_cv.notify_one();
+    }
+}
+
+void ParallelWalker::read_directory(size_t id,
+                                    const std::shared_ptr<WalkNode> &node)
+{
+    int parent_fd = node->parent ? node->parent->fd : AT_FDCWD;
+    const char *name = node->parent ? node->name.c_str() : node->path.c_str();
+
+    node->fd = openat(parent_fd, name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (node->fd < 0) {
+        set_error(format("%s: Failed to open directory: %s",
+                         node->path.c_str(), strerror(errno)));
+        _failed = true;
+        return;
+    }
+
+    if (fstat(node->fd, &node->sb) < 0) {
+        set_error(format("%s: Failed to stat: %s",
+                         node->path.c_str(), strerror(errno)));
+        _failed = true;
+        return;
+    }
+
+    auto actions = call_hooks(directory_entry(*node), false);
+    if (!handle_actions(actions) || (actions & Action::Skip)) {
+        return;
+    }
+
+    node->visit_post = true;
+
+    // Like FTS_XDEV, report mountpoints, but don't enter them
+    if (node->level > 0 && node->sb.st_dev != _root_dev
+            && !(_flags & WalkFlag::CrossMountPointBoundaries)) {
+        return;
+    }
+
+    auto ret = read_dir_entries(node->fd, [&](const char *name,
+                                              unsigned char type) {
+        return !_stop && visit_entry(id, node, name, type);
+    });
+    if (!ret) {
+        set_error(format("%s: Failed to read directory: %s",
+                         node->path.c_str(), ret.error().message().c_str()));
+        _failed = true;
+    }
+}
+
+/*!
+ * \return Whether to continue reading the directory
+ */
+bool ParallelWalker::visit_entry(size_t id,
+                                 const std::shared_ptr<WalkNode> &node,
+                                 const char *name, unsigned char type)
+{
+    WalkEntry entry;
+    entry.path = node->path;
+    if (entry.path.empty() || entry.path.back() != '/') {
+        entry.path += '/';
+    }
+    entry.path += name;
+    entry.dir_fd = node->fd;
+    entry.name = name;
+    entry.fd = -1;
+    entry.level = node->level + 1;
+    entry.type = type;
+    entry.has_stat = false;
+
+    // Directories are stat'ed after they are opened
+    if (type == DT_UNKNOWN
+            || (type != DT_DIR && !(_flags & WalkFlag::NoStat))) {
+        if (fstatat(node->fd, name, &entry.sb, AT_SYMLINK_NOFOLLOW) < 0) {
+            // Entry was removed after the directory was read
+            if (errno == ENOENT) {
+                return true;
+            }
+
+            set_error(format("%s: Failed to stat: %s",
+                             entry.path.c_str(), strerror(errno)));
+            _failed = true;
+            return true;
+        }
+
+        entry.has_stat = true;
+        entry.type = static_cast<unsigned char>(IFTODT(entry.sb.st_mode));
+    }
+
+    if (entry.type == DT_DIR) {
+        auto child = std::make_shared<WalkNode>();
+        child->parent = node;
+        child->path = std::move(entry.path);
+        child->name = name;
+        child->level = entry.level;
+
+        ++node->pending;
+        push_task(id, std::move(child));
+
+        return true;
+    }
+
+    return handle_actions(call_hooks(entry, false));
+}
+
+void ParallelWalker::finish_directory(std::shared_ptr<WalkNode> node)
+{
+    while (node && --node->pending == 0) {
+        if (node->visit_post && !_stop) {
+            handle_actions(call_hooks(directory_entry(*node), true));
+        }
+
+        // The parent's fd stays open until all of its children are done
+        node = std::move(node->parent);
+    }
+}
+
+ParallelWalker::Actions ParallelWalker::call_hooks(const WalkEntry &entry,
+                                                   bool post)
+{
+    // Current path hook
+    Actions first = on_changed_path(entry);
+    if (first & (Action::Next | Action::Skip | Action::Stop)) {
+        return first;
+    }
+
+    // Call other hooks
+    Actions result;
+
+    switch (entry.type) {
+    case DT_DIR:
+        result = post ? on_reached_directory_post(entry)
+                : on_reached_directory_pre(entry);
+        break;
+    case DT_REG:
+        result = on_reached_file(entry);
+        break;
+    case DT_LNK:
+        result = on_reached_symlink(entry);
+        break;
+    case DT_BLK:
+    case DT_CHR:
+    case DT_FIFO:
+    case DT_SOCK:
+        if (_flags & WalkFlag::GroupSpecialFiles) {
+            result = on_reached_special_file(entry);
+        } else {
+            switch (entry.type) {
+            case DT_BLK: result = on_reached_block_device(entry); break;
+            case DT_CHR: result = on_reached_character_device(entry); break;
+            case DT_FIFO: result = on_reached_fifo(entry); break;
+            case DT_SOCK: result = on_reached_socket(entry); break;
+            }
+        }
+        break;
+    default:
+        result = Action::Skip;
+        break;
+    }
+
+    return first | result;
+}
+
+/*!
+ * \return Whether to continue traversal
+ */
+bool ParallelWalker::handle_actions(Actions actions)
+{
+    if (actions & Action::Fail) {
+        set_error("Handler returned failure");
+        _failed = true;
+    }
+    if (actions & Action::Stop) {
+        _stop = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool ParallelWalker::on_pre_execute()
+{
+    return true;
+}
+
+bool ParallelWalker::on_post_execute(bool success)
+{
+    (void) success;
+    return true;
+}
+
+ParallelWalker::Actions ParallelWalker::on_changed_path(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_directory_pre(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_directory_post(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions ParallelWalker::on_reached_file(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_symlink(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_special_file(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_block_device(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_character_device(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions ParallelWalker::on_reached_fifo(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+ParallelWalker::Actions
+ParallelWalker::on_reached_socket(const WalkEntry &entry)
+{
+    (void) entry;
+    return Action::Ok;
+}
+
+}
@@ -0,0 +1,677 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/zip.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#define LOG_TAG "mbutil/zip"
+
+namespace mb::util
+{
+
+// Extraction is mostly bound by inflating, so a few threads are enough
+static constexpr unsigned int MAX_EXTRACT_THREADS = 4;
+
+static constexpr size_t EXTRACT_BUFFER_SIZE = 256 * 1024;
+
+static constexpr uint32_t SIG_LOCAL_HEADER = 0x04034b50;
+static constexpr uint32_t SIG_CENTRAL_HEADER = 0x02014b50;
+static constexpr uint32_t SIG_EOCD = 0x06054b50;
+static constexpr uint32_t SIG_ZIP64_EOCD = 0x06064b50;
+static constexpr uint32_t SIG_ZIP64_EOCD_LOCATOR = 0x07064b50;
+
+static constexpr size_t LOCAL_HEADER_SIZE = 30;
+static constexpr size_t CENTRAL_HEADER_SIZE = 46;
+static constexpr size_t EOCD_SIZE = 22;
+static constexpr size_t ZIP64_EOCD_SIZE = 56;
+static constexpr size_t ZIP64_EOCD_LOCATOR_SIZE = 20;
+static constexpr size_t MAX_COMMENT_SIZE = 0xffff;
+
+static constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+
+static constexpr uint16_t FLAG_ENCRYPTED = 1 << 0;
+
+static constexpr uint16_t METHOD_STORED = 0;
+static constexpr uint16_t METHOD_DEFLATED = 8;
+
+static constexpr uint8_t HOST_UNIX = 3;
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | static_cast<uint32_t>(p[1]) << 8
+            | static_cast<uint32_t>(p[2]) << 16
+            | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(read_le32(p))
+            | static_cast<uint64_t>(read_le32(p + 4)) << 32;
+}
+
+static bool pread_full(int fd, void *buf, size_t size, uint64_t offset)
+{
+    auto *ptr = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pread64(fd, ptr, size, static_cast<off64_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t size)
+{
+    auto *ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Replace the 0xffffffff placeholders of a central directory header
+ *        with the values from its zip64 extra field
+ */
+static bool apply_zip64_extra(const unsigned char *extra, size_t size,
+                              ZipEntry &entry, bool need_usize,
+                              bool need_csize, bool need_offset)
+{
+    while (size >= 4) {
+        uint16_t id = read_le16(extra);
+        uint16_t len = read_le16(extra + 2);
+
+        if (len > size - 4) {
+            return false;
+        }
+
+        if (id == ZIP64_EXTRA_ID) {
+            const unsigned char *p = extra + 4;
+            size_t remain = len;
+
+            for (auto [need, value] : {
+                std::pair{need_usize, &entry.uncompressed_size},
+                std::pair{need_csize, &entry.compressed_size},
+                std::pair{need_offset, &entry.local_header_offset},
+            }) {
+                if (!need) {
+                    continue;
+                } else if (remain < 8) {
+                    return false;
+                }
+
+                *value = read_le64(p);
+                p += 8;
+                remain -= 8;
+            }
+
+            return true;
+        }
+
+        extra += 4 + len;
+        size -= 4 + len;
+    }
+
+    return !need_usize && !need_csize && !need_offset;
+}
+
+ZipIndex::ZipIndex() : _loaded(false), _size(0)
+{
+}
+
+/*!
+ * \brief Read the central directory of a zip file
+ *
+ * \param path Path to zip file
+ *
+ * \return Whether the central directory was successfully parsed. On failure,
+ *         the index is left empty.
+ */
+bool ZipIndex::load(const std::string &path)
+{
+    clear();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    uint64_t file_size = static_cast<uint64_t>(sb.st_size);
+    if (file_size < EOCD_SIZE) {
+        LOGE("%s: Too small to be a zip file", path.c_str());
+        return false;
+    }
+
+    // The end of central directory record is followed by a variable length
+    // comment, so search backwards from the end for its signature
+    size_t tail_size = static_cast<size_t>(
+            std::min<uint64_t>(file_size, EOCD_SIZE + MAX_COMMENT_SIZE));
+    uint64_t tail_offset = file_size - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+
+    if (!pread_full(fd, tail.data(), tail.size(), tail_offset)) {
+        LOGE("%s: Failed to read end of file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t eocd_pos = tail_size - EOCD_SIZE;
+    while (true) {
+        if (read_le32(tail.data() + eocd_pos) == SIG_EOCD
+                && eocd_pos + EOCD_SIZE
+                        + read_le16(tail.data() + eocd_pos + 20) <= tail_size) {
+            break;
+        } else if (eocd_pos == 0) {
+            LOGE("%s: End of central directory record not found",
+                 path.c_str());
+            return false;
+        }
+        --eocd_pos;
+    }
+
+    const unsigned char *eocd = tail.data() + eocd_pos;
+    uint64_t disk = read_le16(eocd + 4);
+    uint64_t cd_disk = read_le16(eocd + 6);
+    uint64_t total = read_le16(eocd + 10);
+    uint64_t cd_size = read_le32(eocd + 12);
+    uint64_t cd_offset = read_le32(eocd + 16);
+
+    if (total == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) {
+        uint64_t eocd_offset = tail_offset + eocd_pos;
+        unsigned char locator[ZIP64_EOCD_LOCATOR_SIZE];
+        unsigned char eocd64[ZIP64_EOCD_SIZE];
+
+        if (eocd_offset < ZIP64_EOCD_LOCATOR_SIZE
+                || !pread_full(fd, locator, sizeof(locator),
+                               eocd_offset - ZIP64_EOCD_LOCATOR_SIZE)
+                || read_le32(locator) != SIG_ZIP64_EOCD_LOCATOR) {
+            LOGE("%s: Zip64 end of central directory locator not found",
+                 path.c_str());
+            return false;
+        }
+
+        uint64_t eocd64_offset = read_le64(locator + 8);
+
+        if (!pread_full(fd, eocd64, sizeof(eocd64), eocd64_offset)
+                || read_le32(eocd64) != SIG_ZIP64_EOCD) {
+            LOGE("%s: Zip64 end of central directory record not found",
+                 path.c_str());
+            return false;
+        }
+
+        disk = read_le32(eocd64 + 16);
+        cd_disk = read_le32(eocd64 + 20);
+        total = read_le64(eocd64 + 32);
+        cd_size = read_le64(eocd64 + 40);
+        cd_offset = read_le64(eocd64 + 48);
+    }
+
+    if (disk != 0 || cd_disk != 0) {
+        LOGE("%s: Multi-disk zip files are not supported", path.c_str());
+        return false;
+    }
+
+    if (cd_offset > file_size || cd_size > file_size - cd_offset
+            || total > cd_size / CENTRAL_HEADER_SIZE) {
+        LOGE("%s: Central directory is out of bounds", path.c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> cd(static_cast<size_t>(cd_size));
+
+    if (!pread_full(fd, cd.data(), cd.size(), cd_offset)) {
+        LOGE("%s: Failed to read central directory: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<ZipEntry> entries;
+    entries.reserve(static_cast<size_t>(total));
+
+    size_t pos = 0;
+
+    for (uint64_t i = 0; i < total; ++i) {
+        const unsigned char *h = cd.data() + pos;
+
+        if (cd.size() - pos < CENTRAL_HEADER_SIZE
+                || read_le32(h) != SIG_CENTRAL_HEADER) {
+            LOGE("%s: Invalid central directory header at entry %" PRIu64,
+                 path.c_str(), i);
+            return false;
+        }
+
+        size_t name_len = read_le16(h + 28);
+        size_t extra_len = read_le16(h + 30);
+        size_t comment_len = read_le16(h + 32);
+
+        if (cd.size() - pos - CENTRAL_HEADER_SIZE
+                < name_len + extra_len + comment_len) {
+            LOGE("%s: Truncated central directory header at entry %" PRIu64,
+                 path.c_str(), i);
+            return false;
+        }
+
+        const char *name = reinterpret_cast<const char *>(
+                h + CENTRAL_HEADER_SIZE);
+
+        ZipEntry entry;
+        entry.name.assign(name, name_len);
+        entry.flags = read_le16(h + 8);
+        entry.method = read_le16(h + 10);
+        entry.crc32 = read_le32(h + 16);
+        entry.compressed_size = read_le32(h + 20);
+        entry.uncompressed_size = read_le32(h + 24);
+        entry.local_header_offset = read_le32(h + 42);
+        entry.mode = 0;
+
+        if (h[5] == HOST_UNIX) {
+            entry.mode = read_le32(h + 38) >> 16;
+        }
+
+        if (!apply_zip64_extra(h + CENTRAL_HEADER_SIZE + name_len, extra_len,
+                               entry,
+                               entry.uncompressed_size == 0xffffffff,
+                               entry.compressed_size == 0xffffffff,
+                               entry.local_header_offset == 0xffffffff)) {
+            LOGE("%s: Invalid zip64 extra field for %s",
+                 path.c_str(), entry.name.c_str());
+            return false;
+        }
+
+        entries.push_back(std::move(entry));
+
+        pos += CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        // Like libarchive's sequential reader, the last entry with a given
+        // name wins
+        _lookup[entries[i].name] = i;
+    }
+
+    _path = path;
+    _loaded = true;
+    _size = file_size;
+    _entries = std::move(entries);
+
+    return true;
+}
+
+void ZipIndex::clear()
+{
+    _path.clear();
+    _loaded = false;
+    _size = 0;
+    _entries.clear();
+    _lookup.clear();
+}
+
+bool ZipIndex::loaded() const
+{
+    return _loaded;
+}
+
+const std::string & ZipIndex::path() const
+{
+    return _path;
+}
+
+const std::vector<ZipEntry> & ZipIndex::entries() const
+{
+    return _entries;
+}
+
+const ZipEntry * ZipIndex::find(const std::string &name) const
+{
+    auto it = _lookup.find(name);
+    if (it == _lookup.end()) {
+        return nullptr;
+    }
+    return &_entries[it->second];
+}
+
+/*!
+ * \brief Check whether entries exist in the zip file
+ *
+ * \param files List of entries to check. ExistsInfo::exists is set for each.
+ *
+ * \return False if \p files is empty or the index is not loaded
+ */
+bool ZipIndex::exists(std::vector<ExistsInfo> &files) const
+{
+    if (!_loaded || files.empty()) {
+        return false;
+    }
+
+    for (ExistsInfo &info : files) {
+        info.exists = find(info.path) != nullptr;
+    }
+
+    return true;
+}
+
+bool ZipIndex::extract_entry(int fd, const ZipEntry &entry,
+                             const std::string &target) const
+{
+    if (entry.flags & FLAG_ENCRYPTED) {
+        LOGE("%s: Encrypted entries are not supported", entry.name.c_str());
+        return false;
+    }
+
+    if (entry.method != METHOD_STORED && entry.method != METHOD_DEFLATED) {
+        LOGE("%s: Unsupported compression method: %u",
+             entry.name.c_str(), entry.method);
+        return false;
+    }
+
+    unsigned char header[LOCAL_HEADER_SIZE];
+
+    if (_size < LOCAL_HEADER_SIZE
+            || entry.local_header_offset > _size - LOCAL_HEADER_SIZE
+            || !pread_full(fd, header, sizeof(header),
+                           entry.local_header_offset)
+            || read_le32(header) != SIG_LOCAL_HEADER) {
+        LOGE("%s: Invalid local file header", entry.name.c_str());
+        return false;
+    }
+
+    // Sizes and CRC in the local header may be deferred to a data
+    // descriptor, so only the name and extra field lengths are used
+    uint64_t offset = entry.local_header_offset + LOCAL_HEADER_SIZE
+            + read_le16(header + 26) + read_le16(header + 28);
+
+    if (offset > _size || entry.compressed_size > _size - offset) {
+        LOGE("%s: Entry data is out of bounds", entry.name.c_str());
+        return false;
+    }
+
+    if (auto r = mkdir_parent(target, 0755); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             target.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (!entry.name.empty() && entry.name.back() == '/') {
+        if (auto r = mkdir_recursive(target, 0755); !r) {
+            LOGE("%s: Failed to create directory: %s",
+                 target.c_str(), r.error().message().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to remove old file: %s",
+             target.c_str(), strerror(errno));
+        return false;
+    }
+
+    int out_fd = open(target.c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out_fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             target.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = false;
+
+    auto close_out_fd = finally([&] {
+        if (close(out_fd) < 0 && ok) {
+            LOGE("%s: Failed to close file: %s",
+                 target.c_str(), strerror(errno));
+            ok = false;
+        }
+        if (!ok) {
+            unlink(target.c_str());
+        }
+    });
+
+    std::vector<unsigned char> in_buf(EXTRACT_BUFFER_SIZE);
+    std::vector<unsigned char> out_buf(EXTRACT_BUFFER_SIZE);
+    uint64_t remain = entry.compressed_size;
+    uint64_t written = 0;
+    uLong crc = crc32(0, nullptr, 0);
+
+    auto emit = [&](const unsigned char *data, size_t size) {
+        if (!write_full(out_fd, data, size)) {
+            LOGE("%s: Failed to write data: %s",
+                 target.c_str(), strerror(errno));
+            return false;
+        }
+        crc = crc32(crc, data, static_cast<uInt>(size));
+        written += size;
+        return true;
+    };
+
+    auto read_chunk = [&](size_t &size) {
+        size = static_cast<size_t>(std::min<uint64_t>(remain, in_buf.size()));
+        if (!pread_full(fd, in_buf.data(), size, offset)) {
+            LOGE("%s: Failed to read entry data: %s",
+                 entry.name.c_str(), strerror(errno));
+            return false;
+        }
+        offset += size;
+        remain -= size;
+        return true;
+    };
+
+    if (entry.method == METHOD_STORED) {
+        while (remain > 0) {
+            size_t n;
+            if (!read_chunk(n) || !emit(in_buf.data(), n)) {
+                return false;
+            }
+        }
+    } else {
+        z_stream zs{};
+
+        if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+            LOGE("%s: Failed to initialize inflater", entry.name.c_str());
+            return false;
+        }
+
+        auto end_inflate = finally([&] {
+            inflateEnd(&zs);
+        });
+
+        int ret = Z_OK;
+
+        while (ret != Z_STREAM_END) {
+            if (zs.avail_in == 0) {
+                if (remain == 0) {
+                    LOGE("%s: Truncated compressed data", entry.name.c_str());
+                    return false;
+                }
+
+                size_t n;
+                if (!read_chunk(n)) {
+                    return false;
+                }
+
+                zs.next_in = in_buf.data();
+                zs.avail_in = static_cast<uInt>(n);
+            }
+
+            zs.next_out = out_buf.data();
+            zs.avail_out = static_cast<uInt>(out_buf.size());
+
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                LOGE("%s: Failed to inflate data: %s", entry.name.c_str(),
+                     zs.msg ? zs.msg : "unknown error");
+                return false;
+            }
+
+            if (!emit(out_buf.data(), out_buf.size() - zs.avail_out)) {
+                return false;
+            }
+        }
+    }
+
+    if (written != entry.uncompressed_size || crc != entry.crc32) {
+        LOGE("%s: Extracted data does not match size or CRC32",
+             entry.name.c_str());
+        return false;
+    }
+
+    mode_t mode = entry.mode & 07777 ? entry.mode & 07777 : 0644;
+
+    if (fchmod(out_fd, mode) < 0) {
+        LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        return false;
+    }
+
+    ok = true;
+    return true;
+}
+
+/*!
+ * \brief Extract entries from the zip file
+ *
+ * Entries are read directly from their local headers using the loaded
+ * central directory. The archive is not rescanned.
+ *
+ * \param files List of entries to extract and their target paths
+ * \param threads Number of threads to extract with (capped at 4)
+ *
+ * \return Whether every entry in \p files was found and extracted
+ */
+bool ZipIndex::extract(const std::vector<ExtractInfo> &files,
+                       unsigned int threads) const
+{
+    if (!_loaded || files.empty()) {
+        return false;
+    }
+
+    std::vector<const ZipEntry *> entries;
+    entries.reserve(files.size());
+
+    for (const ExtractInfo &info : files) {
+        const ZipEntry *entry = find(info.from);
+        if (!entry) {
+            LOGE("%s: Entry not found in %s",
+                 info.from.c_str(), _path.c_str());
+            return false;
+        }
+        entries.push_back(entry);
+    }
+
+    int fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for reading: %s",
+             _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::atomic_size_t next(0);
+    std::atomic_bool failed(false);
+
+    auto worker = [&] {
+        size_t i;
+        while (!failed && (i = next++) < files.size()) {
+            if (!extract_entry(fd, *entries[i], files[i].to)) {
+                failed = true;
+            }
+        }
+    };
+
+    threads = std::clamp(threads, 1u, MAX_EXTRACT_THREADS);
+    threads = std::min(threads, static_cast<unsigned int>(files.size()));
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &t : pool) {
+        t.join();
+    }
+
+    return !failed;
+}
+
+}
@@ -18,6 +18,10 @@
  */
 
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
 
 #include <cerrno>
 #include <cstdarg>
@@ -29,9 +33,14 @@
 
 #include <jni.h>
 
+#include <sys/stat.h>
+
 #include "mbcommon/common.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 
+#include "mbbootimg/compare.h"
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
@@ -238,25 +247,44 @@ static la_ssize_t laBootImgReadCb(archive *a, void *userdata,
     return static_cast<la_ssize_t>(bytesRead.value());
 }
 
-JNIEXPORT jstring JNICALL
-CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
+struct RomIdCacheEntry
 {
-    (void) clazz;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    std::optional<std::string> rom_id;
+};
+
+// Boot images rarely change, so the ROM ID found in each image is cached until
+// the file's metadata changes
+static std::mutex g_rom_id_cache_lock;
+static std::unordered_map<std::string, RomIdCacheEntry> g_rom_id_cache;
 
+static bool timespec_equal(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool rom_id_cache_entry_matches(const RomIdCacheEntry &entry,
+                                       const struct stat &sb)
+{
+    return entry.dev == sb.st_dev
+            && entry.ino == sb.st_ino
+            && entry.size == sb.st_size
+            && timespec_equal(entry.mtime, sb.st_mtim)
+            && timespec_equal(entry.ctime, sb.st_ctim);
+}
+
+static bool read_boot_image_rom_id(JNIEnv *env, const char *filename,
+                                   std::optional<std::string> &rom_id)
+{
     Reader reader;
     Header header;
     Entry entry;
 
-    const char *filename = env->GetStringUTFChars(jfilename, nullptr);
-    if (!filename) {
-        return nullptr;
-    }
-
-    auto free_filename = finally([&] {
-        if (filename) {
-            env->ReleaseStringUTFChars(jfilename, filename);
-        }
-    });
+    rom_id = {};
 
     // Open input boot image
     auto ret = reader.enable_format_all();
@@ -264,14 +292,14 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         throw_exception(env, IOException,
                         "Failed to enable all boot image formats: %s",
                         ret.error().message().c_str());
-        return nullptr;
+        return false;
     }
     ret = reader.open_filename(filename);
     if (!ret) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
                         filename, ret.error().message().c_str());
-        return nullptr;
+        return false;
     }
 
     // Read header
@@ -280,7 +308,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         throw_exception(env, IOException,
                         "%s: Failed to read header: %s",
                         filename, ret.error().message().c_str());
-        return nullptr;
+        return false;
     }
 
     // Go to ramdisk
@@ -294,7 +322,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                             "%s: Failed to find ramdisk entry: %s",
                             filename, ret.error().message().c_str());
         }
-        return nullptr;
+        return false;
     }
 
     ScopedArchive a(archive_read_new(), &archive_read_free);
@@ -303,7 +331,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
 
     if (!a) {
         throw_exception(env, IOException, "Failed to allocate archive");
-        return nullptr;
+        return false;
     }
 
     // Enable support for common ramdisk formats
@@ -321,7 +349,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         throw_exception(env, IOException,
                         "%s: Failed to open ramdisk: %s",
                         filename, archive_error_string(a.get()));
-        return nullptr;
+        return false;
     }
 
     while ((laret = archive_read_next_header(a.get(), &aEntry)) == ARCHIVE_OK) {
@@ -329,7 +357,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         if (!path) {
             throw_exception(env, IOException,
                             "%s: Ramdisk entry has no path", filename);
-            return nullptr;
+            return false;
         }
 
         if (strcmp(path, "romid") == 0) {
@@ -342,7 +370,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                 throw_exception(env, IOException,
                                 "%s: Failed to read ramdisk entry: %s",
                                 filename, archive_error_string(a.get()));
-                return nullptr;
+                return false;
             }
 
             // NULL-terminate
@@ -354,10 +382,11 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                 throw_exception(env, IOException,
                                 "%s: /romid in ramdisk is too large",
                                 filename);
-                return nullptr;
+                return false;
             }
 
-            return env->NewStringUTF(buf);
+            rom_id = buf;
+            return true;
         }
     }
 
@@ -365,10 +394,70 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         throw_exception(env, IOException,
                         "%s: Failed to read ramdisk entry header: %s",
                         filename, archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+JNIEXPORT jstring JNICALL
+CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
+{
+    (void) clazz;
+
+    const char *filename = env->GetStringUTFChars(jfilename, nullptr);
+    if (!filename) {
         return nullptr;
     }
 
-    return nullptr;
+    auto free_filename = finally([&] {
+        if (filename) {
+            env->ReleaseStringUTFChars(jfilename, filename);
+        }
+    });
+
+    struct stat sb;
+    bool have_stat = stat(filename, &sb) == 0;
+
+    if (have_stat) {
+        std::lock_guard<std::mutex> lock(g_rom_id_cache_lock);
+
+        auto it = g_rom_id_cache.find(filename);
+        if (it != g_rom_id_cache.end()
+                && rom_id_cache_entry_matches(it->second, sb)) {
+            auto const &rom_id = it->second.rom_id;
+            return rom_id ? env->NewStringUTF(rom_id->c_str()) : nullptr;
+        }
+    }
+
+    std::optional<std::string> rom_id;
+    if (!read_boot_image_rom_id(env, filename, rom_id)) {
+        return nullptr;
+    }
+
+    if (have_stat) {
+        std::lock_guard<std::mutex> lock(g_rom_id_cache_lock);
+
+        g_rom_id_cache[filename] = {
+            sb.st_dev, sb.st_ino, sb.st_size, sb.st_mtim, sb.st_ctim, rom_id
+        };
+    }
+
+    return rom_id ? env->NewStringUTF(rom_id->c_str()) : nullptr;
+}
+
+static oc::result<std::unique_ptr<File>> open_boot_image(const char *filename)
+{
+    // Map the file if possible so that the entries are compared in place
+    auto mmap_file = std::make_unique<MmapFile>();
+    if (mmap_file->open(filename, false)) {
+        return std::move(mmap_file);
+    }
+
+    auto file = std::make_unique<StandardFile>();
+    OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
+
+    return std::move(file);
 }
 
 JNIEXPORT jboolean JNICALL
@@ -377,14 +466,6 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
 {
     (void) clazz;
 
-    Reader reader1;
-    Reader reader2;
-    Header header1;
-    Header header2;
-    Entry entry1;
-    Entry entry2;
-    size_t entries = 0;
-
     const char *filename1 = env->GetStringUTFChars(jfilename1, nullptr);
     if (!filename1) {
         return false;
@@ -407,142 +488,31 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
         }
     });
 
-    // Set up reader formats
-    auto ret = reader1.enable_format_all();
-    if (!ret) {
-        throw_exception(env, IOException,
-                        "Failed to enable all boot image formats: %s",
-                        ret.error().message().c_str());
-        return false;
-    }
-    ret = reader2.enable_format_all();
-    if (!ret) {
-        throw_exception(env, IOException,
-                        "Failed to enable all boot image formats: %s",
-                        ret.error().message().c_str());
-        return false;
-    }
-
     // Open boot images
-    ret = reader1.open_filename(filename1);
-    if (!ret) {
+    auto file1 = open_boot_image(filename1);
+    if (!file1) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
-                        filename1, ret.error().message().c_str());
+                        filename1, file1.error().message().c_str());
         return false;
     }
-    ret = reader2.open_filename(filename2);
-    if (!ret) {
+    auto file2 = open_boot_image(filename2);
+    if (!file2) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
-                        filename2, ret.error().message().c_str());
+                        filename2, file2.error().message().c_str());
         return false;
     }
 
-    // Read headers
-    ret = reader1.read_header(header1);
-    if (!ret) {
+    auto equal = images_equal(*file1.value(), *file2.value());
+    if (!equal) {
         throw_exception(env, IOException,
-                        "%s: Failed to read header: %s",
-                        filename1, ret.error().message().c_str());
-        return false;
-    }
-    ret = reader2.read_header(header2);
-    if (!ret) {
-        throw_exception(env, IOException,
-                        "%s: Failed to read header: %s",
-                        filename2, ret.error().message().c_str());
+                        "%s and %s: Failed to compare boot images: %s",
+                        filename1, filename2, equal.error().message().c_str());
         return false;
     }
 
-    // Compare headers
-    if (header1 != header2) {
-        return false;
-    }
-
-    // Count entries in first boot image
-    {
-        while (true) {
-            ret = reader1.read_entry(entry1);
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                throw_exception(env, IOException,
-                                "%s: Failed to read entry: %s",
-                                filename1, ret.error().message().c_str());
-                return false;
-            }
-            ++entries;
-        }
-    }
-
-    // Compare each entry in second image to first
-    {
-        while (true) {
-            ret = reader2.read_entry(entry2);
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                throw_exception(env, IOException,
-                                "%s: Failed to read entry: %s",
-                                filename2, ret.error().message().c_str());
-                return false;
-            }
-
-            if (entries == 0) {
-                // Too few entries in second image
-                return false;
-            }
-            --entries;
-
-            // Find the same entry in first image
-            ret = reader1.go_to_entry(entry1, *entry2.type());
-            if (!ret) {
-                if (ret.error() == ReaderError::EndOfEntries) {
-                    // Cannot be equal if entry is missing
-                } else {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to seek to entry: %s", filename1,
-                                    ret.error().message().c_str());
-                }
-                return false;
-            }
-
-            // Compare data
-            char buf1[10240];
-            char buf2[10240];
-
-            while (true) {
-                auto n1 = reader1.read_data(buf1, sizeof(buf1));
-                if (!n1) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename1,
-                                    n1.error().message().c_str());
-                    return false;
-                } else if (n1.value() == 0) {
-                    break;
-                }
-
-                auto n2 = reader2.read_data(buf2, n1.value());
-                if (!n2) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename2,
-                                    n2.error().message().c_str());
-                    return false;
-                }
-
-                if (n1.value() != n2.value()
-                        || memcmp(buf1, buf2, n1.value()) != 0) {
-                    // Data is not equivalent
-                    return false;
-                }
-            }
-        }
-    }
-
-    return true;
+    return equal.value();
 }
 
 }
@@ -51,6 +51,7 @@
 // Singleton
 MbtoolConnection mbtool_connection;
 MbtoolInterface *mbtool_interface = nullptr;
+MbtoolQueue mbtool_queue;
 
 namespace v3 = mbtool::daemon::v3;
 namespace fb = flatbuffers;
@@ -58,7 +59,7 @@ namespace fb = flatbuffers;
 class MbtoolInterfaceV3 : public MbtoolInterface
 {
 public:
-    MbtoolInterfaceV3(int fd) : _fd(fd)
+    MbtoolInterfaceV3(int fd) : _fd(fd), _reader(fd)
     {
     }
 
@@ -275,6 +276,9 @@ private:
                       v3::ResponseType expected_type,
                       Result &result)
     {
+        // The GUI action thread and the request queue share the socket
+        std::lock_guard<std::mutex> guard(_lock);
+
         // Build request table
         v3::RequestBuilder rb(builder);
         rb.add_request_type(request_type);
@@ -289,13 +293,11 @@ private:
         }
 
         // Read response
-        auto response_buf = mb::util::socket_read_bytes(_fd);
-        if (!response_buf) {
+        if (auto ret = _reader.read_bytes_into(buf); !ret) {
             LOGE("Failed to receive response: %s",
-                 response_buf.error().message().c_str());
+                 ret.error().message().c_str());
             return false;
         }
-        response_buf.value().swap(buf);
 
         // Verify response
         auto verifier = fb::Verifier(buf.data(), buf.size());
@@ -326,6 +328,8 @@ private:
     }
 
     int _fd;
+    mb::util::SocketReader _reader;
+    std::mutex _lock;
 };
 
 MbtoolConnection::MbtoolConnection() : _fd(-1), _iface(nullptr)
@@ -436,3 +440,118 @@ MbtoolInterface * MbtoolConnection::interface()
 {
     return _iface;
 }
+
+MbtoolQueue::MbtoolQueue()
+    : _iface(nullptr)
+    , _stop(false)
+    , _roms_generation(0)
+{
+}
+
+MbtoolQueue::~MbtoolQueue()
+{
+    stop();
+}
+
+bool MbtoolQueue::start(MbtoolInterface *iface)
+{
+    if (_thread.joinable()) {
+        return true;
+    }
+
+    _iface = iface;
+    _stop = false;
+    _thread = std::thread(&MbtoolQueue::run, this);
+
+    return true;
+}
+
+void MbtoolQueue::stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _cv.notify_one();
+
+    _thread.join();
+}
+
+void MbtoolQueue::post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _tasks.push_back(std::move(task));
+    }
+    _cv.notify_one();
+}
+
+std::shared_future<InstalledRoms> MbtoolQueue::get_installed_roms()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    if (_roms.valid()) {
+        return _roms;
+    }
+
+    auto promise = std::make_shared<std::promise<InstalledRoms>>();
+    _roms = promise->get_future().share();
+    unsigned int generation = _roms_generation;
+
+    _tasks.push_back([this, promise, generation](MbtoolInterface *iface) {
+        InstalledRoms result;
+        result.ok = iface->get_installed_roms(result.roms);
+
+        if (!result.ok) {
+            // Let the next caller retry instead of caching the failure
+            std::lock_guard<std::mutex> guard(_lock);
+            if (_roms_generation == generation) {
+                _roms = {};
+                ++_roms_generation;
+            }
+        }
+
+        promise->set_value(std::move(result));
+    });
+
+    auto future = _roms;
+    lock.unlock();
+    _cv.notify_one();
+
+    return future;
+}
+
+void MbtoolQueue::invalidate_installed_roms()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _roms = {};
+    ++_roms_generation;
+}
+
+void MbtoolQueue::run()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    while (true) {
+        _cv.wait(lock, [this]{
+            return _stop || !_tasks.empty();
+        });
+
+        if (_tasks.empty()) {
+            // Only stop once everything that was queued has run so that no
+            // promise is left unsatisfied
+            break;
+        }
+
+        Task task = std::move(_tasks.front());
+        _tasks.pop_front();
+
+        lock.unlock();
+        task(_iface);
+        lock.lock();
+    }
+}
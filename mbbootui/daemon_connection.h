@@ -17,7 +17,13 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <flatbuffers/flatbuffers.h>
@@ -78,5 +84,55 @@ private:
     MbtoolInterface *_iface;
 };
 
+class InstalledRoms
+{
+public:
+    bool ok = false;
+    std::vector<Rom> roms;
+};
+
+// Runs daemon requests on a worker thread so that the GUI thread never blocks
+// on the mbtool socket
+class MbtoolQueue
+{
+public:
+    typedef std::function<void(MbtoolInterface *)> Task;
+
+    MbtoolQueue();
+    ~MbtoolQueue();
+
+    bool start(MbtoolInterface *iface);
+    void stop();
+
+    // Queue a task to be run on the worker thread. Tasks run in order and
+    // every task queued before stop() is called will still run.
+    void post(Task task);
+
+    // Fetch the list of installed ROMs. Callers that ask while a request is
+    // already pending share its result and a successful result is reused
+    // until invalidate_installed_roms() is called.
+    std::shared_future<InstalledRoms> get_installed_roms();
+    void invalidate_installed_roms();
+
+    MbtoolQueue(const MbtoolQueue &) = delete;
+    MbtoolQueue(MbtoolQueue &&) = delete;
+    MbtoolQueue & operator=(const MbtoolQueue &) & = delete;
+    MbtoolQueue & operator=(MbtoolQueue &&) & = delete;
+
+private:
+    void run();
+
+    MbtoolInterface *_iface;
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::deque<Task> _tasks;
+    bool _stop;
+
+    std::shared_future<InstalledRoms> _roms;
+    unsigned int _roms_generation;
+};
+
 extern MbtoolConnection mbtool_connection;
 extern MbtoolInterface *mbtool_interface;
+extern MbtoolQueue mbtool_queue;
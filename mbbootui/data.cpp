@@ -389,6 +389,7 @@ void DataManager::SetDefaultValues()
         mPersist.SetValue(VAR_TW_NO_SCREEN_TIMEOUT, "0");
     }
     mData.SetValue(VAR_TW_GUI_DONE, "0");
+    mPersist.SetValue(VAR_TW_FRAME_STATS, "0");
 
     // Brightness handling
     std::string findbright;
@@ -264,6 +264,16 @@ int GUIConsole::Render()
     return RenderConsole();
 }
 
+int GUIConsole::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    // The slideout button is drawn outside of the console area
+    if (mSlideout) {
+        return -1;
+    }
+
+    return GUIScrollList::GetDrawnRect(x, y, w, h);
+}
+
 int GUIConsole::Update()
 {
     if (mSlideout && mSlideoutState != visible) {
@@ -300,9 +310,8 @@ int GUIConsole::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
-            return 2;
-        }
+        AddDamage();
+        return 2;
     }
     return 0;
 }
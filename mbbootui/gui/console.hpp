@@ -38,6 +38,10 @@ public:
     //  Return 1 if this object handles the request, 0 if not
     virtual int IsInRegion(int x, int y);
 
+    // GetDrawnRect - Returns the area that Render() draws to
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x, int& y, int& w, int& h);
+
     // NotifyTouch - Notify of a touch event
     //  Return 0 on success, >0 to ignore remainder of touch, and <0 on error (Return error to allow other handlers)
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/damage.hpp"
+
+#include <algorithm>
+
+// Redrawing most of the screen in pieces is slower than redrawing everything
+static constexpr int MAX_DAMAGE_PERCENT = 75;
+
+static std::vector<GRRect> gCurrent;
+static std::vector<GRRect> gPrevious;
+static bool gCurrentFull = false;
+static bool gPreviousFull = true;
+static unsigned int gSerial = 0;
+
+static bool touches(const GRRect& a, const GRRect& b)
+{
+    return a.x <= b.x + b.w && b.x <= a.x + a.w
+            && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+static GRRect bounding_rect(const GRRect& a, const GRRect& b)
+{
+    GRRect r;
+    r.x = std::min(a.x, b.x);
+    r.y = std::min(a.y, b.y);
+    r.w = std::max(a.x + a.w, b.x + b.w) - r.x;
+    r.h = std::max(a.y + a.h, b.y + b.h) - r.y;
+    return r;
+}
+
+// Add a rectangle to a list of non-overlapping rectangles, merging any that
+// overlap or touch
+static void merge_rect(std::vector<GRRect>& rects, GRRect rect)
+{
+    int x2 = std::min(rect.x + rect.w, gr_fb_width());
+    int y2 = std::min(rect.y + rect.h, gr_fb_height());
+    rect.x = std::max(rect.x, 0);
+    rect.y = std::max(rect.y, 0);
+    rect.w = x2 - rect.x;
+    rect.h = y2 - rect.y;
+
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    for (auto it = rects.begin(); it != rects.end();) {
+        if (touches(*it, rect)) {
+            rect = bounding_rect(*it, rect);
+            rects.erase(it);
+            // The bigger rectangle may now touch earlier ones
+            it = rects.begin();
+        } else {
+            ++it;
+        }
+    }
+
+    rects.push_back(rect);
+
+    if (rects.size() > GR_MAX_FLIP_RECTS) {
+        GRRect all = rects[0];
+        for (auto const& r : rects) {
+            all = bounding_rect(all, r);
+        }
+        rects.assign(1, all);
+    }
+}
+
+void Damage::Add(int x, int y, int w, int h)
+{
+    ++gSerial;
+
+    if (!gCurrentFull) {
+        merge_rect(gCurrent, { x, y, w, h });
+    }
+}
+
+void Damage::AddFull()
+{
+    ++gSerial;
+    gCurrentFull = true;
+    gCurrent.clear();
+}
+
+unsigned int Damage::Serial()
+{
+    return gSerial;
+}
+
+bool Damage::GetRegion(int buffer_age, std::vector<GRRect>& rects)
+{
+    if (gCurrentFull) {
+        return false;
+    }
+
+    rects = gCurrent;
+
+    if (buffer_age == 2) {
+        // The surface is missing the previous frame's changes too
+        if (gPreviousFull) {
+            return false;
+        }
+        for (auto const& r : gPrevious) {
+            merge_rect(rects, r);
+        }
+    } else if (buffer_age != 1) {
+        return false;
+    }
+
+    long area = 0;
+    for (auto const& r : rects) {
+        area += static_cast<long>(r.w) * r.h;
+    }
+
+    long screen_area = static_cast<long>(gr_fb_width()) * gr_fb_height();
+    return area * 100 <= screen_area * MAX_DAMAGE_PERCENT;
+}
+
+void Damage::EndFrame(bool full)
+{
+    gPrevious.swap(gCurrent);
+    gPreviousFull = full || gCurrentFull;
+    gCurrent.clear();
+    gCurrentFull = false;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "minuitwrp/minui.h"
+
+// Tracks the parts of the screen that need to be redrawn in the next frame.
+// Objects report damage from their Update() functions. If an object requests
+// a render without reporting any damage, the whole screen is redrawn.
+class Damage
+{
+public:
+    // Add - Mark a region as needing to be redrawn
+    static void Add(int x, int y, int w, int h);
+
+    // AddFull - Mark the whole screen as needing to be redrawn
+    static void AddFull();
+
+    // Serial - Returns a counter that changes whenever damage is added
+    static unsigned int Serial();
+
+    // GetRegion - Get the regions to redraw for a drawing surface with the
+    // given buffer age (see gr_buffer_age())
+    //  Return true on success, false if the whole screen must be redrawn
+    static bool GetRegion(int buffer_age, std::vector<GRRect>& rects);
+
+    // EndFrame - Notify that a frame was flipped
+    static void EndFrame(bool full);
+};
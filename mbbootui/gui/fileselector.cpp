@@ -157,9 +157,8 @@ int GUIFileSelector::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
-            return 2;
-        }
+        AddDamage();
+        return 2;
     }
     return 0;
 }
@@ -359,20 +358,24 @@ void GUIFileSelector::RenderItem(size_t itemindex, int yPos, bool selected)
     size_t folderSize = mShowFolders ? mFolderList.size() : 0;
 
     ImageResource* icon;
-    std::string text;
+    std::string up_a_level;
+    const std::string* text;
 
+    // Only the visible rows are rendered, but avoid copying each row's name
+    // on every frame while scrolling
     if (itemindex < folderSize) {
-        text = mFolderList.at(itemindex).fileName;
+        text = &mFolderList.at(itemindex).fileName;
         icon = mFolderIcon;
-        if (text == "..") {
-            text = gui_lookup("up_a_level", "(Up A Level)");
+        if (*text == "..") {
+            up_a_level = gui_lookup("up_a_level", "(Up A Level)");
+            text = &up_a_level;
         }
     } else {
-        text = mFileList.at(itemindex - folderSize).fileName;
+        text = &mFileList.at(itemindex - folderSize).fileName;
         icon = mFileIcon;
     }
 
-    RenderStdItem(yPos, selected, icon, text.c_str());
+    RenderStdItem(yPos, selected, icon, text->c_str());
 }
 
 void GUIFileSelector::NotifySelect(size_t item_selected)
@@ -32,3 +32,11 @@ int GUIFill::Render()
     return 0;
 }
 
+int GUIFill::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return 0;
+}
@@ -31,6 +31,10 @@ public:
     //  Return 0 on success, <0 on error
     virtual int Render();
 
+    // GetDrawnRect - Returns the area that Render() draws to
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x, int& y, int& w, int& h);
+
 protected:
     COLOR mColor;
 };
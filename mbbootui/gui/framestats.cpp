@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/framestats.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+#include "mblog/logging.h"
+
+#include "minuitwrp/minui.h"
+
+#include "gui/damage.hpp"
+#include "gui/pages.hpp"
+#include "gui/resources.hpp"
+
+#define LOG_TAG "mbbootui/gui/framestats"
+
+using namespace std::chrono;
+
+// Histogram buckets are 250us wide and cover up to 100ms. Slower frames are
+// counted in the last bucket.
+static constexpr int64_t BUCKET_NS = 250000;
+static constexpr size_t BUCKET_COUNT = 401;
+
+// Number of object types shown in the overlay
+static constexpr size_t OVERLAY_CATEGORIES = 3;
+
+struct CategoryStats
+{
+    std::string name;
+    // Render time of the current frame
+    int64_t frame_ns = 0;
+    // Render time of the last complete frame
+    int64_t last_ns = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+};
+
+static bool gEnabled = false;
+// Index 0 collects objects created without a type
+static std::vector<CategoryStats> gCategories(1);
+
+static uint64_t gHistogram[BUCKET_COUNT];
+static uint64_t gFrames = 0;
+static int64_t gTotalNs = 0;
+static int64_t gMaxNs = 0;
+static int64_t gRenderTotalNs = 0;
+static int64_t gFlipTotalNs = 0;
+static uint64_t gFullFrames = 0;
+
+static steady_clock::time_point gFrameStart;
+static steady_clock::time_point gFlipStart;
+static int64_t gRenderNs = 0;
+static int64_t gLastRenderNs = 0;
+static int64_t gLastFlipNs = 0;
+
+static double to_ms(int64_t ns)
+{
+    return static_cast<double>(ns) / 1000000.0;
+}
+
+// Upper bound of the bucket containing the given percentile
+static double percentile_ms(unsigned int percent)
+{
+    if (gFrames == 0) {
+        return 0;
+    }
+
+    uint64_t target = (gFrames * percent + 99) / 100;
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        count += gHistogram[i];
+        if (count >= target) {
+            return to_ms(static_cast<int64_t>(i + 1) * BUCKET_NS);
+        }
+    }
+
+    return to_ms(static_cast<int64_t>(BUCKET_COUNT) * BUCKET_NS);
+}
+
+static int overlay_height(void* font)
+{
+    return (gr_getMaxFontHeight(font) + 2) * 3 + 4;
+}
+
+static void* overlay_font()
+{
+    const ResourceManager* res = PageManager::GetResources();
+    FontResource* font = res ? res->FindFont("font_s") : nullptr;
+    return font ? font->GetResource() : nullptr;
+}
+
+bool FrameStats::SetEnabled(bool enabled)
+{
+    if (enabled == gEnabled) {
+        return false;
+    }
+
+    gEnabled = enabled;
+    LOGI("Frame statistics %s", enabled ? "enabled" : "disabled");
+    return true;
+}
+
+bool FrameStats::IsEnabled()
+{
+    return gEnabled;
+}
+
+int FrameStats::Category(const std::string& type)
+{
+    for (size_t i = 1; i < gCategories.size(); ++i) {
+        if (gCategories[i].name == type) {
+            return static_cast<int>(i);
+        }
+    }
+
+    gCategories.emplace_back();
+    gCategories.back().name = type;
+    return static_cast<int>(gCategories.size() - 1);
+}
+
+void FrameStats::AddObjectTime(int category, steady_clock::duration time)
+{
+    if (category < 0 || static_cast<size_t>(category) >= gCategories.size()) {
+        category = 0;
+    }
+    gCategories[static_cast<size_t>(category)].frame_ns +=
+            duration_cast<nanoseconds>(time).count();
+}
+
+void FrameStats::BeginFrame()
+{
+    if (!gEnabled) {
+        return;
+    }
+
+    void* font = overlay_font();
+    if (font) {
+        Damage::Add(0, 0, gr_fb_width(), overlay_height(font));
+    }
+
+    gFrameStart = steady_clock::now();
+}
+
+void FrameStats::FinishRender()
+{
+    if (!gEnabled) {
+        return;
+    }
+
+    gRenderNs = duration_cast<nanoseconds>(
+            steady_clock::now() - gFrameStart).count();
+
+    void* font = overlay_font();
+    if (font) {
+        int line_height = gr_getMaxFontHeight(font) + 2;
+        char line[128];
+
+        gr_color(0, 0, 0, 192);
+        gr_fill(0, 0, gr_fb_width(), overlay_height(font));
+        gr_color(255, 255, 0, 255);
+
+        snprintf(line, sizeof(line),
+                 "render %.1f  flip %.1f  max %.1f ms  (%" PRIu64 " frames)",
+                 to_ms(gLastRenderNs), to_ms(gLastFlipNs), to_ms(gMaxNs),
+                 gFrames);
+        gr_textEx_scaleW(2, 2, line, font, gr_fb_width() - 4, TOP_LEFT, 0);
+
+        snprintf(line, sizeof(line), "p50 %.2f  p95 %.2f  p99 %.2f ms",
+                 percentile_ms(50), percentile_ms(95), percentile_ms(99));
+        gr_textEx_scaleW(2, 2 + line_height, line, font,
+                         gr_fb_width() - 4, TOP_LEFT, 0);
+
+        // Slowest object types in the previous frame
+        std::vector<const CategoryStats*> sorted;
+        for (auto const& c : gCategories) {
+            if (c.last_ns > 0) {
+                sorted.push_back(&c);
+            }
+        }
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const CategoryStats* a, const CategoryStats* b) {
+            return a->last_ns > b->last_ns;
+        });
+
+        std::string types;
+        for (size_t i = 0; i < sorted.size() && i < OVERLAY_CATEGORIES; ++i) {
+            snprintf(line, sizeof(line), "%s%s %.2f",
+                     i == 0 ? "" : "  ",
+                     sorted[i]->name.empty() ? "other" : sorted[i]->name.c_str(),
+                     to_ms(sorted[i]->last_ns));
+            types += line;
+        }
+        gr_textEx_scaleW(2, 2 + line_height * 2, types.c_str(), font,
+                         gr_fb_width() - 4, TOP_LEFT, 0);
+    }
+
+    gFlipStart = steady_clock::now();
+}
+
+void FrameStats::EndFrame(size_t rect_count)
+{
+    if (!gEnabled) {
+        return;
+    }
+
+    int64_t flip_ns = duration_cast<nanoseconds>(
+            steady_clock::now() - gFlipStart).count();
+    int64_t frame_ns = gRenderNs + flip_ns;
+
+    size_t bucket = std::min(static_cast<size_t>(frame_ns / BUCKET_NS),
+                             BUCKET_COUNT - 1);
+    ++gHistogram[bucket];
+    ++gFrames;
+    gTotalNs += frame_ns;
+    gMaxNs = std::max(gMaxNs, frame_ns);
+    gRenderTotalNs += gRenderNs;
+    gFlipTotalNs += flip_ns;
+    if (rect_count == 0) {
+        ++gFullFrames;
+    }
+
+    gLastRenderNs = gRenderNs;
+    gLastFlipNs = flip_ns;
+
+    for (auto& c : gCategories) {
+        c.last_ns = c.frame_ns;
+        c.total_ns += c.frame_ns;
+        c.max_ns = std::max(c.max_ns, c.frame_ns);
+        c.frame_ns = 0;
+    }
+}
+
+void FrameStats::Dump()
+{
+    if (gFrames == 0) {
+        LOGI("Frame statistics: no frames recorded");
+        return;
+    }
+
+    double frames = static_cast<double>(gFrames);
+
+    LOGI("Frame statistics: %" PRIu64 " frames (%" PRIu64 " full redraws)",
+         gFrames, gFullFrames);
+    LOGI("  frame avg %.2f ms, max %.2f ms, p50 %.2f ms, p95 %.2f ms,"
+         " p99 %.2f ms", to_ms(gTotalNs) / frames, to_ms(gMaxNs),
+         percentile_ms(50), percentile_ms(95), percentile_ms(99));
+    LOGI("  render avg %.2f ms, flip avg %.2f ms",
+         to_ms(gRenderTotalNs) / frames, to_ms(gFlipTotalNs) / frames);
+
+    std::vector<const CategoryStats*> sorted;
+    for (auto const& c : gCategories) {
+        if (c.total_ns > 0) {
+            sorted.push_back(&c);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const CategoryStats* a, const CategoryStats* b) {
+        return a->total_ns > b->total_ns;
+    });
+
+    for (auto const* c : sorted) {
+        LOGI("  %-16s avg %.3f ms/frame, max %.2f ms, total %.1f ms",
+             c->name.empty() ? "other" : c->name.c_str(),
+             to_ms(c->total_ns) / frames, to_ms(c->max_ns), to_ms(c->total_ns));
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Collects per-frame render and flip timings while enabled (see
+// VAR_TW_FRAME_STATS). The latest numbers are drawn on top of each frame and
+// a summary is written to the log when the GUI exits.
+class FrameStats
+{
+public:
+    // SetEnabled - Start or stop collecting timings
+    //  Return true if the state changed
+    static bool SetEnabled(bool enabled);
+
+    static bool IsEnabled();
+
+    // Category - Get the index used to attribute render time to objects of
+    // the given type
+    static int Category(const std::string& type);
+
+    // AddObjectTime - Add the time spent rendering a single object
+    static void AddObjectTime(int category,
+                              std::chrono::steady_clock::duration time);
+
+    // BeginFrame - Notify that rendering of a frame is starting. The overlay
+    // area is marked as damaged so that it is redrawn with the frame.
+    static void BeginFrame();
+
+    // FinishRender - Record the render time and draw the overlay on top of
+    // the rendered frame. Must be called before the frame is flipped.
+    static void FinishRender();
+
+    // EndFrame - Record the flip time after a frame was flipped
+    static void EndFrame(size_t rect_count);
+
+    // Dump - Write a summary of all recorded frames to the log
+    static void Dump();
+};
@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <vector>
 
 #include <linux/input.h>
 #include <unistd.h>
@@ -36,6 +37,8 @@
 #include "minuitwrp/minui.h"
 
 #include "gui/blanktimer.hpp"
+#include "gui/damage.hpp"
+#include "gui/framestats.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/mousecursor.hpp"
 #include "gui/objects.hpp"
@@ -43,8 +46,10 @@
 
 #define LOG_TAG "mbbootui/gui/gui"
 
-// Enable to print render time of each frame to the log file
-//#define PRINT_RENDER_TIME 1
+// Time between frames while animating or processing input
+#define FRAME_INTERVAL_NS 33333333
+// Maximum time to wait for a page flip to complete
+#define FLIP_TIMEOUT_MS 100
 
 #ifdef _EVENT_LOGGING
 #define LOGEVENT(...) LOGE(__VA_ARGS__)
@@ -71,7 +76,7 @@ static int gRecorder = -1;
 
 void gr_write_frame_to_file(int fd);
 
-void flip()
+static void record_frame()
 {
     if (gRecorder != -1) {
         timespec time;
@@ -79,7 +84,51 @@ void flip()
         write(gRecorder, &time, sizeof(timespec));
         gr_write_frame_to_file(gRecorder);
     }
+}
+
+void flip()
+{
+    record_frame();
     gr_flip();
+    Damage::EndFrame(true);
+}
+
+static void flip_rects(const std::vector<GRRect>& rects)
+{
+    record_frame();
+    gr_flip_rects(rects.data(), static_cast<int>(rects.size()));
+    Damage::EndFrame(false);
+}
+
+// Wait until the previous frame is on screen so that the drawing surface is
+// no longer being scanned out
+static void wait_for_flip()
+{
+    if (!gr_wait_flip(FLIP_TIMEOUT_MS)) {
+        LOGW("Timed out waiting for the previous frame to be displayed");
+    }
+}
+
+// Render the next frame, redrawing only the damaged regions if possible
+static void render_and_flip()
+{
+    std::vector<GRRect> rects;
+
+    wait_for_flip();
+    FrameStats::BeginFrame();
+
+    if (Damage::GetRegion(gr_buffer_age(), rects)) {
+        PageManager::RenderRegion(rects);
+        FrameStats::FinishRender();
+        flip_rects(rects);
+    } else {
+        PageManager::Render();
+        FrameStats::FinishRender();
+        flip();
+        rects.clear();
+    }
+
+    FrameStats::EndFrame(rects.size());
 }
 
 void rapidxml::parse_error_handler(const char *what, void *where)
@@ -385,7 +434,7 @@ static void loopTimer(int input_timeout_ms)
 
         // This is really 2 or 30 times per second
         // As long as we get events, increase the timeout so we can catch up with input
-        long timeout = got_event ? 500000000 : 33333333;
+        long timeout = got_event ? 500000000 : FRAME_INTERVAL_NS;
 
         if (diff.count() > timeout) {
             //auto input_time = duration_cast<milliseconds>(curTime - lastCall);
@@ -397,10 +446,14 @@ static void loopTimer(int input_timeout_ms)
             return;
         }
 
-        // We need to sleep some period time microseconds
-        //unsigned int sleepTime = 33333 -(diff.tv_nsec / 1000);
-        //usleep(sleepTime); // removed so we can scan for input
-        input_timeout_ms = 0;
+        // Sleep in poll() until the next frame is due instead of spinning so
+        // that input is still handled as soon as it arrives
+        if (got_event) {
+            input_timeout_ms = 0;
+        } else {
+            long remaining = FRAME_INTERVAL_NS - diff.count();
+            input_timeout_ms = static_cast<int>((remaining + 999999) / 1000000);
+        }
     } while (1);
 }
 
@@ -442,7 +495,12 @@ static int runPages(const char *page_name, const int stop_on_page_done)
         if (!gForceRender) {
             int ret = PageManager::Update();
             if (ret == 0) {
-                ++idle_frames;
+                // Persist newly rasterized glyphs and decoded images once the
+                // UI settles
+                if (++idle_frames == 16) {
+                    gr_ttf_save_glyph_atlases();
+                    res_cache_save();
+                }
             } else if (ret == -2) {
                 break; // Theme reload failure
             } else {
@@ -451,39 +509,28 @@ static int runPages(const char *page_name, const int stop_on_page_done)
             // due to possible animation objects, we need to delay activating the input timeout
             input_timeout_ms = idle_frames > 15 ? 1000 : 0;
 
-#ifndef PRINT_RENDER_TIME
             if (ret > 1) {
-                PageManager::Render();
-            }
-
-            if (ret > 0) {
-                flip();
-            }
-#else
-            if (ret > 1) {
-                auto start = steady_clock::now();
-                PageManager::Render();
-                auto end = steady_clock::now();
-                auto render_t = duration_cast<milliseconds>(end - start);
-
-                flip();
-                auto flip_end = steady_clock::now();
-                auto flip_t = duration_cast<milliseconds>(flip_end - end);
-
-                LOGI("Render(): %" PRId64 " ms, flip(): %" PRId64 " ms, total: %" PRId64 " ms",
-                     render_t.count(), flip_t.count(),
-                     render_t.count() + flip_t.count());
+                render_and_flip();
             } else if (ret > 0) {
                 flip();
             }
-#endif
         } else {
             gForceRender = 0;
+            wait_for_flip();
+            FrameStats::BeginFrame();
             PageManager::Render();
+            FrameStats::FinishRender();
             flip();
+            FrameStats::EndFrame(0);
             input_timeout_ms = 0;
         }
 
+        // Redraw everything when the overlay is shown or hidden
+        if (FrameStats::SetEnabled(
+                DataManager::GetIntValue(VAR_TW_FRAME_STATS) != 0)) {
+            gui_forceRender();
+        }
+
         blankTimer.checkForTimeout();
         if (stop_on_page_done && DataManager::GetIntValue(VAR_TW_PAGE_DONE) != 0) {
             gui_changePage("main");
@@ -494,6 +541,10 @@ static int runPages(const char *page_name, const int stop_on_page_done)
         }
     }
     gGuiRunning = 0;
+
+    if (FrameStats::IsEnabled()) {
+        FrameStats::Dump();
+    }
     return 0;
 }
 
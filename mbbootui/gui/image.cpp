@@ -68,3 +68,12 @@ int GUIImage::SetRenderPos(int x, int y, int w, int h)
     mRenderY = y;
     return 0;
 }
+
+int GUIImage::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return 0;
+}
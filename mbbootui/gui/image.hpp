@@ -35,6 +35,10 @@ public:
     //  Return 0 on success, <0 on error
     virtual int SetRenderPos(int x, int y, int w = 0, int h = 0);
 
+    // GetDrawnRect - Returns the area that Render() draws to
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x, int& y, int& w, int& h);
+
 public:
     bool isHighlighted;
 
@@ -29,6 +29,7 @@ GUIListBox::GUIListBox(xml_node<>* node) : GUIScrollList(node)
     mIconSelected = mIconUnselected = nullptr;
     mUpdate = 0;
     isCheckList = isTextParsed = false;
+    mRomsPending = false;
 
     // Get the icons, if any
     child = FindNode(node, "icon");
@@ -126,11 +127,16 @@ int GUIListBox::Update()
 
     GUIScrollList::Update();
 
+    if (LoadInstalledRoms()) {
+        DataManager::GetValue(mVariable, currentValue);
+        NotifyVarChange(mVariable, currentValue);
+        mUpdate = 1;
+    }
+
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
-            return 2;
-        }
+        AddDamage();
+        return 2;
     }
     return 0;
 }
@@ -201,20 +207,10 @@ void GUIListBox::SetPageFocus(int inFocus)
         }
 
         if (mVariable == VAR_TW_ROM_ID) {
-            mListItems.clear();
-
-            std::vector<Rom> roms;
-            mbtool_interface->get_installed_roms(roms);
-
-            for (Rom rom : roms) {
-                ListItem data;
-                // TODO: Read name from config file
-                data.displayName = rom.id;
-                data.variableValue = rom.id;
-                data.action = nullptr;
-                data.selected = (currentValue == rom.id);
-                mListItems.push_back(std::move(data));
-            }
+            // The previous items stay listed until the daemon responds
+            mRomsFuture = mbtool_queue.get_installed_roms();
+            mRomsPending = true;
+            LoadInstalledRoms();
         }
 
         DataManager::GetValue(mVariable, currentValue);
@@ -222,6 +218,30 @@ void GUIListBox::SetPageFocus(int inFocus)
     }
 }
 
+bool GUIListBox::LoadInstalledRoms()
+{
+    if (!mRomsPending || mRomsFuture.wait_for(std::chrono::seconds(0))
+            != std::future_status::ready) {
+        return false;
+    }
+    mRomsPending = false;
+
+    const InstalledRoms& roms = mRomsFuture.get();
+
+    mListItems.clear();
+    for (const Rom& rom : roms.roms) {
+        ListItem data;
+        // TODO: Read name from config file
+        data.displayName = rom.id;
+        data.variableValue = rom.id;
+        data.action = nullptr;
+        data.selected = (currentValue == rom.id);
+        mListItems.push_back(std::move(data));
+    }
+
+    return true;
+}
+
 size_t GUIListBox::GetItemCount()
 {
     return mVisibleItems.size();
@@ -22,6 +22,8 @@
 
 #include "gui/action.hpp"
 
+#include "daemon_connection.h"
+
 class GUIListBox : public GUIScrollList
 {
 public:
@@ -43,6 +45,11 @@ public:
     virtual void RenderItem(size_t itemindex, int yPos, bool selected);
     virtual void NotifySelect(size_t item_selected);
 
+protected:
+    // LoadInstalledRoms - Replace the items with the ROM list once the daemon has responded
+    //  Return true if the items were replaced
+    bool LoadInstalledRoms();
+
 protected:
     struct ListItem
     {
@@ -63,4 +70,6 @@ protected:
     ImageResource* mIconUnselected;
     bool isCheckList;
     bool isTextParsed;
+    std::shared_future<InstalledRoms> mRomsFuture;
+    bool mRomsPending;
 };
@@ -8,6 +8,19 @@
 
 #include "data.hpp"
 
+#include "gui/damage.hpp"
+
+void RenderObject::AddDamage()
+{
+    int x, y, w, h;
+
+    if (GetDrawnRect(x, y, w, h) == 0) {
+        Damage::Add(x, y, w, h);
+    } else {
+        Damage::AddFull();
+    }
+}
+
 GUIObject::GUIObject(xml_node<>* node)
 {
     mConditionsResult = true;
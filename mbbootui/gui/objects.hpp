@@ -35,7 +35,8 @@ public:
         mRenderY(0),
         mRenderW(0),
         mRenderH(0),
-        mPlacement(TOP_LEFT) {}
+        mPlacement(TOP_LEFT),
+        mStatsCategory(-1) {}
     virtual ~RenderObject() {}
 
 public:
@@ -94,9 +95,36 @@ public:
         return;
     }
 
+    // GetDrawnRect - Returns the area that Render() draws to. This is used to
+    // skip objects that are outside of the region being redrawn.
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x __unused, int& y __unused,
+                             int& w __unused, int& h __unused)
+    {
+        return -1;
+    }
+
+    // GetStatsCategory - Returns the FrameStats category for render timings
+    int GetStatsCategory()
+    {
+        return mStatsCategory;
+    }
+
+    // SetStatsCategory - Set the FrameStats category for render timings
+    void SetStatsCategory(int category)
+    {
+        mStatsCategory = category;
+    }
+
+protected:
+    // AddDamage - Mark the area returned by GetDrawnRect() as needing to be
+    // redrawn. If the area is unknown, the whole screen is redrawn.
+    void AddDamage();
+
 protected:
     int mRenderX, mRenderY, mRenderW, mRenderH;
     Placement mPlacement;
+    int mStatsCategory;
 };
 
 class ActionObject
@@ -21,6 +21,7 @@
 #include "gui/objects.hpp"
 
 #include <algorithm>
+#include <chrono>
 
 #include <cstring>
 
@@ -48,8 +49,10 @@
 #include "gui/button.hpp"
 #include "gui/checkbox.hpp"
 #include "gui/console.hpp"
+#include "gui/damage.hpp"
 #include "gui/fileselector.hpp"
 #include "gui/fill.hpp"
+#include "gui/framestats.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/image.hpp"
 #include "gui/input.hpp"
@@ -381,6 +384,8 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
             type = attr ? attr->value() : "*unspecified*";
         }
 
+        size_t renderCount = mRenders.size();
+
         if (type == "text") {
             GUIText* element = new GUIText(child);
             mObjects.push_back(element);
@@ -505,10 +510,29 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
         } else {
             LOGE("Unknown object type: %s.", type.c_str());
         }
+
+        // Templates tag their own objects when processed recursively
+        if (mRenders.size() > renderCount && type != "template") {
+            mRenders.back()->SetStatsCategory(FrameStats::Category(type));
+        }
     }
     return true;
 }
 
+// Render an object, timing it if frame statistics are enabled
+static int render_object(RenderObject* object)
+{
+    if (!FrameStats::IsEnabled()) {
+        return object->Render();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int ret = object->Render();
+    FrameStats::AddObjectTime(object->GetStatsCategory(),
+                              std::chrono::steady_clock::now() - start);
+    return ret;
+}
+
 int Page::Render()
 {
     // Render background
@@ -517,7 +541,34 @@ int Page::Render()
 
     // Render remaining objects
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
-        if ((*iter)->Render()) {
+        if (render_object(*iter)) {
+            LOGE("A render request has failed.");
+        }
+    }
+    return 0;
+}
+
+static bool rect_intersects(const GRRect& rect, int x, int y, int w, int h)
+{
+    return x < rect.x + rect.w && rect.x < x + w
+            && y < rect.y + rect.h && rect.y < y + h;
+}
+
+int Page::RenderRegion(const GRRect& rect)
+{
+    // Render background
+    gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
+    gr_fill(rect.x, rect.y, rect.w, rect.h);
+
+    // Render objects that overlap the region. Drawing is clipped to the region
+    // by the caller.
+    for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        int x, y, w, h;
+        if ((*iter)->GetDrawnRect(x, y, w, h) == 0
+                && !rect_intersects(rect, x, y, w, h)) {
+            continue;
+        }
+        if (render_object(*iter)) {
             LOGE("A render request has failed.");
         }
     }
@@ -529,12 +580,17 @@ int Page::Update()
     int retCode = 0;
 
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        unsigned int serial = Damage::Serial();
         int ret = (*iter)->Update();
         if (ret < 0) {
             LOGE("An update request has failed.");
         } else if (ret > retCode) {
             retCode = ret;
         }
+        // Objects that don't report what changed need a full redraw
+        if (ret > 0 && Damage::Serial() == serial) {
+            Damage::AddFull();
+        }
     }
 
     return retCode;
@@ -1091,6 +1147,24 @@ int PageSet::Render()
     return ret;
 }
 
+int PageSet::RenderRegion(const GRRect& rect)
+{
+    int ret;
+
+    ret = (mCurrentPage ? mCurrentPage->RenderRegion(rect) : -1);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
+        ret = ((*iter) ? (*iter)->RenderRegion(rect) : -1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return ret;
+}
+
 int PageSet::Update()
 {
     int ret;
@@ -1585,6 +1659,30 @@ int PageManager::Render()
     return res;
 }
 
+int PageManager::RenderRegion(const std::vector<GRRect>& rects)
+{
+    if (blankTimer.isScreenOff()) {
+        return 0;
+    }
+
+    int res = 0;
+
+    for (auto const& rect : rects) {
+        gr_clip_base(rect.x, rect.y, rect.w, rect.h);
+
+        res = (mCurrentSet ? mCurrentSet->RenderRegion(rect) : -1);
+        if (mMouseCursor) {
+            mMouseCursor->Render();
+        }
+        if (res < 0) {
+            break;
+        }
+    }
+
+    gr_noclip_base();
+    return res;
+}
+
 HardwareKeyboard *PageManager::GetHardwareKeyboard()
 {
     if (!mHardwareKeyboard) {
@@ -1651,6 +1749,9 @@ int PageManager::Update()
         if (c_res > res) {
             res = c_res;
         }
+        if (c_res > 0) {
+            Damage::AddFull();
+        }
     }
     return res;
 }
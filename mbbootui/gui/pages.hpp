@@ -9,6 +9,8 @@
 
 #include "minzip/Zip.h"
 
+#include "minuitwrp/minui.h"
+
 #include "gui/gui.hpp"
 #include "gui/rapidxml.hpp"
 
@@ -77,6 +79,7 @@ public:
 
 public:
     virtual int Render();
+    virtual int RenderRegion(const GRRect& rect);
     virtual int Update();
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
     virtual int NotifyKey(int key, bool down);
@@ -124,6 +127,7 @@ public:
 
     // These are routing routines
     int Render();
+    int RenderRegion(const GRRect& rect);
     int Update();
     int NotifyTouch(TOUCH_STATE state, int x, int y);
     int NotifyKey(int key, bool down);
@@ -173,6 +177,7 @@ public:
 
     // These are routing routines
     static int Render();
+    static int RenderRegion(const std::vector<GRRect>& rects);
     static int Update();
     static int NotifyTouch(TOUCH_STATE state, int x, int y);
     static int NotifyKey(int key, bool down);
@@ -51,8 +51,7 @@ int GUIProgressBar::Render()
         return 0;
     }
 
-    // This handles making sure timing updates occur
-    Update();
+    // Timing updates happen in Update(), which is called before every frame
     return RenderInternal();
 }
 
@@ -142,9 +141,7 @@ int GUIProgressBar::Update()
 
     mLastPos = pos;
 
-    if (RenderInternal() != 0) {
-        return -1;
-    }
+    AddDamage();
     return 2;
 }
 
@@ -208,3 +205,12 @@ int GUIProgressBar::NotifyVarChange(const std::string& varName,
     }
     return 0;
 }
+
+int GUIProgressBar::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return 0;
+}
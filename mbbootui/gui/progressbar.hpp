@@ -38,6 +38,10 @@ public:
     //  Returns 0 on success, <0 on error
     virtual int NotifyVarChange(const std::string& varName, const std::string& value);
 
+    // GetDrawnRect - Returns the area that Render() draws to
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x, int& y, int& w, int& h);
+
 protected:
     ImageResource* mEmptyBar;
     ImageResource* mFullBar;
@@ -101,6 +101,33 @@ void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, in
     }
 }
 
+void Resource::LoadScaledImage(ZipArchive* pZip, const std::string& file,
+                               int retain_aspect, gr_surface* surface)
+{
+    gr_surface temp_surface = nullptr;
+    std::string key;
+
+    // Only images loaded from the theme directory can be validated against
+    // their source file, so images from zips are never cached
+    if (!pZip) {
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), "@%a,%a,%d",
+                 get_scale_w(), get_scale_h(), retain_aspect);
+        key = file + suffix;
+
+        if (res_cache_create_surface(file.c_str(), key.c_str(), surface) == 0) {
+            return;
+        }
+    }
+
+    LoadImage(pZip, file, &temp_surface);
+    CheckAndScaleImage(temp_surface, surface, retain_aspect);
+
+    if (!pZip && *surface) {
+        res_cache_add_surface(file.c_str(), key.c_str(), *surface);
+    }
+}
+
 FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
@@ -195,26 +222,41 @@ FontResource::~FontResource()
 ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
-    std::string file;
-    gr_surface temp_surface = nullptr;
-
     mSurface = nullptr;
+    mRetainAspect = 0;
+    mLoaded = true;
     if (!node) {
         LOGE("ImageResource node is NULL");
         return;
     }
 
     if (node->first_attribute("filename")) {
-        file = node->first_attribute("filename")->value();
+        mFile = node->first_attribute("filename")->value();
     } else {
         LOGE("No filename specified for image resource.");
         return;
     }
 
-    bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
+    mRetainAspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    LoadImage(pZip, file, &temp_surface);
-    CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+
+    // The zip is closed once the theme is loaded, so images from zips can't
+    // be loaded lazily
+    if (pZip) {
+        LoadScaledImage(pZip, mFile, mRetainAspect, &mSurface);
+    } else {
+        mLoaded = false;
+    }
+}
+
+void ImageResource::Load()
+{
+    if (mLoaded) {
+        return;
+    }
+    mLoaded = true;
+
+    LoadScaledImage(nullptr, mFile, mRetainAspect, &mSurface);
 }
 
 ImageResource::~ImageResource()
@@ -247,9 +289,8 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
         std::ostringstream fileName;
         fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-        gr_surface surface, temp_surface = nullptr;
-        LoadImage(pZip, fileName.str(), &temp_surface);
-        CheckAndScaleImage(temp_surface, &surface, retain_aspect);
+        gr_surface surface = nullptr;
+        LoadScaledImage(pZip, fileName.str(), retain_aspect, &surface);
         if (surface) {
             mSurfaces.push_back(surface);
             fileNum++;
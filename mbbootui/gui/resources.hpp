@@ -35,6 +35,8 @@ protected:
                           const std::string& file, gr_surface* surface);
     static void CheckAndScaleImage(gr_surface source, gr_surface* destination,
                                    int retain_aspect);
+    static void LoadScaledImage(ZipArchive* pZip, const std::string& file,
+                                int retain_aspect, gr_surface* surface);
 };
 
 class FontResource : public Resource
@@ -85,6 +87,7 @@ public:
 public:
     gr_surface GetResource()
     {
+        Load();
 #if 0
         return this ? mSurface : nullptr;
 #else
@@ -94,6 +97,7 @@ public:
 
     int GetWidth()
     {
+        Load();
 #if 0
         return gr_get_width(this ? mSurface : nullptr);
 #else
@@ -103,6 +107,7 @@ public:
 
     int GetHeight()
     {
+        Load();
 #if 0
         return gr_get_height(this ? mSurface : nullptr);
 #else
@@ -112,6 +117,14 @@ public:
 
 protected:
     gr_surface mSurface;
+
+private:
+    // Images from the theme directory are decoded on first use
+    void Load();
+
+    std::string mFile;
+    int mRetainAspect;
+    bool mLoaded;
 };
 
 class AnimationResource : public Resource
@@ -609,6 +609,15 @@ int GUIScrollList::SetRenderPos(int x, int y, int w /* = 0 */, int h /* = 0 */)
     return 0;
 }
 
+int GUIScrollList::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return 0;
+}
+
 void GUIScrollList::SetPageFocus(int inFocus)
 {
     if (inFocus) {
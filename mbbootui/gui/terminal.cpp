@@ -26,6 +26,7 @@
 
 #include <fcntl.h>
 #include <linux/input.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <termio.h>
 #include <unistd.h>
@@ -35,8 +36,15 @@
 #include "data.hpp"
 #include "variables.h"
 
+#include "gui/damage.hpp"
+
 #define LOG_TAG "mbbootui/gui/terminal"
 
+// Maximum number of bytes read from the pty per frame. Bursts of output are
+// drained in one go so that they cause a single render instead of one per
+// read, without letting a very chatty child stall the UI.
+#define PTY_READ_BUDGET (64 * 1024)
+
 #if 0
 #define debug_printf printf
 #else
@@ -134,6 +142,16 @@ public:
         return rc;
     }
 
+    // Returns true if a read would not block
+    bool readable()
+    {
+        if (!started()) {
+            return false;
+        }
+        struct pollfd fds = { fdMaster, POLLIN, 0 };
+        return poll(&fds, 1, 0) > 0 && (fds.revents & (POLLIN | POLLHUP));
+    }
+
     int write(const char* buffer, size_t size)
     {
         if (!started()) {
@@ -282,8 +300,9 @@ public:
     {
         std::string text; // in UTF-8 format
         //std::vector<AttributeRange> attrs;
+        unsigned revision; // changes whenever the line needs to be redrawn
 
-        Line() {}
+        Line() : revision(0) {}
 
         size_t utf8forward(size_t start) const
         {
@@ -358,6 +377,7 @@ public:
         width = 40;
         height = 10;
 
+        revisionCounter = 0;
         clear();
         updateCounter = 0;
         state = kStateGround;
@@ -386,16 +406,22 @@ public:
     void readPty()
     {
         char buffer[1024];
-        int rc = pty.read(buffer, sizeof(buffer));
-        debug_printf("readPty: %d bytes\n", rc);
-        if (rc < 0) {
-            output("\r\nChild process exited.\r\n");
-            // TODO: maybe exit terminal here
-        } else {
+        size_t total = 0;
+        do {
+            int rc = pty.read(buffer, sizeof(buffer));
+            debug_printf("readPty: %d bytes\n", rc);
+            if (rc < 0) {
+                output("\r\nChild process exited.\r\n");
+                // TODO: maybe exit terminal here
+                break;
+            } else if (rc == 0) {
+                break;
+            }
             for (int i = 0; i < rc; ++i) {
                 output(buffer[i]);
             }
-        }
+            total += rc;
+        } while (total < PTY_READ_BUDGET && pty.readable());
     }
 
     void clear()
@@ -501,6 +527,13 @@ public:
         return updateCounter;
     }
 
+    // Returns 0 for lines that don't exist. Existing lines never have a
+    // revision of 0.
+    unsigned getLineRevision(size_t n) const
+    {
+        return n < lines.size() ? lines[n].revision : 0;
+    }
+
     void setX(int x)
     {
         x = std::min(width, std::max(x, 0));
@@ -515,6 +548,7 @@ public:
         cursorY = y;
         while (lines.size() <= (size_t) y) {
             lines.push_back(Line());
+            lines.back().revision = ++revisionCounter;
         }
         ++updateCounter;
     }
@@ -540,6 +574,20 @@ public:
     }
 
 private:
+    void touchLine(size_t y)
+    {
+        if (y < lines.size()) {
+            lines[y].revision = ++revisionCounter;
+        }
+    }
+
+    void touchAllLines()
+    {
+        for (Line& line : lines) {
+            line.revision = ++revisionCounter;
+        }
+    }
+
     void packLine()
     {
         std::string& s = lines[unpackedY].text;
@@ -642,6 +690,7 @@ private:
             unpackedLine.cells.resize(cursorX + 1);
         }
         unpackedLine.cells[cursorX].cp = cp;
+        touchLine(cursorY);
 
         right();
         if (cursorX >= width) {
@@ -753,6 +802,7 @@ private:
             default:
             case 0:
                 unpackedLine.eraseFrom(cursorX);
+                touchLine(cursorY);
                 if (lines.size() > (size_t) cursorY + 1) {
                     lines.erase(lines.begin() + cursorY + 1, lines.end());
                 }
@@ -763,6 +813,8 @@ private:
                     lines.erase(lines.begin(), lines.begin() + cursorY - 1);
                     cursorY = 0;
                 }
+                // every line moved
+                touchAllLines();
                 break;
             case 2: // clear
             case 3: // clear incl scrollback
@@ -786,6 +838,7 @@ private:
                 unpackedLine.cells.clear();
                 break;
             }
+            touchLine(cursorY);
             break;
         }
         // case 'L': // IL - insert line
@@ -803,6 +856,7 @@ private:
     UnpackedLine unpackedLine; // current line for editing
     size_t unpackedY; // number of current line
     int updateCounter; // changes whenever terminal could require redraw
+    unsigned revisionCounter; // source of line revisions
 
     Pseudoterminal pty;
     enum { kStateGround, kStateEsc, kStateCsi } state;
@@ -838,6 +892,10 @@ GUITerminal::GUITerminal(xml_node<>* node) : GUIScrollList(node)
 
     engine = &gEngine;
     updateCounter = 0;
+    renderedValid = false;
+    renderedFirst = renderedOffset = 0;
+    renderedCount = 0;
+    renderedCursorX = renderedCursorY = -1;
 }
 
 int GUITerminal::Update()
@@ -851,6 +909,8 @@ int GUITerminal::Update()
         lastCondition = true;
         // we're becoming visible, so we might need to resize the terminal content
         InitAndResize();
+        renderedValid = false;
+        mUpdate = 1;
     }
 
     if (updateCounter != engine->getUpdateCounter()) {
@@ -863,13 +923,64 @@ int GUITerminal::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
+        if (AddLineDamage()) {
             return 2;
         }
     }
     return 0;
 }
 
+// AddLineDamage - Mark the lines that changed since the last render as damaged
+//  Return true if anything needs to be redrawn
+bool GUITerminal::AddLineDamage()
+{
+    size_t count = GetItemCount();
+    size_t lines = GetDisplayItemCount() + 2;
+    int cursorX = engine->getCursorX();
+    int cursorY = engine->getCursorY();
+    bool damaged = false;
+    bool lineDamaged = false;
+
+    // Scrolling moves every line, the scrollbar changes whenever the number
+    // of lines changes, and the separators move when the scrollbar appears
+    if (!renderedValid || renderedFirst != firstDisplayedItem
+            || renderedOffset != y_offset || renderedCount != count) {
+        AddDamage();
+        damaged = true;
+    }
+
+    renderedRevisions.resize(lines);
+
+    for (size_t line = 0; line < lines; ++line) {
+        size_t itemindex = line + firstDisplayedItem;
+        unsigned revision = engine->getLineRevision(itemindex);
+        bool hasCursor = (int) itemindex == cursorY || (int) itemindex == renderedCursorY;
+        bool cursorMoved = cursorX != renderedCursorX || cursorY != renderedCursorY;
+
+        if (!damaged && (renderedRevisions[line] != revision
+                || (hasCursor && cursorMoved))) {
+            int yPos = mRenderY + mHeaderH + y_offset + (int) line * actualItemHeight;
+            int top = std::max(yPos, mRenderY + mHeaderH);
+            int bottom = std::min(yPos + actualItemHeight, mRenderY + mRenderH);
+            if (bottom > top) {
+                Damage::Add(mRenderX, top, mRenderW, bottom - top);
+                lineDamaged = true;
+            }
+        }
+
+        renderedRevisions[line] = revision;
+    }
+
+    renderedValid = true;
+    renderedFirst = firstDisplayedItem;
+    renderedOffset = y_offset;
+    renderedCount = count;
+    renderedCursorX = cursorX;
+    renderedCursorY = cursorY;
+
+    return damaged || lineDamaged;
+}
+
 // NotifyTouch - Notify of a touch event
 //  Return 0 on success, >0 to ignore remainder of touch, and <0 on error
 int GUITerminal::NotifyTouch(TOUCH_STATE state, int x, int y)
@@ -962,5 +1073,6 @@ void GUITerminal::SetPageFocus(int inFocus)
         // It's highly unlikely that there will be any other visible input elements on the page anyway...
         SetInputFocus(1);
         InitAndResize();
+        renderedValid = false;
     }
 }
@@ -52,8 +52,18 @@ public:
 
 protected:
     void InitAndResize();
+    bool AddLineDamage();
 
     TerminalEngine* engine; // non-visual parts of the terminal (text buffer etc.), not owned
     int updateCounter; // to track if anything changed in the back-end
     bool lastCondition; // to track if the condition became true and we might need to resize the terminal engine
+
+    // State of the last render, used to only redraw lines that changed
+    bool renderedValid;
+    int renderedFirst; // firstDisplayedItem
+    int renderedOffset; // y_offset
+    size_t renderedCount; // number of lines in the engine
+    int renderedCursorX;
+    int renderedCursorY;
+    std::vector<unsigned> renderedRevisions; // per visible line slot
 };
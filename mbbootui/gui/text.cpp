@@ -20,6 +20,8 @@
 
 #include "gui/text.hpp"
 
+#include <algorithm>
+
 GUIText::GUIText(xml_node<>* node) : GUIObject(node)
 {
     mFont = nullptr;
@@ -142,7 +144,10 @@ int GUIText::Update()
     if (mLastValue == newValue) {
         return 0;
     } else {
+        // Both the old and the new text need to be redrawn
+        AddDamage();
         mLastValue = newValue;
+        AddDamage();
     }
     return 2;
 }
@@ -161,6 +166,48 @@ int GUIText::GetCurrentBounds(int& w, int& h)
     return 0;
 }
 
+int GUIText::GetDrawnRect(int& x, int& y, int& w, int& h)
+{
+    if (!mFont || !mFont->GetResource()) {
+        return -1;
+    }
+
+    void* fontResource = mFont->GetResource();
+
+    // Mirror the placement calculations in gr_textEx_scaleW(). Scaling only
+    // ever shrinks the text, so the unscaled measurement is an upper bound.
+    int measured = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
+    int height = gr_ttf_getMaxFontHeight(fontResource);
+    int x_adj = std::min(measured, static_cast<int>(maxWidth));
+
+    x = mRenderX;
+    y = mRenderY;
+
+    if (mPlacement != TOP_LEFT && mPlacement != BOTTOM_LEFT
+            && mPlacement != TEXT_ONLY_RIGHT) {
+        if (mPlacement == CENTER || mPlacement == CENTER_X_ONLY) {
+            x -= x_adj / 2;
+        } else {
+            x -= x_adj;
+        }
+    }
+
+    if (mPlacement != TOP_LEFT && mPlacement != TOP_RIGHT) {
+        if (mPlacement == CENTER || mPlacement == TEXT_ONLY_RIGHT) {
+            y -= height / 2;
+        } else if (mPlacement == BOTTOM_LEFT || mPlacement == BOTTOM_RIGHT) {
+            y -= height;
+        }
+    }
+
+    // Leave some room for glyphs that extend past their advance width
+    x -= 2;
+    y -= 2;
+    w = measured + 4;
+    h = height + 4;
+    return 0;
+}
+
 int GUIText::NotifyVarChange(const std::string& varName, const std::string& value)
 {
     GUIObject::NotifyVarChange(varName, value);
@@ -40,6 +40,10 @@ public:
     // Retrieve the size of the current string (dynamic strings may change per call)
     virtual int GetCurrentBounds(int& w, int& h);
 
+    // GetDrawnRect - Returns the area that Render() draws to
+    //  Return 0 on success, <0 if the area is unknown
+    virtual int GetDrawnRect(int& x, int& y, int& w, int& h);
+
     // Notify of a variable change
     virtual int NotifyVarChange(const std::string& varName, const std::string& value);
 
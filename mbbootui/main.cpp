@@ -51,6 +51,8 @@
 
 #include "config/config.hpp"
 
+#include "minuitwrp/minui.h"
+
 #define LOG_TAG "mbbootui/main"
 
 #define APPEND_TO_LOG               1
@@ -61,6 +63,8 @@
 #define MBBOOTUI_LOG_PATH           MBBOOTUI_BASE_PATH "/exec.log"
 #define MBBOOTUI_SCREENSHOTS_PATH   MBBOOTUI_BASE_PATH "/screenshots";
 #define MBBOOTUI_SETTINGS_PATH      MBBOOTUI_BASE_PATH "/settings.bin"
+#define MBBOOTUI_FONT_CACHE_PATH    MBBOOTUI_BASE_PATH "/fonts"
+#define MBBOOTUI_SURFACE_CACHE_PATH MBBOOTUI_BASE_PATH "/surfaces.bin"
 
 #define MBBOOTUI_RUNTIME_PATH       "/mbbootui"
 #define MBBOOTUI_THEME_PATH         MBBOOTUI_RUNTIME_PATH "/theme"
@@ -418,6 +422,7 @@ int main(int argc, char *argv[])
     tw_resource_path = MBBOOTUI_THEME_PATH;
     tw_settings_path = MBBOOTUI_SETTINGS_PATH;
     tw_screenshots_path = MBBOOTUI_SCREENSHOTS_PATH;
+    gr_ttf_set_cache_dir(MBBOOTUI_FONT_CACHE_PATH);
     // Disallow custom themes, which could manipulate variables in such as way
     // as to execute malicious code
     tw_theme_zip_path = "";
@@ -450,6 +455,10 @@ int main(int argc, char *argv[])
     }
     mbtool_interface = mbtool_connection.interface();
 
+    // Fetch the ROM list in the background while the GUI loads
+    mbtool_queue.start(mbtool_interface);
+    mbtool_queue.get_installed_roms();
+
     LOGV("Loading default values...");
     DataManager::SetDefaultValues();
 
@@ -464,6 +473,9 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Decoded theme images from the previous boot
+    res_cache_init(MBBOOTUI_SURFACE_CACHE_PATH);
+
     LOGV("Loading resources...");
     gui_loadResources();
 
@@ -491,6 +503,8 @@ int main(int argc, char *argv[])
     //gui_start();
     gui_startPage("autoboot", 1, 0);
 
+    mbtool_queue.stop();
+
     // Exit action
     std::string exit_action;
     DataManager::GetValue(VAR_TW_EXIT_ACTION, exit_action);
@@ -15,7 +15,9 @@
  */
 
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,6 +54,19 @@ static drmModeConnector *main_monitor_connector;
 
 static int drm_fd = -1;
 
+// Page flips complete asynchronously. A buffer must not be drawn into until
+// the flip away from it has completed.
+static bool flip_pending = false;
+
+// Atomic modesetting state. If the driver doesn't support it, the legacy
+// page flip ioctl is used instead.
+static bool atomic_supported = false;
+static uint32_t primary_plane_id;
+static uint32_t plane_fb_id_prop;
+
+// How long to wait for a flip before assuming the event was lost
+#define FLIP_TIMEOUT_MS 100
+
 static void drm_disable_crtc(int drm_fd, drmModeCrtc *crtc)
 {
     if (crtc) {
@@ -81,8 +96,57 @@ static void drm_enable_crtc(int drm_fd, drmModeCrtc *crtc,
     }
 }
 
-static void drm_blank(minui_backend* backend __unused, bool blank)
+static void page_flip_handler(int fd __unused, unsigned int sequence __unused,
+                              unsigned int tv_sec __unused,
+                              unsigned int tv_usec __unused,
+                              void *user_data __unused)
+{
+    flip_pending = false;
+}
+
+// Process flip completion events until no flip is pending. Returns false if
+// timeout_ms elapses first.
+static bool drm_wait_flip(minui_backend* backend __unused, int timeout_ms)
 {
+    drmEventContext evctx;
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = 2;
+    evctx.page_flip_handler = page_flip_handler;
+
+    while (flip_pending) {
+        struct pollfd pfd;
+        pfd.fd = drm_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            return false;
+        }
+
+        if (drmHandleEvent(drm_fd, &evctx) != 0) {
+            printf("drmHandleEvent failed: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void drm_finish_flip(minui_backend* backend)
+{
+    if (!drm_wait_flip(backend, FLIP_TIMEOUT_MS)) {
+        printf("Timed out waiting for page flip\n");
+        flip_pending = false;
+    }
+}
+
+static void drm_blank(minui_backend* backend, bool blank)
+{
+    drm_finish_flip(backend);
+
     if (blank) {
         drm_disable_crtc(drm_fd, main_monitor_crtc);
     } else {
@@ -390,6 +454,98 @@ static void disable_non_main_crtcs(int fd,
     }
 }
 
+static uint32_t find_plane_property(int fd, uint32_t plane_id,
+                                    const char *name, uint64_t *value)
+{
+    drmModeObjectProperties *props;
+    uint32_t prop_id = 0;
+
+    props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+    if (!props) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < props->count_props && !prop_id; ++i) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop) {
+            continue;
+        }
+        if (strcmp(prop->name, name) == 0) {
+            prop_id = prop->prop_id;
+            if (value) {
+                *value = props->prop_values[i];
+            }
+        }
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return prop_id;
+}
+
+// Find the primary plane of the CRTC so that flips can be done with atomic
+// commits
+static bool setup_atomic(int fd, drmModeRes *resources, drmModeCrtc *crtc)
+{
+    drmModePlaneRes *plane_res;
+    int crtc_index = -1;
+    bool found = false;
+
+    for (int i = 0; i < resources->count_crtcs; i++) {
+        if (resources->crtcs[i] == crtc->crtc_id) {
+            crtc_index = i;
+            break;
+        }
+    }
+    if (crtc_index < 0) {
+        return false;
+    }
+
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+        printf("Atomic modesetting not supported\n");
+        return false;
+    }
+
+    plane_res = drmModeGetPlaneResources(fd);
+    if (!plane_res) {
+        drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 0);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < plane_res->count_planes && !found; ++i) {
+        drmModePlane *plane = drmModeGetPlane(fd, plane_res->planes[i]);
+        uint64_t type;
+
+        if (!plane) {
+            continue;
+        }
+
+        if ((plane->possible_crtcs & (1u << crtc_index))
+                && find_plane_property(fd, plane->plane_id, "type", &type)
+                && type == DRM_PLANE_TYPE_PRIMARY) {
+            plane_fb_id_prop = find_plane_property(
+                    fd, plane->plane_id, "FB_ID", nullptr);
+            if (plane_fb_id_prop) {
+                primary_plane_id = plane->plane_id;
+                found = true;
+            }
+        }
+
+        drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(plane_res);
+
+    if (!found) {
+        printf("No primary plane found for atomic modesetting\n");
+        drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 0);
+        return false;
+    }
+
+    printf("Using atomic modesetting (plane %u)\n", primary_plane_id);
+    return true;
+}
+
 static GRSurface* drm_init(minui_backend* backend __unused)
 {
     drmModeRes *res = nullptr;
@@ -471,6 +627,8 @@ static GRSurface* drm_init(minui_backend* backend __unused)
     width = main_monitor_crtc->mode.hdisplay;
     height = main_monitor_crtc->mode.vdisplay;
 
+    atomic_supported = setup_atomic(drm_fd, res, main_monitor_crtc);
+
     drmModeFreeResources(res);
 
     drm_surfaces[0] = drm_create_surface(width, height);
@@ -490,22 +648,94 @@ static GRSurface* drm_init(minui_backend* backend __unused)
     return &(drm_surfaces[0]->base);
 }
 
-static GRSurface* drm_flip(minui_backend* backend __unused)
+static int drm_atomic_flip(uint32_t fb_id)
 {
+    drmModeAtomicReq *req;
     int ret;
 
-    ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
-                          drm_surfaces[current_buffer]->fb_id, 0, nullptr);
+    req = drmModeAtomicAlloc();
+    if (!req) {
+        return -ENOMEM;
+    }
+
+    ret = drmModeAtomicAddProperty(req, primary_plane_id, plane_fb_id_prop,
+                                   fb_id);
+    if (ret >= 0) {
+        ret = drmModeAtomicCommit(drm_fd, req,
+                                  DRM_MODE_PAGE_FLIP_EVENT
+                                  | DRM_MODE_ATOMIC_NONBLOCK, nullptr);
+    }
+
+    drmModeAtomicFree(req);
+    return ret;
+}
+
+static GRSurface* drm_flip(minui_backend* backend)
+{
+    uint32_t fb_id = drm_surfaces[current_buffer]->fb_id;
+    int ret = -1;
+
+    // Only one flip can be queued at a time
+    drm_finish_flip(backend);
+
+    if (atomic_supported) {
+        ret = drm_atomic_flip(fb_id);
+        if (ret < 0) {
+            printf("Atomic commit failed ret=%d, using legacy flips\n", ret);
+            atomic_supported = false;
+        }
+    }
+    if (!atomic_supported) {
+        ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id, fb_id,
+                              DRM_MODE_PAGE_FLIP_EVENT, nullptr);
+    }
     if (ret < 0) {
         printf("drmModePageFlip failed ret=%d\n", ret);
         return nullptr;
     }
+
+    flip_pending = true;
     current_buffer = 1 - current_buffer;
     return &(drm_surfaces[current_buffer]->base);
 }
 
-static void drm_exit(minui_backend* backend __unused)
+static GRSurface* drm_flip_rects(minui_backend* backend,
+                                 const GRRect* rects, int count)
+{
+    static bool dirty_fb_supported = true;
+
+    // Hint which regions changed for drivers that need to flush manually
+    if (dirty_fb_supported) {
+        drmModeClip clips[GR_MAX_FLIP_RECTS];
+        int n = 0;
+
+        for (int i = 0; i < count && i < GR_MAX_FLIP_RECTS; ++i) {
+            clips[n].x1 = static_cast<unsigned short>(rects[i].x);
+            clips[n].y1 = static_cast<unsigned short>(rects[i].y);
+            clips[n].x2 = static_cast<unsigned short>(rects[i].x + rects[i].w);
+            clips[n].y2 = static_cast<unsigned short>(rects[i].y + rects[i].h);
+            ++n;
+        }
+
+        int ret = drmModeDirtyFB(drm_fd, drm_surfaces[current_buffer]->fb_id,
+                                 clips, n);
+        if (ret == -ENOSYS || ret == -EINVAL) {
+            dirty_fb_supported = false;
+        }
+    }
+
+    return drm_flip(backend);
+}
+
+static int drm_buffer_age(minui_backend* backend __unused)
+{
+    // Drawing alternates between the two buffers
+    return 2;
+}
+
+static void drm_exit(minui_backend* backend)
 {
+    drm_finish_flip(backend);
     drm_disable_crtc(drm_fd, main_monitor_crtc);
     drm_destroy_surface(drm_surfaces[0]);
     drm_destroy_surface(drm_surfaces[1]);
@@ -520,6 +750,9 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .flip_rects = drm_flip_rects,
+    .buffer_age = drm_buffer_age,
+    .wait_flip = drm_wait_flip,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(drm)() {
@@ -32,6 +32,7 @@
 
 #include "backend/backend.h"
 #include "backend/backend.gen.h"
+#include "blitter.h"
 #include "config/config.hpp"
 #include "minui.h"
 #include "graphics.h"
@@ -41,6 +42,8 @@ static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static GRSurface* fbdev_flip_rects(minui_backend*, const GRRect*, int);
+static int fbdev_buffer_age(minui_backend*);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
@@ -51,11 +54,18 @@ static fb_var_screeninfo vi;
 static int fb_fd = -1;
 static __u32 smem_len;
 
+// Regions changed by the previous flip. When double buffered, the buffer that
+// is about to be drawn doesn't have these changes yet.
+static GRRect prev_rects[GR_MAX_FLIP_RECTS];
+static int prev_rect_count;
+
 static minui_backend my_backend = {
     .init = fbdev_init,
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .flip_rects = fbdev_flip_rects,
+    .buffer_age = fbdev_buffer_age,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(fbdev)()
@@ -275,19 +285,32 @@ static GRSurface* fbdev_init(minui_backend* backend)
     return gr_draw;
 }
 
+static void set_prev_rects_full()
+{
+    prev_rects[0].x = 0;
+    prev_rects[0].y = 0;
+    prev_rects[0].w = gr_draw->width;
+    prev_rects[0].h = gr_draw->height;
+    prev_rect_count = 1;
+}
+
+// Partial updates only work if the in-memory surface is never modified during
+// a flip
+static bool can_flip_partial()
+{
+    return tw_device.tw_pixel_format() != mb::device::TwPixelFormat::Bgra8888
+            && !(tw_device.tw_flags()
+                    & mb::device::TwFlag::BoardHasFlippedScreen);
+}
+
 static GRSurface* fbdev_flip(minui_backend* backend __unused)
 {
+    set_prev_rects_full();
+
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         // In case of BGRA, do some byte swapping
-        unsigned int idx;
-        unsigned char tmp;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-                idx += 4) {
-            tmp = ucfb_vaddr[idx];
-            ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-            ucfb_vaddr[idx + 2] = tmp;
-        }
+        gr_get_blitter()->swap_rb(gr_draw->data, gr_draw->data,
+                                  gr_draw->height * gr_draw->row_bytes / 4);
     }
     if (!(tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)) {
         if (double_buffered) {
@@ -333,6 +356,37 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
     return gr_draw;
 }
 
+static GRSurface* fbdev_flip_rects(minui_backend* backend,
+                                   const GRRect* rects, int count)
+{
+    if (!can_flip_partial()) {
+        return fbdev_flip(backend);
+    }
+
+    if (double_buffered) {
+        GRSurface* fb = &gr_framebuffer[1-displayed_buffer];
+
+        // Copy only what changed in the last two frames from the in-memory
+        // surface to the back buffer
+        gr_copy_rects(fb, gr_draw, prev_rects, prev_rect_count);
+        gr_copy_rects(fb, gr_draw, rects, count);
+        set_displayed_framebuffer(1-displayed_buffer);
+    } else {
+        gr_copy_rects(&gr_framebuffer[0], gr_draw, rects, count);
+    }
+
+    memcpy(prev_rects, rects, count * sizeof(GRRect));
+    prev_rect_count = count;
+
+    return gr_draw;
+}
+
+static int fbdev_buffer_age(minui_backend* backend __unused)
+{
+    // Drawing always happens in the same in-memory surface
+    return can_flip_partial() ? 1 : 0;
+}
+
 static void fbdev_exit(minui_backend* backend __unused)
 {
     close(fb_fd);
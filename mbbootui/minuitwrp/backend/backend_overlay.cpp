@@ -38,6 +38,7 @@
 
 #include "backend/backend.h"
 #include "backend/backend.gen.h"
+#include "blitter.h"
 #include "config/config.hpp"
 #include "minui.h"
 #include "graphics.h"
@@ -50,6 +51,8 @@ static GRSurface* overlay_init(minui_backend*);
 static GRSurface* overlay_flip(minui_backend*);
 static void overlay_blank(minui_backend*, bool);
 static void overlay_exit(minui_backend*);
+static GRSurface* overlay_flip_rects(minui_backend*, const GRRect*, int);
+static int overlay_buffer_age(minui_backend*);
 
 static GRSurface gr_framebuffer;
 static GRSurface* gr_draw = nullptr;
@@ -100,6 +103,8 @@ static minui_backend my_backend = {
     .flip = overlay_flip,
     .blank = overlay_blank,
     .exit = overlay_exit,
+    .flip_rects = overlay_flip_rects,
+    .buffer_age = overlay_buffer_age,
 };
 
 bool target_has_overlay(char *version)
@@ -440,20 +445,14 @@ int allocate_overlay(int fd, GRSurface gr_fb)
     return 0;
 }
 
-int overlay_display_frame(int fd, void* data, size_t size)
+// Display the contents of the ION buffer
+static int overlay_play_frame(int fd)
 {
     int ret = 0;
     struct msmfb_overlay_data ovdataL, ovdataR;
     struct mdp_display_commit ext_commit;
 
     if (!isDisplaySplit()) {
-        if (overlayL_id == MSMFB_NEW_REQUEST) {
-            perror("display_frame failed, no overlay\n");
-            return -EINVAL;
-        }
-
-        memcpy(mem_info.mem_buf, data, size);
-
         memset(&ovdataL, 0, sizeof(struct msmfb_overlay_data));
 
         ovdataL.id = overlayL_id;
@@ -467,14 +466,6 @@ int overlay_display_frame(int fd, void* data, size_t size)
             return ret;
         }
     } else {
-
-        if (overlayL_id == MSMFB_NEW_REQUEST) {
-            perror("display_frame failed, no overlayL \n");
-            return -EINVAL;
-        }
-
-        memcpy(mem_info.mem_buf, data, size);
-
         memset(&ovdataL, 0, sizeof(struct msmfb_overlay_data));
 
         ovdataL.id = overlayL_id;
@@ -514,25 +505,67 @@ int overlay_display_frame(int fd, void* data, size_t size)
     return ret;
 }
 
+int overlay_display_frame(int fd, void* data, size_t size)
+{
+    if (overlayL_id == MSMFB_NEW_REQUEST) {
+        perror("display_frame failed, no overlay\n");
+        return -EINVAL;
+    }
+
+    memcpy(mem_info.mem_buf, data, size);
+
+    return overlay_play_frame(fd);
+}
+
+// Like overlay_display_frame(), but only copies the given regions
+static int overlay_display_frame_rects(int fd, GRSurface* src,
+                                       const GRRect* rects, int count)
+{
+    if (overlayL_id == MSMFB_NEW_REQUEST) {
+        perror("display_frame failed, no overlay\n");
+        return -EINVAL;
+    }
+
+    GRSurface dst = *src;
+    dst.data = mem_info.mem_buf;
+    gr_copy_rects(&dst, src, rects, count);
+
+    return overlay_play_frame(fd);
+}
+
 static GRSurface* overlay_flip(minui_backend* backend __unused)
 {
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         // In case of BGRA, do some byte swapping
-        unsigned int idx;
-        unsigned char tmp;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-                idx += 4) {
-            tmp = ucfb_vaddr[idx];
-            ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-            ucfb_vaddr[idx + 2] = tmp;
-        }
+        gr_get_blitter()->swap_rb(gr_draw->data, gr_draw->data,
+                                  gr_draw->height * gr_draw->row_bytes / 4);
     }
     // Copy from the in-memory surface to the framebuffer.
     overlay_display_frame(fb_fd, gr_draw->data, frame_size);
     return gr_draw;
 }
 
+static GRSurface* overlay_flip_rects(minui_backend* backend,
+                                     const GRRect* rects, int count)
+{
+    // The in-memory surface is byte swapped in place for BGRA
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return overlay_flip(backend);
+    }
+
+    overlay_display_frame_rects(fb_fd, gr_draw, rects, count);
+    return gr_draw;
+}
+
+static int overlay_buffer_age(minui_backend* backend __unused)
+{
+    // The ION buffer always holds the last frame
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return 0;
+    }
+    return 1;
+}
+
 int free_overlay(int fd)
 {
     int ret = 0;
@@ -694,6 +727,18 @@ static GRSurface* overlay_flip(minui_backend* backend __unused)
     return nullptr;
 }
 
+static GRSurface* overlay_flip_rects(minui_backend* backend __unused,
+                                     const GRRect* rects __unused,
+                                     int count __unused)
+{
+    return nullptr;
+}
+
+static int overlay_buffer_age(minui_backend* backend __unused)
+{
+    return 0;
+}
+
 static GRSurface* overlay_init(minui_backend* backend __unused)
 {
     return nullptr;
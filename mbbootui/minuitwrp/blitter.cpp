@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "blitter.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__arm__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#endif
+
+// (x + 127) / 255 without a division, exact for x <= 255 * 255
+static inline uint8_t div255(uint32_t x)
+{
+    x += 128;
+    return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+}
+
+static inline uint8_t blend_channel(uint8_t s, uint8_t d, uint8_t a)
+{
+    return div255(static_cast<uint32_t>(s) * a
+            + static_cast<uint32_t>(d) * (255u - a));
+}
+
+void gr_blit_fill_scalar(uint8_t* dst, const uint8_t color[4], size_t count)
+{
+    uint32_t px;
+    memcpy(&px, color, sizeof(px));
+
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(dst + i * 4, &px, sizeof(px));
+    }
+}
+
+void gr_blit_fill_blend_scalar(uint8_t* dst, const uint8_t color[4],
+                               size_t count)
+{
+    uint8_t a = color[3];
+
+    for (size_t i = 0; i < count; ++i, dst += 4) {
+        dst[0] = blend_channel(color[0], dst[0], a);
+        dst[1] = blend_channel(color[1], dst[1], a);
+        dst[2] = blend_channel(color[2], dst[2], a);
+        dst[3] = blend_channel(color[3], dst[3], a);
+    }
+}
+
+template<bool Swap>
+static void blend_scalar(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, dst += 4, src += 4) {
+        uint8_t a = src[3];
+
+        if (a == 0) {
+            continue;
+        } else if (a == 255) {
+            dst[0] = src[Swap ? 2 : 0];
+            dst[1] = src[1];
+            dst[2] = src[Swap ? 0 : 2];
+            dst[3] = 255;
+        } else {
+            dst[0] = blend_channel(src[Swap ? 2 : 0], dst[0], a);
+            dst[1] = blend_channel(src[1], dst[1], a);
+            dst[2] = blend_channel(src[Swap ? 0 : 2], dst[2], a);
+            dst[3] = blend_channel(a, dst[3], a);
+        }
+    }
+}
+
+void gr_blit_blend_scalar(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    blend_scalar<false>(dst, src, count);
+}
+
+void gr_blit_blend_swap_scalar(uint8_t* dst, const uint8_t* src,
+                               size_t count)
+{
+    blend_scalar<true>(dst, src, count);
+}
+
+void gr_blit_blend_mask_scalar(uint8_t* dst, const uint8_t* mask,
+                               const uint8_t color[4], size_t count)
+{
+    for (size_t i = 0; i < count; ++i, dst += 4) {
+        uint8_t m = mask[i];
+
+        if (m == 0) {
+            continue;
+        }
+
+        dst[0] = blend_channel(color[0], dst[0], m);
+        dst[1] = blend_channel(color[1], dst[1], m);
+        dst[2] = blend_channel(color[2], dst[2], m);
+        dst[3] = blend_channel(m, dst[3], m);
+    }
+}
+
+void gr_blit_swap_rb_scalar(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, dst += 4, src += 4) {
+        uint8_t tmp = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = tmp;
+        dst[3] = src[3];
+    }
+}
+
+void gr_blit_rgb_to_rgbx_scalar(uint8_t* dst, const uint8_t* src,
+                                size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        *dst++ = *src++;
+        *dst++ = *src++;
+        *dst++ = *src++;
+        *dst++ = 0xff;
+    }
+}
+
+void gr_blit_gray_to_rgbx_scalar(uint8_t* dst, const uint8_t* src,
+                                 size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        *dst++ = src[i];
+        *dst++ = src[i];
+        *dst++ = src[i];
+        *dst++ = 0xff;
+    }
+}
+
+static const gr_blitter blitter_scalar = {
+    .name = "scalar",
+    .fill = gr_blit_fill_scalar,
+    .fill_blend = gr_blit_fill_blend_scalar,
+    .blend = gr_blit_blend_scalar,
+    .blend_swap = gr_blit_blend_swap_scalar,
+    .blend_mask = gr_blit_blend_mask_scalar,
+    .swap_rb = gr_blit_swap_rb_scalar,
+    .rgb_to_rgbx = gr_blit_rgb_to_rgbx_scalar,
+    .gray_to_rgbx = gr_blit_gray_to_rgbx_scalar,
+};
+
+static const gr_blitter* select_blitter()
+{
+    if (gr_blitter_neon) {
+#if defined(__arm__)
+        // NEON is optional on ARMv7
+        if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+            return gr_blitter_neon;
+        }
+#else
+        return gr_blitter_neon;
+#endif
+    }
+
+    if (gr_blitter_sse2) {
+#if defined(__i386__)
+        if (__builtin_cpu_supports("sse2")) {
+            return gr_blitter_sse2;
+        }
+#else
+        return gr_blitter_sse2;
+#endif
+    }
+
+    return &blitter_scalar;
+}
+
+const gr_blitter* gr_get_blitter()
+{
+    static const gr_blitter* blitter = [] {
+        const gr_blitter* b = select_blitter();
+        printf("Using %s blitter\n", b->name);
+        return b;
+    }();
+
+    return blitter;
+}
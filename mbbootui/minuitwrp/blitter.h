@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Row kernels for drawing into 32bpp surfaces. Pixels are 4 bytes with the
+// alpha (or unused) channel in the last byte. Blending uses the same equation
+// as pixelflinger with GGL_SRC_ALPHA and GGL_ONE_MINUS_SRC_ALPHA.
+struct gr_blitter
+{
+    const char* name;
+
+    // dst = color
+    void (*fill)(uint8_t* dst, const uint8_t color[4], size_t count);
+
+    // dst = color * color[3] + dst * (255 - color[3])
+    void (*fill_blend)(uint8_t* dst, const uint8_t color[4], size_t count);
+
+    // dst = src * src[3] + dst * (255 - src[3])
+    void (*blend)(uint8_t* dst, const uint8_t* src, size_t count);
+
+    // Like blend(), but swaps bytes 0 and 2 of each source pixel first
+    void (*blend_swap)(uint8_t* dst, const uint8_t* src, size_t count);
+
+    // dst = color * mask + dst * (255 - mask), where the alpha channel of
+    // color is replaced by mask
+    void (*blend_mask)(uint8_t* dst, const uint8_t* mask,
+                       const uint8_t color[4], size_t count);
+
+    // dst = src with bytes 0 and 2 of each pixel swapped. dst may equal src.
+    void (*swap_rb)(uint8_t* dst, const uint8_t* src, size_t count);
+
+    // Expand 24-bit RGB to 32-bit RGBX
+    void (*rgb_to_rgbx)(uint8_t* dst, const uint8_t* src, size_t count);
+
+    // Expand 8-bit grayscale to 32-bit RGBX
+    void (*gray_to_rgbx)(uint8_t* dst, const uint8_t* src, size_t count);
+};
+
+// Kernels for the current CPU. The best implementation is detected on the
+// first call.
+const gr_blitter* gr_get_blitter();
+
+// Architecture-specific implementations. These are null if not compiled in.
+extern const gr_blitter* const gr_blitter_neon;
+extern const gr_blitter* const gr_blitter_sse2;
+
+// Scalar implementations, also used by the SIMD kernels for the tail of
+// each row
+void gr_blit_fill_scalar(uint8_t* dst, const uint8_t color[4], size_t count);
+void gr_blit_fill_blend_scalar(uint8_t* dst, const uint8_t color[4],
+                               size_t count);
+void gr_blit_blend_scalar(uint8_t* dst, const uint8_t* src, size_t count);
+void gr_blit_blend_swap_scalar(uint8_t* dst, const uint8_t* src,
+                               size_t count);
+void gr_blit_blend_mask_scalar(uint8_t* dst, const uint8_t* mask,
+                               const uint8_t color[4], size_t count);
+void gr_blit_swap_rb_scalar(uint8_t* dst, const uint8_t* src, size_t count);
+void gr_blit_rgb_to_rgbx_scalar(uint8_t* dst, const uint8_t* src,
+                                size_t count);
+void gr_blit_gray_to_rgbx_scalar(uint8_t* dst, const uint8_t* src,
+                                 size_t count);
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "blitter.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <cstring>
+
+#include <arm_neon.h>
+
+// Same rounding as div255() in blitter.cpp, for 8 lanes
+static inline uint8x8_t div255_u16(uint16x8_t x)
+{
+    return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+
+static inline uint8x8_t blend_u8(uint8x8_t s, uint8x8_t d, uint8x8_t a,
+                                 uint8x8_t ia)
+{
+    return div255_u16(vmlal_u8(vmull_u8(s, a), d, ia));
+}
+
+static void fill_neon(uint8_t* dst, const uint8_t color[4], size_t count)
+{
+    uint32_t px;
+    memcpy(&px, color, sizeof(px));
+    uint32x4_t v = vdupq_n_u32(px);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        vst1q_u32(reinterpret_cast<uint32_t*>(dst + i * 4), v);
+        vst1q_u32(reinterpret_cast<uint32_t*>(dst + i * 4 + 16), v);
+    }
+    gr_blit_fill_scalar(dst + i * 4, color, count - i);
+}
+
+static void fill_blend_neon(uint8_t* dst, const uint8_t color[4],
+                            size_t count)
+{
+    uint8x8_t a = vdup_n_u8(color[3]);
+    uint8x8_t ia = vmvn_u8(a);
+    uint16x8_t c[4];
+
+    for (int j = 0; j < 4; ++j) {
+        c[j] = vmull_u8(vdup_n_u8(color[j]), a);
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t d = vld4_u8(dst + i * 4);
+        for (int j = 0; j < 4; ++j) {
+            d.val[j] = div255_u16(vmlal_u8(c[j], d.val[j], ia));
+        }
+        vst4_u8(dst + i * 4, d);
+    }
+    gr_blit_fill_blend_scalar(dst + i * 4, color, count - i);
+}
+
+template<bool Swap>
+static void blend_neon(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8(src + i * 4);
+        uint8x8x4_t d = vld4_u8(dst + i * 4);
+        uint8x8_t a = s.val[3];
+        uint8x8_t ia = vmvn_u8(a);
+
+        d.val[0] = blend_u8(s.val[Swap ? 2 : 0], d.val[0], a, ia);
+        d.val[1] = blend_u8(s.val[1], d.val[1], a, ia);
+        d.val[2] = blend_u8(s.val[Swap ? 0 : 2], d.val[2], a, ia);
+        d.val[3] = blend_u8(a, d.val[3], a, ia);
+        vst4_u8(dst + i * 4, d);
+    }
+    if (Swap) {
+        gr_blit_blend_swap_scalar(dst + i * 4, src + i * 4, count - i);
+    } else {
+        gr_blit_blend_scalar(dst + i * 4, src + i * 4, count - i);
+    }
+}
+
+static void blend_mask_neon(uint8_t* dst, const uint8_t* mask,
+                            const uint8_t color[4], size_t count)
+{
+    uint8x8_t c[3];
+    for (int j = 0; j < 3; ++j) {
+        c[j] = vdup_n_u8(color[j]);
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8_t m = vld1_u8(mask + i);
+
+        // Skip runs of empty space between glyphs
+        if (vget_lane_u64(vreinterpret_u64_u8(m), 0) == 0) {
+            continue;
+        }
+
+        uint8x8x4_t d = vld4_u8(dst + i * 4);
+        uint8x8_t im = vmvn_u8(m);
+
+        d.val[0] = blend_u8(c[0], d.val[0], m, im);
+        d.val[1] = blend_u8(c[1], d.val[1], m, im);
+        d.val[2] = blend_u8(c[2], d.val[2], m, im);
+        d.val[3] = blend_u8(m, d.val[3], m, im);
+        vst4_u8(dst + i * 4, d);
+    }
+    gr_blit_blend_mask_scalar(dst + i * 4, mask + i, color, count - i);
+}
+
+static void swap_rb_neon(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        uint8x16_t tmp = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = tmp;
+        vst4q_u8(dst + i * 4, v);
+    }
+    gr_blit_swap_rb_scalar(dst + i * 4, src + i * 4, count - i);
+}
+
+static void rgb_to_rgbx_neon(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t s = vld3q_u8(src + i * 3);
+        uint8x16x4_t d;
+        d.val[0] = s.val[0];
+        d.val[1] = s.val[1];
+        d.val[2] = s.val[2];
+        d.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + i * 4, d);
+    }
+    gr_blit_rgb_to_rgbx_scalar(dst + i * 4, src + i * 3, count - i);
+}
+
+static void gray_to_rgbx_neon(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t g = vld1q_u8(src + i);
+        uint8x16x4_t d;
+        d.val[0] = g;
+        d.val[1] = g;
+        d.val[2] = g;
+        d.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + i * 4, d);
+    }
+    gr_blit_gray_to_rgbx_scalar(dst + i * 4, src + i, count - i);
+}
+
+static const gr_blitter blitter_neon = {
+    .name = "NEON",
+    .fill = fill_neon,
+    .fill_blend = fill_blend_neon,
+    .blend = blend_neon<false>,
+    .blend_swap = blend_neon<true>,
+    .blend_mask = blend_mask_neon,
+    .swap_rb = swap_rb_neon,
+    .rgb_to_rgbx = rgb_to_rgbx_neon,
+    .gray_to_rgbx = gray_to_rgbx_neon,
+};
+
+const gr_blitter* const gr_blitter_neon = &blitter_neon;
+
+#else
+
+const gr_blitter* const gr_blitter_neon = nullptr;
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "blitter.h"
+
+#if defined(__SSE2__)
+
+#include <cstring>
+
+#include <emmintrin.h>
+
+// Same rounding as div255() in blitter.cpp, for 8 lanes
+static inline __m128i div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Broadcast the alpha lane of each of the two pixels in an unpacked vector
+static inline __m128i splat_alpha_epi16(__m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+static inline __m128i swap_rb_epi16(__m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 0, 1, 2));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+// s * a + d * (255 - a) for two unpacked pixels
+static inline __m128i blend_epi16(__m128i s, __m128i d, __m128i a)
+{
+    __m128i ia = _mm_xor_si128(a, _mm_set1_epi16(0xff));
+    return div255_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                      _mm_mullo_epi16(d, ia)));
+}
+
+static void fill_sse2(uint8_t* dst, const uint8_t color[4], size_t count)
+{
+    int32_t px;
+    memcpy(&px, color, sizeof(px));
+    __m128i v = _mm_set1_epi32(px);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4 + 16), v);
+    }
+    gr_blit_fill_scalar(dst + i * 4, color, count - i);
+}
+
+static void fill_blend_sse2(uint8_t* dst, const uint8_t color[4],
+                            size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int32_t px;
+    memcpy(&px, color, sizeof(px));
+
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32(px), zero);
+    __m128i a = _mm_set1_epi16(color[3]);
+    __m128i ia = _mm_xor_si128(a, _mm_set1_epi16(0xff));
+    __m128i ca = _mm_mullo_epi16(c, a);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i * 4);
+        __m128i d = _mm_loadu_si128(p);
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+
+        lo = div255_epi16(_mm_add_epi16(ca, _mm_mullo_epi16(lo, ia)));
+        hi = div255_epi16(_mm_add_epi16(ca, _mm_mullo_epi16(hi, ia)));
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    gr_blit_fill_blend_scalar(dst + i * 4, color, count - i);
+}
+
+template<bool Swap>
+static void blend_sse2(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i * 4);
+        __m128i s = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i d = _mm_loadu_si128(p);
+
+        __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+        __m128i a_lo = splat_alpha_epi16(s_lo);
+        __m128i a_hi = splat_alpha_epi16(s_hi);
+        if (Swap) {
+            s_lo = swap_rb_epi16(s_lo);
+            s_hi = swap_rb_epi16(s_hi);
+        }
+
+        __m128i lo = blend_epi16(s_lo, _mm_unpacklo_epi8(d, zero), a_lo);
+        __m128i hi = blend_epi16(s_hi, _mm_unpackhi_epi8(d, zero), a_hi);
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    if (Swap) {
+        gr_blit_blend_swap_scalar(dst + i * 4, src + i * 4, count - i);
+    } else {
+        gr_blit_blend_scalar(dst + i * 4, src + i * 4, count - i);
+    }
+}
+
+static void blend_mask_sse2(uint8_t* dst, const uint8_t* mask,
+                            const uint8_t color[4], size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    int32_t px;
+    memcpy(&px, color, sizeof(px));
+
+    __m128i c = _mm_andnot_si128(alpha_lanes,
+                                 _mm_unpacklo_epi8(_mm_set1_epi32(px), zero));
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t m4;
+        memcpy(&m4, mask + i, sizeof(m4));
+
+        // Skip runs of empty space between glyphs
+        if (m4 == 0) {
+            continue;
+        }
+
+        // Replicate each mask byte across its pixel
+        __m128i m = _mm_cvtsi32_si128(m4);
+        m = _mm_unpacklo_epi8(m, m);
+        m = _mm_unpacklo_epi16(m, m);
+        __m128i m_lo = _mm_unpacklo_epi8(m, zero);
+        __m128i m_hi = _mm_unpackhi_epi8(m, zero);
+
+        // The source alpha is the mask value
+        __m128i s_lo = _mm_or_si128(c, _mm_and_si128(alpha_lanes, m_lo));
+        __m128i s_hi = _mm_or_si128(c, _mm_and_si128(alpha_lanes, m_hi));
+
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i * 4);
+        __m128i d = _mm_loadu_si128(p);
+        __m128i lo = blend_epi16(s_lo, _mm_unpacklo_epi8(d, zero), m_lo);
+        __m128i hi = blend_epi16(s_hi, _mm_unpackhi_epi8(d, zero), m_hi);
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    gr_blit_blend_mask_scalar(dst + i * 4, mask + i, color, count - i);
+}
+
+static void swap_rb_sse2(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    const __m128i ga = _mm_set1_epi32(static_cast<int32_t>(0xff00ff00));
+    const __m128i low = _mm_set1_epi32(0xff);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i b0 = _mm_slli_epi32(_mm_and_si128(v, low), 16);
+        __m128i b2 = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+        v = _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(b0, b2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), v);
+    }
+    gr_blit_swap_rb_scalar(dst + i * 4, src + i * 4, count - i);
+}
+
+static void gray_to_rgbx_sse2(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    const __m128i ones = _mm_set1_epi8(-1);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+        __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        __m128i gx_lo = _mm_unpacklo_epi8(g, ones);
+        __m128i gx_hi = _mm_unpackhi_epi8(g, ones);
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i * 4);
+
+        _mm_storeu_si128(p, _mm_unpacklo_epi16(gg_lo, gx_lo));
+        _mm_storeu_si128(p + 1, _mm_unpackhi_epi16(gg_lo, gx_lo));
+        _mm_storeu_si128(p + 2, _mm_unpacklo_epi16(gg_hi, gx_hi));
+        _mm_storeu_si128(p + 3, _mm_unpackhi_epi16(gg_hi, gx_hi));
+    }
+    gr_blit_gray_to_rgbx_scalar(dst + i * 4, src + i, count - i);
+}
+
+// SSE2 has no byte shuffle, so 24-bit RGB expansion stays scalar
+static const gr_blitter blitter_sse2 = {
+    .name = "SSE2",
+    .fill = fill_sse2,
+    .fill_blend = fill_blend_sse2,
+    .blend = blend_sse2<false>,
+    .blend_swap = blend_sse2<true>,
+    .blend_mask = blend_mask_sse2,
+    .swap_rb = swap_rb_sse2,
+    .rgb_to_rgbx = gr_blit_rgb_to_rgbx_scalar,
+    .gray_to_rgbx = gray_to_rgbx_sse2,
+};
+
+const gr_blitter* const gr_blitter_sse2 = &blitter_sse2;
+
+#else
+
+const gr_blitter* const gr_blitter_sse2 = nullptr;
+
+#endif
@@ -18,7 +18,8 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <dirent.h>
-#include <sys/poll.h>
+#include <errno.h>
+#include <sys/epoll.h>
 #include <limits.h>
 #include <linux/input.h>
 #include <sys/types.h>
@@ -37,6 +38,9 @@
 
 #define MAX_DEVICES         32
 
+// Number of input_event structs read from a device per read() call
+#define EV_BATCH_SIZE       64
+
 #define VIBRATOR_TIME       50ms
 
 #ifndef SYN_REPORT
@@ -90,7 +94,8 @@ struct position
 
 struct ev
 {
-    struct pollfd *fd;
+    int fd;
+    int polled;
 
     struct virtualkey *vks;
     int vk_count;
@@ -101,11 +106,21 @@ struct ev
 
     struct position p, mt_p;
     int down;
+
+    // Events read from the device that have not been translated yet
+    struct input_event buf[EV_BATCH_SIZE];
+    unsigned buf_pos, buf_count;
+
+    // Whether the last translated event was a touch move
+    int moving;
 };
 
-static struct pollfd ev_fds[MAX_DEVICES];
+static int ev_epoll_fd = -1;
 static struct ev evs[MAX_DEVICES];
 static unsigned ev_count = 0;
+// Event held back while looking ahead for more touch moves to coalesce
+static struct input_event pending_ev;
+static int has_pending_ev = 0;
 static struct timespec lastInputStat;
 static unsigned long lastInputMTime;
 static int has_mouse = 0;
@@ -145,7 +160,7 @@ static int vk_init(struct ev *e)
     e->vk_count = 0;
 
     len = strlen(vk_path);
-    len = ioctl(e->fd->fd, EVIOCGNAME(sizeof(e->deviceName)), e->deviceName);
+    len = ioctl(e->fd, EVIOCGNAME(sizeof(e->deviceName)), e->deviceName);
     if (len <= 0) {
         printf("Unable to query event object.\n");
         return -1;
@@ -218,16 +233,16 @@ static int vk_init(struct ev *e)
         e->down = DOWN_NOT;
     }
 
-    ioctl(e->fd->fd, EVIOCGABS(ABS_X), &e->p.xi);
-    ioctl(e->fd->fd, EVIOCGABS(ABS_Y), &e->p.yi);
+    ioctl(e->fd, EVIOCGABS(ABS_X), &e->p.xi);
+    ioctl(e->fd, EVIOCGABS(ABS_Y), &e->p.yi);
     e->p.synced = 0;
 #ifdef _EVENT_LOGGING
     printf("EV: ST minX: %d  maxX: %d  minY: %d  maxY: %d\n",
            e->p.xi.minimum, e->p.xi.maximum, e->p.yi.minimum, e->p.yi.maximum);
 #endif
 
-    ioctl(e->fd->fd, EVIOCGABS(ABS_MT_POSITION_X), &e->mt_p.xi);
-    ioctl(e->fd->fd, EVIOCGABS(ABS_MT_POSITION_Y), &e->mt_p.yi);
+    ioctl(e->fd, EVIOCGABS(ABS_MT_POSITION_X), &e->mt_p.xi);
+    ioctl(e->fd, EVIOCGABS(ABS_MT_POSITION_Y), &e->mt_p.yi);
     e->mt_p.synced = 0;
 #ifdef _EVENT_LOGGING
     printf("EV: MT minX: %d  maxX: %d  minY: %d  maxY: %d\n",
@@ -300,6 +315,39 @@ int ev_has_mouse(void)
     return has_mouse;
 }
 
+// Only keys, absolute axes, and pointer motion are translated into something
+// the GUI uses. Devices that can report none of those (eg. switches or
+// sensors that only send EV_MSC) are never read.
+static int is_input_relevant(int fd)
+{
+    unsigned long bit[EV_MAX][NBITS(KEY_MAX)];
+    memset(bit, 0, sizeof(bit));
+
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(bit[0])), bit[0]) < 0) {
+        // Can't tell, so keep the old behavior of reading everything
+        return 1;
+    }
+
+    if (test_bit(EV_KEY, bit[0]) || test_bit(EV_ABS, bit[0])) {
+        return 1;
+    }
+
+    if (test_bit(EV_REL, bit[0])) {
+        ioctl(fd, EVIOCGBIT(EV_REL, sizeof(bit[EV_REL])), bit[EV_REL]);
+        return test_bit(REL_X, bit[EV_REL]) && test_bit(REL_Y, bit[EV_REL]);
+    }
+
+    return 0;
+}
+
+static void ev_stop_polling(struct ev *e)
+{
+    if (e->polled) {
+        epoll_ctl(ev_epoll_fd, EPOLL_CTL_DEL, e->fd, nullptr);
+        e->polled = 0;
+    }
+}
+
 int ev_init(void)
 {
     DIR *dir;
@@ -307,6 +355,13 @@ int ev_init(void)
     int fd;
 
     has_mouse = 0;
+    has_pending_ev = 0;
+
+    ev_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev_epoll_fd < 0) {
+        printf("Failed to create epoll instance: %s\n", strerror(errno));
+        return -1;
+    }
 
     dir = opendir("/dev/input");
     if (dir) {
@@ -315,20 +370,42 @@ int ev_init(void)
             if (strncmp(de->d_name, "event", 5)) {
                 continue;
             }
-            fd = openat(dirfd(dir), de->d_name, O_RDONLY);
+            fd = openat(dirfd(dir), de->d_name,
+                        O_RDONLY | O_NONBLOCK | O_CLOEXEC);
             if (fd < 0) {
                 continue;
             }
 
-            ev_fds[ev_count].fd = fd;
-            ev_fds[ev_count].events = POLLIN;
-            evs[ev_count].fd = &ev_fds[ev_count];
+            struct ev *e = &evs[ev_count];
+            memset(e, 0, sizeof(*e));
+            e->fd = fd;
 
             /* Load virtualkeys if there are any */
-            vk_init(&evs[ev_count]);
+            vk_init(e);
+
+            if (!is_input_relevant(fd)) {
+                printf("ignoring %s input device: no key, touch or pointer events\n",
+                       e->deviceName);
+                free(e->vks);
+                close(fd);
+                continue;
+            }
 
             check_mouse(fd);
 
+            if (!e->ignored) {
+                struct epoll_event epev = {};
+                epev.events = EPOLLIN;
+                epev.data.u32 = ev_count;
+
+                if (epoll_ctl(ev_epoll_fd, EPOLL_CTL_ADD, fd, &epev) == 0) {
+                    e->polled = 1;
+                } else {
+                    printf("Failed to poll %s: %s\n",
+                           e->deviceName, strerror(errno));
+                }
+            }
+
             ev_count++;
             if (ev_count == MAX_DEVICES) {
                 break;
@@ -353,9 +430,14 @@ void ev_exit(void)
             free(evs[ev_count].vks);
             evs[ev_count].vk_count = 0;
         }
-        close(ev_fds[ev_count].fd);
+        close(evs[ev_count].fd);
     }
     ev_count = 0;
+
+    if (ev_epoll_fd >= 0) {
+        close(ev_epoll_fd);
+        ev_epoll_fd = -1;
+    }
 }
 
 #if 0 // Unused
@@ -738,12 +820,74 @@ static int vk_modify(struct ev *e, struct input_event *ev)
     return 0;
 }
 
+static int is_touch_move(const struct input_event *ev)
+{
+    return ev->type == EV_ABS && ev->code == 1;
+}
+
+// Read everything the device has queued in one go instead of one event per
+// poll()/read() round trip
+static void ev_fill(struct ev *e)
+{
+    if (e->buf_pos < e->buf_count) {
+        return;
+    }
+
+    ssize_t n = read(e->fd, e->buf, sizeof(e->buf));
+    e->buf_pos = 0;
+    e->buf_count = n > 0 ? n / sizeof(e->buf[0]) : 0;
+}
+
+// Translate buffered events until one produces something for the GUI. When a
+// touch is already moving, any further moves in the same batch replace that
+// one so the GUI only sees the newest position.
+static int ev_next(struct ev *e, struct input_event *ev)
+{
+    int have_move = 0;
+
+    while (e->buf_pos < e->buf_count) {
+        struct input_event cur = e->buf[e->buf_pos++];
+
+        if (vk_modify(e, &cur)) {
+            if (e->ignored) {
+                ev_stop_polling(e);
+            }
+            continue;
+        }
+
+        if (have_move && !is_touch_move(&cur)) {
+            // Deliver the coalesced move first
+            pending_ev = cur;
+            has_pending_ev = 1;
+            e->moving = 0;
+            return 0;
+        }
+
+        *ev = cur;
+
+        if (is_touch_move(&cur) && e->moving) {
+            have_move = 1;
+            continue;
+        }
+
+        e->moving = is_touch_move(&cur);
+        return 0;
+    }
+
+    return have_move ? 0 : -1;
+}
+
 int ev_get(struct input_event *ev, int timeout_ms)
 {
-    int r;
     unsigned n;
     struct timespec curr;
 
+    if (has_pending_ev) {
+        *ev = pending_ev;
+        has_pending_ev = 0;
+        return 0;
+    }
+
     clock_gettime(CLOCK_MONOTONIC, &curr);
     if (curr.tv_sec - lastInputStat.tv_sec >= 2) {
         struct stat st;
@@ -757,17 +901,23 @@ int ev_get(struct input_event *ev, int timeout_ms)
         lastInputStat = curr;
     }
 
-    r = poll(ev_fds, ev_count, timeout_ms);
+    // Finish events left over from the previous read before waiting again
+    for (n = 0; n < ev_count; n++) {
+        if (ev_next(&evs[n], ev) == 0) {
+            return 0;
+        }
+    }
+
+    struct epoll_event events[MAX_DEVICES];
+    int r = epoll_wait(ev_epoll_fd, events, MAX_DEVICES, timeout_ms);
 
     if (r > 0) {
+        for (int i = 0; i < r; i++) {
+            ev_fill(&evs[events[i].data.u32]);
+        }
         for (n = 0; n < ev_count; n++) {
-            if (ev_fds[n].revents & POLLIN) {
-                r = read(ev_fds[n].fd, ev, sizeof(*ev));
-                if (r == sizeof(*ev)) {
-                    if (!vk_modify(&evs[n], ev)) {
-                        return 0;
-                    }
-                }
+            if (ev_next(&evs[n], ev) == 0) {
+                return 0;
             }
         }
         return -1;
@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+
 #include <unistd.h>
 
 #include <fcntl.h>
@@ -35,6 +38,7 @@
 
 #include "config/config.hpp"
 #include "backend/backend.h"
+#include "blitter.h"
 #include "minui.h"
 #include "graphics.h"
 #include "gui/placement.h"
@@ -71,6 +75,18 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// Clip region that gr_clip() and gr_noclip() cannot escape. This is used for
+// redrawing only the damaged parts of the screen.
+static bool gr_has_base_clip = false;
+static GRRect gr_base_clip;
+
+// Current scissor rectangle, mirrored for the fast blitters
+static bool gr_has_scissor = false;
+static GRRect gr_scissor;
+
+// Current color in the byte order given to pixelflinger
+static unsigned char gr_current_color[4] = { 255, 255, 255, 255 };
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -106,6 +122,11 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
             y_scale = (measured_height - new_height) / 2;
             vfont = new_font;
         }
+    } else if (placement == TOP_LEFT || placement == BOTTOM_LEFT
+            || placement == TEXT_ONLY_RIGHT) {
+        // The width is not needed for left-aligned text. This saves a string
+        // cache lookup for every list row that is drawn.
+        measured_width = 0;
     } else {
         measured_width = gr_ttf_measureEx(s, vfont);
     }
@@ -130,21 +151,69 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
             y -= measured_height;
         }
     }
-    return gr_ttf_textExWH(gl, x, y + y_scale, s, vfont, measured_width + x, -1);
+    // The whole string is always drawn. Passing the measured width here would
+    // render and cache the string a second time under a different key.
+    return gr_ttf_textExWH(gl, x, y + y_scale, s, vfont, -1, -1);
 }
 
 void gr_clip(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_base_clip) {
+        int x2 = std::min(x + w, gr_base_clip.x + gr_base_clip.w);
+        int y2 = std::min(y + h, gr_base_clip.y + gr_base_clip.h);
+        x = std::max(x, gr_base_clip.x);
+        y = std::max(y, gr_base_clip.y);
+        w = std::max(x2 - x, 0);
+        h = std::max(y2 - y, 0);
+    }
+
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_scissor.x = x;
+    gr_scissor.y = y;
+    gr_scissor.w = w;
+    gr_scissor.h = h;
+    gr_has_scissor = true;
 }
 
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
-    gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
-    gl->disable(gl, GGL_SCISSOR_TEST);
+
+    if (gr_has_base_clip) {
+        gl->scissor(gl, gr_base_clip.x, gr_base_clip.y,
+                    gr_base_clip.w, gr_base_clip.h);
+        gl->enable(gl, GGL_SCISSOR_TEST);
+
+        gr_scissor = gr_base_clip;
+        gr_has_scissor = true;
+    } else {
+        gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
+        gl->disable(gl, GGL_SCISSOR_TEST);
+
+        gr_has_scissor = false;
+    }
+}
+
+void gr_clip_base(int x, int y, int w, int h)
+{
+    gr_has_base_clip = false;
+    gr_clip(x, y, w, h);
+
+    gr_base_clip.x = x;
+    gr_base_clip.y = y;
+    gr_base_clip.w = w;
+    gr_base_clip.h = h;
+    gr_has_base_clip = true;
+}
+
+void gr_noclip_base()
+{
+    gr_has_base_clip = false;
+    gr_noclip();
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -207,14 +276,23 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((r << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+
+        gr_current_color[0] = b;
+        gr_current_color[2] = r;
     } else {
         color[0] = ((r << 8) | r) + 1;
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((b << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+
+        gr_current_color[0] = r;
+        gr_current_color[2] = b;
     }
     gl->color4xv(gl, color);
 
+    gr_current_color[1] = g;
+    gr_current_color[3] = a;
+
     gr_is_curr_clr_opaque = (a == 255);
 }
 
@@ -242,9 +320,180 @@ void gr_clear()
     }
 }
 
+// Returns whether the fast blitters can draw into the current surface. If
+// red and blue are stored in the opposite order from textures, *swap is set.
+static bool gr_fast_target(bool* swap)
+{
+    switch (gr_mem_surface.format) {
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+        *swap = false;
+        return true;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        *swap = true;
+        return true;
+    default:
+        // RGB_565 is left to pixelflinger
+        return false;
+    }
+}
+
+// Clip a destination rectangle to the surface and the scissor rectangle,
+// moving the source offsets along with it. Returns false if nothing is left.
+static bool gr_fast_clip(int* dx, int* dy, int* w, int* h, int* sx, int* sy)
+{
+    int x1 = std::max(*dx, 0);
+    int y1 = std::max(*dy, 0);
+    int x2 = std::min(*dx + *w, static_cast<int>(gr_mem_surface.width));
+    int y2 = std::min(*dy + *h, static_cast<int>(gr_mem_surface.height));
+
+    if (gr_has_scissor) {
+        x1 = std::max(x1, gr_scissor.x);
+        y1 = std::max(y1, gr_scissor.y);
+        x2 = std::min(x2, gr_scissor.x + gr_scissor.w);
+        y2 = std::min(y2, gr_scissor.y + gr_scissor.h);
+    }
+
+    if (x2 <= x1 || y2 <= y1) {
+        return false;
+    }
+
+    *sx += x1 - *dx;
+    *sy += y1 - *dy;
+    *dx = x1;
+    *dy = y1;
+    *w = x2 - x1;
+    *h = y2 - y1;
+    return true;
+}
+
+static unsigned char* gr_fast_row(int x, int y)
+{
+    return gr_mem_surface.data
+            + (static_cast<size_t>(y) * gr_mem_surface.stride + x) * 4;
+}
+
+static void gr_fast_color(unsigned char color[4], bool swap)
+{
+    color[0] = gr_current_color[swap ? 2 : 0];
+    color[1] = gr_current_color[1];
+    color[2] = gr_current_color[swap ? 0 : 2];
+    color[3] = gr_current_color[3];
+}
+
+static void gr_fast_fill(int x, int y, int w, int h, bool swap)
+{
+    int sx = 0, sy = 0;
+    unsigned char color[4];
+
+    if (!gr_fast_clip(&x, &y, &w, &h, &sx, &sy)) {
+        return;
+    }
+
+    gr_fast_color(color, swap);
+
+    // Fully transparent fills don't change anything when blending
+    if (color[3] == 0) {
+        return;
+    }
+
+    const gr_blitter* blitter = gr_get_blitter();
+    auto fn = color[3] == 255 ? blitter->fill : blitter->fill_blend;
+
+    for (int row = y; row < y + h; ++row) {
+        fn(gr_fast_row(x, row), color, static_cast<size_t>(w));
+    }
+}
+
+// Draw a texture with the fast blitters. Returns false if pixelflinger must
+// be used instead.
+static bool gr_fast_blit(const GGLSurface* surface, int sx, int sy,
+                         int w, int h, int dx, int dy)
+{
+    bool swap;
+
+    if (!gr_fast_target(&swap)
+            || (surface->format != GGL_PIXEL_FORMAT_RGBX_8888
+                    && surface->format != GGL_PIXEL_FORMAT_RGBA_8888)) {
+        return false;
+    }
+
+    // Pixelflinger wraps around the texture, so leave that to it
+    if (sx < 0 || sy < 0 || w < 0 || h < 0
+            || sx + w > static_cast<int>(surface->width)
+            || sy + h > static_cast<int>(surface->height)) {
+        return false;
+    }
+
+    if (!gr_fast_clip(&dx, &dy, &w, &h, &sx, &sy)) {
+        return true;
+    }
+
+    const gr_blitter* blitter = gr_get_blitter();
+    size_t count = static_cast<size_t>(w);
+
+    for (int row = 0; row < h; ++row) {
+        unsigned char* dst = gr_fast_row(dx, dy + row);
+        const unsigned char* src = surface->data
+                + (static_cast<size_t>(sy + row) * surface->stride + sx) * 4;
+
+        if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
+            if (swap) {
+                blitter->swap_rb(dst, src, count);
+            } else {
+                memcpy(dst, src, count * 4);
+            }
+        } else if (swap) {
+            blitter->blend_swap(dst, src, count);
+        } else {
+            blitter->blend(dst, src, count);
+        }
+    }
+
+    return true;
+}
+
+bool gr_blit_mask(void* context, const GGLSurface* mask, int x, int y,
+                  int w, int h)
+{
+    bool swap;
+    int sx = 0, sy = 0;
+    unsigned char color[4];
+
+    if (context != gr_context || !gr_fast_target(&swap)
+            || mask->format != GGL_PIXEL_FORMAT_A_8
+            || w > static_cast<int>(mask->width)
+            || h > static_cast<int>(mask->height)) {
+        return false;
+    }
+
+    if (!gr_fast_clip(&x, &y, &w, &h, &sx, &sy)) {
+        return true;
+    }
+
+    gr_fast_color(color, swap);
+
+    const gr_blitter* blitter = gr_get_blitter();
+
+    for (int row = 0; row < h; ++row) {
+        blitter->blend_mask(
+                gr_fast_row(x, y + row),
+                mask->data + static_cast<size_t>(sy + row) * mask->stride + sx,
+                color, static_cast<size_t>(w));
+    }
+
+    return true;
+}
+
 void gr_fill(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+    bool swap;
+
+    if (gr_fast_target(&swap)) {
+        gr_fast_fill(x, y, w, h, swap);
+        return;
+    }
 
     if (gr_is_curr_clr_opaque) {
         gl->disable(gl, GGL_BLEND);
@@ -266,6 +515,10 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    if (gr_fast_blit(surface, sx, sy, w, h, dx, dy)) {
+        return;
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -309,6 +562,51 @@ void gr_flip()
     gr_context->colorBuffer(gr_context, &gr_mem_surface);
 }
 
+void gr_flip_rects(const GRRect* rects, int count)
+{
+    if (!gr_backend->flip_rects || count > GR_MAX_FLIP_RECTS) {
+        gr_flip();
+        return;
+    }
+
+    gr_draw = gr_backend->flip_rects(gr_backend, rects, count);
+    gr_mem_surface.data = (GGLubyte*)gr_draw->data;
+    gr_context->colorBuffer(gr_context, &gr_mem_surface);
+}
+
+int gr_buffer_age(void)
+{
+    return gr_backend->buffer_age ? gr_backend->buffer_age(gr_backend) : 0;
+}
+
+bool gr_wait_flip(int timeout_ms)
+{
+    return gr_backend->wait_flip
+            ? gr_backend->wait_flip(gr_backend, timeout_ms) : true;
+}
+
+void gr_copy_rects(GRSurface* dst, const GRSurface* src,
+                   const GRRect* rects, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        int x1 = std::max(rects[i].x, 0);
+        int y1 = std::max(rects[i].y, 0);
+        int x2 = std::min(rects[i].x + rects[i].w, src->width);
+        int y2 = std::min(rects[i].y + rects[i].h, src->height);
+        if (x1 >= x2 || y1 >= y2) {
+            continue;
+        }
+
+        size_t offset = x1 * src->pixel_bytes;
+        size_t len = (x2 - x1) * src->pixel_bytes;
+
+        for (int y = y1; y < y2; ++y) {
+            memcpy(dst->data + y * dst->row_bytes + offset,
+                   src->data + y * src->row_bytes + offset, len);
+        }
+    }
+}
+
 static void get_memory_surface(GGLSurface* ms)
 {
     ms->version = sizeof(*ms);
@@ -17,6 +17,8 @@
 #ifndef _GRAPHICS_H_
 #define _GRAPHICS_H_
 
+#include <pixelflinger/pixelflinger.h>
+
 #include "minui.h"
 
 // TODO: lose the function pointers.
@@ -35,6 +37,32 @@ struct minui_backend
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Optional. Like flip(), but only the given regions of the drawing
+    // surface changed since the previous flip. If this is null, flip() is
+    // used instead.
+    GRSurface* (*flip_rects)(minui_backend*, const GRRect* rects, int count);
+
+    // Optional. Returns the number of flips since the drawing surface last
+    // held the contents being displayed. 1 means that the surface is always
+    // up to date. 0 means that the contents are unknown and everything must
+    // be redrawn. If this is null, 0 is assumed.
+    int (*buffer_age)(minui_backend*);
+
+    // Optional. Waits up to timeout_ms (-1 for no limit) for the flip queued
+    // by the last call to flip() to complete. The drawing surface must not be
+    // modified before then. Returns false on timeout. If this is null, flips
+    // are assumed to complete immediately.
+    bool (*wait_flip)(minui_backend*, int timeout_ms);
 };
 
+// Copy the given regions from one surface to another with the same format
+void gr_copy_rects(GRSurface* dst, const GRSurface* src,
+                   const GRRect* rects, int count);
+
+// Draw an A_8 coverage mask at (x, y) in the current color without going
+// through pixelflinger. Returns false if the caller must draw it instead.
+bool gr_blit_mask(void* context, const GGLSurface* mask, int x, int y,
+                  int w, int h);
+
 #endif
@@ -36,6 +36,18 @@ struct GRSurface
     __u32 format;
 };
 
+// Region of the screen, used for partial updates
+struct GRRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Maximum number of regions that can be passed to gr_flip_rects()
+#define GR_MAX_FLIP_RECTS 8
+
 typedef void* gr_surface;
 typedef unsigned short gr_pixel;
 
@@ -49,11 +61,16 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+void gr_flip_rects(const struct GRRect *rects, int count);
+int gr_buffer_age(void);
+bool gr_wait_flip(int timeout_ms);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
+void gr_clip_base(int x, int y, int w, int h);
+void gr_noclip_base();
 void gr_fill(int x, int y, int w, int h);
 void gr_line(int x0, int y0, int x1, int y1, int width);
 gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -70,6 +87,11 @@ int gr_ttf_measureEx(const char *s, void *font);
 int gr_ttf_maxExW(const char *s, void *font, int max_width);
 int gr_ttf_getMaxFontHeight(void *font);
 void gr_ttf_dump_stats(void);
+// Directory for the persistent glyph atlases (nullptr disables them). Must be
+// set before fonts are loaded.
+void gr_ttf_set_cache_dir(const char *path);
+// Write the atlases of fonts that rasterized new glyphs since the last save
+void gr_ttf_save_glyph_atlases(void);
 
 void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
 unsigned int gr_get_width(gr_surface surface);
@@ -96,6 +118,15 @@ int res_create_surface(const char* name, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
 
+// Cache of decoded (and scaled) surfaces, stored in the framebuffer pixel
+// format. gr_init() must be called before res_cache_init(). Surfaces are
+// looked up by key and are only returned if the source image (resolved the
+// same way as res_create_surface()) is unchanged.
+int res_cache_init(const char* path);
+int res_cache_create_surface(const char* name, const char* key, gr_surface* pSurface);
+void res_cache_add_surface(const char* name, const char* key, gr_surface surface);
+int res_cache_save(void);
+
 #ifdef __cplusplus
 }
 #endif
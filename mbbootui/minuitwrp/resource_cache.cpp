@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Cache of decoded theme surfaces.
+//
+// Decoding and scaling the theme's PNGs is the most expensive part of loading
+// a theme. The surfaces that come out of that process are already in the
+// framebuffer's pixel format, so they are written to a single cache file
+// (keyed by the caller and validated against the source image's contents).
+// On the next boot, the cache file is mapped and matching surfaces point
+// directly into the mapping.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pixelflinger/pixelflinger.h>
+
+#include "config/config.hpp"
+#include "minui.h"
+
+#define CACHE_MAGIC         "MBSURFC\0"
+#define CACHE_VERSION       1
+#define CACHE_DATA_ALIGN    8
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t fb_width;
+    uint32_t fb_height;
+    uint32_t pixel_format;
+    uint32_t entry_count;
+    uint32_t entries_offset;
+};
+
+struct CacheRecord
+{
+    uint64_t key_offset;
+    uint64_t data_offset;
+    uint64_t source_size;
+    uint32_t key_size;
+    uint32_t source_hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+};
+
+struct CacheMapping
+{
+    void* addr;
+    size_t size;
+};
+
+struct CacheItem
+{
+    uint64_t source_size;
+    uint32_t source_hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    // Points into a mapping or into owned_data
+    const unsigned char* data;
+    std::vector<unsigned char> owned_data;
+};
+
+static struct {
+    std::string path;
+    // Mappings are never unmapped because live surfaces point into them
+    std::vector<CacheMapping> mappings;
+    // Entries in the current cache file
+    std::unordered_map<std::string, const CacheRecord*> records;
+    // Surfaces used during this session. These are written out by
+    // res_cache_save().
+    std::unordered_map<std::string, CacheItem> items;
+    bool dirty;
+} g_cache;
+
+// 32bit FNV-1a
+static uint32_t fnv_hash(const unsigned char* data, size_t size)
+{
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static size_t surface_data_size(uint32_t stride, uint32_t height,
+                                uint32_t format)
+{
+    size_t bpp = format == GGL_PIXEL_FORMAT_A_8 ? 1 : 4;
+    return static_cast<size_t>(stride) * height * bpp;
+}
+
+// Hash the image that res_create_surface() would load for name
+static bool hash_source(const char* name, uint32_t* hash, uint64_t* size)
+{
+    std::string path = tw_resource_path + "/images/" + name + ".png";
+    struct stat sb;
+    bool ret = false;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        void* map = mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            *hash = fnv_hash(static_cast<const unsigned char*>(map),
+                             static_cast<size_t>(sb.st_size));
+            *size = static_cast<uint64_t>(sb.st_size);
+            munmap(map, static_cast<size_t>(sb.st_size));
+            ret = true;
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+static void fill_config(CacheHeader* header)
+{
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->version = CACHE_VERSION;
+    header->fb_width = static_cast<uint32_t>(gr_fb_width());
+    header->fb_height = static_cast<uint32_t>(gr_fb_height());
+    // Decoded surfaces have their color channels swapped for some formats
+    header->pixel_format = static_cast<uint32_t>(tw_device.tw_pixel_format());
+}
+
+static bool map_cache_file(const char* path, bool quiet)
+{
+    CacheHeader expected;
+    struct stat sb;
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (!quiet || errno != ENOENT) {
+            printf("Failed to open surface cache %s: %s\n",
+                   path, strerror(errno));
+        }
+        return false;
+    }
+
+    if (fstat(fd, &sb) == 0
+            && static_cast<size_t>(sb.st_size) >= sizeof(CacheHeader)) {
+        map_size = static_cast<size_t>(sb.st_size);
+        // Writable copy-on-write mapping since surfaces are not expected to
+        // be read-only
+        map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        printf("Failed to map surface cache %s\n", path);
+        return false;
+    }
+
+    auto base = static_cast<const unsigned char*>(map);
+    auto header = static_cast<const CacheHeader*>(map);
+
+    memset(&expected, 0, sizeof(expected));
+    fill_config(&expected);
+
+    if (memcmp(header->magic, expected.magic, sizeof(header->magic)) != 0
+            || header->version != expected.version
+            || header->fb_width != expected.fb_width
+            || header->fb_height != expected.fb_height
+            || header->pixel_format != expected.pixel_format
+            || header->entries_offset % alignof(CacheRecord) != 0
+            || static_cast<uint64_t>(header->entries_offset)
+                    + static_cast<uint64_t>(header->entry_count)
+                            * sizeof(CacheRecord) > map_size) {
+        printf("Ignoring stale or invalid surface cache %s\n", path);
+        munmap(map, map_size);
+        return false;
+    }
+
+    g_cache.mappings.push_back({ map, map_size });
+    g_cache.records.clear();
+
+    auto records = reinterpret_cast<const CacheRecord*>(
+            base + header->entries_offset);
+
+    for (uint32_t i = 0; i < header->entry_count; ++i) {
+        const CacheRecord* r = &records[i];
+        size_t data_size = surface_data_size(r->stride, r->height, r->format);
+
+        if (r->key_offset + r->key_size > map_size
+                || r->data_offset % CACHE_DATA_ALIGN != 0
+                || r->data_offset + data_size > map_size
+                || r->width > r->stride) {
+            continue;
+        }
+
+        g_cache.records.emplace(std::string(
+                reinterpret_cast<const char*>(base + r->key_offset),
+                r->key_size), r);
+    }
+
+    return true;
+}
+
+int res_cache_init(const char* path)
+{
+    g_cache.path = path;
+    g_cache.records.clear();
+    g_cache.items.clear();
+    g_cache.dirty = false;
+
+    if (!map_cache_file(path, true)) {
+        return -1;
+    }
+
+    printf("Loaded %zu surfaces from %s\n", g_cache.records.size(), path);
+    return 0;
+}
+
+int res_cache_create_surface(const char* name, const char* key,
+                             gr_surface* pSurface)
+{
+    uint32_t hash;
+    uint64_t size;
+
+    if (g_cache.path.empty()) {
+        return -1;
+    }
+
+    auto it = g_cache.records.find(key);
+    if (it == g_cache.records.end()) {
+        return -1;
+    }
+
+    const CacheRecord* r = it->second;
+    if (!hash_source(name, &hash, &size)
+            || hash != r->source_hash || size != r->source_size) {
+        return -1;
+    }
+
+    // The surface header is allocated separately, so res_free_surface() does
+    // not need to know that the data is part of a mapping
+    auto surface = static_cast<GGLSurface*>(malloc(sizeof(GGLSurface)));
+    if (!surface) {
+        return -1;
+    }
+
+    auto base = static_cast<unsigned char*>(g_cache.mappings.back().addr);
+
+    memset(surface, 0, sizeof(*surface));
+    surface->version = sizeof(GGLSurface);
+    surface->width = r->width;
+    surface->height = r->height;
+    surface->stride = static_cast<GGLint>(r->stride);
+    surface->data = base + r->data_offset;
+    surface->format = static_cast<GGLubyte>(r->format);
+
+    CacheItem& item = g_cache.items[key];
+    item.source_size = size;
+    item.source_hash = hash;
+    item.width = r->width;
+    item.height = r->height;
+    item.stride = r->stride;
+    item.format = r->format;
+    item.data = surface->data;
+    item.owned_data.clear();
+
+    *pSurface = surface;
+    return 0;
+}
+
+void res_cache_add_surface(const char* name, const char* key,
+                           gr_surface surface)
+{
+    auto s = static_cast<const GGLSurface*>(surface);
+    uint32_t hash;
+    uint64_t size;
+
+    if (g_cache.path.empty() || !s || !hash_source(name, &hash, &size)
+            || (s->format != GGL_PIXEL_FORMAT_RGBX_8888
+                    && s->format != GGL_PIXEL_FORMAT_RGBA_8888
+                    && s->format != GGL_PIXEL_FORMAT_BGRA_8888
+                    && s->format != GGL_PIXEL_FORMAT_A_8)) {
+        return;
+    }
+
+    size_t data_size = surface_data_size(static_cast<uint32_t>(s->stride),
+                                         s->height, s->format);
+
+    CacheItem& item = g_cache.items[key];
+    item.source_size = size;
+    item.source_hash = hash;
+    item.width = s->width;
+    item.height = s->height;
+    item.stride = static_cast<uint32_t>(s->stride);
+    item.format = s->format;
+    item.owned_data.assign(s->data, s->data + data_size);
+    item.data = item.owned_data.data();
+
+    g_cache.dirty = true;
+}
+
+static bool write_fully(int fd, const void* buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char*>(buf);
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int res_cache_save(void)
+{
+    static const unsigned char padding[CACHE_DATA_ALIGN] = {};
+    CacheHeader header;
+    std::vector<CacheRecord> records;
+    std::vector<const std::string*> keys;
+    std::vector<const CacheItem*> items;
+    uint64_t offset;
+
+    if (g_cache.path.empty() || !g_cache.dirty) {
+        return 0;
+    }
+
+    for (auto const& item : g_cache.items) {
+        keys.push_back(&item.first);
+        items.push_back(&item.second);
+    }
+
+    memset(&header, 0, sizeof(header));
+    fill_config(&header);
+    header.entry_count = static_cast<uint32_t>(items.size());
+    header.entries_offset = sizeof(header);
+
+    // Keys follow the records and the surface data follows the keys
+    offset = sizeof(header) + items.size() * sizeof(CacheRecord);
+    records.resize(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        records[i].key_offset = offset;
+        records[i].key_size = static_cast<uint32_t>(keys[i]->size());
+        offset += keys[i]->size();
+    }
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        const CacheItem* item = items[i];
+        offset = (offset + CACHE_DATA_ALIGN - 1) & ~uint64_t(CACHE_DATA_ALIGN - 1);
+        records[i].data_offset = offset;
+        records[i].source_size = item->source_size;
+        records[i].source_hash = item->source_hash;
+        records[i].width = item->width;
+        records[i].height = item->height;
+        records[i].stride = item->stride;
+        records[i].format = item->format;
+        offset += surface_data_size(item->stride, item->height, item->format);
+    }
+
+    // Write to a temporary file first so that a crash can never leave a
+    // truncated cache behind
+    std::string tmp_path = g_cache.path + ".tmp";
+
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        printf("Failed to open %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    bool ok = write_fully(fd, &header, sizeof(header))
+            && write_fully(fd, records.data(),
+                           records.size() * sizeof(CacheRecord));
+    offset = sizeof(header) + records.size() * sizeof(CacheRecord);
+
+    for (size_t i = 0; ok && i < keys.size(); ++i) {
+        ok = write_fully(fd, keys[i]->data(), keys[i]->size());
+        offset += keys[i]->size();
+    }
+
+    for (size_t i = 0; ok && i < items.size(); ++i) {
+        const CacheItem* item = items[i];
+        size_t pad = static_cast<size_t>(records[i].data_offset - offset);
+        size_t size = surface_data_size(item->stride, item->height,
+                                        item->format);
+
+        ok = write_fully(fd, padding, pad)
+                && write_fully(fd, item->data, size);
+        offset = records[i].data_offset + size;
+    }
+
+    ok = ok && fsync(fd) == 0;
+
+    if (close(fd) < 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmp_path.c_str(), g_cache.path.c_str()) < 0) {
+        printf("Failed to write surface cache %s: %s\n",
+               g_cache.path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    printf("Saved %zu surfaces to %s\n", items.size(), g_cache.path.c_str());
+    g_cache.dirty = false;
+
+    // Switch over to the new file so that the copies made by
+    // res_cache_add_surface() can be released
+    if (map_cache_file(g_cache.path.c_str(), false)) {
+        auto base = static_cast<const unsigned char*>(
+                g_cache.mappings.back().addr);
+
+        for (auto& item : g_cache.items) {
+            auto it = g_cache.records.find(item.first);
+            if (it != g_cache.records.end()) {
+                item.second.data = base + it->second->data_offset;
+                item.second.owned_data.clear();
+                item.second.owned_data.shrink_to_fit();
+            }
+        }
+    }
+
+    return 0;
+}
@@ -37,6 +37,7 @@ extern "C" {
 }
 #endif
 #include "config/config.hpp"
+#include "blitter.h"
 #include "minui.h"
 
 #define SURFACE_DATA_ALIGNMENT 8
@@ -178,30 +179,19 @@ static void transform_rgb_to_draw(unsigned char* input_row,
                                   unsigned char* output_row,
                                   int channels, int width)
 {
-    int x;
-    unsigned char* ip = input_row;
-    unsigned char* op = output_row;
+    const gr_blitter* blitter = gr_get_blitter();
 
     switch (channels) {
     case 1:
         // expand gray level to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = 0xff;
-            ip++;
-        }
+        blitter->gray_to_rgbx(output_row, input_row,
+                              static_cast<size_t>(width));
         break;
 
     case 3:
-        // expand RGBA to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = 0xff;
-        }
+        // expand RGB to RGBX
+        blitter->rgb_to_rgbx(output_row, input_row,
+                             static_cast<size_t>(width));
         break;
 
     case 4:
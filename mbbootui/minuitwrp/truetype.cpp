@@ -1,11 +1,16 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "minui.h"
+#include "graphics.h"
 
 #include <cutils/hashmap.h>
 #include <ft2build.h>
@@ -17,6 +22,15 @@
 
 #define STRING_CACHE_MAX_ENTRIES 400
 #define STRING_CACHE_TRUNCATE_ENTRIES 150
+// Upper bound on the rendered pixels held by a font's string cache
+#define STRING_CACHE_MAX_BYTES (2 * 1024 * 1024)
+
+// Glyph atlas cache files. An atlas holds every glyph rasterized for one
+// font file, size and DPI, packed into a single A_8 surface, so that the next
+// boot can mmap it instead of rasterizing the glyphs with FreeType again.
+#define GLYPH_ATLAS_MAGIC "MBGLYPH\0"
+#define GLYPH_ATLAS_VERSION 1
+#define GLYPH_ATLAS_WIDTH 512
 
 typedef struct
 {
@@ -38,16 +52,60 @@ typedef struct
     Hashmap *string_cache;
     struct StringCacheEntry *string_cache_head;
     struct StringCacheEntry *string_cache_tail;
+    size_t string_cache_bytes;
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
+    uint32_t file_hash;
+    uint64_t file_size;
+    // Atlas loaded from the cache file (data points into atlas_map)
+    GGLSurface atlas;
+    void *atlas_map;
+    size_t atlas_map_size;
+    // Whether glyphs were rasterized that are not in the cache file
+    bool atlas_dirty;
 } TrueTypeFont;
 
 typedef struct
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int left;
+    int top;
+    unsigned width;
+    unsigned rows;
+    int pitch;
+    int advance;
+    uint8_t *bitmap;
+    // Whether bitmap points into the font's atlas instead of a heap buffer
+    bool in_atlas;
 } TrueTypeCacheEntry;
 
+struct GlyphAtlasHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_hash;
+    uint64_t file_size;
+    int32_t size;
+    int32_t dpi;
+    uint32_t glyph_count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t glyphs_offset;
+    uint32_t pixels_offset;
+};
+
+struct GlyphAtlasRecord
+{
+    int32_t char_index;
+    int32_t left;
+    int32_t top;
+    uint32_t width;
+    uint32_t rows;
+    int32_t advance;
+    uint32_t x;
+    uint32_t y;
+};
+
 typedef struct
 {
     char *text;
@@ -69,12 +127,14 @@ typedef struct
 {
     FT_Library ft_library;
     Hashmap *fonts;
+    char *cache_dir;
     pthread_mutex_t mutex;
 } FontData;
 
 static FontData font_data = {
     .ft_library = nullptr,
     .fonts = nullptr,
+    .cache_dir = nullptr,
     .mutex = PTHREAD_MUTEX_INITIALIZER,
 };
 
@@ -178,6 +238,160 @@ static int gr_ttf_font_cache_hash(void *key)
     return hash;
 }
 
+void gr_ttf_set_cache_dir(const char *path)
+{
+    pthread_mutex_lock(&font_data.mutex);
+    free(font_data.cache_dir);
+    font_data.cache_dir = path ? strdup(path) : nullptr;
+    pthread_mutex_unlock(&font_data.mutex);
+}
+
+static bool gr_ttf_hash_file(const char *path, uint32_t *hash, uint64_t *size)
+{
+    struct stat sb;
+    void *map;
+    bool ret = false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0 && sb.st_size <= UINT32_MAX) {
+        map = mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            *hash = fnv_hash(map, (uint32_t)sb.st_size);
+            *size = (uint64_t)sb.st_size;
+            munmap(map, (size_t)sb.st_size);
+            ret = true;
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+// Must be called with font_data.mutex locked
+static char *gr_ttf_atlas_path(TrueTypeFont *font)
+{
+    char *path;
+
+    if (!font_data.cache_dir || font->file_size == 0) {
+        return nullptr;
+    }
+
+    if (asprintf(&path, "%s/%08x-%d-%d.atlas", font_data.cache_dir,
+                 font->file_hash, font->size, font->dpi) < 0) {
+        return nullptr;
+    }
+
+    return path;
+}
+
+// Populates the glyph cache from the font's atlas file, if there is a valid one
+static void gr_ttf_load_atlas(TrueTypeFont *font)
+{
+    struct stat sb;
+    const GlyphAtlasHeader *header;
+    const GlyphAtlasRecord *records;
+    uint8_t *pixels;
+    void *map = MAP_FAILED;
+    size_t map_size = 0;
+    uint32_t i;
+    int fd;
+
+    char *path = gr_ttf_atlas_path(font);
+    if (!path) {
+        return;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            printf("Failed to open glyph atlas %s: %s\n", path, strerror(errno));
+        }
+        free(path);
+        return;
+    }
+
+    if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(GlyphAtlasHeader)) {
+        map_size = (size_t)sb.st_size;
+        map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        printf("Failed to map glyph atlas %s\n", path);
+        free(path);
+        return;
+    }
+
+    header = (const GlyphAtlasHeader *)map;
+    if (memcmp(header->magic, GLYPH_ATLAS_MAGIC, sizeof(header->magic)) != 0
+            || header->version != GLYPH_ATLAS_VERSION
+            || header->file_hash != font->file_hash
+            || header->file_size != font->file_size
+            || header->size != font->size
+            || header->dpi != font->dpi
+            || header->glyphs_offset % alignof(GlyphAtlasRecord) != 0
+            || (uint64_t)header->glyphs_offset
+                    + (uint64_t)header->glyph_count * sizeof(GlyphAtlasRecord)
+                    > header->pixels_offset
+            || (uint64_t)header->pixels_offset
+                    + (uint64_t)header->width * header->height > map_size) {
+        printf("Ignoring stale or invalid glyph atlas %s\n", path);
+        munmap(map, map_size);
+        free(path);
+        return;
+    }
+
+    records = (const GlyphAtlasRecord *)((const uint8_t *)map + header->glyphs_offset);
+    pixels = (uint8_t *)map + header->pixels_offset;
+
+    for (i = 0; i < header->glyph_count; ++i) {
+        const GlyphAtlasRecord *r = &records[i];
+        int char_index = r->char_index;
+
+        if ((uint64_t)r->x + r->width > header->width
+                || (uint64_t)r->y + r->rows > header->height
+                || hashmapContainsKey(font->glyph_cache, &char_index)) {
+            continue;
+        }
+
+        TrueTypeCacheEntry *ent = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
+        memset(ent, 0, sizeof(TrueTypeCacheEntry));
+        ent->left = r->left;
+        ent->top = r->top;
+        ent->width = r->width;
+        ent->rows = r->rows;
+        ent->pitch = (int)header->width;
+        ent->advance = r->advance;
+        ent->bitmap = pixels + (size_t)r->y * header->width + r->x;
+        ent->in_atlas = true;
+        ent->bbox.xMin = ent->left;
+        ent->bbox.xMax = ent->left + (FT_Pos)ent->width;
+        ent->bbox.yMax = ent->top;
+        ent->bbox.yMin = ent->top - (FT_Pos)ent->rows;
+
+        int *key = (int *)malloc(sizeof(int));
+        *key = char_index;
+
+        hashmapPut(font->glyph_cache, key, ent);
+    }
+
+    font->atlas.version = sizeof(font->atlas);
+    font->atlas.width = header->width;
+    font->atlas.height = header->height;
+    font->atlas.stride = header->width;
+    font->atlas.data = (GGLubyte *)pixels;
+    font->atlas.format = GGL_PIXEL_FORMAT_A_8;
+    font->atlas_map = map;
+    font->atlas_map_size = map_size;
+
+    printf("Loaded %u glyphs from %s\n", header->glyph_count, path);
+    free(path);
+}
+
 void *gr_ttf_loadFont(const char *filename, int size, int dpi)
 {
     int error;
@@ -235,6 +449,14 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     res->string_cache = hashmapCreate(128, gr_ttf_string_cache_hash, gr_ttf_string_cache_equals);
     pthread_mutex_init(&res->mutex, 0);
 
+    if (font_data.cache_dir) {
+        if (gr_ttf_hash_file(filename, &res->file_hash, &res->file_size)) {
+            gr_ttf_load_atlas(res);
+        } else {
+            printf("Failed to hash font %s; glyph atlas disabled\n", filename);
+        }
+    }
+
     if (!font_data.fonts) {
         font_data.fonts = hashmapCreate(4, gr_ttf_font_cache_hash, gr_ttf_font_cache_equals);
     }
@@ -274,7 +496,9 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
     TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
+    if (!e->in_atlas) {
+        free(e->bitmap);
+    }
     free(e);
     free(key);
     return true;
@@ -292,6 +516,206 @@ static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unuse
     return true;
 }
 
+typedef struct
+{
+    int char_index;
+    TrueTypeCacheEntry *ent;
+    GlyphAtlasRecord record;
+} GlyphAtlasItem;
+
+typedef struct
+{
+    GlyphAtlasItem *items;
+    size_t count;
+} GlyphAtlasItems;
+
+static bool gr_ttf_collect_glyphs(void *key, void *value, void *context)
+{
+    GlyphAtlasItems *items = (GlyphAtlasItems *)context;
+    GlyphAtlasItem *item = &items->items[items->count++];
+    item->char_index = *(int *)key;
+    item->ent = (TrueTypeCacheEntry *)value;
+    return true;
+}
+
+static int gr_ttf_compare_glyph_rows(const void *a, const void *b)
+{
+    const GlyphAtlasItem *ia = (const GlyphAtlasItem *)a;
+    const GlyphAtlasItem *ib = (const GlyphAtlasItem *)b;
+    // Tallest first so that each shelf wastes as little space as possible
+    if (ia->ent->rows != ib->ent->rows) {
+        return ia->ent->rows > ib->ent->rows ? -1 : 1;
+    }
+    return ia->char_index - ib->char_index;
+}
+
+static bool gr_ttf_write_fully(int fd, const void *buf, size_t size)
+{
+    const uint8_t *ptr = (const uint8_t *)buf;
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Packs every cached glyph into an atlas and writes it to the font's cache
+// file. Must be called with font_data.mutex and the font's mutex locked.
+static void gr_ttf_save_atlas(TrueTypeFont *font)
+{
+    GlyphAtlasHeader header;
+    GlyphAtlasItems items;
+    uint8_t *pixels = nullptr;
+    uint32_t width = GLYPH_ATLAS_WIDTH;
+    uint32_t x = 0, y = 0, shelf_height = 0;
+    char *tmp_path = nullptr;
+    bool ok = false;
+    size_t i;
+    int fd;
+
+    char *path = gr_ttf_atlas_path(font);
+    if (!path) {
+        return;
+    }
+
+    items.count = 0;
+    items.items = (GlyphAtlasItem *)calloc(hashmapSize(font->glyph_cache) + 1,
+                                           sizeof(GlyphAtlasItem));
+    hashmapForEach(font->glyph_cache, gr_ttf_collect_glyphs, &items);
+    qsort(items.items, items.count, sizeof(GlyphAtlasItem), gr_ttf_compare_glyph_rows);
+
+    for (i = 0; i < items.count; ++i) {
+        width = MAX(width, items.items[i].ent->width);
+    }
+
+    // Simple shelf packing
+    for (i = 0; i < items.count; ++i) {
+        GlyphAtlasItem *item = &items.items[i];
+        if (x + item->ent->width > width) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+
+        item->record.char_index = item->char_index;
+        item->record.left = item->ent->left;
+        item->record.top = item->ent->top;
+        item->record.width = item->ent->width;
+        item->record.rows = item->ent->rows;
+        item->record.advance = item->ent->advance;
+        item->record.x = x;
+        item->record.y = y;
+
+        x += item->ent->width;
+        shelf_height = MAX(shelf_height, item->ent->rows);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GLYPH_ATLAS_MAGIC, sizeof(header.magic));
+    header.version = GLYPH_ATLAS_VERSION;
+    header.file_hash = font->file_hash;
+    header.file_size = font->file_size;
+    header.size = font->size;
+    header.dpi = font->dpi;
+    header.glyph_count = (uint32_t)items.count;
+    header.width = width;
+    header.height = y + shelf_height;
+    header.glyphs_offset = sizeof(header);
+    header.pixels_offset = (uint32_t)(sizeof(header) + items.count * sizeof(GlyphAtlasRecord));
+
+    pixels = (uint8_t *)calloc((size_t)header.width * header.height + 1, 1);
+
+    for (i = 0; i < items.count; ++i) {
+        const GlyphAtlasItem *item = &items.items[i];
+        const uint8_t *src = item->ent->bitmap;
+        uint8_t *dest = pixels + (size_t)item->record.y * width + item->record.x;
+        for (unsigned row = 0; row < item->ent->rows; ++row) {
+            memcpy(dest, src, item->ent->width);
+            src += item->ent->pitch;
+            dest += width;
+        }
+    }
+
+    if (mkdir(font_data.cache_dir, 0755) < 0 && errno != EEXIST) {
+        printf("Failed to create %s: %s\n", font_data.cache_dir, strerror(errno));
+        goto exit;
+    }
+
+    if (asprintf(&tmp_path, "%s.tmp", path) < 0) {
+        tmp_path = nullptr;
+        goto exit;
+    }
+
+    // Write to a temporary file first so that a crash can never leave a
+    // truncated atlas behind
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("Failed to open %s: %s\n", tmp_path, strerror(errno));
+        goto exit;
+    }
+
+    ok = gr_ttf_write_fully(fd, &header, sizeof(header));
+    for (i = 0; ok && i < items.count; ++i) {
+        ok = gr_ttf_write_fully(fd, &items.items[i].record, sizeof(GlyphAtlasRecord));
+    }
+    ok = ok && gr_ttf_write_fully(fd, pixels, (size_t)header.width * header.height);
+    ok = ok && fsync(fd) == 0;
+
+    if (close(fd) < 0) {
+        ok = false;
+    }
+
+    if (ok && rename(tmp_path, path) < 0) {
+        ok = false;
+    }
+
+    if (ok) {
+        font->atlas_dirty = false;
+        printf("Saved %zu glyphs (%ux%u atlas) to %s\n",
+               items.count, header.width, header.height, path);
+    } else {
+        printf("Failed to write glyph atlas %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+exit:
+    free(tmp_path);
+    free(pixels);
+    free(items.items);
+    free(path);
+}
+
+static bool gr_ttf_save_font_atlas(void *key __unused, void *value, void *context __unused)
+{
+    TrueTypeFont *f = (TrueTypeFont *)value;
+
+    pthread_mutex_lock(&f->mutex);
+    if (f->atlas_dirty) {
+        gr_ttf_save_atlas(f);
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    return true;
+}
+
+void gr_ttf_save_glyph_atlases(void)
+{
+    pthread_mutex_lock(&font_data.mutex);
+
+    if (font_data.fonts && font_data.cache_dir) {
+        hashmapForEach(font_data.fonts, gr_ttf_save_font_atlas, nullptr);
+    }
+
+    pthread_mutex_unlock(&font_data.mutex);
+}
+
 void gr_ttf_freeFont(void *font)
 {
     pthread_mutex_lock(&font_data.mutex);
@@ -299,6 +723,12 @@ void gr_ttf_freeFont(void *font)
     TrueTypeFont *d = (TrueTypeFont *)font;
 
     if (--d->refcount == 0) {
+        if (d->atlas_dirty) {
+            pthread_mutex_lock(&d->mutex);
+            gr_ttf_save_atlas(d);
+            pthread_mutex_unlock(&d->mutex);
+        }
+
         hashmapRemove(font_data.fonts, d->key);
 
         if (hashmapSize(font_data.fonts) == 0) {
@@ -314,6 +744,9 @@ void gr_ttf_freeFont(void *font)
         hashmapFree(d->string_cache);
         hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
         hashmapFree(d->glyph_cache);
+        if (d->atlas_map) {
+            munmap(d->atlas_map, d->atlas_map_size);
+        }
         pthread_mutex_destroy(&d->mutex);
         free(d);
     }
@@ -321,11 +754,6 @@ void gr_ttf_freeFont(void *font)
     pthread_mutex_unlock(&font_data.mutex);
 }
 
-static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index)
-{
-    return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
-}
-
 static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
 {
     TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
@@ -336,39 +764,58 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
             return nullptr;
         }
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
-        }
+        FT_GlyphSlot slot = font->face->glyph;
 
         res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
         memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        res->left = slot->bitmap_left;
+        res->top = slot->bitmap_top;
+        res->advance = (int)(slot->advance.x >> 6);
+
+        // Keep a tightly packed copy of the bitmap so that it can be written
+        // to the atlas as-is
+        if (slot->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY) {
+            uint8_t *src_itr = slot->bitmap.buffer;
+            uint8_t *dest_itr;
+
+            res->width = slot->bitmap.width;
+            res->rows = slot->bitmap.rows;
+            res->pitch = (int)res->width;
+            res->bitmap = (uint8_t *)malloc((size_t)res->width * res->rows + 1);
+
+            dest_itr = res->bitmap;
+            for (unsigned y = 0; y < res->rows; ++y) {
+                memcpy(dest_itr, src_itr, res->width);
+                src_itr += slot->bitmap.pitch;
+                dest_itr += res->pitch;
+            }
+        } else {
+            fprintf(stderr, "Unsupported pixel mode in glyph %d: %d\n",
+                    char_index, slot->bitmap.pixel_mode);
+        }
+
+        res->bbox.xMin = res->left;
+        res->bbox.xMax = res->left + (FT_Pos)res->width;
+        res->bbox.yMax = res->top;
+        res->bbox.yMin = res->top - (FT_Pos)res->rows;
 
         int *key = (int *)malloc(sizeof(int));
         *key = char_index;
 
         hashmapPut(font->glyph_cache, key, res);
+        font->atlas_dirty = true;
     }
 
     return res;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
+static void gr_ttf_copy_glyph_to_surface(GGLSurface *dest, const TrueTypeCacheEntry *ent, int offX, int offY, int base)
 {
     unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
+    const uint8_t *src_itr = ent->bitmap;
     uint8_t *dest_itr = dest->data;
 
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-        return -1;
-    }
-
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+    dest_itr += (offY + base - ent->top)*dest->stride + (offX + ent->left);
 
     // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
     // the result might end up being before the buffer - I'm not sure how to properly handle this.
@@ -376,49 +823,31 @@ static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph,
         dest_itr = dest->data;
     }
 
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
+    for (y = 0; y < ent->rows; ++y) {
+        memcpy(dest_itr, src_itr, ent->width);
+        src_itr += ent->pitch;
         dest_itr += dest->stride;
     }
-    return 0;
 }
 
 static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
 {
     char c;
     int char_idx;
-    int error;
-    FT_Glyph glyph;
     FT_BBox bbox;
-    FT_BBox bbox_glyph;
     TrueTypeCacheEntry *ent;
 
-    bbox.yMin = bbox_glyph.yMin = LONG_MAX;
-    bbox.yMax = bbox_glyph.yMax = LONG_MIN;
+    bbox.yMin = LONG_MAX;
+    bbox.yMax = LONG_MIN;
 
+    // Rasterizing the printable ASCII range here means that it always ends up
+    // in the glyph atlas
     for (c = '!'; c <= '~'; ++c) {
         char_idx = FT_Get_Char_Index(f->face, c);
-        ent = gr_ttf_glyph_cache_peek(f, char_idx);
+        ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
             bbox.yMin = MIN(bbox.yMin, ent->bbox.yMin);
             bbox.yMax = MAX(bbox.yMax, ent->bbox.yMax);
-        } else {
-            error = FT_Load_Glyph(f->face, char_idx, 0);
-            if (error) {
-                continue;
-            }
-
-            error = FT_Get_Glyph(f->face->glyph, &glyph);
-            if (error) {
-                continue;
-            }
-
-            FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_PIXELS, &bbox_glyph);
-            bbox.yMin = MIN(bbox.yMin, bbox_glyph.yMin);
-            bbox.yMax = MAX(bbox.yMax, bbox_glyph.yMax);
-
-            FT_Done_Glyph(glyph);
         }
     }
 
@@ -463,7 +892,7 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
+            diff = ent->advance;
 
             if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
                 FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
@@ -512,8 +941,8 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
+            gr_ttf_copy_glyph_to_surface(surface, ent, x, 0, font->base);
+            x += ent->advance;
         }
 
         prev_idx = char_idx;
@@ -533,6 +962,45 @@ static StringCacheEntry *gr_ttf_string_cache_peek(TrueTypeFont *font, const char
     return (StringCacheEntry *)hashmapGet(font->string_cache, &k);
 }
 
+static size_t gr_ttf_string_cache_entry_bytes(StringCacheEntry *e)
+{
+    return (size_t)e->surface.stride * e->surface.height;
+}
+
+// Evicts the least recently used strings (from the head of the list) once the
+// cache holds too many entries or too many rendered pixels. The most recently
+// used entry is always kept.
+static void gr_ttf_string_cache_trim(TrueTypeFont *font)
+{
+    StringCacheEntry *ent;
+    size_t max_entries = STRING_CACHE_MAX_ENTRIES;
+    size_t max_bytes = STRING_CACHE_MAX_BYTES;
+
+    if (hashmapSize(font->string_cache) < max_entries
+            && font->string_cache_bytes <= max_bytes) {
+        return;
+    }
+
+    printf("Truncating string cache entries.\n");
+
+    // Truncate in batches so that this doesn't run on every insertion
+    max_entries -= STRING_CACHE_TRUNCATE_ENTRIES;
+    max_bytes -= max_bytes / 4;
+
+    while (font->string_cache_head != font->string_cache_tail
+            && (hashmapSize(font->string_cache) > max_entries
+            || font->string_cache_bytes > max_bytes)) {
+        ent = font->string_cache_head;
+        font->string_cache_head = ent->next;
+        font->string_cache_head->prev = nullptr;
+        font->string_cache_bytes -= gr_ttf_string_cache_entry_bytes(ent);
+
+        hashmapRemove(font->string_cache, ent->key);
+
+        gr_ttf_freeStringCache(ent->key, ent, nullptr);
+    }
+}
+
 static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width)
 {
     StringCacheEntry *res;
@@ -567,6 +1035,9 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
         font->string_cache_tail = res;
 
         hashmapPut(font->string_cache, new_key, res);
+
+        font->string_cache_bytes += gr_ttf_string_cache_entry_bytes(res);
+        gr_ttf_string_cache_trim(font);
     } else if (res->next) {
         // move this entry to the tail of the linked list
         // if it isn't already there
@@ -584,22 +1055,6 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
         res->prev = font->string_cache_tail;
         res->prev->next = res;
         font->string_cache_tail = res;
-
-        // truncate old entries
-        if (hashmapSize(font->string_cache) >= STRING_CACHE_MAX_ENTRIES) {
-            printf("Truncating string cache entries.\n");
-            int i;
-            StringCacheEntry *ent;
-            for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
-                ent = font->string_cache_head;
-                font->string_cache_head = ent->next;
-                font->string_cache_head->prev = nullptr;
-
-                hashmapRemove(font->string_cache, ent->key);
-
-                gr_ttf_freeStringCache(ent->key, ent, nullptr);
-            }
-        }
     }
     return res;
 }
@@ -661,7 +1116,7 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
@@ -700,6 +1155,12 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
+    if (gr_blit_mask(context, &e->surface, x, y, e->surface.width,
+                     y_bottom - y)) {
+        pthread_mutex_unlock(&font->mutex);
+        return res;
+    }
+
     gl->bindTexture(gl, &e->surface);
     gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
     gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
@@ -754,10 +1215,12 @@ static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
            "    max_height: %d\n"
            "    base: %d\n"
            "    glyph_cache: %zu entries\n"
+           "    glyph_atlas: %ux%u%s\n"
            "    string_cache: %zu entries (%.2f kB)\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
            hashmapSize(f->glyph_cache),
+           f->atlas.width, f->atlas.height, f->atlas_dirty ? " (dirty)" : "",
            hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
 
     pthread_mutex_unlock(&f->mutex);
@@ -54,6 +54,9 @@
 // Number of seconds until screen timeout
 #define VAR_TW_SCREEN_TIMEOUT_SECS      "tw_screen_timeout_secs"
 
+// Whether frame timings are collected and drawn on screen
+#define VAR_TW_FRAME_STATS              "tw_frame_stats"
+
 // Whether reboot to system is enabled
 #define VAR_TW_REBOOT_SYSTEM            "tw_reboot_system"
 // Whether reboot to recovery is enabled
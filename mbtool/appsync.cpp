@@ -20,7 +20,14 @@
 #include "appsync.h"
 
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
 
 #include <cassert>
 #include <cstdio>
@@ -54,10 +61,12 @@
 #include "mbutil/fts.h"
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
+#include "mbutil/selinux_label.h"
 #include "mbutil/socket.h"
 #include "mbutil/string.h"
 
 #include "appsyncmanager.h"
+#include "file_contexts.h"
 #include "multiboot.h"
 #include "packages.h"
 #include "romconfig.h"
@@ -79,7 +88,11 @@
 #define INSTALLD_SOCKET_PERMS           0600
 #define INSTALLD_SOCKET_CONTEXT         "u:object_r:installd_socket:s0"
 
+#define INSTALLD_CONNECT_TIMEOUT        std::chrono::seconds(5)
+
 #define COMMAND_BUF_SIZE                1024
+// Same as installd's TOKEN_MAX
+#define COMMAND_MAX_ARGS                16
 
 #define PACKAGES_XML_PATH_FMT           "%s/system/packages.xml"
 
@@ -95,6 +108,99 @@ static Packages packages;
 
 static std::vector<RomConfigAndPackages> cfg_pkgs_list; // 'dat naming tho ;)
 
+// Raw path of the current ROM's /data
+static std::string rom_data_path;
+
+/*!
+ * \brief Runs work that neither installd nor its clients need to wait for
+ *
+ * Tasks are run in order on a single background thread. The destructor waits
+ * for all queued tasks to complete.
+ */
+class HookWorker
+{
+public:
+    HookWorker();
+    ~HookWorker();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(HookWorker)
+
+    void post(std::function<void()> task);
+
+private:
+    void run();
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _tasks;
+    bool _done;
+    std::thread _thread;
+};
+
+HookWorker::HookWorker()
+    : _done(false)
+    , _thread(&HookWorker::run, this)
+{
+}
+
+HookWorker::~HookWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _cv.notify_all();
+
+    _thread.join();
+}
+
+void HookWorker::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _cv.notify_one();
+}
+
+void HookWorker::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _cv.wait(lock, [&] { return _done || !_tasks.empty(); });
+
+        if (_tasks.empty()) {
+            break;
+        }
+
+        auto task = std::move(_tasks.front());
+        _tasks.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+static HookWorker *hook_worker;
+
+/*!
+ * \brief Link the current ROM's APKs and libraries to the shared file store
+ */
+static void link_app_files()
+{
+    auto start = steady_clock::now();
+
+    AppSyncManager::link_app_files(rom_data_path + "/app");
+    AppSyncManager::link_app_files(rom_data_path + "/app-lib");
+
+    auto stop = steady_clock::now();
+    LOGD("Linking app files took %" PRIu64 "ms",
+         static_cast<uint64_t>(duration_cast<milliseconds>(
+                stop - start).count()));
+}
+
 /*!
  * \brief Try loading the config file in /data/media/0/MultiBoot/[ROM ID]/config.json
  */
@@ -106,10 +212,11 @@ static bool load_config_files()
         return false;
     }
 
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
+
+    rom_data_path = current_rom->full_data_path();
 
-    for (const std::shared_ptr<Rom> &rom : roms.roms) {
+    for (const std::shared_ptr<Rom> &rom : roms->roms) {
         std::string config_path = rom->config_path();
         std::string packages_path = format(PACKAGES_XML_PATH_FMT,
                                            rom->full_data_path().c_str());
@@ -124,7 +231,8 @@ static bool load_config_files()
             LOGW("%s: Failed to load config for ROM %s",
                  config_path.c_str(), rom->id.c_str());
         }
-        if (!rom_packages.load_xml(packages_path)) {
+        if (!rom_packages.load_cached(packages_path,
+                                      get_raw_path(PACKAGES_CACHE_DIR))) {
             LOGW("%s: Failed to load packages for ROM %s",
                  packages_path.c_str(), rom->id.c_str());
         }
@@ -161,6 +269,9 @@ static bool prepare_appsync()
 
     auto start = steady_clock::now();
 
+    std::vector<SharedDataDirectory> dirs;
+    std::vector<SharedPackage *> dir_pkgs;
+
     for (auto it = config.shared_pkgs.begin();
             it != config.shared_pkgs.end();) {
         SharedPackage &shared_pkg = *it;
@@ -174,27 +285,24 @@ static bool prepare_appsync()
             continue;
         }
 
-        // Ensure that the data directory exists if data sharing is enabled
-        if (shared_pkg.share_data
-                && !AppSyncManager::create_shared_data_directory(
-                        shared_pkg.pkg_id, pkg->get_uid())) {
-            LOGW("Failed to create shared data directory for package %s. "
-                 "App data will not be shared", shared_pkg.pkg_id.c_str());
-            shared_pkg.share_data = false;
+        if (shared_pkg.share_data) {
+            dirs.push_back({ pkg->name, pkg->get_uid(), true });
         }
 
         ++it;
     }
 
-    // Ensure that the shared data is under the u:object_r:app_data_file:s0
-    // context. Otherwise, apps won't be able to write to the shared directory
-    bool disable_data_sharing = false;
-    if (!AppSyncManager::fix_shared_data_permissions()) {
-        LOGW("Failed to fix permissions on shared data directory");
-        LOGW("Data sharing will be disabled for all packages");
-        disable_data_sharing = true;
+    // Pointers are only taken once shared_pkgs is no longer modified
+    for (SharedPackage &shared_pkg : config.shared_pkgs) {
+        if (shared_pkg.share_data) {
+            dir_pkgs.push_back(&shared_pkg);
+        }
     }
 
+    // Ensure that the data directories exist and are owned by and labeled for
+    // the apps
+    AppSyncManager::prepare_shared_data_directories(dirs);
+
     auto stop = steady_clock::now();
     LOGD("Initialization stage 1 took %" PRIu64 "ms",
          static_cast<uint64_t>(duration_cast<milliseconds>(
@@ -203,17 +311,13 @@ static bool prepare_appsync()
     start = steady_clock::now();
 
     // Actually share the data
-    for (SharedPackage &shared_pkg : config.shared_pkgs) {
-        auto pkg = packages.find_by_pkg(shared_pkg.pkg_id);
-
-        if (disable_data_sharing) {
-            shared_pkg.share_data = false;
-        }
+    AppSyncManager::mount_shared_directories(dirs);
 
-        if (shared_pkg.share_data && !AppSyncManager::mount_shared_directory(
-                pkg->name, pkg->get_uid())) {
-            LOGW("Failed to mount shared data directory");
-            shared_pkg.share_data = false;
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        if (!dirs[i].ok) {
+            LOGW("Failed to share data directory for package %s. "
+                 "App data will not be shared", dirs[i].pkg.c_str());
+            dir_pkgs[i]->share_data = false;
         }
     }
 
@@ -350,25 +454,32 @@ static bool send_message(int fd, const char *command,
 {
     auto count = static_cast<uint16_t>(strlen(command));
 
+    // The whole message is sent with a single write
+    util::SocketWriter writer(fd);
+
     if (is_async) {
-        if (auto ret = util::socket_write_int32(fd, async_id); !ret) {
+        if (auto ret = writer.write_int32(async_id); !ret) {
             LOGE("Failed to write async command ID: %s",
                  ret.error().message().c_str());
             return false;
         }
     }
 
-    if (auto ret = util::socket_write_uint16(fd, count); !ret) {
+    if (auto ret = writer.write_uint16(count); !ret) {
         LOGE("Failed to write command size: %s", ret.error().message().c_str());
         return false;
     }
 
-    if (auto ret = util::socket_write(fd, command, count);
-            !ret || ret.value() != count) {
+    if (auto ret = writer.write(command, count); !ret) {
         LOGE("Failed to write command: %s", ret.error().message().c_str());
         return false;
     }
 
+    if (auto ret = writer.flush(); !ret) {
+        LOGE("Failed to send command: %s", ret.error().message().c_str());
+        return false;
+    }
+
     return true;
 }
 
@@ -394,21 +505,33 @@ static int connect_to_installd()
         return -1;
     }
 
-    int attempt;
-    for (attempt = 0; attempt < 5; ++attempt) {
-        LOGV("Connecting to installd [Attempt %d/%d]", attempt + 1, 5);
-        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
-            LOGW("Failed: %s", strerror(errno));
-            sleep(1);
-        } else {
+    // The socket already exists, but connecting fails until installd starts
+    // listening. There is nothing to be notified about, so retry quickly at
+    // first and back off to not spin if installd is slow to start.
+    using namespace std::chrono;
+    auto until = steady_clock::now() + INSTALLD_CONNECT_TIMEOUT;
+    auto delay = milliseconds(10);
+    int attempt = 1;
+
+    while (true) {
+        LOGV("Connecting to installd [Attempt %d]", attempt);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
             break;
         }
-    }
 
-    if (attempt == 5) {
-        LOGD("Failed to connect to installd after 5 attempts");
-        close(fd);
-        return -1;
+        LOGW("Failed: %s", strerror(errno));
+
+        auto now = steady_clock::now();
+        if (now >= until) {
+            LOGD("Failed to connect to installd after %d attempts", attempt);
+            close(fd);
+            return -1;
+        }
+
+        std::this_thread::sleep_for(std::min<steady_clock::duration>(
+                delay, until - now));
+        delay = std::min(delay * 2, milliseconds(500));
+        ++attempt;
     }
 
     LOGD("Connected to installd");
@@ -439,43 +562,68 @@ static pid_t spawn_installd()
     return pid;
 }
 
-static std::vector<std::string> parse_args(const char *cmdline)
+/*!
+ * \brief Space-separated tokens of an installd command
+ *
+ * The tokens point into the receive buffer, so they are only valid until the
+ * next message is received into it.
+ */
+struct CommandArgs
 {
-    std::vector<char> buf(cmdline, cmdline + strlen(cmdline) + 1);
-    std::vector<std::string> args;
-
-    char *temp;
-    char *token;
+    std::array<std::string_view, COMMAND_MAX_ARGS> args;
+    size_t count;
+};
 
-    token = strtok_r(buf.data(), " ", &temp);
-    while (token) {
-        args.push_back(token);
+/*!
+ * \brief Get the next space-separated token in a command
+ *
+ * \param[in,out] cmdline Remaining command. The token is removed from the front.
+ *
+ * \return Token or an empty view if there are no more tokens
+ */
+static std::string_view next_arg(std::string_view &cmdline)
+{
+    auto begin = cmdline.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        cmdline = {};
+        return {};
+    }
 
-        token = strtok_r(nullptr, " ", &temp);
+    auto end = cmdline.find(' ', begin);
+    if (end == std::string_view::npos) {
+        end = cmdline.size();
     }
 
-    return args;
+    auto token = cmdline.substr(begin, end - begin);
+    cmdline.remove_prefix(end);
+    return token;
 }
 
-static std::string args_to_string(const std::vector<std::string> &args)
+/*!
+ * \brief Tokenize a command without copying it
+ *
+ * \return Whether the command had at most COMMAND_MAX_ARGS tokens
+ */
+static bool parse_args(std::string_view cmdline, CommandArgs &out)
 {
-    std::string output("[");
-    for (size_t i = 0; i < args.size(); ++i) {
-        if (i != 0) {
-            output += ", ";
+    out.count = 0;
+
+    for (auto token = next_arg(cmdline); !token.empty();
+            token = next_arg(cmdline)) {
+        if (out.count == out.args.size()) {
+            return false;
         }
-        output += args[i];
+        out.args[out.count++] = token;
     }
-    output += "]";
-    return output;
+
+    return true;
 }
 
-static bool do_remove(const std::vector<std::string> &args)
+static bool do_remove(const CommandArgs &args)
 {
 #define TAG "[remove] "
-    const std::string &pkgname = args[0];
-    int userid [[maybe_unused]];
-    str_to_num(args[1].c_str(), 10, userid);
+    // args[2] is the user ID, which isn't needed
+    std::string_view pkgname = args.args[1];
 
     for (auto it = config.shared_pkgs.begin();
             it != config.shared_pkgs.end(); ++it) {
@@ -494,7 +642,8 @@ static bool do_remove(const std::vector<std::string> &args)
             // If data is shared, make sure the data directory is unmounted
             // before Android wipes it clean
             LOGV(TAG "Attempting to unmount shared data directory");
-            if (!AppSyncManager::unmount_shared_directory(pkgname)) {
+            if (!AppSyncManager::unmount_shared_directory(
+                    std::string(pkgname))) {
                 return false;
             }
         } else {
@@ -511,30 +660,51 @@ static bool do_remove(const std::vector<std::string> &args)
 
 struct CommandInfo
 {
-    const char *name;
+    std::string_view name;
     unsigned int nargs;
-    bool (*func)(const std::vector<std::string> &args);
+    bool (*func)(const CommandArgs &args);
 };
 
-static struct CommandInfo cmds[] = {
-    { "remove",  2, do_remove }
+static constexpr CommandInfo cmds[] = {
+    { "remove",  2, do_remove },
 };
 
-static void handle_command(const std::vector<std::string> &args)
+/*!
+ * \brief Find the hook for a command
+ *
+ * Only the command name is looked at, so commands that aren't hooked are never
+ * tokenized.
+ *
+ * \return Hook or nullptr if the command isn't hooked
+ */
+static const CommandInfo * find_command(std::string_view cmdline)
 {
-    for (std::size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
-        if (args[0] == cmds[i].name) {
-            if (args.size() - 1 != cmds[i].nargs) {
-                LOGE("%s requires %u arguments (%zu given)",
-                     cmds[i].name, cmds[i].nargs, args.size() - 1);
-                LOGE("%s command won't be hooked", cmds[i].name);
-            } else {
-                LOGD("Hooking %s command", cmds[i].name);
-                cmds[i].func(std::vector<std::string>(
-                        args.begin() + 1, args.end()));
-            }
+    std::string_view name = next_arg(cmdline);
+
+    for (auto const &cmd : cmds) {
+        if (name == cmd.name) {
+            return &cmd;
         }
     }
+
+    return nullptr;
+}
+
+static void handle_command(const CommandInfo &cmd, std::string_view cmdline)
+{
+    CommandArgs args;
+
+    if (!parse_args(cmdline, args) || args.count - 1 != cmd.nargs) {
+        LOGE("%.*s requires %u arguments: %.*s",
+             static_cast<int>(cmd.name.size()), cmd.name.data(), cmd.nargs,
+             static_cast<int>(cmdline.size()), cmdline.data());
+        LOGE("%.*s command won't be hooked",
+             static_cast<int>(cmd.name.size()), cmd.name.data());
+    } else {
+        LOGD("Hooking %.*s command",
+             static_cast<int>(cmd.name.size()), cmd.name.data());
+        cmd.func(args);
+    }
 }
 
 static bool handle_installd_event(int client_fd, int installd_fd,
@@ -555,8 +725,7 @@ static bool handle_installd_event(int client_fd, int installd_fd,
     }
     auto stop_installd = steady_clock::now();
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+    LOGD("Received async (probably) reply: %s", buf);
 
     auto start_send = steady_clock::now();
     if (!send_message(client_fd, buf, is_async, async_id)) {
@@ -599,62 +768,27 @@ static bool handle_android_event(int client_fd, int installd_fd,
 
     auto start = steady_clock::now();
 
-    std::vector<std::string> args = parse_args(buf);
-
-    bool log_result = true;
-
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                start_hook = steady_clock::now();
-                handle_command(args);
-                stop_hook = steady_clock::now();
-            }
-        } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
-        }
+    // Commands that aren't hooked are forwarded as-is without being tokenized
+    std::string_view cmdline(buf);
+    const CommandInfo *hook = can_appsync ? find_command(cmdline) : nullptr;
+
+    // Get size is so annoying we don't want it to show... EVER!
+    std::string_view remain = cmdline;
+    std::string_view name = next_arg(remain);
+    bool log_result = name != "getsize";
+    // dexopt is the last installd command for a newly installed package. Its
+    // files may still be in a staging directory that is renamed afterwards,
+    // but that keeps the links intact.
+    bool link_files = can_appsync && name == "dexopt";
+
+    if (hook) {
+        LOGD("Received command: %s", buf);
+
+        start_hook = steady_clock::now();
+        handle_command(*hook, cmdline);
+        stop_hook = steady_clock::now();
+    } else if (log_result) {
+        LOGV("Forwarding command: %s", buf);
     }
 
     auto start_installd = steady_clock::now();
@@ -669,10 +803,16 @@ static bool handle_android_event(int client_fd, int installd_fd,
     }
     auto stop_installd = steady_clock::now();
 
-    args = parse_args(buf);
-
     if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+        LOGD("Sending reply: %s", buf);
+    }
+
+    // The command in buf was overwritten by the reply
+    if (link_files && hook_worker) {
+        std::string_view reply(buf);
+        if (next_arg(reply) == "0") {
+            hook_worker->post(link_app_files);
+        }
     }
 
     auto start_send = steady_clock::now();
@@ -692,7 +832,7 @@ static bool handle_android_event(int client_fd, int installd_fd,
         LOGD("- Time to complete installd command:   %" PRIu64 "ms",
              static_cast<uint64_t>(duration_cast<milliseconds>(
                     stop_installd - start_installd).count()));
-        if (can_appsync) {
+        if (hook) {
             LOGD("- Time to hook installd command:       %" PRIu64 "ms",
                  static_cast<uint64_t>(duration_cast<milliseconds>(
                         stop_hook - start_hook).count()));
@@ -943,11 +1083,29 @@ int appsync_main(int argc, char *argv[])
 
     LOGI("=== APPSYNC VERSION %s ===", version());
 
-    LOGI("Calling restorecon on /data/media/obb");
-    std::vector<std::string> restorecon{
-        "restorecon", "-R", "-F", "/data/media/obb"
-    };
-    util::run_command(restorecon[0], restorecon, {}, {}, nullptr, nullptr);
+    HookWorker worker;
+
+    worker.post([] {
+        LOGI("Restoring SELinux labels on /data/media/obb");
+
+        // Relabel in-process so that the specs are only compiled once and
+        // each path only has to be matched against the specs sharing its stem
+        util::FileContexts contexts;
+        if (load_device_file_contexts(contexts)) {
+            if (auto r = util::selinux_restore_context_recursive(
+                    "/data/media/obb", contexts); !r) {
+                LOGW("/data/media/obb: Failed to restore labels: %s",
+                     r.error().message().c_str());
+            }
+            return;
+        }
+
+        LOGW("Falling back to calling restorecon on /data/media/obb");
+        std::vector<std::string> restorecon{
+            "restorecon", "-R", "-F", "/data/media/obb"
+        };
+        util::run_command(restorecon[0], restorecon, {}, {}, nullptr, nullptr);
+    });
 
     bool can_appsync = false;
 
@@ -963,6 +1121,13 @@ int appsync_main(int argc, char *argv[])
             if (!can_appsync) {
                 LOGW("appsync preparation failed. "
                      "App sharing is completely disabled");
+            } else {
+                hook_worker = &worker;
+
+                worker.post([] {
+                    AppSyncManager::prune_app_store();
+                    link_app_files();
+                });
             }
             LOGD("Entire appsync preparation took %" PRIu64 "ms",
                  static_cast<uint64_t>(duration_cast<milliseconds>(
@@ -20,67 +20,486 @@
 #include "appsyncmanager.h"
 
 #include <algorithm>
+#include <memory>
+#include <set>
+#include <tuple>
+#include <unordered_map>
 
 #include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/chown.h"
 #include "mbutil/directory.h"
 #include "mbutil/fts.h"
+#include "mbutil/hash.h"
 #include "mbutil/selinux.h"
+#include "mbutil/string.h"
 
 #define LOG_TAG "mbtool/appsyncmanager"
 
 #define APP_SHARING_DATA_DIR            "/data/multiboot/_appsharing/data"
+#define APP_SHARING_MANIFEST            "/data/multiboot/_appsharing/manifest"
+#define APP_SHARING_STORE_DIR           "/data/multiboot/_appsharing/store"
 
 #define USER_DATA_DIR                   "/data/data"
 
+// Files changed more recently than this are skipped until the next scan. Their
+// timestamps may not have ticked yet for a write that is still in progress.
+#define APP_FILE_MIN_AGE_SECS           5
+
+// Older kernel headers don't have the generic reflink ioctl
+#ifndef FICLONE
+#  define FICLONE                       _IOW(0x94, 9, int)
+#endif
+
 static std::string _as_data_dir;
+static std::string _as_manifest;
+static std::string _as_store_dir;
 static std::string _user_data_dir;
 
 namespace mb
 {
 
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+// (inode, mtime seconds, mtime nanoseconds) of a directory
+using DirectoryKey = std::tuple<uint64_t, int64_t, int64_t>;
+
+/*!
+ * \brief State of a shared data directory as of the last time it was fixed
+ */
+struct SharedDataState
+{
+    uid_t uid;
+    std::string context;
+    // Directories whose direct entries have the right owner and label
+    std::set<DirectoryKey> dirs;
+};
+
+using SharedDataManifest = std::unordered_map<std::string, SharedDataState>;
+
+static DirectoryKey directory_key(const struct stat &sb)
+{
+    return { sb.st_ino, sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec };
+}
+
+/*!
+ * \brief Identity of an app file at the time it was hashed
+ *
+ * Replacing the file changes the inode and writing to it changes the size or
+ * the timestamps, so a file whose stamp still matches has the hashed contents.
+ */
+struct AppFileStamp
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    timespec mtime;
+    timespec ctime;
+};
+
+static AppFileStamp app_file_stamp(const struct stat &sb)
+{
+    return { sb.st_dev, sb.st_ino, sb.st_size, sb.st_mtim, sb.st_ctim };
+}
+
+static bool operator==(const timespec &a, const timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool operator==(const AppFileStamp &a, const AppFileStamp &b)
+{
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size
+            && a.mtime == b.mtime && a.ctime == b.ctime;
+}
+
+static bool operator!=(const AppFileStamp &a, const AppFileStamp &b)
+{
+    return !(a == b);
+}
+
 /*!
- * Recursively chmod directories to 755 and files to 0644 and chown everything
- * system:system.
+ * \brief Load the manifest of fixed directories
+ *
+ * The format is a "pkg <name> <uid> <context>" line followed by one
+ * "<inode> <mtime sec> <mtime nsec>" line per directory. A missing or corrupt
+ * manifest just means that everything gets fixed.
  */
-class FixPermissions : public util::FtsWrapper {
+static SharedDataManifest load_manifest(const std::string &path)
+{
+    SharedDataManifest manifest;
+
+    ScopedFILE fp(fopen(path.c_str(), "re"), fclose);
+    if (!fp) {
+        return manifest;
+    }
+
+    char *line = nullptr;
+    size_t size = 0;
+    SharedDataState *state = nullptr;
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
+    while (getline(&line, &size, fp.get()) >= 0) {
+        char name[256];
+        char context[256];
+        unsigned int uid;
+        uint64_t ino;
+        int64_t sec;
+        int64_t nsec;
+
+        if (sscanf(line, "pkg %255s %u %255s", name, &uid, context) == 3) {
+            state = &manifest[name];
+            state->uid = uid;
+            state->context = context;
+            state->dirs.clear();
+        } else if (state && sscanf(line, "%" SCNu64 " %" SCNd64 " %" SCNd64,
+                                   &ino, &sec, &nsec) == 3) {
+            state->dirs.emplace(ino, sec, nsec);
+        } else {
+            LOGW("%s: Ignoring corrupt manifest", path.c_str());
+            manifest.clear();
+            break;
+        }
+    }
+
+    return manifest;
+}
+
+static bool save_manifest(const std::string &path,
+                          const SharedDataManifest &manifest)
+{
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), fclose);
+    if (!fp) {
+        LOGW("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (auto const &[pkg, state] : manifest) {
+        fprintf(fp.get(), "pkg %s %u %s\n",
+                pkg.c_str(), state.uid, state.context.c_str());
+        for (auto const &[ino, sec, nsec] : state.dirs) {
+            fprintf(fp.get(), "%" PRIu64 " %" PRId64 " %" PRId64 "\n",
+                    ino, sec, nsec);
+        }
+    }
+
+    if (fclose(fp.release()) != 0
+            || rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to write manifest: %s", path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * Recursively chown everything to the app's UID and set the SELinux label.
+ *
+ * Entries in directories listed in \p clean are skipped. A directory's mtime
+ * changes whenever an entry is added, removed, or renamed in it, so an
+ * unchanged directory still only contains entries that were fixed before. Its
+ * subdirectories are still visited since they are keyed separately.
+ */
+class FixSharedData : public util::FtsWrapper {
 public:
-    FixPermissions(std::string path)
+    FixSharedData(std::string path, uid_t uid, std::string context,
+                  const std::set<DirectoryKey> *clean)
         : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
+        , _uid(uid)
+        , _context(std::move(context))
+        , _clean(clean)
+        , _fixed(0)
     {
     }
 
-    Actions on_changed_path() override
+    Actions on_reached_directory_pre() override
     {
-        (void) util::chown(_curr->fts_accpath, "system", "system", 0);
-        return Action::Ok;
+        DirectoryKey key = directory_key(*_curr->fts_statp);
+        bool clean = _clean && _clean->find(key) != _clean->end();
+
+        // Checked by the directory's children
+        _curr->fts_number = clean;
+        _dirs.insert(key);
+
+        return clean ? Action::Ok : fix();
     }
 
     Actions on_reached_file() override
     {
-        chmod(_curr->fts_accpath, 0644);
+        return _curr->fts_parent->fts_number ? Action::Ok : fix();
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return _curr->fts_parent->fts_number ? Action::Ok : fix();
+    }
+
+    Actions on_reached_special_file() override
+    {
+        return _curr->fts_parent->fts_number ? Action::Ok : fix();
+    }
+
+    std::set<DirectoryKey> & dirs()
+    {
+        return _dirs;
+    }
+
+    uint64_t fixed() const
+    {
+        return _fixed;
+    }
+
+private:
+    uid_t _uid;
+    std::string _context;
+    const std::set<DirectoryKey> *_clean;
+    std::set<DirectoryKey> _dirs;
+    uint64_t _fixed;
+
+    Actions fix()
+    {
+        const struct stat *sb = _curr->fts_statp;
+
+        ++_fixed;
+
+        if ((sb->st_uid != _uid || sb->st_gid != _uid)
+                && lchown(_curr->fts_accpath, _uid, _uid) < 0) {
+            _error_msg = format("%s: Failed to chown: %s",
+                                _curr->fts_path, strerror(errno));
+            return Action::Fail;
+        }
+
+        if (auto r = util::selinux_lset_context(
+                _curr->fts_accpath, _context); !r) {
+            _error_msg = format("%s: Failed to set context to %s: %s",
+                                _curr->fts_path, _context.c_str(),
+                                r.error().message().c_str());
+            return Action::Fail;
+        }
+
         return Action::Ok;
     }
+};
 
-    Actions on_reached_directory_pre() override
+/*!
+ * \brief Collect APKs and native libraries that aren't linked to the store
+ *
+ * Files in /data/app normally have a single link, so files with more than one
+ * are assumed to already be linked to a store entry. This keeps rescans down
+ * to a stat() per file. Files that were changed in the last
+ * APP_FILE_MIN_AGE_SECS seconds are left for the next scan.
+ */
+class FindUnlinkedAppFiles : public util::FtsWrapper {
+public:
+    FindUnlinkedAppFiles(std::string path)
+        : FtsWrapper(std::move(path), util::FtsFlags())
+        , _now(time(nullptr))
     {
-        chmod(_curr->fts_accpath, 0755);
+    }
+
+    Actions on_reached_file() override
+    {
+        const struct stat *sb = _curr->fts_statp;
+        std::string_view name(_curr->fts_name);
+
+        if (sb->st_nlink == 1 && sb->st_size > 0
+                && (ends_with(name, ".apk") || ends_with(name, ".so"))
+                && sb->st_mtim.tv_sec + APP_FILE_MIN_AGE_SECS < _now
+                && sb->st_ctim.tv_sec + APP_FILE_MIN_AGE_SECS < _now) {
+            _paths.emplace_back(_curr->fts_path);
+            _stamps.push_back(app_file_stamp(*sb));
+        }
+
         return Action::Ok;
     }
+
+    std::vector<std::string> & paths()
+    {
+        return _paths;
+    }
+
+    std::vector<AppFileStamp> & stamps()
+    {
+        return _stamps;
+    }
+
+private:
+    time_t _now;
+    std::vector<std::string> _paths;
+    // Stamps of the files before they were hashed
+    std::vector<AppFileStamp> _stamps;
 };
 
+/*!
+ * \brief Replace \p path with a reflinked copy of \p store_path
+ *
+ * The copy gets its own inode, so the owner, mode, and label of \p path are
+ * kept.
+ */
+static bool reflink_from_store(const std::string &store_path,
+                               const std::string &path,
+                               const struct stat &sb,
+                               const std::string &context)
+{
+    std::string temp_path(path);
+    temp_path += ".mbstore";
+
+    int src_fd = open(store_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0) {
+        return false;
+    }
+
+    auto close_src_fd = finally([&] {
+        close(src_fd);
+    });
+
+    int dst_fd = open(temp_path.c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      sb.st_mode & 07777);
+    if (dst_fd < 0) {
+        return false;
+    }
+
+    bool ret = ioctl(dst_fd, FICLONE, src_fd) == 0
+            && fchown(dst_fd, sb.st_uid, sb.st_gid) == 0
+            && fchmod(dst_fd, sb.st_mode & 07777) == 0
+            && util::selinux_fset_context(dst_fd, context);
+
+    if (close(dst_fd) < 0) {
+        ret = false;
+    }
+
+    if (!ret || rename(temp_path.c_str(), path.c_str()) < 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Link a file to the store entry for its contents
+ *
+ * If there's no entry yet, the file itself becomes the entry. Otherwise, the
+ * file is replaced by a hard link to the entry. Hard links share the owner,
+ * mode, and label, so if those differ, a reflink is used instead on
+ * filesystems that support it.
+ *
+ * Nothing is done if the file no longer matches \p stamp, which was taken
+ * before the file was hashed. This way, an APK or library that was replaced
+ * or updated in the meantime is never overwritten with the old contents.
+ *
+ * \return Whether the file now shares its data with the store
+ */
+static bool link_to_store(const std::string &path, const AppFileStamp &stamp,
+                          const std::string &hash)
+{
+    std::string store_path(_as_store_dir);
+    store_path += "/";
+    store_path += hash;
+
+    struct stat sb;
+    struct stat store_sb;
+
+    if (lstat(path.c_str(), &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        return false;
+    } else if (app_file_stamp(sb) != stamp) {
+        LOGV("%s: Changed since it was hashed", path.c_str());
+        return false;
+    }
+
+    if (lstat(store_path.c_str(), &store_sb) < 0) {
+        if (errno != ENOENT) {
+            return false;
+        }
+
+        // The kernel refuses to link across mounts, which covers ROMs with
+        // image-backed or external data
+        if (link(path.c_str(), store_path.c_str()) < 0) {
+            LOGV("%s: Failed to add to store: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        // The path may have been replaced or written to right before it was
+        // linked. Never keep an entry whose contents don't match its name.
+        // The link itself updates the ctime, so that is not compared.
+        if (lstat(store_path.c_str(), &store_sb) < 0
+                || store_sb.st_dev != stamp.dev
+                || store_sb.st_ino != stamp.ino
+                || store_sb.st_size != stamp.size
+                || !(store_sb.st_mtim == stamp.mtime)) {
+            LOGV("%s: Changed while being added to store", path.c_str());
+            unlink(store_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    if (store_sb.st_ino == sb.st_ino && store_sb.st_dev == sb.st_dev) {
+        return true;
+    } else if (store_sb.st_size != sb.st_size) {
+        LOGW("%s: Store entry %s has a different size",
+             path.c_str(), hash.c_str());
+        return false;
+    }
+
+    auto context = util::selinux_lget_context(path);
+    auto store_context = util::selinux_lget_context(store_path);
+    if (!context || !store_context) {
+        return false;
+    }
+
+    if (store_sb.st_uid == sb.st_uid && store_sb.st_gid == sb.st_gid
+            && store_sb.st_mode == sb.st_mode
+            && store_context.value() == context.value()) {
+        std::string temp_path(path);
+        temp_path += ".mbstore";
+
+        if (link(store_path.c_str(), temp_path.c_str()) == 0) {
+            if (rename(temp_path.c_str(), path.c_str()) == 0) {
+                return true;
+            }
+            unlink(temp_path.c_str());
+        }
+    }
+
+    return reflink_from_store(store_path, path, sb, context.value());
+}
+
 void AppSyncManager::detect_directories()
 {
     _as_data_dir = get_raw_path(APP_SHARING_DATA_DIR);
+    _as_manifest = get_raw_path(APP_SHARING_MANIFEST);
+    _as_store_dir = get_raw_path(APP_SHARING_STORE_DIR);
     _user_data_dir = USER_DATA_DIR;
 
     LOGD("App sharing app data directory: %s", _as_data_dir.c_str());
+    LOGD("App sharing file store:         %s", _as_store_dir.c_str());
     LOGD("User app data directory:        %s", _user_data_dir.c_str());
 }
 
@@ -104,85 +523,237 @@ bool AppSyncManager::initialize_directories()
         return false;
     }
 
+    // The store is only an optimization, so app sharing works without it
+    if (auto r = util::mkdir_recursive(_as_store_dir, 0700);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create directory: %s", _as_store_dir.c_str(),
+             r.error().message().c_str());
+    }
+
     return true;
 }
 
-bool AppSyncManager::create_shared_data_directory(const std::string &pkg, uid_t uid)
+/*!
+ * \brief Share identical APKs and native libraries with other ROMs
+ *
+ * Files under \p path are linked to entries in a store, keyed by their SHA-256
+ * digest, which lives on the same filesystem as each ROM's /data/app. A ROM
+ * that installs an app that another ROM already has then only keeps one copy
+ * of the data. Android never modifies installed APKs or libraries in place, so
+ * sharing the data is safe. Deleting an app just drops one link.
+ *
+ * \note Hard links also share the owner, mode, and SELinux label. If one ROM
+ *       runs chown, chmod, or restorecon on a linked file, the change applies
+ *       to every ROM that shares it. installd gives the same owner and mode to
+ *       APKs and libraries in every ROM. But a ROM whose policy labels
+ *       /data/app differently relabels the shared files for all ROMs.
+ *       Reflinked copies are not affected.
+ *
+ * \param path Raw path of the directory to scan (eg. the ROM's /data/app)
+ */
+void AppSyncManager::link_app_files(const std::string &path)
 {
-    std::string data_path = get_shared_data_path(pkg);
+    FindUnlinkedAppFiles fuaf(path);
+    if (!fuaf.run()) {
+        // Apps may be removed or renamed from their staging directories while
+        // the tree is being walked
+        LOGV("%s", fuaf.error().c_str());
+    }
 
-    if (auto r = util::mkdir_recursive(data_path, 0751); !r) {
-        LOGW("[%s] %s: Failed to create directory: %s",
-             pkg.c_str(), data_path.c_str(), r.error().message().c_str());
-        return false;
+    auto &paths = fuaf.paths();
+    auto &stamps = fuaf.stamps();
+    if (paths.empty()) {
+        return;
     }
 
-    // Ensure that the shared data directory permissions are correct
-    if (chmod(data_path.c_str(), 0751) < 0) {
-        LOGW("[%s] %s: Failed to chmod: %s",
-             pkg.c_str(), data_path.c_str(), strerror(errno));
-        return false;
+    auto hashes = util::hash_paths(util::HashAlgorithm::Sha256, paths,
+                                   std::thread::hardware_concurrency());
+    uint64_t linked = 0;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!hashes[i]) {
+            LOGV("%s: Failed to hash: %s", paths[i].c_str(),
+                 hashes[i].error().message().c_str());
+            continue;
+        }
+
+        auto const &digest = hashes[i].value();
+        if (link_to_store(paths[i], stamps[i],
+                          util::hex_string(digest.data(), digest.size()))) {
+            ++linked;
+        }
     }
 
-    if (auto r = util::chown(
-            data_path, uid, uid, util::ChownFlag::Recursive); !r) {
-        LOGW("[%s] %s: Failed to chown: %s",
-             pkg.c_str(), data_path.c_str(), r.error().message().c_str());
-        return false;
+    LOGV("%s: Linked %" PRIu64 "/%zu files to the store",
+         path.c_str(), linked, paths.size());
+}
+
+/*!
+ * \brief Remove store entries that are no longer used by any ROM
+ *
+ * An entry whose only link is the store's own isn't referenced by any hard
+ * link. Reflinked copies own their data, so they are not affected.
+ */
+void AppSyncManager::prune_app_store()
+{
+    DIR *dp = opendir(_as_store_dir.c_str());
+    if (!dp) {
+        return;
     }
 
-    return true;
+    auto close_dp = finally([&] {
+        closedir(dp);
+    });
+
+    int dfd = dirfd(dp);
+    uint64_t removed = 0;
+
+    while (auto *ent = readdir(dp)) {
+        struct stat sb;
+
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+
+        if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+                && S_ISREG(sb.st_mode) && sb.st_nlink == 1
+                && unlinkat(dfd, ent->d_name, 0) == 0) {
+            ++removed;
+        }
+    }
+
+    LOGV("Removed %" PRIu64 " unused entries from the store", removed);
 }
 
-bool AppSyncManager::fix_shared_data_permissions()
+/*!
+ * \brief Create shared data directories and fix their ownership and labels
+ *
+ * Only directories that changed since the last time they were fixed for the
+ * same UID and SELinux context are walked in full. The state is kept in a
+ * manifest next to the shared data so that switching between ROMs, where the
+ * UIDs differ, still fixes everything.
+ *
+ * \param dirs Directories to prepare. SharedDataDirectory::ok is cleared for
+ *             the directories that could not be prepared.
+ */
+void AppSyncManager::prepare_shared_data_directories(
+        std::vector<SharedDataDirectory> &dirs)
 {
+    // Ensure that the shared data is under the u:object_r:app_data_file:s0
+    // context. Otherwise, apps won't be able to write to the shared directory
     std::string context("u:object_r:app_data_file:s0");
     if (auto ret = util::selinux_lget_context(
             "/data/data/com.android.systemui")) {
         context.swap(ret.value());
     }
 
-    if (auto ret = util::selinux_lset_context_recursive(
-            _as_data_dir, context); !ret) {
-        LOGW("%s: Failed to set context recursively to %s: %s",
+    if (auto r = util::selinux_lset_context(_as_data_dir, context); !r) {
+        LOGW("%s: Failed to set context to %s: %s",
              _as_data_dir.c_str(), context.c_str(),
-             ret.error().message().c_str());
-        return false;
+             r.error().message().c_str());
     }
 
-    return true;
-}
-
-bool AppSyncManager::mount_shared_directory(const std::string &pkg, uid_t uid)
-{
-    std::string data_path = get_shared_data_path(pkg);
-    std::string target(_user_data_dir);
-    target += "/";
-    target += pkg;
-
-    if (auto r = util::mkdir_recursive(target, 0755); !r) {
-        LOGW("[%s] %s: Failed to create directory: %s",
-             pkg.c_str(), target.c_str(), r.error().message().c_str());
-        return false;
-    }
-    if (auto r = util::chown(target, uid, uid, util::ChownFlag::Recursive); !r) {
-        LOGW("[%s] %s: Failed to chown: %s",
-             pkg.c_str(), target.c_str(), r.error().message().c_str());
-        return false;
+    SharedDataManifest manifest = load_manifest(_as_manifest);
+
+    for (SharedDataDirectory &dir : dirs) {
+        if (!dir.ok) {
+            continue;
+        }
+
+        std::string data_path = get_shared_data_path(dir.pkg);
+
+        if (auto r = util::mkdir_recursive(data_path, 0751); !r) {
+            LOGW("[%s] %s: Failed to create directory: %s",
+                 dir.pkg.c_str(), data_path.c_str(),
+                 r.error().message().c_str());
+            dir.ok = false;
+            continue;
+        }
+
+        // Ensure that the shared data directory permissions are correct
+        if (chmod(data_path.c_str(), 0751) < 0) {
+            LOGW("[%s] %s: Failed to chmod: %s",
+                 dir.pkg.c_str(), data_path.c_str(), strerror(errno));
+            dir.ok = false;
+            continue;
+        }
+
+        const std::set<DirectoryKey> *clean = nullptr;
+        auto it = manifest.find(dir.pkg);
+        if (it != manifest.end() && it->second.uid == dir.uid
+                && it->second.context == context) {
+            clean = &it->second.dirs;
+        }
+
+        FixSharedData fsd(data_path, dir.uid, context, clean);
+        if (!fsd.run()) {
+            LOGW("[%s] %s", dir.pkg.c_str(), fsd.error().c_str());
+            if (it != manifest.end()) {
+                manifest.erase(it);
+            }
+            dir.ok = false;
+            continue;
+        }
+
+        LOGV("[%s] Fixed %" PRIu64 " entries", dir.pkg.c_str(), fsd.fixed());
+
+        SharedDataState &state = manifest[dir.pkg];
+        state.uid = dir.uid;
+        state.context = context;
+        state.dirs.swap(fsd.dirs());
     }
 
-    LOGV("[%s] Bind mounting data directory:", pkg.c_str());
-    LOGV("[%s] - Source: %s", pkg.c_str(), data_path.c_str());
-    LOGV("[%s] - Target: %s", pkg.c_str(), target.c_str());
+    save_manifest(_as_manifest, manifest);
+}
 
-    if (!unmount_shared_directory(pkg)) {
-        return false;
-    } else if (mount(data_path.c_str(), target.c_str(), "", MS_BIND, "") < 0) {
-        LOGW("[%s] Failed to bind mount: %s", pkg.c_str(), strerror(errno));
-        return false;
+/*!
+ * \brief Bind mount shared data directories over the apps' data directories
+ *
+ * The mount points are hidden by the bind mounts, so only the mount points
+ * themselves are chowned and their contents are left alone.
+ *
+ * \param dirs Directories to mount. Entries where SharedDataDirectory::ok is
+ *             false are skipped and it is cleared if mounting fails.
+ */
+void AppSyncManager::mount_shared_directories(
+        std::vector<SharedDataDirectory> &dirs)
+{
+    for (SharedDataDirectory &dir : dirs) {
+        if (!dir.ok) {
+            continue;
+        }
+
+        std::string data_path = get_shared_data_path(dir.pkg);
+        std::string target(_user_data_dir);
+        target += "/";
+        target += dir.pkg;
+
+        if (mkdir(target.c_str(), 0755) < 0 && errno != EEXIST) {
+            LOGW("[%s] %s: Failed to create directory: %s",
+                 dir.pkg.c_str(), target.c_str(), strerror(errno));
+            dir.ok = false;
+            continue;
+        }
+        if (lchown(target.c_str(), dir.uid, dir.uid) < 0) {
+            LOGW("[%s] %s: Failed to chown: %s",
+                 dir.pkg.c_str(), target.c_str(), strerror(errno));
+            dir.ok = false;
+            continue;
+        }
+
+        LOGV("[%s] Bind mounting data directory:", dir.pkg.c_str());
+        LOGV("[%s] - Source: %s", dir.pkg.c_str(), data_path.c_str());
+        LOGV("[%s] - Target: %s", dir.pkg.c_str(), target.c_str());
+
+        if (!unmount_shared_directory(dir.pkg)) {
+            dir.ok = false;
+        } else if (mount(data_path.c_str(), target.c_str(), "", MS_BIND, "")
+                < 0) {
+            LOGW("[%s] Failed to bind mount: %s",
+                 dir.pkg.c_str(), strerror(errno));
+            dir.ok = false;
+        }
     }
-
-    return true;
 }
 
 bool AppSyncManager::unmount_shared_directory(const std::string &pkg)
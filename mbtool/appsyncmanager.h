@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "packages.h"
 #include "roms.h"
@@ -35,6 +36,14 @@ struct RomConfigAndPackages
     Packages packages;
 };
 
+struct SharedDataDirectory
+{
+    std::string pkg;
+    uid_t uid;
+    // Cleared if the directory could not be prepared or mounted
+    bool ok;
+};
+
 class AppSyncManager
 {
 public:
@@ -43,11 +52,15 @@ public:
     static std::string get_shared_data_path(const std::string &pkg);
 
     static bool initialize_directories();
-    static bool create_shared_data_directory(const std::string &pkg, uid_t uid);
-    static bool fix_shared_data_permissions();
+    static void prepare_shared_data_directories(
+            std::vector<SharedDataDirectory> &dirs);
 
-    static bool mount_shared_directory(const std::string &pkg, uid_t uid);
+    static void mount_shared_directories(
+            std::vector<SharedDataDirectory> &dirs);
     static bool unmount_shared_directory(const std::string &pkg);
+
+    static void link_app_files(const std::string &path);
+    static void prune_app_store();
 };
 
 }
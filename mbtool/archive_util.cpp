@@ -19,9 +19,13 @@
 
 #include "archive_util.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <cstring>
 
+#include <unistd.h>
+
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/archive_util"
@@ -31,34 +35,145 @@
 namespace mb
 {
 
-bool la_copy_data_to_fd(archive *a, int fd)
+static bool write_full(int fd, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static bool write_zeros(int fd, int64_t size)
+{
+    static constexpr char zeros[BUF_SIZE] = {};
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<int64_t>(
+                size, static_cast<int64_t>(sizeof(zeros))));
+        if (!write_full(fd, zeros, n)) {
+            return false;
+        }
+
+        size -= static_cast<int64_t>(n);
+    }
+
+    return true;
+}
+
+static bool pwrite_full(int fd, const void *buf, size_t size, off64_t offset)
 {
-    char buf[BUF_SIZE];
-    la_ssize_t n_read;
-    ssize_t n_written;
-    la_ssize_t remain;
-
-    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
-        remain = n_read;
-
-        while (remain > 0) {
-            n_written = write(fd, buf + (n_read - remain),
-                              static_cast<size_t>(remain));
-            if (n_written <= 0) {
-                LOGE("Failed to write data: %s", strerror(errno));
-                return false;
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pwrite64(fd, ptr, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the data of the current archive entry to a file descriptor
+ *
+ * The data blocks are written straight from libarchive's buffers. If \p fd is
+ * seekable, each block is written at its offset relative to the current file
+ * position, so holes in sparse entries are not written out. Otherwise, the holes
+ * are filled with zeros.
+ *
+ * libarchive does not report a hole at the end of an entry. If \p entry is
+ * given, its size is used to recreate that hole.
+ *
+ * As with write(), the file position ends up after the entry's data.
+ */
+bool la_copy_data_to_fd(archive *a, int fd, archive_entry *entry)
+{
+    off64_t base = lseek64(fd, 0, SEEK_CUR);
+    if (base < 0 && errno != ESPIPE) {
+        LOGE("Failed to get file position: %s", strerror(errno));
+        return false;
+    }
+
+    const void *buf;
+    size_t size;
+    la_int64_t offset;
+    la_int64_t end = 0;
+    int ret;
+
+    while ((ret = archive_read_data_block(a, &buf, &size, &offset))
+            == ARCHIVE_OK) {
+        bool ok;
+
+        if (base >= 0) {
+            ok = pwrite_full(fd, buf, size, base + offset);
+        } else {
+            ok = (offset <= end || write_zeros(fd, offset - end))
+                    && write_full(fd, buf, size);
+        }
 
-            remain -= n_written;
+        if (!ok) {
+            LOGE("Failed to write data: %s", strerror(errno));
+            return false;
         }
+
+        end = std::max(end, offset + static_cast<la_int64_t>(size));
     }
 
-    if (n_read < 0) {
+    if (ret != ARCHIVE_EOF) {
         LOGE("Failed to read archive entry data: %s",
              archive_error_string(a));
         return false;
     }
 
+    la_int64_t data_end = end;
+
+    if (entry && archive_entry_size_is_set(entry)) {
+        end = std::max(end, archive_entry_size(entry));
+    }
+
+    if (base < 0) {
+        if (!write_zeros(fd, end - data_end)) {
+            LOGE("Failed to write data: %s", strerror(errno));
+            return false;
+        }
+    } else {
+        off64_t file_size = lseek64(fd, 0, SEEK_END);
+        if (file_size < 0) {
+            LOGE("Failed to seek file: %s", strerror(errno));
+            return false;
+        }
+
+        if (file_size < base + end && ftruncate64(fd, base + end) < 0) {
+            LOGE("Failed to extend file: %s", strerror(errno));
+            return false;
+        }
+
+        if (lseek64(fd, base + end, SEEK_SET) < 0) {
+            LOGE("Failed to seek file: %s", strerror(errno));
+            return false;
+        }
+    }
+
     return true;
 }
 
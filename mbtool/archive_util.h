@@ -20,10 +20,11 @@
 #pragma once
 
 #include <archive.h>
+#include <archive_entry.h>
 
 namespace mb
 {
 
-bool la_copy_data_to_fd(archive *a, int fd);
+bool la_copy_data_to_fd(archive *a, int fd, archive_entry *entry = nullptr);
 
 }
@@ -19,26 +19,401 @@
 
 #include "auditd.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
 #include <cerrno>
+#include <cinttypes>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <getopt.h>
+#include <poll.h>
 #include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 
 #include "external/audit/libaudit.h"
 
 #define LOG_TAG "mbtool/auditd"
 
+// Maximum number of netlink messages received per recvmmsg() call
+#define AUDIT_BATCH_SIZE                16
+
+// Identical AVC denials within this many seconds are only logged once
+#define AUDIT_DEFAULT_DEDUP_WINDOW      5
+
+// Maximum number of lines waiting to be logged before new ones are dropped
+#define AUDIT_LOG_QUEUE_MAX             1024
+
+using namespace std::chrono;
 
 namespace mb
 {
 
-static bool audit_mainloop()
+static volatile sig_atomic_t g_dump_summary = 0;
+static volatile sig_atomic_t g_exit = 0;
+
+static void signal_handler(int sig)
+{
+    if (sig == SIGUSR1) {
+        g_dump_summary = 1;
+    } else {
+        g_exit = 1;
+    }
+}
+
+// Logs lines on a separate thread so that a flood of messages doesn't stall
+// reading from the audit socket
+class AuditLogger
+{
+public:
+    AuditLogger();
+    ~AuditLogger();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AuditLogger)
+
+    void post(std::string line);
+
+private:
+    void run();
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::string> _lines;
+    uint64_t _dropped;
+    bool _done;
+    std::thread _thread;
+};
+
+AuditLogger::AuditLogger()
+    : _dropped(0)
+    , _done(false)
+    , _thread(&AuditLogger::run, this)
+{
+}
+
+AuditLogger::~AuditLogger()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _cv.notify_all();
+
+    _thread.join();
+}
+
+void AuditLogger::post(std::string line)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_lines.size() >= AUDIT_LOG_QUEUE_MAX) {
+            ++_dropped;
+            return;
+        }
+
+        _lines.push_back(std::move(line));
+    }
+    _cv.notify_one();
+}
+
+void AuditLogger::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _cv.wait(lock, [&] { return _done || !_lines.empty(); });
+
+        if (_lines.empty()) {
+            break;
+        }
+
+        auto line = std::move(_lines.front());
+        _lines.pop_front();
+        uint64_t dropped = _dropped;
+        _dropped = 0;
+
+        lock.unlock();
+
+        if (dropped > 0) {
+            LOGW("Dropped %" PRIu64 " audit messages", dropped);
+        }
+        LOGV("%s", line.c_str());
+
+        lock.lock();
+    }
+}
+
+// Key for the summary. Denials are grouped by source type, target type, and
+// class so that each entry corresponds to one allow rule.
+struct DenialKey
+{
+    std::string source;
+    std::string target;
+    std::string tclass;
+
+    bool operator<(const DenialKey &other) const
+    {
+        return std::tie(source, target, tclass)
+                < std::tie(other.source, other.target, other.tclass);
+    }
+};
+
+struct DenialSummary
+{
+    std::set<std::string> perms;
+    uint64_t count = 0;
+};
+
+struct RecentDenial
+{
+    steady_clock::time_point first;
+    uint64_t suppressed;
+};
+
+class AuditProcessor
+{
+public:
+    AuditProcessor(AuditLogger &logger, seconds window);
+
+    void process(int type, std::string_view text);
+    void expire(steady_clock::time_point now);
+    bool write_summary(const std::string &path) const;
+
+    seconds window() const
+    {
+        return _window;
+    }
+
+private:
+    void add_to_summary(std::string_view text);
+    void report_repeats(const std::string &key, const RecentDenial &denial);
+
+    AuditLogger &_logger;
+    seconds _window;
+    std::unordered_map<std::string, RecentDenial> _recent;
+    std::map<DenialKey, DenialSummary> _summary;
+};
+
+AuditProcessor::AuditProcessor(AuditLogger &logger, seconds window)
+    : _logger(logger)
+    , _window(window)
+{
+}
+
+// Strip the "audit(<time>:<serial>): " prefix and the pid so that repeats of
+// the same denial compare equal
+static std::string denial_dedup_key(std::string_view text)
+{
+    if (text.substr(0, 6) == "audit(") {
+        if (auto pos = text.find("): "); pos != std::string_view::npos) {
+            text.remove_prefix(pos + 3);
+        }
+    }
+
+    std::string key(text);
+
+    if (auto pos = key.find(" pid="); pos != std::string::npos) {
+        auto end = key.find(' ', pos + 1);
+        key.erase(pos, end == std::string::npos ? end : end - pos);
+    }
+
+    return key;
+}
+
+// Get the value of a "<name>=<value>" field
+static std::string_view denial_field(std::string_view text,
+                                     std::string_view name)
+{
+    size_t pos = 0;
+
+    while ((pos = text.find(name, pos)) != std::string_view::npos) {
+        if ((pos == 0 || text[pos - 1] == ' ')
+                && text.substr(pos + name.size(), 1) == "=") {
+            auto value = text.substr(pos + name.size() + 1);
+            return value.substr(0, value.find(' '));
+        }
+        pos += name.size();
+    }
+
+    return {};
+}
+
+// Get the type from a "user:role:type:level" context
+static std::string_view context_type(std::string_view context)
+{
+    auto pos = context.find(':');
+    if (pos == std::string_view::npos) {
+        return context;
+    }
+    pos = context.find(':', pos + 1);
+    if (pos == std::string_view::npos) {
+        return context;
+    }
+    auto type = context.substr(pos + 1);
+    return type.substr(0, type.find(':'));
+}
+
+void AuditProcessor::add_to_summary(std::string_view text)
+{
+    auto begin = text.find("denied  {");
+    if (begin == std::string_view::npos) {
+        return;
+    }
+    begin += 9;
+    auto end = text.find('}', begin);
+    if (end == std::string_view::npos) {
+        return;
+    }
+
+    DenialKey key;
+    key.source = context_type(denial_field(text, "scontext"));
+    key.target = context_type(denial_field(text, "tcontext"));
+    key.tclass = denial_field(text, "tclass");
+    if (key.source.empty() || key.target.empty() || key.tclass.empty()) {
+        return;
+    }
+
+    auto &entry = _summary[std::move(key)];
+    ++entry.count;
+
+    auto perms = text.substr(begin, end - begin);
+    while (!perms.empty()) {
+        auto pos = perms.find(' ');
+        auto perm = perms.substr(0, pos);
+        if (!perm.empty()) {
+            entry.perms.emplace(perm);
+        }
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        perms.remove_prefix(pos + 1);
+    }
+}
+
+void AuditProcessor::process(int type, std::string_view text)
+{
+    if (type == AUDIT_AVC) {
+        add_to_summary(text);
+
+        if (_window.count() > 0) {
+            auto now = steady_clock::now();
+            auto key = denial_dedup_key(text);
+            auto it = _recent.find(key);
+
+            if (it == _recent.end()) {
+                _recent.emplace(std::move(key), RecentDenial{now, 0});
+            } else if (now - it->second.first < _window) {
+                ++it->second.suppressed;
+                return;
+            } else {
+                report_repeats(it->first, it->second);
+                it->second = {now, 0};
+            }
+        }
+    }
+
+    _logger.post(format("type=%d %.*s", type,
+                        static_cast<int>(text.size()), text.data()));
+}
+
+void AuditProcessor::report_repeats(const std::string &key,
+                                    const RecentDenial &denial)
+{
+    if (denial.suppressed > 0) {
+        _logger.post(format("type=%d [repeated %" PRIu64 " times in %llds] %s",
+                            AUDIT_AVC, denial.suppressed,
+                            static_cast<long long>(_window.count()),
+                            key.c_str()));
+    }
+}
+
+// Report the repeat counts for denials whose window has ended
+void AuditProcessor::expire(steady_clock::time_point now)
+{
+    for (auto it = _recent.begin(); it != _recent.end();) {
+        if (now - it->second.first < _window) {
+            ++it;
+            continue;
+        }
+
+        report_repeats(it->first, it->second);
+        it = _recent.erase(it);
+    }
+}
+
+// Write the denials seen so far as allow rules, sorted by the number of
+// denials. This is meant as a starting point for tuning the sepolpatch rules.
+bool AuditProcessor::write_summary(const std::string &path) const
+{
+    std::vector<decltype(_summary)::const_pointer> entries;
+    entries.reserve(_summary.size());
+    for (auto const &entry : _summary) {
+        entries.push_back(&entry);
+    }
+
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](auto const *a, auto const *b) {
+        return a->second.count > b->second.count;
+    });
+
+    std::string data;
+    for (auto const *entry : entries) {
+        data += "allow ";
+        data += entry->first.source;
+        data += ' ';
+        data += entry->first.target;
+        data += ':';
+        data += entry->first.tclass;
+        data += " {";
+        for (auto const &perm : entry->second.perms) {
+            data += ' ';
+            data += perm;
+        }
+        data += format(" }; # %" PRIu64 " denials\n", entry->second.count);
+    }
+
+    std::string temp_path = path + ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, data.data(), data.size());
+            !r) {
+        LOGE("%s: Failed to write summary: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    LOGI("Wrote summary of %zu denial types to %s",
+         entries.size(), path.c_str());
+    return true;
+}
+
+static bool audit_mainloop(seconds window, const char *summary_path)
 {
     int fd = audit_open();
     if (fd < 0) {
@@ -54,22 +429,120 @@ static bool audit_mainloop()
         return false;
     }
 
-    while (true) {
-        struct audit_message reply;
-        reply.nlh.nlmsg_type = 0;
-        reply.nlh.nlmsg_len = 0;
-        reply.data[0] = '\0';
+    // The signals are only unblocked while waiting in ppoll() so that they
+    // can't be missed between checking the flags and waiting
+    sigset_t mask;
+    sigset_t orig_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
+        LOGE("Failed to block signals: %s", strerror(errno));
+        return false;
+    }
+
+    auto restore_mask = finally([&]{
+        sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+    });
+
+    struct sigaction sa;
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGUSR1, &sa, nullptr) < 0
+            || sigaction(SIGINT, &sa, nullptr) < 0
+            || sigaction(SIGTERM, &sa, nullptr) < 0) {
+        LOGE("Failed to set signal handlers: %s", strerror(errno));
+        return false;
+    }
 
-        if (audit_get_reply(fd, &reply, GET_REPLY_BLOCKING, 0) < 0) {
-            LOGE("Failed to get reply from audit socket: %s", strerror(errno));
+    std::vector<audit_message> replies(AUDIT_BATCH_SIZE);
+    sockaddr_nl addrs[AUDIT_BATCH_SIZE];
+    iovec iovs[AUDIT_BATCH_SIZE];
+    mmsghdr msgs[AUDIT_BATCH_SIZE];
+
+    for (size_t i = 0; i < AUDIT_BATCH_SIZE; ++i) {
+        iovs[i].iov_base = &replies[i];
+        iovs[i].iov_len = sizeof(replies[i]);
+    }
+
+    AuditLogger logger;
+    AuditProcessor processor(logger, window);
+
+    while (!g_exit) {
+        if (g_dump_summary) {
+            g_dump_summary = 0;
+            if (summary_path) {
+                processor.write_summary(summary_path);
+            }
+        }
+
+        pollfd pfd = {};
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        // Wake up periodically to report the counts of suppressed denials
+        timespec timeout = {};
+        timeout.tv_sec = std::max<time_t>(processor.window().count(), 1);
+
+        int ret = ppoll(&pfd, 1, window.count() > 0 ? &timeout : nullptr,
+                        &orig_mask);
+        if (ret < 0 && errno != EINTR) {
+            LOGE("Failed to poll audit socket: %s", strerror(errno));
             return false;
         }
 
-        LOGV("type=%d %.*s",
-             reply.nlh.nlmsg_type, reply.nlh.nlmsg_len, reply.data);
+        if (ret > 0) {
+            for (size_t i = 0; i < AUDIT_BATCH_SIZE; ++i) {
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int n = recvmmsg(fd, msgs, AUDIT_BATCH_SIZE, MSG_DONTWAIT,
+                             nullptr);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                LOGE("Failed to get replies from audit socket: %s",
+                     strerror(errno));
+                return false;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                auto const &reply = replies[static_cast<size_t>(i)];
+                auto const &addr = addrs[i];
+                size_t len = msgs[i].msg_len;
+
+                // Make sure the message came from the kernel
+                if (msgs[i].msg_hdr.msg_namelen != sizeof(addr)
+                        || addr.nl_pid != 0) {
+                    LOGW("Ignoring message from pid %u", addr.nl_pid);
+                    continue;
+                } else if (!NLMSG_OK(&reply.nlh, len)) {
+                    LOGW("Ignoring bad message of size %zu", len);
+                    continue;
+                }
+
+                size_t data_len = std::min<size_t>(
+                        reply.nlh.nlmsg_len, len - sizeof(reply.nlh));
+                processor.process(reply.nlh.nlmsg_type,
+                                  {reply.data, strnlen(reply.data, data_len)});
+            }
+        }
+
+        if (window.count() > 0) {
+            processor.expire(steady_clock::now());
+        }
     }
 
-    // unreachable
+    if (summary_path) {
+        processor.write_summary(summary_path);
+    }
+
+    return true;
 }
 
 static void auditd_usage(FILE *stream)
@@ -77,17 +550,28 @@ static void auditd_usage(FILE *stream)
     fprintf(stream,
             "Usage: auditd [options]\n\n"
             "Options:\n"
-            "  -h, --help       Display this help message\n");
+            "  -w, --window <secs>\n"
+            "                   Log identical AVC denials only once within\n"
+            "                   this many seconds (default: %d, 0 disables)\n"
+            "  -s, --summary <file>\n"
+            "                   Write allow rules for the denials seen so far\n"
+            "                   to <file> on SIGUSR1 and on exit\n"
+            "  -h, --help       Display this help message\n",
+            AUDIT_DEFAULT_DEDUP_WINDOW);
 }
 
 int auditd_main(int argc, char *argv[])
 {
     int opt;
+    unsigned int window = AUDIT_DEFAULT_DEDUP_WINDOW;
+    const char *summary_path = nullptr;
 
-    static const char short_options[] = "h";
+    static const char short_options[] = "w:s:h";
 
     static struct option long_options[] = {
-        {"help",  no_argument,       0, 'h'},
+        {"window",  required_argument, 0, 'w'},
+        {"summary", required_argument, 0, 's'},
+        {"help",    no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
@@ -96,6 +580,17 @@ int auditd_main(int argc, char *argv[])
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'w':
+            if (!str_to_num(optarg, 10, window)) {
+                fprintf(stderr, "Invalid window: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 's':
+            summary_path = optarg;
+            break;
+
         case 'h':
             auditd_usage(stdout);
             return EXIT_SUCCESS;
@@ -111,7 +606,8 @@ int auditd_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    return audit_mainloop() ? EXIT_SUCCESS : EXIT_FAILURE;
+    return audit_mainloop(seconds(window), summary_path)
+            ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 }
@@ -20,10 +20,18 @@
 #include "backup.h"
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <dirent.h>
@@ -33,23 +41,31 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mblog/logging.h"
 #include "mbutil/archive.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
+#include "mbutil/sched.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 #include "mbutil/time.h"
 
+#include "backup_manifest.h"
 #include "installer_util.h"
 #include "image.h"
 #include "multiboot.h"
+#include "romconfig.h"
 #include "roms.h"
+#include "switcher.h"
 #include "wipe.h"
 
 #define LOG_TAG "mbtool/backup"
@@ -78,8 +94,19 @@ constexpr char BACKUP_NAME_PREFIX_DATA[]   = "data";
 constexpr char BACKUP_NAME_BOOT_IMAGE[]    = "boot.img";
 constexpr char BACKUP_NAME_CONFIG[]        = "config.json";
 constexpr char BACKUP_NAME_THUMBNAIL[]     = "thumbnail.webp";
+constexpr char BACKUP_NAME_CHECKSUMS[]     = "checksums.sha512";
+
+constexpr char BACKUP_MANIFEST_EXTENSION[] = ".manifest";
+constexpr char BACKUP_BLOCKS_EXTENSION[]   = ".img.sparse";
+
+// Protects against cycles in the base backups of incremental backups
+constexpr size_t BACKUP_MAX_CHAIN_LENGTH   = 64;
+
+// How often the size of the archives being written is logged
+constexpr auto BACKUP_PROGRESS_INTERVAL = std::chrono::seconds(5);
 
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
 enum class Result
 {
@@ -99,9 +126,38 @@ static struct CompressionMap
     { util::CompressionType::Lz4,  "lz4",   ".tar.lz4" },
     { util::CompressionType::Gzip, "gzip",  ".tar.gz" },
     { util::CompressionType::Xz,   "xz",    ".tar.xz" },
+    { util::CompressionType::Zstd, "zstd",  ".tar.zst" },
     { util::CompressionType::None, nullptr, nullptr }
 };
 
+// Finding an unused loop device and attaching an image to it is not atomic, so
+// images being backed up in parallel must be mounted one at a time
+static std::mutex g_mount_mutex;
+
+struct BackupJob
+{
+    // Name of the target for progress output
+    const char *name;
+    // File that is being written, if its size should be reported as progress
+    std::string output_file;
+    std::function<Result()> fn;
+};
+
+struct BackupArchive
+{
+    std::string path;
+    util::CompressionType compression;
+};
+
+struct BackupChain
+{
+    // Archives to extract, starting with the one from the oldest backup
+    std::vector<BackupArchive> archives;
+    // Manifest of the newest backup. Backups made before manifests existed do
+    // not have one.
+    std::optional<BackupManifest> manifest;
+};
+
 static BackupTargets parse_targets_string(const std::string &targets)
 {
     auto targets_list = split_sv(targets, ",");
@@ -140,6 +196,15 @@ static bool parse_compression_type(const char *type,
     return false;
 }
 
+static bool is_valid_backup_name(const std::string &name)
+{
+    // No empty strings, hidden paths, '..', or directory separators
+    return !name.empty()                            // Must be non-empty
+            && name.find('/') == std::string::npos  // and contain no slashes
+            && name != "."                          // and not current directory
+            && name != "..";                        // and not parent directory
+}
+
 static std::string get_compressed_backup_name(const std::string &name,
                                               util::CompressionType compression)
 {
@@ -170,10 +235,33 @@ static std::string find_compressed_backup(const std::string &backup_dir,
     return {};
 }
 
+static BackupManifestEntry manifest_entry_from_archive(archive_entry *entry)
+{
+    BackupManifestEntry result;
+    result.mode = static_cast<uint32_t>(archive_entry_mode(entry));
+    result.uid = static_cast<uint32_t>(archive_entry_uid(entry));
+    result.gid = static_cast<uint32_t>(archive_entry_gid(entry));
+    result.size = static_cast<uint64_t>(archive_entry_size(entry));
+    result.mtime_sec = archive_entry_mtime(entry);
+    result.mtime_nsec = archive_entry_mtime_nsec(entry);
+    result.ino = static_cast<uint64_t>(archive_entry_ino64(entry));
+    return result;
+}
+
+/*!
+ * \brief Archive a directory and record its contents in \p manifest
+ *
+ * If \p base is not null, then files whose metadata matches their entry in
+ * \p base are left out of the archive and their hashes are copied from
+ * \p base. The contents of the files that are archived and the archive itself
+ * are hashed on a separate thread as they are written, so nothing is read twice.
+ */
 static bool backup_directory(const std::string &output_file,
                              const std::string &directory,
                              const std::vector<std::string> &exclusions,
-                             util::CompressionType compression)
+                             util::CompressionType compression,
+                             BackupManifest &manifest,
+                             const BackupManifest *base)
 {
     ScopedDIR dp(opendir(directory.c_str()), closedir);
     if (!dp) {
@@ -202,62 +290,133 @@ static bool backup_directory(const std::string &output_file,
         return false;
     }
 
-    return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression);
+    BackupHasher hasher;
+    util::TarCreateHooks hooks;
+
+    hooks.filter = [&](archive_entry *entry) {
+        std::string path(archive_entry_pathname(entry));
+        auto item = manifest_entry_from_archive(entry);
+
+        if (base) {
+            if (auto it = base->entries.find(path);
+                    it != base->entries.end()
+                    && it->second.same_metadata(item)) {
+                item.hash = it->second.hash;
+                manifest.entries[path] = std::move(item);
+                return false;
+            }
+        }
+
+        hasher.begin_file(path);
+        manifest.entries[path] = std::move(item);
+        return true;
+    };
+    hooks.data = [&](archive_entry *entry, const void *data, size_t size) {
+        (void) entry;
+        hasher.update_file(data, size);
+    };
+    hooks.finished = [&](archive_entry *entry) {
+        // Hard links after the first one have no data in the archive
+        hasher.end_file(archive_entry_filetype(entry) == AE_IFREG
+                && !archive_entry_hardlink(entry));
+    };
+    hooks.output = [&](const void *data, size_t size) {
+        hasher.update_archive(data, size);
+    };
+
+    manifest.entries.clear();
+    manifest.archive_hash.clear();
+
+    if (!util::libarchive_tar_create(output_file, directory, contents,
+                                     compression, &hooks)) {
+        return false;
+    }
+
+    hasher.finish();
+
+    for (auto const &[path, hash] : hasher.file_hashes()) {
+        manifest.entries[path].hash = hash;
+    }
+    manifest.archive_hash = hasher.archive_hash();
+
+    return true;
 }
 
-static bool restore_directory(const std::string &input_file,
+static bool restore_directory(const BackupChain &chain,
                               const std::string &directory,
-                              const std::vector<std::string> &exclusions,
-                              util::CompressionType compression)
+                              const std::vector<std::string> &exclusions)
 {
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
 
-    return util::libarchive_tar_extract(input_file, directory, {}, compression);
+    for (auto const &archive : chain.archives) {
+        LOGI("Extracting %s", archive.path.c_str());
+
+        if (!util::libarchive_tar_extract(archive.path, directory, {},
+                                          archive.compression)) {
+            return false;
+        }
+    }
+
+    // Remove files that were deleted after the older backups were made
+    if (chain.manifest && chain.archives.size() > 1
+            && !chain.manifest->prune(directory, exclusions)) {
+        return false;
+    }
+
+    return true;
 }
 
 static bool backup_image(const std::string &output_file,
                          const std::string &image,
+                         const std::string &mount_point,
                          const std::vector<std::string> &exclusions,
-                         util::CompressionType compression)
+                         util::CompressionType compression,
+                         BackupManifest &manifest,
+                         const BackupManifest *base)
 {
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    if (auto r = util::mkdir_recursive(mount_point, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_point.c_str(), r.error().message().c_str());
         return false;
     }
 
     fsck_ext4_image(image);
 
-    if (auto ret = util::mount(
-            image, BACKUP_MNT_DIR, "ext4", MS_RDONLY, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
-             ret.error().message().c_str());
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(g_mount_mutex);
+
+        if (auto ret = util::mount(
+                image, mount_point, "ext4", MS_RDONLY, "",
+                util::LoopdevFlag::DirectIo); !ret) {
+            LOGE("Failed to mount %s at %s: %s", image.c_str(),
+                 mount_point.c_str(), ret.error().message().c_str());
+            return false;
+        }
     }
 
-    bool ret = backup_directory(output_file, BACKUP_MNT_DIR, exclusions,
-                                compression);
+    bool ret = backup_directory(output_file, mount_point, exclusions,
+                                compression, manifest, base);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_point); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
+    rmdir(mount_point.c_str());
+    // Fails if other images are still mounted
     rmdir(BACKUP_MNT_DIR);
 
     return ret;
 }
 
-static bool restore_image(const std::string &input_file,
+static bool restore_image(const BackupChain &chain,
                           const std::string &image,
                           uint64_t size,
-                          const std::vector<std::string> &exclusions,
-                          util::CompressionType compression)
+                          const std::vector<std::string> &exclusions)
 {
     if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
         LOGE("%s: Failed to create parent directory: %s",
@@ -293,8 +452,7 @@ static bool restore_image(const std::string &input_file,
         return false;
     }
 
-    bool ret = restore_directory(input_file, BACKUP_MNT_DIR, exclusions,
-                                 compression);
+    bool ret = restore_directory(chain, BACKUP_MNT_DIR, exclusions);
 
     if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
         LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
@@ -371,7 +529,8 @@ static Result restore_boot_image(const std::shared_ptr<Rom> &rom,
     rps.push_back(rp_write_rom_id(rom->id));
 
     if (!InstallerUtil::patch_boot_image(
-            boot_image_backup, boot_image_path, rps)) {
+            boot_image_backup, boot_image_path, rps,
+            {{ "write_rom_id", rom->id, {}, {} }})) {
         LOGE("Failed to patch boot image");
         return Result::Failed;
     }
@@ -487,9 +646,15 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  *
  * \param path Path to mountpoint/directory or image
  * \param backup_dir Backup directory
+ * \param prefix Backup name prefix (eg. "system")
  * \param archive_name Backup archive name
  * \param is_image Whether \a path is an ext4 image
+ * \param mount_point Where to mount \a path if it is an image
  * \param exclusions List of top-level directories to exclude from the backup
+ * \param base_name Name of the backup to only store changes relative to. If
+ *                  it is empty or has no manifest for \a prefix, then a full
+ *                  backup is made.
+ * \param[out] archive_hash Hex SHA512 digest of the archive
  *
  * \return Result::Succeeded if the directory/image was successfully backed up
  *         Result::Failed if an error occured
@@ -497,177 +662,653 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  */
 static Result backup_partition(const std::string &path,
                                const std::string &backup_dir,
+                               const std::string &prefix,
                                const std::string &archive_name,
                                bool is_image,
+                               const std::string &mount_point,
                                const std::vector<std::string> &exclusions,
-                               util::CompressionType compression)
+                               util::CompressionType compression,
+                               const std::string &base_name,
+                               std::string &archive_hash)
 {
     std::string archive(backup_dir);
     archive += '/';
     archive += archive_name;
 
+    std::string manifest_name(prefix);
+    manifest_name += BACKUP_MANIFEST_EXTENSION;
+
+    BackupManifest manifest;
+    BackupManifest base;
+    bool have_base = false;
+
+    if (!base_name.empty()) {
+        std::string base_manifest(util::dir_name(backup_dir));
+        base_manifest += '/';
+        base_manifest += base_name;
+        base_manifest += '/';
+        base_manifest += manifest_name;
+
+        have_base = base.load(base_manifest);
+        if (have_base) {
+            manifest.base = base_name;
+        } else {
+            LOGW("%s: Base backup has no usable manifest. Making full backup",
+                 base_manifest.c_str());
+        }
+    }
+
     bool ret = false;
 
     struct stat sb;
     if (stat(path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", path.c_str());
         if (is_image) {
-            ret = backup_image(archive, path, exclusions, compression);
+            ret = backup_image(archive, path, mount_point, exclusions,
+                               compression, manifest,
+                               have_base ? &base : nullptr);
         } else {
-            ret = backup_directory(archive, path, exclusions, compression);
+            ret = backup_directory(archive, path, exclusions, compression,
+                                   manifest, have_base ? &base : nullptr);
         }
     } else {
         LOGW("=== %s does not exist ===", path.c_str());
         return Result::FilesMissing;
     }
 
+    if (ret) {
+        ret = manifest.save(backup_dir + '/' + manifest_name);
+        archive_hash = manifest.archive_hash;
+    }
+
     return ret ? Result::Succeeded : Result::Failed;
 }
 
+/*!
+ * \brief Backup the used blocks of an ext4 image for a ROM
+ *
+ * \param path Path to image
+ * \param backup_dir Backup directory
+ * \param archive_name Backup sparse file name
+ *
+ * \return Result::Succeeded if the image was successfully backed up
+ *         Result::Failed if an error occured
+ *         Result::FilesMissing if \a path does not exist
+ */
+static Result backup_partition_blocks(const std::string &path,
+                                      const std::string &backup_dir,
+                                      const std::string &archive_name)
+{
+    std::string archive(backup_dir);
+    archive += '/';
+    archive += archive_name;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", path.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Backing up blocks of %s ===", path.c_str());
+
+    fsck_ext4_image(path);
+
+    return backup_ext4_image_blocks(path, archive)
+            ? Result::Succeeded : Result::Failed;
+}
+
+/*!
+ * \brief Find the archives needed to restore a partition from a backup
+ *
+ * Incremental backups are followed back through their base backups, which must
+ * be in the same directory as \a backup_dir.
+ *
+ * \param backup_dir Backup directory
+ * \param prefix Backup name prefix (eg. "system")
+ * \param chain Output chain of archives
+ *
+ * \return Whether all of the archives in the chain were found
+ */
+static bool find_backup_chain(const std::string &backup_dir,
+                              const std::string &prefix,
+                              BackupChain &chain)
+{
+    chain = {};
+
+    std::string manifest_name(prefix);
+    manifest_name += BACKUP_MANIFEST_EXTENSION;
+
+    std::string dir(backup_dir);
+
+    while (true) {
+        if (chain.archives.size() == BACKUP_MAX_CHAIN_LENGTH) {
+            LOGE("%s: Too many base backups", backup_dir.c_str());
+            return false;
+        }
+
+        util::CompressionType compression;
+        std::string name = find_compressed_backup(dir, prefix, compression);
+        if (name.empty()) {
+            LOGE("%s: Backup of %s not found", dir.c_str(), prefix.c_str());
+            return false;
+        }
+
+        chain.archives.push_back({ dir + '/' + name, compression });
+
+        std::string manifest_path(dir);
+        manifest_path += '/';
+        manifest_path += manifest_name;
+
+        if (access(manifest_path.c_str(), F_OK) < 0) {
+            break;
+        }
+
+        BackupManifest manifest;
+        if (!manifest.load(manifest_path)) {
+            return false;
+        }
+
+        std::string base = manifest.base;
+
+        if (!chain.manifest) {
+            chain.manifest = std::move(manifest);
+        }
+
+        if (base.empty()) {
+            break;
+        } else if (!is_valid_backup_name(base)) {
+            LOGE("%s: Invalid base backup name: %s",
+                 manifest_path.c_str(), base.c_str());
+            return false;
+        }
+
+        dir = util::dir_name(dir);
+        dir += '/';
+        dir += base;
+    }
+
+    std::reverse(chain.archives.begin(), chain.archives.end());
+
+    return true;
+}
+
 /*!
  * \brief Restore a partition for a ROM
  *
+ * Backups of the used blocks of an image are written directly to the image.
+ * Otherwise, the archives found by find_backup_chain() are extracted.
+ *
  * \param path Path to mountpoint/directory or image
  * \param backup_dir Backup directory
- * \param archive_name Backup archive name
+ * \param prefix Backup name prefix (eg. "system")
  * \param is_image Whether \a path is an ext4 image
+ * \param image_size Size of the image to create if \a path does not exist
  * \param exclusions List of top-level directories to exclude from the wipe
  *                   process before restoring
  *
  * \return Result::Succeeded if the directory/image was successfully restored
  *         Result::Failed if an error occured
- *         Result::FilesMissing if \a archive_name does not exist in
- *         \a backup_dir
  */
 static Result restore_partition(const std::string &path,
                                 const std::string &backup_dir,
-                                const std::string &archive_name,
+                                const std::string &prefix,
                                 bool is_image,
                                 uint64_t image_size,
-                                const std::vector<std::string> &exclusions,
-                                util::CompressionType compression)
+                                const std::vector<std::string> &exclusions)
 {
-    std::string archive(backup_dir);
-    archive += '/';
-    archive += archive_name;
+    std::string blocks(backup_dir);
+    blocks += '/';
+    blocks += prefix;
+    blocks += BACKUP_BLOCKS_EXTENSION;
 
     bool ret = false;
 
-    struct stat sb;
-    if (stat(archive.c_str(), &sb) == 0) {
+    if (access(blocks.c_str(), F_OK) == 0) {
+        if (!is_image) {
+            LOGE("%s: Block-level backups can only be restored to images",
+                 blocks.c_str());
+            return Result::Failed;
+        }
+
+        if (auto r = util::mkdir_parent(path, S_IRWXU); !r) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 path.c_str(), r.error().message().c_str());
+            return Result::Failed;
+        }
+
+        LOGI("=== Restoring blocks to %s ===", path.c_str());
+        ret = restore_ext4_image_blocks(blocks, path);
+    } else {
+        BackupChain chain;
+        if (!find_backup_chain(backup_dir, prefix, chain)) {
+            return Result::Failed;
+        }
+
         LOGI("=== Restoring to %s ===", path.c_str());
         if (is_image) {
-            ret = restore_image(archive, path, image_size, exclusions,
-                                compression);
+            ret = restore_image(chain, path, image_size, exclusions);
         } else {
-            ret = restore_directory(archive, path, exclusions, compression);
+            ret = restore_directory(chain, path, exclusions);
         }
-    } else {
-        LOGW("=== %s does not exist ===", archive.c_str());
-        return Result::FilesMissing;
     }
 
     return ret ? Result::Succeeded : Result::Failed;
 }
 
-static bool backup_rom(const std::shared_ptr<Rom> &rom,
-                       const std::string &output_dir, BackupTargets targets,
-                       util::CompressionType compression)
+/*!
+ * \brief Run backup jobs with up to \a n_jobs of them at a time
+ *
+ * The jobs are started in order. If one fails, the jobs that have not been
+ * started yet are skipped, but the ones that are already running are allowed to
+ * finish. While the jobs run, the size of each archive being written is logged
+ * every BACKUP_PROGRESS_INTERVAL.
+ *
+ * \return Whether none of the jobs failed
+ */
+static bool run_backup_jobs(const std::vector<BackupJob> &jobs,
+                            unsigned int n_jobs)
 {
-    if (!targets) {
-        LOGE("No backup targets specified");
-        return false;
-    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<bool> running(jobs.size());
+    size_t next = 0;
+    bool failed = false;
+
+    auto n_workers = static_cast<unsigned int>(std::min<size_t>(
+            std::max(n_jobs, 1u), jobs.size()));
+    unsigned int active = n_workers;
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!failed && next < jobs.size()) {
+            size_t i = next++;
+            running[i] = true;
+
+            lock.unlock();
+            Result ret = jobs[i].fn();
+            lock.lock();
+
+            running[i] = false;
+            if (ret == Result::Failed) {
+                LOGE("[%s] Backup failed", jobs[i].name);
+                failed = true;
+            }
+        }
 
-    const std::string system_path(rom->full_system_path());
-    const std::string cache_path(rom->full_cache_path());
-    const std::string data_path(rom->full_data_path());
-    const std::string boot_image_path(rom->boot_image_path());
-    const std::string config_path(rom->config_path());
-    const std::string thumbnail_path(rom->thumbnail_path());
+        --active;
+        cv.notify_all();
+    };
 
-    LOGI("Backing up:");
-    LOGI("- ROM ID: %s", rom->id.c_str());
-    LOGI("- Targets:");
-    if (targets & BackupTarget::System) {
-        LOGI("  - System: %s", system_path.c_str());
-    }
-    if (targets & BackupTarget::Cache) {
-        LOGI("  - Cache: %s", cache_path.c_str());
+    TaskGroup group(ThreadPool::global());
+
+    for (unsigned int i = 0; i < n_workers; ++i) {
+        group.run(worker);
     }
-    if (targets & BackupTarget::Data) {
-        LOGI("  - Data: %s", data_path.c_str());
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!cv.wait_for(lock, BACKUP_PROGRESS_INTERVAL,
+                            [&] { return active == 0; })) {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                struct stat sb;
+
+                if (running[i] && !jobs[i].output_file.empty()
+                        && stat(jobs[i].output_file.c_str(), &sb) == 0) {
+                    LOGI("[%s] %.1f MiB written", jobs[i].name,
+                         static_cast<double>(sb.st_size) / 1024 / 1024);
+                }
+            }
+        }
     }
-    if (targets & BackupTarget::Boot) {
-        LOGI("  - Boot image: %s", boot_image_path.c_str());
+
+    group.wait();
+
+    return !failed;
+}
+
+/*!
+ * \brief Compute the SHA512 digests of files with up to \a n_jobs at a time
+ *
+ * \return Hex digest of each file in \a names or an empty string for the files
+ *         that could not be read
+ */
+static std::vector<std::string>
+hash_backup_files(const std::string &backup_dir,
+                  const std::vector<std::string> &names, unsigned int n_jobs)
+{
+    std::vector<std::string> paths;
+    paths.reserve(names.size());
+
+    for (auto const &name : names) {
+        std::string path(backup_dir);
+        path += '/';
+        path += name;
+        paths.push_back(std::move(path));
     }
-    if (targets & BackupTarget::Config) {
-        LOGI("  - Configs: %s", config_path.c_str());
-        LOGI("             %s", thumbnail_path.c_str());
+
+    auto results = util::hash_paths(util::HashAlgorithm::Sha512, paths, n_jobs);
+    std::vector<std::string> digests(names.size());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i]) {
+            digests[i] = util::hex_string(results[i].value().data(),
+                                          results[i].value().size());
+        } else {
+            LOGE("%s: Failed to compute SHA512 hash: %s",
+                 paths[i].c_str(), results[i].error().message().c_str());
+        }
     }
-    LOGI("- Backup directory: %s", output_dir.c_str());
 
-    std::string output_system = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_SYSTEM, compression);
-    std::string output_cache = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_CACHE, compression);
-    std::string output_data = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_DATA, compression);
+    return digests;
+}
 
-    // Backup boot image
-    if (targets & BackupTarget::Boot
-            && backup_boot_image(rom, output_dir) == Result::Failed) {
+/*!
+ * \brief Write the digest of every file in a backup to BACKUP_NAME_CHECKSUMS
+ *
+ * The file uses the format of `sha512sum`, so the backup can also be checked
+ * with `sha512sum -c` on another machine. Archives whose digests are in
+ * \a known_digests were already hashed while they were written and are not
+ * read again.
+ */
+static bool write_backup_checksums(
+        const std::string &backup_dir,
+        const std::unordered_map<std::string, std::string> &known_digests,
+        unsigned int n_jobs)
+{
+    ScopedDIR dp(opendir(backup_dir.c_str()), closedir);
+    if (!dp) {
+        LOGE("%s: Failed to open directory: %s",
+             backup_dir.c_str(), strerror(errno));
         return false;
     }
 
-    // Backup configs
-    if (targets & BackupTarget::Config
-            && backup_configs(rom, output_dir) == Result::Failed) {
+    std::vector<std::string> contents;
+    dirent *ent;
+    errno = 0;
+
+    while ((ent = readdir(dp.get()))) {
+        if (strcmp(ent->d_name, BACKUP_NAME_CHECKSUMS) != 0) {
+            contents.push_back(ent->d_name);
+        }
+    }
+
+    if (errno) {
+        LOGE("%s: Failed to read directory contents: %s",
+             backup_dir.c_str(), strerror(errno));
         return false;
     }
 
-    // Backup system
-    if (targets & BackupTarget::System) {
-        Result ret = backup_partition(
-                system_path, output_dir, output_system,
-                rom->system_is_image, { "multiboot" }, compression);
-        if (ret == Result::Failed) {
-            return false;
+    std::vector<std::string> names;
+    std::vector<std::string> unhashed;
+
+    for (auto &name : contents) {
+        struct stat sb;
+
+        if (fstatat(dirfd(dp.get()), name.c_str(), &sb,
+                    AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(sb.st_mode)) {
+            continue;
         }
-    }
 
-    // Backup cache
-    if (targets & BackupTarget::Cache) {
-        Result ret = backup_partition(
-                cache_path, output_dir, output_cache,
-                rom->cache_is_image, { "multiboot" }, compression);
-        if (ret == Result::Failed) {
-            return false;
+        if (auto it = known_digests.find(name);
+                it == known_digests.end() || it->second.empty()) {
+            unhashed.push_back(name);
         }
+
+        names.push_back(std::move(name));
     }
 
-    // Backup data
-    if (targets & BackupTarget::Data) {
-        Result ret = backup_partition(
-                data_path, output_dir, output_data,
-                rom->data_is_image, { "media", "multiboot" }, compression);
-        if (ret == Result::Failed) {
+    LOGI("=== Computing checksums ===");
+
+    auto digests = hash_backup_files(backup_dir, unhashed, n_jobs);
+    std::unordered_map<std::string, std::string> all_digests(known_digests);
+
+    for (size_t i = 0; i < unhashed.size(); ++i) {
+        if (digests[i].empty()) {
             return false;
         }
+        all_digests[unhashed[i]] = std::move(digests[i]);
     }
 
-    return true;
-}
+    std::sort(names.begin(), names.end());
 
-static bool restore_rom(const std::shared_ptr<Rom> &rom,
-                        const std::string &input_dir, BackupTargets targets)
-{
-    if (!targets) {
-        LOGE("No restore targets specified");
+    std::string path(backup_dir);
+    path += '/';
+    path += BACKUP_NAME_CHECKSUMS;
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "wbe"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
         return false;
     }
 
-    const std::string system_path(rom->full_system_path());
+    for (auto const &name : names) {
+        if (fprintf(fp.get(), "%s  %s\n", all_digests[name].c_str(),
+                    name.c_str()) < 0) {
+            LOGE("%s: Failed to write checksums: %s",
+                 temp_path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check the files in a backup against BACKUP_NAME_CHECKSUMS
+ *
+ * The files are hashed with up to \a n_jobs at a time. Every file is checked,
+ * even after a mismatch is found, so that all of the damage is reported.
+ *
+ * \return Whether every file listed in the checksums file is intact
+ */
+static bool verify_backup(const std::string &backup_dir, unsigned int n_jobs)
+{
+    std::string path(backup_dir);
+    path += '/';
+    path += BACKUP_NAME_CHECKSUMS;
+
+    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::string> expected;
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
+    while ((read = getline(&line, &len, fp.get())) >= 0) {
+        std::string_view sv(line, static_cast<size_t>(read));
+        if (!sv.empty() && sv.back() == '\n') {
+            sv.remove_suffix(1);
+        }
+
+        auto sep = sv.find("  ");
+        if (sep != SHA512_DIGEST_LENGTH * 2
+                || !is_valid_backup_name(std::string(sv.substr(sep + 2)))) {
+            LOGE("%s: Invalid line: %s", path.c_str(),
+                 std::string(sv).c_str());
+            return false;
+        }
+
+        expected.emplace_back(sv.substr(0, sep));
+        names.emplace_back(sv.substr(sep + 2));
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    LOGI("=== Verifying %zu files ===", names.size());
+
+    auto digests = hash_backup_files(backup_dir, names, n_jobs);
+    size_t n_bad = 0;
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (digests[i].empty()) {
+            ++n_bad;
+        } else if (digests[i] != expected[i]) {
+            LOGE("%s: Checksum mismatch", names[i].c_str());
+            ++n_bad;
+        } else {
+            LOGI("%s: OK", names[i].c_str());
+        }
+    }
+
+    if (n_bad > 0) {
+        LOGE("%zu of %zu files are missing or corrupted",
+             n_bad, names.size());
+        return false;
+    }
+
+    return true;
+}
+
+static bool backup_rom(const std::shared_ptr<Rom> &rom,
+                       const std::string &output_dir,
+                       const std::string &base_name, BackupTargets targets,
+                       util::CompressionType compression, bool block_images,
+                       unsigned int n_jobs)
+{
+    if (!targets) {
+        LOGE("No backup targets specified");
+        return false;
+    }
+
+    const std::string system_path(rom->full_system_path());
+    const std::string cache_path(rom->full_cache_path());
+    const std::string data_path(rom->full_data_path());
+    const std::string boot_image_path(rom->boot_image_path());
+    const std::string config_path(rom->config_path());
+    const std::string thumbnail_path(rom->thumbnail_path());
+
+    LOGI("Backing up:");
+    LOGI("- ROM ID: %s", rom->id.c_str());
+    LOGI("- Targets:");
+    if (targets & BackupTarget::System) {
+        LOGI("  - System: %s", system_path.c_str());
+    }
+    if (targets & BackupTarget::Cache) {
+        LOGI("  - Cache: %s", cache_path.c_str());
+    }
+    if (targets & BackupTarget::Data) {
+        LOGI("  - Data: %s", data_path.c_str());
+    }
+    if (targets & BackupTarget::Boot) {
+        LOGI("  - Boot image: %s", boot_image_path.c_str());
+    }
+    if (targets & BackupTarget::Config) {
+        LOGI("  - Configs: %s", config_path.c_str());
+        LOGI("             %s", thumbnail_path.c_str());
+    }
+    LOGI("- Backup directory: %s", output_dir.c_str());
+    if (!base_name.empty()) {
+        LOGI("- Base backup: %s", base_name.c_str());
+    }
+    LOGI("- Block-level image backups: %s", block_images ? "yes" : "no");
+    LOGI("- Parallel jobs: %u", n_jobs);
+
+    std::string mount_dir(BACKUP_MNT_DIR);
+    mount_dir += '/';
+
+    std::vector<BackupJob> jobs;
+    // Digests of the archives that were computed while writing them
+    std::unordered_map<std::string, std::string> digests;
+
+    // Backup boot image
+    if (targets & BackupTarget::Boot) {
+        jobs.push_back({ "boot", {}, [&] {
+            return backup_boot_image(rom, output_dir);
+        } });
+    }
+
+    // Backup configs
+    if (targets & BackupTarget::Config) {
+        jobs.push_back({ "config", {}, [&] {
+            return backup_configs(rom, output_dir);
+        } });
+    }
+
+    auto add_partition_job = [&](const char *prefix, const std::string &path,
+                                 bool is_image,
+                                 std::vector<std::string> exclusions) {
+        if (block_images && is_image) {
+            std::string name = std::string(prefix) + BACKUP_BLOCKS_EXTENSION;
+
+            jobs.push_back({ prefix, output_dir + '/' + name, [=] {
+                return backup_partition_blocks(path, output_dir, name);
+            } });
+        } else {
+            std::string name = get_compressed_backup_name(prefix, compression);
+            // Pointers to unordered_map values stay valid across insertions
+            std::string *digest = &digests[name];
+
+            jobs.push_back({ prefix, output_dir + '/' + name, [=] {
+                return backup_partition(
+                        path, output_dir, prefix, name, is_image,
+                        mount_dir + prefix, exclusions, compression, base_name,
+                        *digest);
+            } });
+        }
+    };
+
+    // Backup system
+    if (targets & BackupTarget::System) {
+        add_partition_job(BACKUP_NAME_PREFIX_SYSTEM, system_path,
+                          rom->system_is_image, { "multiboot" });
+    }
+
+    // Backup cache
+    if (targets & BackupTarget::Cache) {
+        add_partition_job(BACKUP_NAME_PREFIX_CACHE, cache_path,
+                          rom->cache_is_image, { "multiboot" });
+    }
+
+    // Backup data
+    if (targets & BackupTarget::Data) {
+        add_partition_job(BACKUP_NAME_PREFIX_DATA, data_path,
+                          rom->data_is_image, { "media", "multiboot" });
+    }
+
+    return run_backup_jobs(jobs, n_jobs)
+            && write_backup_checksums(output_dir, digests, n_jobs);
+}
+
+static bool restore_rom(const std::shared_ptr<Rom> &rom,
+                        const std::string &input_dir, BackupTargets targets)
+{
+    if (!targets) {
+        LOGE("No restore targets specified");
+        return false;
+    }
+
+    const std::string system_path(rom->full_system_path());
     const std::string cache_path(rom->full_cache_path());
     const std::string data_path(rom->full_data_path());
     const std::string boot_image_path(rom->boot_image_path());
@@ -727,17 +1368,9 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
             return false;
         }
 
-        util::CompressionType compression;
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression);
-        if (path.empty()) {
-            LOGE("Backup of /system not found");
-            return false;
-        }
-
         Result ret = restore_partition(
-                system_path, input_dir, path,
-                rom->system_is_image, image_size.value(), {}, compression);
+                system_path, input_dir, BACKUP_NAME_PREFIX_SYSTEM,
+                rom->system_is_image, image_size.value(), {});
         if (ret == Result::Failed) {
             return false;
         }
@@ -745,41 +1378,340 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     // Restore cache
     if (targets & BackupTarget::Cache) {
-        util::CompressionType compression;
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_CACHE, compression);
-        if (path.empty()) {
-            LOGE("Backup of /cache not found");
+        Result ret = restore_partition(
+                cache_path, input_dir, BACKUP_NAME_PREFIX_CACHE,
+                rom->cache_is_image, DEFAULT_IMAGE_SIZE, {});
+        if (ret == Result::Failed) {
             return false;
         }
+    }
 
+    // Restore data
+    if (targets & BackupTarget::Data) {
         Result ret = restore_partition(
-                cache_path, input_dir, path,
-                rom->cache_is_image, DEFAULT_IMAGE_SIZE, {}, compression);
+                data_path, input_dir, BACKUP_NAME_PREFIX_DATA,
+                rom->data_is_image, DEFAULT_IMAGE_SIZE, { "media" });
         if (ret == Result::Failed) {
             return false;
         }
     }
 
-    // Restore data
-    if (targets & BackupTarget::Data) {
-        util::CompressionType compression;
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_DATA, compression);
-        if (path.empty()) {
-            LOGE("Backup of /data not found");
+    return true;
+}
+
+/*!
+ * \brief Copy a partition of a ROM to another ROM's slot
+ *
+ * Images are copied as files. util::copy_data_fd() shares the extents with
+ * FICLONE on filesystems with reflink support and otherwise only copies the
+ * data regions so that the holes of sparse images are kept. Directories are
+ * copied with the parallel copy engine, which uses the same methods for each
+ * file.
+ *
+ * \param source Path to source mountpoint/directory or image
+ * \param target Path to target directory or image
+ * \param is_image Whether \a source and \a target are ext4 images
+ * \param exclusions List of top-level directories to not copy
+ *
+ * \return Result::Succeeded if the directory/image was successfully copied
+ *         Result::Failed if an error occured
+ *         Result::FilesMissing if \a source does not exist
+ */
+static Result clone_partition(const std::string &source,
+                              const std::string &target, bool is_image,
+                              const std::vector<std::string> &exclusions)
+{
+    struct stat sb;
+    if (stat(source.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", source.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Cloning %s to %s ===", source.c_str(), target.c_str());
+
+    if (is_image) {
+        if (auto r = util::mkdir_parent(target, 0755); !r) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 target.c_str(), r.error().message().c_str());
+            return Result::Failed;
+        }
+
+        if (auto r = util::copy_file(source, target,
+                                     util::CopyFlag::CopyAttributes
+                                   | util::CopyFlag::CopyXattrs); !r) {
+            LOGE("%s", r.error().message().c_str());
+            return Result::Failed;
+        }
+
+        return Result::Succeeded;
+    }
+
+    if (auto r = util::mkdir_recursive(target, 0755); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             target.c_str(), r.error().message().c_str());
+        return Result::Failed;
+    }
+
+    ScopedDIR dp(opendir(source.c_str()), closedir);
+    if (!dp) {
+        LOGE("%s: Failed to open directory: %s",
+             source.c_str(), strerror(errno));
+        return Result::Failed;
+    }
+
+    while (auto ent = readdir(dp.get())) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
+                || std::find(exclusions.begin(), exclusions.end(),
+                             ent->d_name) != exclusions.end()) {
+            continue;
+        }
+
+        std::string path(source);
+        path += '/';
+        path += ent->d_name;
+
+        if (auto r = util::copy_dir(path, target,
+                                    util::CopyFlag::CopyAttributes
+                                  | util::CopyFlag::CopyXattrs
+                                  | util::CopyFlag::Parallel); !r) {
+            LOGE("%s", r.error().message().c_str());
+            return Result::Failed;
+        }
+    }
+
+    if (auto r = util::copy_stat(source, target); !r) {
+        LOGE("%s", r.error().message().c_str());
+        return Result::Failed;
+    }
+    if (auto r = util::copy_xattrs(source, target); !r) {
+        LOGE("%s", r.error().message().c_str());
+        return Result::Failed;
+    }
+
+    return Result::Succeeded;
+}
+
+/*!
+ * \brief Copy the boot image of a ROM to another ROM's slot
+ *
+ * The ROM ID in the ramdisk is replaced with the target's. If the source boot
+ * image matches its recorded checksum, the checksum of the new boot image is
+ * recorded too. Otherwise, the user has to confirm the new boot image when
+ * switching to it, like with a restored one.
+ */
+static Result clone_boot_image(const std::shared_ptr<Rom> &source,
+                               const std::shared_ptr<Rom> &target)
+{
+    std::string source_path(source->boot_image_path());
+    std::string target_path(target->boot_image_path());
+
+    struct stat sb;
+    if (stat(source_path.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", source_path.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Cloning %s to %s ===", source_path.c_str(), target_path.c_str());
+
+    std::vector<std::function<RamdiskPatcherFn>> rps;
+    rps.push_back(rp_write_rom_id(target->id));
+
+    if (!InstallerUtil::patch_boot_image(source_path, target_path, rps,
+                                         {{ "write_rom_id", target->id, {}, {} }})) {
+        LOGE("Failed to patch boot image");
+        return Result::Failed;
+    }
+
+    std::unordered_map<std::string, std::string> props;
+    std::string expected;
+
+    if (!checksums_read(&props)
+            || checksums_get(&props, source->id, "boot.img", &expected)
+                    != ChecksumsGetResult::Found) {
+        return Result::Succeeded;
+    }
+
+    auto source_digest = util::sha512_hash(source_path);
+    auto target_digest = util::sha512_hash(target_path);
+    if (!source_digest || !target_digest) {
+        return Result::Succeeded;
+    }
+
+    if (util::hex_string(source_digest.value().data(),
+                         source_digest.value().size()) != expected) {
+        LOGW("%s: Checksum does not match; not trusting the new boot image",
+             source_path.c_str());
+        return Result::Succeeded;
+    }
+
+    checksums_update(&props, target->id, "boot.img", util::hex_string(
+            target_digest.value().data(), target_digest.value().size()));
+    if (!checksums_write(props)) {
+        LOGW("Failed to update checksums for %s", target->id.c_str());
+    }
+
+    return Result::Succeeded;
+}
+
+/*!
+ * \brief Copy the configuration file and thumbnail of a ROM
+ *
+ * The ID in the copied configuration is replaced with the target's.
+ */
+static Result clone_configs(const std::shared_ptr<Rom> &source,
+                            const std::shared_ptr<Rom> &target)
+{
+    std::string config_path(source->config_path());
+    std::string thumbnail_path(source->thumbnail_path());
+
+    Result ret = Result::Succeeded;
+
+    RomConfig config;
+    if (config.load_file(config_path)) {
+        LOGI("=== Cloning %s ===", config_path.c_str());
+        config.id = target->id;
+        if (!config.save_file(target->config_path())) {
+            LOGE("%s: Failed to save config", target->config_path().c_str());
+            return Result::Failed;
+        }
+    } else {
+        LOGW("=== %s does not exist ===", config_path.c_str());
+        ret = Result::FilesMissing;
+    }
+
+    struct stat sb;
+    if (stat(thumbnail_path.c_str(), &sb) == 0) {
+        LOGI("=== Cloning %s ===", thumbnail_path.c_str());
+        if (auto r = util::copy_file(thumbnail_path, target->thumbnail_path(),
+                                     0); !r) {
+            LOGE("%s", r.error().message().c_str());
+            return Result::Failed;
+        }
+    } else {
+        LOGW("=== %s does not exist ===", thumbnail_path.c_str());
+        ret = Result::FilesMissing;
+    }
+
+    return ret;
+}
+
+static bool clone_rom(const std::shared_ptr<Rom> &source,
+                      const std::shared_ptr<Rom> &target,
+                      BackupTargets targets)
+{
+    if (!targets) {
+        LOGE("No clone targets specified");
+        return false;
+    }
+
+    struct Partition
+    {
+        BackupTarget target;
+        std::string source_path;
+        std::string target_path;
+        bool source_is_image;
+        bool target_is_image;
+        std::vector<std::string> exclusions;
+    };
+
+    const Partition partitions[] = {
+        {
+            BackupTarget::System,
+            source->full_system_path(), target->full_system_path(),
+            source->system_is_image, target->system_is_image,
+            { "multiboot" },
+        },
+        {
+            BackupTarget::Cache,
+            source->full_cache_path(), target->full_cache_path(),
+            source->cache_is_image, target->cache_is_image,
+            { "multiboot" },
+        },
+        {
+            BackupTarget::Data,
+            source->full_data_path(), target->full_data_path(),
+            source->data_is_image, target->data_is_image,
+            { "media", "multiboot" },
+        },
+    };
+
+    LOGI("Cloning:");
+    LOGI("- Source ROM ID: %s", source->id.c_str());
+    LOGI("- Target ROM ID: %s", target->id.c_str());
+
+    for (auto const &p : partitions) {
+        if (!(targets & p.target)) {
+            continue;
+        }
+
+        LOGI("- %s -> %s", p.source_path.c_str(), p.target_path.c_str());
+
+        if (p.source_path.empty() || p.target_path.empty()) {
+            LOGE("Partition for the source or target ROM is not mounted");
             return false;
         }
 
-        Result ret = restore_partition(
-                data_path, input_dir, path,
-                rom->data_is_image, DEFAULT_IMAGE_SIZE, { "media" }, compression);
-        if (ret == Result::Failed) {
+        // Converting between directories and images requires mounting the
+        // image, which backup and restore already do
+        if (p.source_is_image != p.target_is_image) {
+            LOGE("%s: Cloning between directories and images is not "
+                 "supported. Use backup and restore instead",
+                 p.target_path.c_str());
+            return false;
+        }
+
+        struct stat sb;
+        if (lstat(p.target_path.c_str(), &sb) == 0) {
+            LOGE("%s: Already exists; wipe the target ROM first",
+                 p.target_path.c_str());
             return false;
         }
     }
 
-    return true;
+    std::string multiboot_dir(MULTIBOOT_DIR);
+    multiboot_dir += '/';
+    multiboot_dir += target->id;
+    if (auto r = util::mkdir_recursive(multiboot_dir, 0775); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             multiboot_dir.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    bool ret = true;
+
+    if (targets & BackupTarget::Boot
+            && clone_boot_image(source, target) == Result::Failed) {
+        ret = false;
+    }
+
+    if (ret && targets & BackupTarget::Config
+            && clone_configs(source, target) == Result::Failed) {
+        ret = false;
+    }
+
+    fix_multiboot_permissions();
+
+    for (auto const &p : partitions) {
+        if (!ret) {
+            break;
+        }
+
+        if (targets & p.target && clone_partition(
+                p.source_path, p.target_path, p.source_is_image,
+                p.exclusions) == Result::Failed) {
+            ret = false;
+        }
+    }
+
+    if (!ret) {
+        LOGW("Removing partially cloned ROM: %s", target->id.c_str());
+        wipe_system(target);
+        wipe_cache(target);
+        wipe_data(target, nullptr, false, false);
+        wipe_multiboot(target);
+    }
+
+    return ret;
 }
 
 static bool ensure_partitions_mounted()
@@ -815,15 +1747,6 @@ static bool remount_partitions_writable()
             && mount("", data_partition.c_str(), "", MS_REMOUNT, "") == 0;
 }
 
-static bool is_valid_backup_name(const std::string &name)
-{
-    // No empty strings, hidden paths, '..', or directory separators
-    return !name.empty()                            // Must be non-empty
-            && name.find('/') == std::string::npos  // and contain no slashes
-            && name != "."                          // and not current directory
-            && name != "..";                        // and not parent directory
-}
-
 static void warn_selinux_context()
 {
     // We do not need to patch the SELinux policy or switch to mb_exec because
@@ -838,10 +1761,20 @@ static void warn_selinux_context()
     }
 }
 
+static void apply_sched_policy(util::SchedPolicy policy)
+{
+    if (auto r = util::set_sched_policy(policy); !r) {
+        LOGW("Failed to apply %s scheduling policy: %s",
+             util::sched_policy_to_string(policy),
+             r.error().message().c_str());
+    }
+}
+
 static void backup_usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: backup -r <romid> -t <targets> [-n <name>] [OPTION...]\n\n"
+            "Usage: backup -r <romid> -t <targets> [-n <name>] [OPTION...]\n"
+            "       backup -V -n <name> [-d <directory>] [-j <N>]\n\n"
             "Options:\n"
             "  -r, --romid <ROM ID>"
             "                   ROM ID to backup\n"
@@ -852,12 +1785,29 @@ static void backup_usage(FILE *stream)
             "                   Name of backup\n"
             "                   (Default: YYYY.MM.DD-HH.MM.SS)\n"
             "  -c, --compression <compression type>\n"
-            "                   Compression type (none, lz4, gzip, xz)\n"
+            "                   Compression type (none, lz4, gzip, xz, zstd)\n"
             "                   (Default: lz4)\n"
             "  -d, --backupdir <directory>\n"
             "                   Directory to store backups\n"
             "                   (Default: " MULTIBOOT_BACKUP_DIR ")\n"
             "  -f, --force      Allow overwriting old backup with the same name\n"
+            "  -j, --jobs <N>   Number of targets to back up in parallel\n"
+            "                   (Default: 1)\n"
+            "  -b, --base <name>\n"
+            "                   Only store the system, cache and data files\n"
+            "                   that changed since this backup, which must be\n"
+            "                   in the same backup directory\n"
+            "  -i, --block-images\n"
+            "                   Copy the used blocks of ext4 images to sparse\n"
+            "                   files instead of archiving their files\n"
+            "                   (Incompatible with -b for those targets)\n"
+            "  -V, --verify     Check the files of an existing backup against\n"
+            "                   the checksums recorded when it was made,\n"
+            "                   hashing up to -j files in parallel\n"
+            "  -p, --sched <policy>\n"
+            "                   Scheduling policy (default, background, idle,\n"
+            "                   interactive)\n"
+            "                   (Default: default)\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
@@ -882,6 +1832,10 @@ static void restore_usage(FILE *stream)
             "  -d, --backupdir <directory>\n"
             "                   Directory containing backups\n"
             "                   (Default: " MULTIBOOT_BACKUP_DIR ")\n"
+            "  -p, --sched <policy>\n"
+            "                   Scheduling policy (default, background, idle,\n"
+            "                   interactive)\n"
+            "                   (Default: default)\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
@@ -891,19 +1845,49 @@ static void restore_usage(FILE *stream)
             "have not yet been finalized.\n");
 }
 
+static void clone_rom_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: clone-rom -s <romid> -r <romid> [-t <targets>]\n\n"
+            "Options:\n"
+            "  -s, --source <ROM ID>\n"
+            "                   ROM ID to clone\n"
+            "  -r, --romid <ROM ID>\n"
+            "                   Empty slot to clone the ROM into\n"
+            "  -t, --targets <targets>\n"
+            "                   Comma-separated list of targets to clone\n"
+            "                   (Default: 'all')\n"
+            "  -p, --sched <policy>\n"
+            "                   Scheduling policy (default, background, idle,\n"
+            "                   interactive)\n"
+            "                   (Default: default)\n"
+            "  -h, --help       Display this help message\n"
+            "\n"
+            "Valid clone targets: 'all' or some combination of the following:\n"
+            "  system,cache,data,boot,config\n"
+            "\n"
+            "Files are reflinked on filesystems that support it. Otherwise,\n"
+            "they are copied in parallel and images keep their holes.\n");
+}
+
 int backup_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:n:c:d:fh";
+    static const char *short_options = "r:t:n:c:d:fj:b:iVp:h";
     static struct option long_options[] = {
-        {"romid",       required_argument, 0, 'r'},
-        {"targets",     required_argument, 0, 't'},
-        {"name",        required_argument, 0, 'n'},
-        {"compression", required_argument, 0, 'c'},
-        {"backupdir",   required_argument, 0, 'd'},
-        {"force",       no_argument,       0, 'f'},
-        {"help",        no_argument,       0, 'h'},
+        {"romid",        required_argument, 0, 'r'},
+        {"targets",      required_argument, 0, 't'},
+        {"name",         required_argument, 0, 'n'},
+        {"compression",  required_argument, 0, 'c'},
+        {"backupdir",    required_argument, 0, 'd'},
+        {"force",        no_argument,       0, 'f'},
+        {"jobs",         required_argument, 0, 'j'},
+        {"base",         required_argument, 0, 'b'},
+        {"block-images", no_argument,       0, 'i'},
+        {"verify",       no_argument,       0, 'V'},
+        {"sched",        required_argument, 0, 'p'},
+        {"help",         no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
@@ -912,9 +1896,14 @@ int backup_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string name;
+    std::string base_name;
     std::string backupdir(MULTIBOOT_BACKUP_DIR);
     util::CompressionType compression = util::CompressionType::Lz4;
     bool force = false;
+    bool block_images = false;
+    bool verify = false;
+    unsigned int jobs = 1;
+    util::SchedPolicy sched_policy = util::SchedPolicy::Default;
 
     if (auto n = util::format_time("%Y.%m.%d-%H.%M.%S",
                                    std::chrono::system_clock::now())) {
@@ -948,6 +1937,29 @@ int backup_main(int argc, char *argv[])
         case 'f':
             force = true;
             break;
+        case 'j':
+            if (!str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            base_name = optarg;
+            break;
+        case 'i':
+            block_images = true;
+            break;
+        case 'V':
+            verify = true;
+            break;
+        case 'p':
+            if (auto p = util::sched_policy_from_string(optarg)) {
+                sched_policy = *p;
+            } else {
+                fprintf(stderr, "Invalid scheduling policy: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'h':
             backup_usage(stdout);
             return EXIT_SUCCESS;
@@ -963,6 +1975,24 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Inherited by the worker threads spawned for -j
+    apply_sched_policy(sched_policy);
+
+    if (verify) {
+        if (!is_valid_backup_name(name)) {
+            fprintf(stderr, "Invalid backup name: %s\n", name.c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (verify_backup(backupdir + '/' + name, jobs)) {
+            LOGI("=== Finished ===");
+            return EXIT_SUCCESS;
+        } else {
+            LOGI("=== Failed ===");
+            return EXIT_FAILURE;
+        }
+    }
+
     if (romid.empty()) {
         fprintf(stderr, "No ROM ID specified\n");
         return EXIT_FAILURE;
@@ -979,16 +2009,21 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (!base_name.empty()
+            && (!is_valid_backup_name(base_name) || base_name == name)) {
+        fprintf(stderr, "Invalid base backup name: %s\n", base_name.c_str());
+        return EXIT_FAILURE;
+    }
+
     warn_selinux_context();
 
     if (!ensure_partitions_mounted()) {
         return EXIT_FAILURE;
     }
 
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    auto rom = roms.find_by_id(romid);
+    auto rom = roms->find_by_id(romid);
     if (!rom) {
         fprintf(stderr, "ROM '%s' is not installed\n", romid.c_str());
         return EXIT_FAILURE;
@@ -999,6 +2034,13 @@ int backup_main(int argc, char *argv[])
     output_dir += name;
 
     struct stat sb;
+    if (!base_name.empty()
+            && stat((backupdir + '/' + base_name).c_str(), &sb) < 0) {
+        fprintf(stderr, "Base backup '%s' does not exist\n",
+                base_name.c_str());
+        return EXIT_FAILURE;
+    }
+
     if (!force && stat(output_dir.c_str(), &sb) == 0) {
         fprintf(stderr, "Backup '%s' already exists. Choose another name or "
                 "pass -f/--force to use this name anyway.\n", name.c_str());
@@ -1011,7 +2053,8 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = backup_rom(rom, output_dir, targets, compression);
+    bool ret = backup_rom(rom, output_dir, base_name, targets, compression,
+                          block_images, jobs);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1025,12 +2068,13 @@ int restore_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:n:d:h";
+    static const char *short_options = "r:t:n:d:p:h";
     static struct option long_options[] = {
         {"romid",     required_argument, 0, 'r'},
         {"targets",   required_argument, 0, 't'},
         {"name",      required_argument, 0, 'n'},
         {"backupdir", required_argument, 0, 'd'},
+        {"sched",     required_argument, 0, 'p'},
         {"help",      no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -1041,6 +2085,7 @@ int restore_main(int argc, char *argv[])
     std::string targets_str("all");
     std::string name;
     std::string backupdir(MULTIBOOT_BACKUP_DIR);
+    util::SchedPolicy sched_policy = util::SchedPolicy::Default;
 
     while ((opt = getopt_long(argc, argv, short_options,
             long_options, &long_index)) != -1) {
@@ -1057,6 +2102,14 @@ int restore_main(int argc, char *argv[])
         case 'd':
             backupdir = optarg;
             break;
+        case 'p':
+            if (auto p = util::sched_policy_from_string(optarg)) {
+                sched_policy = *p;
+            } else {
+                fprintf(stderr, "Invalid scheduling policy: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'h':
             restore_usage(stdout);
             return EXIT_SUCCESS;
@@ -1121,6 +2174,8 @@ int restore_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    apply_sched_policy(sched_policy);
+
     bool ret = restore_rom(rom, input_dir, targets);
     if (ret) {
         LOGI("=== Finished ===");
@@ -1131,4 +2186,112 @@ int restore_main(int argc, char *argv[])
     }
 }
 
+int clone_rom_main(int argc, char *argv[])
+{
+    int opt;
+
+    static const char *short_options = "s:r:t:p:h";
+    static struct option long_options[] = {
+        {"source",  required_argument, 0, 's'},
+        {"romid",   required_argument, 0, 'r'},
+        {"targets", required_argument, 0, 't'},
+        {"sched",   required_argument, 0, 'p'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    std::string source_id;
+    std::string target_id;
+    std::string targets_str("all");
+    util::SchedPolicy sched_policy = util::SchedPolicy::Default;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+            long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's':
+            source_id = optarg;
+            break;
+        case 'r':
+            target_id = optarg;
+            break;
+        case 't':
+            targets_str = optarg;
+            break;
+        case 'p':
+            if (auto p = util::sched_policy_from_string(optarg)) {
+                sched_policy = *p;
+            } else {
+                fprintf(stderr, "Invalid scheduling policy: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            clone_rom_usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            clone_rom_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // There should be no other arguments
+    if (argc - optind != 0) {
+        clone_rom_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (source_id.empty() || target_id.empty()) {
+        fprintf(stderr, "Both the source and target ROM IDs are required\n");
+        return EXIT_FAILURE;
+    }
+
+    BackupTargets targets = parse_targets_string(targets_str);
+    if (!targets) {
+        fprintf(stderr, "Invalid targets: %s\n", targets_str.c_str());
+        return EXIT_FAILURE;
+    }
+
+    warn_selinux_context();
+
+    if (!ensure_partitions_mounted()) {
+        return EXIT_FAILURE;
+    }
+
+    if (!remount_partitions_writable()) {
+        fprintf(stderr, "Failed to remount partitions as writable: %s\n",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    auto roms = Roms::installed();
+
+    auto source = roms->find_by_id(source_id);
+    if (!source) {
+        fprintf(stderr, "ROM '%s' is not installed\n", source_id.c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto target = Roms::create_rom(target_id);
+    if (!target || target_id == "primary" || target_id == source_id) {
+        fprintf(stderr, "Invalid target ROM ID: '%s'\n", target_id.c_str());
+        return EXIT_FAILURE;
+    } else if (roms->find_by_id(target_id)) {
+        fprintf(stderr, "ROM '%s' is already installed\n", target_id.c_str());
+        return EXIT_FAILURE;
+    }
+
+    apply_sched_policy(sched_policy);
+
+    bool ret = clone_rom(source, target, targets);
+    if (ret) {
+        LOGI("=== Finished ===");
+        return EXIT_SUCCESS;
+    } else {
+        LOGI("=== Failed ===");
+        return EXIT_FAILURE;
+    }
+}
+
 }
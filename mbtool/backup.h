@@ -24,5 +24,6 @@ namespace mb
 
 int backup_main(int argc, char *argv[]);
 int restore_main(int argc, char *argv[]);
+int clone_rom_main(int argc, char *argv[]);
 
 }
\ No newline at end of file
@@ -0,0 +1,503 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "backup_manifest.h"
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/delete.h"
+#include "mbutil/fts.h"
+#include "mbutil/hash.h"
+#include "mbutil/string.h"
+
+#define LOG_TAG "mbtool/backup_manifest"
+
+// Manifests are tab-separated text files. The first line identifies the format,
+// the next lines name the base backup and give the digest of the archive, and
+// each of the remaining lines describes one file:
+//
+//   <mode (octal)> <uid> <gid> <size> <mtime> <mtime nsec> <inode> <hash> <path>
+//
+// The path is the last field and has tabs, newlines and backslashes escaped.
+constexpr char MANIFEST_MAGIC[] = "mbtool-backup-manifest\t1";
+constexpr char MANIFEST_KEY_BASE[] = "base\t";
+constexpr char MANIFEST_KEY_ARCHIVE[] = "archive\t";
+constexpr char MANIFEST_NO_HASH[] = "-";
+constexpr size_t MANIFEST_FIELDS = 9;
+
+// Limit on the data waiting to be hashed by BackupHasher
+constexpr size_t HASHER_QUEUE_MAX_BYTES = 16 * 1024 * 1024;
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+namespace mb
+{
+
+static std::string escape_path(const std::string &path)
+{
+    std::string result;
+    result.reserve(path.size());
+
+    for (char c : path) {
+        switch (c) {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+            break;
+        }
+    }
+
+    return result;
+}
+
+static bool unescape_path(std::string_view str, std::string &path)
+{
+    path.clear();
+    path.reserve(str.size());
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '\\') {
+            path += str[i];
+            continue;
+        }
+
+        if (++i == str.size()) {
+            return false;
+        }
+
+        switch (str[i]) {
+        case '\\':
+            path += '\\';
+            break;
+        case 't':
+            path += '\t';
+            break;
+        case 'n':
+            path += '\n';
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool parse_entry(std::string_view line, std::string &path,
+                        BackupManifestEntry &entry)
+{
+    auto pieces = split(line, '\t');
+    if (pieces.size() != MANIFEST_FIELDS
+            || !str_to_num(pieces[0].c_str(), 8, entry.mode)
+            || !str_to_num(pieces[1].c_str(), 10, entry.uid)
+            || !str_to_num(pieces[2].c_str(), 10, entry.gid)
+            || !str_to_num(pieces[3].c_str(), 10, entry.size)
+            || !str_to_num(pieces[4].c_str(), 10, entry.mtime_sec)
+            || !str_to_num(pieces[5].c_str(), 10, entry.mtime_nsec)
+            || !str_to_num(pieces[6].c_str(), 10, entry.ino)
+            || !unescape_path(pieces[8], path)
+            || path.empty()) {
+        return false;
+    }
+
+    if (pieces[7] == MANIFEST_NO_HASH) {
+        entry.hash.clear();
+    } else {
+        entry.hash = std::move(pieces[7]);
+    }
+
+    return true;
+}
+
+bool BackupManifestEntry::same_metadata(const BackupManifestEntry &other) const
+{
+    return mode == other.mode
+            && uid == other.uid
+            && gid == other.gid
+            && size == other.size
+            && mtime_sec == other.mtime_sec
+            && mtime_nsec == other.mtime_nsec
+            && ino == other.ino;
+}
+
+bool BackupManifest::load(const std::string &path)
+{
+    base.clear();
+    archive_hash.clear();
+    entries.clear();
+
+    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
+    if (!fp) {
+        if (errno != ENOENT) {
+            LOGE("%s: Failed to open for reading: %s",
+                 path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+    size_t line_num = 0;
+
+    auto free_line = finally([&]{
+        free(line);
+    });
+
+    while ((read = getline(&line, &len, fp.get())) >= 0) {
+        std::string_view sv(line, static_cast<size_t>(read));
+        if (!sv.empty() && sv.back() == '\n') {
+            sv.remove_suffix(1);
+        }
+
+        ++line_num;
+
+        if (line_num == 1) {
+            if (sv != MANIFEST_MAGIC) {
+                LOGE("%s: Not a backup manifest", path.c_str());
+                return false;
+            }
+        } else if (line_num == 2) {
+            if (!starts_with(sv, MANIFEST_KEY_BASE)) {
+                LOGE("%s: Missing base backup name", path.c_str());
+                return false;
+            }
+            base = sv.substr(sizeof(MANIFEST_KEY_BASE) - 1);
+        } else if (line_num == 3 && starts_with(sv, MANIFEST_KEY_ARCHIVE)) {
+            archive_hash = sv.substr(sizeof(MANIFEST_KEY_ARCHIVE) - 1);
+            if (archive_hash == MANIFEST_NO_HASH) {
+                archive_hash.clear();
+            }
+        } else {
+            std::string entry_path;
+            BackupManifestEntry entry;
+
+            if (!parse_entry(sv, entry_path, entry)) {
+                LOGE("%s:%zu: Invalid manifest entry", path.c_str(), line_num);
+                return false;
+            }
+
+            entries[std::move(entry_path)] = std::move(entry);
+        }
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (line_num < 2) {
+        LOGE("%s: Truncated backup manifest", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool BackupManifest::save(const std::string &path) const
+{
+    // Sort the paths so that manifests of similar backups can be diffed
+    std::vector<const decltype(entries)::value_type *> sorted;
+    sorted.reserve(entries.size());
+
+    for (auto const &item : entries) {
+        sorted.push_back(&item);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+        return a->first < b->first;
+    });
+
+    std::string temp_path = format("%s.%d.tmp", path.c_str(), getpid());
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "wbe"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    bool ok = fprintf(fp.get(), "%s\n%s%s\n%s%s\n", MANIFEST_MAGIC,
+                      MANIFEST_KEY_BASE, base.c_str(), MANIFEST_KEY_ARCHIVE,
+                      archive_hash.empty()
+                              ? MANIFEST_NO_HASH : archive_hash.c_str()) >= 0;
+
+    for (auto it = sorted.begin(); ok && it != sorted.end(); ++it) {
+        auto const &[entry_path, entry] = **it;
+
+        ok = fprintf(fp.get(), "%" PRIo32 "\t%" PRIu32 "\t%" PRIu32
+                     "\t%" PRIu64 "\t%" PRId64 "\t%" PRId64 "\t%" PRIu64
+                     "\t%s\t%s\n", entry.mode, entry.uid, entry.gid,
+                     entry.size, entry.mtime_sec, entry.mtime_nsec, entry.ino,
+                     entry.hash.empty() ? MANIFEST_NO_HASH : entry.hash.c_str(),
+                     escape_path(entry_path).c_str()) >= 0;
+    }
+
+    if (!ok || fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to write file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+class PruneDirectory : public util::FtsWrapper {
+public:
+    PruneDirectory(std::string path, const BackupManifest &manifest,
+                   const std::vector<std::string> &exclusions)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+        , _manifest(manifest)
+        , _exclusions(exclusions)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        // Directories are handled before their contents are visited
+        if (_curr->fts_level == 0 || _curr->fts_info == FTS_DP) {
+            return Action::Ok;
+        }
+
+        // Exclude first-level directories
+        if (_curr->fts_level == 1
+                && std::find(_exclusions.begin(), _exclusions.end(),
+                             _curr->fts_name) != _exclusions.end()) {
+            return Action::Skip;
+        }
+
+        std::string_view relpath(_curr->fts_path);
+        relpath.remove_prefix(std::min(
+                relpath.size(), static_cast<size_t>(_root->fts_pathlen)));
+        while (!relpath.empty() && relpath.front() == '/') {
+            relpath.remove_prefix(1);
+        }
+
+        if (_manifest.entries.find(std::string(relpath))
+                != _manifest.entries.end()) {
+            return Action::Ok;
+        }
+
+        LOGV("%s: Removing file that is not in the backup", _curr->fts_path);
+
+        if (_curr->fts_info == FTS_D) {
+            if (auto r = util::delete_recursive(_curr->fts_accpath); !r) {
+                _error_msg = format("%s: Failed to delete: %s",
+                                    _curr->fts_path,
+                                    r.error().message().c_str());
+                LOGW("%s", _error_msg.c_str());
+                return Action::Fail | Action::Skip;
+            }
+            return Action::Skip;
+        } else if (remove(_curr->fts_accpath) < 0) {
+            _error_msg = format("%s: Failed to delete: %s",
+                                _curr->fts_path, strerror(errno));
+            LOGW("%s", _error_msg.c_str());
+            return Action::Fail | Action::Next;
+        }
+
+        return Action::Next;
+    }
+
+private:
+    const BackupManifest &_manifest;
+    const std::vector<std::string> &_exclusions;
+};
+
+/*!
+ * \brief Delete the files in \p directory that are not in the manifest
+ *
+ * \param directory Directory the backup was restored to
+ * \param exclusions List of top-level directories to leave alone
+ *
+ * \return Whether all of the extra files were deleted
+ */
+bool BackupManifest::prune(const std::string &directory,
+                           const std::vector<std::string> &exclusions) const
+{
+    return PruneDirectory(directory, *this, exclusions).run();
+}
+
+BackupHasher::BackupHasher()
+    : _queued_bytes(0)
+    , _done(false)
+{
+    SHA512_Init(&_file_ctx);
+    SHA512_Init(&_archive_ctx);
+
+    _thread = std::thread(&BackupHasher::run, this);
+}
+
+BackupHasher::~BackupHasher()
+{
+    finish();
+}
+
+void BackupHasher::begin_file(std::string path)
+{
+    push({ Op::BeginFile, std::move(path), {} });
+}
+
+void BackupHasher::update_file(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+    push({ Op::UpdateFile, {}, { ptr, ptr + size } });
+}
+
+/*!
+ * \brief Finish hashing the current file
+ *
+ * \param record Whether to keep the digest. It is discarded for entries that
+ *               have no data in the archive, like hard links.
+ */
+void BackupHasher::end_file(bool record)
+{
+    push({ record ? Op::EndFile : Op::DiscardFile, {}, {} });
+}
+
+void BackupHasher::update_archive(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+    push({ Op::UpdateArchive, {}, { ptr, ptr + size } });
+}
+
+/*!
+ * \brief Wait for all of the queued data to be hashed
+ */
+void BackupHasher::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _cv.notify_all();
+
+    if (_thread.joinable()) {
+        _thread.join();
+
+        util::Sha512Digest digest;
+        SHA512_Final(digest.data(), &_archive_ctx);
+        _archive_hash = util::hex_string(digest.data(), digest.size());
+    }
+}
+
+const std::unordered_map<std::string, std::string> &
+BackupHasher::file_hashes() const
+{
+    return _file_hashes;
+}
+
+const std::string & BackupHasher::archive_hash() const
+{
+    return _archive_hash;
+}
+
+void BackupHasher::push(Task task)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _cv.wait(lock, [&] {
+        return _queue.empty()
+                || _queued_bytes + task.data.size() <= HASHER_QUEUE_MAX_BYTES;
+    });
+
+    _queued_bytes += task.data.size();
+    _queue.push_back(std::move(task));
+    _cv.notify_all();
+}
+
+void BackupHasher::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _cv.wait(lock, [&] {
+            return _done || !_queue.empty();
+        });
+
+        if (_queue.empty()) {
+            break;
+        }
+
+        Task task = std::move(_queue.front());
+        _queue.pop_front();
+        _queued_bytes -= task.data.size();
+        _cv.notify_all();
+
+        lock.unlock();
+
+        switch (task.op) {
+        case Op::BeginFile:
+            _cur_path = std::move(task.path);
+            SHA512_Init(&_file_ctx);
+            break;
+        case Op::UpdateFile:
+            SHA512_Update(&_file_ctx, task.data.data(), task.data.size());
+            break;
+        case Op::EndFile: {
+            util::Sha512Digest digest;
+            SHA512_Final(digest.data(), &_file_ctx);
+            _file_hashes[std::move(_cur_path)] =
+                    util::hex_string(digest.data(), digest.size());
+            break;
+        }
+        case Op::DiscardFile:
+            break;
+        case Op::UpdateArchive:
+            SHA512_Update(&_archive_ctx, task.data.data(), task.data.size());
+            break;
+        }
+
+        lock.lock();
+    }
+}
+
+}
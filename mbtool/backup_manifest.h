@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <openssl/sha.h>
+
+#include <cstdint>
+
+namespace mb
+{
+
+struct BackupManifestEntry
+{
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t ino;
+    // Hex SHA512 digest of the contents of a regular file. Empty if unknown.
+    std::string hash;
+
+    bool same_metadata(const BackupManifestEntry &other) const;
+};
+
+/*!
+ * List of every file in a backup of a partition.
+ *
+ * A backup that was made relative to a base backup only contains the files
+ * that were added or changed since the base. Restoring it means extracting the
+ * archives of every backup in the chain, starting with the oldest one, and then
+ * removing the files that aren't listed in the newest manifest.
+ */
+struct BackupManifest
+{
+    // Name of the backup this one is relative to. Empty for full backups.
+    std::string base;
+    // Hex SHA512 digest of the archive file. Empty if unknown.
+    std::string archive_hash;
+    // Paths are relative to the root of the partition
+    std::unordered_map<std::string, BackupManifestEntry> entries;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    bool prune(const std::string &directory,
+               const std::vector<std::string> &exclusions) const;
+};
+
+/*!
+ * Computes the SHA512 digests of the files in an archive and of the archive
+ * itself on a separate thread.
+ *
+ * The data is copied into a bounded queue, so hashing overlaps with reading and
+ * compressing the files instead of slowing down the thread writing the archive.
+ * All functions except the accessors must be called from the same thread.
+ */
+class BackupHasher
+{
+public:
+    BackupHasher();
+    ~BackupHasher();
+
+    void begin_file(std::string path);
+    void update_file(const void *data, size_t size);
+    void end_file(bool record);
+    void update_archive(const void *data, size_t size);
+
+    void finish();
+
+    // Only valid after finish() returns
+    const std::unordered_map<std::string, std::string> & file_hashes() const;
+    const std::string & archive_hash() const;
+
+private:
+    enum class Op
+    {
+        BeginFile,
+        UpdateFile,
+        EndFile,
+        DiscardFile,
+        UpdateArchive,
+    };
+
+    struct Task
+    {
+        Op op;
+        std::string path;
+        std::vector<unsigned char> data;
+    };
+
+    void push(Task task);
+    void run();
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Task> _queue;
+    size_t _queued_bytes;
+    bool _done;
+
+    SHA512_CTX _file_ctx;
+    SHA512_CTX _archive_ctx;
+    std::string _cur_path;
+    std::unordered_map<std::string, std::string> _file_hashes;
+    std::string _archive_hash;
+
+    std::thread _thread;
+};
+
+}
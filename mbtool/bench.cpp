@@ -0,0 +1,884 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mbcommon/version.h"
+#include "mblog/logging.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
+#include "mbutil/fts.h"
+#include "mbutil/hash.h"
+#include "mbutil/loopdev.h"
+#include "mbutil/properties.h"
+#include "mbutil/socket.h"
+
+#include "mkfs_ext4.h"
+
+#include "protocol/request_generated.h"
+#include "protocol/response_generated.h"
+
+#define LOG_TAG "mbtool/bench"
+
+#define DAEMON_SOCKET_ADDRESS   "mbtool.daemon"
+#define DAEMON_PROTOCOL_VERSION 3
+
+namespace v3 = mbtool::daemon::v3;
+namespace fb = flatbuffers;
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+namespace mb
+{
+
+using namespace std::chrono;
+
+static constexpr char DEFAULT_DIRECTORY[] = "/data/local/tmp";
+static constexpr uint64_t DEFAULT_SIZE_MIB = 64;
+static constexpr unsigned int DEFAULT_FILES = 2000;
+
+// Files per directory in the generated trees
+static constexpr unsigned int FILES_PER_DIR = 100;
+static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+static constexpr unsigned int LOOPDEV_ITERATIONS = 10;
+static constexpr uint64_t LOOPDEV_IMAGE_SIZE = 16 * 1024 * 1024;
+static constexpr unsigned int DAEMON_REQUESTS = 200;
+
+struct BenchOptions
+{
+    std::string directory;
+    uint64_t size;
+    unsigned int files;
+};
+
+using BenchValue = std::variant<uint64_t, double>;
+
+struct BenchResult
+{
+    const char *name;
+    std::string error;
+    std::vector<std::pair<const char *, BenchValue>> metrics;
+
+    void add(const char *key, BenchValue value)
+    {
+        metrics.emplace_back(key, value);
+    }
+
+    bool fail(std::string msg)
+    {
+        LOGE("%s: %s", name, msg.c_str());
+        error = std::move(msg);
+        return false;
+    }
+};
+
+struct BenchTest
+{
+    const char *name;
+    bool (*func)(const BenchOptions &, BenchResult &);
+};
+
+static double seconds_since(steady_clock::time_point start)
+{
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static double mb_per_s(uint64_t bytes, double secs)
+{
+    return secs > 0 ? static_cast<double>(bytes) / 1e6 / secs : 0.0;
+}
+
+static double rate(uint64_t count, double secs)
+{
+    return secs > 0 ? static_cast<double>(count) / secs : 0.0;
+}
+
+struct LatencyStats
+{
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double max_us;
+};
+
+static LatencyStats latency_stats(std::vector<double> samples_us)
+{
+    if (samples_us.empty()) {
+        return {};
+    }
+
+    std::sort(samples_us.begin(), samples_us.end());
+
+    double total = 0;
+    for (double s : samples_us) {
+        total += s;
+    }
+
+    auto percentile = [&](size_t p) {
+        return samples_us[std::min(samples_us.size() - 1,
+                                   samples_us.size() * p / 100)];
+    };
+
+    return {
+        total / static_cast<double>(samples_us.size()),
+        percentile(50),
+        percentile(99),
+        samples_us.back(),
+    };
+}
+
+//! Evict a file's pages from the page cache so it is read from storage
+static void drop_file_cache(int fd)
+{
+    (void) fdatasync(fd);
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+//! Create a file filled with poorly compressible data
+static oc::result<void> write_test_file(const std::string &path,
+                                        uint64_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+    uint32_t state = 1;
+
+    for (uint64_t done = 0; done < size;) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(buf.size(),
+                                                        size - done));
+
+        for (size_t i = 0; i < n; ++i) {
+            state = state * 1103515245u + 12345u;
+            buf[i] = static_cast<unsigned char>(state >> 16);
+        }
+
+        for (size_t written = 0; written < n;) {
+            ssize_t w = write(fd, buf.data() + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            }
+            written += static_cast<size_t>(w);
+        }
+
+        done += n;
+    }
+
+    drop_file_cache(fd);
+
+    return oc::success();
+}
+
+//! Create a tree of \p files small files, FILES_PER_DIR per directory
+static oc::result<void> create_tree(const std::string &path,
+                                    unsigned int files)
+{
+    if (mkdir(path.c_str(), 0700) < 0) {
+        return ec_from_errno();
+    }
+
+    std::string dir;
+    char name[32];
+
+    for (unsigned int i = 0; i < files; ++i) {
+        if (i % FILES_PER_DIR == 0) {
+            snprintf(name, sizeof(name), "/d%04u", i / FILES_PER_DIR);
+            dir = path + name;
+            if (mkdir(dir.c_str(), 0700) < 0) {
+                return ec_from_errno();
+            }
+        }
+
+        snprintf(name, sizeof(name), "/f%06u", i);
+        int fd = open((dir + name).c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        bool ok = write(fd, name, strlen(name))
+                == static_cast<ssize_t>(strlen(name));
+        close(fd);
+
+        if (!ok) {
+            return ec_from_errno();
+        }
+    }
+
+    sync();
+
+    return oc::success();
+}
+
+class FtsCounter : public util::FtsWrapper
+{
+public:
+    FtsCounter(std::string path)
+        : FtsWrapper(std::move(path), {})
+        , files(0)
+        , dirs(0)
+    {
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        ++dirs;
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        ++files;
+        return Action::Ok;
+    }
+
+    uint64_t files;
+    uint64_t dirs;
+};
+
+static bool bench_copy(const BenchOptions &opts, BenchResult &result)
+{
+    std::string source = opts.directory + "/copy.src";
+    std::string target = opts.directory + "/copy.dst";
+
+    if (auto r = write_test_file(source, opts.size); !r) {
+        return result.fail(source + ": Failed to create: "
+                + r.error().message());
+    }
+
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        return result.fail(source + ": Failed to open: " + strerror(errno));
+    }
+
+    auto close_source = finally([&] {
+        close(fd_source);
+        unlink(source.c_str());
+    });
+
+    int fd_target = open(target.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd_target < 0) {
+        return result.fail(target + ": Failed to open: " + strerror(errno));
+    }
+
+    auto close_target = finally([&] {
+        close(fd_target);
+        unlink(target.c_str());
+    });
+
+    auto start = steady_clock::now();
+
+    if (auto r = util::copy_data_fd(fd_source, fd_target); !r) {
+        return result.fail("Failed to copy data: " + r.error().message());
+    }
+
+    // Include the time to get the data to storage
+    if (fdatasync(fd_target) < 0) {
+        return result.fail(target + ": Failed to sync: " + strerror(errno));
+    }
+
+    double secs = seconds_since(start);
+
+    result.add("bytes", opts.size);
+    result.add("seconds", secs);
+    result.add("mb_per_s", mb_per_s(opts.size, secs));
+
+    return true;
+}
+
+static bool bench_sha512(const BenchOptions &opts, BenchResult &result)
+{
+    std::string path = opts.directory + "/sha512.src";
+
+    if (auto r = write_test_file(path, opts.size); !r) {
+        return result.fail(path + ": Failed to create: "
+                + r.error().message());
+    }
+
+    auto remove_file = finally([&] {
+        unlink(path.c_str());
+    });
+
+    // Cold cache, so this includes reading from storage
+    auto start = steady_clock::now();
+
+    if (auto r = util::sha512_hash(path); !r) {
+        return result.fail(path + ": Failed to hash: " + r.error().message());
+    }
+
+    double file_secs = seconds_since(start);
+
+    // Hashing only
+    auto memory_size = std::min<uint64_t>(opts.size, 64 * CHUNK_SIZE);
+    std::vector<unsigned char> data(static_cast<size_t>(memory_size));
+
+    start = steady_clock::now();
+
+    if (auto r = util::sha512_hash(data.data(), data.size()); !r) {
+        return result.fail("Failed to hash buffer: " + r.error().message());
+    }
+
+    double memory_secs = seconds_since(start);
+
+    result.add("bytes", opts.size);
+    result.add("file_seconds", file_secs);
+    result.add("file_mb_per_s", mb_per_s(opts.size, file_secs));
+    result.add("memory_bytes", static_cast<uint64_t>(data.size()));
+    result.add("memory_mb_per_s", mb_per_s(data.size(), memory_secs));
+
+    return true;
+}
+
+static bool bench_fts(const BenchOptions &opts, BenchResult &result)
+{
+    std::string path = opts.directory + "/fts";
+
+    auto start = steady_clock::now();
+
+    if (auto r = create_tree(path, opts.files); !r) {
+        (void) util::delete_recursive(path);
+        return result.fail(path + ": Failed to create tree: "
+                + r.error().message());
+    }
+
+    double create_secs = seconds_since(start);
+
+    auto remove_tree = finally([&] {
+        (void) util::delete_recursive(path);
+    });
+
+    FtsCounter counter(path);
+
+    start = steady_clock::now();
+
+    if (!counter.run()) {
+        return result.fail(path + ": Failed to walk tree: " + counter.error());
+    }
+
+    double walk_secs = seconds_since(start);
+    uint64_t entries = counter.files + counter.dirs;
+
+    result.add("files", counter.files);
+    result.add("directories", counter.dirs);
+    result.add("create_files_per_s", rate(opts.files, create_secs));
+    result.add("walk_seconds", walk_secs);
+    result.add("walk_entries_per_s", rate(entries, walk_secs));
+
+    return true;
+}
+
+static bool bench_delete(const BenchOptions &opts, BenchResult &result)
+{
+    std::string path = opts.directory + "/delete";
+
+    if (auto r = create_tree(path, opts.files); !r) {
+        (void) util::delete_recursive(path);
+        return result.fail(path + ": Failed to create tree: "
+                + r.error().message());
+    }
+
+    auto start = steady_clock::now();
+
+    if (auto r = util::delete_recursive(path); !r) {
+        return result.fail("Failed to delete tree: " + r.error().message());
+    }
+
+    double secs = seconds_since(start);
+
+    result.add("files", static_cast<uint64_t>(opts.files));
+    result.add("seconds", secs);
+    result.add("files_per_s", rate(opts.files, secs));
+
+    return true;
+}
+
+static bool bench_loopdev(const BenchOptions &opts, BenchResult &result)
+{
+    std::string image = opts.directory + "/loop.img";
+
+    if (auto r = write_test_file(image, LOOPDEV_IMAGE_SIZE); !r) {
+        return result.fail(image + ": Failed to create: "
+                + r.error().message());
+    }
+
+    auto remove_image = finally([&] {
+        unlink(image.c_str());
+    });
+
+    std::vector<double> setup_us;
+    std::vector<double> teardown_us;
+
+    for (unsigned int i = 0; i < LOOPDEV_ITERATIONS; ++i) {
+        auto start = steady_clock::now();
+
+        auto loopdev = util::loopdev_find_unused();
+        if (!loopdev) {
+            return result.fail("Failed to find unused loop device: "
+                    + loopdev.error().message());
+        }
+
+        if (auto r = util::loopdev_set_up_device(
+                loopdev.value(), image, 0, true, {}); !r) {
+            return result.fail(loopdev.value() + ": Failed to set up: "
+                    + r.error().message());
+        }
+
+        setup_us.push_back(seconds_since(start) * 1e6);
+        start = steady_clock::now();
+
+        if (auto r = util::loopdev_remove_device(loopdev.value()); !r) {
+            return result.fail(loopdev.value() + ": Failed to remove: "
+                    + r.error().message());
+        }
+
+        teardown_us.push_back(seconds_since(start) * 1e6);
+    }
+
+    auto setup = latency_stats(std::move(setup_us));
+    auto teardown = latency_stats(std::move(teardown_us));
+
+    result.add("iterations", static_cast<uint64_t>(LOOPDEV_ITERATIONS));
+    result.add("setup_mean_us", setup.mean_us);
+    result.add("setup_p50_us", setup.p50_us);
+    result.add("setup_max_us", setup.max_us);
+    result.add("teardown_mean_us", teardown.mean_us);
+    result.add("teardown_p50_us", teardown.p50_us);
+    result.add("teardown_max_us", teardown.max_us);
+
+    return true;
+}
+
+static bool bench_mkfs_ext4(const BenchOptions &opts, BenchResult &result)
+{
+    std::string image = opts.directory + "/ext4.img";
+    uint64_t size = std::max(opts.size, MKFS_EXT4_MIN_SIZE);
+
+    auto remove_image = finally([&] {
+        unlink(image.c_str());
+    });
+
+    auto start = steady_clock::now();
+
+    if (!mkfs_ext4(image, size)) {
+        return result.fail(image + ": Failed to create ext4 image");
+    }
+
+    double secs = seconds_since(start);
+
+    result.add("image_size", size);
+    result.add("seconds", secs);
+
+    return true;
+}
+
+static oc::result<int> daemon_connect()
+{
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    char abs_name[] = "\0" DAEMON_SOCKET_ADDRESS;
+    size_t abs_name_len = sizeof(abs_name) - 1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    memcpy(addr.sun_path, abs_name, abs_name_len);
+
+    auto addr_len = static_cast<socklen_t>(
+            offsetof(sockaddr_un, sun_path) + abs_name_len);
+
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) < 0) {
+        return ec_from_errno();
+    }
+
+    OUTCOME_TRY(auth, util::socket_read_string(fd));
+    if (auth != "ALLOW") {
+        return std::errc::permission_denied;
+    }
+
+    OUTCOME_TRYV(util::socket_write_int32(fd, DAEMON_PROTOCOL_VERSION));
+
+    OUTCOME_TRY(version, util::socket_read_string(fd));
+    if (version != "OK") {
+        return std::errc::protocol_not_supported;
+    }
+
+    close_fd.dismiss();
+
+    return fd;
+}
+
+static bool bench_daemon(const BenchOptions &opts, BenchResult &result)
+{
+    (void) opts;
+
+    auto start = steady_clock::now();
+
+    auto fd = daemon_connect();
+    if (!fd) {
+        return result.fail("Failed to connect to daemon: "
+                + fd.error().message());
+    }
+
+    double connect_secs = seconds_since(start);
+
+    auto close_fd = finally([&] {
+        close(fd.value());
+    });
+
+    util::SocketReader reader(fd.value());
+    std::vector<unsigned char> buf;
+    std::vector<double> samples_us;
+
+    fb::FlatBufferBuilder builder;
+    auto request = v3::CreateMbGetVersionRequest(builder);
+    builder.Finish(v3::CreateRequest(
+            builder, v3::RequestType_MbGetVersionRequest, request.Union()));
+
+    for (unsigned int i = 0; i < DAEMON_REQUESTS; ++i) {
+        start = steady_clock::now();
+
+        if (auto r = util::socket_write_bytes(
+                fd.value(), builder.GetBufferPointer(), builder.GetSize());
+                !r) {
+            return result.fail("Failed to send request: "
+                    + r.error().message());
+        }
+
+        if (auto r = reader.read_bytes_into(buf); !r) {
+            return result.fail("Failed to receive response: "
+                    + r.error().message());
+        }
+
+        samples_us.push_back(seconds_since(start) * 1e6);
+
+        auto verifier = fb::Verifier(buf.data(), buf.size());
+        if (!v3::VerifyResponseBuffer(verifier)
+                || v3::GetResponse(buf.data())->response_type()
+                        != v3::ResponseType_MbGetVersionResponse) {
+            return result.fail("Received invalid response");
+        }
+    }
+
+    auto stats = latency_stats(std::move(samples_us));
+
+    result.add("connect_us", connect_secs * 1e6);
+    result.add("requests", static_cast<uint64_t>(DAEMON_REQUESTS));
+    result.add("mean_us", stats.mean_us);
+    result.add("p50_us", stats.p50_us);
+    result.add("p99_us", stats.p99_us);
+    result.add("max_us", stats.max_us);
+
+    return true;
+}
+
+static const BenchTest g_tests[] = {
+    { "copy", bench_copy },
+    { "sha512", bench_sha512 },
+    { "fts", bench_fts },
+    { "delete", bench_delete },
+    { "loopdev", bench_loopdev },
+    { "mkfs_ext4", bench_mkfs_ext4 },
+    { "daemon", bench_daemon },
+};
+
+static const BenchTest * find_test(const char *name)
+{
+    for (auto const &test : g_tests) {
+        if (strcmp(test.name, name) == 0) {
+            return &test;
+        }
+    }
+    return nullptr;
+}
+
+template<typename Writer>
+static void write_value(Writer &writer, const BenchValue &value)
+{
+    if (auto const *u = std::get_if<uint64_t>(&value)) {
+        writer.Uint64(*u);
+    } else {
+        writer.Double(std::get<double>(value));
+    }
+}
+
+static bool write_report(FILE *fp, const BenchOptions &opts,
+                         const std::vector<BenchResult> &results)
+{
+    utsname uts = {};
+    (void) uname(&uts);
+
+    std::string fs_type;
+    struct statfs sfs;
+    if (statfs(opts.directory.c_str(), &sfs) == 0) {
+        fs_type = format("0x%" PRIx64,
+                         static_cast<uint64_t>(sfs.f_type));
+    }
+
+    char buf[4096];
+    rapidjson::FileWriteStream os(fp, buf, sizeof(buf));
+    rapidjson::Writer<rapidjson::FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key("version");
+    writer.String(version());
+    writer.Key("git_version");
+    writer.String(git_version());
+    writer.Key("device");
+    writer.String(util::property_get_string("ro.product.device", {}));
+    writer.Key("model");
+    writer.String(util::property_get_string("ro.product.model", {}));
+    writer.Key("kernel");
+    writer.String(uts.release);
+    writer.Key("directory");
+    writer.String(opts.directory);
+    writer.Key("filesystem_magic");
+    writer.String(fs_type);
+    writer.Key("size");
+    writer.Uint64(opts.size);
+    writer.Key("files");
+    writer.Uint(opts.files);
+    writer.Key("results");
+    writer.StartArray();
+
+    for (auto const &r : results) {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(r.name);
+        writer.Key("success");
+        writer.Bool(r.error.empty());
+        if (!r.error.empty()) {
+            writer.Key("error");
+            writer.String(r.error);
+        }
+        for (auto const &[key, value] : r.metrics) {
+            writer.Key(key);
+            write_value(writer, value);
+        }
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    os.Flush();
+
+    fputc('\n', fp);
+
+    return !ferror(fp);
+}
+
+static void bench_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: bench [options]\n\n"
+            "Measures the performance of I/O paths used by mbtool on this\n"
+            "device and prints the results as JSON.\n\n"
+            "Options:\n"
+            "  -d, --directory <dir>\n"
+            "                   Directory for temporary files (default: %s)\n"
+            "  -s, --size <MiB>  Size of the files for the throughput tests\n"
+            "                   (default: %" PRIu64 ")\n"
+            "  -n, --files <count>\n"
+            "                   Number of files for the tree tests\n"
+            "                   (default: %u)\n"
+            "  -t, --test <name>\n"
+            "                   Run only this test (can be repeated)\n"
+            "  -o, --output <file>\n"
+            "                   Write the report to <file> instead of stdout\n"
+            "  -h, --help       Display this help message\n\n"
+            "Tests:\n",
+            DEFAULT_DIRECTORY, DEFAULT_SIZE_MIB, DEFAULT_FILES);
+    for (auto const &test : g_tests) {
+        fprintf(stream, "  %s\n", test.name);
+    }
+}
+
+int bench_main(int argc, char *argv[])
+{
+    int opt;
+    BenchOptions opts{DEFAULT_DIRECTORY, DEFAULT_SIZE_MIB * 1024 * 1024,
+                      DEFAULT_FILES};
+    std::vector<const BenchTest *> tests;
+    const char *output_path = nullptr;
+    uint64_t size_mib;
+
+    static const char short_options[] = "d:s:n:t:o:h";
+
+    static struct option long_options[] = {
+        {"directory", required_argument, 0, 'd'},
+        {"size",      required_argument, 0, 's'},
+        {"files",     required_argument, 0, 'n'},
+        {"test",      required_argument, 0, 't'},
+        {"output",    required_argument, 0, 'o'},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'd':
+            opts.directory = optarg;
+            break;
+
+        case 's':
+            if (!str_to_num(optarg, 10, size_mib) || size_mib == 0
+                    || size_mib > UINT64_MAX / 1024 / 1024) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.size = size_mib * 1024 * 1024;
+            break;
+
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.files) || opts.files == 0) {
+                fprintf(stderr, "Invalid file count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 't':
+            if (auto const *test = find_test(optarg)) {
+                tests.push_back(test);
+            } else {
+                fprintf(stderr, "Unknown test: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'o':
+            output_path = optarg;
+            break;
+
+        case 'h':
+            bench_usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            bench_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 0) {
+        bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (tests.empty()) {
+        for (auto const &test : g_tests) {
+            tests.push_back(&test);
+        }
+    }
+
+    // Keep everything in a private directory so that failed tests cannot
+    // leave files behind
+    std::string temp_dir = opts.directory + "/mbtool-bench.XXXXXX";
+    if (!mkdtemp(temp_dir.data())) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n",
+                temp_dir.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    auto remove_temp_dir = finally([&] {
+        (void) util::delete_recursive(temp_dir);
+    });
+
+    BenchOptions test_opts = opts;
+    test_opts.directory = temp_dir;
+
+    std::vector<BenchResult> results;
+    bool success = true;
+
+    for (auto const *test : tests) {
+        LOGI("Running benchmark: %s", test->name);
+
+        BenchResult result{test->name, {}, {}};
+        success = test->func(test_opts, result) && success;
+        results.push_back(std::move(result));
+    }
+
+    ScopedFILE fp(nullptr, fclose);
+    if (output_path) {
+        fp.reset(fopen(output_path, "we"));
+        if (!fp) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    output_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!write_report(fp ? fp.get() : stdout, opts, results)
+            || (fp && fclose(fp.release()) != 0)) {
+        fprintf(stderr, "Failed to write report: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot_timeline.h"
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include "mbcommon/version.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#define LOG_TAG "mbtool/boot_timeline"
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+namespace mb
+{
+
+using namespace std::chrono;
+
+// Number of steps kept. Older steps are overwritten if more are recorded.
+static constexpr size_t BOOT_TIMELINE_SIZE = 64;
+
+struct BootTimelineEntry
+{
+    // Must be a string literal
+    const char *step;
+    steady_clock::time_point time;
+};
+
+static std::mutex g_timeline_lock;
+static std::array<BootTimelineEntry, BOOT_TIMELINE_SIZE> g_timeline;
+static size_t g_timeline_count = 0;
+
+static auto to_us(steady_clock::duration d)
+{
+    return static_cast<int64_t>(duration_cast<microseconds>(d).count());
+}
+
+/*!
+ * \brief Record that a boot step has completed
+ *
+ * The step's duration (the time since the previous step) and its monotonic
+ * timestamp are logged immediately so that they show up in the kernel log even
+ * if the boot process never gets to boot_timeline_save().
+ *
+ * \param step Name of the step. This must be a string literal since only the
+ *             pointer is stored.
+ */
+void boot_timeline_mark(const char *step)
+{
+    auto now = steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(g_timeline_lock);
+
+    if (g_timeline_count > 0) {
+        auto &prev = g_timeline[(g_timeline_count - 1) % BOOT_TIMELINE_SIZE];
+        LOGV("Boot timeline: %s took %" PRId64 " us (at %" PRId64 " us)",
+             step, to_us(now - prev.time), to_us(now.time_since_epoch()));
+    } else {
+        LOGV("Boot timeline: %s (at %" PRId64 " us)",
+             step, to_us(now.time_since_epoch()));
+    }
+
+    g_timeline[g_timeline_count % BOOT_TIMELINE_SIZE] = {step, now};
+    ++g_timeline_count;
+}
+
+/*!
+ * \brief Write the recorded boot steps to a JSON file
+ *
+ * Each step in the "steps" array contains its name, its monotonic timestamp
+ * in microseconds, and its duration in microseconds (relative to the previous
+ * step). "dropped" is the number of steps that no longer fit in the buffer.
+ */
+bool boot_timeline_save(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(g_timeline_lock);
+
+    if (auto r = util::mkdir_parent(path, 0771); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    ScopedFILE fp(fopen(path.c_str(), "we"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t begin = g_timeline_count > BOOT_TIMELINE_SIZE
+            ? g_timeline_count - BOOT_TIMELINE_SIZE : 0;
+
+    char buf[4096];
+    rapidjson::FileWriteStream os(fp.get(), buf, sizeof(buf));
+    rapidjson::Writer<rapidjson::FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key("version");
+    writer.String(version());
+    writer.Key("dropped");
+    writer.Uint64(begin);
+    writer.Key("steps");
+    writer.StartArray();
+
+    for (size_t i = begin; i < g_timeline_count; ++i) {
+        auto const &entry = g_timeline[i % BOOT_TIMELINE_SIZE];
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(entry.step);
+        writer.Key("time_us");
+        writer.Int64(to_us(entry.time.time_since_epoch()));
+        writer.Key("duration_us");
+        if (i > begin) {
+            auto const &prev = g_timeline[(i - 1) % BOOT_TIMELINE_SIZE];
+            writer.Int64(to_us(entry.time - prev.time));
+        } else {
+            writer.Null();
+        }
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+}
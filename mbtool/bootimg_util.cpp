@@ -19,17 +19,34 @@
 
 #include "bootimg_util.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 
 #include <unistd.h>
 
+#include "mbcommon/file_error.h"
 #include "mblog/logging.h"
 
+#include "mbutil/directory.h"
+#include "mbutil/path.h"
+
+#include "multiboot.h"
+#include "roms.h"
+
 #define LOG_TAG "mbtool/bootimg_util"
 
-#define BUF_SIZE    10240
+// The copy buffers start small so that tiny entries, like device trees, don't
+// allocate much. They grow while reads keep filling them completely.
+#define MIN_BUF_SIZE    (64 * 1024)
+#define MAX_BUF_SIZE    (1024 * 1024)
 
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
@@ -38,35 +55,197 @@ using namespace mb::bootimg;
 namespace mb
 {
 
-bool bi_copy_data_to_fd(Reader &reader, int fd)
+// Reads up to size bytes into buf. Returns false after logging an error.
+using CopyReadFn = std::function<bool(void *buf, size_t size, size_t &n_read)>;
+// Writes all of buf. Returns false after logging an error.
+using CopyWriteFn = std::function<bool(const void *buf, size_t size)>;
+
+/*!
+ * \brief Copy data with reading and writing overlapped
+ *
+ * A separate thread reads into one buffer while the calling thread writes the
+ * other. This lets decompression in the boot image reader run at the same time
+ * as the writes to the output. \p read_fn is only called from the reader thread
+ * and \p write_fn is only called from the calling thread.
+ */
+static bool pipelined_copy(const CopyReadFn &read_fn,
+                           const CopyWriteFn &write_fn)
 {
-    char buf[BUF_SIZE];
+    struct Buffer
+    {
+        std::vector<char> data;
+        size_t size = 0;
+        bool full = false;
+    };
+
+    Buffer bufs[2];
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool reader_done = false;
+    bool read_failed = false;
+    bool write_failed = false;
+
+    std::thread reader([&] {
+        size_t buf_size = MIN_BUF_SIZE;
+
+        for (size_t i = 0; ; i ^= 1) {
+            auto &buf = bufs[i];
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !buf.full || write_failed; });
+                if (write_failed) {
+                    break;
+                }
+            }
+
+            if (buf.data.size() < buf_size) {
+                buf.data.resize(buf_size);
+            }
+
+            size_t n;
+            bool ok = read_fn(buf.data.data(), buf_size, n);
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!ok) {
+                read_failed = true;
+                break;
+            }
+
+            // An empty buffer marks the end of the data
+            buf.size = n;
+            buf.full = true;
+            cv.notify_all();
+
+            if (n == 0) {
+                break;
+            } else if (n == buf_size) {
+                buf_size = std::min<size_t>(buf_size * 2, MAX_BUF_SIZE);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        reader_done = true;
+        cv.notify_all();
+    });
+
+    bool ret = false;
+
+    for (size_t i = 0; ; i ^= 1) {
+        auto &buf = bufs[i];
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return buf.full || reader_done; });
+            if (!buf.full) {
+                // The reader failed
+                break;
+            }
+        }
+
+        if (buf.size == 0) {
+            ret = true;
+            break;
+        }
+
+        bool ok = write_fn(buf.data.data(), buf.size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!ok) {
+            write_failed = true;
+            cv.notify_all();
+            break;
+        }
+
+        buf.full = false;
+        cv.notify_all();
+    }
+
+    reader.join();
+
+    return ret && !read_failed;
+}
 
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
+static CopyReadFn reader_read_fn(Reader &reader)
+{
+    return [&reader](void *buf, size_t size, size_t &n_read) {
+        auto n = reader.read_data(buf, size);
+        if (!n) {
             LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
+                 n.error().message().c_str());
             return false;
-        } else if (n_read.value() == 0) {
-            break;
         }
 
-        size_t remain = n_read.value();
+        n_read = n.value();
+        return true;
+    };
+}
+
+static CopyWriteFn writer_write_fn(Writer &writer)
+{
+    return [&writer](const void *buf, size_t size) {
+        auto n = writer.write_data(buf, size);
+        if (!n) {
+            LOGE("Failed to write entry data: %s",
+                 n.error().message().c_str());
+            return false;
+        }
 
-        while (remain > 0) {
-            ssize_t n_written = write(
-                    fd, buf + (n_read.value() - remain), remain);
-            if (n_written <= 0) {
+        return true;
+    };
+}
+
+/*!
+ * \brief Write the data directly if the reader's input is memory-backed
+ *
+ * \return Whether a view was available. \p ret is only set in that case.
+ */
+static bool try_copy_view(Reader &reader, const CopyWriteFn &write_fn,
+                          bool &ret)
+{
+    auto view = reader.read_data_view();
+    if (view) {
+        ret = view.value().size == 0
+                || write_fn(view.value().data, view.value().size);
+        return true;
+    } else if (view.error() != FileError::UnsupportedView) {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
+        ret = false;
+        return true;
+    }
+
+    return false;
+}
+
+bool bi_copy_data_to_fd(Reader &reader, int fd)
+{
+    auto write_fn = [fd](const void *buf, size_t size) {
+        auto ptr = static_cast<const char *>(buf);
+
+        while (size > 0) {
+            ssize_t n_written = write(fd, ptr, size);
+            if (n_written < 0 && errno == EINTR) {
+                continue;
+            } else if (n_written <= 0) {
                 LOGE("Failed to write data: %s", strerror(errno));
                 return false;
             }
 
-            remain -= static_cast<size_t>(n_written);
+            ptr += n_written;
+            size -= static_cast<size_t>(n_written);
         }
+
+        return true;
+    };
+
+    if (bool ret; try_copy_view(reader, write_fn, ret)) {
+        return ret;
     }
 
-    return true;
+    return pipelined_copy(reader_read_fn(reader), write_fn);
 }
 
 bool bi_copy_file_to_data(const std::string &path, Writer &writer)
@@ -78,30 +257,19 @@ bool bi_copy_file_to_data(const std::string &path, Writer &writer)
         return false;
     }
 
-    char buf[10240];
-    size_t n;
-
-    while (true) {
-        n = fread(buf, 1, sizeof(buf), fp.get());
+    auto read_fn = [&](void *buf, size_t size, size_t &n_read) {
+        n_read = fread(buf, 1, size, fp.get());
 
-        auto bytes_written = writer.write_data(buf, n);
-        if (!bytes_written) {
-            LOGE("Failed to write entry data: %s",
-                 bytes_written.error().message().c_str());
+        if (n_read < size && ferror(fp.get())) {
+            LOGE("%s: Failed to read file: %s",
+                 path.c_str(), strerror(errno));
             return false;
         }
 
-        if (n < sizeof(buf)) {
-            if (ferror(fp.get())) {
-                LOGE("%s: Failed to read file: %s",
-                     path.c_str(), strerror(errno));
-            } else {
-                break;
-            }
-        }
-    }
+        return true;
+    };
 
-    return true;
+    return pipelined_copy(read_fn, writer_write_fn(writer));
 }
 
 bool bi_copy_data_to_file(Reader &reader, const std::string &path)
@@ -113,23 +281,24 @@ bool bi_copy_data_to_file(Reader &reader, const std::string &path)
         return false;
     }
 
-    char buf[10240];
-
-    while (true) {
-        auto n = reader.read_data(buf, sizeof(buf));
-        if (!n) {
-            LOGE("Failed to read entry data: %s",
-                 n.error().message().c_str());
-            return false;
-        } else if (n.value() == 0) {
-            break;
-        }
-
-        if (fwrite(buf, 1, n.value(), fp.get()) != n.value()) {
+    auto write_fn = [&](const void *buf, size_t size) {
+        if (fwrite(buf, 1, size, fp.get()) != size) {
             LOGE("%s: Failed to write data: %s",
                  path.c_str(), strerror(errno));
             return false;
         }
+
+        return true;
+    };
+
+    bool ret;
+
+    if (!try_copy_view(reader, write_fn, ret)) {
+        ret = pipelined_copy(reader_read_fn(reader), write_fn);
+    }
+
+    if (!ret) {
+        return false;
     }
 
     if (fclose(fp.release()) < 0) {
@@ -143,27 +312,36 @@ bool bi_copy_data_to_file(Reader &reader, const std::string &path)
 
 bool bi_copy_data_to_data(Reader &reader, Writer &writer)
 {
-    char buf[10240];
+    auto write_fn = writer_write_fn(writer);
 
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
+    // Hand the entry data straight to the writer if the input is memory-backed
+    if (bool ret; try_copy_view(reader, write_fn, ret)) {
+        return ret;
+    }
 
-        auto n_written = writer.write_data(buf, n_read.value());
-        if (!n_written) {
-            LOGE("Failed to write entry data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
+    return pipelined_copy(reader_read_fn(reader), write_fn);
+}
+
+/*!
+ * \brief Remember which format won the bid for each boot image
+ *
+ * Failing to enable the cache is not an error. The reader then falls back to
+ * letting every format bid.
+ */
+void bi_enable_format_cache(Reader &reader)
+{
+    std::string path(get_raw_path(BOOTIMG_FORMAT_CACHE_PATH));
+
+    if (auto r = util::mkdir_recursive(util::dir_name(path), 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             util::dir_name(path).c_str(), r.error().message().c_str());
+        return;
     }
 
-    return true;
+    if (auto r = reader.set_format_cache(path); !r) {
+        LOGW("%s: Failed to enable format cache: %s",
+             path.c_str(), r.error().message().c_str());
+    }
 }
 
 }
@@ -32,4 +32,6 @@ bool bi_copy_file_to_data(const std::string &path, bootimg::Writer &writer);
 bool bi_copy_data_to_file(bootimg::Reader &reader, const std::string &path);
 bool bi_copy_data_to_data(bootimg::Reader &reader, bootimg::Writer &writer);
 
+void bi_enable_format_cache(bootimg::Reader &reader);
+
 }
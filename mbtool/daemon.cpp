@@ -25,6 +25,7 @@
 #include <getopt.h>
 #include <sched.h>
 #include <sys/mount.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
@@ -33,6 +34,7 @@
 
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
@@ -60,6 +62,9 @@
 #define RESPONSE_OK "OK"                        // Generic accepted response
 #define RESPONSE_UNSUPPORTED "UNSUPPORTED"      // Generic unsupported response
 
+#define MAX_PREFORK_WORKERS 16
+#define DEFAULT_SLOW_REQUEST_MS 1000
+
 
 namespace mb
 {
@@ -73,6 +78,8 @@ static bool allow_root_client = false;
 static bool log_to_kmsg = false;
 static bool log_to_stdio = false;
 static bool no_unshare = false;
+static unsigned int prefork_workers = 0;
+static unsigned int slow_request_ms = DEFAULT_SLOW_REQUEST_MS;
 
 static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     if (fp) {
@@ -90,7 +97,7 @@ static bool verify_credentials(uid_t uid)
     // which case, there's not much we can do to prevent damage.
 
     Packages pkgs;
-    if (!pkgs.load_xml(PACKAGES_XML)) {
+    if (!pkgs.load_cached(PACKAGES_XML, get_raw_path(PACKAGES_CACHE_DIR))) {
         LOGE("Failed to load " PACKAGES_XML);
         return false;
     }
@@ -194,6 +201,218 @@ static bool client_connection(int fd)
     }
 }
 
+// Give the current process its own mount namespace
+static bool unshare_mount_namespace()
+{
+    if (!no_unshare) {
+        if (unshare(CLONE_NEWNS) < 0) {
+            LOGE("unshare() failed: %s", strerror(errno));
+            return false;
+        }
+
+        if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
+            LOGE("Failed to set private mount propagation: %s",
+                 strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Restore default SIGCHLD handler
+static bool restore_sigchld_handler()
+{
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGCHLD, &sa, 0) < 0) {
+        LOGE("Failed to set default SIGCHLD handler: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// Prepare the current process for handling a single client connection
+static bool init_connection_process()
+{
+    return unshare_mount_namespace() && restore_sigchld_handler();
+}
+
+// Change the process name so --replace doesn't kill existing connections
+static bool set_connection_process_title()
+{
+    if (auto ret = util::set_process_title(
+            "mbtool connection initializing"); !ret) {
+        LOGE("Failed to set process title: %s",
+             ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+[[noreturn]]
+static void handle_connection(int fd, int client_fd)
+{
+    // Don't need the listening socket fd
+    close(fd);
+
+    bool ret = client_connection(client_fd);
+    close(client_fd);
+    _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static bool run_fork_per_connection(int fd)
+{
+    int client_fd;
+    while ((client_fd = accept(fd, nullptr, nullptr)) >= 0) {
+        pid_t child_pid = fork();
+        if (child_pid < 0) {
+            LOGE("Failed to fork: %s", strerror(errno));
+        } else if (child_pid == 0) {
+            if (!init_connection_process() || !set_connection_process_title()) {
+                _exit(127);
+            }
+
+            handle_connection(fd, client_fd);
+        }
+        close(client_fd);
+    }
+
+    LOGE("Failed to accept connection on socket: %s", strerror(errno));
+    return false;
+}
+
+// Sent by a prefork worker when it stops being idle
+struct PreforkWorkerStatus
+{
+    pid_t pid;
+    bool accepted;
+};
+
+[[noreturn]]
+static void run_prefork_worker(int fd, int status_fd, pid_t daemon_pid)
+{
+    PreforkWorkerStatus status{getpid(), false};
+
+    auto send_status = [&] {
+        // Writes smaller than PIPE_BUF are atomic, so the workers can share
+        // the pipe
+        if (write(status_fd, &status, sizeof(status))
+                != static_cast<ssize_t>(sizeof(status))) {
+            LOGE("Failed to send worker status: %s", strerror(errno));
+        }
+        close(status_fd);
+    };
+
+    // Idle workers hold the listening socket, so they must not outlive the
+    // daemon. This also keeps --replace working because the process title is
+    // only changed once a connection is accepted.
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0) {
+        LOGE("Failed to set parent death signal: %s", strerror(errno));
+        send_status();
+        _exit(127);
+    } else if (getppid() != daemon_pid) {
+        _exit(EXIT_FAILURE);
+    }
+
+    // The mount namespace is only unshared once a connection is accepted.
+    // Otherwise, an idle worker would serve a copy of the mount table from
+    // whenever it was forked.
+    if (!restore_sigchld_handler()) {
+        send_status();
+        _exit(127);
+    }
+
+    int client_fd;
+    do {
+        client_fd = accept(fd, nullptr, nullptr);
+    } while (client_fd < 0 && errno == EINTR);
+
+    if (client_fd < 0) {
+        LOGE("Failed to accept connection on socket: %s", strerror(errno));
+        send_status();
+        _exit(EXIT_FAILURE);
+    }
+
+    status.accepted = true;
+    send_status();
+
+    // Like in the fork-per-connection mode, active connections are not
+    // affected by the daemon exiting
+    (void) prctl(PR_SET_PDEATHSIG, 0);
+
+    if (!unshare_mount_namespace() || !set_connection_process_title()) {
+        _exit(127);
+    }
+
+    handle_connection(fd, client_fd);
+}
+
+/*
+ * Keep a number of processes that have already been forked waiting in
+ * accept(). Each worker unshares its mount namespace after accepting, like in
+ * the fork-per-connection mode, so that it sees the current mounts. Each worker
+ * still handles exactly one connection and then exits, so clients remain
+ * isolated from each other. The daemon only has to fork a replacement after a
+ * connection has been accepted.
+ */
+static bool run_prefork(int fd, unsigned int n_workers)
+{
+    int status_fds[2];
+    if (pipe2(status_fds, O_CLOEXEC) < 0) {
+        LOGE("Failed to create pipe: %s", strerror(errno));
+        return false;
+    }
+
+    auto close_status_fds = finally([&] {
+        close(status_fds[0]);
+        close(status_fds[1]);
+    });
+
+    pid_t daemon_pid = getpid();
+    unsigned int idle = 0;
+
+    while (true) {
+        while (idle < n_workers) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                LOGE("Failed to fork: %s", strerror(errno));
+                if (idle == 0) {
+                    return false;
+                }
+                break;
+            } else if (pid == 0) {
+                close(status_fds[0]);
+                run_prefork_worker(fd, status_fds[1], daemon_pid);
+            }
+
+            ++idle;
+        }
+
+        PreforkWorkerStatus status;
+        ssize_t n = read(status_fds[0], &status, sizeof(status));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n != static_cast<ssize_t>(sizeof(status))) {
+            LOGE("Failed to read worker status: %s",
+                 n < 0 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        --idle;
+
+        // Don't keep respawning workers that can never succeed
+        if (!status.accepted) {
+            LOGE("Worker %d failed to accept connections", status.pid);
+            return false;
+        }
+    }
+}
+
 static bool run_daemon()
 {
     int fd = socket(AF_LOCAL, SOCK_STREAM, 0);
@@ -254,63 +473,18 @@ static bool run_daemon()
         }
     }
 
-    LOGD("Socket ready, waiting for connections");
-
-    int client_fd;
-    while ((client_fd = accept(fd, nullptr, nullptr)) >= 0) {
-        pid_t child_pid = fork();
-        if (child_pid < 0) {
-            LOGE("Failed to fork: %s", strerror(errno));
-        } else if (child_pid == 0) {
-            if (!no_unshare) {
-                if (unshare(CLONE_NEWNS) < 0) {
-                    LOGE("unshare() failed: %s", strerror(errno));
-                    _exit(127);
-                }
-
-                if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
-                    LOGE("Failed to set private mount propagation: %s",
-                         strerror(errno));
-                    _exit(127);
-                }
-            }
-
-            // Change the process name so --replace doesn't kill existing
-            // connections
-            if (auto ret = util::set_process_title(
-                    "mbtool connection initializing"); !ret) {
-                LOGE("Failed to set process title: %s",
-                     ret.error().message().c_str());
-                _exit(127);
-            }
-
-            // Restore default SIGCHLD handler
-            struct sigaction sa;
-            sa.sa_handler = SIG_DFL;
-            sigemptyset(&sa.sa_mask);
-            sa.sa_flags = 0;
-            if (sigaction(SIGCHLD, &sa, 0) < 0) {
-                LOGE("Failed to set default SIGCHLD handler: %s",
-                     strerror(errno));
-                _exit(127);
-            }
-
-            // Don't need the listening socket fd
-            close(fd);
-
-            bool ret = client_connection(client_fd);
-            close(client_fd);
-            _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
-        }
-        close(client_fd);
+    // Must be done before forking any connection processes
+    if (!init_version_3_stats(std::chrono::milliseconds(slow_request_ms))) {
+        LOGW("Request stats will not be available");
     }
 
-    if (client_fd < 0) {
-        LOGE("Failed to accept connection on socket: %s", strerror(errno));
-        return false;
-    }
+    LOGD("Socket ready, waiting for connections");
 
-    return true;
+    if (prefork_workers > 0) {
+        return run_prefork(fd, prefork_workers);
+    } else {
+        return run_fork_per_connection(fd);
+    }
 }
 
 static bool redirect_stdio_to_dev_null()
@@ -476,7 +650,14 @@ static void daemon_usage(bool error)
             "                   fully initialized\n"
             "  --log-to-kmsg    Send log output to kernel log instead of file\n"
             "  --log-to-stdio   Send log output to stdout/stderr\n"
-            "  --no-unshare     Don't unshare mount namespace\n");
+            "  --no-unshare     Don't unshare mount namespace\n"
+            "  --prefork <N>    Keep N initialized processes waiting for\n"
+            "                   connections instead of forking after accepting\n"
+            "                   each connection\n"
+            "  --slow-request-ms <MS>\n"
+            "                   Log requests that take longer than MS\n"
+            "                   milliseconds (default: %d, 0 to disable)\n",
+            DEFAULT_SLOW_REQUEST_MS);
 }
 
 int daemon_main(int argc, char *argv[])
@@ -493,6 +674,8 @@ int daemon_main(int argc, char *argv[])
         OPT_LOG_TO_KMSG = 1003,
         OPT_LOG_TO_STDIO = 1004,
         OPT_NO_UNSHARE = 1005,
+        OPT_PREFORK = 1006,
+        OPT_SLOW_REQUEST_MS = 1007,
     };
 
     static struct option long_options[] = {
@@ -505,6 +688,8 @@ int daemon_main(int argc, char *argv[])
         {"log-to-kmsg",        no_argument, 0, OPT_LOG_TO_KMSG},
         {"log-to-stdio",       no_argument, 0, OPT_LOG_TO_STDIO},
         {"no-unshare",         no_argument, 0, OPT_NO_UNSHARE},
+        {"prefork",            required_argument, 0, OPT_PREFORK},
+        {"slow-request-ms",    required_argument, 0, OPT_SLOW_REQUEST_MS},
         {0, 0, 0, 0}
     };
 
@@ -548,6 +733,23 @@ int daemon_main(int argc, char *argv[])
             no_unshare = true;
             break;
 
+        case OPT_PREFORK:
+            if (!str_to_num(optarg, 10, prefork_workers)
+                    || prefork_workers > MAX_PREFORK_WORKERS) {
+                fprintf(stderr, "Invalid number of prefork workers: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case OPT_SLOW_REQUEST_MS:
+            if (!str_to_num(optarg, 10, slow_request_ms)) {
+                fprintf(stderr, "Invalid slow request threshold: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
         default:
             daemon_usage(1);
             return EXIT_FAILURE;
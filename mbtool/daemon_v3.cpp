@@ -19,12 +19,24 @@
 
 #include "daemon_v3.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <deque>
+#include <new>
+#include <optional>
 #include <unordered_map>
-#include <unordered_set>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -37,17 +49,18 @@
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
-#include "mbutil/fts.h"
 #include "mbutil/path.h"
-#include "mbutil/properties.h"
+#include "mbutil/sched.h"
 #include "mbutil/selinux.h"
 #include "mbutil/socket.h"
 #include "mbutil/string.h"
 
+#include "directory_size.h"
 #include "init.h"
+#include "multiboot.h"
 #include "packages.h"
 #include "reboot.h"
-#include "romconfig.h"
+#include "rom_metadata.h"
 #include "roms.h"
 #include "signature.h"
 #include "switcher.h"
@@ -68,6 +81,20 @@
 
 #define LOG_TAG "mbtool/daemon_v3"
 
+#ifndef MFD_CLOEXEC
+#  define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#  define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#  define F_ADD_SEALS (1024 + 9)
+#  define F_SEAL_SEAL 0x0001
+#  define F_SEAL_SHRINK 0x0002
+#  define F_SEAL_GROW 0x0004
+#  define F_SEAL_WRITE 0x0008
+#endif
+
 namespace mb
 {
 
@@ -77,15 +104,151 @@ namespace fb = flatbuffers;
 static std::unordered_map<int, int> fd_map;
 static int fd_count = 0;
 
+// Reused for every response on the connection so that its buffer isn't
+// reallocated for each message. A builder that grew unusually large (eg. for a
+// big FileReadResponse) is replaced instead of being kept around.
+static constexpr size_t BUILDER_MAX_RETAINED_SIZE = 1024 * 1024;
+static std::optional<fb::FlatBufferBuilder> response_builder;
+
+static fb::FlatBufferBuilder & v3_builder()
+{
+    if (!response_builder
+            || response_builder->GetSize() > BUILDER_MAX_RETAINED_SIZE) {
+        response_builder.emplace();
+    } else {
+        response_builder->Clear();
+    }
+    return *response_builder;
+}
+
+// Responses of the batch being processed, if any
+static std::vector<std::vector<unsigned char>> *batch_responses = nullptr;
+
+// Requests that arrived while a request with progress reporting was running.
+// They are handled in order once it completes.
+static std::deque<std::vector<unsigned char>> pending_requests;
+
+// Buffered reader for the connection. Everything received from the client must
+// be read through it.
+static std::optional<util::SocketReader> connection_reader;
+
+// Whether the last request with progress reporting was cancelled. This is
+// reported to the first OperationCancelRequest handled after it.
+static bool operation_cancelled = false;
+
+// Responses at least this large are sent as a sealed memfd if the client set
+// allow_memfd in the request. The client maps the memfd instead of copying the
+// data out of the socket.
+static constexpr size_t MEMFD_RESPONSE_THRESHOLD = 256 * 1024;
+
+// Whether the request being handled set allow_memfd
+static bool memfd_allowed = false;
+
+// Whether memfd_create() is unavailable (Linux < 3.17)
+static bool memfd_unsupported = false;
+
+/*!
+ * \brief Copy a response buffer into a new sealed memfd
+ *
+ * \return File descriptor or -1 if the memfd could not be created. This is
+ *         not a connection error and the response should be sent normally.
+ */
+static int v3_create_response_memfd(const uint8_t *data, size_t size)
+{
+#ifdef __NR_memfd_create
+    int mfd = static_cast<int>(syscall(__NR_memfd_create, "mbtool-response",
+                                       MFD_CLOEXEC | MFD_ALLOW_SEALING));
+#else
+    int mfd = -1;
+    errno = ENOSYS;
+#endif
+    if (mfd < 0) {
+        if (errno == ENOSYS || errno == EINVAL) {
+            memfd_unsupported = true;
+        } else {
+            LOGW("Failed to create memfd: %s", strerror(errno));
+        }
+        return -1;
+    }
+
+    auto close_mfd = finally([&]{
+        if (mfd >= 0) {
+            close(mfd);
+        }
+    });
+
+    while (size > 0) {
+        ssize_t n = write(mfd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            LOGW("Failed to write to memfd: %s", strerror(errno));
+            return -1;
+        }
+
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    // The client must not be able to change the data while we or it might
+    // still be reading it
+    if (fcntl(mfd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        LOGW("Failed to seal memfd: %s", strerror(errno));
+        return -1;
+    }
+
+    int ret = mfd;
+    mfd = -1;
+    return ret;
+}
+
 static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
 {
+    if (batch_responses) {
+        auto data = builder.GetBufferPointer();
+        batch_responses->emplace_back(data, data + builder.GetSize());
+        return true;
+    }
+
+    if (memfd_allowed && !memfd_unsupported
+            && builder.GetSize() >= MEMFD_RESPONSE_THRESHOLD) {
+        int mfd = v3_create_response_memfd(
+                builder.GetBufferPointer(), builder.GetSize());
+        if (mfd >= 0) {
+            auto close_mfd = finally([&]{
+                close(mfd);
+            });
+
+            // Empty response announcing the descriptor, which follows it in
+            // the same way as for FileOpenFdRequest
+            fb::FlatBufferBuilder stub_builder;
+            stub_builder.Finish(v3::CreateResponse(
+                    stub_builder, v3::ResponseType_NONE, 0, true));
+
+            if (!util::socket_write_bytes(
+                    fd, stub_builder.GetBufferPointer(),
+                    stub_builder.GetSize())) {
+                return false;
+            }
+
+            if (auto ret = util::socket_send_fds(fd, { mfd }); !ret) {
+                LOGE("Failed to send memfd: %s",
+                     ret.error().message().c_str());
+                return false;
+            }
+
+            return true;
+        }
+    }
+
     return util::socket_write_bytes(
             fd, builder.GetBufferPointer(), builder.GetSize()).has_value();
 }
 
 static bool v3_send_response_invalid(int fd)
 {
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     auto response = v3::CreateResponse(builder, v3::ResponseType_Invalid,
                                        v3::CreateInvalid(builder).Union());
     builder.Finish(response);
@@ -94,7 +257,7 @@ static bool v3_send_response_invalid(int fd)
 
 static bool v3_send_response_unsupported(int fd)
 {
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     auto response = v3::CreateResponse(builder, v3::ResponseType_Unsupported,
                                        v3::CreateUnsupported(builder).Union());
     builder.Finish(response);
@@ -117,7 +280,7 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileChmodError> error;
 
     bool ret = fchmod(ffd, mode) == 0;
@@ -150,7 +313,7 @@ static bool v3_file_close(int fd, const v3::Request *msg)
     int ffd = it->second;
     fd_map.erase(it);
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileCloseError> error;
 
     bool ret = close(ffd) == 0;
@@ -171,17 +334,12 @@ static bool v3_file_close(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
-static bool v3_file_open(int fd, const v3::Request *msg)
+static int v3_file_open_flags(const fb::Vector<int16_t> *openflags)
 {
-    auto request = static_cast<const v3::FileOpenRequest *>(msg->request());
-    if (!request->path()) {
-        return v3_send_response_invalid(fd);
-    }
-
     int flags = O_CLOEXEC;
 
-    if (request->flags()) {
-        for (short openflag : *request->flags()) {
+    if (openflags) {
+        for (short openflag : *openflags) {
             if (openflag == v3::FileOpenFlag_APPEND) {
                 flags |= O_APPEND;
             } else if (openflag == v3::FileOpenFlag_CREAT) {
@@ -200,7 +358,19 @@ static bool v3_file_open(int fd, const v3::Request *msg)
         }
     }
 
-    fb::FlatBufferBuilder builder;
+    return flags;
+}
+
+static bool v3_file_open(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileOpenRequest *>(msg->request());
+    if (!request->path()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    int flags = v3_file_open_flags(request->flags());
+
+    auto &builder = v3_builder();
     fb::Offset<v3::FileOpenError> error;
     int id = -1;
 
@@ -227,6 +397,69 @@ static bool v3_file_open(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
+/*!
+ * \brief Open a path and pass the file descriptor to the client
+ *
+ * The file is opened with the daemon's privileges and SELinux context. This
+ * request is only reachable on connections that passed verify_credentials() in
+ * daemon.cpp, which is the same check that guards every other file operation.
+ */
+static bool v3_file_open_fd(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileOpenFdRequest *>(msg->request());
+    if (!request->path()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    // Don't allow creating files with setuid or setgid permissions
+    mode_t mode = static_cast<mode_t>(request->perms());
+    mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+    if (masked != mode) {
+        return v3_send_response_invalid(fd);
+    }
+
+    int flags = v3_file_open_flags(request->flags());
+
+    auto &builder = v3_builder();
+    fb::Offset<v3::FileOpenFdError> error;
+
+    int ffd = open(request->path()->c_str(), flags, mode);
+    int saved_errno = errno;
+
+    auto close_ffd = finally([&]{
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+
+    if (ffd < 0) {
+        error = v3::CreateFileOpenFdErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    }
+
+    auto response = v3::CreateFileOpenFdResponse(builder, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileOpenFdResponse, response.Union()));
+
+    if (!v3_send_response(fd, builder)) {
+        return false;
+    }
+
+    // The descriptor follows the response. The client gets its own copy, so
+    // ours is closed afterwards.
+    if (ffd >= 0) {
+        if (auto ret = util::socket_send_fds(fd, { ffd }); !ret) {
+            LOGE("Failed to send file descriptor: %s",
+                 ret.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static bool v3_file_read(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileReadRequest *>(msg->request());
@@ -239,7 +472,7 @@ static bool v3_file_read(int fd, const v3::Request *msg)
 
     std::vector<unsigned char> buf(static_cast<size_t>(request->count()));
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileReadError> error;
     fb::Offset<fb::Vector<unsigned char>> data;
 
@@ -287,7 +520,7 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileSeekError> error;
 
     // Ahh, posix...
@@ -323,7 +556,7 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
 
     int ffd = it->second;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileSELinuxGetLabelError> error;
 
     auto label = util::selinux_fget_context(ffd);
@@ -356,7 +589,7 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
 
     int ffd = it->second;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileSELinuxSetLabelError> error;
 
     auto ret = util::selinux_fset_context(ffd, request->label()->str());
@@ -387,7 +620,7 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
 
     int ffd = it->second;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileStatError> error;
     fb::Offset<v3::StructStat> statbuf;
     struct stat sb;
@@ -427,6 +660,269 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
+/*
+ * Streaming transfers
+ *
+ * The daemon first replies with an empty response of the matching type to
+ * accept the stream (or with Invalid/Unsupported, in which case no stream
+ * follows). Then the data is sent as chunks, each being a 32-bit length
+ * followed by that many bytes of raw file data, with an empty chunk marking the
+ * end of the stream. Finally, the daemon sends a second response containing
+ * the byte count and error, if any. The data is not wrapped in flatbuffers so
+ * that regular files can be handed directly to sendfile().
+ */
+
+static constexpr size_t STREAM_DEFAULT_CHUNK_SIZE = 1024 * 1024;
+static constexpr size_t STREAM_MAX_CHUNK_SIZE = 8 * 1024 * 1024;
+
+static size_t v3_stream_chunk_size(uint32_t requested)
+{
+    if (requested == 0) {
+        return STREAM_DEFAULT_CHUNK_SIZE;
+    }
+    return std::min<size_t>(requested, STREAM_MAX_CHUNK_SIZE);
+}
+
+/*!
+ * \brief Send \p size bytes from \p ffd after a chunk header has been written
+ *
+ * sendfile() is used when possible. If it is not supported for the file, the
+ * data is copied through \p buf. If the file cannot provide all of the bytes
+ * (eg. it was truncated), the rest of the chunk is zero-filled to keep the
+ * stream in sync and the error is stored in \p saved_errno.
+ *
+ * \return Whether the chunk was fully written to the socket
+ */
+static bool v3_stream_send_chunk_data(int fd, int ffd, size_t size,
+                                      bool &use_sendfile,
+                                      std::vector<unsigned char> &buf,
+                                      int &saved_errno)
+{
+    while (size > 0 && use_sendfile && saved_errno == 0) {
+        ssize_t n = sendfile(fd, ffd, nullptr, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            use_sendfile = false;
+        } else if (n < 0) {
+            saved_errno = errno;
+        } else if (n == 0) {
+            saved_errno = EIO;
+        } else {
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    while (size > 0) {
+        size_t to_read = std::min(size, buf.size());
+
+        if (saved_errno == 0) {
+            ssize_t n = read(ffd, buf.data(), to_read);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                saved_errno = errno;
+            } else if (n == 0) {
+                saved_errno = EIO;
+            } else {
+                to_read = static_cast<size_t>(n);
+            }
+        }
+
+        if (saved_errno != 0) {
+            std::fill_n(buf.data(), to_read, 0);
+        }
+
+        auto ret = util::socket_write(fd, buf.data(), to_read);
+        if (!ret || ret.value() != to_read) {
+            return false;
+        }
+
+        size -= to_read;
+    }
+
+    return true;
+}
+
+static bool v3_file_stream_read_send_result(int fd, uint64_t bytes_read,
+                                            int saved_errno)
+{
+    auto &builder = v3_builder();
+    fb::Offset<v3::FileStreamReadError> error;
+
+    if (saved_errno != 0) {
+        error = v3::CreateFileStreamReadErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    }
+
+    auto response = v3::CreateFileStreamReadResponse(
+            builder, bytes_read, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileStreamReadResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_file_stream_read(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileStreamReadRequest *>(
+            msg->request());
+    auto it = fd_map.find(request->id());
+    if (it == fd_map.end()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    int ffd = it->second;
+
+    if (!v3_file_stream_read_send_result(fd, 0, 0)) {
+        return false;
+    }
+
+    uint64_t remaining = request->count() > 0
+            ? request->count() : UINT64_MAX;
+    size_t chunk_size = v3_stream_chunk_size(request->chunk_size());
+    bool use_sendfile = false;
+
+    // The chunk length must be sent before the data, so sendfile() can only
+    // be used when the amount of remaining data is known up front
+    struct stat sb;
+    if (fstat(ffd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        off64_t offset = lseek64(ffd, 0, SEEK_CUR);
+        if (offset >= 0 && offset <= sb.st_size) {
+            remaining = std::min(remaining,
+                                 static_cast<uint64_t>(sb.st_size - offset));
+            use_sendfile = true;
+        }
+    }
+
+    std::vector<unsigned char> buf(std::min<uint64_t>(chunk_size, remaining));
+    uint64_t total = 0;
+    int saved_errno = 0;
+
+    while (remaining > 0 && saved_errno == 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(chunk_size, remaining));
+
+        if (use_sendfile) {
+            if (!util::socket_write_int32(fd, static_cast<int32_t>(n))
+                    || !v3_stream_send_chunk_data(fd, ffd, n, use_sendfile,
+                                                  buf, saved_errno)) {
+                return false;
+            }
+        } else {
+            ssize_t ret = read(ffd, buf.data(), n);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            } else if (ret < 0) {
+                saved_errno = errno;
+                break;
+            } else if (ret == 0) {
+                break;
+            }
+
+            n = static_cast<size_t>(ret);
+
+            if (!util::socket_write_bytes(fd, buf.data(), n)) {
+                return false;
+            }
+        }
+
+        total += n;
+        remaining -= n;
+    }
+
+    // End of stream
+    if (!util::socket_write_int32(fd, 0)) {
+        return false;
+    }
+
+    return v3_file_stream_read_send_result(fd, total, saved_errno);
+}
+
+static bool v3_file_stream_write_send_result(int fd, uint64_t bytes_written,
+                                             int saved_errno)
+{
+    auto &builder = v3_builder();
+    fb::Offset<v3::FileStreamWriteError> error;
+
+    if (saved_errno != 0) {
+        error = v3::CreateFileStreamWriteErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    }
+
+    auto response = v3::CreateFileStreamWriteResponse(
+            builder, bytes_written, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileStreamWriteResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_file_stream_write(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileStreamWriteRequest *>(
+            msg->request());
+    auto it = fd_map.find(request->id());
+    if (it == fd_map.end()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    int ffd = it->second;
+
+    if (!v3_file_stream_write_send_result(fd, 0, 0)) {
+        return false;
+    }
+
+    std::vector<unsigned char> buf;
+    uint64_t total = 0;
+    int saved_errno = 0;
+
+    // The whole stream is always consumed, even if a write fails, so that the
+    // next request is read from the right place
+    while (true) {
+        auto size = connection_reader->read_int32();
+        if (!size) {
+            LOGE("Failed to read chunk size: %s",
+                 size.error().message().c_str());
+            return false;
+        } else if (size.value() < 0
+                || static_cast<size_t>(size.value()) > STREAM_MAX_CHUNK_SIZE) {
+            LOGE("Invalid chunk size: %d", size.value());
+            return false;
+        } else if (size.value() == 0) {
+            break;
+        }
+
+        auto n = static_cast<size_t>(size.value());
+        if (buf.size() < n) {
+            buf.resize(n);
+        }
+
+        if (!connection_reader->read(buf.data(), n)) {
+            return false;
+        }
+
+        for (size_t written = 0; saved_errno == 0 && written < n;) {
+            ssize_t w = write(ffd, buf.data() + written, n - written);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            } else if (w < 0) {
+                saved_errno = errno;
+            } else {
+                written += static_cast<size_t>(w);
+                total += static_cast<size_t>(w);
+            }
+        }
+    }
+
+    return v3_file_stream_write_send_result(fd, total, saved_errno);
+}
+
 static bool v3_file_write(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileWriteRequest *>(msg->request());
@@ -437,7 +933,7 @@ static bool v3_file_write(int fd, const v3::Request *msg)
 
     int ffd = it->second;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::FileWriteError> error;
 
     ssize_t ret = write(ffd, request->data()->Data(), request->data()->size());
@@ -473,7 +969,7 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathChmodError> error;
 
     bool ret = chmod(request->path()->c_str(), mode) == 0;
@@ -501,7 +997,7 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathCopyError> error;
 
     auto ret = util::copy_contents(request->source()->str(),
@@ -558,7 +1054,7 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathDeleteError> error;
 
     if (!ret) {
@@ -590,7 +1086,7 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathMkdirError> error;
 
     oc::result<void> ret = oc::success();
@@ -627,7 +1123,7 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
 
     auto target = util::read_link(request->path()->str());
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathReadlinkError> error;
 
     if (!target) {
@@ -661,7 +1157,7 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
         label = util::selinux_lget_context(request->path()->str());
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathSELinuxGetLabelError> error;
 
     if (!label) {
@@ -699,7 +1195,7 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
                                          request->label()->str());
     }
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathSELinuxSetLabelError> error;
 
     if (!ret) {
@@ -719,55 +1215,6 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
-class DirectorySizeGetter : public util::FtsWrapper {
-public:
-    DirectorySizeGetter(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-        , _total(0)
-    {
-    }
-
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
-        }
-
-        return Action::Ok;
-    }
-
-    Actions on_reached_file() override
-    {
-        dev_t dev = static_cast<dev_t>(_curr->fts_statp->st_dev);
-        ino_t ino = static_cast<ino_t>(_curr->fts_statp->st_ino);
-
-        // If this file has been visited before (hard link), then skip it
-        if (_links.find(dev) != _links.end()
-                && _links[dev].find(ino) != _links[dev].end()) {
-            return Action::Ok;
-        }
-
-        _total += static_cast<uint64_t>(_curr->fts_statp->st_size);
-        _links[dev].emplace(ino);
-
-        return Action::Ok;
-    }
-
-    uint64_t total() const {
-        return _total;
-    }
-
-private:
-    std::vector<std::string> _exclusions;
-    std::unordered_map<dev_t, std::unordered_set<ino_t>> _links;
-    uint64_t _total;
-};
-
 static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
@@ -783,11 +1230,31 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
         }
     }
 
-    DirectorySizeGetter dsg(request->path()->str(), std::move(exclusions));
-    bool ret = dsg.run();
+    // Progress messages would break the one-response-per-request rule of
+    // batches, so only the final size is sent there
+    DirectorySizeProgressFn progress_cb;
+    if (request->report_progress() && !batch_responses) {
+        progress_cb = [fd](uint64_t size) {
+            auto &builder = v3_builder();
+            auto response = v3::CreatePathGetDirectorySizeProgressResponse(
+                    builder, size);
+
+            // Wrap response
+            builder.Finish(v3::CreateResponse(
+                    builder, v3::ResponseType_PathGetDirectorySizeProgressResponse,
+                    response.Union()));
+
+            // Stop walking the tree if the client is gone
+            return v3_send_response(fd, builder);
+        };
+    }
+
+    uint64_t size;
+    bool ret = get_directory_size(request->path()->str(), exclusions, size,
+                                  progress_cb);
     int saved_errno = errno;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::PathGetDirectorySizeError> error;
 
     if (!ret) {
@@ -796,8 +1263,7 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
     }
 
     auto response = v3::CreatePathGetDirectorySizeResponseDirect(
-            builder, ret, ret ? nullptr : strerror(saved_errno), dsg.total(),
-            error);
+            builder, ret, ret ? nullptr : strerror(saved_errno), size, error);
 
     // Wrap response
     builder.Finish(v3::CreateResponse(
@@ -814,7 +1280,7 @@ static void signed_exec_output_cb(const char *line, bool error, void *userdata)
     int *fd_ptr = static_cast<int *>(userdata);
     // TODO: Send line
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<fb::String> line_id = builder.CreateString(line);
 
     // Create response
@@ -972,7 +1438,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     }
 
 done:
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<fb::String> error_msg_id = 0;
     fb::Offset<v3::SignedExecError> error;
 
@@ -997,7 +1463,7 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<fb::String> id;
     auto rom = Roms::get_current_rom();
     if (rom) {
@@ -1019,14 +1485,16 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
 
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
+
+    RomMetadataCache cache;
+    cache.load();
 
     std::vector<fb::Offset<v3::MbRom>> fb_roms;
 
-    for (auto r : roms.roms) {
+    for (auto r : roms->roms) {
         std::string system_path = r->full_system_path();
         std::string cache_path = r->full_cache_path();
         std::string data_path = r->full_data_path();
@@ -1038,28 +1506,13 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         fb::Offset<fb::String> fb_version;
         fb::Offset<fb::String> fb_build;
 
-        std::string build_prop;
-        if (r->system_is_image) {
-            build_prop += "/raw/images/";
-            build_prop += r->id;
-        } else {
-            build_prop += system_path;
-        }
-        build_prop += "/build.prop";
-
-        std::unordered_map<std::string, std::string> props;
-
-        RomConfig config;
-        config.load_file(r->config_path());
-        props.swap(config.cached_props);
-
-        util::property_file_get_all(build_prop, props);
+        auto metadata = cache.get(r);
 
-        if (auto it = props.find("ro.build.version.release"); it != props.end()) {
-            fb_version = builder.CreateString(it->second);
+        if (!metadata.version.empty()) {
+            fb_version = builder.CreateString(metadata.version);
         }
-        if (auto it = props.find("ro.build.display.id"); it != props.end()) {
-            fb_build = builder.CreateString(it->second);
+        if (!metadata.build.empty()) {
+            fb_build = builder.CreateString(metadata.build);
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1074,6 +1527,8 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         fb_roms.push_back(fb_rom);
     }
 
+    cache.save();
+
     // Create response
     auto response = v3::CreateMbGetInstalledRomsResponseDirect(
             builder, &fb_roms);
@@ -1090,7 +1545,7 @@ static bool v3_mb_get_version(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
 
     // Get version
     auto response = v3::CreateMbGetVersionResponseDirect(builder, version());
@@ -1102,25 +1557,251 @@ static bool v3_mb_get_version(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
-static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
+// Upper bounds (inclusive) of the request latency histogram buckets
+static constexpr std::array<uint64_t, 9> STATS_HISTOGRAM_BOUNDS_USEC{
+    1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000,
+};
+
+struct RequestTypeStats
 {
-    auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
-    if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
-    }
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_usec;
+    std::atomic<uint64_t> max_usec;
+    std::atomic<uint64_t> histogram[STATS_HISTOGRAM_BOUNDS_USEC.size() + 1];
+};
 
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::MbSetKernelError> error;
+// The counters are updated concurrently by every connection process
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Counters in shared memory must be lock-free");
 
-    bool ret = set_kernel(request->rom_id()->str(),
-                          request->boot_blockdev()->str());
+using RequestStatsTable =
+        std::array<RequestTypeStats, v3::RequestType_MAX + 1>;
 
-    if (!ret) {
+// Mapped in the daemon process before any connection processes are forked so
+// that the stats cover all connections. Null if stats are not enabled.
+static RequestStatsTable *request_stats = nullptr;
+static std::chrono::milliseconds slow_request_threshold{0};
+
+bool init_version_3_stats(std::chrono::milliseconds slow_threshold)
+{
+    slow_request_threshold = slow_threshold;
+
+    void *mem = mmap(nullptr, sizeof(RequestStatsTable),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        LOGW("Failed to map memory for request stats: %s", strerror(errno));
+        return false;
+    }
+
+    request_stats = new (mem) RequestStatsTable();
+    return true;
+}
+
+static bool v3_mb_get_stats(int fd, const v3::Request *msg)
+{
+    (void) msg;
+
+    auto &builder = v3_builder();
+
+    std::vector<fb::Offset<v3::MbRequestStats>> fb_stats;
+    std::vector<uint64_t> histogram;
+
+    if (request_stats) {
+        for (size_t i = 0; i < request_stats->size(); ++i) {
+            auto const &stats = (*request_stats)[i];
+
+            uint64_t count = stats.count.load(std::memory_order_relaxed);
+            if (count == 0) {
+                continue;
+            }
+
+            histogram.clear();
+            for (auto const &bucket : stats.histogram) {
+                histogram.push_back(bucket.load(std::memory_order_relaxed));
+            }
+
+            fb_stats.push_back(v3::CreateMbRequestStatsDirect(
+                    builder,
+                    v3::EnumNameRequestType(static_cast<v3::RequestType>(i)),
+                    count,
+                    stats.total_usec.load(std::memory_order_relaxed),
+                    stats.max_usec.load(std::memory_order_relaxed),
+                    &histogram));
+        }
+    }
+
+    std::vector<uint64_t> bounds(STATS_HISTOGRAM_BOUNDS_USEC.begin(),
+                                 STATS_HISTOGRAM_BOUNDS_USEC.end());
+
+    auto response = v3::CreateMbGetStatsResponseDirect(
+            builder, &bounds, &fb_stats,
+            static_cast<uint32_t>(slow_request_threshold.count()));
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_MbGetStatsResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(250);
+
+/*!
+ * \brief Check if the client asked to cancel the running request
+ *
+ * Reads every request that is already available on the connection without
+ * blocking and queues them in \a pending_requests.
+ *
+ * \return Whether an OperationCancelRequest was received or the connection was
+ *         lost
+ */
+static bool v3_poll_cancel(int fd)
+{
+    bool cancel = false;
+
+    while (true) {
+        // Requests that were already received do not wake up poll()
+        if (connection_reader->buffered() == 0) {
+            pollfd pfd{fd, POLLIN, 0};
+
+            int n = poll(&pfd, 1, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                LOGE("Failed to poll connection: %s", strerror(errno));
+                return true;
+            } else if (n == 0) {
+                break;
+            } else if (!(pfd.revents & POLLIN)) {
+                // Hung up or errored without any data left to read
+                return true;
+            }
+        }
+
+        std::vector<unsigned char> data;
+        if (auto ret = connection_reader->read_bytes_into(data); !ret) {
+            LOGE("Failed to read request: %s", ret.error().message().c_str());
+            return true;
+        }
+
+        // Invalid buffers are queued too and rejected when they are handled
+        auto verifier = fb::Verifier(data.data(), data.size());
+        if (v3::VerifyRequestBuffer(verifier)
+                && v3::GetRequest(data.data())->request_type()
+                        == v3::RequestType_OperationCancelRequest) {
+            cancel = true;
+        }
+
+        pending_requests.push_back(std::move(data));
+    }
+
+    return cancel;
+}
+
+/*!
+ * \brief Create a progress callback for a request with report_progress set
+ *
+ * The callback sends an OperationProgressResponse at most every
+ * PROGRESS_INTERVAL and returns false once the client cancels the request or
+ * the connection is lost. \a cancel_requested is set to true in that case.
+ *
+ * Progress messages would break the one-response-per-request rule of batches,
+ * so no callback is returned inside a batch.
+ */
+static OperationProgressFn v3_progress_cb(int fd, bool report_progress,
+                                          bool &cancel_requested)
+{
+    cancel_requested = false;
+
+    if (!report_progress || batch_responses) {
+        return nullptr;
+    }
+
+    return [fd, &cancel_requested, last = std::chrono::steady_clock::time_point()]
+            (const OperationProgress &progress) mutable {
+        if (cancel_requested) {
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last < PROGRESS_INTERVAL) {
+            return true;
+        }
+        last = now;
+
+        if (v3_poll_cancel(fd)) {
+            cancel_requested = true;
+            return false;
+        }
+
+        auto &builder = v3_builder();
+        auto response = v3::CreateOperationProgressResponseDirect(
+                builder, progress.files, progress.bytes, progress.path.c_str());
+
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_OperationProgressResponse,
+                response.Union()));
+
+        // Stop if the client is gone
+        if (!v3_send_response(fd, builder)) {
+            cancel_requested = true;
+            return false;
+        }
+
+        return true;
+    };
+}
+
+static bool v3_operation_cancel(int fd, const v3::Request *msg)
+{
+    (void) msg;
+
+    // OperationCancelRequests are read while the request they cancel is
+    // running, but are answered after it, like any other request
+    bool cancelled = operation_cancelled;
+    operation_cancelled = false;
+
+    auto &builder = v3_builder();
+    auto response = v3::CreateOperationCancelResponse(builder, cancelled);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_OperationCancelResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
+    if (!request->rom_id() || !request->boot_blockdev()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    bool cancel_requested;
+    auto progress_cb = v3_progress_cb(fd, request->report_progress(),
+                                      cancel_requested);
+
+    bool ret = set_kernel(request->rom_id()->str(),
+                          request->boot_blockdev()->str(),
+                          progress_cb);
+    bool cancelled = !ret && cancel_requested && errno == ECANCELED;
+    if (progress_cb) {
+        operation_cancelled = cancelled;
+    }
+
+    auto &builder = v3_builder();
+    fb::Offset<v3::MbSetKernelError> error;
+
+    if (!ret) {
         error = v3::CreateMbSetKernelError(builder);
     }
 
     // Create response
-    auto response = v3::CreateMbSetKernelResponse(builder, ret, error);
+    auto response = v3::CreateMbSetKernelResponse(
+            builder, ret, error, cancelled);
 
     // Wrap response
     builder.Finish(v3::CreateResponse(
@@ -1146,13 +1827,21 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
 
     bool force_update_checksums = request->force_update_checksums();
 
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::MbSwitchRomError> error;
+    bool cancel_requested;
+    auto progress_cb = v3_progress_cb(fd, request->report_progress(),
+                                      cancel_requested);
 
     SwitchRomResult ret = switch_rom(request->rom_id()->str(),
                                      request->boot_blockdev()->str(),
                                      block_dev_dirs,
-                                     force_update_checksums);
+                                     force_update_checksums,
+                                     progress_cb);
+    if (progress_cb) {
+        operation_cancelled = ret == SwitchRomResult::Cancelled;
+    }
+
+    auto &builder = v3_builder();
+    fb::Offset<v3::MbSwitchRomError> error;
 
     bool success = ret == SwitchRomResult::Succeeded;
     v3::MbSwitchRomResult fb_ret = v3::MbSwitchRomResult_FAILED;
@@ -1169,6 +1858,9 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
     case SwitchRomResult::ChecksumInvalid:
         fb_ret = v3::MbSwitchRomResult_CHECKSUM_INVALID;
         break;
+    case SwitchRomResult::Cancelled:
+        fb_ret = v3::MbSwitchRomResult_CANCELLED;
+        break;
     }
 
     if (!success) {
@@ -1194,10 +1886,9 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
     }
 
     // Find and verify ROM is installed
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    auto rom = roms.find_by_id(request->rom_id()->str());
+    auto rom = roms->find_by_id(request->rom_id()->str());
     if (!rom) {
         LOGE("Tried to wipe non-installed or invalid ROM ID: %s",
              request->rom_id()->c_str());
@@ -1211,9 +1902,33 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
+    bool background = request->background();
+
+    bool cancel_requested;
+    auto progress_cb = v3_progress_cb(fd, request->report_progress(),
+                                      cancel_requested);
+
+    // Targets report their own progress from zero, so keep a running total
+    // across all of them
+    OperationProgress completed;
+    OperationProgress current;
+    OperationProgressFn target_progress_cb;
+
+    if (progress_cb) {
+        target_progress_cb = [&](const OperationProgress &progress) {
+            current = progress;
+            return progress_cb({
+                completed.files + progress.files,
+                completed.bytes + progress.bytes,
+                progress.path,
+            });
+        };
+    }
+
     // Wipe the selected targets
     std::vector<int16_t> succeeded;
     std::vector<int16_t> failed;
+    bool cancelled = false;
 
     if (request->targets()) {
         std::string raw_system = get_raw_path("/system");
@@ -1225,16 +1940,23 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
         for (short target : *request->targets()) {
             bool success = false;
 
+            // The remaining targets are not attempted after a cancellation
+            if (cancel_requested) {
+                cancelled = true;
+                break;
+            }
+
             if (target == v3::MbWipeTarget_SYSTEM) {
-                success = wipe_system(rom);
+                success = wipe_system(rom, target_progress_cb, background);
             } else if (target == v3::MbWipeTarget_CACHE) {
-                success = wipe_cache(rom);
+                success = wipe_cache(rom, target_progress_cb, background);
             } else if (target == v3::MbWipeTarget_DATA) {
-                success = wipe_data(rom);
+                success = wipe_data(rom, target_progress_cb, background);
             } else if (target == v3::MbWipeTarget_DALVIK_CACHE) {
-                success = wipe_dalvik_cache(rom);
+                success = wipe_dalvik_cache(rom, target_progress_cb,
+                                            background);
             } else if (target == v3::MbWipeTarget_MULTIBOOT) {
-                success = wipe_multiboot(rom);
+                success = wipe_multiboot(rom, target_progress_cb, background);
             } else {
                 LOGE("Unknown wipe target %d", target);
             }
@@ -1243,15 +1965,28 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
                 succeeded.push_back(target);
             } else {
                 failed.push_back(target);
+                // The target was only partially wiped if it was cancelled
+                cancelled = cancel_requested;
             }
+
+            completed.files += current.files;
+            completed.bytes += current.bytes;
+            current = {};
         }
     }
 
-    fb::FlatBufferBuilder builder;
+    if (cancelled) {
+        LOGD("Wiping %s was cancelled", rom->id.c_str());
+    }
+    if (progress_cb) {
+        operation_cancelled = cancelled;
+    }
+
+    auto &builder = v3_builder();
 
     // Create response
     auto response = v3::CreateMbWipeRomResponseDirect(
-            builder, &succeeded, &failed);
+            builder, &succeeded, &failed, cancelled);
 
     // Wrap response
     builder.Finish(v3::CreateResponse(
@@ -1269,10 +2004,9 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
     }
 
     // Find and verify ROM is installed
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    auto rom = roms.find_by_id(request->rom_id()->str());
+    auto rom = roms->find_by_id(request->rom_id()->str());
     if (!rom) {
         return v3_send_response_invalid(fd);
     }
@@ -1280,14 +2014,15 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
     std::string packages_xml(rom->full_data_path());
     packages_xml += "/system/packages.xml";
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::MbGetPackagesCountError> error;
     unsigned int system_pkgs = 0;
     unsigned int update_pkgs = 0;
     unsigned int other_pkgs = 0;
 
     Packages pkgs;
-    bool ret = pkgs.load_xml(packages_xml);
+    bool ret = pkgs.load_cached(packages_xml,
+                                get_raw_path(PACKAGES_CACHE_DIR));
 
     if (ret) {
         for (std::shared_ptr<Package> pkg : pkgs.pkgs) {
@@ -1323,7 +2058,7 @@ static bool v3_reboot(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::RebootRequest *>(msg->request());
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::RebootError> error;
 
     std::string reboot_arg;
@@ -1367,7 +2102,7 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::ShutdownRequest *>(msg->request());
 
-    fb::FlatBufferBuilder builder;
+    auto &builder = v3_builder();
     fb::Offset<v3::ShutdownError> error;
 
     // The client probably won't get the chance to see the success message, but
@@ -1399,6 +2134,241 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
     return v3_send_response(fd, builder);
 }
 
+static constexpr auto EVENT_COALESCE_DELAY = std::chrono::milliseconds(250);
+
+struct EventWatch
+{
+    std::string path;
+    uint32_t mask;
+    // Only match events for this file name (if not null)
+    const char *name;
+    // Only match events for subdirectories
+    bool dirs_only;
+    v3::EventType type;
+    int wd;
+};
+
+static uint32_t v3_event_bit(v3::EventType type)
+{
+    return 1u << static_cast<unsigned int>(type);
+}
+
+static std::vector<EventWatch> v3_event_watches()
+{
+    std::vector<EventWatch> watches;
+
+    // ROMs are detected by the presence of their directories
+    for (auto const &dir : {
+        get_raw_path("/system/multiboot"),
+        get_raw_path("/cache/multiboot"),
+        get_raw_path("/data/multiboot"),
+        get_raw_path(MULTIBOOT_DIR),
+    }) {
+        watches.push_back({dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                | IN_MOVED_TO, nullptr, true, v3::EventType_ROMS_CHANGED, -1});
+    }
+
+    // Switching ROMs and setting kernels update the boot image checksums
+    watches.push_back({get_raw_path("/data/multiboot"), IN_CLOSE_WRITE
+            | IN_MOVED_TO, "checksums.prop", false,
+            v3::EventType_ROM_SWITCHED, -1});
+
+    watches.push_back({"/data/system", IN_CLOSE_WRITE | IN_MOVED_TO,
+            "packages.xml", false, v3::EventType_PACKAGES_CHANGED, -1});
+
+    return watches;
+}
+
+static bool v3_event_subscribe_send_error(int fd, int error_code)
+{
+    auto &builder = v3_builder();
+
+    auto error = v3::CreateEventSubscribeErrorDirect(
+            builder, error_code, strerror(error_code));
+
+    // Create response
+    auto response = v3::CreateEventSubscribeResponse(builder, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_EventSubscribeResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_event_notify(int fd, uint32_t events)
+{
+    auto &builder = v3_builder();
+
+    std::vector<int16_t> types;
+    for (int16_t type = v3::EventType_MIN; type <= v3::EventType_MAX; ++type) {
+        if (events & v3_event_bit(static_cast<v3::EventType>(type))) {
+            types.push_back(type);
+        }
+    }
+
+    // Create response
+    auto response = v3::CreateEventNotificationResponseDirect(builder, &types);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_EventNotificationResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_event_subscribe(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::EventSubscribeRequest *>(
+            msg->request());
+
+    uint32_t subscribed = 0;
+
+    if (request->events() && request->events()->size() > 0) {
+        for (auto type : *request->events()) {
+            if (type < v3::EventType_MIN || type > v3::EventType_MAX) {
+                return v3_send_response_invalid(fd);
+            }
+            subscribed |= v3_event_bit(static_cast<v3::EventType>(type));
+        }
+    } else {
+        subscribed = ~0u;
+    }
+
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd < 0) {
+        return v3_event_subscribe_send_error(fd, errno);
+    }
+
+    auto close_ifd = finally([&] {
+        close(ifd);
+    });
+
+    auto watches = v3_event_watches();
+    for (auto &w : watches) {
+        if (!(subscribed & v3_event_bit(w.type))) {
+            continue;
+        }
+
+        // Masks for the same directory are combined with IN_MASK_ADD, which
+        // returns the same watch descriptor
+        w.wd = inotify_add_watch(ifd, w.path.c_str(),
+                                 w.mask | IN_MASK_ADD | IN_ONLYDIR);
+        if (w.wd < 0 && errno != ENOENT) {
+            LOGW("%s: Failed to watch directory: %s",
+                 w.path.c_str(), strerror(errno));
+        }
+    }
+
+    {
+        auto &builder = v3_builder();
+
+        // Create response
+        auto response = v3::CreateEventSubscribeResponse(builder);
+
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_EventSubscribeResponse,
+                response.Union()));
+
+        if (!v3_send_response(fd, builder)) {
+            return false;
+        }
+    }
+
+    alignas(struct inotify_event) char buf[4096];
+    uint32_t pending = 0;
+    std::chrono::steady_clock::time_point deadline;
+
+    while (true) {
+        int timeout = -1;
+        if (pending) {
+            auto remaining = std::chrono::duration_cast<
+                    std::chrono::milliseconds>(
+                            deadline - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<decltype(remaining.count())>(
+                    remaining.count(), 0));
+        }
+
+        struct pollfd fds[2] = {
+            { fd, POLLIN, 0 },
+            { ifd, POLLIN, 0 },
+        };
+
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll for events: %s", strerror(errno));
+            return false;
+        }
+
+        // The subscription ends when the client sends anything or hangs up
+        if (fds[0].revents) {
+            return false;
+        }
+
+        uint32_t old_pending = pending;
+        ssize_t n;
+
+        while ((n = read(ifd, buf, sizeof(buf))) > 0) {
+            for (char *ptr = buf; ptr < buf + n;) {
+                auto *event = reinterpret_cast<struct inotify_event *>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    pending |= subscribed;
+                    continue;
+                }
+
+                for (auto &w : watches) {
+                    if (w.wd < 0 || w.wd != event->wd) {
+                        continue;
+                    }
+
+                    // The directory itself was removed
+                    if (event->mask & IN_IGNORED) {
+                        pending |= v3_event_bit(w.type);
+                        w.wd = -1;
+                        continue;
+                    }
+
+                    if (!(event->mask & w.mask)
+                            || (w.dirs_only && !(event->mask & IN_ISDIR))
+                            || (w.name && (event->len == 0
+                                    || strcmp(event->name, w.name) != 0))) {
+                        continue;
+                    }
+
+                    pending |= v3_event_bit(w.type);
+                }
+            }
+        }
+
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            LOGE("Failed to read inotify events: %s", strerror(errno));
+            return false;
+        }
+
+        // Wait a bit for more changes before notifying so that eg. installing
+        // a ROM results in one notification instead of several
+        if (!old_pending && pending) {
+            deadline = std::chrono::steady_clock::now() + EVENT_COALESCE_DELAY;
+        }
+
+        if (pending && std::chrono::steady_clock::now() >= deadline) {
+            if (!v3_event_notify(fd, pending)) {
+                return false;
+            }
+            pending = 0;
+        }
+    }
+}
+
+static bool v3_batch(int fd, const v3::Request *msg);
+
 typedef bool (*request_handler_fn)(int, const v3::Request *);
 
 struct RequestMap
@@ -1411,11 +2381,14 @@ static RequestMap request_map[] = {
     { v3::RequestType_FileChmodRequest, v3_file_chmod },
     { v3::RequestType_FileCloseRequest, v3_file_close },
     { v3::RequestType_FileOpenRequest, v3_file_open },
+    { v3::RequestType_FileOpenFdRequest, v3_file_open_fd },
     { v3::RequestType_FileReadRequest, v3_file_read },
     { v3::RequestType_FileSeekRequest, v3_file_seek },
     { v3::RequestType_FileSELinuxGetLabelRequest, v3_file_selinux_get_label },
     { v3::RequestType_FileSELinuxSetLabelRequest, v3_file_selinux_set_label },
     { v3::RequestType_FileStatRequest, v3_file_stat },
+    { v3::RequestType_FileStreamReadRequest, v3_file_stream_read },
+    { v3::RequestType_FileStreamWriteRequest, v3_file_stream_write },
     { v3::RequestType_FileWriteRequest, v3_file_write },
     { v3::RequestType_PathChmodRequest, v3_path_chmod },
     { v3::RequestType_PathCopyRequest, v3_path_copy },
@@ -1433,11 +2406,296 @@ static RequestMap request_map[] = {
     { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom },
     { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom },
     { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count },
+    { v3::RequestType_MbGetStatsRequest, v3_mb_get_stats },
     { v3::RequestType_RebootRequest, v3_reboot },
     { v3::RequestType_ShutdownRequest, v3_shutdown },
-    { v3::RequestType_NONE, nullptr }
+    { v3::RequestType_BatchRequest, v3_batch },
+    { v3::RequestType_EventSubscribeRequest, v3_event_subscribe },
+    { v3::RequestType_OperationCancelRequest, v3_operation_cancel },
 };
 
+using RequestHandlerTable =
+        std::array<request_handler_fn, v3::RequestType_MAX + 1>;
+
+static const RequestHandlerTable request_handlers = []{
+    RequestHandlerTable handlers{};
+    for (auto const &item : request_map) {
+        handlers[static_cast<size_t>(item.type)] = item.fn;
+    }
+    return handlers;
+}();
+
+static const char * v3_string_param(const fb::String *str)
+{
+    return str ? str->c_str() : "(null)";
+}
+
+template<typename T>
+static std::string v3_describe_id(const void *r)
+{
+    return format("id=%d", static_cast<const T *>(r)->id());
+}
+
+template<typename T>
+static std::string v3_describe_path(const void *r)
+{
+    return format("path=%s",
+                  v3_string_param(static_cast<const T *>(r)->path()));
+}
+
+template<typename T>
+static std::string v3_describe_rom_id(const void *r)
+{
+    return format("rom_id=%s",
+                  v3_string_param(static_cast<const T *>(r)->rom_id()));
+}
+
+/*!
+ * \brief Get the parameters that identify what a request operates on
+ *
+ * This is used for logging slow requests, so file contents and arguments are
+ * never included.
+ */
+static std::string v3_describe_request(const v3::Request *msg)
+{
+    auto const *r = msg->request();
+
+    switch (msg->request_type()) {
+    case v3::RequestType_FileChmodRequest:
+        return v3_describe_id<v3::FileChmodRequest>(r);
+    case v3::RequestType_FileCloseRequest:
+        return v3_describe_id<v3::FileCloseRequest>(r);
+    case v3::RequestType_FileOpenRequest:
+        return v3_describe_path<v3::FileOpenRequest>(r);
+    case v3::RequestType_FileOpenFdRequest:
+        return v3_describe_path<v3::FileOpenFdRequest>(r);
+    case v3::RequestType_FileReadRequest: {
+        auto const *req = static_cast<const v3::FileReadRequest *>(r);
+        return format("id=%d, count=%" PRIu64, req->id(), req->count());
+    }
+    case v3::RequestType_FileSeekRequest:
+        return v3_describe_id<v3::FileSeekRequest>(r);
+    case v3::RequestType_FileSELinuxGetLabelRequest:
+        return v3_describe_id<v3::FileSELinuxGetLabelRequest>(r);
+    case v3::RequestType_FileSELinuxSetLabelRequest:
+        return v3_describe_id<v3::FileSELinuxSetLabelRequest>(r);
+    case v3::RequestType_FileStatRequest:
+        return v3_describe_id<v3::FileStatRequest>(r);
+    case v3::RequestType_FileStreamReadRequest: {
+        auto const *req = static_cast<const v3::FileStreamReadRequest *>(r);
+        return format("id=%d, count=%" PRIu64, req->id(), req->count());
+    }
+    case v3::RequestType_FileStreamWriteRequest:
+        return v3_describe_id<v3::FileStreamWriteRequest>(r);
+    case v3::RequestType_FileWriteRequest: {
+        auto const *req = static_cast<const v3::FileWriteRequest *>(r);
+        return format("id=%d, size=%u", req->id(),
+                      req->data() ? req->data()->size() : 0u);
+    }
+    case v3::RequestType_PathChmodRequest:
+        return v3_describe_path<v3::PathChmodRequest>(r);
+    case v3::RequestType_PathCopyRequest: {
+        auto const *req = static_cast<const v3::PathCopyRequest *>(r);
+        return format("source=%s, target=%s", v3_string_param(req->source()),
+                      v3_string_param(req->target()));
+    }
+    case v3::RequestType_PathDeleteRequest:
+        return v3_describe_path<v3::PathDeleteRequest>(r);
+    case v3::RequestType_PathMkdirRequest:
+        return v3_describe_path<v3::PathMkdirRequest>(r);
+    case v3::RequestType_PathReadlinkRequest:
+        return v3_describe_path<v3::PathReadlinkRequest>(r);
+    case v3::RequestType_PathSELinuxGetLabelRequest:
+        return v3_describe_path<v3::PathSELinuxGetLabelRequest>(r);
+    case v3::RequestType_PathSELinuxSetLabelRequest:
+        return v3_describe_path<v3::PathSELinuxSetLabelRequest>(r);
+    case v3::RequestType_PathGetDirectorySizeRequest:
+        return v3_describe_path<v3::PathGetDirectorySizeRequest>(r);
+    case v3::RequestType_SignedExecRequest:
+        return format("binary_path=%s", v3_string_param(
+                static_cast<const v3::SignedExecRequest *>(r)->binary_path()));
+    case v3::RequestType_MbGetPackagesCountRequest:
+        return v3_describe_rom_id<v3::MbGetPackagesCountRequest>(r);
+    case v3::RequestType_MbSetKernelRequest:
+        return v3_describe_rom_id<v3::MbSetKernelRequest>(r);
+    case v3::RequestType_MbSwitchRomRequest:
+        return v3_describe_rom_id<v3::MbSwitchRomRequest>(r);
+    case v3::RequestType_MbWipeRomRequest:
+        return v3_describe_rom_id<v3::MbWipeRomRequest>(r);
+    case v3::RequestType_BatchRequest: {
+        auto const *req = static_cast<const v3::BatchRequest *>(r);
+        return format("requests=%u",
+                      req->requests() ? req->requests()->size() : 0u);
+    }
+    default:
+        return {};
+    }
+}
+
+static void v3_record_request(const v3::Request *request,
+                              std::chrono::steady_clock::duration duration)
+{
+    using namespace std::chrono;
+
+    auto type = request->request_type();
+    auto usec = static_cast<uint64_t>(
+            duration_cast<microseconds>(duration).count());
+
+    if (request_stats) {
+        auto &stats = (*request_stats)[static_cast<size_t>(type)];
+
+        stats.count.fetch_add(1, std::memory_order_relaxed);
+        stats.total_usec.fetch_add(usec, std::memory_order_relaxed);
+
+        uint64_t max = stats.max_usec.load(std::memory_order_relaxed);
+        while (max < usec && !stats.max_usec.compare_exchange_weak(
+                max, usec, std::memory_order_relaxed)) {
+            // max was updated with the current value; try again
+        }
+
+        auto it = std::lower_bound(STATS_HISTOGRAM_BOUNDS_USEC.begin(),
+                                   STATS_HISTOGRAM_BOUNDS_USEC.end(), usec);
+        auto bucket = static_cast<size_t>(
+                it - STATS_HISTOGRAM_BOUNDS_USEC.begin());
+        stats.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (slow_request_threshold.count() > 0
+            && duration > slow_request_threshold) {
+        auto params = v3_describe_request(request);
+        LOGW("Slow request: %s%s%s%s took %" PRIu64 "ms",
+             v3::EnumNameRequestType(type),
+             params.empty() ? "" : " (", params.c_str(),
+             params.empty() ? "" : ")",
+             static_cast<uint64_t>(
+                     duration_cast<milliseconds>(duration).count()));
+    }
+}
+
+static bool v3_dispatch(int fd, const v3::Request *request)
+{
+    auto type = static_cast<size_t>(request->request_type());
+    request_handler_fn fn = type < request_handlers.size()
+            ? request_handlers[type] : nullptr;
+
+    if (fn) {
+        auto start = std::chrono::steady_clock::now();
+        bool ret = fn(fd, request);
+
+        // A false return value means that the connection was lost, which is
+        // also how event subscriptions end, so only completed requests count
+        if (ret) {
+            v3_record_request(request, std::chrono::steady_clock::now() - start);
+        }
+
+        return ret;
+    } else {
+        // Invalid command; allow further commands
+        return v3_send_response_unsupported(fd);
+    }
+}
+
+/*
+ * Requests that write to the socket outside of their single response can't be
+ * part of a batch
+ */
+static bool v3_is_batchable(v3::RequestType type)
+{
+    switch (type) {
+    case v3::RequestType_BatchRequest:
+    case v3::RequestType_EventSubscribeRequest:
+    case v3::RequestType_FileOpenFdRequest:
+    case v3::RequestType_FileStreamReadRequest:
+    case v3::RequestType_FileStreamWriteRequest:
+    case v3::RequestType_SignedExecRequest:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static bool v3_batch(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::BatchRequest *>(msg->request());
+    if (!request->requests()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    std::vector<std::vector<unsigned char>> responses;
+    std::vector<unsigned char> buf;
+
+    batch_responses = &responses;
+    auto end_batch = finally([&]{
+        batch_responses = nullptr;
+    });
+
+    for (auto const *item : *request->requests()) {
+        size_t n_responses = responses.size();
+        bool ret;
+
+        // Copy the nested buffer so it is properly aligned
+        if (item->data()) {
+            auto data = item->data();
+            buf.assign(data->Data(), data->Data() + data->size());
+        } else {
+            buf.clear();
+        }
+
+        auto verifier = fb::Verifier(buf.data(), buf.size());
+        if (buf.empty() || !v3::VerifyRequestBuffer(verifier)) {
+            ret = v3_send_response_invalid(fd);
+        } else {
+            auto sub_request = v3::GetRequest(buf.data());
+            if (v3_is_batchable(sub_request->request_type())) {
+                ret = v3_dispatch(fd, sub_request);
+            } else {
+                ret = v3_send_response_invalid(fd);
+            }
+        }
+
+        if (!ret) {
+            return false;
+        } else if (responses.size() != n_responses + 1) {
+            LOGE("Batched request produced %zu responses",
+                 responses.size() - n_responses);
+            return false;
+        }
+    }
+
+    batch_responses = nullptr;
+
+    auto &builder = v3_builder();
+    std::vector<fb::Offset<v3::BatchResponseItem>> items;
+    items.reserve(responses.size());
+
+    for (auto const &response : responses) {
+        items.push_back(v3::CreateBatchResponseItemDirect(builder, &response));
+    }
+
+    auto response = v3::CreateBatchResponseDirect(builder, &items);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_BatchResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static util::SchedPolicy to_util_sched_policy(v3::SchedPolicy policy)
+{
+    switch (policy) {
+    case v3::SchedPolicy_BACKGROUND:
+        return util::SchedPolicy::Background;
+    case v3::SchedPolicy_IDLE:
+        return util::SchedPolicy::Idle;
+    case v3::SchedPolicy_INTERACTIVE:
+        return util::SchedPolicy::Interactive;
+    case v3::SchedPolicy_DEFAULT:
+    default:
+        return util::SchedPolicy::Default;
+    }
+}
+
 bool connection_version_3(int fd)
 {
     std::string command;
@@ -1448,44 +2706,54 @@ bool connection_version_3(int fd)
             close(p.second);
         }
         fd_map.clear();
+
+        response_builder.reset();
+        pending_requests.clear();
+        connection_reader.reset();
+        memfd_allowed = false;
     });
 
+    connection_reader.emplace(fd);
+
+    // Reused for every request, like the response builder
+    std::vector<unsigned char> data;
+
+    // Requests are handled strictly in order and each one is answered before
+    // the next one is read, so clients may pipeline requests without waiting
+    // for the replies as long as they read the responses in the same order.
     while (1) {
-        auto data = util::socket_read_bytes(fd);
-        if (!data) {
-            LOGE("Failed to read request: %s",  data.error().message().c_str());
+        if (data.capacity() > BUILDER_MAX_RETAINED_SIZE) {
+            std::vector<unsigned char>().swap(data);
+        }
+
+        if (!pending_requests.empty()) {
+            data = std::move(pending_requests.front());
+            pending_requests.pop_front();
+        } else if (auto ret = connection_reader->read_bytes_into(data); !ret) {
+            LOGE("Failed to read request: %s",  ret.error().message().c_str());
             return false;
         }
 
-        auto verifier = fb::Verifier(data.value().data(), data.value().size());
+        auto verifier = fb::Verifier(data.data(), data.size());
         if (!v3::VerifyRequestBuffer(verifier)) {
             LOGE("Received invalid buffer");
             return false;
         }
 
-        const v3::Request *request = v3::GetRequest(data.value().data());
-        v3::RequestType type = request->request_type();
-        request_handler_fn fn = nullptr;
+        const v3::Request *request = v3::GetRequest(data.data());
 
-        for (auto iter = request_map; iter->fn; ++iter) {
-            if (type == iter->type) {
-                fn = iter->fn;
-                break;
-            }
-        }
+        // Requests inside a batch can't opt in themselves because their
+        // responses are always embedded in the BatchResponse
+        memfd_allowed = request->allow_memfd();
+
+        // The policy covers the whole request, including the requests inside
+        // a batch and any child processes spawned by SignedExecRequest
+        util::ScopedSchedPolicy sched_policy(
+                to_util_sched_policy(request->sched_policy()));
 
         // NOTE: A false return value indicates a connection error, not a
         //       command failure!
-        bool ret = true;
-
-        if (fn) {
-            ret = fn(fd, request);
-        } else {
-            // Invalid command; allow further commands
-            ret = v3_send_response_unsupported(fd);
-        }
-
-        if (!ret) {
+        if (!v3_dispatch(fd, request)) {
             return false;
         }
     }
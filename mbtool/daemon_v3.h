@@ -19,9 +19,13 @@
 
 #pragma once
 
+#include <chrono>
+
 namespace mb
 {
 
+bool init_version_3_stats(std::chrono::milliseconds slow_threshold);
+
 bool connection_version_3(int fd);
 
 }
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directory_size.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/thread_pool.h"
+
+namespace mb
+{
+
+// Directory traversal is bound by storage latency rather than CPU, so a few
+// threads are enough to keep the I/O queue busy
+static constexpr unsigned int MAX_WORKERS = 4;
+
+static constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(250);
+
+/*!
+ * Computes the total size of the regular files in a directory tree.
+ *
+ * Directories are pulled from a shared work queue by a few tasks on the global
+ * thread pool, each of which reads one directory at a time and pushes the
+ * subdirectories it finds back onto the queue. Like the FTS walk it replaces,
+ * this does not follow symlinks, does not cross mountpoint boundaries, counts
+ * hard links only once, and keeps going after errors.
+ */
+class DirectorySizeWalker
+{
+public:
+    DirectorySizeWalker(const std::vector<std::string> &exclusions, dev_t dev)
+        : _exclusions(exclusions)
+        , _dev(dev)
+        , _pending(0)
+        , _cancelled(false)
+        , _error(0)
+        , _total(0)
+    {
+    }
+
+    bool run(const std::string &path, uint64_t &size,
+             const DirectorySizeProgressFn &progress_cb)
+    {
+        _queue.emplace_back(path, 0);
+        _pending = 1;
+
+        unsigned int n_workers = std::clamp(
+                std::thread::hardware_concurrency(), 1u, MAX_WORKERS);
+        TaskGroup group(ThreadPool::global());
+
+        for (unsigned int i = 0; i < n_workers; ++i) {
+            group.run([this] { worker(); });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            uint64_t reported = 0;
+
+            while (!_cv.wait_for(lock, PROGRESS_INTERVAL,
+                                 [&] { return _pending == 0; })) {
+                uint64_t current = _total;
+                if (!progress_cb || _cancelled || current == reported) {
+                    continue;
+                }
+
+                // Don't block the workers while the callback runs
+                lock.unlock();
+                bool keep_going = progress_cb(current);
+                lock.lock();
+
+                reported = current;
+
+                if (!keep_going) {
+                    _cancelled = true;
+                    _pending -= _queue.size();
+                    _queue.clear();
+                    _cv.notify_all();
+                }
+            }
+        }
+
+        group.wait();
+
+        size = _total;
+
+        if (_cancelled) {
+            errno = ECANCELED;
+            return false;
+        } else if (_error != 0) {
+            errno = _error;
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] { return !_queue.empty() || _pending == 0; });
+            if (_queue.empty()) {
+                break;
+            }
+
+            auto [path, depth] = std::move(_queue.back());
+            _queue.pop_back();
+
+            lock.unlock();
+
+            std::vector<std::string> subdirs;
+            int error = scan_directory(path, depth, subdirs);
+
+            lock.lock();
+
+            if (error != 0 && _error == 0) {
+                _error = error;
+            }
+            if (!_cancelled) {
+                for (auto &subdir : subdirs) {
+                    _queue.emplace_back(std::move(subdir), depth + 1);
+                }
+                _pending += subdirs.size();
+            }
+            --_pending;
+
+            if (!subdirs.empty() || _pending == 0) {
+                _cv.notify_all();
+            }
+        }
+    }
+
+    // Returns 0 or the first errno value encountered
+    int scan_directory(const std::string &path, int depth,
+                       std::vector<std::string> &subdirs)
+    {
+        int dfd = open(path.c_str(),
+                       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dfd < 0) {
+            return errno;
+        }
+
+        DIR *dp = fdopendir(dfd);
+        if (!dp) {
+            int saved_errno = errno;
+            close(dfd);
+            return saved_errno;
+        }
+
+        auto close_dp = finally([&] {
+            closedir(dp);
+        });
+
+        std::string prefix = path;
+        if (prefix.empty() || prefix.back() != '/') {
+            prefix += '/';
+        }
+
+        int error = 0;
+        uint64_t size = 0;
+        struct dirent *ent;
+        struct stat sb;
+
+        while ((errno = 0, ent = readdir(dp))) {
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            // Exclude first-level directories
+            if (depth == 0 && std::find(_exclusions.begin(), _exclusions.end(),
+                    ent->d_name) != _exclusions.end()) {
+                continue;
+            }
+
+            if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                // Files deleted during the walk aren't an error
+                if (errno != ENOENT && error == 0) {
+                    error = errno;
+                }
+                continue;
+            }
+
+            if (S_ISDIR(sb.st_mode)) {
+                if (sb.st_dev == _dev) {
+                    subdirs.push_back(prefix + ent->d_name);
+                }
+            } else if (S_ISREG(sb.st_mode) && visit_inode(sb)) {
+                size += static_cast<uint64_t>(sb.st_size);
+            }
+        }
+
+        if (errno != 0 && error == 0) {
+            error = errno;
+        }
+
+        _total += size;
+
+        return error;
+    }
+
+    // Returns false if the file is a hard link that was already counted
+    bool visit_inode(const struct stat &sb)
+    {
+        if (sb.st_nlink <= 1) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(_links_mutex);
+        return _links[static_cast<dev_t>(sb.st_dev)]
+                .emplace(static_cast<ino_t>(sb.st_ino)).second;
+    }
+
+    const std::vector<std::string> &_exclusions;
+    dev_t _dev;
+
+    // Protects the work queue and everything below it
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::pair<std::string, int>> _queue;
+    // Number of directories that are queued or being scanned
+    size_t _pending;
+    bool _cancelled;
+    int _error;
+
+    std::mutex _links_mutex;
+    std::unordered_map<dev_t, std::unordered_set<ino_t>> _links;
+
+    std::atomic<uint64_t> _total;
+};
+
+/*!
+ * \brief Recursively get the total size of the regular files under a path
+ *
+ * \param path Path to directory
+ * \param exclusions Top-level directories to exclude
+ * \param[out] size Total size in bytes. This is set even if the function fails
+ *                  and contains the sizes of the files that could be read.
+ * \param progress_cb Optional callback for receiving the running total
+ *
+ * \return Whether the whole tree was read. If false, errno is set to the first
+ *         error encountered or ECANCELED if \p progress_cb returned false.
+ */
+bool get_directory_size(const std::string &path,
+                        const std::vector<std::string> &exclusions,
+                        uint64_t &size,
+                        const DirectorySizeProgressFn &progress_cb)
+{
+    struct stat sb;
+
+    size = 0;
+
+    if (lstat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        if (S_ISREG(sb.st_mode)) {
+            size = static_cast<uint64_t>(sb.st_size);
+        }
+        return true;
+    }
+
+    DirectorySizeWalker walker(exclusions, static_cast<dev_t>(sb.st_dev));
+    return walker.run(path, size, progress_cb);
+}
+
+}
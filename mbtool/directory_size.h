@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace mb
+{
+
+/*!
+ * Called periodically with the number of bytes counted so far. Return false to
+ * cancel the calculation.
+ */
+using DirectorySizeProgressFn = std::function<bool(uint64_t size)>;
+
+bool get_directory_size(const std::string &path,
+                        const std::vector<std::string> &exclusions,
+                        uint64_t &size,
+                        const DirectorySizeProgressFn &progress_cb = nullptr);
+
+}
@@ -20,6 +20,7 @@
 #include "emergency.h"
 
 #include <algorithm>
+#include <thread>
 
 #include <cerrno>
 #include <cstring>
@@ -37,6 +38,7 @@
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/mount.h"
+#include "mbutil/path.h"
 #include "mbutil/time.h"
 #include "mbutil/vibrate.h"
 
@@ -94,7 +96,7 @@ private:
     std::vector<std::string> _results;
 };
 
-static oc::result<void> dump_kernel_log(const char *file)
+static oc::result<std::vector<char>> read_kernel_log()
 {
     int len = klogctl(KLOG_SIZE_BUFFER, nullptr, 0);
     if (len < 0) {
@@ -108,6 +110,14 @@ static oc::result<void> dump_kernel_log(const char *file)
         return ec_from_errno();
     }
 
+    buf.resize(static_cast<size_t>(len));
+
+    return std::move(buf);
+}
+
+static oc::result<void> dump_kernel_log(const char *file,
+                                        const std::vector<char> &buf)
+{
     ScopedFILE fp(fopen(file, "wb"), fclose);
     if (!fp) {
         return ec_from_errno();
@@ -120,17 +130,21 @@ static oc::result<void> dump_kernel_log(const char *file)
         return ec_from_errno();
     }
 
-    if (len > 0) {
-        if (fwrite(buf.data(), static_cast<size_t>(len), 1, fp.get()) != 1) {
+    if (!buf.empty()) {
+        if (fwrite(buf.data(), buf.size(), 1, fp.get()) != 1) {
             return ec_from_errno();
         }
-        if (buf[static_cast<size_t>(len - 1)] != '\n') {
+        if (buf.back() != '\n') {
             if (fputc('\n', fp.get()) == EOF) {
                 return ec_from_errno();
             }
         }
     }
 
+    if (fclose(fp.release()) != 0) {
+        return ec_from_errno();
+    }
+
     return oc::success();
 }
 
@@ -138,21 +152,93 @@ struct EmergencyMount
 {
     std::string mount_point;
     std::string log_path;
+    std::vector<std::string> names;
     std::vector<std::string> paths;
 };
 
+static void mount_emergency_partition(const EmergencyMount &em)
+{
+    if (auto r = util::mkdir_recursive(em.mount_point, 0755);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create directory: %s",
+             em.mount_point.c_str(), r.error().message().c_str());
+    }
+
+    if (!util::is_mounted(em.mount_point)) {
+        for (const std::string &path : em.paths) {
+            if (auto ret = util::mount(path, em.mount_point, "auto", 0, "")) {
+                LOGV("%s: Mounted %s",
+                     em.mount_point.c_str(), path.c_str());
+                break;
+            } else {
+                LOGW("%s: Failed to mount %s: %s",
+                     em.mount_point.c_str(), path.c_str(),
+                     ret.error().message().c_str());
+            }
+        }
+    }
+}
+
+static void dump_emergency_log(const EmergencyMount &em,
+                               const std::vector<char> &klog)
+{
+    std::string log_path(em.mount_point);
+    log_path += "/";
+    log_path += em.log_path;
+    std::string log_path_old(log_path);
+    log_path_old += ".old";
+
+    if (auto r = util::mkdir_parent(log_path, 0755);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create parent directory: %s",
+             log_path.c_str(), strerror(errno));
+    }
+
+    LOGI("Dumping kernel log to %s", log_path.c_str());
+
+    rename(log_path.c_str(), log_path_old.c_str());
+    if (auto ret = dump_kernel_log(log_path.c_str(), klog); !ret) {
+        LOGW("Failed to dump kernel log: %s",
+             ret.error().message().c_str());
+    }
+}
+
+/*!
+ * \brief Run a function for every partition concurrently
+ *
+ * Mounting, writing, and unmounting each wait on a different block device, so
+ * there's no reason for the partitions to wait on each other.
+ */
+template<typename Fn>
+static void for_each_partition(const std::vector<EmergencyMount> &ems, Fn fn)
+{
+    std::vector<std::thread> threads;
+
+    for (auto const &em : ems) {
+        threads.emplace_back(fn, std::cref(em));
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
 bool emergency_reboot()
 {
     using namespace std::chrono_literals;
 
-    (void) util::vibrate(100ms, 250ms);
-    (void) util::vibrate(100ms, 250ms);
-    (void) util::vibrate(100ms, 250ms);
-    (void) util::vibrate(100ms, 250ms);
-    (void) util::vibrate(100ms, 250ms);
-
     LOGW("--- EMERGENCY REBOOT FROM MBTOOL ---");
 
+    // The vibration pattern alone takes almost 2 seconds, so let it play while
+    // the logs are saved
+    std::thread vibrate_thread([] {
+        (void) util::vibrate(100ms, 250ms);
+        (void) util::vibrate(100ms, 250ms);
+        (void) util::vibrate(100ms, 250ms);
+        (void) util::vibrate(100ms, 250ms);
+        (void) util::vibrate(100ms, 250ms);
+    });
+
     std::vector<EmergencyMount> ems;
     Device device;
     JsonError error;
@@ -170,26 +256,12 @@ bool emergency_reboot()
     // /data
     {
         EmergencyMount em;
-        BlockDevFinder finder("/dev/block", {
-            "data", "DATA", "userdata", "USERDATA", "UDA"
-        });
-
         em.mount_point = "/raw/data";
         em.log_path = "media/0/MultiBoot/logs/kmsg.log";
-
-        LOGV("Searching for data partition block device paths");
+        em.names = { "data", "DATA", "userdata", "USERDATA", "UDA" };
 
         if (loaded_json) {
-            for (auto const &path : device.data_block_devs()) {
-                LOGV("- %s", path.c_str());
-                em.paths.push_back(path);
-            }
-        }
-
-        finder.run();
-        for (auto const &path : finder.results()) {
-            LOGV("- %s", path.c_str());
-            em.paths.push_back(path);
+            em.paths = device.data_block_devs();
         }
 
         ems.push_back(std::move(em));
@@ -198,78 +270,69 @@ bool emergency_reboot()
     // /cache
     {
         EmergencyMount em;
-        BlockDevFinder finder("/dev/block", {
-            "cache", "CACHE", "CAC"
-        });
-
         em.mount_point = "/raw/cache";
         em.log_path = "multiboot/logs/kmsg.log";
-
-        LOGV("Searching for cache partition block device paths");
+        em.names = { "cache", "CACHE", "CAC" };
 
         if (loaded_json) {
-            for (auto const &path : device.cache_block_devs()) {
-                LOGV("- %s", path.c_str());
-                em.paths.push_back(path);
-            }
-        }
-
-        finder.run();
-        for (auto const &path : finder.results()) {
-            LOGV("- %s", path.c_str());
-            em.paths.push_back(path);
+            em.paths = device.cache_block_devs();
         }
 
         ems.push_back(std::move(em));
     }
 
-    for (auto const &em : ems) {
-        if (auto r = util::mkdir_recursive(em.mount_point, 0755);
-                !r && r.error() != std::errc::file_exists) {
-            LOGW("%s: Failed to create directory: %s",
-                 em.mount_point.c_str(), r.error().message().c_str());
+    // Walk /dev/block once for all of the partitions
+    {
+        std::vector<std::string> all_names;
+        for (auto const &em : ems) {
+            all_names.insert(all_names.end(),
+                             em.names.begin(), em.names.end());
         }
 
-        if (!util::is_mounted(em.mount_point)) {
-            for (const std::string &path : em.paths) {
-                if (auto ret = util::mount(path, em.mount_point, "auto", 0, "")) {
-                    LOGV("%s: Mounted %s",
-                         em.mount_point.c_str(), path.c_str());
-                    break;
-                } else {
-                    LOGW("%s: Failed to mount %s: %s",
-                         em.mount_point.c_str(), path.c_str(),
-                         ret.error().message().c_str());
+        BlockDevFinder finder("/dev/block", std::move(all_names));
+        finder.run();
+
+        for (auto &em : ems) {
+            for (auto const &path : finder.results()) {
+                if (std::find(em.names.begin(), em.names.end(),
+                              util::base_name(path)) != em.names.end()) {
+                    em.paths.push_back(path);
                 }
             }
+
+            LOGV("Block device paths for %s:", em.mount_point.c_str());
+            for (auto const &path : em.paths) {
+                LOGV("- %s", path.c_str());
+            }
         }
+    }
 
-        std::string log_path(em.mount_point);
-        log_path += "/";
-        log_path += em.log_path;
-        std::string log_path_old(log_path);
-        log_path_old += ".old";
+    for_each_partition(ems, &mount_emergency_partition);
 
-        if (auto r = util::mkdir_parent(log_path, 0755);
-                !r && r.error() != std::errc::file_exists) {
-            LOGW("%s: Failed to create parent directory: %s",
-                 log_path.c_str(), strerror(errno));
-        }
+    // Read the log once everything is mounted so that it includes the mount
+    // errors, if any
+    std::vector<char> klog;
+    bool have_klog = false;
 
-        LOGI("Dumping kernel log to %s", log_path.c_str());
+    if (auto r = read_kernel_log()) {
+        klog = std::move(r.value());
+        have_klog = true;
+    } else {
+        LOGW("Failed to read kernel log: %s", r.error().message().c_str());
+    }
 
-        rename(log_path.c_str(), log_path_old.c_str());
-        if (auto ret = dump_kernel_log(log_path.c_str()); !ret) {
-            LOGW("Failed to dump kernel log: %s",
-                 ret.error().message().c_str());
+    for_each_partition(ems, [&](const EmergencyMount &em) {
+        if (have_klog) {
+            dump_emergency_log(em, klog);
         }
-        sync();
 
         (void) util::umount(em.mount_point);
-    }
+    });
 
     fix_multiboot_permissions();
 
+    vibrate_thread.join();
+
     // Does not return if successful
     reboot_directly("recovery");
 
@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_contexts.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "mblog/logging.h"
+#include "mbutil/file.h"
+
+#define LOG_TAG "mbtool/file_contexts"
+
+// See misc/file-contexts-tool/compile.c for a description of the format
+#define FCONTEXT_MAGIC                  0xf97cff8a
+#define FCONTEXT_VERS_PCRE              2
+#define FCONTEXT_VERS_MODE              3
+#define FCONTEXT_VERS_PREFIX_LEN        4
+#define FCONTEXT_VERS_MAX               FCONTEXT_VERS_PREFIX_LEN
+
+namespace mb
+{
+
+struct FileContextsReader
+{
+    const unsigned char *cur;
+    const unsigned char *end;
+
+    bool read_u32(uint32_t &value)
+    {
+        if (static_cast<size_t>(end - cur) < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, cur, sizeof(value));
+        cur += sizeof(value);
+        return true;
+    }
+
+    bool read_bytes(size_t size, std::string &out)
+    {
+        if (static_cast<size_t>(end - cur) < size) {
+            return false;
+        }
+        out.assign(reinterpret_cast<const char *>(cur), size);
+        cur += size;
+        return true;
+    }
+
+    // Reads a length-prefixed string that includes the NULL terminator
+    bool read_cstring(std::string &out)
+    {
+        uint32_t size;
+        if (!read_u32(size) || size == 0 || !read_bytes(size, out)
+                || out.back() != '\0') {
+            return false;
+        }
+        out.pop_back();
+        return true;
+    }
+
+    // Reads a length-prefixed blob, keeping the length field in \p out
+    bool append_blob(std::string &out)
+    {
+        const unsigned char *start = cur;
+        uint32_t size;
+        if (!read_u32(size) || static_cast<size_t>(end - cur) < size) {
+            return false;
+        }
+        cur += size;
+        out.append(reinterpret_cast<const char *>(start),
+                   static_cast<size_t>(cur - start));
+        return true;
+    }
+};
+
+static void append_u32(std::string &out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void append_cstring(std::string &out, const std::string &str)
+{
+    append_u32(out, static_cast<uint32_t>(str.size() + 1));
+    out.append(str.c_str(), str.size() + 1);
+}
+
+/*!
+ * \brief Check if a PCRE version string belongs to PCRE2 (10.x and newer)
+ */
+static bool is_pcre2_version(const std::string &version)
+{
+    return strtoul(version.c_str(), nullptr, 10) >= 10;
+}
+
+bool CompiledFileContexts::load(const void *data, size_t size)
+{
+    FileContextsReader reader{
+        static_cast<const unsigned char *>(data),
+        static_cast<const unsigned char *>(data) + size,
+    };
+    uint32_t magic;
+    uint32_t count;
+
+    _regex_version.clear();
+    _pcre2 = false;
+    _stems.clear();
+    _specs.clear();
+
+    if (!reader.read_u32(magic) || magic != FCONTEXT_MAGIC) {
+        LOGE("Invalid magic field");
+        return false;
+    }
+
+    if (!reader.read_u32(_version) || _version > FCONTEXT_VERS_MAX) {
+        LOGE("Invalid version field");
+        return false;
+    }
+
+    if (_version >= FCONTEXT_VERS_PCRE) {
+        uint32_t len;
+        if (!reader.read_u32(len) || !reader.read_bytes(len, _regex_version)) {
+            LOGE("Invalid PCRE version field");
+            return false;
+        }
+        _pcre2 = is_pcre2_version(_regex_version);
+    }
+
+    if (!reader.read_u32(count)) {
+        LOGE("Invalid stem map length field");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string stem;
+        uint32_t len;
+
+        // Length does not include NULL-terminator
+        if (!reader.read_u32(len) || len == UINT32_MAX
+                || !reader.read_bytes(len + 1, stem) || stem.back() != '\0') {
+            LOGE("Invalid stem %" PRIu32, i);
+            return false;
+        }
+        stem.pop_back();
+
+        _stems.push_back(std::move(stem));
+    }
+
+    if (!reader.read_u32(count)) {
+        LOGE("Invalid regex array length field");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        FileContextsSpec spec;
+        uint32_t stem_id;
+
+        spec.prefix_len = 0;
+
+        if (!reader.read_cstring(spec.context)
+                || !reader.read_cstring(spec.regex)
+                || !reader.read_u32(spec.mode)
+                || !reader.read_u32(stem_id)
+                || !reader.read_u32(spec.has_meta_chars)
+                || (_version >= FCONTEXT_VERS_PREFIX_LEN
+                        && !reader.read_u32(spec.prefix_len))
+                // PCRE regex, followed by the study data for PCRE1
+                || !reader.append_blob(spec.regex_data)
+                || (!_pcre2 && !reader.append_blob(spec.regex_data))) {
+            LOGE("Invalid regex spec %" PRIu32, i);
+            return false;
+        }
+
+        spec.stem_id = static_cast<int32_t>(stem_id);
+        if (spec.stem_id >= static_cast<int32_t>(_stems.size())) {
+            LOGE("Invalid stem ID in regex spec %" PRIu32, i);
+            return false;
+        }
+
+        _specs.push_back(std::move(spec));
+    }
+
+    if (reader.cur != reader.end) {
+        LOGE("Trailing data after regex specs");
+        return false;
+    }
+
+    return true;
+}
+
+bool CompiledFileContexts::load_file(const std::string &path)
+{
+    auto data = util::file_read_all(path);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), data.error().message().c_str());
+        return false;
+    }
+
+    if (!load(data.value().data(), data.value().size())) {
+        LOGE("%s: Failed to load compiled file_contexts", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool CompiledFileContexts::save(std::string &out) const
+{
+    out.clear();
+
+    append_u32(out, FCONTEXT_MAGIC);
+    append_u32(out, _version);
+
+    if (_version >= FCONTEXT_VERS_PCRE) {
+        append_u32(out, static_cast<uint32_t>(_regex_version.size()));
+        out += _regex_version;
+    }
+
+    append_u32(out, static_cast<uint32_t>(_stems.size()));
+    for (auto const &stem : _stems) {
+        append_u32(out, static_cast<uint32_t>(stem.size()));
+        out.append(stem.c_str(), stem.size() + 1);
+    }
+
+    append_u32(out, static_cast<uint32_t>(_specs.size()));
+    for (auto const &spec : _specs) {
+        append_cstring(out, spec.context);
+        append_cstring(out, spec.regex);
+        append_u32(out, spec.mode);
+        append_u32(out, static_cast<uint32_t>(spec.stem_id));
+        append_u32(out, spec.has_meta_chars);
+        if (_version >= FCONTEXT_VERS_PREFIX_LEN) {
+            append_u32(out, spec.prefix_len);
+        }
+        out += spec.regex_data;
+    }
+
+    return true;
+}
+
+bool CompiledFileContexts::save_file(const std::string &path) const
+{
+    std::string data;
+
+    if (!save(data)) {
+        return false;
+    }
+
+    if (auto r = util::file_write_data(path, data.data(), data.size()); !r) {
+        LOGE("%s: Failed to write file: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t CompiledFileContexts::version() const
+{
+    return _version;
+}
+
+const std::string & CompiledFileContexts::regex_version() const
+{
+    return _regex_version;
+}
+
+const std::vector<FileContextsSpec> & CompiledFileContexts::specs() const
+{
+    return _specs;
+}
+
+/*!
+ * \brief Remove specs matching a predicate
+ *
+ * Stems are left as is since unused stems are harmless.
+ *
+ * \return Number of specs removed
+ */
+size_t CompiledFileContexts::remove_specs(
+        const std::function<bool(const FileContextsSpec &)> &pred)
+{
+    auto it = std::remove_if(_specs.begin(), _specs.end(), pred);
+    auto removed = static_cast<size_t>(_specs.end() - it);
+    _specs.erase(it, _specs.end());
+    return removed;
+}
+
+/*!
+ * \brief Append the specs from another compiled file
+ *
+ * The result is the same as compiling this file's source with the other
+ * file's source appended to it. libselinux sorts the specs so that the ones
+ * with meta characters come before the exact paths, keeping the relative order
+ * otherwise, so the other file's specs with meta characters are inserted after
+ * this file's specs with meta characters.
+ *
+ * \return Whether the other file has the same regex format. The specs are not
+ *         merged if it doesn't.
+ */
+bool CompiledFileContexts::merge(const CompiledFileContexts &other)
+{
+    if (other._pcre2 != _pcre2 || other._regex_version != _regex_version) {
+        LOGE("PCRE versions do not match: '%s' != '%s'",
+             other._regex_version.c_str(), _regex_version.c_str());
+        return false;
+    }
+
+    std::vector<FileContextsSpec> meta;
+    std::vector<FileContextsSpec> exact;
+
+    for (FileContextsSpec spec : other._specs) {
+        if (spec.stem_id >= 0) {
+            auto const &stem = other._stems[static_cast<size_t>(spec.stem_id)];
+            auto it = std::find(_stems.begin(), _stems.end(), stem);
+
+            spec.stem_id = static_cast<int32_t>(it - _stems.begin());
+            if (it == _stems.end()) {
+                _stems.push_back(stem);
+            }
+        }
+
+        (spec.has_meta_chars ? meta : exact).push_back(std::move(spec));
+    }
+
+    auto pos = std::find_if(_specs.begin(), _specs.end(),
+                            [](const FileContextsSpec &spec) {
+        return !spec.has_meta_chars;
+    });
+    _specs.insert(pos, std::make_move_iterator(meta.begin()),
+                  std::make_move_iterator(meta.end()));
+    _specs.insert(_specs.end(), std::make_move_iterator(exact.begin()),
+                  std::make_move_iterator(exact.end()));
+
+    return true;
+}
+
+/*!
+ * \brief Load the file_contexts specs of the running system
+ *
+ * The split plat/vendor files used by Android 7.0+ are preferred. Otherwise,
+ * the ramdisk's file_contexts.bin or text file_contexts is used. The regexes in
+ * file_contexts.bin are stored alongside their compiled PCRE data, so they are
+ * recompiled from the source strings.
+ *
+ * \param contexts Output FileContexts (must be empty)
+ *
+ * \return Whether any file_contexts file was loaded
+ */
+bool load_device_file_contexts(util::FileContexts &contexts)
+{
+    static constexpr char PLAT_FILE_CONTEXTS[] =
+            "/system/etc/selinux/plat_file_contexts";
+    static constexpr const char *VENDOR_FILE_CONTEXTS[] = {
+        "/vendor/etc/selinux/vendor_file_contexts",
+        "/vendor/etc/selinux/nonplat_file_contexts",
+    };
+
+    struct stat sb;
+
+    if (stat(PLAT_FILE_CONTEXTS, &sb) == 0) {
+        if (auto r = contexts.load_file(PLAT_FILE_CONTEXTS); !r) {
+            LOGE("%s: Failed to load file_contexts: %s",
+                 PLAT_FILE_CONTEXTS, r.error().message().c_str());
+            return false;
+        }
+
+        for (auto const &path : VENDOR_FILE_CONTEXTS) {
+            if (stat(path, &sb) == 0) {
+                if (auto r = contexts.load_file(path); !r) {
+                    LOGE("%s: Failed to load file_contexts: %s",
+                         path, r.error().message().c_str());
+                    return false;
+                }
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    if (stat("/file_contexts.bin", &sb) == 0) {
+        CompiledFileContexts fc;
+        if (!fc.load_file("/file_contexts.bin")) {
+            return false;
+        }
+
+        for (auto const &spec : fc.specs()) {
+            if (auto r = contexts.add_spec(
+                    spec.regex, static_cast<mode_t>(spec.mode), spec.context);
+                    !r) {
+                LOGE("/file_contexts.bin: Failed to add spec %s: %s",
+                     spec.regex.c_str(), r.error().message().c_str());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    if (auto r = contexts.load_file("/file_contexts"); !r) {
+        LOGE("/file_contexts: Failed to load file_contexts: %s",
+             r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbutil/selinux_label.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Entry in a compiled file_contexts.bin file
+ */
+struct FileContextsSpec
+{
+    std::string context;
+    std::string regex;
+    uint32_t mode;
+    int32_t stem_id;
+    uint32_t has_meta_chars;
+    uint32_t prefix_len;
+    // Serialized PCRE data, including the length fields. This is never
+    // interpreted, so it is only valid with the file's PCRE version.
+    std::string regex_data;
+};
+
+/*!
+ * \brief Editor for the compiled file_contexts.bin format
+ *
+ * This parses the format written by libselinux's sefcontext_compile (and
+ * misc/file-contexts-tool) without needing PCRE. Specs can be removed and
+ * specs from another compiled file with the same PCRE version can be merged
+ * in, so patching the file doesn't require decompiling and recompiling every
+ * regex.
+ */
+class CompiledFileContexts
+{
+public:
+    bool load(const void *data, size_t size);
+    bool load_file(const std::string &path);
+    bool save(std::string &out) const;
+    bool save_file(const std::string &path) const;
+
+    uint32_t version() const;
+    const std::string & regex_version() const;
+    const std::vector<FileContextsSpec> & specs() const;
+
+    size_t remove_specs(
+            const std::function<bool(const FileContextsSpec &)> &pred);
+    bool merge(const CompiledFileContexts &other);
+
+private:
+    uint32_t _version = 0;
+    std::string _regex_version;
+    bool _pcre2 = false;
+    std::vector<std::string> _stems;
+    std::vector<FileContextsSpec> _specs;
+};
+
+bool load_device_file_contexts(util::FileContexts &contexts);
+
+}
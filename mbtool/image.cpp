@@ -19,32 +19,142 @@
 
 #include "image.h"
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
 
+#include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include "mbcommon/endian.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
 #include "mbutil/command.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/string.h"
 
+#include "mkfs_ext4.h"
+
 #define LOG_TAG "mbtool/image"
 
+// Only the fields needed for finding the block bitmaps are parsed. See
+// Documentation/filesystems/ext4/ in the kernel source tree for the layout.
+constexpr uint64_t EXT4_SUPERBLOCK_OFFSET       = 1024;
+constexpr size_t EXT4_SUPERBLOCK_SIZE           = 1024;
+constexpr uint16_t EXT4_SUPER_MAGIC             = 0xef53;
+
+constexpr uint32_t EXT4_FEATURE_COMPAT_SPARSE_SUPER2    = 0x0200;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_META_BG        = 0x0010;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_64BIT          = 0x0080;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER  = 0x0001;
+
+constexpr uint16_t EXT4_BG_BLOCK_UNINIT         = 0x0002;
+
+constexpr uint16_t EXT4_MIN_DESC_SIZE           = 32;
+constexpr uint16_t EXT4_MIN_DESC_SIZE_64BIT     = 64;
+
+// Amount of data copied at a time between the image and the sparse file
+constexpr size_t IMAGE_COPY_BUFFER_SIZE         = 1024 * 1024;
+
+// e2fsck can print a line for every problem it fixes
+constexpr mb::util::CmdLineRateLimit FSCK_OUTPUT_RATE_LIMIT{
+    200, std::chrono::seconds(1)
+};
+
 namespace mb
 {
 
-static void output_cb(const char *line, bool error, void *userdata)
+struct Ext4Layout
+{
+    uint32_t block_size;
+    uint64_t blocks_count;
+    uint32_t first_data_block;
+    uint32_t blocks_per_group;
+    uint32_t inodes_per_group;
+    uint16_t inode_size;
+    uint16_t desc_size;
+    uint16_t reserved_gdt_blocks;
+    bool sparse_super;
+    bool is_64bit;
+};
+
+struct Ext4GroupDesc
+{
+    uint64_t block_bitmap;
+    uint64_t inode_bitmap;
+    uint64_t inode_table;
+    uint16_t flags;
+};
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return mb_le16toh(value);
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static void output_cb(std::string_view line, bool error, void *userdata)
 {
     (void) error;
 
     auto *args = static_cast<std::vector<std::string> *>(userdata);
-    LOGV("%s: %s", (*args)[0].c_str(), line);
+    LOGV("%s: %.*s", (*args)[0].c_str(), static_cast<int>(line.size()),
+         line.data());
+}
+
+static bool make_ext4_image(const std::string &path, uint64_t size)
+{
+    // Images that are too small for the native formatter's fixed layout are
+    // rare enough that make_ext4fs is fine for them
+    if (size >= MKFS_EXT4_MIN_SIZE) {
+        auto start = std::chrono::steady_clock::now();
+
+        if (!mkfs_ext4(path, size)) {
+            LOGE("%s: Failed to create image", path.c_str());
+            return false;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        LOGD("%s: Created ext4 image in %" PRId64 "ms", path.c_str(),
+             static_cast<int64_t>(elapsed.count()));
+        return true;
+    }
+
+    char size_str[64];
+    snprintf(size_str, sizeof(size_str), "%" PRIu64, size);
+
+    std::vector<std::string> argv{
+        "make_ext4fs", "-l", size_str, path
+    };
+    int ret = util::run_command(argv[0], argv, {}, {}, &output_cb, &argv,
+                                {});
+    if (ret < 0 || WEXITSTATUS(ret) != 0) {
+        LOGE("%s: Failed to create image", path.c_str());
+        return false;
+    }
+    return true;
 }
 
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
@@ -68,19 +178,9 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
             LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
             return CreateImageResult::Failed;
         } else {
-            char size_str[64];
-            snprintf(size_str, sizeof(size_str), "%" PRIu64, size);
-
-            LOGD("%s: Creating new %s ext4 image", path.c_str(), size_str);
+            LOGD("%s: Creating new %" PRIu64 " ext4 image", path.c_str(), size);
 
-            // Create new image
-            std::vector<std::string> argv{
-                "make_ext4fs", "-l", size_str, path
-            };
-            int ret = util::run_command(argv[0], argv, {}, {}, &output_cb,
-                                        &argv);
-            if (ret < 0 || WEXITSTATUS(ret) != 0) {
-                LOGE("%s: Failed to create image", path.c_str());
+            if (!make_ext4_image(path, size)) {
                 return CreateImageResult::Failed;
             }
             return CreateImageResult::Succeeded;
@@ -94,7 +194,8 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
 bool fsck_ext4_image(const std::string &image)
 {
     std::vector<std::string> argv{ "e2fsck", "-f", "-y", image };
-    int ret = util::run_command(argv[0], argv, {}, {}, &output_cb, &argv);
+    int ret = util::run_command(argv[0], argv, {}, {}, &output_cb, &argv,
+                                FSCK_OUTPUT_RATE_LIMIT);
     if (ret < 0 || (WEXITSTATUS(ret) != 0 && WEXITSTATUS(ret) != 1)) {
         LOGE("%s: Failed to e2fsck", image.c_str());
         return false;
@@ -102,4 +203,645 @@ bool fsck_ext4_image(const std::string &image)
     return true;
 }
 
+/*!
+ * \brief Copy the excluded top-level paths of a mounted image to \p save_dir
+ *
+ * \return Whether all of the excluded paths that exist were copied
+ */
+static bool save_excluded_paths(const std::string &mount_point,
+                                const std::string &save_dir,
+                                const std::vector<std::string> &exclusions)
+{
+    for (auto const &name : exclusions) {
+        std::string source(mount_point);
+        source += '/';
+        source += name;
+
+        struct stat sb;
+        if (lstat(source.c_str(), &sb) < 0) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            LOGE("%s: Failed to stat: %s", source.c_str(), strerror(errno));
+            return false;
+        }
+
+        LOGD("Saving %s", source.c_str());
+
+        auto r = S_ISDIR(sb.st_mode)
+                ? util::copy_dir(source, save_dir,
+                                 util::CopyFlag::CopyAttributes
+                               | util::CopyFlag::CopyXattrs
+                               | util::CopyFlag::Parallel)
+                : util::copy_file(source, save_dir + '/' + name,
+                                  util::CopyFlag::CopyAttributes
+                                | util::CopyFlag::CopyXattrs);
+        if (!r) {
+            LOGE("Failed to save %s: %s",
+                 source.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Replace the contents of an ext4 image with an empty filesystem
+ *
+ * Instead of deleting every file, the image is truncated, which releases all of
+ * its blocks on the host filesystem, and a new filesystem of the same size is
+ * created in it. This takes the same amount of time no matter how many files
+ * the image contains.
+ *
+ * If \p exclusions is not empty, the image is mounted first and the excluded
+ * top-level paths are copied next to the image. They are copied back into the
+ * new filesystem afterwards, so their size (not the number of other files)
+ * determines how long this takes. If they cannot be copied back, they are left
+ * in a directory next to the image and its path is logged.
+ *
+ * \param path Image file, which must not be mounted
+ * \param exclusions Top-level paths to keep
+ *
+ * \return Whether the image was reformatted and the exclusions were restored
+ */
+bool reformat_ext4_image(const std::string &path,
+                         const std::vector<std::string> &exclusions)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto size = static_cast<uint64_t>(sb.st_size);
+
+    // Holds the mount point and the saved paths
+    std::string temp_dir(path);
+    temp_dir += ".wipe.XXXXXX";
+    bool have_temp_dir = false;
+    std::string mount_point;
+    std::string save_dir;
+
+    if (!exclusions.empty()) {
+        if (!mkdtemp(temp_dir.data())) {
+            LOGE("%s: Failed to create directory: %s",
+                 temp_dir.c_str(), strerror(errno));
+            return false;
+        }
+        have_temp_dir = true;
+
+        mount_point = temp_dir + "/mnt";
+        save_dir = temp_dir + "/save";
+
+        if (mkdir(mount_point.c_str(), 0700) < 0
+                || mkdir(save_dir.c_str(), 0700) < 0) {
+            LOGE("%s: Failed to create directory: %s",
+                 temp_dir.c_str(), strerror(errno));
+            (void) util::delete_recursive(temp_dir);
+            return false;
+        }
+
+        if (auto r = util::mount(path, mount_point, "ext4", MS_RDONLY, "");
+                !r) {
+            LOGE("Failed to mount %s at %s: %s", path.c_str(),
+                 mount_point.c_str(), r.error().message().c_str());
+            (void) util::delete_recursive(temp_dir);
+            return false;
+        }
+
+        bool saved = save_excluded_paths(mount_point, save_dir, exclusions);
+
+        if (auto r = util::umount(mount_point); !r) {
+            LOGE("Failed to unmount %s: %s",
+                 mount_point.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (!saved) {
+            (void) util::delete_recursive(temp_dir);
+            return false;
+        }
+    }
+
+    LOGD("%s: Reformatting %" PRIu64 " byte ext4 image", path.c_str(), size);
+
+    // Release every block before creating the new filesystem
+    if (truncate(path.c_str(), 0) < 0) {
+        LOGE("%s: Failed to truncate: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (!make_ext4_image(path, size)) {
+        if (have_temp_dir) {
+            LOGE("Excluded paths were kept in %s", save_dir.c_str());
+        }
+        return false;
+    }
+
+    if (!have_temp_dir) {
+        return true;
+    }
+
+    bool ret = true;
+
+    if (auto r = util::mount(path, mount_point, "ext4", 0, ""); !r) {
+        LOGE("Failed to mount %s at %s: %s", path.c_str(),
+             mount_point.c_str(), r.error().message().c_str());
+        ret = false;
+    } else {
+        if (auto r2 = util::copy_dir(save_dir, mount_point,
+                                     util::CopyFlag::CopyAttributes
+                                   | util::CopyFlag::CopyXattrs
+                                   | util::CopyFlag::ExcludeTopLevel
+                                   | util::CopyFlag::Parallel); !r2) {
+            LOGE("Failed to restore excluded paths: %s",
+                 r2.error().message().c_str());
+            ret = false;
+        }
+
+        if (auto r2 = util::umount(mount_point); !r2) {
+            LOGE("Failed to unmount %s: %s",
+                 mount_point.c_str(), r2.error().message().c_str());
+            return false;
+        }
+    }
+
+    if (ret) {
+        (void) util::delete_recursive(temp_dir);
+    } else {
+        LOGE("Excluded paths were kept in %s", save_dir.c_str());
+    }
+
+    return ret;
+}
+
+static bool read_ext4_layout(File &file, const std::string &image,
+                             Ext4Layout &layout)
+{
+    unsigned char sb[EXT4_SUPERBLOCK_SIZE];
+
+    if (auto r = file.seek(EXT4_SUPERBLOCK_OFFSET, SEEK_SET); !r) {
+        LOGE("%s: Failed to seek to superblock: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = file_read_exact(file, sb, sizeof(sb)); !r2) {
+        LOGE("%s: Failed to read superblock: %s",
+             image.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    if (read_le16(sb + 0x38) != EXT4_SUPER_MAGIC) {
+        LOGE("%s: Not an ext4 image", image.c_str());
+        return false;
+    }
+
+    uint32_t log_block_size = read_le32(sb + 0x18);
+    uint32_t rev_level = read_le32(sb + 0x4c);
+    uint32_t feature_compat = read_le32(sb + 0x5c);
+    uint32_t feature_incompat = read_le32(sb + 0x60);
+    uint32_t feature_ro_compat = read_le32(sb + 0x64);
+
+    // The group descriptors of meta_bg filesystems are spread across the
+    // filesystem and sparse_super2 moves the backup superblocks. Neither is
+    // used by make_ext4fs.
+    if (feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG
+            || feature_compat & EXT4_FEATURE_COMPAT_SPARSE_SUPER2) {
+        LOGE("%s: Unsupported ext4 features", image.c_str());
+        return false;
+    } else if (log_block_size > 6) {
+        LOGE("%s: Invalid block size", image.c_str());
+        return false;
+    }
+
+    layout.block_size = 1024u << log_block_size;
+    layout.is_64bit = feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT;
+    layout.blocks_count = read_le32(sb + 0x04);
+    if (layout.is_64bit) {
+        layout.blocks_count |= static_cast<uint64_t>(read_le32(sb + 0x150))
+                << 32;
+    }
+    layout.first_data_block = read_le32(sb + 0x14);
+    layout.blocks_per_group = read_le32(sb + 0x20);
+    layout.inodes_per_group = read_le32(sb + 0x28);
+    layout.inode_size = rev_level == 0 ? 128 : read_le16(sb + 0x58);
+    layout.desc_size = layout.is_64bit
+            ? read_le16(sb + 0xfe) : EXT4_MIN_DESC_SIZE;
+    layout.reserved_gdt_blocks = read_le16(sb + 0xce);
+    layout.sparse_super = feature_ro_compat
+            & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER;
+
+    // Each group's bitmap must fit in one block
+    if (layout.blocks_per_group == 0
+            || layout.blocks_per_group > layout.block_size * 8
+            || layout.blocks_count <= layout.first_data_block
+            || layout.desc_size < EXT4_MIN_DESC_SIZE
+            || (layout.is_64bit
+                    && layout.desc_size < EXT4_MIN_DESC_SIZE_64BIT)
+            || layout.desc_size > layout.block_size) {
+        LOGE("%s: Invalid ext4 superblock", image.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_ext4_group_descs(File &file, const std::string &image,
+                                  const Ext4Layout &layout,
+                                  std::vector<Ext4GroupDesc> &descs)
+{
+    uint64_t groups = (layout.blocks_count - layout.first_data_block
+            + layout.blocks_per_group - 1) / layout.blocks_per_group;
+
+    std::vector<unsigned char> buf(static_cast<size_t>(groups)
+            * layout.desc_size);
+
+    // The descriptor table starts in the block after the superblock
+    uint64_t offset = (static_cast<uint64_t>(layout.first_data_block) + 1)
+            * layout.block_size;
+
+    if (auto r = file.seek(static_cast<int64_t>(offset), SEEK_SET); !r) {
+        LOGE("%s: Failed to seek to group descriptors: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = file_read_exact(file, buf.data(), buf.size()); !r2) {
+        LOGE("%s: Failed to read group descriptors: %s",
+             image.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    descs.clear();
+    descs.reserve(static_cast<size_t>(groups));
+
+    for (size_t i = 0; i < groups; ++i) {
+        const unsigned char *p = buf.data() + i * layout.desc_size;
+        Ext4GroupDesc desc;
+
+        desc.block_bitmap = read_le32(p + 0x00);
+        desc.inode_bitmap = read_le32(p + 0x04);
+        desc.inode_table = read_le32(p + 0x08);
+        desc.flags = read_le16(p + 0x12);
+
+        if (layout.is_64bit) {
+            desc.block_bitmap |= static_cast<uint64_t>(read_le32(p + 0x20))
+                    << 32;
+            desc.inode_bitmap |= static_cast<uint64_t>(read_le32(p + 0x24))
+                    << 32;
+            desc.inode_table |= static_cast<uint64_t>(read_le32(p + 0x28))
+                    << 32;
+        }
+
+        if (desc.block_bitmap >= layout.blocks_count) {
+            LOGE("%s: Invalid block bitmap location for group %zu",
+                 image.c_str(), i);
+            return false;
+        }
+
+        descs.push_back(desc);
+    }
+
+    return true;
+}
+
+static bool is_power_of(uint64_t n, uint64_t base)
+{
+    while (n > 1 && n % base == 0) {
+        n /= base;
+    }
+    return n == 1;
+}
+
+// Whether a group contains a copy of the superblock and descriptor table
+static bool ext4_group_has_super(const Ext4Layout &layout, uint64_t group)
+{
+    return !layout.sparse_super || group <= 1 || is_power_of(group, 3)
+            || is_power_of(group, 5) || is_power_of(group, 7);
+}
+
+static void set_bit_range(std::vector<unsigned char> &bitmap, uint64_t begin,
+                          uint64_t end)
+{
+    end = std::min<uint64_t>(end, bitmap.size() * 8);
+    for (uint64_t i = begin; i < end; ++i) {
+        bitmap[static_cast<size_t>(i / 8)] |=
+                static_cast<unsigned char>(1u << (i % 8));
+    }
+}
+
+/*!
+ * \brief Build the block bitmap of a group whose bitmap is uninitialized
+ *
+ * The kernel only marks the group's own metadata as used in this case: the
+ * backup superblock and descriptor table (if any) and, if they are stored in
+ * the group, its bitmaps and inode table.
+ */
+static void synthesize_ext4_block_bitmap(const Ext4Layout &layout,
+                                         const Ext4GroupDesc &desc,
+                                         uint64_t group,
+                                         uint64_t n_groups,
+                                         std::vector<unsigned char> &bitmap)
+{
+    uint64_t start = layout.first_data_block
+            + group * layout.blocks_per_group;
+    uint64_t end = start + layout.blocks_per_group;
+
+    std::fill(bitmap.begin(), bitmap.end(), 0);
+
+    if (ext4_group_has_super(layout, group)) {
+        uint64_t gdt_blocks = (n_groups * layout.desc_size
+                + layout.block_size - 1) / layout.block_size;
+        set_bit_range(bitmap, 0, 1 + gdt_blocks + layout.reserved_gdt_blocks);
+    }
+
+    uint64_t inode_table_blocks =
+            (static_cast<uint64_t>(layout.inodes_per_group) * layout.inode_size
+                    + layout.block_size - 1) / layout.block_size;
+
+    for (auto const &[b_begin, b_end] : {
+        std::make_pair(desc.block_bitmap, desc.block_bitmap + 1),
+        std::make_pair(desc.inode_bitmap, desc.inode_bitmap + 1),
+        std::make_pair(desc.inode_table, desc.inode_table + inode_table_blocks),
+    }) {
+        if (b_begin < end && b_end > start) {
+            set_bit_range(bitmap, std::max(b_begin, start) - start,
+                          std::min(b_end, end) - start);
+        }
+    }
+}
+
+static bool copy_image_range(File &in, File &out, const std::string &image,
+                             std::vector<unsigned char> &buf, uint64_t offset,
+                             uint64_t size)
+{
+    auto seek_ret = in.seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        LOGE("%s: Failed to seek: %s",
+             image.c_str(), seek_ret.error().message().c_str());
+        return false;
+    }
+
+    seek_ret = out.seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        LOGE("%s: Failed to seek sparse file: %s",
+             image.c_str(), seek_ret.error().message().c_str());
+        return false;
+    }
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+
+        if (auto r = file_read_exact(in, buf.data(), n); !r) {
+            LOGE("%s: Failed to read: %s",
+                 image.c_str(), r.error().message().c_str());
+            return false;
+        } else if (auto r2 = file_write_exact(out, buf.data(), n); !r2) {
+            LOGE("%s: Failed to write sparse file: %s",
+                 image.c_str(), r2.error().message().c_str());
+            return false;
+        }
+
+        size -= n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy the allocated blocks of an ext4 image to an Android sparse file
+ *
+ * The block bitmaps are used to find the blocks that are in use. Free blocks
+ * are stored as "don't care" chunks, so the sparse file is only about as large
+ * as the data in the filesystem. The image must not be mounted.
+ *
+ * \param image Path to ext4 image
+ * \param sparse_file Output sparse file
+ *
+ * \return Whether the image was successfully copied
+ */
+bool backup_ext4_image_blocks(const std::string &image,
+                              const std::string &sparse_file)
+{
+    StandardFile in;
+    StandardFile out_raw;
+    sparse::SparseWriter out;
+
+    if (auto r = in.open(image, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open for reading: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    Ext4Layout layout;
+    std::vector<Ext4GroupDesc> descs;
+
+    if (!read_ext4_layout(in, image, layout)
+            || !read_ext4_group_descs(in, image, layout, descs)) {
+        return false;
+    }
+
+    if (auto r = out_raw.open(sparse_file, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             sparse_file.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = out.open(&out_raw, layout.block_size); !r2) {
+        LOGE("%s: Failed to open sparse writer: %s",
+             sparse_file.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> bitmap(layout.block_size);
+    std::vector<unsigned char> buf(IMAGE_COPY_BUFFER_SIZE);
+    uint64_t used_blocks = 0;
+
+    // Blocks before the first group (the boot block on 1k block filesystems)
+    // are not described by any bitmap
+    if (layout.first_data_block > 0) {
+        if (!copy_image_range(in, out, image, buf, 0,
+                              static_cast<uint64_t>(layout.first_data_block)
+                                      * layout.block_size)) {
+            return false;
+        }
+        used_blocks += layout.first_data_block;
+    }
+
+    for (uint64_t group = 0; group < descs.size(); ++group) {
+        auto const &desc = descs[static_cast<size_t>(group)];
+        uint64_t start = layout.first_data_block
+                + group * layout.blocks_per_group;
+        uint64_t n_blocks = std::min<uint64_t>(
+                layout.blocks_per_group, layout.blocks_count - start);
+
+        if (desc.flags & EXT4_BG_BLOCK_UNINIT) {
+            synthesize_ext4_block_bitmap(layout, desc, group, descs.size(),
+                                         bitmap);
+        } else if (auto r = in.seek(static_cast<int64_t>(
+                desc.block_bitmap * layout.block_size), SEEK_SET); !r) {
+            LOGE("%s: Failed to seek to block bitmap: %s",
+                 image.c_str(), r.error().message().c_str());
+            return false;
+        } else if (auto r2 = file_read_exact(in, bitmap.data(), bitmap.size());
+                !r2) {
+            LOGE("%s: Failed to read block bitmap: %s",
+                 image.c_str(), r2.error().message().c_str());
+            return false;
+        }
+
+        // Copy each run of allocated blocks
+        for (uint64_t i = 0; i < n_blocks;) {
+            auto is_used = [&](uint64_t bit) {
+                return bitmap[static_cast<size_t>(bit / 8)] & (1u << (bit % 8));
+            };
+
+            if (!is_used(i)) {
+                ++i;
+                continue;
+            }
+
+            uint64_t run_start = i;
+            while (i < n_blocks && is_used(i)) {
+                ++i;
+            }
+
+            if (!copy_image_range(in, out, image, buf,
+                                  (start + run_start) * layout.block_size,
+                                  (i - run_start) * layout.block_size)) {
+                return false;
+            }
+
+            used_blocks += i - run_start;
+        }
+    }
+
+    // The remaining free blocks become a "don't care" chunk
+    if (auto r = out.seek(static_cast<int64_t>(
+            layout.blocks_count * layout.block_size), SEEK_SET); !r) {
+        LOGE("%s: Failed to seek sparse file: %s",
+             sparse_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out.close(); !r) {
+        LOGE("%s: Failed to finish sparse file: %s",
+             sparse_file.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = out_raw.close(); !r2) {
+        LOGE("%s: Failed to close file: %s",
+             sparse_file.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    LOGD("%s: Copied %" PRIu64 "/%" PRIu64 " blocks", image.c_str(),
+         used_blocks, layout.blocks_count);
+
+    return true;
+}
+
+/*!
+ * \brief Write a sparse file created by backup_ext4_image_blocks() to an image
+ *
+ * The image is replaced, so the "don't care" regions become holes in the new
+ * image file.
+ *
+ * \param sparse_file Path to sparse file
+ * \param image Path to output image
+ *
+ * \return Whether the image was successfully written
+ */
+bool restore_ext4_image_blocks(const std::string &sparse_file,
+                               const std::string &image)
+{
+    StandardFile in_raw;
+    sparse::SparseFile in;
+    StandardFile out;
+
+    if (auto r = in_raw.open(sparse_file, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open for reading: %s",
+             sparse_file.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = in.open(&in_raw); !r2) {
+        LOGE("%s: Failed to open sparse file: %s",
+             sparse_file.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    uint64_t size = in.size();
+
+    if (auto avail = util::mount_get_avail_size(util::dir_name(image)); !avail) {
+        LOGE("%s: Failed to get available space: %s", image.c_str(),
+             avail.error().message().c_str());
+        return false;
+    } else if (avail.value() < size) {
+        // The image may still fit because it is sparse, so only warn
+        LOGW("%s: Image size (%" PRIu64 " bytes) exceeds available space"
+             " (%" PRIu64 " bytes)", image.c_str(), size, avail.value());
+    }
+
+    // Truncating the image first discards its old contents so that the free
+    // blocks do not use any space
+    if (auto r = out.open(image, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    } else if (auto r2 = out.truncate(size); !r2) {
+        LOGE("%s: Failed to truncate: %s",
+             image.c_str(), r2.error().message().c_str());
+        return false;
+    }
+
+    auto chunks = in.chunks();
+    if (!chunks) {
+        LOGE("%s: Failed to read chunks: %s",
+             sparse_file.c_str(), chunks.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> buf(IMAGE_COPY_BUFFER_SIZE);
+
+    for (auto const &chunk : chunks.value()) {
+        // Holes and zero-filled chunks are left as holes in the new image
+        if (chunk.type == sparse::detail::CHUNK_TYPE_DONT_CARE
+                || chunk.type == sparse::detail::CHUNK_TYPE_CRC32
+                || (chunk.type == sparse::detail::CHUNK_TYPE_FILL
+                        && chunk.fill_val == 0)) {
+            continue;
+        }
+
+        if (auto r = in.seek(static_cast<int64_t>(chunk.begin), SEEK_SET); !r) {
+            LOGE("%s: Failed to seek: %s",
+                 sparse_file.c_str(), r.error().message().c_str());
+            return false;
+        } else if (auto r2 = out.seek(static_cast<int64_t>(chunk.begin),
+                                      SEEK_SET); !r2) {
+            LOGE("%s: Failed to seek: %s",
+                 image.c_str(), r2.error().message().c_str());
+            return false;
+        }
+
+        for (uint64_t remain = chunk.end - chunk.begin; remain > 0;) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(remain, buf.size()));
+
+            if (auto r = file_read_exact(in, buf.data(), n); !r) {
+                LOGE("%s: Failed to read: %s",
+                     sparse_file.c_str(), r.error().message().c_str());
+                return false;
+            } else if (auto r2 = file_write_exact(out, buf.data(), n); !r2) {
+                LOGE("%s: Failed to write: %s",
+                     image.c_str(), r2.error().message().c_str());
+                return false;
+            }
+
+            remain -= n;
+        }
+    }
+
+    if (auto r = out.close(); !r) {
+        LOGE("%s: Failed to close file: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 }
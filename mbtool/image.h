@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace mb
 {
@@ -36,5 +37,12 @@ enum class CreateImageResult
 
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size);
 bool fsck_ext4_image(const std::string &image);
+bool reformat_ext4_image(const std::string &path,
+                         const std::vector<std::string> &exclusions);
+
+bool backup_ext4_image_blocks(const std::string &image,
+                              const std::string &sparse_file);
+bool restore_ext4_image_blocks(const std::string &sparse_file,
+                               const std::string &image);
 
 }
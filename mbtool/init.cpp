@@ -64,8 +64,10 @@
 
 #include "initwrapper/devices.h"
 #include "initwrapper/util.h"
+#include "boot_timeline.h"
 #include "daemon.h"
 #include "emergency.h"
+#include "file_contexts.h"
 #include "mount_fstab.h"
 #include "multiboot.h"
 #include "romconfig.h"
@@ -304,6 +306,14 @@ static bool replace_file(const char *replace, const char *with)
     return true;
 }
 
+static const char *MULTIBOOT_FILE_CONTEXTS =
+        "/data/media              <<none>>\n"
+        "/data/media/[0-9]+(/.*)? <<none>>\n"
+        "/raw(/.*)?               <<none>>\n"
+        "/data/multiboot(/.*)?    <<none>>\n"
+        "/cache/multiboot(/.*)?   <<none>>\n"
+        "/system/multiboot(/.*)?  <<none>>\n";
+
 static bool fix_file_contexts(const char *path)
 {
     std::string new_path(path);
@@ -348,15 +358,73 @@ static bool fix_file_contexts(const char *path)
         }
     }
 
-    static const char *new_contexts =
-            "\n"
-            "/data/media              <<none>>\n"
-            "/data/media/[0-9]+(/.*)? <<none>>\n"
-            "/raw(/.*)?               <<none>>\n"
-            "/data/multiboot(/.*)?    <<none>>\n"
-            "/cache/multiboot(/.*)?   <<none>>\n"
-            "/system/multiboot(/.*)?  <<none>>\n";
-    fputs(new_contexts, fp_new.get());
+    fputs("\n", fp_new.get());
+    fputs(MULTIBOOT_FILE_CONTEXTS, fp_new.get());
+
+    return replace_file(path, new_path.c_str());
+}
+
+static bool run_file_contexts_tool(const std::vector<std::string> &argv)
+{
+    int ret = util::run_command(argv[0], argv, {}, {}, nullptr, nullptr);
+    return ret >= 0 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0;
+}
+
+/*!
+ * \brief Patch binary file_contexts without recompiling the existing specs
+ *
+ * Only the multiboot specs are compiled by file-contexts-tool (PCRE is only
+ * available as a shared library on the firmware). Everything else is edited in
+ * place.
+ */
+static bool patch_binary_file_contexts(const char *path)
+{
+    std::string new_path(path);
+    new_path += ".bin";
+    std::string extra_path(path);
+    extra_path += ".multiboot";
+    std::string extra_bin_path(extra_path);
+    extra_bin_path += ".bin";
+
+    auto remove_temp_files = finally([&]{
+        unlink(extra_path.c_str());
+        unlink(extra_bin_path.c_str());
+    });
+
+    CompiledFileContexts fc;
+    if (!fc.load_file(path)) {
+        return false;
+    }
+
+    if (auto r = util::file_write_data(extra_path, MULTIBOOT_FILE_CONTEXTS,
+                                       strlen(MULTIBOOT_FILE_CONTEXTS)); !r) {
+        LOGE("%s: Failed to write file: %s",
+             extra_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (!run_file_contexts_tool({
+            "/sbin/file-contexts-tool", "compile", "-p", PCRE_PATH,
+            extra_path, extra_bin_path})) {
+        LOGE("%s: Failed to compile multiboot file_contexts",
+             extra_path.c_str());
+        return false;
+    }
+
+    CompiledFileContexts extra;
+    if (!extra.load_file(extra_bin_path)) {
+        return false;
+    }
+
+    size_t removed = fc.remove_specs([](const FileContextsSpec &spec) {
+        return starts_with(spec.regex, "/data/media(")
+                && spec.context != "<<none>>";
+    });
+    LOGV("%s: Removed %zu /data/media specs", path, removed);
+
+    if (!fc.merge(extra) || !fc.save_file(new_path)) {
+        return false;
+    }
 
     return replace_file(path, new_path.c_str());
 }
@@ -377,19 +445,16 @@ static bool fix_binary_file_contexts(const char *path)
         return false;
     }
 
-    std::vector<std::string> decompile_argv{
-        "/sbin/file-contexts-tool",  "decompile", "-p", PCRE_PATH,
-        path, tmp_path
-    };
-    std::vector<std::string> compile_argv{
-        "/sbin/file-contexts-tool", "compile", "-p", PCRE_PATH,
-        tmp_path, new_path
-    };
+    if (patch_binary_file_contexts(path)) {
+        return true;
+    }
+
+    LOGW("%s: Falling back to decompiling and recompiling", path);
 
     // Decompile binary file_contexts to temporary file
-    int ret = util::run_command(decompile_argv[0], decompile_argv,
-                                {}, {}, nullptr, nullptr);
-    if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+    if (!run_file_contexts_tool({
+            "/sbin/file-contexts-tool",  "decompile", "-p", PCRE_PATH,
+            path, tmp_path})) {
         LOGE("%s: Failed to decompile file_contexts", path);
         return false;
     }
@@ -401,9 +466,9 @@ static bool fix_binary_file_contexts(const char *path)
     }
 
     // Recompile binary file_contexts
-    ret = util::run_command(compile_argv[0], compile_argv,
-                            {}, {}, nullptr, nullptr);
-    if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+    if (!run_file_contexts_tool({
+            "/sbin/file-contexts-tool", "compile", "-p", PCRE_PATH,
+            tmp_path, new_path})) {
         LOGE("%s: Failed to compile binary file_contexts", tmp_path.c_str());
         unlink(tmp_path.c_str());
         return false;
@@ -667,50 +732,44 @@ static std::string encode_list(const std::vector<std::string> &list)
 
 static bool add_props_to_default_prop(const Device &device)
 {
-    ScopedFILE fp(fopen(DEFAULT_PROP_PATH, "r+b"), fclose);
-    if (!fp) {
+    util::PropertyFile props;
+    if (!props.load(DEFAULT_PROP_PATH)) {
         if (errno == ENOENT) {
             return true;
         } else {
-            LOGE("%s: Failed to open file: %s",
+            LOGE("%s: Failed to load file: %s",
                  DEFAULT_PROP_PATH, strerror(errno));
             return false;
         }
     }
 
-    // Add newline if the last character isn't already one
-    if (std::fseek(fp.get(), -1, SEEK_END) == 0) {
-        char lastchar;
-        if (std::fread(&lastchar, 1, 1, fp.get()) == 1 && lastchar != '\n') {
-            fputs("\n", fp.get());
-        }
-    } else if (std::fseek(fp.get(), 0, SEEK_END) < 0) {
-        LOGE("%s: Failed to seek to end of file: %s",
+    // Version property
+    props.set(PROP_MULTIBOOT_VERSION, version());
+    // ROM ID property
+    props.set(PROP_MULTIBOOT_ROM_ID, get_rom_id());
+
+    // Block device paths (deprecated)
+    props.set("ro.patcher.blockdevs.base",
+              encode_list(device.block_dev_base_dirs()));
+    props.set("ro.patcher.blockdevs.system",
+              encode_list(device.system_block_devs()));
+    props.set("ro.patcher.blockdevs.cache",
+              encode_list(device.cache_block_devs()));
+    props.set("ro.patcher.blockdevs.data",
+              encode_list(device.data_block_devs()));
+    props.set("ro.patcher.blockdevs.boot",
+              encode_list(device.boot_block_devs()));
+    props.set("ro.patcher.blockdevs.recovery",
+              encode_list(device.recovery_block_devs()));
+    props.set("ro.patcher.blockdevs.extra",
+              encode_list(device.extra_block_devs()));
+
+    if (!props.save(DEFAULT_PROP_PATH)) {
+        LOGE("%s: Failed to write file: %s",
              DEFAULT_PROP_PATH, strerror(errno));
         return false;
     }
 
-    // Write version property
-    fprintf(fp.get(), PROP_MULTIBOOT_VERSION "=%s\n", version());
-    // Write ROM ID property
-    fprintf(fp.get(), PROP_MULTIBOOT_ROM_ID "=%s\n", get_rom_id().c_str());
-
-    // Block device paths (deprecated)
-    fprintf(fp.get(), "ro.patcher.blockdevs.base=%s\n",
-            encode_list(device.block_dev_base_dirs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.system=%s\n",
-            encode_list(device.system_block_devs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.cache=%s\n",
-            encode_list(device.cache_block_devs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.data=%s\n",
-            encode_list(device.data_block_devs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.boot=%s\n",
-            encode_list(device.boot_block_devs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.recovery=%s\n",
-            encode_list(device.recovery_block_devs()).c_str());
-    fprintf(fp.get(), "ro.patcher.blockdevs.extra=%s\n",
-            encode_list(device.extra_block_devs()).c_str());
-
     return true;
 }
 
@@ -912,11 +971,13 @@ static bool disable_spota()
 {
     static const char *spota_dir = "/data/security/spota";
 
-    std::unordered_map<std::string, std::string> props;
-    util::property_file_get_all("/system/build.prop", props);
+    util::PropertyFile props;
+    props.load("/system/build.prop");
 
-    if (strcasecmp(props["ro.product.manufacturer"].c_str(), "samsung") != 0
-            && strcasecmp(props["ro.product.brand"].c_str(), "samsung") != 0) {
+    if (strcasecmp(props.get_string("ro.product.manufacturer", {}).c_str(),
+                   "samsung") != 0
+            && strcasecmp(props.get_string("ro.product.brand", {}).c_str(),
+                          "samsung") != 0) {
         // Not a Samsung device
         LOGV("Not mounting empty tmpfs over: %s", spota_dir);
         return true;
@@ -1190,6 +1251,8 @@ int init_main(int argc, char *argv[])
         }
     }
 
+    boot_timeline_mark("start");
+
     // Mount base directories
     mkdir("/dev", 0755);
     mkdir("/proc", 0755);
@@ -1221,6 +1284,8 @@ int init_main(int argc, char *argv[])
     LOGV("Booting up with version %s (%s)",
          version(), git_version());
 
+    boot_timeline_mark("early_mounts");
+
     auto contents = util::file_read_all(DEVICE_JSON_PATH);
     if (!contents) {
         LOGE("%s: Failed to read file: %s", DEVICE_JSON_PATH,
@@ -1248,6 +1313,8 @@ int init_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    boot_timeline_mark("device_definition");
+
     // Symlink by-name directory to /dev/block/by-name (ugh... ASUS)
     symlink_base_dir(device);
 
@@ -1256,10 +1323,14 @@ int init_main(int argc, char *argv[])
     // initialize properties
     properties_setup();
 
+    boot_timeline_mark("properties_setup");
+
     std::string fstab(find_fstab());
 
     LOGV("fstab file: %s", fstab.c_str());
 
+    boot_timeline_mark("find_fstab");
+
     if (access(fstab.c_str(), R_OK) < 0) {
         LOGW("%s: Failed to access file: %s", fstab.c_str(), strerror(errno));
         LOGW("Continuing anyway...");
@@ -1293,16 +1364,28 @@ int init_main(int argc, char *argv[])
 
     LOGV("Successfully mounted fstab");
 
+    boot_timeline_mark("mount_fstab");
+
+    // The boot menu needs the input and graphics devices
+    device_wait_coldboot();
+
+    boot_timeline_mark("coldboot");
+
     if (!launch_boot_menu()) {
         LOGE("Failed to run boot menu");
         // Continue anyway since boot menu might not run on every device
     }
 
+    boot_timeline_mark("boot_menu");
+
     // Mount selinuxfs
     selinux_mount();
     // Load pre-boot policy
-    patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE, util::SELINUX_LOAD_FILE,
-                   SELinuxPatch::PreBoot);
+    patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                          util::SELINUX_LOAD_FILE, SELinuxPatch::PreBoot,
+                          SEPOLICY_CACHE_DIR);
+
+    boot_timeline_mark("pre_boot_sepolicy");
 
     // Mount ROM (bind mount directory or mount images, etc.)
     if (!mount_rom(rom)) {
@@ -1311,6 +1394,8 @@ int init_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    boot_timeline_mark("mount_rom");
+
     std::string config_path(rom->config_path());
     RomConfig config;
     if (!config.load_file(config_path)) {
@@ -1327,6 +1412,9 @@ int init_main(int argc, char *argv[])
     if (access(FILE_CONTEXTS_BIN, R_OK) == 0) {
         fix_binary_file_contexts(FILE_CONTEXTS_BIN);
     }
+
+    boot_timeline_mark("file_contexts");
+
     write_fstab_hack(fstab.c_str());
     add_mbtool_services(config.indiv_app_sharing);
     strip_manual_mounts();
@@ -1336,6 +1424,8 @@ int init_main(int argc, char *argv[])
         disable_installd();
     }
 
+    boot_timeline_mark("ramdisk_modifications");
+
     // Data modifications
     create_layout_version();
 
@@ -1345,9 +1435,9 @@ int init_main(int argc, char *argv[])
     // Patch SELinux policy
     struct stat sb;
     if (stat(util::SELINUX_DEFAULT_POLICY_FILE, &sb) == 0) {
-        if (!patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE,
-                            util::SELINUX_DEFAULT_POLICY_FILE,
-                            SELinuxPatch::Main)) {
+        if (!patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                                   util::SELINUX_DEFAULT_POLICY_FILE,
+                                   SELinuxPatch::Main, SEPOLICY_CACHE_DIR)) {
             LOGW("%s: Failed to patch policy",
                  util::SELINUX_DEFAULT_POLICY_FILE);
             critical_failure();
@@ -1355,12 +1445,19 @@ int init_main(int argc, char *argv[])
         }
     }
 
+    boot_timeline_mark("sepolicy");
+
     // Kill uevent thread and close uevent socket
     device_close();
 
     // Kill properties service and clean up
     properties_cleanup();
 
+    boot_timeline_mark("cleanup");
+
+    // The ROM's /data is still mounted under /raw at this point
+    boot_timeline_save(get_raw_path(BOOT_TIMELINE_PATH));
+
     // Remove mbtool init symlink and restore original binary
     unlink("/init");
     rename("/init.orig", "/init");
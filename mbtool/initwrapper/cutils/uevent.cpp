@@ -49,6 +49,51 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/**
+ * Checks that a received netlink message actually originates from the kernel.
+ * On failure, the message buffer is cleared, errno is set to EIO, and -1 is
+ * returned.
+ */
+static ssize_t uevent_kernel_check(struct msghdr *hdr, ssize_t n,
+                                   bool require_group, uid_t *uid)
+{
+    struct sockaddr_nl *addr = (struct sockaddr_nl *) hdr->msg_name;
+    struct cmsghdr *cmsg;
+    struct ucred *cred;
+
+    *uid = -1;
+
+    cmsg = CMSG_FIRSTHDR(hdr);
+    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        // Ignoring netlink message with no sender credentials
+        goto out;
+    }
+
+    cred = (struct ucred *) CMSG_DATA(cmsg);
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        // Ignoring netlink message from non-root user
+        goto out;
+    }
+
+    if (addr->nl_pid != 0) {
+        // Ignore non-kernel
+        goto out;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        // Ignore unicast messages when requested
+        goto out;
+    }
+
+    return n;
+
+out:
+    // Clear residual potentially malicious data
+    bzero(hdr->msg_iov->iov_base, hdr->msg_iov->iov_len);
+    errno = EIO;
+    return -1;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     struct iovec iov = { buffer, length };
@@ -70,38 +115,56 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    struct cmsghdr *cmsg;
-    struct ucred *cred;
+    return uevent_kernel_check(&hdr, n, require_group, uid);
+}
 
-    cmsg = CMSG_FIRSTHDR(&hdr);
-    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        // Ignoring netlink message with no sender credentials
-        goto out;
+/**
+ * Like uevent_kernel_multicast_recv(), but receives up to \a count messages
+ * with a single recvmmsg() call. \a buffers must point to \a count buffers of
+ * \a length bytes each.
+ *
+ * Returns the number of messages received or the recvmmsg() error. For each
+ * message, \a lengths will contain the message size or -1 if the message did
+ * not originate from the kernel (in which case the buffer is cleared).
+ */
+int uevent_kernel_multicast_recv_batch(int socket, void **buffers,
+                                       size_t length, ssize_t *lengths,
+                                       unsigned int count)
+{
+    struct iovec iovs[UEVENT_RECV_BATCH_MAX];
+    struct sockaddr_nl addrs[UEVENT_RECV_BATCH_MAX];
+    char controls[UEVENT_RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+    struct mmsghdr hdrs[UEVENT_RECV_BATCH_MAX];
+
+    if (count > UEVENT_RECV_BATCH_MAX) {
+        count = UEVENT_RECV_BATCH_MAX;
     }
 
-    cred = (struct ucred *) CMSG_DATA(cmsg);
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        // Ignoring netlink message from non-root user
-        goto out;
+    memset(hdrs, 0, sizeof(hdrs[0]) * count);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        iovs[i].iov_base = buffers[i];
+        iovs[i].iov_len = length;
+        hdrs[i].msg_hdr.msg_name = &addrs[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_control = controls[i];
+        hdrs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
 
-    if (addr.nl_pid != 0) {
-        // Ignore non-kernel
-        goto out;
+    int n = recvmmsg(socket, hdrs, count, 0, nullptr);
+    if (n <= 0) {
+        return n;
     }
-    if (require_group && addr.nl_groups == 0) {
-        // Ignore unicast messages when requested
-        goto out;
+
+    for (int i = 0; i < n; ++i) {
+        uid_t uid;
+        lengths[i] = uevent_kernel_check(&hdrs[i].msg_hdr, hdrs[i].msg_len,
+                                         true, &uid);
     }
 
     return n;
-
-out:
-    // Clear residual potentially malicious data
-    bzero(buffer, length);
-    errno = EIO;
-    return -1;
 }
 
 int uevent_open_socket(int buf_sz, bool passcred)
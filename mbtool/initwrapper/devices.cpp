@@ -17,8 +17,15 @@
 
 #include "initwrapper/devices.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string_view>
+#include <unordered_set>
 
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 
@@ -36,6 +43,7 @@
 #include "mblog/logging.h"
 #include "mbutil/cmdline.h"
 #include "mbutil/directory.h"
+#include "mbutil/path.h"
 #include "mbutil/string.h"
 #include "mbutil/external/system_properties.h"
 
@@ -48,6 +56,9 @@
 
 #define UEVENT_LOGGING 0
 
+// Number of uevent files to poke before draining the netlink socket
+#define COLDBOOT_BATCH_SIZE 32
+
 static std::string bootdevice;
 static int device_fd = -1;
 static int pipe_fd[2];
@@ -55,6 +66,13 @@ static volatile bool run_thread = true;
 static pthread_t thread;
 static bool dry_run = false;
 
+// sysfs directories that were already triggered by the targeted coldboot
+static std::unordered_set<std::string> coldboot_triggered;
+static unsigned int coldboot_pending = 0;
+static bool coldboot_done = false;
+static std::mutex coldboot_done_guard;
+static std::condition_variable coldboot_done_cv;
+
 struct uevent {
     const char *action;
     const char *path;
@@ -67,16 +85,27 @@ struct uevent {
     int minor;
 };
 
+// Platform devices are stored in a trie keyed on the devpath components so
+// that finding the platform devices containing a device doesn't require
+// scanning every known platform device
 struct platform_node {
-    char *name;
-    char *path;
+    std::string path;   // Interned devpath (empty if not a platform device)
+    const char *name;   // Points into path
     int path_len;
+    std::map<std::string, std::unique_ptr<platform_node>, std::less<>> children;
 };
 
-static std::vector<platform_node> platform_names;
+static platform_node platform_root;
 
 static std::unordered_map<std::string, BlockDevInfo> block_dev_mappings;
+// Device node and symlink paths -> sysfs path
+static std::unordered_map<std::string, std::string> block_dev_links;
+// Partition names -> sysfs path
+static std::unordered_map<std::string, std::string> block_dev_names;
+// sysfs paths of added block devices in the order they were added
+static std::vector<std::string> block_dev_added;
 static std::mutex block_dev_mappings_guard;
+static std::condition_variable block_dev_mappings_cv;
 
 static mode_t get_device_perm(const char *path,
                               const std::vector<std::string> &links,
@@ -122,66 +151,114 @@ static void make_device(const char *path,
     }
 }
 
+/*
+ * Call func(node, component_end) for each trie node along the given path,
+ * creating the nodes if requested. Stops when func returns false or when a
+ * node does not exist.
+ */
+template<typename Fn>
+static void walk_platform_nodes(const char *path, bool create, Fn func)
+{
+    platform_node *node = &platform_root;
+    const char *p = path;
+
+    while (*p == '/') {
+        const char *start = p + 1;
+        const char *end = start + strcspn(start, "/");
+        std::string_view component(start, static_cast<size_t>(end - start));
+
+        auto it = node->children.find(component);
+        if (it == node->children.end()) {
+            if (!create) {
+                return;
+            }
+            it = node->children.emplace(
+                    std::string(component),
+                    std::make_unique<platform_node>()).first;
+        }
+
+        node = it->second.get();
+        p = end;
+
+        if (!func(node, p)) {
+            return;
+        }
+    }
+}
+
 static void add_platform_device(const char *path)
 {
-    int path_len = strlen(path);
-    const char *name = path;
+    walk_platform_nodes(path, true, [&](platform_node *node, const char *end) {
+        if (*end) {
+            return true;
+        }
 
-    if (strncmp(path, "/devices/", 9) == 0) {
-        name += 9;
-        if (strncmp(name, "platform/", 9) == 0) {
+        // The targeted and full coldboot may both trigger the same device
+        if (!node->path.empty()) {
+            return false;
+        }
+
+        const char *name = path;
+
+        if (strncmp(path, "/devices/", 9) == 0) {
             name += 9;
+            if (strncmp(name, "platform/", 9) == 0) {
+                name += 9;
+            }
         }
-    }
 
 #if UEVENT_LOGGING
-    LOGI("Adding platform device %s (%s)", name, path);
+        LOGI("Adding platform device %s (%s)", name, path);
 #endif
 
-    platform_names.emplace_back();
-    struct platform_node &bus = platform_names.back();
-    bus.path = strdup(path);
-    bus.path_len = path_len;
-    bus.name = bus.path + (name - path);
+        node->path = path;
+        node->path_len = static_cast<int>(node->path.size());
+        node->name = node->path.c_str() + (name - path);
+        return false;
+    });
 }
 
 /*
- * Given a path that may start with a platform device, find the length of the
- * platform device prefix.  If it doesn't start with a platform device, return
- * 0.
+ * Given a path that may start with a platform device, find the platform
+ * devices that it is contained in, from the innermost to the outermost.
  */
 static std::vector<struct platform_node *> find_platform_devices(const char *path)
 {
     std::vector<struct platform_node *> nodes;
-    int path_len = strlen(path);
-
-    for (auto it = platform_names.rbegin(); it != platform_names.rend(); ++it) {
-        struct platform_node &bus = *it;
 
-        if ((bus.path_len < path_len) &&
-                (path[bus.path_len] == '/') &&
-                strncmp(path, bus.path, bus.path_len) == 0) {
-            nodes.push_back(&bus);
+    walk_platform_nodes(path, false, [&](platform_node *node, const char *end) {
+        // The device itself does not count
+        if (!*end) {
+            return false;
         }
-    }
+        if (!node->path.empty()) {
+            nodes.push_back(node);
+        }
+        return true;
+    });
+
+    std::reverse(nodes.begin(), nodes.end());
 
     return nodes;
 }
 
 static void remove_platform_device(const char *path)
 {
-    for (auto it = platform_names.rbegin(); it != platform_names.rend(); ++it) {
-        const struct platform_node &bus = *it;
+    walk_platform_nodes(path, false, [&](platform_node *node, const char *end) {
+        if (*end) {
+            return true;
+        }
 
-        if (strcmp(path, bus.path) == 0) {
+        if (!node->path.empty()) {
 #if UEVENT_LOGGING
-            LOGI("Removing platform device %s", bus.name);
+            LOGI("Removing platform device %s", node->name);
 #endif
-            free(bus.path);
-            platform_names.erase((it + 1).base());
-            return;
+            node->path.clear();
+            node->name = nullptr;
+            node->path_len = 0;
         }
-    }
+        return false;
+    });
 }
 
 /*
@@ -593,12 +670,30 @@ static void handle_block_device_event(struct uevent *uevent)
             info.partition_name = uevent->partition_name;
         }
 
-        std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
-        block_dev_mappings.emplace(
-                std::make_pair(uevent->path, std::move(info)));
+        {
+            std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
+            block_dev_mappings.insert_or_assign(uevent->path, std::move(info));
+            block_dev_links.insert_or_assign(devpath, uevent->path);
+            for (const std::string &link : links) {
+                block_dev_links.insert_or_assign(link, uevent->path);
+            }
+            if (uevent->partition_name) {
+                block_dev_names.insert_or_assign(
+                        uevent->partition_name, uevent->path);
+            }
+            block_dev_added.push_back(uevent->path);
+        }
+        block_dev_mappings_cv.notify_all();
     } else if (strcmp(uevent->action, "remove") == 0) {
         std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
         block_dev_mappings.erase(uevent->path);
+        block_dev_links.erase(devpath);
+        for (const std::string &link : links) {
+            block_dev_links.erase(link);
+        }
+        if (uevent->partition_name) {
+            block_dev_names.erase(uevent->partition_name);
+        }
     }
 }
 
@@ -741,26 +836,42 @@ static void handle_device_event(struct uevent *uevent)
 #define UEVENT_MSG_LEN  2048
 void handle_device_fd()
 {
-    char msg[UEVENT_MSG_LEN + 2];
-    int n;
-    while ((n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN)) > 0) {
-        if (n >= UEVENT_MSG_LEN) {
-            // overflow -- discard
-            continue;
-        }
+    // Only ever called from one thread at a time: the main thread during the
+    // targeted coldboot and the uevent thread afterwards
+    static char msgs[UEVENT_RECV_BATCH_MAX][UEVENT_MSG_LEN + 2];
+    void *buffers[UEVENT_RECV_BATCH_MAX];
+    ssize_t lengths[UEVENT_RECV_BATCH_MAX];
+    int count;
+
+    for (int i = 0; i < UEVENT_RECV_BATCH_MAX; ++i) {
+        buffers[i] = msgs[i];
+    }
 
-        msg[n] = '\0';
-        msg[n + 1] = '\0';
+    while ((count = uevent_kernel_multicast_recv_batch(
+            device_fd, buffers, UEVENT_MSG_LEN, lengths,
+            UEVENT_RECV_BATCH_MAX)) > 0) {
+        for (int i = 0; i < count; ++i) {
+            char *msg = msgs[i];
+            ssize_t n = lengths[i];
 
-        struct uevent uevent;
-        parse_event(msg, &uevent);
+            if (n <= 0 || n >= UEVENT_MSG_LEN) {
+                // rejected or overflow -- discard
+                continue;
+            }
 
-        if (uevent.path && strstr(uevent.path, "sec-battery")) {
-            // sec-battery causes boot delays on the Galaxy S4
-            continue;
-        }
+            msg[n] = '\0';
+            msg[n + 1] = '\0';
+
+            struct uevent uevent;
+            parse_event(msg, &uevent);
+
+            if (uevent.path && strstr(uevent.path, "sec-battery")) {
+                // sec-battery causes boot delays on the Galaxy S4
+                continue;
+            }
 
-        handle_device_event(&uevent);
+            handle_device_event(&uevent);
+        }
     }
 }
 
@@ -769,26 +880,44 @@ void handle_device_fd()
  * to cause the kernel to regenerate device add events that happened
  * before init's device manager was started
  *
- * We drain any pending events from the netlink socket every time
- * we poke another uevent file to make sure we don't overrun the
+ * We drain any pending events from the netlink socket every
+ * COLDBOOT_BATCH_SIZE uevent files to make sure we don't overrun the
  * socket's buffer.
  */
 
-static void do_coldboot(DIR *d)
+static void coldboot_flush()
+{
+    if (coldboot_pending > 0) {
+        handle_device_fd();
+        coldboot_pending = 0;
+    }
+}
+
+static void coldboot_trigger(int dfd)
+{
+    int fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        write(fd, "add\n", 4);
+        close(fd);
+
+        if (++coldboot_pending >= COLDBOOT_BATCH_SIZE) {
+            coldboot_flush();
+        }
+    }
+}
+
+static void do_coldboot(DIR *d, std::string &path)
 {
     struct dirent *de;
     int dfd, fd;
 
     dfd = dirfd(d);
 
-    fd = openat(dfd, "uevent", O_WRONLY);
-    if (fd >= 0) {
-        write(fd, "add\n", 4);
-        close(fd);
-        handle_device_fd();
+    if (coldboot_triggered.find(path) == coldboot_triggered.end()) {
+        coldboot_trigger(dfd);
     }
 
-    while ((de = readdir(d))) {
+    while (run_thread && (de = readdir(d))) {
         DIR *d2;
 
         if (de->d_type != DT_DIR || de->d_name[0] == '.') {
@@ -804,8 +933,14 @@ static void do_coldboot(DIR *d)
         if (d2 == 0) {
             close(fd);
         } else {
-            do_coldboot(d2);
+            size_t old_size = path.size();
+            path += '/';
+            path += de->d_name;
+
+            do_coldboot(d2, path);
             closedir(d2);
+
+            path.resize(old_size);
         }
     }
 }
@@ -814,13 +949,89 @@ static void coldboot(const char *path)
 {
     DIR *d = opendir(path);
     if (d) {
-        do_coldboot(d);
+        std::string buf(path);
+        do_coldboot(d, buf);
         closedir(d);
     }
+
+    coldboot_flush();
+}
+
+/*
+ * Targeted coldboot only pokes the block devices and their parent devices
+ * (eg. the platform devices providing the by-name symlinks) so that the fstab
+ * can be mounted without waiting for the rest of /sys to be walked. Parents
+ * are triggered top-down so their events are handled before the block devices'
+ * events.
+ */
+static void coldboot_block_devices()
+{
+    DIR *d = opendir("/sys/class/block");
+    if (!d) {
+        return;
+    }
+
+    struct dirent *de;
+    char link_path[PATH_MAX];
+    char real_path[PATH_MAX];
+
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(link_path, sizeof(link_path), "/sys/class/block/%s",
+                 de->d_name);
+        if (!realpath(link_path, real_path)
+                || strncmp(real_path, "/sys/devices/", 13) != 0) {
+            continue;
+        }
+
+        // Trigger every ancestor below /sys/devices/, then the device itself
+        for (char *p = real_path + 13; ; ++p) {
+            bool last = *p == '\0';
+            if (!last && *p != '/') {
+                continue;
+            }
+
+            *p = '\0';
+
+            if (coldboot_triggered.emplace(real_path).second) {
+                int fd = open(real_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd >= 0) {
+                    coldboot_trigger(fd);
+                    close(fd);
+                }
+            }
+
+            if (last) {
+                break;
+            }
+            *p = '/';
+        }
+    }
+
+    closedir(d);
+
+    coldboot_flush();
 }
 
 void * device_thread(void *)
 {
+    // Walk the rest of /sys. Devices handled by the targeted coldboot are
+    // skipped.
+    coldboot("/sys/class");
+    coldboot("/sys/block");
+    coldboot("/sys/devices");
+
+    coldboot_triggered.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(coldboot_done_guard);
+        coldboot_done = true;
+    }
+    coldboot_done_cv.notify_all();
+
     struct pollfd fds[2];
     fds[0].fd = pipe_fd[0];
     fds[0].events = POLLIN;
@@ -858,23 +1069,34 @@ void device_init(bool dry_run_)
         }
     }
 
-    // Is 256K enough? udev uses 16MB!
-    device_fd = uevent_open_socket(256 * 1024, true);
+    coldboot_done = true;
+
+    // Is 1M enough? udev uses 16MB!
+    device_fd = uevent_open_socket(1024 * 1024, true);
     if (device_fd < 0) {
         return;
     }
 
     fcntl(device_fd, F_SETFL, O_NONBLOCK);
 
-    coldboot("/sys/class");
-    coldboot("/sys/block");
-    coldboot("/sys/devices");
-
     run_thread = true;
+
+    // Block devices are needed right away for mounting the fstab. Everything
+    // else is coldbooted by the uevent thread.
+    coldboot_triggered.clear();
+    coldboot_block_devices();
+
+    coldboot_done = false;
     pipe(pipe_fd);
     pthread_create(&thread, nullptr, &device_thread, nullptr);
 }
 
+void device_wait_coldboot()
+{
+    std::unique_lock<std::mutex> lock(coldboot_done_guard);
+    coldboot_done_cv.wait(lock, []{ return coldboot_done; });
+}
+
 void device_close()
 {
     run_thread = false;
@@ -898,3 +1120,83 @@ std::unordered_map<std::string, BlockDevInfo> get_block_dev_mappings()
     std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
     return block_dev_mappings;
 }
+
+size_t get_block_dev_mappings_since(
+        size_t generation,
+        std::vector<std::pair<std::string, BlockDevInfo>> &added)
+{
+    std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
+
+    for (size_t i = generation; i < block_dev_added.size(); ++i) {
+        // Skip devices that were removed in the meantime
+        auto it = block_dev_mappings.find(block_dev_added[i]);
+        if (it != block_dev_mappings.end()) {
+            added.emplace_back(*it);
+        }
+    }
+
+    return block_dev_added.size();
+}
+
+bool wait_for_block_dev_mappings(size_t generation,
+                                 std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(block_dev_mappings_guard);
+    return block_dev_mappings_cv.wait_for(lock, timeout, [&]{
+        return block_dev_added.size() > generation;
+    });
+}
+
+bool wait_for_block_dev(const std::string &path,
+                        std::chrono::milliseconds timeout)
+{
+    return wait_for_block_devs({ path }, timeout);
+}
+
+/*
+ * Each item is either a block device node or symlink path (eg.
+ * /dev/block/platform/msm_sdcc.1/by-name/system) or a partition name (eg.
+ * system).
+ */
+bool wait_for_block_devs(const std::vector<std::string> &items,
+                         std::chrono::milliseconds timeout)
+{
+    if (device_fd < 0) {
+        // Not managing devices, so there's nothing to be notified about. Only
+        // paths can be checked.
+        auto until = std::chrono::steady_clock::now() + timeout;
+
+        for (const std::string &item : items) {
+            if (item.empty() || item[0] != '/') {
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (!mb::util::wait_for_path(item, until > now
+                    ? std::chrono::duration_cast<std::chrono::milliseconds>(
+                            until - now)
+                    : std::chrono::milliseconds(0))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(block_dev_mappings_guard);
+    return block_dev_mappings_cv.wait_for(lock, timeout, [&]{
+        for (const std::string &item : items) {
+            if (!item.empty() && item[0] == '/') {
+                // Also check the filesystem in case the path wasn't created
+                // by us (eg. a symlink to the block device)
+                if (block_dev_links.find(item) == block_dev_links.end()
+                        && access(item.c_str(), F_OK) < 0) {
+                    return false;
+                }
+            } else if (block_dev_names.find(item) == block_dev_names.end()) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
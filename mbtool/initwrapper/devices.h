@@ -17,8 +17,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <sys/stat.h>
 
@@ -33,7 +36,23 @@ struct BlockDevInfo
 
 void handle_device_fd();
 void device_init(bool dry_run);
+void device_wait_coldboot();
 void device_close();
 int get_device_fd();
 
 std::unordered_map<std::string, BlockDevInfo> get_block_dev_mappings();
+
+// Appends the sysfs path -> block device mappings added since the given
+// generation (starting at 0) and returns the new generation
+size_t get_block_dev_mappings_since(
+        size_t generation,
+        std::vector<std::pair<std::string, BlockDevInfo>> &added);
+// Waits until block devices were added after the given generation
+bool wait_for_block_dev_mappings(size_t generation,
+                                 std::chrono::milliseconds timeout);
+// Waits until a block device node or symlink exists
+bool wait_for_block_dev(const std::string &path,
+                        std::chrono::milliseconds timeout);
+// Waits until all of the block device paths or partition names are available
+bool wait_for_block_devs(const std::vector<std::string> &items,
+                         std::chrono::milliseconds timeout);
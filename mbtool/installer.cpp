@@ -22,6 +22,7 @@
 // C++
 #include <algorithm>
 #include <chrono>
+#include <thread>
 
 // C
 #include <cstring>
@@ -30,10 +31,14 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/file.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -78,6 +83,7 @@
 #include "signature.h"
 #include "romconfig.h"
 #include "switcher.h"
+#include "update_binary_tool.h"
 #include "wipe.h"
 
 #define LOG_TAG "mbtool/installer"
@@ -102,6 +108,13 @@
 
 #define HELPER_TOOL             "/update-binary-tool"
 
+// Must not have the chroot path as a prefix since util::unmount_all() does
+// dumb string prefix matching
+#define CHROOT_SKELETON_DIR     "/mb_chroot_skel"
+#define CHROOT_SKELETON_RO_DIR  CHROOT_SKELETON_DIR "/lower"
+#define CHROOT_SKELETON_RW_DIR  CHROOT_SKELETON_DIR "/rw"
+#define CHROOT_SKELETON_STAMP   CHROOT_SKELETON_RO_DIR "/.complete"
+
 
 using namespace mb::device;
 
@@ -124,6 +137,7 @@ Installer::Installer(std::string zip_file, std::string chroot_dir,
     , _output_fd(output_fd)
     , _flags(flags)
     , _ran(false)
+    , _chroot_overlay(false)
 {
     _passthrough = _output_fd >= 0;
 
@@ -219,6 +233,38 @@ static bool log_copy_dir(const std::string &source,
     return true;
 }
 
+/*!
+ * \brief Create the directory layout and copy of /sbin for a chroot at \p root
+ */
+static bool populate_chroot_root(const std::string &root)
+{
+    static constexpr const char *dirs[] = {
+        "/mb", "/dev", "/etc", "/proc", "/sbin", "/sys", "/tmp", "/data",
+        "/cache", "/system", "/firmware", "/efs",
+    };
+
+    for (auto const &dir : dirs) {
+        if (log_mkdir((root + dir).c_str(), 0755) < 0) {
+            return false;
+        }
+    }
+
+    // Copy the contents of sbin since we need to mess with some of the binaries
+    // there. Also, for whatever reason, bind mounting /sbin results in EINVAL
+    // no matter if it's done from here or from busybox.
+    if (!log_copy_dir("/sbin", root + "/sbin",
+                      util::CopyFlag::CopyAttributes
+                    | util::CopyFlag::CopyXattrs
+                    | util::CopyFlag::ExcludeTopLevel)) {
+        return false;
+    }
+
+    // Remove reboot binary
+    remove((root + "/sbin/reboot").c_str());
+
+    return true;
+}
+
 
 /*
  * Helper functions
@@ -234,7 +280,9 @@ void Installer::output_cb(const char *line, bool error, void *userdata)
 
 int Installer::run_command(const std::vector<std::string> &argv)
 {
-    return util::run_command(
+    InstallProfile::Sample start;
+
+    int status = util::run_command(
         argv[0],
         argv,
         {},
@@ -242,12 +290,19 @@ int Installer::run_command(const std::vector<std::string> &argv)
         _passthrough ? nullptr : &output_cb,
         this
     );
+
+    _profile.add_command(argv, status >= 0 && WIFEXITED(status)
+            ? WEXITSTATUS(status) : -1, start);
+
+    return status;
 }
 
 int Installer::run_command_chroot(const std::string &dir,
                                   const std::vector<std::string> &argv)
 {
-    return util::run_command(
+    InstallProfile::Sample start;
+
+    int status = util::run_command(
         argv[0],
         argv,
         {},
@@ -255,6 +310,11 @@ int Installer::run_command_chroot(const std::string &dir,
         _passthrough ? nullptr : &output_cb,
         this
     );
+
+    _profile.add_command(argv, status >= 0 && WIFEXITED(status)
+            ? WEXITSTATUS(status) : -1, start);
+
+    return status;
 }
 
 std::string Installer::in_chroot(const std::string &path) const
@@ -266,6 +326,81 @@ std::string Installer::in_chroot(const std::string &path) const
     }
 }
 
+/*!
+ * \brief Mount the chroot as an overlay on top of a cached skeleton
+ *
+ * The skeleton is kept in a read-only tmpfs that is populated once per boot, so
+ * back-to-back installs don't need to copy /sbin again. Each install gets a
+ * fresh tmpfs for the overlay's upper layer.
+ *
+ * \return Whether the overlay was mounted. The caller should create the chroot
+ *         from scratch if this fails (eg. the kernel has no overlayfs).
+ */
+bool Installer::mount_chroot_overlay()
+{
+    // Clean up after a previous install that didn't exit cleanly
+    if (auto r = util::unmount_all(CHROOT_SKELETON_RW_DIR); !r) {
+        LOGW("Failed to unmount %s: %s", CHROOT_SKELETON_RW_DIR,
+             r.error().message().c_str());
+        return false;
+    }
+
+    if (access(CHROOT_SKELETON_STAMP, F_OK) < 0) {
+        LOGD("Populating chroot skeleton in %s", CHROOT_SKELETON_RO_DIR);
+
+        InstallProfile::Sample skel_start;
+
+        // Start over if a previous attempt was interrupted
+        if (!log_unmount_all(CHROOT_SKELETON_DIR)
+                || !log_delete_recursive(CHROOT_SKELETON_DIR)) {
+            return false;
+        }
+
+        if (log_mkdir(CHROOT_SKELETON_DIR, 0700) < 0
+                || log_mkdir(CHROOT_SKELETON_RO_DIR, 0755) < 0
+                || log_mkdir(CHROOT_SKELETON_RW_DIR, 0700) < 0
+                || log_mount("tmpfs", CHROOT_SKELETON_RO_DIR, "tmpfs", 0,
+                             "mode=0755") < 0
+                || !populate_chroot_root(CHROOT_SKELETON_RO_DIR)
+                || !util::create_empty_file(CHROOT_SKELETON_STAMP)
+                || log_mount("", CHROOT_SKELETON_RO_DIR, "",
+                             MS_REMOUNT | MS_RDONLY, "") < 0) {
+            (void) util::unmount_all(CHROOT_SKELETON_DIR);
+            return false;
+        }
+
+        _profile.add_step("populate_chroot_skeleton", skel_start);
+    }
+
+    std::string upper(CHROOT_SKELETON_RW_DIR "/upper");
+    std::string work(CHROOT_SKELETON_RW_DIR "/work");
+    std::string options("lowerdir=" CHROOT_SKELETON_RO_DIR ",upperdir=");
+    options += upper;
+    options += ",workdir=";
+    options += work;
+
+    if (log_mount("tmpfs", CHROOT_SKELETON_RW_DIR, "tmpfs", 0,
+                  "mode=0700") < 0) {
+        return false;
+    }
+
+    if (log_mkdir(upper.c_str(), 0755) < 0
+            || log_mkdir(work.c_str(), 0700) < 0) {
+        log_umount(CHROOT_SKELETON_RW_DIR);
+        return false;
+    }
+
+    if (mount("overlay", _chroot.c_str(), "overlay", 0, options.c_str()) < 0) {
+        LOGW("Failed to mount overlay at %s: %s",
+             _chroot.c_str(), strerror(errno));
+        log_umount(CHROOT_SKELETON_RW_DIR);
+        return false;
+    }
+
+    LOGD("Mounted chroot on top of skeleton in %s", CHROOT_SKELETON_RO_DIR);
+    return true;
+}
+
 bool Installer::create_chroot()
 {
     // We'll just call the recovery's mount tools directly to avoid having to
@@ -297,26 +432,18 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // Create chroot and mount tmpfs there
-    if (log_mkdir(_chroot.c_str(), 0700) < 0
-            || log_mount("tmpfs", _chroot.c_str(), "tmpfs", 0, "") < 0) {
+    if (log_mkdir(_chroot.c_str(), 0700) < 0) {
         return false;
     }
 
-    // Create remaining directories
-    if (log_mkdir(in_chroot("/mb").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/dev").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/etc").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/proc").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/sbin").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/sys").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/tmp").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/data").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/cache").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/system").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/firmware").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/efs").c_str(), 0755) < 0) {
-        return false;
+    // Mount the chroot on top of the cached skeleton if possible. Otherwise,
+    // create it from scratch in a tmpfs.
+    _chroot_overlay = mount_chroot_overlay();
+    if (!_chroot_overlay) {
+        if (log_mount("tmpfs", _chroot.c_str(), "tmpfs", 0, "") < 0
+                || !populate_chroot_root(_chroot)) {
+            return false;
+        }
     }
 
     // Other mounts
@@ -339,19 +466,6 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // Copy the contents of sbin since we need to mess with some of the binaries
-    // there. Also, for whatever reason, bind mounting /sbin results in EINVAL
-    // no matter if it's done from here or from busybox.
-    if (!log_copy_dir("/sbin", in_chroot("/sbin"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
-        return false;
-    }
-
-    // Remove reboot binary
-    remove(in_chroot("/sbin/reboot").c_str());
-
     // Don't create unnecessary special files in /dev to avoid install scripts
     // from overwriting partitions
     if (log_mknod(in_chroot("/dev/console").c_str(), S_IFCHR | 0644, makedev(5, 1)) < 0
@@ -395,7 +509,10 @@ bool Installer::create_chroot()
     }
 
     // Mount EFS partition so patched Odin images can properly set up multi-CSC
-    if (!mount_efs()) {
+    InstallProfile::Sample efs_start;
+    bool efs_ret = mount_efs();
+    _profile.add_step("mount_efs", efs_start);
+    if (!efs_ret) {
         return false;
     }
 
@@ -404,8 +521,42 @@ bool Installer::create_chroot()
     return true;
 }
 
+/*!
+ * \brief Wait for update-binary-tool to finish deleting formatted files
+ *
+ * `format()` moves the old files aside and deletes them in a detached process
+ * that keeps the bind mounts busy until it is done.
+ */
+static void wait_for_background_format(const std::string &lock_path)
+{
+    int fd = open(lock_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // Nothing was formatted
+        return;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        return;
+    }
+
+    LOGD("Waiting for formatted files to be deleted");
+
+    while (flock(fd, LOCK_EX) < 0) {
+        if (errno != EINTR) {
+            LOGW("%s: Failed to lock: %s", lock_path.c_str(), strerror(errno));
+            return;
+        }
+    }
+}
+
 bool Installer::destroy_chroot() const
 {
+    wait_for_background_format(in_chroot(CHROOT_FORMAT_LOCK_FILE));
+
     // Disassociate loop devices that the ROM installer may have assigned
     // (grr, SuperSU...)
     std::string dev_block_path(in_chroot("/dev/block"));
@@ -444,6 +595,12 @@ bool Installer::destroy_chroot() const
         return false;
     }
 
+    // Throw away the overlay's upper layer. The skeleton itself is kept for
+    // the next install.
+    if (_chroot_overlay) {
+        log_umount(CHROOT_SKELETON_RW_DIR);
+    }
+
     (void) util::delete_recursive(_chroot);
 
     if (log_is_mounted("/efs")) {
@@ -505,17 +662,15 @@ bool Installer::mount_efs() const
         } else {
             LOGE("Looking for /efs entry in non-TWRP-format fstab");
 
-            if (auto recs = util::read_fstab("/etc/recovery.fstab")) {
-                for (auto const &rec : recs.value()) {
-                    if (util::path_compare(rec.mount_point, "/efs") == 0) {
-                        LOGD("Found /efs fstab entry");
-                        efs_dev = rec.blk_device;
-                        break;
-                    }
+            if (auto fstab = util::Fstab::load("/etc/recovery.fstab")) {
+                auto const &entries = fstab.value().find_mount_point("/efs");
+                if (!entries.empty()) {
+                    LOGD("Found /efs fstab entry");
+                    efs_dev = entries.front()->blk_device;
                 }
             } else {
                 LOGW("/etc/recovery.fstab: Failed to read fstab: %s",
-                     recs.error().message().c_str());
+                     fstab.error().message().c_str());
             }
         }
 
@@ -544,6 +699,15 @@ bool Installer::mount_efs() const
 /*!
  * \brief Extract needed multiboot files from the patched zip file
  */
+bool Installer::load_zip_index()
+{
+    if (_zip_index.loaded()) {
+        return true;
+    }
+
+    return _zip_index.load(_zip_file);
+}
+
 bool Installer::extract_multiboot_files()
 {
     std::vector<util::ExtractInfo> files{
@@ -595,30 +759,26 @@ bool Installer::extract_multiboot_files()
         });
     }
 
-    if (!util::extract_files2(_zip_file, files)) {
+    if (!load_zip_index() || !_zip_index.extract(
+            files, std::thread::hardware_concurrency())) {
         LOGE("Failed to extract all multiboot files");
         return false;
     }
 
-    std::vector<std::string> sigcheck{
+    std::vector<SigFile> sigcheck;
+
+    for (auto const &path : {
         _temp + "/mbtool",
         _temp + "/bb-wrapper.sh",
         _temp + "/binaries/file-contexts-tool",
         _temp + "/binaries/fsck-wrapper",
         _temp + "/binaries/mbtool",
         _temp + "/binaries/mount.exfat",
-    };
-
-    for (auto const &item : sigcheck) {
-        SigVerifyResult result =
-                verify_signature(item.c_str(), (item + ".sig").c_str());
-        if (result != SigVerifyResult::Valid) {
-            LOGE("%s: Signature verification failed", item.c_str());
-            return false;
-        }
+    }) {
+        sigcheck.push_back({path, path + ".sig"});
     }
 
-    return true;
+    return verify_signatures(sigcheck);
 }
 
 /*!
@@ -732,11 +892,42 @@ bool Installer::system_image_copy(const std::string &source,
     return true;
 }
 
+/*!
+ * \brief Check if the zip's block image doesn't need the current system files
+ *
+ * Copying the system directory to the temporary image is pointless if the
+ * updater is going to overwrite every block of it anyway.
+ */
+bool Installer::block_image_replaces_system()
+{
+    if (!_has_block_image || !load_zip_index()
+            || !_zip_index.find("system.transfer.list")) {
+        return false;
+    }
+
+    std::string path(_temp);
+    path += "/system.transfer.list";
+
+    auto remove_list = finally([&] {
+        remove(path.c_str());
+    });
+
+    if (!_zip_index.extract({ { "system.transfer.list", path } })) {
+        LOGW("Failed to extract system.transfer.list");
+        return false;
+    }
+
+    return InstallerUtil::is_full_transfer_list(path);
+}
+
 /*!
  * \brief Bind mount directory or create and mount image
  *
  * \param source Source path (directory or image file)
  * \param bind_target Mount point for bind mount (if \a is_image is false)
+ * \param parent_target Mount point for bind mount of \a source's parent
+ *                      directory (if \a is_image is false and the parent is on
+ *                      the same filesystem)
  * \param loop_target Path to create loop device (if \a is_image is true)
  * \param is_image Whether \a source is an image file
  * \param image_size Desired image size (only used if \a is_image is true and
@@ -744,6 +935,7 @@ bool Installer::system_image_copy(const std::string &source,
  */
 bool Installer::mount_dir_or_image(const std::string &source,
                                    const std::string &bind_target,
+                                   const std::string &parent_target,
                                    const std::string &loop_target,
                                    bool is_image,
                                    uint64_t image_size)
@@ -770,7 +962,8 @@ bool Installer::mount_dir_or_image(const std::string &source,
             return false;
         }
         if (auto ret = util::loopdev_set_up_device(
-                loopdev.value(), source, 0, false); !ret) {
+                loopdev.value(), source, 0, false,
+                util::LoopdevFlag::DirectIo); !ret) {
             LOGE("Failed to attach %s to %s: %s",
                  loopdev.value().c_str(), source.c_str(),
                  ret.error().message().c_str());
@@ -790,6 +983,23 @@ bool Installer::mount_dir_or_image(const std::string &source,
                         source.c_str(), bind_target.c_str());
             return false;
         }
+
+        // Give update-binary-tool a place outside of the bind mount, but on
+        // the same filesystem, to move formatted files to. Without it, they
+        // are deleted before the format returns.
+        std::string parent = util::dir_name(source);
+        struct stat sb;
+        struct stat parent_sb;
+        if (stat(source.c_str(), &sb) == 0
+                && stat(parent.c_str(), &parent_sb) == 0
+                && sb.st_dev == parent_sb.st_dev) {
+            if (!util::mkdir_recursive(parent_target, 0771)
+                    || mount(parent.c_str(), parent_target.c_str(),
+                             "", MS_BIND, "") < 0) {
+                LOGW("Failed to bind mount %s to %s: %s",
+                     parent.c_str(), parent_target.c_str(), strerror(errno));
+            }
+        }
     }
 
     return true;
@@ -873,72 +1083,161 @@ bool Installer::set_up_legacy_properties()
     return true;
 }
 
-bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+void Installer::updater_command(std::string line)
 {
-    int status;
-    pid_t pid = fork();
-
-    if (pid < 0) {
-        LOGE("Failed to fork updater fd reader process");
-    } else if (pid == 0) {
-        // Don't need command_fd in the child process
-        close(command_fd);
-
-        // Read program output in child process (stdout, stderr)
-        char buf[1024];
+    char *save_ptr;
+
+    // Similar parsing to AOSP recovery
+    char *cmd = strtok_r(line.data(), " \n", &save_ptr);
+    if (!cmd) {
+        return;
+    } else if (strcmp(cmd, "progress") == 0
+            || strcmp(cmd, "set_progress") == 0
+            || strcmp(cmd, "wipe_cache") == 0
+            || strcmp(cmd, "clear_display") == 0
+            || strcmp(cmd, "enable_reboot") == 0) {
+        // Ignore
+    } else if (strcmp(cmd, "ui_print") == 0) {
+        char *str = strtok_r(nullptr, "\n", &save_ptr);
+        if (str) {
+            updater_print(str);
+        } else {
+            updater_print("\n");
+        }
+    } else {
+        LOGE("Unknown updater command: %s", cmd);
+    }
+}
 
-        ScopedFILE fp(fdopen(stdio_fd, "rb"), fclose);
-        if (!fp) {
-            _exit(EXIT_FAILURE);
+/*!
+ * \brief Read the updater's output and commands until both pipes are closed
+ *
+ * Both fds are polled from the installer process. Data is accumulated per fd
+ * and only complete lines are dispatched, so long lines (eg. from `ui_print`)
+ * are not split up.
+ */
+bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+{
+    // Force lines this long to be dispatched to bound memory usage
+    static constexpr size_t MAX_LINE_LENGTH = 64 * 1024;
+
+    struct pollfd fds[2];
+    const size_t fds_size = sizeof(fds) / sizeof(fds[0]);
+    std::string lines[fds_size];
+    char buf[8192];
+    bool ret = true;
+
+    fds[0].fd = stdio_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = command_fd;
+    fds[1].events = POLLIN;
+
+    auto dispatch = [&](size_t i, std::string line) {
+        if (fds[i].fd == stdio_fd) {
+            command_output(line);
+        } else {
+            updater_command(std::move(line));
         }
+    };
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            command_output(buf);
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, fds_size, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll() updater fds: %s", strerror(errno));
+            return false;
         }
 
-        _exit(EXIT_SUCCESS);
-    } else {
-        // Read special command fd in parent process
+        for (size_t i = 0; i < fds_size; ++i) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP
+                    | POLLERR))) {
+                continue;
+            }
 
-        char buf[1024];
-        char *save_ptr;
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                if (n < 0) {
+                    LOGE("Failed to read updater fd: %s", strerror(errno));
+                    ret = false;
+                }
 
-        // Similar parsing to AOSP recovery
-        ScopedFILE fp(fdopen(command_fd, "rb"), fclose);
+                // EOF. Dispatch the incomplete last line, if any.
+                if (!lines[i].empty()) {
+                    dispatch(i, std::move(lines[i]));
+                    lines[i].clear();
+                }
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            char *cmd = strtok_r(buf, " \n", &save_ptr);
-            if (!cmd) {
+                fds[i].fd = -1;
+                fds[i].events = 0;
                 continue;
-            } else if (strcmp(cmd, "progress") == 0
-                    || strcmp(cmd, "set_progress") == 0
-                    || strcmp(cmd, "wipe_cache") == 0
-                    || strcmp(cmd, "clear_display") == 0
-                    || strcmp(cmd, "enable_reboot") == 0) {
-                // Ignore
-            } else if (strcmp(cmd, "ui_print") == 0) {
-                char *str = strtok_r(nullptr, "\n", &save_ptr);
-                if (str) {
-                    updater_print(str);
-                } else {
-                    updater_print("\n");
-                }
-            } else {
-                LOGE("Unknown updater command: %s", cmd);
             }
-        }
 
-        do {
-            if (waitpid(pid, &status, 0) < 0) {
-                LOGE("Failed to waitpid(): %s", strerror(errno));
-                return false;
+            std::string &line = lines[i];
+            line.append(buf, static_cast<size_t>(n));
+
+            size_t begin = 0;
+            size_t newline;
+            while ((newline = line.find('\n', begin)) != std::string::npos) {
+                dispatch(i, line.substr(begin, newline - begin + 1));
+                begin = newline + 1;
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+            line.erase(0, begin);
 
-        return true;
+            if (line.size() >= MAX_LINE_LENGTH) {
+                dispatch(i, std::move(line));
+                line.clear();
+            }
+        }
     }
 
-    return false;
+    return ret;
+}
+
+/*!
+ * \brief Create the listening socket for the resident update-binary-tool
+ *
+ * \return Socket fd or -1 if the socket could not be created
+ */
+static int create_update_binary_tool_socket(const std::string &path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOGW("%s: Socket path is too long", path.c_str());
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGW("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOGW("%s: Failed to remove stale socket: %s",
+             path.c_str(), strerror(errno));
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        LOGW("%s: Failed to bind socket: %s", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, 4) < 0) {
+        LOGW("%s: Failed to listen on socket: %s",
+             path.c_str(), strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    return fd;
 }
 
 /*!
@@ -1031,6 +1330,42 @@ bool Installer::run_real_updater()
 
     bool updater_ret = true;
 
+    // update-binary-tool is run several times per install. Keep one instance
+    // resident for the duration of the updater so that the calls just connect
+    // to it instead of going through the full mbtool startup every time. If
+    // any of this fails, the tool simply runs the action itself.
+    std::string helper_socket = in_chroot(CHROOT_UPDATE_BINARY_TOOL_SOCKET);
+    int helper_listen_fd = create_update_binary_tool_socket(helper_socket);
+    int helper_control[2] = { -1, -1 };
+    if (helper_listen_fd >= 0 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC,
+                                            0, helper_control) < 0) {
+        LOGW("Failed to create socket pair: %s", strerror(errno));
+        close(helper_listen_fd);
+        helper_listen_fd = -1;
+        unlink(helper_socket.c_str());
+    }
+
+    auto stop_helper = finally([&]{
+        if (helper_listen_fd >= 0) {
+            close(helper_listen_fd);
+        }
+        if (helper_control[1] >= 0) {
+            close(helper_control[1]);
+        }
+        if (helper_control[0] >= 0) {
+            // Ask the helper to exit and wait for its end of the socket pair
+            // to be closed
+            shutdown(helper_control[0], SHUT_WR);
+            char c;
+            ssize_t n;
+            do {
+                n = read(helper_control[0], &c, 1);
+            } while (n > 0 || (n < 0 && errno == EINTR));
+            close(helper_control[0]);
+            unlink(helper_socket.c_str());
+        }
+    });
+
     if ((pid = fork()) >= 0) {
         if (pid == 0) {
             if (!_passthrough) {
@@ -1043,6 +1378,33 @@ bool Installer::run_real_updater()
                 _exit(EXIT_FAILURE);
             }
 
+            // The helper has to be forked after entering the chroot so that
+            // it shares the updater's mount namespace
+            if (helper_listen_fd >= 0) {
+                close(helper_control[0]);
+
+                pid_t helper_pid = fork();
+                if (helper_pid == 0) {
+                    // Don't keep the updater's output pipes open
+                    if (_passthrough) {
+                        close(_output_fd);
+                    } else {
+                        close(pipe_fds[1]);
+                        close(stdio_fds[1]);
+                    }
+
+                    _exit(update_binary_tool_serve(
+                            helper_listen_fd, helper_control[1])
+                            ? EXIT_SUCCESS : EXIT_FAILURE);
+                } else if (helper_pid < 0) {
+                    LOGW("Failed to fork update-binary-tool helper: %s",
+                         strerror(errno));
+                }
+
+                close(helper_listen_fd);
+                close(helper_control[1]);
+            }
+
             if (!_passthrough) {
                 if (dup2(stdio_fds[1], STDOUT_FILENO) < 0
                         || dup2(stdio_fds[1], STDERR_FILENO) < 0) {
@@ -1074,13 +1436,20 @@ bool Installer::run_real_updater()
             LOGE("Failed to execute updater: %s", strerror(errno));
             _exit(127);
         } else {
+            if (helper_listen_fd >= 0) {
+                close(helper_listen_fd);
+                close(helper_control[1]);
+                helper_listen_fd = -1;
+                helper_control[1] = -1;
+            }
+
             if (!_passthrough) {
                 // Close write ends of the pipes
                 close(pipe_fds[1]);
                 close(stdio_fds[1]);
 
                 if (!updater_fd_reader(stdio_fds[0], pipe_fds[0])) {
-                    LOGW("Updater fd reader process failed");
+                    LOGW("Failed to read updater output");
                 }
 
                 close(pipe_fds[0]);
@@ -1275,7 +1644,7 @@ Installer::ProceedState Installer::install_stage_initialize()
         { "system.img", false },
         { "system.img.sparse", false },
     };
-    if (!util::archive_exists(_zip_file, info)) {
+    if (!load_zip_index() || !_zip_index.exists(info)) {
         LOGE("Failed to read zip file");
     } else {
         _has_block_image = false;
@@ -1324,7 +1693,10 @@ Installer::ProceedState Installer::install_stage_set_up_environment()
         return ProceedState::Fail;
     }
 
-    if (!extract_multiboot_files()) {
+    InstallProfile::Sample extract_start;
+    bool extract_ret = extract_multiboot_files();
+    _profile.add_step("extract_multiboot_files", extract_start);
+    if (!extract_ret) {
         display_msg("Failed to extract multiboot files from zip");
         return ProceedState::Fail;
     }
@@ -1578,7 +1950,7 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
     LOGV("Patching ramdisk to undo init modifications");
     std::vector<std::function<RamdiskPatcherFn>> rps{rp_restore_init()};
     if (!InstallerUtil::patch_boot_image(_boot_block_dev, _boot_block_dev,
-                                         rps)) {
+                                         rps, {{ "restore_init", {}, {}, {} }})) {
         LOGW("Failed to patch boot image. Continuing anyway...");
     }
 
@@ -1618,6 +1990,7 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 
     if (!mount_dir_or_image(_cache_path,
                             in_chroot(CHROOT_CACHE_BIND_MOUNT),
+                            in_chroot(CHROOT_CACHE_PARENT_MOUNT),
                             in_chroot(CHROOT_CACHE_LOOP_DEV),
                             _rom->cache_is_image, DEFAULT_IMAGE_SIZE)) {
         return ProceedState::Fail;
@@ -1634,6 +2007,7 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 
     if (!mount_dir_or_image(_data_path,
                             in_chroot(CHROOT_DATA_BIND_MOUNT),
+                            in_chroot(CHROOT_DATA_PARENT_MOUNT),
                             in_chroot(CHROOT_DATA_LOOP_DEV),
                             _rom->data_is_image, DEFAULT_IMAGE_SIZE)) {
         return ProceedState::Fail;
@@ -1681,6 +2055,11 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
             }
         }
 
+        if (_copy_to_temp_image && block_image_replaces_system()) {
+            LOGD("Block image overwrites the temporary image; not copying");
+            _copy_to_temp_image = false;
+        }
+
         if (_copy_to_temp_image) {
             display_msg("Copying system to temporary image");
 
@@ -1698,6 +2077,7 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 
     if (!mount_dir_or_image(system_path,
                             in_chroot(CHROOT_SYSTEM_BIND_MOUNT),
+                            in_chroot(CHROOT_SYSTEM_PARENT_MOUNT),
                             in_chroot(CHROOT_SYSTEM_LOOP_DEV),
                             system_is_image, system_size.value())) {
         return ProceedState::Fail;
@@ -1740,9 +2120,12 @@ Installer::ProceedState Installer::install_stage_installation()
     struct stat sb;
     if (lstat(in_chroot("/.skip-install").c_str(), &sb) < 0
             && errno == ENOENT) {
+        InstallProfile::Sample updater_start;
         auto start = steady_clock::now();
         updater_ret = run_real_updater();
         auto stop = steady_clock::now();
+        _profile.add_command({ "/mb/updater" }, updater_ret ? 0 : 1,
+                             updater_start);
         auto ms = duration_cast<milliseconds>(stop - start);
 
         auto h = duration_cast<hours>(ms);
@@ -1817,6 +2200,8 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     run_command_chroot(_chroot, { HELPER_TOOL, "unmount", "/cache" });
     run_command_chroot(_chroot, { HELPER_TOOL, "unmount", "/data" });
 
+    wait_for_background_format(in_chroot(CHROOT_FORMAT_LOCK_FILE));
+
     // Disassociate loop devices
     for (const std::string &loop_dev : _associated_loop_devs) {
         if (auto ret = util::loopdev_remove_device(loop_dev); !ret) {
@@ -1862,6 +2247,83 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     return on_unmounted_filesystems();
 }
 
+/*!
+ * \brief Compute a digest of the files that are copied into the ramdisk
+ *
+ * Every regular file in \p binaries_dir is hashed, along with its name, and so
+ * is \p device_json.
+ *
+ * \return Hex digest or std::nullopt if any of the files could not be read
+ */
+static std::optional<std::string>
+hash_patcher_inputs(const std::string &binaries_dir,
+                    const std::string &device_json)
+{
+    ScopedDIR dp(opendir(binaries_dir.c_str()), closedir);
+    if (!dp) {
+        LOGW("%s: Failed to open directory: %s",
+             binaries_dir.c_str(), strerror(errno));
+        return std::nullopt;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *ent;
+    struct stat sb;
+
+    while ((ent = readdir(dp.get()))) {
+        if (fstatat(dirfd(dp.get()), ent->d_name, &sb,
+                    AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb.st_mode)) {
+            names.push_back(ent->d_name);
+        }
+    }
+
+    dp.reset();
+
+    std::sort(names.begin(), names.end());
+
+    std::vector<std::string> paths;
+    for (auto const &name : names) {
+        paths.push_back(binaries_dir + "/" + name);
+    }
+    names.push_back(util::base_name(device_json));
+    paths.push_back(device_json);
+
+    auto digests = util::hash_paths(util::HashAlgorithm::Sha256, paths,
+                                    std::thread::hardware_concurrency());
+
+    util::Hasher hasher(util::HashAlgorithm::Sha256);
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!digests[i]) {
+            LOGW("%s: Failed to hash file: %s", paths[i].c_str(),
+                 digests[i].error().message().c_str());
+            return std::nullopt;
+        }
+
+        auto const &digest = digests[i].value();
+
+        // The name is NUL-terminated so that it can't run into the digest
+        auto r = hasher.update(names[i].c_str(), names[i].size() + 1);
+        if (r) {
+            r = hasher.update(digest.data(), digest.size());
+        }
+        if (!r) {
+            LOGW("Failed to hash ramdisk inputs: %s",
+                 r.error().message().c_str());
+            return std::nullopt;
+        }
+    }
+
+    auto digest = hasher.finish();
+    if (!digest) {
+        LOGW("Failed to hash ramdisk inputs: %s",
+             digest.error().message().c_str());
+        return std::nullopt;
+    }
+
+    return util::hex_string(digest.value().data(), digest.value().size());
+}
+
 Installer::ProceedState Installer::install_stage_finish()
 {
     LOGD("[Installer] Finalization stage");
@@ -1880,7 +2342,21 @@ Installer::ProceedState Installer::install_stage_finish()
         rp_add_device_json(_temp + "/device.json"),
     };
 
-    if (!InstallerUtil::patch_boot_image(_boot_block_dev, temp_boot_img, rps)) {
+    std::optional<RamdiskCacheKey> cache_key;
+    if (auto inputs = hash_patcher_inputs(_temp + "/binaries",
+                                          _temp + "/device.json")) {
+        cache_key = RamdiskCacheKey{
+            format("write_rom_id,patch_default_prop(%d),add_binaries,"
+                   "symlink_fuse_exfat,symlink_init,add_device_json",
+                   _use_fuse_exfat),
+            _rom->id,
+            _detected_device,
+            std::move(*inputs),
+        };
+    }
+
+    if (!InstallerUtil::patch_boot_image(_boot_block_dev, temp_boot_img, rps,
+                                         cache_key)) {
         display_msg("Failed to patch boot image");
         return ProceedState::Fail;
     }
@@ -1947,6 +2423,8 @@ void Installer::install_stage_cleanup(Installer::ProceedState ret)
 {
     LOGD("[Installer] Cleanup stage");
 
+    InstallProfile::Sample start;
+
     if (ret == ProceedState::Fail) {
         display_msg("Failed to flash zip file.");
     }
@@ -1969,11 +2447,43 @@ void Installer::install_stage_cleanup(Installer::ProceedState ret)
                     "reboot into recovery again to avoid flashing issues.");
     }
 
+    _profile.add_stage("cleanup", start);
+    write_profile(ret);
+
     on_cleanup(ret);
 
     LOGV("Finished cleanup");
 }
 
+Installer::ProceedState
+Installer::run_stage(const char *name, ProceedState (Installer::*fn)())
+{
+    InstallProfile::Sample start;
+    ProceedState ret = (this->*fn)();
+    _profile.add_stage(name, start);
+    return ret;
+}
+
+/*!
+ * \brief Save the stage and command timings next to the installer log and
+ *        show a summary
+ */
+void Installer::write_profile(ProceedState ret)
+{
+    const char *result = ret == ProceedState::Fail ? "failed"
+            : ret == ProceedState::Cancel ? "cancelled" : "succeeded";
+
+    if (!_profile.write_json(MULTIBOOT_LOG_INSTALLER_PROFILE, result)) {
+        LOGW("Failed to write installation profile");
+    }
+
+    display_msg(std::string{});
+    display_msg("Time spent:");
+    for (auto const &line : _profile.summary()) {
+        display_msg(line);
+    }
+}
+
 bool Installer::start_installation()
 {
     if (_ran) {
@@ -1990,37 +2500,42 @@ bool Installer::start_installation()
     });
 
 
-    ret = install_stage_initialize();
+    ret = run_stage("initialize", &Installer::install_stage_initialize);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_create_chroot();
+    ret = run_stage("create_chroot", &Installer::install_stage_create_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_environment();
+    ret = run_stage("set_up_environment",
+                    &Installer::install_stage_set_up_environment);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_check_device();
+    ret = run_stage("check_device", &Installer::install_stage_check_device);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_get_install_type();
+    ret = run_stage("get_install_type",
+                    &Installer::install_stage_get_install_type);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_chroot();
+    ret = run_stage("set_up_chroot", &Installer::install_stage_set_up_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_mount_filesystems();
+    ret = run_stage("mount_filesystems",
+                    &Installer::install_stage_mount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ProceedState install_ret = install_stage_installation();
+    ProceedState install_ret =
+            run_stage("installation", &Installer::install_stage_installation);
 
-    ret = install_stage_unmount_filesystems();
+    ret = run_stage("unmount_filesystems",
+                    &Installer::install_stage_unmount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -2028,7 +2543,7 @@ bool Installer::start_installation()
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_finish();
+    ret = run_stage("finish", &Installer::install_stage_finish);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
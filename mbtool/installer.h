@@ -27,6 +27,9 @@
 #include "mbcommon/flags.h"
 #include "mbdevice/device.h"
 
+#include "mbutil/zip.h"
+
+#include "installer_profile.h"
 #include "roms.h"
 
 namespace mb
@@ -115,28 +118,40 @@ protected:
 
 private:
     bool _ran;
+    // Whether the chroot is an overlay on top of the cached skeleton
+    bool _chroot_overlay;
+
+    // Central directory of the zip file, read once per install
+    util::ZipIndex _zip_index;
+
+    InstallProfile _profile;
 
     static void output_cb(const char *line, bool error, void *userdata);
     int run_command(const std::vector<std::string> &argv);
     int run_command_chroot(const std::string &dir,
                            const std::vector<std::string> &argv);
 
+    bool mount_chroot_overlay();
     bool create_chroot();
     bool destroy_chroot() const;
     bool mount_efs() const;
 
+    bool load_zip_index();
     bool extract_multiboot_files();
     bool set_up_busybox_wrapper();
     bool create_image(const std::string &path, uint64_t size);
+    bool block_image_replaces_system();
     bool system_image_copy(const std::string &source,
                            const std::string &image, bool reverse);
     bool mount_dir_or_image(const std::string &source,
                             const std::string &mount_point,
+                            const std::string &parent_target,
                             const std::string &loop_target,
                             bool is_image,
                             uint64_t image_size);
     static bool change_root(const std::string &path);
     bool set_up_legacy_properties();
+    void updater_command(std::string line);
     bool updater_fd_reader(int stdio_fd, int command_fd);
     bool run_real_updater();
     bool run_debug_shell();
@@ -152,6 +167,9 @@ private:
     ProceedState install_stage_unmount_filesystems();
     ProceedState install_stage_finish();
     void install_stage_cleanup(ProceedState ret);
+
+    ProceedState run_stage(const char *name, ProceedState (Installer::*fn)());
+    void write_profile(ProceedState ret);
 };
 
 int update_binary_main(int argc, char *argv[]);
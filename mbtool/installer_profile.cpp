@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "installer_profile.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/prettywriter.h>
+
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/installer_profile"
+
+// Number of slowest commands listed in the summary
+constexpr size_t SUMMARY_MAX_COMMANDS = 3;
+
+using namespace rapidjson;
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+namespace mb
+{
+
+using namespace std::chrono;
+
+static microseconds timeval_to_us(const timeval &tv)
+{
+    return seconds(tv.tv_sec) + microseconds(tv.tv_usec);
+}
+
+InstallProfile::Sample::Sample()
+    : _wall(steady_clock::now())
+    , _cpu(0)
+    , _child_cpu(0)
+{
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        _cpu = duration_cast<microseconds>(
+                seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec));
+    }
+
+    rusage usage;
+    if (getrusage(RUSAGE_CHILDREN, &usage) == 0) {
+        _child_cpu = timeval_to_us(usage.ru_utime)
+                + timeval_to_us(usage.ru_stime);
+    }
+}
+
+InstallProfile::InstallProfile() = default;
+
+ProfileEntry InstallProfile::make_entry(std::string name, const Sample &start)
+{
+    Sample stop;
+
+    ProfileEntry entry;
+    entry.name = std::move(name);
+    entry.exit_code = 0;
+    entry.wall = duration_cast<microseconds>(stop._wall - start._wall);
+    entry.cpu = stop._cpu - start._cpu;
+    entry.child_cpu = stop._child_cpu - start._child_cpu;
+
+    return entry;
+}
+
+void InstallProfile::add_stage(std::string name, const Sample &start)
+{
+    _stages.push_back(make_entry(std::move(name), start));
+}
+
+void InstallProfile::add_step(std::string name, const Sample &start)
+{
+    _steps.push_back(make_entry(std::move(name), start));
+}
+
+void InstallProfile::add_command(std::vector<std::string> argv,
+                                 int exit_code, const Sample &start)
+{
+    auto entry = make_entry(argv.empty() ? std::string() : argv[0], start);
+    entry.argv = std::move(argv);
+    entry.exit_code = exit_code;
+
+    _commands.push_back(std::move(entry));
+}
+
+template<typename W>
+static void write_times(W &writer, const ProfileEntry &entry)
+{
+    writer.Key("wall_us");
+    writer.Int64(entry.wall.count());
+    writer.Key("cpu_us");
+    writer.Int64(entry.cpu.count());
+    writer.Key("child_cpu_us");
+    writer.Int64(entry.child_cpu.count());
+}
+
+template<typename W>
+static void write_entries(W &writer, const char *key,
+                          const std::vector<ProfileEntry> &entries)
+{
+    writer.Key(key);
+    writer.StartArray();
+
+    for (auto const &entry : entries) {
+        writer.StartObject();
+
+        writer.Key("name");
+        writer.String(entry.name);
+
+        if (!entry.argv.empty()) {
+            writer.Key("argv");
+            writer.StartArray();
+            for (auto const &arg : entry.argv) {
+                writer.String(arg);
+            }
+            writer.EndArray();
+
+            writer.Key("exit_code");
+            writer.Int(entry.exit_code);
+        }
+
+        write_times(writer, entry);
+
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+}
+
+/*!
+ * \brief Write the timings as JSON
+ *
+ * \param path Output file
+ * \param result Outcome of the installation
+ *
+ * \return Whether the report was successfully written
+ */
+bool InstallProfile::write_json(const std::string &path,
+                                const char *result) const
+{
+    ScopedFILE fp(fopen(path.c_str(), "we"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[65536];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    PrettyWriter<FileWriteStream> writer(os);
+
+    writer.StartObject();
+
+    writer.Key("result");
+    writer.String(result);
+
+    writer.Key("total");
+    writer.StartObject();
+    write_times(writer, make_entry({}, _start));
+    writer.EndObject();
+
+    write_entries(writer, "stages", _stages);
+    write_entries(writer, "steps", _steps);
+    write_entries(writer, "commands", _commands);
+
+    writer.EndObject();
+    os.Put('\n');
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static std::string format_entry(const ProfileEntry &entry)
+{
+    return format("%s: %.2fs (CPU %.2fs + %.2fs)", entry.name.c_str(),
+                  duration<double>(entry.wall).count(),
+                  duration<double>(entry.cpu).count(),
+                  duration<double>(entry.child_cpu).count());
+}
+
+/*!
+ * \brief Get a short human-readable summary of the timings
+ *
+ * The summary lists every stage followed by the slowest external commands.
+ */
+std::vector<std::string> InstallProfile::summary() const
+{
+    std::vector<std::string> lines;
+
+    lines.push_back(format_entry(make_entry("Total", _start)));
+
+    for (auto const &stage : _stages) {
+        lines.push_back("- " + format_entry(stage));
+    }
+
+    std::vector<const ProfileEntry *> commands;
+    for (auto const &command : _commands) {
+        commands.push_back(&command);
+    }
+
+    std::sort(commands.begin(), commands.end(),
+              [](const ProfileEntry *a, const ProfileEntry *b) {
+        return a->wall > b->wall;
+    });
+    commands.resize(std::min(commands.size(), SUMMARY_MAX_COMMANDS));
+
+    if (!commands.empty()) {
+        lines.push_back("Slowest commands:");
+        for (auto const *command : commands) {
+            lines.push_back("- " + format_entry(*command));
+        }
+    }
+
+    return lines;
+}
+
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace mb
+{
+
+/*!
+ * \brief Wall and CPU time of an installer stage, step, or external command
+ */
+struct ProfileEntry
+{
+    std::string name;
+    // Only set for external commands
+    std::vector<std::string> argv;
+    // Exit code of external commands or -1 if it didn't exit normally
+    int exit_code;
+    std::chrono::microseconds wall;
+    // CPU time used by mbtool itself (all threads)
+    std::chrono::microseconds cpu;
+    // CPU time used by child processes that exited during the entry
+    std::chrono::microseconds child_cpu;
+};
+
+class InstallProfile
+{
+public:
+    class Sample
+    {
+    public:
+        Sample();
+
+    private:
+        std::chrono::steady_clock::time_point _wall;
+        std::chrono::microseconds _cpu;
+        std::chrono::microseconds _child_cpu;
+
+        friend class InstallProfile;
+    };
+
+    InstallProfile();
+
+    void add_stage(std::string name, const Sample &start);
+    void add_step(std::string name, const Sample &start);
+    void add_command(std::vector<std::string> argv, int exit_code,
+                     const Sample &start);
+
+    bool write_json(const std::string &path, const char *result) const;
+    std::vector<std::string> summary() const;
+
+private:
+    static ProfileEntry make_entry(std::string name, const Sample &start);
+
+    Sample _start;
+    std::vector<ProfileEntry> _stages;
+    std::vector<ProfileEntry> _steps;
+    std::vector<ProfileEntry> _commands;
+};
+
+}
@@ -19,19 +19,21 @@
 
 #include "installer_util.h"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
+#include <string_view>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
-#include <archive.h>
-#include <archive_entry.h>
-
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
@@ -39,260 +41,307 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_error.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mbcommon/version.h"
 
 #include "mblog/logging.h"
 
 #include "mbutil/delete.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/path.h"
+#include "mbutil/string.h"
 
 #include "bootimg_util.h"
 #include "multiboot.h"
+#include "ramdisk.h"
+#include "roms.h"
 
 #define LOG_TAG "mbtool/installer_util"
 
 using namespace mb::bootimg;
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
+// Each entry is a few MiB, so only keep the most recently used ones
+static constexpr size_t RAMDISK_CACHE_MAX_ENTRIES = 8;
+
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
+/*!
+ * \brief Get the raw (still compressed) data of the current entry
+ *
+ * \p buf is only used if the boot image is not memory-backed.
+ */
+static bool read_entry_data(Reader &reader, std::string &buf,
+                            std::string_view &data)
 {
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-    archive_entry *entry;
-    std::string target_path;
-    int ret;
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
+    auto view = reader.read_data_view();
+    if (view) {
+        data = {static_cast<const char *>(view.value().data),
+                view.value().size};
+        return true;
+    } else if (view.error() != FileError::UnsupportedView) {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
         return false;
     }
 
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
+    buf.clear();
+    char chunk[10240];
 
     while (true) {
-        ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
+        auto n = reader.read_data(chunk, sizeof(chunk));
+        if (!n) {
+            LOGE("Failed to read boot image entry data: %s",
+                 n.error().message().c_str());
             return false;
+        } else if (n.value() == 0) {
+            break;
         }
 
-        // Build path
-        target_path = output_dir;
-        if (!target_path.empty() && target_path.back() != '/' && *path != '/') {
-            target_path += '/';
-        }
-        target_path += path;
+        buf.append(chunk, n.value());
+    }
 
-        archive_entry_set_pathname(entry, target_path.c_str());
+    data = buf;
+    return true;
+}
 
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(ain.get()));
-            return false;
-        }
+static bool write_entry_data(Writer &writer, const void *data, size_t size)
+{
+    auto n = writer.write_data(data, size);
+    if (!n) {
+        LOGE("Failed to write entry data: %s", n.error().message().c_str());
+        return false;
+    } else if (n.value() != size) {
+        LOGE("Short write of entry data: %zu < %zu", n.value(), size);
+        return false;
     }
 
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
+    return true;
+}
+
+static std::optional<std::string>
+ramdisk_cache_path(const RamdiskCacheKey &key, std::string_view ramdisk)
+{
+    util::Hasher hasher(util::HashAlgorithm::Sha256);
+
+    // The fields are separated by NUL bytes so that they can't run together
+    for (std::string_view field : {std::string_view(version()),
+                                   std::string_view(key.patches),
+                                   std::string_view(key.rom_id),
+                                   std::string_view(key.device_id),
+                                   std::string_view(key.inputs),
+                                   ramdisk}) {
+        auto r = hasher.update(field.data(), field.size());
+        if (r) {
+            r = hasher.update("", 1);
+        }
+        if (!r) {
+            LOGW("Failed to compute ramdisk cache key: %s",
+                 r.error().message().c_str());
+            return std::nullopt;
         }
     }
 
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
+    auto digest = hasher.finish();
+    if (!digest) {
+        LOGW("Failed to compute ramdisk cache key: %s",
+             digest.error().message().c_str());
+        return std::nullopt;
     }
 
-    return true;
+    std::string path(get_raw_path(RAMDISK_CACHE_DIR));
+    path += '/';
+    path += util::hex_string(digest.value().data(), digest.value().size());
+    return path;
 }
 
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
+/*!
+ * \brief Load a cached ramdisk
+ *
+ * Entries begin with the SHA-256 digest of the rest of the file. A damaged
+ * entry would make the boot image unbootable, so it is deleted instead of
+ * being used.
+ */
+static std::optional<std::vector<unsigned char>>
+load_cached_ramdisk(const std::string &path)
 {
-    (void) data;
-    (void) entry;
+    auto data = util::file_read_all(path);
+    if (!data) {
+        if (data.error() != std::errc::no_such_file_or_directory) {
+            LOGW("%s: Failed to read cached ramdisk: %s",
+                 path.c_str(), data.error().message().c_str());
+        }
+        return std::nullopt;
+    }
+
+    size_t digest_size = util::hash_digest_size(util::HashAlgorithm::Sha256);
+    auto &buf = data.value();
 
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
+    if (buf.size() > digest_size) {
+        auto digest = util::hash_data(util::HashAlgorithm::Sha256,
+                                      buf.data() + digest_size,
+                                      buf.size() - digest_size);
+        if (digest && std::equal(digest.value().begin(), digest.value().end(),
+                                 buf.begin())) {
+            // Keep recently used entries when pruning
+            (void) utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+
+            buf.erase(buf.begin(), buf.begin() + digest_size);
+            return std::move(buf);
+        }
     }
-    return 1;
+
+    LOGW("%s: Removing corrupted cached ramdisk", path.c_str());
+    unlink(path.c_str());
+    return std::nullopt;
 }
 
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
+static void prune_ramdisk_cache(const std::string &cache_dir)
 {
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
+    DIR *dp = opendir(cache_dir.c_str());
+    if (!dp) {
+        return;
     }
 
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
+    auto close_dp = finally([&] {
+        closedir(dp);
+    });
 
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
+    std::vector<std::pair<timespec, std::string>> entries;
+
+    while (auto *ent = readdir(dp)) {
+        struct stat sb;
+        if (fstatat(dirfd(dp), ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+                && S_ISREG(sb.st_mode)) {
+            entries.emplace_back(sb.st_mtim, ent->d_name);
         }
     }
 
-    archive_write_set_bytes_per_block(aout.get(), 512);
+    if (entries.size() <= RAMDISK_CACHE_MAX_ENTRIES) {
+        return;
+    }
 
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
+    // Newest first
+    std::sort(entries.begin(), entries.end(), [](auto const &a, auto const &b) {
+        return a.first.tv_sec != b.first.tv_sec
+                ? a.first.tv_sec > b.first.tv_sec
+                : a.first.tv_nsec > b.first.tv_nsec;
+    });
+
+    for (auto it = entries.begin() + RAMDISK_CACHE_MAX_ENTRIES;
+            it != entries.end(); ++it) {
+        if (unlinkat(dirfd(dp), it->second.c_str(), 0) < 0) {
+            LOGW("%s/%s: Failed to remove cached ramdisk: %s",
+                 cache_dir.c_str(), it->second.c_str(), strerror(errno));
+        }
     }
+}
 
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
-        return false;
+static void store_cached_ramdisk(const std::string &path,
+                                 const std::string &ramdisk)
+{
+    auto digest = util::hash_data(util::HashAlgorithm::Sha256,
+                                  ramdisk.data(), ramdisk.size());
+    if (!digest) {
+        LOGW("%s: Failed to hash ramdisk: %s",
+             path.c_str(), digest.error().message().c_str());
+        return;
     }
 
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
+    std::string cache_dir = util::dir_name(path);
 
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
+    if (auto r = util::mkdir_recursive(cache_dir, 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             cache_dir.c_str(), r.error().message().c_str());
+        return;
+    }
 
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
+    std::string data(digest.value().begin(), digest.value().end());
+    data += ramdisk;
 
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            auto relpath = util::relative_path(curpath, input_dir);
-            if (!relpath) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(),
-                     relpath.error().message().c_str());
-                return false;
-            }
-            if (relpath.value().empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.value().c_str());
-        }
+    // Never expose a partially written entry under the real name
+    std::string temp_path(path);
+    temp_path += ".tmp";
 
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
-        }
+    if (auto r = util::file_write_data(temp_path, data.data(), data.size());
+            !r) {
+        LOGW("%s: Failed to write cached ramdisk: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+        return;
+    } else if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename cached ramdisk: %s",
+             path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return;
+    }
 
-        char buf[10240];
-        la_ssize_t n;
+    prune_ramdisk_cache(cache_dir);
+}
 
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, static_cast<size_t>(n))
-                        != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
+/*!
+ * \brief Patch the ramdisk of the current entry, reusing a cached result
+ *
+ * On a cache hit, the previously patched and compressed ramdisk is spliced
+ * into the output without being decompressed or recompressed.
+ */
+static bool patch_ramdisk_cached(Reader &reader, Writer &writer,
+                                 std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                 const RamdiskCacheKey &cache_key)
+{
+    std::string buf;
+    std::string_view input;
 
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
+    if (!read_entry_data(reader, buf, input)) {
+        return false;
+    }
+
+    auto cache_path = ramdisk_cache_path(cache_key, input);
+
+    if (cache_path) {
+        if (auto cached = load_cached_ramdisk(*cache_path)) {
+            LOGD("Using cached patched ramdisk: %s", cache_path->c_str());
+            return write_entry_data(writer, cached->data(), cached->size());
         }
     }
 
-    archive_read_close(ain.get());
+    Ramdisk ramdisk;
+    std::string output;
 
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
+    if (!ramdisk.load(input.data(), input.size())
+            || !InstallerUtil::patch_ramdisk(ramdisk, 0, rps)
+            || !ramdisk.save(output)
+            || !write_entry_data(writer, output.data(), output.size())) {
         return false;
     }
 
+    if (cache_path) {
+        store_cached_ramdisk(*cache_path, output);
+    }
+
     return true;
 }
 
+/*!
+ * \brief Patch the ramdisk and kernel of a boot image
+ *
+ * If \p cache_key is given, the patched and compressed ramdisk is cached in
+ * RAMDISK_CACHE_DIR, keyed by the input ramdisk, the mbtool version, and
+ * \p cache_key. Repeating the same operation then skips all of the ramdisk
+ * decoding, patching, and compression.
+ */
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
-                                     std::vector<std::function<RamdiskPatcherFn>> &rps)
+                                     std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                     const std::optional<RamdiskCacheKey> &cache_key)
 {
     std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
 
@@ -324,7 +373,14 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
              ret.error().message().c_str());
         return false;
     }
-    ret = reader.open_filename(input_file);
+    bi_enable_format_cache(reader);
+    // Map the input so that entries can be copied without intermediate buffers
+    auto input = std::make_unique<MmapFile>();
+    if (input->open(input_file, false)) {
+        ret = reader.open(std::move(input));
+    } else {
+        ret = reader.open_filename(input_file);
+    }
     if (!ret) {
         LOGE("%s: Failed to open boot image for reading: %s",
              input_file.c_str(), ret.error().message().c_str());
@@ -403,26 +459,21 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
                 }
             }
 
-            if (type == ENTRY_TYPE_RAMDISK) {
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
-
-                auto delete_temp_files = finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, ramdisk_in)) {
+            if (type == ENTRY_TYPE_RAMDISK && cache_key) {
+                if (!patch_ramdisk_cached(reader, writer, rps, *cache_key)) {
                     return false;
                 }
+            } else if (type == ENTRY_TYPE_RAMDISK) {
+                // Patch the ramdisk in memory and write the new cpio archive
+                // straight into the output boot image
+                Ramdisk ramdisk;
 
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
+                if (!ramdisk.load(reader)) {
                     return false;
                 }
 
-                if (!bi_copy_file_to_data(ramdisk_out, writer)) {
+                if (!patch_ramdisk(ramdisk, 0, rps)
+                        || !ramdisk.save(writer)) {
                     return false;
                 }
             } else if (type == ENTRY_TYPE_KERNEL) {
@@ -466,9 +517,7 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
-                                  unsigned int depth,
+bool InstallerUtil::patch_ramdisk(Ramdisk &ramdisk, unsigned int depth,
                                   std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
     if (depth > 1) {
@@ -476,50 +525,18 @@ bool InstallerUtil::patch_ramdisk(const std::string &input_file,
         return true;
     }
 
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
-
-    int format;
-    std::vector<int> filters;
-
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
-        return false;
-    }
-
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
-
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
-    }
+    // Patch the nested ramdisk instead if there is one
+    auto *nested = ramdisk.find("sbin/ramdisk.cpio");
+    if (nested && S_ISREG(nested->mode)) {
+        Ramdisk nested_ramdisk;
 
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
-        return false;
+        return nested_ramdisk.load(nested->data.data(), nested->data.size())
+                && patch_ramdisk(nested_ramdisk, depth + 1, rps)
+                && nested_ramdisk.save(nested->data);
     }
 
-    return ret;
-}
-
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
-{
     for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
+        if (!rp(ramdisk)) {
             return false;
         }
     }
@@ -673,6 +690,76 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
+/*!
+ * \brief Check if a block image transfer list overwrites the whole image
+ *
+ * Full OTAs only contain `erase`, `zero`, and `new` commands, so the previous
+ * contents of the target are never read. Incremental OTAs (`move`, `bsdiff`,
+ * `imgdiff`, `stash`, etc.) patch the existing blocks.
+ *
+ * \param path Path to `system.transfer.list`
+ *
+ * \return Whether the transfer list does not depend on the previous contents
+ *         of the image. Returns false if the file cannot be parsed.
+ */
+bool InstallerUtil::is_full_transfer_list(const std::string &path)
+{
+    ScopedFILE fp(fopen(path.c_str(), "re"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
+    size_t line_num = 0;
+    size_t header_lines = 2;
+    bool has_new = false;
+
+    while ((read = getline(&line, &len, fp.get())) >= 0) {
+        std::string_view sv(line, static_cast<size_t>(read));
+        if (!sv.empty() && sv.back() == '\n') {
+            sv.remove_suffix(1);
+        }
+
+        if (line_num++ == 0) {
+            // Version 2 and newer have two additional lines for the stash
+            int version = atoi(std::string(sv).c_str());
+            if (version < 1) {
+                LOGE("%s: Invalid transfer list version: %s",
+                     path.c_str(), std::string(sv).c_str());
+                return false;
+            } else if (version >= 2) {
+                header_lines = 4;
+            }
+            continue;
+        } else if (line_num <= header_lines || sv.empty()) {
+            continue;
+        }
+
+        std::string_view cmd = sv.substr(0, sv.find(' '));
+        if (cmd == "new") {
+            has_new = true;
+        } else if (cmd != "erase" && cmd != "zero") {
+            return false;
+        }
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return has_new;
+}
+
 bool InstallerUtil::copy_file_to_file(File &fin, File &fout, uint64_t to_copy)
 {
     char buf[10240];
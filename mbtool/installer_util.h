@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -28,33 +29,39 @@ namespace mb
 {
 class File;
 
+/*!
+ * \brief Identifies the result of applying a set of ramdisk patchers
+ *
+ * Together with the input ramdisk and the mbtool version, this must determine
+ * the patched ramdisk completely. \a patches names the patcher list and any
+ * arguments that are not covered by the ROM and device IDs. \a inputs is a
+ * digest of the files that the patchers read, if any.
+ */
+struct RamdiskCacheKey
+{
+    std::string patches;
+    std::string rom_id;
+    std::string device_id;
+    std::string inputs;
+};
+
 class InstallerUtil
 {
 public:
-    static bool unpack_ramdisk(const std::string &input_file,
-                               const std::string &output_dir,
-                               int &format_out,
-                               std::vector<int> &filters_out);
-    static bool pack_ramdisk(const std::string &input_dir,
-                             const std::string &output_file,
-                             int format,
-                             const std::vector<int> &filters);
-
     static bool patch_boot_image(const std::string &input_file,
                                  const std::string &output_file,
-                                 std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk(const std::string &input_file,
-                              const std::string &output_file,
-                              unsigned int depth,
+                                 std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                 const std::optional<RamdiskCacheKey> &cache_key = {});
+    static bool patch_ramdisk(Ramdisk &ramdisk, unsigned int depth,
                               std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                  std::vector<std::function<RamdiskPatcherFn>> &rps);
     static bool patch_kernel_rkp(const std::string &input_file,
                                  const std::string &output_file);
 
     static bool replace_file(const std::string &replace,
                              const std::string &with);
 
+    static bool is_full_transfer_list(const std::string &path);
+
 private:
     static bool copy_file_to_file(File &fin, File &fout, uint64_t to_copy);
     static bool copy_file_to_file_eof(File &fin, File &fout);
@@ -35,6 +35,7 @@
 #else
 #include "appsync.h"
 #include "auditd.h"
+#include "bench.h"
 #include "daemon.h"
 #include "init.h"
 #include "miniadbd.h"
@@ -64,6 +65,7 @@ static Tool g_tools[] = {
     // Tools
 #ifdef RECOVERY
     { "backup", mb::backup_main },
+    { "clone-rom", mb::clone_rom_main },
     { "restore", mb::restore_main },
     { "rom-installer", mb::rom_installer_main },
     { "updater", mb::update_binary_main }, // TWRP
@@ -74,6 +76,7 @@ static Tool g_tools[] = {
     { "adbd", mb::miniadbd_main },
     { "appsync", mb::appsync_main },
     { "auditd", mb::auditd_main },
+    { "bench", mb::bench_main },
     { "daemon", mb::daemon_main },
     { "init", mb::init_main },
     { "miniadbd", mb::miniadbd_main },
@@ -17,6 +17,8 @@
 #include "sysdeps.h"
 #include "adb.h"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -24,6 +26,7 @@
 #include <unistd.h>
 
 #include "adb_log.h"
+#include "file_sync_service.h"
 #include "transport.h"
 
 #include "mbcommon/string.h"
@@ -58,11 +61,30 @@ void fatal_errno(const char *fmt, ...)
     exit(-1);
 }
 
+// Packets are large enough that malloc() would map and unmap them each time,
+// so freed packets are kept around for reuse. They are allocated and freed on
+// both the transport threads and the main thread.
+#define APACKET_POOL_MAX 16
+
+static pthread_mutex_t apacket_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static apacket *apacket_pool = nullptr;
+static size_t apacket_pool_size = 0;
+
 apacket* get_apacket(void)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    pthread_mutex_lock(&apacket_pool_lock);
+    apacket* p = apacket_pool;
+    if (p) {
+        apacket_pool = p->next;
+        --apacket_pool_size;
+    }
+    pthread_mutex_unlock(&apacket_pool_lock);
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+            fatal("failed to allocate an apacket");
+        }
     }
 
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
@@ -71,6 +93,15 @@ apacket* get_apacket(void)
 
 void put_apacket(apacket *p)
 {
+    pthread_mutex_lock(&apacket_pool_lock);
+    if (apacket_pool_size < APACKET_POOL_MAX) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        ++apacket_pool_size;
+        p = nullptr;
+    }
+    pthread_mutex_unlock(&apacket_pool_lock);
+
     free(p);
 }
 
@@ -170,7 +201,8 @@ static void send_close(unsigned local, unsigned remote, atransport *t)
 static size_t fill_connect_data(char *buf, size_t bufsize)
 {
     size_t len;
-    len = snprintf(buf, bufsize, "%s::", adb_device_banner);
+    len = snprintf(buf, bufsize, "%s::features=%s", adb_device_banner,
+                   file_sync_features());
     return len + 1;
 }
 
@@ -179,8 +211,8 @@ void send_connect(atransport *t)
     ADB_LOGD(ADB_CONN, "Calling send_connect");
     apacket *cp = get_apacket();
     cp->msg.command = A_CNXN;
-    cp->msg.arg0 = A_VERSION;
-    cp->msg.arg1 = MAX_PAYLOAD;
+    cp->msg.arg0 = t->protocol_version;
+    cp->msg.arg1 = t->max_payload;
     cp->msg.data_length = fill_connect_data((char *)cp->data,
                                             sizeof(cp->data));
     send_packet(cp, t);
@@ -263,6 +295,9 @@ void handle_packet(apacket *p, atransport *t)
             handle_offline(t);
         }
 
+        t->protocol_version = std::min<unsigned>(p->msg.arg0, A_VERSION);
+        t->max_payload = std::min<size_t>(p->msg.arg1, MAX_PAYLOAD);
+
         parse_banner(reinterpret_cast<const char*>(p->data), t);
 
         handle_online(t);
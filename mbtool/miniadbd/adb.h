@@ -19,7 +19,11 @@
 
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+// Maximum payload supported by every version of the protocol
+#define MAX_PAYLOAD_V1 (4 * 1024)
+// Maximum payload that we support. The actual payload of a transport is
+// negotiated when the host connects.
+#define MAX_PAYLOAD (256 * 1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -29,7 +33,10 @@
 #define A_WRTE 0x45545257
 
 // ADB protocol version.
-#define A_VERSION 0x01000000
+#define A_VERSION_MIN 0x01000000
+// Version where data_check is no longer computed or verified
+#define A_VERSION_SKIP_CHECKSUM 0x01000001
+#define A_VERSION 0x01000001
 
 struct atransport;
 struct usb_handle;
@@ -195,6 +202,10 @@ struct atransport
     void *key;
     unsigned char token[TOKEN_SIZE];
 
+        /* negotiated with the host in A_CNXN */
+    unsigned protocol_version;
+    size_t max_payload;
+
     const char* connection_state_name() const;
 };
 
@@ -249,6 +260,9 @@ int service_to_fd(const char *name);
 apacket *get_apacket(void);
 void put_apacket(apacket *p);
 
+/* largest payload that can be sent through a socket's transport */
+size_t get_max_payload(asocket *s);
+
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
 
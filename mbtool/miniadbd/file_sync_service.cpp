@@ -20,12 +20,358 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include <dirent.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <utime.h>
 
+#ifdef MINIADBD_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef MINIADBD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "adb_io.h"
 #include "adb_log.h"
 
+// Receives the output of a SyncCodec as it is produced
+using SyncSink = std::function<bool(const char *data, size_t size)>;
+
+// Streaming compressor or decompressor for the ID_SEND_V2/ID_RECV_V2 data
+class SyncCodec
+{
+public:
+    virtual ~SyncCodec() = default;
+
+    // Feed more input through the codec
+    virtual bool process(const char *data, size_t size,
+                         const SyncSink &sink) = 0;
+    // End the stream (encoders) or check that it is complete (decoders)
+    virtual bool finish(const SyncSink &sink) = 0;
+};
+
+#ifdef MINIADBD_HAVE_LZ4
+class Lz4Encoder : public SyncCodec
+{
+public:
+    Lz4Encoder()
+    {
+        memset(&m_prefs, 0, sizeof(m_prefs));
+        m_prefs.autoFlush = 1;
+    }
+
+    ~Lz4Encoder() override
+    {
+        LZ4F_freeCompressionContext(m_ctx);
+    }
+
+    bool init()
+    {
+        if (LZ4F_isError(LZ4F_createCompressionContext(
+                &m_ctx, LZ4F_VERSION))) {
+            return false;
+        }
+        m_buf.resize(LZ4F_compressBound(SYNC_DATA_MAX, &m_prefs));
+        return true;
+    }
+
+    bool process(const char *data, size_t size, const SyncSink &sink) override
+    {
+        if (!m_started && !begin(sink)) {
+            return false;
+        }
+
+        while (size > 0) {
+            size_t n = size < SYNC_DATA_MAX ? size : SYNC_DATA_MAX;
+            size_t ret = LZ4F_compressUpdate(m_ctx, m_buf.data(), m_buf.size(),
+                                             data, n, nullptr);
+            if (LZ4F_isError(ret)) {
+                ADB_LOGE(ADB_SERV, "lz4: failed to compress: %s",
+                         LZ4F_getErrorName(ret));
+                return false;
+            } else if (!sink(m_buf.data(), ret)) {
+                return false;
+            }
+            data += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    bool finish(const SyncSink &sink) override
+    {
+        if (!m_started && !begin(sink)) {
+            return false;
+        }
+
+        size_t ret = LZ4F_compressEnd(m_ctx, m_buf.data(), m_buf.size(),
+                                      nullptr);
+        if (LZ4F_isError(ret)) {
+            ADB_LOGE(ADB_SERV, "lz4: failed to end frame: %s",
+                     LZ4F_getErrorName(ret));
+            return false;
+        }
+        return sink(m_buf.data(), ret);
+    }
+
+private:
+    bool begin(const SyncSink &sink)
+    {
+        size_t ret = LZ4F_compressBegin(m_ctx, m_buf.data(), m_buf.size(),
+                                        &m_prefs);
+        if (LZ4F_isError(ret)) {
+            ADB_LOGE(ADB_SERV, "lz4: failed to begin frame: %s",
+                     LZ4F_getErrorName(ret));
+            return false;
+        }
+        m_started = true;
+        return sink(m_buf.data(), ret);
+    }
+
+    LZ4F_cctx *m_ctx = nullptr;
+    LZ4F_preferences_t m_prefs;
+    std::vector<char> m_buf;
+    bool m_started = false;
+};
+
+class Lz4Decoder : public SyncCodec
+{
+public:
+    ~Lz4Decoder() override
+    {
+        LZ4F_freeDecompressionContext(m_ctx);
+    }
+
+    bool init()
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(
+                &m_ctx, LZ4F_VERSION))) {
+            return false;
+        }
+        m_buf.resize(SYNC_DATA_MAX);
+        return true;
+    }
+
+    bool process(const char *data, size_t size, const SyncSink &sink) override
+    {
+        while (true) {
+            size_t out_size = m_buf.size();
+            size_t in_size = size;
+
+            m_hint = LZ4F_decompress(m_ctx, m_buf.data(), &out_size,
+                                     data, &in_size, nullptr);
+            if (LZ4F_isError(m_hint)) {
+                ADB_LOGE(ADB_SERV, "lz4: failed to decompress: %s",
+                         LZ4F_getErrorName(m_hint));
+                return false;
+            } else if (out_size > 0 && !sink(m_buf.data(), out_size)) {
+                return false;
+            }
+
+            data += in_size;
+            size -= in_size;
+
+            // Keep going while there's input or the output buffer was filled
+            if (size == 0 && out_size < m_buf.size()) {
+                return true;
+            }
+        }
+    }
+
+    bool finish(const SyncSink &sink) override
+    {
+        (void) sink;
+
+        if (m_hint != 0) {
+            ADB_LOGE(ADB_SERV, "lz4: truncated stream");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    LZ4F_dctx *m_ctx = nullptr;
+    std::vector<char> m_buf;
+    size_t m_hint = 1;
+};
+#endif
+
+#ifdef MINIADBD_HAVE_ZSTD
+class ZstdEncoder : public SyncCodec
+{
+public:
+    ~ZstdEncoder() override
+    {
+        ZSTD_freeCCtx(m_ctx);
+    }
+
+    bool init()
+    {
+        m_ctx = ZSTD_createCCtx();
+        if (!m_ctx) {
+            return false;
+        }
+        // The device's CPU is slower than the host's, so favor speed
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, 1);
+        m_buf.resize(ZSTD_CStreamOutSize());
+        return true;
+    }
+
+    bool process(const char *data, size_t size, const SyncSink &sink) override
+    {
+        ZSTD_inBuffer in = { data, size, 0 };
+
+        while (in.pos < in.size) {
+            if (!compress(&in, ZSTD_e_continue, sink)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool finish(const SyncSink &sink) override
+    {
+        ZSTD_inBuffer in = { nullptr, 0, 0 };
+        return compress(&in, ZSTD_e_end, sink);
+    }
+
+private:
+    bool compress(ZSTD_inBuffer *in, ZSTD_EndDirective mode,
+                  const SyncSink &sink)
+    {
+        size_t ret;
+
+        do {
+            ZSTD_outBuffer out = { m_buf.data(), m_buf.size(), 0 };
+
+            ret = ZSTD_compressStream2(m_ctx, &out, in, mode);
+            if (ZSTD_isError(ret)) {
+                ADB_LOGE(ADB_SERV, "zstd: failed to compress: %s",
+                         ZSTD_getErrorName(ret));
+                return false;
+            } else if (out.pos > 0 && !sink(m_buf.data(), out.pos)) {
+                return false;
+            }
+        } while (mode == ZSTD_e_end && ret != 0);
+
+        return true;
+    }
+
+    ZSTD_CCtx *m_ctx = nullptr;
+    std::vector<char> m_buf;
+};
+
+class ZstdDecoder : public SyncCodec
+{
+public:
+    ~ZstdDecoder() override
+    {
+        ZSTD_freeDCtx(m_ctx);
+    }
+
+    bool init()
+    {
+        m_ctx = ZSTD_createDCtx();
+        if (!m_ctx) {
+            return false;
+        }
+        m_buf.resize(ZSTD_DStreamOutSize());
+        return true;
+    }
+
+    bool process(const char *data, size_t size, const SyncSink &sink) override
+    {
+        ZSTD_inBuffer in = { data, size, 0 };
+        ZSTD_outBuffer out;
+
+        do {
+            out = { m_buf.data(), m_buf.size(), 0 };
+
+            m_hint = ZSTD_decompressStream(m_ctx, &out, &in);
+            if (ZSTD_isError(m_hint)) {
+                ADB_LOGE(ADB_SERV, "zstd: failed to decompress: %s",
+                         ZSTD_getErrorName(m_hint));
+                return false;
+            } else if (out.pos > 0 && !sink(m_buf.data(), out.pos)) {
+                return false;
+            }
+        } while (in.pos < in.size || out.pos == out.size);
+
+        return true;
+    }
+
+    bool finish(const SyncSink &sink) override
+    {
+        (void) sink;
+
+        if (m_hint != 0) {
+            ADB_LOGE(ADB_SERV, "zstd: truncated stream");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    ZSTD_DCtx *m_ctx = nullptr;
+    std::vector<char> m_buf;
+    size_t m_hint = 1;
+};
+#endif
+
+template<typename T>
+static std::unique_ptr<SyncCodec> init_codec()
+{
+    auto codec = std::make_unique<T>();
+    if (!codec->init()) {
+        return nullptr;
+    }
+    return codec;
+}
+
+// Returns whether the compression type in flags is supported. SYNC_FLAG_NONE
+// is always supported.
+static bool is_supported_compression(unsigned flags)
+{
+    switch (flags & ~SYNC_FLAG_DRY_RUN) {
+    case SYNC_FLAG_NONE:
+#ifdef MINIADBD_HAVE_LZ4
+    case SYNC_FLAG_LZ4:
+#endif
+#ifdef MINIADBD_HAVE_ZSTD
+    case SYNC_FLAG_ZSTD:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Create the codec for the compression type in flags. The flags must have been
+// checked with is_supported_compression() and must not be SYNC_FLAG_NONE.
+static std::unique_ptr<SyncCodec> create_codec(unsigned flags, bool encode)
+{
+    switch (flags & ~SYNC_FLAG_DRY_RUN) {
+#ifdef MINIADBD_HAVE_LZ4
+    case SYNC_FLAG_LZ4:
+        return encode ? init_codec<Lz4Encoder>() : init_codec<Lz4Decoder>();
+#endif
+#ifdef MINIADBD_HAVE_ZSTD
+    case SYNC_FLAG_ZSTD:
+        return encode ? init_codec<ZstdEncoder>() : init_codec<ZstdDecoder>();
+#endif
+    default:
+        (void) encode;
+        return nullptr;
+    }
+}
+
 static int mkdirs(char *name)
 {
     int ret;
@@ -155,42 +501,59 @@ static int fail_errno(int s)
 }
 
 static int handle_send_file(int s, char *path, uid_t uid,
-        gid_t gid, mode_t mode, char *buffer, bool do_unlink)
+        gid_t gid, mode_t mode, char *buffer, bool do_unlink,
+        SyncCodec *decoder, bool dry_run)
 {
     syncmsg msg;
     unsigned int timestamp = 0;
-    int fd;
+    int fd = -1;
 
-    fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
-    if (fd < 0 && errno == ENOENT) {
-        if (mkdirs(path) != 0) {
+    if (!dry_run) {
+        fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+        if (fd < 0 && errno == ENOENT) {
+            if (mkdirs(path) != 0) {
+                if (fail_errno(s))
+                    return -1;
+                fd = -1;
+            } else {
+                fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+            }
+        }
+        if (fd < 0 && errno == EEXIST) {
+            fd = adb_open_mode(path, O_WRONLY | O_CLOEXEC, mode);
+        }
+        if (fd < 0) {
             if (fail_errno(s))
                 return -1;
             fd = -1;
         } else {
-            fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+            if (fchown(fd, uid, gid) != 0) {
+                fail_errno(s);
+                errno = 0;
+            }
+
+            /*
+             * fchown clears the setuid bit - restore it if present.
+             * Ignore the result of calling fchmod. It's not supported
+             * by all filesystems. b/12441485
+             */
+            fchmod(fd, mode);
         }
     }
-    if (fd < 0 && errno == EEXIST) {
-        fd = adb_open_mode(path, O_WRONLY | O_CLOEXEC, mode);
-    }
-    if (fd < 0) {
-        if (fail_errno(s))
-            return -1;
-        fd = -1;
-    } else {
-        if (fchown(fd, uid, gid) != 0) {
-            fail_errno(s);
-            errno = 0;
-        }
 
-        /*
-         * fchown clears the setuid bit - restore it if present.
-         * Ignore the result of calling fchmod. It's not supported
-         * by all filesystems. b/12441485
-         */
-        fchmod(fd, mode);
-    }
+    // On a write error, report it and keep reading until ID_DONE. Returns
+    // false only if the failure couldn't be reported.
+    SyncSink write_data = [&](const char *data, size_t size) {
+        if (fd >= 0 && !WriteFdExactly(fd, data, size)) {
+            int saved_errno = errno;
+            close(fd);
+            if (do_unlink) unlink(path);
+            fd = -1;
+            errno = saved_errno;
+            if (fail_errno(s)) return false;
+        }
+        return true;
+    };
 
     for (;;) {
         unsigned int len;
@@ -214,25 +577,33 @@ static int handle_send_file(int s, char *path, uid_t uid,
         if (!ReadFdExactly(s, buffer, len))
             goto fail;
 
-        if (fd < 0)
+        // A dry run still decompresses the data, but discards it
+        if (fd < 0 && !dry_run)
             continue;
-        if (!WriteFdExactly(fd, buffer, len)) {
-            int saved_errno = errno;
-            close(fd);
-            if (do_unlink) unlink(path);
-            fd = -1;
-            errno = saved_errno;
-            if (fail_errno(s)) return -1;
+        if (decoder) {
+            if (!decoder->process(buffer, len, write_data)) {
+                fail_message(s, "failed to decompress data");
+                goto fail;
+            }
+        } else if (!write_data(buffer, len)) {
+            return -1;
         }
     }
 
-    if (fd >= 0) {
-        struct utimbuf u;
-        close(fd);
-        //selinux_android_restorecon(path, 0);
-        u.actime = timestamp;
-        u.modtime = timestamp;
-        utime(path, &u);
+    if (decoder && (fd >= 0 || dry_run) && !decoder->finish(write_data)) {
+        fail_message(s, "truncated compressed data");
+        goto fail;
+    }
+
+    if (fd >= 0 || dry_run) {
+        if (fd >= 0) {
+            struct utimbuf u;
+            close(fd);
+            //selinux_android_restorecon(path, 0);
+            u.actime = timestamp;
+            u.modtime = timestamp;
+            utime(path, &u);
+        }
 
         msg.status.id = ID_OKAY;
         msg.status.msglen = 0;
@@ -244,7 +615,7 @@ static int handle_send_file(int s, char *path, uid_t uid,
 fail:
     if (fd >= 0)
         close(fd);
-    if (do_unlink) unlink(path);
+    if (do_unlink && !dry_run) unlink(path);
     return -1;
 }
 
@@ -299,37 +670,46 @@ static int handle_send_link(int s, char *path, char *buffer)
     return 0;
 }
 
-static int do_send(int s, char *path, char *buffer)
+static int send_file_or_link(int s, char *path, unsigned int mode,
+        bool have_mode, unsigned int flags, char *buffer)
 {
-    unsigned int mode;
     bool is_link = false;
     bool do_unlink;
+    bool dry_run = flags & SYNC_FLAG_DRY_RUN;
 
-    char* tmp = strrchr(path,',');
-    if (tmp) {
-        *tmp = 0;
-        errno = 0;
-        mode = strtoul(tmp + 1, NULL, 0);
-        is_link = S_ISLNK((mode_t) mode);
-        mode &= 0777;
-    }
-    if (!tmp || errno) {
+    if (!have_mode) {
         mode = 0644;
-        is_link = 0;
         do_unlink = true;
     } else {
+        is_link = S_ISLNK((mode_t) mode);
+        mode &= 0777;
+
         struct stat st;
         /* Don't delete files before copying if they are not "regular" */
         do_unlink = lstat(path, &st) || S_ISREG(st.st_mode) || S_ISLNK(st.st_mode);
-        if (do_unlink) {
+        if (do_unlink && !dry_run) {
             unlink(path);
         }
     }
 
+    // Symlink targets are never compressed
     if (is_link) {
+        if (dry_run) {
+            fail_message(s, "dry run is not supported for symlinks");
+            return -1;
+        }
         return handle_send_link(s, path, buffer);
     }
 
+    std::unique_ptr<SyncCodec> decoder;
+    if ((flags & ~SYNC_FLAG_DRY_RUN) != SYNC_FLAG_NONE) {
+        decoder = create_codec(flags, false);
+        if (!decoder) {
+            fail_message(s, "failed to initialize decompressor");
+            return -1;
+        }
+    }
+
     uid_t uid = -1;
     gid_t gid = -1;
 
@@ -337,16 +717,192 @@ static int do_send(int s, char *path, char *buffer)
     mode |= ((mode >> 3) & 0070);
     mode |= ((mode >> 3) & 0007);
 
-    tmp = path;
-    if (*tmp == '/') {
-        tmp++;
+    return handle_send_file(s, path, uid, gid, mode, buffer, do_unlink,
+                            decoder.get(), dry_run);
+}
+
+static int do_send(int s, char *path, char *buffer)
+{
+    unsigned int mode = 0;
+    bool have_mode = false;
+
+    char* tmp = strrchr(path,',');
+    if (tmp) {
+        *tmp = 0;
+        errno = 0;
+        mode = strtoul(tmp + 1, NULL, 0);
+        have_mode = !errno;
+    }
+
+    return send_file_or_link(s, path, mode, have_mode, SYNC_FLAG_NONE, buffer);
+}
+
+// Unlike ID_SEND, the mode is not appended to the path, but sent separately
+// along with the flags
+static int do_send_v2(int s, char *path, char *buffer)
+{
+    syncmsg msg;
+
+    if (!ReadFdExactly(s, &msg.send_v2, sizeof(msg.send_v2)))
+        return -1;
+    if (msg.send_v2.id != ID_SEND_V2) {
+        fail_message(s, "invalid send_v2 message");
+        return -1;
+    }
+
+    unsigned int flags = ltohl(msg.send_v2.flags);
+    if (!is_supported_compression(flags)) {
+        fail_message(s, "unsupported compression type");
+        return -1;
     }
-    return handle_send_file(s, path, uid, gid, mode, buffer, do_unlink);
+
+    return send_file_or_link(s, path, ltohl(msg.send_v2.mode), true, flags,
+                             buffer);
 }
 
-static int do_recv(int s, const char *path, char *buffer)
+// Send a regular file of a known size. The data is sent with sendfile() so that
+// it doesn't have to be copied through userspace, falling back to pread() if
+// the filesystem doesn't support it.
+static int send_file_data(int s, int fd, off_t size, char *buffer)
 {
     syncmsg msg;
+    off_t offset = 0;
+    bool use_sendfile = true;
+
+    msg.data.id = ID_DATA;
+    while (offset < size) {
+        size_t chunk = size - offset < SYNC_DATA_MAX
+                ? static_cast<size_t>(size - offset) : SYNC_DATA_MAX;
+        size_t sent = 0;
+
+        msg.data.size = htoll(chunk);
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data))) {
+            return -1;
+        }
+
+        while (sent < chunk) {
+            ssize_t n;
+
+            if (use_sendfile) {
+                n = sendfile(s, fd, &offset, chunk - sent);
+                if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    use_sendfile = false;
+                    continue;
+                }
+            } else {
+                n = pread(fd, buffer, chunk - sent, offset);
+                if (n > 0 && !WriteFdExactly(s, buffer, n)) {
+                    return -1;
+                } else if (n > 0) {
+                    offset += n;
+                }
+            }
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                // The chunk size was already sent, so the file shrinking or a
+                // read error can't be reported in-band
+                ADB_LOGE(ADB_SERV, "failed to send file data: %s",
+                         n < 0 ? strerror(errno) : "unexpected EOF");
+                return -1;
+            }
+
+            sent += n;
+        }
+    }
+
+    return 0;
+}
+
+// Packs a stream into ID_DATA messages of up to SYNC_DATA_MAX bytes
+class SyncDataWriter
+{
+public:
+    explicit SyncDataWriter(int s) : m_s(s)
+    {
+        m_buf.reserve(SYNC_DATA_MAX);
+    }
+
+    bool write(const char *data, size_t size)
+    {
+        while (size > 0) {
+            size_t n = SYNC_DATA_MAX - m_buf.size();
+            if (n > size) {
+                n = size;
+            }
+            m_buf.insert(m_buf.end(), data, data + n);
+            data += n;
+            size -= n;
+
+            if (m_buf.size() == SYNC_DATA_MAX && !flush()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool flush()
+    {
+        if (m_buf.empty()) {
+            return true;
+        }
+
+        syncmsg msg;
+        msg.data.id = ID_DATA;
+        msg.data.size = htoll(m_buf.size());
+        if (!WriteFdExactly(m_s, &msg.data, sizeof(msg.data))
+                || !WriteFdExactly(m_s, m_buf.data(), m_buf.size())) {
+            return false;
+        }
+        m_buf.clear();
+        return true;
+    }
+
+private:
+    int m_s;
+    std::vector<char> m_buf;
+};
+
+// Send the file contents as a compressed stream. Returns 1 if everything was
+// sent, 0 if a failure was reported to the client, or -1 if the connection
+// failed.
+static int send_compressed_file(int s, int fd, unsigned int flags,
+                                char *buffer)
+{
+    std::unique_ptr<SyncCodec> encoder = create_codec(flags, true);
+    if (!encoder) {
+        return fail_message(s, "failed to initialize compressor");
+    }
+
+    SyncDataWriter writer(s);
+    SyncSink sink = [&](const char *data, size_t size) {
+        return writer.write(data, size);
+    };
+
+    for (;;) {
+        int r = adb_read(fd, buffer, SYNC_DATA_MAX);
+        if (r < 0) {
+            return fail_errno(s);
+        } else if (r == 0) {
+            break;
+        }
+        if (!encoder->process(buffer, r, sink)) {
+            return -1;
+        }
+    }
+
+    if (!encoder->finish(sink) || !writer.flush()) {
+        return -1;
+    }
+
+    return 1;
+}
+
+static int do_recv(int s, const char *path, unsigned int flags, char *buffer)
+{
+    syncmsg msg;
+    struct stat sb;
     int fd, r;
 
     fd = adb_open(path, O_RDONLY | O_CLOEXEC);
@@ -355,12 +911,32 @@ static int do_recv(int s, const char *path, char *buffer)
         return 0;
     }
 
+    // The size of files in /proc, /sys, etc. can't be trusted
+    r = 1;
+    if (flags != SYNC_FLAG_NONE) {
+        r = send_compressed_file(s, fd, flags, buffer);
+        if (r <= 0) {
+            close(fd);
+            return r;
+        }
+        r = 0;
+    } else if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        if (send_file_data(s, fd, sb.st_size, buffer) < 0) {
+            close(fd);
+            return -1;
+        }
+        r = 0;
+    }
+
     msg.data.id = ID_DATA;
-    for (;;) {
+    while (r > 0) {
         r = adb_read(fd, buffer, SYNC_DATA_MAX);
         if (r <= 0) {
             if (r == 0) break;
-            if (errno == EINTR) continue;
+            if (errno == EINTR) {
+                r = 1;
+                continue;
+            }
             r = fail_errno(s);
             close(fd);
             return r;
@@ -384,6 +960,38 @@ static int do_recv(int s, const char *path, char *buffer)
     return 0;
 }
 
+static int do_recv_v2(int s, const char *path, char *buffer)
+{
+    syncmsg msg;
+
+    if (!ReadFdExactly(s, &msg.recv_v2, sizeof(msg.recv_v2)))
+        return -1;
+    if (msg.recv_v2.id != ID_RECV_V2) {
+        fail_message(s, "invalid recv_v2 message");
+        return -1;
+    }
+
+    unsigned int flags = ltohl(msg.recv_v2.flags);
+    if ((flags & SYNC_FLAG_DRY_RUN) || !is_supported_compression(flags)) {
+        fail_message(s, "unsupported compression type");
+        return -1;
+    }
+
+    return do_recv(s, path, flags, buffer);
+}
+
+const char *file_sync_features()
+{
+    return "sendrecv_v2"
+#ifdef MINIADBD_HAVE_LZ4
+            ",sendrecv_v2_lz4"
+#endif
+#ifdef MINIADBD_HAVE_ZSTD
+            ",sendrecv_v2_zstd"
+#endif
+            ",sendrecv_v2_dry_run_send";
+}
+
 void file_sync_service(int fd, void *cookie)
 {
     syncmsg msg;
@@ -424,8 +1032,14 @@ void file_sync_service(int fd, void *cookie)
         case ID_SEND:
             if (do_send(fd, name, buffer)) goto fail;
             break;
+        case ID_SEND_V2:
+            if (do_send_v2(fd, name, buffer)) goto fail;
+            break;
         case ID_RECV:
-            if (do_recv(fd, name, buffer)) goto fail;
+            if (do_recv(fd, name, SYNC_FLAG_NONE, buffer)) goto fail;
+            break;
+        case ID_RECV_V2:
+            if (do_recv_v2(fd, name, buffer)) goto fail;
             break;
         case ID_QUIT:
             goto fail;
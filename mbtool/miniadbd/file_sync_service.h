@@ -29,6 +29,8 @@
 #define ID_ULNK MKID('U','L','N','K')
 #define ID_SEND MKID('S','E','N','D')
 #define ID_RECV MKID('R','E','C','V')
+#define ID_SEND_V2 MKID('S','N','D','2')
+#define ID_RECV_V2 MKID('R','C','V','2')
 #define ID_DENT MKID('D','E','N','T')
 #define ID_DONE MKID('D','O','N','E')
 #define ID_DATA MKID('D','A','T','A')
@@ -36,6 +38,13 @@
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
 
+// Flags for ID_SEND_V2 and ID_RECV_V2. At most one compression type may be set.
+#define SYNC_FLAG_NONE    0u
+#define SYNC_FLAG_BROTLI  1u
+#define SYNC_FLAG_LZ4     2u
+#define SYNC_FLAG_ZSTD    4u
+#define SYNC_FLAG_DRY_RUN 0x80000000u
+
 union syncmsg {
     unsigned id;
     struct {
@@ -63,11 +72,23 @@ union syncmsg {
         unsigned id;
         unsigned msglen;
     } status;
+    struct {
+        unsigned id;
+        unsigned mode;
+        unsigned flags;
+    } send_v2;
+    struct {
+        unsigned id;
+        unsigned flags;
+    } recv_v2;
 };
 
 
 void file_sync_service(int fd, void *cookie);
 
+// Comma-separated list of sync features to advertise in the connect banner
+const char *file_sync_features();
+
 #define SYNC_DATA_MAX (64*1024)
 
 #endif
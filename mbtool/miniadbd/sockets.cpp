@@ -16,6 +16,8 @@
 
 #include "sysdeps.h"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -261,6 +263,20 @@ static void local_socket_close_locked(asocket *s)
     insert_local_socket(s, &local_socket_closing_list);
 }
 
+size_t get_max_payload(asocket *s)
+{
+    size_t max_payload = MAX_PAYLOAD;
+
+    if (s->transport) {
+        max_payload = std::min(max_payload, s->transport->max_payload);
+    }
+    if (s->peer && s->peer->transport) {
+        max_payload = std::min(max_payload, s->peer->transport->max_payload);
+    }
+
+    return max_payload;
+}
+
 static void local_socket_event_func(int fd, unsigned ev, void* _s)
 {
     asocket* s = reinterpret_cast<asocket*>(_s);
@@ -325,7 +341,8 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     if (ev & FDE_READ) {
         apacket *p = get_apacket();
         unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
+        size_t max_payload = get_max_payload(s);
+        size_t avail = max_payload;
         int r;
         int is_eof = 0;
 
@@ -351,10 +368,10 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
         ADB_LOGD(ADB_SOCK,
                  "LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d",
                  s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if ((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if ((avail == max_payload) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = MAX_PAYLOAD - avail;
+            p->len = max_payload - avail;
 
             r = s->peer->enqueue(s->peer, p);
             ADB_LOGD(ADB_SOCK, "LS(%d): fd=%d post peer->enqueue(). r=%d",
@@ -208,11 +208,16 @@ void send_packet(apacket *p, atransport *t)
 
     p->msg.magic = p->msg.command ^ 0xffffffff;
 
-    count = p->msg.data_length;
-    x = (unsigned char *) p->data;
+    // A_CNXN always has a checksum since the host may not have negotiated the
+    // version yet when it receives it
     sum = 0;
-    while (count-- > 0) {
-        sum += *x++;
+    if (!t || t->protocol_version < A_VERSION_SKIP_CHECKSUM
+            || p->msg.command == A_CNXN) {
+        count = p->msg.data_length;
+        x = (unsigned char *) p->data;
+        while (count-- > 0) {
+            sum += *x++;
+        }
     }
     p->msg.data_check = sum;
 
@@ -674,11 +679,18 @@ int check_header(apacket *p)
     return 0;
 }
 
-int check_data(apacket *p)
+int check_data(apacket *p, atransport *t)
 {
     unsigned count, sum;
     unsigned char *x;
 
+    // Newer hosts may omit the checksum, even in their first A_CNXN
+    if (t->protocol_version >= A_VERSION_SKIP_CHECKSUM
+            || (p->msg.command == A_CNXN
+                    && p->msg.arg0 >= A_VERSION_SKIP_CHECKSUM)) {
+        return 0;
+    }
+
     count = p->msg.data_length;
     x = p->data;
     sum = 0;
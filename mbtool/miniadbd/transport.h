@@ -47,7 +47,7 @@ void register_usb_transport(usb_handle* h, const char* serial,
 void unregister_usb_transport(usb_handle* usb);
 
 int check_header(apacket* p);
-int check_data(apacket* p);
+int check_data(apacket* p, atransport* t);
 
 void send_packet(apacket* p, atransport* t);
 
@@ -38,7 +38,7 @@ static int remote_read(apacket *p, atransport *t)
         }
     }
 
-    if (check_data(p)) {
+    if (check_data(p, t)) {
         ADB_LOGE(ADB_TSPT, "remote usb: check_data failed");
         return -1;
     }
@@ -83,6 +83,8 @@ void init_usb_transport(atransport *t, usb_handle *h, int state)
     t->write_to_remote = remote_write;
     t->sync_token = 1;
     t->connection_state = state;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
     t->type = kTransportUsb;
     t->usb = h;
 }
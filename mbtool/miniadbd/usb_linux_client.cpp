@@ -20,7 +20,11 @@
 #include <cstring>
 
 #include <endian.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
 
@@ -32,6 +36,29 @@
 #define MAX_PACKET_SIZE_HS      512
 #define MAX_PACKET_SIZE_SS      1024
 
+// Now that payloads can be larger than MAX_PAYLOAD_V1, transfers are split up
+// to stay within what the kernel drivers accept. FunctionFS allocates a
+// contiguous kernel buffer per transfer, which can fail for large sizes, and
+// the f_adb driver rejects reads larger than 4096 bytes.
+#define USB_FFS_MAX_WRITE       16384
+#define USB_FFS_MAX_READ        16384
+#define USB_ADB_MAX_READ        4096
+
+// Number of transfers that can be outstanding per direction when using AIO.
+// This is enough for a full packet to be queued at once.
+#define USB_FFS_NUM_BUFS        (MAX_PAYLOAD / USB_FFS_MAX_READ + 1)
+
+// State for submitting several FunctionFS transfers at once. Completions are
+// signalled through an eventfd.
+struct aio_block
+{
+    struct iocb iocb[USB_FFS_NUM_BUFS];
+    struct iocb *iocbs[USB_FFS_NUM_BUFS];
+    struct io_event events[USB_FFS_NUM_BUFS];
+    aio_context_t ctx;
+    int eventfd;
+};
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
@@ -51,6 +78,11 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+
+    // FunctionFS AIO (one block per direction since the reads and writes
+    // happen on different threads)
+    aio_block read_aiob;
+    aio_block write_aiob;
 };
 
 struct func_desc {
@@ -268,14 +300,18 @@ static int usb_adb_write(usb_handle *h, const void *data, int len)
 
 static int usb_adb_read(usb_handle *h, void *data, int len)
 {
-    int n;
-
     ADB_LOGD(ADB_USB, "about to read (fd=%d, len=%d)", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if (n != len) {
-        ADB_LOGE(ADB_USB, "ERROR: fd = %d, n = %d, errno = %d (%s)",
-                 h->fd, n, errno, strerror(errno));
-        return -1;
+    uint8_t *ptr = reinterpret_cast<uint8_t*>(data);
+    while (len > 0) {
+        int xfer = len < USB_ADB_MAX_READ ? len : USB_ADB_MAX_READ;
+        int n = adb_read(h->fd, ptr, xfer);
+        if (n != xfer) {
+            ADB_LOGE(ADB_USB, "ERROR: fd = %d, n = %d, errno = %d (%s)",
+                     h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        ptr += n;
+        len -= n;
     }
     ADB_LOGD(ADB_USB, "[ done fd=%d ]", h->fd);
     return 0;
@@ -442,7 +478,12 @@ static int bulk_write(int bulk_in, const uint8_t* buf, size_t length)
     int ret;
 
     do {
-        ret = adb_write(bulk_in, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_WRITE) {
+            xfer = USB_FFS_MAX_WRITE;
+        }
+
+        ret = adb_write(bulk_in, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR)
                 return ret;
@@ -474,7 +515,12 @@ static int bulk_read(int bulk_out, uint8_t* buf, size_t length)
     int ret;
 
     do {
-        ret = adb_read(bulk_out, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_READ) {
+            xfer = USB_FFS_MAX_READ;
+        }
+
+        ret = adb_read(bulk_out, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR) {
                 ADB_LOGE(ADB_USB,
@@ -503,6 +549,214 @@ static int usb_ffs_read(usb_handle* h, void* data, int len)
     return 0;
 }
 
+// bionic and glibc don't wrap the kernel AIO syscalls
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return static_cast<int>(syscall(__NR_io_setup, nr, ctx));
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+    return static_cast<int>(syscall(__NR_io_destroy, ctx));
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return static_cast<int>(syscall(__NR_io_submit, ctx, nr, iocbpp));
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+                        struct io_event *events, struct timespec *timeout)
+{
+    return static_cast<int>(
+            syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout));
+}
+
+static bool aio_block_init(aio_block *aiob)
+{
+    memset(aiob, 0, sizeof(*aiob));
+
+    for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+        aiob->iocbs[i] = &aiob->iocb[i];
+    }
+
+    aiob->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (aiob->eventfd < 0) {
+        ADB_LOGE(ADB_USB, "[ aio: eventfd failed: errno=%d ]", errno);
+        return false;
+    }
+
+    if (io_setup(USB_FFS_NUM_BUFS, &aiob->ctx) < 0) {
+        ADB_LOGE(ADB_USB, "[ aio: io_setup failed: errno=%d ]", errno);
+        close(aiob->eventfd);
+        aiob->eventfd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static void aio_block_destroy(aio_block *aiob)
+{
+    if (aiob->ctx) {
+        io_destroy(aiob->ctx);
+        aiob->ctx = 0;
+    }
+    if (aiob->eventfd >= 0) {
+        close(aiob->eventfd);
+        aiob->eventfd = -1;
+    }
+}
+
+// Wait for the completions of the first n submitted transfers. Every transfer
+// must complete before returning since the kernel writes to the buffers.
+static bool aio_wait(aio_block *aiob, int n)
+{
+    int done = 0;
+    bool ok = true;
+
+    while (done < n) {
+        pollfd pfd = {};
+        pfd.fd = aiob->eventfd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Without the eventfd, fall back to blocking for the rest
+            ADB_LOGE(ADB_USB, "[ aio: poll failed: errno=%d ]", errno);
+            ok = false;
+        } else {
+            uint64_t count;
+            if (adb_read(aiob->eventfd, &count, sizeof(count)) < 0
+                    && errno != EAGAIN) {
+                ADB_LOGE(ADB_USB, "[ aio: eventfd read failed: errno=%d ]",
+                         errno);
+            }
+        }
+
+        struct timespec zero = {};
+        int ret = io_getevents(aiob->ctx, ok ? 0 : n - done, n - done,
+                               aiob->events + done, ok ? &zero : nullptr);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ADB_LOGE(ADB_USB, "[ aio: io_getevents failed: errno=%d ]", errno);
+            // Nothing else can be done, so make sure the buffers are no longer
+            // in use by tearing down the context
+            io_destroy(aiob->ctx);
+            if (io_setup(USB_FFS_NUM_BUFS, &aiob->ctx) < 0) {
+                aiob->ctx = 0;
+            }
+            return false;
+        }
+        done += ret;
+    }
+
+    return ok;
+}
+
+// Transfer len bytes to or from an endpoint, splitting it into transfers of at
+// most USB_FFS_MAX_READ bytes that are all queued at once. Returns 0 if every
+// transfer completed in full.
+static int usb_ffs_do_aio(usb_handle *h, void *data, int len, bool is_read)
+{
+    aio_block *aiob = is_read ? &h->read_aiob : &h->write_aiob;
+    int fd = is_read ? h->bulk_out : h->bulk_in;
+    uint8_t *ptr = reinterpret_cast<uint8_t *>(data);
+    int num_bufs = 0;
+
+    if (!aiob->ctx) {
+        errno = EIO;
+        return -1;
+    }
+
+    for (int remain = len; remain > 0; ++num_bufs) {
+        int xfer = remain < USB_FFS_MAX_READ ? remain : USB_FFS_MAX_READ;
+
+        struct iocb *cb = &aiob->iocb[num_bufs];
+        memset(cb, 0, sizeof(*cb));
+        cb->aio_fildes = static_cast<uint32_t>(fd);
+        cb->aio_lio_opcode = is_read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+        cb->aio_buf = reinterpret_cast<uintptr_t>(ptr);
+        cb->aio_nbytes = static_cast<__u64>(xfer);
+        cb->aio_flags = IOCB_FLAG_RESFD;
+        cb->aio_resfd = static_cast<uint32_t>(aiob->eventfd);
+        cb->aio_data = static_cast<__u64>(xfer);
+
+        ptr += xfer;
+        remain -= xfer;
+    }
+
+    while (true) {
+        int submitted = io_submit(aiob->ctx, num_bufs, aiob->iocbs);
+        if (submitted < 0 && errno == EINTR) {
+            continue;
+        } else if (submitted < num_bufs) {
+            ADB_LOGE(ADB_USB, "[ aio: io_submit failed (%d/%d): errno=%d ]",
+                     submitted, num_bufs, errno);
+            if (submitted > 0) {
+                aio_wait(aiob, submitted);
+            }
+            return -1;
+        }
+
+        if (!aio_wait(aiob, num_bufs)) {
+            return -1;
+        }
+
+        // A zero-length packet that the host sent after the previous transfer
+        // completes a read early. It can only land in the first read after a
+        // transfer, which is always a single-buffer header read.
+        if (is_read && num_bufs == 1 && aiob->events[0].res == 0) {
+            continue;
+        }
+
+        for (int i = 0; i < num_bufs; ++i) {
+            const io_event &ev = aiob->events[i];
+            if (ev.res < 0) {
+                errno = static_cast<int>(-ev.res);
+                ADB_LOGE(ADB_USB, "[ aio: %s failed: errno=%d ]",
+                         is_read ? "read" : "write", errno);
+                return -1;
+            } else if (static_cast<uint64_t>(ev.res) != ev.data) {
+                ADB_LOGE(ADB_USB, "[ aio: short %s: %lld/%llu ]",
+                         is_read ? "read" : "write",
+                         static_cast<long long>(ev.res),
+                         static_cast<unsigned long long>(ev.data));
+                errno = EIO;
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+}
+
+static int usb_ffs_aio_write(usb_handle *h, const void *data, int len)
+{
+    ADB_LOGD(ADB_USB, "about to write (fd=%d, len=%d)", h->bulk_in, len);
+    if (usb_ffs_do_aio(h, const_cast<void *>(data), len, false) < 0) {
+        ADB_LOGE(ADB_USB, "ERROR: fd = %d: %s", h->bulk_in, strerror(errno));
+        return -1;
+    }
+    ADB_LOGD(ADB_USB, "[ done fd=%d ]", h->bulk_in);
+    return 0;
+}
+
+static int usb_ffs_aio_read(usb_handle *h, void *data, int len)
+{
+    ADB_LOGD(ADB_USB, "about to read (fd=%d, len=%d)", h->bulk_out, len);
+    if (usb_ffs_do_aio(h, data, len, true) < 0) {
+        ADB_LOGE(ADB_USB, "ERROR: fd = %d: %s", h->bulk_out, strerror(errno));
+        return -1;
+    }
+    ADB_LOGD(ADB_USB, "[ done fd=%d ]", h->bulk_out);
+    return 0;
+}
+
 static void usb_ffs_kick(usb_handle *h)
 {
     int err;
@@ -535,8 +789,17 @@ static void usb_ffs_init()
     usb_handle* h = reinterpret_cast<usb_handle*>(calloc(1, sizeof(usb_handle)));
     if (h == nullptr) fatal("couldn't allocate usb_handle");
 
-    h->write = usb_ffs_write;
-    h->read = usb_ffs_read;
+    // Queue several transfers at once if the kernel supports AIO
+    if (aio_block_init(&h->read_aiob) && aio_block_init(&h->write_aiob)) {
+        ADB_LOGD(ADB_USB, "[ usb_init - using AIO ]");
+        h->write = usb_ffs_aio_write;
+        h->read = usb_ffs_aio_read;
+    } else {
+        aio_block_destroy(&h->read_aiob);
+        aio_block_destroy(&h->write_aiob);
+        h->write = usb_ffs_write;
+        h->read = usb_ffs_read;
+    }
     h->kick = usb_ffs_kick;
     h->control = -1;
     h->bulk_out = -1;
@@ -0,0 +1,646 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mkfs_ext4.h"
+
+#include <algorithm>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/mkfs_ext4"
+
+// <linux/fs.h> defines the kernel's 1 KiB BLOCK_SIZE, which is unrelated
+#undef BLOCK_SIZE
+
+// The filesystem is laid out the same way as mke2fs does without flex_bg:
+// every block group starts with its superblock backup (if any), followed by
+// its bitmaps and its inode table. Only group 0 contains any data. Since the
+// image file is created sparse, everything that is not written reads back as
+// zeros, so the inode tables never need to be initialized and every group
+// but the first and last can be marked as uninitialized. See
+// Documentation/filesystems/ext4/ in the kernel source tree for the layout.
+
+constexpr uint32_t BLOCK_SIZE                   = 4096;
+constexpr uint32_t LOG_BLOCK_SIZE               = 2;
+constexpr uint32_t BLOCKS_PER_GROUP             = 8 * BLOCK_SIZE;
+constexpr uint32_t INODE_SIZE                   = 256;
+constexpr uint32_t INODES_PER_BLOCK             = BLOCK_SIZE / INODE_SIZE;
+constexpr uint32_t BYTES_PER_INODE              = 16384;
+constexpr uint32_t DESC_SIZE                    = 32;
+constexpr uint16_t EXTRA_ISIZE                  = 32;
+
+// Groups with fewer free blocks than this at the end of the image are dropped
+constexpr uint32_t MIN_LAST_GROUP_FREE_BLOCKS   = 50;
+
+constexpr uint32_t ROOT_INO                     = 2;
+constexpr uint32_t JOURNAL_INO                  = 8;
+constexpr uint32_t FIRST_INO                    = 11;
+constexpr uint32_t LOST_FOUND_INO               = 11;
+
+constexpr uint16_t EXT4_SUPER_MAGIC             = 0xef53;
+
+constexpr uint32_t EXT4_FEATURE_COMPAT_HAS_JOURNAL      = 0x0004;
+constexpr uint32_t EXT4_FEATURE_COMPAT_EXT_ATTR         = 0x0008;
+constexpr uint32_t EXT4_FEATURE_COMPAT_DIR_INDEX        = 0x0020;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_FILETYPE       = 0x0002;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_EXTENTS        = 0x0040;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER  = 0x0001;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_LARGE_FILE    = 0x0002;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_GDT_CSUM      = 0x0010;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_DIR_NLINK     = 0x0020;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE   = 0x0040;
+
+constexpr uint32_t EXT4_DEFM_XATTR_USER         = 0x0004;
+constexpr uint32_t EXT4_DEFM_ACL                = 0x0008;
+
+constexpr uint32_t EXT2_FLAGS_SIGNED_HASH       = 0x0001;
+constexpr uint32_t EXT2_FLAGS_UNSIGNED_HASH     = 0x0002;
+
+constexpr uint16_t EXT4_BG_INODE_UNINIT         = 0x0001;
+constexpr uint16_t EXT4_BG_BLOCK_UNINIT         = 0x0002;
+constexpr uint16_t EXT4_BG_INODE_ZEROED         = 0x0004;
+
+constexpr uint32_t EXT4_EXTENTS_FL              = 0x00080000;
+constexpr uint16_t EXT4_EXT_MAGIC               = 0xf30a;
+constexpr uint32_t EXT4_MAX_EXTENT_LEN          = 32768;
+
+constexpr uint8_t EXT4_FT_DIR                   = 2;
+
+constexpr uint32_t JBD2_MAGIC_NUMBER            = 0xc03b3998;
+constexpr uint32_t JBD2_SUPERBLOCK_V2           = 4;
+
+// Journal sizes are the same as mke2fs's defaults, but limited to what fits
+// in the first block group
+constexpr uint32_t MIN_JOURNAL_BLOCKS           = 1024;
+
+namespace mb
+{
+
+struct Ext4Geometry
+{
+    uint64_t blocks_count;
+    uint32_t groups;
+    uint32_t inodes_per_group;
+    uint32_t inode_table_blocks;
+    uint32_t gdt_blocks;
+    uint32_t journal_blocks;
+};
+
+static void put_le16(unsigned char *p, uint16_t value)
+{
+    value = mb_htole16(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static void put_be32(unsigned char *p, uint32_t value)
+{
+    value = mb_htobe32(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static void set_bits(unsigned char *bitmap, uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; ++i) {
+        bitmap[i / 8] = static_cast<unsigned char>(bitmap[i / 8] | 1 << i % 8);
+    }
+}
+
+/*!
+ * \brief CRC16 (ANSI, reflected) used for the uninit_bg group checksums
+ */
+static uint16_t crc16(uint16_t crc, const unsigned char *data, size_t size)
+{
+    while (size-- > 0) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = static_cast<uint16_t>(
+                    crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static bool is_power_of(uint32_t n, uint32_t base)
+{
+    while (n > 1 && n % base == 0) {
+        n /= base;
+    }
+    return n == 1;
+}
+
+/*!
+ * \brief Whether a group has a superblock backup with sparse_super
+ */
+static bool group_has_super(uint32_t group)
+{
+    return group <= 1 || is_power_of(group, 3) || is_power_of(group, 5)
+            || is_power_of(group, 7);
+}
+
+static uint64_t group_first_block(uint32_t group)
+{
+    return static_cast<uint64_t>(group) * BLOCKS_PER_GROUP;
+}
+
+static uint32_t group_blocks(const Ext4Geometry &geo, uint32_t group)
+{
+    return static_cast<uint32_t>(std::min<uint64_t>(
+            BLOCKS_PER_GROUP, geo.blocks_count - group_first_block(group)));
+}
+
+static uint32_t group_super_blocks(const Ext4Geometry &geo, uint32_t group)
+{
+    return group_has_super(group) ? 1 + geo.gdt_blocks : 0;
+}
+
+static uint32_t group_overhead(const Ext4Geometry &geo, uint32_t group)
+{
+    return group_super_blocks(geo, group) + 2 + geo.inode_table_blocks;
+}
+
+static uint32_t default_journal_blocks(uint64_t blocks)
+{
+    if (blocks < 32768) {
+        return 1024;
+    } else if (blocks < 256 * 1024) {
+        return 4096;
+    } else if (blocks < 512 * 1024) {
+        return 8192;
+    } else {
+        return 16384;
+    }
+}
+
+static bool compute_geometry(uint64_t size, Ext4Geometry &geo)
+{
+    geo.blocks_count = size / BLOCK_SIZE;
+
+    while (true) {
+        uint64_t groups = (geo.blocks_count + BLOCKS_PER_GROUP - 1)
+                / BLOCKS_PER_GROUP;
+        if (groups == 0 || groups > UINT32_MAX / 8) {
+            return false;
+        }
+        geo.groups = static_cast<uint32_t>(groups);
+
+        uint64_t inodes = geo.blocks_count * BLOCK_SIZE / BYTES_PER_INODE;
+        uint64_t ipg = (inodes + geo.groups - 1) / geo.groups;
+        ipg = (ipg + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK
+                * INODES_PER_BLOCK;
+        ipg = std::clamp<uint64_t>(ipg, INODES_PER_BLOCK, 8 * BLOCK_SIZE);
+        if (ipg * geo.groups > UINT32_MAX) {
+            return false;
+        }
+        geo.inodes_per_group = static_cast<uint32_t>(ipg);
+        geo.inode_table_blocks = geo.inodes_per_group / INODES_PER_BLOCK;
+
+        geo.gdt_blocks = static_cast<uint32_t>(
+                (static_cast<uint64_t>(geo.groups) * DESC_SIZE + BLOCK_SIZE - 1)
+                / BLOCK_SIZE);
+
+        // Drop the last group if it's too small to be useful
+        uint32_t last = geo.groups - 1;
+        if (last > 0 && group_blocks(geo, last) < group_overhead(geo, last)
+                + MIN_LAST_GROUP_FREE_BLOCKS) {
+            geo.blocks_count = group_first_block(last);
+            continue;
+        }
+
+        break;
+    }
+
+    // The root directory, lost+found, and the journal are all in group 0
+    uint32_t overhead = group_overhead(geo, 0) + 2;
+    uint32_t avail = group_blocks(geo, 0);
+    if (avail < overhead + MIN_JOURNAL_BLOCKS) {
+        return false;
+    }
+
+    geo.journal_blocks = std::min({default_journal_blocks(geo.blocks_count),
+                                   avail - overhead, EXT4_MAX_EXTENT_LEN});
+
+    return true;
+}
+
+/*!
+ * \brief Fill in an inode whose data is a single extent
+ */
+static void make_inode(unsigned char *inode, uint16_t mode, uint16_t links,
+                       uint64_t first_block, uint32_t blocks, uint32_t now)
+{
+    uint64_t size = static_cast<uint64_t>(blocks) * BLOCK_SIZE;
+
+    put_le16(inode + 0, mode);
+    put_le32(inode + 4, static_cast<uint32_t>(size));
+    put_le32(inode + 8, now);
+    put_le32(inode + 12, now);
+    put_le32(inode + 16, now);
+    put_le16(inode + 26, links);
+    put_le32(inode + 28, blocks * (BLOCK_SIZE / 512));
+    put_le32(inode + 32, EXT4_EXTENTS_FL);
+
+    // Extent tree with the header and one leaf in i_block
+    unsigned char *i_block = inode + 40;
+    put_le16(i_block + 0, EXT4_EXT_MAGIC);
+    put_le16(i_block + 2, 1);
+    put_le16(i_block + 4, 4);
+    put_le16(i_block + 12 + 4, static_cast<uint16_t>(blocks));
+    put_le16(i_block + 12 + 6, static_cast<uint16_t>(first_block >> 32));
+    put_le32(i_block + 12 + 8, static_cast<uint32_t>(first_block));
+
+    put_le32(inode + 108, static_cast<uint32_t>(size >> 32));
+    put_le16(inode + 128, EXTRA_ISIZE);
+    put_le32(inode + 144, now);
+}
+
+static size_t add_dirent(unsigned char *block, size_t offset, uint32_t ino,
+                         const char *name, uint16_t rec_len)
+{
+    size_t name_len = strlen(name);
+
+    put_le32(block + offset, ino);
+    put_le16(block + offset + 4, rec_len);
+    block[offset + 6] = static_cast<unsigned char>(name_len);
+    block[offset + 7] = EXT4_FT_DIR;
+    memcpy(block + offset + 8, name, name_len);
+
+    return offset + rec_len;
+}
+
+static bool pwrite_full(int fd, const void *buf, size_t size, uint64_t block)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+    auto offset = static_cast<off64_t>(block * BLOCK_SIZE);
+
+    while (size > 0) {
+        ssize_t n = pwrite64(fd, ptr, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Make the first \p size bytes of a block device read back as zeros
+ *
+ * The range is discarded first so that a loop device releases the blocks of
+ * its backing file. If the device does not guarantee that discarded blocks
+ * read back as zeros, the range is explicitly zeroed, which the kernel
+ * offloads to the device (or backing file) where possible.
+ */
+static bool zero_blockdev(int fd, const std::string &path, uint64_t size)
+{
+    uint64_t range[2] = { 0, size };
+    unsigned int discard_zeroes = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+
+    if (ioctl(fd, BLKDISCARD, range) < 0) {
+        LOGV("%s: Failed to discard: %s", path.c_str(), strerror(errno));
+    } else if (ioctl(fd, BLKDISCARDZEROES, &discard_zeroes) < 0) {
+        discard_zeroes = 0;
+    }
+
+    if (!discard_zeroes && ioctl(fd, BLKZEROOUT, range) < 0) {
+        LOGE("%s: Failed to zero: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+#pragma GCC diagnostic pop
+
+    return true;
+}
+
+/*!
+ * \brief Create an empty ext4 image without running an external mkfs
+ *
+ * The file is truncated and recreated as a sparse file of \p size bytes
+ * (rounded down to the block size). If \p path is a block device, such as a
+ * loop device backed by an image, it is discarded and zeroed instead, which is
+ * equally fast when the device can offload it. Only the superblocks, group descriptors,
+ * the first and last groups' bitmaps, the first inode table block, the root
+ * and lost+found directories, and the journal superblock are written, so
+ * creating the image takes about the same time regardless of its size.
+ *
+ * \param path Path to image file
+ * \param size Size of image
+ *
+ * \return Whether the image was successfully created
+ */
+bool mkfs_ext4(const std::string &path, uint64_t size)
+{
+    Ext4Geometry geo;
+
+    if (!compute_geometry(size, geo)) {
+        LOGE("%s: Cannot create ext4 image of size %" PRIu64,
+             path.c_str(), size);
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (S_ISBLK(st.st_mode)) {
+        if (!zero_blockdev(fd, path, geo.blocks_count * BLOCK_SIZE)) {
+            return false;
+        }
+    } else if (ftruncate64(fd, 0) < 0 || ftruncate64(
+            fd, static_cast<off64_t>(geo.blocks_count * BLOCK_SIZE)) < 0) {
+        // Truncating to 0 first guarantees that the unwritten blocks, which
+        // includes the inode tables, are all zeros
+        LOGE("%s: Failed to truncate: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto now = static_cast<uint32_t>(time(nullptr));
+
+    unsigned char uuid[16];
+    unsigned char hash_seed[16];
+    {
+        std::random_device rd;
+        for (size_t i = 0; i < sizeof(uuid); i += 4) {
+            put_le32(uuid + i, rd());
+            put_le32(hash_seed + i, rd());
+        }
+    }
+    // Random (version 4) UUID
+    uuid[6] = static_cast<unsigned char>((uuid[6] & 0x0f) | 0x40);
+    uuid[8] = static_cast<unsigned char>((uuid[8] & 0x3f) | 0x80);
+
+    // Blocks in group 0 after its metadata
+    uint64_t root_block = group_overhead(geo, 0);
+    uint64_t lost_found_block = root_block + 1;
+    uint64_t journal_block = root_block + 2;
+
+    // Group descriptors
+    std::vector<unsigned char> gdt(
+            static_cast<size_t>(geo.gdt_blocks) * BLOCK_SIZE);
+    uint64_t free_blocks = 0;
+    uint32_t last = geo.groups - 1;
+
+    for (uint32_t g = 0; g < geo.groups; ++g) {
+        unsigned char *desc = gdt.data() + g * DESC_SIZE;
+        uint64_t block_bitmap = group_first_block(g)
+                + group_super_blocks(geo, g);
+        uint32_t group_free = group_blocks(geo, g) - group_overhead(geo, g);
+        uint32_t free_inodes = geo.inodes_per_group;
+        uint16_t flags = EXT4_BG_INODE_ZEROED;
+
+        if (g == 0) {
+            group_free -= 2 + geo.journal_blocks;
+            free_inodes -= FIRST_INO;
+            put_le16(desc + 16, 2);
+        } else {
+            flags |= EXT4_BG_INODE_UNINIT;
+            if (g != last) {
+                flags |= EXT4_BG_BLOCK_UNINIT;
+            }
+        }
+
+        put_le32(desc + 0, static_cast<uint32_t>(block_bitmap));
+        put_le32(desc + 4, static_cast<uint32_t>(block_bitmap + 1));
+        put_le32(desc + 8, static_cast<uint32_t>(block_bitmap + 2));
+        put_le16(desc + 12, static_cast<uint16_t>(group_free));
+        put_le16(desc + 14, static_cast<uint16_t>(free_inodes));
+        put_le16(desc + 18, flags);
+        put_le16(desc + 28, static_cast<uint16_t>(free_inodes));
+
+        unsigned char group_le[4];
+        put_le32(group_le, g);
+
+        uint16_t crc = crc16(0xffff, uuid, sizeof(uuid));
+        crc = crc16(crc, group_le, sizeof(group_le));
+        crc = crc16(crc, desc, 30);
+        put_le16(desc + 30, crc);
+
+        free_blocks += group_free;
+    }
+
+    // Inodes 1-16 all fit in the first block of group 0's inode table
+    std::vector<unsigned char> itable(BLOCK_SIZE);
+
+    make_inode(itable.data() + (ROOT_INO - 1) * INODE_SIZE,
+               040755, 3, root_block, 1, now);
+    make_inode(itable.data() + (JOURNAL_INO - 1) * INODE_SIZE,
+               0100600, 1, journal_block, geo.journal_blocks, now);
+    make_inode(itable.data() + (LOST_FOUND_INO - 1) * INODE_SIZE,
+               040700, 2, lost_found_block, 1, now);
+
+    // Superblock
+    unsigned char sb[1024] = {};
+    put_le32(sb + 0, geo.inodes_per_group * geo.groups);
+    put_le32(sb + 4, static_cast<uint32_t>(geo.blocks_count));
+    put_le32(sb + 12, static_cast<uint32_t>(free_blocks));
+    put_le32(sb + 16, geo.inodes_per_group * geo.groups - FIRST_INO);
+    put_le32(sb + 20, 0);
+    put_le32(sb + 24, LOG_BLOCK_SIZE);
+    put_le32(sb + 28, LOG_BLOCK_SIZE);
+    put_le32(sb + 32, BLOCKS_PER_GROUP);
+    put_le32(sb + 36, BLOCKS_PER_GROUP);
+    put_le32(sb + 40, geo.inodes_per_group);
+    put_le32(sb + 48, now);
+    put_le16(sb + 54, 0xffff);
+    put_le16(sb + 56, EXT4_SUPER_MAGIC);
+    put_le16(sb + 58, 1);
+    put_le16(sb + 60, 1);
+    put_le32(sb + 64, now);
+    put_le32(sb + 76, 1);
+    put_le32(sb + 84, FIRST_INO);
+    put_le16(sb + 88, INODE_SIZE);
+    put_le32(sb + 92, EXT4_FEATURE_COMPAT_HAS_JOURNAL
+            | EXT4_FEATURE_COMPAT_EXT_ATTR
+            | EXT4_FEATURE_COMPAT_DIR_INDEX);
+    put_le32(sb + 96, EXT4_FEATURE_INCOMPAT_FILETYPE
+            | EXT4_FEATURE_INCOMPAT_EXTENTS);
+    put_le32(sb + 100, EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER
+            | EXT4_FEATURE_RO_COMPAT_LARGE_FILE
+            | EXT4_FEATURE_RO_COMPAT_GDT_CSUM
+            | EXT4_FEATURE_RO_COMPAT_DIR_NLINK
+            | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE);
+    memcpy(sb + 104, uuid, sizeof(uuid));
+    put_le32(sb + 224, JOURNAL_INO);
+    memcpy(sb + 236, hash_seed, sizeof(hash_seed));
+    sb[252] = 1; // Half MD4 directory hashes
+    sb[253] = 1; // s_jnl_blocks contains a copy of the journal's i_block
+    put_le32(sb + 256, EXT4_DEFM_XATTR_USER | EXT4_DEFM_ACL);
+    put_le32(sb + 264, now);
+    memcpy(sb + 268, itable.data() + (JOURNAL_INO - 1) * INODE_SIZE + 40, 60);
+    memcpy(sb + 328, itable.data() + (JOURNAL_INO - 1) * INODE_SIZE + 108, 4);
+    memcpy(sb + 332, itable.data() + (JOURNAL_INO - 1) * INODE_SIZE + 4, 4);
+    put_le16(sb + 348, EXTRA_ISIZE);
+    put_le16(sb + 350, EXTRA_ISIZE);
+    put_le32(sb + 352, std::is_signed_v<char>
+            ? EXT2_FLAGS_SIGNED_HASH : EXT2_FLAGS_UNSIGNED_HASH);
+
+    std::vector<unsigned char> block(BLOCK_SIZE);
+
+    for (uint32_t g = 0; g < geo.groups; ++g) {
+        if (!group_has_super(g)) {
+            continue;
+        }
+
+        // The primary superblock is 1024 bytes into the first block. The
+        // backups are at the start of their groups.
+        std::fill(block.begin(), block.end(), 0);
+        put_le16(sb + 90, static_cast<uint16_t>(g));
+        memcpy(block.data() + (g == 0 ? 1024 : 0), sb, sizeof(sb));
+
+        if (!pwrite_full(fd, block.data(), block.size(), group_first_block(g))
+                || !pwrite_full(fd, gdt.data(), gdt.size(),
+                                group_first_block(g) + 1)) {
+            LOGE("%s: Failed to write superblock: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    // Bitmaps for the groups that aren't marked as uninitialized. Blocks
+    // past the end of the last group are marked as in use.
+    for (uint32_t g : { 0u, last }) {
+        uint32_t used = group_overhead(geo, g);
+        if (g == 0) {
+            used += 2 + geo.journal_blocks;
+        }
+
+        std::fill(block.begin(), block.end(), 0);
+        set_bits(block.data(), 0, used);
+        set_bits(block.data(), group_blocks(geo, g), BLOCKS_PER_GROUP);
+
+        uint64_t bitmap_block = group_first_block(g)
+                + group_super_blocks(geo, g);
+
+        if (!pwrite_full(fd, block.data(), block.size(), bitmap_block)) {
+            LOGE("%s: Failed to write block bitmap: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (g == 0) {
+            std::fill(block.begin(), block.end(), 0);
+            set_bits(block.data(), 0, FIRST_INO);
+            set_bits(block.data(), geo.inodes_per_group, 8 * BLOCK_SIZE);
+
+            if (!pwrite_full(fd, block.data(), block.size(),
+                             bitmap_block + 1)
+                    || !pwrite_full(fd, itable.data(), itable.size(),
+                                    bitmap_block + 2)) {
+                LOGE("%s: Failed to write inodes: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    // Root directory and lost+found
+    std::fill(block.begin(), block.end(), 0);
+    size_t offset = add_dirent(block.data(), 0, ROOT_INO, ".", 12);
+    offset = add_dirent(block.data(), offset, ROOT_INO, "..", 12);
+    add_dirent(block.data(), offset, LOST_FOUND_INO, "lost+found",
+               static_cast<uint16_t>(BLOCK_SIZE - offset));
+
+    if (!pwrite_full(fd, block.data(), block.size(), root_block)) {
+        LOGE("%s: Failed to write root directory: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::fill(block.begin(), block.end(), 0);
+    offset = add_dirent(block.data(), 0, LOST_FOUND_INO, ".", 12);
+    add_dirent(block.data(), offset, ROOT_INO, "..",
+               static_cast<uint16_t>(BLOCK_SIZE - offset));
+
+    if (!pwrite_full(fd, block.data(), block.size(), lost_found_block)) {
+        LOGE("%s: Failed to write lost+found: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Journal superblock. The journal is empty (s_start == 0), so the rest of
+    // it doesn't need to be zeroed.
+    std::fill(block.begin(), block.end(), 0);
+    put_be32(block.data() + 0, JBD2_MAGIC_NUMBER);
+    put_be32(block.data() + 4, JBD2_SUPERBLOCK_V2);
+    put_be32(block.data() + 12, BLOCK_SIZE);
+    put_be32(block.data() + 16, geo.journal_blocks);
+    put_be32(block.data() + 20, 1);
+    put_be32(block.data() + 24, 1);
+    memcpy(block.data() + 48, uuid, sizeof(uuid));
+    put_be32(block.data() + 64, 1);
+
+    if (!pwrite_full(fd, block.data(), block.size(), journal_block)) {
+        LOGE("%s: Failed to write journal: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (fsync(fd) < 0) {
+        LOGE("%s: Failed to sync: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+}
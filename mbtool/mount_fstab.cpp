@@ -20,6 +20,10 @@
 #include "mount_fstab.h"
 
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
 
 #include <cerrno>
 #include <cstdio>
@@ -80,6 +84,11 @@ using namespace mb::device;
 namespace mb
 {
 
+// fsck can print a line for every problem it fixes
+constexpr util::CmdLineRateLimit FSCK_OUTPUT_RATE_LIMIT{
+    200, std::chrono::seconds(1)
+};
+
 /*!
  * \brief Try mounting each entry in a list of fstab entry until one works.
  *
@@ -119,7 +128,7 @@ static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
         if (rec.fs_mgr_flags & util::MF_WAIT) {
             LOGD("%s: Waiting up to 20 seconds for block device",
                  rec.blk_device.c_str());
-            util::wait_for_path(rec.blk_device, std::chrono::seconds(20));
+            wait_for_block_dev(rec.blk_device, std::chrono::seconds(20));
         }
 
         // Try mounting
@@ -223,21 +232,12 @@ static bool path_matches(const char *path, const char *pattern)
     }
 }
 
-static void dump(const char *line, bool error, void *userdata)
+static void dump(std::string_view line, bool error, void *userdata)
 {
     (void) error;
     (void) userdata;
 
-    size_t size = strlen(line);
-
-    std::string copy;
-    if (size > 0 && line[size - 1] == '\n') {
-        copy.assign(line, line + size - 1);
-    } else {
-        copy.assign(line, line + size);
-    }
-
-    LOGD("Command output: %s", copy.c_str());
+    LOGD("Command output: %.*s", static_cast<int>(line.size()), line.data());
 }
 
 static uid_t get_media_rw_uid()
@@ -255,15 +255,10 @@ static bool mount_exfat_fuse(const char *source, const char *target)
     uid_t uid = get_media_rw_uid();
 
     // Check signatures
-    SigVerifyResult result;
-    result = verify_signature("/sbin/fsck.exfat", "/sbin/fsck.exfat.sig");
-    if (result != SigVerifyResult::Valid) {
-        LOGE("Invalid fsck.exfat signature");
-        return false;
-    }
-    result = verify_signature("/sbin/mount.exfat", "/sbin/mount.exfat.sig");
-    if (result != SigVerifyResult::Valid) {
-        LOGE("Invalid mount.exfat signature");
+    if (!verify_signatures({
+        {"/sbin/fsck.exfat", "/sbin/fsck.exfat.sig"},
+        {"/sbin/mount.exfat", "/sbin/mount.exfat.sig"},
+    })) {
         return false;
     }
 
@@ -282,11 +277,12 @@ static bool mount_exfat_fuse(const char *source, const char *target)
     };
 
     // Run filesystem checks
-    util::run_command(fsck_argv[0], fsck_argv, {}, {}, &dump, nullptr);
+    util::run_command(fsck_argv[0], fsck_argv, {}, {}, &dump, nullptr,
+                      FSCK_OUTPUT_RATE_LIMIT);
 
     // Mount exfat, matching vold options as much as possible
     int ret = util::run_command(mount_argv[0], mount_argv, {}, {}, &dump,
-                                nullptr);
+                                nullptr, {});
 
     if (ret >= 0) {
         LOGD("mount.exfat returned: %d", WEXITSTATUS(ret));
@@ -373,7 +369,8 @@ static bool mount_ext4(const char *source, const char *target)
     }
 }
 
-static bool try_extsd_mount(const char *block_dev, const char *mount_point)
+static bool try_extsd_mount(const char *block_dev, const std::string &fstype,
+                            const char *mount_point)
 {
     bool use_fuse_exfat = false;
 
@@ -396,30 +393,53 @@ static bool try_extsd_mount(const char *block_dev, const char *mount_point)
         }
     }
 
-    auto fstype = util::blkid_get_fs_type(block_dev);
-    if (!fstype) {
-        LOGE("%s: Failed to detect filesystem type: %s",
-             block_dev, fstype.error().message().c_str());
-    } else if (fstype.value().empty()) {
-        LOGE("%s: Unknown filesystem", block_dev);
-    } else if (fstype.value() == "exfat") {
+    if (fstype == "exfat") {
         LOGD("Using fuse-exfat: %d", use_fuse_exfat);
 
         auto func = use_fuse_exfat ? &mount_exfat_fuse : &mount_exfat_kernel;
         return func(block_dev, mount_point);
-    } else if (fstype.value() == "vfat") {
+    } else if (fstype == "vfat") {
         return mount_vfat(block_dev, mount_point);
-    } else if (fstype.value() == "ext") {
+    } else if (fstype == "ext") {
         // Assume ext4
         return mount_ext4(block_dev, mount_point);
     } else {
         LOGE("%s: Cannot handle filesystem: %s",
-             block_dev, fstype.value().c_str());
+             block_dev, fstype.c_str());
     }
 
     return false;
 }
 
+/*!
+ * \brief Detect the filesystem types of external SD candidates in parallel
+ *
+ * Reading the superblocks of slow SD cards can take a while, so every
+ * candidate is probed at the same time.
+ *
+ * \return Filesystem type for each block device (empty if unknown)
+ */
+static std::vector<std::string>
+probe_extsd_candidates(const std::vector<std::string> &block_devs)
+{
+    auto results = util::blkid_get_fs_types(block_devs);
+    std::vector<std::string> fstypes(block_devs.size());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i]) {
+            LOGE("%s: Failed to detect filesystem type: %s",
+                 block_devs[i].c_str(),
+                 results[i].error().message().c_str());
+        } else if (results[i].value().empty()) {
+            LOGE("%s: Unknown filesystem", block_devs[i].c_str());
+        } else {
+            fstypes[i] = std::move(results[i].value());
+        }
+    }
+
+    return fstypes;
+}
+
 /*!
  * \brief Split list of globs from a list of glob strings
  *
@@ -471,15 +491,21 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
     }
 
     // We can't wait for a block device path to appear since we don't know the
-    // block device path. Thus, we'll match the paths a number of times with a
-    // delay between each attempt.
-    static const int max_attempts = 10;
+    // block device path. Instead, we'll match the block devices as they are
+    // added until the timeout expires.
+    using namespace std::chrono;
+    auto until = steady_clock::now() + seconds(10);
+    size_t generation = 0;
+
+    while (true) {
+        std::vector<std::pair<std::string, BlockDevInfo>> devices;
+        generation = get_block_dev_mappings_since(generation, devices);
 
-    for (int i = 0; i < max_attempts; ++i) {
-        LOGV("[Attempt %d/%d] Finding and mounting external SD",
-             i + 1, max_attempts);
+        LOGV("Finding and mounting external SD from %zu new block devices",
+             devices.size());
 
-        auto devices_map = get_block_dev_mappings();
+        // Candidates in the order of the fstab entries and patterns
+        std::vector<std::string> candidates;
 
         for (const util::FstabRec &rec : extsd_recs) {
             std::vector<std::string> patterns =
@@ -489,7 +515,7 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
             for (const std::string &pattern : patterns) {
                 LOGD("Matching devices against pattern: %s", pattern.c_str());
 
-                for (auto const &pair : devices_map) {
+                for (auto const &pair : devices) {
                     const BlockDevInfo &info = pair.second;
 
                     if (path_matches(pair.first.c_str(), pattern.c_str())) {
@@ -505,22 +531,32 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
                             continue;
                         }
 
-                        if (try_extsd_mount(info.path.c_str(), mount_point)) {
-                            return true;
+                        if (std::find(candidates.begin(), candidates.end(),
+                                      info.path) == candidates.end()) {
+                            candidates.push_back(info.path);
                         }
                     }
                 }
             }
         }
 
-        if (i < max_attempts - 1) {
-            LOGW("No external SD patterns were matched; waiting 1 second");
-            sleep(1);
+        auto fstypes = probe_extsd_candidates(candidates);
+
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (!fstypes[i].empty() && try_extsd_mount(
+                    candidates[i].c_str(), fstypes[i], mount_point)) {
+                return true;
+            }
+        }
+
+        auto now = steady_clock::now();
+        if (now >= until || !wait_for_block_dev_mappings(
+                generation, duration_cast<milliseconds>(until - now))) {
+            break;
         }
     }
 
-    LOGE("No external SD patterns were matched after %d attempts",
-         max_attempts);
+    LOGE("No external SD patterns were matched after 10 seconds");
 
     return false;
 }
@@ -551,10 +587,17 @@ static bool mount_target(const char *source, const char *target, bool bind)
         }
     }
 
+    // Images are only used by this filesystem, so caching their contents in
+    // the page cache a second time for the loop device is wasted memory
+    util::LoopdevFlags loopdev_flags;
+    if (!bind) {
+        loopdev_flags |= util::LoopdevFlag::DirectIo;
+    }
+
     auto ret = util::mount(source, target,
                            bind ? "" : "auto",
                            bind ? MS_BIND : 0,
-                           "");
+                           "", loopdev_flags);
     if (!ret) {
         LOGE("%s: Failed to mount: %s: %s", target, source, strerror(errno));
         return false;
@@ -568,12 +611,11 @@ static bool mount_target(const char *source, const char *target, bool bind)
  */
 static bool mount_all_system_images()
 {
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
     bool failed = false;
 
-    for (const std::shared_ptr<Rom> &rom : roms.roms) {
+    for (const std::shared_ptr<Rom> &rom : roms->roms) {
         if (rom->system_is_image) {
             std::string mount_point(IMAGES_MOUNT_POINT);
             mount_point += "/";
@@ -839,6 +881,82 @@ static bool process_fstab(const char *path, const std::shared_ptr<Rom> &rom,
     return true;
 }
 
+static bool is_under_mount_point(const std::string &path,
+                                 const char *mount_point)
+{
+    if (!mount_point) {
+        return false;
+    }
+
+    size_t len = strlen(mount_point);
+    return path.size() > len
+            && path.compare(0, len, mount_point) == 0
+            && path[len] == '/';
+}
+
+/*!
+ * \brief Find which mount jobs have to wait for other mount jobs
+ *
+ * A job depends on another job if one of its fstab entries' sources is located
+ * under the other job's mount point. If the dependencies are cyclic, they are
+ * dropped and all jobs run independently.
+ */
+template<typename Job>
+static void compute_mount_job_deps(std::vector<Job> &jobs)
+{
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            if (i == j) {
+                continue;
+            }
+
+            for (const util::FstabRec &rec : *jobs[i].recs) {
+                if (is_under_mount_point(rec.blk_device, jobs[j].mount_point)
+                        || is_under_mount_point(rec.blk_device,
+                                                jobs[j].orig_mount_point)) {
+                    LOGD("%s depends on %s",
+                         jobs[i].mount_point, jobs[j].mount_point);
+                    jobs[i].deps.push_back(j);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Check for cycles by repeatedly removing jobs without pending deps
+    std::vector<size_t> pending(jobs.size());
+    std::vector<size_t> ready;
+    size_t visited = 0;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        pending[i] = jobs[i].deps.size();
+        if (pending[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+
+    while (!ready.empty()) {
+        size_t done = ready.back();
+        ready.pop_back();
+        ++visited;
+
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            for (size_t dep : jobs[i].deps) {
+                if (dep == done && --pending[i] == 0) {
+                    ready.push_back(i);
+                }
+            }
+        }
+    }
+
+    if (visited != jobs.size()) {
+        LOGW("Mount dependencies are cyclic; ignoring them");
+        for (Job &job : jobs) {
+            job.deps.clear();
+        }
+    }
+}
+
 /*!
  * \brief Mount system, cache, and data entries from fstab
  *
@@ -865,36 +983,6 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
 
     bool ret = true;
 
-    // Mount system
-    if (ret && !recs.system.empty()) {
-        if (create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755)) {
-            successful.push_back(SYSTEM_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " SYSTEM_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount cache
-    if (ret && !recs.cache.empty()) {
-        if (create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755)) {
-            successful.push_back(CACHE_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " CACHE_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount data
-    if (ret && !recs.data.empty()) {
-        if (create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755)) {
-            successful.push_back(DATA_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " DATA_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
     // Mount external SD only if ROM is installed on the external SD. This is
     // necessary because mount_extsd_fstab_entries() blocks until an SD card is
     // found or a timeout occurs.
@@ -905,11 +993,87 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         LOGV("Skipping extsd mount because ROM is not an extsd-slot");
     }
 
-    if (ret && !recs.extsd.empty() && require_extsd) {
-        if (mount_extsd_fstab_entries(recs.extsd, EXTSD_MOUNT_POINT, 0755)) {
-            successful.push_back(EXTSD_MOUNT_POINT);
+    // Mount everything in parallel. Each mount only waits for its own block
+    // devices, so a slow device (eg. the SD card) doesn't delay the others. A
+    // mount whose source lives on another mount (eg. a loop image under /data)
+    // waits for that mount first.
+    struct MountJob
+    {
+        const std::vector<util::FstabRec> *recs;
+        const char *mount_point;
+        const char *orig_mount_point;
+        std::function<bool()> func;
+        std::vector<size_t> deps;
+        std::promise<bool> promise;
+        std::shared_future<bool> future;
+    };
+
+    std::vector<MountJob> jobs;
+    auto add_job = [&](const std::vector<util::FstabRec> &job_recs,
+                       const char *mount_point, const char *orig_mount_point,
+                       std::function<bool()> func) {
+        jobs.emplace_back();
+        MountJob &job = jobs.back();
+        job.recs = &job_recs;
+        job.mount_point = mount_point;
+        job.orig_mount_point = orig_mount_point;
+        job.func = std::move(func);
+        job.future = job.promise.get_future().share();
+    };
+
+    if (!recs.system.empty()) {
+        add_job(recs.system, SYSTEM_MOUNT_POINT, "/system", [&] {
+            return create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755);
+        });
+    }
+    if (!recs.cache.empty()) {
+        add_job(recs.cache, CACHE_MOUNT_POINT, "/cache", [&] {
+            return create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755);
+        });
+    }
+    if (!recs.data.empty()) {
+        add_job(recs.data, DATA_MOUNT_POINT, "/data", [&] {
+            return create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755);
+        });
+    }
+    if (!recs.extsd.empty() && require_extsd) {
+        add_job(recs.extsd, EXTSD_MOUNT_POINT, nullptr, [&] {
+            return mount_extsd_fstab_entries(
+                    recs.extsd, EXTSD_MOUNT_POINT, 0755);
+        });
+    }
+
+    compute_mount_job_deps(jobs);
+
+    std::vector<std::thread> workers;
+    for (MountJob &job : jobs) {
+        workers.emplace_back([&job, &jobs] {
+            bool job_ret = true;
+
+            for (size_t dep : job.deps) {
+                if (!jobs[dep].future.get()) {
+                    LOGE("%s: Dependency %s failed to mount",
+                         job.mount_point, jobs[dep].mount_point);
+                    job_ret = false;
+                }
+            }
+
+            if (job_ret) {
+                job_ret = job.func();
+            }
+
+            job.promise.set_value(job_ret);
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    for (MountJob &job : jobs) {
+        if (job.future.get()) {
+            successful.push_back(job.mount_point);
         } else {
-            LOGE("Failed to mount " EXTSD_MOUNT_POINT);
+            LOGE("Failed to mount %s", job.mount_point);
             ret = false;
         }
     }
@@ -19,7 +19,11 @@
 
 #include "multiboot.h"
 
+#include <algorithm>
+#include <thread>
+
 #include <cerrno>
+#include <cinttypes>
 #include <cstring>
 #include <sys/stat.h>
 
@@ -39,6 +43,9 @@
 namespace mb
 {
 
+// Maximum number of threads relabeling the multiboot directory
+constexpr unsigned int RELABEL_MAX_THREADS = 4;
+
 class CopySystem : public util::FtsWrapper {
 public:
     CopySystem(std::string path, std::string target)
@@ -82,7 +89,8 @@ public:
         // CopyFlag::ExcludeTopLevel flag)
         if (auto r = util::copy_dir(_curr->fts_accpath, _target,
                                     util::CopyFlag::CopyAttributes
-                                  | util::CopyFlag::CopyXattrs); !r) {
+                                  | util::CopyFlag::CopyXattrs
+                                  | util::CopyFlag::Parallel); !r) {
             _error_msg = format("Failed to copy directory: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -191,13 +199,21 @@ bool fix_multiboot_permissions()
     }
 
     if (auto context = util::selinux_lget_context(INTERNAL_STORAGE)) {
-        if (auto ret = util::selinux_lset_context_recursive(
-                MULTIBOOT_DIR, context.value()); !ret) {
+        util::SELinuxRelabelOptions options;
+        options.threads = std::clamp(std::thread::hardware_concurrency(),
+                                     1u, RELABEL_MAX_THREADS);
+
+        auto ret = util::selinux_relabel_recursive(
+                MULTIBOOT_DIR, context.value(), options);
+        if (!ret) {
             LOGE("%s: Failed to set context to %s: %s",
-                 MULTIBOOT_DIR, context.value().c_str(),
-                 ret.error().message().c_str());
+                 ret.error().path.c_str(), context.value().c_str(),
+                 ret.error().ec.message().c_str());
             return false;
         }
+
+        LOGI("%s: Relabeled %" PRIu64 " paths (%" PRIu64 " already labeled)",
+             MULTIBOOT_DIR, ret.value().changed, ret.value().skipped);
     }
 
     return true;
@@ -25,6 +25,7 @@
 #define MULTIBOOT_DIR                   INTERNAL_STORAGE "/MultiBoot"
 #define MULTIBOOT_BACKUP_DIR            MULTIBOOT_DIR "/backups"
 #define MULTIBOOT_LOG_INSTALLER         INTERNAL_STORAGE "/MultiBoot.log"
+#define MULTIBOOT_LOG_INSTALLER_PROFILE INTERNAL_STORAGE "/MultiBoot.profile.json"
 #define MULTIBOOT_LOG_APPSYNC           MULTIBOOT_DIR "/appsync.log"
 #define MULTIBOOT_LOG_DAEMON            MULTIBOOT_DIR "/daemon.log"
 
@@ -60,6 +61,21 @@
 #define BOOT_UI_PATH                    "/mbbootui"
 #define BOOT_UI_EXEC_PATH               BOOT_UI_PATH "/exec"
 
+// Boot timeline
+#define BOOT_TIMELINE_PATH              "/data/multiboot/boot-timeline.json"
+
+// Patched SELinux policies
+#define SEPOLICY_CACHE_DIR              "/raw/cache/multiboot/sepolicy"
+
+// Parsed packages.xml files
+#define PACKAGES_CACHE_DIR              "/data/multiboot/cache/packages"
+
+// Patched and recompressed boot image ramdisks
+#define RAMDISK_CACHE_DIR               "/data/multiboot/cache/ramdisk"
+
+// Formats that won the bid for previously read boot images
+#define BOOTIMG_FORMAT_CACHE_PATH       "/data/multiboot/cache/bootimg-formats"
+
 // Installer
 #define CHROOT_SYSTEM_BIND_MOUNT        "/mb/bind.system"
 #define CHROOT_CACHE_BIND_MOUNT         "/mb/bind.cache"
@@ -67,6 +83,14 @@
 #define CHROOT_SYSTEM_LOOP_DEV          "/mb/loop.system"
 #define CHROOT_CACHE_LOOP_DEV           "/mb/loop.cache"
 #define CHROOT_DATA_LOOP_DEV            "/mb/loop.data"
+// Parent directories of the bind mount sources, if on the same filesystem
+#define CHROOT_SYSTEM_PARENT_MOUNT      "/mb/parent.system"
+#define CHROOT_CACHE_PARENT_MOUNT       "/mb/parent.cache"
+#define CHROOT_DATA_PARENT_MOUNT        "/mb/parent.data"
+// Held (shared) by update-binary-tool while formatted files are being deleted
+#define CHROOT_FORMAT_LOCK_FILE         "/mb/format.lock"
+// Listened on by the resident update-binary-tool while the updater runs
+#define CHROOT_UPDATE_BINARY_TOOL_SOCKET "/mb/update-binary-tool.sock"
 
 // SELinux context for mbtool utils
 #define MB_EXEC_CONTEXT                 "u:r:mb_exec:s0"
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <cstdint>
+
+namespace mb
+{
+
+struct OperationProgress
+{
+    // Number of files processed so far
+    uint64_t files = 0;
+    // Number of bytes processed so far
+    uint64_t bytes = 0;
+    // Path currently being processed
+    std::string path;
+};
+
+/*!
+ * Called as a long-running operation makes progress. Return false to cancel
+ * the operation at the next point where it can safely stop.
+ */
+using OperationProgressFn = std::function<bool(const OperationProgress &progress)>;
+
+}
@@ -22,15 +22,24 @@
 #include <algorithm>
 
 #include <cassert>
-#include <cstdlib>
+#include <cerrno>
 #include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <pugixml.hpp>
 
 #include "mbcommon/integer.h"
 #include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/hash.h"
+#include "mbutil/string.h"
 
 #define LOG_TAG "mbtool/packages"
 
@@ -93,6 +102,15 @@ static const char *ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA
 static const char *ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR
                                              = "secondaryNativeLibraryDir";
 
+// Only attributes and elements are needed. Entities must still be decoded
+// since the values are compared against other sources.
+static constexpr unsigned int XML_PARSE_OPTIONS =
+        pugi::parse_minimal | pugi::parse_escapes;
+
+static constexpr uint32_t CACHE_MAGIC   = 0x4b50424d; // "MBPK"
+static constexpr uint32_t CACHE_VERSION = 1;
+
+static bool parse_document(const pugi::xml_document &doc, Packages *pkgs);
 static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg);
 static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
@@ -318,13 +336,428 @@ bool Packages::load_xml(const std::string &path)
     sigs.clear();
 
     pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
+    pugi::xml_parse_result result =
+            doc.load_file(path.c_str(), XML_PARSE_OPTIONS);
     if (!result) {
         LOGE("Failed to parse XML file: %s: %s",
              path.c_str(), result.description());
         return false;
     }
 
+    return parse_document(doc, this);
+}
+
+namespace
+{
+
+/*!
+ * \brief Identity of the packages.xml file that a cache entry was built from
+ */
+struct CacheKey
+{
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    util::Sha512Digest digest;
+};
+
+class CacheWriter
+{
+public:
+    std::string buf;
+
+    void write_varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            buf += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        buf += static_cast<char>(value);
+    }
+
+    void write_raw(const void *data, size_t size)
+    {
+        buf.append(static_cast<const char *>(data), size);
+    }
+
+    // Strings are interned so that each distinct value (eg. installer package
+    // names, ABIs, signature indexes) is stored only once
+    void write_string(const std::string &str)
+    {
+        if (str.empty()) {
+            write_varint(0);
+            return;
+        }
+
+        auto it = _ids.find(str);
+        if (it == _ids.end()) {
+            it = _ids.emplace(str, static_cast<uint32_t>(_strings.size() + 1))
+                    .first;
+            _strings.push_back(&it->first);
+        }
+        write_varint(it->second);
+    }
+
+    std::string finish(const CacheKey &key)
+    {
+        CacheWriter header;
+        header.write_raw(&CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.write_raw(&CACHE_VERSION, sizeof(CACHE_VERSION));
+        header.write_varint(key.size);
+        header.write_varint(static_cast<uint64_t>(key.mtime_sec));
+        header.write_varint(static_cast<uint64_t>(key.mtime_nsec));
+        header.write_raw(key.digest.data(), key.digest.size());
+
+        header.write_varint(_strings.size());
+        for (auto const *str : _strings) {
+            header.write_varint(str->size());
+            header.write_raw(str->data(), str->size());
+        }
+
+        header.buf += buf;
+        return std::move(header.buf);
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t> _ids;
+    std::vector<const std::string *> _strings;
+};
+
+class CacheReader
+{
+public:
+    CacheReader(const unsigned char *data, size_t size)
+        : _ptr(data), _end(data + size), _ok(true)
+    {
+    }
+
+    bool ok() const
+    {
+        return _ok;
+    }
+
+    bool at_end() const
+    {
+        return _ptr == _end;
+    }
+
+    uint64_t read_varint()
+    {
+        uint64_t value = 0;
+
+        for (unsigned int shift = 0; _ok; shift += 7) {
+            if (_ptr == _end || shift > 63) {
+                _ok = false;
+                break;
+            }
+
+            unsigned char c = *_ptr++;
+            value |= static_cast<uint64_t>(c & 0x7f) << shift;
+
+            if (!(c & 0x80)) {
+                return value;
+            }
+        }
+
+        return 0;
+    }
+
+    bool read_raw(void *data, size_t size)
+    {
+        if (!_ok || static_cast<size_t>(_end - _ptr) < size) {
+            _ok = false;
+            return false;
+        }
+
+        memcpy(data, _ptr, size);
+        _ptr += size;
+        return true;
+    }
+
+    bool read_string_table()
+    {
+        uint64_t count = read_varint();
+        if (!_ok || count > static_cast<size_t>(_end - _ptr)) {
+            _ok = false;
+            return false;
+        }
+
+        _strings.clear();
+        _strings.reserve(static_cast<size_t>(count) + 1);
+        _strings.emplace_back();
+
+        for (uint64_t i = 0; i < count && _ok; ++i) {
+            uint64_t size = read_varint();
+            if (!_ok || size > static_cast<size_t>(_end - _ptr)) {
+                _ok = false;
+                return false;
+            }
+
+            _strings.emplace_back(reinterpret_cast<const char *>(_ptr),
+                                  static_cast<size_t>(size));
+            _ptr += size;
+        }
+
+        return _ok;
+    }
+
+    std::string read_string()
+    {
+        uint64_t id = read_varint();
+        if (!_ok || id >= _strings.size()) {
+            _ok = false;
+            return {};
+        }
+
+        return _strings[static_cast<size_t>(id)];
+    }
+
+private:
+    const unsigned char *_ptr;
+    const unsigned char *_end;
+    bool _ok;
+    std::vector<std::string> _strings;
+};
+
+}
+
+static std::string serialize_packages(const Packages &pkgs,
+                                      const CacheKey &key)
+{
+    CacheWriter writer;
+
+    writer.write_varint(pkgs.sigs.size());
+    for (auto const &[index, sig] : pkgs.sigs) {
+        writer.write_string(index);
+        writer.write_string(sig);
+    }
+
+    writer.write_varint(pkgs.pkgs.size());
+    for (auto const &pkg : pkgs.pkgs) {
+        writer.write_string(pkg->name);
+        writer.write_string(pkg->real_name);
+        writer.write_string(pkg->code_path);
+        writer.write_string(pkg->resource_path);
+        writer.write_string(pkg->native_library_path);
+        writer.write_string(pkg->primary_cpu_abi);
+        writer.write_string(pkg->secondary_cpu_abi);
+        writer.write_string(pkg->cpu_abi_override);
+        writer.write_varint(static_cast<uint64_t>(pkg->pkg_flags));
+        writer.write_varint(static_cast<uint64_t>(pkg->pkg_public_flags));
+        writer.write_varint(static_cast<uint64_t>(pkg->pkg_private_flags));
+        writer.write_varint(pkg->timestamp);
+        writer.write_varint(pkg->first_install_time);
+        writer.write_varint(pkg->last_update_time);
+        writer.write_varint(static_cast<uint32_t>(pkg->version));
+        writer.write_varint(static_cast<uint32_t>(pkg->user_id));
+        writer.write_varint(static_cast<uint32_t>(pkg->shared_user_id));
+        writer.write_varint(pkg->is_shared_user ? 1 : 0);
+        writer.write_string(pkg->uid_error);
+        writer.write_string(pkg->install_status);
+        writer.write_string(pkg->installer);
+
+        writer.write_varint(pkg->sig_indexes.size());
+        for (auto const &index : pkg->sig_indexes) {
+            writer.write_string(index);
+        }
+    }
+
+    return writer.finish(key);
+}
+
+static bool deserialize_packages(const std::vector<unsigned char> &data,
+                                 const CacheKey &key, Packages &pkgs)
+{
+    CacheReader reader(data.data(), data.size());
+    uint32_t magic;
+    uint32_t version;
+    CacheKey cached_key;
+
+    if (!reader.read_raw(&magic, sizeof(magic))
+            || !reader.read_raw(&version, sizeof(version))
+            || magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        return false;
+    }
+
+    cached_key.size = reader.read_varint();
+    cached_key.mtime_sec = static_cast<int64_t>(reader.read_varint());
+    cached_key.mtime_nsec = static_cast<int64_t>(reader.read_varint());
+
+    if (!reader.read_raw(cached_key.digest.data(), cached_key.digest.size())
+            || cached_key.size != key.size
+            || cached_key.mtime_sec != key.mtime_sec
+            || cached_key.mtime_nsec != key.mtime_nsec
+            || cached_key.digest != key.digest
+            || !reader.read_string_table()) {
+        return false;
+    }
+
+    pkgs.pkgs.clear();
+    pkgs.sigs.clear();
+
+    for (uint64_t n = reader.read_varint(); n > 0 && reader.ok(); --n) {
+        std::string index = reader.read_string();
+        pkgs.sigs[std::move(index)] = reader.read_string();
+    }
+
+    for (uint64_t n = reader.read_varint(); n > 0 && reader.ok(); --n) {
+        auto pkg = std::make_shared<Package>();
+
+        pkg->name = reader.read_string();
+        pkg->real_name = reader.read_string();
+        pkg->code_path = reader.read_string();
+        pkg->resource_path = reader.read_string();
+        pkg->native_library_path = reader.read_string();
+        pkg->primary_cpu_abi = reader.read_string();
+        pkg->secondary_cpu_abi = reader.read_string();
+        pkg->cpu_abi_override = reader.read_string();
+        pkg->pkg_flags = static_cast<Package::Flag>(reader.read_varint());
+        pkg->pkg_public_flags =
+                static_cast<Package::PublicFlag>(reader.read_varint());
+        pkg->pkg_private_flags =
+                static_cast<Package::PrivateFlag>(reader.read_varint());
+        pkg->timestamp = reader.read_varint();
+        pkg->first_install_time = reader.read_varint();
+        pkg->last_update_time = reader.read_varint();
+        pkg->version = static_cast<int>(
+                static_cast<uint32_t>(reader.read_varint()));
+        pkg->user_id = static_cast<int>(
+                static_cast<uint32_t>(reader.read_varint()));
+        pkg->shared_user_id = static_cast<int>(
+                static_cast<uint32_t>(reader.read_varint()));
+        pkg->is_shared_user = reader.read_varint() ? 1 : 0;
+        pkg->uid_error = reader.read_string();
+        pkg->install_status = reader.read_string();
+        pkg->installer = reader.read_string();
+
+        for (uint64_t i = reader.read_varint(); i > 0 && reader.ok(); --i) {
+            pkg->sig_indexes.push_back(reader.read_string());
+        }
+
+        pkgs.pkgs.push_back(std::move(pkg));
+    }
+
+    if (!reader.ok() || !reader.at_end()) {
+        pkgs.pkgs.clear();
+        pkgs.sigs.clear();
+        return false;
+    }
+
+    return true;
+}
+
+static void write_packages_cache(const std::string &cache_dir,
+                                 const std::string &cache_path,
+                                 const std::string &data)
+{
+    if (auto r = util::mkdir_recursive(cache_dir, 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             cache_dir.c_str(), r.error().message().c_str());
+        return;
+    }
+
+    // Readers validate the whole entry, so a torn write only costs a reparse,
+    // but never expose a partially written file under the real name
+    std::string temp_path(cache_path);
+    temp_path += ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, data.data(), data.size());
+            !r) {
+        LOGW("%s: Failed to write packages cache: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+    } else if (rename(temp_path.c_str(), cache_path.c_str()) < 0) {
+        LOGW("%s: Failed to rename packages cache: %s",
+             cache_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+}
+
+/*!
+ * \brief Load packages.xml, reusing a previously parsed copy if possible
+ *
+ * The parsed package table is cached in \p cache_dir in a compact binary form
+ * and is keyed by the size, modification time, and SHA-512 digest of \p path.
+ * If the file has not changed since the cache was written, the XML is never
+ * parsed.
+ *
+ * \param path Path to packages.xml
+ * \param cache_dir Cache directory
+ *
+ * \return Whether the packages were successfully loaded
+ */
+bool Packages::load_cached(const std::string &path,
+                           const std::string &cache_dir)
+{
+    pkgs.clear();
+    sigs.clear();
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto data = util::file_read_all(path);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), data.error().message().c_str());
+        return false;
+    }
+
+    auto digest = util::sha512_hash(data.value().data(), data.value().size());
+    if (!digest) {
+        LOGE("%s: Failed to compute SHA-512 digest: %s",
+             path.c_str(), digest.error().message().c_str());
+        return false;
+    }
+
+    CacheKey key;
+    key.size = data.value().size();
+    key.mtime_sec = sb.st_mtim.tv_sec;
+    key.mtime_nsec = sb.st_mtim.tv_nsec;
+    key.digest = digest.value();
+
+    // One entry per packages.xml path
+    auto path_digest = util::sha512_hash(path.data(), path.size());
+    if (!path_digest) {
+        LOGE("%s: Failed to compute SHA-512 digest: %s",
+             path.c_str(), path_digest.error().message().c_str());
+        return false;
+    }
+
+    std::string cache_path(cache_dir);
+    cache_path += '/';
+    cache_path += util::hex_string(path_digest.value().data(), 16);
+
+    if (auto cached = util::file_read_all(cache_path);
+            cached && deserialize_packages(cached.value(), key, *this)) {
+        LOGV("%s: Loaded %zu packages from cache",
+             path.c_str(), pkgs.size());
+        return true;
+    }
+
+    pugi::xml_document doc;
+    pugi::xml_parse_result result = doc.load_buffer_inplace(
+            data.value().data(), data.value().size(), XML_PARSE_OPTIONS);
+    if (!result) {
+        LOGE("Failed to parse XML file: %s: %s",
+             path.c_str(), result.description());
+        return false;
+    }
+
+    if (!parse_document(doc, this)) {
+        return false;
+    }
+
+    write_packages_cache(cache_dir, cache_path,
+                         serialize_packages(*this, key));
+
+    return true;
+}
+
+static bool parse_document(const pugi::xml_document &doc, Packages *pkgs)
+{
     pugi::xml_node root = doc.root();
 
     for (pugi::xml_node cur_node : root.children()) {
@@ -333,7 +766,7 @@ bool Packages::load_xml(const std::string &path)
         }
 
         if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            if (!parse_tag_packages(cur_node, this)) {
+            if (!parse_tag_packages(cur_node, pkgs)) {
                 return false;
             }
         } else {
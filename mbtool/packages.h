@@ -176,6 +176,7 @@ public:
     std::unordered_map<std::string, std::string> sigs;
 
     bool load_xml(const std::string &path);
+    bool load_cached(const std::string &path, const std::string &cache_dir);
 
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
@@ -0,0 +1,223 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct BatchRequestItem;
+
+struct BatchRequest;
+
+struct BatchResponseItem;
+
+struct BatchResponse;
+
+struct BatchRequestItem FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_DATA = 4
+  };
+  const flatbuffers::Vector<uint8_t> *data() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_DATA);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_DATA) &&
+           verifier.Verify(data()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestItemBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_data(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> data) {
+    fbb_.AddOffset(BatchRequestItem::VT_DATA, data);
+  }
+  BatchRequestItemBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestItemBuilder &operator=(const BatchRequestItemBuilder &);
+  flatbuffers::Offset<BatchRequestItem> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<BatchRequestItem>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequestItem> CreateBatchRequestItem(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> data = 0) {
+  BatchRequestItemBuilder builder_(_fbb);
+  builder_.add_data(data);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequestItem> CreateBatchRequestItemDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *data = nullptr) {
+  return mbtool::daemon::v3::CreateBatchRequestItem(
+      _fbb,
+      data ? _fbb.CreateVector<uint8_t>(*data) : 0);
+}
+
+struct BatchRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUESTS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>> *requests() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>> *>(VT_REQUESTS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_REQUESTS) &&
+           verifier.Verify(requests()) &&
+           verifier.VerifyVectorOfTables(requests()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_requests(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>>> requests) {
+    fbb_.AddOffset(BatchRequest::VT_REQUESTS, requests);
+  }
+  BatchRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestBuilder &operator=(const BatchRequestBuilder &);
+  flatbuffers::Offset<BatchRequest> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<BatchRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>>> requests = 0) {
+  BatchRequestBuilder builder_(_fbb);
+  builder_.add_requests(requests);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<BatchRequestItem>> *requests = nullptr) {
+  return mbtool::daemon::v3::CreateBatchRequest(
+      _fbb,
+      requests ? _fbb.CreateVector<flatbuffers::Offset<BatchRequestItem>>(*requests) : 0);
+}
+
+struct BatchResponseItem FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_DATA = 4
+  };
+  const flatbuffers::Vector<uint8_t> *data() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_DATA);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_DATA) &&
+           verifier.Verify(data()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseItemBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_data(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> data) {
+    fbb_.AddOffset(BatchResponseItem::VT_DATA, data);
+  }
+  BatchResponseItemBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseItemBuilder &operator=(const BatchResponseItemBuilder &);
+  flatbuffers::Offset<BatchResponseItem> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<BatchResponseItem>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponseItem> CreateBatchResponseItem(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> data = 0) {
+  BatchResponseItemBuilder builder_(_fbb);
+  builder_.add_data(data);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponseItem> CreateBatchResponseItemDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *data = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponseItem(
+      _fbb,
+      data ? _fbb.CreateVector<uint8_t>(*data) : 0);
+}
+
+struct BatchResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESPONSES = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>> *responses() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>> *>(VT_RESPONSES);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_RESPONSES) &&
+           verifier.Verify(responses()) &&
+           verifier.VerifyVectorOfTables(responses()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_responses(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>>> responses) {
+    fbb_.AddOffset(BatchResponse::VT_RESPONSES, responses);
+  }
+  BatchResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseBuilder &operator=(const BatchResponseBuilder &);
+  flatbuffers::Offset<BatchResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<BatchResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>>> responses = 0) {
+  BatchResponseBuilder builder_(_fbb);
+  builder_.add_responses(responses);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<BatchResponseItem>> *responses = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponse(
+      _fbb,
+      responses ? _fbb.CreateVector<flatbuffers::Offset<BatchResponseItem>>(*responses) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
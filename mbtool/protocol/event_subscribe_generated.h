@@ -0,0 +1,248 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_EVENTSUBSCRIBE_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_EVENTSUBSCRIBE_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct EventSubscribeError;
+
+struct EventSubscribeRequest;
+
+struct EventSubscribeResponse;
+
+struct EventNotificationResponse;
+
+enum EventType {
+  EventType_ROMS_CHANGED = 0,
+  EventType_ROM_SWITCHED = 1,
+  EventType_PACKAGES_CHANGED = 2,
+  EventType_MIN = EventType_ROMS_CHANGED,
+  EventType_MAX = EventType_PACKAGES_CHANGED
+};
+
+inline const char **EnumNamesEventType() {
+  static const char *names[] = {
+    "ROMS_CHANGED",
+    "ROM_SWITCHED",
+    "PACKAGES_CHANGED",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameEventType(EventType e) {
+  const size_t index = static_cast<int>(e);
+  return EnumNamesEventType()[index];
+}
+
+struct EventSubscribeError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct EventSubscribeErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(EventSubscribeError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(EventSubscribeError::VT_MSG, msg);
+  }
+  EventSubscribeErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  EventSubscribeErrorBuilder &operator=(const EventSubscribeErrorBuilder &);
+  flatbuffers::Offset<EventSubscribeError> Finish() {
+    const auto end = fbb_.EndTable(start_, 2);
+    auto o = flatbuffers::Offset<EventSubscribeError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<EventSubscribeError> CreateEventSubscribeError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  EventSubscribeErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<EventSubscribeError> CreateEventSubscribeErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateEventSubscribeError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct EventSubscribeRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_EVENTS = 4
+  };
+  const flatbuffers::Vector<int16_t> *events() const {
+    return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_EVENTS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_EVENTS) &&
+           verifier.Verify(events()) &&
+           verifier.EndTable();
+  }
+};
+
+struct EventSubscribeRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_events(flatbuffers::Offset<flatbuffers::Vector<int16_t>> events) {
+    fbb_.AddOffset(EventSubscribeRequest::VT_EVENTS, events);
+  }
+  EventSubscribeRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  EventSubscribeRequestBuilder &operator=(const EventSubscribeRequestBuilder &);
+  flatbuffers::Offset<EventSubscribeRequest> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<EventSubscribeRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<EventSubscribeRequest> CreateEventSubscribeRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> events = 0) {
+  EventSubscribeRequestBuilder builder_(_fbb);
+  builder_.add_events(events);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<EventSubscribeRequest> CreateEventSubscribeRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<int16_t> *events = nullptr) {
+  return mbtool::daemon::v3::CreateEventSubscribeRequest(
+      _fbb,
+      events ? _fbb.CreateVector<int16_t>(*events) : 0);
+}
+
+struct EventSubscribeResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERROR = 4
+  };
+  const EventSubscribeError *error() const {
+    return GetPointer<const EventSubscribeError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct EventSubscribeResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_error(flatbuffers::Offset<EventSubscribeError> error) {
+    fbb_.AddOffset(EventSubscribeResponse::VT_ERROR, error);
+  }
+  EventSubscribeResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  EventSubscribeResponseBuilder &operator=(const EventSubscribeResponseBuilder &);
+  flatbuffers::Offset<EventSubscribeResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<EventSubscribeResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<EventSubscribeResponse> CreateEventSubscribeResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<EventSubscribeError> error = 0) {
+  EventSubscribeResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+struct EventNotificationResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_EVENTS = 4
+  };
+  const flatbuffers::Vector<int16_t> *events() const {
+    return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_EVENTS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_EVENTS) &&
+           verifier.Verify(events()) &&
+           verifier.EndTable();
+  }
+};
+
+struct EventNotificationResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_events(flatbuffers::Offset<flatbuffers::Vector<int16_t>> events) {
+    fbb_.AddOffset(EventNotificationResponse::VT_EVENTS, events);
+  }
+  EventNotificationResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  EventNotificationResponseBuilder &operator=(const EventNotificationResponseBuilder &);
+  flatbuffers::Offset<EventNotificationResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<EventNotificationResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<EventNotificationResponse> CreateEventNotificationResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> events = 0) {
+  EventNotificationResponseBuilder builder_(_fbb);
+  builder_.add_events(events);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<EventNotificationResponse> CreateEventNotificationResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<int16_t> *events = nullptr) {
+  return mbtool::daemon::v3::CreateEventNotificationResponse(
+      _fbb,
+      events ? _fbb.CreateVector<int16_t>(*events) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_EVENTSUBSCRIBE_MBTOOL_DAEMON_V3_H_
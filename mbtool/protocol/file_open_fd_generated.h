@@ -0,0 +1,201 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_FILEOPENFD_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_FILEOPENFD_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "file_open_generated.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct FileOpenFdError;
+
+struct FileOpenFdRequest;
+
+struct FileOpenFdResponse;
+
+struct FileOpenFdError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileOpenFdErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(FileOpenFdError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(FileOpenFdError::VT_MSG, msg);
+  }
+  FileOpenFdErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileOpenFdErrorBuilder &operator=(const FileOpenFdErrorBuilder &);
+  flatbuffers::Offset<FileOpenFdError> Finish() {
+    const auto end = fbb_.EndTable(start_, 2);
+    auto o = flatbuffers::Offset<FileOpenFdError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileOpenFdError> CreateFileOpenFdError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  FileOpenFdErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<FileOpenFdError> CreateFileOpenFdErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateFileOpenFdError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct FileOpenFdRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_PATH = 4,
+    VT_FLAGS = 6,
+    VT_PERMS = 8
+  };
+  const flatbuffers::String *path() const {
+    return GetPointer<const flatbuffers::String *>(VT_PATH);
+  }
+  const flatbuffers::Vector<int16_t> *flags() const {
+    return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_FLAGS);
+  }
+  uint32_t perms() const {
+    return GetField<uint32_t>(VT_PERMS, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PATH) &&
+           verifier.Verify(path()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_FLAGS) &&
+           verifier.Verify(flags()) &&
+           VerifyField<uint32_t>(verifier, VT_PERMS) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileOpenFdRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_path(flatbuffers::Offset<flatbuffers::String> path) {
+    fbb_.AddOffset(FileOpenFdRequest::VT_PATH, path);
+  }
+  void add_flags(flatbuffers::Offset<flatbuffers::Vector<int16_t>> flags) {
+    fbb_.AddOffset(FileOpenFdRequest::VT_FLAGS, flags);
+  }
+  void add_perms(uint32_t perms) {
+    fbb_.AddElement<uint32_t>(FileOpenFdRequest::VT_PERMS, perms, 0);
+  }
+  FileOpenFdRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileOpenFdRequestBuilder &operator=(const FileOpenFdRequestBuilder &);
+  flatbuffers::Offset<FileOpenFdRequest> Finish() {
+    const auto end = fbb_.EndTable(start_, 3);
+    auto o = flatbuffers::Offset<FileOpenFdRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileOpenFdRequest> CreateFileOpenFdRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> path = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> flags = 0,
+    uint32_t perms = 0) {
+  FileOpenFdRequestBuilder builder_(_fbb);
+  builder_.add_perms(perms);
+  builder_.add_flags(flags);
+  builder_.add_path(path);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<FileOpenFdRequest> CreateFileOpenFdRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *path = nullptr,
+    const std::vector<int16_t> *flags = nullptr,
+    uint32_t perms = 0) {
+  return mbtool::daemon::v3::CreateFileOpenFdRequest(
+      _fbb,
+      path ? _fbb.CreateString(path) : 0,
+      flags ? _fbb.CreateVector<int16_t>(*flags) : 0,
+      perms);
+}
+
+struct FileOpenFdResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERROR = 4
+  };
+  const FileOpenFdError *error() const {
+    return GetPointer<const FileOpenFdError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileOpenFdResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_error(flatbuffers::Offset<FileOpenFdError> error) {
+    fbb_.AddOffset(FileOpenFdResponse::VT_ERROR, error);
+  }
+  FileOpenFdResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileOpenFdResponseBuilder &operator=(const FileOpenFdResponseBuilder &);
+  flatbuffers::Offset<FileOpenFdResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<FileOpenFdResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileOpenFdResponse> CreateFileOpenFdResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<FileOpenFdError> error = 0) {
+  FileOpenFdResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_FILEOPENFD_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,224 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct MbRequestStats;
+
+struct MbGetStatsRequest;
+
+struct MbGetStatsResponse;
+
+struct MbRequestStats FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUEST_TYPE = 4,
+    VT_COUNT = 6,
+    VT_TOTAL_USEC = 8,
+    VT_MAX_USEC = 10,
+    VT_HISTOGRAM = 12
+  };
+  const flatbuffers::String *request_type() const {
+    return GetPointer<const flatbuffers::String *>(VT_REQUEST_TYPE);
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  uint64_t total_usec() const {
+    return GetField<uint64_t>(VT_TOTAL_USEC, 0);
+  }
+  uint64_t max_usec() const {
+    return GetField<uint64_t>(VT_MAX_USEC, 0);
+  }
+  const flatbuffers::Vector<uint64_t> *histogram() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_HISTOGRAM);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_REQUEST_TYPE) &&
+           verifier.Verify(request_type()) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           VerifyField<uint64_t>(verifier, VT_TOTAL_USEC) &&
+           VerifyField<uint64_t>(verifier, VT_MAX_USEC) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_HISTOGRAM) &&
+           verifier.Verify(histogram()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbRequestStatsBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_request_type(flatbuffers::Offset<flatbuffers::String> request_type) {
+    fbb_.AddOffset(MbRequestStats::VT_REQUEST_TYPE, request_type);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_COUNT, count, 0);
+  }
+  void add_total_usec(uint64_t total_usec) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_TOTAL_USEC, total_usec, 0);
+  }
+  void add_max_usec(uint64_t max_usec) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_MAX_USEC, max_usec, 0);
+  }
+  void add_histogram(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> histogram) {
+    fbb_.AddOffset(MbRequestStats::VT_HISTOGRAM, histogram);
+  }
+  MbRequestStatsBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbRequestStatsBuilder &operator=(const MbRequestStatsBuilder &);
+  flatbuffers::Offset<MbRequestStats> Finish() {
+    const auto end = fbb_.EndTable(start_, 5);
+    auto o = flatbuffers::Offset<MbRequestStats>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbRequestStats> CreateMbRequestStats(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> request_type = 0,
+    uint64_t count = 0,
+    uint64_t total_usec = 0,
+    uint64_t max_usec = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> histogram = 0) {
+  MbRequestStatsBuilder builder_(_fbb);
+  builder_.add_max_usec(max_usec);
+  builder_.add_total_usec(total_usec);
+  builder_.add_count(count);
+  builder_.add_histogram(histogram);
+  builder_.add_request_type(request_type);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbRequestStats> CreateMbRequestStatsDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *request_type = nullptr,
+    uint64_t count = 0,
+    uint64_t total_usec = 0,
+    uint64_t max_usec = 0,
+    const std::vector<uint64_t> *histogram = nullptr) {
+  return mbtool::daemon::v3::CreateMbRequestStats(
+      _fbb,
+      request_type ? _fbb.CreateString(request_type) : 0,
+      count,
+      total_usec,
+      max_usec,
+      histogram ? _fbb.CreateVector<uint64_t>(*histogram) : 0);
+}
+
+struct MbGetStatsRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  MbGetStatsRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsRequestBuilder &operator=(const MbGetStatsRequestBuilder &);
+  flatbuffers::Offset<MbGetStatsRequest> Finish() {
+    const auto end = fbb_.EndTable(start_, 0);
+    auto o = flatbuffers::Offset<MbGetStatsRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsRequest> CreateMbGetStatsRequest(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  MbGetStatsRequestBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+struct MbGetStatsResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_HISTOGRAM_BOUNDS = 4,
+    VT_REQUESTS = 6,
+    VT_SLOW_REQUEST_THRESHOLD_MS = 8
+  };
+  const flatbuffers::Vector<uint64_t> *histogram_bounds() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_HISTOGRAM_BOUNDS);
+  }
+  const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *requests() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *>(VT_REQUESTS);
+  }
+  uint32_t slow_request_threshold_ms() const {
+    return GetField<uint32_t>(VT_SLOW_REQUEST_THRESHOLD_MS, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_HISTOGRAM_BOUNDS) &&
+           verifier.Verify(histogram_bounds()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_REQUESTS) &&
+           verifier.Verify(requests()) &&
+           verifier.VerifyVectorOfTables(requests()) &&
+           VerifyField<uint32_t>(verifier, VT_SLOW_REQUEST_THRESHOLD_MS) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_histogram_bounds(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> histogram_bounds) {
+    fbb_.AddOffset(MbGetStatsResponse::VT_HISTOGRAM_BOUNDS, histogram_bounds);
+  }
+  void add_requests(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> requests) {
+    fbb_.AddOffset(MbGetStatsResponse::VT_REQUESTS, requests);
+  }
+  void add_slow_request_threshold_ms(uint32_t slow_request_threshold_ms) {
+    fbb_.AddElement<uint32_t>(MbGetStatsResponse::VT_SLOW_REQUEST_THRESHOLD_MS, slow_request_threshold_ms, 0);
+  }
+  MbGetStatsResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsResponseBuilder &operator=(const MbGetStatsResponseBuilder &);
+  flatbuffers::Offset<MbGetStatsResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 3);
+    auto o = flatbuffers::Offset<MbGetStatsResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> histogram_bounds = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> requests = 0,
+    uint32_t slow_request_threshold_ms = 0) {
+  MbGetStatsResponseBuilder builder_(_fbb);
+  builder_.add_slow_request_threshold_ms(slow_request_threshold_ms);
+  builder_.add_requests(requests);
+  builder_.add_histogram_bounds(histogram_bounds);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint64_t> *histogram_bounds = nullptr,
+    const std::vector<flatbuffers::Offset<MbRequestStats>> *requests = nullptr,
+    uint32_t slow_request_threshold_ms = 0) {
+  return mbtool::daemon::v3::CreateMbGetStatsResponse(
+      _fbb,
+      histogram_bounds ? _fbb.CreateVector<uint64_t>(*histogram_bounds) : 0,
+      requests ? _fbb.CreateVector<flatbuffers::Offset<MbRequestStats>>(*requests) : 0,
+      slow_request_threshold_ms);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
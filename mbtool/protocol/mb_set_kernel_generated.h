@@ -47,7 +47,8 @@ inline flatbuffers::Offset<MbSetKernelError> CreateMbSetKernelError(
 struct MbSetKernelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_ROM_ID = 4,
-    VT_BOOT_BLOCKDEV = 6
+    VT_BOOT_BLOCKDEV = 6,
+    VT_REPORT_PROGRESS = 8
   };
   const flatbuffers::String *rom_id() const {
     return GetPointer<const flatbuffers::String *>(VT_ROM_ID);
@@ -55,12 +56,16 @@ struct MbSetKernelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::String *boot_blockdev() const {
     return GetPointer<const flatbuffers::String *>(VT_BOOT_BLOCKDEV);
   }
+  bool report_progress() const {
+    return GetField<uint8_t>(VT_REPORT_PROGRESS, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_ROM_ID) &&
            verifier.Verify(rom_id()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_BOOT_BLOCKDEV) &&
            verifier.Verify(boot_blockdev()) &&
+           VerifyField<uint8_t>(verifier, VT_REPORT_PROGRESS) &&
            verifier.EndTable();
   }
 };
@@ -74,13 +79,16 @@ struct MbSetKernelRequestBuilder {
   void add_boot_blockdev(flatbuffers::Offset<flatbuffers::String> boot_blockdev) {
     fbb_.AddOffset(MbSetKernelRequest::VT_BOOT_BLOCKDEV, boot_blockdev);
   }
+  void add_report_progress(bool report_progress) {
+    fbb_.AddElement<uint8_t>(MbSetKernelRequest::VT_REPORT_PROGRESS, static_cast<uint8_t>(report_progress), 0);
+  }
   MbSetKernelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MbSetKernelRequestBuilder &operator=(const MbSetKernelRequestBuilder &);
   flatbuffers::Offset<MbSetKernelRequest> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<MbSetKernelRequest>(end);
     return o;
   }
@@ -89,27 +97,32 @@ struct MbSetKernelRequestBuilder {
 inline flatbuffers::Offset<MbSetKernelRequest> CreateMbSetKernelRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::String> rom_id = 0,
-    flatbuffers::Offset<flatbuffers::String> boot_blockdev = 0) {
+    flatbuffers::Offset<flatbuffers::String> boot_blockdev = 0,
+    bool report_progress = false) {
   MbSetKernelRequestBuilder builder_(_fbb);
   builder_.add_boot_blockdev(boot_blockdev);
   builder_.add_rom_id(rom_id);
+  builder_.add_report_progress(report_progress);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<MbSetKernelRequest> CreateMbSetKernelRequestDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const char *rom_id = nullptr,
-    const char *boot_blockdev = nullptr) {
+    const char *boot_blockdev = nullptr,
+    bool report_progress = false) {
   return mbtool::daemon::v3::CreateMbSetKernelRequest(
       _fbb,
       rom_id ? _fbb.CreateString(rom_id) : 0,
-      boot_blockdev ? _fbb.CreateString(boot_blockdev) : 0);
+      boot_blockdev ? _fbb.CreateString(boot_blockdev) : 0,
+      report_progress);
 }
 
 struct MbSetKernelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_SUCCESS = 4,
-    VT_ERROR = 6
+    VT_ERROR = 6,
+    VT_CANCELLED = 8
   };
   bool success() const {
     return GetField<uint8_t>(VT_SUCCESS, 0) != 0;
@@ -117,11 +130,15 @@ struct MbSetKernelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table
   const MbSetKernelError *error() const {
     return GetPointer<const MbSetKernelError *>(VT_ERROR);
   }
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_SUCCESS) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_ERROR) &&
            verifier.VerifyTable(error()) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
            verifier.EndTable();
   }
 };
@@ -135,13 +152,16 @@ struct MbSetKernelResponseBuilder {
   void add_error(flatbuffers::Offset<MbSetKernelError> error) {
     fbb_.AddOffset(MbSetKernelResponse::VT_ERROR, error);
   }
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(MbSetKernelResponse::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
   MbSetKernelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MbSetKernelResponseBuilder &operator=(const MbSetKernelResponseBuilder &);
   flatbuffers::Offset<MbSetKernelResponse> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<MbSetKernelResponse>(end);
     return o;
   }
@@ -150,9 +170,11 @@ struct MbSetKernelResponseBuilder {
 inline flatbuffers::Offset<MbSetKernelResponse> CreateMbSetKernelResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     bool success = false,
-    flatbuffers::Offset<MbSetKernelError> error = 0) {
+    flatbuffers::Offset<MbSetKernelError> error = 0,
+    bool cancelled = false) {
   MbSetKernelResponseBuilder builder_(_fbb);
   builder_.add_error(error);
+  builder_.add_cancelled(cancelled);
   builder_.add_success(success);
   return builder_.Finish();
 }
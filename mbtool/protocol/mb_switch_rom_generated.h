@@ -21,8 +21,9 @@ enum MbSwitchRomResult {
   MbSwitchRomResult_FAILED = 1,
   MbSwitchRomResult_CHECKSUM_NOT_FOUND = 2,
   MbSwitchRomResult_CHECKSUM_INVALID = 3,
+  MbSwitchRomResult_CANCELLED = 4,
   MbSwitchRomResult_MIN = MbSwitchRomResult_SUCCEEDED,
-  MbSwitchRomResult_MAX = MbSwitchRomResult_CHECKSUM_INVALID
+  MbSwitchRomResult_MAX = MbSwitchRomResult_CANCELLED
 };
 
 inline const char **EnumNamesMbSwitchRomResult() {
@@ -31,6 +32,7 @@ inline const char **EnumNamesMbSwitchRomResult() {
     "FAILED",
     "CHECKSUM_NOT_FOUND",
     "CHECKSUM_INVALID",
+    "CANCELLED",
     nullptr
   };
   return names;
@@ -74,7 +76,8 @@ struct MbSwitchRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_ROM_ID = 4,
     VT_BOOT_BLOCKDEV = 6,
     VT_BLOCKDEV_BASE_DIRS = 8,
-    VT_FORCE_UPDATE_CHECKSUMS = 10
+    VT_FORCE_UPDATE_CHECKSUMS = 10,
+    VT_REPORT_PROGRESS = 12
   };
   const flatbuffers::String *rom_id() const {
     return GetPointer<const flatbuffers::String *>(VT_ROM_ID);
@@ -88,6 +91,9 @@ struct MbSwitchRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   bool force_update_checksums() const {
     return GetField<uint8_t>(VT_FORCE_UPDATE_CHECKSUMS, 0) != 0;
   }
+  bool report_progress() const {
+    return GetField<uint8_t>(VT_REPORT_PROGRESS, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_ROM_ID) &&
@@ -98,6 +104,7 @@ struct MbSwitchRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            verifier.Verify(blockdev_base_dirs()) &&
            verifier.VerifyVectorOfStrings(blockdev_base_dirs()) &&
            VerifyField<uint8_t>(verifier, VT_FORCE_UPDATE_CHECKSUMS) &&
+           VerifyField<uint8_t>(verifier, VT_REPORT_PROGRESS) &&
            verifier.EndTable();
   }
 };
@@ -117,13 +124,16 @@ struct MbSwitchRomRequestBuilder {
   void add_force_update_checksums(bool force_update_checksums) {
     fbb_.AddElement<uint8_t>(MbSwitchRomRequest::VT_FORCE_UPDATE_CHECKSUMS, static_cast<uint8_t>(force_update_checksums), 0);
   }
+  void add_report_progress(bool report_progress) {
+    fbb_.AddElement<uint8_t>(MbSwitchRomRequest::VT_REPORT_PROGRESS, static_cast<uint8_t>(report_progress), 0);
+  }
   MbSwitchRomRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MbSwitchRomRequestBuilder &operator=(const MbSwitchRomRequestBuilder &);
   flatbuffers::Offset<MbSwitchRomRequest> Finish() {
-    const auto end = fbb_.EndTable(start_, 4);
+    const auto end = fbb_.EndTable(start_, 5);
     auto o = flatbuffers::Offset<MbSwitchRomRequest>(end);
     return o;
   }
@@ -134,11 +144,13 @@ inline flatbuffers::Offset<MbSwitchRomRequest> CreateMbSwitchRomRequest(
     flatbuffers::Offset<flatbuffers::String> rom_id = 0,
     flatbuffers::Offset<flatbuffers::String> boot_blockdev = 0,
     flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> blockdev_base_dirs = 0,
-    bool force_update_checksums = false) {
+    bool force_update_checksums = false,
+    bool report_progress = false) {
   MbSwitchRomRequestBuilder builder_(_fbb);
   builder_.add_blockdev_base_dirs(blockdev_base_dirs);
   builder_.add_boot_blockdev(boot_blockdev);
   builder_.add_rom_id(rom_id);
+  builder_.add_report_progress(report_progress);
   builder_.add_force_update_checksums(force_update_checksums);
   return builder_.Finish();
 }
@@ -148,13 +160,15 @@ inline flatbuffers::Offset<MbSwitchRomRequest> CreateMbSwitchRomRequestDirect(
     const char *rom_id = nullptr,
     const char *boot_blockdev = nullptr,
     const std::vector<flatbuffers::Offset<flatbuffers::String>> *blockdev_base_dirs = nullptr,
-    bool force_update_checksums = false) {
+    bool force_update_checksums = false,
+    bool report_progress = false) {
   return mbtool::daemon::v3::CreateMbSwitchRomRequest(
       _fbb,
       rom_id ? _fbb.CreateString(rom_id) : 0,
       boot_blockdev ? _fbb.CreateString(boot_blockdev) : 0,
       blockdev_base_dirs ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*blockdev_base_dirs) : 0,
-      force_update_checksums);
+      force_update_checksums,
+      report_progress);
 }
 
 struct MbSwitchRomResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
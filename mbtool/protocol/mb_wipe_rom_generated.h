@@ -44,7 +44,9 @@ inline const char *EnumNameMbWipeTarget(MbWipeTarget e) {
 struct MbWipeRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_ROM_ID = 4,
-    VT_TARGETS = 6
+    VT_TARGETS = 6,
+    VT_REPORT_PROGRESS = 8,
+    VT_BACKGROUND = 10
   };
   const flatbuffers::String *rom_id() const {
     return GetPointer<const flatbuffers::String *>(VT_ROM_ID);
@@ -52,12 +54,20 @@ struct MbWipeRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<int16_t> *targets() const {
     return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_TARGETS);
   }
+  bool report_progress() const {
+    return GetField<uint8_t>(VT_REPORT_PROGRESS, 0) != 0;
+  }
+  bool background() const {
+    return GetField<uint8_t>(VT_BACKGROUND, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_ROM_ID) &&
            verifier.Verify(rom_id()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_TARGETS) &&
            verifier.Verify(targets()) &&
+           VerifyField<uint8_t>(verifier, VT_REPORT_PROGRESS) &&
+           VerifyField<uint8_t>(verifier, VT_BACKGROUND) &&
            verifier.EndTable();
   }
 };
@@ -71,13 +81,19 @@ struct MbWipeRomRequestBuilder {
   void add_targets(flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets) {
     fbb_.AddOffset(MbWipeRomRequest::VT_TARGETS, targets);
   }
+  void add_report_progress(bool report_progress) {
+    fbb_.AddElement<uint8_t>(MbWipeRomRequest::VT_REPORT_PROGRESS, static_cast<uint8_t>(report_progress), 0);
+  }
+  void add_background(bool background) {
+    fbb_.AddElement<uint8_t>(MbWipeRomRequest::VT_BACKGROUND, static_cast<uint8_t>(background), 0);
+  }
   MbWipeRomRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MbWipeRomRequestBuilder &operator=(const MbWipeRomRequestBuilder &);
   flatbuffers::Offset<MbWipeRomRequest> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 4);
     auto o = flatbuffers::Offset<MbWipeRomRequest>(end);
     return o;
   }
@@ -86,27 +102,36 @@ struct MbWipeRomRequestBuilder {
 inline flatbuffers::Offset<MbWipeRomRequest> CreateMbWipeRomRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::String> rom_id = 0,
-    flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets = 0,
+    bool report_progress = false,
+    bool background = false) {
   MbWipeRomRequestBuilder builder_(_fbb);
   builder_.add_targets(targets);
   builder_.add_rom_id(rom_id);
+  builder_.add_background(background);
+  builder_.add_report_progress(report_progress);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<MbWipeRomRequest> CreateMbWipeRomRequestDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const char *rom_id = nullptr,
-    const std::vector<int16_t> *targets = nullptr) {
+    const std::vector<int16_t> *targets = nullptr,
+    bool report_progress = false,
+    bool background = false) {
   return mbtool::daemon::v3::CreateMbWipeRomRequest(
       _fbb,
       rom_id ? _fbb.CreateString(rom_id) : 0,
-      targets ? _fbb.CreateVector<int16_t>(*targets) : 0);
+      targets ? _fbb.CreateVector<int16_t>(*targets) : 0,
+      report_progress,
+      background);
 }
 
 struct MbWipeRomResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_SUCCEEDED = 4,
-    VT_FAILED = 6
+    VT_FAILED = 6,
+    VT_CANCELLED = 8
   };
   const flatbuffers::Vector<int16_t> *succeeded() const {
     return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_SUCCEEDED);
@@ -114,12 +139,16 @@ struct MbWipeRomResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<int16_t> *failed() const {
     return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_FAILED);
   }
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_SUCCEEDED) &&
            verifier.Verify(succeeded()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_FAILED) &&
            verifier.Verify(failed()) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
            verifier.EndTable();
   }
 };
@@ -133,13 +162,16 @@ struct MbWipeRomResponseBuilder {
   void add_failed(flatbuffers::Offset<flatbuffers::Vector<int16_t>> failed) {
     fbb_.AddOffset(MbWipeRomResponse::VT_FAILED, failed);
   }
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(MbWipeRomResponse::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
   MbWipeRomResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MbWipeRomResponseBuilder &operator=(const MbWipeRomResponseBuilder &);
   flatbuffers::Offset<MbWipeRomResponse> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<MbWipeRomResponse>(end);
     return o;
   }
@@ -148,21 +180,25 @@ struct MbWipeRomResponseBuilder {
 inline flatbuffers::Offset<MbWipeRomResponse> CreateMbWipeRomResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::Vector<int16_t>> succeeded = 0,
-    flatbuffers::Offset<flatbuffers::Vector<int16_t>> failed = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> failed = 0,
+    bool cancelled = false) {
   MbWipeRomResponseBuilder builder_(_fbb);
   builder_.add_failed(failed);
   builder_.add_succeeded(succeeded);
+  builder_.add_cancelled(cancelled);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<MbWipeRomResponse> CreateMbWipeRomResponseDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const std::vector<int16_t> *succeeded = nullptr,
-    const std::vector<int16_t> *failed = nullptr) {
+    const std::vector<int16_t> *failed = nullptr,
+    bool cancelled = false) {
   return mbtool::daemon::v3::CreateMbWipeRomResponse(
       _fbb,
       succeeded ? _fbb.CreateVector<int16_t>(*succeeded) : 0,
-      failed ? _fbb.CreateVector<int16_t>(*failed) : 0);
+      failed ? _fbb.CreateVector<int16_t>(*failed) : 0,
+      cancelled);
 }
 
 }  // namespace v3
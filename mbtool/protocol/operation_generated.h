@@ -0,0 +1,164 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_OPERATION_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_OPERATION_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct OperationProgressResponse;
+
+struct OperationCancelRequest;
+
+struct OperationCancelResponse;
+
+struct OperationProgressResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_FILES = 4,
+    VT_BYTES = 6,
+    VT_PATH = 8
+  };
+  uint64_t files() const {
+    return GetField<uint64_t>(VT_FILES, 0);
+  }
+  uint64_t bytes() const {
+    return GetField<uint64_t>(VT_BYTES, 0);
+  }
+  const flatbuffers::String *path() const {
+    return GetPointer<const flatbuffers::String *>(VT_PATH);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_FILES) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PATH) &&
+           verifier.Verify(path()) &&
+           verifier.EndTable();
+  }
+};
+
+struct OperationProgressResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_files(uint64_t files) {
+    fbb_.AddElement<uint64_t>(OperationProgressResponse::VT_FILES, files, 0);
+  }
+  void add_bytes(uint64_t bytes) {
+    fbb_.AddElement<uint64_t>(OperationProgressResponse::VT_BYTES, bytes, 0);
+  }
+  void add_path(flatbuffers::Offset<flatbuffers::String> path) {
+    fbb_.AddOffset(OperationProgressResponse::VT_PATH, path);
+  }
+  OperationProgressResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  OperationProgressResponseBuilder &operator=(const OperationProgressResponseBuilder &);
+  flatbuffers::Offset<OperationProgressResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 3);
+    auto o = flatbuffers::Offset<OperationProgressResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<OperationProgressResponse> CreateOperationProgressResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t files = 0,
+    uint64_t bytes = 0,
+    flatbuffers::Offset<flatbuffers::String> path = 0) {
+  OperationProgressResponseBuilder builder_(_fbb);
+  builder_.add_bytes(bytes);
+  builder_.add_files(files);
+  builder_.add_path(path);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<OperationProgressResponse> CreateOperationProgressResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t files = 0,
+    uint64_t bytes = 0,
+    const char *path = nullptr) {
+  return mbtool::daemon::v3::CreateOperationProgressResponse(
+      _fbb,
+      files,
+      bytes,
+      path ? _fbb.CreateString(path) : 0);
+}
+
+struct OperationCancelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct OperationCancelRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  OperationCancelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  OperationCancelRequestBuilder &operator=(const OperationCancelRequestBuilder &);
+  flatbuffers::Offset<OperationCancelRequest> Finish() {
+    const auto end = fbb_.EndTable(start_, 0);
+    auto o = flatbuffers::Offset<OperationCancelRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<OperationCancelRequest> CreateOperationCancelRequest(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  OperationCancelRequestBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+struct OperationCancelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_CANCELLED = 4
+  };
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
+           verifier.EndTable();
+  }
+};
+
+struct OperationCancelResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(OperationCancelResponse::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
+  OperationCancelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  OperationCancelResponseBuilder &operator=(const OperationCancelResponseBuilder &);
+  flatbuffers::Offset<OperationCancelResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<OperationCancelResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<OperationCancelResponse> CreateOperationCancelResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool cancelled = false) {
+  OperationCancelResponseBuilder builder_(_fbb);
+  builder_.add_cancelled(cancelled);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_OPERATION_MBTOOL_DAEMON_V3_H_
@@ -16,6 +16,8 @@ struct PathGetDirectorySizeRequest;
 
 struct PathGetDirectorySizeResponse;
 
+struct PathGetDirectorySizeProgressResponse;
+
 struct PathGetDirectorySizeError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_ERRNO_VALUE = 4,
@@ -80,7 +82,8 @@ inline flatbuffers::Offset<PathGetDirectorySizeError> CreatePathGetDirectorySize
 struct PathGetDirectorySizeRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_PATH = 4,
-    VT_EXCLUSIONS = 6
+    VT_EXCLUSIONS = 6,
+    VT_REPORT_PROGRESS = 8
   };
   const flatbuffers::String *path() const {
     return GetPointer<const flatbuffers::String *>(VT_PATH);
@@ -88,6 +91,9 @@ struct PathGetDirectorySizeRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers
   const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *exclusions() const {
     return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_EXCLUSIONS);
   }
+  bool report_progress() const {
+    return GetField<uint8_t>(VT_REPORT_PROGRESS, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_PATH) &&
@@ -95,6 +101,7 @@ struct PathGetDirectorySizeRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_EXCLUSIONS) &&
            verifier.Verify(exclusions()) &&
            verifier.VerifyVectorOfStrings(exclusions()) &&
+           VerifyField<uint8_t>(verifier, VT_REPORT_PROGRESS) &&
            verifier.EndTable();
   }
 };
@@ -108,13 +115,16 @@ struct PathGetDirectorySizeRequestBuilder {
   void add_exclusions(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> exclusions) {
     fbb_.AddOffset(PathGetDirectorySizeRequest::VT_EXCLUSIONS, exclusions);
   }
+  void add_report_progress(bool report_progress) {
+    fbb_.AddElement<uint8_t>(PathGetDirectorySizeRequest::VT_REPORT_PROGRESS, static_cast<uint8_t>(report_progress), 0);
+  }
   PathGetDirectorySizeRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   PathGetDirectorySizeRequestBuilder &operator=(const PathGetDirectorySizeRequestBuilder &);
   flatbuffers::Offset<PathGetDirectorySizeRequest> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<PathGetDirectorySizeRequest>(end);
     return o;
   }
@@ -123,21 +133,25 @@ struct PathGetDirectorySizeRequestBuilder {
 inline flatbuffers::Offset<PathGetDirectorySizeRequest> CreatePathGetDirectorySizeRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::String> path = 0,
-    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> exclusions = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> exclusions = 0,
+    bool report_progress = false) {
   PathGetDirectorySizeRequestBuilder builder_(_fbb);
   builder_.add_exclusions(exclusions);
   builder_.add_path(path);
+  builder_.add_report_progress(report_progress);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<PathGetDirectorySizeRequest> CreatePathGetDirectorySizeRequestDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const char *path = nullptr,
-    const std::vector<flatbuffers::Offset<flatbuffers::String>> *exclusions = nullptr) {
+    const std::vector<flatbuffers::Offset<flatbuffers::String>> *exclusions = nullptr,
+    bool report_progress = false) {
   return mbtool::daemon::v3::CreatePathGetDirectorySizeRequest(
       _fbb,
       path ? _fbb.CreateString(path) : 0,
-      exclusions ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*exclusions) : 0);
+      exclusions ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*exclusions) : 0,
+      report_progress);
 }
 
 struct PathGetDirectorySizeResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
@@ -226,6 +240,46 @@ inline flatbuffers::Offset<PathGetDirectorySizeResponse> CreatePathGetDirectoryS
       error);
 }
 
+struct PathGetDirectorySizeProgressResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SIZE = 4
+  };
+  uint64_t size() const {
+    return GetField<uint64_t>(VT_SIZE, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_SIZE) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathGetDirectorySizeProgressResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_size(uint64_t size) {
+    fbb_.AddElement<uint64_t>(PathGetDirectorySizeProgressResponse::VT_SIZE, size, 0);
+  }
+  PathGetDirectorySizeProgressResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathGetDirectorySizeProgressResponseBuilder &operator=(const PathGetDirectorySizeProgressResponseBuilder &);
+  flatbuffers::Offset<PathGetDirectorySizeProgressResponse> Finish() {
+    const auto end = fbb_.EndTable(start_, 1);
+    auto o = flatbuffers::Offset<PathGetDirectorySizeProgressResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathGetDirectorySizeProgressResponse> CreatePathGetDirectorySizeProgressResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t size = 0) {
+  PathGetDirectorySizeProgressResponseBuilder builder_(_fbb);
+  builder_.add_size(size);
+  return builder_.Finish();
+}
+
 }  // namespace v3
 }  // namespace daemon
 }  // namespace mbtool
@@ -6,24 +6,31 @@
 
 #include "flatbuffers/flatbuffers.h"
 
+#include "batch_generated.h"
 #include "crypto_decrypt_generated.h"
 #include "crypto_get_pw_type_generated.h"
+#include "event_subscribe_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
 #include "file_open_generated.h"
+#include "file_open_fd_generated.h"
 #include "file_read_generated.h"
 #include "file_seek_generated.h"
 #include "file_selinux_get_label_generated.h"
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
+#include "file_stream_read_generated.h"
+#include "file_stream_write_generated.h"
 #include "file_write_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
 #include "mb_wipe_rom_generated.h"
+#include "operation_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
 #include "path_delete_generated.h"
@@ -73,8 +80,15 @@ enum RequestType {
   RequestType_CryptoDecryptRequest = 27,
   RequestType_CryptoGetPwTypeRequest = 28,
   RequestType_PathReadlinkRequest = 29,
+  RequestType_FileStreamReadRequest = 30,
+  RequestType_FileStreamWriteRequest = 31,
+  RequestType_FileOpenFdRequest = 32,
+  RequestType_BatchRequest = 33,
+  RequestType_EventSubscribeRequest = 34,
+  RequestType_OperationCancelRequest = 35,
+  RequestType_MbGetStatsRequest = 36,
   RequestType_MIN = RequestType_NONE,
-  RequestType_MAX = RequestType_PathReadlinkRequest
+  RequestType_MAX = RequestType_MbGetStatsRequest
 };
 
 inline const char **EnumNamesRequestType() {
@@ -109,6 +123,13 @@ inline const char **EnumNamesRequestType() {
     "CryptoDecryptRequest",
     "CryptoGetPwTypeRequest",
     "PathReadlinkRequest",
+    "FileStreamReadRequest",
+    "FileStreamWriteRequest",
+    "FileOpenFdRequest",
+    "BatchRequest",
+    "EventSubscribeRequest",
+    "OperationCancelRequest",
+    "MbGetStatsRequest",
     nullptr
   };
   return names;
@@ -239,13 +260,68 @@ template<> struct RequestTypeTraits<mbtool::daemon::v3::PathReadlinkRequest> {
   static const RequestType enum_value = RequestType_PathReadlinkRequest;
 };
 
+template<> struct RequestTypeTraits<mbtool::daemon::v3::FileStreamReadRequest> {
+  static const RequestType enum_value = RequestType_FileStreamReadRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::FileStreamWriteRequest> {
+  static const RequestType enum_value = RequestType_FileStreamWriteRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::FileOpenFdRequest> {
+  static const RequestType enum_value = RequestType_FileOpenFdRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::BatchRequest> {
+  static const RequestType enum_value = RequestType_BatchRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::EventSubscribeRequest> {
+  static const RequestType enum_value = RequestType_EventSubscribeRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::OperationCancelRequest> {
+  static const RequestType enum_value = RequestType_OperationCancelRequest;
+};
+
+template<> struct RequestTypeTraits<mbtool::daemon::v3::MbGetStatsRequest> {
+  static const RequestType enum_value = RequestType_MbGetStatsRequest;
+};
+
 bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj, RequestType type);
 bool VerifyRequestTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
+enum SchedPolicy {
+  SchedPolicy_DEFAULT = 0,
+  SchedPolicy_BACKGROUND = 1,
+  SchedPolicy_IDLE = 2,
+  SchedPolicy_INTERACTIVE = 3,
+  SchedPolicy_MIN = SchedPolicy_DEFAULT,
+  SchedPolicy_MAX = SchedPolicy_INTERACTIVE
+};
+
+inline const char **EnumNamesSchedPolicy() {
+  static const char *names[] = {
+    "DEFAULT",
+    "BACKGROUND",
+    "IDLE",
+    "INTERACTIVE",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameSchedPolicy(SchedPolicy e) {
+  const size_t index = static_cast<int>(e);
+  return EnumNamesSchedPolicy()[index];
+}
+
 struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_REQUEST_TYPE = 4,
-    VT_REQUEST = 6
+    VT_REQUEST = 6,
+    VT_ALLOW_MEMFD = 8,
+    VT_SCHED_POLICY = 10
   };
   RequestType request_type() const {
     return static_cast<RequestType>(GetField<uint8_t>(VT_REQUEST_TYPE, 0));
@@ -253,11 +329,19 @@ struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const void *request() const {
     return GetPointer<const void *>(VT_REQUEST);
   }
+  bool allow_memfd() const {
+    return GetField<uint8_t>(VT_ALLOW_MEMFD, 0) != 0;
+  }
+  SchedPolicy sched_policy() const {
+    return static_cast<SchedPolicy>(GetField<int16_t>(VT_SCHED_POLICY, 0));
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_REQUEST_TYPE) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_REQUEST) &&
            VerifyRequestType(verifier, request(), request_type()) &&
+           VerifyField<uint8_t>(verifier, VT_ALLOW_MEMFD) &&
+           VerifyField<int16_t>(verifier, VT_SCHED_POLICY) &&
            verifier.EndTable();
   }
 };
@@ -271,13 +355,19 @@ struct RequestBuilder {
   void add_request(flatbuffers::Offset<void> request) {
     fbb_.AddOffset(Request::VT_REQUEST, request);
   }
+  void add_allow_memfd(bool allow_memfd) {
+    fbb_.AddElement<uint8_t>(Request::VT_ALLOW_MEMFD, static_cast<uint8_t>(allow_memfd), 0);
+  }
+  void add_sched_policy(SchedPolicy sched_policy) {
+    fbb_.AddElement<int16_t>(Request::VT_SCHED_POLICY, static_cast<int16_t>(sched_policy), 0);
+  }
   RequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   RequestBuilder &operator=(const RequestBuilder &);
   flatbuffers::Offset<Request> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 4);
     auto o = flatbuffers::Offset<Request>(end);
     return o;
   }
@@ -286,10 +376,14 @@ struct RequestBuilder {
 inline flatbuffers::Offset<Request> CreateRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     RequestType request_type = RequestType_NONE,
-    flatbuffers::Offset<void> request = 0) {
+    flatbuffers::Offset<void> request = 0,
+    bool allow_memfd = false,
+    SchedPolicy sched_policy = SchedPolicy_DEFAULT) {
   RequestBuilder builder_(_fbb);
   builder_.add_request(request);
+  builder_.add_sched_policy(sched_policy);
   builder_.add_request_type(request_type);
+  builder_.add_allow_memfd(allow_memfd);
   return builder_.Finish();
 }
 
@@ -414,6 +508,34 @@ inline bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const mbtool::daemon::v3::PathReadlinkRequest *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case RequestType_FileStreamReadRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileStreamReadRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_FileStreamWriteRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileStreamWriteRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_FileOpenFdRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileOpenFdRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_BatchRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::BatchRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_EventSubscribeRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::EventSubscribeRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_OperationCancelRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::OperationCancelRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_MbGetStatsRequest: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::MbGetStatsRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
@@ -6,24 +6,31 @@
 
 #include "flatbuffers/flatbuffers.h"
 
+#include "batch_generated.h"
 #include "crypto_decrypt_generated.h"
 #include "crypto_get_pw_type_generated.h"
+#include "event_subscribe_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
 #include "file_open_generated.h"
+#include "file_open_fd_generated.h"
 #include "file_read_generated.h"
 #include "file_seek_generated.h"
 #include "file_selinux_get_label_generated.h"
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
+#include "file_stream_read_generated.h"
+#include "file_stream_write_generated.h"
 #include "file_write_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
 #include "mb_wipe_rom_generated.h"
+#include "operation_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
 #include "path_delete_generated.h"
@@ -80,8 +87,18 @@ enum ResponseType {
   ResponseType_CryptoDecryptResponse = 30,
   ResponseType_CryptoGetPwTypeResponse = 31,
   ResponseType_PathReadlinkResponse = 32,
+  ResponseType_FileStreamReadResponse = 33,
+  ResponseType_FileStreamWriteResponse = 34,
+  ResponseType_FileOpenFdResponse = 35,
+  ResponseType_BatchResponse = 36,
+  ResponseType_PathGetDirectorySizeProgressResponse = 37,
+  ResponseType_EventSubscribeResponse = 38,
+  ResponseType_EventNotificationResponse = 39,
+  ResponseType_OperationProgressResponse = 40,
+  ResponseType_OperationCancelResponse = 41,
+  ResponseType_MbGetStatsResponse = 42,
   ResponseType_MIN = ResponseType_NONE,
-  ResponseType_MAX = ResponseType_PathReadlinkResponse
+  ResponseType_MAX = ResponseType_MbGetStatsResponse
 };
 
 inline const char **EnumNamesResponseType() {
@@ -119,6 +136,16 @@ inline const char **EnumNamesResponseType() {
     "CryptoDecryptResponse",
     "CryptoGetPwTypeResponse",
     "PathReadlinkResponse",
+    "FileStreamReadResponse",
+    "FileStreamWriteResponse",
+    "FileOpenFdResponse",
+    "BatchResponse",
+    "PathGetDirectorySizeProgressResponse",
+    "EventSubscribeResponse",
+    "EventNotificationResponse",
+    "OperationProgressResponse",
+    "OperationCancelResponse",
+    "MbGetStatsResponse",
     nullptr
   };
   return names;
@@ -261,6 +288,46 @@ template<> struct ResponseTypeTraits<mbtool::daemon::v3::PathReadlinkResponse> {
   static const ResponseType enum_value = ResponseType_PathReadlinkResponse;
 };
 
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::FileStreamReadResponse> {
+  static const ResponseType enum_value = ResponseType_FileStreamReadResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::FileStreamWriteResponse> {
+  static const ResponseType enum_value = ResponseType_FileStreamWriteResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::FileOpenFdResponse> {
+  static const ResponseType enum_value = ResponseType_FileOpenFdResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::BatchResponse> {
+  static const ResponseType enum_value = ResponseType_BatchResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::PathGetDirectorySizeProgressResponse> {
+  static const ResponseType enum_value = ResponseType_PathGetDirectorySizeProgressResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::EventSubscribeResponse> {
+  static const ResponseType enum_value = ResponseType_EventSubscribeResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::EventNotificationResponse> {
+  static const ResponseType enum_value = ResponseType_EventNotificationResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::OperationProgressResponse> {
+  static const ResponseType enum_value = ResponseType_OperationProgressResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::OperationCancelResponse> {
+  static const ResponseType enum_value = ResponseType_OperationCancelResponse;
+};
+
+template<> struct ResponseTypeTraits<mbtool::daemon::v3::MbGetStatsResponse> {
+  static const ResponseType enum_value = ResponseType_MbGetStatsResponse;
+};
+
 bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj, ResponseType type);
 bool VerifyResponseTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -323,7 +390,8 @@ inline flatbuffers::Offset<Unsupported> CreateUnsupported(
 struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_RESPONSE_TYPE = 4,
-    VT_RESPONSE = 6
+    VT_RESPONSE = 6,
+    VT_MEMFD = 8
   };
   ResponseType response_type() const {
     return static_cast<ResponseType>(GetField<uint8_t>(VT_RESPONSE_TYPE, 0));
@@ -331,11 +399,15 @@ struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const void *response() const {
     return GetPointer<const void *>(VT_RESPONSE);
   }
+  bool memfd() const {
+    return GetField<uint8_t>(VT_MEMFD, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_RESPONSE_TYPE) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_RESPONSE) &&
            VerifyResponseType(verifier, response(), response_type()) &&
+           VerifyField<uint8_t>(verifier, VT_MEMFD) &&
            verifier.EndTable();
   }
 };
@@ -349,13 +421,16 @@ struct ResponseBuilder {
   void add_response(flatbuffers::Offset<void> response) {
     fbb_.AddOffset(Response::VT_RESPONSE, response);
   }
+  void add_memfd(bool memfd) {
+    fbb_.AddElement<uint8_t>(Response::VT_MEMFD, static_cast<uint8_t>(memfd), 0);
+  }
   ResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   ResponseBuilder &operator=(const ResponseBuilder &);
   flatbuffers::Offset<Response> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<Response>(end);
     return o;
   }
@@ -364,10 +439,12 @@ struct ResponseBuilder {
 inline flatbuffers::Offset<Response> CreateResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     ResponseType response_type = ResponseType_NONE,
-    flatbuffers::Offset<void> response = 0) {
+    flatbuffers::Offset<void> response = 0,
+    bool memfd = false) {
   ResponseBuilder builder_(_fbb);
   builder_.add_response(response);
   builder_.add_response_type(response_type);
+  builder_.add_memfd(memfd);
   return builder_.Finish();
 }
 
@@ -504,6 +581,46 @@ inline bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const mbtool::daemon::v3::PathReadlinkResponse *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case ResponseType_FileStreamReadResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileStreamReadResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_FileStreamWriteResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileStreamWriteResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_FileOpenFdResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::FileOpenFdResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_BatchResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::BatchResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathGetDirectorySizeProgressResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::PathGetDirectorySizeProgressResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_EventSubscribeResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::EventSubscribeResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_EventNotificationResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::EventNotificationResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_OperationProgressResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::OperationProgressResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_OperationCancelResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::OperationCancelResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbGetStatsResponse: {
+      auto ptr = reinterpret_cast<const mbtool::daemon::v3::MbGetStatsResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ramdisk.h"
+
+#include <memory>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/file_error.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/ramdisk"
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
+
+namespace mb
+{
+
+static std::string_view normalize_entry_path(std::string_view path)
+{
+    while (true) {
+        if (path.substr(0, 2) == "./") {
+            path.remove_prefix(2);
+        } else if (!path.empty() && path.front() == '/') {
+            path.remove_prefix(1);
+        } else {
+            break;
+        }
+    }
+
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+
+    if (path == ".") {
+        path = {};
+    }
+
+    return path;
+}
+
+static RamdiskEntry new_entry(std::string path, mode_t mode)
+{
+    RamdiskEntry entry;
+    entry.path = std::move(path);
+    entry.mode = mode;
+    entry.uid = 0;
+    entry.gid = 0;
+    entry.mtime = time(nullptr);
+    entry.rdev = 0;
+    return entry;
+}
+
+Ramdisk::Ramdisk()
+    : _format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+{
+}
+
+/*!
+ * \brief Load entries from a cpio archive in memory
+ *
+ * The compression filters and cpio format are remembered so that save()
+ * writes the archive back in the same format.
+ */
+bool Ramdisk::load(const void *data, size_t size)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    archive_entry *entry;
+    int ret;
+
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    archive_read_support_filter_gzip(a.get());
+    archive_read_support_filter_lz4(a.get());
+    archive_read_support_filter_lzma(a.get());
+    archive_read_support_filter_xz(a.get());
+    archive_read_support_format_cpio(a.get());
+
+    if (archive_read_open_memory(a.get(), data, size) != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    _entries.clear();
+
+    // Indexes of the entries belonging to each set of hard links
+    std::unordered_map<std::string, std::vector<size_t>> links;
+
+    while (true) {
+        ret = archive_read_next_header(a.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("Failed to read ramdisk header: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("Ramdisk header has null or empty filename");
+            return false;
+        }
+
+        auto normalized = normalize_entry_path(path);
+        if (normalized.empty()) {
+            // Root of the archive
+            continue;
+        }
+
+        RamdiskEntry item = new_entry(std::string(normalized),
+                                      archive_entry_mode(entry));
+        item.uid = static_cast<uid_t>(archive_entry_uid(entry));
+        item.gid = static_cast<gid_t>(archive_entry_gid(entry));
+        item.mtime = archive_entry_mtime(entry);
+        item.rdev = archive_entry_rdev(entry);
+
+        if (S_ISLNK(item.mode)) {
+            if (const char *target = archive_entry_symlink(entry)) {
+                item.data = target;
+            }
+        } else if (S_ISREG(item.mode) && archive_entry_size(entry) > 0) {
+            item.data.resize(static_cast<size_t>(archive_entry_size(entry)));
+
+            size_t offset = 0;
+            while (offset < item.data.size()) {
+                la_ssize_t n = archive_read_data(
+                        a.get(), item.data.data() + offset,
+                        item.data.size() - offset);
+                if (n < 0) {
+                    LOGE("%s: Failed to read ramdisk entry data: %s",
+                         item.path.c_str(), archive_error_string(a.get()));
+                    return false;
+                } else if (n == 0) {
+                    LOGE("%s: Ramdisk entry data is truncated",
+                         item.path.c_str());
+                    return false;
+                }
+                offset += static_cast<size_t>(n);
+            }
+        }
+
+        if (const char *hardlink = archive_entry_hardlink(entry)) {
+            std::string source(normalize_entry_path(hardlink));
+            auto &indexes = links[source];
+
+            if (indexes.empty()) {
+                auto const *source_entry = find(source);
+                if (!source_entry) {
+                    LOGE("%s: Hard link target does not exist: %s",
+                         item.path.c_str(), hardlink);
+                    return false;
+                }
+                indexes.push_back(static_cast<size_t>(
+                        source_entry - _entries.data()));
+            }
+
+            if (item.data.empty()) {
+                item.data = _entries[indexes.front()].data;
+            } else {
+                // Data belongs to the whole set (eg. last entry in newc)
+                for (auto index : indexes) {
+                    _entries[index].data = item.data;
+                }
+            }
+
+            item.mode = _entries[indexes.front()].mode;
+            indexes.push_back(_entries.size());
+        }
+
+        _entries.push_back(std::move(item));
+    }
+
+    _format = archive_format(a.get());
+    _filters.clear();
+    for (int i = 0; i < archive_filter_count(a.get()); ++i) {
+        int code = archive_filter_code(a.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            _filters.push_back(code);
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load entries from the data of the current boot image entry
+ *
+ * If the boot image is memory-backed, the ramdisk is decompressed straight
+ * from the mapping without copying the compressed data first.
+ */
+bool Ramdisk::load(bootimg::Reader &reader)
+{
+    auto view = reader.read_data_view();
+    if (view) {
+        return load(view.value().data, view.value().size);
+    } else if (view.error() != FileError::UnsupportedView) {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
+        return false;
+    }
+
+    std::string data;
+    char buf[10240];
+
+    while (true) {
+        auto n = reader.read_data(buf, sizeof(buf));
+        if (!n) {
+            LOGE("Failed to read boot image entry data: %s",
+                 n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        data.append(buf, n.value());
+    }
+
+    return load(data.data(), data.size());
+}
+
+static bool string_write_cb(const void *data, size_t size, void *userdata)
+{
+    auto *out = static_cast<std::string *>(userdata);
+    out->append(static_cast<const char *>(data), size);
+    return true;
+}
+
+static bool writer_write_cb(const void *data, size_t size, void *userdata)
+{
+    auto *writer = static_cast<bootimg::Writer *>(userdata);
+
+    auto n = writer->write_data(data, size);
+    if (!n) {
+        LOGE("Failed to write entry data: %s", n.error().message().c_str());
+        return false;
+    } else if (n.value() != size) {
+        LOGE("Short write of entry data: %zu < %zu", n.value(), size);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the archive to a string
+ */
+bool Ramdisk::save(std::string &out) const
+{
+    out.clear();
+    return save(&string_write_cb, &out);
+}
+
+/*!
+ * \brief Write the archive as the data of the current boot image entry
+ */
+bool Ramdisk::save(bootimg::Writer &writer) const
+{
+    return save(&writer_write_cb, &writer);
+}
+
+struct RamdiskWriteCtx
+{
+    bool (*cb)(const void *data, size_t size, void *userdata);
+    void *userdata;
+};
+
+static la_ssize_t la_write_cb(archive *a, void *userdata,
+                              const void *buffer, size_t length)
+{
+    auto *ctx = static_cast<RamdiskWriteCtx *>(userdata);
+
+    if (!ctx->cb(buffer, length, ctx->userdata)) {
+        archive_set_error(a, EIO, "Failed to write ramdisk data");
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(length);
+}
+
+bool Ramdisk::save(WriteCb cb, void *userdata) const
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+
+    if (!a || !entry) {
+        LOGE("Failed to allocate archive writer or entry instance");
+        return false;
+    }
+
+    if (archive_write_set_format(a.get(), _format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+    for (const int &filter : _filters) {
+        if (archive_write_add_filter(a.get(), filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+    }
+
+    archive_write_set_bytes_per_block(a.get(), 512);
+
+    RamdiskWriteCtx ctx{cb, userdata};
+
+    if (archive_write_open(a.get(), &ctx, nullptr, &la_write_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    la_int64_t ino = 0;
+
+    for (auto const &item : _entries) {
+        archive_entry_clear(entry.get());
+
+        archive_entry_set_pathname(entry.get(), item.path.c_str());
+        archive_entry_set_mode(entry.get(), item.mode);
+        archive_entry_set_uid(entry.get(), item.uid);
+        archive_entry_set_gid(entry.get(), item.gid);
+        archive_entry_set_mtime(entry.get(), item.mtime, 0);
+        archive_entry_set_rdev(entry.get(), item.rdev);
+        archive_entry_set_ino64(entry.get(), ++ino);
+        archive_entry_set_nlink(entry.get(), S_ISDIR(item.mode) ? 2 : 1);
+
+        if (S_ISLNK(item.mode)) {
+            archive_entry_set_symlink(entry.get(), item.data.c_str());
+            archive_entry_set_size(entry.get(), 0);
+        } else if (S_ISREG(item.mode)) {
+            archive_entry_set_size(entry.get(),
+                                   static_cast<la_int64_t>(item.data.size()));
+        } else {
+            archive_entry_set_size(entry.get(), 0);
+        }
+
+        if (archive_write_header(a.get(), entry.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write header: %s",
+                 item.path.c_str(), archive_error_string(a.get()));
+            return false;
+        }
+
+        if (S_ISREG(item.mode) && !item.data.empty()) {
+            la_ssize_t n = archive_write_data(a.get(), item.data.data(),
+                                              item.data.size());
+            if (n < 0 || static_cast<size_t>(n) != item.data.size()) {
+                LOGE("%s: Failed to write data: %s",
+                     item.path.c_str(), archive_error_string(a.get()));
+                return false;
+            }
+        }
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+const std::vector<RamdiskEntry> & Ramdisk::entries() const
+{
+    return _entries;
+}
+
+RamdiskEntry * Ramdisk::find(std::string_view path)
+{
+    path = normalize_entry_path(path);
+
+    for (auto &item : _entries) {
+        if (item.path == path) {
+            return &item;
+        }
+    }
+
+    return nullptr;
+}
+
+const RamdiskEntry * Ramdisk::find(std::string_view path) const
+{
+    return const_cast<Ramdisk *>(this)->find(path);
+}
+
+/*!
+ * \brief Add an entry or replace the existing entry with the same path
+ *
+ * The parent directories are not created.
+ */
+void Ramdisk::add(RamdiskEntry entry)
+{
+    entry.path = std::string(normalize_entry_path(entry.path));
+
+    if (auto *item = find(entry.path)) {
+        *item = std::move(entry);
+    } else {
+        _entries.push_back(std::move(entry));
+    }
+}
+
+/*!
+ * \brief Add or replace a regular file (owned by root)
+ *
+ * Missing parent directories are created with mode 0755.
+ */
+bool Ramdisk::add_file(std::string path, std::string data, mode_t perm)
+{
+    if (!create_parents(path)) {
+        return false;
+    }
+
+    RamdiskEntry entry = new_entry(std::move(path), S_IFREG | (perm & 07777));
+    entry.data = std::move(data);
+    add(std::move(entry));
+
+    return true;
+}
+
+/*!
+ * \brief Add or replace a symlink (owned by root)
+ *
+ * Missing parent directories are created with mode 0755.
+ */
+bool Ramdisk::add_symlink(std::string path, std::string target)
+{
+    if (!create_parents(path)) {
+        return false;
+    }
+
+    RamdiskEntry entry = new_entry(std::move(path), S_IFLNK | 0777);
+    entry.data = std::move(target);
+    add(std::move(entry));
+
+    return true;
+}
+
+/*!
+ * \brief Remove a single entry
+ *
+ * \return Whether the entry existed
+ */
+bool Ramdisk::remove(std::string_view path)
+{
+    auto *item = find(path);
+    if (!item) {
+        return false;
+    }
+
+    _entries.erase(_entries.begin() + (item - _entries.data()));
+    return true;
+}
+
+/*!
+ * \brief Rename a single entry, replacing the target if it exists
+ *
+ * \return Whether \p old_path existed
+ */
+bool Ramdisk::rename(std::string_view old_path, std::string new_path)
+{
+    new_path = std::string(normalize_entry_path(new_path));
+
+    if (!find(old_path)) {
+        return false;
+    }
+
+    if (normalize_entry_path(old_path) != new_path) {
+        remove(new_path);
+    }
+
+    // Look up again since remove() may have moved the entry
+    find(old_path)->path = std::move(new_path);
+    return true;
+}
+
+bool Ramdisk::create_parents(std::string_view path)
+{
+    path = normalize_entry_path(path);
+
+    for (size_t pos = path.find('/'); pos != std::string_view::npos;
+            pos = path.find('/', pos + 1)) {
+        auto parent = path.substr(0, pos);
+
+        if (auto const *item = find(parent)) {
+            if (!S_ISDIR(item->mode)) {
+                LOGE("%.*s: Parent of %.*s is not a directory",
+                     static_cast<int>(parent.size()), parent.data(),
+                     static_cast<int>(path.size()), path.data());
+                return false;
+            }
+        } else {
+            add(new_entry(std::string(parent), S_IFDIR | 0755));
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Entry in an in-memory cpio archive
+ */
+struct RamdiskEntry
+{
+    // Relative path without a leading "./" or "/"
+    std::string path;
+    // File type and permission bits
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    int64_t mtime;
+    dev_t rdev;
+    // File contents for regular files or target for symlinks
+    std::string data;
+};
+
+/*!
+ * \brief In-memory model of a (possibly compressed) cpio ramdisk
+ *
+ * The patchers in ramdisk_patcher.cpp edit this model instead of extracting
+ * the ramdisk to a temporary directory. Hard links are loaded as independent
+ * copies of the file, which is what extracting and repacking used to do.
+ */
+class Ramdisk
+{
+public:
+    Ramdisk();
+
+    bool load(const void *data, size_t size);
+    bool load(bootimg::Reader &reader);
+    bool save(std::string &out) const;
+    bool save(bootimg::Writer &writer) const;
+
+    const std::vector<RamdiskEntry> & entries() const;
+
+    RamdiskEntry * find(std::string_view path);
+    const RamdiskEntry * find(std::string_view path) const;
+
+    void add(RamdiskEntry entry);
+    bool add_file(std::string path, std::string data, mode_t perm);
+    bool add_symlink(std::string path, std::string target);
+    bool remove(std::string_view path);
+    bool rename(std::string_view old_path, std::string new_path);
+
+private:
+    bool create_parents(std::string_view path);
+
+    using WriteCb = bool (*)(const void *data, size_t size, void *userdata);
+    bool save(WriteCb cb, void *userdata) const;
+
+    std::vector<RamdiskEntry> _entries;
+    int _format;
+    std::vector<int> _filters;
+};
+
+}
@@ -21,63 +21,39 @@
 
 #include <algorithm>
 
-#include <cerrno>
-#include <cstdio>
-#include <cstdlib>
-#include <cstring>
-
 #include <sys/stat.h>
-#include <unistd.h>
 
-#include "mbcommon/finally.h"
-#include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/copy.h"
+#include "mbutil/file.h"
 #include "mbutil/path.h"
+#include "mbutil/properties.h"
 
-#include "installer_util.h"
 #include "multiboot.h"
+#include "ramdisk.h"
 
 #define LOG_TAG "mbtool/ramdisk_patcher"
 
 namespace mb
 {
 
-static bool _rp_write_rom_id(const std::string &dir, const std::string &rom_id)
+static bool read_file(const std::string &path, std::string &out)
 {
-    std::string path(dir);
-    path += "/romid";
-
-    FILE *fp = fopen(path.c_str(), "wb");
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fputs(rom_id.c_str(), fp) == EOF) {
-        LOGE("%s: Failed to write ROM ID: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fchmod(fileno(fp), 0664) < 0) {
-        LOGE("%s: Failed to chmod: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fclose(fp) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
+    auto data = util::file_read_all(path);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), data.error().message().c_str());
         return false;
     }
 
+    out.assign(data.value().begin(), data.value().end());
     return true;
 }
 
+static bool _rp_write_rom_id(Ramdisk &ramdisk, const std::string &rom_id)
+{
+    return ramdisk.add_file("romid", rom_id, 0664);
+}
+
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id)
 {
@@ -86,99 +62,27 @@ rp_write_rom_id(const std::string &rom_id)
     return std::bind(_rp_write_rom_id, _1, rom_id);
 }
 
-static bool _rp_patch_default_prop(const std::string &dir,
+static bool _rp_patch_default_prop(Ramdisk &ramdisk,
                                    const std::string &device_id,
                                    bool use_fuse_exfat)
 {
-    std::string path(dir);
-    path += "/default.prop";
-
-    std::string tmp_path = format("%s.XXXXXX", path.c_str());
-
-    const int tmp_fd = mkstemp(tmp_path.data());
-    if (tmp_fd < 0) {
-        LOGE("%s: Failed to create temporary file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    auto unlink_tmp_path = finally([&tmp_path] {
-        unlink(tmp_path.c_str());
-    });
-
-    auto close_tmp_fd = finally([&tmp_fd] {
-        close(tmp_fd);
-    });
-
-    FILE *fp_in = fopen(path.c_str(), "rb");
-    if (!fp_in) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
+    auto *entry = ramdisk.find("default.prop");
+    if (!entry || !S_ISREG(entry->mode)) {
+        LOGE("%s: File not found in ramdisk", "default.prop");
         return false;
     }
 
-    auto close_fp_in = finally([&fp_in] {
-        fclose(fp_in);
-    });
+    util::PropertyFile props;
+    props.load_data(std::move(entry->data));
 
-    FILE *fp_out = fdopen(tmp_fd, "wb");
-    if (!fp_out) {
-        LOGE("%s: Failed to open for writing: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // fp_out will automatically close the fd
-    close_tmp_fd.dismiss();
-
-    auto close_fp_out = finally([&fp_out] {
-        fclose(fp_out);
-    });
-
-    char *buf = nullptr;
-    size_t buf_size = 0;
-    ssize_t n;
-
-    auto free_buf = finally([&buf] {
-        free(buf);
-    });
-
-    while ((n = getline(&buf, &buf_size, fp_in)) >= 0) {
-        // Remove old multiboot properties
-        if (starts_with(buf, "ro.patcher.")) {
-            continue;
-        }
-
-        if (fwrite(buf, 1, static_cast<size_t>(n), fp_out)
-                != static_cast<size_t>(n)) {
-            LOGE("%s: Failed to write file: %s",
-                 tmp_path.c_str(), strerror(errno));
-            return false;
-        }
-    }
+    // Remove old multiboot properties
+    props.remove_prefix("ro.patcher.");
 
     // Write new properties
-    if (fputc('\n', fp_out) == EOF
-            || fprintf(fp_out, PROP_DEVICE "=%s\n", device_id.c_str()) < 0
-            || fprintf(fp_out, PROP_USE_FUSE_EXFAT "=%s\n",
-                       use_fuse_exfat ? "true" : "false") < 0) {
-        LOGE("%s: Failed to write properties: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // Manually close file to ensure we catch write errors
-    close_fp_out.dismiss();
+    props.set(PROP_DEVICE, device_id);
+    props.set(PROP_USE_FUSE_EXFAT, use_fuse_exfat ? "true" : "false");
 
-    if (fclose(fp_out) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (!InstallerUtil::replace_file(path.c_str(), tmp_path)) {
-        return false;
-    }
+    entry->data = props.data();
 
     return true;
 }
@@ -191,7 +95,7 @@ rp_patch_default_prop(const std::string &device_id, bool use_fuse_exfat)
     return std::bind(_rp_patch_default_prop, _1, device_id, use_fuse_exfat);
 }
 
-static bool _rp_add_binaries(const std::string &dir,
+static bool _rp_add_binaries(Ramdisk &ramdisk,
                              const std::string &binaries_dir)
 {
     struct CopySpec
@@ -216,16 +120,10 @@ static bool _rp_add_binaries(const std::string &dir,
         std::string source(binaries_dir);
         source += "/";
         source += item.from;
-        std::string target(dir);
-        target += "/";
-        target += item.to;
 
-        if (auto r = util::copy_file(source, target, 0); !r) {
-            LOGE("%s", r.error().message().c_str());
-            return false;
-        }
-        if (chmod(target.c_str(), item.perm) < 0) {
-            LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        std::string data;
+        if (!read_file(source, data)
+                || !ramdisk.add_file(item.to, std::move(data), item.perm)) {
             return false;
         }
     }
@@ -241,22 +139,10 @@ rp_add_binaries(const std::string &binaries_dir)
     return std::bind(_rp_add_binaries, _1, binaries_dir);
 }
 
-static bool _rp_symlink_fuse_exfat(const std::string &dir)
+static bool _rp_symlink_fuse_exfat(Ramdisk &ramdisk)
 {
-    std::string fsck_exfat(dir);
-    fsck_exfat += "/sbin/fsck.exfat";
-    std::string fsck_exfat_sig(fsck_exfat);
-    fsck_exfat_sig += ".sig";
-
-    if ((unlink(fsck_exfat.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat", fsck_exfat.c_str()) < 0
-            || (unlink(fsck_exfat_sig.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat.sig", fsck_exfat_sig.c_str()) < 0) {
-        LOGE("Failed to symlink exfat fsck binaries: %s", strerror(errno));
-        return false;
-    }
-
-    return true;
+    return ramdisk.add_symlink("sbin/fsck.exfat", "mount.exfat")
+            && ramdisk.add_symlink("sbin/fsck.exfat.sig", "mount.exfat.sig");
 }
 
 std::function<RamdiskPatcherFn>
@@ -265,14 +151,13 @@ rp_symlink_fuse_exfat()
     return _rp_symlink_fuse_exfat;
 }
 
-static bool _is_linked_to_mbtool(const std::string &path)
+static bool _is_linked_to_mbtool(const RamdiskEntry *entry)
 {
-    auto link_target = util::read_link(path);
-    if (!link_target) {
+    if (!entry || !S_ISLNK(entry->mode)) {
         return false;
     }
 
-    auto pieces = util::path_split(link_target.value());
+    auto pieces = util::path_split(entry->data);
 
     if (std::find(pieces.begin(), pieces.end(), "mbtool") == pieces.end()) {
         return false;
@@ -281,15 +166,8 @@ static bool _is_linked_to_mbtool(const std::string &path)
     return true;
 }
 
-static std::string _get_init_target(const std::string &dir)
+static std::string _get_init_target(const Ramdisk &ramdisk)
 {
-    std::string target{dir};
-    target += "/init";
-    std::string sony_init_wrapper(dir);
-    sony_init_wrapper += "/sbin/init_sony";
-    std::string sony_real_init(dir);
-    sony_real_init += "/init.real";
-
     // If this is a Sony device that doesn't use sbin/ramdisk.cpio for the
     // combined ramdisk, we'll have to explicitly allow their init executable to
     // run first. We'll use a relatively strong heuristic to prevent false
@@ -299,51 +177,41 @@ static std::string _get_init_target(const std::string &dir)
     // * https://github.com/chenxiaolong/DualBootPatcher/issues/533
     // * https://github.com/sonyxperiadev/device-sony-common-init
 
-    struct stat sb;
-
     // Check that /init is a symlink and that /init.real exists
-    if (lstat(target.c_str(), &sb) == 0 && S_ISLNK(sb.st_mode)) {
-        auto sony_symlink_target = util::read_link(target);
-        if (sony_symlink_target && lstat(sony_real_init.c_str(), &sb) == 0) {
-            auto haystack = util::path_split(sony_symlink_target.value());
-            auto needle = util::path_split("sbin/init_sony");
-
-            util::normalize_path(haystack);
-
-            // Check that init points to some path with "sbin/init_sony" in it
-            auto const it = std::search(haystack.cbegin(), haystack.cend(),
-                                        needle.cbegin(), needle.cend());
-            if (it != haystack.cend()) {
-                target.swap(sony_real_init);
-            }
+    auto const *init = ramdisk.find("init");
+    if (init && S_ISLNK(init->mode) && ramdisk.find("init.real")) {
+        auto haystack = util::path_split(init->data);
+        auto needle = util::path_split("sbin/init_sony");
+
+        util::normalize_path(haystack);
+
+        // Check that init points to some path with "sbin/init_sony" in it
+        auto const it = std::search(haystack.cbegin(), haystack.cend(),
+                                    needle.cbegin(), needle.cend());
+        if (it != haystack.cend()) {
+            return "init.real";
         }
     }
 
-    return target;
+    return "init";
 }
 
-static bool _rp_symlink_init(const std::string &dir)
+static bool _rp_symlink_init(Ramdisk &ramdisk)
 {
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    auto target = _get_init_target(dir);
+    auto target = _get_init_target(ramdisk);
     LOGD("[init] Target init path: %s", target.c_str());
 
     // Move /init to /init.orig if it's not a symlink to mbtool
 
-    if (!_is_linked_to_mbtool(target)) {
+    if (!_is_linked_to_mbtool(ramdisk.find(target))) {
         LOGD("[init] Moving real init and symlinking init to mbtool");
 
-        if (rename(target.c_str(), real_init.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 target.c_str(), strerror(errno));
+        if (!ramdisk.rename(target, "init.orig")) {
+            LOGE("%s: File not found in ramdisk", target.c_str());
             return false;
         }
 
-        if (symlink("/mbtool", target.c_str()) < 0) {
-            LOGE("%s: Failed to symlink mbtool: %s",
-                 target.c_str(), strerror(errno));
+        if (!ramdisk.add_symlink(target, "/mbtool")) {
             return false;
         }
     }
@@ -357,22 +225,18 @@ rp_symlink_init()
     return _rp_symlink_init;
 }
 
-static bool _rp_restore_init(const std::string &dir)
+static bool _rp_restore_init(Ramdisk &ramdisk)
 {
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    auto target = _get_init_target(dir);
+    auto target = _get_init_target(ramdisk);
     LOGD("[init] Target init path: %s", target.c_str());
 
     // Move /init.orig to /init if /init is a symlink to mbtool
 
-    if (_is_linked_to_mbtool(target)) {
+    if (_is_linked_to_mbtool(ramdisk.find(target))) {
         LOGD("[init] Restoring real init to init");
 
-        if (rename(real_init.c_str(), target.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 real_init.c_str(), strerror(errno));
+        if (!ramdisk.rename("init.orig", target)) {
+            LOGE("%s: File not found in ramdisk", "init.orig");
             return false;
         }
     }
@@ -386,24 +250,12 @@ rp_restore_init()
     return _rp_restore_init;
 }
 
-static bool _rp_add_device_json(const std::string &dir,
+static bool _rp_add_device_json(Ramdisk &ramdisk,
                                 const std::string &device_json_file)
 {
-    std::string device_json(dir);
-    device_json += "/device.json";
-
-    if (auto r = util::copy_file(device_json_file, device_json, 0); !r) {
-        LOGE("%s", r.error().message().c_str());
-        return false;
-    }
-
-    if (chmod(device_json.c_str(), 0644) < 0) {
-        LOGE("%s: Failed to chmod file: %s",
-             device_json.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
+    std::string data;
+    return read_file(device_json_file, data)
+            && ramdisk.add_file("device.json", std::move(data), 0644);
 }
 
 std::function<RamdiskPatcherFn>
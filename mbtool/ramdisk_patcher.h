@@ -26,7 +26,9 @@
 namespace mb
 {
 
-typedef bool (RamdiskPatcherFn)(const std::string &dir);
+class Ramdisk;
+
+typedef bool (RamdiskPatcherFn)(Ramdisk &ramdisk);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
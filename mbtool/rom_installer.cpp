@@ -19,6 +19,9 @@
 
 #include "rom_installer.h"
 
+#include <cerrno>
+#include <cstring>
+
 #include <fcntl.h>
 #include <getopt.h>
 #include <sched.h>
@@ -31,8 +34,11 @@
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/compressed.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mblog/async_logger.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
 #include "mbutil/archive.h"
@@ -44,7 +50,6 @@
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
-#include "archive_util.h"
 #include "bootimg_util.h"
 #include "installer.h"
 #include "multiboot.h"
@@ -89,8 +94,8 @@ private:
 
     static bool extract_ramdisk(const std::string &boot_image_file,
                                 const std::string &output_dir, bool nested);
-    static bool extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                   bool nested);
+    static bool extract_ramdisk_file(File &file, const std::string &output_dir,
+                                     bool nested);
 };
 
 
@@ -282,6 +287,49 @@ void RomInstaller::on_cleanup(Installer::ProceedState ret)
                 "internal storage.");
 }
 
+static oc::result<size_t> reader_read_cb(File &file, void *userdata,
+                                         void *buf, size_t size)
+{
+    (void) file;
+    return static_cast<Reader *>(userdata)->read_data(buf, size);
+}
+
+static oc::result<size_t> archive_data_read_cb(File &file, void *userdata,
+                                               void *buf, size_t size)
+{
+    (void) file;
+    auto a = static_cast<archive *>(userdata);
+
+    la_ssize_t n = archive_read_data(a, buf, size);
+    if (n < 0) {
+        LOGE("Failed to read archive entry data: %s", archive_error_string(a));
+        return std::make_error_code(std::errc::io_error);
+    }
+
+    return static_cast<size_t>(n);
+}
+
+struct LaFileCtx
+{
+    File *file;
+    char buf[10240];
+};
+
+static la_ssize_t la_file_read_cb(archive *a, void *userdata,
+                                  const void **buffer)
+{
+    auto ctx = static_cast<LaFileCtx *>(userdata);
+
+    auto n = ctx->file->read(ctx->buf, sizeof(ctx->buf));
+    if (!n) {
+        archive_set_error(a, EIO, "%s", n.error().message().c_str());
+        return -1;
+    }
+
+    *buffer = ctx->buf;
+    return static_cast<la_ssize_t>(n.value());
+}
+
 bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
                                    const std::string &output_dir, bool nested)
 {
@@ -296,6 +344,7 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
              ret.error().message().c_str());
         return false;
     }
+    bi_enable_format_cache(reader);
     ret = reader.open_filename(boot_image_file);
     if (!ret) {
         LOGE("%s: Failed to open boot image for reading: %s",
@@ -323,29 +372,20 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
         return false;
     }
 
-    {
-        std::string tmpfile = format("%s.XXXXXX", output_dir.c_str());
-
-        int tmpfd = mkstemp(tmpfile.data());
-        if (tmpfd < 0) {
-            LOGE("Failed to create temporary file: %s", strerror(errno));
-            return false;
-        }
-
-        // We don't need the path
-        unlink(tmpfile.c_str());
-
-        auto close_fd = finally([&]{
-            close(tmpfd);
-        });
-
-        return bi_copy_data_to_fd(reader, tmpfd)
-                && extract_ramdisk_fd(tmpfd, output_dir, nested);
+    // Stream the ramdisk straight from the boot image
+    CallbackFile data_file(nullptr, nullptr, &reader_read_cb, nullptr, nullptr,
+                           nullptr, &reader);
+    if (!data_file.is_open()) {
+        LOGE("%s: Failed to open ramdisk data", boot_image_file.c_str());
+        return false;
     }
+
+    return extract_ramdisk_file(data_file, output_dir, nested);
 }
 
-bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                      bool nested)
+bool RomInstaller::extract_ramdisk_file(File &file,
+                                        const std::string &output_dir,
+                                        bool nested)
 {
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
@@ -357,19 +397,25 @@ bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
         return false;
     }
 
-    // Seek to beginning
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        LOGE("Failed to seek to beginning: %s", strerror(errno));
+    // Decompress on the fly. Uncompressed data and formats not handled by
+    // CompressedFile (eg. legacy lzma) are passed through to libarchive.
+    CompressedFile cpio_file;
+    auto open_ret = cpio_file.open(&file, CompressionMode::Decompress,
+                                   CompressionFormat::Auto);
+    if (!open_ret) {
+        LOGE("Failed to open ramdisk for decompression: %s",
+             open_ret.error().message().c_str());
         return false;
     }
 
-    archive_read_support_filter_gzip(in.get());
-    archive_read_support_filter_lz4(in.get());
     archive_read_support_filter_lzma(in.get());
-    archive_read_support_filter_xz(in.get());
     archive_read_support_format_cpio(in.get());
 
-    if (archive_read_open_fd(in.get(), fd, 10240) != ARCHIVE_OK) {
+    LaFileCtx ctx;
+    ctx.file = &cpio_file;
+
+    if (archive_read_open(in.get(), &ctx, nullptr, &la_file_read_cb, nullptr)
+            != ARCHIVE_OK) {
         LOGE("Failed to open archive: %s", archive_error_string(in.get()));
         return false;
     }
@@ -395,24 +441,16 @@ bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
 
         if (nested) {
             if (strcmp(path, "sbin/ramdisk.cpio") == 0) {
-                std::string tmpfile = format("%s.XXXXXX", output_dir.c_str());
-
-                int tmpfd = mkstemp(tmpfile.data());
-                if (tmpfd < 0) {
-                    LOGE("Failed to create temporary file: %s",
-                         strerror(errno));
+                // Read the nested ramdisk directly from the outer archive
+                CallbackFile entry_file(nullptr, nullptr,
+                                        &archive_data_read_cb, nullptr,
+                                        nullptr, nullptr, in.get());
+                if (!entry_file.is_open()) {
+                    LOGE("Failed to open nested ramdisk");
                     return false;
                 }
 
-                // We don't need the path
-                unlink(tmpfile.c_str());
-
-                auto close_fd = finally([&]{
-                    close(tmpfd);
-                });
-
-                return la_copy_data_to_fd(in.get(), tmpfd)
-                        && extract_ramdisk_fd(tmpfd, output_dir, false);
+                return extract_ramdisk_file(entry_file, output_dir, false);
             }
         } else {
             if (strcmp(path, "default.prop") == 0) {
@@ -607,8 +645,16 @@ int rom_installer_main(int argc, char *argv[])
     }
 #endif
 
-    // mbtool logging
-    log::set_logger(std::make_shared<log::StdioLogger>(fp.get()));
+    // mbtool logging. Records are written on a background thread, so the
+    // logger must be flushed and removed before fp is closed.
+    auto logger = std::make_shared<log::AsyncLogger>(
+            std::make_shared<log::StdioLogger>(fp.get()));
+    log::set_logger(logger);
+
+    auto reset_logger = finally([&] {
+        log::set_logger(nullptr);
+        logger->flush();
+    });
 
     // Start installing!
     RomInstaller ri(zip_file, rom_id, fp.get(), flags);
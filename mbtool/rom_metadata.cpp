@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rom_metadata.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/properties.h"
+
+#include "romconfig.h"
+
+#define LOG_TAG "mbtool/rom_metadata"
+
+#define ROM_METADATA_CACHE_PATH "/data/multiboot/rom_metadata.prop"
+
+#define KEY_VERSION     "version."
+#define KEY_BUILD       "build."
+#define KEY_BUILD_PROP  "build_prop."
+#define KEY_CONFIG      "config."
+
+namespace mb
+{
+
+static std::string build_prop_path(Rom &rom)
+{
+    std::string path;
+
+    if (rom.system_is_image) {
+        path += "/raw/images/";
+        path += rom.id;
+    } else {
+        path += rom.full_system_path();
+    }
+    path += "/build.prop";
+
+    return path;
+}
+
+bool RomMetadataCache::FileStamp::operator==(const FileStamp &other) const
+{
+    return exists == other.exists
+            && ino == other.ino
+            && size == other.size
+            && mtime_sec == other.mtime_sec
+            && mtime_nsec == other.mtime_nsec;
+}
+
+RomMetadataCache::RomMetadataCache()
+    : _dirty(false)
+{
+}
+
+RomMetadataCache::FileStamp RomMetadataCache::stamp_file(const std::string &path)
+{
+    FileStamp stamp{};
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) == 0) {
+        stamp.exists = true;
+        stamp.ino = static_cast<uint64_t>(sb.st_ino);
+        stamp.size = static_cast<uint64_t>(sb.st_size);
+        stamp.mtime_sec = static_cast<int64_t>(sb.st_mtim.tv_sec);
+        stamp.mtime_nsec = static_cast<int64_t>(sb.st_mtim.tv_nsec);
+    }
+
+    return stamp;
+}
+
+std::string RomMetadataCache::stamp_to_string(const FileStamp &stamp)
+{
+    if (!stamp.exists) {
+        return "none";
+    }
+
+    return format("%" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64,
+                  stamp.ino, stamp.size, stamp.mtime_sec, stamp.mtime_nsec);
+}
+
+bool RomMetadataCache::stamp_from_string(const std::string &str,
+                                         FileStamp &stamp)
+{
+    stamp = {};
+
+    if (str == "none") {
+        return true;
+    }
+
+    auto pieces = split(str, ':');
+    if (pieces.size() != 4
+            || !str_to_num(pieces[0].c_str(), 10, stamp.ino)
+            || !str_to_num(pieces[1].c_str(), 10, stamp.size)
+            || !str_to_num(pieces[2].c_str(), 10, stamp.mtime_sec)
+            || !str_to_num(pieces[3].c_str(), 10, stamp.mtime_nsec)) {
+        return false;
+    }
+
+    stamp.exists = true;
+    return true;
+}
+
+void RomMetadataCache::load()
+{
+    std::unordered_map<std::string, std::string> props;
+
+    _entries.clear();
+
+    if (!util::property_file_get_all(
+            get_raw_path(ROM_METADATA_CACHE_PATH), props)) {
+        return;
+    }
+
+    // Entries are only usable if all of their keys are present and valid
+    std::unordered_map<std::string, int> n_fields;
+
+    for (auto const &[key, value] : props) {
+        std::string id;
+        Entry *entry;
+        bool valid = true;
+
+        if (starts_with(key, KEY_VERSION)) {
+            id = key.substr(sizeof(KEY_VERSION) - 1);
+            _entries[id].metadata.version = value;
+        } else if (starts_with(key, KEY_BUILD_PROP)) {
+            id = key.substr(sizeof(KEY_BUILD_PROP) - 1);
+            entry = &_entries[id];
+            valid = stamp_from_string(value, entry->build_prop);
+        } else if (starts_with(key, KEY_BUILD)) {
+            id = key.substr(sizeof(KEY_BUILD) - 1);
+            _entries[id].metadata.build = value;
+        } else if (starts_with(key, KEY_CONFIG)) {
+            id = key.substr(sizeof(KEY_CONFIG) - 1);
+            entry = &_entries[id];
+            valid = stamp_from_string(value, entry->config);
+        } else {
+            continue;
+        }
+
+        n_fields[id] += valid ? 1 : 0;
+    }
+
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (n_fields[it->first] != 4) {
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/*!
+ * \brief Write the entries that were used since the cache was loaded
+ *
+ * Entries for ROMs that were not looked up (ie. ones that are no longer
+ * installed) are dropped. Nothing is written if no entries changed.
+ */
+bool RomMetadataCache::save()
+{
+    if (!_dirty && _used.size() == _entries.size()) {
+        return true;
+    }
+
+    std::unordered_map<std::string, std::string> props;
+
+    for (auto const &[id, entry] : _used) {
+        props[KEY_VERSION + id] = entry.metadata.version;
+        props[KEY_BUILD + id] = entry.metadata.build;
+        props[KEY_BUILD_PROP + id] = stamp_to_string(entry.build_prop);
+        props[KEY_CONFIG + id] = stamp_to_string(entry.config);
+    }
+
+    // Multiple daemon connections can save at the same time, so write to a
+    // temporary file and atomically replace the cache
+    std::string path = get_raw_path(ROM_METADATA_CACHE_PATH);
+    std::string temp_path = format("%s.%d.tmp", path.c_str(), getpid());
+
+    if (!util::property_file_write_all(temp_path, props)
+            || rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to write ROM metadata cache: %s",
+             path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+RomMetadata RomMetadataCache::get(const std::shared_ptr<Rom> &rom)
+{
+    std::string build_prop = build_prop_path(*rom);
+    std::string config_path = rom->config_path();
+
+    FileStamp build_prop_stamp = stamp_file(build_prop);
+    FileStamp config_stamp = stamp_file(config_path);
+
+    if (auto it = _entries.find(rom->id); it != _entries.end()
+            && it->second.build_prop == build_prop_stamp
+            && it->second.config == config_stamp) {
+        _used[rom->id] = it->second;
+        return it->second.metadata;
+    }
+
+    std::unordered_map<std::string, std::string> props;
+
+    RomConfig config;
+    config.load_file(config_path);
+    props.swap(config.cached_props);
+
+    util::property_file_get_all(build_prop, props);
+
+    Entry entry{};
+    entry.build_prop = build_prop_stamp;
+    entry.config = config_stamp;
+
+    if (auto it = props.find("ro.build.version.release"); it != props.end()) {
+        entry.metadata.version = it->second;
+    }
+    if (auto it = props.find("ro.build.display.id"); it != props.end()) {
+        entry.metadata.build = it->second;
+    }
+
+    // Values that can't be represented in the properties file are never
+    // cached
+    if (entry.metadata.version.find('\n') == std::string::npos
+            && entry.metadata.build.find('\n') == std::string::npos) {
+        _used[rom->id] = entry;
+        _dirty = true;
+    }
+
+    return entry.metadata;
+}
+
+}
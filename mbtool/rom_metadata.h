@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <cstdint>
+
+#include "roms.h"
+
+namespace mb
+{
+
+struct RomMetadata
+{
+    std::string version;
+    std::string build;
+};
+
+/*!
+ * Persistent cache of the build.prop-derived information in RomMetadata.
+ *
+ * Entries are revalidated by comparing the stat() results of the ROM's
+ * build.prop and config.json against the values recorded when the entry was
+ * created, so the files are only read and parsed again when they change.
+ */
+class RomMetadataCache
+{
+public:
+    RomMetadataCache();
+
+    void load();
+    bool save();
+
+    RomMetadata get(const std::shared_ptr<Rom> &rom);
+
+private:
+    struct FileStamp
+    {
+        bool exists;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+
+        bool operator==(const FileStamp &other) const;
+    };
+
+    struct Entry
+    {
+        RomMetadata metadata;
+        FileStamp build_prop;
+        FileStamp config;
+    };
+
+    static FileStamp stamp_file(const std::string &path);
+    static std::string stamp_to_string(const FileStamp &stamp);
+    static bool stamp_from_string(const std::string &str, FileStamp &stamp);
+
+    std::unordered_map<std::string, Entry> _entries;
+    std::unordered_map<std::string, Entry> _used;
+    bool _dirty;
+};
+
+}
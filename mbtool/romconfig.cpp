@@ -19,16 +19,24 @@
 
 #include "romconfig.h"
 
+#include <algorithm>
+#include <memory>
+
 #include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
 
-#include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
 #include <rapidjson/filereadstream.h>
-#include <rapidjson/filewritestream.h>
 #include <rapidjson/reader.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 
 #define LOG_TAG "mbtool/romconfig"
 
@@ -73,155 +81,339 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
  * }
  */
 
-static inline std::string get_string(const Value &node)
+/*!
+ * \brief SAX handler that fills in a RomConfig as the file is parsed
+ *
+ * Strings are moved straight from the parser into the config, so no document
+ * tree is built. Values of unknown keys are skipped, along with anything
+ * nested in them.
+ */
+class RomConfigHandler : public BaseReaderHandler<UTF8<>, RomConfigHandler>
 {
-    return {node.GetString(), node.GetStringLength()};
-}
+public:
+    explicit RomConfigHandler(RomConfig &config)
+        : _config(config)
+        , _state(State::Root)
+        , _expect(Expect::Object)
+        , _skip_depth(0)
+        , _pkg_index(0)
+        , _pkg()
+    {
+    }
 
-static bool load_app_sharing_packages(RomConfig &config, const Value &node)
-{
-    static constexpr char context[] = "." KEY_APP_SHARING "." KEY_PACKAGES;
+    bool Null()
+    {
+        return scalar(Expect::Any) != Action::Fail;
+    }
 
-    if (!node.IsArray()) {
-        LOGE("%s: Not an array", context);
-        return false;
+    bool Bool(bool b)
+    {
+        if (auto action = scalar(Expect::Boolean); action != Action::Store) {
+            return action == Action::Skip;
+        }
+
+        if (_state == State::AppSharing) {
+            _config.indiv_app_sharing = b;
+        } else if (_state == State::Package) {
+            _pkg.share_data = b;
+        }
+
+        return true;
+    }
+
+    bool Int(int)
+    {
+        return scalar(Expect::Any) != Action::Fail;
+    }
+
+    bool Uint(unsigned)
+    {
+        return scalar(Expect::Any) != Action::Fail;
+    }
+
+    bool Int64(int64_t)
+    {
+        return scalar(Expect::Any) != Action::Fail;
+    }
+
+    bool Uint64(uint64_t)
+    {
+        return scalar(Expect::Any) != Action::Fail;
     }
 
-    size_t i = 0;
-    for (auto const &item : node.GetArray()) {
-        if (!item.IsObject()) {
-            LOGE("%s[%zu]: Not an object", context, i);
-            return false;
+    bool Double(double)
+    {
+        return scalar(Expect::Any) != Action::Fail;
+    }
+
+    bool String(const char *str, SizeType length, bool copy)
+    {
+        (void) copy;
+
+        if (auto action = scalar(Expect::String); action != Action::Store) {
+            return action == Action::Skip;
         }
 
-        SharedPackage shared_pkg = {};
-
-        for (auto const &pkg_item : item.GetObject()) {
-            auto const &key = get_string(pkg_item.name);
-
-            if (key == KEY_PACKAGE_ID) {
-                if (!pkg_item.value.IsString()) {
-                    LOGE("%s[%zu].%s: Not a string", context, i, key.c_str());
-                    return false;
-                }
-                shared_pkg.pkg_id = get_string(pkg_item.value);
-            } else if (key == KEY_SHARE_DATA) {
-                if (!pkg_item.value.IsBool()) {
-                    LOGE("%s[%zu].%s: Not a boolean", context, i, key.c_str());
-                    return false;
-                }
-                shared_pkg.share_data = pkg_item.value.GetBool();
+        std::string value(str, length);
+
+        if (_state == State::RootObject) {
+            if (_key == KEY_ID) {
+                _config.id = std::move(value);
             } else {
-                LOGW("%s[%zu].%s: Skipping unknown key", context, i, key.c_str());
+                _config.name = std::move(value);
             }
+        } else if (_state == State::CachedProps) {
+            _config.cached_props[_key] = std::move(value);
+        } else if (_state == State::Package) {
+            _pkg.pkg_id = std::move(value);
+        }
+
+        return true;
+    }
+
+    bool StartObject()
+    {
+        if (auto action = container(Expect::Object); action != Action::Store) {
+            return action == Action::Skip;
         }
 
-        if (!shared_pkg.pkg_id.empty()) {
-            config.shared_pkgs.push_back(std::move(shared_pkg));
+        switch (_state) {
+        case State::Root:
+            _state = State::RootObject;
+            break;
+        case State::RootObject:
+            _state = _key == KEY_CACHED_PROPERTIES
+                    ? State::CachedProps : State::AppSharing;
+            break;
+        case State::Packages:
+            _state = State::Package;
+            _pkg = {};
+            break;
+        default:
+            break;
         }
 
-        ++i;
+        return true;
     }
 
-    return true;
-}
+    bool Key(const char *str, SizeType length, bool copy)
+    {
+        (void) copy;
 
-static bool load_app_sharing(RomConfig &config, const Value &node)
-{
-    static constexpr char context[] = "." KEY_APP_SHARING;
+        if (_skip_depth > 0) {
+            return true;
+        }
 
-    if (!node.IsObject()) {
-        LOGE("%s: Not an object", context);
-        return false;
+        _key.assign(str, length);
+        _expect = Expect::Any;
+
+        switch (_state) {
+        case State::RootObject:
+            if (_key == KEY_ID || _key == KEY_NAME) {
+                _expect = Expect::String;
+            } else if (_key == KEY_CACHED_PROPERTIES
+                    || _key == KEY_APP_SHARING) {
+                _expect = Expect::Object;
+            }
+            break;
+        case State::CachedProps:
+            _expect = Expect::String;
+            break;
+        case State::AppSharing:
+            if (_key == KEY_INDIVIDUAL_APP_SHARING) {
+                _expect = Expect::Boolean;
+            } else if (_key == KEY_PACKAGES) {
+                _expect = Expect::Array;
+            }
+            break;
+        case State::Package:
+            if (_key == KEY_PACKAGE_ID) {
+                _expect = Expect::String;
+            } else if (_key == KEY_SHARE_DATA) {
+                _expect = Expect::Boolean;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (_expect == Expect::Any) {
+            LOGW("%s: Skipping unknown key", context().c_str());
+        }
+
+        return true;
     }
 
-    for (auto const &item : node.GetObject()) {
-        auto const &key = get_string(item.name);
+    bool EndObject(SizeType member_count)
+    {
+        (void) member_count;
 
-        if (key == KEY_INDIVIDUAL_APP_SHARING) {
-            if (!item.value.IsBool()) {
-                LOGE("%s.%s: Not a boolean", context, key.c_str());
-                return false;
-            }
-            config.indiv_app_sharing = item.value.GetBool();
-        } else if (key == KEY_PACKAGES) {
-            if (!load_app_sharing_packages(config, node)) {
-                return false;
+        if (_skip_depth > 0) {
+            --_skip_depth;
+            return true;
+        }
+
+        switch (_state) {
+        case State::RootObject:
+            _state = State::Done;
+            break;
+        case State::CachedProps:
+        case State::AppSharing:
+            _state = State::RootObject;
+            break;
+        case State::Package:
+            if (!_pkg.pkg_id.empty()) {
+                _config.shared_pkgs.push_back(std::move(_pkg));
             }
-        } else {
-            LOGW("%s.%s: Skipping unknown key", context, key.c_str());
+            _state = State::Packages;
+            _expect = Expect::Object;
+            ++_pkg_index;
+            break;
+        default:
+            break;
         }
+
+        return true;
     }
 
-    return true;
-}
+    bool StartArray()
+    {
+        if (auto action = container(Expect::Array); action != Action::Store) {
+            return action == Action::Skip;
+        }
 
-static bool load_cached_props(RomConfig &config, const Value &node)
-{
-    static constexpr char context[] = "." KEY_CACHED_PROPERTIES;
+        _state = State::Packages;
+        _expect = Expect::Object;
+        _pkg_index = 0;
 
-    if (!node.IsObject()) {
-        LOGE("%s: Not an object", context);
-        return false;
+        return true;
     }
 
-    for (auto const &item : node.GetObject()) {
-        auto const &key = get_string(item.name);
+    bool EndArray(SizeType element_count)
+    {
+        (void) element_count;
 
-        if (!item.value.IsString()) {
-            LOGE("%s.%s: Not a string", context, key.c_str());
-            return false;
+        if (_skip_depth > 0) {
+            --_skip_depth;
+            return true;
         }
 
-        config.cached_props[key] = get_string(item.value);
+        _state = State::AppSharing;
+
+        return true;
     }
 
-    return true;
-}
+private:
+    enum class State
+    {
+        Root,
+        RootObject,
+        CachedProps,
+        AppSharing,
+        Packages,
+        Package,
+        Done,
+    };
+
+    enum class Expect
+    {
+        Object,
+        Array,
+        String,
+        Boolean,
+        // Value of an unknown key
+        Any,
+    };
+
+    enum class Action
+    {
+        Store,
+        Skip,
+        Fail,
+    };
+
+    RomConfig &_config;
+    State _state;
+    Expect _expect;
+    // Nesting level within a skipped value
+    unsigned int _skip_depth;
+    std::string _key;
+    size_t _pkg_index;
+    SharedPackage _pkg;
+
+    std::string context() const
+    {
+        switch (_state) {
+        case State::RootObject:
+            return "." + _key;
+        case State::CachedProps:
+            return "." KEY_CACHED_PROPERTIES "." + _key;
+        case State::AppSharing:
+            return "." KEY_APP_SHARING "." + _key;
+        case State::Packages:
+            return format("." KEY_APP_SHARING "." KEY_PACKAGES "[%zu]",
+                          _pkg_index);
+        case State::Package:
+            return format("." KEY_APP_SHARING "." KEY_PACKAGES "[%zu].%s",
+                          _pkg_index, _key.c_str());
+        default:
+            return ".";
+        }
+    }
 
-static bool load_root(RomConfig &config, const Value &node)
-{
-    static constexpr char context[] = ".";
+    /*!
+     * \brief Check the type of a scalar value against the expected type
+     */
+    Action scalar(Expect type)
+    {
+        if (_skip_depth > 0 || _expect == Expect::Any) {
+            return Action::Skip;
+        } else if (_expect != type) {
+            LOGE("%s: Not %s", context().c_str(), type_name(_expect));
+            return Action::Fail;
+        }
 
-    if (!node.IsObject()) {
-        LOGE("%s: Not an object", context);
-        return false;
+        return Action::Store;
     }
 
-    for (auto const &item : node.GetObject()) {
-        auto const &key = get_string(item.name);
-
-        if (key == KEY_ID) {
-            if (!item.value.IsString()) {
-                LOGE("%s.%s: Not a string", context, key.c_str());
-                return false;
-            }
-            config.id = get_string(item.value);
-        } else if (key == KEY_NAME) {
-            if (!item.value.IsString()) {
-                LOGE("%s.%s: Not a string", context, key.c_str());
-                return false;
-            }
-            config.name = get_string(item.value);
-        } else if (key == KEY_CACHED_PROPERTIES) {
-            if (!load_cached_props(config, item.value)) {
-                return false;
-            }
-        } else if (key == KEY_APP_SHARING) {
-            if (!load_app_sharing(config, item.value)) {
-                return false;
-            }
-        } else {
-            LOGW("%s.%s: Skipping unknown key", context, key.c_str());
+    /*!
+     * \brief Check the type of a container against the expected type
+     *
+     * If the container is being skipped, everything in it is skipped as well.
+     */
+    Action container(Expect type)
+    {
+        if (_skip_depth > 0 || _expect == Expect::Any) {
+            ++_skip_depth;
+            return Action::Skip;
+        } else if (_expect != type) {
+            LOGE("%s: Not %s", context().c_str(), type_name(_expect));
+            return Action::Fail;
         }
+
+        return Action::Store;
     }
 
-    return true;
-}
+    static const char * type_name(Expect expect)
+    {
+        switch (expect) {
+        case Expect::Object:
+            return "an object";
+        case Expect::Array:
+            return "an array";
+        case Expect::String:
+            return "a string";
+        case Expect::Boolean:
+            return "a boolean";
+        default:
+            return "a value";
+        }
+    }
+};
 
 bool RomConfig::load_file(const std::string &path)
 {
-    ScopedFILE fp(fopen(path.c_str(), "r"), &fclose);
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
     if (!fp) {
         LOGE("%s: Failed to open for reading: %s",
              path.c_str(), strerror(errno));
@@ -229,87 +421,137 @@ bool RomConfig::load_file(const std::string &path)
     }
 
     char buf[65536];
-    Reader reader;
     FileReadStream is(fp.get(), buf, sizeof(buf));
-    Document d;
+    RomConfig config;
+    RomConfigHandler handler(config);
+    Reader reader;
 
-    if (d.ParseStream(is).HasParseError()) {
-        fprintf(stderr, "Error at offset %zu: %s\n",
-                reader.GetErrorOffset(),
-                GetParseError_En(reader.GetParseErrorCode()));
+    if (auto r = reader.Parse(is, handler); r.IsError()) {
+        // The handler already logged the reason for stopping
+        if (r.Code() != kParseErrorTermination) {
+            LOGE("%s: Error at offset %zu: %s", path.c_str(),
+                 r.Offset(), GetParseError_En(r.Code()));
+        }
         return false;
     }
 
-    return load_root(*this, d);
+    *this = std::move(config);
+
+    return true;
+}
+
+static void write_string(Writer<StringBuffer> &writer, const std::string &str)
+{
+    writer.String(str.data(), static_cast<SizeType>(str.size()));
 }
 
+/*!
+ * \brief Save the config to a file
+ *
+ * The file is left untouched if its contents would not change. Otherwise, the
+ * new contents are written to a temporary file, synced, and renamed over the
+ * old file, so readers never see a partially written config.
+ */
 bool RomConfig::save_file(const std::string &path)
 {
-    Document d;
-    d.SetObject();
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
 
-    auto &alloc = d.GetAllocator();
+    writer.StartObject();
 
     if (!id.empty()) {
-        d.AddMember(KEY_ID, id, alloc);
+        writer.Key(KEY_ID);
+        write_string(writer, id);
     }
 
     if (!name.empty()) {
-        d.AddMember(KEY_NAME, name, alloc);
+        writer.Key(KEY_NAME);
+        write_string(writer, name);
     }
 
-    Value v_cached_props(kObjectType);
+    if (!cached_props.empty()) {
+        // Sort the properties so that the output only depends on the contents
+        std::vector<const decltype(cached_props)::value_type *> sorted;
+        sorted.reserve(cached_props.size());
 
-    for (auto const &cp : cached_props) {
-        v_cached_props.AddMember(StringRef(cp.first), StringRef(cp.second),
-                                 alloc);
-    }
+        for (auto const &item : cached_props) {
+            sorted.push_back(&item);
+        }
 
-    if (!v_cached_props.ObjectEmpty()) {
-        d.AddMember(KEY_CACHED_PROPERTIES, v_cached_props, alloc);
-    }
+        std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+            return a->first < b->first;
+        });
 
-    if (indiv_app_sharing || !shared_pkgs.empty()) {
-        Value v_app_sharing(kObjectType);
+        writer.Key(KEY_CACHED_PROPERTIES);
+        writer.StartObject();
 
-        v_app_sharing.AddMember(KEY_INDIVIDUAL_APP_SHARING,
-                                indiv_app_sharing, alloc);
-
-        Value v_shared_pkgs(kArrayType);
+        for (auto const *item : sorted) {
+            write_string(writer, item->first);
+            write_string(writer, item->second);
+        }
 
-        for (auto const &sp : shared_pkgs) {
-            Value v_shared_pkg(kObjectType);
+        writer.EndObject();
+    }
 
-            v_shared_pkg.AddMember(KEY_PACKAGE_ID, sp.pkg_id, alloc);
-            v_shared_pkg.AddMember(KEY_SHARE_DATA, sp.share_data, alloc);
+    if (indiv_app_sharing || !shared_pkgs.empty()) {
+        writer.Key(KEY_APP_SHARING);
+        writer.StartObject();
+
+        writer.Key(KEY_INDIVIDUAL_APP_SHARING);
+        writer.Bool(indiv_app_sharing);
+
+        if (!shared_pkgs.empty()) {
+            writer.Key(KEY_PACKAGES);
+            writer.StartArray();
+
+            for (auto const &sp : shared_pkgs) {
+                writer.StartObject();
+                writer.Key(KEY_PACKAGE_ID);
+                write_string(writer, sp.pkg_id);
+                writer.Key(KEY_SHARE_DATA);
+                writer.Bool(sp.share_data);
+                writer.EndObject();
+            }
 
-            v_shared_pkgs.PushBack(v_shared_pkg, alloc);
+            writer.EndArray();
         }
 
-        if (!v_shared_pkgs.Empty()) {
-            v_app_sharing.AddMember(KEY_PACKAGES, v_shared_pkgs, alloc);
-        }
+        writer.EndObject();
+    }
+
+    writer.EndObject();
 
-        d.AddMember(KEY_APP_SHARING, v_app_sharing, alloc);
+    if (auto old_data = util::file_read_all(path); old_data
+            && old_data.value().size() == sb.GetSize()
+            && memcmp(old_data.value().data(), sb.GetString(),
+                      sb.GetSize()) == 0) {
+        return true;
     }
 
-    ScopedFILE fp(fopen(path.c_str(), "w"), &fclose);
+    std::string temp_path = format("%s.%d.tmp", path.c_str(), getpid());
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), &fclose);
     if (!fp) {
         LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
+             temp_path.c_str(), strerror(errno));
         return false;
     }
 
-    char buf[65536];
-    FileWriteStream os(fp.get(), buf, sizeof(buf));
-    Writer<FileWriteStream> writer(os);
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
 
-    if (!d.Accept(writer)) {
+    if (fwrite(sb.GetString(), 1, sb.GetSize(), fp.get()) != sb.GetSize()
+            || fflush(fp.get()) != 0
+            || fsync(fileno(fp.get())) < 0
+            || fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to write file: %s",
+             temp_path.c_str(), strerror(errno));
         return false;
     }
 
-    if (fclose(fp.release()) != 0) {
-        LOGE("%s: Failed to close file: %s",
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp_path.c_str(),
              path.c_str(), strerror(errno));
         return false;
     }
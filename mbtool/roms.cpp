@@ -20,17 +20,22 @@
 #include "roms.h"
 
 #include <algorithm>
+#include <mutex>
 
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <unistd.h>
 
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/mount.h"
+#include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
@@ -40,6 +45,10 @@
 
 #define BUILD_PROP "build.prop"
 
+// Directories modified this recently are not trusted to have a new timestamp
+// after the next change (vfat only has a 2 second resolution)
+#define SNAPSHOT_RACY_SECS 2
+
 static std::vector<std::string> extsd_mount_points{
     "/raw/extsd",
     "/external_sd",
@@ -55,7 +64,114 @@ static std::vector<std::string> extsd_mount_points{
 namespace mb
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+/*!
+ * \brief State of a path that a ROM snapshot was derived from
+ *
+ * Adding, removing, or renaming an entry in a directory updates the mtime and
+ * ctime of the directory, so comparing a stamp of every directory that was
+ * read is enough to tell whether the scan would have a different result.
+ */
+struct PathStamp
+{
+    std::string path;
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+// Everything below is protected by g_cache_mutex
+static std::mutex g_cache_mutex;
+// PID that g_mount_table was opened in
+static pid_t g_cache_pid;
+static std::unique_ptr<util::MountTable> g_mount_table;
+// Last installed ROMs snapshot
+static std::shared_ptr<const Roms> g_snapshot;
+static std::vector<PathStamp> g_snapshot_stamps;
+static uint64_t g_snapshot_generation;
+// Last external SD partition lookup
+static std::string g_extsd_partition;
+static uint64_t g_extsd_generation;
+
+static PathStamp stamp_path(const std::string &path)
+{
+    PathStamp stamp = {};
+    stamp.path = path;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == 0) {
+        stamp.exists = true;
+        stamp.dev = sb.st_dev;
+        stamp.ino = sb.st_ino;
+        stamp.mtime = sb.st_mtim;
+        stamp.ctime = sb.st_ctim;
+    }
+
+    return stamp;
+}
+
+static bool timespec_equal(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool stamp_is_current(const PathStamp &stamp)
+{
+    PathStamp current = stamp_path(stamp.path);
+
+    if (current.exists != stamp.exists) {
+        return false;
+    } else if (!current.exists) {
+        return true;
+    }
+
+    return current.dev == stamp.dev
+            && current.ino == stamp.ino
+            && timespec_equal(current.mtime, stamp.mtime)
+            && timespec_equal(current.ctime, stamp.ctime);
+}
+
+static bool stamp_is_racy(const PathStamp &stamp, time_t now)
+{
+    return stamp.exists
+            && (stamp.mtime.tv_sec >= now - SNAPSHOT_RACY_SECS
+                    || stamp.ctime.tv_sec >= now - SNAPSHOT_RACY_SECS);
+}
+
+/*!
+ * \brief Bring the cached mount table up to date
+ *
+ * \note g_cache_mutex must be held
+ *
+ * \return Mount table generation or 0 if the mount table could not be read, in
+ *         which case nothing derived from it should be cached
+ */
+static uint64_t refresh_mounts_locked()
+{
+    // The poll state of the mountinfo fd belongs to the open file description,
+    // which forked children share. Reopen it so that a child cannot consume
+    // change notifications meant for the parent (and vice versa).
+    pid_t pid = getpid();
+    if (!g_mount_table || pid != g_cache_pid) {
+        g_mount_table = std::make_unique<util::MountTable>();
+        g_cache_pid = pid;
+
+        // Generations of the new table are unrelated to the old ones
+        g_snapshot.reset();
+        g_snapshot_stamps.clear();
+        g_snapshot_generation = 0;
+        g_extsd_partition.clear();
+        g_extsd_generation = 0;
+    }
+
+    if (auto r = g_mount_table->refresh(); !r) {
+        LOGW("Failed to refresh mount table: %s", r.error().message().c_str());
+        return 0;
+    }
+
+    return g_mount_table->generation();
+}
 
 std::string Rom::full_system_path()
 {
@@ -197,10 +313,12 @@ static bool cmp_rom_id(const std::shared_ptr<Rom> &a,
     return a->id < b->id;
 }
 
-void Roms::add_data_roms()
+void Roms::add_data_roms(const WatchFn &watch)
 {
     std::string system = get_raw_path("/data/multiboot");
 
+    watch(system);
+
     DIR *dp = opendir(system.c_str());
     if (!dp ) {
         return;
@@ -235,7 +353,7 @@ void Roms::add_data_roms()
     std::move(temp_roms.begin(), temp_roms.end(), std::back_inserter(roms));
 }
 
-void Roms::add_extsd_roms()
+void Roms::add_extsd_roms(const WatchFn &watch)
 {
     std::string mount_point = get_extsd_partition();
     std::string search_dir;
@@ -250,6 +368,8 @@ void Roms::add_extsd_roms()
         is_boot = false;
     }
 
+    watch(search_dir);
+
     DIR *dp = opendir(search_dir.c_str());
     if (!dp) {
         return;
@@ -273,6 +393,9 @@ void Roms::add_extsd_roms()
         std::string image(search_dir);
         image += "/";
         image += ent->d_name;
+
+        watch(image);
+
         if (is_boot) {
             image += "/boot.img";
         } else {
@@ -288,12 +411,12 @@ void Roms::add_extsd_roms()
     std::move(temp_roms.begin(), temp_roms.end(), std::back_inserter(roms));
 }
 
-void Roms::add_installed()
+void Roms::add_scanned(const WatchFn &watch)
 {
     Roms all_roms;
     all_roms.add_builtin();
-    all_roms.add_data_roms();
-    all_roms.add_extsd_roms();
+    all_roms.add_data_roms(watch);
+    all_roms.add_extsd_roms(watch);
 
     struct stat sb;
 
@@ -301,15 +424,21 @@ void Roms::add_installed()
         std::string boot_path = get_raw_path(rom->boot_image_path());
         std::string system_path = rom->full_system_path();
 
+        watch(util::dir_name(boot_path));
+
         if (stat(boot_path.c_str(), &sb) == 0) {
             // If boot image exists, assume that the ROM is installed
             roms.push_back(rom);
         } else if (rom->system_is_image) {
+            watch(util::dir_name(system_path));
+
             // If /system is on an ext4 image, check if the image exists
             if (stat(system_path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
                 roms.push_back(rom);
             }
         } else {
+            watch(system_path);
+
             // If /system is bind-mounted, check if build.prop exists
             std::string build_prop(system_path);
             build_prop += "/build.prop";
@@ -321,6 +450,74 @@ void Roms::add_installed()
     }
 }
 
+void Roms::add_installed()
+{
+    auto snapshot = installed();
+    roms.insert(roms.end(), snapshot->roms.begin(), snapshot->roms.end());
+}
+
+/*!
+ * \brief Get the installed ROMs
+ *
+ * The result of a scan is cached for the whole process and shared between
+ * callers. It is reused until the mount table changes or one of the
+ * directories that the scan read is modified, so repeated calls only cost a
+ * poll() and a stat() per directory.
+ *
+ * \return Immutable snapshot of the installed ROMs
+ */
+std::shared_ptr<const Roms> Roms::installed()
+{
+    uint64_t generation;
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+
+        generation = refresh_mounts_locked();
+
+        if (generation != 0 && g_snapshot
+                && generation == g_snapshot_generation
+                && std::all_of(g_snapshot_stamps.begin(),
+                               g_snapshot_stamps.end(), &stamp_is_current)) {
+            return g_snapshot;
+        }
+    }
+
+    time_t now = time(nullptr);
+    std::vector<PathStamp> stamps;
+    bool racy = false;
+
+    // Every path is stamped before it is read so that a concurrent change is
+    // either seen by the scan or detected on the next call
+    auto watch = [&](const std::string &path) {
+        for (auto const &stamp : stamps) {
+            if (stamp.path == path) {
+                return;
+            }
+        }
+
+        stamps.push_back(stamp_path(path));
+        racy = racy || stamp_is_racy(stamps.back(), now);
+    };
+
+    // Partition paths are resolved from entries in these directories
+    watch("/");
+    watch("/raw");
+
+    auto snapshot = std::make_shared<Roms>();
+    snapshot->add_scanned(watch);
+
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+
+    if (!racy && generation != 0 && refresh_mounts_locked() == generation) {
+        g_snapshot = snapshot;
+        g_snapshot_stamps = std::move(stamps);
+        g_snapshot_generation = generation;
+    }
+
+    return snapshot;
+}
+
 std::shared_ptr<Rom> Roms::find_by_id(const std::string &id) const
 {
     for (auto r : roms) {
@@ -334,8 +531,7 @@ std::shared_ptr<Rom> Roms::find_by_id(const std::string &id) const
 
 std::shared_ptr<Rom> Roms::get_current_rom()
 {
-    Roms roms;
-    roms.add_installed();
+    auto roms = installed();
 
     // This is set if mbtool is handling the boot process
     std::string prop_id = util::property_get_string(PROP_MULTIBOOT_ROM_ID, {});
@@ -347,7 +543,7 @@ std::shared_ptr<Rom> Roms::get_current_rom()
     }
 
     if (!prop_id.empty()) {
-        auto rom = roms.find_by_id(prop_id);
+        auto rom = roms->find_by_id(prop_id);
         if (rom) {
             return rom;
         }
@@ -362,13 +558,13 @@ std::shared_ptr<Rom> Roms::get_current_rom()
         // Cache the result
         util::property_set(PROP_MULTIBOOT_ROM_ID, "primary");
 
-        return roms.find_by_id("primary");
+        return roms->find_by_id("primary");
     }
 
     // Otherwise, iterate through the installed ROMs
 
     if (stat("/system/build.prop", &sb) == 0) {
-        for (auto rom : roms.roms) {
+        for (auto rom : roms->roms) {
             // We can't check roms that use images since they aren't mounted
             if (rom->system_is_image) {
                 continue;
@@ -469,46 +665,47 @@ std::string Roms::get_data_partition()
     }
 }
 
-std::string Roms::get_extsd_partition()
+/*!
+ * \brief Find the mounted external SD partition
+ *
+ * \note g_cache_mutex must be held and g_mount_table must be up to date
+ */
+static std::string find_extsd_partition_locked()
 {
     // Try hard-coded mount points first
-    struct stat sb;
     for (const std::string &mount_point : extsd_mount_points) {
-        if (stat(mount_point.c_str(), &sb) == 0) {
-            if (util::is_mounted(mount_point)) {
-                return mount_point;
-            }
+        if (g_mount_table->find(mount_point)) {
+            return mount_point;
         }
     }
 
     static constexpr char prefix_mnt[] = "/mnt/media_rw/";
     static constexpr char prefix_storage[] = "/storage/";
 
+    struct stat sb;
+
     // Look for mounted MMC partitions
-    ScopedFILE fp(std::fopen(util::PROC_MOUNTS, "r"), std::fclose);
-    if (fp) {
-        while (auto entry = util::get_mount_entry(fp.get())) {
-            // Skip useless mounts
-            if (!starts_with(entry.value().dir.c_str(), prefix_mnt)) {
-                continue;
-            }
+    for (auto const &entry : g_mount_table->entries()) {
+        // Skip useless mounts
+        if (!starts_with(entry.dir.c_str(), prefix_mnt)) {
+            continue;
+        }
 
-            if (stat(entry.value().fsname.c_str(), &sb) < 0) {
-                LOGW("%s: Failed to stat: %s",
-                     entry.value().fsname.c_str(), strerror(errno));
-                continue;
-            }
+        if (stat(entry.fsname.c_str(), &sb) < 0) {
+            LOGW("%s: Failed to stat: %s",
+                 entry.fsname.c_str(), strerror(errno));
+            continue;
+        }
 
-            if (major(sb.st_rdev) == 179) {
-                std::string_view suffix(entry.value().dir);
-                suffix.remove_prefix(strlen(prefix_mnt));
+        if (major(sb.st_rdev) == 179) {
+            std::string_view suffix(entry.dir);
+            suffix.remove_prefix(strlen(prefix_mnt));
 
-                std::string path(prefix_storage);
-                path += suffix;
+            std::string path(prefix_storage);
+            path += suffix;
 
-                if (util::is_mounted(path)) {
-                    return path;
-                }
+            if (g_mount_table->find(path)) {
+                return path;
             }
         }
     }
@@ -516,6 +713,22 @@ std::string Roms::get_extsd_partition()
     return {};
 }
 
+std::string Roms::get_extsd_partition()
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+
+    // The result only depends on the mount table
+    uint64_t generation = refresh_mounts_locked();
+    if (generation == 0) {
+        return {};
+    } else if (generation != g_extsd_generation) {
+        g_extsd_partition = find_extsd_partition_locked();
+        g_extsd_generation = generation;
+    }
+
+    return g_extsd_partition;
+}
+
 std::string Roms::get_mountpoint(Rom::Source source)
 {
     switch (source) {
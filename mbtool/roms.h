@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -73,12 +74,17 @@ private:
     static std::shared_ptr<Rom> create_rom_data_slot(const std::string &id);
     static std::shared_ptr<Rom> create_rom_extsd_slot(const std::string &id);
 
+    using WatchFn = std::function<void(const std::string &)>;
+
     void add_builtin();
-    void add_data_roms();
-    void add_extsd_roms();
+    void add_data_roms(const WatchFn &watch);
+    void add_extsd_roms(const WatchFn &watch);
+    void add_scanned(const WatchFn &watch);
 public:
     void add_installed();
 
+    static std::shared_ptr<const Roms> installed();
+
     std::shared_ptr<Rom> find_by_id(const std::string &id) const;
 
     static std::shared_ptr<Rom> get_current_rom();
@@ -19,11 +19,14 @@
 
 #include "sepolpatch.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <climits>
 #include <cstdio>
+#include <cstring>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/mman.h>
@@ -41,13 +44,21 @@
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/selinux.h"
+#include "mbutil/string.h"
 
 #include "multiboot.h"
 
 #define LOG_TAG "mbtool/sepolpatch"
 
+// Patched policies for this many different source policies are kept
+static constexpr size_t SEPOLICY_CACHE_MAX_ENTRIES = 8;
+
 
 extern "C" int policydb_index_decls(sepol_handle_t *handle, policydb_t *p);
 
@@ -801,29 +812,181 @@ static void selinux_strip_no_audit(policydb_t *pdb)
 #endif
 }
 
-// Patching functions
+/*!
+ * \brief Create an empty rule set for a policy
+ *
+ * The permission masks for every class are computed up front so that granting
+ * all permissions does not need to walk the permission hash tables for every
+ * pair of types.
+ */
+SELinuxRuleSet::SELinuxRuleSet(policydb_t *pdb)
+    : _pdb(pdb)
+    , _class_perms(pdb->p_classes.nprim)
+{
+    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
+            ++class_val) {
+        auto clazz = pdb->class_val_to_struct[class_val - 1];
+        if (!clazz) {
+            continue;
+        }
 
-// Fail fast
-#define ff(expr) \
-    do { \
-        if (!(expr)) return false; \
-    } while (0)
+        hashtab_t tables[] = { clazz->permissions.table, nullptr, nullptr };
+        if (clazz->comdatum) {
+            tables[1] = clazz->comdatum->permissions.table;
+        }
+
+        uint32_t mask = 0;
 
-static inline bool add_rules(policydb_t *pdb,
-                             const char *source,
-                             const char *target,
-                             const char *clazz,
-                             const std::vector<std::string> &perms)
+        for (auto table = tables; *table; ++table) {
+            for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
+                for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
+                        cur = cur->next) {
+                    auto perm_datum = static_cast<perm_datum_t *>(cur->datum);
+                    mask |= 1U << (perm_datum->s.value - 1);
+                }
+            }
+        }
+
+        _class_perms[class_val - 1] = mask;
+    }
+}
+
+void SELinuxRuleSet::add_mask(uint16_t source_type_val,
+                              uint16_t target_type_val,
+                              uint16_t class_val,
+                              uint32_t mask)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_add_rule(pdb, source, target, clazz, perm.c_str())) {
+    if (mask == 0) {
+        return;
+    }
+
+    uint64_t key = (static_cast<uint64_t>(source_type_val) << 32)
+            | (static_cast<uint64_t>(target_type_val) << 16)
+            | class_val;
+    _rules[key] |= mask;
+}
+
+bool SELinuxRuleSet::add_rules(const char *source_str,
+                               const char *target_str,
+                               const char *class_str,
+                               const std::vector<std::string> &perms)
+{
+    type_datum_t *source = find_type(_pdb, source_str);
+    if (!source) {
+        LOGE("Source type %s does not exist", source_str);
+        return false;
+    }
+
+    type_datum_t *target = find_type(_pdb, target_str);
+    if (!target) {
+        LOGE("Target type %s does not exist", target_str);
+        return false;
+    }
+
+    class_datum_t *clazz = find_class(_pdb, class_str);
+    if (!clazz) {
+        LOGE("Class %s does not exist", class_str);
+        return false;
+    }
+
+    uint32_t mask = 0;
+
+    for (auto const &perm_str : perms) {
+        perm_datum_t *perm = find_perm(clazz, perm_str.c_str());
+        if (!perm) {
+            LOGE("Perm %s does not exist in class %s",
+                 perm_str.c_str(), class_str);
             return false;
         }
+
+        mask |= 1U << (perm->s.value - 1);
+    }
+
+    add_mask(static_cast<uint16_t>(source->s.value),
+             static_cast<uint16_t>(target->s.value),
+             static_cast<uint16_t>(clazz->s.value), mask);
+    return true;
+}
+
+bool SELinuxRuleSet::add_rule(const char *source_str,
+                              const char *target_str,
+                              const char *class_str,
+                              const char *perm_str)
+{
+    return add_rules(source_str, target_str, class_str, { perm_str });
+}
+
+bool SELinuxRuleSet::grant_all_perms(uint16_t source_type_val,
+                                     uint16_t target_type_val,
+                                     uint16_t class_val)
+{
+    if (class_val == 0 || class_val > _class_perms.size()
+            || !_pdb->class_val_to_struct[class_val - 1]) {
+        return false;
     }
 
+    add_mask(source_type_val, target_type_val, class_val,
+             _class_perms[class_val - 1]);
     return true;
 }
 
+bool SELinuxRuleSet::grant_all_perms(uint16_t source_type_val,
+                                     uint16_t target_type_val)
+{
+    for (uint32_t class_val = 1; class_val <= _class_perms.size();
+            ++class_val) {
+        if (!grant_all_perms(source_type_val, target_type_val,
+                             static_cast<uint16_t>(class_val))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Merge the accumulated rules into the policy's avtab
+ *
+ * The rule set is empty after this returns successfully.
+ */
+bool SELinuxRuleSet::apply()
+{
+    for (auto const &[k, mask] : _rules) {
+        avtab_key_t key;
+        key.source_type = static_cast<uint16_t>(k >> 32);
+        key.target_type = static_cast<uint16_t>(k >> 16);
+        key.target_class = static_cast<uint16_t>(k);
+        key.specified = AVTAB_ALLOWED;
+
+        avtab_datum_t *av = avtab_search(&_pdb->te_avtab, &key);
+        if (av) {
+            av->data |= mask;
+        } else {
+            avtab_datum_t av_new = {};
+            av_new.data = mask;
+            if (avtab_insert(&_pdb->te_avtab, &key, &av_new) != 0) {
+                LOGE("Failed to add rule: allow %s %s:%s 0x%08x;",
+                     _pdb->p_type_val_to_name[key.source_type - 1],
+                     _pdb->p_type_val_to_name[key.target_type - 1],
+                     _pdb->p_class_val_to_name[key.target_class - 1],
+                     mask);
+                return false;
+            }
+        }
+    }
+
+    _rules.clear();
+    return true;
+}
+
+// Patching functions
+
+// Fail fast
+#define ff(expr) \
+    do { \
+        if (!(expr)) return false; \
+    } while (0)
+
 [[maybe_unused]]
 static inline bool remove_rules(policydb_t *pdb,
                                 const char *source,
@@ -859,6 +1022,8 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
         return false;
     }
 
+    SELinuxRuleSet rules(pdb);
+
     // For all attributes
     for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
         // Skip non-attributes
@@ -866,14 +1031,8 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
             continue;
         }
 
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(kernel->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
+        if (!rules.grant_all_perms(static_cast<uint16_t>(kernel->s.value),
+                                   static_cast<uint16_t>(type_val))) {
             LOGE("Failed to grant all perms for: %s -> %s",
                  "kernel", pdb->p_type_val_to_name[type_val - 1]);
             return false;
@@ -881,7 +1040,9 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
     }
 
     // Allow the real init to load the "secure" SELinux policy
-    ff(selinux_add_rule(pdb, "kernel", "kernel", "security", "load_policy"));
+    ff(rules.add_rule("kernel", "kernel", "security", "load_policy"));
+
+    ff(rules.apply());
 
     return true;
 }
@@ -1005,22 +1166,24 @@ static bool create_mbtool_types(policydb_t *pdb)
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedobject"));
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
 
+    SELinuxRuleSet rules(pdb);
+
     // Allow setting the current process context from init to mb_exec
-    ff(add_rules(pdb, "init", "mb_exec", "process", {
+    ff(rules.add_rules("init", "mb_exec", "process", {
         "noatsecure", "rlimitinh", "setcurrent", "siginh", "transition",
         //"dyntransition",
     }));
 
     // Allow installd to connect to appsync's socket
-    ff(add_rules(pdb, "installd", "mb_exec", "unix_stream_socket", {
+    ff(rules.add_rules("installd", "mb_exec", "unix_stream_socket", {
         "accept", "listen", "read", "write",
     }));
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "unix_stream_socket", {
+        ff(rules.add_rules("system_server", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     } else {
-        ff(add_rules(pdb, "system", "mb_exec", "unix_stream_socket", {
+        ff(rules.add_rules("system", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     }
@@ -1028,39 +1191,39 @@ static bool create_mbtool_types(policydb_t *pdb)
     // Allow apps to connect to the daemon
     for (auto const &type : { "untrusted_app", "untrusted_app_25" }) {
         if (find_type(pdb, type)) {
-            ff(add_rules(pdb, type, "mb_exec", "unix_stream_socket", {
+            ff(rules.add_rules(type, "mb_exec", "unix_stream_socket", {
                 "connectto",
             }));
         }
     }
 
     // Allow zygote to write to our stdout pipe when rebooting
-    ff(add_rules(pdb, "zygote", "init", "fifo_file", { "write" }));
+    ff(rules.add_rules("zygote", "init", "fifo_file", { "write" }));
 
     // Allow rebooting via the android.intent.action.REBOOT intent
     if (find_type(pdb, "activity_service")) {
-        ff(add_rules(pdb, "zygote", "activity_service", "service_manager", { "find" }));
+        ff(rules.add_rules("zygote", "activity_service", "service_manager", { "find" }));
     }
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "zygote", "system_server", "binder", { "call" }));
+        ff(rules.add_rules("zygote", "system_server", "binder", { "call" }));
     }
 
-    ff(add_rules(pdb, "zygote", "init", "unix_stream_socket", { "read", "write" }));
-    ff(add_rules(pdb, "zygote", "servicemanager", "binder", { "call" }));
+    ff(rules.add_rules("zygote", "init", "unix_stream_socket", { "read", "write" }));
+    ff(rules.add_rules("zygote", "servicemanager", "binder", { "call" }));
 
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "binder", { "transfer" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "file", { "open", "read" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "process", { "getattr" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "open" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "read" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "process", { "getattr" }));
+    ff(rules.add_rules("servicemanager", "mb_exec", "binder", { "transfer" }));
+    ff(rules.add_rules("servicemanager", "mb_exec", "dir", { "search" }));
+    ff(rules.add_rules("servicemanager", "mb_exec", "file", { "open", "read" }));
+    ff(rules.add_rules("servicemanager", "mb_exec", "process", { "getattr" }));
+    ff(rules.add_rules("servicemanager", "zygote", "dir", { "search" }));
+    ff(rules.add_rules("servicemanager", "zygote", "file", { "open" }));
+    ff(rules.add_rules("servicemanager", "zygote", "file", { "read" }));
+    ff(rules.add_rules("servicemanager", "zygote", "process", { "getattr" }));
 
     // For in-app flashing
-    ff(add_rules(pdb, "rootfs", "tmpfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "kernel", "mb_exec", "fd", { "use" }));
+    ff(rules.add_rules("rootfs", "tmpfs", "filesystem", { "associate" }));
+    ff(rules.add_rules("tmpfs",  "rootfs", "filesystem", { "associate" }));
+    ff(rules.add_rules("kernel", "mb_exec", "fd", { "use" }));
 
     // Give mb_exec <insert diety here> permissions
     type_datum_t *mb_exec = find_type(pdb, "mb_exec");
@@ -1077,20 +1240,16 @@ static bool create_mbtool_types(policydb_t *pdb)
             continue;
         }
 
-        auto ret2 = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(mb_exec->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret2) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
+        if (!rules.grant_all_perms(static_cast<uint16_t>(mb_exec->s.value),
+                                   static_cast<uint16_t>(type_val))) {
             LOGE("Failed to grant all perms for: %s -> %s",
                  "mb_exec", pdb->p_type_val_to_name[type_val - 1]);
             return false;
         }
     }
 
+    ff(rules.apply());
+
     return true;
 }
 
@@ -1104,20 +1263,24 @@ static bool apply_main_patches(policydb_t *pdb)
 
 static bool apply_cwm_recovery_patches(policydb_t *pdb)
 {
+    SELinuxRuleSet rules(pdb);
+
     // Debugging rules (for CWM and Philz)
-    ff(add_rules(pdb, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "system_file",     "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "tmpfs",           "file",       { "relabelto" }));
-
-    ff(add_rules(pdb, "rootfs", "tmpfs",          "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+    ff(rules.add_rules("adbd",  "block_device",    "blk_file",   { "relabelto" }));
+    ff(rules.add_rules("adbd",  "graphics_device", "chr_file",   { "relabelto" }));
+    ff(rules.add_rules("adbd",  "graphics_device", "dir",        { "relabelto" }));
+    ff(rules.add_rules("adbd",  "input_device",    "chr_file",   { "relabelto" }));
+    ff(rules.add_rules("adbd",  "input_device",    "dir",        { "relabelto" }));
+    ff(rules.add_rules("adbd",  "rootfs",          "dir",        { "relabelto" }));
+    ff(rules.add_rules("adbd",  "rootfs",          "file",       { "relabelto" }));
+    ff(rules.add_rules("adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
+    ff(rules.add_rules("adbd",  "system_file",     "file",       { "relabelto" }));
+    ff(rules.add_rules("adbd",  "tmpfs",           "file",       { "relabelto" }));
+
+    ff(rules.add_rules("rootfs", "tmpfs",          "filesystem", { "associate" }));
+    ff(rules.add_rules("tmpfs",  "rootfs",         "filesystem", { "associate" }));
+
+    ff(rules.apply());
 
     return true;
 }
@@ -1147,9 +1310,79 @@ bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
     return ret;
 }
 
+/*!
+ * \brief Load a policy and apply a series of patches to it
+ *
+ * All patches are applied to the same policydb so that chaining patches does
+ * not require serializing and reloading the policy in between.
+ */
+static bool load_and_patch_sepolicy(const std::string &source,
+                                    const std::vector<SELinuxPatch> &patches,
+                                    policydb_t *pdb)
+{
+    if (!util::selinux_read_policy(source, pdb)) {
+        LOGE("%s: Failed to load SELinux policy", source.c_str());
+        return false;
+    }
+
+    LOGD("Policy version: %u", pdb->policyvers);
+
+    for (auto patch : patches) {
+        if (!selinux_apply_patch(pdb, patch)) {
+            LOGE("%s: Failed to apply policy patch", source.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch)
+{
+    return patch_sepolicy(source, target, std::vector<SELinuxPatch>{patch});
+}
+
+bool patch_sepolicy(const std::string &source,
+                    const std::string &target,
+                    const std::vector<SELinuxPatch> &patches)
+{
+    policydb_t pdb;
+
+    if (policydb_init(&pdb) < 0) {
+        LOGE("Failed to initialize policydb");
+        return false;
+    }
+
+    auto destroy_pdb = finally([&]{
+        policydb_destroy(&pdb);
+    });
+
+    if (!load_and_patch_sepolicy(source, patches, &pdb)) {
+        return false;
+    }
+
+    if (!util::selinux_write_policy(target, &pdb)) {
+        LOGE("%s: Failed to write SELinux policy", target.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Patch an SELinux policy and return the result as a binary image
+ *
+ * \param source Path of the policy to patch
+ * \param patches Patches to apply, in order
+ * \param[out] image Patched policy image
+ *
+ * \return Whether the policy was successfully patched
+ */
+bool patch_sepolicy_image(const std::string &source,
+                          const std::vector<SELinuxPatch> &patches,
+                          std::vector<unsigned char> &image)
 {
     policydb_t pdb;
 
@@ -1162,7 +1395,221 @@ bool patch_sepolicy(const std::string &source,
         policydb_destroy(&pdb);
     });
 
-    if (!util::selinux_read_policy(source, &pdb)) {
+    return load_and_patch_sepolicy(source, patches, &pdb)
+            && util::selinux_policy_to_image(&pdb, image);
+}
+
+/*!
+ * \brief Get external state that a patch depends on besides the policy itself
+ */
+static std::string patch_external_inputs(SELinuxPatch patch)
+{
+    std::string inputs;
+
+    if (patch == SELinuxPatch::Main) {
+        // fix_data_media_rules() depends on the label of the internal storage
+        for (auto const &path : { INTERNAL_STORAGE, "/data/media" }) {
+            if (auto context = util::selinux_lget_context(path)) {
+                inputs += context.value();
+                break;
+            }
+        }
+    }
+
+    return inputs;
+}
+
+static void prune_sepolicy_cache(const std::string &cache_dir,
+                                 const std::string &keep)
+{
+    DIR *dp = opendir(cache_dir.c_str());
+    if (!dp) {
+        return;
+    }
+
+    auto close_dp = finally([&] {
+        closedir(dp);
+    });
+
+    std::vector<std::pair<time_t, std::string>> entries;
+    struct stat sb;
+
+    while (auto ent = readdir(dp)) {
+        if (ent->d_name[0] == '.' || keep == ent->d_name) {
+            continue;
+        }
+
+        std::string path(cache_dir);
+        path += '/';
+        path += ent->d_name;
+
+        if (lstat(path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+            entries.emplace_back(sb.st_mtime, std::move(path));
+        }
+    }
+
+    if (entries.size() < SEPOLICY_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    // Remove the oldest entries, leaving room for the new one
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i <= entries.size() - SEPOLICY_CACHE_MAX_ENTRIES; ++i) {
+        if (unlink(entries[i].second.c_str()) < 0) {
+            LOGW("%s: Failed to remove cached policy: %s",
+                 entries[i].second.c_str(), strerror(errno));
+        }
+    }
+}
+
+static bool write_sepolicy_cache(const std::string &cache_dir,
+                                 const std::string &name,
+                                 const void *data, size_t len)
+{
+    if (auto r = util::mkdir_recursive(cache_dir, 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             cache_dir.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    prune_sepolicy_cache(cache_dir, name);
+
+    std::string path(cache_dir);
+    path += '/';
+    path += name;
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    int fd = open(temp_path.c_str(),
+                  O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGW("%s: Failed to open file: %s", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    // The entry must be complete before it becomes visible since a truncated
+    // policy would fail to load on the next boot
+    bool ok = true;
+    auto ptr = static_cast<const char *>(data);
+
+    for (size_t remain = len; ok && remain > 0;) {
+        ssize_t n = write(fd, ptr, remain);
+        if (n < 0) {
+            ok = errno == EINTR;
+        } else {
+            ptr += n;
+            remain -= static_cast<size_t>(n);
+        }
+    }
+
+    if (!ok || fsync(fd) < 0) {
+        ok = false;
+    }
+    if (close(fd) < 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to write cached policy: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Patch an SELinux policy, reusing a previously patched copy if possible
+ *
+ * The patched policy is cached in \p cache_dir, keyed by the SHA-512 digest of
+ * the source policy, the patch type, the mbtool version, and any external state
+ * that the patch depends on. Since ROMs rarely change their policies, booting
+ * usually only needs to hash the policy and copy the cached result to
+ * \p target.
+ *
+ * \param source Path of the policy to patch
+ * \param target Path to write the patched policy to (may be \p source)
+ * \param patch Patch to apply
+ * \param cache_dir Cache directory
+ *
+ * \return Whether the patched policy was written to \p target
+ */
+bool patch_sepolicy_cached(const std::string &source,
+                           const std::string &target,
+                           SELinuxPatch patch,
+                           const std::string &cache_dir)
+{
+    auto policy = util::file_read_all(source);
+    if (!policy) {
+        LOGE("%s: Failed to read SELinux policy: %s",
+             source.c_str(), policy.error().message().c_str());
+        return false;
+    }
+
+    auto &policy_data = policy.value();
+    size_t policy_size = policy_data.size();
+
+    // Compute the cache key over the policy followed by the other inputs
+    std::string key_inputs;
+    key_inputs += '\0';
+    key_inputs += version();
+    key_inputs += '\0';
+    key_inputs += std::to_string(static_cast<int>(patch));
+    key_inputs += '\0';
+    key_inputs += patch_external_inputs(patch);
+
+    policy_data.insert(policy_data.end(), key_inputs.begin(), key_inputs.end());
+    auto digest = util::sha512_hash(policy_data.data(), policy_data.size());
+    policy_data.resize(policy_size);
+
+    std::string cache_name;
+    std::string cache_path;
+
+    if (digest) {
+        cache_name = util::hex_string(digest.value().data(),
+                                      digest.value().size());
+        cache_path = cache_dir;
+        cache_path += '/';
+        cache_path += cache_name;
+    } else {
+        LOGW("%s: Failed to hash SELinux policy: %s",
+             source.c_str(), digest.error().message().c_str());
+    }
+
+    if (!cache_path.empty()) {
+        if (auto cached = util::file_read_all(cache_path)) {
+            LOGD("%s: Using cached patched policy", cache_path.c_str());
+
+            if (util::selinux_write_policy_image(
+                    target, cached.value().data(), cached.value().size())) {
+                return true;
+            }
+
+            // Maybe the kernel rejected it. Regenerate it from scratch.
+            LOGW("%s: Failed to write cached policy to %s",
+                 cache_path.c_str(), target.c_str());
+            unlink(cache_path.c_str());
+        }
+    }
+
+    policydb_t pdb;
+
+    if (policydb_init(&pdb) < 0) {
+        LOGE("Failed to initialize policydb");
+        return false;
+    }
+
+    auto destroy_pdb = finally([&]{
+        policydb_destroy(&pdb);
+    });
+
+    // The source may have been overwritten above, so load it from memory
+    if (!util::selinux_read_policy_image(policy_data.data(), policy_size,
+                                         &pdb)) {
         LOGE("%s: Failed to load SELinux policy", source.c_str());
         return false;
     }
@@ -1174,15 +1621,29 @@ bool patch_sepolicy(const std::string &source,
         return false;
     }
 
-    if (!util::selinux_write_policy(target, &pdb)) {
+    std::vector<unsigned char> image;
+    if (!util::selinux_policy_to_image(&pdb, image)) {
+        return false;
+    }
+
+    if (!util::selinux_write_policy_image(target, image.data(), image.size())) {
         LOGE("%s: Failed to write SELinux policy", target.c_str());
         return false;
     }
 
+    if (!cache_path.empty()) {
+        write_sepolicy_cache(cache_dir, cache_name, image.data(), image.size());
+    }
+
     return true;
 }
 
 bool patch_loaded_sepolicy(SELinuxPatch patch)
+{
+    return patch_loaded_sepolicy(std::vector<SELinuxPatch>{patch});
+}
+
+bool patch_loaded_sepolicy(const std::vector<SELinuxPatch> &patches)
 {
     ScopedFILE fp(fopen(util::SELINUX_ENFORCE_FILE, "rbe"), fclose);
     if (!fp) {
@@ -1199,7 +1660,7 @@ bool patch_loaded_sepolicy(SELinuxPatch patch)
     }
 
     return patch_sepolicy(util::SELINUX_POLICY_FILE, util::SELINUX_LOAD_FILE,
-                          patch);
+                          patches);
 }
 
 static void sepolpatch_usage(FILE *stream)
@@ -1213,7 +1674,7 @@ static void sepolpatch_usage(FILE *stream)
             "                      Target policy file to patch\n"
             "  --loaded            Patch currently loaded policy\n"
             "  -p [PATCH], --patch [PATCH]\n"
-            "                      Policy patch to apply\n"
+            "                      Policy patch to apply (may be repeated)\n"
             "  -l, --list-patches  List available policy patches\n"
             "  -h, --help          Display this help message\n"
             "\n"
@@ -1222,7 +1683,9 @@ static void sepolpatch_usage(FILE *stream)
             "Note that, unlike --loaded, sepolpatch will not check if SELinux is\n"
             "supported, enabled, and enforcing before patching.\n\n"
             "Note: The source and target file can be set to the same path to patch\n"
-            "the policy file in place.\n");
+            "the policy file in place.\n\n"
+            "If multiple patches are specified, they are applied in order before the\n"
+            "policy is written.\n");
 }
 
 struct {
@@ -1241,7 +1704,7 @@ int sepolpatch_main(int argc, char *argv[])
     int opt;
     const char *source_file = nullptr;
     const char *target_file = nullptr;
-    const char *patch = nullptr;
+    std::vector<const char *> patch_names;
     bool flag_loaded = false;
     bool flag_list_patches = false;
 
@@ -1279,7 +1742,7 @@ int sepolpatch_main(int argc, char *argv[])
             break;
 
         case 'p':
-            patch = optarg;
+            patch_names.push_back(optarg);
             break;
 
         case 'l':
@@ -1303,7 +1766,8 @@ int sepolpatch_main(int argc, char *argv[])
     }
 
     if (flag_list_patches
-            && (source_file || target_file || flag_loaded || patch)) {
+            && (source_file || target_file || flag_loaded
+                    || !patch_names.empty())) {
         fprintf(stderr, "--list-patches cannot be used with other options\n");
         return EXIT_FAILURE;
     }
@@ -1315,23 +1779,29 @@ int sepolpatch_main(int argc, char *argv[])
 
         return EXIT_SUCCESS;
     } else {
-        if (!patch) {
+        if (patch_names.empty()) {
             fprintf(stderr, "A patch must be specified via --patch\n");
             return EXIT_FAILURE;
         }
 
-        SELinuxPatch patch_type(SELinuxPatch::None);
+        std::vector<SELinuxPatch> patch_types;
 
-        for (auto it = patches; it->name; ++it) {
-            if (strcmp(it->name, patch) == 0) {
-                patch_type = it->patch;
-                break;
+        for (auto const &name : patch_names) {
+            SELinuxPatch patch_type(SELinuxPatch::None);
+
+            for (auto it = patches; it->name; ++it) {
+                if (strcmp(it->name, name) == 0) {
+                    patch_type = it->patch;
+                    break;
+                }
             }
-        }
 
-        if (patch_type == SELinuxPatch::None) {
-            fprintf(stderr, "Invalid patch: %s\n", patch);
-            return EXIT_FAILURE;
+            if (patch_type == SELinuxPatch::None) {
+                fprintf(stderr, "Invalid patch: %s\n", name);
+                return EXIT_FAILURE;
+            }
+
+            patch_types.push_back(patch_type);
         }
 
         if (flag_loaded) {
@@ -1340,7 +1810,7 @@ int sepolpatch_main(int argc, char *argv[])
                 return EXIT_FAILURE;
             }
 
-            return patch_loaded_sepolicy(patch_type)
+            return patch_loaded_sepolicy(patch_types)
                     ? EXIT_SUCCESS : EXIT_FAILURE;
         } else {
             if (!source_file) {
@@ -1350,7 +1820,7 @@ int sepolpatch_main(int argc, char *argv[])
                 target_file = util::SELINUX_LOAD_FILE;
             }
 
-            return patch_sepolicy(source_file, target_file, patch_type)
+            return patch_sepolicy(source_file, target_file, patch_types)
                     ? EXIT_SUCCESS : EXIT_FAILURE;
         }
     }
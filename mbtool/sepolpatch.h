@@ -20,6 +20,8 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <sepol/policydb/policydb.h>
 
@@ -106,6 +108,44 @@ bool selinux_add_to_role(policydb_t *pdb,
                          const char *role_name,
                          const char *type_name);
 
+/*!
+ * \brief Batch of allow rules to merge into a policy's avtab
+ *
+ * Rules are accumulated as permission masks per (source, target, class) key
+ * and are only written to the avtab, with one lookup per key, when apply() is
+ * called.
+ */
+class SELinuxRuleSet
+{
+public:
+    explicit SELinuxRuleSet(policydb_t *pdb);
+
+    bool add_rules(const char *source_str,
+                   const char *target_str,
+                   const char *class_str,
+                   const std::vector<std::string> &perms);
+    bool add_rule(const char *source_str,
+                  const char *target_str,
+                  const char *class_str,
+                  const char *perm_str);
+    bool grant_all_perms(uint16_t source_type_val,
+                         uint16_t target_type_val,
+                         uint16_t class_val);
+    bool grant_all_perms(uint16_t source_type_val,
+                         uint16_t target_type_val);
+
+    bool apply();
+
+private:
+    void add_mask(uint16_t source_type_val, uint16_t target_type_val,
+                  uint16_t class_val, uint32_t mask);
+
+    policydb_t *_pdb;
+    // Mask of every permission (including common ones) for each class
+    std::vector<uint32_t> _class_perms;
+    std::unordered_map<uint64_t, uint32_t> _rules;
+};
+
 // Patching functions
 
 enum class SELinuxPatch
@@ -122,7 +162,18 @@ bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch);
 bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch);
+bool patch_sepolicy(const std::string &source,
+                    const std::string &target,
+                    const std::vector<SELinuxPatch> &patches);
+bool patch_sepolicy_image(const std::string &source,
+                          const std::vector<SELinuxPatch> &patches,
+                          std::vector<unsigned char> &image);
+bool patch_sepolicy_cached(const std::string &source,
+                           const std::string &target,
+                           SELinuxPatch patch,
+                           const std::string &cache_dir);
 bool patch_loaded_sepolicy(SELinuxPatch patch);
+bool patch_loaded_sepolicy(const std::vector<SELinuxPatch> &patches);
 
 int sepolpatch_main(int argc, char *argv[]);
 
@@ -19,6 +19,10 @@
 
 #include "signature.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -127,6 +131,9 @@ static SigVerifyResult verify_signature_with_key(const char *path,
     auto ret = sign::verify_data(*bio_data_in, *bio_sig_in, public_key);
     if (!ret) {
         if (ret.error().ec == sign::Error::BadSignature) {
+            // The next key may still match, so don't leave this key's errors
+            // in the (per-thread) queue for a later failure to report
+            ERR_clear_error();
             return SigVerifyResult::Invalid;
         } else {
             LOGE("%s: Failed to verify signature: %s", sig_path,
@@ -141,14 +148,14 @@ static SigVerifyResult verify_signature_with_key(const char *path,
     return SigVerifyResult::Valid;
 }
 
-SigVerifyResult verify_signature(const char *path, const char *sig_path)
+SignatureVerifier::SignatureVerifier() : _valid(false)
 {
     for (const std::string &hex_der : valid_certs) {
         std::string der;
         if (!hex2bin(hex_der, der)) {
             LOGE("Failed to convert hex-encoded certificate to binary: %s",
                  hex_der.c_str());
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Cast to (void *) is okay since BIO_new_mem_buf() creates a read-only
@@ -159,7 +166,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to create BIO for X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Load DER-encoded certificate
@@ -167,7 +174,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
         if (!cert) {
             LOGE("Failed to load X509 certificate: %s", hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Get public key from certificate
@@ -176,11 +183,33 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to load public key from X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
+        _keys.push_back(std::move(public_key));
+    }
+
+    _valid = true;
+}
+
+/*!
+ * \brief Check whether all of the trusted certificates were loaded
+ */
+bool SignatureVerifier::valid() const
+{
+    return _valid;
+}
+
+SigVerifyResult SignatureVerifier::verify(const char *path,
+                                          const char *sig_path) const
+{
+    if (!_valid) {
+        return SigVerifyResult::Failure;
+    }
+
+    for (auto const &key : _keys) {
         SigVerifyResult result =
-                verify_signature_with_key(path, sig_path, *public_key);
+                verify_signature_with_key(path, sig_path, *key);
         if (result == SigVerifyResult::Invalid) {
             // Keep trying ...
             continue;
@@ -192,6 +221,87 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
     return SigVerifyResult::Invalid;
 }
 
+/*!
+ * \brief Verify the signatures of several files in parallel
+ *
+ * \param files List of files and their signature files
+ * \param threads Number of threads to use (0 = number of CPUs)
+ *
+ * \return Verification result for each entry in \p files
+ */
+std::vector<SigVerifyResult>
+SignatureVerifier::verify(const std::vector<SigFile> &files,
+                          unsigned int threads) const
+{
+    std::vector<SigVerifyResult> results(files.size(),
+                                         SigVerifyResult::Failure);
+    std::atomic_size_t next(0);
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            results[i] = verify(files[i].path.c_str(),
+                                files[i].sig_path.c_str());
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, files.size()));
+
+    std::vector<std::thread> pool;
+
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &t : pool) {
+        t.join();
+    }
+
+    return results;
+}
+
+/*!
+ * \brief Get shared verifier for the trusted certificates
+ *
+ * The certificates are only parsed the first time this is called.
+ */
+const SignatureVerifier & signature_verifier()
+{
+    static const SignatureVerifier verifier;
+    return verifier;
+}
+
+SigVerifyResult verify_signature(const char *path, const char *sig_path)
+{
+    return signature_verifier().verify(path, sig_path);
+}
+
+/*!
+ * \brief Verify the signatures of several files in parallel
+ *
+ * \return Whether every signature is valid. An error is logged for each file
+ *         that failed verification.
+ */
+bool verify_signatures(const std::vector<SigFile> &files)
+{
+    auto results = signature_verifier().verify(files);
+    bool ret = true;
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (results[i] != SigVerifyResult::Valid) {
+            LOGE("%s: Signature verification failed", files[i].path.c_str());
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
 static void sigverify_usage(FILE *stream)
 {
     fprintf(stream,
@@ -19,6 +19,11 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
+#include "mbsign/sign.h"
+
 namespace mb
 {
 
@@ -29,7 +34,38 @@ enum class SigVerifyResult
     Failure,
 };
 
+struct SigFile
+{
+    std::string path;
+    std::string sig_path;
+};
+
+/*!
+ * \brief Verifier for files signed with one of the trusted certificates
+ *
+ * The trusted certificates are parsed once when the verifier is constructed.
+ * A verifier can be shared between threads.
+ */
+class SignatureVerifier
+{
+public:
+    SignatureVerifier();
+
+    bool valid() const;
+
+    SigVerifyResult verify(const char *path, const char *sig_path) const;
+    std::vector<SigVerifyResult> verify(const std::vector<SigFile> &files,
+                                        unsigned int threads = 0) const;
+
+private:
+    std::vector<sign::ScopedEVP_PKEY> _keys;
+    bool _valid;
+};
+
+const SignatureVerifier & signature_verifier();
+
 SigVerifyResult verify_signature(const char *path, const char *sig_path);
+bool verify_signatures(const std::vector<SigFile> &files);
 
 int sigverify_main(int argc, char *argv[]);
 
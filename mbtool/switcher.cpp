@@ -19,18 +19,24 @@
 
 #include "switcher.h"
 
-#include <array>
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#include <openssl/sha.h>
-
+#include "mbbootimg/delta.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
@@ -39,6 +45,7 @@
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
@@ -50,6 +57,9 @@
 
 #define CHECKSUMS_PATH "/data/multiboot/checksums.prop"
 
+// Chunk size for reading back a flashed image
+#define VERIFY_BUF_SIZE (1024 * 1024)
+
 namespace mb
 {
 
@@ -184,8 +194,129 @@ struct Flashable
     std::string expected_hash;
     std::string hash;
     std::vector<unsigned char> data;
+    // Error from reading and hashing the image
+    std::string error;
 };
 
+/*!
+ * \brief Write only the blocks of an image that differ from the partition
+ *
+ * \param f Flashable containing the image data and target block device
+ *
+ * \return Nothing if the changed blocks were successfully written. Otherwise,
+ *         the error code. Some blocks may have been written on failure.
+ */
+static oc::result<void> flash_changed_blocks(const Flashable &f)
+{
+    StandardFile dest;
+    OUTCOME_TRYV(dest.open(f.block_dev, FileOpenMode::ReadWrite));
+
+    MemoryFile src(f.data.data(), f.data.size());
+
+    OUTCOME_TRY(delta, bootimg::delta_compute(dest, src));
+
+    LOGD("%s: %" MB_PRIzu " changed entries, header changed: %d",
+         f.block_dev.c_str(), delta.changed_entries.size(),
+         delta.header_changed);
+
+    OUTCOME_TRY(n, bootimg::delta_apply(delta, src, dest));
+
+    LOGD("%s: Wrote %" PRIu64 " of %" MB_PRIzu " bytes"
+         " (skipped %" PRIu64 " unchanged bytes)",
+         f.block_dev.c_str(), n, f.data.size(), f.data.size() - n);
+
+    return dest.close();
+}
+
+/*!
+ * \brief Check that a block device starts with an image's data
+ *
+ * The block device's cached pages are dropped first so that the data is read
+ * back from the storage device rather than from memory.
+ *
+ * \param f Flashable containing the image data and target block device
+ *
+ * \return Whether the data matches
+ */
+static bool verify_flashed_image(const Flashable &f)
+{
+    int fd = open(f.block_dev.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for verification: %s",
+             f.block_dev.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fsync(fd) < 0) {
+        LOGW("%s: Failed to sync: %s", f.block_dev.c_str(), strerror(errno));
+    }
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    std::vector<unsigned char> buf(std::min<size_t>(f.data.size(),
+                                                    VERIFY_BUF_SIZE));
+    size_t offset = 0;
+
+    while (offset < f.data.size()) {
+        size_t to_read = std::min(buf.size(), f.data.size() - offset);
+
+        ssize_t n = pread64(fd, buf.data(), to_read,
+                            static_cast<off64_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            LOGE("%s: Failed to read for verification: %s",
+                 f.block_dev.c_str(), strerror(errno));
+            return false;
+        } else if (n == 0) {
+            LOGE("%s: Block device is smaller than the image",
+                 f.block_dev.c_str());
+            return false;
+        }
+
+        if (memcmp(buf.data(), f.data.data() + offset,
+                   static_cast<size_t>(n)) != 0) {
+            LOGE("%s: Data at offset %" MB_PRIzu " does not match the image",
+                 f.block_dev.c_str(), offset);
+            return false;
+        }
+
+        offset += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Flash and verify an image
+ *
+ * Only the blocks that changed are written to avoid unnecessary flash wear. If
+ * that fails, the whole image is written instead.
+ *
+ * \param f Flashable containing the image data and target block device
+ *
+ * \return Whether the image was successfully written and verified
+ */
+static bool flash_image(const Flashable &f)
+{
+    if (auto r = flash_changed_blocks(f); !r) {
+        LOGW("%s: Failed to write changed blocks: %s",
+             f.block_dev.c_str(), r.error().message().c_str());
+
+        if (auto r2 = util::file_write_data(
+                f.block_dev, f.data.data(), f.data.size()); !r2) {
+            LOGE("%s: Failed to write image: %s",
+                 f.block_dev.c_str(), r2.error().message().c_str());
+            return false;
+        }
+    }
+
+    return verify_flashed_image(f);
+}
+
 /*!
  * \brief Perform non-recursive search for a block device
  *
@@ -296,17 +427,23 @@ static bool add_extra_images(const std::string &multiboot_dir,
  * \param blockdev_base_dirs Search paths (non-recursive) for block devices
  *                           corresponding to extra flashable images in
  *                           /sdcard/MultiBoot/[ROM ID]/ *.img
+ * \param progress_cb Called after each image is read and after each image is
+ *                    flashed and verified. Cancellation is only possible
+ *                    before the first image is flashed. While flashing, calls
+ *                    come from other threads, but never at the same time.
  *
  * \return SwitchRomResult::Succeeded if the switching succeeded,
  *         SwitchRomResult::Failed if the switching failed,
  *         SwitchRomResult::ChecksumNotFound if the checksum for some image is missing,
- *         SwitchRomResult::ChecksumInvalid if the checksum for some image is invalid
+ *         SwitchRomResult::ChecksumInvalid if the checksum for some image is invalid,
+ *         SwitchRomResult::Cancelled if \a progress_cb cancelled the switching
  *
  */
 SwitchRomResult switch_rom(const std::string &id,
                            const std::string &boot_blockdev,
                            const std::vector<std::string> &blockdev_base_dirs,
-                           bool force_update_checksums)
+                           bool force_update_checksums,
+                           const OperationProgressFn &progress_cb)
 {
     LOGD("Attempting to switch to %s", id.c_str());
     LOGD("Force update checksums: %d", force_update_checksums);
@@ -320,10 +457,9 @@ SwitchRomResult switch_rom(const std::string &id,
     bootimg_path += "/boot.img";
 
     // Verify ROM ID
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    if (!roms.find_by_id(id)) {
+    if (!roms->find_by_id(id)) {
         LOGE("Invalid ROM ID: %s", id.c_str());
         return SwitchRomResult::Failed;
     }
@@ -351,22 +487,58 @@ SwitchRomResult switch_rom(const std::string &id,
     std::unordered_map<std::string, std::string> props;
     checksums_read(&props);
 
+    OperationProgress progress;
+
+    // The images are on different partitions, so read and hash them in
+    // parallel
+    {
+        std::vector<std::thread> threads;
+
+        for (Flashable &f : flashables) {
+            threads.emplace_back([&f] {
+                // If memory becomes an issue, an alternative method is to
+                // create a temporary directory in /data/multiboot/ that's only
+                // writable by root and copy the images there.
+                auto data = util::file_read_all(f.image);
+                if (!data) {
+                    f.error = format("Failed to read image: %s",
+                                     data.error().message().c_str());
+                    return;
+                }
+                f.data = std::move(data.value());
+
+                auto digest = util::sha512_hash(f.data.data(), f.data.size());
+                if (!digest) {
+                    f.error = format("Failed to compute checksum: %s",
+                                     digest.error().message().c_str());
+                    return;
+                }
+                f.hash = util::hex_string(digest.value().data(),
+                                          digest.value().size());
+            });
+        }
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
     for (Flashable &f : flashables) {
-        // If memory becomes an issue, an alternative method is to create a
-        // temporary directory in /data/multiboot/ that's only writable by root
-        // and copy the images there.
-        if (auto r = util::file_read_all(f.image)) {
-            f.data = std::move(r.value());
-        } else {
-            LOGE("%s: Failed to read image: %s",
-                 f.image.c_str(), r.error().message().c_str());
+        if (!f.error.empty()) {
+            LOGE("%s: %s", f.image.c_str(), f.error.c_str());
             return SwitchRomResult::Failed;
         }
 
-        // Get actual sha512sum
-        std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-        SHA512(f.data.data(), f.data.size(), digest.data());
-        f.hash = util::hex_string(digest.data(), digest.size());
+        if (progress_cb) {
+            ++progress.files;
+            progress.bytes += f.data.size();
+            progress.path = f.image;
+
+            if (!progress_cb(progress)) {
+                LOGD("Switching to %s was cancelled", id.c_str());
+                return SwitchRomResult::Cancelled;
+            }
+        }
 
         if (force_update_checksums) {
             checksums_update(&props, id, util::base_name(f.image), f.hash);
@@ -397,14 +569,43 @@ SwitchRomResult switch_rom(const std::string &id,
         }
     }
 
-    // Now we can flash the images
-    for (Flashable &f : flashables) {
-        if (auto r = util::file_write_data(
-                f.block_dev, f.data.data(), f.data.size()); !r) {
-            LOGE("%s: Failed to write image: %s",
-                 f.block_dev.c_str(), r.error().message().c_str());
-            return SwitchRomResult::Failed;
+    // Now we can flash the images. The targets are independent block devices,
+    // so they are written and verified in parallel. Stopping partway through
+    // would leave a mix of images from different ROMs, so cancellation is no
+    // longer possible from here on.
+    std::mutex progress_mutex;
+    std::vector<char> flashed(flashables.size());
+
+    {
+        std::vector<std::thread> threads;
+
+        for (size_t i = 0; i < flashables.size(); ++i) {
+            threads.emplace_back([&, i] {
+                const Flashable &f = flashables[i];
+
+                flashed[i] = flash_image(f);
+
+                if (flashed[i] && progress_cb) {
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+
+                    ++progress.files;
+                    progress.bytes += f.data.size();
+                    progress.path = f.block_dev;
+
+                    (void) progress_cb(progress);
+                }
+            });
         }
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    if (!std::all_of(flashed.begin(), flashed.end(),
+                     [](char ok) { return ok; })) {
+        LOGE("Failed to flash some images for %s", id.c_str());
+        return SwitchRomResult::Failed;
     }
 
     if (force_update_checksums) {
@@ -427,10 +628,15 @@ SwitchRomResult switch_rom(const std::string &id,
  *
  * \param id ROM ID to set the kernel for
  * \param boot_blockdev Block device path of the boot partition
+ * \param progress_cb Called after the boot partition is read and after the
+ *                    image is written. Cancellation is only possible before
+ *                    the image is written.
  *
- * \return True if the kernel was successfully set. Otherwise, false.
+ * \return True if the kernel was successfully set. Otherwise, false with
+ *         errno set to ECANCELED if \a progress_cb cancelled the operation.
  */
-bool set_kernel(const std::string &id, const std::string &boot_blockdev)
+bool set_kernel(const std::string &id, const std::string &boot_blockdev,
+                const OperationProgressFn &progress_cb)
 {
     LOGD("Attempting to set the kernel for %s", id.c_str());
 
@@ -443,10 +649,9 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
     bootimg_path += "/boot.img";
 
     // Verify ROM ID
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    if (!roms.find_by_id(id)) {
+    if (!roms->find_by_id(id)) {
         LOGE("Invalid ROM ID: %s", id.c_str());
         return false;
     }
@@ -464,10 +669,29 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
         return false;
     }
 
+    OperationProgress progress;
+
+    if (progress_cb) {
+        progress.files = 1;
+        progress.bytes = data.value().size();
+        progress.path = boot_blockdev;
+
+        if (!progress_cb(progress)) {
+            LOGD("Setting the kernel for %s was cancelled", id.c_str());
+            errno = ECANCELED;
+            return false;
+        }
+    }
+
     // Get actual sha512sum
-    std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-    SHA512(data.value().data(), data.value().size(), digest.data());
-    std::string hash = util::hex_string(digest.data(), digest.size());
+    auto digest = util::sha512_hash(data.value().data(), data.value().size());
+    if (!digest) {
+        LOGE("%s: Failed to compute checksum: %s",
+             boot_blockdev.c_str(), digest.error().message().c_str());
+        return false;
+    }
+    std::string hash = util::hex_string(
+            digest.value().data(), digest.value().size());
 
     // Add to checksums.prop
     std::unordered_map<std::string, std::string> props;
@@ -486,6 +710,14 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
         return false;
     }
 
+    if (progress_cb) {
+        ++progress.files;
+        progress.bytes += data.value().size();
+        progress.path = bootimg_path;
+
+        (void) progress_cb(progress);
+    }
+
     LOGD("Updating checksums file");
     checksums_write(props);
 
@@ -23,6 +23,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "operation_progress.h"
+
 namespace mb
 {
 
@@ -50,12 +52,15 @@ enum class SwitchRomResult
     Failed,
     ChecksumNotFound,
     ChecksumInvalid,
+    Cancelled,
 };
 
 SwitchRomResult switch_rom(const std::string &id,
                            const std::string &boot_blockdev,
                            const std::vector<std::string> &blockdev_base_dirs,
-                           bool force_update_checksums);
-bool set_kernel(const std::string &id, const std::string &boot_blockdev);
+                           bool force_update_checksums,
+                           const OperationProgressFn &progress_cb = nullptr);
+bool set_kernel(const std::string &id, const std::string &boot_blockdev,
+                const OperationProgressFn &progress_cb = nullptr);
 
 }
@@ -74,6 +74,7 @@ int uevent_dump_main(int argc, char *argv[])
 
     // Start probing for devices
     device_init(true);
+    device_wait_coldboot();
     // Kill uevent thread and close uevent socket
     device_close();
 
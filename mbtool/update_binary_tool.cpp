@@ -19,19 +19,34 @@
 
 #include "update_binary_tool.h"
 
+#include <memory>
+#include <optional>
+
 #include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <sys/file.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
+#include "mbutil/delete.h"
 #include "mbutil/file.h"
 #include "mbutil/mount.h"
+#include "mbutil/socket.h"
 
+#include "mkfs_ext4.h"
 #include "multiboot.h"
 #include "wipe.h"
 
@@ -47,6 +62,9 @@
 
 #define TAG "update-binary-tool: "
 
+// Number of threads deleting formatted files in the background
+constexpr unsigned int FORMAT_DELETE_THREADS = 4;
+
 
 namespace mb
 {
@@ -83,6 +101,17 @@ static bool get_paths(const char *mountpoint, const char **out_source_path,
     return true;
 }
 
+static const char * get_parent_path(const char *mountpoint)
+{
+    if (strcmp(mountpoint, SYSTEM) == 0) {
+        return CHROOT_SYSTEM_PARENT_MOUNT;
+    } else if (strcmp(mountpoint, CACHE) == 0) {
+        return CHROOT_CACHE_PARENT_MOUNT;
+    } else {
+        return CHROOT_DATA_PARENT_MOUNT;
+    }
+}
+
 static bool do_mount(const char *mountpoint)
 {
     const char *source_path;
@@ -134,13 +163,196 @@ static bool do_unmount(const char *mountpoint)
     return true;
 }
 
+/*!
+ * \brief Replace the filesystem on an image-backed mountpoint's loop device
+ *
+ * This takes the same amount of time no matter how many files the image
+ * contains. The filesystem must not be mounted. If \p remount is true, it is
+ * mounted again afterwards.
+ */
+static bool format_image(const char *mountpoint, const char *loop_path,
+                         uint64_t size, bool remount)
+{
+    if (!mkfs_ext4(loop_path, size)) {
+        LOGE(TAG "%s: Failed to create filesystem", loop_path);
+        return false;
+    }
+
+    if (remount && !do_mount(mountpoint)) {
+        LOGE(TAG "%s: Failed to mount path", mountpoint);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Delete a path in a detached child process
+ *
+ * The child holds a shared lock on CHROOT_FORMAT_LOCK_FILE until it is done so
+ * that the installer can wait for it before tearing down the chroot. If the
+ * child cannot be started, the path is deleted before returning.
+ */
+static void delete_in_background(const std::string &path)
+{
+    int lock_fd = open(CHROOT_FORMAT_LOCK_FILE,
+                       O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_SH) < 0) {
+        LOGW(TAG "%s: Failed to lock: %s",
+             CHROOT_FORMAT_LOCK_FILE, strerror(errno));
+    } else if (pid_t pid = fork(); pid == 0) {
+        // Outlive update-binary-tool and the updater's process group. The
+        // installer reads the updater's output until EOF, so nothing but the
+        // lock may stay open.
+        setsid();
+
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+
+        for (int fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); ++fd) {
+            if (fd != lock_fd) {
+                close(fd);
+            }
+        }
+
+        util::DeleteOptions options;
+        options.threads = FORMAT_DELETE_THREADS;
+
+        _exit(util::delete_recursive(path, options)
+                ? EXIT_SUCCESS : EXIT_FAILURE);
+    } else if (pid > 0) {
+        LOGD(TAG "Deleting %s in process %d", path.c_str(), pid);
+        close(lock_fd);
+        return;
+    } else {
+        LOGW(TAG "Failed to fork: %s", strerror(errno));
+    }
+
+    if (lock_fd >= 0) {
+        close(lock_fd);
+    }
+
+    if (auto r = util::delete_recursive(path); !r) {
+        LOGW(TAG "%s", r.error().message().c_str());
+    }
+}
+
+/*!
+ * \brief Find a bind mount's source directory through its parent's bind mount
+ *
+ * \return Path of the source inside \p parent_path or an empty string if
+ *         \p parent_path is not mounted or does not contain the source
+ */
+static std::string find_in_parent(const char *bind_path,
+                                  const char *parent_path)
+{
+    struct stat sb;
+    if (stat(bind_path, &sb) < 0) {
+        return {};
+    }
+
+    std::unique_ptr<DIR, decltype(closedir) *> dp(
+            opendir(parent_path), closedir);
+    if (!dp) {
+        return {};
+    }
+
+    while (auto *ent = readdir(dp.get())) {
+        struct stat ent_sb;
+        if (strcmp(ent->d_name, ".") != 0
+                && strcmp(ent->d_name, "..") != 0
+                && fstatat(dirfd(dp.get()), ent->d_name, &ent_sb,
+                           AT_SYMLINK_NOFOLLOW) == 0
+                && ent_sb.st_dev == sb.st_dev
+                && ent_sb.st_ino == sb.st_ino) {
+            std::string path(parent_path);
+            path += '/';
+            path += ent->d_name;
+            return path;
+        }
+    }
+
+    return {};
+}
+
+/*!
+ * \brief Empty a bind-mounted directory without waiting for the deletion
+ *
+ * Everything except the exclusions is renamed into a hidden directory next to
+ * the bind mount's source, which is then deleted in the background. The hidden
+ * directory is outside of \p mountpoint, so nothing that walks \p mountpoint
+ * afterwards sees the files being deleted. If the source's parent directory is
+ * not available in the chroot, the files are deleted before returning.
+ */
+static bool format_directory(const char *mountpoint, const char *bind_path,
+                             const char *parent_path,
+                             const std::vector<std::string> &exclusions)
+{
+    std::string path = find_in_parent(bind_path, parent_path);
+    if (path.empty()) {
+        return wipe_directory(mountpoint, exclusions);
+    }
+
+    util::DeleteOptions options;
+    options.exclusions = exclusions;
+    options.keep_root = true;
+    options.trash_dir = parent_path;
+
+    auto trash = util::delete_recursive_to_trash(path, options);
+    if (!trash) {
+        LOGE(TAG "%s", trash.error().message().c_str());
+        return false;
+    }
+
+    if (!trash.value().empty()) {
+        delete_in_background(trash.value());
+    }
+
+    return true;
+}
+
 static bool do_format(const char *mountpoint)
 {
-    if (!get_paths(mountpoint, nullptr, nullptr)) {
+    const char *source_path;
+    bool is_image;
+
+    if (!get_paths(mountpoint, &source_path, &is_image)) {
         LOGE(TAG "%s: Invalid mountpoint", mountpoint);
         return false;
     }
 
+    std::vector<std::string> exclusions;
+    if (strcmp(mountpoint, DATA) == 0) {
+        exclusions.push_back("media");
+    }
+
+    // Images without anything to keep can simply get a new filesystem
+    if (is_image && exclusions.empty()) {
+        if (auto size = util::get_blockdev_size(source_path); !size) {
+            LOGW(TAG "%s: Failed to get size: %s",
+                 source_path, size.error().message().c_str());
+        } else if (size.value() >= MKFS_EXT4_MIN_SIZE) {
+            bool was_mounted = static_cast<bool>(util::is_mounted(mountpoint));
+
+            if (was_mounted && !do_unmount(mountpoint)) {
+                LOGW(TAG "%s: Failed to unmount path; deleting files instead",
+                     mountpoint);
+            } else {
+                if (!format_image(mountpoint, source_path, size.value(),
+                                  was_mounted)) {
+                    return false;
+                }
+
+                LOGD(TAG "Successfully formatted %s", mountpoint);
+                return true;
+            }
+        }
+    }
+
     bool needs_mount = !util::is_mounted(mountpoint);
 
     if (needs_mount && !do_mount(mountpoint)) {
@@ -148,12 +360,17 @@ static bool do_format(const char *mountpoint)
         return false;
     }
 
-    std::vector<std::string> exclusions;
-    if (strcmp(mountpoint, DATA) == 0) {
-        exclusions.push_back("media");
+    bool ret;
+
+    if (is_image) {
+        ret = wipe_directory(mountpoint, exclusions);
+    } else {
+        exclusions.insert(exclusions.begin(), "multiboot");
+        ret = format_directory(mountpoint, source_path,
+                               get_parent_path(mountpoint), exclusions);
     }
 
-    if (!wipe_directory(mountpoint, exclusions)) {
+    if (!ret) {
         LOGE(TAG "%s: Failed to wipe directory", mountpoint);
         return false;
     }
@@ -168,6 +385,188 @@ static bool do_format(const char *mountpoint)
     return true;
 }
 
+static bool is_valid_request(const char *action, const char *mountpoint)
+{
+    bool is_valid_action = strcmp(action, ACTION_MOUNT) == 0
+            || strcmp(action, ACTION_UNMOUNT) == 0
+            || strcmp(action, ACTION_FORMAT) == 0;
+    bool is_valid_mountpoint = strcmp(mountpoint, SYSTEM) == 0
+            || strcmp(mountpoint, CACHE) == 0
+            || strcmp(mountpoint, DATA) == 0;
+
+    return is_valid_action && is_valid_mountpoint;
+}
+
+static bool run_action(const char *action, const char *mountpoint)
+{
+    if (strcmp(action, ACTION_MOUNT) == 0) {
+        return do_mount(mountpoint);
+    } else if (strcmp(action, ACTION_UNMOUNT) == 0) {
+        return do_unmount(mountpoint);
+    } else if (strcmp(action, ACTION_FORMAT) == 0) {
+        return do_format(mountpoint);
+    } else {
+        return false;
+    }
+}
+
+/*!
+ * \brief Handle one request from run_on_server()
+ *
+ * The request consists of the action and mountpoint strings followed by the
+ * client's stderr, which receives the log output so that it ends up in the
+ * same place as when the action runs in the client process. The exit status
+ * is sent back as an int32.
+ */
+static void serve_client(int fd)
+{
+    auto action = util::socket_read_string(fd);
+    if (!action) {
+        return;
+    }
+
+    auto mountpoint = util::socket_read_string(fd);
+    if (!mountpoint) {
+        return;
+    }
+
+    std::vector<int> fds;
+    if (!util::socket_receive_fds(fd, fds)) {
+        return;
+    }
+
+    auto close_fds = finally([&]{
+        for (int client_fd : fds) {
+            close(client_fd);
+        }
+    });
+
+    if (fds.size() != 1) {
+        LOGW(TAG "Expected 1 file descriptor, but received %zu", fds.size());
+        return;
+    }
+
+    FILE *fp = fdopen(fds[0], "w");
+    if (!fp) {
+        LOGW(TAG "Failed to open client stderr: %s", strerror(errno));
+        return;
+    }
+    fds.clear();
+
+    auto server_logger = log::logger();
+    log::set_logger(std::make_shared<log::StdioLogger>(fp));
+
+    bool ret = is_valid_request(action.value().c_str(),
+                                mountpoint.value().c_str())
+            && run_action(action.value().c_str(), mountpoint.value().c_str());
+
+    log::set_logger(std::move(server_logger));
+    fclose(fp);
+
+    (void) util::socket_write_int32(fd, ret ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*!
+ * \brief Run an action in the resident helper, if there is one
+ *
+ * \return Exit status of the action or std::nullopt if no helper is listening
+ */
+static std::optional<int> run_on_server(const char *action,
+                                        const char *mountpoint)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    auto close_fd = finally([&]{
+        close(fd);
+    });
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    static_assert(sizeof(CHROOT_UPDATE_BINARY_TOOL_SOCKET)
+            <= sizeof(addr.sun_path));
+    memcpy(addr.sun_path, CHROOT_UPDATE_BINARY_TOOL_SOCKET,
+           sizeof(CHROOT_UPDATE_BINARY_TOOL_SOCKET));
+
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        return std::nullopt;
+    }
+
+    // The helper may have already started running the action, so falling back
+    // to running it here is not safe after this point
+    if (!util::socket_write_string(fd, action)
+            || !util::socket_write_string(fd, mountpoint)
+            || !util::socket_send_fds(fd, { STDERR_FILENO })) {
+        fprintf(stderr, TAG "Failed to send request to helper\n");
+        return EXIT_FAILURE;
+    }
+
+    auto status = util::socket_read_int32(fd);
+    if (!status) {
+        fprintf(stderr, TAG "Failed to receive result from helper\n");
+        return EXIT_FAILURE;
+    }
+
+    return status.value();
+}
+
+/*!
+ * \brief Serve update-binary-tool requests until \p control_fd is closed
+ *
+ * This runs in a process forked from the updater after it has entered the
+ * chroot, so mounts made here are visible to the updater. Requests are handled
+ * one at a time, in the order they are accepted.
+ *
+ * \param listen_fd Listening socket bound to CHROOT_UPDATE_BINARY_TOOL_SOCKET
+ * \param control_fd Socket that becomes readable once the installer wants the
+ *                   helper to exit
+ *
+ * \return Whether the helper exited because it was asked to
+ */
+bool update_binary_tool_serve(int listen_fd, int control_fd)
+{
+    // Clients that go away must not kill the helper
+    signal(SIGPIPE, SIG_IGN);
+
+    pollfd fds[2] = {
+        { listen_fd, POLLIN, 0 },
+        { control_fd, POLLIN, 0 },
+    };
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE(TAG "Failed to poll: %s", strerror(errno));
+            return false;
+        }
+
+        if (fds[1].revents) {
+            return true;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                LOGE(TAG "Failed to accept connection: %s", strerror(errno));
+                return false;
+            }
+
+            serve_client(client_fd);
+            close(client_fd);
+        } else if (fds[0].revents) {
+            LOGE(TAG "Listening socket failed");
+            return false;
+        }
+    }
+}
+
 static void update_binary_tool_usage(FILE *stream)
 {
     fprintf(stream,
@@ -219,20 +618,10 @@ int update_binary_tool_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // Log to stderr, so the output is ordered correctly in /tmp/recovery.log
-    log::set_logger(std::make_shared<log::StdioLogger>(stderr));
-
     const char *action = argv[optind];
     const char *mountpoint = argv[optind + 1];
 
-    bool is_valid_action = strcmp(action, ACTION_MOUNT) == 0
-            || strcmp(action, ACTION_UNMOUNT) == 0
-            || strcmp(action, ACTION_FORMAT) == 0;
-    bool is_valid_mountpoint = strcmp(mountpoint, SYSTEM) == 0
-            || strcmp(mountpoint, CACHE) == 0
-            || strcmp(mountpoint, DATA) == 0;
-
-    if (!is_valid_action || !is_valid_mountpoint) {
+    if (!is_valid_request(action, mountpoint)) {
         update_binary_tool_usage(stderr);
         return EXIT_FAILURE;
     }
@@ -242,17 +631,16 @@ int update_binary_tool_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = false;
-
-    if (strcmp(action, ACTION_MOUNT) == 0) {
-        ret = do_mount(mountpoint);
-    } else if (strcmp(action, ACTION_UNMOUNT) == 0) {
-        ret = do_unmount(mountpoint);
-    } else if (strcmp(action, ACTION_FORMAT) == 0) {
-        ret = do_format(mountpoint);
+    // While the updater is running, the installer's resident helper does the
+    // work so that the setup below doesn't happen for every call
+    if (auto status = run_on_server(action, mountpoint)) {
+        return *status;
     }
 
-    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    // Log to stderr, so the output is ordered correctly in /tmp/recovery.log
+    log::set_logger(std::make_shared<log::StdioLogger>(stderr));
+
+    return run_action(action, mountpoint) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 }
@@ -24,4 +24,6 @@ namespace mb
 
 int update_binary_tool_main(int argc, char *argv[]);
 
+bool update_binary_tool_serve(int listen_fd, int control_fd);
+
 }
\ No newline at end of file
@@ -36,7 +36,9 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/database.h"
 #include "mbdevice/device.h"
+#include "mbdevice/index.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
@@ -62,6 +64,43 @@ namespace mb
 
 static const char *devices_file = nullptr;
 
+// Look up the device in a binary device database. This only materializes the
+// matching record instead of parsing every device.
+static bool get_device_from_database(const char *path,
+                                     const std::vector<unsigned char> &data,
+                                     const std::string &prop_product_device,
+                                     const std::string &prop_build_product,
+                                     Device &device)
+{
+    DeviceDatabase db;
+
+    if (!db.load(data.data(), data.size())) {
+        LOGE("%s: Invalid device database", path);
+        return false;
+    }
+
+    // Like the JSON path below, the first device that matches either property
+    // wins
+    auto index = db.find_by_codename(prop_product_device);
+    auto build_index = db.find_by_codename(prop_build_product);
+    if (build_index && (!index || *build_index < *index)) {
+        index = build_index;
+    }
+
+    if (!index) {
+        LOGE("Unknown device: %s", prop_product_device.c_str());
+        return false;
+    }
+
+    device = db.device(*index);
+    if (device.validate()) {
+        LOGE("%s: Device %s is invalid", path, device.id().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 static bool get_device(const char *path, Device &device)
 {
     std::string prop_product_device =
@@ -78,6 +117,13 @@ static bool get_device(const char *path, Device &device)
              contents.error().message().c_str());
         return false;
     }
+
+    if (is_device_database(contents.value().data(), contents.value().size())) {
+        return get_device_from_database(path, contents.value(),
+                                        prop_product_device,
+                                        prop_build_product, device);
+    }
+
     contents.value().push_back('\0');
 
     std::vector<Device> devices;
@@ -89,26 +135,25 @@ static bool get_device(const char *path, Device &device)
         return false;
     }
 
-    for (auto &d : devices) {
+    devices.erase(std::remove_if(devices.begin(), devices.end(),
+                                 [](const Device &d) {
         if (d.validate()) {
             LOGW("Skipping invalid device");
-            continue;
+            return true;
         }
+        return false;
+    }), devices.end());
 
-        auto const &codenames = d.codenames();
-        auto it = std::find_if(codenames.begin(), codenames.end(),
-                               [&](const std::string &item) {
-            return item == prop_product_device || item == prop_build_product;
-        });
+    DeviceIndex index(devices);
 
-        if (it != codenames.end()) {
-            device = std::move(d);
-            return true;
-        }
+    auto position = index.find_first(prop_product_device, prop_build_product);
+    if (!position) {
+        LOGE("Unknown device: %s", prop_product_device.c_str());
+        return false;
     }
 
-    LOGE("Unknown device: %s", prop_product_device.c_str());
-    return false;
+    device = std::move(devices[*position]);
+    return true;
 }
 
 static bool utilities_switch_rom(const char *rom_id, bool force)
@@ -152,6 +197,9 @@ static bool utilities_switch_rom(const char *rom_id, bool force)
     case SwitchRomResult::ChecksumNotFound:
         LOGD("CHECKSUM_NOT_FOUND");
         break;
+    case SwitchRomResult::Cancelled:
+        LOGD("CANCELLED");
+        break;
     }
 
     return ret == SwitchRomResult::Succeeded;
@@ -214,11 +262,10 @@ static void generate_aroma_config(std::vector<unsigned char> &data)
     std::string rom_menu_items;
     std::string rom_selection_items;
 
-    Roms roms;
-    roms.add_installed();
+    auto roms = Roms::installed();
 
-    for (std::size_t i = 0; i < roms.roms.size(); ++i) {
-        const std::shared_ptr<Rom> &rom = roms.roms[i];
+    for (std::size_t i = 0; i < roms->roms.size(); ++i) {
+        const std::shared_ptr<Rom> &rom = roms->roms[i];
 
         std::string config_path = rom->config_path();
         std::string name = rom->id;
@@ -239,7 +286,7 @@ static void generate_aroma_config(std::vector<unsigned char> &data)
     }
 
     std::string first_index = format("%d", 2 + 1);
-    std::string last_index = format("%zu", 2 + roms.roms.size());
+    std::string last_index = format("%zu", 2 + roms->roms.size());
 
     util::replace_all(str_data, "\t", "\\t");
     util::replace_all(str_data, "@MBTOOL_VERSION@", version());
@@ -489,7 +536,7 @@ static void utilities_usage(bool error)
             "\n"
             "Options:\n"
             "  -f, --force      Force (only for 'switch' action)\n"
-            "  -d, --devices    Path to device defintions file\n");
+            "  -d, --devices    Path to device defintions file (JSON or binary)\n");
 }
 
 int utilities_main(int argc, char *argv[])
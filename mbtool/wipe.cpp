@@ -20,6 +20,7 @@
 #include "wipe.h"
 
 #include <algorithm>
+#include <thread>
 
 #include <cerrno>
 #include <cstring>
@@ -30,10 +31,10 @@
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/delete.h"
-#include "mbutil/fts.h"
 #include "mbutil/mount.h"
 #include "mbutil/string.h"
 
+#include "image.h"
 #include "multiboot.h"
 
 #define LOG_TAG "mbtool/wipe"
@@ -41,98 +42,94 @@
 namespace mb
 {
 
-class WipeDirectory : public util::FtsWrapper {
-public:
-    WipeDirectory(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-    {
-    }
+// Maximum number of threads deleting files
+constexpr unsigned int WIPE_MAX_THREADS = 4;
 
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
+/*!
+ * \brief Recursively delete a path, reporting each removed path as progress
+ *
+ * Removal errors are logged and skipped, while cancellation stops the deletion.
+ *
+ * \param background Move the files out of the way and delete them on a
+ *                   background thread. Progress is not reported for them.
+ */
+static bool delete_with_progress(const std::string &path,
+                                 std::vector<std::string> exclusions,
+                                 bool keep_root, bool background,
+                                 const OperationProgressFn &progress_cb,
+                                 OperationProgress &progress)
+{
+    util::DeleteOptions options;
+    options.exclusions = std::move(exclusions);
+    options.keep_root = keep_root;
+    options.threads = std::clamp(std::thread::hardware_concurrency(),
+                                 1u, WIPE_MAX_THREADS);
+
+    if (progress_cb) {
+        options.callback = [&](const std::string &p, const struct stat &sb) {
+            ++progress.files;
+            if (S_ISREG(sb.st_mode)) {
+                progress.bytes += static_cast<uint64_t>(sb.st_size);
             }
-        }
-
-        return Action::Ok;
-    }
-
-    Actions on_reached_directory_pre() override
-    {
-        // Do nothing. Need depth-first search, so directories are deleted
-        // in FTS_DP
-        return Action::Ok;
-    }
-
-    Actions on_reached_directory_post() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
+            progress.path = p;
 
-    Actions on_reached_symlink() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+            return progress_cb(progress);
+        };
     }
 
-    Actions on_reached_special_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+    auto ret = background
+            ? util::delete_recursive_in_background(path, options)
+            : util::delete_recursive(path, options);
+    if (!ret) {
+        LOGW("%s", ret.error().message().c_str());
+        return false;
     }
 
-private:
-    std::vector<std::string> _exclusions;
-
-    bool delete_path()
-    {
-        if (_curr->fts_level >= 1 && remove(_curr->fts_accpath) < 0) {
-            _error_msg = format("%s: Failed to remove: %s",
-                                _curr->fts_path, strerror(errno));
-            LOGW("%s", _error_msg.c_str());
-            return false;
-        }
-        return true;
-    }
-};
+    return true;
+}
 
-bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions)
+static bool wipe_directory(const std::string &directory,
+                           const std::vector<std::string> &exclusions,
+                           bool background,
+                           const OperationProgressFn &progress_cb,
+                           OperationProgress &progress)
 {
-    struct stat sb;
-    if (stat(directory.c_str(), &sb) < 0 && errno == ENOENT) {
-        // Don't fail if directory does not exist
-        return true;
-    }
-
     std::vector<std::string> new_exclusions{ "multiboot" };
     new_exclusions.insert(new_exclusions.end(),
                           exclusions.begin(), exclusions.end());
 
-    WipeDirectory wd(directory, std::move(new_exclusions));
-    return wd.run();
+    return delete_with_progress(directory, std::move(new_exclusions), true,
+                                background, progress_cb, progress);
+}
+
+bool wipe_directory(const std::string &directory,
+                    const std::vector<std::string> &exclusions,
+                    const OperationProgressFn &progress_cb)
+{
+    OperationProgress progress;
+    return wipe_directory(directory, exclusions, false, progress_cb, progress);
 }
 
 /*!
- * \brief Log deletion of file
+ * \brief Log wiping of ext4 image
  *
- * \note The path will be deleted only if it is a regular file.
+ * \note The image will be wiped only if it is a regular file. If there is
+ *       nothing to keep, the image is deleted. Otherwise, it is reformatted at
+ *       the same size and the exclusions are copied back into it.
  *
- * \param path File to delete
+ * \param path Image to wipe, which must not be mounted
+ * \param exclusions List of first-level paths in the image to keep
+ * \param progress_cb Progress callback
+ * \param progress Progress of the current wipe operation
  *
- * \return True if file was deleted or doesn't exist. False, otherwise.
+ * \return True if image was wiped or doesn't exist. False, otherwise.
  */
-static bool log_wipe_file(const std::string &path)
+static bool log_wipe_image(const std::string &path,
+                           const std::vector<std::string> &exclusions,
+                           const OperationProgressFn &progress_cb,
+                           OperationProgress &progress)
 {
-    LOGV("Wiping file %s", path.c_str());
+    LOGV("Wiping image %s", path.c_str());
 
     struct stat sb;
     if (stat(path.c_str(), &sb) < 0) {
@@ -145,12 +142,31 @@ static bool log_wipe_file(const std::string &path)
     }
 
     if (!S_ISREG(sb.st_mode)) {
-        LOGE("%s: Cannot wipe file: not a regular file", path.c_str());
+        LOGE("%s: Cannot wipe image: not a regular file", path.c_str());
+        return false;
+    }
+
+    if (progress_cb && !progress_cb(progress)) {
         return false;
     }
 
-    bool ret = unlink(path.c_str()) == 0 || errno == ENOENT;
+    bool ret;
+    if (exclusions.empty()) {
+        ret = unlink(path.c_str()) == 0 || errno == ENOENT;
+    } else {
+        ret = reformat_ext4_image(path, exclusions);
+    }
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
+
+    // There's nothing left to cancel
+    if (ret && progress_cb) {
+        ++progress.files;
+        progress.bytes += static_cast<uint64_t>(sb.st_size);
+        progress.path = path;
+
+        (void) progress_cb(progress);
+    }
+
     return ret;
 }
 
@@ -162,11 +178,17 @@ static bool log_wipe_file(const std::string &path)
  *
  * \param mountpoint Mountpoint root to wipe
  * \param exclusions List of first-level paths to exclude
+ * \param background Whether to finish deleting the files in the background
+ * \param progress_cb Progress callback
+ * \param progress Progress of the current wipe operation
  *
  * \return True if the path was wiped or doesn't exist. False, otherwise
  */
 static bool log_wipe_directory(const std::string &mountpoint,
-                               const std::vector<std::string> &exclusions)
+                               const std::vector<std::string> &exclusions,
+                               bool background,
+                               const OperationProgressFn &progress_cb,
+                               OperationProgress &progress)
 {
     if (exclusions.empty()) {
         LOGV("Wiping directory %s", mountpoint.c_str());
@@ -190,25 +212,30 @@ static bool log_wipe_directory(const std::string &mountpoint,
         return false;
     }
 
-    bool ret = wipe_directory(mountpoint, exclusions);
+    bool ret = wipe_directory(mountpoint, exclusions, background, progress_cb,
+                              progress);
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
     return ret;
 }
 
-static bool log_delete_recursive(const std::string &path)
+static bool log_delete_recursive(const std::string &path, bool background,
+                                 const OperationProgressFn &progress_cb,
+                                 OperationProgress &progress)
 {
     LOGV("Recursively deleting %s", path.c_str());
-    if (auto r = util::delete_recursive(path)) {
-        LOGV("-> Succeeded");
-        return true;
-    } else {
-        LOGV("-> Failed: %s", r.error().message().c_str());
-        return false;
-    }
+
+    // Does not fail if the path does not exist
+    bool ret = delete_with_progress(path, {}, false, background, progress_cb,
+                                    progress);
+    LOGV("-> %s", ret ? "Succeeded" : "Failed");
+    return ret;
 }
 
-bool wipe_system(const std::shared_ptr<Rom> &rom)
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 const OperationProgressFn &progress_cb, bool background)
 {
+    OperationProgress progress;
+
     std::string path = rom->full_system_path();
     if (path.empty()) {
         LOGE("Failed to determine full system path");
@@ -220,19 +247,29 @@ bool wipe_system(const std::shared_ptr<Rom> &rom)
         // Ensure the image is no longer mounted
         std::string mount_point("/raw/images/");
         mount_point += rom->id;
-        (void) util::umount(mount_point);
+        if (util::is_mounted(mount_point)) {
+            if (auto r = util::umount(mount_point); !r) {
+                LOGE("Failed to unmount %s: %s",
+                     mount_point.c_str(), r.error().message().c_str());
+                return false;
+            }
+        }
 
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, {}, progress_cb, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, background, progress_cb,
+                                 progress);
         // Try removing ROM's /system if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                const OperationProgressFn &progress_cb, bool background)
 {
+    OperationProgress progress;
+
     std::string path = rom->full_cache_path();
     if (path.empty()) {
         LOGE("Failed to determine full cache path");
@@ -241,28 +278,39 @@ bool wipe_cache(const std::shared_ptr<Rom> &rom)
 
     bool ret;
     if (rom->cache_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, {}, progress_cb, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, background, progress_cb,
+                                 progress);
         // Try removing ROM's /cache if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_data(const std::shared_ptr<Rom> &rom)
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               const OperationProgressFn &progress_cb, bool background,
+               bool keep_media)
 {
+    OperationProgress progress;
+
     std::string path = rom->full_data_path();
     if (path.empty()) {
         LOGE("Failed to determine full data path");
         return false;
     }
 
+    std::vector<std::string> exclusions;
+    if (keep_media) {
+        exclusions.push_back("media");
+    }
+
     bool ret;
     if (rom->data_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, exclusions, progress_cb, progress);
     } else {
-        ret = log_wipe_directory(path, { "media" });
+        ret = log_wipe_directory(path, exclusions, background, progress_cb,
+                                 progress);
         // Try removing ROM's /data/media and /data if they're empty
         remove((path + "/media").c_str());
         remove(path.c_str());
@@ -270,8 +318,11 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
     return ret;
 }
 
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       const OperationProgressFn &progress_cb, bool background)
 {
+    OperationProgress progress;
+
     if (rom->data_is_image || rom->cache_is_image) {
         LOGE("Wiping dalvik-cache for ROMs that use data or cache images is "
              "currently not supported.");
@@ -294,20 +345,25 @@ bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
     data_path += "/dalvik-cache";
     cache_path += "/dalvik-cache";
 
-    // util::delete_recursive() returns true if the path does not
+    // log_delete_recursive() returns true if the path does not
     // exist (ie. returns false only on errors), which is exactly
     // what we want
-    return log_delete_recursive(data_path)
-            && log_delete_recursive(cache_path);
+    return log_delete_recursive(data_path, background, progress_cb, progress)
+            && log_delete_recursive(cache_path, background, progress_cb,
+                                    progress);
 }
 
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom)
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    const OperationProgressFn &progress_cb, bool background)
 {
+    OperationProgress progress;
+
     // Delete /data/media/0/MultiBoot/[ROM ID]
     std::string multiboot_path(MULTIBOOT_DIR);
     multiboot_path += '/';
     multiboot_path += rom->id;
-    return log_delete_recursive(multiboot_path);
+    return log_delete_recursive(multiboot_path, background, progress_cb,
+                                progress);
 }
 
 }
@@ -19,17 +19,30 @@
 
 #pragma once
 
+#include "operation_progress.h"
 #include "roms.h"
 
 namespace mb
 {
 
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions);
-bool wipe_system(const std::shared_ptr<Rom> &rom);
-bool wipe_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_data(const std::shared_ptr<Rom> &rom);
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom);
+                    const std::vector<std::string> &exclusions,
+                    const OperationProgressFn &progress_cb = nullptr);
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 const OperationProgressFn &progress_cb = nullptr,
+                 bool background = false);
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                const OperationProgressFn &progress_cb = nullptr,
+                bool background = false);
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               const OperationProgressFn &progress_cb = nullptr,
+               bool background = false,
+               bool keep_media = true);
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       const OperationProgressFn &progress_cb = nullptr,
+                       bool background = false);
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    const OperationProgressFn &progress_cb = nullptr,
+                    bool background = false);
 
 }
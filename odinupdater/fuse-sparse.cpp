@@ -19,12 +19,19 @@
 
 #define FUSE_USE_VERSION 26
 
+#include <algorithm>
+#include <condition_variable>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <new>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -59,6 +66,7 @@
 // libmbcommon
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 
 // libmbsparse
 #include "mbsparse/sparse.h"
@@ -71,12 +79,100 @@
 
 static char source_fd_path[50];
 static uint64_t sparse_size;
+static std::vector<unsigned char> sparse_index;
 
-struct context
+// Decoded data is cached in blocks of this size
+static constexpr size_t CACHE_BLOCK_SIZE = 64 * 1024;
+
+static size_t max_readers = 4;
+
+/*!
+ * \brief LRU cache of decoded sparse file blocks
+ *
+ * Shared by all open file handles since they all refer to the same image.
+ */
+class BlockCache
+{
+public:
+    using Block = std::shared_ptr<const std::vector<char>>;
+
+    void set_budget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_max_blocks = bytes / CACHE_BLOCK_SIZE;
+        evict_locked();
+    }
+
+    bool enabled()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_max_blocks > 0;
+    }
+
+    Block get(uint64_t index)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_map.find(index);
+        if (it == m_map.end()) {
+            return nullptr;
+        }
+
+        // Move to front
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return it->second->second;
+    }
+
+    void put(uint64_t index, Block block)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Another reader may have decoded the same block
+        if (m_max_blocks == 0 || m_map.find(index) != m_map.end()) {
+            return;
+        }
+
+        m_lru.emplace_front(index, std::move(block));
+        m_map.emplace(index, m_lru.begin());
+        evict_locked();
+    }
+
+private:
+    void evict_locked()
+    {
+        while (m_lru.size() > m_max_blocks) {
+            m_map.erase(m_lru.back().first);
+            m_lru.pop_back();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::list<std::pair<uint64_t, Block>> m_lru;
+    std::unordered_map<uint64_t, decltype(m_lru)::iterator> m_map;
+    size_t m_max_blocks = 0;
+};
+
+static BlockCache block_cache;
+
+struct reader
 {
     mb::StandardFile source_file;
     mb::sparse::SparseFile sparse_file;
+};
+
+/*!
+ * \brief Per file handle pool of readers
+ *
+ * FUSE may call fuse_read() from several threads for the same file handle.
+ * Each concurrent read gets its own SparseFile so that they don't have to
+ * wait on each other. All readers load the same chunk index.
+ */
+struct context
+{
     std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::unique_ptr<reader>> idle;
+    size_t count = 0;
 };
 
 static std::optional<int> extract_errno(std::error_code ec)
@@ -89,6 +185,86 @@ static std::optional<int> extract_errno(std::error_code ec)
     return {};
 }
 
+/*!
+ * \brief Open new reader for the sparse file
+ */
+static int open_reader(std::unique_ptr<reader> &out)
+{
+    auto r = std::unique_ptr<reader>(new(std::nothrow) reader());
+    if (!r) {
+        return -ENOMEM;
+    }
+
+    auto ret = r->source_file.open(source_fd_path,
+                                   mb::FileOpenMode::ReadOnly);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                source_fd_path, ret.error().message().c_str());
+        return -extract_errno(ret.error()).value_or(EIO);
+    }
+
+    ret = r->sparse_file.open(&r->source_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
+                source_fd_path, ret.error().message().c_str());
+        return -extract_errno(ret.error()).value_or(EIO);
+    }
+
+    // Reuse the chunk table built in get_sparse_file_size() instead of
+    // rereading every chunk header for each reader
+    if (!sparse_index.empty()) {
+        ret = r->sparse_file.load_chunk_index(sparse_index.data(),
+                                              sparse_index.size());
+        if (!ret) {
+            fprintf(stderr, "%s: Failed to load chunk index: %s\n",
+                    source_fd_path, ret.error().message().c_str());
+        }
+    }
+
+    out = std::move(r);
+
+    return 0;
+}
+
+/*!
+ * \brief Get idle reader or open a new one if the limit isn't reached yet
+ */
+static int acquire_reader(context *ctx, std::unique_ptr<reader> &out)
+{
+    {
+        std::unique_lock<std::mutex> lock(ctx->mutex);
+        ctx->cond.wait(lock, [ctx] {
+            return !ctx->idle.empty() || ctx->count < max_readers;
+        });
+
+        if (!ctx->idle.empty()) {
+            out = std::move(ctx->idle.back());
+            ctx->idle.pop_back();
+            return 0;
+        }
+
+        ++ctx->count;
+    }
+
+    int ret = open_reader(out);
+    if (ret < 0) {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        --ctx->count;
+        ctx->cond.notify_one();
+    }
+
+    return ret;
+}
+
+static void release_reader(context *ctx, std::unique_ptr<reader> r)
+{
+    {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        ctx->idle.push_back(std::move(r));
+    }
+    ctx->cond.notify_one();
+}
+
 /*!
  * \brief Open callback for fuse
  */
@@ -105,22 +281,16 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -ENOMEM;
     }
 
-    auto ret = ctx->source_file.open(source_fd_path,
-                                     mb::FileOpenMode::ReadOnly);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
+    // Open the first reader now so that errors are reported by open()
+    std::unique_ptr<reader> r;
+    int ret = open_reader(r);
+    if (ret < 0) {
         delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
+        return ret;
     }
 
-    ret = ctx->sparse_file.open(&ctx->source_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
-    }
+    ctx->idle.push_back(std::move(r));
+    ctx->count = 1;
 
     fi->fh = reinterpret_cast<uint64_t>(ctx);
 
@@ -141,20 +311,17 @@ static int fuse_release(const char *path, fuse_file_info *fi)
 
 /*!
  * \brief Read from sparse file
- *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+static int read_sparse(reader *r, char *buf, size_t size, uint64_t offset)
 {
     // Seek to position
-    auto new_offset = ctx->sparse_file.seek(offset, SEEK_SET);
+    auto new_offset = r->sparse_file.seek(static_cast<int64_t>(offset),
+                                          SEEK_SET);
     if (!new_offset) {
         return -extract_errno(new_offset.error()).value_or(EIO);
     }
 
-    auto n = ctx->sparse_file.read(buf, size);
+    auto n = mb::file_read_retry(r->sparse_file, buf, size);
     if (!n) {
         return -extract_errno(n.error()).value_or(EIO);
     }
@@ -162,6 +329,57 @@ static int fuse_read_locked(context *ctx, char *buf, size_t size,
     return static_cast<int>(n.value());
 }
 
+/*!
+ * \brief Read from sparse file through the block cache
+ */
+static int read_cached(context *ctx, std::unique_ptr<reader> &r, char *buf,
+                       size_t size, uint64_t offset)
+{
+    size_t total = 0;
+
+    while (size > 0) {
+        uint64_t index = offset / CACHE_BLOCK_SIZE;
+        auto block_offset = static_cast<size_t>(offset % CACHE_BLOCK_SIZE);
+
+        auto block = block_cache.get(index);
+        if (!block) {
+            if (!r) {
+                int ret = acquire_reader(ctx, r);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+
+            auto data = std::make_shared<std::vector<char>>(CACHE_BLOCK_SIZE);
+
+            int n = read_sparse(r.get(), data->data(), data->size(),
+                                index * CACHE_BLOCK_SIZE);
+            if (n < 0) {
+                return n;
+            }
+
+            data->resize(static_cast<size_t>(n));
+            block = data;
+            block_cache.put(index, block);
+        }
+
+        if (block_offset >= block->size()) {
+            // EOF
+            break;
+        }
+
+        size_t n = std::min(size, block->size() - block_offset);
+        memcpy(buf, block->data() + block_offset, n);
+
+        buf += n;
+        size -= n;
+        offset += n;
+        total += n;
+    }
+
+    return static_cast<int>(total);
+}
+
 /*!
  * \brief Read callback for fuse
  */
@@ -171,9 +389,28 @@ static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
     (void) path;
 
     context *ctx = reinterpret_cast<context *>(fi->fh);
+    std::unique_ptr<reader> r;
+    int ret;
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    if (block_cache.enabled()) {
+        ret = read_cached(ctx, r, buf, size, static_cast<uint64_t>(offset));
+    } else {
+        ret = acquire_reader(ctx, r);
+        if (ret == 0) {
+            ret = read_sparse(r.get(), buf, size,
+                              static_cast<uint64_t>(offset));
+        }
+    }
 
-    std::lock_guard<std::mutex> lock(ctx->mutex);
-    return fuse_read_locked(ctx, buf, size, offset);
+    if (r) {
+        release_reader(ctx, std::move(r));
+    }
+
+    return ret;
 }
 
 /*!
@@ -190,7 +427,8 @@ static int fuse_getattr(const char *path, struct stat *stbuf)
 }
 
 /*!
- * \brief Get size of sparse file (needed for fuse_getattr())
+ * \brief Get size and chunk index of sparse file (needed for fuse_getattr()
+ *        and fuse_open())
  */
 static int get_sparse_file_size()
 {
@@ -213,6 +451,14 @@ static int get_sparse_file_size()
 
     sparse_size = sparse_file.size();
 
+    // Not fatal. Each open file handle will just read the chunk headers itself.
+    if (auto index = sparse_file.chunk_index()) {
+        sparse_index = std::move(index.value());
+    } else {
+        fprintf(stderr, "%s: Failed to build chunk index: %s\n",
+                source_fd_path, index.error().message().c_str());
+    }
+
     return 0;
 }
 
@@ -220,6 +466,8 @@ struct arg_ctx
 {
     char *source_file = nullptr;
     char *target_file = nullptr;
+    unsigned int cache_size_mib = 16;
+    unsigned int readers = 4;
     bool show_help = false;
 };
 
@@ -232,6 +480,8 @@ static fuse_opt fuse_opts[] =
 {
     FUSE_OPT_KEY("-h",     KEY_HELP),
     FUSE_OPT_KEY("--help", KEY_HELP),
+    FUSE_OPT("--cache-size=%u", offsetof(arg_ctx, cache_size_mib), 0),
+    FUSE_OPT("--readers=%u", offsetof(arg_ctx, readers), 0),
     FUSE_OPT_END
 };
 
@@ -243,6 +493,10 @@ static void usage(FILE *stream, const char *progname)
             "general options:\n"
             "    -o opt,[opt...]        comma-separated list of mount options\n"
             "    -h   --help            show this help message\n"
+            "\n"
+            "fuse-sparse options:\n"
+            "    --cache-size=<MiB>     size of decoded block cache (default: 16)\n"
+            "    --readers=<count>      readers per open file (default: 4)\n"
             "\n",
             progname);
 }
@@ -306,6 +560,10 @@ int main(int argc, char *argv[])
             close(fd);
             return EXIT_FAILURE;
         }
+
+        block_cache.set_budget(static_cast<size_t>(arg_ctx.cache_size_mib)
+                * 1024 * 1024);
+        max_readers = std::max(arg_ctx.readers, 1u);
     }
 
     fuse_operations fuse_oper = {};
@@ -18,10 +18,17 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -31,6 +38,7 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 // libmbcommon
 #include "mbcommon/error_code.h"
@@ -38,8 +46,10 @@
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/thread_pool.h"
 
 // libmbsparse
+#include "mbsparse/crc32.h"
 #include "mbsparse/sparse.h"
 
 // libmbdevice
@@ -76,7 +86,10 @@
 #define PROP_SYSTEM_DEV         "system"
 #define PROP_BOOT_DEV           "boot"
 
+#define JOURNAL_FILE            "/cache/odinupdater.journal"
+
 typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
 using namespace mb::device;
 
@@ -95,9 +108,15 @@ static char sales_code[10];
 static std::string system_block_dev;
 static std::string boot_block_dev;
 
+// Keeps messages from the background extraction thread from interleaving with
+// the main thread's
+static std::mutex output_mutex;
+
 MB_PRINTF(1, 2)
 static void ui_print(const char *fmt, ...)
 {
+    std::lock_guard<std::mutex> lock(output_mutex);
+
     va_list ap;
     va_list copy;
 
@@ -105,13 +124,13 @@ static void ui_print(const char *fmt, ...)
 
     dprintf(output_fd, "ui_print ");
     va_copy(copy, ap);
-    vdprintf(output_fd, fmt, ap);
+    vdprintf(output_fd, fmt, copy);
     va_end(copy);
     dprintf(output_fd, "\nui_print\n");
 
     fputs("[UI] ", stdout);
     va_copy(copy, ap);
-    vprintf(fmt, ap);
+    vprintf(fmt, copy);
     va_end(copy);
     fputc('\n', stdout);
 
@@ -120,12 +139,16 @@ static void ui_print(const char *fmt, ...)
 
 static void set_progress(double frac)
 {
+    std::lock_guard<std::mutex> lock(output_mutex);
+
     dprintf(output_fd, "set_progress %f\n", frac);
 }
 
 MB_PRINTF(1, 2)
 static void error(const char *fmt, ...)
 {
+    std::lock_guard<std::mutex> lock(output_mutex);
+
     va_list ap;
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
@@ -136,6 +159,8 @@ static void error(const char *fmt, ...)
 MB_PRINTF(1, 2)
 static void info(const char *fmt, ...)
 {
+    std::lock_guard<std::mutex> lock(output_mutex);
+
     va_list ap;
     va_start(ap, fmt);
     vprintf(fmt, ap);
@@ -342,42 +367,440 @@ static bool load_block_devs()
     return true;
 }
 
-static mb::oc::result<size_t> cb_zip_read(mb::File &file, void *userdata,
-                                          void *buf, size_t size)
+/*!
+ * \brief Flashing progress of one partition
+ *
+ * For partially flashed sparse images, \a bytes is the offset up to which the
+ * block device is known to contain the image and \a crc32 is the checksum of
+ * the image data before that offset ("don't care" regions excluded).
+ */
+struct JournalEntry
 {
-    (void) file;
+    uint64_t bytes = 0;
+    uint32_t crc32 = 0;
+    bool complete = false;
+};
 
-    archive *a = static_cast<archive *>(userdata);
-    uint64_t total = 0;
+// Identifies the zip that the journal belongs to
+static std::string journal_source;
+static std::map<std::string, JournalEntry> journal;
 
-    while (size > 0) {
-        la_ssize_t n = archive_read_data(a, buf, size);
+static std::string get_journal_source()
+{
+    struct stat sb;
+    if (stat(zip_file, &sb) < 0) {
+        return {};
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%" PRIu64 " %" PRId64 " ",
+             static_cast<uint64_t>(sb.st_size),
+             static_cast<int64_t>(sb.st_mtime));
+
+    return buf + std::string(zip_file);
+}
+
+/*!
+ * \brief Load journal from a previous interrupted run with the same zip
+ */
+static void load_journal()
+{
+    journal.clear();
+    journal_source = get_journal_source();
+
+    ScopedFILE fp(fopen(JOURNAL_FILE, "re"), &fclose);
+    if (!fp) {
+        return;
+    }
+
+    char line[1024];
+    bool source_matches = false;
+
+    while (fgets(line, sizeof(line), fp.get())) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char name[32];
+        uint64_t bytes;
+        uint32_t crc32;
+        int complete;
+
+        if (strncmp(line, "source ", 7) == 0) {
+            source_matches = !journal_source.empty()
+                    && journal_source == line + 7;
+        } else if (sscanf(line, "entry %31s %" SCNu64 " %" SCNx32 " %d",
+                          name, &bytes, &crc32, &complete) == 4) {
+            journal[name] = JournalEntry{bytes, crc32, complete != 0};
+        }
+    }
+
+    if (!source_matches) {
+        journal.clear();
+    } else {
+        info("Resuming from journal: %s", JOURNAL_FILE);
+    }
+}
+
+/*!
+ * \brief Atomically write journal
+ *
+ * Failure is not fatal. It only means that an interrupted run will have to
+ * start over.
+ */
+static void save_journal()
+{
+    if (journal_source.empty()) {
+        return;
+    }
+
+    static const char *temp_path = JOURNAL_FILE ".tmp";
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error("%s: Failed to open for writing: %s", temp_path, strerror(errno));
+        return;
+    }
+
+    std::string data = "source " + journal_source + "\n";
+    for (auto const &[name, entry] : journal) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "entry %s %" PRIu64 " %08" PRIx32 " %d\n",
+                 name.c_str(), entry.bytes, entry.crc32, entry.complete);
+        data += buf;
+    }
+
+    bool ok = write(fd, data.data(), data.size())
+            == static_cast<ssize_t>(data.size()) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(temp_path, JOURNAL_FILE) < 0) {
+        error("%s: Failed to write journal: %s", JOURNAL_FILE, strerror(errno));
+        unlink(temp_path);
+    }
+}
+
+static void remove_journal()
+{
+    journal.clear();
+
+    if (unlink(JOURNAL_FILE) < 0 && errno != ENOENT) {
+        error("%s: Failed to remove: %s", JOURNAL_FILE, strerror(errno));
+    }
+}
+
+// Buffers passed between the flashing threads. A buffer either contains data
+// to write or, if hole is non-zero, the number of bytes to skip. An empty
+// buffer marks the end of the stream.
+struct IoBuffer
+{
+    std::unique_ptr<unsigned char, decltype(free) *> data{nullptr, &free};
+    size_t size;
+    uint64_t hole;
+};
+
+using IoBufferPtr = std::unique_ptr<IoBuffer>;
+
+// Blocking queue. Once closed, push() fails and pop() only returns the
+// remaining items.
+class IoBufferQueue
+{
+public:
+    bool push(IoBufferPtr buf)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closed) {
+                return false;
+            }
+            m_items.push_back(std::move(buf));
+        }
+        m_cond.notify_one();
+        return true;
+    }
+
+    IoBufferPtr pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty()) {
+            return nullptr;
+        }
+        auto buf = std::move(m_items.front());
+        m_items.pop_front();
+        return buf;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<IoBufferPtr> m_items;
+    bool m_closed = false;
+};
+
+// Fixed set of aligned buffers cycling between a producer and a consumer. The
+// number of buffers bounds the amount of memory used and how far the producer
+// can get ahead of the consumer.
+class IoPipe
+{
+public:
+    static constexpr size_t BUFFER_ALIGNMENT = 4096;
+
+    bool init(size_t count, size_t buf_size)
+    {
+        m_buf_size = buf_size;
+
+        for (size_t i = 0; i < count; ++i) {
+            void *ptr;
+            if (posix_memalign(&ptr, BUFFER_ALIGNMENT, buf_size) != 0) {
+                return false;
+            }
+
+            auto buf = std::make_unique<IoBuffer>();
+            buf->data.reset(static_cast<unsigned char *>(ptr));
+            m_free.push(std::move(buf));
+        }
+
+        return true;
+    }
+
+    size_t buffer_size() const
+    {
+        return m_buf_size;
+    }
+
+    // Producer side
+    IoBufferPtr get_free()
+    {
+        auto buf = m_free.pop();
+        if (buf) {
+            buf->size = 0;
+            buf->hole = 0;
+        }
+        return buf;
+    }
+
+    bool put_full(IoBufferPtr buf)
+    {
+        return m_full.push(std::move(buf));
+    }
+
+    // Consumer side
+    IoBufferPtr get_full()
+    {
+        return m_full.pop();
+    }
+
+    void recycle(IoBufferPtr buf)
+    {
+        (void) m_free.push(std::move(buf));
+    }
+
+    // Wake up both sides when either one fails
+    void close()
+    {
+        m_free.close();
+        m_full.close();
+    }
+
+private:
+    IoBufferQueue m_free;
+    IoBufferQueue m_full;
+    size_t m_buf_size = 0;
+};
+
+static constexpr size_t FLASH_BUFFER_COUNT = 4;
+static constexpr size_t FLASH_BUFFER_SIZE = 1024 * 1024;
+// Amount of data read from the sparse file between checks for holes
+static constexpr size_t FLASH_READ_STEP = 64 * 1024;
+
+/*!
+ * \brief Inflate zip entry into pipe (runs on its own thread)
+ */
+static void zip_inflate_thread(archive *a, IoPipe &pipe, std::error_code &ec)
+{
+    while (auto buf = pipe.get_free()) {
+        la_ssize_t n = archive_read_data(a, buf->data.get(),
+                                         pipe.buffer_size());
         if (n < 0) {
             error("libarchive: Failed to read data: %s",
                   archive_error_string(a));
-            return mb::ec_from_errno(archive_errno(a));
-        } else if (n == 0) {
-            break;
+            ec = mb::ec_from_errno(archive_errno(a));
+            pipe.close();
+            return;
         }
 
-        total += static_cast<size_t>(n);
-        size -= static_cast<size_t>(n);
+        buf->size = static_cast<size_t>(n);
+
+        if (!pipe.put_full(std::move(buf)) || n == 0) {
+            return;
+        }
+    }
+}
+
+struct ZipPipeReader
+{
+    IoPipe *pipe;
+    const std::error_code *ec;
+    IoBufferPtr buf;
+    size_t pos;
+    bool eof;
+};
+
+static mb::oc::result<size_t> cb_pipe_read(mb::File &file, void *userdata,
+                                           void *buf, size_t size)
+{
+    (void) file;
+
+    auto *ctx = static_cast<ZipPipeReader *>(userdata);
+    size_t total = 0;
+
+    while (size > 0 && !ctx->eof) {
+        if (!ctx->buf || ctx->pos == ctx->buf->size) {
+            if (ctx->buf) {
+                ctx->pipe->recycle(std::move(ctx->buf));
+            }
+
+            ctx->buf = ctx->pipe->get_full();
+            ctx->pos = 0;
+
+            if (!ctx->buf) {
+                // Inflate thread failed
+                return *ctx->ec ? *ctx->ec : std::make_error_code(
+                        std::errc::io_error);
+            } else if (ctx->buf->size == 0) {
+                ctx->eof = true;
+                break;
+            }
+        }
+
+        size_t n = std::min(size, ctx->buf->size - ctx->pos);
+        memcpy(buf, ctx->buf->data.get() + ctx->pos, n);
+
+        ctx->pos += n;
+        total += n;
+        size -= n;
         buf = static_cast<char *>(buf) + n;
     }
 
-    return static_cast<size_t>(total);
+    return total;
 }
 
-#if DEBUG_SKIP_FLASH_SYSTEM
-[[maybe_unused]]
-#endif
+static bool write_fully(int fd, const unsigned char *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINVAL) {
+            // O_DIRECT requires aligned sizes. Only the last write or writes
+            // before unaligned holes should hit this.
+            int flags = fcntl(fd, F_GETFL);
+            if (flags < 0 || !(flags & O_DIRECT)
+                    || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+                return false;
+            }
+            continue;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+
+        buf += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+// Minimum amount of data written between journal updates
+static constexpr uint64_t JOURNAL_INTERVAL = 64 * 1024 * 1024;
+
+struct BlockWriteState
+{
+    int fd;
+    const char *out_filename;
+    JournalEntry *entry;
+    // Offset in block device
+    uint64_t offset;
+    // Checksum of data written before offset
+    uint32_t crc32;
+    // Offset recorded in the journal
+    uint64_t checkpoint;
+    bool failed;
+};
+
+/*!
+ * \brief Write pipe contents to block device (runs on its own thread)
+ *
+ * The journal is updated after every \a JOURNAL_INTERVAL bytes once the data
+ * has been synced to the device.
+ */
+static void block_write_thread(BlockWriteState &state, IoPipe &pipe)
+{
+    while (auto buf = pipe.get_full()) {
+        if (buf->hole > 0) {
+            if (lseek64(state.fd, static_cast<off64_t>(buf->hole), SEEK_CUR)
+                    < 0) {
+                error("%s: Failed to seek file: %s",
+                      state.out_filename, strerror(errno));
+                state.failed = true;
+                break;
+            }
+            state.offset += buf->hole;
+        } else if (buf->size == 0) {
+            return;
+        } else if (!write_fully(state.fd, buf->data.get(), buf->size)) {
+            error("%s: Failed to write file: %s",
+                  state.out_filename, strerror(errno));
+            state.failed = true;
+            break;
+        } else {
+            state.offset += buf->size;
+            state.crc32 = mb::sparse::crc32_update(
+                    state.crc32, buf->data.get(), buf->size);
+
+            if (state.offset - state.checkpoint >= JOURNAL_INTERVAL
+                    && fdatasync(state.fd) == 0) {
+                state.entry->bytes = state.offset;
+                state.entry->crc32 = state.crc32;
+                save_journal();
+                state.checkpoint = state.offset;
+            }
+        }
+
+        pipe.recycle(std::move(buf));
+    }
+
+    pipe.close();
+}
+
+/*!
+ * \brief Flash sparse image from the zip to a block device
+ *
+ * Inflating the zip entry, expanding the sparse image, and writing to the
+ * block device each run on their own thread. They are connected by pipes with
+ * a fixed number of large aligned buffers so that the device can be written
+ * with O_DIRECT.
+ *
+ * If \p journal_entry records a partial flash, the image data before the
+ * recorded offset is only checksummed instead of being written again. If the
+ * checksum does not match, \p mismatch is set and an error is returned.
+ */
 static ExtractResult extract_sparse_file(const char *zip_filename,
-                                         const char *out_filename)
+                                         const char *out_filename,
+                                         JournalEntry &journal_entry,
+                                         bool &mismatch)
 {
     ScopedArchive a{archive_read_new(), &archive_read_free};
     mb::CallbackFile file;
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
 
     if (!a) {
         error("Out of memory");
@@ -394,14 +817,77 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return result;
     }
 
-    auto open_ret = file.open(nullptr, nullptr, &cb_zip_read, nullptr, nullptr,
-                              nullptr, a.get());
+    int fd = open(out_filename, O_WRONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        // Not all filesystems support O_DIRECT
+        fd = open(out_filename, O_WRONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        error("%s: Failed to open for writing: %s",
+              out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    auto close_fd = mb::finally([&fd] {
+        if (fd >= 0) {
+            close(fd);
+        }
+    });
+
+    uint64_t resume_offset = journal_entry.bytes;
+
+    if (resume_offset > 0) {
+        info("Resuming %s at offset %" PRIu64, out_filename, resume_offset);
+
+        if (lseek64(fd, static_cast<off64_t>(resume_offset), SEEK_SET) < 0) {
+            error("%s: Failed to seek file: %s", out_filename, strerror(errno));
+            return ExtractResult::Error;
+        }
+    }
+
+    IoPipe in_pipe;
+    IoPipe out_pipe;
+
+    if (!in_pipe.init(FLASH_BUFFER_COUNT, FLASH_BUFFER_SIZE)
+            || !out_pipe.init(FLASH_BUFFER_COUNT, FLASH_BUFFER_SIZE)) {
+        error("Out of memory");
+        return ExtractResult::Error;
+    }
+
+    std::error_code inflate_ec;
+    BlockWriteState write_state{fd, out_filename, &journal_entry,
+                                resume_offset, journal_entry.crc32,
+                                resume_offset, false};
+
+    std::thread inflate_thread(zip_inflate_thread, a.get(), std::ref(in_pipe),
+                               std::ref(inflate_ec));
+    std::thread write_thread(block_write_thread, std::ref(write_state),
+                             std::ref(out_pipe));
+
+    auto join_threads = mb::finally([&] {
+        in_pipe.close();
+        out_pipe.close();
+        if (inflate_thread.joinable()) {
+            inflate_thread.join();
+        }
+        if (write_thread.joinable()) {
+            write_thread.join();
+        }
+    });
+
+    ZipPipeReader reader{&in_pipe, &inflate_ec, nullptr, 0, false};
+
+    auto open_ret = file.open(nullptr, nullptr, &cb_pipe_read, nullptr,
+                              nullptr, nullptr, &reader);
     if (!open_ret) {
         error("Failed to open sparse file in zip: %s",
               open_ret.error().message().c_str());
         return ExtractResult::Error;
     }
 
+    // The image is read sequentially, so any CRC32 chunks can be checked
+    sparse_file.set_crc32_validation(true);
+
     open_ret = sparse_file.open(&file);
     if (!open_ret) {
         error("Failed to open sparse file: %s",
@@ -409,22 +895,73 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    open_ret = out_file.open(out_filename, mb::FileOpenMode::WriteOnly);
-    if (!open_ret) {
-        error("%s: Failed to open for writing: %s",
-              out_filename, open_ret.error().message().c_str());
-        return ExtractResult::Error;
-    }
-
-    char buf[10240];
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = sparse_file.size();
     uint64_t old_bytes = 0;
+    IoBufferPtr buf;
+    uint32_t prefix_crc32 = 0;
+    bool prefix_checked = false;
 
     set_progress(0);
 
     while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
+        // Make sure the data that was already flashed is from the same image
+        if (!prefix_checked && cur_bytes >= resume_offset) {
+            if (prefix_crc32 != journal_entry.crc32) {
+                error("%s: Journal does not match image", out_filename);
+                mismatch = true;
+                return ExtractResult::Error;
+            }
+            prefix_checked = true;
+        }
+
+        // Don't write anything for "don't care" regions. Like fastboot, leave
+        // whatever is already on the block device.
+        auto skipped = sparse_file.skip_hole();
+        if (!skipped) {
+            error("Failed to read sparse file %s: %s",
+                  zip_filename, skipped.error().message().c_str());
+            return ExtractResult::Error;
+        } else if (skipped.value() > 0) {
+            uint64_t hole_begin = std::max(cur_bytes, resume_offset);
+            uint64_t hole_end = cur_bytes + skipped.value();
+            cur_bytes = hole_end;
+
+            if (hole_end <= hole_begin) {
+                continue;
+            }
+
+            if (buf && buf->size > 0 && !out_pipe.put_full(std::move(buf))) {
+                break;
+            }
+
+            auto hole = out_pipe.get_free();
+            if (!hole) {
+                break;
+            }
+            hole->hole = hole_end - hole_begin;
+            if (!out_pipe.put_full(std::move(hole))) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (!buf) {
+            buf = out_pipe.get_free();
+            if (!buf) {
+                break;
+            }
+        }
+
+        size_t to_read = std::min(FLASH_READ_STEP,
+                                  out_pipe.buffer_size() - buf->size);
+        if (cur_bytes < resume_offset) {
+            to_read = static_cast<size_t>(std::min<uint64_t>(
+                    to_read, resume_offset - cur_bytes));
+        }
+
+        auto n = sparse_file.read(buf->data.get() + buf->size, to_read);
         if (!n) {
             error("Failed to read sparse file %s: %s",
                   zip_filename, n.error().message().c_str());
@@ -433,6 +970,22 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             break;
         }
 
+        if (cur_bytes < resume_offset) {
+            // Already on the device. Only checksum it.
+            prefix_crc32 = mb::sparse::crc32_update(
+                    prefix_crc32, buf->data.get() + buf->size, n.value());
+            cur_bytes += n.value();
+            continue;
+        }
+
+        buf->size += n.value();
+        cur_bytes += n.value();
+
+        if (buf->size == out_pipe.buffer_size()
+                && !out_pipe.put_full(std::move(buf))) {
+            break;
+        }
+
         // Rate limit: update progress only after difference exceeds 0.1%
         double old_ratio = static_cast<double>(old_bytes) / max_bytes;
         double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -440,35 +993,66 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             set_progress(new_ratio);
             old_bytes = cur_bytes;
         }
+    }
 
-        char *out_ptr = buf;
-
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
-                return ExtractResult::Error;
-            }
+    // Flush the remaining data and mark the end of the stream
+    if (buf && buf->size > 0) {
+        (void) out_pipe.put_full(std::move(buf));
+    }
+    if (auto end = out_pipe.get_free()) {
+        (void) out_pipe.put_full(std::move(end));
+    }
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
-        }
+    write_thread.join();
+    if (write_state.failed) {
+        return ExtractResult::Error;
+    } else if (!prefix_checked) {
+        error("%s: Journal offset is past the end of the image", out_filename);
+        mismatch = true;
+        return ExtractResult::Error;
     }
 
-    auto close_ret = out_file.close();
-    if (!close_ret) {
-        error("%s: Failed to close file: %s",
-              out_filename, close_ret.error().message().c_str());
+    int close_ret = close(fd);
+    fd = -1;
+    if (close_ret < 0) {
+        error("%s: Failed to close file: %s", out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
     return ExtractResult::Ok;
 }
 
+/*!
+ * \brief Flash sparse image, resuming from the journal if possible
+ */
+#if DEBUG_SKIP_FLASH_SYSTEM
+[[maybe_unused]]
+#endif
+static ExtractResult flash_sparse_file(const char *zip_filename,
+                                       const char *out_filename,
+                                       const char *journal_name)
+{
+    auto &entry = journal[journal_name];
+    bool mismatch = false;
+
+    auto result = extract_sparse_file(zip_filename, out_filename, entry,
+                                      mismatch);
+    if (result == ExtractResult::Error && mismatch) {
+        info("Flashing %s from the beginning", out_filename);
+
+        entry = {};
+        save_journal();
+
+        result = extract_sparse_file(zip_filename, out_filename, entry,
+                                     mismatch);
+    }
+
+    return result;
+}
+
 static ExtractResult extract_raw_file(const char *zip_filename,
-                                      const char *out_filename)
+                                      const char *out_filename,
+                                      bool show_progress = true)
 {
     ScopedArchive a{archive_read_new(), &archive_read_free};
     char buf[10240];
@@ -508,13 +1092,15 @@ static ExtractResult extract_raw_file(const char *zip_filename,
         close(fd);
     });
 
-    set_progress(0);
+    if (show_progress) {
+        set_progress(0);
+    }
 
     while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
         // Rate limit: update progress only after difference exceeds 0.1%
         old_ratio = static_cast<double>(old_bytes) / max_bytes;
         new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
+        if (show_progress && new_ratio - old_ratio >= 0.001) {
             set_progress(new_ratio);
             old_bytes = cur_bytes;
         }
@@ -542,6 +1128,79 @@ static ExtractResult extract_raw_file(const char *zip_filename,
     return ExtractResult::Ok;
 }
 
+/*!
+ * \brief Read a file from the zip into memory
+ *
+ * This does not report progress, so it can run alongside another step.
+ */
+static ExtractResult read_raw_file(const char *zip_filename,
+                                   std::vector<unsigned char> &data)
+{
+    ScopedArchive a{archive_read_new(), &archive_read_free};
+    if (!a) {
+        error("Out of memory");
+        return ExtractResult::Error;
+    }
+
+    if (!la_open_zip(a.get(), zip_file)) {
+        return ExtractResult::Error;
+    }
+
+    archive_entry *entry;
+    auto result = la_skip_to(a.get(), zip_filename, &entry);
+    if (result != ExtractResult::Ok) {
+        return result;
+    }
+
+    data.resize(static_cast<size_t>(archive_entry_size(entry)));
+
+    size_t offset = 0;
+
+    while (offset < data.size()) {
+        la_ssize_t n = archive_read_data(a.get(), data.data() + offset,
+                                         data.size() - offset);
+        if (n <= 0) {
+            error("libarchive: %s: Failed to read %s: %s",
+                  zip_file, zip_filename,
+                  n == 0 ? "Unexpected EOF" : archive_error_string(a.get()));
+            return ExtractResult::Error;
+        }
+
+        offset += static_cast<size_t>(n);
+    }
+
+    return ExtractResult::Ok;
+}
+
+/*!
+ * \brief Write an in-memory image to a block device
+ */
+static ExtractResult write_raw_file(const std::vector<unsigned char> &data,
+                                    const char *out_filename)
+{
+    int fd = open64(out_filename, O_WRONLY | O_CLOEXEC | O_LARGEFILE);
+    if (fd < 0) {
+        error("%s: Failed to open: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    auto close_fd = mb::finally([fd]{
+        close(fd);
+    });
+
+    if (!write_fully(fd, data.data(), data.size())) {
+        error("%s: Failed to write: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    if (fsync(fd) < 0) {
+        error("%s: Failed to sync: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    return ExtractResult::Ok;
+}
+
 static bool copy_dir_if_exists(const char *source_dir,
                                const char *target_dir)
 {
@@ -633,36 +1292,48 @@ static bool apply_multi_csc()
     return true;
 }
 
-static bool flash_csc_zip()
+/*!
+ * \brief Read next header, retrying if needed
+ */
+static int la_next_header(archive *a, archive_entry **entry)
 {
-    ScopedArchive matcher{archive_match_new(), &archive_match_free};
-    ScopedArchive in{archive_read_new(), &archive_read_free};
-    ScopedArchive out{archive_write_disk_new(), &archive_write_free};
-
-    if (!matcher) {
-        error("libarchive: Out of memory when creating matcher");
-        return false;
+    int ret;
+    while ((ret = archive_read_next_header(a, entry)) == ARCHIVE_RETRY) {
+        info("libarchive: %s: Retrying header read", TEMP_CSC_ZIP_FILE);
     }
+    return ret;
+}
+
+static bool open_csc_zip(ScopedArchive &in)
+{
+    in.reset(archive_read_new());
     if (!in) {
         error("libarchive: Out of memory when creating archive reader");
         return false;
     }
-    if (!out) {
-        error("libarchive: Out of memory when creating disk writer");
+
+    // The zip reader uses the central directory when the file is seekable, so
+    // skipping over entries doesn't require inflating them
+    archive_read_support_format_zip(in.get());
+
+    if (archive_read_open_filename(in.get(), TEMP_CSC_ZIP_FILE, 10240)
+            != ARCHIVE_OK) {
+        error("libarchive: %s: Failed to open file: %s",
+              TEMP_CSC_ZIP_FILE, archive_error_string(in.get()));
         return false;
     }
 
-    // Only process system/* paths from zip
-    if (archive_match_include_pattern(matcher.get(), "system/*") != ARCHIVE_OK) {
-        error("libarchive: Failed to add 'system/*' pattern: %s",
-              archive_error_string(matcher.get()));
+    return true;
+}
+
+static bool open_disk_writer(ScopedArchive &out)
+{
+    out.reset(archive_write_disk_new());
+    if (!out) {
+        error("libarchive: Out of memory when creating disk writer");
         return false;
     }
 
-    // Set up archive reader parameters
-    archive_read_support_format_zip(in.get());
-
-    // Set up disk writer parameters
     archive_write_disk_set_standard_lookup(out.get());
     archive_write_disk_set_options(out.get(),
                                    ARCHIVE_EXTRACT_TIME
@@ -676,29 +1347,104 @@ static bool flash_csc_zip()
                                  | ARCHIVE_EXTRACT_MAC_METADATA
                                  | ARCHIVE_EXTRACT_SPARSE);
 
-    if (archive_read_open_filename(in.get(), TEMP_CSC_ZIP_FILE, 10240)
-            != ARCHIVE_OK) {
-        error("libarchive: %s: Failed to open file: %s",
-              zip_file, archive_error_string(in.get()));
-        return false;
+    return true;
+}
+
+enum class CscEntry : uint8_t
+{
+    Skip,
+    File,
+    Directory,
+};
+
+/*!
+ * \brief Extract CSC zip entries (runs on each worker thread)
+ *
+ * Every worker walks the zip with its own reader. Entries are claimed with
+ * an atomic flag, so a worker that falls behind skips over entries that
+ * faster workers already extracted.
+ */
+static void csc_extract_worker(const std::vector<CscEntry> &entries,
+                               std::unique_ptr<std::atomic_bool[]> &claimed,
+                               std::atomic_bool &failed)
+{
+    ScopedArchive in{nullptr, &archive_read_free};
+    ScopedArchive out{nullptr, &archive_write_free};
+
+    if (!open_csc_zip(in) || !open_disk_writer(out)) {
+        failed = true;
+        return;
     }
 
     archive_entry *entry;
-    int ret;
 
-    while (true) {
-        ret = archive_read_next_header(in.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            info("libarchive: %s: Retrying header read", zip_file);
-            continue;
-        } else if (ret != ARCHIVE_OK) {
+    for (size_t i = 0; i < entries.size() && !failed; ++i) {
+        if (la_next_header(in.get(), &entry) != ARCHIVE_OK) {
             error("libarchive: %s: Failed to read header: %s",
-                  zip_file, archive_error_string(in.get()));
-            return false;
+                  TEMP_CSC_ZIP_FILE, archive_error_string(in.get()));
+            failed = true;
+            return;
+        }
+
+        if (entries[i] != CscEntry::File || claimed[i].exchange(true)) {
+            continue;
         }
 
+        const char *path = archive_entry_pathname(entry);
+
+        info("Extracting %s", path);
+
+        if (archive_read_extract2(in.get(), entry, out.get()) != ARCHIVE_OK) {
+            error("%s: %s", path, archive_error_string(in.get()));
+            failed = true;
+            return;
+        }
+    }
+
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        error("libarchive: Failed to close disk writer: %s",
+              archive_error_string(out.get()));
+        failed = true;
+    }
+}
+
+/*!
+ * \brief Extract the system directory from the CSC zip
+ *
+ * This is done in three passes:
+ * 1. Index the entries that should be extracted.
+ * 2. Extract all non-directory entries on several threads.
+ * 3. Extract the directories on a single thread. This sets their metadata
+ *    after the workers created their contents, so the directory timestamps
+ *    and permissions aren't changed by later writes.
+ */
+static bool flash_csc_zip()
+{
+    ScopedArchive matcher{archive_match_new(), &archive_match_free};
+    ScopedArchive in{nullptr, &archive_read_free};
+    ScopedArchive out{nullptr, &archive_write_free};
+
+    if (!matcher) {
+        error("libarchive: Out of memory when creating matcher");
+        return false;
+    }
+
+    // Only process system/* paths from zip
+    if (archive_match_include_pattern(matcher.get(), "system/*") != ARCHIVE_OK) {
+        error("libarchive: Failed to add 'system/*' pattern: %s",
+              archive_error_string(matcher.get()));
+        return false;
+    }
+
+    if (!open_csc_zip(in)) {
+        return false;
+    }
+
+    std::vector<CscEntry> entries;
+    archive_entry *entry;
+    int ret;
+
+    while ((ret = la_next_header(in.get(), &entry)) == ARCHIVE_OK) {
         const char *path = archive_entry_pathname(entry);
         if (!path || !*path) {
             error("libarchive: %s: Header has null or empty filename",
@@ -709,12 +1455,55 @@ static bool flash_csc_zip()
         // Check pattern matches
         if (archive_match_excluded(matcher.get(), entry)) {
             info("Skipping %s", path);
+            entries.push_back(CscEntry::Skip);
+        } else if (archive_entry_filetype(entry) == AE_IFDIR) {
+            entries.push_back(CscEntry::Directory);
+        } else {
+            entries.push_back(CscEntry::File);
+        }
+    }
+    if (ret != ARCHIVE_EOF) {
+        error("libarchive: %s: Failed to read header: %s",
+              zip_file, archive_error_string(in.get()));
+        return false;
+    }
+
+    // Extract files
+    {
+        auto claimed = std::make_unique<std::atomic_bool[]>(entries.size());
+        std::atomic_bool failed{false};
+
+        unsigned int n_workers = std::clamp(std::thread::hardware_concurrency(),
+                                            1u, 4u);
+        mb::run_on_threads(mb::ThreadPool::global(), n_workers, [&] {
+            csc_extract_worker(entries, claimed, failed);
+        });
+
+        if (failed) {
+            return false;
+        }
+    }
+
+    // Extract directories
+    if (!open_csc_zip(in) || !open_disk_writer(out)) {
+        return false;
+    }
+
+    for (auto type : entries) {
+        if (la_next_header(in.get(), &entry) != ARCHIVE_OK) {
+            error("libarchive: %s: Failed to read header: %s",
+                  zip_file, archive_error_string(in.get()));
+            return false;
+        }
+
+        if (type != CscEntry::Directory) {
             continue;
         }
 
+        const char *path = archive_entry_pathname(entry);
+
         info("Extracting %s", path);
 
-        // Extract file
         ret = archive_read_extract2(in.get(), entry, out.get());
         if (ret != ARCHIVE_OK) {
             error("%s: %s", path, archive_error_string(in.get()));
@@ -731,17 +1520,23 @@ static bool flash_csc_zip()
     return true;
 }
 
-static ExtractResult flash_csc()
+/*!
+ * \brief Extract the cache image and fuse-sparse to /tmp
+ *
+ * This does not touch the system partition or report progress, so it can run
+ * while the system image is being flashed.
+ */
+static ExtractResult prepare_csc()
 {
-    int status;
     ExtractResult result;
 
-    result = extract_raw_file(CACHE_SPARSE_FILE, TEMP_CACHE_SPARSE_FILE);
+    result = extract_raw_file(CACHE_SPARSE_FILE, TEMP_CACHE_SPARSE_FILE,
+                              false);
     if (result != ExtractResult::Ok) {
         return result;
     }
 
-    result = extract_raw_file(FUSE_SPARSE_FILE, TEMP_FUSE_SPARSE_FILE);
+    result = extract_raw_file(FUSE_SPARSE_FILE, TEMP_FUSE_SPARSE_FILE, false);
     if (result != ExtractResult::Ok) {
         return ExtractResult::Error;
     }
@@ -752,6 +1547,16 @@ static ExtractResult flash_csc()
         return ExtractResult::Error;
     }
 
+    return ExtractResult::Ok;
+}
+
+/*!
+ * \brief Flash the CSC files from the cache image extracted by prepare_csc()
+ */
+static ExtractResult flash_csc()
+{
+    int status;
+
     // Create temporary file for fuse
     close(open(TEMP_CACHE_MOUNT_FILE, O_CREAT | O_WRONLY | O_CLOEXEC, 0600));
 
@@ -854,41 +1659,92 @@ static bool flash_zip()
     ExtractResult result;
 #endif
 
+    // Skip anything that was completed by a previous interrupted run
+    load_journal();
+
+    auto mark_complete = [](const char *name) {
+        journal[name].complete = true;
+        save_journal();
+    };
+
+    // The files that the CSC and boot steps need are extracted from the zip by
+    // a background thread while the system image is being flashed. Only one
+    // thread is used because it competes with the system image writes for I/O.
+    // The boot image is only held in memory, so it is still written after the
+    // system partition, like before.
+    bool csc_complete = journal["csc"].complete;
+    ExtractResult csc_prepared = ExtractResult::Missing;
+    ExtractResult boot_read = ExtractResult::Missing;
+    std::vector<unsigned char> boot_data;
+
+    std::thread prefetch_thread([&] {
+#if !DEBUG_SKIP_FLASH_CSC
+        if (!csc_complete) {
+            csc_prepared = prepare_csc();
+        }
+#endif
+#if !DEBUG_SKIP_FLASH_BOOT
+        boot_read = read_raw_file(BOOT_IMAGE_FILE, boot_data);
+#endif
+    });
+
+    auto join_prefetch_thread = mb::finally([&]{
+        if (prefetch_thread.joinable()) {
+            prefetch_thread.join();
+        }
+    });
+
     // Flash system.img.ext4
 #if DEBUG_SKIP_FLASH_SYSTEM
     ui_print("[DEBUG] Skipping flashing of system image");
 #else
-    ui_print("Flashing system image");
-    result = extract_sparse_file(SYSTEM_SPARSE_FILE, system_block_dev.c_str());
-    switch (result) {
-    case ExtractResult::Error:
-        ui_print("Failed to flash system image");
-        return false;
-    case ExtractResult::Missing:
-        ui_print("[WARNING] System image not found");
-        break;
-    case ExtractResult::Ok:
-        ui_print("Successfully flashed system image");
-        break;
+    if (journal["system"].complete) {
+        ui_print("System image was already flashed");
+    } else {
+        ui_print("Flashing system image");
+        result = flash_sparse_file(SYSTEM_SPARSE_FILE,
+                                   system_block_dev.c_str(), "system");
+        switch (result) {
+        case ExtractResult::Error:
+            ui_print("Failed to flash system image");
+            return false;
+        case ExtractResult::Missing:
+            ui_print("[WARNING] System image not found");
+            break;
+        case ExtractResult::Ok:
+            ui_print("Successfully flashed system image");
+            mark_complete("system");
+            break;
+        }
     }
 #endif
 
+    prefetch_thread.join();
+
     // Flash CSC from cache.img.ext4
 #if DEBUG_SKIP_FLASH_CSC
     ui_print("[DEBUG] Skipping flashing of CSC");
 #else
-    ui_print("Flashing CSC from cache image");
-    result = flash_csc();
-    switch (result) {
-    case ExtractResult::Error:
-        ui_print("Failed to flash CSC");
-        return false;
-    case ExtractResult::Missing:
-        ui_print("[WARNING] Cache image not found. Won't flash CSC");
-        break;
-    case ExtractResult::Ok:
-        ui_print("Successfully flashed CSC");
-        break;
+    if (csc_complete) {
+        ui_print("CSC was already flashed");
+    } else {
+        ui_print("Flashing CSC from cache image");
+        result = csc_prepared;
+        if (result == ExtractResult::Ok) {
+            result = flash_csc();
+        }
+        switch (result) {
+        case ExtractResult::Error:
+            ui_print("Failed to flash CSC");
+            return false;
+        case ExtractResult::Missing:
+            ui_print("[WARNING] Cache image not found. Won't flash CSC");
+            break;
+        case ExtractResult::Ok:
+            ui_print("Successfully flashed CSC");
+            mark_complete("csc");
+            break;
+        }
     }
 #endif
 
@@ -897,7 +1753,10 @@ static bool flash_zip()
     ui_print("[DEBUG] Skipping flashing of boot image");
 #else
     ui_print("Flashing boot image");
-    result = extract_raw_file(BOOT_IMAGE_FILE, boot_block_dev.c_str());
+    result = boot_read;
+    if (result == ExtractResult::Ok) {
+        result = write_raw_file(boot_data, boot_block_dev.c_str());
+    }
     if (result != ExtractResult::Ok) {
         ui_print("Failed to flash boot image");
         return false;
@@ -905,6 +1764,9 @@ static bool flash_zip()
     ui_print("Successfully flashed boot image");
 #endif
 
+    // Start from scratch the next time
+    remove_journal();
+
     ui_print("---");
     ui_print("Flashing completed. The bootloader");
     ui_print("and non-system partitions were left");
@@ -3,24 +3,31 @@
 cd "$(dirname "${BASH_SOURCE[0]}")"
 
 files=(
+    v3/batch.fbs
     v3/crypto_decrypt.fbs
     v3/crypto_get_pw_type.fbs
+    v3/event_subscribe.fbs
     v3/file_chmod.fbs
     v3/file_close.fbs
     v3/file_open.fbs
+    v3/file_open_fd.fbs
     v3/file_read.fbs
     v3/file_seek.fbs
     v3/file_selinux_get_label.fbs
     v3/file_selinux_set_label.fbs
     v3/file_stat.fbs
+    v3/file_stream_read.fbs
+    v3/file_stream_write.fbs
     v3/file_write.fbs
     v3/mb_get_booted_rom_id.fbs
     v3/mb_get_installed_roms.fbs
     v3/mb_get_packages_count.fbs
+    v3/mb_get_stats.fbs
     v3/mb_get_version.fbs
     v3/mb_set_kernel.fbs
     v3/mb_switch_rom.fbs
     v3/mb_wipe_rom.fbs
+    v3/operation.fbs
     v3/path_chmod.fbs
     v3/path_copy.fbs
     v3/path_delete.fbs
@@ -18,6 +18,7 @@
  */
 
 #include <memory>
+#include <vector>
 
 #include <cstdio>
 #include <cstdlib>
@@ -28,8 +29,6 @@
 // libmbsign
 #include "mbsign/sign.h"
 
-using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
-
 static void openssl_log_errors()
 {
     ERR_print_errors_fp(stderr);
@@ -38,7 +37,10 @@ static void openssl_log_errors()
 static void usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n\n"
+            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n"
+            "                [<input file> <output signature file>]...\n\n"
+            "Multiple files are hashed in parallel and signed with a single\n"
+            "load of the private key.\n\n"
             "NOTE: This is not a general purpose tool for signing files!\n"
             "It is only meant for use with mbtool.\n");
 }
@@ -48,14 +50,17 @@ int main(int argc, char *argv[])
     ERR_load_crypto_strings();
     OpenSSL_add_all_algorithms();
 
-    if (argc != 4) {
+    if (argc < 4 || (argc - 2) % 2 != 0) {
         usage(stderr);
         return EXIT_FAILURE;
     }
 
     const char *file_pkcs12 = argv[1];
-    const char *file_input = argv[2];
-    const char *file_output = argv[3];
+
+    std::vector<mb::sign::SignFile> files;
+    for (int i = 2; i < argc; i += 2) {
+        files.push_back({argv[i], argv[i + 1]});
+    }
 
     const char *pass = getenv("MBSIGN_PASSPHRASE");
     if (!pass) {
@@ -70,40 +75,20 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
-    if (!bio_data_in) {
-        fprintf(stderr, "%s: Failed to open input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-    ScopedBIO bio_sig_out(BIO_new_file(file_output, "wb"), BIO_free);
-    if (!bio_sig_out) {
-        fprintf(stderr, "%s: Failed to open output file\n", file_output);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-
-    if (auto ret = mb::sign::sign_data(
-            *bio_data_in, *bio_sig_out, *private_key.value()); !ret) {
-        fprintf(stderr, "Failed to sign data: %s\n",
-                ret.error().ec.message().c_str());
-        if (ret.error().has_openssl_error) {
-            openssl_log_errors();
+    auto results = mb::sign::sign_files(files, *private_key.value());
+    bool ret = true;
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!results[i]) {
+            fprintf(stderr, "%s: Failed to sign data: %s\n",
+                    files[i].path.c_str(),
+                    results[i].error().ec.message().c_str());
+            if (results[i].error().has_openssl_error) {
+                openssl_log_errors();
+            }
+            ret = false;
         }
-        return EXIT_FAILURE;
-    }
-
-    if (!BIO_free(bio_data_in.release())) {
-        fprintf(stderr, "%s: Failed to close input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-
-    if (!BIO_free(bio_sig_out.release())) {
-        fprintf(stderr, "%s: Failed to close output file\n", file_output);
-        openssl_log_errors();
-        return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }